@@ -0,0 +1,113 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <esp_matter.h>
+#include <esp_matter_console.h>
+#if CONFIG_DIAG_ENABLE_METRICS
+#include <esp_diagnostics_metrics.h>
+#endif
+
+#include <app_priv.h>
+
+static const char *TAG = "app_boot_profile";
+
+#define BOOT_METRICS_TAG "boot"
+#define BOOT_METRICS_KEY_READY "boot_ready"
+#define BOOT_METRICS_KEY_NETWORK "boot_net"
+
+/* Indexed by app_boot_phase_t */
+static const char *s_phase_names[APP_BOOT_PHASE_MAX] = {
+    "nvs_flash_init",
+    "app_persist_init",
+    "app_driver_light_init",
+    "node::create",
+    "endpoints",
+    "app_driver_button_init",
+    "esp_matter::start",
+    "app_driver_light_set_defaults",
+    "ip_address",
+    "commissioning_complete",
+};
+
+/* Time since boot at the end of each phase, 0 if the phase was not reached yet */
+static int64_t s_phase_us[APP_BOOT_PHASE_MAX];
+
+#if CONFIG_DIAG_ENABLE_METRICS
+static void app_boot_profile_report(const char *key, const char *label, int64_t time_us)
+{
+    /* Metrics can only be registered once esp_insights (or esp_diag_metrics_init()) is up, so do it lazily */
+    esp_err_t err = esp_diag_metrics_register(BOOT_METRICS_TAG, key, label, "boot", ESP_DIAG_DATA_TYPE_UINT);
+    if (err != ESP_OK && err != ESP_FAIL) {
+        ESP_LOGD(TAG, "Boot time metric not registered, err:%d", err);
+        return;
+    }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_add_unit(key, "ms");
+    esp_diag_metrics_add_uint(key, (uint32_t)(time_us / 1000));
+#else
+    esp_diag_metrics_add_unit(BOOT_METRICS_TAG, key, "ms");
+    esp_diag_metrics_report_uint(BOOT_METRICS_TAG, key, (uint32_t)(time_us / 1000));
+#endif
+}
+#endif
+
+void app_boot_profile_mark(app_boot_phase_t phase)
+{
+    if (phase >= APP_BOOT_PHASE_MAX || s_phase_us[phase] != 0) {
+        /* Only the first occurrence counts, events like IP changes come again later */
+        return;
+    }
+    s_phase_us[phase] = esp_timer_get_time();
+    ESP_LOGD(TAG, "%s done at %" PRId64 " ms", s_phase_names[phase], s_phase_us[phase] / 1000);
+
+#if CONFIG_DIAG_ENABLE_METRICS
+    if (phase == APP_BOOT_PHASE_LIGHT_DEFAULTS) {
+        app_boot_profile_report(BOOT_METRICS_KEY_READY, "Boot to Matter ready", s_phase_us[phase]);
+    } else if (phase == APP_BOOT_PHASE_IP_ADDRESS) {
+        app_boot_profile_report(BOOT_METRICS_KEY_NETWORK, "Boot to IP address", s_phase_us[phase]);
+    }
+#endif
+}
+
+void app_boot_profile_dump()
+{
+    int64_t last_us = 0;
+    printf("%-32s %10s %10s\n", "phase", "at (ms)", "took (ms)");
+    for (int i = 0; i < APP_BOOT_PHASE_MAX; i++) {
+        if (s_phase_us[i] == 0) {
+            printf("%-32s %10s %10s\n", s_phase_names[i], "-", "-");
+            continue;
+        }
+        printf("%-32s %10" PRId64 " %10" PRId64 "\n", s_phase_names[i], s_phase_us[i] / 1000,
+               (s_phase_us[i] - last_us) / 1000);
+        last_us = s_phase_us[i];
+    }
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t app_boot_profile_console_handler(int argc, char **argv)
+{
+    app_boot_profile_dump();
+    return ESP_OK;
+}
+
+esp_err_t app_boot_profile_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "boot",
+        .description = "Print the time spent in each boot phase. Usage: matter esp boot",
+        .handler = app_boot_profile_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
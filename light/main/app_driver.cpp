@@ -6,96 +6,931 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <esp_bit_defs.h>
 #include <esp_log.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <esp_diagnostics_spans.h>
 #include <esp_matter.h>
+#include <esp_matter_console.h>
+#include <platform/CHIPDeviceLayer.h>
 #include "bsp/esp-bsp.h"
 
 #include <app_priv.h>
 
 using namespace chip::app::Clusters;
+using namespace chip::DeviceLayer;
 using namespace esp_matter;
 
 static const char *TAG = "app_driver";
-extern uint16_t light_endpoint_id;
 
-/* Do any conversions/remapping for the actual value here */
-static esp_err_t app_driver_light_set_power(led_indicator_handle_t handle, esp_matter_attr_val_t *val)
+/* Pending state flags, a set flag means the value has not been pushed to the hardware yet */
+#define LIGHT_PENDING_POWER       BIT(0)
+#define LIGHT_PENDING_BRIGHTNESS  BIT(1)
+#define LIGHT_PENDING_HS          BIT(2)
+#define LIGHT_PENDING_TEMPERATURE BIT(3)
+
+/* Button callbacks run in this task instead of the esp_timer task, see app_driver_button_init() */
+#define APP_DRIVER_BUTTON_QUEUE_LEN     8
+#define APP_DRIVER_BUTTON_TASK_STACK    4096
+#define APP_DRIVER_BUTTON_TASK_PRIORITY 5
+
+/* Channels interpolated by the transition engine, in Q16.16 fixed point. BIT(channel) matches the
+ * APP_DRIVER_TRANSITION_* flags. */
+typedef enum {
+    LIGHT_CHANNEL_BRIGHTNESS = 0,
+    LIGHT_CHANNEL_HUE,
+    LIGHT_CHANNEL_SATURATION,
+    LIGHT_CHANNEL_MAX,
+} light_channel_t;
+
+typedef struct {
+    int32_t value_q16;          /* Current interpolated value */
+    int32_t step_q16;           /* Increment per step, precomputed when the transition starts */
+    uint16_t target;
+} light_transition_channel_t;
+
+/* Scene cached by the driver. The output frame is computed when the scene is stored, so that a recall is a single
+ * RGB write without any colour conversion. */
+typedef struct {
+    bool valid;
+    bool power;
+    bool color_temperature;     /* Colour comes from the temperature rather than hue/saturation */
+    uint8_t scene_id;
+    uint16_t group_id;
+    uint8_t brightness;
+    uint16_t hue;
+    uint8_t saturation;
+    uint32_t temperature;       /* Mireds */
+    uint32_t frame;             /* RGB output at the scene brightness, before gamma correction */
+} light_scene_t;
+
+/* Light driver handle, this is what gets stored as the endpoint's priv_data */
+typedef struct {
+    led_indicator_handle_t led;
+    esp_timer_handle_t commit_timer;
+    esp_timer_handle_t transition_timer;
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t pm_lock;   /* Keeps the chip out of light sleep while a transition runs */
+    bool pm_held;
+#endif
+    portMUX_TYPE lock;          /* Protects the pending and transition state below */
+    uint32_t pending;           /* LIGHT_PENDING_* flags */
+    bool commit_scheduled;
+    bool power;
+    uint8_t brightness;
+    uint16_t hue;
+    uint8_t saturation;
+    uint32_t temperature;       /* Mireds, as in the ColorControl cluster */
+    bool color_temperature;     /* The colour comes from the temperature rather than hue/saturation */
+    bool output_power;          /* Power state last written to the hardware */
+    bool scene_active;          /* The output comes from a recalled scene, writes of the same values are echoes */
+    uint32_t transition_flags;  /* APP_DRIVER_TRANSITION_* flags of the running transition */
+    uint32_t transition_steps;  /* Steps left in the running transition */
+    light_transition_channel_t transition[LIGHT_CHANNEL_MAX];
+    app_driver_light_transition_t transition_target;    /* In Matter units, as written to the data model at the end */
+    uint16_t endpoint_id;       /* Set by app_driver_light_register() */
+    uint32_t report_flags;      /* Channels the data model is to be updated for, cleared when a write takes over */
+    bool report_scheduled;
+    bool report_final;          /* The transition ended, the targets are written rather than the current values */
+    int64_t reported_us;        /* Time of the last intermediate update scheduled */
+    uint32_t button_updates;    /* Button toggles switched locally and not applied to the data model yet */
+    int64_t on_off_since_us;    /* Time of the oldest attribute update not pushed yet, per cluster, 0 if none */
+    int64_t level_since_us;
+    int64_t color_since_us;
+    light_scene_t scenes[APP_DRIVER_MAX_SCENES];
+} app_driver_light_t;
+
+/* Push everything that changed since the last push to the hardware in one go */
+static void app_driver_light_push(app_driver_light_t *light)
 {
+    portENTER_CRITICAL(&light->lock);
+    uint32_t pending = light->pending;
+    bool power = light->power;
+    uint8_t brightness = light->brightness;
+    uint16_t hue = light->hue;
+    uint8_t saturation = light->saturation;
+    uint32_t temperature = light->temperature;
+    int64_t on_off_since_us = light->on_off_since_us;
+    int64_t level_since_us = light->level_since_us;
+    int64_t color_since_us = light->color_since_us;
+    light->pending = 0;
+    light->on_off_since_us = 0;
+    light->level_since_us = 0;
+    light->color_since_us = 0;
+    portEXIT_CRITICAL(&light->lock);
+
+    if (!pending) {
+        return;
+    }
+
+    ESP_DIAG_SPAN_BEGIN(light_push);
 #if CONFIG_BSP_LEDS_NUM > 0
     esp_err_t err = ESP_OK;
-    if (val->val.b) {
-        err = led_indicator_start(handle, BSP_LED_ON);
-    } else {
-        err = led_indicator_start(handle, BSP_LED_OFF);
+    if (pending & LIGHT_PENDING_HS) {
+        /* Hue, saturation and brightness are all known here, so no read-modify-write is needed */
+        err = led_indicator_set_hsv(light->led, SET_HSV(hue, saturation, brightness));
+        if (err == ESP_OK) {
+            pending &= ~LIGHT_PENDING_BRIGHTNESS;
+        }
+    } else if (pending & LIGHT_PENDING_TEMPERATURE) {
+        err = led_indicator_set_color_temperature_mireds(light->led, temperature);
+    }
+    if (pending & LIGHT_PENDING_BRIGHTNESS) {
+        err |= led_indicator_set_brightness(light->led, brightness);
+    }
+    if (pending & LIGHT_PENDING_POWER) {
+        err |= led_indicator_start(light->led, power ? BSP_LED_ON : BSP_LED_OFF);
+        light->output_power = power;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to commit light state, pending: 0x%" PRIx32, pending);
     }
-    return err;
 #else
-    ESP_LOGI(TAG, "LED set power: %d", val->val.b);
-    return ESP_OK;
+    if (pending & LIGHT_PENDING_HS) {
+        ESP_LOGI(TAG, "LED set hue: %d, saturation: %d", hue, saturation);
+    } else if (pending & LIGHT_PENDING_TEMPERATURE) {
+        ESP_LOGI(TAG, "LED set temperature: %" PRIu32 " mireds", temperature);
+    }
+    if (pending & LIGHT_PENDING_BRIGHTNESS) {
+        ESP_LOGI(TAG, "LED set brightness: %d", brightness);
+    }
+    if (pending & LIGHT_PENDING_POWER) {
+        ESP_LOGI(TAG, "LED set power: %d", power);
+    }
 #endif
+    ESP_DIAG_SPAN_END(light_push);
+
+    /* Attribute update to output latency, transition steps and restores have no start time and are skipped */
+    app_latency_record(OnOff::Id, on_off_since_us);
+    app_latency_record(LevelControl::Id, level_since_us);
+    app_latency_record(ColorControl::Id, color_since_us);
 }
 
-static esp_err_t app_driver_light_set_brightness(led_indicator_handle_t handle, esp_matter_attr_val_t *val)
+static void app_driver_light_commit(void *arg)
 {
-    int value = REMAP_TO_RANGE(val->val.u8, MATTER_BRIGHTNESS, STANDARD_BRIGHTNESS);
-#if CONFIG_BSP_LEDS_NUM > 0
-    return led_indicator_set_brightness(handle, value);
-#else
-    ESP_LOGI(TAG, "LED set brightness: %d", value);
-    return ESP_OK;
+    app_driver_light_t *light = (app_driver_light_t *)arg;
+
+    portENTER_CRITICAL(&light->lock);
+    light->commit_scheduled = false;
+    portEXIT_CRITICAL(&light->lock);
+    app_driver_light_push(light);
+}
+
+/* Endpoint whose data model the transition reports are writing, its driver writes are echoes. Only used in the
+ * Matter task. */
+static uint16_t s_report_endpoint_id = UINT16_MAX;
+
+/* Runs in the Matter task. The values are taken when the work runs, so a report that was waiting carries the latest
+ * ones, and the targets once the transition ended. */
+static void app_driver_light_report_work(intptr_t arg)
+{
+    app_driver_light_t *light = (app_driver_light_t *)arg;
+
+    portENTER_CRITICAL(&light->lock);
+    uint32_t flags = light->report_flags;
+    bool final = light->report_final;
+    uint8_t level = final ? light->transition_target.level :
+                    (uint8_t)REMAP_TO_RANGE(light->brightness, STANDARD_BRIGHTNESS, MATTER_BRIGHTNESS);
+    uint8_t hue = final ? light->transition_target.hue : (uint8_t)REMAP_TO_RANGE(light->hue, STANDARD_HUE, MATTER_HUE);
+    uint8_t saturation = final ? light->transition_target.saturation :
+                         (uint8_t)REMAP_TO_RANGE(light->saturation, STANDARD_SATURATION, MATTER_SATURATION);
+    light->report_scheduled = false;
+    if (final) {
+        light->report_flags = 0;
+        light->report_final = false;
+    }
+    portEXIT_CRITICAL(&light->lock);
+
+    s_report_endpoint_id = light->endpoint_id;
+    if (flags & APP_DRIVER_TRANSITION_LEVEL) {
+        esp_matter_attr_val_t val = esp_matter_nullable_uint8(level);
+        attribute::update(light->endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id, &val);
+    }
+    if (flags & APP_DRIVER_TRANSITION_HUE) {
+        esp_matter_attr_val_t val = esp_matter_uint8(hue);
+        attribute::update(light->endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentHue::Id, &val);
+    }
+    if (flags & APP_DRIVER_TRANSITION_SATURATION) {
+        esp_matter_attr_val_t val = esp_matter_uint8(saturation);
+        attribute::update(light->endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id, &val);
+    }
+    s_report_endpoint_id = UINT16_MAX;
+}
+
+/* Must be called with light->lock held. The data model follows a transition at most once per
+ * APP_DRIVER_TRANSITION_REPORT_MS, and gets the targets as soon as it ends, so that subscribers see the end of a
+ * dim without a report for every step. Returns true if a report is to be scheduled. */
+static bool app_driver_light_report_due(app_driver_light_t *light, bool done)
+{
+    if (!light->report_flags) {
+        return false;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (done) {
+        light->report_final = true;
+    } else if (APP_DRIVER_TRANSITION_REPORT_MS == 0 ||
+               now_us - light->reported_us < APP_DRIVER_TRANSITION_REPORT_MS * 1000LL) {
+        return false;
+    }
+    if (light->report_scheduled) {
+        return false;
+    }
+    light->report_scheduled = true;
+    light->reported_us = now_us;
+    return true;
+}
+
+/* With automatic light sleep the chip sleeps between commits, but not during a transition, so that its steps land on
+ * time. Called by the task which starts the transition and by the step which ends it. */
+static void app_driver_light_pm_hold(app_driver_light_t *light, bool hold)
+{
+#if CONFIG_PM_ENABLE
+    if (light->pm_lock && __atomic_exchange_n(&light->pm_held, hold, __ATOMIC_ACQ_REL) != hold) {
+        if (hold) {
+            esp_pm_lock_acquire(light->pm_lock);
+        } else {
+            esp_pm_lock_release(light->pm_lock);
+        }
+    }
 #endif
 }
 
-static esp_err_t app_driver_light_set_hue(led_indicator_handle_t handle, esp_matter_attr_val_t *val)
+/* Runs once per APP_DRIVER_TRANSITION_STEP_MS while a transition is in progress */
+static void app_driver_light_transition_step(void *arg)
+{
+    app_driver_light_t *light = (app_driver_light_t *)arg;
+    bool done = false;
+
+    portENTER_CRITICAL(&light->lock);
+    if (light->transition_steps > 0) {
+        light->transition_steps--;
+    }
+    bool last_step = (light->transition_steps == 0);
+    for (int i = 0; i < LIGHT_CHANNEL_MAX; i++) {
+        if (!(light->transition_flags & BIT(i))) {
+            continue;
+        }
+        light_transition_channel_t *channel = &light->transition[i];
+        channel->value_q16 += channel->step_q16;
+        /* Land exactly on the target regardless of the rounding of step_q16 */
+        uint16_t value = last_step ? channel->target : (uint16_t)(channel->value_q16 >> 16);
+        if (i == LIGHT_CHANNEL_BRIGHTNESS) {
+            light->brightness = value;
+            light->pending |= LIGHT_PENDING_BRIGHTNESS;
+        } else {
+            if (i == LIGHT_CHANNEL_HUE) {
+                light->hue = value;
+            } else {
+                light->saturation = value;
+            }
+            light->color_temperature = false;
+            light->pending &= ~LIGHT_PENDING_TEMPERATURE;
+            light->pending |= LIGHT_PENDING_HS;
+        }
+    }
+    if (last_step || !light->transition_flags) {
+        light->transition_flags = 0;
+        done = true;
+    }
+    bool report = app_driver_light_report_due(light, done);
+    portEXIT_CRITICAL(&light->lock);
+
+    if (done) {
+        esp_timer_stop(light->transition_timer);
+        app_driver_light_pm_hold(light, false);
+    }
+    app_driver_light_push(light);
+    if (report && PlatformMgr().ScheduleWork(app_driver_light_report_work, (intptr_t)light) != CHIP_NO_ERROR) {
+        portENTER_CRITICAL(&light->lock);
+        light->report_scheduled = false;
+        portEXIT_CRITICAL(&light->lock);
+        ESP_LOGW(TAG, "Transition of endpoint %d not reported", light->endpoint_id);
+    }
+}
+
+/* Must be called with light->lock held. A direct write to a channel that is being interpolated stops the
+ * interpolation of that channel, unless it only confirms the transition target. Returns true if the write
+ * should be dropped. */
+static bool app_driver_light_transition_override(app_driver_light_t *light, light_channel_t channel, uint16_t value)
+{
+    if (!(light->transition_flags & BIT(channel))) {
+        return false;
+    }
+    if (light->transition[channel].target == value) {
+        return true;
+    }
+    light->transition_flags &= ~BIT(channel);
+    light->report_flags &= ~BIT(channel);
+    return false;
+}
+
+/* Must be called with light->lock held. After a scene recall the data model writes the scene values back, these
+ * are dropped as the output already shows them. The first write of a different value ends the scene. Returns true
+ * if the write should be dropped. */
+static bool app_driver_light_scene_echo(app_driver_light_t *light, bool same_value)
+{
+    if (!light->scene_active) {
+        return false;
+    }
+    if (same_value) {
+        return true;
+    }
+    light->scene_active = false;
+    return false;
+}
+
+/* Must be called with light->lock held. Arms the commit timer once per frame. */
+static esp_err_t app_driver_light_schedule_commit(app_driver_light_t *light, uint32_t flag)
+{
+    int64_t *since_us = (flag & LIGHT_PENDING_POWER) ? &light->on_off_since_us :
+                        (flag & LIGHT_PENDING_BRIGHTNESS) ? &light->level_since_us : &light->color_since_us;
+    if (*since_us == 0) {
+        *since_us = esp_timer_get_time();
+    }
+    light->pending |= flag;
+    if (light->commit_scheduled) {
+        return ESP_OK;
+    }
+    esp_err_t err = esp_timer_start_once(light->commit_timer, APP_DRIVER_COMMIT_PERIOD_MS * 1000);
+    light->commit_scheduled = (err == ESP_OK);
+    return err;
+}
+
+/* Do any conversions/remapping for the actual value here */
+static esp_err_t app_driver_light_set_power(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&light->lock);
+    if (app_driver_light_scene_echo(light, light->power == val->val.b)) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_OK;
+    }
+    light->power = val->val.b;
+    esp_err_t err = app_driver_light_schedule_commit(light, LIGHT_PENDING_POWER);
+    portEXIT_CRITICAL(&light->lock);
+    return err;
+}
+
+static esp_err_t app_driver_light_set_brightness(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int value = REMAP_TO_RANGE(val->val.u8, MATTER_BRIGHTNESS, STANDARD_BRIGHTNESS);
+    portENTER_CRITICAL(&light->lock);
+    if (app_driver_light_scene_echo(light, light->brightness == value) ||
+            app_driver_light_transition_override(light, LIGHT_CHANNEL_BRIGHTNESS, value)) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_OK;
+    }
+    light->brightness = value;
+    esp_err_t err = app_driver_light_schedule_commit(light, LIGHT_PENDING_BRIGHTNESS);
+    portEXIT_CRITICAL(&light->lock);
+    return err;
+}
+
+static esp_err_t app_driver_light_set_hue(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
 {
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
     int value = REMAP_TO_RANGE(val->val.u8, MATTER_HUE, STANDARD_HUE);
-#if CONFIG_BSP_LEDS_NUM > 0
-    led_indicator_ihsv_t hsv;
-    hsv.value = led_indicator_get_hsv(handle);
-    hsv.h = value;
-    return led_indicator_set_hsv(handle, hsv.value);
-#else
-    ESP_LOGI(TAG, "LED set hue: %d", value);
-    return ESP_OK;
-#endif
+    portENTER_CRITICAL(&light->lock);
+    if (app_driver_light_scene_echo(light, !light->color_temperature && light->hue == value) ||
+            app_driver_light_transition_override(light, LIGHT_CHANNEL_HUE, value)) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_OK;
+    }
+    light->hue = value;
+    light->color_temperature = false;
+    light->pending &= ~LIGHT_PENDING_TEMPERATURE;
+    esp_err_t err = app_driver_light_schedule_commit(light, LIGHT_PENDING_HS);
+    portEXIT_CRITICAL(&light->lock);
+    return err;
 }
 
-static esp_err_t app_driver_light_set_saturation(led_indicator_handle_t handle, esp_matter_attr_val_t *val)
+static esp_err_t app_driver_light_set_saturation(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
 {
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
     int value = REMAP_TO_RANGE(val->val.u8, MATTER_SATURATION, STANDARD_SATURATION);
-#if CONFIG_BSP_LEDS_NUM > 0
-    led_indicator_ihsv_t hsv;
-    hsv.value = led_indicator_get_hsv(handle);
-    hsv.s = value;
-    return led_indicator_set_hsv(handle, hsv.value);
-#else
-    ESP_LOGI(TAG, "LED set saturation: %d", value);
+    portENTER_CRITICAL(&light->lock);
+    if (app_driver_light_scene_echo(light, !light->color_temperature && light->saturation == value) ||
+            app_driver_light_transition_override(light, LIGHT_CHANNEL_SATURATION, value)) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_OK;
+    }
+    light->saturation = value;
+    light->color_temperature = false;
+    light->pending &= ~LIGHT_PENDING_TEMPERATURE;
+    esp_err_t err = app_driver_light_schedule_commit(light, LIGHT_PENDING_HS);
+    portEXIT_CRITICAL(&light->lock);
+    return err;
+}
+
+static esp_err_t app_driver_light_set_temperature(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t value = val->val.u16;
+    portENTER_CRITICAL(&light->lock);
+    if (app_driver_light_scene_echo(light, light->color_temperature && light->temperature == value)) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_OK;
+    }
+    /* Colour temperature replaces hue and saturation, so any running colour interpolation is stale */
+    light->transition_flags &= ~(BIT(LIGHT_CHANNEL_HUE) | BIT(LIGHT_CHANNEL_SATURATION));
+    light->report_flags &= ~(BIT(LIGHT_CHANNEL_HUE) | BIT(LIGHT_CHANNEL_SATURATION));
+    light->temperature = value;
+    light->color_temperature = true;
+    light->pending &= ~LIGHT_PENDING_HS;
+    esp_err_t err = app_driver_light_schedule_commit(light, LIGHT_PENDING_TEMPERATURE);
+    portEXIT_CRITICAL(&light->lock);
+    return err;
+}
+
+esp_err_t app_driver_light_start_transition(app_driver_handle_t driver_handle,
+                                            const app_driver_light_transition_t *transition, uint32_t duration_ms)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light || !transition) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Indexed by light_channel_t */
+    uint16_t targets[LIGHT_CHANNEL_MAX] = {
+        (uint16_t)REMAP_TO_RANGE(transition->level, MATTER_BRIGHTNESS, STANDARD_BRIGHTNESS),
+        (uint16_t)REMAP_TO_RANGE(transition->hue, MATTER_HUE, STANDARD_HUE),
+        (uint16_t)REMAP_TO_RANGE(transition->saturation, MATTER_SATURATION, STANDARD_SATURATION),
+    };
+    uint32_t steps = duration_ms / APP_DRIVER_TRANSITION_STEP_MS;
+    if (steps == 0) {
+        steps = 1;
+    }
+
+    esp_timer_stop(light->transition_timer);
+    portENTER_CRITICAL(&light->lock);
+    uint16_t current[LIGHT_CHANNEL_MAX] = {light->brightness, light->hue, light->saturation};
+    light->transition_flags = transition->flags & (BIT(LIGHT_CHANNEL_MAX) - 1);
+    light->transition_steps = steps;
+    light->transition_target = *transition;
+    light->report_flags = light->transition_flags;
+    light->report_final = false;
+    light->reported_us = esp_timer_get_time();
+    for (int i = 0; i < LIGHT_CHANNEL_MAX; i++) {
+        light_transition_channel_t *channel = &light->transition[i];
+        channel->target = targets[i];
+        channel->value_q16 = (int32_t)current[i] << 16;
+        channel->step_q16 = (((int32_t)targets[i] - (int32_t)current[i]) << 16) / (int32_t)steps;
+    }
+    portEXIT_CRITICAL(&light->lock);
+
+    app_driver_light_pm_hold(light, true);
+    esp_err_t err = esp_timer_start_periodic(light->transition_timer, APP_DRIVER_TRANSITION_STEP_MS * 1000);
+    if (err != ESP_OK) {
+        app_driver_light_pm_hold(light, false);
+    }
+    return err;
+}
+
+esp_err_t app_driver_light_restore(app_driver_handle_t driver_handle, const app_light_state_t *state)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light || !state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&light->lock);
+    light->power = state->on_off;
+    light->brightness = REMAP_TO_RANGE(state->level, MATTER_BRIGHTNESS, STANDARD_BRIGHTNESS);
+    light->pending |= LIGHT_PENDING_POWER | LIGHT_PENDING_BRIGHTNESS;
+    if (state->color_mode == (uint8_t)ColorControl::ColorMode::kCurrentHueAndCurrentSaturation) {
+        light->hue = REMAP_TO_RANGE(state->hue, MATTER_HUE, STANDARD_HUE);
+        light->saturation = REMAP_TO_RANGE(state->saturation, MATTER_SATURATION, STANDARD_SATURATION);
+        light->color_temperature = false;
+        light->pending |= LIGHT_PENDING_HS;
+    } else if (state->color_mode == (uint8_t)ColorControl::ColorMode::kColorTemperature &&
+               state->temperature_mireds) {
+        light->temperature = state->temperature_mireds;
+        light->color_temperature = true;
+        light->pending |= LIGHT_PENDING_TEMPERATURE;
+    }
+    portEXIT_CRITICAL(&light->lock);
+
+    /* Called before Matter is up, so push right away instead of waiting for a frame */
+    app_driver_light_push(light);
     return ESP_OK;
+}
+
+esp_err_t app_driver_light_apply_now(app_driver_handle_t driver_handle, const app_driver_light_action_t *action)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light || !action) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&light->lock);
+    bool power = light->power;
+    portEXIT_CRITICAL(&light->lock);
+
+    if ((action->flags & APP_DRIVER_ACTION_LEVEL) || ((action->flags & APP_DRIVER_ACTION_LEVEL_IF_ON) && power)) {
+        esp_matter_attr_val_t val = esp_matter_uint8(action->level);
+        err |= app_driver_light_set_brightness(light, &val);
+    }
+    if (action->flags & (APP_DRIVER_ACTION_POWER | APP_DRIVER_ACTION_TOGGLE)) {
+        bool on_off = (action->flags & APP_DRIVER_ACTION_TOGGLE) ? !power : action->on_off;
+        esp_matter_attr_val_t val = esp_matter_bool(on_off);
+        err |= app_driver_light_set_power(light, &val);
+    }
+    app_driver_light_push(light);
+    return err;
+}
+
+/* Must be called with light->lock held */
+static light_scene_t *app_driver_light_scene_find(app_driver_light_t *light, uint16_t group_id, uint8_t scene_id)
+{
+    for (int i = 0; i < APP_DRIVER_MAX_SCENES; i++) {
+        light_scene_t *scene = &light->scenes[i];
+        if (scene->valid && scene->group_id == group_id && scene->scene_id == scene_id) {
+            return scene;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t app_driver_light_scene_store(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Capture what the latest writes asked for, not what the next frame would have shown */
+    app_driver_light_push(light);
+
+    light_scene_t scene = {};
+    portENTER_CRITICAL(&light->lock);
+    scene.power = light->power;
+    scene.color_temperature = light->color_temperature;
+    scene.brightness = light->brightness;
+    scene.hue = light->hue;
+    scene.saturation = light->saturation;
+    scene.temperature = light->temperature;
+    portEXIT_CRITICAL(&light->lock);
+
+#if CONFIG_BSP_LEDS_NUM > 0
+    uint32_t hsv;
+    if (scene.color_temperature) {
+        /* The indicator keeps the hue and saturation it derived from the temperature, only the level is replaced */
+        hsv = (led_indicator_get_hsv(light->led) & ~0xFFUL) | scene.brightness;
+    } else {
+        hsv = SET_HSV(scene.hue, scene.saturation, scene.brightness);
+    }
+    uint32_t r, g, b;
+    led_indicator_hsv2rgb(hsv, &r, &g, &b);
+    scene.frame = SET_RGB(r, g, b);
 #endif
+    scene.valid = true;
+    scene.group_id = group_id;
+    scene.scene_id = scene_id;
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&light->lock);
+    light_scene_t *slot = app_driver_light_scene_find(light, group_id, scene_id);
+    for (int i = 0; !slot && i < APP_DRIVER_MAX_SCENES; i++) {
+        if (!light->scenes[i].valid) {
+            slot = &light->scenes[i];
+        }
+    }
+    if (slot) {
+        *slot = scene;
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&light->lock);
+    return err;
 }
 
-static esp_err_t app_driver_light_set_temperature(led_indicator_handle_t handle, esp_matter_attr_val_t *val)
+esp_err_t app_driver_light_scene_recall(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id)
 {
-    uint32_t value = REMAP_TO_RANGE_INVERSE(val->val.u16, STANDARD_TEMPERATURE_FACTOR);
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&light->lock);
+    light_scene_t *slot = app_driver_light_scene_find(light, group_id, scene_id);
+    if (!slot) {
+        portEXIT_CRITICAL(&light->lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    light_scene_t scene = *slot;
+    bool output_power = light->output_power;
+    light->power = scene.power;
+    light->color_temperature = scene.color_temperature;
+    light->brightness = scene.brightness;
+    light->hue = scene.hue;
+    light->saturation = scene.saturation;
+    light->temperature = scene.temperature;
+    /* The frame replaces whatever was still waiting for a commit or being animated */
+    light->pending = 0;
+    light->transition_flags = 0;
+    light->report_flags = 0;
+    light->on_off_since_us = 0;
+    light->level_since_us = 0;
+    light->color_since_us = 0;
+    light->scene_active = true;
+    light->output_power = scene.power;
+    portEXIT_CRITICAL(&light->lock);
+    esp_timer_stop(light->transition_timer);
+    app_driver_light_pm_hold(light, false);
+
+    esp_err_t err = ESP_OK;
 #if CONFIG_BSP_LEDS_NUM > 0
-    return led_indicator_set_color_temperature(handle, value);
+    if (scene.power) {
+        err = led_indicator_set_rgb(light->led, scene.frame);
+    }
+    if (scene.power != output_power) {
+        err |= led_indicator_start(light->led, scene.power ? BSP_LED_ON : BSP_LED_OFF);
+    }
 #else
-    ESP_LOGI(TAG, "LED set temperature: %ld", value);
-    return ESP_OK;
+    ESP_LOGI(TAG, "LED recall scene %d of group %d, power: %d -> %d", scene_id, group_id, output_power, scene.power);
 #endif
+    return err;
+}
+
+esp_err_t app_driver_light_scene_remove(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id)
+{
+    app_driver_light_t *light = (app_driver_light_t *)driver_handle;
+    if (!light) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&light->lock);
+    light_scene_t *slot = app_driver_light_scene_find(light, group_id, scene_id);
+    if (slot) {
+        slot->valid = false;
+    }
+    portEXIT_CRITICAL(&light->lock);
+    return slot ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+/* Attributes read by the driver outside of the attribute callbacks, indexed by app_driver_cached_attribute_t */
+typedef enum {
+    APP_DRIVER_ATTR_ON_OFF = 0,
+    APP_DRIVER_ATTR_CURRENT_LEVEL,
+    APP_DRIVER_ATTR_COLOR_MODE,
+    APP_DRIVER_ATTR_CURRENT_HUE,
+    APP_DRIVER_ATTR_CURRENT_SATURATION,
+    APP_DRIVER_ATTR_COLOR_TEMPERATURE,
+    APP_DRIVER_ATTR_MAX,
+} app_driver_cached_attribute_t;
+
+static const struct {
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+} s_cached_attribute_ids[APP_DRIVER_ATTR_MAX] = {
+    {OnOff::Id, OnOff::Attributes::OnOff::Id},
+    {LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id},
+    {ColorControl::Id, ColorControl::Attributes::ColorMode::Id},
+    {ColorControl::Id, ColorControl::Attributes::CurrentHue::Id},
+    {ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id},
+    {ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id},
+};
+
+typedef struct {
+    bool valid;
+    app_driver_handle_t driver_handle;              /* priv_data of the endpoint */
+    attribute_t *attributes[APP_DRIVER_ATTR_MAX];   /* NULL if the endpoint does not have the attribute */
+} app_driver_attribute_cache_t;
+
+/* Indexed by endpoint_id, like s_endpoint_tables */
+static app_driver_attribute_cache_t s_attribute_caches[APP_DRIVER_MAX_ENDPOINTS];
+
+esp_err_t app_driver_attribute_cache_fill(uint16_t endpoint_id)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS) {
+        ESP_LOGE(TAG, "Cannot cache the attributes of endpoint %d", endpoint_id);
+        return ESP_ERR_INVALID_ARG;
+    }
+    app_driver_attribute_cache_t *cache = &s_attribute_caches[endpoint_id];
+    for (int i = 0; i < APP_DRIVER_ATTR_MAX; i++) {
+        cache->attributes[i] = attribute::get(endpoint_id, s_cached_attribute_ids[i].cluster_id,
+                                              s_cached_attribute_ids[i].attribute_id);
+    }
+    cache->driver_handle = (app_driver_handle_t)endpoint::get_priv_data(endpoint_id);
+    cache->valid = true;
+    return ESP_OK;
+}
+
+void app_driver_attribute_cache_invalidate(uint16_t endpoint_id)
+{
+    if (endpoint_id < APP_DRIVER_MAX_ENDPOINTS) {
+        s_attribute_caches[endpoint_id] = {};
+    }
+}
+
+/* Endpoints without a filled cache go through the data model lookup */
+static attribute_t *app_driver_attribute_get(uint16_t endpoint_id, app_driver_cached_attribute_t attr)
+{
+    if (endpoint_id < APP_DRIVER_MAX_ENDPOINTS && s_attribute_caches[endpoint_id].valid) {
+        return s_attribute_caches[endpoint_id].attributes[attr];
+    }
+    return attribute::get(endpoint_id, s_cached_attribute_ids[attr].cluster_id,
+                          s_cached_attribute_ids[attr].attribute_id);
+}
+
+static esp_err_t app_driver_attribute_get_val(uint16_t endpoint_id, app_driver_cached_attribute_t attr,
+                                              esp_matter_attr_val_t *val)
+{
+    attribute_t *attribute = app_driver_attribute_get(endpoint_id, attr);
+    if (!attribute) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return attribute::get_val(attribute, val);
+}
+
+/* Sorted by (cluster_id, attribute_id), see app_driver_attribute_table_is_sorted() */
+static constexpr app_driver_attribute_entry_t s_light_attribute_table[] = {
+    {OnOff::Id, OnOff::Attributes::OnOff::Id, app_driver_light_set_power},
+    {LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id, app_driver_light_set_brightness},
+    {ColorControl::Id, ColorControl::Attributes::CurrentHue::Id, app_driver_light_set_hue},
+    {ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id, app_driver_light_set_saturation},
+    {ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id, app_driver_light_set_temperature},
+};
+static_assert(app_driver_attribute_table_is_sorted(s_light_attribute_table), "Light attribute table must be sorted");
+
+typedef struct {
+    const app_driver_attribute_entry_t *table;
+    size_t count;
+} app_driver_endpoint_table_t;
+
+/* Indexed directly by endpoint_id so that the endpoint lookup is O(1) */
+static app_driver_endpoint_table_t s_endpoint_tables[APP_DRIVER_MAX_ENDPOINTS];
+
+static inline uint64_t app_driver_attribute_key(uint32_t cluster_id, uint32_t attribute_id)
+{
+    return ((uint64_t)cluster_id << 32) | attribute_id;
+}
+
+static app_driver_attribute_cb_t app_driver_attribute_lookup(const app_driver_endpoint_table_t *endpoint,
+                                                             uint32_t cluster_id, uint32_t attribute_id)
+{
+    uint64_t key = app_driver_attribute_key(cluster_id, attribute_id);
+    size_t low = 0;
+    size_t high = endpoint->count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        uint64_t mid_key = app_driver_attribute_key(endpoint->table[mid].cluster_id, endpoint->table[mid].attribute_id);
+        if (mid_key == key) {
+            return endpoint->table[mid].cb;
+        } else if (mid_key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t app_driver_register_attribute_table(uint16_t endpoint_id, const app_driver_attribute_entry_t *table,
+                                              size_t count)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || (count > 0 && !table)) {
+        ESP_LOGE(TAG, "Invalid attribute table for endpoint %d", endpoint_id);
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 1; i < count; i++) {
+        if (app_driver_attribute_key(table[i - 1].cluster_id, table[i - 1].attribute_id) >=
+            app_driver_attribute_key(table[i].cluster_id, table[i].attribute_id)) {
+            ESP_LOGE(TAG, "Attribute table for endpoint %d is not sorted", endpoint_id);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    s_endpoint_tables[endpoint_id].table = table;
+    s_endpoint_tables[endpoint_id].count = count;
+    return ESP_OK;
 }
 
+esp_err_t app_driver_light_register(uint16_t endpoint_id)
+{
+    app_driver_light_t *light = (app_driver_light_t *)endpoint::get_priv_data(endpoint_id);
+    if (light) {
+        light->endpoint_id = endpoint_id;
+    }
+    return app_driver_register_attribute_table(endpoint_id, s_light_attribute_table,
+                                               sizeof(s_light_attribute_table) / sizeof(s_light_attribute_table[0]));
+}
+
+app_driver_handle_t app_driver_light_get(uint16_t endpoint_id)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || !s_attribute_caches[endpoint_id].valid ||
+            s_endpoint_tables[endpoint_id].table != s_light_attribute_table) {
+        return NULL;
+    }
+    return s_attribute_caches[endpoint_id].driver_handle;
+}
+
+esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_t endpoint_id, uint32_t cluster_id,
+                                      uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || endpoint_id == s_report_endpoint_id) {
+        return ESP_OK;
+    }
+    app_driver_attribute_cb_t cb = app_driver_attribute_lookup(&s_endpoint_tables[endpoint_id], cluster_id,
+                                                               attribute_id);
+    if (!cb) {
+        return ESP_OK;
+    }
+    return cb(driver_handle, val);
+}
+
+#if APP_DRIVER_BUTTON_LOCAL_FEEDBACK
+/* Runs in the Matter task. Only the update of the last press is applied, an older one would switch the output back
+ * for a frame. The update calls app_driver_light_set_power() again with the same value, which keeps the output in
+ * line with the data model if another write got in between. If the update is refused, the output goes back to the
+ * value of the data model. */
+static void app_driver_button_update_work(intptr_t arg)
+{
+    uint16_t endpoint_id = (uint16_t)(arg >> 1);
+    app_driver_light_t *light = (app_driver_light_t *)s_attribute_caches[endpoint_id].driver_handle;
+    portENTER_CRITICAL(&light->lock);
+    bool superseded = (--light->button_updates > 0);
+    portEXIT_CRITICAL(&light->lock);
+    if (superseded) {
+        return;
+    }
+
+    esp_matter_attr_val_t val = esp_matter_bool((bool)(arg & 1));
+    esp_err_t err = attribute::update(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id, &val);
+    if (err == ESP_OK) {
+        return;
+    }
+    ESP_LOGW(TAG, "Button toggle not applied to endpoint %d, err:%d", endpoint_id, err);
+    if (app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_ON_OFF, &val) == ESP_OK) {
+        app_driver_light_set_power(light, &val);
+    }
+}
+
+/* Switches the output from the button task and leaves the data model update, with its reporting and persistence,
+ * to the Matter task. Returns false if the endpoint is not a light of this driver with a filled cache. */
+static bool app_driver_button_toggle_local(uint16_t endpoint_id)
+{
+    app_driver_light_t *light = (app_driver_light_t *)app_driver_light_get(endpoint_id);
+    if (!light) {
+        return false;
+    }
+    /* The driver state already has the presses the data model has not seen yet */
+    portENTER_CRITICAL(&light->lock);
+    bool on_off = !light->power;
+    light->button_updates++;
+    portEXIT_CRITICAL(&light->lock);
+
+    esp_matter_attr_val_t val = esp_matter_bool(on_off);
+    app_driver_light_set_power(light, &val);
+    app_driver_light_push(light);
+
+    /* The update carries the value rather than a toggle, so it does not matter what the data model has by then */
+    intptr_t arg = ((intptr_t)endpoint_id << 1) | (on_off ? 1 : 0);
+    if (PlatformMgr().ScheduleWork(app_driver_button_update_work, arg) != CHIP_NO_ERROR) {
+        ESP_LOGW(TAG, "Button toggle not queued, updating endpoint %d directly", endpoint_id);
+        app_driver_button_update_work(arg);
+    }
+    return true;
+}
+#endif
+
 static void app_driver_button_toggle_cb(void *arg, void *data)
 {
     ESP_LOGI(TAG, "Toggle button pressed");
-    uint16_t endpoint_id = light_endpoint_id;
+    uint16_t endpoint_id = (uint16_t)(uintptr_t)data;
     uint32_t cluster_id = OnOff::Id;
     uint32_t attribute_id = OnOff::Attributes::OnOff::Id;
 
-    attribute_t *attribute = attribute::get(endpoint_id, cluster_id, attribute_id);
+#if APP_DRIVER_BUTTON_LOCAL_FEEDBACK
+    if (app_driver_button_toggle_local(endpoint_id)) {
+        return;
+    }
+#endif
+    attribute_t *attribute = app_driver_attribute_get(endpoint_id, APP_DRIVER_ATTR_ON_OFF);
 
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
     attribute::get_val(attribute, &val);
@@ -103,95 +938,254 @@ static void app_driver_button_toggle_cb(void *arg, void *data)
     attribute::update(endpoint_id, cluster_id, attribute_id, &val);
 }
 
-esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_t endpoint_id, uint32_t cluster_id,
-                                      uint32_t attribute_id, esp_matter_attr_val_t *val)
+typedef esp_err_t (*app_driver_scene_op_t)(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id);
+
+/* Apply a scene operation to every light endpoint, so that a whole room changes in one pass */
+static esp_err_t app_driver_scene_for_each_light(app_driver_scene_op_t op, uint16_t group_id, uint8_t scene_id)
 {
-    esp_err_t err = ESP_OK;
-    if (endpoint_id == light_endpoint_id) {
-        led_indicator_handle_t handle = (led_indicator_handle_t)driver_handle;
-        if (cluster_id == OnOff::Id) {
-            if (attribute_id == OnOff::Attributes::OnOff::Id) {
-                // err = app_driver_light_set_power(handle, val);
-                err = led_indicator_gpio_set_on_off(handle, val->val.b);
-            }
-        } else if (cluster_id == LevelControl::Id) {
-            if (attribute_id == LevelControl::Attributes::CurrentLevel::Id) {
-                err = app_driver_light_set_brightness(handle, val);
-            }
-        } else if (cluster_id == ColorControl::Id) {
-            if (attribute_id == ColorControl::Attributes::CurrentHue::Id) {
-                err = app_driver_light_set_hue(handle, val);
-            } else if (attribute_id == ColorControl::Attributes::CurrentSaturation::Id) {
-                err = app_driver_light_set_saturation(handle, val);
-            } else if (attribute_id == ColorControl::Attributes::ColorTemperatureMireds::Id) {
-                err = app_driver_light_set_temperature(handle, val);
-            }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for (uint16_t endpoint_id = 0; endpoint_id < APP_DRIVER_MAX_ENDPOINTS; endpoint_id++) {
+        if (s_endpoint_tables[endpoint_id].table != s_light_attribute_table) {
+            continue;
+        }
+        app_driver_handle_t handle = (app_driver_handle_t)endpoint::get_priv_data(endpoint_id);
+        esp_err_t op_err = op(handle, group_id, scene_id);
+        if (op_err == ESP_OK && err == ESP_ERR_NOT_FOUND) {
+            err = ESP_OK;
+        } else if (op_err != ESP_OK && op_err != ESP_ERR_NOT_FOUND) {
+            err = op_err;
         }
     }
     return err;
 }
 
+esp_err_t app_driver_scene_recall(uint16_t group_id, uint8_t scene_id)
+{
+    return app_driver_scene_for_each_light(app_driver_light_scene_recall, group_id, scene_id);
+}
+
+void app_driver_light_stats_dump()
+{
+#if CONFIG_BSP_LEDS_NUM > 0 && CONFIG_LED_INDICATOR_STATS
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    for (uint16_t endpoint_id = 0; endpoint_id < APP_DRIVER_MAX_ENDPOINTS; endpoint_id++) {
+        if (s_endpoint_tables[endpoint_id].table != s_light_attribute_table) {
+            continue;
+        }
+        app_driver_light_t *light = (app_driver_light_t *)endpoint::get_priv_data(endpoint_id);
+        led_indicator_stats_t stats;
+        if (!light || led_indicator_get_stats(light->led, &stats) != ESP_OK) {
+            continue;
+        }
+        int32_t late_avg_us = stats.late_count ? (int32_t)(stats.late_sum_us / stats.late_count) : 0;
+        printf("led endpoint %u: steps %" PRIu32 " retries %" PRIu32 " late avg/min/max %" PRId32 "/%" PRId32
+               "/%" PRId32 " us, step avg/max %" PRIu32 "/%" PRIu32 " us\n", endpoint_id, stats.steps, stats.retries,
+               late_avg_us, stats.late_min_us, stats.late_max_us,
+               stats.steps ? (uint32_t)(stats.cycles_sum / stats.steps / ticks_per_us) : 0,
+               stats.cycles_max / ticks_per_us);
+    }
+#else
+    printf("led: enable CONFIG_LED_INDICATOR_STATS\n");
+#endif
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t app_driver_scene_console_handler(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4) {
+        printf("Usage: matter esp scene <store|recall|remove> <group_id> <scene_id> [endpoint_id]\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    app_driver_scene_op_t op;
+    if (strcmp(argv[0], "store") == 0) {
+        op = app_driver_light_scene_store;
+    } else if (strcmp(argv[0], "recall") == 0) {
+        op = app_driver_light_scene_recall;
+    } else if (strcmp(argv[0], "remove") == 0) {
+        op = app_driver_light_scene_remove;
+    } else {
+        printf("Unknown scene operation: %s\n", argv[0]);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint16_t group_id = (uint16_t)strtoul(argv[1], NULL, 0);
+    uint8_t scene_id = (uint8_t)strtoul(argv[2], NULL, 0);
+
+    esp_err_t err;
+    if (argc == 4) {
+        uint16_t endpoint_id = (uint16_t)strtoul(argv[3], NULL, 0);
+        if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || s_endpoint_tables[endpoint_id].table != s_light_attribute_table) {
+            printf("Endpoint %u is not a light\n", endpoint_id);
+            return ESP_ERR_INVALID_ARG;
+        }
+        err = op((app_driver_handle_t)endpoint::get_priv_data(endpoint_id), group_id, scene_id);
+    } else {
+        err = app_driver_scene_for_each_light(op, group_id, scene_id);
+    }
+    if (err != ESP_OK) {
+        printf("Scene %s failed, err:%d\n", argv[0], err);
+    }
+    return err;
+}
+
+esp_err_t app_driver_scene_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "scene",
+        .description = "Store, recall or remove a driver scene on one or all lights. "
+                       "Usage: matter esp scene <store|recall|remove> <group_id> <scene_id> [endpoint_id]",
+        .handler = app_driver_scene_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
+
 esp_err_t app_driver_light_set_defaults(uint16_t endpoint_id)
 {
     esp_err_t err = ESP_OK;
-    void *priv_data = endpoint::get_priv_data(endpoint_id);
-    led_indicator_handle_t handle = (led_indicator_handle_t)priv_data;
+    app_driver_handle_t handle = (app_driver_handle_t)endpoint::get_priv_data(endpoint_id);
     esp_matter_attr_val_t val = esp_matter_invalid(NULL);
 
     /* Setting brightness */
-    attribute_t *attribute = attribute::get(endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id);
-    attribute::get_val(attribute, &val);
+    app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_CURRENT_LEVEL, &val);
     err |= app_driver_light_set_brightness(handle, &val);
 
     /* Setting color */
-    attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorMode::Id);
-    attribute::get_val(attribute, &val);
+    app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_COLOR_MODE, &val);
     if (val.val.u8 == (uint8_t)ColorControl::ColorMode::kCurrentHueAndCurrentSaturation) {
         /* Setting hue */
-        attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentHue::Id);
-        attribute::get_val(attribute, &val);
+        app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_CURRENT_HUE, &val);
         err |= app_driver_light_set_hue(handle, &val);
         /* Setting saturation */
-        attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id);
-        attribute::get_val(attribute, &val);
+        app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_CURRENT_SATURATION, &val);
         err |= app_driver_light_set_saturation(handle, &val);
     } else if (val.val.u8 == (uint8_t)ColorControl::ColorMode::kColorTemperature) {
         /* Setting temperature */
-        attribute = attribute::get(endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id);
-        attribute::get_val(attribute, &val);
+        app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_COLOR_TEMPERATURE, &val);
         err |= app_driver_light_set_temperature(handle, &val);
     } else {
         ESP_LOGE(TAG, "Color mode not supported");
     }
 
     /* Setting power */
-    attribute = attribute::get(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id);
-    attribute::get_val(attribute, &val);
+    app_driver_attribute_get_val(endpoint_id, APP_DRIVER_ATTR_ON_OFF, &val);
     err |= app_driver_light_set_power(handle, &val);
 
     return err;
 }
 
-app_driver_handle_t app_driver_light_init()
+#if CONFIG_BSP_LEDS_NUM > 0
+/* One light per LED of the board, the lights are never deleted */
+static app_driver_light_t s_lights[CONFIG_BSP_LEDS_NUM];
+#endif
+
+/* Button events queued for app_driver_button_task() */
+static StaticQueue_t s_button_queue;
+static uint8_t s_button_queue_storage[APP_DRIVER_BUTTON_QUEUE_LEN * sizeof(button_event_msg_t)];
+static StaticTask_t s_button_task;
+static StackType_t s_button_task_stack[APP_DRIVER_BUTTON_TASK_STACK];
+
+static app_driver_light_t *app_driver_light_create(app_driver_light_t *light, led_indicator_handle_t led)
+{
+    memset(light, 0, sizeof(*light));
+    portMUX_INITIALIZE(&light->lock);
+    light->led = led;
+    light->brightness = DEFAULT_BRIGHTNESS;
+    light->hue = DEFAULT_HUE;
+    light->saturation = DEFAULT_SATURATION;
+
+    esp_timer_create_args_t commit_timer_args = {
+        .callback = app_driver_light_commit,
+        .arg = light,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "light_commit",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&commit_timer_args, &light->commit_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create light commit timer");
+        return NULL;
+    }
+
+    esp_timer_create_args_t transition_timer_args = {
+        .callback = app_driver_light_transition_step,
+        .arg = light,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "light_transition",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&transition_timer_args, &light->transition_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create light transition timer");
+        esp_timer_delete(light->commit_timer);
+        return NULL;
+    }
+#if CONFIG_PM_ENABLE
+    /* Without the lock the transitions still run, with the wakeup latency of light sleep on every step */
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "light_transition", &light->pm_lock) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to create light transition PM lock");
+        light->pm_lock = NULL;
+    }
+#endif
+    return light;
+}
+
+esp_err_t app_driver_light_init(app_driver_handle_t light_array[], int *light_cnt, int light_array_size)
 {
+    if (!light_array || !light_cnt) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *light_cnt = 0;
 #if CONFIG_BSP_LEDS_NUM > 0
     /* Initialize led */
     led_indicator_handle_t leds[CONFIG_BSP_LEDS_NUM];
-    ESP_ERROR_CHECK(bsp_led_indicator_create(leds, NULL, CONFIG_BSP_LEDS_NUM));
-    led_indicator_set_hsv(leds[0], SET_HSV(DEFAULT_HUE, DEFAULT_SATURATION, DEFAULT_BRIGHTNESS));
-    
-    return (app_driver_handle_t)leds[0];
-#else
-    return NULL;
+    int led_cnt = 0;
+    esp_err_t err = bsp_led_indicator_create(leds, &led_cnt, CONFIG_BSP_LEDS_NUM);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create LED indicators, err:%d", err);
+        return err;
+    }
+    if (led_cnt > light_array_size) {
+        ESP_LOGW(TAG, "Only %d of %d LEDs can be used as lights", light_array_size, led_cnt);
+        led_cnt = light_array_size;
+    }
+    for (int i = 0; i < led_cnt; i++) {
+        led_indicator_set_hsv(leds[i], SET_HSV(DEFAULT_HUE, DEFAULT_SATURATION, DEFAULT_BRIGHTNESS));
+        app_driver_light_t *light = app_driver_light_create(&s_lights[i], leds[i]);
+        if (!light) {
+            return ESP_ERR_NO_MEM;
+        }
+        light_array[i] = (app_driver_handle_t)light;
+        (*light_cnt)++;
+    }
 #endif
+    return ESP_OK;
 }
 
-app_driver_handle_t app_driver_button_init()
+static void app_driver_button_task(void *arg)
+{
+    QueueHandle_t queue = (QueueHandle_t)arg;
+    button_event_msg_t msg;
+    while (true) {
+        if (xQueueReceive(queue, &msg, portMAX_DELAY) == pdTRUE) {
+            iot_button_dispatch_event_msg(&msg);
+        }
+    }
+}
+
+app_driver_handle_t app_driver_button_init(uint16_t endpoint_id)
 {
     /* Initialize button */
     button_handle_t btns[BSP_BUTTON_NUM];
     ESP_ERROR_CHECK(bsp_iot_button_create(btns, NULL, BSP_BUTTON_NUM));
-    ESP_ERROR_CHECK(iot_button_register_cb(btns[0], BUTTON_PRESS_DOWN, app_driver_button_toggle_cb, NULL));
+
+    /* The toggle goes through the data model, keep it out of the esp_timer task so it cannot delay the button
+     * debouncing or the other timers. The queue and the task live in static storage and cannot fail. */
+    QueueHandle_t queue = xQueueCreateStatic(APP_DRIVER_BUTTON_QUEUE_LEN, sizeof(button_event_msg_t),
+                                             s_button_queue_storage, &s_button_queue);
+    xTaskCreateStaticPinnedToCore(app_driver_button_task, "app_button", APP_DRIVER_BUTTON_TASK_STACK, queue,
+                                  APP_DRIVER_BUTTON_TASK_PRIORITY, s_button_task_stack, &s_button_task,
+                                  APP_CORE_OUTPUT);
+    iot_button_set_event_queue(queue);
+    ESP_ERROR_CHECK(iot_button_register_cb(btns[0], BUTTON_PRESS_DOWN, app_driver_button_toggle_cb,
+                                           (void *)(uintptr_t)endpoint_id));
     
     return (app_driver_handle_t)btns[0];
 }
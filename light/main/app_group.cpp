@@ -0,0 +1,126 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+
+#include <esp_matter.h>
+
+#include <app_priv.h>
+
+#include <access/AuthMode.h>
+#include <app/CommandHandlerInterface.h>
+#include <app/InteractionModelEngine.h>
+
+using namespace chip;
+using namespace chip::app;
+using namespace chip::app::Clusters;
+
+static const char *TAG = "app_group";
+
+/* Sits in front of the cluster server of all the endpoints. Commands are never marked as handled, so the server
+ * still runs them and the data model ends up the same as without the fast path. */
+class AppGroupCommandHandler : public CommandHandlerInterface
+{
+public:
+    AppGroupCommandHandler(ClusterId cluster_id) : CommandHandlerInterface(NullOptional, cluster_id) {}
+
+    void InvokeCommand(HandlerContext &ctx) override;
+};
+
+static bool app_group_decode_on_off(CommandId command_id, app_driver_light_action_t *action)
+{
+    switch (command_id) {
+    case OnOff::Commands::On::Id:
+        action->flags = APP_DRIVER_ACTION_POWER;
+        action->on_off = true;
+        return true;
+    case OnOff::Commands::Off::Id:
+        action->flags = APP_DRIVER_ACTION_POWER;
+        action->on_off = false;
+        return true;
+    case OnOff::Commands::Toggle::Id:
+        action->flags = APP_DRIVER_ACTION_TOGGLE;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Only the commands without a transition, the server steps the others itself. A level down to the minimum with
+ * OnOff turns the light off, that is left to the server. */
+template <typename T>
+static bool app_group_decode_move_to_level(TLV::TLVReader &payload, bool with_on_off, app_driver_light_action_t *action)
+{
+    /* The server decodes the same payload afterwards */
+    TLV::TLVReader reader(payload);
+    T command;
+    if (DataModel::Decode(reader, command) != CHIP_NO_ERROR) {
+        return false;
+    }
+    if (command.transitionTime.IsNull() || command.transitionTime.Value() != 0) {
+        return false;
+    }
+    if (with_on_off) {
+        if (command.level <= 1) {
+            return false;
+        }
+        action->flags = APP_DRIVER_ACTION_LEVEL | APP_DRIVER_ACTION_POWER;
+        action->on_off = true;
+    } else {
+        /* A light which is off only takes the level with ExecuteIfOff, and keeps its output off anyway */
+        action->flags = APP_DRIVER_ACTION_LEVEL_IF_ON;
+    }
+    action->level = command.level;
+    return true;
+}
+
+void AppGroupCommandHandler::InvokeCommand(HandlerContext &ctx)
+{
+    if (ctx.mCommandHandler.GetSubjectDescriptor().authMode != Access::AuthMode::kGroup) {
+        return;
+    }
+    app_driver_handle_t handle = app_driver_light_get(ctx.mRequestPath.mEndpointId);
+    if (!handle) {
+        return;
+    }
+
+    app_driver_light_action_t action = {};
+    bool decoded = false;
+    if (ctx.mRequestPath.mClusterId == OnOff::Id) {
+        decoded = app_group_decode_on_off(ctx.mRequestPath.mCommandId, &action);
+    } else if (ctx.mRequestPath.mCommandId == LevelControl::Commands::MoveToLevel::Id) {
+        decoded = app_group_decode_move_to_level<LevelControl::Commands::MoveToLevel::DecodableType>(ctx.mPayload,
+                                                                                                      false, &action);
+    } else if (ctx.mRequestPath.mCommandId == LevelControl::Commands::MoveToLevelWithOnOff::Id) {
+        decoded = app_group_decode_move_to_level<LevelControl::Commands::MoveToLevelWithOnOff::DecodableType>(
+                      ctx.mPayload, true, &action);
+    }
+    if (!decoded) {
+        return;
+    }
+    esp_err_t err = app_driver_light_apply_now(handle, &action);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Group command not applied to endpoint %d, err:%d", ctx.mRequestPath.mEndpointId, err);
+    }
+}
+
+static AppGroupCommandHandler s_on_off_handler(OnOff::Id);
+static AppGroupCommandHandler s_level_control_handler(LevelControl::Id);
+
+esp_err_t app_group_init()
+{
+    AppGroupCommandHandler *handlers[] = {&s_on_off_handler, &s_level_control_handler};
+    for (AppGroupCommandHandler *handler : handlers) {
+        CHIP_ERROR err = InteractionModelEngine::GetInstance()->RegisterCommandHandler(handler);
+        if (err != CHIP_NO_ERROR) {
+            ESP_LOGE(TAG, "Failed to register group command handler, err:%" CHIP_ERROR_FORMAT, err.Format());
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,156 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_matter.h>
+#include <esp_matter_console.h>
+
+#include <app_priv.h>
+
+using namespace chip::app::Clusters;
+
+/* Bucket i counts latencies in [2^i, 2^(i+1)) us, the last bucket also takes everything above */
+#define LATENCY_BUCKET_NUM 24
+
+typedef enum {
+    LATENCY_CLUSTER_ON_OFF = 0,
+    LATENCY_CLUSTER_LEVEL_CONTROL,
+    LATENCY_CLUSTER_COLOR_CONTROL,
+    LATENCY_CLUSTER_MAX,
+} latency_cluster_t;
+
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKET_NUM];
+    uint32_t count;
+    uint32_t max_us;
+} latency_histogram_t;
+
+/* Indexed by latency_cluster_t */
+static const char *s_cluster_names[LATENCY_CLUSTER_MAX] = {
+    "OnOff",
+    "LevelControl",
+    "ColorControl",
+};
+
+static latency_histogram_t s_histograms[LATENCY_CLUSTER_MAX];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int app_latency_cluster_index(uint32_t cluster_id)
+{
+    switch (cluster_id) {
+    case OnOff::Id:
+        return LATENCY_CLUSTER_ON_OFF;
+    case LevelControl::Id:
+        return LATENCY_CLUSTER_LEVEL_CONTROL;
+    case ColorControl::Id:
+        return LATENCY_CLUSTER_COLOR_CONTROL;
+    default:
+        return -1;
+    }
+}
+
+static inline int app_latency_bucket(uint32_t latency_us)
+{
+    if (latency_us == 0) {
+        return 0;
+    }
+    int bucket = 31 - __builtin_clz(latency_us);
+    return bucket < LATENCY_BUCKET_NUM ? bucket : LATENCY_BUCKET_NUM - 1;
+}
+
+void app_latency_record(uint32_t cluster_id, int64_t start_us)
+{
+    int index = app_latency_cluster_index(cluster_id);
+    if (index < 0 || start_us <= 0) {
+        return;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    uint32_t latency_us = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+    int bucket = app_latency_bucket(latency_us);
+
+    portENTER_CRITICAL(&s_lock);
+    latency_histogram_t *histogram = &s_histograms[index];
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (latency_us > histogram->max_us) {
+        histogram->max_us = latency_us;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+/* Upper bound of the bucket holding the given percentile, capped to the max seen */
+static uint32_t app_latency_percentile(const latency_histogram_t *histogram, uint32_t percent)
+{
+    uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKET_NUM; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint32_t upper_us = (i == LATENCY_BUCKET_NUM - 1) ? UINT32_MAX : ((1UL << (i + 1)) - 1);
+            return upper_us < histogram->max_us ? upper_us : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+void app_latency_dump()
+{
+    printf("%-14s %10s %10s %10s %10s\n", "cluster", "count", "p50 (us)", "p99 (us)", "max (us)");
+    for (int i = 0; i < LATENCY_CLUSTER_MAX; i++) {
+        latency_histogram_t histogram;
+        portENTER_CRITICAL(&s_lock);
+        histogram = s_histograms[i];
+        portEXIT_CRITICAL(&s_lock);
+        if (histogram.count == 0) {
+            printf("%-14s %10d %10s %10s %10s\n", s_cluster_names[i], 0, "-", "-", "-");
+            continue;
+        }
+        printf("%-14s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", s_cluster_names[i],
+               histogram.count, app_latency_percentile(&histogram, 50), app_latency_percentile(&histogram, 99),
+               histogram.max_us);
+    }
+}
+
+void app_latency_reset()
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(s_histograms, 0, sizeof(s_histograms));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t app_latency_console_handler(int argc, char **argv)
+{
+    if (argc == 1 && strcmp(argv[0], "reset") == 0) {
+        app_latency_reset();
+        return ESP_OK;
+    }
+    if (argc != 0) {
+        printf("Usage: matter esp latency [reset]\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    app_latency_dump();
+    return ESP_OK;
+}
+
+esp_err_t app_latency_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "latency",
+        .description = "Attribute update to light output latency per cluster. Usage: matter esp latency [reset]",
+        .handler = app_latency_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
@@ -7,7 +7,12 @@
 */
 #include <driver/gpio.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
 #include <esp_log.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+#include <inttypes.h>
 #include <nvs_flash.h>
 
 #include <esp_matter.h>
@@ -21,6 +26,15 @@
 #include <platform/ESP32/OpenthreadLauncher.h>
 #endif
 
+#if CONFIG_DIAG_ENABLE_METRICS
+#include <esp_diagnostics_metrics.h>
+#endif
+#include <esp_diagnostics_trace.h>
+#if CONFIG_MDNS_SHARED_TASK
+#include <esp_rmaker_work_queue.h>
+#include <mdns.h>
+#endif
+
 #include <app/server/CommissioningWindowManager.h>
 #include <app/server/Server.h>
 
@@ -30,8 +44,6 @@ using namespace esp_matter::endpoint;
 using namespace chip::app::Clusters;
 
 static const char *TAG = "app_main";
-uint16_t light_endpoint_id = 0;
-attribute_t *attribute_ref;
 
 const uint32_t CLUSTER_ID = OnOff::Id;
 const uint32_t ATTRIBUTE_ID = OnOff::Attributes::OnOff::Id;
@@ -46,15 +58,49 @@ constexpr auto k_timeout_seconds = 300;
 // static const uint16_t s_decryption_key_len = decryption_key_end - decryption_key_start;
 // #endif // CONFIG_ENABLE_ENCRYPTED_OTA
 
+/* Free heap when commissioning completed, 0 if the node was already commissioned at boot */
+static size_t s_commissioned_free_heap;
+
+/* With CONFIG_USE_BLE_ONLY_FOR_COMMISSIONING the BLE stack is deinitialized and its memory, including the static
+ * memory of the controller, goes back to the heap once the node is on a fabric */
+static void app_ble_reclaim_report()
+{
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t reclaimed = s_commissioned_free_heap && free_heap > s_commissioned_free_heap ?
+                         free_heap - s_commissioned_free_heap : 0;
+    ESP_LOGI(TAG, "BLE deinitialized, %" PRIu32 " bytes reclaimed, free heap %u", reclaimed, (unsigned)free_heap);
+#if CONFIG_DIAG_ENABLE_METRICS
+    if (reclaimed == 0) {
+        return;
+    }
+    esp_err_t err = esp_diag_metrics_register("heap", "ble_reclaim", "Heap reclaimed from BLE", "heap",
+                                              ESP_DIAG_DATA_TYPE_UINT);
+    if (err != ESP_OK && err != ESP_FAIL) {
+        ESP_LOGD(TAG, "BLE reclaim metric not registered, err:%d", err);
+        return;
+    }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_add_unit("ble_reclaim", "bytes");
+    esp_diag_metrics_add_uint("ble_reclaim", reclaimed);
+#else
+    esp_diag_metrics_add_unit("heap", "ble_reclaim", "bytes");
+    esp_diag_metrics_report_uint("heap", "ble_reclaim", reclaimed);
+#endif
+#endif
+}
+
 static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
 {
     switch (event->Type) {
     case chip::DeviceLayer::DeviceEventType::kInterfaceIpAddressChanged:
         ESP_LOGI(TAG, "Interface IP Address changed");
+        app_boot_profile_mark(APP_BOOT_PHASE_IP_ADDRESS);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kCommissioningComplete:
         ESP_LOGI(TAG, "Commissioning complete");
+        app_boot_profile_mark(APP_BOOT_PHASE_COMMISSIONING_COMPLETE);
+        s_commissioned_free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
         break;
 
     case chip::DeviceLayer::DeviceEventType::kFailSafeTimerExpired:
@@ -113,7 +159,7 @@ static void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
         break;
 
     case chip::DeviceLayer::DeviceEventType::kBLEDeinitialized:
-        ESP_LOGI(TAG, "BLE deinitialized and memory reclaimed");
+        app_ble_reclaim_report();
         break;
 
     default:
@@ -130,6 +176,18 @@ static esp_err_t app_identification_cb(identification::callback_type_t type, uin
     return ESP_OK;
 }
 
+static esp_err_t app_gpio_set_on_off(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val)
+{
+    gpio_set_level(LED_PIN, val->val.b);
+    return ESP_OK;
+}
+
+/* Sorted by (cluster_id, attribute_id), see app_driver_attribute_table_is_sorted() */
+static constexpr app_driver_attribute_entry_t s_gpio_light_attribute_table[] = {
+    {CLUSTER_ID, ATTRIBUTE_ID, app_gpio_set_on_off},
+};
+static_assert(app_driver_attribute_table_is_sorted(s_gpio_light_attribute_table), "Attribute table must be sorted");
+
 // This callback is called for every attribute update. The callback implementation shall
 // handle the desired attributes and return an appropriate error code. If the attribute
 // is not of your interest, please do not return an error code and strictly return ESP_OK.
@@ -138,28 +196,64 @@ static esp_err_t app_attribute_update_cb(attribute::callback_type_t type, uint16
 {
     esp_err_t err = ESP_OK;
 
-    if (type == PRE_UPDATE && endpoint_id == light_endpoint_id &&
-        cluster_id == CLUSTER_ID && attribute_id == ATTRIBUTE_ID) {
+    if (type == PRE_UPDATE) {
         /* Driver update */
-        // app_driver_handle_t driver_handle = (app_driver_handle_t)priv_data;
-        // err = app_driver_attribute_update(driver_handle, endpoint_id, cluster_id, attribute_id, val);
-        gpio_set_level(LED_PIN, val->val.b);
+        app_driver_handle_t driver_handle = (app_driver_handle_t)priv_data;
+        ESP_DIAG_TRACE_SPAN_BEGIN("attribute_update", cluster_id);
+        err = app_driver_attribute_update(driver_handle, endpoint_id, cluster_id, attribute_id, val);
+        ESP_DIAG_TRACE_SPAN_END("attribute_update", attribute_id);
+    } else if (type == POST_UPDATE) {
+        /* Batched light state persistence */
+        app_persist_attribute_update(endpoint_id, cluster_id, attribute_id, val);
     }
 
     return err;
 }
 
+#if CONFIG_PM_ENABLE
+/* Scale the CPU down while idle and, with tickless idle, sleep between packets. The light driver keeps the chip
+ * awake during transitions, the LEDC output and the button are set up for light sleep by their components, see
+ * sdkconfig.defaults.light_sleep. */
+static void app_pm_init()
+{
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = APP_PM_MIN_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to configure power management, err:%d", err);
+    }
+}
+#endif
+
 extern "C" void app_main()
 {
     esp_err_t err = ESP_OK;
 
     /* Initialize the ESP NVS layer */
     nvs_flash_init();
+    app_boot_profile_mark(APP_BOOT_PHASE_NVS_INIT);
+
+#if CONFIG_PM_ENABLE
+    app_pm_init();
+#endif
+
+    err = app_persist_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Light state persistence disabled, err:%d", err);
+    }
+    app_boot_profile_mark(APP_BOOT_PHASE_PERSIST_INIT);
 
     /* Initialize driver */
-    app_driver_handle_t light_handle = app_driver_light_init();
-    app_driver_handle_t button_handle = app_driver_button_init();
-    app_reset_button_register(button_handle);
+    app_driver_handle_t light_handles[APP_DRIVER_MAX_LIGHTS];
+    int light_count = 0;
+    err = app_driver_light_init(light_handles, &light_count, APP_DRIVER_MAX_LIGHTS);
+    ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to initialize light driver, err:%d", err));
+    app_boot_profile_mark(APP_BOOT_PHASE_LIGHT_INIT);
 
     /* Create a Matter node and add the mandatory Root Node device type on endpoint 0 */
     node::config_t node_config;
@@ -167,37 +261,75 @@ extern "C" void app_main()
     // node handle can be used to add/modify other endpoints.
     node_t *node = node::create(&node_config, app_attribute_update_cb, app_identification_cb);
     ABORT_APP_ON_FAILURE(node != nullptr, ESP_LOGE(TAG, "Failed to create Matter node"));
+    app_boot_profile_mark(APP_BOOT_PHASE_NODE_CREATE);
+
+    endpoint_t *endpoint = nullptr;
+    uint16_t light_endpoint_ids[APP_DRIVER_MAX_LIGHTS];
+    if (light_count == 0) {
+        /* No LEDs on the board, fall back to the on-board light driven directly through LED_PIN */
+        on_off_light::config_t light_config;
+        light_config.on_off.on_off = false;
+        light_config.on_off.lighting.start_up_on_off = false;
+
+        // endpoint handles can be used to add/modify clusters.
+        endpoint = on_off_light::create(node, &light_config, ENDPOINT_FLAG_NONE, NULL);
+        ABORT_APP_ON_FAILURE(endpoint != nullptr, ESP_LOGE(TAG, "Failed to create ESP32 on-board light endpoint"));
+        light_endpoint_ids[0] = endpoint::get_id(endpoint);
+        ESP_LOGI(TAG, "Light created with endpoint_id %d", light_endpoint_ids[0]);
+
+        err = app_driver_register_attribute_table(light_endpoint_ids[0], s_gpio_light_attribute_table,
+                                                  sizeof(s_gpio_light_attribute_table) / sizeof(s_gpio_light_attribute_table[0]));
+        ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to register light attribute table, err:%d", err));
+        err = app_driver_attribute_cache_fill(light_endpoint_ids[0]);
+        ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to cache light attributes, err:%d", err));
+    }
+
+    /* One light endpoint per LED, the driver handle is bound to the endpoint through priv_data */
+    for (int i = 0; i < light_count; i++) {
+        extended_color_light::config_t light_config;
+        light_config.level_control.current_level = DEFAULT_BRIGHTNESS;
+        light_config.level_control.on_level = DEFAULT_BRIGHTNESS;
+        light_config.level_control.lighting.start_up_current_level = DEFAULT_BRIGHTNESS;
+        light_config.color_control.color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
+        light_config.color_control.enhanced_color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
+        light_config.color_control.color_temperature.startup_color_temperature_mireds = nullptr;
+
+        endpoint = extended_color_light::create(node, &light_config, ENDPOINT_FLAG_NONE, light_handles[i]);
+        ABORT_APP_ON_FAILURE(endpoint != nullptr, ESP_LOGE(TAG, "Failed to create light endpoint %d", i));
+
+        light_endpoint_ids[i] = endpoint::get_id(endpoint);
+        ESP_LOGI(TAG, "Light %d created with endpoint_id %d", i, light_endpoint_ids[i]);
+
+        /* Pre-start restore: bring the light back to its last state now rather than after Matter start */
+        app_light_state_t light_state;
+        if (app_persist_get(light_endpoint_ids[i], &light_state) == ESP_OK) {
+            app_driver_light_restore(light_handles[i], &light_state);
+        }
+
+        err = app_driver_light_register(light_endpoint_ids[i]);
+        ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to register light attribute table, err:%d", err));
 
-    // extended_color_light::config_t light_config;
-    // light_config.level_control.current_level = DEFAULT_BRIGHTNESS;
-    // light_config.level_control.on_level = DEFAULT_BRIGHTNESS;
-    // light_config.level_control.lighting.start_up_current_level = DEFAULT_BRIGHTNESS;
-    // light_config.color_control.color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
-    // light_config.color_control.enhanced_color_mode = (uint8_t)ColorControl::ColorMode::kColorTemperature;
-    // light_config.color_control.color_temperature.startup_color_temperature_mireds = nullptr;
-    on_off_light::config_t light_config;
-    light_config.on_off.on_off = false;
-    light_config.on_off.lighting.start_up_on_off = false;
-
-    // endpoint handles can be used to add/modify clusters.
-    // endpoint_t *endpoint = extended_color_light::create(node, &light_config, ENDPOINT_FLAG_NONE, light_handle);
-    endpoint_t *endpoint = on_off_light::create(node, &light_config, ENDPOINT_FLAG_NONE, NULL);
-    ABORT_APP_ON_FAILURE(endpoint != nullptr, ESP_LOGE(TAG, "Failed to create ESP32 on-board light endpoint"));
-    attribute_ref = attribute::get(cluster::get(endpoint, CLUSTER_ID), ATTRIBUTE_ID);
-
-    light_endpoint_id = endpoint::get_id(endpoint);
-    ESP_LOGI(TAG, "Light created with endpoint_id %d", light_endpoint_id);
-
-    /* Mark deferred persistence for some attributes that might be changed rapidly */
-    attribute_t *current_level_attribute = attribute::get(light_endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id);
-    attribute::set_deferred_persistence(current_level_attribute);
-
-    // attribute_t *current_x_attribute = attribute::get(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentX::Id);
-    // attribute::set_deferred_persistence(current_x_attribute);
-    // attribute_t *current_y_attribute = attribute::get(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentY::Id);
-    // attribute::set_deferred_persistence(current_y_attribute);
-    // attribute_t *color_temp_attribute = attribute::get(light_endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id);
-    // attribute::set_deferred_persistence(color_temp_attribute);
+        /* Mark deferred persistence for some attributes that might be changed rapidly */
+        attribute_t *current_level_attribute = attribute::get(light_endpoint_ids[i], LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id);
+        attribute::set_deferred_persistence(current_level_attribute);
+
+        attribute_t *current_x_attribute = attribute::get(light_endpoint_ids[i], ColorControl::Id, ColorControl::Attributes::CurrentX::Id);
+        attribute::set_deferred_persistence(current_x_attribute);
+        attribute_t *current_y_attribute = attribute::get(light_endpoint_ids[i], ColorControl::Id, ColorControl::Attributes::CurrentY::Id);
+        attribute::set_deferred_persistence(current_y_attribute);
+        attribute_t *color_temp_attribute = attribute::get(light_endpoint_ids[i], ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id);
+        attribute::set_deferred_persistence(color_temp_attribute);
+
+        err = app_driver_attribute_cache_fill(light_endpoint_ids[i]);
+        ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to cache light attributes, err:%d", err));
+    }
+
+    app_boot_profile_mark(APP_BOOT_PHASE_ENDPOINTS_CREATE);
+
+    /* The button toggles the first light */
+    app_driver_handle_t button_handle = app_driver_button_init(light_endpoint_ids[0]);
+    app_reset_button_register(button_handle);
+    app_boot_profile_mark(APP_BOOT_PHASE_BUTTON_INIT);
 
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD && CHIP_DEVICE_CONFIG_ENABLE_WIFI_STATION
     // Enable secondary network interface
@@ -214,15 +346,47 @@ extern "C" void app_main()
         .host_config = ESP_OPENTHREAD_DEFAULT_HOST_CONFIG(),
         .port_config = ESP_OPENTHREAD_DEFAULT_PORT_CONFIG(),
     };
+    app_thread_port_config(&config.port_config);
     set_openthread_platform_config(&config);
 #endif
 
+    err = app_ota_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Delta OTA images not accepted, err:%d", err);
+    }
+
+    err = app_group_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Group commands take the regular path, err:%d", err);
+    }
+
+#if CONFIG_MDNS_SHARED_TASK
+    /* mDNS is started by Matter, its actions run on the work queue also used by esp_insights, without an mDNS task */
+    if (esp_rmaker_work_queue_init() == ESP_OK && esp_rmaker_work_queue_start() == ESP_OK) {
+        mdns_executor_set(esp_rmaker_work_queue_add_task);
+    }
+#endif
+
     /* Matter start */
     err = esp_matter::start(app_event_cb);
     ABORT_APP_ON_FAILURE(err == ESP_OK, ESP_LOGE(TAG, "Failed to start Matter, err:%d", err));
+    app_boot_profile_mark(APP_BOOT_PHASE_MATTER_START);
 
     /* Starting driver with default values */
-    app_driver_light_set_defaults(light_endpoint_id);
+    for (int i = 0; i < light_count; i++) {
+        app_driver_light_set_defaults(light_endpoint_ids[i]);
+    }
+    app_boot_profile_mark(APP_BOOT_PHASE_LIGHT_DEFAULTS);
+
+    err = app_mdns_metrics_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "mDNS metrics not reported, err:%d", err);
+    }
+
+    err = app_thread_queues_init();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "OpenThread load not monitored, err:%d", err);
+    }
 
 #if CONFIG_ENABLE_ENCRYPTED_OTA
     err = esp_matter_ota_requestor_encrypted_init(s_decryption_key, s_decryption_key_len);
@@ -231,6 +395,14 @@ extern "C" void app_main()
 
 #if CONFIG_ENABLE_CHIP_SHELL
     esp_matter::console::diagnostics_register_commands();
+    app_boot_profile_register_commands();
+    app_latency_register_commands();
+    app_perf_register_commands();
+#if CONFIG_DIAG_ENABLE_TRACE
+    app_trace_register_commands();
+#endif
+    app_driver_scene_register_commands();
+    app_thread_queues_register_commands();
     esp_matter::console::wifi_register_commands();
     esp_matter::console::factoryreset_register_commands();
 #if CONFIG_OPENTHREAD_CLI
@@ -0,0 +1,121 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stddef.h>
+
+#include <app_priv.h>
+
+#if CONFIG_DIAG_ENABLE_METRICS && CONFIG_MDNS_ENABLE_STATS
+#include <esp_diagnostics_metrics.h>
+#include <mdns.h>
+
+static const char *TAG = "app_mdns_metrics";
+
+#define MDNS_METRICS_TAG "mdns"
+#define MDNS_METRICS_PERIOD_US (60 * 1000 * 1000)
+
+typedef struct {
+    const char *key;
+    const char *label;
+    const char *unit;
+    size_t offset;
+} mdns_metric_t;
+
+static const mdns_metric_t s_metrics[] = {
+    {"mdns_rx", "mDNS packets received", "packets", offsetof(mdns_stats_t, rx_packets)},
+    {"mdns_rx_q", "mDNS questions received", "questions", offsetof(mdns_stats_t, rx_questions)},
+    {"mdns_rx_drop", "mDNS packets dropped", "packets", offsetof(mdns_stats_t, rx_dropped)},
+    {"mdns_tx_ans", "mDNS answers sent", "answers", offsetof(mdns_stats_t, tx_answers)},
+    {"mdns_tx_supp", "mDNS answers suppressed", "answers", offsetof(mdns_stats_t, tx_suppressed)},
+    {"mdns_tx_bytes", "mDNS bytes sent", "bytes", offsetof(mdns_stats_t, tx_bytes)},
+    {"mdns_conflict", "mDNS probe conflicts", "conflicts", offsetof(mdns_stats_t, probe_conflicts)},
+};
+
+#define MDNS_METRICS_NUM (sizeof(s_metrics) / sizeof(s_metrics[0]))
+
+static esp_timer_handle_t s_timer;
+static mdns_stats_t s_last;
+static bool s_registered;
+static esp_diag_metrics_handle_t s_handles[MDNS_METRICS_NUM];
+
+static uint32_t app_mdns_metrics_counter(const mdns_stats_t *stats, const mdns_metric_t *metric)
+{
+    return *(const uint32_t *)((const uint8_t *)stats + metric->offset);
+}
+
+static bool app_mdns_metrics_register()
+{
+    /* Metrics can only be registered once esp_insights (or esp_diag_metrics_init()) is up, so do it lazily */
+    for (size_t i = 0; i < MDNS_METRICS_NUM; i++) {
+        if (s_handles[i]) {
+            /* Registered by an earlier attempt */
+            continue;
+        }
+        esp_err_t err = esp_diag_metrics_register_with_handle(MDNS_METRICS_TAG, s_metrics[i].key, s_metrics[i].label,
+                                                              "mdns", ESP_DIAG_DATA_TYPE_UINT, &s_handles[i]);
+        if (err != ESP_OK) {
+            ESP_LOGD(TAG, "mDNS metric not registered, err:%d", err);
+            return false;
+        }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_add_unit(s_metrics[i].key, s_metrics[i].unit);
+#else
+        esp_diag_metrics_add_unit(MDNS_METRICS_TAG, s_metrics[i].key, s_metrics[i].unit);
+#endif
+    }
+    return true;
+}
+
+static void app_mdns_metrics_report(void *arg)
+{
+    mdns_stats_t stats;
+    if (mdns_stats_get(NULL, &stats) != ESP_OK) {
+        /* mDNS is not running, e.g. Matter uses its minimal mDNS */
+        return;
+    }
+    if (!s_registered) {
+        s_registered = app_mdns_metrics_register();
+        if (!s_registered) {
+            return;
+        }
+    }
+    /* Each report carries the counts of the last period, so that storms show up as spikes */
+    for (size_t i = 0; i < MDNS_METRICS_NUM; i++) {
+        uint32_t count = app_mdns_metrics_counter(&stats, &s_metrics[i]) - app_mdns_metrics_counter(&s_last, &s_metrics[i]);
+        esp_diag_metrics_add_uint_by_handle(s_handles[i], count);
+    }
+    s_last = stats;
+}
+
+esp_err_t app_mdns_metrics_init()
+{
+    if (s_timer) {
+        return ESP_OK;
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = app_mdns_metrics_report,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mdns_metrics",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the mDNS metrics timer, err:%d", err);
+        return err;
+    }
+    return esp_timer_start_periodic(s_timer, MDNS_METRICS_PERIOD_US);
+}
+#else
+esp_err_t app_mdns_metrics_init()
+{
+    return ESP_OK;
+}
+#endif
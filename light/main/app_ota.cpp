@@ -0,0 +1,714 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <app_priv.h>
+
+#if CONFIG_ENABLE_OTA_REQUESTOR && !CONFIG_ENABLE_ENCRYPTED_OTA
+#include <esp_app_format.h>
+#include <esp_delta_ota.h>
+#include <esp_diagnostics_spans.h>
+#include <esp_matter_ota.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <app/clusters/ota-requestor/ExtendedOTARequestorDriver.h>
+#include <app/clusters/ota-requestor/OTADownloader.h>
+#include <app/clusters/ota-requestor/OTARequestorInterface.h>
+#include <lib/core/OTAImageHeader.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <platform/ESP32/ESP32Utils.h>
+#include <platform/OTAImageProcessor.h>
+
+using namespace chip;
+using namespace chip::DeviceLayer;
+
+static const char *TAG = "app_ota";
+
+/* Header of the patches made by esp_delta_ota_patch_gen.py: magic, SHA-256 of the base image, reserved */
+#define DELTA_OTA_MAGIC 0xfccdde10
+#define DELTA_OTA_HEADER_SIZE 64
+#define DELTA_OTA_DIGEST_OFFSET 4
+#define DELTA_OTA_DIGEST_SIZE 32
+
+#define APP_OTA_REBOOT_DELAY_MS 2000
+#define APP_OTA_WRITER_STACK 4096
+#define APP_OTA_WRITER_PRIORITY 4
+#define APP_OTA_ERASER_STACK 3072
+#define APP_OTA_ERASER_PRIORITY (tskIDLE_PRIORITY + 1)
+/* Erased flash is checked in pieces of this size before a sector is erased */
+#define APP_OTA_ERASER_CHECK_SIZE 256
+
+static_assert(APP_OTA_WRITER_BLOCKS >= 2 && APP_OTA_WRITER_BLOCKS <= 32, "The free blocks are a 32 bit mask");
+
+/* The payload after the Matter OTA image header is either an app image or a delta OTA patch of the running one */
+typedef enum {
+    APP_OTA_PAYLOAD_UNKNOWN,
+    APP_OTA_PAYLOAD_FULL,
+    APP_OTA_PAYLOAD_DELTA,
+} app_ota_payload_t;
+
+/* Everything touching the flash or the patch is done by the writer task, in the order the requestor asked for it */
+typedef enum {
+    APP_OTA_OP_PREPARE,
+    APP_OTA_OP_WRITE,
+    APP_OTA_OP_FINALIZE,
+    APP_OTA_OP_APPLY,
+    APP_OTA_OP_ABORT,
+} app_ota_op_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t block;
+    uint16_t len;
+} app_ota_msg_t;
+
+/* Proposes larger blocks than the BDX default of 1024 bytes, the provider may still pick smaller ones */
+class AppOTARequestorDriver : public ExtendedOTARequestorDriver
+{
+public:
+    uint16_t GetMaxDownloadBlockSize() override { return APP_OTA_BDX_BLOCK_SIZE; }
+};
+
+class AppOTAImageProcessor : public OTAImageProcessorInterface
+{
+public:
+    CHIP_ERROR PrepareDownload() override;
+    CHIP_ERROR Finalize() override;
+    CHIP_ERROR Apply() override;
+    CHIP_ERROR Abort() override;
+    CHIP_ERROR ProcessBlock(ByteSpan &block) override;
+    bool IsFirstImageRun() override;
+    CHIP_ERROR ConfirmCurrentImage() override;
+
+    void SetOTADownloader(OTADownloader *downloader) { m_downloader = downloader; }
+
+private:
+    static void WriterTask(void *arg);
+    static void HandlePrepared(intptr_t context);
+    static void HandleFetchNext(intptr_t context);
+    static void HandleApplied(intptr_t context);
+    static void HandleRestart(System::Layer *layer, void *context);
+    static esp_err_t DeltaWrite(const uint8_t *buf, size_t size, void *user_data);
+
+    CHIP_ERROR Send(app_ota_op_t op, uint8_t block = 0, uint16_t len = 0);
+    void ReturnBlock(uint8_t block);
+    void Prepare();
+    void Write(const app_ota_msg_t &msg);
+    void FinalizeImage();
+    void ApplyImage();
+    esp_err_t ProcessHeader(ByteSpan &block);
+    esp_err_t ProcessPayload(ByteSpan &block);
+    esp_err_t StartPayload();
+    esp_err_t WriteImage(const uint8_t *buf, size_t size);
+    void Cleanup();
+
+    OTADownloader *m_downloader = nullptr;
+    TaskHandle_t m_task = nullptr;
+    QueueHandle_t m_queue = nullptr;
+    uint8_t *m_blocks = nullptr;                /* APP_OTA_WRITER_BLOCKS of APP_OTA_BDX_BLOCK_SIZE, while downloading */
+    portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t m_free_blocks = 0;                 /* Mask of the blocks not queued to the writer */
+    bool m_fetch_pending = false;               /* The next block is asked for once a block is free */
+    volatile bool m_aborting = false;           /* Queued writes are dropped */
+    volatile esp_err_t m_error = ESP_OK;        /* Set by the writer, ends the download at the next fetch */
+
+    /* Owned by the writer task */
+    OTAImageHeaderParser m_header_parser;
+    const esp_partition_t *m_partition = nullptr;
+    esp_ota_handle_t m_ota_handle = 0;
+    size_t m_written = 0;
+    size_t m_erased = 0;                        /* Erased from the start of m_partition, written up to m_written */
+    esp_delta_ota_handle_t m_delta_handle = nullptr;
+    app_ota_payload_t m_payload = APP_OTA_PAYLOAD_UNKNOWN;
+    uint8_t m_payload_head[DELTA_OTA_HEADER_SIZE]; /* Start of the payload, until its kind is known */
+    size_t m_payload_head_len = 0;
+};
+
+static AppOTARequestorDriver s_requestor_driver;
+static AppOTAImageProcessor s_image_processor;
+
+/*
+ * The update partition is erased in the background, a sector at a time, so that a download does not wait for the
+ * erases. It starts once the running image is confirmed, the update partition holds the image to roll back to until
+ * then, and ends for good when a download starts, which takes over the part erased.
+ */
+static struct {
+    SemaphoreHandle_t lock;                     /* Held during each erase */
+    const esp_partition_t *partition;
+    size_t erased;                              /* From the start of the partition */
+    bool ended;
+} s_pre_erase;
+
+static bool app_ota_sector_is_erased(const esp_partition_t *partition, size_t offset)
+{
+    uint32_t buf[APP_OTA_ERASER_CHECK_SIZE / sizeof(uint32_t)];
+    for (size_t pos = 0; pos < SPI_FLASH_SEC_SIZE; pos += sizeof(buf)) {
+        /* Raw, erased flash does not read as 0xff through the flash encryption */
+        if (esp_partition_read_raw(partition, offset + pos, buf, sizeof(buf)) != ESP_OK) {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(buf) / sizeof(buf[0]); i++) {
+            if (buf[i] != UINT32_MAX) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void app_ota_pre_erase_task(void *arg)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    do {
+        vTaskDelay(pdMS_TO_TICKS(APP_OTA_PRE_ERASE_DELAY_MS));
+    } while (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY);
+
+    size_t erases = 0;
+    while (true) {
+        xSemaphoreTake(s_pre_erase.lock, portMAX_DELAY);
+        bool done = s_pre_erase.ended || s_pre_erase.erased >= s_pre_erase.partition->size;
+        if (!done) {
+            /* Sectors left erased since the last boot are not worn again */
+            if (app_ota_sector_is_erased(s_pre_erase.partition, s_pre_erase.erased)) {
+                s_pre_erase.erased += SPI_FLASH_SEC_SIZE;
+            } else if (esp_partition_erase_range(s_pre_erase.partition, s_pre_erase.erased, SPI_FLASH_SEC_SIZE) == ESP_OK) {
+                s_pre_erase.erased += SPI_FLASH_SEC_SIZE;
+                erases++;
+            } else {
+                done = true;
+            }
+        }
+        xSemaphoreGive(s_pre_erase.lock);
+        if (done) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(APP_OTA_PRE_ERASE_INTERVAL_MS));
+    }
+    ESP_LOGI(TAG, "%s erased up to %u KB ahead of the next OTA, %u sectors needed it",
+             s_pre_erase.partition->label, (unsigned)(s_pre_erase.erased / 1024), (unsigned)erases);
+    vTaskDelete(NULL);
+}
+
+static void app_ota_pre_erase_start()
+{
+    s_pre_erase.partition = esp_ota_get_next_update_partition(NULL);
+    if (s_pre_erase.partition == nullptr) {
+        return;
+    }
+    s_pre_erase.lock = xSemaphoreCreateMutex();
+    if (s_pre_erase.lock == nullptr ||
+            xTaskCreate(app_ota_pre_erase_task, "app_ota_eraser", APP_OTA_ERASER_STACK, nullptr, APP_OTA_ERASER_PRIORITY,
+                        nullptr) != pdPASS) {
+        ESP_LOGW(TAG, "The update partition is erased during the OTA");
+    }
+}
+
+/* Ends the background erase, returns how much of the partition it erased */
+static size_t app_ota_pre_erase_end(const esp_partition_t *partition)
+{
+    if (s_pre_erase.lock == nullptr) {
+        return 0;
+    }
+    xSemaphoreTake(s_pre_erase.lock, portMAX_DELAY);
+    size_t erased = !s_pre_erase.ended && s_pre_erase.partition == partition ? s_pre_erase.erased : 0;
+    s_pre_erase.ended = true;
+    xSemaphoreGive(s_pre_erase.lock);
+    return erased;
+}
+
+CHIP_ERROR AppOTAImageProcessor::Send(app_ota_op_t op, uint8_t block, uint16_t len)
+{
+    app_ota_msg_t msg = { (uint8_t)op, block, len };
+    /* The queue has room for a write per block and a few other operations, it never waits */
+    if (xQueueSend(m_queue, &msg, 0) != pdTRUE) {
+        return CHIP_ERROR_NO_MEMORY;
+    }
+    return CHIP_NO_ERROR;
+}
+
+CHIP_ERROR AppOTAImageProcessor::PrepareDownload()
+{
+    if (m_downloader == nullptr) {
+        ESP_LOGE(TAG, "No OTA downloader");
+        return CHIP_ERROR_INCORRECT_STATE;
+    }
+    /* The writer is started by the first download and kept, its blocks only live during a download */
+    if (m_queue == nullptr) {
+        m_queue = xQueueCreate(APP_OTA_WRITER_BLOCKS + 4, sizeof(app_ota_msg_t));
+        if (m_queue == nullptr) {
+            return CHIP_ERROR_NO_MEMORY;
+        }
+    }
+    if (m_task == nullptr &&
+            xTaskCreatePinnedToCore(WriterTask, "app_ota_writer", APP_OTA_WRITER_STACK, this, APP_OTA_WRITER_PRIORITY,
+                                    &m_task, APP_CORE_NETWORK) != pdPASS) {
+        m_task = nullptr;
+        return CHIP_ERROR_NO_MEMORY;
+    }
+    /* Until prepared, writes left from an earlier download are dropped */
+    m_aborting = true;
+    return Send(APP_OTA_OP_PREPARE);
+}
+
+CHIP_ERROR AppOTAImageProcessor::Finalize()
+{
+    return Send(APP_OTA_OP_FINALIZE);
+}
+
+CHIP_ERROR AppOTAImageProcessor::Apply()
+{
+    return Send(APP_OTA_OP_APPLY);
+}
+
+CHIP_ERROR AppOTAImageProcessor::Abort()
+{
+    if (m_queue == nullptr) {
+        return CHIP_NO_ERROR;
+    }
+    m_aborting = true;
+    return Send(APP_OTA_OP_ABORT);
+}
+
+CHIP_ERROR AppOTAImageProcessor::ProcessBlock(ByteSpan &block)
+{
+    if (block.size() > APP_OTA_BDX_BLOCK_SIZE) {
+        ESP_LOGE(TAG, "OTA block of %u bytes is too large", (unsigned)block.size());
+        return CHIP_ERROR_INVALID_ARGUMENT;
+    }
+
+    /* The block is only valid during the call, it is copied to a free block of the writer */
+    int index = -1;
+    taskENTER_CRITICAL(&m_lock);
+    if (m_free_blocks) {
+        index = __builtin_ctz(m_free_blocks);
+        m_free_blocks &= ~(1U << index);
+    }
+    taskEXIT_CRITICAL(&m_lock);
+    if (index < 0) {
+        /* Blocks are only asked for while one is free, so the download is not prepared */
+        return CHIP_ERROR_INCORRECT_STATE;
+    }
+    memcpy(m_blocks + index * APP_OTA_BDX_BLOCK_SIZE, block.data(), block.size());
+    mParams.downloadedBytes += block.size();
+    ReturnErrorOnFailure(Send(APP_OTA_OP_WRITE, index, block.size()));
+
+    /* The next block is asked for right away, it comes over the network while this one is written to flash */
+    bool fetch = false;
+    taskENTER_CRITICAL(&m_lock);
+    if (m_free_blocks) {
+        fetch = true;
+    } else {
+        m_fetch_pending = true;
+    }
+    taskEXIT_CRITICAL(&m_lock);
+    if (fetch) {
+        PlatformMgr().ScheduleWork(HandleFetchNext, reinterpret_cast<intptr_t>(this));
+    }
+    return CHIP_NO_ERROR;
+}
+
+bool AppOTAImageProcessor::IsFirstImageRun()
+{
+    OTARequestorInterface *requestor = GetRequestorInstance();
+    if (requestor == nullptr) {
+        return false;
+    }
+    return requestor->GetCurrentUpdateState() == OTARequestorInterface::OTAUpdateStateEnum::kApplying;
+}
+
+CHIP_ERROR AppOTAImageProcessor::ConfirmCurrentImage()
+{
+    OTARequestorInterface *requestor = GetRequestorInstance();
+    if (requestor == nullptr) {
+        return CHIP_ERROR_INTERNAL;
+    }
+    uint32_t current_version;
+    ReturnErrorOnFailure(ConfigurationMgr().GetSoftwareVersion(current_version));
+    if (current_version != requestor->GetTargetVersion()) {
+        return CHIP_ERROR_INCORRECT_STATE;
+    }
+    return CHIP_NO_ERROR;
+}
+
+void AppOTAImageProcessor::HandlePrepared(intptr_t context)
+{
+    AppOTAImageProcessor *self = reinterpret_cast<AppOTAImageProcessor *>(context);
+    esp_err_t err = self->m_error;
+    self->m_downloader->OnPreparedForDownload(err == ESP_OK ? CHIP_NO_ERROR : ESP32Utils::MapError(err));
+}
+
+void AppOTAImageProcessor::HandleFetchNext(intptr_t context)
+{
+    AppOTAImageProcessor *self = reinterpret_cast<AppOTAImageProcessor *>(context);
+    if (self->m_error != ESP_OK) {
+        self->m_downloader->EndDownload(CHIP_ERROR_WRITE_FAILED);
+        return;
+    }
+    self->m_downloader->FetchNextData();
+}
+
+void AppOTAImageProcessor::HandleApplied(intptr_t context)
+{
+    ESP_LOGI(TAG, "Applying the OTA image, rebooting in %d ms", APP_OTA_REBOOT_DELAY_MS);
+    SystemLayer().StartTimer(System::Clock::Milliseconds32(APP_OTA_REBOOT_DELAY_MS), HandleRestart, nullptr);
+}
+
+void AppOTAImageProcessor::HandleRestart(System::Layer *layer, void *context)
+{
+    esp_restart();
+}
+
+void AppOTAImageProcessor::ReturnBlock(uint8_t block)
+{
+    bool fetch;
+    taskENTER_CRITICAL(&m_lock);
+    m_free_blocks |= 1U << block;
+    fetch = m_fetch_pending;
+    m_fetch_pending = false;
+    taskEXIT_CRITICAL(&m_lock);
+    if (fetch) {
+        PlatformMgr().ScheduleWork(HandleFetchNext, reinterpret_cast<intptr_t>(this));
+    }
+}
+
+void AppOTAImageProcessor::Cleanup()
+{
+    if (m_delta_handle) {
+        esp_delta_ota_deinit(m_delta_handle);
+        m_delta_handle = nullptr;
+    }
+    if (m_ota_handle) {
+        esp_ota_abort(m_ota_handle);
+        m_ota_handle = 0;
+    }
+    m_header_parser.Clear();
+    taskENTER_CRITICAL(&m_lock);
+    m_free_blocks = 0;
+    m_fetch_pending = false;
+    taskEXIT_CRITICAL(&m_lock);
+    free(m_blocks);
+    m_blocks = nullptr;
+}
+
+void AppOTAImageProcessor::Prepare()
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    Cleanup();
+    m_payload = APP_OTA_PAYLOAD_UNKNOWN;
+    m_payload_head_len = 0;
+    m_written = 0;
+    m_partition = esp_ota_get_next_update_partition(NULL);
+    if (m_partition) {
+        /* esp_ota_begin() erases the size it is given only, the rest is erased by WriteImage() unless already done */
+        m_erased = app_ota_pre_erase_end(m_partition);
+        if (m_erased < SPI_FLASH_SEC_SIZE) {
+            m_erased = SPI_FLASH_SEC_SIZE;
+        }
+        m_blocks = (uint8_t *)malloc(APP_OTA_WRITER_BLOCKS * APP_OTA_BDX_BLOCK_SIZE);
+        err = m_blocks ? esp_ota_begin(m_partition, SPI_FLASH_SEC_SIZE, &m_ota_handle) : ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK) {
+        m_header_parser.Init();
+        mParams.downloadedBytes = 0;
+        taskENTER_CRITICAL(&m_lock);
+        m_free_blocks = (uint32_t)((1ULL << APP_OTA_WRITER_BLOCKS) - 1);
+        taskEXIT_CRITICAL(&m_lock);
+        m_aborting = false;
+    } else {
+        ESP_LOGE(TAG, "Failed to start the OTA, err:%d", err);
+        m_ota_handle = 0;
+        Cleanup();
+    }
+    m_error = err;
+    PlatformMgr().ScheduleWork(HandlePrepared, reinterpret_cast<intptr_t>(this));
+}
+
+void AppOTAImageProcessor::Write(const app_ota_msg_t &msg)
+{
+    if (m_aborting || m_blocks == nullptr) {
+        /* The blocks are freed with the download */
+        return;
+    }
+    if (m_error == ESP_OK) {
+        ByteSpan block(m_blocks + msg.block * APP_OTA_BDX_BLOCK_SIZE, msg.len);
+        esp_err_t err = ProcessHeader(block);
+        if (err == ESP_OK) {
+            err = ProcessPayload(block);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write the OTA image, err:%d", err);
+            m_error = err;
+        }
+    }
+    ReturnBlock(msg.block);
+}
+
+void AppOTAImageProcessor::FinalizeImage()
+{
+    esp_err_t err = m_error;
+    if (err == ESP_OK && m_payload == APP_OTA_PAYLOAD_DELTA) {
+        err = esp_delta_ota_finalize(m_delta_handle);
+        esp_delta_ota_deinit(m_delta_handle);
+        m_delta_handle = nullptr;
+    } else if (err == ESP_OK && m_payload != APP_OTA_PAYLOAD_FULL) {
+        ESP_LOGE(TAG, "OTA image ended before its payload");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_end(m_ota_handle);
+        m_ota_handle = 0;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to finalize the OTA image, err:%d", err);
+    } else {
+        ESP_LOGI(TAG, "OTA image downloaded to %s", m_partition->label);
+    }
+    m_error = err;
+    Cleanup();
+}
+
+void AppOTAImageProcessor::ApplyImage()
+{
+    if (m_error != ESP_OK || m_partition == NULL) {
+        ESP_LOGE(TAG, "No OTA image to apply");
+        return;
+    }
+    esp_err_t err = esp_ota_set_boot_partition(m_partition);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed, err:%d", err);
+        return;
+    }
+    PlatformMgr().ScheduleWork(HandleApplied, reinterpret_cast<intptr_t>(this));
+}
+
+void AppOTAImageProcessor::WriterTask(void *arg)
+{
+    AppOTAImageProcessor *self = static_cast<AppOTAImageProcessor *>(arg);
+    app_ota_msg_t msg;
+    while (true) {
+        if (xQueueReceive(self->m_queue, &msg, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        switch (msg.op) {
+        case APP_OTA_OP_PREPARE:
+            self->Prepare();
+            break;
+        case APP_OTA_OP_WRITE: {
+            ESP_DIAG_SPAN_BEGIN(ota_write);
+            self->Write(msg);
+            ESP_DIAG_SPAN_END(ota_write);
+            break;
+        }
+        case APP_OTA_OP_FINALIZE:
+            self->FinalizeImage();
+            break;
+        case APP_OTA_OP_APPLY:
+            self->ApplyImage();
+            break;
+        case APP_OTA_OP_ABORT:
+            ESP_LOGI(TAG, "OTA image download aborted");
+            self->Cleanup();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+esp_err_t AppOTAImageProcessor::ProcessHeader(ByteSpan &block)
+{
+    if (m_header_parser.IsInitialized()) {
+        OTAImageHeader header;
+        CHIP_ERROR err = m_header_parser.AccumulateAndDecode(block, header);
+        /* More data is needed to decode the header */
+        if (err == CHIP_ERROR_BUFFER_TOO_SMALL) {
+            return ESP_OK;
+        }
+        if (err != CHIP_NO_ERROR) {
+            ESP_LOGE(TAG, "Failed to process the OTA image header");
+            return ESP_ERR_INVALID_ARG;
+        }
+        mParams.totalFileBytes = header.mPayloadSize;
+        m_header_parser.Clear();
+    }
+    return ESP_OK;
+}
+
+/* Erases the sectors written to past the ones erased, as esp_ota_write() does with OTA_WITH_SEQUENTIAL_WRITES */
+esp_err_t AppOTAImageProcessor::WriteImage(const uint8_t *buf, size_t size)
+{
+    size_t end = m_written + size;
+    if (end > m_erased && m_erased < m_partition->size) {
+        size_t erase_end = (end + SPI_FLASH_SEC_SIZE - 1) & ~(size_t)(SPI_FLASH_SEC_SIZE - 1);
+        if (erase_end > m_partition->size) {
+            erase_end = m_partition->size;
+        }
+        esp_err_t err = esp_partition_erase_range(m_partition, m_erased, erase_end - m_erased);
+        if (err != ESP_OK) {
+            return err;
+        }
+        m_erased = erase_end;
+    }
+    esp_err_t err = esp_ota_write(m_ota_handle, buf, size);
+    if (err == ESP_OK) {
+        m_written = end;
+    }
+    return err;
+}
+
+esp_err_t AppOTAImageProcessor::DeltaWrite(const uint8_t *buf, size_t size, void *user_data)
+{
+    AppOTAImageProcessor *self = static_cast<AppOTAImageProcessor *>(user_data);
+    return self->WriteImage(buf, size);
+}
+
+/*
+ * Reads the SHA-256 esptool appends to an app image, which the bootloader checked the running image against. Much
+ * cheaper than esp_partition_get_sha256(), which hashes all of the image again.
+ */
+static esp_err_t app_ota_read_image_sha256(const esp_partition_t *partition, uint8_t *sha256)
+{
+    esp_image_header_t header;
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (header.magic != ESP_IMAGE_HEADER_MAGIC || header.hash_appended != 1) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t offset = sizeof(header);
+    for (int i = 0; i < header.segment_count; i++) {
+        esp_image_segment_header_t segment;
+        err = esp_partition_read(partition, offset, &segment, sizeof(segment));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (segment.data_len > partition->size - offset - sizeof(segment)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        offset += sizeof(segment) + segment.data_len;
+    }
+    /* The checksum ends the segments on a 16 byte boundary */
+    offset = (offset + 16) & ~(size_t)15;
+    if (offset > partition->size - DELTA_OTA_DIGEST_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return esp_partition_read(partition, offset, sha256, DELTA_OTA_DIGEST_SIZE);
+}
+
+/* Called once the start of the payload tells its kind, writes or checks what was held back */
+esp_err_t AppOTAImageProcessor::StartPayload()
+{
+    uint32_t magic;
+    memcpy(&magic, m_payload_head, sizeof(magic));
+    if (magic != DELTA_OTA_MAGIC) {
+        /* Not a patch, esp_ota_write() checks that it is an app image */
+        m_payload = APP_OTA_PAYLOAD_FULL;
+        return WriteImage(m_payload_head, m_payload_head_len);
+    }
+    if (m_payload_head_len < DELTA_OTA_HEADER_SIZE) {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    uint8_t sha256[DELTA_OTA_DIGEST_SIZE];
+    esp_err_t err = app_ota_read_image_sha256(running, sha256);
+    if (err == ESP_ERR_NOT_FOUND) {
+        err = esp_partition_get_sha256(running, sha256);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(sha256, m_payload_head + DELTA_OTA_DIGEST_OFFSET, DELTA_OTA_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Delta OTA image is not a patch of the running firmware");
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    esp_delta_ota_cfg_t cfg = {};
+    cfg.user_data = this;
+    cfg.write_cb_with_user_data = DeltaWrite;
+    cfg.src_partition = running;
+    m_delta_handle = esp_delta_ota_init(&cfg);
+    if (m_delta_handle == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Delta OTA image, patching %s", running->label);
+    m_payload = APP_OTA_PAYLOAD_DELTA;
+    return ESP_OK;
+}
+
+esp_err_t AppOTAImageProcessor::ProcessPayload(ByteSpan &block)
+{
+    const uint8_t *data = block.data();
+    size_t len = block.size();
+
+    if (m_payload == APP_OTA_PAYLOAD_UNKNOWN) {
+        /* The kind is told by the first 4 bytes, a patch header is only checked once complete */
+        size_t want = m_payload_head_len < sizeof(uint32_t) ? sizeof(uint32_t) : DELTA_OTA_HEADER_SIZE;
+        size_t copy = want - m_payload_head_len < len ? want - m_payload_head_len : len;
+        memcpy(m_payload_head + m_payload_head_len, data, copy);
+        m_payload_head_len += copy;
+        data += copy;
+        len -= copy;
+        if (m_payload_head_len < sizeof(uint32_t)) {
+            return ESP_OK;
+        }
+        esp_err_t err = StartPayload();
+        if (err != ESP_OK || m_payload == APP_OTA_PAYLOAD_UNKNOWN) {
+            /* Still within the patch header, unless the rest of the block fills it */
+            if (err != ESP_OK || len == 0) {
+                return err;
+            }
+            ByteSpan rest(data, len);
+            return ProcessPayload(rest);
+        }
+    }
+
+    if (len == 0) {
+        return ESP_OK;
+    }
+    if (m_payload == APP_OTA_PAYLOAD_DELTA) {
+        return esp_delta_ota_feed_patch(m_delta_handle, data, len);
+    }
+    return WriteImage(data, len);
+}
+
+esp_err_t app_ota_init()
+{
+    esp_matter_ota_requestor_impl_t impl = {};
+    /* esp_matter hands its BDX downloader over to the image processor with SetOTADownloader() */
+    impl.driver = &s_requestor_driver;
+    impl.image_processor = &s_image_processor;
+    esp_err_t err = esp_matter_ota_requestor_set_config(impl);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set the OTA image processor, err:%d", err);
+        return err;
+    }
+    app_ota_pre_erase_start();
+    return ESP_OK;
+}
+
+#else /* CONFIG_ENABLE_OTA_REQUESTOR && !CONFIG_ENABLE_ENCRYPTED_OTA */
+
+esp_err_t app_ota_init()
+{
+    /* The encrypted OTA is handled by the esp_matter image processor, which takes full images only */
+    return ESP_OK;
+}
+
+#endif /* CONFIG_ENABLE_OTA_REQUESTOR && !CONFIG_ENABLE_ENCRYPTED_OTA */
@@ -0,0 +1,250 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_rom_sys.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_diagnostics_heap_tags.h>
+#include <esp_diagnostics_spans.h>
+#include <esp_diagnostics_trace.h>
+#include <esp_matter.h>
+#include <esp_matter_console.h>
+#include <iot_button.h>
+#include <mdns.h>
+#if CONFIG_ESP_INSIGHTS_ENABLED
+#include <esp_diag_data_store.h>
+#endif
+
+#include <app_priv.h>
+
+#if CONFIG_ENABLE_CHIP_SHELL
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define PERF_TASKS_MAX 32
+
+#ifndef configRUN_TIME_COUNTER_TYPE
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+#endif
+
+typedef struct {
+    UBaseType_t task_number;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} perf_task_sample_t;
+
+/* Run time of the tasks at the previous `perf tasks`, by task number */
+static perf_task_sample_t s_prev_tasks[PERF_TASKS_MAX];
+static size_t s_prev_tasks_count;
+static configRUN_TIME_COUNTER_TYPE s_prev_total;
+
+static configRUN_TIME_COUNTER_TYPE perf_prev_run_time(UBaseType_t task_number)
+{
+    for (size_t i = 0; i < s_prev_tasks_count; i++) {
+        if (s_prev_tasks[i].task_number == task_number) {
+            return s_prev_tasks[i].run_time;
+        }
+    }
+    return 0;
+}
+#endif
+
+static void perf_dump_tasks()
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    UBaseType_t count = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = (TaskStatus_t *)calloc(count, sizeof(TaskStatus_t));
+    if (!tasks) {
+        printf("tasks: no memory\n");
+        return;
+    }
+    configRUN_TIME_COUNTER_TYPE total;
+    count = uxTaskGetSystemState(tasks, count, &total);
+
+    /* The total is the time of one core, every core ran a task all along */
+    uint64_t elapsed = (uint64_t)(configRUN_TIME_COUNTER_TYPE)(total - s_prev_total) * portNUM_PROCESSORS;
+    printf("%-16s %6s %8s %6s\n", "task", "prio", "stack", "cpu");
+    for (UBaseType_t i = 0; i < count; i++) {
+        configRUN_TIME_COUNTER_TYPE delta = tasks[i].ulRunTimeCounter - perf_prev_run_time(tasks[i].xTaskNumber);
+        uint32_t permille = elapsed ? (uint32_t)((uint64_t)delta * 1000 / elapsed) : 0;
+        printf("%-16s %6u %8" PRIu32 " %3" PRIu32 ".%" PRIu32 "%%\n", tasks[i].pcTaskName,
+               (unsigned)tasks[i].uxCurrentPriority, (uint32_t)tasks[i].usStackHighWaterMark, permille / 10,
+               permille % 10);
+    }
+
+    s_prev_tasks_count = 0;
+    for (UBaseType_t i = 0; i < count && s_prev_tasks_count < PERF_TASKS_MAX; i++) {
+        s_prev_tasks[s_prev_tasks_count++] = { tasks[i].xTaskNumber, tasks[i].ulRunTimeCounter };
+    }
+    s_prev_total = total;
+    free(tasks);
+#else
+    printf("tasks: enable CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS\n");
+#endif
+}
+
+#if CONFIG_DIAG_HEAP_TAGS
+static void perf_print_heap_tag_cb(const esp_diag_heap_tag_stats_t *stats, void *arg)
+{
+    printf("%-10s %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", stats->tag, stats->bytes, stats->peak, stats->allocs);
+}
+#endif
+
+static void perf_dump_heap()
+{
+    static const struct {
+        const char *name;
+        uint32_t caps;
+    } s_heaps[] = {
+        { "internal", MALLOC_CAP_INTERNAL },
+        { "dma", MALLOC_CAP_DMA },
+#if CONFIG_SPIRAM || CONFIG_ESP32_SPIRAM_SUPPORT
+        { "spiram", MALLOC_CAP_SPIRAM },
+#endif
+        { "default", MALLOC_CAP_DEFAULT },
+    };
+    printf("%-10s %10s %10s %10s\n", "heap", "free", "largest", "min free");
+    for (size_t i = 0; i < sizeof(s_heaps) / sizeof(s_heaps[0]); i++) {
+        printf("%-10s %10u %10u %10u\n", s_heaps[i].name, (unsigned)heap_caps_get_free_size(s_heaps[i].caps),
+               (unsigned)heap_caps_get_largest_free_block(s_heaps[i].caps),
+               (unsigned)heap_caps_get_minimum_free_size(s_heaps[i].caps));
+    }
+#if CONFIG_DIAG_HEAP_TAGS
+    printf("%-10s %10s %10s %10s\n", "heap tag", "bytes", "peak", "allocs");
+    esp_diag_heap_tags_foreach(perf_print_heap_tag_cb, NULL);
+#endif
+}
+
+static void perf_dump_mdns()
+{
+#if CONFIG_MDNS_ENABLE_STATS
+    mdns_stats_t stats;
+    if (mdns_stats_get(NULL, &stats) != ESP_OK) {
+        printf("mdns: not running\n");
+        return;
+    }
+    printf("mdns: rx %" PRIu32 " packets %" PRIu32 " questions %" PRIu32 " dropped, tx %" PRIu32 " answers %" PRIu32
+           " suppressed %" PRIu32 " bytes, %" PRIu32 " probe conflicts\n", stats.rx_packets, stats.rx_questions,
+           stats.rx_dropped, stats.tx_answers, stats.tx_suppressed, stats.tx_bytes, stats.probe_conflicts);
+#else
+    printf("mdns: enable CONFIG_MDNS_ENABLE_STATS\n");
+#endif
+}
+
+static void perf_dump_button()
+{
+#if CONFIG_BUTTON_STATS
+    button_stats_t stats;
+    if (iot_button_get_stats(&stats) != ESP_OK) {
+        return;
+    }
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    printf("button: %" PRIu32 " scans, %" PRIu32 " wakeups, scan avg/max %" PRIu32 "/%" PRIu32 " us\n", stats.scans,
+           stats.intr_wakeups, stats.scans ? (uint32_t)(stats.scan_cycles_sum / stats.scans / ticks_per_us) : 0,
+           stats.scan_cycles_max / ticks_per_us);
+#else
+    printf("button: enable CONFIG_BUTTON_STATS\n");
+#endif
+}
+
+static void perf_dump_insights()
+{
+#if CONFIG_ESP_INSIGHTS_ENABLED
+    esp_diag_data_store_usage_t usage;
+    if (esp_diag_data_store_usage_get(&usage) != ESP_OK) {
+        printf("insights: data store not initialized\n");
+        return;
+    }
+    printf("insights: critical %u/%u bytes, non critical %u/%u bytes\n", (unsigned)usage.critical_filled,
+           (unsigned)usage.critical_size, (unsigned)usage.non_critical_filled, (unsigned)usage.non_critical_size);
+#else
+    printf("insights: disabled\n");
+#endif
+}
+
+#if CONFIG_DIAG_ENABLE_SPAN_METRICS
+static void perf_print_span_cb(const esp_diag_span_stats_t *stats, void *arg)
+{
+    printf("%-12s %10" PRIu32 " %10" PRIu64 " %10" PRIu32 " %10" PRIu32 "\n", stats->tag, stats->count,
+           stats->total_us, stats->count ? (uint32_t)(stats->total_us / stats->count) : 0, stats->max_us);
+}
+#endif
+
+static void perf_dump_spans()
+{
+#if CONFIG_DIAG_ENABLE_SPAN_METRICS
+    printf("%-12s %10s %10s %10s %10s\n", "span", "count", "total (us)", "avg (us)", "max (us)");
+    esp_diag_spans_foreach(perf_print_span_cb, NULL);
+#else
+    printf("spans: enable CONFIG_DIAG_ENABLE_SPAN_METRICS\n");
+#endif
+}
+
+static void perf_dump_trace()
+{
+#if CONFIG_DIAG_ENABLE_TRACE
+    esp_diag_trace_print_json();
+#else
+    printf("trace: enable CONFIG_DIAG_ENABLE_TRACE\n");
+#endif
+}
+
+static const struct {
+    const char *name;
+    void (*dump)();
+    bool in_all;               /* Printed when no section is given */
+} s_sections[] = {
+    { "tasks", perf_dump_tasks, true },
+    { "heap", perf_dump_heap, true },
+    { "mdns", perf_dump_mdns, true },
+    { "led", app_driver_light_stats_dump, true },
+    { "button", perf_dump_button, true },
+    { "insights", perf_dump_insights, true },
+    { "latency", app_latency_dump, true },
+    { "spans", perf_dump_spans, true },
+    { "trace", perf_dump_trace, false },
+};
+
+static esp_err_t app_perf_console_handler(int argc, char **argv)
+{
+    if (argc == 0) {
+        for (size_t i = 0; i < sizeof(s_sections) / sizeof(s_sections[0]); i++) {
+            if (s_sections[i].in_all) {
+                s_sections[i].dump();
+            }
+        }
+        return ESP_OK;
+    }
+    if (argc == 1) {
+        for (size_t i = 0; i < sizeof(s_sections) / sizeof(s_sections[0]); i++) {
+            if (strcmp(argv[0], s_sections[i].name) == 0) {
+                s_sections[i].dump();
+                return ESP_OK;
+            }
+        }
+    }
+    printf("Usage: matter esp perf [tasks|heap|mdns|led|button|insights|latency|spans|trace]\n");
+    return ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t app_perf_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "perf",
+        .description = "Runtime performance counters, all but trace by default. "
+                       "Usage: matter esp perf [tasks|heap|mdns|led|button|insights|latency|spans|trace]",
+        .handler = app_perf_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
@@ -0,0 +1,342 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_matter.h>
+
+#include <app_priv.h>
+
+using namespace chip::app::Clusters;
+
+static const char *TAG = "app_persist";
+
+#define APP_PERSIST_NAMESPACE "light_state"
+#define APP_PERSIST_KEY "lights"
+#define APP_PERSIST_BLOB_VERSION 1
+#define APP_PERSIST_TASK_STACK 3072
+#define APP_PERSIST_TASK_PRIORITY 1
+
+typedef struct {
+    app_light_state_t state;
+    bool valid;                 /* The record holds at least one value */
+    bool dirty;                 /* The record changed since the last flush */
+} app_persist_record_t;
+
+/* The state of all the endpoints is stored in one blob, read with a single lookup at boot and written once per window.
+ * It holds a record for each endpoint with a stored state. */
+typedef struct {
+    uint16_t endpoint_id;
+    app_light_state_t state;
+} app_persist_blob_record_t;
+
+typedef struct {
+    uint8_t version;
+    uint8_t count;
+    app_persist_blob_record_t records[APP_DRIVER_MAX_ENDPOINTS];
+} app_persist_blob_t;
+
+static_assert(APP_DRIVER_MAX_ENDPOINTS <= UINT8_MAX, "The records are counted on 8 bits");
+
+static app_persist_record_t s_records[APP_DRIVER_MAX_ENDPOINTS];
+static app_persist_blob_t s_blob;                            /* Used with s_flush_mutex held */
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;  /* Protects s_records and the window state */
+static SemaphoreHandle_t s_flush_mutex;                      /* Serializes NVS access */
+static nvs_handle_t s_nvs_handle;
+static esp_timer_handle_t s_window_timer;
+static TaskHandle_t s_task;
+static int64_t s_first_dirty_us;                             /* 0 when nothing is waiting to be written */
+
+/* Key of the state of an endpoint in the earlier layout, moved to the blob once */
+static void app_persist_legacy_key(uint16_t endpoint_id, char *key, size_t key_len)
+{
+    snprintf(key, key_len, "ep%u", endpoint_id);
+}
+
+static size_t app_persist_blob_size(uint8_t count)
+{
+    return offsetof(app_persist_blob_t, records) + count * sizeof(app_persist_blob_record_t);
+}
+
+/* Fills the blob with the records, returns whether one of them changed since the last time */
+static bool app_persist_blob_build()
+{
+    bool dirty = false;
+    uint8_t count = 0;
+    portENTER_CRITICAL(&s_lock);
+    for (uint16_t endpoint_id = 0; endpoint_id < APP_DRIVER_MAX_ENDPOINTS; endpoint_id++) {
+        app_persist_record_t *record = &s_records[endpoint_id];
+        dirty |= record->dirty;
+        record->dirty = false;
+        if (record->valid) {
+            s_blob.records[count].endpoint_id = endpoint_id;
+            s_blob.records[count].state = record->state;
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    s_blob.version = APP_PERSIST_BLOB_VERSION;
+    s_blob.count = count;
+    return dirty;
+}
+
+static esp_err_t app_persist_blob_load()
+{
+    size_t len = sizeof(s_blob);
+    esp_err_t err = nvs_get_blob(s_nvs_handle, APP_PERSIST_KEY, &s_blob, &len);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && (len < app_persist_blob_size(0) ||
+            s_blob.version != APP_PERSIST_BLOB_VERSION || s_blob.count > APP_DRIVER_MAX_ENDPOINTS ||
+            len != app_persist_blob_size(s_blob.count)))) {
+        /* Rewritten at the next change */
+        ESP_LOGW(TAG, "Discarding the light state stored with another layout");
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint8_t i = 0; i < s_blob.count; i++) {
+        const app_persist_blob_record_t *record = &s_blob.records[i];
+        if (record->endpoint_id < APP_DRIVER_MAX_ENDPOINTS && record->state.version == APP_LIGHT_STATE_VERSION) {
+            s_records[record->endpoint_id].state = record->state;
+            s_records[record->endpoint_id].valid = true;
+        }
+    }
+    return ESP_OK;
+}
+
+/* Moves the state stored a key per endpoint to the blob, which is written even if empty so this is done once */
+static esp_err_t app_persist_migrate()
+{
+    uint32_t legacy = 0;
+    static_assert(APP_DRIVER_MAX_ENDPOINTS <= 32, "The legacy keys found are a 32 bit mask");
+    for (uint16_t endpoint_id = 0; endpoint_id < APP_DRIVER_MAX_ENDPOINTS; endpoint_id++) {
+        char key[8];
+        app_persist_legacy_key(endpoint_id, key, sizeof(key));
+        app_light_state_t state;
+        size_t len = sizeof(state);
+        esp_err_t err = nvs_get_blob(s_nvs_handle, key, &state, &len);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            continue;
+        }
+        legacy |= 1U << endpoint_id;
+        if (err == ESP_OK && len == sizeof(state) && state.version == APP_LIGHT_STATE_VERSION) {
+            s_records[endpoint_id].state = state;
+            s_records[endpoint_id].valid = true;
+        }
+    }
+    app_persist_blob_build();
+    esp_err_t err = nvs_set_blob(s_nvs_handle, APP_PERSIST_KEY, &s_blob, app_persist_blob_size(s_blob.count));
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint16_t endpoint_id = 0; endpoint_id < APP_DRIVER_MAX_ENDPOINTS; endpoint_id++) {
+        if (legacy & (1U << endpoint_id)) {
+            char key[8];
+            app_persist_legacy_key(endpoint_id, key, sizeof(key));
+            nvs_erase_key(s_nvs_handle, key);
+        }
+    }
+    if (legacy) {
+        ESP_LOGI(TAG, "Moved the light state of %u endpoints to a single record", (unsigned)__builtin_popcount(legacy));
+    }
+    return nvs_commit(s_nvs_handle);
+}
+
+static bool app_persist_apply(app_light_state_t *state, uint32_t cluster_id, uint32_t attribute_id,
+                              esp_matter_attr_val_t *val)
+{
+    switch (cluster_id) {
+    case OnOff::Id:
+        if (attribute_id == OnOff::Attributes::OnOff::Id) {
+            state->on_off = val->val.b;
+            return true;
+        }
+        break;
+    case LevelControl::Id:
+        if (attribute_id == LevelControl::Attributes::CurrentLevel::Id) {
+            state->level = val->val.u8;
+            return true;
+        }
+        break;
+    case ColorControl::Id:
+        switch (attribute_id) {
+        case ColorControl::Attributes::ColorMode::Id:
+            state->color_mode = val->val.u8;
+            return true;
+        case ColorControl::Attributes::CurrentHue::Id:
+            state->hue = val->val.u8;
+            return true;
+        case ColorControl::Attributes::CurrentSaturation::Id:
+            state->saturation = val->val.u8;
+            return true;
+        case ColorControl::Attributes::CurrentX::Id:
+            state->current_x = val->val.u16;
+            return true;
+        case ColorControl::Attributes::CurrentY::Id:
+            state->current_y = val->val.u16;
+            return true;
+        case ColorControl::Attributes::ColorTemperatureMireds::Id:
+            state->temperature_mireds = val->val.u16;
+            return true;
+        default:
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+static void app_persist_window_cb(void *arg)
+{
+    xTaskNotifyGive(s_task);
+}
+
+static void app_persist_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        app_persist_flush();
+    }
+}
+
+static void app_persist_shutdown_handler(void)
+{
+    app_persist_flush();
+}
+
+esp_err_t app_persist_init()
+{
+    esp_err_t err = nvs_open(APP_PERSIST_NAMESPACE, NVS_READWRITE, &s_nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS namespace, err:%d", err);
+        return err;
+    }
+    s_flush_mutex = xSemaphoreCreateMutex();
+    if (!s_flush_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Load what was stored last time, so that partial updates keep the other values of a record */
+    err = app_persist_blob_load();
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = app_persist_migrate();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to load the light state, err:%d", err);
+    }
+
+    esp_timer_create_args_t window_timer_args = {
+        .callback = app_persist_window_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "persist_window",
+        .skip_unhandled_events = true,
+    };
+    err = esp_timer_create(&window_timer_args, &s_window_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create persistence timer, err:%d", err);
+        return err;
+    }
+
+    /* NVS writes happen here, at low priority, instead of in the Matter task */
+    if (xTaskCreatePinnedToCore(app_persist_task, "app_persist", APP_PERSIST_TASK_STACK, NULL,
+                                APP_PERSIST_TASK_PRIORITY, &s_task, APP_CORE_NETWORK) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create persistence task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Pending writes are flushed on esp_restart(). A brown-out cannot be handled the same way as flash writes are
+     * not safe at that point, APP_PERSIST_MAX_DELAY_MS bounds what can be lost. */
+    return esp_register_shutdown_handler(app_persist_shutdown_handler);
+}
+
+esp_err_t app_persist_attribute_update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                                       esp_matter_attr_val_t *val)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || !s_window_timer) {
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    app_persist_record_t *record = &s_records[endpoint_id];
+    if (!app_persist_apply(&record->state, cluster_id, attribute_id, val)) {
+        portEXIT_CRITICAL(&s_lock);
+        return ESP_OK;
+    }
+    record->state.version = APP_LIGHT_STATE_VERSION;
+    record->valid = true;
+    record->dirty = true;
+
+    /* Restart the window on every change, but never push the write past APP_PERSIST_MAX_DELAY_MS */
+    int64_t now = esp_timer_get_time();
+    if (s_first_dirty_us == 0) {
+        s_first_dirty_us = now;
+    }
+    int64_t deadline = s_first_dirty_us + APP_PERSIST_MAX_DELAY_MS * 1000LL;
+    int64_t timeout = APP_PERSIST_WINDOW_MS * 1000LL;
+    if (now + timeout > deadline) {
+        timeout = deadline > now ? deadline - now : 0;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    esp_timer_stop(s_window_timer);
+    return esp_timer_start_once(s_window_timer, timeout);
+}
+
+esp_err_t app_persist_get(uint16_t endpoint_id, app_light_state_t *state)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || !state) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&s_lock);
+    if (s_records[endpoint_id].valid) {
+        *state = s_records[endpoint_id].state;
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return err;
+}
+
+esp_err_t app_persist_flush()
+{
+    if (!s_flush_mutex) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(s_flush_mutex, portMAX_DELAY);
+    /* Changes from now on open a new window */
+    portENTER_CRITICAL(&s_lock);
+    s_first_dirty_us = 0;
+    portEXIT_CRITICAL(&s_lock);
+
+    /* One write and one commit for everything that changed in the window */
+    if (app_persist_blob_build()) {
+        err = nvs_set_blob(s_nvs_handle, APP_PERSIST_KEY, &s_blob, app_persist_blob_size(s_blob.count));
+        if (err == ESP_OK) {
+            err = nvs_commit(s_nvs_handle);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to store the light state, err:%d", err);
+        }
+    }
+    xSemaphoreGive(s_flush_mutex);
+    return err;
+}
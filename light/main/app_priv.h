@@ -33,30 +33,333 @@
 #define DEFAULT_HUE 128
 #define DEFAULT_SATURATION 254
 
+/** Attribute updates arriving within this period are merged into a single hardware commit */
+#define APP_DRIVER_COMMIT_PERIOD_MS 10
+
+/** Step period of the transition engine */
+#define APP_DRIVER_TRANSITION_STEP_MS 20
+
+/** During a transition the data model is updated with the current values at most once per period, 0 to only update it
+ * with the targets once the transition ends */
+#define APP_DRIVER_TRANSITION_REPORT_MS 1000
+
+/** Channels animated by `app_driver_light_start_transition()` */
+#define APP_DRIVER_TRANSITION_LEVEL      (1 << 0)
+#define APP_DRIVER_TRANSITION_HUE        (1 << 1)
+#define APP_DRIVER_TRANSITION_SATURATION (1 << 2)
+
+/** Set to 1 for the button to switch the light right away and update the data model afterwards from the Matter
+ * task, set to 0 for the button to go through the data model like any other write */
+#define APP_DRIVER_BUTTON_LOCAL_FEEDBACK 1
+
+/** Maximum number of endpoints that can be registered with the driver dispatch table */
+#define APP_DRIVER_MAX_ENDPOINTS 24
+
+/** Maximum number of light endpoints, one per LED/strip segment */
+#define APP_DRIVER_MAX_LIGHTS 16
+
+/** Number of scenes the driver caches per light */
+#define APP_DRIVER_MAX_SCENES 16
+
+/** Persistence batching: a write waits for the window to be quiet, but never longer than the max delay */
+#define APP_PERSIST_WINDOW_MS 1000
+#define APP_PERSIST_MAX_DELAY_MS 5000
+
+/** Largest BDX block proposed to the OTA provider, which fits the 1200 byte application payload of a Matter message */
+#define APP_OTA_BDX_BLOCK_SIZE 1152
+
+/** OTA blocks buffered for the flash writer, the next block is downloaded while the previous ones are written */
+#define APP_OTA_WRITER_BLOCKS 3
+
+/** Background erase of the update partition: delay after boot, and pause between two sectors */
+#define APP_OTA_PRE_ERASE_DELAY_MS 30000
+#define APP_OTA_PRE_ERASE_INTERVAL_MS 20
+
+/** Cores of the tasks on dual core chips, in step with the task affinities in sdkconfig.defaults: the LED output, the
+ * esp_timer task driving it and the button on one core, the network stack and the work it brings on the other, so
+ * that bursts of traffic do not delay the output */
+#if CONFIG_FREERTOS_UNICORE
+#define APP_CORE_OUTPUT tskNO_AFFINITY
+#define APP_CORE_NETWORK tskNO_AFFINITY
+#else
+#define APP_CORE_OUTPUT 0
+#define APP_CORE_NETWORK 1
+#endif
+
+/** Lowest CPU frequency while idle when CONFIG_PM_ENABLE is set, the XTAL frequency of most chips */
+#define APP_PM_MIN_FREQ_MHZ 40
+
 typedef void *app_driver_handle_t;
 
+#define APP_LIGHT_STATE_VERSION 1
+
+/** Light state stored by the persistence batcher, one record per endpoint (Matter units), all in one NVS blob */
+typedef struct {
+    uint8_t version;
+    uint8_t on_off;
+    uint8_t level;
+    uint8_t color_mode;
+    uint8_t hue;
+    uint8_t saturation;
+    uint16_t current_x;
+    uint16_t current_y;
+    uint16_t temperature_mireds;
+} app_light_state_t;
+
+/** Attribute handler
+ *
+ * Called from `app_driver_attribute_update()` for the (cluster, attribute) pair it is registered for.
+ *
+ * @param[in] driver_handle Driver handle (the endpoint's priv_data).
+ * @param[in] val Pointer to `esp_matter_attr_val_t`.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+typedef esp_err_t (*app_driver_attribute_cb_t)(app_driver_handle_t driver_handle, esp_matter_attr_val_t *val);
+
+/** Attribute dispatch table entry
+ *
+ * Tables must be sorted by (cluster_id, attribute_id) in ascending order so that the lookup can be done with a
+ * binary search. Use `app_driver_attribute_table_is_sorted()` in a `static_assert` to check this at compile time.
+ */
+typedef struct {
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    app_driver_attribute_cb_t cb;
+} app_driver_attribute_entry_t;
+
+/** Check at compile time that a dispatch table is sorted by (cluster_id, attribute_id) */
+template <size_t N>
+constexpr bool app_driver_attribute_table_is_sorted(const app_driver_attribute_entry_t (&table)[N])
+{
+    for (size_t i = 1; i < N; i++) {
+        if (table[i - 1].cluster_id > table[i].cluster_id ||
+            (table[i - 1].cluster_id == table[i].cluster_id && table[i - 1].attribute_id >= table[i].attribute_id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /** Initialize the light driver
  *
- * This initializes the light driver associated with the selected board.
+ * This initializes one light driver per LED of the selected board. Each handle is meant to be used as the
+ * priv_data of its own light endpoint.
  *
- * @return Handle on success.
- * @return NULL in case of failure.
+ * @param[out] light_array Output light driver handles.
+ * @param[out] light_cnt Number of handles saved to light_array, 0 if the board has no LEDs.
+ * @param[in] light_array_size Size of light_array.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_light_init(app_driver_handle_t light_array[], int *light_cnt, int light_array_size);
+
+/** Light transition targets
+ *
+ * Targets are in Matter units (CurrentLevel, CurrentHue, CurrentSaturation). Only the channels selected in
+ * `flags` are animated.
+ */
+typedef struct {
+    uint32_t flags;         /*!< APP_DRIVER_TRANSITION_* */
+    uint8_t level;
+    uint8_t hue;
+    uint8_t saturation;
+} app_driver_light_transition_t;
+
+/** Start a light transition
+ *
+ * The driver interpolates from the current output to the targets on its own timer, using fixed point increments
+ * precomputed here, so no attribute updates are needed for the intermediate values. A running transition is
+ * replaced. An attribute update for a channel being animated cancels the animation of that channel, unless it
+ * carries the transition target.
+ *
+ * The driver updates the attributes of the animated channels itself, so that subscribers see the light follow the
+ * transition without a report for every step: with the current values at most once per
+ * `APP_DRIVER_TRANSITION_REPORT_MS`, and with the targets as soon as the transition ends. The light must have been
+ * registered with `app_driver_light_register()`.
+ *
+ * @param[in] driver_handle Light driver handle.
+ * @param[in] transition Transition targets.
+ * @param[in] duration_ms Duration of the transition.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
  */
-app_driver_handle_t app_driver_light_init();
+esp_err_t app_driver_light_start_transition(app_driver_handle_t driver_handle,
+                                            const app_driver_light_transition_t *transition, uint32_t duration_ms);
+
+/** Restore a light from its stored state
+ *
+ * Drives the output straight away, without going through the data model. This is meant to be called before
+ * `esp_matter::start()`, so that the light comes back in its previous state within a few milliseconds of boot.
+ * `app_driver_light_set_defaults()` syncs the output with the data model once Matter is up.
+ *
+ * @param[in] driver_handle Light driver handle.
+ * @param[in] state State stored by the persistence batcher.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_light_restore(app_driver_handle_t driver_handle, const app_light_state_t *state);
+
+/** Output changes made by `app_driver_light_apply_now()` */
+#define APP_DRIVER_ACTION_POWER      (1 << 0)   /*!< Switch to `on_off` */
+#define APP_DRIVER_ACTION_TOGGLE     (1 << 1)   /*!< Switch to the opposite of the current output */
+#define APP_DRIVER_ACTION_LEVEL      (1 << 2)   /*!< Set the level to `level` */
+#define APP_DRIVER_ACTION_LEVEL_IF_ON (1 << 3)  /*!< Set the level to `level`, only if the light is on */
+
+/** Light output change, in Matter units */
+typedef struct {
+    uint32_t flags;         /*!< APP_DRIVER_ACTION_* */
+    bool on_off;
+    uint8_t level;
+} app_driver_light_action_t;
+
+/** Apply an output change right away
+ *
+ * Pushes the change to the hardware without waiting for the commit frame, and without going through the data model.
+ * The data model update which follows writes the same values, so it does not change the output again.
+ *
+ * @param[in] driver_handle Light driver handle.
+ * @param[in] action Output change.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_light_apply_now(app_driver_handle_t driver_handle, const app_driver_light_action_t *action);
+
+/** Get the driver handle of a light endpoint
+ *
+ * @param[in] endpoint_id Endpoint ID.
+ *
+ * @return Handle if the endpoint is a light registered with `app_driver_light_register()` and its attributes are
+ *         cached.
+ * @return NULL otherwise.
+ */
+app_driver_handle_t app_driver_light_get(uint16_t endpoint_id);
+
+/** Store a scene
+ *
+ * Captures the current state of the light and precomputes the RGB frame it shows, so that recalling the scene needs
+ * no colour conversion. Storing a scene again replaces it.
+ *
+ * @param[in] driver_handle Light driver handle.
+ * @param[in] group_id Group ID of the scene.
+ * @param[in] scene_id Scene ID.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NO_MEM if all `APP_DRIVER_MAX_SCENES` slots are used.
+ */
+esp_err_t app_driver_light_scene_store(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id);
+
+/** Recall a scene
+ *
+ * Writes the stored frame to the hardware in one go, replacing any pending commit or running transition. The
+ * attribute updates the data model then sends for the same values are dropped, until a different value comes in.
+ *
+ * @param[in] driver_handle Light driver handle.
+ * @param[in] group_id Group ID of the scene.
+ * @param[in] scene_id Scene ID.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_FOUND if the scene is not stored.
+ */
+esp_err_t app_driver_light_scene_recall(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id);
+
+/** Remove a scene
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_FOUND if the scene is not stored.
+ */
+esp_err_t app_driver_light_scene_remove(app_driver_handle_t driver_handle, uint16_t group_id, uint8_t scene_id);
+
+/** Recall a scene on all the lights
+ *
+ * @param[in] group_id Group ID of the scene.
+ * @param[in] scene_id Scene ID.
+ *
+ * @return ESP_OK if at least one light recalled the scene.
+ * @return ESP_ERR_NOT_FOUND if no light has the scene.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_scene_recall(uint16_t group_id, uint8_t scene_id);
+
+/** Print the timing statistics of the blink steps of every light, with `CONFIG_LED_INDICATOR_STATS` */
+void app_driver_light_stats_dump();
+
+#if CONFIG_ENABLE_CHIP_SHELL
+/** Register the `scene` console command
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_scene_register_commands();
+#endif
 
 /** Initialize the button driver
  *
  * This initializes the button driver associated with the selected board.
  *
+ * @param[in] endpoint_id Endpoint ID of the light toggled by the button.
+ *
  * @return Handle on success.
  * @return NULL in case of failure.
  */
-app_driver_handle_t app_driver_button_init();
+app_driver_handle_t app_driver_button_init(uint16_t endpoint_id);
+
+/** Register an attribute dispatch table for an endpoint
+ *
+ * The table is not copied and must stay valid for the lifetime of the endpoint. Registering a table for an
+ * endpoint which already has one replaces the previous table.
+ *
+ * @param[in] endpoint_id Endpoint ID, must be less than `APP_DRIVER_MAX_ENDPOINTS`.
+ * @param[in] table Dispatch table sorted by (cluster_id, attribute_id).
+ * @param[in] count Number of entries in the table.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_ARG if the endpoint is out of range or the table is not sorted.
+ */
+esp_err_t app_driver_register_attribute_table(uint16_t endpoint_id, const app_driver_attribute_entry_t *table,
+                                              size_t count);
+
+/** Register the light attribute handlers for an endpoint
+ *
+ * @param[in] endpoint_id Endpoint ID of the light.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_driver_light_register(uint16_t endpoint_id);
+
+/** Cache the attribute handles the driver reads outside of the attribute callbacks
+ *
+ * Looks the attributes up in the data model once, so that the button and `app_driver_light_set_defaults()` use
+ * the stored handles instead of walking the endpoint, cluster and attribute lists on every call. Must be called
+ * after all the clusters of the endpoint are created.
+ *
+ * @param[in] endpoint_id Endpoint ID, must be less than `APP_DRIVER_MAX_ENDPOINTS`.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_INVALID_ARG if the endpoint is out of range.
+ */
+esp_err_t app_driver_attribute_cache_fill(uint16_t endpoint_id);
+
+/** Drop the cached attribute handles of an endpoint
+ *
+ * Must be called before the endpoint is destroyed, the handles point into its data model. The driver falls back to
+ * looking the attributes up until the cache is filled again.
+ *
+ * @param[in] endpoint_id Endpoint ID.
+ */
+void app_driver_attribute_cache_invalidate(uint16_t endpoint_id);
 
 /** Driver Update
  *
  * This API should be called to update the driver for the attribute being updated.
- * This is usually called from the common `app_attribute_update_cb()`.
+ * This is usually called from the common `app_attribute_update_cb()`. The handler is looked up in the table
+ * registered for the endpoint, attributes without a handler are ignored.
  *
  * @param[in] endpoint_id Endpoint ID of the attribute.
  * @param[in] cluster_id Cluster ID of the attribute.
@@ -80,7 +383,201 @@ esp_err_t app_driver_attribute_update(app_driver_handle_t driver_handle, uint16_
  */
 esp_err_t app_driver_light_set_defaults(uint16_t endpoint_id);
 
+/** Initialize the persistence batcher
+ *
+ * Loads the stored light state, with a single NVS read for all the endpoints, and starts the low priority task doing
+ * the NVS writes. Must be called after `nvs_flash_init()`.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_persist_init();
+
+/** Record an attribute change
+ *
+ * This is usually called from `app_attribute_update_cb()` for POST_UPDATE. Attributes that are not part of
+ * `app_light_state_t` are ignored. Changes from all endpoints are written together with a single NVS commit once
+ * no change came in for `APP_PERSIST_WINDOW_MS`, or at the latest `APP_PERSIST_MAX_DELAY_MS` after the first one.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_persist_attribute_update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id,
+                                       esp_matter_attr_val_t *val);
+
+/** Get the stored light state of an endpoint
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NOT_FOUND if nothing was stored for the endpoint.
+ */
+esp_err_t app_persist_get(uint16_t endpoint_id, app_light_state_t *state);
+
+/** Write all pending changes now
+ *
+ * This is also done automatically on `esp_restart()`.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_persist_flush();
+
+/** Boot phases tracked by the boot profiler, in the order they are expected to complete */
+typedef enum {
+    APP_BOOT_PHASE_NVS_INIT = 0,
+    APP_BOOT_PHASE_PERSIST_INIT,
+    APP_BOOT_PHASE_LIGHT_INIT,
+    APP_BOOT_PHASE_NODE_CREATE,
+    APP_BOOT_PHASE_ENDPOINTS_CREATE,
+    APP_BOOT_PHASE_BUTTON_INIT,
+    APP_BOOT_PHASE_MATTER_START,
+    APP_BOOT_PHASE_LIGHT_DEFAULTS,
+    APP_BOOT_PHASE_IP_ADDRESS,
+    APP_BOOT_PHASE_COMMISSIONING_COMPLETE,
+    APP_BOOT_PHASE_MAX,
+} app_boot_phase_t;
+
+/** Mark the end of a boot phase
+ *
+ * Only the first mark of a phase is kept. Reaching `APP_BOOT_PHASE_LIGHT_DEFAULTS` and `APP_BOOT_PHASE_IP_ADDRESS`
+ * also reports the boot time as a diagnostics metric, when metrics are enabled.
+ *
+ * @param[in] phase Boot phase that just completed.
+ */
+void app_boot_profile_mark(app_boot_phase_t phase);
+
+/** Print the boot phase timings */
+void app_boot_profile_dump();
+
+#if CONFIG_ENABLE_CHIP_SHELL
+/** Register the `boot` console command
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_boot_profile_register_commands();
+#endif
+
+/** Record an attribute update latency
+ *
+ * Adds the time elapsed since `start_us` to the fixed bucket histogram of the cluster. Only the OnOff,
+ * LevelControl and ColorControl clusters are tracked, other clusters and a `start_us` of 0 are ignored.
+ *
+ * @param[in] cluster_id Cluster ID of the updated attribute.
+ * @param[in] start_us Value of `esp_timer_get_time()` when the update was received.
+ */
+void app_latency_record(uint32_t cluster_id, int64_t start_us);
+
+/** Print count, p50, p99 and max latency per cluster */
+void app_latency_dump();
+
+/** Clear the latency histograms */
+void app_latency_reset();
+
+#if CONFIG_ENABLE_CHIP_SHELL
+/** Register the `latency` console command
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_latency_register_commands();
+
+/** Register the `perf` console command
+ *
+ * Prints the CPU share of the tasks since the previous call, the heap of each capability, the mDNS, LED, button
+ * and Insights counters, the latency histograms, the span totals and the trace events. Nothing is collected
+ * besides what the components already count, the command only reads it.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_perf_register_commands();
+#endif
+
+#if CONFIG_DIAG_ENABLE_TRACE && CONFIG_ENABLE_CHIP_SHELL
+/** Register the `trace` console command
+ *
+ * Prints the trace events kept as a Trace Event Format document, to open in Perfetto, or clears them.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_trace_register_commands();
+#endif
+
+/** Start reporting the mDNS statistics
+ *
+ * Every minute, the counts of received packets and questions, dropped packets, answers sent and suppressed, bytes
+ * sent and probe conflicts of the last minute, summed over all the interfaces, are reported as diagnostics metrics.
+ * Does nothing unless both the metrics and `CONFIG_MDNS_ENABLE_STATS` are enabled, and nothing is reported while the
+ * mDNS component is not running.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_mdns_metrics_init();
+
+/** Initialize the group command fast path
+ *
+ * On, Off, Toggle and the MoveToLevel commands without a transition, when sent to a group, switch the light output
+ * as soon as they are received, before the cluster servers handle them and update, persist and report the
+ * attributes. So the lights of a group change together, whatever the load of each node. Must be called before
+ * `esp_matter::start()`.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_group_init();
+
+/** Initialize the OTA image processor
+ *
+ * Sets the image processor of the OTA requestor to one taking both app images and delta OTA patches of the running
+ * app, as made by `esp_delta_ota_patch_gen.py`, told apart by the start of the payload of the Matter OTA image.
+ * A patch is applied while it is downloaded, so only the patch goes over the network. Blocks are written to flash, or
+ * patched, by a separate task, so that the next block is asked for without waiting for the flash. The update partition
+ * is erased in the background ahead of the next download once the running image is confirmed. Does nothing with the
+ * encrypted OTA, which keeps the esp_matter image processor. Must be called before `esp_matter::start()`.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_ota_init();
+
+/* Sizes of the OpenThread port queues, between the network interface or the other tasks and the OpenThread task */
+#define APP_THREAD_QUEUE_SIZE_DEFAULT 10
+#define APP_THREAD_QUEUE_SIZE_MIN 4
+#define APP_THREAD_QUEUE_SIZE_MAX 40
+
+/** Start monitoring the OpenThread load
+ *
+ * Every second, the most message buffers in use and the longest IPv6 send queue of OpenThread, and its IPv6 messages
+ * which failed to be sent or received, are sampled. Their worst over each minute is reported as diagnostics metrics,
+ * when enabled. With the automatic sizing, a minute short of buffers and losing messages grows the port queues by
+ * half, up to `APP_THREAD_QUEUE_SIZE_MAX`, from the next boot. Does nothing without Thread.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_thread_queues_init();
+
+#if CONFIG_ENABLE_CHIP_SHELL
+/** Register the `otqueues` console command
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t app_thread_queues_register_commands();
+#endif
+
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD
+/** Set the OpenThread port queue sizes
+ *
+ * Takes the sizes stored by the automatic sizing or the `otqueues` command, `APP_THREAD_QUEUE_SIZE_DEFAULT`
+ * otherwise. The NVS must be initialized.
+ *
+ * @param[out] config The port config to update.
+ */
+void app_thread_port_config(esp_openthread_port_config_t *config);
+
 #define ESP_OPENTHREAD_DEFAULT_RADIO_CONFIG()                                           \
     {                                                                                   \
         .radio_mode = RADIO_MODE_NATIVE,                                                \
@@ -93,6 +590,8 @@ esp_err_t app_driver_light_set_defaults(uint16_t endpoint_id);
 
 #define ESP_OPENTHREAD_DEFAULT_PORT_CONFIG()                                            \
     {                                                                                   \
-        .storage_partition_name = "nvs", .netif_queue_size = 10, .task_queue_size = 10, \
+        .storage_partition_name = "nvs",                                                \
+        .netif_queue_size = APP_THREAD_QUEUE_SIZE_DEFAULT,                              \
+        .task_queue_size = APP_THREAD_QUEUE_SIZE_DEFAULT,                               \
     }
 #endif
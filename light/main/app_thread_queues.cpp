@@ -0,0 +1,304 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <esp_matter.h>
+#include <esp_matter_console.h>
+
+#include <app_priv.h>
+
+#if CHIP_DEVICE_CONFIG_ENABLE_THREAD
+#include <esp_openthread.h>
+#include <esp_openthread_lock.h>
+#include <nvs.h>
+#include <openthread/message.h>
+#include <openthread/thread.h>
+
+#if CONFIG_DIAG_ENABLE_METRICS
+#include <esp_diagnostics_metrics.h>
+#endif
+
+static const char *TAG = "app_thread_queues";
+
+#define THREAD_QUEUES_NAMESPACE  "app_thread"
+#define THREAD_QUEUES_KEY_NETIF  "netif_q"
+#define THREAD_QUEUES_KEY_TASK   "task_q"
+#define THREAD_QUEUES_KEY_AUTO   "auto"
+
+#define THREAD_METRICS_TAG       "thread"
+#define THREAD_SAMPLE_PERIOD_US  (1000 * 1000)
+#define THREAD_REPORT_SAMPLES    60
+
+typedef struct {
+    uint16_t buffers_max;       /* Most message buffers in use */
+    uint16_t buffers_total;
+    uint16_t ip6_queue_max;     /* Most IPv6 messages waiting to be sent */
+    uint32_t tx_failures;       /* IPv6 messages that could not be sent or received */
+    uint32_t rx_failures;
+} thread_load_t;
+
+/* Owned by the esp_timer task once sampling started */
+static esp_timer_handle_t s_timer;
+static uint32_t s_samples;
+static thread_load_t s_period;
+static thread_load_t s_overall;     /* Since boot, shown by the console command */
+static otIpCounters s_last_counters;
+
+/* Sizes this boot uses, and whether they grow by themselves for the next boots */
+static uint8_t s_netif_queue_size = APP_THREAD_QUEUE_SIZE_DEFAULT;
+static uint8_t s_task_queue_size = APP_THREAD_QUEUE_SIZE_DEFAULT;
+static bool s_auto_size = true;
+
+static esp_err_t app_thread_queues_store(uint8_t netif_queue_size, uint8_t task_queue_size, bool auto_size)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(THREAD_QUEUES_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_u8(nvs, THREAD_QUEUES_KEY_NETIF, netif_queue_size);
+    if (err == ESP_OK) {
+        err = nvs_set_u8(nvs, THREAD_QUEUES_KEY_TASK, task_queue_size);
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_u8(nvs, THREAD_QUEUES_KEY_AUTO, auto_size);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+void app_thread_port_config(esp_openthread_port_config_t *config)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(THREAD_QUEUES_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        uint8_t value;
+        if (nvs_get_u8(nvs, THREAD_QUEUES_KEY_NETIF, &value) == ESP_OK && value >= APP_THREAD_QUEUE_SIZE_MIN &&
+                value <= APP_THREAD_QUEUE_SIZE_MAX) {
+            s_netif_queue_size = value;
+        }
+        if (nvs_get_u8(nvs, THREAD_QUEUES_KEY_TASK, &value) == ESP_OK && value >= APP_THREAD_QUEUE_SIZE_MIN &&
+                value <= APP_THREAD_QUEUE_SIZE_MAX) {
+            s_task_queue_size = value;
+        }
+        if (nvs_get_u8(nvs, THREAD_QUEUES_KEY_AUTO, &value) == ESP_OK) {
+            s_auto_size = value != 0;
+        }
+        nvs_close(nvs);
+    }
+    config->netif_queue_size = s_netif_queue_size;
+    config->task_queue_size = s_task_queue_size;
+    ESP_LOGI(TAG, "OpenThread queues: netif %d, task %d%s", s_netif_queue_size, s_task_queue_size,
+             s_auto_size ? " (auto)" : "");
+}
+
+/* The port queues feed the OpenThread task, they only fill up when it cannot keep up, which shows as its message
+ * buffers running out and IPv6 messages failing. Queue sizes are fixed when OpenThread starts, so a period which
+ * shows both grows the stored sizes for the next boot. */
+static void app_thread_queues_auto_size(const thread_load_t *load)
+{
+    if (!s_auto_size || load->buffers_total == 0) {
+        return;
+    }
+    bool saturated = load->buffers_max * 4 >= load->buffers_total * 3 || load->ip6_queue_max >= s_netif_queue_size;
+    if (!saturated || (load->tx_failures == 0 && load->rx_failures == 0)) {
+        return;
+    }
+    uint8_t netif_queue_size = (uint8_t)MIN(s_netif_queue_size + s_netif_queue_size / 2, APP_THREAD_QUEUE_SIZE_MAX);
+    uint8_t task_queue_size = (uint8_t)MIN(s_task_queue_size + s_task_queue_size / 2, APP_THREAD_QUEUE_SIZE_MAX);
+    if (netif_queue_size == s_netif_queue_size && task_queue_size == s_task_queue_size) {
+        return;
+    }
+    if (app_thread_queues_store(netif_queue_size, task_queue_size, true) == ESP_OK) {
+        ESP_LOGW(TAG, "OpenThread saturated, queues grow to netif %d, task %d from the next boot", netif_queue_size,
+                 task_queue_size);
+        /* Only once per boot, the next one shows whether it was enough */
+        s_auto_size = false;
+    }
+}
+
+#if CONFIG_DIAG_ENABLE_METRICS
+typedef struct {
+    const char *key;
+    const char *label;
+    const char *unit;
+} thread_metric_t;
+
+/* Same order as the values in app_thread_metrics_report() */
+static const thread_metric_t s_metrics[] = {
+    {"ot_buf_max", "OpenThread message buffers used at most", "buffers"},
+    {"ot_ip6_q_max", "OpenThread IPv6 send queue at most", "messages"},
+    {"ot_tx_fail", "OpenThread IPv6 messages not sent", "messages"},
+    {"ot_rx_fail", "OpenThread IPv6 messages dropped", "messages"},
+};
+
+#define THREAD_METRICS_NUM (sizeof(s_metrics) / sizeof(s_metrics[0]))
+
+static esp_diag_metrics_handle_t s_handles[THREAD_METRICS_NUM];
+static bool s_registered;
+
+static bool app_thread_metrics_register()
+{
+    /* Metrics can only be registered once esp_insights (or esp_diag_metrics_init()) is up, so do it lazily */
+    for (size_t i = 0; i < THREAD_METRICS_NUM; i++) {
+        if (s_handles[i]) {
+            continue;
+        }
+        esp_err_t err = esp_diag_metrics_register_with_handle(THREAD_METRICS_TAG, s_metrics[i].key, s_metrics[i].label,
+                                                              "thread", ESP_DIAG_DATA_TYPE_UINT, &s_handles[i]);
+        if (err != ESP_OK) {
+            ESP_LOGD(TAG, "Thread metric not registered, err:%d", err);
+            return false;
+        }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_add_unit(s_metrics[i].key, s_metrics[i].unit);
+#else
+        esp_diag_metrics_add_unit(THREAD_METRICS_TAG, s_metrics[i].key, s_metrics[i].unit);
+#endif
+    }
+    return true;
+}
+
+static void app_thread_metrics_report(const thread_load_t *load)
+{
+    if (!s_registered) {
+        s_registered = app_thread_metrics_register();
+        if (!s_registered) {
+            return;
+        }
+    }
+    uint32_t values[THREAD_METRICS_NUM] = {load->buffers_max, load->ip6_queue_max, load->tx_failures,
+                                           load->rx_failures};
+    for (size_t i = 0; i < THREAD_METRICS_NUM; i++) {
+        esp_diag_metrics_add_uint_by_handle(s_handles[i], values[i]);
+    }
+}
+#endif
+
+static void app_thread_queues_sample(void *arg)
+{
+    otInstance *instance = esp_openthread_get_instance();
+    /* Never hold up the timer task behind the OpenThread task, a skipped sample only loses precision */
+    if (!instance || !esp_openthread_lock_acquire(pdMS_TO_TICKS(5))) {
+        return;
+    }
+    otBufferInfo info;
+    otMessageGetBufferInfo(instance, &info);
+    otMessageResetBufferInfo(instance);
+    otIpCounters counters = *otThreadGetIp6Counters(instance);
+    esp_openthread_lock_release();
+
+    s_period.buffers_max = MAX(s_period.buffers_max, info.mMaxUsedBuffers);
+    s_period.buffers_total = info.mTotalBuffers;
+    s_period.ip6_queue_max = MAX(s_period.ip6_queue_max, info.mIp6Queue.mNumMessages);
+    s_period.tx_failures += counters.mTxFailure - s_last_counters.mTxFailure;
+    s_period.rx_failures += counters.mRxFailure - s_last_counters.mRxFailure;
+    s_last_counters = counters;
+
+    if (++s_samples < THREAD_REPORT_SAMPLES) {
+        return;
+    }
+    s_overall.buffers_max = MAX(s_overall.buffers_max, s_period.buffers_max);
+    s_overall.buffers_total = s_period.buffers_total;
+    s_overall.ip6_queue_max = MAX(s_overall.ip6_queue_max, s_period.ip6_queue_max);
+    s_overall.tx_failures += s_period.tx_failures;
+    s_overall.rx_failures += s_period.rx_failures;
+#if CONFIG_DIAG_ENABLE_METRICS
+    app_thread_metrics_report(&s_period);
+#endif
+    app_thread_queues_auto_size(&s_period);
+    memset(&s_period, 0, sizeof(s_period));
+    s_samples = 0;
+}
+
+esp_err_t app_thread_queues_init()
+{
+    if (s_timer) {
+        return ESP_OK;
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = app_thread_queues_sample,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "thread_queues",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the Thread queues timer, err:%d", err);
+        return err;
+    }
+    return esp_timer_start_periodic(s_timer, THREAD_SAMPLE_PERIOD_US);
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+static esp_err_t app_thread_queues_console_handler(int argc, char **argv)
+{
+    esp_err_t err = ESP_OK;
+    if (argc == 1 && strcmp(argv[0], "auto") == 0) {
+        err = app_thread_queues_store(s_netif_queue_size, s_task_queue_size, true);
+    } else if (argc == 2) {
+        long netif_queue_size = strtol(argv[0], NULL, 0);
+        long task_queue_size = strtol(argv[1], NULL, 0);
+        if (netif_queue_size < APP_THREAD_QUEUE_SIZE_MIN || netif_queue_size > APP_THREAD_QUEUE_SIZE_MAX ||
+                task_queue_size < APP_THREAD_QUEUE_SIZE_MIN || task_queue_size > APP_THREAD_QUEUE_SIZE_MAX) {
+            printf("Queue sizes must be within %d and %d\n", APP_THREAD_QUEUE_SIZE_MIN, APP_THREAD_QUEUE_SIZE_MAX);
+            return ESP_ERR_INVALID_ARG;
+        }
+        err = app_thread_queues_store((uint8_t)netif_queue_size, (uint8_t)task_queue_size, false);
+    } else if (argc != 0) {
+        printf("Usage: matter esp otqueues [auto | <netif_size> <task_size>]\n");
+        return ESP_ERR_INVALID_ARG;
+    } else {
+        printf("Queues: netif %d, task %d%s\n", s_netif_queue_size, s_task_queue_size, s_auto_size ? " (auto)" : "");
+        printf("Since boot: buffers %d/%d at most, IPv6 send queue %d at most, %" PRIu32 " tx and %" PRIu32
+               " rx failures\n", s_overall.buffers_max, s_overall.buffers_total, s_overall.ip6_queue_max,
+               s_overall.tx_failures, s_overall.rx_failures);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        printf("Failed to store the queue sizes, err:%d\n", err);
+        return err;
+    }
+    printf("Applied from the next boot\n");
+    return ESP_OK;
+}
+
+esp_err_t app_thread_queues_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "otqueues",
+        .description = "Show the OpenThread load, or set the port queue sizes for the next boot. "
+                       "Usage: matter esp otqueues [auto | <netif_size> <task_size>]",
+        .handler = app_thread_queues_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
+#else
+esp_err_t app_thread_queues_init()
+{
+    return ESP_OK;
+}
+
+#if CONFIG_ENABLE_CHIP_SHELL
+esp_err_t app_thread_queues_register_commands()
+{
+    return ESP_OK;
+}
+#endif
+#endif
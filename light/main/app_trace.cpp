@@ -0,0 +1,44 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <esp_err.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_matter.h>
+#include <esp_matter_console.h>
+
+#include <app_priv.h>
+
+#if CONFIG_DIAG_ENABLE_TRACE && CONFIG_ENABLE_CHIP_SHELL
+#include <esp_diagnostics_trace.h>
+
+static esp_err_t app_trace_console_handler(int argc, char **argv)
+{
+    if (argc == 1 && strcmp(argv[0], "clear") == 0) {
+        esp_diag_trace_clear();
+        return ESP_OK;
+    }
+    if (argc != 0) {
+        printf("Usage: matter esp trace [clear]\n");
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_diag_trace_print_json();
+    return ESP_OK;
+}
+
+esp_err_t app_trace_register_commands()
+{
+    static esp_matter::console::command_t command = {
+        .name = "trace",
+        .description = "Print the trace events as Trace Event Format JSON, for Perfetto. Usage: matter esp trace [clear]",
+        .handler = app_trace_console_handler,
+    };
+    return esp_matter::console::add_commands(&command, 1);
+}
+#endif
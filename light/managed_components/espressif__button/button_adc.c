@@ -13,6 +13,9 @@
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+#include "esp_adc/adc_continuous.h"
+#endif
 #else
 #include "driver/gpio.h"
 #include "driver/adc.h"
@@ -44,6 +47,25 @@ static const char *TAG = "adc button";
 #define ADC1_BUTTON_CHANNEL_MAX ADC1_CHANNEL_MAX
 #define ADC_BUTTON_ATTEN        DEFAULT_ADC_ATTEN
 #endif
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+#error "CONFIG_ADC_BUTTON_CONTINUOUS_MODE requires ESP-IDF v5.0 or later"
+#endif
+#undef ADC_BUTTON_WIDTH
+#define ADC_BUTTON_WIDTH        SOC_ADC_DIGI_MAX_BITWIDTH
+#define ADC_BUTTON_FRAME_SIZE   (CONFIG_ADC_BUTTON_CONTINUOUS_FRAME_CONV * SOC_ADC_DIGI_DATA_BYTES_PER_CONV)
+#define ADC_BUTTON_FRAME_NUM    4
+#define ADC_BUTTON_SAMPLE_FREQ  SOC_ADC_SAMPLE_FREQ_THRES_LOW
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define ADC_BUTTON_OUTPUT_TYPE          ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_BUTTON_GET_CHANNEL(p_data)  ((p_data)->type1.channel)
+#define ADC_BUTTON_GET_DATA(p_data)     ((p_data)->type1.data)
+#else
+#define ADC_BUTTON_OUTPUT_TYPE          ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_BUTTON_GET_CHANNEL(p_data)  ((p_data)->type2.channel)
+#define ADC_BUTTON_GET_DATA(p_data)     ((p_data)->type2.data)
+#endif
+#endif
 #define ADC_BUTTON_ADC_UNIT     ADC_UNIT_1
 #define ADC_BUTTON_MAX_CHANNEL  CONFIG_ADC_BUTTON_MAX_CHANNEL
 #define ADC_BUTTON_MAX_BUTTON   CONFIG_ADC_BUTTON_MAX_BUTTON_PER_CHANNEL
@@ -58,6 +80,7 @@ typedef struct {
     uint8_t is_init;
     button_data_t btns[ADC_BUTTON_MAX_BUTTON];  /* all button on the channel */
     uint64_t last_time;  /* the last time of adc sample */
+    uint16_t vol;        /* the last voltage in mV sampled on the channel */
 } btn_adc_channel_t;
 
 typedef struct {
@@ -65,6 +88,12 @@ typedef struct {
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
     adc_cali_handle_t adc1_cali_handle;
     adc_oneshot_unit_handle_t adc1_handle;
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+    adc_continuous_handle_t adc1_cont_handle;
+    bool is_started;
+    uint64_t last_time;  /* the last time the conversion frames were drained */
+    uint8_t frame[ADC_BUTTON_FRAME_SIZE];
+#endif
 #else
     esp_adc_cal_characteristics_t adc_chars;
 #endif
@@ -144,6 +173,85 @@ static esp_err_t adc_calibration_init(adc_unit_t unit, adc_atten_t atten, adc_ca
 }
 #endif
 
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+/**
+ * @brief (Re)start the background conversion over all the initialized channels
+ */
+static esp_err_t adc_continuous_update_pattern(void)
+{
+    esp_err_t ret;
+    if (g_button.is_started) {
+        ret = adc_continuous_stop(g_button.adc1_cont_handle);
+        ADC_BTN_CHECK(ret == ESP_OK, "adc continuous stop fail!", ESP_FAIL);
+        g_button.is_started = false;
+    }
+
+    adc_digi_pattern_config_t pattern[ADC_BUTTON_MAX_CHANNEL] = {0};
+    uint32_t pattern_num = 0;
+    for (size_t i = 0; i < ADC_BUTTON_MAX_CHANNEL; i++) {
+        if (g_button.ch[i].is_init) {
+            pattern[pattern_num].atten = ADC_BUTTON_ATTEN;
+            pattern[pattern_num].channel = g_button.ch[i].channel;
+            pattern[pattern_num].unit = ADC_BUTTON_ADC_UNIT;
+            pattern[pattern_num].bit_width = ADC_BUTTON_WIDTH;
+            pattern_num++;
+        }
+    }
+    if (0 == pattern_num) {
+        return ESP_OK;
+    }
+
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = pattern_num,
+        .adc_pattern = pattern,
+        .sample_freq_hz = ADC_BUTTON_SAMPLE_FREQ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_BUTTON_OUTPUT_TYPE,
+    };
+    ret = adc_continuous_config(g_button.adc1_cont_handle, &dig_cfg);
+    ADC_BTN_CHECK(ret == ESP_OK, "adc continuous config fail!", ESP_FAIL);
+    ret = adc_continuous_start(g_button.adc1_cont_handle);
+    ADC_BTN_CHECK(ret == ESP_OK, "adc continuous start fail!", ESP_FAIL);
+    g_button.is_started = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Drain the conversion frames without waiting, the newest frame gives the averaged voltage of each channel
+ */
+static void adc_continuous_update_voltage(void)
+{
+    uint32_t len = 0;
+    uint32_t frame_len = 0;
+    while (adc_continuous_read(g_button.adc1_cont_handle, g_button.frame, ADC_BUTTON_FRAME_SIZE, &len, 0) == ESP_OK) {
+        frame_len = len;
+    }
+    if (0 == frame_len) {
+        return;
+    }
+
+    uint32_t sum[ADC_BUTTON_MAX_CHANNEL] = {0};
+    uint32_t cnt[ADC_BUTTON_MAX_CHANNEL] = {0};
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= frame_len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&g_button.frame[i];
+        int ch_index = find_channel(ADC_BUTTON_GET_CHANNEL(p));
+        if (ch_index >= 0) {
+            sum[ch_index] += ADC_BUTTON_GET_DATA(p);
+            cnt[ch_index]++;
+        }
+    }
+
+    for (size_t i = 0; i < ADC_BUTTON_MAX_CHANNEL; i++) {
+        if (cnt[i]) {
+            int voltage = 0;
+            adc_cali_raw_to_voltage(g_button.adc1_cali_handle, sum[i] / cnt[i], &voltage);
+            g_button.ch[i].vol = voltage;
+            ESP_LOGV(TAG, "Channel: %d\tRaw: %"PRIu32"\tVoltage: %dmV", g_button.ch[i].channel, sum[i] / cnt[i], voltage);
+        }
+    }
+}
+#endif
+
 esp_err_t button_adc_init(const button_adc_config_t *config)
 {
     ADC_BTN_CHECK(NULL != config, "Pointer of config is invalid", ESP_ERR_INVALID_ARG);
@@ -162,7 +270,15 @@ esp_err_t button_adc_init(const button_adc_config_t *config)
 
     /** initialize adc */
     if (0 == g_button.is_configured) {
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+        ADC_BTN_CHECK(NULL == config->adc_handle, "adc_handle is not supported in continuous mode", ESP_ERR_NOT_SUPPORTED);
+        adc_continuous_handle_cfg_t adc_config = {
+            .max_store_buf_size = ADC_BUTTON_FRAME_SIZE * ADC_BUTTON_FRAME_NUM,
+            .conv_frame_size = ADC_BUTTON_FRAME_SIZE,
+        };
+        esp_err_t ret = adc_continuous_new_handle(&adc_config, &g_button.adc1_cont_handle);
+        ADC_BTN_CHECK(ret == ESP_OK, "adc continuous new handle fail!", ESP_FAIL);
+#elif ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
         esp_err_t ret;
         if (NULL == config->adc_handle) {
             //ADC1 Init
@@ -193,7 +309,10 @@ esp_err_t button_adc_init(const button_adc_config_t *config)
 
     /** initialize adc channel */
     if (0 == g_button.ch[ch_index].is_init) {
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+        esp_err_t ret = adc_calibration_init(ADC_BUTTON_ADC_UNIT, ADC_BUTTON_ATTEN, &g_button.adc1_cali_handle);
+        ADC_BTN_CHECK(ret == ESP_OK, "ADC1 Calibration Init False", 0);
+#elif ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
         //ADC1 Config
         adc_oneshot_chan_cfg_t oneshot_config = {
             .bitwidth = ADC_BUTTON_WIDTH,
@@ -210,6 +329,11 @@ esp_err_t button_adc_init(const button_adc_config_t *config)
         g_button.ch[ch_index].channel = config->adc_channel;
         g_button.ch[ch_index].is_init = 1;
         g_button.ch[ch_index].last_time = 0;
+        g_button.ch[ch_index].vol = 0;
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+        ret = adc_continuous_update_pattern();
+        ADC_BTN_CHECK(ret == ESP_OK, "adc continuous update pattern fail!", ESP_FAIL);
+#endif
     }
     g_button.ch[ch_index].btns[config->button_index].max = config->max;
     g_button.ch[ch_index].btns[config->button_index].min = config->min;
@@ -240,6 +364,9 @@ esp_err_t button_adc_deinit(uint8_t channel, int button_index)
         g_button.ch[ch_index].is_init = 0;
         g_button.ch[ch_index].channel = ADC1_BUTTON_CHANNEL_MAX;
         ESP_LOGD(TAG, "all button is unused on channel%d, deinit the channel", g_button.ch[ch_index].channel);
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+        adc_continuous_update_pattern();
+#endif
     }
 
     /** check channel usage on the adc*/
@@ -250,17 +377,22 @@ esp_err_t button_adc_deinit(uint8_t channel, int button_index)
         }
     }
     if (unused_ch == ADC_BUTTON_MAX_CHANNEL && g_button.is_configured) { /**< if all channel is unused, deinit the adc */
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+        esp_err_t ret = adc_continuous_deinit(g_button.adc1_cont_handle);
+        ADC_BTN_CHECK(ret == ESP_OK, "adc continuous deinit fail", ESP_FAIL);
+#endif
         g_button.is_configured = false;
         memset(&g_button, 0, sizeof(adc_button_t));
         ESP_LOGD(TAG, "all channel is unused, , deinit adc");
     }
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0) && !CONFIG_ADC_BUTTON_CONTINUOUS_MODE
     esp_err_t ret = adc_oneshot_del_unit(g_button.adc1_handle);
     ADC_BTN_CHECK(ret == ESP_OK, "adc oneshot deinit fail", ESP_FAIL);
 #endif
     return ESP_OK;
 }
 
+#if !CONFIG_ADC_BUTTON_CONTINUOUS_MODE
 static uint32_t get_adc_volatge(uint8_t channel)
 {
     uint32_t adc_reading = 0;
@@ -287,10 +419,10 @@ static uint32_t get_adc_volatge(uint8_t channel)
 #endif
     return voltage;
 }
+#endif
 
 uint8_t button_adc_get_key_level(void *button_index)
 {
-    static uint16_t vol = 0;
     uint32_t ch = ADC_BUTTON_SPLIT_CHANNEL(button_index);
     uint32_t index = ADC_BUTTON_SPLIT_INDEX(button_index);
     ADC_BTN_CHECK(ch < ADC1_BUTTON_CHANNEL_MAX, "channel out of range", 0);
@@ -298,11 +430,20 @@ uint8_t button_adc_get_key_level(void *button_index)
     int ch_index = find_channel(ch);
     ADC_BTN_CHECK(ch_index >= 0, "The button_index is not init", 0);
 
+#if CONFIG_ADC_BUTTON_CONTINUOUS_MODE
+    /** The frames of all channels are drained at most once per 1ms, no conversion is waited for */
+    if ((esp_timer_get_time() - g_button.last_time) > 1000) {
+        adc_continuous_update_voltage();
+        g_button.last_time = esp_timer_get_time();
+    }
+#else
     /** It starts only when the elapsed time is more than 1ms */
     if ((esp_timer_get_time() - g_button.ch[ch_index].last_time) > 1000) {
-        vol = get_adc_volatge(ch);
+        g_button.ch[ch_index].vol = get_adc_volatge(ch);
         g_button.ch[ch_index].last_time = esp_timer_get_time();
     }
+#endif
+    uint16_t vol = g_button.ch[ch_index].vol;
 
     if (vol <= g_button.ch[ch_index].btns[index].max &&
             vol >= g_button.ch[ch_index].btns[index].min) {
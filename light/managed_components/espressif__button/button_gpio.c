@@ -5,11 +5,16 @@
 
 #include "esp_log.h"
 #include "driver/gpio.h"
+#include "soc/soc_caps.h"
+#include "soc/gpio_reg.h"
+#include "hal/gpio_ll.h"
 #include "button_gpio.h"
 #include "esp_sleep.h"
 
 static const char *TAG = "gpio button";
 
+static uint64_t g_gpio_levels = 0;  /* input levels of all pins at the last button_gpio_sample_levels() */
+
 #define GPIO_BTN_CHECK(a, str, ret_val)                          \
     if (!(a))                                                     \
     {                                                             \
@@ -80,6 +85,20 @@ uint8_t button_gpio_get_key_level(void *gpio_num)
     return (uint8_t)gpio_get_level((uint32_t)gpio_num);
 }
 
+void button_gpio_sample_levels(void)
+{
+    uint64_t levels = REG_READ(GPIO_IN_REG);
+#if SOC_GPIO_PIN_COUNT > 32
+    levels |= (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+#endif
+    g_gpio_levels = levels;
+}
+
+uint8_t button_gpio_get_sampled_level(void *gpio_num)
+{
+    return (g_gpio_levels >> (uint32_t)gpio_num) & 0x1;
+}
+
 esp_err_t button_gpio_set_intr(int gpio_num, gpio_int_type_t intr_type, gpio_isr_t isr_handler, void *args)
 {
     static bool isr_service_installed = false;
@@ -92,23 +111,33 @@ esp_err_t button_gpio_set_intr(int gpio_num, gpio_int_type_t intr_type, gpio_isr
     return ESP_OK;
 }
 
-esp_err_t button_gpio_intr_control(int gpio_num, bool enable)
+esp_err_t button_gpio_clear_intr(int gpio_num)
+{
+    gpio_intr_disable(gpio_num);
+    gpio_isr_handler_remove(gpio_num);
+    gpio_set_intr_type(gpio_num, GPIO_INTR_DISABLE);
+    return ESP_OK;
+}
+
+/* Disabling is called from the gpio isr, which also runs while the flash is written, it stays in IRAM and writes
+ * the registers itself instead of calling the driver from flash */
+esp_err_t IRAM_ATTR button_gpio_intr_control(int gpio_num, bool enable)
 {
     if (enable) {
         gpio_intr_enable(gpio_num);
     } else {
-        gpio_intr_disable(gpio_num);
+        gpio_ll_intr_disable(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num);
     }
     return ESP_OK;
 }
 
-esp_err_t button_gpio_enable_gpio_wakeup(uint32_t gpio_num, uint8_t active_level, bool enable)
+esp_err_t IRAM_ATTR button_gpio_enable_gpio_wakeup(uint32_t gpio_num, uint8_t active_level, bool enable)
 {
-    esp_err_t ret;
+    esp_err_t ret = ESP_OK;
     if (enable) {
         ret = gpio_wakeup_enable(gpio_num, active_level == 0 ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
     } else {
-        ret = gpio_wakeup_disable(gpio_num);
+        gpio_ll_wakeup_disable(GPIO_LL_GET_HW(GPIO_PORT_0), gpio_num);
     }
     return ret;
 }
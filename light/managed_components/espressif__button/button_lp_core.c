@@ -0,0 +1,210 @@
+/* SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_bit_defs.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/rtc_io.h"
+#include "ulp_lp_core.h"
+#include "ulp_button_lp.h"
+#include "lp_core/button_lp_core_shared.h"
+#include "button_lp_core.h"
+
+static const char *TAG = "lp core button";
+
+#define LP_CORE_BTN_CHECK(a, str, ret_val)                        \
+    if (!(a))                                                     \
+    {                                                             \
+        ESP_LOGE(TAG, "%s(%d): %s", __FUNCTION__, __LINE__, str); \
+        return (ret_val);                                         \
+    }
+
+extern const uint8_t lp_core_bin_start[] asm("_binary_ulp_button_lp_bin_start");
+extern const uint8_t lp_core_bin_end[] asm("_binary_ulp_button_lp_bin_end");
+
+#define SHARED ((volatile button_lp_shared_t *)&ulp_button_lp_shared)
+
+static portMUX_TYPE s_lp_core_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_started = false;
+static uint32_t s_owned;                    /* Slots of the buttons created since boot */
+static uint8_t s_levels[BUTTON_LP_MAX];     /* Gpio level of each slot, as of the last segment taken */
+
+static esp_err_t button_lp_core_start(void)
+{
+    /** The LP core kept scanning through the deep sleep, its state and the unread segments are kept */
+    if (esp_reset_reason() == ESP_RST_DEEPSLEEP && SHARED->magic == BUTTON_LP_MAGIC) {
+        ESP_LOGI(TAG, "LP core still running, %"PRIu32" segments pending", SHARED->write - SHARED->read);
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ulp_lp_core_load_binary(lp_core_bin_start, lp_core_bin_end - lp_core_bin_start);
+    LP_CORE_BTN_CHECK(ESP_OK == ret, "load LP core binary failed", ret);
+    memset((void *)SHARED, 0, sizeof(button_lp_shared_t));
+    SHARED->debounce_ticks = CONFIG_BUTTON_DEBOUNCE_TICKS;
+    SHARED->serial_ticks = CONFIG_BUTTON_SERIAL_TIME_MS / CONFIG_BUTTON_PERIOD_TIME_MS;
+    SHARED->magic = BUTTON_LP_MAGIC;
+
+    ulp_lp_core_cfg_t cfg = {
+        .wakeup_source = ULP_LP_CORE_WAKEUP_SOURCE_LP_TIMER,
+        .lp_timer_sleep_duration_us = CONFIG_BUTTON_PERIOD_TIME_MS * 1000,
+    };
+    ret = ulp_lp_core_run(&cfg);
+    LP_CORE_BTN_CHECK(ESP_OK == ret, "start LP core failed", ret);
+    return ESP_OK;
+}
+
+static esp_err_t button_lp_core_init_io(int32_t gpio_num, rtc_gpio_mode_t mode)
+{
+    LP_CORE_BTN_CHECK(rtc_gpio_is_valid_gpio(gpio_num), "GPIO is not a LP IO", ESP_ERR_INVALID_ARG);
+    rtc_gpio_init(gpio_num);
+    rtc_gpio_set_direction(gpio_num, mode);
+    return ESP_OK;
+}
+
+static bool button_lp_core_pin_used(int32_t gpio_num)
+{
+    for (int i = 0; i < BUTTON_LP_MAX; i++) {
+        volatile button_lp_slot_t *slot = &SHARED->slots[i];
+        if (slot->type != BUTTON_LP_SLOT_UNUSED &&
+                (slot->gpio_num == gpio_num || (slot->type == BUTTON_LP_SLOT_MATRIX && slot->col_gpio_num == gpio_num))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t button_lp_core_init(const button_lp_core_config_t *config, uint16_t long_press_ticks, uint16_t short_press_ticks, int *slot)
+{
+    LP_CORE_BTN_CHECK(NULL != config && NULL != slot, "Pointer of config is invalid", ESP_ERR_INVALID_ARG);
+    bool matrix = config->col_gpio_num >= 0;
+    uint8_t type = matrix ? BUTTON_LP_SLOT_MATRIX : BUTTON_LP_SLOT_GPIO;
+    uint8_t active_level = matrix ? 1 : config->active_level;
+
+    if (!s_started) {
+        esp_err_t ret = button_lp_core_start();
+        if (ESP_OK != ret) {
+            return ret;
+        }
+        ret = esp_sleep_enable_ulp_wakeup();
+        LP_CORE_BTN_CHECK(ESP_OK == ret, "enable LP core wakeup failed", ret);
+        s_started = true;
+    }
+
+    /** A slot still configured the same since before the deep sleep is taken back */
+    int index = -1;
+    for (int i = 0; i < BUTTON_LP_MAX; i++) {
+        volatile button_lp_slot_t *s = &SHARED->slots[i];
+        if (s_owned & BIT(i)) {
+            continue;
+        }
+        if (s->type == type && s->gpio_num == config->gpio_num && s->active_level == active_level &&
+                (!matrix || s->col_gpio_num == config->col_gpio_num)) {
+            index = i;
+            break;
+        }
+        if (index < 0 && s->type == BUTTON_LP_SLOT_UNUSED) {
+            index = i;
+        }
+    }
+    LP_CORE_BTN_CHECK(index >= 0, "No free LP core button slot", ESP_ERR_NO_MEM);
+
+    volatile button_lp_slot_t *s = &SHARED->slots[index];
+    if (s->type == BUTTON_LP_SLOT_UNUSED) {
+        if (matrix) {
+            LP_CORE_BTN_CHECK(ESP_OK == button_lp_core_init_io(config->gpio_num, RTC_GPIO_MODE_OUTPUT_ONLY), "row init failed", ESP_ERR_INVALID_ARG);
+            rtc_gpio_set_level(config->gpio_num, 0);
+            LP_CORE_BTN_CHECK(ESP_OK == button_lp_core_init_io(config->col_gpio_num, RTC_GPIO_MODE_INPUT_ONLY), "column init failed", ESP_ERR_INVALID_ARG);
+            rtc_gpio_pullup_dis(config->col_gpio_num);
+            rtc_gpio_pulldown_en(config->col_gpio_num);
+        } else {
+            LP_CORE_BTN_CHECK(ESP_OK == button_lp_core_init_io(config->gpio_num, RTC_GPIO_MODE_INPUT_ONLY), "gpio init failed", ESP_ERR_INVALID_ARG);
+            if (config->disable_pull) {
+                rtc_gpio_pullup_dis(config->gpio_num);
+                rtc_gpio_pulldown_dis(config->gpio_num);
+            } else if (active_level) {
+                rtc_gpio_pullup_dis(config->gpio_num);
+                rtc_gpio_pulldown_en(config->gpio_num);
+            } else {
+                rtc_gpio_pulldown_dis(config->gpio_num);
+                rtc_gpio_pullup_en(config->gpio_num);
+            }
+        }
+        s->gpio_num = config->gpio_num;
+        s->col_gpio_num = matrix ? config->col_gpio_num : 0;
+        s->active_level = active_level;
+    }
+    s->long_ticks = long_press_ticks;
+    s->short_ticks = short_press_ticks;
+    s_levels[index] = !active_level;
+    /** The LP core only scans the slot once its type is set */
+    __sync_synchronize();
+    s->type = type;
+    s_owned |= BIT(index);
+    *slot = index;
+    return ESP_OK;
+}
+
+esp_err_t button_lp_core_deinit(int slot)
+{
+    LP_CORE_BTN_CHECK(slot >= 0 && slot < BUTTON_LP_MAX, "Invalid slot", ESP_ERR_INVALID_ARG);
+    volatile button_lp_slot_t *s = &SHARED->slots[slot];
+    LP_CORE_BTN_CHECK(s->type != BUTTON_LP_SLOT_UNUSED, "Slot is not used", ESP_ERR_INVALID_ARG);
+    uint8_t type = s->type;
+    s->type = BUTTON_LP_SLOT_UNUSED;
+    s_owned &= ~BIT(slot);
+    __sync_synchronize();
+    if (!button_lp_core_pin_used(s->gpio_num)) {
+        rtc_gpio_deinit(s->gpio_num);
+    }
+    if (type == BUTTON_LP_SLOT_MATRIX && !button_lp_core_pin_used(s->col_gpio_num)) {
+        rtc_gpio_deinit(s->col_gpio_num);
+    }
+    return ESP_OK;
+}
+
+esp_err_t button_lp_core_set_ticks(int slot, uint16_t long_press_ticks, uint16_t short_press_ticks)
+{
+    LP_CORE_BTN_CHECK(slot >= 0 && slot < BUTTON_LP_MAX, "Invalid slot", ESP_ERR_INVALID_ARG);
+    volatile button_lp_slot_t *s = &SHARED->slots[slot];
+    LP_CORE_BTN_CHECK(s->type != BUTTON_LP_SLOT_UNUSED, "Slot is not used", ESP_ERR_INVALID_ARG);
+    s->long_ticks = long_press_ticks;
+    s->short_ticks = short_press_ticks;
+    return ESP_OK;
+}
+
+bool button_lp_core_read_segment(button_lp_core_segment_t *segment)
+{
+    portENTER_CRITICAL(&s_lp_core_lock);
+    uint32_t read = SHARED->read;
+    if (!s_started || read == SHARED->write) {
+        portEXIT_CRITICAL(&s_lp_core_lock);
+        return false;
+    }
+    /** The index is read before the segment it publishes */
+    __sync_synchronize();
+    volatile button_lp_segment_t *seg = &SHARED->segments[read % BUTTON_LP_SEGMENTS];
+    segment->slot = seg->slot;
+    segment->pressed = seg->pressed;
+    segment->ticks = seg->ticks;
+    __sync_synchronize();
+    SHARED->read = read + 1;
+    portEXIT_CRITICAL(&s_lp_core_lock);
+
+    if (segment->slot < BUTTON_LP_MAX) {
+        uint8_t active_level = SHARED->slots[segment->slot].active_level;
+        s_levels[segment->slot] = segment->pressed ? active_level : !active_level;
+    }
+    return true;
+}
+
+uint8_t button_lp_core_get_key_level(void *hardware_data)
+{
+    int slot = (int)hardware_data;
+    return slot >= 0 && slot < BUTTON_LP_MAX ? s_levels[slot] : 0;
+}
@@ -5,7 +5,10 @@
  */
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
+#include "soc/soc_caps.h"
+#include "soc/gpio_reg.h"
 #include "button_matrix.h"
 
 static const char *TAG = "matrix button";
@@ -17,33 +20,126 @@ static const char *TAG = "matrix button";
         return (ret_val);                                         \
     }
 
+#define MATRIX_BUTTON_MAX_ROW   16
+
+typedef struct {
+    int32_t gpio_num;
+    uint64_t levels;     /* input levels of all pins while the row is driven */
+} matrix_row_t;
+
+typedef struct {
+    matrix_row_t rows[MATRIX_BUTTON_MAX_ROW];
+    uint8_t row_num;
+    uint8_t pin_users[GPIO_NUM_MAX];  /* buttons using the pin as row or column */
+    uint64_t col_mask;
+    uint64_t last_time;  /* the last time of the matrix scan */
+    bool ghosting;
+} matrix_scanner_t;
+
+static matrix_scanner_t g_matrix = {0};
+
+static int find_row(int32_t gpio_num)
+{
+    for (int i = 0; i < g_matrix.row_num; i++) {
+        if (g_matrix.rows[i].gpio_num == gpio_num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline uint64_t matrix_read_inputs(void)
+{
+    uint64_t levels = REG_READ(GPIO_IN_REG);
+#if SOC_GPIO_PIN_COUNT > 32
+    levels |= (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+#endif
+    return levels;
+}
+
+/**
+ * @brief Strobe each row once and read every column in one go, then look for pressed key rectangles
+ */
+static void matrix_scan(void)
+{
+    for (int i = 0; i < g_matrix.row_num; i++) {
+        gpio_set_level(g_matrix.rows[i].gpio_num, 1);
+        g_matrix.rows[i].levels = matrix_read_inputs() & g_matrix.col_mask;
+        gpio_set_level(g_matrix.rows[i].gpio_num, 0);
+    }
+
+    /** Two rows sharing two pressed columns cannot be told apart from three keys pressed */
+    bool ghosting = false;
+    for (int i = 0; i < g_matrix.row_num && !ghosting; i++) {
+        for (int j = i + 1; j < g_matrix.row_num; j++) {
+            uint64_t common = g_matrix.rows[i].levels & g_matrix.rows[j].levels;
+            if (common & (common - 1)) {
+                ghosting = true;
+                break;
+            }
+        }
+    }
+    if (ghosting && !g_matrix.ghosting) {
+        ESP_LOGD(TAG, "ghosting detected, the pressed keys are ambiguous");
+    }
+    g_matrix.ghosting = ghosting;
+}
+
 esp_err_t button_matrix_init(const button_matrix_config_t *config)
 {
     MATRIX_BTN_CHECK(NULL != config, "Pointer of config is invalid", ESP_ERR_INVALID_ARG);
     MATRIX_BTN_CHECK(GPIO_IS_VALID_GPIO(config->row_gpio_num), "row GPIO number error", ESP_ERR_INVALID_ARG);
     MATRIX_BTN_CHECK(GPIO_IS_VALID_GPIO(config->col_gpio_num), "col GPIO number error", ESP_ERR_INVALID_ARG);
 
-    // set row gpio as output
-    gpio_config_t gpio_conf = {0};
-    gpio_conf.intr_type = GPIO_INTR_DISABLE;
-    gpio_conf.mode = GPIO_MODE_OUTPUT;
-    gpio_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
-    gpio_conf.pin_bit_mask = (1ULL << config->row_gpio_num);
-    gpio_config(&gpio_conf);
+    int row_index = find_row(config->row_gpio_num);
+    if (row_index < 0) {
+        MATRIX_BTN_CHECK(g_matrix.row_num < MATRIX_BUTTON_MAX_ROW, "exceed max row number", ESP_ERR_INVALID_STATE);
+        // set row gpio as output
+        gpio_config_t gpio_conf = {0};
+        gpio_conf.intr_type = GPIO_INTR_DISABLE;
+        gpio_conf.mode = GPIO_MODE_OUTPUT;
+        gpio_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+        gpio_conf.pin_bit_mask = (1ULL << config->row_gpio_num);
+        gpio_config(&gpio_conf);
+        g_matrix.rows[g_matrix.row_num].gpio_num = config->row_gpio_num;
+        g_matrix.rows[g_matrix.row_num].levels = 0;
+        g_matrix.row_num++;
+    }
+    g_matrix.pin_users[config->row_gpio_num]++;
 
-    // set col gpio as input
-    gpio_conf.mode = GPIO_MODE_INPUT;
-    gpio_conf.pin_bit_mask = (1ULL << config->col_gpio_num);
-    gpio_config(&gpio_conf);
+    if (0 == g_matrix.pin_users[config->col_gpio_num]++) {
+        // set col gpio as input
+        gpio_config_t gpio_conf = {0};
+        gpio_conf.intr_type = GPIO_INTR_DISABLE;
+        gpio_conf.mode = GPIO_MODE_INPUT;
+        gpio_conf.pull_down_en = GPIO_PULLDOWN_ENABLE;
+        gpio_conf.pin_bit_mask = (1ULL << config->col_gpio_num);
+        gpio_config(&gpio_conf);
+        g_matrix.col_mask |= (1ULL << config->col_gpio_num);
+    }
+    /** Rescan on the next read so the new key starts from a fresh snapshot */
+    g_matrix.last_time = 0;
 
     return ESP_OK;
 }
 
 esp_err_t button_matrix_deinit(int row_gpio_num, int col_gpio_num)
 {
+    MATRIX_BTN_CHECK(GPIO_IS_VALID_GPIO(row_gpio_num), "row GPIO number error", ESP_ERR_INVALID_ARG);
+    MATRIX_BTN_CHECK(GPIO_IS_VALID_GPIO(col_gpio_num), "col GPIO number error", ESP_ERR_INVALID_ARG);
+
     //Reset an gpio to default state (select gpio function, enable pullup and disable input and output).
-    gpio_reset_pin(row_gpio_num);
-    gpio_reset_pin(col_gpio_num);
+    if (g_matrix.pin_users[row_gpio_num] && 0 == --g_matrix.pin_users[row_gpio_num]) {
+        int row_index = find_row(row_gpio_num);
+        if (row_index >= 0) {
+            g_matrix.rows[row_index] = g_matrix.rows[--g_matrix.row_num];
+        }
+        gpio_reset_pin(row_gpio_num);
+    }
+    if (g_matrix.pin_users[col_gpio_num] && 0 == --g_matrix.pin_users[col_gpio_num]) {
+        g_matrix.col_mask &= ~(1ULL << col_gpio_num);
+        gpio_reset_pin(col_gpio_num);
+    }
     return ESP_OK;
 }
 
@@ -51,9 +147,19 @@ uint8_t button_matrix_get_key_level(void *hardware_data)
 {
     uint32_t row = MATRIX_BUTTON_SPLIT_ROW(hardware_data);
     uint32_t col = MATRIX_BUTTON_SPLIT_COL(hardware_data);
-    gpio_set_level(row, 1);
-    uint8_t level = gpio_get_level(col);
-    gpio_set_level(row, 0);
 
-    return level;
+    /** All keys share one scan per tick, it starts only when the elapsed time is more than 1ms */
+    if ((esp_timer_get_time() - g_matrix.last_time) > 1000) {
+        matrix_scan();
+        g_matrix.last_time = esp_timer_get_time();
+    }
+
+    int row_index = find_row(row);
+    MATRIX_BTN_CHECK(row_index >= 0, "The row is not init", 0);
+    return (g_matrix.rows[row_index].levels >> col) & 0x1;
+}
+
+bool button_matrix_is_ghosting(void)
+{
+    return g_matrix.ghosting;
 }
@@ -18,6 +18,7 @@ extern "C" {
 typedef struct {
     int32_t gpio_num;              /**< num of gpio */
     uint8_t active_level;          /**< gpio level when press down */
+    bool enable_intr;              /**< scan only after the gpio interrupt fires, the scan timer stops once all buttons are idle */
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
     bool enable_power_save;        /**< enable power save mode */
 #endif
@@ -53,6 +54,22 @@ esp_err_t button_gpio_deinit(int gpio_num);
  */
 uint8_t button_gpio_get_key_level(void *gpio_num);
 
+/**
+ * @brief Read the input levels of all gpios at once, for button_gpio_get_sampled_level
+ *
+ * The scan timer calls it once per tick, so that all gpio buttons see the same instant.
+ */
+void button_gpio_sample_levels(void);
+
+/**
+ * @brief Get the level of the button gpio at the last button_gpio_sample_levels
+ *
+ * @param gpio_num gpio number of button, it will be treated as a uint32_t variable.
+ *
+ * @return Level on gpio
+ */
+uint8_t button_gpio_get_sampled_level(void *gpio_num);
+
 /**
  * @brief Sets up interrupt for GPIO button.
  *
@@ -64,9 +81,19 @@ uint8_t button_gpio_get_key_level(void *gpio_num);
  */
 esp_err_t button_gpio_set_intr(int gpio_num, gpio_int_type_t intr_type, gpio_isr_t isr_handler, void *args);
 
+/**
+ * @brief Removes the interrupt set up by button_gpio_set_intr.
+ *
+ * @param gpio_num gpio number of button
+ * @return Always return ESP_OK
+ */
+esp_err_t button_gpio_clear_intr(int gpio_num);
+
 /**
  * @brief Enable or disable interrupt for GPIO button.
  *
+ * Disabling is IRAM safe, it can be called from an isr while the flash is written.
+ *
  * @param gpio_num gpio number of button
  * @param enable enable or disable
  * @return Always return ESP_OK
@@ -76,7 +103,8 @@ esp_err_t button_gpio_intr_control(int gpio_num, bool enable);
 /**
  * @brief Enable or disable GPIO wakeup functionality.
  *
- * This function allows enabling or disabling GPIO wakeup feature.
+ * This function allows enabling or disabling GPIO wakeup feature. Disabling is IRAM safe, it can be called from an
+ * isr while the flash is written.
  *
  * @param gpio_num GPIO number for wakeup functionality.
  * @param active_level Active level of the GPIO when triggered.
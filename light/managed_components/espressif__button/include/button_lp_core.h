@@ -0,0 +1,102 @@
+/* SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief LP core button configuration
+ *
+ *        The button is scanned and debounced by the LP core, which keeps running while the main CPU is in light or
+ *        deep sleep. The main CPU is only woken once an event of the press is due, the events then fire as for the
+ *        other buttons, with the same ticks. PRESS_DOWN and PRESS_UP of a click are delivered with the click, when
+ *        the short press time ran out.
+ */
+typedef struct {
+    int32_t gpio_num;              /**< LP IO of the button, or of the row for a matrix button */
+    int32_t col_gpio_num;          /**< LP IO of the column for a matrix button, -1 for a gpio button */
+    uint8_t active_level;          /**< gpio level when press down, matrix buttons are active high */
+    bool disable_pull;             /**< disable internal pull or not, for a gpio button */
+} button_lp_core_config_t;
+
+/**
+ * @brief One level of a button, as debounced by the LP core
+ */
+typedef struct {
+    uint8_t slot;                  /**< slot of the button, see button_lp_core_init */
+    bool pressed;                  /**< pressed or released */
+    uint16_t ticks;                /**< scan ticks the level lasted */
+} button_lp_core_segment_t;
+
+/**
+ * @brief Initialize a LP core button, the LP core program is loaded and started with the first one
+ *
+ *        After a wakeup from deep sleep the LP core kept scanning, a button created again with the same
+ *        configuration gets its slot back and the press which woke the chip up is not lost.
+ *
+ * @param config pointer of configuration struct
+ * @param long_press_ticks ticks of a long press
+ * @param short_press_ticks ticks of a short press
+ * @param[out] slot slot of the button
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG   Arguments are invalid, or the pins are not LP IOs.
+ *      - ESP_ERR_NO_MEM        All CONFIG_BUTTON_LP_CORE_MAX_BUTTONS slots are used.
+ */
+esp_err_t button_lp_core_init(const button_lp_core_config_t *config, uint16_t long_press_ticks, uint16_t short_press_ticks, int *slot);
+
+/**
+ * @brief Deinitialize a LP core button
+ *
+ * @param slot slot of the button
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG   The slot is not used.
+ */
+esp_err_t button_lp_core_deinit(int slot);
+
+/**
+ * @brief Update the press ticks the LP core decides the wakeups with
+ *
+ * @param slot slot of the button
+ * @param long_press_ticks ticks of a long press
+ * @param short_press_ticks ticks of a short press
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG   The slot is not used.
+ */
+esp_err_t button_lp_core_set_ticks(int slot, uint16_t long_press_ticks, uint16_t short_press_ticks);
+
+/**
+ * @brief Take the oldest segment published by the LP core
+ *
+ * @param[out] segment segment
+ *
+ * @return true if a segment was taken, false if there is none
+ */
+bool button_lp_core_read_segment(button_lp_core_segment_t *segment);
+
+/**
+ * @brief Get the level of a LP core button, as of the last segment taken
+ *
+ * @param hardware_data slot of the button
+ *
+ * @return gpio level of the button
+ */
+uint8_t button_lp_core_get_key_level(void *hardware_data);
+
+#ifdef __cplusplus
+}
+#endif
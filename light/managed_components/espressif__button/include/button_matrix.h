@@ -5,6 +5,8 @@
  */
 #pragma once
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -75,6 +77,16 @@ esp_err_t button_matrix_deinit(int row_gpio_num, int col_gpio_num);
  */
 uint8_t button_matrix_get_key_level(void *hardware_data);
 
+/**
+ * @brief Check if the last matrix scan saw ghosting.
+ *
+ * @return true if two driven rows share two or more active columns, the pressed keys can not be told apart then
+ *
+ * @note Every row is strobed once per scan and all columns are read with one register read,
+ *       every matrix button is then fed from that snapshot.
+ */
+bool button_matrix_is_ghosting(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,7 +11,12 @@
 #endif
 #include "button_gpio.h"
 #include "button_matrix.h"
+#if CONFIG_BUTTON_LP_CORE
+#include "button_lp_core.h"
+#endif
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,6 +39,19 @@ typedef struct {
 
 typedef void *button_handle_t;
 
+#if CONFIG_BUTTON_STATS
+/**
+ * @brief Statistics of the button scan timer, shared by all the buttons
+ *
+ */
+typedef struct {
+    uint32_t scans;                    /*!< Number of scans of the button list, one per timer tick */
+    uint32_t intr_wakeups;             /*!< Number of times a GPIO interrupt restarted the stopped scan timer */
+    uint64_t scan_cycles_sum;          /*!< CPU cycles spent in the scans, callbacks called directly included */
+    uint32_t scan_cycles_max;          /*!< CPU cycles of the longest scan */
+} button_stats_t;
+#endif
+
 /**
  * @brief Button events
  *
@@ -93,7 +111,10 @@ typedef enum {
     BUTTON_TYPE_GPIO,
     BUTTON_TYPE_ADC,
     BUTTON_TYPE_MATRIX,
-    BUTTON_TYPE_CUSTOM
+    BUTTON_TYPE_CUSTOM,
+#if CONFIG_BUTTON_LP_CORE
+    BUTTON_TYPE_LP_CORE,
+#endif
 } button_type_t;
 
 /**
@@ -133,9 +154,26 @@ typedef struct {
 #endif
         button_matrix_config_t matrix_button_config; /**< matrix key button configuration */
         button_custom_config_t custom_button_config;  /**< custom button configuration */
+#if CONFIG_BUTTON_LP_CORE
+        button_lp_core_config_t lp_core_button_config; /**< LP core button configuration */
+#endif
     }; /**< button configuration */
 } button_config_t;
 
+/**
+ * @brief Button event posted to the event queue, see iot_button_set_event_queue
+ *
+ */
+typedef struct {
+    button_handle_t btn_handle;                       /**< button the event fired on */
+    button_event_t event;                             /**< event that fired */
+    uint8_t repeat;                                   /**< repeat count when the event fired */
+    uint16_t long_press_hold_cnt;                     /**< long press hold count when the event fired */
+    uint32_t ticks_time;                              /**< pressed time(ms) when the event fired */
+    button_cb_t cb;                                   /**< registered callback */
+    void *usr_data;                                   /**< user data of the registered callback */
+} button_event_msg_t;
+
 /**
  * @brief Create a button
  *
@@ -343,6 +381,50 @@ esp_err_t iot_button_resume(void);
  */
 esp_err_t iot_button_stop(void);
 
+/**
+ * @brief Deliver the button callbacks through a queue instead of calling them in the button timer task.
+ *
+ *        Every callback that would run is posted as a button_event_msg_t with the button state at the time
+ *        the event fired, the app task receiving from the queue calls iot_button_dispatch_event_msg().
+ *        Slow callbacks then no longer delay the button scan or other esp_timer users.
+ *        Posting never blocks, events are dropped while the queue is full.
+ *
+ * @note The getters such as iot_button_get_event() return the live state of the button, not the one of the
+ *       message being dispatched. Use the fields of the message in queued callbacks that need them.
+ *
+ * @param queue Queue created with an item size of sizeof(button_event_msg_t), NULL to call the callbacks directly again
+ * @return
+ *     - ESP_OK on success
+ */
+esp_err_t iot_button_set_event_queue(QueueHandle_t queue);
+
+/**
+ * @brief Call the callback of a message received from the button event queue.
+ *
+ * @param msg Message received from the queue set with iot_button_set_event_queue()
+ */
+void iot_button_dispatch_event_msg(const button_event_msg_t *msg);
+
+#if CONFIG_BUTTON_STATS
+/**
+ * @brief Get the statistics of the button scan timer.
+ *
+ * @param stats Statistics accumulated since boot or since iot_button_reset_stats() was called
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG   stats is NULL
+ */
+esp_err_t iot_button_get_stats(button_stats_t *stats);
+
+/**
+ * @brief Clear the statistics of the button scan timer.
+ *
+ * @return
+ *     - ESP_OK on success
+ */
+esp_err_t iot_button_reset_stats(void);
+#endif
+
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
 /**
  * @brief Register a callback function for power saving.
@@ -9,6 +9,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/timers.h"
+#include "freertos/queue.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
@@ -17,8 +18,30 @@
 #endif
 #include "iot_button.h"
 #include "sdkconfig.h"
+#if CONFIG_BUTTON_STATS
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_cpu.h"
+#define STATS_CYCLE_COUNT() esp_cpu_get_cycle_count()
+#else
+#include "hal/cpu_hal.h"
+#define STATS_CYCLE_COUNT() cpu_hal_get_cycle_count()
+#endif
+#endif
 
 static const char *TAG = "button";
+
+#if CONFIG_DIAG_ENABLE_TRACE
+/* Weak, so that the events are only recorded when the application links the esp_diagnostics trace */
+extern void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg) __attribute__((weak));
+#define BUTTON_TRACE(phase, arg) do {                         \
+        if (esp_diag_trace_record) {                          \
+            esp_diag_trace_record("button_scan", phase, arg); \
+        }                                                     \
+    } while (0)
+#else
+#define BUTTON_TRACE(phase, arg)
+#endif
 static portMUX_TYPE s_button_lock = portMUX_INITIALIZER_UNLOCKED;
 #define BUTTON_ENTER_CRITICAL()           portENTER_CRITICAL(&s_button_lock)
 #define BUTTON_EXIT_CRITICAL()            portEXIT_CRITICAL(&s_button_lock)
@@ -53,8 +76,20 @@ typedef struct {
     button_cb_t cb;
     void *usr_data;
     button_event_data_t event_data;
+    uint32_t threshold;                /*!< Press ticks for long press events, clicks for BUTTON_MULTIPLE_CLICK, the array is sorted by it */
 } button_cb_info_t;
 
+/**
+ * @brief Cursors into the threshold sorted callback arrays, reset on every press down
+ *
+ */
+typedef struct {
+    uint16_t lp_start_next;            /*!< First BUTTON_LONG_PRESS_START callback not called yet */
+    uint16_t lp_up_base;               /*!< First BUTTON_LONG_PRESS_UP callback at or above the long press ticks */
+    uint16_t lp_up_next;               /*!< First BUTTON_LONG_PRESS_UP callback whose press ticks are not reached yet */
+    uint16_t click_next;               /*!< First BUTTON_MULTIPLE_CLICK callback with clicks not below repeat */
+} button_cursor_t;
+
 /**
  * @brief Structs to record individual key parameters
  *
@@ -70,6 +105,7 @@ typedef struct Button {
     uint8_t              active_level: 1;
     uint8_t              button_level: 1;
     uint8_t              enable_power_save: 1;
+    uint8_t              enable_intr: 1;           /*!< Woken up by the GPIO interrupt, the scan timer may stop while idle */
     button_event_t       event;
     uint8_t (*hal_button_Level)(void *hardware_data);
     esp_err_t (*hal_button_deinit)(void *hardware_data);
@@ -77,7 +113,7 @@ typedef struct Button {
     button_type_t        type;
     button_cb_info_t     *cb_info[BUTTON_EVENT_MAX];
     size_t               size[BUTTON_EVENT_MAX];
-    int                  count[2];
+    button_cursor_t      cursor;
     struct Button        *next;
 } button_dev_t;
 
@@ -85,9 +121,17 @@ typedef struct Button {
 static button_dev_t *g_head_handle = NULL;
 static esp_timer_handle_t g_button_timer_handle = NULL;
 static bool g_is_timer_running = false;
+static QueueHandle_t g_event_queue = NULL;
+#if CONFIG_BUTTON_LP_CORE
+static esp_timer_handle_t g_lp_core_timer_handle = NULL;
+#endif
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
 static button_power_save_config_t power_save_usr_cfg = {0};
 #endif
+#if CONFIG_BUTTON_STATS
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static button_stats_t g_stats = {0};
+#endif
 
 #define TICKS_INTERVAL    CONFIG_BUTTON_PERIOD_TIME_MS
 #define DEBOUNCE_TICKS    CONFIG_BUTTON_DEBOUNCE_TICKS //MAX 8
@@ -96,21 +140,93 @@ static button_power_save_config_t power_save_usr_cfg = {0};
 #define SERIAL_TICKS      (CONFIG_BUTTON_SERIAL_TIME_MS /TICKS_INTERVAL)
 #define TOLERANCE         (CONFIG_BUTTON_PERIOD_TIME_MS*4)
 
+/**
+  * @brief  Call the callback right away, or post it to the event queue for the app task when one is set.
+  */
+static void button_invoke_cb(button_dev_t *btn, const button_cb_info_t *cb_info)
+{
+    QueueHandle_t queue = g_event_queue;
+    if (!queue) {
+        cb_info->cb(btn, cb_info->usr_data);
+        return;
+    }
+
+    button_event_msg_t msg = {
+        .btn_handle = btn,
+        .event = btn->event,
+        .repeat = btn->repeat,
+        .long_press_hold_cnt = btn->long_press_hold_cnt,
+        .ticks_time = btn->ticks * TICKS_INTERVAL,
+        .cb = cb_info->cb,
+        .usr_data = cb_info->usr_data,
+    };
+    /** Never block the scan, a full queue drops the event */
+    if (xQueueSend(queue, &msg, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "event queue full, %s dropped", button_event_str[msg.event]);
+    }
+}
+
 #define CALL_EVENT_CB(ev)                                                   \
     if (btn->cb_info[ev]) {                                                 \
         for (int i = 0; i < btn->size[ev]; i++) {                           \
-            btn->cb_info[ev][i].cb(btn, btn->cb_info[ev][i].usr_data);      \
+            button_invoke_cb(btn, &btn->cb_info[ev][i]);                    \
         }                                                                   \
     }                                                                       \
 
 #define TIME_TO_TICKS(time, congfig_time)  (0 == (time))?congfig_time:(((time) / TICKS_INTERVAL))?((time) / TICKS_INTERVAL):1
 
+/**
+  * @brief  The callback array of the event changed, its cursors are parked so that the press in progress fires none of it.
+  *         Everything is compared again from the next press down.
+  */
+static inline void button_cursor_invalidate(button_dev_t *btn, button_event_t event)
+{
+    switch (event) {
+    case BUTTON_LONG_PRESS_START:
+        btn->cursor.lp_start_next = btn->size[event];
+        break;
+    case BUTTON_LONG_PRESS_UP:
+        btn->cursor.lp_up_base = 0;
+        btn->cursor.lp_up_next = 0;
+        break;
+    case BUTTON_MULTIPLE_CLICK:
+        btn->cursor.click_next = btn->size[event];
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+  * @brief  Move the cursor past the callbacks with a threshold below limit, without calling them.
+  */
+static inline void button_skip_threshold(button_dev_t *btn, button_event_t event, uint16_t *cursor, uint32_t limit)
+{
+    while (*cursor < btn->size[event] && btn->cb_info[event][*cursor].threshold < limit) {
+        (*cursor)++;
+    }
+}
+
+/**
+  * @brief  Call the callbacks from the cursor on whose threshold is reached. Costs a single compare when none is due.
+  */
+static inline void button_call_threshold_cb(button_dev_t *btn, button_event_t event, uint16_t *cursor, uint32_t reached)
+{
+    while (*cursor < btn->size[event] && btn->cb_info[event][*cursor].threshold <= reached) {
+        btn->event = (uint8_t)event;
+        button_invoke_cb(btn, &btn->cb_info[event][*cursor]);
+        (*cursor)++;
+    }
+}
+
 /**
   * @brief  Button driver core function, driver state machine.
   */
 static void button_handler(button_dev_t *btn)
 {
-    uint8_t read_gpio_level = btn->hal_button_Level(btn->hardware_data);
+    /** gpio buttons read the snapshot taken at the start of the tick */
+    uint8_t read_gpio_level = btn->hal_button_Level == button_gpio_get_key_level ?
+                              button_gpio_get_sampled_level(btn->hardware_data) : btn->hal_button_Level(btn->hardware_data);
 
     /** ticks counter working.. */
     if ((btn->state) > 0) {
@@ -131,6 +247,7 @@ static void button_handler(button_dev_t *btn)
     switch (btn->state) {
     case 0:
         if (btn->button_level == btn->active_level) {
+            memset(&btn->cursor, 0, sizeof(btn->cursor));
             btn->event = (uint8_t)BUTTON_PRESS_DOWN;
             CALL_EVENT_CB(BUTTON_PRESS_DOWN);
             btn->ticks = 0;
@@ -151,20 +268,12 @@ static void button_handler(button_dev_t *btn)
         } else if (btn->ticks >= btn->long_press_ticks) {
             btn->event = (uint8_t)BUTTON_LONG_PRESS_START;
             btn->state = 4;
-            /** Calling callbacks for BUTTON_LONG_PRESS_START */
-            uint32_t ticks_time = iot_button_get_ticks_time(btn);
-            int32_t diff = ticks_time - btn->long_press_ticks * TICKS_INTERVAL;
-            if (btn->cb_info[btn->event] && btn->count[0] == 0) {
-                if (abs(diff) <= TOLERANCE && btn->cb_info[btn->event][btn->count[0]].event_data.long_press.press_time == (btn->long_press_ticks * TICKS_INTERVAL)) {
-                    do {
-                        btn->cb_info[btn->event][btn->count[0]].cb(btn, btn->cb_info[btn->event][btn->count[0]].usr_data);
-                        btn->count[0]++;
-                        if (btn->count[0] >= btn->size[btn->event]) {
-                            break;
-                        }
-                    } while (btn->cb_info[btn->event][btn->count[0]].event_data.long_press.press_time == btn->long_press_ticks * TICKS_INTERVAL);
-                }
-            }
+            /** Press times below the long press ticks never fire, the others are called once reached */
+            button_skip_threshold(btn, BUTTON_LONG_PRESS_START, &btn->cursor.lp_start_next, btn->long_press_ticks);
+            button_call_threshold_cb(btn, BUTTON_LONG_PRESS_START, &btn->cursor.lp_start_next, btn->ticks);
+            button_skip_threshold(btn, BUTTON_LONG_PRESS_UP, &btn->cursor.lp_up_next, btn->long_press_ticks);
+            btn->cursor.lp_up_base = btn->cursor.lp_up_next;
+            button_skip_threshold(btn, BUTTON_LONG_PRESS_UP, &btn->cursor.lp_up_next, btn->ticks + 1);
         }
         break;
 
@@ -174,6 +283,7 @@ static void button_handler(button_dev_t *btn)
             CALL_EVENT_CB(BUTTON_PRESS_DOWN);
             btn->event = (uint8_t)BUTTON_PRESS_REPEAT;
             btn->repeat++;
+            button_skip_threshold(btn, BUTTON_MULTIPLE_CLICK, &btn->cursor.click_next, btn->repeat);
             CALL_EVENT_CB(BUTTON_PRESS_REPEAT); // repeat hit
             btn->ticks = 0;
             btn->state = 3;
@@ -188,18 +298,8 @@ static void button_handler(button_dev_t *btn)
 
             btn->event = (uint8_t)BUTTON_MULTIPLE_CLICK;
 
-            /** Calling the callbacks for MULTIPLE BUTTON CLICKS */
-            for (int i = 0; i < btn->size[btn->event]; i++) {
-                if (btn->repeat == btn->cb_info[btn->event][i].event_data.multiple_clicks.clicks) {
-                    do {
-                        btn->cb_info[btn->event][i].cb(btn, btn->cb_info[btn->event][i].usr_data);
-                        i++;
-                        if (i >= btn->size[btn->event]) {
-                            break;
-                        }
-                    } while (btn->cb_info[btn->event][i].event_data.multiple_clicks.clicks == btn->repeat);
-                }
-            }
+            /** Calling the callbacks for MULTIPLE BUTTON CLICKS, the cursor already skipped the smaller click counts */
+            button_call_threshold_cb(btn, BUTTON_MULTIPLE_CLICK, &btn->cursor.click_next, btn->repeat);
 
             btn->event = (uint8_t)BUTTON_PRESS_REPEAT_DONE;
             CALL_EVENT_CB(BUTTON_PRESS_REPEAT_DONE); // repeat hit
@@ -232,77 +332,25 @@ static void button_handler(button_dev_t *btn)
                 btn->event = (uint8_t)BUTTON_LONG_PRESS_HOLD;
                 btn->long_press_hold_cnt++;
                 CALL_EVENT_CB(BUTTON_LONG_PRESS_HOLD);
-
-                /** Calling callbacks for BUTTON_LONG_PRESS_START based on press_time */
-                uint32_t ticks_time = iot_button_get_ticks_time(btn);
-                if (btn->cb_info[BUTTON_LONG_PRESS_START]) {
-                    button_cb_info_t *cb_info = btn->cb_info[BUTTON_LONG_PRESS_START];
-                    uint16_t time = cb_info[btn->count[0]].event_data.long_press.press_time;
-                    if (btn->long_press_ticks * TICKS_INTERVAL > time) {
-                        for (int i = btn->count[0] + 1; i < btn->size[BUTTON_LONG_PRESS_START]; i++) {
-                            time = cb_info[i].event_data.long_press.press_time;
-                            if (btn->long_press_ticks * TICKS_INTERVAL <= time) {
-                                btn->count[0] = i;
-                                break;
-                            }
-                        }
-                    }
-                    if (btn->count[0] < btn->size[BUTTON_LONG_PRESS_START] && abs((int)ticks_time - (int)time) <= TOLERANCE) {
-                        btn->event = (uint8_t)BUTTON_LONG_PRESS_START;
-                        do {
-                            cb_info[btn->count[0]].cb(btn, cb_info[btn->count[0]].usr_data);
-                            btn->count[0]++;
-                            if (btn->count[0] >= btn->size[BUTTON_LONG_PRESS_START]) {
-                                break;
-                            }
-                        } while (time == cb_info[btn->count[0]].event_data.long_press.press_time);
-                    }
-                }
-
-                /** Updating counter for BUTTON_LONG_PRESS_UP press_time */
-                if (btn->cb_info[BUTTON_LONG_PRESS_UP]) {
-                    button_cb_info_t *cb_info = btn->cb_info[BUTTON_LONG_PRESS_UP];
-                    uint16_t time = cb_info[btn->count[1] + 1].event_data.long_press.press_time;
-                    if (btn->long_press_ticks * TICKS_INTERVAL > time) {
-                        for (int i = btn->count[1] + 1; i < btn->size[BUTTON_LONG_PRESS_UP]; i++) {
-                            time = cb_info[i].event_data.long_press.press_time;
-                            if (btn->long_press_ticks * TICKS_INTERVAL <= time) {
-                                btn->count[1] = i;
-                                break;
-                            }
-                        }
-                    }
-                    if (btn->count[1] + 1 < btn->size[BUTTON_LONG_PRESS_UP] && abs((int)ticks_time - (int)time) <= TOLERANCE) {
-                        do {
-                            btn->count[1]++;
-                            if (btn->count[1] + 1 >= btn->size[BUTTON_LONG_PRESS_UP]) {
-                                break;
-                            }
-                        } while (time == cb_info[btn->count[1] + 1].event_data.long_press.press_time);
-                    }
-                }
             }
+
+            /** Longer press times, only the next pending callback of each event is compared */
+            button_call_threshold_cb(btn, BUTTON_LONG_PRESS_START, &btn->cursor.lp_start_next, btn->ticks);
+            button_skip_threshold(btn, BUTTON_LONG_PRESS_UP, &btn->cursor.lp_up_next, btn->ticks + 1);
         } else { //releasd
 
             btn->event = BUTTON_LONG_PRESS_UP;
 
-            /** calling callbacks for BUTTON_LONG_PRESS_UP press_time */
-            if (btn->cb_info[btn->event] && btn->count[1] >= 0) {
+            /** calling the callbacks for the longest BUTTON_LONG_PRESS_UP press_time reached */
+            if (btn->cursor.lp_up_next > btn->cursor.lp_up_base) {
                 button_cb_info_t *cb_info = btn->cb_info[btn->event];
-                do {
-                    cb_info[btn->count[1]].cb(btn, cb_info[btn->count[1]].usr_data);
-                    if (!btn->count[1]) {
-                        break;
-                    }
-                    btn->count[1]--;
-                } while (cb_info[btn->count[1]].event_data.long_press.press_time == cb_info[btn->count[1] + 1].event_data.long_press.press_time);
-
-                /** Reset the counter */
-                btn->count[1] = -1;
-            }
-            /** Reset counter */
-            if (btn->cb_info[BUTTON_LONG_PRESS_START]) {
-                btn->count[0] = 0;
+                uint16_t i = btn->cursor.lp_up_next - 1;
+                while (i > btn->cursor.lp_up_base && cb_info[i - 1].threshold == cb_info[i].threshold) {
+                    i--;
+                }
+                for (; i < btn->cursor.lp_up_next; i++) {
+                    button_invoke_cb(btn, &cb_info[i]);
+                }
             }
 
             btn->event = (uint8_t)BUTTON_PRESS_UP;
@@ -318,52 +366,137 @@ static void button_handler(button_dev_t *btn)
 
 static void button_cb(void *args)
 {
+    BUTTON_TRACE('B', 0);
+#if CONFIG_BUTTON_STATS
+    uint32_t start_cycles = STATS_CYCLE_COUNT();
+#endif
     button_dev_t *target;
-    /*!< When all buttons enter the BUTTON_NONE_PRESS state, the system enters low-power mode */
+    /*!< When all buttons are interrupt driven and back to BUTTON_NONE_PRESS, the scan timer is stopped */
+    bool enter_idle_flag = true;
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
     bool enter_power_save_flag = true;
 #endif
+    button_gpio_sample_levels();
     for (target = g_head_handle; target; target = target->next) {
+#if CONFIG_BUTTON_LP_CORE
+        /*!< Scanned by the LP core, replayed by button_lp_core_cb */
+        if (target->type == BUTTON_TYPE_LP_CORE) {
+            continue;
+        }
+#endif
         button_handler(target);
+        if (!(target->enable_intr && target->debounce_cnt == 0 && target->event == BUTTON_NONE_PRESS)) {
+            enter_idle_flag = false;
+        }
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
-        if (!(target->enable_power_save && target->debounce_cnt == 0 && target->event == BUTTON_NONE_PRESS)) {
+        if (!target->enable_power_save) {
             enter_power_save_flag = false;
         }
 #endif
     }
-#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
-    if (enter_power_save_flag) {
-        /*!< Stop esp timer for power save */
+    if (enter_idle_flag) {
+        /*!< Stop esp timer, the next press is caught by the level interrupt even if it is already held */
         if (g_is_timer_running) {
             esp_timer_stop(g_button_timer_handle);
             g_is_timer_running = false;
         }
         for (target = g_head_handle; target; target = target->next) {
-            if (target->type == BUTTON_TYPE_GPIO && target->enable_power_save) {
-                button_gpio_intr_control((int)(target->hardware_data), true);
+            if (target->type != BUTTON_TYPE_GPIO) {
+                continue;
+            }
+            button_gpio_intr_control((int)(target->hardware_data), true);
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+            if (target->enable_power_save) {
                 button_gpio_enable_gpio_wakeup((uint32_t)(target->hardware_data), target->active_level, true);
             }
+#endif
         }
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
         /*!< Notify the user that the Button has entered power save mode by calling this callback function. */
-        if (power_save_usr_cfg.enter_power_save_cb) {
+        if (enter_power_save_flag && power_save_usr_cfg.enter_power_save_cb) {
             power_save_usr_cfg.enter_power_save_cb(power_save_usr_cfg.usr_data);
         }
+#endif
+    }
+#if CONFIG_BUTTON_STATS
+    uint32_t cycles = STATS_CYCLE_COUNT() - start_cycles;
+    portENTER_CRITICAL(&s_stats_lock);
+    g_stats.scans++;
+    g_stats.scan_cycles_sum += cycles;
+    if (cycles > g_stats.scan_cycles_max) {
+        g_stats.scan_cycles_max = cycles;
     }
+    portEXIT_CRITICAL(&s_stats_lock);
 #endif
+    BUTTON_TRACE('E', enter_idle_flag);
 }
 
-#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
-static void IRAM_ATTR button_power_save_isr_handler(void* arg)
+#if CONFIG_BUTTON_LP_CORE
+/**
+  * @brief  Replay the levels debounced by the LP core through the state machine, one call per scan tick they lasted.
+  *         The events fire with the ticks of the LP core scan, only later.
+  */
+static void button_lp_core_cb(void *args)
+{
+    button_lp_core_segment_t segment;
+    while (button_lp_core_read_segment(&segment)) {
+        button_dev_t *btn;
+        for (btn = g_head_handle; btn; btn = btn->next) {
+            if (btn->type == BUTTON_TYPE_LP_CORE && (int)btn->hardware_data == segment.slot) {
+                break;
+            }
+        }
+        if (!btn) {
+            continue;
+        }
+        uint8_t level = segment.pressed ? btn->active_level : !btn->active_level;
+        for (uint32_t i = 0; i < segment.ticks; i++) {
+            /*!< Already debounced, skip the debounce of the state machine */
+            btn->button_level = level;
+            button_handler(btn);
+        }
+    }
+}
+
+static esp_err_t button_lp_core_timer_start(void)
+{
+    if (g_lp_core_timer_handle) {
+        return ESP_OK;
+    }
+    /*!< Never wakes the chip up from light sleep, the LP core does once an event is due */
+    esp_timer_create_args_t lp_core_timer = {
+        .callback = button_lp_core_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "button_lp_core",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t ret = esp_timer_create(&lp_core_timer, &g_lp_core_timer_handle);
+    BTN_CHECK(ESP_OK == ret, "LP core timer create failed", ret);
+    return esp_timer_start_periodic(g_lp_core_timer_handle, CONFIG_BUTTON_LP_CORE_POLL_TIME_MS * 1000U);
+}
+#endif
+
+static void IRAM_ATTR button_gpio_isr_handler(void* arg)
 {
+    button_dev_t *btn = (button_dev_t *)arg;
     if (!g_is_timer_running) {
         esp_timer_start_periodic(g_button_timer_handle, TICKS_INTERVAL * 1000U);
         g_is_timer_running = true;
+#if CONFIG_BUTTON_STATS
+        portENTER_CRITICAL_ISR(&s_stats_lock);
+        g_stats.intr_wakeups++;
+        portEXIT_CRITICAL_ISR(&s_stats_lock);
+#endif
+    }
+    /*!< Level interrupt, keep it off until the scan timer goes idle again */
+    button_gpio_intr_control((int)(btn->hardware_data), false);
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+    if (btn->enable_power_save) {
+        /*!< disable gpio wakeup not need active level*/
+        button_gpio_enable_gpio_wakeup((uint32_t)(btn->hardware_data), 0, false);
     }
-    button_gpio_intr_control((int)arg, false);
-    /*!< disable gpio wakeup not need active level*/
-    button_gpio_enable_gpio_wakeup((uint32_t)arg, 0, false);
-}
 #endif
+}
 
 static button_dev_t *button_create_com(uint8_t active_level, uint8_t (*hal_get_key_state)(void *hardware_data), void *hardware_data, uint16_t long_press_ticks, uint16_t short_press_ticks)
 {
@@ -412,13 +545,29 @@ static esp_err_t button_delete_com(button_dev_t *btn)
 
     /* count button number */
     uint16_t number = 0;
+#if CONFIG_BUTTON_LP_CORE
+    uint16_t lp_core_number = 0;
+#endif
     button_dev_t *target = g_head_handle;
     while (target) {
+#if CONFIG_BUTTON_LP_CORE
+        if (target->type == BUTTON_TYPE_LP_CORE) {
+            lp_core_number++;
+        }
+#endif
         target = target->next;
         number++;
     }
     ESP_LOGD(TAG, "remain btn number=%d", number);
 
+#if CONFIG_BUTTON_LP_CORE
+    if (0 == lp_core_number && g_lp_core_timer_handle) {
+        esp_timer_stop(g_lp_core_timer_handle);
+        esp_timer_delete(g_lp_core_timer_handle);
+        g_lp_core_timer_handle = NULL;
+    }
+#endif
+
     if (0 == number && g_is_timer_running) { /**<  if all button is deleted, stop the timer */
         esp_timer_stop(g_button_timer_handle);
         esp_timer_delete(g_button_timer_handle);
@@ -445,12 +594,17 @@ button_handle_t iot_button_create(const button_config_t *config)
         ret = button_gpio_init(cfg);
         BTN_CHECK(ESP_OK == ret, "gpio button init failed", NULL);
         btn = button_create_com(cfg->active_level, button_gpio_get_key_level, (void *)cfg->gpio_num, long_press_time, short_press_time);
-#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
-        if (cfg->enable_power_save) {
-            btn->enable_power_save = cfg->enable_power_save;
-            button_gpio_set_intr(cfg->gpio_num, cfg->active_level == 0 ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL, button_power_save_isr_handler, (void *)cfg->gpio_num);
+        if (!btn) {
+            break;
         }
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        btn->enable_power_save = cfg->enable_power_save;
 #endif
+        if (cfg->enable_intr || btn->enable_power_save) {
+            btn->enable_intr = 1;
+            button_gpio_set_intr(cfg->gpio_num, cfg->active_level == 0 ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL, button_gpio_isr_handler, btn);
+            button_gpio_intr_control(cfg->gpio_num, true);
+        }
     } break;
 #if CONFIG_SOC_ADC_SUPPORTED
     case BUTTON_TYPE_ADC: {
@@ -466,6 +620,23 @@ button_handle_t iot_button_create(const button_config_t *config)
         BTN_CHECK(ESP_OK == ret, "matrix button init failed", NULL);
         btn = button_create_com(1, button_matrix_get_key_level, (void *)MATRIX_BUTTON_COMBINE(cfg->row_gpio_num, cfg->col_gpio_num), long_press_time, short_press_time);
     } break;
+#if CONFIG_BUTTON_LP_CORE
+    case BUTTON_TYPE_LP_CORE: {
+        const button_lp_core_config_t *cfg = &(config->lp_core_button_config);
+        int slot;
+        ret = button_lp_core_init(cfg, long_press_time, short_press_time, &slot);
+        BTN_CHECK(ESP_OK == ret, "LP core button init failed", NULL);
+        ret = button_lp_core_timer_start();
+        if (ESP_OK != ret) {
+            button_lp_core_deinit(slot);
+            return NULL;
+        }
+        btn = button_create_com(cfg->col_gpio_num >= 0 ? 1 : cfg->active_level, button_lp_core_get_key_level, (void *)slot, long_press_time, short_press_time);
+        if (!btn) {
+            button_lp_core_deinit(slot);
+        }
+    } break;
+#endif
     case BUTTON_TYPE_CUSTOM: {
         if (config->custom_button_config.button_custom_init) {
             ret = config->custom_button_config.button_custom_init(config->custom_button_config.priv);
@@ -487,7 +658,12 @@ button_handle_t iot_button_create(const button_config_t *config)
     }
     BTN_CHECK(NULL != btn, "button create failed", NULL);
     btn->type = config->type;
-    if (!btn->enable_power_save && !g_is_timer_running) {
+#if CONFIG_BUTTON_LP_CORE
+    if (btn->type == BUTTON_TYPE_LP_CORE) {
+        return (button_handle_t)btn;
+    }
+#endif
+    if (!btn->enable_intr && !g_is_timer_running) {
         esp_timer_start_periodic(g_button_timer_handle, TICKS_INTERVAL * 1000U);
         g_is_timer_running = true;
     }
@@ -501,6 +677,9 @@ esp_err_t iot_button_delete(button_handle_t btn_handle)
     button_dev_t *btn = (button_dev_t *)btn_handle;
     switch (btn->type) {
     case BUTTON_TYPE_GPIO:
+        if (btn->enable_intr) {
+            button_gpio_clear_intr((int)(btn->hardware_data));
+        }
         ret = button_gpio_deinit((int)(btn->hardware_data));
         break;
 #if CONFIG_SOC_ADC_SUPPORTED
@@ -517,6 +696,11 @@ esp_err_t iot_button_delete(button_handle_t btn_handle)
         }
 
         break;
+#if CONFIG_BUTTON_LP_CORE
+    case BUTTON_TYPE_LP_CORE:
+        ret = button_lp_core_deinit((int)(btn->hardware_data));
+        break;
+#endif
     default:
         break;
     }
@@ -555,74 +739,40 @@ esp_err_t iot_button_register_event_cb(button_handle_t btn_handle, button_event_
     BTN_CHECK(!(event == BUTTON_LONG_PRESS_START || event == BUTTON_LONG_PRESS_UP) || event_cfg.event_data.long_press.press_time > btn->short_press_ticks * TICKS_INTERVAL, "event_data is invalid", ESP_ERR_INVALID_ARG);
     BTN_CHECK(event != BUTTON_MULTIPLE_CLICK || event_cfg.event_data.multiple_clicks.clicks, "event_data is invalid", ESP_ERR_INVALID_ARG);
 
-    if (!btn->cb_info[event]) {
-        btn->cb_info[event] = calloc(1, sizeof(button_cb_info_t));
-        BTN_CHECK(NULL != btn->cb_info[event], "calloc cb_info failed", ESP_ERR_NO_MEM);
-        if (event == BUTTON_LONG_PRESS_START) {
-            btn->count[0] = 0;
-        } else if (event == BUTTON_LONG_PRESS_UP) {
-            btn->count[1] = -1;
-        }
-    } else {
-        button_cb_info_t *p = realloc(btn->cb_info[event], sizeof(button_cb_info_t) * (btn->size[event] + 1));
-        BTN_CHECK(NULL != p, "realloc cb_info failed", ESP_ERR_NO_MEM);
-        btn->cb_info[event] = p;
+    uint32_t threshold = 0;
+    if (event == BUTTON_LONG_PRESS_START || event == BUTTON_LONG_PRESS_UP) {
+        uint16_t press_time = event_cfg.event_data.long_press.press_time;
+        BTN_CHECK(press_time / TICKS_INTERVAL > btn->short_press_ticks, "press_time event_data is less than short_press_ticks", ESP_ERR_INVALID_ARG);
+        threshold = press_time / TICKS_INTERVAL;
+    } else if (event == BUTTON_MULTIPLE_CLICK) {
+        threshold = event_cfg.event_data.multiple_clicks.clicks;
     }
 
-    btn->cb_info[event][btn->size[event]].cb = cb;
-    btn->cb_info[event][btn->size[event]].usr_data = usr_data;
+    button_cb_info_t *p = realloc(btn->cb_info[event], sizeof(button_cb_info_t) * (btn->size[event] + 1));
+    BTN_CHECK(NULL != p, "realloc cb_info failed", ESP_ERR_NO_MEM);
+
+    /** Inserting in threshold order, callbacks with the same threshold keep their registration order */
+    btn->cb_info[event] = p;
+    size_t pos = btn->size[event];
+    while (pos > 0 && p[pos - 1].threshold > threshold) {
+        p[pos] = p[pos - 1];
+        pos--;
+    }
+    p[pos].cb = cb;
+    p[pos].usr_data = usr_data;
+    p[pos].event_data = event_cfg.event_data;
+    p[pos].threshold = threshold;
     btn->size[event]++;
+    button_cursor_invalidate(btn, event);
 
-    /** Inserting the event_data in sorted manner */
     if (event == BUTTON_LONG_PRESS_START || event == BUTTON_LONG_PRESS_UP) {
         uint16_t press_time = event_cfg.event_data.long_press.press_time;
-        BTN_CHECK(press_time / TICKS_INTERVAL > btn->short_press_ticks, "press_time event_data is less than short_press_ticks", ESP_ERR_INVALID_ARG);
-        if (btn->size[event] >= 2) {
-            for (int i = btn->size[event] - 2; i >= 0; i--) {
-                if (btn->cb_info[event][i].event_data.long_press.press_time > press_time) {
-                    btn->cb_info[event][i + 1] = btn->cb_info[event][i];
-
-                    btn->cb_info[event][i].event_data.long_press.press_time = press_time;
-                    btn->cb_info[event][i].cb = cb;
-                    btn->cb_info[event][i].usr_data = usr_data;
-                } else {
-                    btn->cb_info[event][i + 1].event_data.long_press.press_time = press_time;
-                    btn->cb_info[event][i + 1].cb = cb;
-                    btn->cb_info[event][i + 1].usr_data = usr_data;
-                    break;
-                }
-            }
-        } else {
-            btn->cb_info[event][btn->size[event] - 1].event_data.long_press.press_time = press_time;
-        }
-
         int32_t press_ticks = press_time / TICKS_INTERVAL;
         if (btn->short_press_ticks < press_ticks && press_ticks < btn->long_press_ticks) {
             iot_button_set_param(btn, BUTTON_LONG_PRESS_TIME_MS, (void*)(intptr_t)press_time);
         }
     }
 
-    if (event == BUTTON_MULTIPLE_CLICK) {
-        if (btn->size[event] >= 2) {
-            for (int i = btn->size[event] - 2; i >= 0; i--) {
-                if (btn->cb_info[event][i].event_data.multiple_clicks.clicks > event_cfg.event_data.multiple_clicks.clicks) {
-                    btn->cb_info[event][i + 1] = btn->cb_info[event][i];
-
-                    btn->cb_info[event][i].event_data.multiple_clicks.clicks = event_cfg.event_data.multiple_clicks.clicks;
-                    btn->cb_info[event][i].cb = cb;
-                    btn->cb_info[event][i].usr_data = usr_data;
-                } else {
-                    btn->cb_info[event][i + 1].event_data.multiple_clicks.clicks = event_cfg.event_data.multiple_clicks.clicks;
-                    btn->cb_info[event][i + 1].cb = cb;
-                    btn->cb_info[event][i + 1].usr_data = usr_data;
-                    break;
-                }
-            }
-        } else {
-            btn->cb_info[event][btn->size[event] - 1].event_data.multiple_clicks.clicks = event_cfg.event_data.multiple_clicks.clicks;
-        }
-    }
-
     return ESP_OK;
 }
 
@@ -633,20 +783,10 @@ esp_err_t iot_button_unregister_cb(button_handle_t btn_handle, button_event_t ev
     button_dev_t *btn = (button_dev_t *) btn_handle;
     BTN_CHECK(NULL != btn->cb_info[event], "No callbacks registered for the event", ESP_ERR_INVALID_STATE);
 
-    if (btn->cb_info[event]) {
-        free(btn->cb_info[event]);
-
-        /** Reset the counter */
-        if (event == BUTTON_LONG_PRESS_START) {
-            btn->count[0] = 0;
-        } else if (event == BUTTON_LONG_PRESS_UP) {
-            btn->count[1] = -1;
-        }
-
-    }
-
+    free(btn->cb_info[event]);
     btn->cb_info[event] = NULL;
     btn->size[event] = 0;
+    button_cursor_invalidate(btn, event);
     return ESP_OK;
 }
 
@@ -674,7 +814,7 @@ esp_err_t iot_button_unregister_event(button_handle_t btn_handle, button_event_c
                 }
             }
             check = i;
-            for (int j = i; j <= btn->size[event] - 1; j++) {
+            for (int j = i; j < btn->size[event] - 1; j++) {
                 btn->cb_info[event][j] = btn->cb_info[event][j + 1];
             }
 
@@ -688,6 +828,7 @@ esp_err_t iot_button_unregister_event(button_handle_t btn_handle, button_event_c
                 btn->cb_info[event] = NULL;
                 btn->size[event] = 0;
             }
+            button_cursor_invalidate(btn, event);
             break;
         }
     }
@@ -775,6 +916,11 @@ esp_err_t iot_button_set_param(button_handle_t btn_handle, button_param_t param,
         break;
     }
     BUTTON_EXIT_CRITICAL();
+#if CONFIG_BUTTON_LP_CORE
+    if (btn->type == BUTTON_TYPE_LP_CORE) {
+        return button_lp_core_set_ticks((int)(btn->hardware_data), btn->long_press_ticks, btn->short_press_ticks);
+    }
+#endif
     return ESP_OK;
 }
 
@@ -808,6 +954,38 @@ esp_err_t iot_button_stop(void)
     return ESP_OK;
 }
 
+esp_err_t iot_button_set_event_queue(QueueHandle_t queue)
+{
+    g_event_queue = queue;
+    return ESP_OK;
+}
+
+void iot_button_dispatch_event_msg(const button_event_msg_t *msg)
+{
+    if (msg && msg->cb) {
+        msg->cb(msg->btn_handle, msg->usr_data);
+    }
+}
+
+#if CONFIG_BUTTON_STATS
+esp_err_t iot_button_get_stats(button_stats_t *stats)
+{
+    BTN_CHECK(NULL != stats, "Pointer of stats is invalid", ESP_ERR_INVALID_ARG);
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = g_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+    return ESP_OK;
+}
+
+esp_err_t iot_button_reset_stats(void)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    memset(&g_stats, 0, sizeof(g_stats));
+    portEXIT_CRITICAL(&s_stats_lock);
+    return ESP_OK;
+}
+#endif
+
 #if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
 esp_err_t iot_button_register_power_save_cb(const button_power_save_config_t *config)
 {
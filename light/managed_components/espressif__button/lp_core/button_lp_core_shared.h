@@ -0,0 +1,53 @@
+/* SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/**
+ * Memory shared by the button program of the LP core and button_lp_core.c, in LP RAM.
+ *
+ * The LP core scans every slot each CONFIG_BUTTON_PERIOD_TIME_MS, debounces it and follows the press with the same
+ * states as button_handler(). The debounced levels of a press are published as segments, a level and the ticks it
+ * lasted, and the main CPU is only woken once a press reached a point where an event fires: long press start or hold,
+ * release of a long press, end of the clicks. The main CPU replays the segments through button_handler().
+ */
+
+#define BUTTON_LP_MAX           CONFIG_BUTTON_LP_CORE_MAX_BUTTONS
+#define BUTTON_LP_SEGMENTS      64
+#define BUTTON_LP_MAGIC         0x50544c42      /* "BLTP", the program was loaded and configured */
+
+#define BUTTON_LP_SLOT_UNUSED   0
+#define BUTTON_LP_SLOT_GPIO     1
+#define BUTTON_LP_SLOT_MATRIX   2
+
+typedef struct {
+    uint8_t type;               /* BUTTON_LP_SLOT_*, written last by the main CPU */
+    uint8_t gpio_num;           /* LP IO of a gpio button, or of the row of a matrix button */
+    uint8_t col_gpio_num;       /* LP IO of the column of a matrix button */
+    uint8_t active_level;       /* Level of a pressed gpio button, matrix buttons are active high */
+    uint16_t long_ticks;        /* Copy of long_press_ticks of the button */
+    uint16_t short_ticks;       /* Copy of short_press_ticks of the button */
+} button_lp_slot_t;
+
+typedef struct {
+    uint8_t slot;
+    uint8_t pressed;
+    uint16_t ticks;
+} button_lp_segment_t;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t debounce_ticks;
+    uint8_t serial_ticks;
+    uint16_t reserved;
+    button_lp_slot_t slots[BUTTON_LP_MAX];
+    uint32_t write;             /* Segments published, only written by the LP core */
+    uint32_t read;              /* Segments replayed, only written by the main CPU */
+    uint32_t dropped;           /* Segments lost because the ring was full */
+    button_lp_segment_t segments[BUTTON_LP_SEGMENTS];
+} button_lp_shared_t;
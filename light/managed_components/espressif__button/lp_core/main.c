@@ -0,0 +1,163 @@
+/* SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * Button program of the LP core, run once per CONFIG_BUTTON_PERIOD_TIME_MS by the LP timer.
+ * The states mirror button_handler() of iot_button.c, keep them in step.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ulp_lp_core_utils.h"
+#include "ulp_lp_core_gpio.h"
+#include "button_lp_core_shared.h"
+
+#define MATRIX_SETTLE_CYCLES    16
+
+volatile button_lp_shared_t button_lp_shared;
+
+typedef struct {
+    uint8_t state;              /* Same states as button_dev_t */
+    uint8_t pressed;            /* Debounced level */
+    uint8_t debounce_cnt;
+    uint16_t seg_ticks;         /* Ticks of the current level not published yet */
+    uint32_t level_ticks;       /* Ticks of the current level */
+    uint32_t press_ticks;       /* Ticks of the press that just ended */
+} button_lp_state_t;
+
+/* LP RAM is kept between the runs of the program */
+static button_lp_state_t s_states[BUTTON_LP_MAX];
+
+static bool button_lp_read(volatile button_lp_slot_t *slot)
+{
+    if (slot->type == BUTTON_LP_SLOT_MATRIX) {
+        ulp_lp_core_gpio_set_level((lp_io_num_t)slot->gpio_num, 1);
+        ulp_lp_core_delay_cycles(MATRIX_SETTLE_CYCLES);
+        bool pressed = ulp_lp_core_gpio_get_level((lp_io_num_t)slot->col_gpio_num) == 1;
+        ulp_lp_core_gpio_set_level((lp_io_num_t)slot->gpio_num, 0);
+        return pressed;
+    }
+    return ulp_lp_core_gpio_get_level((lp_io_num_t)slot->gpio_num) == slot->active_level;
+}
+
+static void button_lp_publish(uint8_t index, button_lp_state_t *s)
+{
+    if (!s->seg_ticks) {
+        return;
+    }
+    uint32_t write = button_lp_shared.write;
+    if (write - button_lp_shared.read >= BUTTON_LP_SEGMENTS) {
+        button_lp_shared.dropped++;
+    } else {
+        volatile button_lp_segment_t *seg = &button_lp_shared.segments[write % BUTTON_LP_SEGMENTS];
+        seg->slot = index;
+        seg->pressed = s->pressed;
+        seg->ticks = s->seg_ticks;
+        /* The segment is written before the main CPU can see it */
+        __sync_synchronize();
+        button_lp_shared.write = write + 1;
+    }
+    s->seg_ticks = 0;
+}
+
+/**
+ * @brief Scan one slot, true when an event of the press is due and the main CPU has to replay it
+ */
+static bool button_lp_scan(uint8_t index, volatile button_lp_slot_t *slot, button_lp_state_t *s)
+{
+    bool pressed = button_lp_read(slot);
+    if (pressed != s->pressed) {
+        if (++s->debounce_cnt >= button_lp_shared.debounce_ticks) {
+            button_lp_publish(index, s);
+            s->pressed = pressed;
+            s->press_ticks = s->level_ticks;
+            s->level_ticks = 0;
+            s->debounce_cnt = 0;
+        }
+    } else {
+        s->debounce_cnt = 0;
+    }
+
+    /* Released and idle, there is nothing to replay */
+    if (s->state == 0 && !s->pressed) {
+        return false;
+    }
+    s->level_ticks++;
+    if (++s->seg_ticks == UINT16_MAX) {
+        button_lp_publish(index, s);
+    }
+
+    uint32_t long_ticks = slot->long_ticks;
+    uint32_t serial_ticks = button_lp_shared.serial_ticks ? button_lp_shared.serial_ticks : 1;
+    switch (s->state) {
+    case 0:
+        s->state = 1;
+        break;
+    case 1:
+        /* button_handler() counts the ticks from 0 at the press down */
+        if (!s->pressed) {
+            s->state = 2;
+        } else if (s->level_ticks >= long_ticks + 1) {
+            s->state = 4;
+            return true;
+        }
+        break;
+    case 2:
+        if (s->pressed) {
+            s->state = 3;
+        } else if (s->level_ticks >= (uint32_t)slot->short_ticks + 2) {
+            s->state = 0;
+            return true;
+        }
+        break;
+    case 3:
+        if (!s->pressed) {
+            if (s->press_ticks < slot->short_ticks) {
+                s->state = 2;
+            } else {
+                s->state = 0;
+                return true;
+            }
+        }
+        break;
+    case 4:
+        if (!s->pressed) {
+            s->state = 0;
+            return true;
+        }
+        /* Long press hold, and the longer press times of BUTTON_LONG_PRESS_START are checked then */
+        return (s->level_ticks - long_ticks - 1) % serial_ticks == 0;
+    default:
+        s->state = 0;
+        break;
+    }
+    return false;
+}
+
+int main(void)
+{
+    if (button_lp_shared.magic != BUTTON_LP_MAGIC) {
+        return 0;
+    }
+
+    bool wakeup = false;
+    for (uint8_t i = 0; i < BUTTON_LP_MAX; i++) {
+        volatile button_lp_slot_t *slot = &button_lp_shared.slots[i];
+        button_lp_state_t *s = &s_states[i];
+        if (slot->type == BUTTON_LP_SLOT_UNUSED) {
+            *s = (button_lp_state_t) {0};
+            continue;
+        }
+        if (button_lp_scan(i, slot, s)) {
+            button_lp_publish(i, s);
+            wakeup = true;
+        }
+    }
+
+    if (wakeup) {
+        ulp_lp_core_wakeup_main_processor();
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+/* SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include "iot_button.h"
+#include "sdkconfig.h"
+
+#if CONFIG_BUTTON_STATS
+
+/* Same wiring as the auto-test: GPIO 45 drives the button on GPIO 0 */
+#define BENCH_BUTTON_IO_NUM   0
+#define BENCH_LOOPBACK_IO_NUM 45
+#define BENCH_PRESSES         50
+#define BENCH_IDLE_MS         2000
+#define BENCH_SCAN_MS         1000
+#define BENCH_MAX_BUTTONS     32
+
+static SemaphoreHandle_t s_pressed;
+static volatile int64_t s_press_us;
+static button_handle_t s_bench_btns[BENCH_MAX_BUTTONS];
+
+static void bench_press_down_cb(void *arg, void *data)
+{
+    s_press_us = esp_timer_get_time();
+    xSemaphoreGive(s_pressed);
+}
+
+static void bench_loopback_init(void)
+{
+    gpio_config_t io_conf = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_OUTPUT,
+        .pin_bit_mask = (1ULL << BENCH_LOOPBACK_IO_NUM),
+        .pull_down_en = 0,
+        .pull_up_en = 0,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, gpio_config(&io_conf));
+    gpio_set_level(BENCH_LOOPBACK_IO_NUM, 1);
+}
+
+static void bench_latency(bool enable_intr)
+{
+    button_config_t cfg = {
+        .type = BUTTON_TYPE_GPIO,
+        .gpio_button_config = {
+            .gpio_num = BENCH_BUTTON_IO_NUM,
+            .active_level = 0,
+            .enable_intr = enable_intr,
+        },
+    };
+    button_handle_t btn = iot_button_create(&cfg);
+    TEST_ASSERT_NOT_NULL(btn);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_button_register_cb(btn, BUTTON_PRESS_DOWN, bench_press_down_cb, NULL));
+    /* Let the button settle on the released level, and the interrupt mode stop its timer */
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_BUTTON_SHORT_PRESS_TIME_MS + 100));
+
+    int64_t sum_us = 0;
+    int64_t min_us = INT64_MAX;
+    int64_t max_us = 0;
+    for (int i = 0; i < BENCH_PRESSES; i++) {
+        /* Spread the edges over the scan period */
+        vTaskDelay(pdMS_TO_TICKS(i % (CONFIG_BUTTON_PERIOD_TIME_MS + 1)));
+        int64_t edge_us = esp_timer_get_time();
+        gpio_set_level(BENCH_LOOPBACK_IO_NUM, 0);
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(s_pressed, pdMS_TO_TICKS(500)));
+        int64_t latency_us = s_press_us - edge_us;
+        sum_us += latency_us;
+        min_us = latency_us < min_us ? latency_us : min_us;
+        max_us = latency_us > max_us ? latency_us : max_us;
+        vTaskDelay(pdMS_TO_TICKS(50));
+        gpio_set_level(BENCH_LOOPBACK_IO_NUM, 1);
+        /* Wait for the single click to end so that the next press starts from idle */
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BUTTON_SHORT_PRESS_TIME_MS + 100));
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, iot_button_reset_stats());
+    vTaskDelay(pdMS_TO_TICKS(BENCH_IDLE_MS));
+    button_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_button_get_stats(&stats));
+
+    printf("BENCH %-9s press_down latency_us min=%" PRId64 " avg=%" PRId64 " max=%" PRId64
+           " idle wakeups/s=%" PRIu32 "\n", enable_intr ? "interrupt" : "polling", min_us, sum_us / BENCH_PRESSES,
+           max_us, stats.scans * 1000 / BENCH_IDLE_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_button_delete(btn));
+}
+
+TEST_CASE("gpio button press latency bench", "[button][bench]")
+{
+    s_pressed = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(s_pressed);
+    bench_loopback_init();
+
+    bench_latency(false);
+    bench_latency(true);
+
+    gpio_reset_pin(BENCH_LOOPBACK_IO_NUM);
+    vSemaphoreDelete(s_pressed);
+    vTaskDelay(pdMS_TO_TICKS(100));
+}
+
+static uint8_t bench_released_get_key_value(void *param)
+{
+    return 1;
+}
+
+TEST_CASE("button scan cost bench", "[button][bench]")
+{
+    button_config_t cfg = {
+        .type = BUTTON_TYPE_CUSTOM,
+        .custom_button_config = {
+            .button_custom_get_key_value = bench_released_get_key_value,
+            .active_level = 0,
+        },
+    };
+
+    int count = 0;
+    for (int target = 1; target <= BENCH_MAX_BUTTONS; target *= 2) {
+        for (; count < target; count++) {
+            s_bench_btns[count] = iot_button_create(&cfg);
+            TEST_ASSERT_NOT_NULL(s_bench_btns[count]);
+            TEST_ASSERT_EQUAL(ESP_OK, iot_button_register_cb(s_bench_btns[count], BUTTON_PRESS_DOWN,
+                                                             bench_press_down_cb, NULL));
+        }
+        TEST_ASSERT_EQUAL(ESP_OK, iot_button_reset_stats());
+        vTaskDelay(pdMS_TO_TICKS(BENCH_SCAN_MS));
+        button_stats_t stats;
+        TEST_ASSERT_EQUAL(ESP_OK, iot_button_get_stats(&stats));
+        TEST_ASSERT_GREATER_THAN(0, stats.scans);
+
+        printf("BENCH polling  buttons=%-2d scans/s=%-4" PRIu32 " cycles/scan avg=%" PRIu64 " max=%" PRIu32
+               " cycles/button=%" PRIu64 "\n", count, stats.scans * 1000 / BENCH_SCAN_MS,
+               stats.scan_cycles_sum / stats.scans, stats.scan_cycles_max, stats.scan_cycles_sum / stats.scans / count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_button_delete(s_bench_btns[i]));
+        s_bench_btns[i] = NULL;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+}
+
+#endif
@@ -27,3 +27,16 @@ def test_button(dut: Dut)-> None:
     dut.expect_exact('Press ENTER to see the list of tests.')
     dut.write('[auto]')
     dut.expect_unity_test_output(timeout = 300)
+
+@pytest.mark.target('esp32s3')
+@pytest.mark.env('button')
+@pytest.mark.parametrize(
+    'config',
+    [
+        'defaults',
+    ],
+)
+def test_button_bench(dut: Dut)-> None:
+    dut.expect_exact('Press ENTER to see the list of tests.')
+    dut.write('[bench]')
+    dut.expect_unity_test_output(timeout = 300)
@@ -0,0 +1,312 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "unity.h"
+#include "cbor.h"
+
+/* Encodes and parses payloads shaped like the ones of esp_insights: metric points, logs and metrics meta.
+ * Only tinycbor is measured, the payload contents are generated up front. */
+
+#define BENCH_BUF_SIZE   4096
+#define BENCH_ITERATIONS 500
+#define BENCH_ITEMS      24            /*!< Points, logs or meta entries per payload, fits in BENCH_BUF_SIZE */
+#define BENCH_STR_MAX    32
+
+static uint8_t s_buf[BENCH_BUF_SIZE];
+static volatile bool s_count_allocs;
+static volatile uint32_t s_allocs;
+static volatile uint32_t s_sink;
+
+/* CONFIG_HEAP_USE_HOOKS, counts the allocations of the code under measurement */
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (s_count_allocs) {
+        s_allocs++;
+    }
+}
+
+void esp_heap_trace_free_hook(void *ptr)
+{
+}
+
+typedef size_t (*bench_encode_fn_t)(uint8_t *buf, size_t size);
+
+static const char *const s_tags[] = {"heap", "wifi", "thread", "light", "matter"};
+static const char *const s_keys[] = {"free", "min_free", "rssi", "tx_fail", "level", "sessions"};
+static char s_meta_keys[BENCH_ITEMS][BENCH_STR_MAX];
+
+static CborError bench_encode_name(CborEncoder *map, int i)
+{
+    CborEncoder key_arr;
+    CborError err = cbor_encode_text_stringz(map, "n");
+    err |= cbor_encoder_create_array(map, &key_arr, CborIndefiniteLength);
+    err |= cbor_encode_text_stringz(&key_arr, s_tags[i % 5]);
+    err |= cbor_encode_text_stringz(&key_arr, s_keys[i % 6]);
+    err |= cbor_encoder_close_container(map, &key_arr);
+    return err;
+}
+
+// [{"n": [<tag>, <key>], "v": <value>, "ts": <ts>}, ...], one in four aggregated with "st", "cnt", "min", "max"
+static size_t bench_encode_metrics(uint8_t *buf, size_t size)
+{
+    CborEncoder encoder, array, map;
+    cbor_encoder_init(&encoder, buf, size, 0);
+    CborError err = cbor_encoder_create_array(&encoder, &array, CborIndefiniteLength);
+    for (int i = 0; i < BENCH_ITEMS; i++) {
+        uint64_t ts = 1700000000000000ULL + i * 1000003ULL;
+        err |= cbor_encoder_create_map(&array, &map, CborIndefiniteLength);
+        err |= bench_encode_name(&map, i);
+        err |= cbor_encode_text_stringz(&map, "v");
+        err |= cbor_encode_uint(&map, 180000 + i * 37);
+        err |= cbor_encode_text_stringz(&map, "ts");
+        err |= cbor_encode_uint(&map, ts);
+        if (i % 4 == 0) {
+            err |= cbor_encode_text_stringz(&map, "st");
+            err |= cbor_encode_uint(&map, ts - 60000000ULL);
+            err |= cbor_encode_text_stringz(&map, "cnt");
+            err |= cbor_encode_uint(&map, 60);
+            err |= cbor_encode_text_stringz(&map, "min");
+            err |= cbor_encode_int(&map, -90 + i);
+            err |= cbor_encode_text_stringz(&map, "max");
+            err |= cbor_encode_int(&map, 200000 + i);
+        }
+        err |= cbor_encoder_close_container(&array, &map);
+    }
+    err |= cbor_encoder_close_container(&encoder, &array);
+    return err == CborNoError ? cbor_encoder_get_buffer_size(&encoder, buf) : 0;
+}
+
+// [{"ts": <ts>, "tag": <tag>, "pc": <pc>, "ro": <fmt>, "av": [<args>], "task": <name>}, ...]
+static size_t bench_encode_logs(uint8_t *buf, size_t size)
+{
+    CborEncoder encoder, array, map, args;
+    cbor_encoder_init(&encoder, buf, size, 0);
+    CborError err = cbor_encoder_create_array(&encoder, &array, CborIndefiniteLength);
+    for (int i = 0; i < BENCH_ITEMS; i++) {
+        err |= cbor_encoder_create_map(&array, &map, CborIndefiniteLength);
+        err |= cbor_encode_text_stringz(&map, "ts");
+        err |= cbor_encode_uint(&map, 1700000000000000ULL + i * 2000017ULL);
+        err |= cbor_encode_text_stringz(&map, "tag");
+        err |= cbor_encode_text_stringz(&map, s_tags[i % 5]);
+        err |= cbor_encode_text_stringz(&map, "pc");
+        err |= cbor_encode_uint(&map, 0x42001234 + i * 4);
+        err |= cbor_encode_text_stringz(&map, "ro");
+        err |= cbor_encode_uint(&map, 0x3c012340 + i * 16);
+        err |= cbor_encode_text_stringz(&map, "av");
+        err |= cbor_encoder_create_array(&map, &args, CborIndefiniteLength);
+        err |= cbor_encode_int(&args, -i);
+        err |= cbor_encode_text_stringz(&args, "ESP_ERR_TIMEOUT");
+        err |= cbor_encoder_close_container(&map, &args);
+        err |= cbor_encode_text_stringz(&map, "task");
+        err |= cbor_encode_text_stringz(&map, i % 2 ? "CHIP" : "ot_task");
+        err |= cbor_encoder_close_container(&array, &map);
+    }
+    err |= cbor_encoder_close_container(&encoder, &array);
+    return err == CborNoError ? cbor_encoder_get_buffer_size(&encoder, buf) : 0;
+}
+
+// {<key>: {"tag": <tag>, "label": <label>, "path": <path>, "data_type": <type>, "unit": <unit>}, ...}
+static size_t bench_encode_meta(uint8_t *buf, size_t size)
+{
+    CborEncoder encoder, map, entry;
+    cbor_encoder_init(&encoder, buf, size, 0);
+    CborError err = cbor_encoder_create_map(&encoder, &map, CborIndefiniteLength);
+    for (int i = 0; i < BENCH_ITEMS; i++) {
+        err |= cbor_encode_text_stringz(&map, s_meta_keys[i]);
+        err |= cbor_encoder_create_map(&map, &entry, CborIndefiniteLength);
+        err |= cbor_encode_text_stringz(&entry, "tag");
+        err |= cbor_encode_text_stringz(&entry, s_tags[i % 5]);
+        err |= cbor_encode_text_stringz(&entry, "label");
+        err |= cbor_encode_text_stringz(&entry, "Minimum free heap");
+        err |= cbor_encode_text_stringz(&entry, "path");
+        err |= cbor_encode_text_stringz(&entry, "heap.internal");
+        err |= cbor_encode_text_stringz(&entry, "data_type");
+        err |= cbor_encode_uint(&entry, 1 + i % 4);
+        err |= cbor_encode_text_stringz(&entry, "unit");
+        err |= cbor_encode_text_stringz(&entry, "bytes");
+        err |= cbor_encoder_close_container(&map, &entry);
+    }
+    err |= cbor_encoder_close_container(&encoder, &map);
+    return err == CborNoError ? cbor_encoder_get_buffer_size(&encoder, buf) : 0;
+}
+
+typedef enum {
+    BENCH_PARSE_CHUNK,                 /*!< Strings read in place from the buffer */
+    BENCH_PARSE_COPY,                  /*!< Strings copied to a stack buffer */
+    BENCH_PARSE_DUP,                   /*!< Strings duplicated on the heap */
+} bench_parse_mode_t;
+
+static const char *const s_parse_mode_str[] = {"chunk", "copy", "dup"};
+
+static CborError bench_parse_string(CborValue *it, bench_parse_mode_t mode)
+{
+    CborError err;
+    switch (mode) {
+    case BENCH_PARSE_CHUNK: {
+        err = cbor_value_begin_string_iteration(it);
+        while (err == CborNoError) {
+            const char *ptr;
+            size_t len;
+            err = cbor_value_get_text_string_chunk(it, &ptr, &len, it);
+            if (err == CborNoError) {
+                s_sink += len ? (uint8_t)ptr[0] : 0;
+            }
+        }
+        if (err != CborErrorNoMoreStringChunks) {
+            return err;
+        }
+        return cbor_value_finish_string_iteration(it);
+    }
+    case BENCH_PARSE_COPY: {
+        char str[BENCH_STR_MAX];
+        size_t len = sizeof(str);
+        err = cbor_value_copy_text_string(it, str, &len, it);
+        s_sink += len ? (uint8_t)str[0] : 0;
+        return err;
+    }
+    case BENCH_PARSE_DUP: {
+        char *str;
+        size_t len;
+        err = cbor_value_dup_text_string(it, &str, &len, it);
+        if (err == CborNoError) {
+            s_sink += len ? (uint8_t)str[0] : 0;
+            free(str);
+        }
+        return err;
+    }
+    default:
+        return CborErrorUnknownType;
+    }
+}
+
+/* Reads every value, as a decoder of these payloads would */
+static CborError bench_parse_value(CborValue *it, bench_parse_mode_t mode, int depth)
+{
+    while (!cbor_value_at_end(it)) {
+        CborError err;
+        switch (cbor_value_get_type(it)) {
+        case CborArrayType:
+        case CborMapType: {
+            CborValue recursed;
+            if (depth == 0) {
+                return CborErrorNestingTooDeep;
+            }
+            err = cbor_value_enter_container(it, &recursed);
+            if (err == CborNoError) {
+                err = bench_parse_value(&recursed, mode, depth - 1);
+            }
+            if (err == CborNoError) {
+                err = cbor_value_leave_container(it, &recursed);
+            }
+            break;
+        }
+        case CborIntegerType: {
+            int64_t val;
+            err = cbor_value_get_int64(it, &val);
+            s_sink += (uint32_t)val;
+            if (err == CborNoError) {
+                err = cbor_value_advance_fixed(it);
+            }
+            break;
+        }
+        case CborTextStringType:
+            err = bench_parse_string(it, mode);
+            break;
+        default:
+            err = cbor_value_advance(it);
+            break;
+        }
+        if (err != CborNoError) {
+            return err;
+        }
+    }
+    return CborNoError;
+}
+
+static CborError bench_parse(const uint8_t *buf, size_t len, bench_parse_mode_t mode)
+{
+    CborParser parser;
+    CborValue it;
+    CborError err = cbor_parser_init(buf, len, 0, &parser, &it);
+    if (err != CborNoError) {
+        return err;
+    }
+    /* The top level is a single container, bench_parse_value() walks its siblings */
+    return bench_parse_value(&it, mode, 4);
+}
+
+static void bench_report(const char *payload, const char *op, size_t len, int64_t elapsed_us, uint32_t allocs)
+{
+    printf("BENCH %-7s %-12s bytes=%-5u %7.2f MB/s %6.1f us/payload allocs/payload=%.1f\n", payload, op,
+           (unsigned)len, (double)len * BENCH_ITERATIONS / elapsed_us, (double)elapsed_us / BENCH_ITERATIONS,
+           (double)allocs / BENCH_ITERATIONS);
+}
+
+static void bench_payload(const char *payload, bench_encode_fn_t encode)
+{
+    size_t len = encode(s_buf, sizeof(s_buf));
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, len, "payload does not fit the buffer");
+
+    s_allocs = 0;
+    s_count_allocs = true;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        encode(s_buf, sizeof(s_buf));
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    s_count_allocs = false;
+    bench_report(payload, "encode", len, elapsed_us, s_allocs);
+
+    for (bench_parse_mode_t mode = BENCH_PARSE_CHUNK; mode <= BENCH_PARSE_DUP; mode++) {
+        TEST_ASSERT_EQUAL(CborNoError, bench_parse(s_buf, len, mode));
+        s_allocs = 0;
+        s_count_allocs = true;
+        start = esp_timer_get_time();
+        for (int i = 0; i < BENCH_ITERATIONS; i++) {
+            bench_parse(s_buf, len, mode);
+        }
+        elapsed_us = esp_timer_get_time() - start;
+        s_count_allocs = false;
+        char op[16];
+        snprintf(op, sizeof(op), "parse/%s", s_parse_mode_str[mode]);
+        bench_report(payload, op, len, elapsed_us, s_allocs);
+    }
+
+    s_allocs = 0;
+    s_count_allocs = true;
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        CborParser parser;
+        CborValue it;
+        cbor_parser_init(s_buf, len, 0, &parser, &it);
+        cbor_value_validate(&it, CborValidateBasic);
+    }
+    elapsed_us = esp_timer_get_time() - start;
+    s_count_allocs = false;
+    bench_report(payload, "validate", len, elapsed_us, s_allocs);
+}
+
+TEST_CASE("cbor insights payload bench", "[cbor][bench]")
+{
+    for (int i = 0; i < BENCH_ITEMS; i++) {
+        snprintf(s_meta_keys[i], sizeof(s_meta_keys[i]), "%s_%d", s_keys[i % 6], i);
+    }
+    bench_payload("metrics", bench_encode_metrics);
+    bench_payload("logs", bench_encode_logs);
+    bench_payload("meta", bench_encode_meta);
+}
+
+void app_main(void)
+{
+    printf("tinycbor benchmark, %d iterations per measurement\n", BENCH_ITERATIONS);
+    unity_run_menu();
+}
@@ -97,6 +97,30 @@ typedef struct {
   .trials = 10, \
 }
 
+/**
+ * @brief Loader of one target, see esp_loader_ctx_create()
+ */
+typedef struct esp_loader esp_loader_t;
+
+/**
+ * @brief Port of a loader, defined in esp_loader_io.h
+ */
+typedef struct esp_loader_port esp_loader_port_t;
+
+/**
+ * @brief Flasher stub, a program loaded into target RAM which takes over from
+ *        the ROM loader. The fields are the ones of the stub JSON files of esptool.
+ */
+typedef struct {
+    uint32_t entry;         /*!< Entry point of the stub. */
+    uint32_t text_start;    /*!< Load address of the text segment. */
+    const uint8_t *text;    /*!< Text segment. */
+    uint32_t text_size;     /*!< Size of the text segment in bytes. */
+    uint32_t data_start;    /*!< Load address of the data segment. */
+    const uint8_t *data;    /*!< Data segment, NULL if data_size is 0. */
+    uint32_t data_size;     /*!< Size of the data segment in bytes. */
+} esp_loader_stub_t;
+
 /**
   * @brief Connects to the target
   *
@@ -146,6 +170,8 @@ esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size,
   *        esp_loader_flash_start function. If size is less than block_size,
   *        remaining bytes of payload buffer will be padded with 0xff.
   *        Therefore, size of payload buffer has to be equal or greater than block_size.
+  *        With a window set by esp_loader_flash_set_window(), the function returns
+  *        before the response to the block, and an error may be the one of an earlier block.
   *
   * @return
   *     - ESP_LOADER_SUCCESS Success
@@ -156,6 +182,7 @@ esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size);
 
 /**
   * @brief Ends flash operation.
+  *        Waits for the responses to the blocks in flight first.
   *
   * @param reboot[in]       reboot the target if true.
   *
@@ -167,6 +194,59 @@ esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size);
 esp_loader_error_t esp_loader_flash_finish(bool reboot);
 
 
+/**
+  * @brief Initiates compressed flash operation
+  *
+  * @param offset[in]           Address from which flash operation will be performed.
+  * @param image_size[in]       Size of the whole binary to be loaded into flash, decompressed.
+  * @param compressed_size[in]  Size of the binary compressed with zlib, as sent to the target.
+  * @param block_size[in]       Size of buffer used in subsequent calls to esp_loader_flash_deflate_write.
+  *
+  * @note  The target decompresses the data it receives, so that much less data goes over
+  *        the serial interface for most binaries. The data is compressed on the host or,
+  *        more likely, stored compressed (for instance with zlib.compress() in Python).
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_PARAM Invalid parameter
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target
+  */
+esp_loader_error_t esp_loader_flash_deflate_start(uint32_t offset, uint32_t image_size,
+                                                  uint32_t compressed_size, uint32_t block_size);
+
+/**
+  * @brief Writes supplied compressed data to target's flash memory.
+  *
+  * @param payload[in]      Compressed data to be flashed into target's memory.
+  * @param size[in]         Size of payload in bytes.
+  *
+  * @note  size must not be greater than block_size supplied to previously called
+  *        esp_loader_flash_deflate_start function. The payload is not padded.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_PARAM Invalid parameter
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_deflate_write(const void *payload, uint32_t size);
+
+/**
+  * @brief Ends compressed flash operation.
+  *        Waits for the responses to the blocks in flight first.
+  *
+  * @param reboot[in]       reboot the target if true.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_deflate_finish(bool reboot);
+
+
 /**
   * @brief Initiates mem operation, initiates loading for program into target RAM
   *
@@ -216,6 +296,53 @@ esp_loader_error_t esp_loader_mem_write(const void *payload, uint32_t size);
   */
 esp_loader_error_t esp_loader_mem_finish(uint32_t entrypoint);
 
+/**
+  * @brief Loads the flasher stub into target RAM and runs it, after esp_loader_connect().
+  *        The stub then answers all the commands, at higher transmission rates than
+  *        the ROM loader and with compressed flashing on all targets.
+  *
+  * @param stub[in]         Stub to run, for the attached target.
+  *
+  * @note  The stub runs until the target is reset, esp_loader_connect() and
+  *        esp_loader_reset_target() return to the ROM loader. Change the transmission
+  *        rate with esp_loader_change_transmission_rate_stub() once it runs.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_PARAM Invalid parameter
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE The stub did not start
+  */
+esp_loader_error_t esp_loader_run_stub(const esp_loader_stub_t *stub);
+
+/**
+  * @brief Tells if the flasher stub runs on the target.
+  *
+  * @return true after a successful esp_loader_run_stub(), until the target is reset.
+  */
+bool esp_loader_stub_running(void);
+
+/**
+  * @brief Sets the number of blocks sent to the flasher stub ahead of their
+  *        responses, by esp_loader_flash_write() and esp_loader_flash_deflate_write().
+  *        The link is not idle while the target answers, so that flashing gets
+  *        close to the transmission rate.
+  *
+  * @param blocks_in_flight[in] Blocks sent without their response, 1 to wait for each block.
+  *
+  * @note  The stub must buffer all the blocks in flight but the one it writes,
+  *        the one of esptool buffers one, which is a window of 2.
+  *        esp_loader_flash_finish(), esp_loader_flash_deflate_finish() and the
+  *        MD5 verification wait for the responses to the blocks in flight.
+  *        The window is back to 1 once the target is reset.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_INVALID_PARAM Invalid parameter
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Over 1, and the stub does not run
+  */
+esp_loader_error_t esp_loader_flash_set_window(uint32_t blocks_in_flight);
+
 
 /**
   * @brief Writes register.
@@ -259,6 +386,24 @@ esp_loader_error_t esp_loader_read_register(uint32_t address, uint32_t *reg_valu
   */
 esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rate);
 
+/**
+  * @brief Change baud rate of the flasher stub, which needs the current one too.
+  *
+  * @note  Baud rate has to be also adjusted accordingly on host MCU, as
+  *        target's baud rate is changed upon return from this function.
+  *
+  * @param old_transmission_rate[in] current baud rate.
+  * @param new_transmission_rate[in] new baud rate to be set.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC The stub does not run
+  */
+esp_loader_error_t esp_loader_change_transmission_rate_stub(uint32_t old_transmission_rate,
+                                                            uint32_t new_transmission_rate);
+
 /**
   * @brief Verify target's flash integrity by checking MD5.
   *        MD5 checksum is computed from data pushed to target's memory by calling
@@ -267,22 +412,95 @@ esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rat
   *        esp_loader_flash_start() function.
   *
   * @note  This function is only available if MD5_ENABLED is set.
+  *        After compressed flashing, use esp_loader_flash_verify_known_md5() instead.
   *
   * @return
   *     - ESP_LOADER_SUCCESS Success
   *     - ESP_LOADER_ERROR_INVALID_MD5 MD5 does not match
   *     - ESP_LOADER_ERROR_TIMEOUT Timeout
   *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
-  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target,
+  *       or the data was flashed compressed
   */
 #if MD5_ENABLED
 esp_loader_error_t esp_loader_flash_verify(void);
+
+/**
+  * @brief Verify target's flash integrity by comparing the MD5 of a region
+  *        against the expected one, for instance the MD5 of a binary taken
+  *        before it was compressed.
+  *
+  * @param address[in]      Address of the region.
+  * @param size[in]         Size of the region.
+  * @param expected_md5[in] MD5 digest of the region, 16 bytes.
+  *
+  * @note  This function is only available if MD5_ENABLED is set.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_INVALID_MD5 MD5 does not match
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target
+  */
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size, const uint8_t expected_md5[16]);
 #endif
 /**
   * @brief Toggles reset pin.
   */
 void esp_loader_reset_target(void);
 
+/*
+ * The functions above drive a single target, through the loader_port_ functions.
+ * The esp_loader_ctx_ ones below drive the target of a loader, through its port,
+ * so that several targets are programmed at once, each from its own task.
+ * They are the same as the functions above otherwise.
+ */
+
+/**
+  * @brief Creates the loader of a target.
+  *
+  * @param port[in]     Port of the target, which must outlive the loader.
+  *
+  * @return The loader, NULL if there is not enough memory or the port has no functions.
+  */
+esp_loader_t *esp_loader_ctx_create(esp_loader_port_t *port);
+
+/**
+  * @brief Deletes a loader created by esp_loader_ctx_create().
+  */
+void esp_loader_ctx_delete(esp_loader_t *loader);
+
+esp_loader_error_t esp_loader_ctx_connect(esp_loader_t *loader, esp_loader_connect_args_t *connect_args);
+target_chip_t esp_loader_ctx_get_target(esp_loader_t *loader);
+esp_loader_error_t esp_loader_ctx_flash_start(esp_loader_t *loader, uint32_t offset, uint32_t image_size,
+                                              uint32_t block_size);
+esp_loader_error_t esp_loader_ctx_flash_write(esp_loader_t *loader, void *payload, uint32_t size);
+esp_loader_error_t esp_loader_ctx_flash_finish(esp_loader_t *loader, bool reboot);
+esp_loader_error_t esp_loader_ctx_flash_deflate_start(esp_loader_t *loader, uint32_t offset, uint32_t image_size,
+                                                      uint32_t compressed_size, uint32_t block_size);
+esp_loader_error_t esp_loader_ctx_flash_deflate_write(esp_loader_t *loader, const void *payload, uint32_t size);
+esp_loader_error_t esp_loader_ctx_flash_deflate_finish(esp_loader_t *loader, bool reboot);
+esp_loader_error_t esp_loader_ctx_mem_start(esp_loader_t *loader, uint32_t offset, uint32_t size,
+                                            uint32_t block_size);
+esp_loader_error_t esp_loader_ctx_mem_write(esp_loader_t *loader, const void *payload, uint32_t size);
+esp_loader_error_t esp_loader_ctx_mem_finish(esp_loader_t *loader, uint32_t entrypoint);
+esp_loader_error_t esp_loader_ctx_run_stub(esp_loader_t *loader, const esp_loader_stub_t *stub);
+bool esp_loader_ctx_stub_running(esp_loader_t *loader);
+esp_loader_error_t esp_loader_ctx_flash_set_window(esp_loader_t *loader, uint32_t blocks_in_flight);
+esp_loader_error_t esp_loader_ctx_write_register(esp_loader_t *loader, uint32_t address, uint32_t reg_value);
+esp_loader_error_t esp_loader_ctx_read_register(esp_loader_t *loader, uint32_t address, uint32_t *reg_value);
+esp_loader_error_t esp_loader_ctx_change_transmission_rate(esp_loader_t *loader, uint32_t transmission_rate);
+esp_loader_error_t esp_loader_ctx_change_transmission_rate_stub(esp_loader_t *loader,
+                                                                uint32_t old_transmission_rate,
+                                                                uint32_t new_transmission_rate);
+#if MD5_ENABLED
+esp_loader_error_t esp_loader_ctx_flash_verify(esp_loader_t *loader);
+esp_loader_error_t esp_loader_ctx_flash_verify_known_md5(esp_loader_t *loader, uint32_t address, uint32_t size,
+                                                         const uint8_t expected_md5[16]);
+#endif
+void esp_loader_ctx_reset_target(esp_loader_t *loader);
+
 
 
 #ifdef __cplusplus
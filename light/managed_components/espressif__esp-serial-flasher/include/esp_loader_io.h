@@ -100,6 +100,29 @@ void loader_port_reset_target(void);
   */
 void loader_port_debug_print(const char *str);
 
+/**
+  * @brief Functions of a port which drives one target, given the port they are called for.
+  *        They are the loader_port_ functions above, debug_print can be NULL.
+  */
+typedef struct {
+    esp_loader_error_t (*write)(esp_loader_port_t *port, const uint8_t *data, uint16_t size, uint32_t timeout);
+    esp_loader_error_t (*read)(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout);
+    void (*delay_ms)(esp_loader_port_t *port, uint32_t ms);
+    void (*start_timer)(esp_loader_port_t *port, uint32_t ms);
+    uint32_t (*remaining_time)(esp_loader_port_t *port);
+    void (*enter_bootloader)(esp_loader_port_t *port);
+    void (*reset_target)(esp_loader_port_t *port);
+    void (*debug_print)(esp_loader_port_t *port, const char *str);
+} esp_loader_port_ops_t;
+
+/**
+  * @brief Port given to esp_loader_ctx_create(), first member of the state of a port,
+  *        so that its functions get their state from the port they are given.
+  */
+struct esp_loader_port {
+    const esp_loader_port_ops_t *ops;
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -59,16 +59,41 @@ static void serial_debug_print(const uint8_t *data, uint16_t size, bool write) {
 
 #endif
 
-static int64_t s_time_end;
-static int32_t s_uart_port;
-static int32_t s_reset_trigger_pin;
-static int32_t s_gpio0_trigger_pin;
+/* The port of the single target loader_port_ functions */
+static loader_esp32_port_t s_port;
+
+static esp_loader_error_t esp32_write(esp_loader_port_t *port, const uint8_t *data, uint16_t size, uint32_t timeout);
+static esp_loader_error_t esp32_read(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout);
+static void esp32_delay_ms(esp_loader_port_t *port, uint32_t ms);
+static void esp32_start_timer(esp_loader_port_t *port, uint32_t ms);
+static uint32_t esp32_remaining_time(esp_loader_port_t *port);
+static void esp32_enter_bootloader(esp_loader_port_t *port);
+static void esp32_reset_target(esp_loader_port_t *port);
+static void esp32_debug_print(esp_loader_port_t *port, const char *str);
+
+static const esp_loader_port_ops_t s_esp32_port_ops = {
+    .write = esp32_write,
+    .read = esp32_read,
+    .delay_ms = esp32_delay_ms,
+    .start_timer = esp32_start_timer,
+    .remaining_time = esp32_remaining_time,
+    .enter_bootloader = esp32_enter_bootloader,
+    .reset_target = esp32_reset_target,
+    .debug_print = esp32_debug_print,
+};
+
+static inline loader_esp32_port_t *esp32_port(esp_loader_port_t *port)
+{
+    return (loader_esp32_port_t *)port;
+}
 
-esp_loader_error_t loader_port_esp32_init(const loader_esp32_config_t *config)
+esp_loader_error_t loader_esp32_port_init(loader_esp32_port_t *port, const loader_esp32_config_t *config)
 {
-    s_uart_port = config->uart_port;
-    s_reset_trigger_pin = config->reset_trigger_pin;
-    s_gpio0_trigger_pin = config->gpio0_trigger_pin;
+    port->port.ops = &s_esp32_port_ops;
+    port->uart_port = config->uart_port;
+    port->reset_trigger_pin = config->reset_trigger_pin;
+    port->gpio0_trigger_pin = config->gpio0_trigger_pin;
+    port->time_end = 0;
 
     // Initialize UART
     uart_config_t uart_config = {
@@ -87,54 +112,53 @@ esp_loader_error_t loader_port_esp32_init(const loader_esp32_config_t *config)
     QueueHandle_t *uart_queue = config->uart_queue ? config->uart_queue : NULL;
     int queue_size = config->queue_size ? config->queue_size : 0;
 
-    if ( uart_param_config(s_uart_port, &uart_config) != ESP_OK ) {
+    if ( uart_param_config(port->uart_port, &uart_config) != ESP_OK ) {
         return ESP_LOADER_ERROR_FAIL;
     }
-    if ( uart_set_pin(s_uart_port, config->uart_tx_pin, config->uart_rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK ) {
+    if ( uart_set_pin(port->uart_port, config->uart_tx_pin, config->uart_rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK ) {
         return ESP_LOADER_ERROR_FAIL;
     }
-    if ( uart_driver_install(s_uart_port, rx_buffer_size, tx_buffer_size, queue_size, uart_queue, 0) != ESP_OK ) {
+    if ( uart_driver_install(port->uart_port, rx_buffer_size, tx_buffer_size, queue_size, uart_queue, 0) != ESP_OK ) {
         return ESP_LOADER_ERROR_FAIL;
     }
 
     // Initialize boot pin selection pins
-    gpio_reset_pin(s_reset_trigger_pin);
-    gpio_set_pull_mode(s_reset_trigger_pin, GPIO_PULLUP_ONLY);
-    gpio_set_direction(s_reset_trigger_pin, GPIO_MODE_OUTPUT);
+    gpio_reset_pin(port->reset_trigger_pin);
+    gpio_set_pull_mode(port->reset_trigger_pin, GPIO_PULLUP_ONLY);
+    gpio_set_direction(port->reset_trigger_pin, GPIO_MODE_OUTPUT);
 
-    gpio_reset_pin(s_gpio0_trigger_pin);
-    gpio_set_pull_mode(s_gpio0_trigger_pin, GPIO_PULLUP_ONLY);
-    gpio_set_direction(s_gpio0_trigger_pin, GPIO_MODE_OUTPUT);
+    gpio_reset_pin(port->gpio0_trigger_pin);
+    gpio_set_pull_mode(port->gpio0_trigger_pin, GPIO_PULLUP_ONLY);
+    gpio_set_direction(port->gpio0_trigger_pin, GPIO_MODE_OUTPUT);
 
     return ESP_LOADER_SUCCESS;
 }
 
-void loader_port_esp32_deinit(void)
+void loader_esp32_port_deinit(loader_esp32_port_t *port)
 {
-    uart_driver_delete(s_uart_port);
+    uart_driver_delete(port->uart_port);
 }
 
 
-esp_loader_error_t loader_port_write(const uint8_t *data, uint16_t size, uint32_t timeout)
+static esp_loader_error_t esp32_write(esp_loader_port_t *port, const uint8_t *data, uint16_t size, uint32_t timeout)
 {
-    serial_debug_print(data, size, true);
+    int32_t uart_port = esp32_port(port)->uart_port;
 
-    uart_write_bytes(s_uart_port, (const char *)data, size);
-    esp_err_t err = uart_wait_tx_done(s_uart_port, pdMS_TO_TICKS(timeout));
+    serial_debug_print(data, size, true);
 
-    if (err == ESP_OK) {
-        return ESP_LOADER_SUCCESS;
-    } else if (err == ESP_ERR_TIMEOUT) {
-        return ESP_LOADER_ERROR_TIMEOUT;
-    } else {
+    /* The driver sends the end of the data from its TX buffer while the loader goes on, hashing
+       the block for instance, the response it waits for next comes after the data anyway */
+    if (uart_write_bytes(uart_port, (const char *)data, size) < 0) {
         return ESP_LOADER_ERROR_FAIL;
     }
+
+    return ESP_LOADER_SUCCESS;
 }
 
 
-esp_loader_error_t loader_port_read(uint8_t *data, uint16_t size, uint32_t timeout)
+static esp_loader_error_t esp32_read(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout)
 {
-    int read = uart_read_bytes(s_uart_port, data, size, pdMS_TO_TICKS(timeout));
+    int read = uart_read_bytes(esp32_port(port)->uart_port, data, size, pdMS_TO_TICKS(timeout));
 
     serial_debug_print(data, read, false);
 
@@ -150,49 +174,105 @@ esp_loader_error_t loader_port_read(uint8_t *data, uint16_t size, uint32_t timeo
 
 // Set GPIO0 LOW, then
 // assert reset pin for 50 milliseconds.
-void loader_port_enter_bootloader(void)
+static void esp32_enter_bootloader(esp_loader_port_t *port)
 {
-    gpio_set_level(s_gpio0_trigger_pin, 0);
-    loader_port_reset_target();
-    loader_port_delay_ms(SERIAL_FLASHER_BOOT_HOLD_TIME_MS);
-    gpio_set_level(s_gpio0_trigger_pin, 1);
+    gpio_set_level(esp32_port(port)->gpio0_trigger_pin, 0);
+    esp32_reset_target(port);
+    esp32_delay_ms(port, SERIAL_FLASHER_BOOT_HOLD_TIME_MS);
+    gpio_set_level(esp32_port(port)->gpio0_trigger_pin, 1);
 }
 
 
-void loader_port_reset_target(void)
+static void esp32_reset_target(esp_loader_port_t *port)
 {
-    gpio_set_level(s_reset_trigger_pin, 0);
-    loader_port_delay_ms(SERIAL_FLASHER_RESET_HOLD_TIME_MS);
-    gpio_set_level(s_reset_trigger_pin, 1);
+    gpio_set_level(esp32_port(port)->reset_trigger_pin, 0);
+    esp32_delay_ms(port, SERIAL_FLASHER_RESET_HOLD_TIME_MS);
+    gpio_set_level(esp32_port(port)->reset_trigger_pin, 1);
 }
 
 
-void loader_port_delay_ms(uint32_t ms)
+static void esp32_delay_ms(esp_loader_port_t *port, uint32_t ms)
 {
     usleep(ms * 1000);
 }
 
 
-void loader_port_start_timer(uint32_t ms)
+static void esp32_start_timer(esp_loader_port_t *port, uint32_t ms)
 {
-    s_time_end = esp_timer_get_time() + ms * 1000;
+    esp32_port(port)->time_end = esp_timer_get_time() + ms * 1000;
 }
 
 
-uint32_t loader_port_remaining_time(void)
+static uint32_t esp32_remaining_time(esp_loader_port_t *port)
 {
-    int64_t remaining = (s_time_end - esp_timer_get_time()) / 1000;
+    int64_t remaining = (esp32_port(port)->time_end - esp_timer_get_time()) / 1000;
     return (remaining > 0) ? (uint32_t)remaining : 0;
 }
 
 
-void loader_port_debug_print(const char *str)
+static void esp32_debug_print(esp_loader_port_t *port, const char *str)
 {
     printf("DEBUG: %s\n", str);
 }
 
-esp_loader_error_t loader_port_change_transmission_rate(uint32_t baudrate)
+esp_loader_error_t loader_esp32_port_change_transmission_rate(loader_esp32_port_t *port, uint32_t baudrate)
 {
-    esp_err_t err = uart_set_baudrate(s_uart_port, baudrate);
+    esp_err_t err = uart_set_baudrate(port->uart_port, baudrate);
     return (err == ESP_OK) ? ESP_LOADER_SUCCESS : ESP_LOADER_ERROR_FAIL;
-}
\ No newline at end of file
+}
+
+
+esp_loader_error_t loader_port_esp32_init(const loader_esp32_config_t *config)
+{
+    return loader_esp32_port_init(&s_port, config);
+}
+
+void loader_port_esp32_deinit(void)
+{
+    loader_esp32_port_deinit(&s_port);
+}
+
+esp_loader_error_t loader_port_write(const uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    return esp32_write(&s_port.port, data, size, timeout);
+}
+
+esp_loader_error_t loader_port_read(uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    return esp32_read(&s_port.port, data, size, timeout);
+}
+
+void loader_port_enter_bootloader(void)
+{
+    esp32_enter_bootloader(&s_port.port);
+}
+
+void loader_port_reset_target(void)
+{
+    esp32_reset_target(&s_port.port);
+}
+
+void loader_port_delay_ms(uint32_t ms)
+{
+    esp32_delay_ms(&s_port.port, ms);
+}
+
+void loader_port_start_timer(uint32_t ms)
+{
+    esp32_start_timer(&s_port.port, ms);
+}
+
+uint32_t loader_port_remaining_time(void)
+{
+    return esp32_remaining_time(&s_port.port);
+}
+
+void loader_port_debug_print(const char *str)
+{
+    esp32_debug_print(&s_port.port, str);
+}
+
+esp_loader_error_t loader_port_change_transmission_rate(uint32_t baudrate)
+{
+    return loader_esp32_port_change_transmission_rate(&s_port, baudrate);
+}
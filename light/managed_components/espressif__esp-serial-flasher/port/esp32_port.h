@@ -38,6 +38,17 @@ typedef struct
                                    necessary. Otherwise, it will be assigned here */
 } loader_esp32_config_t;
 
+/**
+  * @brief Port of one target, for esp_loader_ctx_create(). Each target has its own UART port and pins.
+  */
+typedef struct {
+  esp_loader_port_t port;     /*!< Given to esp_loader_ctx_create() */
+  int32_t uart_port;
+  int32_t reset_trigger_pin;
+  int32_t gpio0_trigger_pin;
+  int64_t time_end;
+} loader_esp32_port_t;
+
 /**
   * @brief Initializes serial interface.
   *
@@ -54,6 +65,28 @@ esp_loader_error_t loader_port_esp32_init(const loader_esp32_config_t *config);
   */
 void loader_port_esp32_deinit(void);
 
+/**
+  * @brief Initializes the serial interface of a port, for the loader of one target.
+  *
+  * @param port[out]           Port to initialize.
+  * @param config[in]          Configuration of the serial interface of the target.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_FAIL Initialization failure
+  */
+esp_loader_error_t loader_esp32_port_init(loader_esp32_port_t *port, const loader_esp32_config_t *config);
+
+/**
+  * @brief Deinitialize the serial interface of a port.
+  */
+void loader_esp32_port_deinit(loader_esp32_port_t *port);
+
+/**
+  * @brief Changes the baud rate of the serial interface of a port.
+  */
+esp_loader_error_t loader_esp32_port_change_transmission_rate(loader_esp32_port_t *port, uint32_t baudrate);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,6 +28,6 @@ typedef struct {
     uint32_t miso_dlen;
 } target_registers_t;
 
-esp_loader_error_t loader_detect_chip(target_chip_t *target, const target_registers_t **regs);
-esp_loader_error_t loader_read_spi_config(target_chip_t target_chip, uint32_t *spi_config);
+esp_loader_error_t loader_detect_chip(esp_loader_t *loader, target_chip_t *target, const target_registers_t **regs);
+esp_loader_error_t loader_read_spi_config(esp_loader_t *loader, target_chip_t target_chip, uint32_t *spi_config);
 bool encryption_in_begin_flash_cmd(target_chip_t target);
\ No newline at end of file
@@ -0,0 +1,111 @@
+/* Copyright 2020-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_loader.h"
+#include "esp_loader_io.h"
+#include "esp_targets.h"
+#include "md5_hash.h"
+#include "slip.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if SERIAL_FLASHER_ROM_MD5
+#include "esp_rom_md5.h"
+/* The MD5 of the ROM runs from ROM, without flash cache misses, the targets have no MD5 peripheral */
+typedef md5_context_t loader_md5_context_t;
+#else
+typedef struct MD5Context loader_md5_context_t;
+#endif
+
+/* All the state of the connection to one target, nothing is shared between loaders */
+struct esp_loader {
+    esp_loader_port_t *port;
+    const target_registers_t *reg;
+    target_chip_t target;
+    bool stub_running;
+
+    uint32_t sequence_number;
+    slip_tx_t slip_tx;
+
+    uint32_t flash_write_size;
+    uint32_t deflate_image_size;
+    uint32_t deflate_compressed_size;
+    uint32_t flash_window;
+    uint32_t blocks_in_flight;
+    uint32_t block_timeout;
+    bool deflating;
+
+    loader_md5_context_t md5_context;
+    uint32_t start_address;
+    uint32_t image_size;
+    bool md5_of_writes;
+};
+
+/* The loader of the single target functions, on the loader_port_ functions */
+esp_loader_t *loader_default_ctx(void);
+
+static inline esp_loader_error_t loader_io_write(esp_loader_t *loader, const uint8_t *data, uint16_t size,
+                                                 uint32_t timeout)
+{
+    return loader->port->ops->write(loader->port, data, size, timeout);
+}
+
+static inline esp_loader_error_t loader_io_read(esp_loader_t *loader, uint8_t *data, uint16_t size,
+                                                uint32_t timeout)
+{
+    return loader->port->ops->read(loader->port, data, size, timeout);
+}
+
+static inline void loader_io_delay_ms(esp_loader_t *loader, uint32_t ms)
+{
+    loader->port->ops->delay_ms(loader->port, ms);
+}
+
+static inline void loader_io_start_timer(esp_loader_t *loader, uint32_t ms)
+{
+    loader->port->ops->start_timer(loader->port, ms);
+}
+
+static inline uint32_t loader_io_remaining_time(esp_loader_t *loader)
+{
+    return loader->port->ops->remaining_time(loader->port);
+}
+
+static inline void loader_io_enter_bootloader(esp_loader_t *loader)
+{
+    loader->port->ops->enter_bootloader(loader->port);
+}
+
+static inline void loader_io_reset_target(esp_loader_t *loader)
+{
+    loader->port->ops->reset_target(loader->port);
+}
+
+static inline void loader_io_debug_print(esp_loader_t *loader, const char *str)
+{
+    if (loader->port->ops->debug_print) {
+        loader->port->ops->debug_print(loader->port, str);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -184,6 +184,13 @@ typedef struct __attribute__((packed))
     response_status_t status;
 } rom_md5_response_t;
 
+typedef struct __attribute__((packed))
+{
+    common_response_t common;
+    uint8_t md5[16];           // Raw digest, flasher stub only
+    response_status_t status;
+} stub_md5_response_t;
+
 typedef struct __attribute__((packed))
 {
     command_common_t common;
@@ -195,37 +202,55 @@ typedef struct __attribute__((packed))
     uint32_t status_mask;
 } write_spi_command_t;
 
-esp_loader_error_t loader_flash_begin_cmd(uint32_t offset, uint32_t erase_size, uint32_t block_size, uint32_t blocks_to_write, bool encryption);
+esp_loader_error_t loader_flash_begin_cmd(esp_loader_t *loader, uint32_t offset, uint32_t erase_size, uint32_t block_size, uint32_t blocks_to_write, bool encryption);
+
+esp_loader_error_t loader_flash_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size);
+
+esp_loader_error_t loader_flash_data_send(esp_loader_t *loader, const uint8_t *data, uint32_t size);
+
+esp_loader_error_t loader_flash_data_response(esp_loader_t *loader);
+
+esp_loader_error_t loader_flash_end_cmd(esp_loader_t *loader, bool stay_in_loader);
+
+esp_loader_error_t loader_flash_defl_begin_cmd(esp_loader_t *loader, uint32_t offset, uint32_t erase_size, uint32_t block_size, uint32_t blocks_to_write, bool encryption);
+
+esp_loader_error_t loader_flash_defl_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size);
+
+esp_loader_error_t loader_flash_defl_data_send(esp_loader_t *loader, const uint8_t *data, uint32_t size);
+
+esp_loader_error_t loader_flash_defl_data_response(esp_loader_t *loader);
+
+esp_loader_error_t loader_flash_defl_end_cmd(esp_loader_t *loader, bool stay_in_loader);
 
-esp_loader_error_t loader_flash_data_cmd(const uint8_t *data, uint32_t size);
+esp_loader_error_t loader_mem_begin_cmd(esp_loader_t *loader, uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size);
 
-esp_loader_error_t loader_flash_end_cmd(bool stay_in_loader);
+esp_loader_error_t loader_mem_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size);
 
-esp_loader_error_t loader_mem_begin_cmd(uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size);
+esp_loader_error_t loader_mem_end_cmd(esp_loader_t *loader, uint32_t entrypoint);
 
-esp_loader_error_t loader_mem_data_cmd(const uint8_t *data, uint32_t size);
+esp_loader_error_t loader_mem_begin_cmd(esp_loader_t *loader, uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size);
 
-esp_loader_error_t loader_mem_end_cmd(uint32_t entrypoint);
+esp_loader_error_t loader_mem_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size);
 
-esp_loader_error_t loader_mem_begin_cmd(uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size);
+esp_loader_error_t loader_mem_end_cmd(esp_loader_t *loader, uint32_t entrypoint);
 
-esp_loader_error_t loader_mem_data_cmd(const uint8_t *data, uint32_t size);
+esp_loader_error_t loader_write_reg_cmd(esp_loader_t *loader, uint32_t address, uint32_t value, uint32_t mask, uint32_t delay_us);
 
-esp_loader_error_t loader_mem_end_cmd(uint32_t entrypoint);
+esp_loader_error_t loader_read_reg_cmd(esp_loader_t *loader, uint32_t address, uint32_t *reg);
 
-esp_loader_error_t loader_write_reg_cmd(uint32_t address, uint32_t value, uint32_t mask, uint32_t delay_us);
+esp_loader_error_t loader_sync_cmd(esp_loader_t *loader);
 
-esp_loader_error_t loader_read_reg_cmd(uint32_t address, uint32_t *reg);
+esp_loader_error_t loader_spi_attach_cmd(esp_loader_t *loader, uint32_t config);
 
-esp_loader_error_t loader_sync_cmd(void);
+esp_loader_error_t loader_change_baudrate_cmd(esp_loader_t *loader, uint32_t baudrate, uint32_t old_baudrate);
 
-esp_loader_error_t loader_spi_attach_cmd(uint32_t config);
+esp_loader_error_t loader_md5_cmd(esp_loader_t *loader, uint32_t address, uint32_t size, uint8_t *md5_out);
 
-esp_loader_error_t loader_change_baudrate_cmd(uint32_t baudrate);
+esp_loader_error_t loader_stub_md5_cmd(esp_loader_t *loader, uint32_t address, uint32_t size, uint8_t *raw_md5_out);
 
-esp_loader_error_t loader_md5_cmd(uint32_t address, uint32_t size, uint8_t *md5_out);
+esp_loader_error_t loader_stub_greeting(esp_loader_t *loader);
 
-esp_loader_error_t loader_spi_parameters(uint32_t total_size);
+esp_loader_error_t loader_spi_parameters(esp_loader_t *loader, uint32_t total_size);
 
 #ifdef __cplusplus
 }
@@ -16,13 +16,37 @@
 #pragma once
 
 #include "esp_loader.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-esp_loader_error_t SLIP_receive_data(uint8_t *buff, size_t size);
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-esp_loader_error_t SLIP_receive_packet(uint8_t *buff, size_t size);
+#ifndef SERIAL_FLASHER_SLIP_BUFFER_SIZE
+#ifdef CONFIG_SERIAL_FLASHER_SLIP_BUFFER_SIZE
+#define SERIAL_FLASHER_SLIP_BUFFER_SIZE CONFIG_SERIAL_FLASHER_SLIP_BUFFER_SIZE
+#else
+#define SERIAL_FLASHER_SLIP_BUFFER_SIZE 1536
+#endif
+#endif
 
-esp_loader_error_t SLIP_send(const uint8_t *data, size_t size);
+/* Packets are encoded into the buffer, written to the port once they end or it is full */
+typedef struct {
+    uint8_t buffer[SERIAL_FLASHER_SLIP_BUFFER_SIZE];
+    size_t size;
+    bool in_packet;
+} slip_tx_t;
 
-esp_loader_error_t SLIP_send_delimiter(void);
+esp_loader_error_t SLIP_receive_data(esp_loader_t *loader, uint8_t *buff, size_t size);
+
+esp_loader_error_t SLIP_receive_packet(esp_loader_t *loader, uint8_t *buff, size_t size);
+
+esp_loader_error_t SLIP_send(esp_loader_t *loader, const uint8_t *data, size_t size);
+
+esp_loader_error_t SLIP_send_delimiter(esp_loader_t *loader);
+
+#ifdef __cplusplus
+}
+#endif
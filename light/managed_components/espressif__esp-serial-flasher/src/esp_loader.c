@@ -17,7 +17,9 @@
 #include "esp_loader_io.h"
 #include "esp_loader.h"
 #include "esp_targets.h"
+#include "loader_ctx.h"
 #include "md5_hash.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -37,45 +39,60 @@ static const uint32_t DEFAULT_TIMEOUT = 1000;
 static const uint32_t DEFAULT_FLASH_TIMEOUT = 3000;       // timeout for most flash operations
 static const uint32_t ERASE_REGION_TIMEOUT_PER_MB = 10000; // timeout (per megabyte) for erasing a region
 static const uint32_t LOAD_RAM_TIMEOUT_PER_MB = 2000000; // timeout (per megabyte) for erasing a region
+static const uint32_t ERASE_WRITE_TIMEOUT_PER_MB = 40000; // timeout (per megabyte) for erasing and writing data
 static const uint8_t  PADDING_PATTERN = 0xFF;
+static const uint32_t STUB_RAM_BLOCK = 0x1800;            // block size used to load the flasher stub
 
 typedef enum {
     SPI_FLASH_READ_ID = 0x9F
 } spi_flash_cmd_t;
 
-static uint32_t s_flash_write_size = 0;
-static const target_registers_t *s_reg = NULL;
-static target_chip_t s_target = ESP_UNKNOWN_CHIP;
-
 #if MD5_ENABLED
 
 static const uint32_t MD5_TIMEOUT_PER_MB = 800;
-static struct MD5Context s_md5_context;
-static uint32_t s_start_address;
-static uint32_t s_image_size;
 
-static inline void init_md5(uint32_t address, uint32_t size)
+static inline void init_md5(esp_loader_t *loader, uint32_t address, uint32_t size)
 {
-    s_start_address = address;
-    s_image_size = size;
-    MD5Init(&s_md5_context);
+    loader->start_address = address;
+    loader->image_size = size;
+    loader->md5_of_writes = true;
+#if SERIAL_FLASHER_ROM_MD5
+    esp_rom_md5_init(&loader->md5_context);
+#else
+    MD5Init(&loader->md5_context);
+#endif
 }
 
-static inline void md5_update(const uint8_t *data, uint32_t size)
+/* Compressed data is flashed decompressed, so its MD5 cannot be computed from the data written */
+static inline void skip_md5(esp_loader_t *loader)
 {
-    MD5Update(&s_md5_context, data, size);
+    loader->md5_of_writes = false;
 }
 
-static inline void md5_final(uint8_t digets[16])
+static inline void md5_update(esp_loader_t *loader, const uint8_t *data, uint32_t size)
 {
-    MD5Final(digets, &s_md5_context);
+#if SERIAL_FLASHER_ROM_MD5
+    esp_rom_md5_update(&loader->md5_context, data, size);
+#else
+    MD5Update(&loader->md5_context, data, size);
+#endif
 }
 
+static inline void md5_final(esp_loader_t *loader, uint8_t digets[16])
+{
+#if SERIAL_FLASHER_ROM_MD5
+    esp_rom_md5_final(digets, &loader->md5_context);
 #else
+    MD5Final(digets, &loader->md5_context);
+#endif
+}
 
-static inline void init_md5(uint32_t address, uint32_t size) { }
-static inline void md5_update(const uint8_t *data, uint32_t size) { }
-static inline void md5_final(uint8_t digets[16]) { }
+#else
+
+static inline void init_md5(esp_loader_t *loader, uint32_t address, uint32_t size) { }
+static inline void skip_md5(esp_loader_t *loader) { }
+static inline void md5_update(esp_loader_t *loader, const uint8_t *data, uint32_t size) { }
+static inline void md5_final(esp_loader_t *loader, uint8_t digets[16]) { }
 
 #endif
 
@@ -86,65 +103,94 @@ static uint32_t timeout_per_mb(uint32_t size_bytes, uint32_t time_per_mb)
     return MAX(timeout, DEFAULT_FLASH_TIMEOUT);
 }
 
-esp_loader_error_t esp_loader_connect(esp_loader_connect_args_t *connect_args)
+static void loader_init(esp_loader_t *loader, esp_loader_port_t *port)
+{
+    memset(loader, 0, sizeof(*loader));
+    loader->port = port;
+    loader->target = ESP_UNKNOWN_CHIP;
+    loader->flash_window = 1;
+}
+
+esp_loader_t *esp_loader_ctx_create(esp_loader_port_t *port)
+{
+    if (port == NULL || port->ops == NULL) {
+        return NULL;
+    }
+
+    esp_loader_t *loader = malloc(sizeof(*loader));
+    if (loader != NULL) {
+        loader_init(loader, port);
+    }
+
+    return loader;
+}
+
+void esp_loader_ctx_delete(esp_loader_t *loader)
+{
+    free(loader);
+}
+
+esp_loader_error_t esp_loader_ctx_connect(esp_loader_t *loader, esp_loader_connect_args_t *connect_args)
 {
     uint32_t spi_config;
     esp_loader_error_t err;
     int32_t trials = connect_args->trials;
 
-    loader_port_enter_bootloader();
+    loader->stub_running = false;
+    loader->flash_window = 1;
+    loader_io_enter_bootloader(loader);
 
     do {
-        loader_port_start_timer(connect_args->sync_timeout);
-        err = loader_sync_cmd();
+        loader_io_start_timer(loader, connect_args->sync_timeout);
+        err = loader_sync_cmd(loader);
         if (err == ESP_LOADER_ERROR_TIMEOUT) {
             if (--trials == 0) {
                 return ESP_LOADER_ERROR_TIMEOUT;
             }
-            loader_port_delay_ms(100);
+            loader_io_delay_ms(loader, 100);
         } else if (err != ESP_LOADER_SUCCESS) {
             return err;
         }
     } while (err != ESP_LOADER_SUCCESS);
 
-    RETURN_ON_ERROR( loader_detect_chip(&s_target, &s_reg) );
+    RETURN_ON_ERROR( loader_detect_chip(loader, &loader->target, &loader->reg) );
 
-    if (s_target == ESP8266_CHIP) {
-        err = loader_flash_begin_cmd(0, 0, 0, 0, s_target);
+    if (loader->target == ESP8266_CHIP) {
+        err = loader_flash_begin_cmd(loader, 0, 0, 0, 0, loader->target);
     } else {
-        RETURN_ON_ERROR( loader_read_spi_config(s_target, &spi_config) );
-        loader_port_start_timer(DEFAULT_TIMEOUT);
-        err = loader_spi_attach_cmd(spi_config);
+        RETURN_ON_ERROR( loader_read_spi_config(loader, loader->target, &spi_config) );
+        loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+        err = loader_spi_attach_cmd(loader, spi_config);
     }
 
     return err;
 }
 
-target_chip_t esp_loader_get_target(void)
+target_chip_t esp_loader_ctx_get_target(esp_loader_t *loader)
 {
-    return s_target;
+    return loader->target;
 }
 
-static esp_loader_error_t spi_set_data_lengths(size_t mosi_bits, size_t miso_bits)
+static esp_loader_error_t spi_set_data_lengths(esp_loader_t *loader, size_t mosi_bits, size_t miso_bits)
 {
     if (mosi_bits > 0) {
-        RETURN_ON_ERROR( esp_loader_write_register(s_reg->mosi_dlen, mosi_bits - 1) );
+        RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->mosi_dlen, mosi_bits - 1) );
     }
     if (miso_bits > 0) {
-        RETURN_ON_ERROR( esp_loader_write_register(s_reg->miso_dlen, miso_bits - 1) );
+        RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->miso_dlen, miso_bits - 1) );
     }
 
     return ESP_LOADER_SUCCESS;
 }
 
-static esp_loader_error_t spi_set_data_lengths_8266(size_t mosi_bits, size_t miso_bits)
+static esp_loader_error_t spi_set_data_lengths_8266(esp_loader_t *loader, size_t mosi_bits, size_t miso_bits)
 {
     uint32_t mosi_mask = (mosi_bits == 0) ? 0 : mosi_bits - 1;
     uint32_t miso_mask = (miso_bits == 0) ? 0 : miso_bits - 1;
-    return esp_loader_write_register(s_reg->usr1, (miso_mask << 8) | (mosi_mask << 17));
+    return esp_loader_ctx_write_register(loader, loader->reg->usr1, (miso_mask << 8) | (mosi_mask << 17));
 }
 
-static esp_loader_error_t spi_flash_command(spi_flash_cmd_t cmd, void *data_tx, size_t tx_size, void *data_rx, size_t rx_size)
+static esp_loader_error_t spi_flash_command(esp_loader_t *loader, spi_flash_cmd_t cmd, void *data_tx, size_t tx_size, void *data_rx, size_t rx_size)
 {
     assert(rx_size <= 32); // Reading more than 32 bits back from a SPI flash operation is unsupported
     assert(tx_size <= 64); // Writing more than 64 bytes of data with one SPI command is unsupported
@@ -158,13 +204,13 @@ static esp_loader_error_t spi_flash_command(spi_flash_cmd_t cmd, void *data_tx,
     // Save SPI configuration
     uint32_t old_spi_usr;
     uint32_t old_spi_usr2;
-    RETURN_ON_ERROR( esp_loader_read_register(s_reg->usr, &old_spi_usr) );
-    RETURN_ON_ERROR( esp_loader_read_register(s_reg->usr2, &old_spi_usr2) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, loader->reg->usr, &old_spi_usr) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, loader->reg->usr2, &old_spi_usr2) );
 
-    if (s_target == ESP8266_CHIP) {
-        RETURN_ON_ERROR( spi_set_data_lengths_8266(tx_size, rx_size) );
+    if (loader->target == ESP8266_CHIP) {
+        RETURN_ON_ERROR( spi_set_data_lengths_8266(loader, tx_size, rx_size) );
     } else {
-        RETURN_ON_ERROR( spi_set_data_lengths(tx_size, rx_size) );
+        RETURN_ON_ERROR( spi_set_data_lengths(loader, tx_size, rx_size) );
     }
 
     uint32_t usr_reg_2 = (7 << CMD_LEN_SHIFT) | cmd;
@@ -176,30 +222,30 @@ static esp_loader_error_t spi_flash_command(spi_flash_cmd_t cmd, void *data_tx,
         usr_reg |= SPI_USR_MOSI;
     }
 
-    RETURN_ON_ERROR( esp_loader_write_register(s_reg->usr, usr_reg) );
-    RETURN_ON_ERROR( esp_loader_write_register(s_reg->usr2, usr_reg_2 ) );
+    RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->usr, usr_reg) );
+    RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->usr2, usr_reg_2 ) );
 
     if (tx_size == 0) {
         // clear data register before we read it
-        RETURN_ON_ERROR( esp_loader_write_register(s_reg->w0, 0) );
+        RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->w0, 0) );
     } else {
         uint32_t *data = (uint32_t *)data_tx;
         uint32_t words_to_write = (tx_size + 31) / (8 * 4);
-        uint32_t data_reg_addr = s_reg->w0;
+        uint32_t data_reg_addr = loader->reg->w0;
 
         while (words_to_write--) {
             uint32_t word = *data++;
-            RETURN_ON_ERROR( esp_loader_write_register(data_reg_addr, word) );
+            RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, data_reg_addr, word) );
             data_reg_addr += 4;
         }
     }
 
-    RETURN_ON_ERROR( esp_loader_write_register(s_reg->cmd, SPI_CMD_USR) );
+    RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->cmd, SPI_CMD_USR) );
 
     uint32_t trials = 10;
     while (trials--) {
         uint32_t cmd_reg;
-        RETURN_ON_ERROR( esp_loader_read_register(s_reg->cmd, &cmd_reg) );
+        RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, loader->reg->cmd, &cmd_reg) );
         if ((cmd_reg & SPI_CMD_USR) == 0) {
             break;
         }
@@ -209,20 +255,20 @@ static esp_loader_error_t spi_flash_command(spi_flash_cmd_t cmd, void *data_tx,
         return ESP_LOADER_ERROR_TIMEOUT;
     }
 
-    RETURN_ON_ERROR( esp_loader_read_register(s_reg->w0, data_rx) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, loader->reg->w0, data_rx) );
 
     // Restore SPI configuration
-    RETURN_ON_ERROR( esp_loader_write_register(s_reg->usr, old_spi_usr) );
-    RETURN_ON_ERROR( esp_loader_write_register(s_reg->usr2, old_spi_usr2) );
+    RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->usr, old_spi_usr) );
+    RETURN_ON_ERROR( esp_loader_ctx_write_register(loader, loader->reg->usr2, old_spi_usr2) );
 
     return ESP_LOADER_SUCCESS;
 }
 
-static esp_loader_error_t detect_flash_size(size_t *flash_size)
+static esp_loader_error_t detect_flash_size(esp_loader_t *loader, size_t *flash_size)
 {
     uint32_t flash_id = 0;
 
-    RETURN_ON_ERROR( spi_flash_command(SPI_FLASH_READ_ID, NULL, 0, &flash_id, 24) );
+    RETURN_ON_ERROR( spi_flash_command(loader, SPI_FLASH_READ_ID, NULL, 0, &flash_id, 24) );
     uint32_t size_id = flash_id >> 16;
 
     if (size_id < 0x12 || size_id > 0x18) {
@@ -259,39 +305,67 @@ static uint32_t calc_erase_size(const target_chip_t target, const uint32_t offse
     }
 }
 
-esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+static esp_loader_error_t set_flash_parameters(esp_loader_t *loader, uint32_t image_size)
 {
-    s_flash_write_size = block_size;
-
     size_t flash_size = 0;
-    if (detect_flash_size(&flash_size) == ESP_LOADER_SUCCESS) {
+    if (detect_flash_size(loader, &flash_size) == ESP_LOADER_SUCCESS) {
         if (image_size > flash_size) {
             return ESP_LOADER_ERROR_IMAGE_SIZE;
         }
-        loader_port_start_timer(DEFAULT_TIMEOUT);
-        RETURN_ON_ERROR( loader_spi_parameters(flash_size) );
+        loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+        RETURN_ON_ERROR( loader_spi_parameters(loader, flash_size) );
     } else {
-        loader_port_debug_print("Flash size detection failed, falling back to default");
+        loader_io_debug_print(loader, "Flash size detection failed, falling back to default");
+    }
+
+    return ESP_LOADER_SUCCESS;
+}
+
+/* Waits for the responses to the blocks sent, until at most max_in_flight are left without one */
+static esp_loader_error_t wait_flash_data(esp_loader_t *loader, uint32_t max_in_flight)
+{
+    while (loader->blocks_in_flight > max_in_flight) {
+        loader_io_start_timer(loader, loader->block_timeout);
+        esp_loader_error_t err = loader->deflating ? loader_flash_defl_data_response(loader) : loader_flash_data_response(loader);
+        if (err != ESP_LOADER_SUCCESS) {
+            loader->blocks_in_flight = 0;
+            return err;
+        }
+        loader->blocks_in_flight--;
     }
 
-    init_md5(offset, image_size);
+    return ESP_LOADER_SUCCESS;
+}
+
+esp_loader_error_t esp_loader_ctx_flash_start(esp_loader_t *loader, uint32_t offset, uint32_t image_size, uint32_t block_size)
+{
+    loader->flash_write_size = block_size;
+    loader->blocks_in_flight = 0;
+    loader->block_timeout = DEFAULT_TIMEOUT;
+    loader->deflating = false;
+
+    RETURN_ON_ERROR( set_flash_parameters(loader, image_size) );
+
+    init_md5(loader, offset, image_size);
 
-    bool encryption_in_cmd = encryption_in_begin_flash_cmd(s_target);
-    const uint32_t erase_size = calc_erase_size(esp_loader_get_target(), offset, image_size);
+    /* The flasher stub has neither the encryption parameter nor the ESP8266 ROM erase bug */
+    bool encryption_in_cmd = !loader->stub_running && encryption_in_begin_flash_cmd(loader->target);
+    const uint32_t erase_size = loader->stub_running ? image_size :
+                                calc_erase_size(esp_loader_ctx_get_target(loader), offset, image_size);
     const uint32_t blocks_to_write = (image_size + block_size - 1) / block_size;
 
-    loader_port_start_timer(timeout_per_mb(erase_size, ERASE_REGION_TIMEOUT_PER_MB));
-    return loader_flash_begin_cmd(offset, erase_size, block_size, blocks_to_write, encryption_in_cmd);
+    loader_io_start_timer(loader, timeout_per_mb(erase_size, ERASE_REGION_TIMEOUT_PER_MB));
+    return loader_flash_begin_cmd(loader, offset, erase_size, block_size, blocks_to_write, encryption_in_cmd);
 }
 
 
-esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size)
+esp_loader_error_t esp_loader_ctx_flash_write(esp_loader_t *loader, void *payload, uint32_t size)
 {
-    uint32_t padding_bytes = s_flash_write_size - size;
+    uint32_t padding_bytes = loader->flash_write_size - size;
     uint8_t *data = (uint8_t *)payload;
     uint32_t padding_index = size;
 
-    if (size > s_flash_write_size) {
+    if (size > loader->flash_write_size) {
         return ESP_LOADER_ERROR_INVALID_PARAM;
     }
 
@@ -299,69 +373,211 @@ esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size)
         data[padding_index++] = PADDING_PATTERN;
     }
 
-    md5_update(payload, (size + 3) & ~3);
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+    RETURN_ON_ERROR( loader_flash_data_send(loader, data, loader->flash_write_size) );
+    loader->blocks_in_flight++;
 
-    loader_port_start_timer(DEFAULT_TIMEOUT);
+    /* Hashed while the port sends the end of the block, the link does not wait for the MD5 */
+    md5_update(loader, payload, (size + 3) & ~3);
 
-    return loader_flash_data_cmd(data, s_flash_write_size);
+    return wait_flash_data(loader, loader->flash_window - 1);
 }
 
 
-esp_loader_error_t esp_loader_flash_finish(bool reboot)
+esp_loader_error_t esp_loader_ctx_flash_finish(esp_loader_t *loader, bool reboot)
 {
-    loader_port_start_timer(DEFAULT_TIMEOUT);
+    RETURN_ON_ERROR( wait_flash_data(loader, 0) );
 
-    return loader_flash_end_cmd(!reboot);
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+
+    return loader_flash_end_cmd(loader, !reboot);
 }
 
 
-esp_loader_error_t esp_loader_mem_start(uint32_t offset, uint32_t size, uint32_t block_size)
+esp_loader_error_t esp_loader_ctx_flash_deflate_start(esp_loader_t *loader, uint32_t offset, uint32_t image_size,
+                                                      uint32_t compressed_size, uint32_t block_size)
+{
+    /* The ESP8266 ROM loader has no compressed flashing */
+    if (loader->target == ESP8266_CHIP && !loader->stub_running) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    if (compressed_size == 0 || block_size == 0) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    loader->flash_write_size = block_size;
+    loader->deflate_image_size = image_size;
+    loader->deflate_compressed_size = compressed_size;
+    loader->blocks_in_flight = 0;
+    loader->deflating = true;
+
+    RETURN_ON_ERROR( set_flash_parameters(loader, image_size) );
+
+    skip_md5(loader);
+
+    /* The ROM loader erases whole blocks of the decompressed image, the stub erases as it writes */
+    bool encryption_in_cmd = !loader->stub_running && encryption_in_begin_flash_cmd(loader->target);
+    const uint32_t erase_size = loader->stub_running ? image_size : ROUNDUP(image_size, block_size) * block_size;
+    const uint32_t blocks_to_write = ROUNDUP(compressed_size, block_size);
+
+    loader_io_start_timer(loader, timeout_per_mb(erase_size, ERASE_REGION_TIMEOUT_PER_MB));
+    return loader_flash_defl_begin_cmd(loader, offset, erase_size, block_size, blocks_to_write, encryption_in_cmd);
+}
+
+
+esp_loader_error_t esp_loader_ctx_flash_deflate_write(esp_loader_t *loader, const void *payload, uint32_t size)
+{
+    if (size > loader->flash_write_size) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    /* The block is written once decompressed, which is about the average ratio larger */
+    uint64_t decompressed_size = (uint64_t)size * loader->deflate_image_size / loader->deflate_compressed_size;
+    loader->block_timeout = timeout_per_mb((uint32_t)decompressed_size, ERASE_WRITE_TIMEOUT_PER_MB);
+
+    loader_io_start_timer(loader, loader->block_timeout);
+    RETURN_ON_ERROR( loader_flash_defl_data_send(loader, (const uint8_t *)payload, size) );
+    loader->blocks_in_flight++;
+
+    return wait_flash_data(loader, loader->flash_window - 1);
+}
+
+
+esp_loader_error_t esp_loader_ctx_flash_deflate_finish(esp_loader_t *loader, bool reboot)
+{
+    RETURN_ON_ERROR( wait_flash_data(loader, 0) );
+
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+
+    return loader_flash_defl_end_cmd(loader, !reboot);
+}
+
+
+esp_loader_error_t esp_loader_ctx_mem_start(esp_loader_t *loader, uint32_t offset, uint32_t size, uint32_t block_size)
 {
     uint32_t blocks_to_write = ROUNDUP(size, block_size);
-    loader_port_start_timer(timeout_per_mb(size, LOAD_RAM_TIMEOUT_PER_MB));
-    return loader_mem_begin_cmd(offset, size, blocks_to_write, block_size);
+    loader_io_start_timer(loader, timeout_per_mb(size, LOAD_RAM_TIMEOUT_PER_MB));
+    return loader_mem_begin_cmd(loader, offset, size, blocks_to_write, block_size);
 }
 
 
-esp_loader_error_t esp_loader_mem_write(const void *payload, uint32_t size)
+esp_loader_error_t esp_loader_ctx_mem_write(esp_loader_t *loader, const void *payload, uint32_t size)
 {
     const uint8_t *data = (const uint8_t *)payload;
-    loader_port_start_timer(timeout_per_mb(size, LOAD_RAM_TIMEOUT_PER_MB));
-    return loader_mem_data_cmd(data, size);
+    loader_io_start_timer(loader, timeout_per_mb(size, LOAD_RAM_TIMEOUT_PER_MB));
+    return loader_mem_data_cmd(loader, data, size);
 }
 
 
-esp_loader_error_t esp_loader_mem_finish(uint32_t entrypoint)
+esp_loader_error_t esp_loader_ctx_mem_finish(esp_loader_t *loader, uint32_t entrypoint)
 {
-    loader_port_start_timer(DEFAULT_TIMEOUT);
-    return loader_mem_end_cmd(entrypoint);
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+    return loader_mem_end_cmd(loader, entrypoint);
 }
 
 
-esp_loader_error_t esp_loader_read_register(uint32_t address, uint32_t *reg_value)
+static esp_loader_error_t load_stub_segment(esp_loader_t *loader, uint32_t address, const uint8_t *data, uint32_t size)
 {
-    loader_port_start_timer(DEFAULT_TIMEOUT);
+    if (size == 0) {
+        return ESP_LOADER_SUCCESS;
+    }
 
-    return loader_read_reg_cmd(address, reg_value);
+    RETURN_ON_ERROR( esp_loader_ctx_mem_start(loader, address, size, STUB_RAM_BLOCK) );
+
+    while (size > 0) {
+        uint32_t to_write = MIN(size, STUB_RAM_BLOCK);
+        RETURN_ON_ERROR( esp_loader_ctx_mem_write(loader, data, to_write) );
+        data += to_write;
+        size -= to_write;
+    }
+
+    return ESP_LOADER_SUCCESS;
 }
 
 
-esp_loader_error_t esp_loader_write_register(uint32_t address, uint32_t reg_value)
+esp_loader_error_t esp_loader_ctx_run_stub(esp_loader_t *loader, const esp_loader_stub_t *stub)
 {
-    loader_port_start_timer(DEFAULT_TIMEOUT);
+    if (stub == NULL || (stub->text_size && stub->text == NULL) || (stub->data_size && stub->data == NULL)) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    if (loader->stub_running) {
+        return ESP_LOADER_SUCCESS;
+    }
+
+    RETURN_ON_ERROR( load_stub_segment(loader, stub->text_start, stub->text, stub->text_size) );
+    RETURN_ON_ERROR( load_stub_segment(loader, stub->data_start, stub->data, stub->data_size) );
+    RETURN_ON_ERROR( esp_loader_ctx_mem_finish(loader, stub->entry) );
+
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+    RETURN_ON_ERROR( loader_stub_greeting(loader) );
+
+    loader->stub_running = true;
 
-    return loader_write_reg_cmd(address, reg_value, 0xFFFFFFFF, 0);
+    return ESP_LOADER_SUCCESS;
 }
 
-esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rate)
+
+bool esp_loader_ctx_stub_running(esp_loader_t *loader)
+{
+    return loader->stub_running;
+}
+
+
+esp_loader_error_t esp_loader_ctx_flash_set_window(esp_loader_t *loader, uint32_t blocks_in_flight)
+{
+    if (blocks_in_flight == 0) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    /* The ROM loader does not read the next block while it writes one to flash */
+    if (blocks_in_flight > 1 && !loader->stub_running) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    loader->flash_window = blocks_in_flight;
+
+    return ESP_LOADER_SUCCESS;
+}
+
+
+esp_loader_error_t esp_loader_ctx_read_register(esp_loader_t *loader, uint32_t address, uint32_t *reg_value)
+{
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+
+    return loader_read_reg_cmd(loader, address, reg_value);
+}
+
+
+esp_loader_error_t esp_loader_ctx_write_register(esp_loader_t *loader, uint32_t address, uint32_t reg_value)
 {
-    if (s_target == ESP8266_CHIP) {
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+
+    return loader_write_reg_cmd(loader, address, reg_value, 0xFFFFFFFF, 0);
+}
+
+esp_loader_error_t esp_loader_ctx_change_transmission_rate(esp_loader_t *loader, uint32_t transmission_rate)
+{
+    if (loader->target == ESP8266_CHIP) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
+
+    return loader_change_baudrate_cmd(loader, transmission_rate, 0);
+}
+
+esp_loader_error_t esp_loader_ctx_change_transmission_rate_stub(esp_loader_t *loader, uint32_t old_transmission_rate,
+                                                                uint32_t new_transmission_rate)
+{
+    if (!loader->stub_running) {
         return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
     }
 
-    loader_port_start_timer(DEFAULT_TIMEOUT);
+    loader_io_start_timer(loader, DEFAULT_TIMEOUT);
 
-    return loader_change_baudrate_cmd(transmission_rate);
+    return loader_change_baudrate_cmd(loader, new_transmission_rate, old_transmission_rate);
 }
 
 #if MD5_ENABLED
@@ -379,24 +595,26 @@ static void hexify(const uint8_t raw_md5[16], uint8_t hex_md5_out[32])
 }
 
 
-esp_loader_error_t esp_loader_flash_verify(void)
+static esp_loader_error_t verify_md5(esp_loader_t *loader, uint32_t address, uint32_t size, const uint8_t raw_md5[16])
 {
-    if (s_target == ESP8266_CHIP) {
-        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
-    }
-
-    uint8_t raw_md5[16] = {0};
-
     /* Zero termination and new line character require 2 bytes */
     uint8_t hex_md5[MD5_SIZE + 2] = {0};
     uint8_t received_md5[MD5_SIZE + 2] = {0};
 
-    md5_final(raw_md5);
     hexify(raw_md5, hex_md5);
 
-    loader_port_start_timer(timeout_per_mb(s_image_size, MD5_TIMEOUT_PER_MB));
+    /* The responses to the blocks in flight come first */
+    RETURN_ON_ERROR( wait_flash_data(loader, 0) );
 
-    RETURN_ON_ERROR( loader_md5_cmd(s_start_address, s_image_size, received_md5) );
+    loader_io_start_timer(loader, timeout_per_mb(size, MD5_TIMEOUT_PER_MB));
+
+    if (loader->stub_running) {
+        uint8_t raw_received_md5[16];
+        RETURN_ON_ERROR( loader_stub_md5_cmd(loader, address, size, raw_received_md5) );
+        hexify(raw_received_md5, received_md5);
+    } else {
+        RETURN_ON_ERROR( loader_md5_cmd(loader, address, size, received_md5) );
+    }
 
     bool md5_match = memcmp(hex_md5, received_md5, MD5_SIZE) == 0;
 
@@ -404,11 +622,11 @@ esp_loader_error_t esp_loader_flash_verify(void)
         hex_md5[MD5_SIZE] = '\n';
         received_md5[MD5_SIZE] = '\n';
 
-        loader_port_debug_print("Error: MD5 checksum does not match:\n");
-        loader_port_debug_print("Expected:\n");
-        loader_port_debug_print((char *)received_md5);
-        loader_port_debug_print("Actual:\n");
-        loader_port_debug_print((char *)hex_md5);
+        loader_io_debug_print(loader, "Error: MD5 checksum does not match:\n");
+        loader_io_debug_print(loader, "Expected:\n");
+        loader_io_debug_print(loader, (char *)received_md5);
+        loader_io_debug_print(loader, "Actual:\n");
+        loader_io_debug_print(loader, (char *)hex_md5);
 
         return ESP_LOADER_ERROR_INVALID_MD5;
     }
@@ -416,9 +634,214 @@ esp_loader_error_t esp_loader_flash_verify(void)
     return ESP_LOADER_SUCCESS;
 }
 
+
+esp_loader_error_t esp_loader_ctx_flash_verify(esp_loader_t *loader)
+{
+    if ((loader->target == ESP8266_CHIP && !loader->stub_running) || !loader->md5_of_writes) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    uint8_t raw_md5[16] = {0};
+
+    md5_final(loader, raw_md5);
+
+    return verify_md5(loader, loader->start_address, loader->image_size, raw_md5);
+}
+
+
+esp_loader_error_t esp_loader_ctx_flash_verify_known_md5(esp_loader_t *loader, uint32_t address, uint32_t size, const uint8_t expected_md5[16])
+{
+    if (loader->target == ESP8266_CHIP && !loader->stub_running) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    return verify_md5(loader, address, size, expected_md5);
+}
+
 #endif
 
-void esp_loader_reset_target(void)
+void esp_loader_ctx_reset_target(esp_loader_t *loader)
+{
+    loader->stub_running = false;
+    loader->flash_window = 1;
+    loader_io_reset_target(loader);
+}
+
+
+/* The single target functions drive the loader_port_ functions */
+
+static esp_loader_error_t default_write(esp_loader_port_t *port, const uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    return loader_port_write(data, size, timeout);
+}
+
+static esp_loader_error_t default_read(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    return loader_port_read(data, size, timeout);
+}
+
+static void default_delay_ms(esp_loader_port_t *port, uint32_t ms)
+{
+    loader_port_delay_ms(ms);
+}
+
+static void default_start_timer(esp_loader_port_t *port, uint32_t ms)
+{
+    loader_port_start_timer(ms);
+}
+
+static uint32_t default_remaining_time(esp_loader_port_t *port)
+{
+    return loader_port_remaining_time();
+}
+
+static void default_enter_bootloader(esp_loader_port_t *port)
+{
+    loader_port_enter_bootloader();
+}
+
+static void default_reset_target(esp_loader_port_t *port)
 {
     loader_port_reset_target();
 }
+
+static void default_debug_print(esp_loader_port_t *port, const char *str)
+{
+    loader_port_debug_print(str);
+}
+
+static const esp_loader_port_ops_t s_default_port_ops = {
+    .write = default_write,
+    .read = default_read,
+    .delay_ms = default_delay_ms,
+    .start_timer = default_start_timer,
+    .remaining_time = default_remaining_time,
+    .enter_bootloader = default_enter_bootloader,
+    .reset_target = default_reset_target,
+    .debug_print = default_debug_print,
+};
+
+static esp_loader_port_t s_default_port = { .ops = &s_default_port_ops };
+
+static esp_loader_t s_default_loader = {
+    .port = &s_default_port,
+    .target = ESP_UNKNOWN_CHIP,
+    .flash_window = 1,
+};
+
+esp_loader_t *loader_default_ctx(void)
+{
+    return &s_default_loader;
+}
+
+esp_loader_error_t esp_loader_connect(esp_loader_connect_args_t *connect_args)
+{
+    return esp_loader_ctx_connect(loader_default_ctx(), connect_args);
+}
+
+target_chip_t esp_loader_get_target(void)
+{
+    return esp_loader_ctx_get_target(loader_default_ctx());
+}
+
+esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+{
+    return esp_loader_ctx_flash_start(loader_default_ctx(), offset, image_size, block_size);
+}
+
+esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size)
+{
+    return esp_loader_ctx_flash_write(loader_default_ctx(), payload, size);
+}
+
+esp_loader_error_t esp_loader_flash_finish(bool reboot)
+{
+    return esp_loader_ctx_flash_finish(loader_default_ctx(), reboot);
+}
+
+esp_loader_error_t esp_loader_flash_deflate_start(uint32_t offset, uint32_t image_size,
+                                                  uint32_t compressed_size, uint32_t block_size)
+{
+    return esp_loader_ctx_flash_deflate_start(loader_default_ctx(), offset, image_size, compressed_size, block_size);
+}
+
+esp_loader_error_t esp_loader_flash_deflate_write(const void *payload, uint32_t size)
+{
+    return esp_loader_ctx_flash_deflate_write(loader_default_ctx(), payload, size);
+}
+
+esp_loader_error_t esp_loader_flash_deflate_finish(bool reboot)
+{
+    return esp_loader_ctx_flash_deflate_finish(loader_default_ctx(), reboot);
+}
+
+esp_loader_error_t esp_loader_mem_start(uint32_t offset, uint32_t size, uint32_t block_size)
+{
+    return esp_loader_ctx_mem_start(loader_default_ctx(), offset, size, block_size);
+}
+
+esp_loader_error_t esp_loader_mem_write(const void *payload, uint32_t size)
+{
+    return esp_loader_ctx_mem_write(loader_default_ctx(), payload, size);
+}
+
+esp_loader_error_t esp_loader_mem_finish(uint32_t entrypoint)
+{
+    return esp_loader_ctx_mem_finish(loader_default_ctx(), entrypoint);
+}
+
+esp_loader_error_t esp_loader_run_stub(const esp_loader_stub_t *stub)
+{
+    return esp_loader_ctx_run_stub(loader_default_ctx(), stub);
+}
+
+bool esp_loader_stub_running(void)
+{
+    return esp_loader_ctx_stub_running(loader_default_ctx());
+}
+
+esp_loader_error_t esp_loader_flash_set_window(uint32_t blocks_in_flight)
+{
+    return esp_loader_ctx_flash_set_window(loader_default_ctx(), blocks_in_flight);
+}
+
+esp_loader_error_t esp_loader_read_register(uint32_t address, uint32_t *reg_value)
+{
+    return esp_loader_ctx_read_register(loader_default_ctx(), address, reg_value);
+}
+
+esp_loader_error_t esp_loader_write_register(uint32_t address, uint32_t reg_value)
+{
+    return esp_loader_ctx_write_register(loader_default_ctx(), address, reg_value);
+}
+
+esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rate)
+{
+    return esp_loader_ctx_change_transmission_rate(loader_default_ctx(), transmission_rate);
+}
+
+esp_loader_error_t esp_loader_change_transmission_rate_stub(uint32_t old_transmission_rate,
+                                                            uint32_t new_transmission_rate)
+{
+    return esp_loader_ctx_change_transmission_rate_stub(loader_default_ctx(), old_transmission_rate,
+                                                        new_transmission_rate);
+}
+
+#if MD5_ENABLED
+
+esp_loader_error_t esp_loader_flash_verify(void)
+{
+    return esp_loader_ctx_flash_verify(loader_default_ctx());
+}
+
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size, const uint8_t expected_md5[16])
+{
+    return esp_loader_ctx_flash_verify_known_md5(loader_default_ctx(), address, size, expected_md5);
+}
+
+#endif
+
+void esp_loader_reset_target(void)
+{
+    esp_loader_ctx_reset_target(loader_default_ctx());
+}
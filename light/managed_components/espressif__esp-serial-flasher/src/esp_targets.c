@@ -18,7 +18,7 @@
 
 #define MAX_MAGIC_VALUES 2
 
-typedef esp_loader_error_t (*read_spi_config_t)(uint32_t efuse_base, uint32_t *spi_config);
+typedef esp_loader_error_t (*read_spi_config_t)(esp_loader_t *loader, uint32_t efuse_base, uint32_t *spi_config);
 
 typedef struct {
     target_registers_t regs;
@@ -36,8 +36,8 @@ typedef struct {
 #define ESP32xx_SPI_REG_BASE 0x60002000
 #define ESP32_SPI_REG_BASE   0x3ff42000
 
-static esp_loader_error_t spi_config_esp32(uint32_t efuse_base, uint32_t *spi_config);
-static esp_loader_error_t spi_config_esp32xx(uint32_t efuse_base, uint32_t *spi_config);
+static esp_loader_error_t spi_config_esp32(esp_loader_t *loader, uint32_t efuse_base, uint32_t *spi_config);
+static esp_loader_error_t spi_config_esp32xx(esp_loader_t *loader, uint32_t efuse_base, uint32_t *spi_config);
 
 static const esp_target_t esp_target[ESP_MAX_CHIP] = {
 
@@ -173,10 +173,10 @@ const target_registers_t *get_esp_target_data(target_chip_t chip)
     return (const target_registers_t *)&esp_target[chip];
 }
 
-esp_loader_error_t loader_detect_chip(target_chip_t *target_chip, const target_registers_t **target_data)
+esp_loader_error_t loader_detect_chip(esp_loader_t *loader, target_chip_t *target_chip, const target_registers_t **target_data)
 {
     uint32_t magic_value;
-    RETURN_ON_ERROR( esp_loader_read_register(CHIP_DETECT_MAGIC_REG_ADDR,  &magic_value) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, CHIP_DETECT_MAGIC_REG_ADDR,  &magic_value) );
 
     for (int chip = 0; chip < ESP_MAX_CHIP; chip++) {
         for(int index = 0; index < MAX_MAGIC_VALUES; index++) {
@@ -191,10 +191,10 @@ esp_loader_error_t loader_detect_chip(target_chip_t *target_chip, const target_r
     return ESP_LOADER_ERROR_INVALID_TARGET;
 }
 
-esp_loader_error_t loader_read_spi_config(target_chip_t target_chip, uint32_t *spi_config)
+esp_loader_error_t loader_read_spi_config(esp_loader_t *loader, target_chip_t target_chip, uint32_t *spi_config)
 {
     const esp_target_t *target = &esp_target[target_chip];
-    return target->read_spi_config(target->efuse_base, spi_config);
+    return target->read_spi_config(loader, target->efuse_base, spi_config);
 }
 
 static inline uint32_t efuse_word_addr(uint32_t efuse_base, uint32_t n)
@@ -209,13 +209,13 @@ static inline uint8_t adjust_pin_number(uint8_t num)
 }
 
 
-static esp_loader_error_t spi_config_esp32(uint32_t efuse_base, uint32_t *spi_config)
+static esp_loader_error_t spi_config_esp32(esp_loader_t *loader, uint32_t efuse_base, uint32_t *spi_config)
 {
     *spi_config = 0;
 
     uint32_t reg5, reg3;
-    RETURN_ON_ERROR( esp_loader_read_register(efuse_word_addr(efuse_base, 5), &reg5) );
-    RETURN_ON_ERROR( esp_loader_read_register(efuse_word_addr(efuse_base, 3), &reg3) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, efuse_word_addr(efuse_base, 5), &reg5) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, efuse_word_addr(efuse_base, 3), &reg3) );
 
     uint32_t pins = reg5 & 0xfffff;
 
@@ -239,13 +239,13 @@ static esp_loader_error_t spi_config_esp32(uint32_t efuse_base, uint32_t *spi_co
 }
 
 // Applies for esp32s2, esp32c3 and esp32c3
-static esp_loader_error_t spi_config_esp32xx(uint32_t efuse_base, uint32_t *spi_config)
+static esp_loader_error_t spi_config_esp32xx(esp_loader_t *loader, uint32_t efuse_base, uint32_t *spi_config)
 {
     *spi_config = 0;
 
     uint32_t reg1, reg2;
-    RETURN_ON_ERROR( esp_loader_read_register(efuse_word_addr(efuse_base, 18), &reg1) );
-    RETURN_ON_ERROR( esp_loader_read_register(efuse_word_addr(efuse_base, 19), &reg2) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, efuse_word_addr(efuse_base, 18), &reg1) );
+    RETURN_ON_ERROR( esp_loader_ctx_read_register(loader, efuse_word_addr(efuse_base, 19), &reg2) );
 
     uint32_t pins = ((reg1 >> 16) | ((reg2 & 0xfffff) << 16)) & 0x3fffffff;
 
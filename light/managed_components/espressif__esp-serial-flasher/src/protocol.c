@@ -15,15 +15,14 @@
 
 #include "protocol.h"
 #include "esp_loader_io.h"
+#include "loader_ctx.h"
 #include "slip.h"
 #include <stddef.h>
 #include <string.h>
 
 #define CMD_SIZE(cmd) ( sizeof(cmd) - sizeof(command_common_t) )
 
-static uint32_t s_sequence_number = 0;
-
-static esp_loader_error_t check_response(command_t cmd, uint32_t *reg_value, void* resp, uint32_t resp_size);
+static esp_loader_error_t check_response(esp_loader_t *loader, command_t cmd, uint32_t *reg_value, void* resp, uint32_t resp_size);
 
 static uint8_t compute_checksum(const uint8_t *data, uint32_t size)
 {
@@ -36,77 +35,72 @@ static uint8_t compute_checksum(const uint8_t *data, uint32_t size)
     return checksum;
 }
 
-static esp_loader_error_t send_cmd(const void *cmd_data, uint32_t size, uint32_t *reg_value)
+static esp_loader_error_t send_cmd(esp_loader_t *loader, const void *cmd_data, uint32_t size, uint32_t *reg_value)
 {
     response_t response;
     command_t command = ((const command_common_t *)cmd_data)->command;
 
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
-    RETURN_ON_ERROR( SLIP_send((const uint8_t *)cmd_data, size) );
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
+    RETURN_ON_ERROR( SLIP_send(loader, (const uint8_t *)cmd_data, size) );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
 
-    return check_response(command, reg_value, &response, sizeof(response));
+    return check_response(loader, command, reg_value, &response, sizeof(response));
 }
 
 
-static esp_loader_error_t send_cmd_with_data(const void *cmd_data, size_t cmd_size,
+static esp_loader_error_t send_cmd_with_data(esp_loader_t *loader, const void *cmd_data, size_t cmd_size,
                                              const void *data, size_t data_size)
 {
     response_t response;
     command_t command = ((const command_common_t *)cmd_data)->command;
 
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
-    RETURN_ON_ERROR( SLIP_send((const uint8_t *)cmd_data, cmd_size) );
-    RETURN_ON_ERROR( SLIP_send(data, data_size) );
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
+    RETURN_ON_ERROR( SLIP_send(loader, (const uint8_t *)cmd_data, cmd_size) );
+    RETURN_ON_ERROR( SLIP_send(loader, data, data_size) );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
 
-    return check_response(command, NULL, &response, sizeof(response));
+    return check_response(loader, command, NULL, &response, sizeof(response));
 }
 
 
-static esp_loader_error_t send_cmd_md5(const void *cmd_data, size_t cmd_size, uint8_t md5_out[MD5_SIZE])
+static esp_loader_error_t send_cmd_md5(esp_loader_t *loader, const void *cmd_data, size_t cmd_size, void *resp, uint32_t resp_size)
 {
-    rom_md5_response_t response;
     command_t command = ((const command_common_t *)cmd_data)->command;
 
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
-    RETURN_ON_ERROR( SLIP_send((const uint8_t *)cmd_data, cmd_size) );
-    RETURN_ON_ERROR( SLIP_send_delimiter() );
-
-    RETURN_ON_ERROR( check_response(command, NULL, &response, sizeof(response)) );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
+    RETURN_ON_ERROR( SLIP_send(loader, (const uint8_t *)cmd_data, cmd_size) );
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
 
-    memcpy(md5_out, response.md5, MD5_SIZE);
-
-    return ESP_LOADER_SUCCESS;
+    return check_response(loader, command, NULL, resp, resp_size);
 }
 
 
-static void log_loader_internal_error(error_code_t error)
+static void log_loader_internal_error(esp_loader_t *loader, error_code_t error)
 {
-    loader_port_debug_print("Error: ");
+    loader_io_debug_print(loader, "Error: ");
 
     switch (error) {
-        case INVALID_CRC:     loader_port_debug_print("INVALID_CRC"); break;
-        case INVALID_COMMAND: loader_port_debug_print("INVALID_COMMAND"); break;
-        case COMMAND_FAILED:  loader_port_debug_print("COMMAND_FAILED"); break;
-        case FLASH_WRITE_ERR: loader_port_debug_print("FLASH_WRITE_ERR"); break;
-        case FLASH_READ_ERR:  loader_port_debug_print("FLASH_READ_ERR"); break;
-        case READ_LENGTH_ERR: loader_port_debug_print("READ_LENGTH_ERR"); break;
-        case DEFLATE_ERROR:   loader_port_debug_print("DEFLATE_ERROR"); break;
-        default:              loader_port_debug_print("UNKNOWN ERROR"); break;
+        case INVALID_CRC:     loader_io_debug_print(loader, "INVALID_CRC"); break;
+        case INVALID_COMMAND: loader_io_debug_print(loader, "INVALID_COMMAND"); break;
+        case COMMAND_FAILED:  loader_io_debug_print(loader, "COMMAND_FAILED"); break;
+        case FLASH_WRITE_ERR: loader_io_debug_print(loader, "FLASH_WRITE_ERR"); break;
+        case FLASH_READ_ERR:  loader_io_debug_print(loader, "FLASH_READ_ERR"); break;
+        case READ_LENGTH_ERR: loader_io_debug_print(loader, "READ_LENGTH_ERR"); break;
+        case DEFLATE_ERROR:   loader_io_debug_print(loader, "DEFLATE_ERROR"); break;
+        default:              loader_io_debug_print(loader, "UNKNOWN ERROR"); break;
     }
 
-    loader_port_debug_print("\n");
+    loader_io_debug_print(loader, "\n");
 }
 
 
-static esp_loader_error_t check_response(command_t cmd, uint32_t *reg_value, void* resp, uint32_t resp_size)
+static esp_loader_error_t check_response(esp_loader_t *loader, command_t cmd, uint32_t *reg_value, void* resp, uint32_t resp_size)
 {
     esp_loader_error_t err;
     common_response_t *response = (common_response_t *)resp;
 
     do {
-        err = SLIP_receive_packet(resp, resp_size);
+        err = SLIP_receive_packet(loader, resp, resp_size);
         if (err != ESP_LOADER_SUCCESS) {
             return err;
         }
@@ -115,7 +109,7 @@ static esp_loader_error_t check_response(command_t cmd, uint32_t *reg_value, voi
     response_status_t *status = (response_status_t *)((uint8_t *)resp + resp_size - sizeof(response_status_t));
 
     if (status->failed) {
-        log_loader_internal_error(status->error);
+        log_loader_internal_error(loader, status->error);
         return ESP_LOADER_ERROR_INVALID_RESPONSE;
     }
 
@@ -126,18 +120,19 @@ static esp_loader_error_t check_response(command_t cmd, uint32_t *reg_value, voi
     return ESP_LOADER_SUCCESS;
 }
 
-esp_loader_error_t loader_flash_begin_cmd(uint32_t offset,
-                                          uint32_t erase_size,
-                                          uint32_t block_size,
-                                          uint32_t blocks_to_write,
-                                          bool encryption)
+static esp_loader_error_t flash_begin_cmd(esp_loader_t *loader, command_t command,
+                                         uint32_t offset,
+                                         uint32_t erase_size,
+                                         uint32_t block_size,
+                                         uint32_t blocks_to_write,
+                                         bool encryption)
 {
     uint32_t encryption_size = encryption ? sizeof(uint32_t) : 0;
 
     flash_begin_command_t flash_begin_cmd = {
         .common = {
             .direction = WRITE_DIRECTION,
-            .command = FLASH_BEGIN,
+            .command = command,
             .size = CMD_SIZE(flash_begin_cmd) - encryption_size,
             .checksum = 0
         },
@@ -148,46 +143,134 @@ esp_loader_error_t loader_flash_begin_cmd(uint32_t offset,
         .encrypted = 0
     };
 
-    s_sequence_number = 0;
+    loader->sequence_number = 0;
 
-    return send_cmd(&flash_begin_cmd, sizeof(flash_begin_cmd) - encryption_size, NULL);
+    return send_cmd(loader, &flash_begin_cmd, sizeof(flash_begin_cmd) - encryption_size, NULL);
 }
 
 
-esp_loader_error_t loader_flash_data_cmd(const uint8_t *data, uint32_t size)
+static esp_loader_error_t send_flash_data(esp_loader_t *loader, command_t command, const uint8_t *data, uint32_t size)
 {
     data_command_t data_cmd = {
         .common = {
             .direction = WRITE_DIRECTION,
-            .command = FLASH_DATA,
+            .command = command,
             .size = CMD_SIZE(data_cmd) + size,
             .checksum = compute_checksum(data, size)
         },
         .data_size = size,
-        .sequence_number = s_sequence_number++,
+        .sequence_number = loader->sequence_number++,
     };
 
-    return send_cmd_with_data(&data_cmd, sizeof(data_cmd), data, size);
+    RETURN_ON_ERROR( SLIP_send_delimiter(loader) );
+    RETURN_ON_ERROR( SLIP_send(loader, (const uint8_t *)&data_cmd, sizeof(data_cmd)) );
+    RETURN_ON_ERROR( SLIP_send(loader, data, size) );
+    return SLIP_send_delimiter(loader);
 }
 
 
-esp_loader_error_t loader_flash_end_cmd(bool stay_in_loader)
+/* The responses to data commands come in the order of the commands, without their sequence number */
+static esp_loader_error_t flash_data_response(esp_loader_t *loader, command_t command)
+{
+    response_t response;
+
+    return check_response(loader, command, NULL, &response, sizeof(response));
+}
+
+
+static esp_loader_error_t flash_data_cmd(esp_loader_t *loader, command_t command, const uint8_t *data, uint32_t size)
+{
+    RETURN_ON_ERROR( send_flash_data(loader, command, data, size) );
+
+    return flash_data_response(loader, command);
+}
+
+
+static esp_loader_error_t flash_end_cmd(esp_loader_t *loader, command_t command, bool stay_in_loader)
 {
     flash_end_command_t end_cmd = {
         .common = {
             .direction = WRITE_DIRECTION,
-            .command = FLASH_END,
+            .command = command,
             .size = CMD_SIZE(end_cmd),
             .checksum = 0
         },
         .stay_in_loader = stay_in_loader
     };
 
-    return send_cmd(&end_cmd, sizeof(end_cmd), NULL);
+    return send_cmd(loader, &end_cmd, sizeof(end_cmd), NULL);
+}
+
+
+esp_loader_error_t loader_flash_begin_cmd(esp_loader_t *loader, uint32_t offset,
+                                          uint32_t erase_size,
+                                          uint32_t block_size,
+                                          uint32_t blocks_to_write,
+                                          bool encryption)
+{
+    return flash_begin_cmd(loader, FLASH_BEGIN, offset, erase_size, block_size, blocks_to_write, encryption);
 }
 
 
-esp_loader_error_t loader_mem_begin_cmd(uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size)
+esp_loader_error_t loader_flash_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size)
+{
+    return flash_data_cmd(loader, FLASH_DATA, data, size);
+}
+
+
+esp_loader_error_t loader_flash_data_send(esp_loader_t *loader, const uint8_t *data, uint32_t size)
+{
+    return send_flash_data(loader, FLASH_DATA, data, size);
+}
+
+
+esp_loader_error_t loader_flash_data_response(esp_loader_t *loader)
+{
+    return flash_data_response(loader, FLASH_DATA);
+}
+
+
+esp_loader_error_t loader_flash_end_cmd(esp_loader_t *loader, bool stay_in_loader)
+{
+    return flash_end_cmd(loader, FLASH_END, stay_in_loader);
+}
+
+
+esp_loader_error_t loader_flash_defl_begin_cmd(esp_loader_t *loader, uint32_t offset,
+                                               uint32_t erase_size,
+                                               uint32_t block_size,
+                                               uint32_t blocks_to_write,
+                                               bool encryption)
+{
+    return flash_begin_cmd(loader, FLASH_DEFL_BEGIN, offset, erase_size, block_size, blocks_to_write, encryption);
+}
+
+
+esp_loader_error_t loader_flash_defl_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size)
+{
+    return flash_data_cmd(loader, FLASH_DEFL_DATA, data, size);
+}
+
+
+esp_loader_error_t loader_flash_defl_data_send(esp_loader_t *loader, const uint8_t *data, uint32_t size)
+{
+    return send_flash_data(loader, FLASH_DEFL_DATA, data, size);
+}
+
+
+esp_loader_error_t loader_flash_defl_data_response(esp_loader_t *loader)
+{
+    return flash_data_response(loader, FLASH_DEFL_DATA);
+}
+
+
+esp_loader_error_t loader_flash_defl_end_cmd(esp_loader_t *loader, bool stay_in_loader)
+{
+    return flash_end_cmd(loader, FLASH_DEFL_END, stay_in_loader);
+}
+
+
+esp_loader_error_t loader_mem_begin_cmd(esp_loader_t *loader, uint32_t offset, uint32_t size, uint32_t blocks_to_write, uint32_t block_size)
 {
 
     mem_begin_command_t mem_begin_cmd = {
@@ -203,13 +286,13 @@ esp_loader_error_t loader_mem_begin_cmd(uint32_t offset, uint32_t size, uint32_t
         .offset = offset
     };
 
-    s_sequence_number = 0;
+    loader->sequence_number = 0;
 
-    return send_cmd(&mem_begin_cmd, sizeof(mem_begin_cmd), NULL);
+    return send_cmd(loader, &mem_begin_cmd, sizeof(mem_begin_cmd), NULL);
 }
 
 
-esp_loader_error_t loader_mem_data_cmd(const uint8_t *data, uint32_t size)
+esp_loader_error_t loader_mem_data_cmd(esp_loader_t *loader, const uint8_t *data, uint32_t size)
 {
     data_command_t data_cmd = {
         .common = {
@@ -219,12 +302,12 @@ esp_loader_error_t loader_mem_data_cmd(const uint8_t *data, uint32_t size)
             .checksum = compute_checksum(data, size)
         },
         .data_size = size,
-        .sequence_number = s_sequence_number++,
+        .sequence_number = loader->sequence_number++,
     };
-    return send_cmd_with_data(&data_cmd, sizeof(data_cmd), data, size);
+    return send_cmd_with_data(loader, &data_cmd, sizeof(data_cmd), data, size);
 }
 
-esp_loader_error_t loader_mem_end_cmd(uint32_t entrypoint)
+esp_loader_error_t loader_mem_end_cmd(esp_loader_t *loader, uint32_t entrypoint)
 {
     mem_end_command_t end_cmd = {
         .common = {
@@ -236,11 +319,11 @@ esp_loader_error_t loader_mem_end_cmd(uint32_t entrypoint)
         .entry_point_address = entrypoint
     };
 
-    return send_cmd(&end_cmd, sizeof(end_cmd), NULL);
+    return send_cmd(loader, &end_cmd, sizeof(end_cmd), NULL);
 }
 
 
-esp_loader_error_t loader_sync_cmd(void)
+esp_loader_error_t loader_sync_cmd(esp_loader_t *loader)
 {
     sync_command_t sync_cmd = {
         .common = {
@@ -258,11 +341,11 @@ esp_loader_error_t loader_sync_cmd(void)
         }
     };
 
-    return send_cmd(&sync_cmd, sizeof(sync_cmd), NULL);
+    return send_cmd(loader, &sync_cmd, sizeof(sync_cmd), NULL);
 }
 
 
-esp_loader_error_t loader_write_reg_cmd(uint32_t address, uint32_t value,
+esp_loader_error_t loader_write_reg_cmd(esp_loader_t *loader, uint32_t address, uint32_t value,
                                         uint32_t mask, uint32_t delay_us)
 {
     write_reg_command_t write_cmd = {
@@ -278,11 +361,11 @@ esp_loader_error_t loader_write_reg_cmd(uint32_t address, uint32_t value,
         .delay_us = delay_us
     };
 
-    return send_cmd(&write_cmd, sizeof(write_cmd), NULL);
+    return send_cmd(loader, &write_cmd, sizeof(write_cmd), NULL);
 }
 
 
-esp_loader_error_t loader_read_reg_cmd(uint32_t address, uint32_t *reg)
+esp_loader_error_t loader_read_reg_cmd(esp_loader_t *loader, uint32_t address, uint32_t *reg)
 {
     read_reg_command_t read_cmd = {
         .common = {
@@ -294,11 +377,11 @@ esp_loader_error_t loader_read_reg_cmd(uint32_t address, uint32_t *reg)
         .address = address,
     };
 
-    return send_cmd(&read_cmd, sizeof(read_cmd), reg);
+    return send_cmd(loader, &read_cmd, sizeof(read_cmd), reg);
 }
 
 
-esp_loader_error_t loader_spi_attach_cmd(uint32_t config)
+esp_loader_error_t loader_spi_attach_cmd(esp_loader_t *loader, uint32_t config)
 {
     spi_attach_command_t attach_cmd = {
         .common = {
@@ -311,10 +394,10 @@ esp_loader_error_t loader_spi_attach_cmd(uint32_t config)
         .zero = 0
     };
 
-    return send_cmd(&attach_cmd, sizeof(attach_cmd), NULL);
+    return send_cmd(loader, &attach_cmd, sizeof(attach_cmd), NULL);
 }
 
-esp_loader_error_t loader_change_baudrate_cmd(uint32_t baudrate)
+esp_loader_error_t loader_change_baudrate_cmd(esp_loader_t *loader, uint32_t baudrate, uint32_t old_baudrate)
 {
     change_baudrate_command_t baudrate_cmd = {
         .common = {
@@ -324,19 +407,19 @@ esp_loader_error_t loader_change_baudrate_cmd(uint32_t baudrate)
             .checksum = 0
         },
         .new_baudrate = baudrate,
-        .old_baudrate = 0 // ESP32 ROM only
+        .old_baudrate = old_baudrate // 0 for the ROM loader
     };
 
-    return send_cmd(&baudrate_cmd, sizeof(baudrate_cmd), NULL);
+    return send_cmd(loader, &baudrate_cmd, sizeof(baudrate_cmd), NULL);
 }
 
-esp_loader_error_t loader_md5_cmd(uint32_t address, uint32_t size, uint8_t *md5_out)
+static void md5_cmd_init(spi_flash_md5_command_t *md5_cmd, uint32_t address, uint32_t size)
 {
-    spi_flash_md5_command_t md5_cmd = {
+    *md5_cmd = (spi_flash_md5_command_t) {
         .common = {
             .direction = WRITE_DIRECTION,
             .command = SPI_FLASH_MD5,
-            .size = CMD_SIZE(md5_cmd),
+            .size = CMD_SIZE(*md5_cmd),
             .checksum = 0
         },
         .address = address,
@@ -344,11 +427,52 @@ esp_loader_error_t loader_md5_cmd(uint32_t address, uint32_t size, uint8_t *md5_
         .reserved_0 = 0,
         .reserved_1 = 0
     };
+}
+
+esp_loader_error_t loader_md5_cmd(esp_loader_t *loader, uint32_t address, uint32_t size, uint8_t *md5_out)
+{
+    spi_flash_md5_command_t md5_cmd;
+    rom_md5_response_t response;
 
-    return send_cmd_md5(&md5_cmd, sizeof(md5_cmd), md5_out);
+    md5_cmd_init(&md5_cmd, address, size);
+
+    RETURN_ON_ERROR( send_cmd_md5(loader, &md5_cmd, sizeof(md5_cmd), &response, sizeof(response)) );
+
+    memcpy(md5_out, response.md5, MD5_SIZE);
+
+    return ESP_LOADER_SUCCESS;
+}
+
+esp_loader_error_t loader_stub_md5_cmd(esp_loader_t *loader, uint32_t address, uint32_t size, uint8_t *raw_md5_out)
+{
+    spi_flash_md5_command_t md5_cmd;
+    stub_md5_response_t response;
+
+    md5_cmd_init(&md5_cmd, address, size);
+
+    RETURN_ON_ERROR( send_cmd_md5(loader, &md5_cmd, sizeof(md5_cmd), &response, sizeof(response)) );
+
+    memcpy(raw_md5_out, response.md5, sizeof(response.md5));
+
+    return ESP_LOADER_SUCCESS;
+}
+
+esp_loader_error_t loader_stub_greeting(esp_loader_t *loader)
+{
+    /* The stub sends this packet once it runs, it is not a response to any command */
+    static const uint8_t greeting[] = { 'O', 'H', 'A', 'I' };
+    uint8_t received[sizeof(greeting)];
+
+    RETURN_ON_ERROR( SLIP_receive_packet(loader, received, sizeof(received)) );
+
+    if (memcmp(received, greeting, sizeof(greeting)) != 0) {
+        return ESP_LOADER_ERROR_INVALID_RESPONSE;
+    }
+
+    return ESP_LOADER_SUCCESS;
 }
 
-esp_loader_error_t loader_spi_parameters(uint32_t total_size)
+esp_loader_error_t loader_spi_parameters(esp_loader_t *loader, uint32_t total_size)
 {
     write_spi_command_t spi_cmd = {
         .common = {
@@ -365,7 +489,7 @@ esp_loader_error_t loader_spi_parameters(uint32_t total_size)
         .status_mask = 0xFFFF,
     };
 
-    return send_cmd(&spi_cmd, sizeof(spi_cmd), NULL);
+    return send_cmd(loader, &spi_cmd, sizeof(spi_cmd), NULL);
 }
 
 __attribute__ ((weak)) void loader_port_debug_print(const char *str)
@@ -14,40 +14,126 @@
  */
 
 #include "slip.h"
-#include "esp_loader_io.h"
+#include "loader_ctx.h"
+#include <stdbool.h>
+#include <string.h>
 
 static const uint8_t DELIMITER = 0xC0;
 static const uint8_t C0_REPLACEMENT[2] = {0xDB, 0xDC};
 static const uint8_t DB_REPLACEMENT[2] = {0xDB, 0xDD};
 
-static inline esp_loader_error_t peripheral_read(uint8_t *buff, const size_t size)
+static inline esp_loader_error_t peripheral_read(esp_loader_t *loader, uint8_t *buff, const size_t size)
 {
-    return loader_port_read(buff, size, loader_port_remaining_time());
+    return loader_io_read(loader, buff, size, loader_io_remaining_time(loader));
 }
 
-static inline esp_loader_error_t peripheral_write(const uint8_t *buff, const size_t size)
+static inline esp_loader_error_t peripheral_write(esp_loader_t *loader, const uint8_t *buff, const size_t size)
 {
-    return loader_port_write(buff, size, loader_port_remaining_time());
+    return loader_io_write(loader, buff, size, loader_io_remaining_time(loader));
 }
 
-esp_loader_error_t SLIP_receive_data(uint8_t *buff, const size_t size)
+static esp_loader_error_t tx_flush(esp_loader_t *loader)
 {
-    uint8_t ch;
+    slip_tx_t *tx = &loader->slip_tx;
+    size_t size = tx->size;
+
+    tx->size = 0;
+    if (size == 0) {
+        return ESP_LOADER_SUCCESS;
+    }
+
+    esp_loader_error_t err = peripheral_write(loader, tx->buffer, size);
+    if (err != ESP_LOADER_SUCCESS) {
+        /* The rest of the packet is not sent, the next one starts afresh */
+        tx->in_packet = false;
+    }
+
+    return err;
+}
+
+static esp_loader_error_t tx_append(esp_loader_t *loader, const uint8_t *data, size_t size)
+{
+    slip_tx_t *tx = &loader->slip_tx;
+
+    while (size > 0) {
+        if (tx->size == sizeof(tx->buffer)) {
+            RETURN_ON_ERROR( tx_flush(loader) );
+        }
 
-    for (uint32_t i = 0; i < size; i++) {
-        RETURN_ON_ERROR( peripheral_read(&ch, 1) );
+        size_t to_copy = sizeof(tx->buffer) - tx->size;
+        if (to_copy > size) {
+            to_copy = size;
+        }
+
+        memcpy(&tx->buffer[tx->size], data, to_copy);
+        tx->size += to_copy;
+        data += to_copy;
+        size -= to_copy;
+    }
+
+    return ESP_LOADER_SUCCESS;
+}
+
+/* True if a byte of the word is 0xC0 or 0xDB, with the zero byte test on the word xor each of them */
+static inline bool word_needs_encoding(uint32_t word)
+{
+    const uint32_t c0 = word ^ 0xC0C0C0C0;
+    const uint32_t db = word ^ 0xDBDBDBDB;
+
+    return ((((c0 - 0x01010101) & ~c0) | ((db - 0x01010101) & ~db)) & 0x80808080) != 0;
+}
 
-        if (ch == 0xDB) {
-            RETURN_ON_ERROR( peripheral_read(&ch, 1) );
-            if (ch == 0xDC) {
-                buff[i] = 0xC0;
-            } else if (ch == 0xDD) {
-                buff[i] = 0xDB;
+/* Number of bytes at the start of data which are sent as they are */
+static size_t plain_bytes(const uint8_t *data, size_t size)
+{
+    size_t i = 0;
+    uint32_t word;
+
+    while (i + sizeof(word) <= size) {
+        memcpy(&word, &data[i], sizeof(word));
+        if (word_needs_encoding(word)) {
+            break;
+        }
+        i += sizeof(word);
+    }
+
+    while (i < size && data[i] != 0xC0 && data[i] != 0xDB) {
+        i++;
+    }
+
+    return i;
+}
+
+esp_loader_error_t SLIP_receive_data(esp_loader_t *loader, uint8_t *buff, const size_t size)
+{
+    size_t received = 0;
+    bool escaped = false;
+
+    /* Each read is of the bytes left assuming no escapes, decoded in place as
+       the decoded data is never longer than the encoded one */
+    while (received < size) {
+        uint8_t *encoded = &buff[received];
+        const size_t to_read = size - received;
+
+        RETURN_ON_ERROR( peripheral_read(loader, encoded, to_read) );
+
+        for (size_t i = 0; i < to_read; i++) {
+            const uint8_t ch = encoded[i];
+
+            if (escaped) {
+                if (ch == 0xDC) {
+                    buff[received++] = 0xC0;
+                } else if (ch == 0xDD) {
+                    buff[received++] = 0xDB;
+                } else {
+                    return ESP_LOADER_ERROR_INVALID_RESPONSE;
+                }
+                escaped = false;
+            } else if (ch == 0xDB) {
+                escaped = true;
             } else {
-                return ESP_LOADER_ERROR_INVALID_RESPONSE;
+                buff[received++] = ch;
             }
-        } else {
-            buff[i] = ch;
         }
     }
 
@@ -55,71 +141,65 @@ esp_loader_error_t SLIP_receive_data(uint8_t *buff, const size_t size)
 }
 
 
-esp_loader_error_t SLIP_receive_packet(uint8_t *buff, const size_t size)
+esp_loader_error_t SLIP_receive_packet(esp_loader_t *loader, uint8_t *buff, const size_t size)
 {
     uint8_t ch;
 
     // Wait for delimiter
     do {
-        RETURN_ON_ERROR( peripheral_read(&ch, 1) );
+        RETURN_ON_ERROR( peripheral_read(loader, &ch, 1) );
     } while (ch != DELIMITER);
 
     // Workaround: bootloader sends two dummy(0xC0) bytes after response when baud rate is changed.
     do {
-        RETURN_ON_ERROR( peripheral_read(&ch, 1) );
+        RETURN_ON_ERROR( peripheral_read(loader, &ch, 1) );
     } while (ch == DELIMITER);
 
     buff[0] = ch;
 
-    RETURN_ON_ERROR( SLIP_receive_data(&buff[1], size - 1) );
+    RETURN_ON_ERROR( SLIP_receive_data(loader, &buff[1], size - 1) );
 
     // Wait for delimiter
     do {
-        RETURN_ON_ERROR( peripheral_read(&ch, 1) );
+        RETURN_ON_ERROR( peripheral_read(loader, &ch, 1) );
     } while (ch != DELIMITER);
 
     return ESP_LOADER_SUCCESS;
 }
 
 
-esp_loader_error_t SLIP_send(const uint8_t *data, const size_t size)
+esp_loader_error_t SLIP_send(esp_loader_t *loader, const uint8_t *data, const size_t size)
 {
-    uint32_t to_write = 0;  // Bytes ready to write as they are
-    uint32_t written = 0;   // Bytes already written
+    size_t i = 0;
 
-    for (uint32_t i = 0; i < size; i++) {
-        if (data[i] != 0xC0 && data[i] != 0xDB) {
-            to_write++; // Queue this byte for writing
-            continue;
-        }
+    while (i < size) {
+        const size_t plain = plain_bytes(&data[i], size - i);
 
-        // We have a byte that needs encoding, write the queue first
-        if (to_write > 0) {
-            RETURN_ON_ERROR( peripheral_write(&data[written], to_write) );
-        }
+        RETURN_ON_ERROR( tx_append(loader, &data[i], plain) );
+        i += plain;
 
-        // Write the encoded byte
-        if (data[i] == 0xC0) {
-            RETURN_ON_ERROR( peripheral_write(C0_REPLACEMENT, 2) );
-        } else {
-            RETURN_ON_ERROR( peripheral_write(DB_REPLACEMENT, 2) );
+        if (i < size) {
+            RETURN_ON_ERROR( tx_append(loader, data[i] == 0xC0 ? C0_REPLACEMENT : DB_REPLACEMENT, 2) );
+            i++;
         }
-
-        // Update to start again after the encoded byte
-        written = i + 1;
-        to_write = 0;
-    }
-
-    // Write the rest of the bytes that didn't need encoding
-    if (to_write > 0) {
-        RETURN_ON_ERROR( peripheral_write(&data[written], to_write) );
     }
 
     return ESP_LOADER_SUCCESS;
 }
 
 
-esp_loader_error_t SLIP_send_delimiter(void)
+esp_loader_error_t SLIP_send_delimiter(esp_loader_t *loader)
 {
-    return peripheral_write(&DELIMITER, 1);
+    slip_tx_t *tx = &loader->slip_tx;
+
+    RETURN_ON_ERROR( tx_append(loader, &DELIMITER, 1) );
+
+    /* Every packet is sent between two delimiters, the packet is written once it ends */
+    if (tx->in_packet) {
+        tx->in_packet = false;
+        return tx_flush(loader);
+    }
+    tx->in_packet = true;
+
+    return ESP_LOADER_SUCCESS;
 }
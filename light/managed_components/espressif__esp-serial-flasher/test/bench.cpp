@@ -0,0 +1,296 @@
+/* Copyright 2018-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Flashes images to the simulated target of serial_io_sim, in each mode of the library,
+// and reports the effective throughput. Time is virtual, so the results only depend on
+// the link, the timings of the target and the library.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "serial_io_sim.h"
+#include "loader_ctx.h"
+#include "md5_hash.h"
+#include "esp_loader.h"
+
+using namespace std;
+
+static const uint32_t APP_START_ADDRESS = 0x10000;
+static const size_t FLASH_SIZE = 16 * 1024 * 1024;
+static const uint32_t ROM_BLOCK_SIZE = 0x400;
+static const uint32_t STUB_BLOCK_SIZE = 0x4000;
+
+// About the size of the esptool flasher stub of the ESP32
+static const uint32_t STUB_TEXT_SIZE = 6 * 1024;
+static const uint32_t STUB_DATA_SIZE = 1024;
+
+struct bench_mode_t {
+    const char *name;
+    bool stub;
+    bool compressed;
+    uint32_t block_size;
+    uint32_t window;
+};
+
+static const bench_mode_t s_modes[] = {
+    { "raw",             false, false, ROM_BLOCK_SIZE,  1 },
+    { "compressed",      false, true,  ROM_BLOCK_SIZE,  1 },
+    { "stub",            true,  false, STUB_BLOCK_SIZE, 1 },
+    { "stub-compressed", true,  true,  STUB_BLOCK_SIZE, 1 },
+    { "windowed",        true,  true,  STUB_BLOCK_SIZE, 2 },
+};
+
+struct bench_image_t {
+    string name;
+    vector<uint8_t> data;
+    vector<uint8_t> compressed;
+    uint8_t md5[16];
+};
+
+struct bench_result_t {
+    esp_loader_error_t err;
+    double setup_us;
+    double flash_us;
+    double verify_us;
+    uint64_t bytes_to_target;
+    double link_load;
+};
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-b baudrate] [-s stub_baudrate] [-l latency_us] [-m image_mb] [image...]\n"
+           "\n"
+           "  -b  Transmission rate of the ROM loader, 115200 by default\n"
+           "  -s  Transmission rate once the stub runs, 921600 by default\n"
+           "  -l  One way latency of the link, for each write and response, 0 by default\n"
+           "  -m  Size of the image made of copies of hello-world.bin, 4 MB by default, 0 for none\n"
+           "\n"
+           "hello-world.bin and the image of -m are flashed, when no image is given.\n", name);
+    exit(1);
+}
+
+static void image_prepare(bench_image_t *image)
+{
+    uLongf compressed_size = compressBound(image->data.size());
+    struct MD5Context context;
+
+    image->compressed.resize(compressed_size);
+    if (compress2(image->compressed.data(), &compressed_size, image->data.data(), image->data.size(), 9) != Z_OK) {
+        fprintf(stderr, "Cannot compress %s\n", image->name.c_str());
+        exit(1);
+    }
+    image->compressed.resize(compressed_size);
+
+    MD5Init(&context);
+    MD5Update(&context, image->data.data(), image->data.size());
+    MD5Final(image->md5, &context);
+}
+
+static bool image_load(bench_image_t *image, const char *path)
+{
+    ifstream file(path, ios::binary);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    image->name = path;
+    image->name = image->name.substr(image->name.find_last_of('/') + 1);
+    image->data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    image_prepare(image);
+
+    return true;
+}
+
+static void image_repeat(bench_image_t *image, const bench_image_t *base, size_t size)
+{
+    image->name = to_string(size / (1024 * 1024)) + "MB.bin";
+    image->data.clear();
+    while (image->data.size() < size) {
+        size_t to_copy = min(size - image->data.size(), base->data.size());
+        image->data.insert(image->data.end(), base->data.begin(), base->data.begin() + to_copy);
+    }
+    image_prepare(image);
+}
+
+static esp_loader_error_t flash_image(esp_loader_t *loader, const bench_mode_t *mode, const bench_image_t *image)
+{
+    vector<uint8_t> block(mode->block_size);
+
+    if (mode->compressed) {
+        const vector<uint8_t> &data = image->compressed;
+
+        RETURN_ON_ERROR( esp_loader_ctx_flash_deflate_start(loader, APP_START_ADDRESS, image->data.size(),
+                                                            data.size(), mode->block_size) );
+        for (size_t offset = 0; offset < data.size(); offset += mode->block_size) {
+            size_t size = min((size_t)mode->block_size, data.size() - offset);
+            RETURN_ON_ERROR( esp_loader_ctx_flash_deflate_write(loader, &data[offset], size) );
+        }
+
+        return esp_loader_ctx_flash_deflate_finish(loader, false);
+    }
+
+    const vector<uint8_t> &data = image->data;
+
+    RETURN_ON_ERROR( esp_loader_ctx_flash_start(loader, APP_START_ADDRESS, data.size(), mode->block_size) );
+    for (size_t offset = 0; offset < data.size(); offset += mode->block_size) {
+        // The block is padded in place
+        size_t size = min((size_t)mode->block_size, data.size() - offset);
+        memcpy(block.data(), &data[offset], size);
+        RETURN_ON_ERROR( esp_loader_ctx_flash_write(loader, block.data(), size) );
+    }
+
+    return esp_loader_ctx_flash_finish(loader, false);
+}
+
+static esp_loader_error_t verify_image(esp_loader_t *loader, const bench_mode_t *mode, const bench_image_t *image)
+{
+    if (mode->compressed) {
+        return esp_loader_ctx_flash_verify_known_md5(loader, APP_START_ADDRESS, image->data.size(), image->md5);
+    }
+
+    return esp_loader_ctx_flash_verify(loader);
+}
+
+static esp_loader_error_t bench_run(sim_port_t *sim, esp_loader_t *loader, const bench_mode_t *mode,
+                                    const bench_image_t *image, uint32_t stub_baudrate, bench_result_t *result)
+{
+    static vector<uint8_t> stub_text(STUB_TEXT_SIZE);
+    static vector<uint8_t> stub_data(STUB_DATA_SIZE);
+    const esp_loader_stub_t stub = {
+        .entry = 0x4009f000,
+        .text_start = 0x4009e000,
+        .text = stub_text.data(),
+        .text_size = STUB_TEXT_SIZE,
+        .data_start = 0x3ffe0000,
+        .data = stub_data.data(),
+        .data_size = STUB_DATA_SIZE,
+    };
+    esp_loader_connect_args_t connect_args = ESP_LOADER_CONNECT_DEFAULT();
+
+    RETURN_ON_ERROR( esp_loader_ctx_connect(loader, &connect_args) );
+
+    if (mode->stub) {
+        RETURN_ON_ERROR( esp_loader_ctx_run_stub(loader, &stub) );
+        if (stub_baudrate != sim->link.baudrate) {
+            RETURN_ON_ERROR( esp_loader_ctx_change_transmission_rate_stub(loader, sim->link.baudrate,
+                                                                           stub_baudrate) );
+        }
+        RETURN_ON_ERROR( esp_loader_ctx_flash_set_window(loader, mode->window) );
+    }
+
+    result->setup_us = sim->now_us;
+    sim_port_reset_stats(sim);
+
+    RETURN_ON_ERROR( flash_image(loader, mode, image) );
+
+    result->flash_us = sim->now_us - sim->stats_start_us;
+    result->bytes_to_target = sim->bytes_to_target;
+    result->link_load = sim->to_target_busy_us / result->flash_us;
+
+    double verify_start_us = sim->now_us;
+    RETURN_ON_ERROR( verify_image(loader, mode, image) );
+    result->verify_us = sim->now_us - verify_start_us;
+
+    if (memcmp(&sim->flash[APP_START_ADDRESS], image->data.data(), image->data.size()) != 0) {
+        return ESP_LOADER_ERROR_INVALID_MD5;
+    }
+
+    return ESP_LOADER_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    sim_link_t link = SIM_LINK_DEFAULT();
+    const sim_timing_t timing = SIM_TIMING_DEFAULT();
+    uint32_t stub_baudrate = 921600;
+    size_t repeated_size = 4 * 1024 * 1024;
+    vector<bench_image_t> images;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:s:l:m:h")) != -1) {
+        switch (opt) {
+        case 'b': link.baudrate = strtoul(optarg, NULL, 0); break;
+        case 's': stub_baudrate = strtoul(optarg, NULL, 0); break;
+        case 'l': link.latency_us = strtoul(optarg, NULL, 0); break;
+        case 'm': repeated_size = strtoul(optarg, NULL, 0) * 1024 * 1024; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (link.baudrate == 0 || stub_baudrate == 0 || repeated_size + APP_START_ADDRESS > FLASH_SIZE) {
+        usage(argv[0]);
+    }
+
+    for (int i = optind; i < argc; i++) {
+        images.emplace_back();
+        if (!image_load(&images.back(), argv[i])) {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (images.empty()) {
+        images.emplace_back();
+        if (!image_load(&images.back(), "../hello-world.bin")) {
+            fprintf(stderr, "Cannot read ../hello-world.bin, run from the build directory\n");
+            return 1;
+        }
+        if (repeated_size > 0) {
+            images.emplace_back();
+            image_repeat(&images.back(), &images[0], repeated_size);
+        }
+    }
+
+    printf("BENCH link baudrate=%u stub_baudrate=%u latency_us=%u\n", link.baudrate, stub_baudrate,
+           link.latency_us);
+
+    int failures = 0;
+    for (const auto &image : images) {
+        printf("BENCH image %s size=%zu compressed=%zu (%.1f%%)\n", image.name.c_str(), image.data.size(),
+               image.compressed.size(), 100.0 * image.compressed.size() / image.data.size());
+
+        for (const auto &mode : s_modes) {
+            sim_port_t sim;
+            bench_result_t result = {};
+
+            sim_port_init(&sim, &link, &timing, FLASH_SIZE);
+            esp_loader_t *loader = esp_loader_ctx_create(&sim.port);
+            result.err = bench_run(&sim, loader, &mode, &image, stub_baudrate, &result);
+            esp_loader_ctx_delete(loader);
+            sim_port_deinit(&sim);
+
+            if (result.err != ESP_LOADER_SUCCESS) {
+                printf("BENCH %-16s %-15s failed with error %d\n", image.name.c_str(), mode.name, result.err);
+                failures++;
+                continue;
+            }
+
+            printf("BENCH %-16s %-15s KB/s=%-7.1f flash_ms=%-8.0f verify_ms=%-6.0f setup_ms=%-6.0f "
+                   "sent=%-8" PRIu64 " link_load=%.0f%%\n", image.name.c_str(), mode.name,
+                   image.data.size() / 1024.0 / (result.flash_us / 1e6), result.flash_us / 1000,
+                   result.verify_us / 1000, result.setup_us / 1000, result.bytes_to_target, 100 * result.link_load);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
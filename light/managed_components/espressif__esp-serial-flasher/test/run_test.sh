@@ -5,6 +5,8 @@ mkdir -p build && cd build
 
 if [ "$1" = "host" ]; then
     cmake -DQEMU_TEST=False .. && cmake --build . && ./serial_flasher_test
+elif [ "$1" = "bench" ]; then
+    cmake -DQEMU_TEST=False .. && cmake --build . && ./serial_flasher_bench "${@:2}"
 elif [ "$1" = "qemu" ]; then
     # QEMU_PATH environment variable has to be defined, pointing to qemu-system-xtensa
     # Example: export QEMU_PATH=/home/user/esp/qemu/xtensa-softmmu/qemu-system-xtensa
@@ -29,5 +31,5 @@ elif [ "$1" = "qemu" ]; then
     # Kill qemu process running in background
     kill -9 $(pidof qemu-system-xtensa)
 else
-    echo "Please select which test to run: qemu or host"
+    echo "Please select which test to run: qemu, host or bench"
 fi
\ No newline at end of file
@@ -26,6 +26,7 @@ using namespace std;
 
 static vector<int8_t> write_buffer;
 static vector<int8_t> read_buffer;
+static size_t write_calls = 0;
 static uint32_t receive_delay = 0;
 static int32_t timer = 0;
 
@@ -43,6 +44,7 @@ void loader_port_mock_deinit()
 esp_loader_error_t loader_port_write(const uint8_t *data, uint16_t size, uint32_t timeout)
 {
     copy(&data[0], &data[size], back_inserter(write_buffer));
+    write_calls++;
 
     return ESP_LOADER_SUCCESS;
 }
@@ -118,10 +120,88 @@ static void SLIP_encode(const int8_t *in_buff, size_t size, vector<int8_t> &enco
     encoded_buff.push_back('\xc0');
 }
 
+static mock_port_t *mock_port(esp_loader_port_t *port)
+{
+    return reinterpret_cast<mock_port_t *>(port);
+}
+
+static esp_loader_error_t mock_port_write(esp_loader_port_t *port, const uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    copy(&data[0], &data[size], back_inserter(mock_port(port)->write_buffer));
+
+    return ESP_LOADER_SUCCESS;
+}
+
+static esp_loader_error_t mock_port_read(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    vector<int8_t> &buffer = mock_port(port)->read_buffer;
+
+    if (buffer.size() < size) {
+        return ESP_LOADER_ERROR_TIMEOUT;
+    }
+
+    copy_n(buffer.begin(), size, data);
+    buffer.erase(buffer.begin(), buffer.begin() + size);
+
+    return ESP_LOADER_SUCCESS;
+}
+
+static void mock_port_nothing(esp_loader_port_t *port)
+{
+
+}
+
+static void mock_port_delay_ms(esp_loader_port_t *port, uint32_t ms)
+{
+
+}
+
+static void mock_port_start_timer(esp_loader_port_t *port, uint32_t ms)
+{
+    mock_port(port)->timer = (int32_t)ms;
+}
+
+static uint32_t mock_port_remaining_time(esp_loader_port_t *port)
+{
+    int32_t timer = mock_port(port)->timer;
+
+    return (timer > 0) ? timer : 0;
+}
+
+static const esp_loader_port_ops_t mock_port_ops = {
+    .write = mock_port_write,
+    .read = mock_port_read,
+    .delay_ms = mock_port_delay_ms,
+    .start_timer = mock_port_start_timer,
+    .remaining_time = mock_port_remaining_time,
+    .enter_bootloader = mock_port_nothing,
+    .reset_target = mock_port_nothing,
+    .debug_print = NULL,
+};
+
+void mock_port_init(mock_port_t *port)
+{
+    port->port.ops = &mock_port_ops;
+    port->write_buffer.clear();
+    port->read_buffer.clear();
+    port->timer = 0;
+}
+
+void mock_port_set_read_buffer(mock_port_t *port, const void *data, size_t size)
+{
+    SLIP_encode((const int8_t *)data, size, port->read_buffer);
+}
+
 void clear_buffers()
 {
     write_buffer.clear();
     read_buffer.clear();
+    write_calls = 0;
+}
+
+size_t write_buffer_writes()
+{
+    return write_calls;
 }
 
 int8_t *write_buffer_data()
@@ -17,12 +17,15 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <vector>
 #include "esp_loader.h"
+#include "esp_loader_io.h"
 
 void clear_buffers();
 
 void write_buffer_print();
 size_t write_buffer_size();
+size_t write_buffer_writes();
 int8_t* write_buffer_data();
 
 void set_read_buffer(const void *data, size_t size);
@@ -35,4 +38,15 @@ typedef struct {
 } loader_serial_config_t;
 
 esp_loader_error_t loader_port_mock_init(const loader_serial_config_t *config);
-void loader_port_mock_deinit();
\ No newline at end of file
+void loader_port_mock_deinit();
+
+// A port of its own, for the loaders of several targets
+struct mock_port_t {
+    esp_loader_port_t port;
+    std::vector<int8_t> write_buffer;
+    std::vector<int8_t> read_buffer;
+    int32_t timer;
+};
+
+void mock_port_init(mock_port_t *port);
+void mock_port_set_read_buffer(mock_port_t *port, const void *data, size_t size);
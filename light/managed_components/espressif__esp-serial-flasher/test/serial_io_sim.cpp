@@ -0,0 +1,527 @@
+/* Copyright 2018-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include "serial_io_sim.h"
+#include "protocol.h"
+#include "md5_hash.h"
+
+using namespace std;
+
+static const uint32_t CHIP_DETECT_MAGIC_REG_ADDR = 0x40001000;
+static const uint32_t ESP32_MAGIC_VALUE = 0x00f01d83;
+static const uint32_t ESP32_SPI_CMD_REG = 0x3ff42000;
+static const uint32_t ESP32_SPI_W0_REG = 0x3ff42080;
+static const uint32_t SPI_CMD_USR = (1 << 18);
+static const uint32_t SECTOR_SIZE = 0x1000;
+static const uint32_t BLOCK_SIZE = 0x10000;
+static const uint32_t STUB_START_US = 1000;
+static const uint8_t OLD_FLASH_CONTENT = 0x00;
+
+static sim_port_t *sim_port(esp_loader_port_t *port)
+{
+    return reinterpret_cast<sim_port_t *>(port);
+}
+
+static double byte_us(const sim_port_t *sim)
+{
+    return 10e6 / sim->link.baudrate;
+}
+
+static void slip_encode(const uint8_t *data, size_t size, vector<uint8_t> &out)
+{
+    out.push_back(0xc0);
+
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == 0xc0) {
+            out.push_back(0xdb);
+            out.push_back(0xdc);
+        } else if (data[i] == 0xdb) {
+            out.push_back(0xdb);
+            out.push_back(0xdd);
+        } else {
+            out.push_back(data[i]);
+        }
+    }
+
+    out.push_back(0xc0);
+}
+
+/* The target starts to send at_us, after what it sent before */
+static void send_to_host(sim_port_t *sim, double at_us, const void *data, size_t size)
+{
+    sim_response_t response;
+
+    slip_encode((const uint8_t *)data, size, response.data);
+
+    double start_us = max(at_us, sim->to_host_free_us);
+    sim->to_host_free_us = start_us + response.data.size() * byte_us(sim);
+    sim->bytes_to_host += response.data.size();
+    response.arrival_us = sim->to_host_free_us + sim->link.latency_us;
+
+    sim->responses.push_back(move(response));
+}
+
+static void send_response(sim_port_t *sim, double at_us, uint8_t command, uint32_t value,
+                          const void *body, size_t body_size, uint8_t error)
+{
+    vector<uint8_t> response(sizeof(common_response_t) + body_size + sizeof(response_status_t));
+    common_response_t common = {
+        .direction = READ_DIRECTION,
+        .command = command,
+        .size = (uint16_t)(body_size + sizeof(response_status_t)),
+        .value = value,
+    };
+    response_status_t status = {
+        .failed = (uint8_t)(error != RESPONSE_OK ? STATUS_FAILURE : STATUS_SUCCESS),
+        .error = error,
+    };
+
+    memcpy(&response[0], &common, sizeof(common));
+    if (body_size > 0) {
+        memcpy(&response[sizeof(common)], body, body_size);
+    }
+    memcpy(&response[sizeof(common) + body_size], &status, sizeof(status));
+
+    send_to_host(sim, at_us, response.data(), response.size());
+}
+
+/* Erases ahead of the writes, with block erases where a whole block is left */
+static double erase_until(sim_port_t *sim, uint32_t end)
+{
+    double cost_us = 0;
+
+    end = min(end, sim->erase_limit);
+
+    while (sim->erase_end < end) {
+        uint32_t size = SECTOR_SIZE;
+        if (sim->erase_end % BLOCK_SIZE == 0 && sim->erase_limit - sim->erase_end >= BLOCK_SIZE) {
+            size = BLOCK_SIZE;
+            cost_us += sim->timing.block_erase_us;
+        } else {
+            cost_us += sim->timing.sector_erase_us;
+        }
+        memset(&sim->flash[sim->erase_end], 0xff, size);
+        sim->erase_end += size;
+    }
+
+    return cost_us;
+}
+
+/* NOR flash only clears bits, unerased data shows in the verification */
+static double flash_write(sim_port_t *sim, const uint8_t *data, size_t size, uint8_t *error)
+{
+    uint32_t address = sim->flash_offset + sim->written;
+
+    if (address + size > sim->flash.size()) {
+        *error = FLASH_WRITE_ERR;
+        return 0;
+    }
+
+    double cost_us = sim->stub_running ? erase_until(sim, address + size) : 0;
+
+    for (size_t i = 0; i < size; i++) {
+        sim->flash[address + i] &= data[i];
+    }
+    sim->written += size;
+
+    return cost_us + (double)size * sim->timing.write_us_per_kb / 1024;
+}
+
+static double flash_inflate(sim_port_t *sim, const uint8_t *data, size_t size, uint8_t *error)
+{
+    uint8_t out[4096];
+    double cost_us = 0;
+    z_stream *z = &sim->inflater;
+
+    z->next_in = (Bytef *)data;
+    z->avail_in = size;
+
+    while (true) {
+        z->next_out = out;
+        z->avail_out = sizeof(out);
+
+        int res = inflate(z, Z_NO_FLUSH);
+        if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR) {
+            *error = DEFLATE_ERROR;
+            return cost_us;
+        }
+
+        size_t produced = sizeof(out) - z->avail_out;
+        cost_us += (double)produced * sim->timing.inflate_us_per_kb / 1024;
+        cost_us += flash_write(sim, out, produced, error);
+
+        /* Done with the block once the output is not full and the input is consumed */
+        if (res != Z_OK || *error != RESPONSE_OK || (z->avail_in == 0 && z->avail_out != 0)) {
+            break;
+        }
+    }
+
+    return cost_us;
+}
+
+static uint8_t checksum(const uint8_t *data, size_t size)
+{
+    uint8_t sum = 0xef;
+
+    while (size--) {
+        sum ^= *data++;
+    }
+
+    return sum;
+}
+
+static void spi_flash_md5(sim_port_t *sim, double at_us, const uint8_t *payload, size_t size)
+{
+    static const char hex[] = "0123456789abcdef";
+    spi_flash_md5_command_t cmd;
+    struct MD5Context context;
+    uint8_t digest[16];
+    uint8_t hex_digest[MD5_SIZE];
+
+    memcpy(&cmd.address, payload, sizeof(cmd) - sizeof(command_common_t));
+    if ((size_t)cmd.address + cmd.size > sim->flash.size()) {
+        send_response(sim, at_us, SPI_FLASH_MD5, 0, NULL, 0, FLASH_READ_ERR);
+        return;
+    }
+
+    MD5Init(&context);
+    MD5Update(&context, &sim->flash[cmd.address], cmd.size);
+    MD5Final(digest, &context);
+
+    for (int i = 0; i < 16; i++) {
+        hex_digest[i * 2] = hex[digest[i] >> 4];
+        hex_digest[i * 2 + 1] = hex[digest[i] & 0xf];
+    }
+
+    at_us += (double)cmd.size * sim->timing.md5_us_per_kb / 1024;
+    sim->target_free_us = at_us;
+
+    /* The ROM loader sends the digest in hex, the stub sends it raw */
+    if (sim->stub_running) {
+        send_response(sim, at_us, SPI_FLASH_MD5, 0, digest, sizeof(digest), RESPONSE_OK);
+    } else {
+        send_response(sim, at_us, SPI_FLASH_MD5, 0, hex_digest, sizeof(hex_digest), RESPONSE_OK);
+    }
+}
+
+static void handle_packet(sim_port_t *sim, const vector<uint8_t> &packet, double arrival_us)
+{
+    command_common_t common;
+
+    if (packet.size() < sizeof(common)) {
+        return;
+    }
+
+    memcpy(&common, packet.data(), sizeof(common));
+    if (common.direction != WRITE_DIRECTION) {
+        return;
+    }
+
+    const uint8_t *payload = packet.data() + sizeof(common);
+    const size_t size = packet.size() - sizeof(common);
+    double start_us = max(arrival_us, sim->target_free_us) + sim->timing.command_us;
+    double work_us = 0;
+    bool respond_before_work = false;
+    uint32_t value = 0;
+    uint8_t error = RESPONSE_OK;
+    uint32_t new_baudrate = 0;
+    bool start_stub = false;
+
+    switch (common.command) {
+    case SYNC:
+    case SPI_ATTACH:
+    case SPI_SET_PARAMS:
+    case MEM_BEGIN:
+    case MEM_DATA:
+        break;
+
+    case READ_REG: {
+        read_reg_command_t cmd;
+        memcpy(&cmd.address, payload, sizeof(cmd.address));
+        auto reg = sim->registers.find(cmd.address);
+        value = (reg != sim->registers.end()) ? reg->second : 0;
+        break;
+    }
+
+    case WRITE_REG: {
+        write_reg_command_t cmd;
+        memcpy(&cmd.address, payload, sizeof(cmd) - sizeof(common));
+        sim->registers[cmd.address] = cmd.value;
+        /* The only SPI command sent is the read of the flash ID, done at once */
+        if (cmd.address == ESP32_SPI_CMD_REG && (cmd.value & SPI_CMD_USR)) {
+            uint32_t size_id = 0;
+            while ((1u << size_id) < sim->flash.size()) {
+                size_id++;
+            }
+            sim->registers[ESP32_SPI_W0_REG] = (size_id << 16) | 0x40ef;
+            sim->registers[ESP32_SPI_CMD_REG] = 0;
+        }
+        break;
+    }
+
+    case CHANGE_BAUDRATE: {
+        change_baudrate_command_t cmd;
+        memcpy(&cmd.new_baudrate, payload, sizeof(cmd) - sizeof(common));
+        new_baudrate = cmd.new_baudrate;
+        break;
+    }
+
+    case MEM_END: {
+        mem_end_command_t cmd;
+        memcpy(&cmd.stay_in_loader, payload, sizeof(cmd) - sizeof(common));
+        start_stub = !cmd.stay_in_loader;
+        break;
+    }
+
+    case FLASH_BEGIN:
+    case FLASH_DEFL_BEGIN: {
+        flash_begin_command_t cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        memcpy(&cmd.erase_size, payload, min(size, sizeof(cmd) - sizeof(common)));
+        if ((size_t)cmd.offset + cmd.erase_size > sim->flash.size() || cmd.offset % SECTOR_SIZE != 0) {
+            error = INVALID_COMMAND;
+            break;
+        }
+        sim->flash_offset = cmd.offset;
+        sim->erase_end = cmd.offset;
+        sim->erase_limit = cmd.offset + cmd.erase_size;
+        sim->written = 0;
+        if (common.command == FLASH_DEFL_BEGIN) {
+            inflateReset(&sim->inflater);
+        }
+        /* The ROM loader erases the whole region at once, the stub as it writes */
+        if (!sim->stub_running) {
+            work_us = erase_until(sim, sim->erase_limit);
+        }
+        break;
+    }
+
+    case FLASH_DATA:
+    case FLASH_DEFL_DATA: {
+        data_command_t cmd;
+        const size_t header = sizeof(cmd) - sizeof(common);
+        memcpy(&cmd.data_size, payload, min(size, header));
+        if (size < header || cmd.data_size != size - header) {
+            error = INVALID_COMMAND;
+            break;
+        }
+        if (checksum(payload + header, cmd.data_size) != (uint8_t)common.checksum) {
+            error = INVALID_CRC;
+            break;
+        }
+        if (common.command == FLASH_DATA) {
+            work_us = flash_write(sim, payload + header, cmd.data_size, &error);
+        } else {
+            work_us = flash_inflate(sim, payload + header, cmd.data_size, &error);
+        }
+        /* The stub answers once the block is received, and writes it while it receives the next one */
+        respond_before_work = sim->stub_running;
+        break;
+    }
+
+    case FLASH_END:
+    case FLASH_DEFL_END:
+        break;
+
+    case SPI_FLASH_MD5:
+        spi_flash_md5(sim, start_us, payload, size);
+        return;
+
+    default:
+        error = INVALID_COMMAND;
+        break;
+    }
+
+    double response_us = respond_before_work ? start_us : start_us + work_us;
+    sim->target_free_us = start_us + work_us;
+    send_response(sim, response_us, common.command, value, NULL, 0, error);
+
+    if (new_baudrate != 0) {
+        /* The response goes at the previous rate, both ends change once it is sent */
+        sim->link.baudrate = new_baudrate;
+    }
+
+    if (start_stub) {
+        static const uint8_t greeting[] = { 'O', 'H', 'A', 'I' };
+        sim->stub_running = true;
+        sim->target_free_us = response_us + STUB_START_US;
+        send_to_host(sim, sim->target_free_us, greeting, sizeof(greeting));
+    }
+}
+
+static esp_loader_error_t sim_port_write(esp_loader_port_t *port, const uint8_t *data, uint16_t size,
+                                         uint32_t timeout)
+{
+    sim_port_t *sim = sim_port(port);
+    const double t_byte_us = byte_us(sim);
+    const double start_us = max(sim->now_us, sim->to_target_free_us);
+
+    for (size_t i = 0; i < size; i++) {
+        const uint8_t ch = data[i];
+
+        if (ch == 0xc0) {
+            if (sim->in_packet && !sim->packet.empty()) {
+                handle_packet(sim, sim->packet, start_us + (i + 1) * t_byte_us + sim->link.latency_us);
+            }
+            sim->packet.clear();
+            sim->in_packet = true;
+            sim->escaped = false;
+        } else if (!sim->in_packet) {
+            continue;
+        } else if (sim->escaped) {
+            sim->packet.push_back(ch == 0xdc ? 0xc0 : 0xdb);
+            sim->escaped = false;
+        } else if (ch == 0xdb) {
+            sim->escaped = true;
+        } else {
+            sim->packet.push_back(ch);
+        }
+    }
+
+    sim->to_target_free_us = start_us + size * t_byte_us;
+    sim->to_target_busy_us += size * t_byte_us;
+    sim->bytes_to_target += size;
+
+    return ESP_LOADER_SUCCESS;
+}
+
+static esp_loader_error_t sim_port_read(esp_loader_port_t *port, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    sim_port_t *sim = sim_port(port);
+    const double deadline_us = sim->now_us + timeout * 1000.0;
+    size_t available = 0;
+    double arrival_us = sim->now_us;
+
+    for (const auto &response : sim->responses) {
+        available += response.data.size() - (&response == &sim->responses.front() ? sim->response_offset : 0);
+        arrival_us = max(arrival_us, response.arrival_us);
+        if (available >= size) {
+            break;
+        }
+    }
+
+    if (available < size || arrival_us > deadline_us) {
+        sim->now_us = max(sim->now_us, deadline_us);
+        return ESP_LOADER_ERROR_TIMEOUT;
+    }
+
+    sim->now_us = arrival_us;
+
+    while (size > 0) {
+        sim_response_t &response = sim->responses.front();
+        size_t to_copy = min((size_t)size, response.data.size() - sim->response_offset);
+
+        memcpy(data, &response.data[sim->response_offset], to_copy);
+        data += to_copy;
+        size -= to_copy;
+        sim->response_offset += to_copy;
+
+        if (sim->response_offset == response.data.size()) {
+            sim->responses.pop_front();
+            sim->response_offset = 0;
+        }
+    }
+
+    return ESP_LOADER_SUCCESS;
+}
+
+static void sim_port_delay_ms(esp_loader_port_t *port, uint32_t ms)
+{
+    sim_port(port)->now_us += ms * 1000.0;
+}
+
+static void sim_port_start_timer(esp_loader_port_t *port, uint32_t ms)
+{
+    sim_port_t *sim = sim_port(port);
+
+    sim->timer_end_us = sim->now_us + ms * 1000.0;
+}
+
+static uint32_t sim_port_remaining_time(esp_loader_port_t *port)
+{
+    sim_port_t *sim = sim_port(port);
+
+    return (sim->timer_end_us > sim->now_us) ? (uint32_t)((sim->timer_end_us - sim->now_us) / 1000) : 0;
+}
+
+/* The ROM loader runs again, at the initial rate */
+static void sim_port_reset(esp_loader_port_t *port)
+{
+    sim_port_t *sim = sim_port(port);
+
+    sim->stub_running = false;
+    sim->link.baudrate = sim->initial_baudrate;
+    sim->responses.clear();
+    sim->response_offset = 0;
+    sim->in_packet = false;
+    sim->target_free_us = sim->now_us;
+}
+
+static const esp_loader_port_ops_t sim_port_ops = {
+    .write = sim_port_write,
+    .read = sim_port_read,
+    .delay_ms = sim_port_delay_ms,
+    .start_timer = sim_port_start_timer,
+    .remaining_time = sim_port_remaining_time,
+    .enter_bootloader = sim_port_reset,
+    .reset_target = sim_port_reset,
+    .debug_print = NULL,
+};
+
+void sim_port_init(sim_port_t *port, const sim_link_t *link, const sim_timing_t *timing, size_t flash_size)
+{
+    port->port.ops = &sim_port_ops;
+    port->link = *link;
+    port->timing = *timing;
+    port->initial_baudrate = link->baudrate;
+    port->now_us = 0;
+    port->timer_end_us = 0;
+    port->to_target_free_us = 0;
+    port->to_host_free_us = 0;
+    port->target_free_us = 0;
+    port->packet.clear();
+    port->in_packet = false;
+    port->escaped = false;
+    port->responses.clear();
+    port->response_offset = 0;
+    port->registers.clear();
+    port->registers[CHIP_DETECT_MAGIC_REG_ADDR] = ESP32_MAGIC_VALUE;
+    port->stub_running = false;
+    port->flash.assign(flash_size, OLD_FLASH_CONTENT);
+    port->flash_offset = 0;
+    port->erase_end = 0;
+    port->erase_limit = 0;
+    port->written = 0;
+    memset(&port->inflater, 0, sizeof(port->inflater));
+    inflateInit(&port->inflater);
+    sim_port_reset_stats(port);
+}
+
+void sim_port_deinit(sim_port_t *port)
+{
+    inflateEnd(&port->inflater);
+    port->flash.clear();
+    port->flash.shrink_to_fit();
+}
+
+void sim_port_reset_stats(sim_port_t *port)
+{
+    port->stats_start_us = port->now_us;
+    port->to_target_busy_us = 0;
+    port->bytes_to_target = 0;
+    port->bytes_to_host = 0;
+}
@@ -0,0 +1,108 @@
+/* Copyright 2018-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include <zlib.h>
+#include "esp_loader.h"
+#include "esp_loader_io.h"
+
+// A port to a simulated ESP32, which answers the commands of the ROM loader and of the
+// flasher stub. Time is virtual: the link and the target charge their latencies to the
+// clock of the port, which the loader reads through its timer.
+
+// Serial link between the host and the target
+struct sim_link_t {
+    uint32_t baudrate;          // 10 bits per byte
+    uint32_t latency_us;        // One way, for each write and each response (USB-serial bridge, TCP)
+};
+
+// Timings of the target
+struct sim_timing_t {
+    uint32_t command_us;        // Handling of any command
+    uint32_t sector_erase_us;   // 4 KB sector
+    uint32_t block_erase_us;    // 64 KB block
+    uint32_t write_us_per_kb;   // Page program
+    uint32_t inflate_us_per_kb; // Of decompressed data
+    uint32_t md5_us_per_kb;     // Flash read and MD5
+};
+
+#define SIM_LINK_DEFAULT() {        \
+    .baudrate = 115200,             \
+    .latency_us = 0,                \
+}
+
+#define SIM_TIMING_DEFAULT() {      \
+    .command_us = 50,               \
+    .sector_erase_us = 30000,       \
+    .block_erase_us = 150000,       \
+    .write_us_per_kb = 1600,        \
+    .inflate_us_per_kb = 80,        \
+    .md5_us_per_kb = 60,            \
+}
+
+struct sim_response_t {
+    double arrival_us;
+    std::vector<uint8_t> data;
+};
+
+struct sim_port_t {
+    esp_loader_port_t port;
+    sim_link_t link;
+    sim_timing_t timing;
+
+    double now_us;                  // Clock of the host
+    double timer_end_us;
+    double to_target_free_us;       // End of the last byte sent to the target
+    double to_host_free_us;         // End of the last byte sent to the host
+    double target_free_us;          // End of the command the target handles
+    uint32_t initial_baudrate;
+
+    // Since sim_port_reset_stats()
+    double stats_start_us;
+    double to_target_busy_us;
+    uint64_t bytes_to_target;
+    uint64_t bytes_to_host;
+
+    // Packet being received by the target
+    std::vector<uint8_t> packet;
+    bool in_packet;
+    bool escaped;
+
+    std::deque<sim_response_t> responses;
+    size_t response_offset;
+
+    std::map<uint32_t, uint32_t> registers;
+    bool stub_running;
+
+    // Flashing state
+    std::vector<uint8_t> flash;
+    uint32_t flash_offset;
+    uint32_t erase_end;             // Erased up to
+    uint32_t erase_limit;           // End of the region given to FLASH_BEGIN
+    uint32_t written;
+    z_stream inflater;
+};
+
+void sim_port_init(sim_port_t *port, const sim_link_t *link, const sim_timing_t *timing, size_t flash_size);
+void sim_port_deinit(sim_port_t *port);
+
+// Starts to count the link load again, from the current time
+void sim_port_reset_stats(sim_port_t *port);
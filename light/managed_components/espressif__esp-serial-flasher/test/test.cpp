@@ -14,8 +14,10 @@
  */
 
 #include "catch.hpp"
+#include "loader_ctx.h"
 #include "protocol.h"
 #include "serial_io_mock.h"
+#include "slip.h"
 #include "esp_loader.h"
 #include "esp_loader_io.h"
 #include <string.h>
@@ -85,6 +87,13 @@ expected_response set_params_response(SPI_SET_PARAMS);
 expected_response flash_begin_response(FLASH_BEGIN);
 expected_response flash_data_response(FLASH_DATA);
 expected_response flash_end_response(FLASH_END);
+expected_response flash_defl_data_response(FLASH_DEFL_DATA);
+expected_response mem_begin_response(MEM_BEGIN);
+expected_response mem_data_response(MEM_DATA);
+expected_response mem_end_response(MEM_END);
+expected_response change_baudrate_response(CHANGE_BAUDRATE);
+expected_response flash_defl_begin_response(FLASH_DEFL_BEGIN);
+expected_response flash_defl_end_response(FLASH_DEFL_END);
 expected_response write_reg_response(WRITE_REG);
 expected_response read_reg_response(READ_REG);
 expected_response attach_response(SPI_ATTACH);
@@ -275,7 +284,7 @@ TEST_CASE( "Register can be written correctly" )
 
 TEST_CASE ( "SLIP is encoded correctly" )
 {
-    loader_flash_begin_cmd(0, 0, 0, 0, ESP32_CHIP); // To reset sequence number counter
+    loader_flash_begin_cmd(loader_default_ctx(), 0, 0, 0, 0, ESP32_CHIP); // To reset sequence number counter
 
     uint8_t data[] = { TEST_SLIP_PACKET };
 
@@ -299,12 +308,239 @@ TEST_CASE ( "SLIP is encoded correctly" )
     clear_buffers();
     queue_response(flash_data_response);
 
-    REQUIRE_SUCCESS( loader_flash_data_cmd(data, sizeof(data)) );
+    REQUIRE_SUCCESS( loader_flash_data_cmd(loader_default_ctx(), data, sizeof(data)) );
 
     REQUIRE( memcmp(write_buffer_data(), expected, sizeof(expected)) == 0 );
 }
 
 
+TEST_CASE( "Compressed data is sent with the deflate data command" )
+{
+    loader_flash_defl_begin_cmd(loader_default_ctx(), 0, 0, 0, 0, ESP32_CHIP); // To reset sequence number counter
+
+    uint8_t data[] = { 1, 2, 3, 4, 5 };
+
+    uint8_t expected[] = {
+        0xc0,       // Begin
+        0x00,         // Write direction
+        0x11,         // FLASH_DEFL_DATA command
+        16 + sizeof(data), 0, // Number of characters to send
+        0xee, 0, 0, 0,// Checksum
+        sizeof(data), 0, 0, 0, // Data size
+        0, 0, 0, 0,   // Sequence number
+        0, 0, 0, 0,   // zero
+        0, 0, 0, 0,   // zero
+        1, 2, 3, 4, 5, // Not padded
+        0xc0,       // End
+    };
+
+    clear_buffers();
+    queue_response(flash_defl_data_response);
+
+    REQUIRE_SUCCESS( loader_flash_defl_data_cmd(loader_default_ctx(), data, sizeof(data)) );
+
+    REQUIRE( write_buffer_size() == sizeof(expected) );
+    REQUIRE( memcmp(write_buffer_data(), expected, sizeof(expected)) == 0 );
+}
+
+
+TEST_CASE( "Flasher stub is loaded, then answers with its own MD5 and baud rate commands" )
+{
+    const uint8_t text[] = { 1, 2, 3, 4 };
+    const esp_loader_stub_t stub = {
+        .entry = 0x40380004,
+        .text_start = 0x40380000,
+        .text = text,
+        .text_size = sizeof(text),
+        .data_start = 0,
+        .data = NULL,
+        .data_size = 0,
+    };
+    const uint8_t greeting[] = { 'O', 'H', 'A', 'I' };
+
+    clear_buffers();
+    queue_response(mem_begin_response);
+    queue_response(mem_data_response);
+    queue_response(mem_end_response);
+    set_read_buffer(greeting, sizeof(greeting));
+
+    REQUIRE_SUCCESS( esp_loader_run_stub(&stub) );
+    REQUIRE( esp_loader_stub_running() );
+
+    SECTION( "MD5 is received as raw digest" ) {
+        struct __attribute__((packed)) {
+            common_response_t common;
+            uint8_t md5[16];
+            response_status_t status;
+        } md5_response = {
+            .common = { .direction = READ_DIRECTION, .command = SPI_FLASH_MD5, .size = 18, .value = 0 },
+            .md5 = { 0xde, 0xad, 0xbe, 0xef },
+            .status = { .failed = STATUS_SUCCESS, .error = 0 },
+        };
+
+        queue_response(*(expected_response *)&md5_response, sizeof(md5_response));
+        REQUIRE_SUCCESS( esp_loader_flash_verify_known_md5(0x1000, 16, md5_response.md5) );
+    }
+
+    SECTION( "Current baud rate is sent along the new one" ) {
+        uint8_t expected[] = {
+            0xc0,       // Begin
+            0x00,         // Write direction
+            0x0f,         // CHANGE_BAUDRATE command
+            8, 0,         // Number of characters to send
+            0, 0, 0, 0,   // Checksum
+            0x00, 0x10, 0x0e, 0, // 921600
+            0x00, 0xc2, 0x01, 0, // 115200
+            0xc0,       // End
+        };
+
+        clear_buffers();
+        queue_response(change_baudrate_response);
+
+        REQUIRE_SUCCESS( esp_loader_change_transmission_rate_stub(115200, 921600) );
+
+        REQUIRE( write_buffer_size() == sizeof(expected) );
+        REQUIRE( memcmp(write_buffer_data(), expected, sizeof(expected)) == 0 );
+    }
+
+    SECTION( "Blocks are sent ahead of their responses" ) {
+        uint8_t block[4] = { 1, 2, 3, 4 };
+        // Flash size detection fails on the first register read, then flashing starts
+        auto read_reg_failure = read_reg_response;
+        read_reg_failure.data.status.failed = STATUS_FAILURE;
+
+        clear_buffers();
+        queue_response(read_reg_failure);
+        queue_response(flash_defl_begin_response);
+
+        REQUIRE_SUCCESS( esp_loader_flash_set_window(2) );
+        REQUIRE_SUCCESS( esp_loader_flash_deflate_start(0, 100, 12, sizeof(block)) );
+        REQUIRE_SUCCESS( esp_loader_flash_deflate_write(block, sizeof(block)) );
+
+        queue_response(flash_defl_data_response);
+        queue_response(flash_defl_data_response);
+        queue_response(flash_defl_end_response);
+
+        REQUIRE_SUCCESS( esp_loader_flash_deflate_write(block, sizeof(block)) );
+        REQUIRE_SUCCESS( esp_loader_flash_deflate_finish(false) );
+
+        REQUIRE_SUCCESS( esp_loader_flash_set_window(1) );
+        REQUIRE( esp_loader_flash_deflate_write(block, sizeof(block)) == ESP_LOADER_ERROR_TIMEOUT );
+    }
+
+    esp_loader_reset_target();
+    REQUIRE( !esp_loader_stub_running() );
+    REQUIRE( esp_loader_flash_set_window(2) == ESP_LOADER_ERROR_UNSUPPORTED_FUNC );
+    REQUIRE( esp_loader_change_transmission_rate_stub(115200, 921600) == ESP_LOADER_ERROR_UNSUPPORTED_FUNC );
+}
+
+
+TEST_CASE( "Loaders of different ports keep their own state" )
+{
+    mock_port_t port_a, port_b;
+    mock_port_init(&port_a);
+    mock_port_init(&port_b);
+    clear_buffers();
+
+    esp_loader_t *loader_a = esp_loader_ctx_create(&port_a.port);
+    esp_loader_t *loader_b = esp_loader_ctx_create(&port_b.port);
+    REQUIRE( loader_a != NULL );
+    REQUIRE( loader_b != NULL );
+
+    SECTION( "Each loader reads the responses of its port" ) {
+        auto response_a = read_reg_response;
+        auto response_b = read_reg_response;
+        response_a.data.common.value = 1;
+        response_b.data.common.value = 2;
+        mock_port_set_read_buffer(&port_a, &response_a, sizeof(response_a));
+        mock_port_set_read_buffer(&port_b, &response_b, sizeof(response_b));
+
+        uint32_t value_a = 0;
+        uint32_t value_b = 0;
+        REQUIRE_SUCCESS( esp_loader_ctx_read_register(loader_b, reg_address, &value_b) );
+        REQUIRE_SUCCESS( esp_loader_ctx_read_register(loader_a, reg_address, &value_a) );
+
+        REQUIRE( value_a == 1 );
+        REQUIRE( value_b == 2 );
+        REQUIRE( port_a.read_buffer.empty() );
+        REQUIRE( port_b.read_buffer.empty() );
+        REQUIRE( write_buffer_size() == 0 );
+    }
+
+    SECTION( "Each loader numbers its own blocks" ) {
+        uint8_t data[] = { 1, 2, 3, 4 };
+        const size_t packet_size = 1 + sizeof(data_command_t) + sizeof(data) + 1;
+        data_command_t last_a, last_b;
+
+        mock_port_set_read_buffer(&port_a, &flash_begin_response, sizeof(flash_begin_response));
+        mock_port_set_read_buffer(&port_a, &flash_data_response, sizeof(flash_data_response));
+        mock_port_set_read_buffer(&port_a, &flash_data_response, sizeof(flash_data_response));
+        mock_port_set_read_buffer(&port_b, &flash_begin_response, sizeof(flash_begin_response));
+        mock_port_set_read_buffer(&port_b, &flash_data_response, sizeof(flash_data_response));
+
+        REQUIRE_SUCCESS( loader_flash_begin_cmd(loader_a, 0, 0, 0, 0, false) );
+        REQUIRE_SUCCESS( loader_flash_begin_cmd(loader_b, 0, 0, 0, 0, false) );
+        REQUIRE_SUCCESS( loader_flash_data_cmd(loader_a, data, sizeof(data)) );
+        REQUIRE_SUCCESS( loader_flash_data_cmd(loader_a, data, sizeof(data)) );
+        REQUIRE_SUCCESS( loader_flash_data_cmd(loader_b, data, sizeof(data)) );
+
+        memcpy(&last_a, &port_a.write_buffer[port_a.write_buffer.size() - packet_size + 1], sizeof(last_a));
+        memcpy(&last_b, &port_b.write_buffer[port_b.write_buffer.size() - packet_size + 1], sizeof(last_b));
+        REQUIRE( last_a.sequence_number == 1 );
+        REQUIRE( last_b.sequence_number == 0 );
+    }
+
+    esp_loader_ctx_delete(loader_a);
+    esp_loader_ctx_delete(loader_b);
+}
+
+TEST_CASE( "SLIP packets are encoded in one write and decoded at any alignment" )
+{
+    uint8_t data[64];
+    uint8_t decoded[sizeof(data)];
+
+    // Mostly bytes to escape, so that words with and without them are all met
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (i * 7) % 5 == 0 ? 0xc0 : (i * 11) % 7 == 0 ? 0xdb : i;
+    }
+    data[0] = 1;
+
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t size = 1; offset + size <= sizeof(data); size++) {
+            vector<uint8_t> expected = { 0xc0 };
+            for (size_t i = offset; i < offset + size; i++) {
+                if (data[i] == 0xc0) {
+                    expected.insert(expected.end(), { 0xdb, 0xdc });
+                } else if (data[i] == 0xdb) {
+                    expected.insert(expected.end(), { 0xdb, 0xdd });
+                } else {
+                    expected.push_back(data[i]);
+                }
+            }
+            expected.push_back(0xc0);
+
+            clear_buffers();
+            REQUIRE_SUCCESS( SLIP_send_delimiter(loader_default_ctx()) );
+            REQUIRE_SUCCESS( SLIP_send(loader_default_ctx(), &data[offset], size) );
+            REQUIRE_SUCCESS( SLIP_send_delimiter(loader_default_ctx()) );
+
+            REQUIRE( write_buffer_writes() == 1 );
+            REQUIRE( write_buffer_size() == expected.size() );
+            REQUIRE( memcmp(write_buffer_data(), expected.data(), expected.size()) == 0 );
+
+            uint8_t received[sizeof(data)];
+            memcpy(received, &data[offset], size);
+            received[0] = 1; // The first byte of a response is never escaped
+
+            clear_buffers();
+            set_read_buffer(received, size);
+            REQUIRE_SUCCESS( SLIP_receive_packet(loader_default_ctx(), decoded, size) );
+            REQUIRE( memcmp(decoded, received, size) == 0 );
+        }
+    }
+}
+
+
 TEST_CASE( "Sync command is constructed correctly" )
 {
     uint8_t expected[] = {
@@ -324,7 +560,7 @@ TEST_CASE( "Sync command is constructed correctly" )
     clear_buffers();
     queue_response(sync_response);
 
-    REQUIRE_SUCCESS( loader_sync_cmd() );
+    REQUIRE_SUCCESS( loader_sync_cmd(loader_default_ctx()) );
 
     REQUIRE( memcmp(write_buffer_data(), expected, sizeof(expected)) == 0 );
 }
@@ -27,6 +27,10 @@ static const button_config_t bsp_button_config[] = {
         .type = BUTTON_TYPE_GPIO,
         .gpio_button_config.gpio_num = BSP_BUTTON_1_IO,
         .gpio_button_config.active_level = CONFIG_BSP_BUTTON_1_LEVEL,
+        .gpio_button_config.enable_intr = true,
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        .gpio_button_config.enable_power_save = true,
+#endif
     },
 #elif CONFIG_BSP_BUTTON_1_TYPE_ADC
     {
@@ -45,6 +49,10 @@ static const button_config_t bsp_button_config[] = {
         .type = BUTTON_TYPE_GPIO,
         .gpio_button_config.gpio_num = BSP_BUTTON_2_IO,
         .gpio_button_config.active_level = CONFIG_BSP_BUTTON_2_LEVEL,
+        .gpio_button_config.enable_intr = true,
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        .gpio_button_config.enable_power_save = true,
+#endif
     },
 
 #elif CONFIG_BSP_BUTTON_2_TYPE_ADC
@@ -64,6 +72,10 @@ static const button_config_t bsp_button_config[] = {
         .type = BUTTON_TYPE_GPIO,
         .gpio_button_config.gpio_num = BSP_BUTTON_3_IO,
         .gpio_button_config.active_level = CONFIG_BSP_BUTTON_3_LEVEL,
+        .gpio_button_config.enable_intr = true,
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        .gpio_button_config.enable_power_save = true,
+#endif
     },
 
 #elif CONFIG_BSP_BUTTON_3_TYPE_ADC
@@ -83,6 +95,10 @@ static const button_config_t bsp_button_config[] = {
         .type = BUTTON_TYPE_GPIO,
         .gpio_button_config.gpio_num = BSP_BUTTON_4_IO,
         .gpio_button_config.active_level = CONFIG_BSP_BUTTON_4_LEVEL,
+        .gpio_button_config.enable_intr = true,
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        .gpio_button_config.enable_power_save = true,
+#endif
     },
 
 #elif CONFIG_BSP_BUTTON_4_TYPE_ADC
@@ -102,6 +118,10 @@ static const button_config_t bsp_button_config[] = {
         .type = BUTTON_TYPE_GPIO,
         .gpio_button_config.gpio_num = BSP_BUTTON_5_IO,
         .gpio_button_config.active_level = CONFIG_BSP_BUTTON_5_LEVEL,
+        .gpio_button_config.enable_intr = true,
+#if CONFIG_GPIO_BUTTON_SUPPORT_POWER_SAVE
+        .gpio_button_config.enable_power_save = true,
+#endif
     },
 
 #elif CONFIG_BSP_BUTTON_5_TYPE_ADC
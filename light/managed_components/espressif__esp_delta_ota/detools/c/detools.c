@@ -47,10 +47,42 @@
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define DIV_CEIL(n, d) (((n) + (d) - 1) / (d))
 
+/* Data chunk buffers are words, so that diff data is added a word at
+   a time. */
+#define DATA_CHUNK_WORDS DIV_CEIL(DETOOLS_CONFIG_DATA_CHUNK_SIZE, sizeof(size_t))
+
 /*
  * Utility functions.
  */
 
+/**
+ * Add given bytes to given bytes, a word at a time and then byte by
+ * byte. The top bit of each byte is added apart, so that carries do
+ * not cross bytes.
+ */
+static void add_bytes(size_t *to_p, const size_t *from_p, size_t size)
+{
+    const size_t low = (((size_t)-1 / 0xff) * 0x7f);
+    size_t words;
+    size_t i;
+    uint8_t *to_bytes_p;
+    const uint8_t *from_bytes_p;
+
+    words = (size / sizeof(size_t));
+
+    for (i = 0; i < words; i++) {
+        to_p[i] = (((to_p[i] & low) + (from_p[i] & low))
+                   ^ ((to_p[i] ^ from_p[i]) & ~low));
+    }
+
+    to_bytes_p = (uint8_t *)&to_p[words];
+    from_bytes_p = (const uint8_t *)&from_p[words];
+
+    for (i = 0; i < size % sizeof(size_t); i++) {
+        to_bytes_p[i] = (uint8_t)(to_bytes_p[i] + from_bytes_p[i]);
+    }
+}
+
 static size_t chunk_left(struct detools_apply_patch_chunk_t *self_p)
 {
     return (self_p->size - self_p->offset);
@@ -255,6 +287,7 @@ static int patch_reader_heatshrink_decompress(
 {
     int res;
     struct detools_apply_patch_patch_reader_heatshrink_t *heatshrink_p;
+    struct detools_apply_patch_chunk_t *chunk_p;
     size_t size;
     size_t left;
     HSD_poll_res pres;
@@ -314,18 +347,21 @@ static int patch_reader_heatshrink_decompress(
             return (0);
         }
 
-        /* Input (sink) more data if available. */
-        res = chunk_get(self_p->patch_chunk_p, &byte);
-
-        if (res == 0) {
-            sres = heatshrink_decoder_sink(heatshrink_p->decoder_p,
-                                           &byte,
-                                           sizeof(byte),
-                                           &size);
-
-            if ((sres < 0) || (size != sizeof(byte))) {
+        /* Input (sink) as much of the available data as the input
+           buffer of the decoder takes, which is empty once polled. */
+        if (chunk_available(self_p->patch_chunk_p)) {
+            chunk_p = self_p->patch_chunk_p;
+            sres = heatshrink_decoder_sink(
+                heatshrink_p->decoder_p,
+                (uint8_t *)&chunk_p->buf_p[chunk_p->offset],
+                chunk_left(chunk_p),
+                &size);
+
+            if ((sres < 0) || (size == 0)) {
                 return (-DETOOLS_HEATSHRINK_SINK);
             }
+
+            chunk_p->offset += size;
         } else {
             if (left != *size_p) {
                 *size_p -= left;
@@ -756,13 +792,9 @@ static int patch_reader_crle_decompress_repeated_data_read(
     size_t *size_p)
 {
     size_t size;
-    size_t i;
 
     size = MIN(*size_p, crle_p->kind.repeated.number_of_bytes_left);
-
-    for (i = 0; i < size; i++) {
-        buf_p[i] = crle_p->kind.repeated.value;
-    }
+    memset(buf_p, crle_p->kind.repeated.value, size);
 
     *size_p = size;
     crle_p->kind.repeated.number_of_bytes_left -= size;
@@ -1006,6 +1038,42 @@ static int patch_reader_decompress(
     return (self_p->decompress(self_p, buf_p, size_p));
 }
 
+/**
+ * Decompress up to given number of bytes, in as many calls as the
+ * available patch data allows, so that short runs of CRLE do not make
+ * short writes. Returns 1 if no data is available.
+ */
+static int patch_reader_decompress_fill(
+    struct detools_apply_patch_patch_reader_t *self_p,
+    uint8_t *buf_p,
+    size_t *size_p)
+{
+    int res;
+    size_t size;
+    size_t filled;
+
+    filled = 0;
+
+    do {
+        size = (*size_p - filled);
+        res = patch_reader_decompress(self_p, &buf_p[filled], &size);
+
+        if (res != 0) {
+            break;
+        }
+
+        filled += size;
+    } while (filled < *size_p);
+
+    if ((res < 0) || (filled == 0)) {
+        return (res);
+    }
+
+    *size_p = filled;
+
+    return (0);
+}
+
 /**
  * Unpack a size value.
  */
@@ -1183,14 +1251,74 @@ static int process_dfpatch_size(struct detools_apply_patch_t *self_p)
     }
 
     if (size > 0) {
-        return (-DETOOLS_NOT_IMPLEMENTED);
+        if (self_p->dfpatch_write == NULL) {
+            return (-DETOOLS_NOT_IMPLEMENTED);
+        }
+
+        self_p->chunk_size = (size_t)size;
+        self_p->state = detools_apply_patch_state_dfpatch_data_format_t;
+    } else {
+        self_p->state = detools_apply_patch_state_diff_size_t;
     }
 
-    self_p->state = detools_apply_patch_state_diff_size_t;
+    return (0);
+}
+
+static int process_dfpatch_data_format(struct detools_apply_patch_t *self_p)
+{
+    int res;
+
+    res = patch_reader_unpack_size(&self_p->patch_reader,
+                                   &self_p->data_format);
+
+    if (res != 0) {
+        return (res);
+    }
+
+    self_p->state = detools_apply_patch_state_dfpatch_data_t;
 
     return (0);
 }
 
+static int process_dfpatch_data(struct detools_apply_patch_t *self_p)
+{
+    int res;
+    uint8_t buf[128];
+    size_t size;
+
+    size = MIN(sizeof(buf), self_p->chunk_size);
+
+    if (size == 0) {
+        res = self_p->dfpatch_write(self_p->arg_p,
+                                    self_p->data_format,
+                                    NULL,
+                                    0);
+
+        if (res != 0) {
+            return (res);
+        }
+
+        self_p->state = detools_apply_patch_state_diff_size_t;
+
+        return (0);
+    }
+
+    res = patch_reader_decompress(&self_p->patch_reader,
+                                  &buf[0],
+                                  &size);
+
+    if (res != 0) {
+        return (res);
+    }
+
+    self_p->chunk_size -= size;
+
+    return (self_p->dfpatch_write(self_p->arg_p,
+                                  self_p->data_format,
+                                  &buf[0],
+                                  size));
+}
+
 static int process_size(struct detools_apply_patch_t *self_p,
                         enum detools_apply_patch_state_t next_state)
 {
@@ -1216,10 +1344,9 @@ static int process_data(struct detools_apply_patch_t *self_p,
                         enum detools_apply_patch_state_t next_state)
 {
     int res;
-    size_t i;
-    uint8_t to[128];
+    size_t to[DATA_CHUNK_WORDS];
     size_t to_size;
-    uint8_t from[128];
+    size_t from[DATA_CHUNK_WORDS];
 
     to_size = MIN(sizeof(to), self_p->chunk_size);
 
@@ -1229,32 +1356,29 @@ static int process_data(struct detools_apply_patch_t *self_p,
         return (0);
     }
 
-    res = patch_reader_decompress(&self_p->patch_reader,
-                                  &to[0],
-                                  &to_size);
+    res = patch_reader_decompress_fill(&self_p->patch_reader,
+                                       (uint8_t *)&to[0],
+                                       &to_size);
 
     if (res != 0) {
         return (res);
     }
 
     if (next_state == detools_apply_patch_state_extra_size_t) {
-        res = self_p->from_read(self_p->arg_p, &from[0], to_size);
+        res = self_p->from_read(self_p->arg_p, (uint8_t *)&from[0], to_size);
 
         if (res != 0) {
             return (-DETOOLS_IO_FAILED);
         }
 
         self_p->from_offset += to_size;
-
-        for (i = 0; i < to_size; i++) {
-            to[i] = (uint8_t)(to[i] + from[i]);
-        }
+        add_bytes(&to[0], &from[0], to_size);
     }
 
     self_p->to_offset += to_size;
     self_p->chunk_size -= to_size;
 
-    res = self_p->to_write(self_p->arg_p, &to[0], to_size);
+    res = self_p->to_write(self_p->arg_p, (uint8_t *)&to[0], to_size);
 
     if (res != 0) {
         return (-DETOOLS_IO_FAILED);
@@ -1325,6 +1449,14 @@ static int apply_patch_process_once(struct detools_apply_patch_t *self_p)
         res = process_dfpatch_size(self_p);
         break;
 
+    case detools_apply_patch_state_dfpatch_data_format_t:
+        res = process_dfpatch_data_format(self_p);
+        break;
+
+    case detools_apply_patch_state_dfpatch_data_t:
+        res = process_dfpatch_data(self_p);
+        break;
+
     case detools_apply_patch_state_diff_size_t:
         res = process_diff_size(self_p);
         break;
@@ -1407,6 +1539,7 @@ int detools_apply_patch_init(struct detools_apply_patch_t *self_p,
     self_p->to_write = to_write;
     self_p->from_offset = 0;
     self_p->arg_p = arg_p;
+    self_p->dfpatch_write = NULL;
     self_p->state = detools_apply_patch_state_init_t;
     self_p->init_state = detools_apply_patch_init_state_fixed_header_t;
     self_p->patch_reader.destroy = NULL;
@@ -1414,6 +1547,15 @@ int detools_apply_patch_init(struct detools_apply_patch_t *self_p,
     return (0);
 }
 
+int detools_apply_patch_set_dfpatch_write(
+    struct detools_apply_patch_t *self_p,
+    detools_dfpatch_write_t dfpatch_write)
+{
+    self_p->dfpatch_write = dfpatch_write;
+
+    return (0);
+}
+
 int detools_apply_patch_dump(struct detools_apply_patch_t *self_p,
                              detools_state_write_t state_write)
 {
@@ -1454,6 +1596,7 @@ int detools_apply_patch_restore(struct detools_apply_patch_t *self_p,
     }
 
     self_p->compression = dumped.compression;
+    self_p->data_format = dumped.data_format;
     self_p->patch_offset = dumped.patch_offset;
     self_p->to_offset = dumped.to_offset;
     self_p->to_size = dumped.to_size;
@@ -1895,10 +2038,9 @@ static int in_place_process_data(struct detools_apply_patch_in_place_t *self_p,
                                  enum detools_apply_patch_state_t next_state)
 {
     int res;
-    size_t i;
-    uint8_t to[128];
+    size_t to[DATA_CHUNK_WORDS];
     size_t to_size;
-    uint8_t from[128];
+    size_t from[DATA_CHUNK_WORDS];
 
     to_size = MIN(sizeof(to), self_p->chunk_size);
 
@@ -1908,9 +2050,9 @@ static int in_place_process_data(struct detools_apply_patch_in_place_t *self_p,
         return (0);
     }
 
-    res = patch_reader_decompress(&self_p->patch_reader,
-                                  &to[0],
-                                  &to_size);
+    res = patch_reader_decompress_fill(&self_p->patch_reader,
+                                       (uint8_t *)&to[0],
+                                       &to_size);
 
     if (res != 0) {
         return (res);
@@ -1927,10 +2069,7 @@ static int in_place_process_data(struct detools_apply_patch_in_place_t *self_p,
         }
 
         self_p->segment.from_offset += (int)to_size;
-
-        for (i = 0; i < to_size; i++) {
-            to[i] = (uint8_t)(to[i] + from[i]);
-        }
+        add_bytes(&to[0], &from[0], to_size);
     }
 
     res = in_place_mem_write(self_p,
@@ -55,6 +55,13 @@
 #    define DETOOLS_CONFIG_COMPRESSION_HEATSHRINK  1
 #endif
 
+/* Diff and extra data are patched in chunks of this many bytes. Two
+   buffers of this size are on the stack while patching. A multiple of
+   the word size. */
+#ifndef DETOOLS_CONFIG_DATA_CHUNK_SIZE
+#    define DETOOLS_CONFIG_DATA_CHUNK_SIZE         128
+#endif
+
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -208,6 +215,22 @@ typedef int (*detools_step_set_t)(void *arg_p, int step);
  */
 typedef int (*detools_step_get_t)(void *arg_p, int *step_p);
 
+/**
+ * Data format patch callback.
+ *
+ * @param[in] arg_p User data passed to detools_apply_patch_init().
+ * @param[in] data_format Data format of the patch.
+ * @param[in] buf_p Next bytes of the data format patch.
+ * @param[in] size Number of bytes, or zero(0) once the whole data
+ *                 format patch has been passed.
+ *
+ * @return zero(0) or negative error code.
+ */
+typedef int (*detools_dfpatch_write_t)(void *arg_p,
+                                       int data_format,
+                                       const uint8_t *buf_p,
+                                       size_t size);
+
 struct detools_apply_patch_size_t {
     int state;
     int value;
@@ -315,6 +338,8 @@ struct detools_apply_patch_chunk_t {
 enum detools_apply_patch_state_t {
     detools_apply_patch_state_init_t = 0,
     detools_apply_patch_state_dfpatch_size_t,
+    detools_apply_patch_state_dfpatch_data_format_t,
+    detools_apply_patch_state_dfpatch_data_t,
     detools_apply_patch_state_diff_size_t,
     detools_apply_patch_state_diff_data_t,
     detools_apply_patch_state_extra_size_t,
@@ -338,9 +363,11 @@ struct detools_apply_patch_t {
     size_t patch_size;
     detools_write_t to_write;
     void *arg_p;
+    detools_dfpatch_write_t dfpatch_write;
     enum detools_apply_patch_state_t state;
     enum detools_apply_patch_init_state_t init_state;
     int compression;
+    int data_format;
     size_t patch_offset;
     size_t to_offset;
     size_t to_size;
@@ -402,6 +429,21 @@ int detools_apply_patch_init(struct detools_apply_patch_t *self_p,
                              detools_write_t to_write,
                              void *arg_p);
 
+/**
+ * Pass the data format patch, if any, to given callback instead of
+ * failing with DETOOLS_NOT_IMPLEMENTED. The callback is expected to
+ * undo the data format in the from-data read callback. Call after
+ * `detools_apply_patch_init()`.
+ *
+ * @param[in] self_p Initialized apply patch object.
+ * @param[in] dfpatch_write Data format patch callback.
+ *
+ * @return zero(0) or negative error code.
+ */
+int detools_apply_patch_set_dfpatch_write(
+    struct detools_apply_patch_t *self_p,
+    detools_dfpatch_write_t dfpatch_write);
+
 /**
  * Dump given apply patch object state. Call
  * `detools_apply_patch_restore()` to restore an apply patch object to
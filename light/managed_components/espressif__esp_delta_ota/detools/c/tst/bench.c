@@ -0,0 +1,618 @@
+/**
+ * Apply patch benchmark on a simulated flash.
+ *
+ * The from image, the to image and the in-place memory live in a
+ * simulated NOR flash. Every read, program and erase is charged a
+ * latency to a virtual clock, the patch itself is read from RAM, as
+ * when it is received over the network. The result is the CPU time
+ * of the apply plus the simulated flash time.
+ *
+ * Usage: detools-bench [options] sequential <from> <patch> <to>
+ *        detools-bench [options] in-place <from> <patch> <to> <memory-size>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "../detools.h"
+
+#define BENCH_SECTOR_SIZE 4096
+#define BENCH_PAGE_SIZE    256
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+struct flash_config_t {
+    /* Sector erase, in us. */
+    double erase_us;
+    /* Fixed cost of a program transaction, in us. */
+    double program_op_us;
+    /* Program of one page, in us, charged pro rata. */
+    double program_us;
+    /* Fixed cost of a read transaction, in us. */
+    double read_op_us;
+    /* Read of one byte, in us. */
+    double read_byte_us;
+    /* Read cache of the from image, in bytes, 0 to disable. */
+    size_t cache_size;
+};
+
+struct flash_stats_t {
+    size_t reads;
+    size_t read_bytes;
+    size_t programs;
+    size_t program_bytes;
+    size_t erases;
+    double read_us;
+    double program_us;
+    double erase_us;
+};
+
+struct bench_t {
+    struct flash_config_t config;
+    struct flash_stats_t stats;
+    uint8_t *flash_p;
+    size_t flash_size;
+    /* Sequential: the from image, then the to image, sector aligned. */
+    size_t from_offset;
+    size_t from_size;
+    size_t from_pos;
+    size_t to_offset;
+    size_t to_written;
+    size_t cache_offset;
+    size_t cache_len;
+    /* The patch, in RAM. */
+    const uint8_t *patch_p;
+    size_t patch_size;
+    size_t patch_pos;
+    /* In-place. */
+    int step;
+};
+
+/* Heap accounting, glibc only. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr_p, size_t size);
+extern void __libc_free(void *ptr_p);
+
+static int heap_tracking = 0;
+static size_t heap_used = 0;
+static size_t heap_peak = 0;
+static size_t heap_allocs = 0;
+
+static void heap_add(void *ptr_p)
+{
+    if (heap_tracking && (ptr_p != NULL)) {
+        heap_used += malloc_usable_size(ptr_p);
+        heap_allocs++;
+
+        if (heap_used > heap_peak) {
+            heap_peak = heap_used;
+        }
+    }
+}
+
+static void heap_remove(void *ptr_p)
+{
+    size_t size;
+
+    if (heap_tracking && (ptr_p != NULL)) {
+        size = malloc_usable_size(ptr_p);
+        heap_used = (size > heap_used) ? 0 : heap_used - size;
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr_p;
+
+    ptr_p = __libc_malloc(size);
+    heap_add(ptr_p);
+
+    return (ptr_p);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr_p;
+
+    ptr_p = __libc_calloc(nmemb, size);
+    heap_add(ptr_p);
+
+    return (ptr_p);
+}
+
+void *realloc(void *ptr_p, size_t size)
+{
+    void *new_p;
+
+    heap_remove(ptr_p);
+    new_p = __libc_realloc(ptr_p, size);
+
+    if (new_p != NULL) {
+        heap_add(new_p);
+        heap_allocs--;
+    }
+
+    return (new_p);
+}
+
+void free(void *ptr_p)
+{
+    heap_remove(ptr_p);
+    __libc_free(ptr_p);
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3);
+}
+
+static uint8_t *read_file(const char *name_p, size_t *size_p)
+{
+    FILE *file_p;
+    uint8_t *buf_p;
+    long size;
+
+    file_p = fopen(name_p, "rb");
+
+    if (file_p == NULL) {
+        fprintf(stderr, "error: cannot open '%s'\n", name_p);
+        exit(1);
+    }
+
+    fseek(file_p, 0, SEEK_END);
+    size = ftell(file_p);
+    fseek(file_p, 0, SEEK_SET);
+    buf_p = __libc_malloc((size_t)size + 1);
+
+    if ((buf_p == NULL)
+        || ((size > 0) && (fread(buf_p, (size_t)size, 1, file_p) != 1))) {
+        fprintf(stderr, "error: cannot read '%s'\n", name_p);
+        exit(1);
+    }
+
+    fclose(file_p);
+    *size_p = (size_t)size;
+
+    return (buf_p);
+}
+
+static size_t sector_align(size_t size)
+{
+    return ((size + BENCH_SECTOR_SIZE - 1) & ~(size_t)(BENCH_SECTOR_SIZE - 1));
+}
+
+static void flash_read(struct bench_t *self_p,
+                       void *dst_p,
+                       size_t addr,
+                       size_t size)
+{
+    memcpy(dst_p, &self_p->flash_p[addr], size);
+    self_p->stats.reads++;
+    self_p->stats.read_bytes += size;
+    self_p->stats.read_us += (self_p->config.read_op_us
+                              + self_p->config.read_byte_us * (double)size);
+}
+
+/* NOR flash only clears bits when programming. */
+static int flash_program(struct bench_t *self_p,
+                         size_t addr,
+                         const uint8_t *src_p,
+                         size_t size)
+{
+    size_t i;
+
+    if (addr + size > self_p->flash_size) {
+        return (-1);
+    }
+
+    for (i = 0; i < size; i++) {
+        self_p->flash_p[addr + i] &= src_p[i];
+    }
+
+    self_p->stats.programs++;
+    self_p->stats.program_bytes += size;
+    self_p->stats.program_us += (self_p->config.program_op_us
+                                 + (self_p->config.program_us
+                                    * (double)size / BENCH_PAGE_SIZE));
+
+    return (0);
+}
+
+/* The in-place apply erases the tail of the last segment, round up
+   to whole sectors as a device does. */
+static int flash_erase(struct bench_t *self_p, size_t addr, size_t size)
+{
+    size_t sectors;
+
+    size = sector_align(size);
+
+    if (((addr % BENCH_SECTOR_SIZE) != 0)
+        || (addr + size > self_p->flash_size)) {
+        return (-1);
+    }
+
+    memset(&self_p->flash_p[addr], 0xff, size);
+    sectors = size / BENCH_SECTOR_SIZE;
+    self_p->stats.erases += sectors;
+    self_p->stats.erase_us += self_p->config.erase_us * (double)sectors;
+
+    return (0);
+}
+
+static int patch_read(void *arg_p, uint8_t *buf_p, size_t size)
+{
+    struct bench_t *self_p;
+
+    self_p = (struct bench_t *)arg_p;
+
+    if (size > self_p->patch_size - self_p->patch_pos) {
+        return (-1);
+    }
+
+    memcpy(buf_p, &self_p->patch_p[self_p->patch_pos], size);
+    self_p->patch_pos += size;
+
+    return (0);
+}
+
+static int from_read(void *arg_p, uint8_t *buf_p, size_t size)
+{
+    struct bench_t *self_p;
+    size_t start;
+    size_t n;
+
+    self_p = (struct bench_t *)arg_p;
+
+    if (size > self_p->from_size - self_p->from_pos) {
+        return (-1);
+    }
+
+    if (self_p->config.cache_size == 0) {
+        flash_read(self_p, buf_p, self_p->from_offset + self_p->from_pos, size);
+        self_p->from_pos += size;
+
+        return (0);
+    }
+
+    while (size > 0) {
+        if ((self_p->from_pos < self_p->cache_offset)
+            || (self_p->from_pos >= self_p->cache_offset + self_p->cache_len)) {
+            start = self_p->from_pos - (self_p->from_pos % self_p->config.cache_size);
+            self_p->cache_offset = start;
+            self_p->cache_len = MIN(self_p->config.cache_size,
+                                    self_p->from_size - start);
+            /* Only the cost is simulated, the data is copied below. */
+            self_p->stats.reads++;
+            self_p->stats.read_bytes += self_p->cache_len;
+            self_p->stats.read_us += (self_p->config.read_op_us
+                                      + (self_p->config.read_byte_us
+                                         * (double)self_p->cache_len));
+        }
+
+        n = MIN(size,
+                self_p->cache_offset + self_p->cache_len - self_p->from_pos);
+        memcpy(buf_p,
+               &self_p->flash_p[self_p->from_offset + self_p->from_pos],
+               n);
+        buf_p += n;
+        self_p->from_pos += n;
+        size -= n;
+    }
+
+    return (0);
+}
+
+static int from_seek(void *arg_p, int offset)
+{
+    struct bench_t *self_p;
+
+    self_p = (struct bench_t *)arg_p;
+
+    if ((offset < 0 && (size_t)-offset > self_p->from_pos)
+        || (offset > 0 && (size_t)offset > self_p->from_size - self_p->from_pos)) {
+        return (-1);
+    }
+
+    self_p->from_pos = (size_t)((long)self_p->from_pos + offset);
+
+    return (0);
+}
+
+/* Erases the sectors as the image grows, as esp_ota_write() does. */
+static int to_write(void *arg_p, const uint8_t *buf_p, size_t size)
+{
+    struct bench_t *self_p;
+    size_t erased;
+    size_t end;
+
+    self_p = (struct bench_t *)arg_p;
+    erased = sector_align(self_p->to_written);
+    end = self_p->to_written + size;
+
+    if (end > erased) {
+        if (flash_erase(self_p,
+                        self_p->to_offset + erased,
+                        sector_align(end) - erased) != 0) {
+            return (-1);
+        }
+    }
+
+    if (flash_program(self_p,
+                      self_p->to_offset + self_p->to_written,
+                      buf_p,
+                      size) != 0) {
+        return (-1);
+    }
+
+    self_p->to_written += size;
+
+    return (0);
+}
+
+static int mem_read(void *arg_p, void *dst_p, uintptr_t src, size_t size)
+{
+    struct bench_t *self_p;
+
+    self_p = (struct bench_t *)arg_p;
+
+    if (src + size > self_p->flash_size) {
+        return (-1);
+    }
+
+    flash_read(self_p, dst_p, src, size);
+
+    return (0);
+}
+
+static int mem_write(void *arg_p, uintptr_t dst, void *src_p, size_t size)
+{
+    return (flash_program((struct bench_t *)arg_p, dst, src_p, size));
+}
+
+static int mem_erase(void *arg_p, uintptr_t addr, size_t size)
+{
+    return (flash_erase((struct bench_t *)arg_p, addr, size));
+}
+
+/* The step is stored in flash on a device, charge a program. */
+static int step_set(void *arg_p, int step)
+{
+    struct bench_t *self_p;
+
+    self_p = (struct bench_t *)arg_p;
+    self_p->step = step;
+    self_p->stats.programs++;
+    self_p->stats.program_bytes += sizeof(step);
+    self_p->stats.program_us += self_p->config.program_op_us;
+
+    return (0);
+}
+
+static int step_get(void *arg_p, int *step_p)
+{
+    struct bench_t *self_p;
+
+    self_p = (struct bench_t *)arg_p;
+    *step_p = self_p->step;
+
+    return (0);
+}
+
+static void print_usage_and_exit(const char *name_p)
+{
+    printf("Usage: %s [options] sequential <from> <patch> <to>\n"
+           "       %s [options] in-place <from> <patch> <to> <memory-size>\n"
+           "\n"
+           "Options:\n"
+           "  -e <us>   Sector erase time (default 45000).\n"
+           "  -w <us>   Program transaction overhead (default 20).\n"
+           "  -p <us>   Page program time (default 400).\n"
+           "  -r <us>   Read transaction overhead (default 10).\n"
+           "  -b <us>   Read time per byte (default 0.05).\n"
+           "  -c <n>    From image read cache in bytes, 0 to disable "
+           "(default 4096).\n"
+           "  -n <n>    Number of runs, the best CPU time is kept (default 3).\n",
+           name_p,
+           name_p);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_t bench;
+    const uint8_t *from_p;
+    const uint8_t *to_p;
+    size_t from_size;
+    size_t to_size;
+    size_t memory_size;
+    const char *mode_p;
+    const char *patch_name_p;
+    bool in_place;
+    int runs;
+    int run;
+    int opt;
+    int res;
+    double start;
+    double cpu_us;
+    double best_cpu_us;
+    double flash_us;
+    size_t peak;
+    size_t allocs;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.config.erase_us = 45000;
+    bench.config.program_op_us = 20;
+    bench.config.program_us = 400;
+    bench.config.read_op_us = 10;
+    bench.config.read_byte_us = 0.05;
+    bench.config.cache_size = BENCH_SECTOR_SIZE;
+    runs = 3;
+
+    while ((opt = getopt(argc, argv, "e:w:p:r:b:c:n:")) != -1) {
+        switch (opt) {
+        case 'e':
+            bench.config.erase_us = atof(optarg);
+            break;
+        case 'w':
+            bench.config.program_op_us = atof(optarg);
+            break;
+        case 'p':
+            bench.config.program_us = atof(optarg);
+            break;
+        case 'r':
+            bench.config.read_op_us = atof(optarg);
+            break;
+        case 'b':
+            bench.config.read_byte_us = atof(optarg);
+            break;
+        case 'c':
+            bench.config.cache_size = (size_t)atol(optarg);
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        default:
+            print_usage_and_exit(argv[0]);
+        }
+    }
+
+    if (argc - optind < 4 || runs < 1) {
+        print_usage_and_exit(argv[0]);
+    }
+
+    mode_p = argv[optind];
+    in_place = (strcmp(mode_p, "in-place") == 0);
+
+    if (!in_place && strcmp(mode_p, "sequential") != 0) {
+        print_usage_and_exit(argv[0]);
+    }
+
+    if (in_place && argc - optind < 5) {
+        print_usage_and_exit(argv[0]);
+    }
+
+    from_p = read_file(argv[optind + 1], &from_size);
+    bench.patch_p = read_file(argv[optind + 2], &bench.patch_size);
+    to_p = read_file(argv[optind + 3], &to_size);
+    patch_name_p = strrchr(argv[optind + 2], '/');
+    patch_name_p = (patch_name_p != NULL) ? patch_name_p + 1 : argv[optind + 2];
+
+    if (in_place) {
+        memory_size = (size_t)atol(argv[optind + 4]);
+
+        if (memory_size < from_size || memory_size < to_size) {
+            fprintf(stderr, "error: memory smaller than the images\n");
+            exit(1);
+        }
+
+        bench.flash_size = sector_align(memory_size);
+    } else {
+        bench.from_offset = 0;
+        bench.from_size = from_size;
+        bench.to_offset = sector_align(from_size);
+        bench.flash_size = bench.to_offset + sector_align(to_size);
+    }
+
+    bench.flash_p = __libc_malloc(bench.flash_size);
+    best_cpu_us = 0;
+    peak = 0;
+    allocs = 0;
+
+    for (run = 0; run < runs; run++) {
+        memset(bench.flash_p, 0xff, bench.flash_size);
+        memcpy(bench.flash_p, from_p, from_size);
+        memset(&bench.stats, 0, sizeof(bench.stats));
+        bench.from_pos = 0;
+        bench.to_written = 0;
+        bench.cache_offset = 0;
+        bench.cache_len = 0;
+        bench.patch_pos = 0;
+        bench.step = 0;
+        heap_used = 0;
+        heap_peak = 0;
+        heap_allocs = 0;
+        heap_tracking = 1;
+        start = now_us();
+
+        if (in_place) {
+            res = detools_apply_patch_in_place_callbacks(mem_read,
+                                                         mem_write,
+                                                         mem_erase,
+                                                         step_set,
+                                                         step_get,
+                                                         patch_read,
+                                                         bench.patch_size,
+                                                         &bench);
+        } else {
+            res = detools_apply_patch_callbacks(from_read,
+                                                from_seek,
+                                                patch_read,
+                                                bench.patch_size,
+                                                to_write,
+                                                &bench);
+        }
+
+        cpu_us = now_us() - start;
+        heap_tracking = 0;
+
+        if (res != (int)to_size) {
+            fprintf(stderr,
+                    "error: %s: %s (%d)\n",
+                    patch_name_p,
+                    detools_error_as_string(-res),
+                    res);
+            exit(1);
+        }
+
+        if (memcmp(&bench.flash_p[in_place ? 0 : bench.to_offset],
+                   to_p,
+                   to_size) != 0) {
+            fprintf(stderr, "error: %s: wrong output\n", patch_name_p);
+            exit(1);
+        }
+
+        if (run == 0 || cpu_us < best_cpu_us) {
+            best_cpu_us = cpu_us;
+        }
+
+        peak = heap_peak;
+        allocs = heap_allocs;
+    }
+
+    flash_us = bench.stats.read_us + bench.stats.program_us + bench.stats.erase_us;
+    printf("%s %s: to %zu bytes, patch %zu bytes\n",
+           mode_p,
+           patch_name_p,
+           to_size,
+           bench.patch_size);
+    printf("  cpu %.1f ms (%.2f MB/s), flash %.1f ms "
+           "(read %.1f, program %.1f, erase %.1f), total %.2f MB/s\n",
+           best_cpu_us / 1e3,
+           (double)to_size / best_cpu_us,
+           flash_us / 1e3,
+           bench.stats.read_us / 1e3,
+           bench.stats.program_us / 1e3,
+           bench.stats.erase_us / 1e3,
+           (double)to_size / (best_cpu_us + flash_us));
+    printf("  flash reads %zu (%zu bytes), programs %zu (%zu bytes), "
+           "sector erases %zu\n",
+           bench.stats.reads,
+           bench.stats.read_bytes,
+           bench.stats.programs,
+           bench.stats.program_bytes,
+           bench.stats.erases);
+    printf("  heap peak %zu bytes, allocations %zu\n", peak, allocs);
+
+    return (0);
+}
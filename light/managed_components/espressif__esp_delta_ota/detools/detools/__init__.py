@@ -13,6 +13,7 @@ from elftools.elf.elffile import ELFFile
 
 from .create import create_patch
 from .create import create_patch_filenames
+from .create import create_patches_filenames
 from .apply import apply_patch
 from .apply import apply_patch_in_place
 from .apply import apply_patch_bsdiff
@@ -278,6 +279,25 @@ def _do_create_patch_in_place(args):
     print_successful(args.patchfile, start_time)
 
 
+def _do_create_patches(args):
+    if len(args.files) % 3 != 0:
+        raise Error(
+            'Expected from, to and patch files for each patch, got {} '
+            'files.'.format(len(args.files)))
+
+    start_time = time.time()
+    patches = list(zip(args.files[0::3], args.files[1::3], args.files[2::3]))
+    create_patches_filenames(patches,
+                             args.compression,
+                             args.suffix_array_algorithm,
+                             args.data_format,
+                             jobs=args.jobs,
+                             **heatshrink_args(args))
+
+    for _, _, patchfile in patches:
+        print_successful(patchfile, start_time)
+
+
 def _do_create_patch_bsdiff(args):
     start_time = time.time()
     create_patch_filenames(args.fromfile,
@@ -664,6 +684,37 @@ def _main():
     subparser.add_argument('patchfile', help='Created patch file.')
     subparser.set_defaults(func=_do_create_patch_in_place)
 
+    # Create several sequential patches subparser.
+    subparser = subparsers.add_parser(
+        'create_patches',
+        description=('Create several sequential patches in parallel, sharing '
+                     'the suffix array of each from file.'))
+    subparser.add_argument(
+        '-c', '--compression',
+        choices=sorted(_COMPRESSIONS),
+        default='lzma',
+        help='Compression algorithm (default: %(default)s).')
+    subparser.add_argument(
+        '-s', '--suffix-array-algorithm',
+        choices=('sais', 'divsufsort'),
+        default='divsufsort',
+        help='Suffix array algorithm (default: %(default)s).')
+    subparser.add_argument(
+        '--data-format',
+        choices=['xtensa-esp32'],
+        help='Data format to create patches for.')
+    subparser.add_argument(
+        '-j', '--jobs',
+        type=int,
+        help='Number of threads (default: the number of processors).')
+    add_heatshrink_args(subparser)
+    subparser.add_argument(
+        'files',
+        nargs='+',
+        metavar='fromfile tofile patchfile',
+        help='From file, to file and created patch file of each patch.')
+    subparser.set_defaults(func=_do_create_patches)
+
     # Create bsdiff patch subparser.
     subparser = subparsers.add_parser('create_patch_bsdiff',
                                       description='Create a bsdiff patch.')
@@ -331,6 +331,9 @@ static int create_patch_loop(PyObject *list_p,
         from_score = 0;
         scan += len;
 
+        /* The search does not touch any Python object. */
+        Py_BEGIN_ALLOW_THREADS
+
         for (scsc = scan; scan < to_size; scan++) {
             len = search(sa_p,
                          from_p,
@@ -358,6 +361,8 @@ static int create_patch_loop(PyObject *list_p,
             }
         }
 
+        Py_END_ALLOW_THREADS
+
         if ((len != from_score) || (scan == to_size)) {
             res = write_diff_extra_and_adjustment(list_p,
                                                   from_p,
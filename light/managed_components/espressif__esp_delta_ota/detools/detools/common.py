@@ -37,11 +37,13 @@ COMPRESSIONS = {
 DATA_FORMAT_ARM_CORTEX_M4 = 0
 DATA_FORMAT_AARCH64       = 1
 DATA_FORMAT_XTENSA_LX106  = 2
+DATA_FORMAT_XTENSA_ESP32  = 3
 
 DATA_FORMATS = {
     'arm-cortex-m4': DATA_FORMAT_ARM_CORTEX_M4,
     'aarch64': DATA_FORMAT_AARCH64,
-    'xtensa-lx106': DATA_FORMAT_XTENSA_LX106
+    'xtensa-lx106': DATA_FORMAT_XTENSA_LX106,
+    'xtensa-esp32': DATA_FORMAT_XTENSA_ESP32
 }
 
 
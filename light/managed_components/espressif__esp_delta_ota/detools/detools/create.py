@@ -4,6 +4,8 @@ import logging
 import tempfile
 import mmap
 import lzma
+from concurrent.futures import ThreadPoolExecutor
+from concurrent.futures import as_completed
 from bz2 import BZ2Compressor
 from io import BytesIO
 import struct
@@ -126,10 +128,7 @@ def create_chunks_mmap(ffrom, fto, suffix_array_algorithm):
     return chunks
 
 
-def create_chunks_heap(ffrom, fto, suffix_array_algorithm):
-    LOGGER.debug('Creating chunks using the heap.')
-
-    from_data = file_read(ffrom)
+def create_suffix_array_heap(from_data, suffix_array_algorithm):
     start_time = time.time()
     suffix_array = bytearray(4 * (len(from_data) + 1))
     create_suffix_array(suffix_array, from_data, suffix_array_algorithm)
@@ -138,6 +137,18 @@ def create_chunks_heap(ffrom, fto, suffix_array_algorithm):
                 format_size(len(suffix_array)),
                 format_timespan(time.time() - start_time))
 
+    return suffix_array
+
+
+def create_chunks_heap(ffrom, fto, suffix_array_algorithm, suffix_array=None):
+    LOGGER.debug('Creating chunks using the heap.')
+
+    from_data = file_read(ffrom)
+
+    if suffix_array is None:
+        suffix_array = create_suffix_array_heap(from_data,
+                                                suffix_array_algorithm)
+
     start_time = time.time()
     chunks = bsdiff.create_patch(suffix_array,
                                  from_data,
@@ -150,9 +161,16 @@ def create_chunks_heap(ffrom, fto, suffix_array_algorithm):
     return chunks
 
 
-def create_chunks(ffrom, fto, suffix_array_algorithm, use_mmap):
-    if not use_mmap:
-        return create_chunks_heap(ffrom, fto, suffix_array_algorithm)
+def create_chunks(ffrom,
+                  fto,
+                  suffix_array_algorithm,
+                  use_mmap,
+                  suffix_array=None):
+    if not use_mmap or suffix_array is not None:
+        return create_chunks_heap(ffrom,
+                                  fto,
+                                  suffix_array_algorithm,
+                                  suffix_array)
 
     try:
         return create_chunks_mmap(ffrom, fto, suffix_array_algorithm)
@@ -169,7 +187,8 @@ def create_patch_sequential_data(ffrom,
                                  data_segment,
                                  use_mmap,
                                  heatshrink_window_sz2,
-                                 heatshrink_lookahead_sz2):
+                                 heatshrink_lookahead_sz2,
+                                 suffix_array=None):
     to_size = file_size(fto)
 
     if to_size == 0:
@@ -193,7 +212,11 @@ def create_patch_sequential_data(ffrom,
         dfpatch += patch
 
     fpatch.write(compressor.compress(dfpatch))
-    chunks = create_chunks(ffrom, fto, suffix_array_algorithm, use_mmap)
+    chunks = create_chunks(ffrom,
+                           fto,
+                           suffix_array_algorithm,
+                           use_mmap,
+                           suffix_array)
     start_time = time.time()
 
     for chunk in chunks:
@@ -215,7 +238,8 @@ def create_patch_sequential(ffrom,
                             data_segment,
                             use_mmap,
                             heatshrink_window_sz2,
-                            heatshrink_lookahead_sz2):
+                            heatshrink_lookahead_sz2,
+                            suffix_array=None):
     fpatch.write(pack_header(PATCH_TYPE_SEQUENTIAL,
                              compression_string_to_number(compression)))
     fpatch.write(pack_size(file_size(fto)))
@@ -228,7 +252,8 @@ def create_patch_sequential(ffrom,
                                  data_segment,
                                  use_mmap,
                                  heatshrink_window_sz2,
-                                 heatshrink_lookahead_sz2)
+                                 heatshrink_lookahead_sz2,
+                                 suffix_array)
 
 
 def calc_shift(memory_size, segment_size, minimum_shift_size, from_size):
@@ -678,3 +703,96 @@ def create_patch_filenames(fromfile,
                              use_mmap,
                              heatshrink_window_sz2,
                              heatshrink_lookahead_sz2)
+
+
+def create_patches_filenames(patches,
+                             compression='lzma',
+                             suffix_array_algorithm='divsufsort',
+                             data_format=None,
+                             heatshrink_window_sz2=8,
+                             heatshrink_lookahead_sz2=7,
+                             jobs=None):
+    """Create a sequential bsdiff patch for each ``(fromfile, tofile,
+    patchfile)`` tuple in `patches`, using up to `jobs` threads
+    (default: the number of processors).
+
+    The suffix array of each from file is created once and shared by
+    all its patches, so a patch for every pair of a set of versions
+    costs one suffix array per version. With the ``'xtensa-esp32'``
+    `data_format`, the only one supported here, each patch creates its
+    own, of the relocated from file.
+
+    All patches are created, or the first error is raised once the
+    running ones finished.
+
+    >>> create_patches_filenames([('foo.1', 'foo.3', 'foo-1-3.patch'),
+    ...                           ('foo.2', 'foo.3', 'foo-2-3.patch')])
+
+    """
+
+    if data_format not in [None, 'xtensa-esp32']:
+        raise Error(
+            'Data format {} cannot be used when creating several '
+            'patches.'.format(data_format))
+
+    def create_suffix_array_of(fromfile):
+        with open(fromfile, 'rb') as ffrom:
+            from_data = ffrom.read()
+
+        return from_data, create_suffix_array_heap(from_data,
+                                                   suffix_array_algorithm)
+
+    def create(from_data, suffix_array, tofile, patchfile):
+        with open(tofile, 'rb') as fto:
+            with open(patchfile, 'wb') as fpatch:
+                create_patch_sequential(BytesIO(from_data),
+                                        fto,
+                                        fpatch,
+                                        compression,
+                                        suffix_array_algorithm,
+                                        data_format,
+                                        None,
+                                        False,
+                                        heatshrink_window_sz2,
+                                        heatshrink_lookahead_sz2,
+                                        suffix_array)
+
+    def create_with_data_format(fromfile, tofile, patchfile):
+        with open(fromfile, 'rb') as ffrom:
+            create(ffrom.read(), None, tofile, patchfile)
+
+    patches_by_fromfile = {}
+
+    for fromfile, tofile, patchfile in patches:
+        patches_by_fromfile.setdefault(fromfile, []).append((tofile, patchfile))
+
+    with ThreadPoolExecutor(jobs) as executor:
+        futures = []
+
+        if data_format is None:
+            suffix_arrays = {
+                executor.submit(create_suffix_array_of, fromfile): fromfile
+                for fromfile in patches_by_fromfile
+            }
+
+            # Patches of a from file are started as soon as its suffix
+            # array is created.
+            for future in as_completed(suffix_arrays):
+                from_data, suffix_array = future.result()
+                fromfile = suffix_arrays[future]
+
+                for tofile, patchfile in patches_by_fromfile[fromfile]:
+                    futures.append(executor.submit(create,
+                                                   from_data,
+                                                   suffix_array,
+                                                   tofile,
+                                                   patchfile))
+        else:
+            for fromfile, tofile, patchfile in patches:
+                futures.append(executor.submit(create_with_data_format,
+                                               fromfile,
+                                               tofile,
+                                               patchfile))
+
+        for future in futures:
+            future.result()
@@ -8,11 +8,13 @@ from ..errors import Error
 from ..common import DATA_FORMAT_AARCH64
 from ..common import DATA_FORMAT_ARM_CORTEX_M4
 from ..common import DATA_FORMAT_XTENSA_LX106
+from ..common import DATA_FORMAT_XTENSA_ESP32
 from ..common import format_bad_data_format
 from ..common import format_bad_data_format_number
 from . import aarch64
 from . import arm_cortex_m4
 from . import xtensa_lx106
+from . import xtensa_esp32
 
 
 def encode(ffrom, fto, data_format, data_segment):
@@ -28,6 +30,8 @@ def encode(ffrom, fto, data_format, data_segment):
         return arm_cortex_m4.encode(ffrom, fto, data_segment)
     elif data_format == 'xtensa-lx106':
         return xtensa_lx106.encode(ffrom, fto, data_segment)
+    elif data_format == 'xtensa-esp32':
+        return xtensa_esp32.encode(ffrom, fto, data_segment)
     else:
         raise Error(format_bad_data_format(data_format))
 
@@ -43,6 +47,8 @@ def create_readers(data_format, ffrom, patch, to_size):
         return arm_cortex_m4.create_readers(ffrom, patch, to_size)
     elif data_format == DATA_FORMAT_XTENSA_LX106:
         return xtensa_lx106.create_readers(ffrom, patch, to_size)
+    elif data_format == DATA_FORMAT_XTENSA_ESP32:
+        return xtensa_esp32.create_readers(ffrom, patch, to_size)
     else:
         raise Error(format_bad_data_format_number(data_format))
 
@@ -58,5 +64,7 @@ def info(data_format, patch, fsize):
         return arm_cortex_m4.info(patch, fsize)
     elif data_format == DATA_FORMAT_XTENSA_LX106:
         return xtensa_lx106.info(patch, fsize)
+    elif data_format == DATA_FORMAT_XTENSA_ESP32:
+        return xtensa_esp32.info(patch, fsize)
     else:
         raise Error(format_bad_data_format_number(data_format))
@@ -0,0 +1,373 @@
+"""ESP-IDF app images for Xtensa based ESP32 chips.
+
+Instead of values to add to the to-data, the patch is a map from
+from-addresses to to-addresses, found by diffing the images once. The
+from-reader relocates the from-data with it: 32-bit words pointing
+into a mapped range, which are literal pools and pointer tables, and
+CALLn instructions with both ends mapped. The map is small and the
+relocation only needs the bytes around the ones read, so a device
+applies it while streaming the patch.
+
+"""
+
+import struct
+from bisect import bisect_right
+from io import BytesIO
+from io import StringIO
+from contextlib import redirect_stdout
+from ..errors import Error
+from ..common import file_read
+from ..common import pack_size
+from ..common import unpack_size
+from ..suffix_array import divsufsort
+from .. import bsdiff
+from .utils import FromReader as UtilsFromReader
+
+
+ESP_IMAGE_MAGIC = 0xe9
+ESP_IMAGE_HEADER_SIZE = 24
+ESP_IMAGE_SEGMENT_HEADER_SIZE = 8
+
+SEGMENT_KIND_DATA = 0
+SEGMENT_KIND_CODE = 1
+
+# Bus addresses of the images of all ESP chips. Other segments, as the
+# padding ones at address 0, hold no pointers.
+ADDRESS_BEGIN = 0x3c000000
+ADDRESS_END = 0x60000000
+CODE_ADDRESS_BEGIN = 0x40000000
+CODE_ADDRESS_END = 0x50000000
+
+# Segments are relocated in independent windows, so that a window is
+# all that is read around the bytes asked for.
+WINDOW_SIZE = 64
+
+# Shorter matches are not worth a range.
+MINIMUM_RANGE_SIZE = 32
+
+# Neighbouring ranges with the same shift and at most this far apart
+# are merged.
+MAXIMUM_RANGE_GAP = 64
+
+
+def load_segments(data):
+    """Returns the (offset, size, address, kind) of each segment of given
+    image with addresses on the bus.
+
+    """
+
+    if len(data) < ESP_IMAGE_HEADER_SIZE or data[0] != ESP_IMAGE_MAGIC:
+        raise Error('Not an ESP-IDF app image.')
+
+    segments = []
+    offset = ESP_IMAGE_HEADER_SIZE
+
+    for _ in range(data[1]):
+        if offset + ESP_IMAGE_SEGMENT_HEADER_SIZE > len(data):
+            raise Error('Short ESP-IDF app image segment header.')
+
+        address, size = struct.unpack_from('<II', data, offset)
+        offset += ESP_IMAGE_SEGMENT_HEADER_SIZE
+
+        if offset + size > len(data):
+            raise Error('Short ESP-IDF app image segment.')
+
+        if ADDRESS_BEGIN <= address < ADDRESS_END:
+            if CODE_ADDRESS_BEGIN <= address < CODE_ADDRESS_END:
+                kind = SEGMENT_KIND_CODE
+            else:
+                kind = SEGMENT_KIND_DATA
+
+            segments.append((offset, size, address, kind))
+
+        offset += size
+
+    return segments
+
+
+class AddressMap(object):
+
+    def __init__(self, ranges):
+        self._ranges = ranges
+        self._begins = [begin for begin, _, _ in ranges]
+
+    def __call__(self, address):
+        """Returns the to-address of given from-address, or None if not
+        mapped.
+
+        """
+
+        i = bisect_right(self._begins, address) - 1
+
+        if i >= 0:
+            _, end, shift = self._ranges[i]
+
+            if address < end:
+                return address + shift
+
+        return None
+
+
+def relocate_window(data, address, kind, address_map):
+    relocated = bytearray(data)
+    pointers = set()
+
+    for i in range(0, len(data) - 3, 4):
+        value = address_map(struct.unpack_from('<I', data, i)[0])
+
+        if value is not None:
+            struct.pack_into('<I', relocated, i, value & 0xffffffff)
+            pointers.add(i)
+
+    if kind != SEGMENT_KIND_CODE:
+        return relocated
+
+    # A linear sweep, on the instruction lengths of the core and density
+    # options. Pointers are skipped, as they are literals.
+    i = 0
+
+    while i + 3 <= len(data):
+        op0 = (data[i] & 0xf)
+
+        if i in pointers:
+            i += 4
+        elif op0 == 0x5:
+            pc = address + i
+            instruction = int.from_bytes(data[i:i + 3], 'little')
+            offset = (instruction >> 6)
+
+            if offset & 0x20000:
+                offset -= 0x40000
+
+            to_pc = address_map(pc)
+            to_target = address_map((pc & ~3) + (offset << 2) + 4)
+
+            if to_pc is not None and to_target is not None:
+                offset = to_target - ((to_pc & ~3) + 4)
+
+                if offset % 4 == 0 and -0x80000 <= offset < 0x80000:
+                    instruction &= 0x3f
+                    instruction |= (((offset >> 2) & 0x3ffff) << 6)
+                    relocated[i:i + 3] = instruction.to_bytes(3, 'little')
+
+            i += 3
+        elif op0 >= 0x8:
+            i += 2
+        else:
+            i += 3
+
+    return relocated
+
+
+def relocate(data, segments, address_map):
+    relocated = bytearray(data)
+
+    for offset, size, address, kind in segments:
+        for i in range(0, size, WINDOW_SIZE):
+            begin = offset + i
+            end = offset + min(i + WINDOW_SIZE, size)
+            relocated[begin:end] = relocate_window(data[begin:end],
+                                                   address + i,
+                                                   kind,
+                                                   address_map)
+
+    return relocated
+
+
+def iter_diff_blocks(from_data, to_data):
+    """Yields from-offset, to-offset and size of each diff of a bsdiff
+    patch of given data.
+
+    """
+
+    suffix_array = bytearray(4 * (len(from_data) + 1))
+    divsufsort(from_data, suffix_array)
+    chunks = bsdiff.create_patch(suffix_array,
+                                 from_data,
+                                 to_data,
+                                 bytearray(len(to_data) + 1))
+    fpatch = BytesIO(b''.join(chunks))
+    from_offset = 0
+    to_offset = 0
+
+    while to_offset < len(to_data):
+        size = unpack_size(fpatch)
+        fpatch.seek(size, 1)
+        yield from_offset, to_offset, size
+        from_offset += size
+        to_offset += size
+        size = unpack_size(fpatch)
+        fpatch.seek(size, 1)
+        to_offset += size
+        from_offset += unpack_size(fpatch)
+
+
+def find_segment(segments, offset):
+    for segment in segments:
+        if segment[0] <= offset < segment[0] + segment[1]:
+            return segment
+
+    return None
+
+
+def create_ranges(from_data, to_data, from_segments, to_segments):
+    """Returns sorted, non-overlapping from-address ranges and the shift
+    of each to its to-address.
+
+    """
+
+    ranges = []
+
+    for from_offset, to_offset, size in iter_diff_blocks(from_data, to_data):
+        for offset, segment_size, address, kind in from_segments:
+            begin = max(from_offset, offset)
+            end = min(from_offset + size, offset + segment_size)
+
+            if end - begin < MINIMUM_RANGE_SIZE:
+                continue
+
+            to_begin = to_offset + begin - from_offset
+            to_segment = find_segment(to_segments, to_begin)
+
+            if to_segment is None or to_segment[3] != kind:
+                continue
+
+            end = min(end, begin + to_segment[0] + to_segment[1] - to_begin)
+
+            if end - begin < MINIMUM_RANGE_SIZE:
+                continue
+
+            from_address = address + begin - offset
+            to_address = to_segment[2] + to_begin - to_segment[0]
+            ranges.append((from_address,
+                           from_address + end - begin,
+                           to_address - from_address))
+
+    ranges.sort()
+    merged = []
+
+    for begin, end, shift in ranges:
+        if merged:
+            previous_begin, previous_end, previous_shift = merged[-1]
+            begin = max(begin, previous_end)
+
+            if begin >= end:
+                continue
+
+            if (shift == previous_shift
+                and begin - previous_end <= MAXIMUM_RANGE_GAP):
+                merged[-1] = (previous_begin, end, shift)
+                continue
+
+        merged.append((begin, end, shift))
+
+    return merged
+
+
+def pack_patch(segments, ranges):
+    patch = [pack_size(len(segments))]
+
+    for offset, size, address, kind in segments:
+        patch.append(pack_size(offset))
+        patch.append(pack_size(size))
+        patch.append(pack_size(address))
+        patch.append(pack_size(kind))
+
+    patch.append(pack_size(len(ranges)))
+    previous_end = 0
+
+    for begin, end, shift in ranges:
+        patch.append(pack_size(begin - previous_end))
+        patch.append(pack_size(end - begin))
+        patch.append(pack_size(shift))
+        previous_end = end
+
+    return b''.join(patch)
+
+
+def unpack_patch(patch):
+    fpatch = BytesIO(patch)
+    segments = []
+
+    for _ in range(unpack_size(fpatch)):
+        segments.append((unpack_size(fpatch),
+                         unpack_size(fpatch),
+                         unpack_size(fpatch),
+                         unpack_size(fpatch)))
+
+    ranges = []
+    previous_end = 0
+
+    for _ in range(unpack_size(fpatch)):
+        begin = previous_end + unpack_size(fpatch)
+        end = begin + unpack_size(fpatch)
+        ranges.append((begin, end, unpack_size(fpatch)))
+        previous_end = end
+
+    return segments, ranges
+
+
+class FromReader(UtilsFromReader):
+
+    def __init__(self, ffrom, segments, ranges):
+        super().__init__(ffrom)
+        self._ffrom = BytesIO(relocate(file_read(self._ffrom),
+                                       segments,
+                                       AddressMap(ranges)))
+
+
+def encode(ffrom, fto, data_segment):
+    """The data segment is not used, the ranges are found in the segment
+    tables of the images.
+
+    """
+
+    from_data = file_read(ffrom)
+    to_data = file_read(fto)
+    from_segments = load_segments(from_data)
+    ranges = create_ranges(from_data,
+                           to_data,
+                           from_segments,
+                           load_segments(to_data))
+    ffrom = BytesIO(relocate(from_data, from_segments, AddressMap(ranges)))
+
+    return ffrom, BytesIO(to_data), pack_patch(from_segments, ranges)
+
+
+def create_readers(ffrom, patch, to_size):
+    """Return diff and from readers, used when applying a patch. All of
+    the relocation is in the from reader.
+
+    """
+
+    segments, ranges = unpack_patch(patch)
+
+    return None, FromReader(ffrom, segments, ranges)
+
+
+def info(patch, fsize):
+    segments, ranges = unpack_patch(patch)
+    fout = StringIO()
+
+    with redirect_stdout(fout):
+        print('Number of segments: {}'.format(len(segments)))
+        print()
+
+        for offset, size, address, kind in segments:
+            print('Segment:            0x{:08x} {} at offset {} ({})'.format(
+                address,
+                fsize(size),
+                offset,
+                'code' if kind == SEGMENT_KIND_CODE else 'data'))
+
+        print()
+        print('Number of ranges:   {}'.format(len(ranges)))
+        print()
+
+        for begin, end, shift in ranges:
+            print('Range:              0x{:08x}-0x{:08x} {:+d}'.format(
+                begin,
+                end,
+                shift))
+
+    return fout.getvalue()
@@ -72,10 +72,13 @@ static PyObject *create(PyObject *self_p,
     suffix_array_p = (int32_t *)suffix_array_view.buf;
     suffix_array_p[0] = (int32_t)from_view.len;
 
-    /* Execute the SA-IS algorithm. */
+    /* Execute the SA-IS algorithm. The buffers are held by the views,
+       so other threads may run meanwhile. */
+    Py_BEGIN_ALLOW_THREADS
     res = create_callback((uint8_t *)from_view.buf,
                           &suffix_array_p[1],
                           (int32_t)from_view.len);
+    Py_END_ALLOW_THREADS
 
     if (res != 0) {
         goto err2;
@@ -117,6 +117,25 @@ class DetoolsCommandLineTest(unittest.TestCase):
 
         self.execute_and_assert(argv, foo_patch, 'tests/files/foo/patch')
 
+    def test_create_patches_foo(self):
+        foo_patch = 'foo.patch'
+        foo_backwards_patch = 'foo-backwards.patch'
+        argv = [
+            'detools',
+            'create_patches',
+            '--jobs', '2',
+            'tests/files/foo/old',
+            'tests/files/foo/new',
+            foo_patch,
+            'tests/files/foo/new',
+            'tests/files/foo/old',
+            foo_backwards_patch
+        ]
+
+        self.execute_and_assert(argv, foo_patch, 'tests/files/foo/patch')
+        self.assertEqual(read_file(foo_backwards_patch),
+                         read_file('tests/files/foo/backwards.patch'))
+
     def test_apply_patch_foo(self):
         foo_new = 'foo.new'
         argv = [
@@ -3,6 +3,7 @@ from elftools.elf.elffile import ELFFile
 
 from detools.data_format.utils import Blocks
 from detools.data_format import elf
+from detools.data_format import xtensa_esp32
 
 
 class DetoolsDataFormatTest(unittest.TestCase):
@@ -36,6 +37,48 @@ class DetoolsDataFormatTest(unittest.TestCase):
         self.assertEqual(data_range.begin, 0x4027b368)
         self.assertEqual(data_range.end, 0x40293ab8)
 
+    def test_xtensa_esp32_relocate_window(self):
+        address_map = xtensa_esp32.AddressMap([
+            (0x3f400000, 0x3f401000, 0x10),
+            (0x400d0000, 0x400d0180, 0x20),
+            (0x400d0180, 0x400e0000, 0x40)
+        ])
+        # A data pointer, CALL8 to 0x400d0200, RET.N and a NOP.
+        data = (b'\x10\x00\x40\x3f'
+                + b'\xa5\x0f\x00'
+                + b'\x0d\xf0'
+                + b'\x00\x00\x00')
+
+        self.assertEqual(
+            xtensa_esp32.relocate_window(data,
+                                         0x400d0100,
+                                         xtensa_esp32.SEGMENT_KIND_CODE,
+                                         address_map),
+            b'\x20\x00\x40\x3f'
+            + b'\xa5\x11\x00'
+            + b'\x0d\xf0'
+            + b'\x00\x00\x00')
+        self.assertEqual(
+            xtensa_esp32.relocate_window(data,
+                                         0x3f400100,
+                                         xtensa_esp32.SEGMENT_KIND_DATA,
+                                         address_map),
+            b'\x20\x00\x40\x3f' + data[4:])
+
+    def test_xtensa_esp32_pack_patch(self):
+        segments = [
+            (32, 0x100, 0x3f400020, xtensa_esp32.SEGMENT_KIND_DATA),
+            (296, 0x200, 0x400d0020, xtensa_esp32.SEGMENT_KIND_CODE)
+        ]
+        ranges = [
+            (0x3f400020, 0x3f400120, 0),
+            (0x400d0020, 0x400d0100, 16),
+            (0x400d0100, 0x400d0220, -8)
+        ]
+        patch = xtensa_esp32.pack_patch(segments, ranges)
+
+        self.assertEqual(xtensa_esp32.unpack_patch(patch), (segments, ranges))
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -23,13 +23,26 @@ MAGIC_SIZE = 4
 DIGEST_SIZE = 32
 RESERVED_HEADER = 64 - (MAGIC_SIZE + DIGEST_SIZE)
 
-def create_patch(chip: str, base_binary: str, new_binary: str, patch_file_name: str) -> None:
+def create_patch(chip: str, base_binary: str, new_binary: str, patch_file_name: str,
+                 window_sz2: int, lookahead_sz2: int, memory_size: int, segment_size: int,
+                 data_format: str) -> None:
     cmd = "esptool.py --chip " + chip + " image_info " + base_binary
     proc = subprocess.Popen([cmd], stdout=subprocess.PIPE, shell=True)
     (out, err) = proc.communicate()
     x = re.search(b"Validation Hash: ([A-Za-z0-9]+) \(valid\)", out)
 
-    os.system("detools create_patch -c heatshrink " + base_binary + " " + new_binary + " " + patch_file_name)
+    # The sizes must match CONFIG_ESP_DELTA_OTA_HEATSHRINK_WINDOW_BITS and CONFIG_ESP_DELTA_OTA_HEATSHRINK_LOOKAHEAD_BITS
+    # An in place patch applies with esp_delta_ota_in_place_init(), in a partition of memory_size bytes
+    in_place = ""
+    if memory_size:
+        in_place = "_in_place --memory-size " + str(memory_size) + " --segment-size " + str(segment_size)
+    # A firmware aware patch needs CONFIG_ESP_DELTA_OTA_DATA_FORMAT, and the detools of this component
+    data_format_option = ""
+    if data_format:
+        data_format_option = " --data-format " + data_format
+    os.system("detools create_patch" + in_place + " -c heatshrink --heatshrink-window-sz2 " + str(window_sz2) +
+              " --heatshrink-lookahead-sz2 " + str(lookahead_sz2) + data_format_option + " " +
+              base_binary + " " + new_binary + " " + patch_file_name)
     patch_file_without_header = "patch_file_temp.bin"
     os.system("mv " + patch_file_name + " " + patch_file_without_header)
 
@@ -48,10 +61,22 @@ def main() -> None:
     parser.add_argument('--base_binary', help="Path of Base Binary for creating the patch")
     parser.add_argument('--new_binary', help="Path of New Binary for which patch has to be created")
     parser.add_argument('--patch_file_name', help="Patch file path", default="patch.bin")
+    parser.add_argument('--heatshrink_window_sz2', help="Heatshrink window size, log2", type=int, default=8)
+    parser.add_argument('--heatshrink_lookahead_sz2', help="Heatshrink lookahead size, log2", type=int, default=7)
+    parser.add_argument('--in_place_memory_size', help="Create an in place patch for a partition of this size",
+                        type=lambda x: int(x, 0), default=0)
+    parser.add_argument('--in_place_segment_size', help="Segment size of an in place patch, a multiple of the flash sector size",
+                        type=lambda x: int(x, 0), default=0x10000)
+    parser.add_argument('--data_format', help="Relocate the moved code and data of the base binary to make a smaller patch",
+                        choices=['xtensa-esp32'], default=None)
 
     args = parser.parse_args()
+    if args.data_format and args.in_place_memory_size:
+        parser.error("--data_format is not supported for in place patches")
 
-    create_patch(args.chip, args.base_binary, args.new_binary, args.patch_file_name)
+    create_patch(args.chip, args.base_binary, args.new_binary, args.patch_file_name,
+                 args.heatshrink_window_sz2, args.heatshrink_lookahead_sz2,
+                 args.in_place_memory_size, args.in_place_segment_size, args.data_format)
 
 
 if __name__ == '__main__':
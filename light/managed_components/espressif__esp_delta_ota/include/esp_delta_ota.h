@@ -7,7 +7,13 @@
 #pragma once
 
 #include "esp_err.h"
+#include "esp_partition.h"
 #include <esp_idf_version.h>
+#include "sdkconfig.h"
+
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+#include "esp_encrypted_img.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,19 +41,65 @@ typedef struct esp_delta_ota_cfg {
         merged_stream_write_cb_with_user_ctx_t write_cb_with_user_data;     /*!< Write Callback with user data */
         merged_stream_write_cb_t write_cb DEPRECATED_ATTRIBUTE;             /*!< Write Callback */
     };
+    const esp_partition_t *src_partition;   /*!< Partition holding the source image, usually the running one.
+                                                 If set, the source is read from a memory mapped view of it,
+                                                 or from the partition if it cannot be mapped, and read_cb is
+                                                 not used. */
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    const esp_decrypt_cfg_t *decrypt_cfg;   /*!< If set, the patch is fed as an image encrypted by esp_encrypted_img, and
+                                                 decrypted as it is patched. It must stay valid until esp_delta_ota_init()
+                                                 returns. */
+#endif
 } esp_delta_ota_cfg_t;
 
 #undef DEPRECATED_ATTRIBUTE
 
+typedef struct esp_delta_ota_in_place_cfg {
+    const esp_partition_t *partition;   /*!< Partition holding the source image, overwritten by the patched image.
+                                             It must not be the running one, patching in place is done by a
+                                             recovery image or a factory app. */
+    size_t patch_size;                  /*!< Size of the in place patch, made by detools create_patch_in_place */
+    const char *step_key;               /*!< NVS key of the progress, so that patching interrupted by a reset continues
+                                             when the patch is fed again from the start. If NULL, an interrupted
+                                             patching leaves the partition unusable. */
+} esp_delta_ota_in_place_cfg_t;
+
+/**
+ * @brief Where to continue a delta OTA restored from a checkpoint
+ */
+typedef struct esp_delta_ota_resume_info {
+    size_t patch_offset;          /*!< Bytes of patch fed before the checkpoint, feeding continues from here */
+    size_t image_offset;          /*!< Bytes of the patched image written before the checkpoint, the write callback
+                                       continues from here */
+} esp_delta_ota_resume_info_t;
+
 /**
  * @brief Initializes the delta OTA process
  *
+ * With CONFIG_ESP_DELTA_OTA_HDIFFPATCH, the patch is applied by detools or by HDiffPatch, after the patch type in its
+ * header: sequential or hdiffpatch (detools create_patch --type). Both read and write with the callbacks of cfg.
+ *
  * @param[in] cfg pointer to esp_delta_ota_cfg_t structure.
  * @return - NULL   On failure
  *         - esp_delta_ota_handle_t handle
  */
 esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg);
 
+/**
+ * @brief Initializes a delta OTA which patches the source image in place
+ *
+ * The patch is fed and finalized as for esp_delta_ota_init(), the image is written to the partition directly and the
+ * write callback is not used. The segment size of the patch must be a multiple of the flash sector size, and its
+ * memory size at most the size of the partition. So a single application slot is enough, next to a recovery image.
+ *
+ * @note NVS must be initialized if cfg->step_key is set. The progress is kept until the patching completes.
+ *
+ * @param[in] cfg pointer to esp_delta_ota_in_place_cfg_t structure.
+ * @return - NULL   On failure
+ *         - esp_delta_ota_handle_t handle
+ */
+esp_delta_ota_handle_t esp_delta_ota_in_place_init(const esp_delta_ota_in_place_cfg_t *cfg);
+
 /**
  * @brief This function performs the patch applying operation on the source data.
  *
@@ -56,6 +108,7 @@ esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg);
  * @param[in] size      size of patch buffer.
  * @return - ESP_OK
  *         - ESP_ERR_INVALID_ARG
+ *         - ESP_ERR_INVALID_STATE if the decryption of an encrypted patch ended
  *         - ESP_FAIL
  */
 esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size);
@@ -63,11 +116,79 @@ esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t
 /**
  * @brief This function finishes the patch applying operation.
  *
+ * @note An encrypted patch is authenticated here, its patched image must not be booted unless this returns ESP_OK.
+ * @note A hdiffpatch patch is applied here, once all of its diff was fed, and all of its patched image is written.
+ * @note With CONFIG_ESP_DELTA_OTA_IMAGE_SHA256, the patched image is checked against the SHA-256 appended to it.
+ *
  * @param[in] handle    esp_delta_ota_handle_t
  * @return int
  */
 esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t handle);
 
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+/**
+ * @brief Gets the SHA-256 of the patched image, computed as it was written
+ *
+ * For an app image, it is the hash of the image up to its checksum, the digest esptool appends to it and which
+ * esp_partition_get_sha256() returns for the partition written. For other data, it is the hash of all of it.
+ *
+ * @param[in] handle    esp_delta_ota_handle_t, once esp_delta_ota_finalize() returned ESP_OK
+ * @param[out] sha256   32 bytes
+ * @return - ESP_OK
+ *         - ESP_ERR_INVALID_ARG
+ *         - ESP_ERR_INVALID_STATE if the patching did not complete, was resumed from a checkpoint, or was done in place
+ */
+esp_err_t esp_delta_ota_get_image_sha256(esp_delta_ota_handle_t handle, uint8_t sha256[32]);
+#endif
+
+/**
+ * @brief Saves the progress of the delta OTA in NVS, so that it can be resumed after a lost connection or a reset
+ *
+ * Call it between two esp_delta_ota_feed_patch(), for instance every few tens of kilobytes of patch.
+ * All the patched image produced so far has been passed to the write callback when it returns, the caller
+ * makes sure that it is in flash as well.
+ *
+ * @note NVS must be initialized.
+ *
+ * @param[in] handle    esp_delta_ota_handle_t handle
+ * @param[in] key       NVS key of the checkpoint, in the "delta_ota" namespace
+ * @return - ESP_OK
+ *         - ESP_ERR_INVALID_ARG
+ *         - ESP_ERR_INVALID_STATE if the patch header or its data format patch was not processed yet
+ *         - ESP_ERR_NOT_SUPPORTED when patching in place, which resumes from its steps, an encrypted patch or a
+ *           hdiffpatch one
+ *         - ESP_FAIL if the write callback failed
+ *         - error codes of NVS
+ */
+esp_err_t esp_delta_ota_checkpoint(esp_delta_ota_handle_t handle, const char *key);
+
+/**
+ * @brief Restores the progress of a delta OTA saved by esp_delta_ota_checkpoint()
+ *
+ * Call it right after esp_delta_ota_init(), with a configuration for the same source image.
+ * The caller then feeds the patch from info->patch_offset and writes the patched image from info->image_offset.
+ *
+ * @param[in] handle    esp_delta_ota_handle_t handle
+ * @param[in] key       NVS key of the checkpoint
+ * @param[out] info     Where to continue
+ * @return - ESP_OK
+ *         - ESP_ERR_INVALID_ARG
+ *         - ESP_ERR_NOT_FOUND if there is no checkpoint
+ *         - ESP_ERR_INVALID_VERSION if the checkpoint was saved by another build, the OTA starts over
+ *         - ESP_ERR_NOT_SUPPORTED when patching in place or for an encrypted patch
+ *         - ESP_FAIL
+ */
+esp_err_t esp_delta_ota_resume(esp_delta_ota_handle_t handle, const char *key, esp_delta_ota_resume_info_t *info);
+
+/**
+ * @brief Erases a checkpoint, once the delta OTA it belongs to finished or was abandoned
+ *
+ * @param[in] key       NVS key of the checkpoint
+ * @return - ESP_OK, also if there is no checkpoint
+ *         - error codes of NVS
+ */
+esp_err_t esp_delta_ota_checkpoint_erase(const char *key);
+
 /**
  * @brief Clean-up delta ota process
  *
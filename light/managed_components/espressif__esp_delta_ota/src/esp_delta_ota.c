@@ -6,17 +6,199 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
+#include <sys/param.h>
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_partition.h"
+#include "nvs.h"
 
 #include "esp_delta_ota.h"
 #include "detools.h"
 
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define PIPELINE_BLOCK_SIZE     CONFIG_ESP_DELTA_OTA_PIPELINE_BLOCK_SIZE
+#define PIPELINE_BLOCKS         2
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+#include "esp_encrypted_img.h"
+
+/* Encrypted patch is decrypted in slices of at most this size, which bounds the buffer it is decrypted into */
+#define DECRYPT_SLICE_SIZE      CONFIG_ESP_DELTA_OTA_DECRYPT_SLICE_SIZE
+#endif
+
+/* Read ahead from the source partition when it cannot be mapped */
+#define SRC_CACHE_SIZE          SPI_FLASH_SEC_SIZE
+
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+typedef esp_partition_mmap_handle_t src_map_handle_t;
+#else
+typedef spi_flash_mmap_handle_t src_map_handle_t;
+#endif
+
+#define CHECKPOINT_NAMESPACE    "delta_ota"
+#define CHECKPOINT_MAGIC        0x50434f44  // "DOCP"
+
+/* detools parses the header of an in place patch from one piece, the header is at most 26 bytes */
+#define IN_PLACE_HEADER_SIZE    32
+
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+/* DATA_FORMAT_XTENSA_ESP32 of detools */
+#define DATA_FORMAT_XTENSA_ESP32    3
+#define RELOC_MAX_SEGMENTS          16
+#define RELOC_MAX_RANGES            CONFIG_ESP_DELTA_OTA_DATA_FORMAT_MAX_RANGES
+#define RELOC_SEGMENT_KIND_CODE     1
+/* Segments are relocated in windows independent of each other, of the size used by detools */
+#define RELOC_WINDOW_SIZE           64
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+#include "esp_heap_caps.h"
+#include "heatshrink_decoder.h"
+#include "patch.h"
+
+/* Patch type and compressions of the header of detools */
+#define PATCH_TYPE_HDIFFPATCH   2
+#define COMPRESSION_NONE        0
+#define COMPRESSION_HEATSHRINK  4
+/* The header byte, then the sizes of the patched image and of the diff, of at most 5 bytes each */
+#define HPATCH_HEADER_SIZE      11
+#define HPATCH_CACHE_SIZE       CONFIG_ESP_DELTA_OTA_HDIFFPATCH_CACHE_SIZE
+#define HPATCH_MAX_DIFF_SIZE    CONFIG_ESP_DELTA_OTA_HDIFFPATCH_MAX_DIFF_SIZE
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+#include "mbedtls/sha256.h"
+
+/* Layout of an app image, as in esp_app_format.h */
+#define IMAGE_MAGIC             0xe9
+#define IMAGE_HEADER_SIZE       24
+#define IMAGE_SEGMENT_COUNT     1   // offset in the image header
+#define IMAGE_HASH_APPENDED     23
+#define IMAGE_SEGMENT_HDR_SIZE  8
+#define IMAGE_DIGEST_SIZE       32
+#endif
+
 static const char *TAG = "esp_delta_ota";
 
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t addr;
+    uint32_t kind;
+} reloc_segment_t;
+
+typedef struct {
+    uint32_t begin;
+    uint32_t end;
+    int32_t shift;                  // to the address in the patched image
+} reloc_range_t;
+
+/* Address map of a patch of the xtensa-esp32 data format, the source image is relocated with it as it is read */
+typedef struct {
+    uint32_t segments_count;
+    reloc_segment_t segments[RELOC_MAX_SEGMENTS];
+    uint32_t ranges_count;
+    reloc_range_t ranges[RELOC_MAX_RANGES];     // sorted, not overlapping
+} reloc_map_t;
+
+typedef struct {
+    reloc_map_t *map;               // NULL if the patch has no data format
+    size_t values;                  // of the map unpacked so far
+    uint64_t value;                 // being unpacked
+    int bits;
+    bool negative;
+    uint32_t end;                   // of the last range unpacked
+    uint8_t window[RELOC_WINDOW_SIZE];
+    size_t window_offset;           // of the last window relocated
+    size_t window_len;
+} reloc_t;
+#endif
+
+/* With the heatshrink decoder in static memory, the whole state of detools is its apply patch object */
+typedef struct {
+    uint32_t magic;
+    uint32_t state_size;
+    struct detools_apply_patch_t state;
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    reloc_map_t map;                // saved up to the ranges used
+#endif
+} checkpoint_t;
+
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+/*
+ * The diff of a hdiffpatch patch is in the HDIFF13 format of HDiffPatch, whose sections are read side by side while
+ * patching. So the diff is gathered as it is fed, and esp_delta_ota_finalize() patches from it.
+ */
+typedef struct {
+    bool header_done;
+    int compression;
+    size_t to_size;
+    uint8_t *diff;                  // uncompressed
+    size_t diff_size;
+    size_t diff_len;                // gathered so far
+    size_t written;                 // of the patched image
+    heatshrink_decoder decoder;
+    uint8_t cache[HPATCH_CACHE_SIZE];
+} hpatch_t;
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+typedef enum {
+    IMAGE_PART_HEADER,
+    IMAGE_PART_SEGMENT,
+    IMAGE_PART_DIGEST,
+    IMAGE_PART_NONE,                // the rest is hashed up to next, then not hashed
+} image_part_t;
+
+/*
+ * SHA-256 of the patched image as it is written. The image layout is followed, to hash up to the checksum and
+ * gather the digest appended after it, which esp_delta_ota_finalize() compares.
+ */
+typedef struct {
+    mbedtls_sha256_context sha;
+    bool valid;                     // hashed from the first byte of the image
+    bool done;
+    size_t pos;                     // bytes of the image written
+    image_part_t part;
+    size_t next;                    // offset of the part
+    uint8_t buf[IMAGE_DIGEST_SIZE]; // the part, gathered, and then the digest appended
+    size_t len;
+    size_t want;
+    int segments;                   // segment headers left
+    bool hash_appended;
+    uint8_t digest[IMAGE_DIGEST_SIZE];  // once done
+} image_hash_t;
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} pipeline_block_t;
+
+/* The patched image is gathered in one block while the write task writes the other one */
+typedef struct {
+    TaskHandle_t task;
+    QueueHandle_t full;             // blocks to write, NULL asks to signal `drained`
+    QueueHandle_t free;             // blocks written
+    SemaphoreHandle_t drained;
+    pipeline_block_t blocks[PIPELINE_BLOCKS];
+    pipeline_block_t *current;      // block being filled
+    volatile esp_err_t err;         // first error of the write callback
+} pipeline_t;
+#endif
+
 typedef struct esp_delta_ota_ctx {
     void *user_data;
     src_read_cb_t read_cb;
@@ -25,15 +207,202 @@ typedef struct esp_delta_ota_ctx {
         merged_stream_write_cb_t write_cb;
     };
     struct detools_apply_patch_t *apply_patch;
+    struct detools_apply_patch_in_place_t *apply_patch_in_place;    // in place mode instead
+    const esp_partition_t *partition;       // patched in place
+    size_t patch_size;
+    uint8_t header[IN_PLACE_HEADER_SIZE];
+    size_t header_len;
+    char step_key[NVS_KEY_NAME_MAX_SIZE];   // empty if the steps are not kept
+    int step;                               // last step completed
     int src_offset;
+    const esp_partition_t *src_partition;
+    const uint8_t *src_map;         // mapped source partition
+    src_map_handle_t src_map_handle;
+    uint8_t *src_cache;             // or the sector around the last read from it
+    size_t src_cache_offset;
+    size_t src_cache_len;
+    checkpoint_t *checkpoint;       // being saved or restored
+    size_t checkpoint_len;
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    reloc_t reloc;
+#endif
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    pipeline_t pipeline;
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    bool type_known;                // the first byte of the patch was fed
+    hpatch_t *hpatch;               // the patch is applied by HDiffPatch instead of detools
+#endif
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    image_hash_t image_hash;        // updated by the write task with the pipeline
+#endif
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    bool encrypted;
+    esp_decrypt_handle_t decrypt;   // until the authentication tag is checked
+    char *decrypt_buf;              // the patch is decrypted into it and applied from it, for each slice, allocated once
+    bool decrypt_done;              // all of the encrypted patch was fed
+#endif
 } esp_delta_ota_ctx;
 
-static int esp_delta_ota_write_cb(void *arg_p, const uint8_t *buf_p, size_t size)
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+/* Memory of the one delta OTA which can run at a time, so that nothing is taken from the heap */
+typedef struct {
+    bool in_use;
+    esp_delta_ota_ctx ctx;
+    union {
+        struct detools_apply_patch_t apply_patch;
+        struct detools_apply_patch_in_place_t apply_patch_in_place;
+    };
+    uint8_t src_cache[SRC_CACHE_SIZE];
+    checkpoint_t checkpoint;
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    reloc_map_t map;
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    hpatch_t hpatch;
+#endif
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    uint8_t blocks[PIPELINE_BLOCKS][PIPELINE_BLOCK_SIZE];
+    StaticQueue_t full;
+    uint8_t full_storage[(PIPELINE_BLOCKS + 1) * sizeof(pipeline_block_t *)];
+    StaticQueue_t free;
+    uint8_t free_storage[PIPELINE_BLOCKS * sizeof(pipeline_block_t *)];
+    StaticSemaphore_t drained;
+    StaticTask_t task;
+    StackType_t stack[CONFIG_ESP_DELTA_OTA_PIPELINE_TASK_STACK_SIZE];
+#endif
+} static_arena_t;
+
+static static_arena_t s_arena;
+#endif
+
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
+#define image_sha256_starts(sha)            mbedtls_sha256_starts_ret(sha, 0)
+#define image_sha256_update(sha, buf, len)  mbedtls_sha256_update_ret(sha, buf, len)
+#define image_sha256_finish(sha, out)       mbedtls_sha256_finish_ret(sha, out)
+#else
+#define image_sha256_starts(sha)            mbedtls_sha256_starts(sha, 0)
+#define image_sha256_update(sha, buf, len)  mbedtls_sha256_update(sha, buf, len)
+#define image_sha256_finish(sha, out)       mbedtls_sha256_finish(sha, out)
+#endif
+
+static void image_hash_start(image_hash_t *hash)
 {
-    if (size <= 0) {
-        return ESP_ERR_INVALID_ARG;
+    memset(hash, 0, sizeof(*hash));
+    mbedtls_sha256_init(&hash->sha);
+    image_sha256_starts(&hash->sha);
+    hash->valid = true;
+    hash->part = IMAGE_PART_HEADER;
+    hash->want = IMAGE_HEADER_SIZE;
+}
+
+/* A part of the image layout was gathered, sets the next one */
+static void image_hash_part(image_hash_t *hash)
+{
+    const uint8_t *buf = hash->buf;
+    hash->len = 0;
+    switch (hash->part) {
+    case IMAGE_PART_HEADER:
+        if (buf[0] != IMAGE_MAGIC) {
+            /* Not an app image, all of it is hashed */
+            hash->part = IMAGE_PART_NONE;
+            hash->next = SIZE_MAX;
+            return;
+        }
+        hash->segments = buf[IMAGE_SEGMENT_COUNT];
+        hash->hash_appended = buf[IMAGE_HASH_APPENDED] == 1;
+        hash->next = IMAGE_HEADER_SIZE;
+        break;
+    case IMAGE_PART_SEGMENT: {
+        uint32_t len = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+        if (len > SIZE_MAX / 2 - hash->next) {
+            /* Never reached, esp_delta_ota_finalize() reports the image truncated */
+            hash->part = IMAGE_PART_DIGEST;
+            hash->next = SIZE_MAX;
+            return;
+        }
+        hash->next += IMAGE_SEGMENT_HDR_SIZE + len;
+        hash->segments--;
+        break;
     }
-    esp_delta_ota_ctx *handle = (esp_delta_ota_ctx *)arg_p;
+    case IMAGE_PART_DIGEST:
+        /* Nothing after it is hashed */
+        hash->part = IMAGE_PART_NONE;
+        hash->next = 0;
+        return;
+    default:
+        return;
+    }
+    if (hash->segments) {
+        hash->part = IMAGE_PART_SEGMENT;
+        hash->want = IMAGE_SEGMENT_HDR_SIZE;
+        return;
+    }
+    /* The checksum ends the segments on a 16 byte boundary, the digest follows it */
+    hash->next = (hash->next + 16) & ~(size_t)15;
+    if (hash->hash_appended) {
+        hash->part = IMAGE_PART_DIGEST;
+        hash->want = IMAGE_DIGEST_SIZE;
+    } else {
+        hash->part = IMAGE_PART_NONE;
+    }
+}
+
+static void image_hash_update(image_hash_t *hash, const uint8_t *buf, size_t size)
+{
+    if (!hash->valid) {
+        return;
+    }
+    while (size) {
+        size_t n;
+        bool hashed = true;
+        if (hash->pos < hash->next) {
+            n = MIN(size, hash->next - hash->pos);
+        } else if (hash->part == IMAGE_PART_NONE) {
+            /* The padding after the digest is not hashed */
+            hash->pos += size;
+            return;
+        } else {
+            n = MIN(size, hash->want - hash->len);
+            memcpy(hash->buf + hash->len, buf, n);
+            hash->len += n;
+            hashed = hash->part != IMAGE_PART_DIGEST;
+        }
+        if (hashed) {
+            image_sha256_update(&hash->sha, buf, n);
+        }
+        hash->pos += n;
+        buf += n;
+        size -= n;
+        if (hash->len == hash->want) {
+            image_hash_part(hash);
+        }
+    }
+}
+
+/* Compares the hash of the patched image with the digest appended to it */
+static esp_err_t image_hash_finish(image_hash_t *hash)
+{
+    if (!hash->valid) {
+        return ESP_OK;
+    }
+    image_sha256_finish(&hash->sha, hash->digest);
+    if (hash->part != IMAGE_PART_NONE || (hash->next != SIZE_MAX && hash->pos < hash->next)) {
+        ESP_LOGE(TAG, "Patched image is truncated");
+        return ESP_FAIL;
+    }
+    if (hash->hash_appended && memcmp(hash->digest, hash->buf, IMAGE_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Patched image does not match the SHA-256 appended to it");
+        return ESP_FAIL;
+    }
+    hash->done = true;
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_DELTA_OTA_IMAGE_SHA256 */
+
+static esp_err_t esp_delta_ota_user_write(esp_delta_ota_ctx *handle, const uint8_t *buf_p, size_t size)
+{
     esp_err_t err = ESP_OK;
     if (!handle->user_data) {
         err = handle->write_cb(buf_p, size);
@@ -48,8 +417,520 @@ static int esp_delta_ota_write_cb(void *arg_p, const uint8_t *buf_p, size_t size
             return ESP_FAIL;
         }
     }
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    image_hash_update(&handle->image_hash, buf_p, size);
+#endif
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+static void pipeline_task(void *arg)
+{
+    esp_delta_ota_ctx *handle = (esp_delta_ota_ctx *)arg;
+    pipeline_t *pipeline = &handle->pipeline;
+    pipeline_block_t *block;
+
+    while (1) {
+        xQueueReceive(pipeline->full, &block, portMAX_DELAY);
+        if (!block) {
+            xSemaphoreGive(pipeline->drained);
+            continue;
+        }
+        /* Once a write failed, the image is broken and the rest is dropped */
+        if (pipeline->err == ESP_OK) {
+            pipeline->err = esp_delta_ota_user_write(handle, block->buf, block->len);
+        }
+        block->len = 0;
+        xQueueSend(pipeline->free, &block, portMAX_DELAY);
+    }
+}
+
+/* Hands the current block to the write task, and waits for a block to fill if both are in use */
+static void pipeline_submit(pipeline_t *pipeline)
+{
+    xQueueSend(pipeline->full, &pipeline->current, portMAX_DELAY);
+    xQueueReceive(pipeline->free, &pipeline->current, portMAX_DELAY);
+}
+
+/* Waits until the write task wrote all the data gathered so far */
+static esp_err_t pipeline_drain(pipeline_t *pipeline)
+{
+    pipeline_block_t *marker = NULL;
+
+    if (pipeline->current->len) {
+        pipeline_submit(pipeline);
+    }
+    xQueueSend(pipeline->full, &marker, portMAX_DELAY);
+    xSemaphoreTake(pipeline->drained, portMAX_DELAY);
+    return pipeline->err;
+}
+
+static void pipeline_deinit(pipeline_t *pipeline)
+{
+    if (pipeline->task) {
+        /* Idle, waiting for the next block */
+        pipeline_drain(pipeline);
+        vTaskDelete(pipeline->task);
+    }
+    if (pipeline->full) {
+        vQueueDelete(pipeline->full);
+    }
+    if (pipeline->free) {
+        vQueueDelete(pipeline->free);
+    }
+    if (pipeline->drained) {
+        vSemaphoreDelete(pipeline->drained);
+    }
+#if !CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        free(pipeline->blocks[i].buf);
+    }
+#endif
+    memset(pipeline, 0, sizeof(*pipeline));
+}
+
+static esp_err_t pipeline_init(esp_delta_ota_ctx *handle)
+{
+    pipeline_t *pipeline = &handle->pipeline;
+
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    pipeline->full = xQueueCreateStatic(PIPELINE_BLOCKS + 1, sizeof(pipeline_block_t *), s_arena.full_storage, &s_arena.full);
+    pipeline->free = xQueueCreateStatic(PIPELINE_BLOCKS, sizeof(pipeline_block_t *), s_arena.free_storage, &s_arena.free);
+    pipeline->drained = xSemaphoreCreateBinaryStatic(&s_arena.drained);
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        pipeline->blocks[i].buf = s_arena.blocks[i];
+    }
+#else
+    pipeline->full = xQueueCreate(PIPELINE_BLOCKS + 1, sizeof(pipeline_block_t *));
+    pipeline->free = xQueueCreate(PIPELINE_BLOCKS, sizeof(pipeline_block_t *));
+    pipeline->drained = xSemaphoreCreateBinary();
+    if (!pipeline->full || !pipeline->free || !pipeline->drained) {
+        goto err;
+    }
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        pipeline->blocks[i].buf = malloc(PIPELINE_BLOCK_SIZE);
+        if (!pipeline->blocks[i].buf) {
+            goto err;
+        }
+    }
+#endif
+    pipeline->current = &pipeline->blocks[0];
+    pipeline_block_t *block = &pipeline->blocks[1];
+    xQueueSend(pipeline->free, &block, 0);
+
+#if CONFIG_FREERTOS_UNICORE
+    BaseType_t core = tskNO_AFFINITY;
+#else
+    /* Flash writes do not hold up the core applying the patch */
+    BaseType_t core = !xPortGetCoreID();
+#endif
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    pipeline->task = xTaskCreateStaticPinnedToCore(pipeline_task, "delta_ota_wr", CONFIG_ESP_DELTA_OTA_PIPELINE_TASK_STACK_SIZE,
+                                                   handle, CONFIG_ESP_DELTA_OTA_PIPELINE_TASK_PRIORITY, s_arena.stack,
+                                                   &s_arena.task, core);
+    return ESP_OK;
+#else
+    if (xTaskCreatePinnedToCore(pipeline_task, "delta_ota_wr", CONFIG_ESP_DELTA_OTA_PIPELINE_TASK_STACK_SIZE, handle,
+                                CONFIG_ESP_DELTA_OTA_PIPELINE_TASK_PRIORITY, &pipeline->task, core) != pdPASS) {
+        pipeline->task = NULL;
+        goto err;
+    }
     return ESP_OK;
+err:
+    pipeline_deinit(pipeline);
+    return ESP_ERR_NO_MEM;
+#endif
 }
+#endif /* CONFIG_ESP_DELTA_OTA_PIPELINE */
+
+static int esp_delta_ota_write_cb(void *arg_p, const uint8_t *buf_p, size_t size)
+{
+    if (size <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_delta_ota_ctx *handle = (esp_delta_ota_ctx *)arg_p;
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    pipeline_t *pipeline = &handle->pipeline;
+    if (pipeline->err != ESP_OK) {
+        return ESP_FAIL;
+    }
+    while (size) {
+        size_t n = PIPELINE_BLOCK_SIZE - pipeline->current->len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(pipeline->current->buf + pipeline->current->len, buf_p, n);
+        pipeline->current->len += n;
+        buf_p += n;
+        size -= n;
+        if (pipeline->current->len == PIPELINE_BLOCK_SIZE) {
+            pipeline_submit(pipeline);
+        }
+    }
+    return ESP_OK;
+#else
+    return esp_delta_ota_user_write(handle, buf_p, size);
+#endif
+}
+
+static esp_err_t esp_delta_ota_src_read(esp_delta_ota_ctx *handle, uint8_t *buf_p, size_t size, size_t offset)
+{
+    if (offset > handle->src_partition->size || size > handle->src_partition->size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (handle->src_map) {
+        memcpy(buf_p, handle->src_map + offset, size);
+        return ESP_OK;
+    }
+    /* detools reads the source in pieces of at most 128 bytes, mostly one after the other */
+    while (size) {
+        if (offset < handle->src_cache_offset || offset >= handle->src_cache_offset + handle->src_cache_len) {
+            size_t start = offset & ~(SRC_CACHE_SIZE - 1);
+            size_t len = MIN(SRC_CACHE_SIZE, handle->src_partition->size - start);
+            handle->src_cache_len = 0;
+            esp_err_t err = esp_partition_read(handle->src_partition, start, handle->src_cache, len);
+            if (err != ESP_OK) {
+                return err;
+            }
+            handle->src_cache_offset = start;
+            handle->src_cache_len = len;
+        }
+        size_t n = MIN(size, handle->src_cache_offset + handle->src_cache_len - offset);
+        memcpy(buf_p, handle->src_cache + offset - handle->src_cache_offset, n);
+        buf_p += n;
+        offset += n;
+        size -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t esp_delta_ota_src_init(esp_delta_ota_ctx *handle)
+{
+    const void *map;
+    esp_err_t err = esp_partition_mmap(handle->src_partition, 0, handle->src_partition->size,
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+                                       ESP_PARTITION_MMAP_DATA,
+#else
+                                       SPI_FLASH_MMAP_DATA,
+#endif
+                                       &map, &handle->src_map_handle);
+    if (err == ESP_OK) {
+        handle->src_map = map;
+        return ESP_OK;
+    }
+    /* Not enough free MMU pages for the whole partition */
+    ESP_LOGW(TAG, "Unable to map the source partition (%s), reading it instead", esp_err_to_name(err));
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    handle->src_cache = s_arena.src_cache;
+#else
+    handle->src_cache = malloc(SRC_CACHE_SIZE);
+#endif
+    return handle->src_cache ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void esp_delta_ota_src_deinit(esp_delta_ota_ctx *handle)
+{
+    if (handle->src_map) {
+#if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0))
+        esp_partition_munmap(handle->src_map_handle);
+#else
+        spi_flash_munmap(handle->src_map_handle);
+#endif
+        handle->src_map = NULL;
+    }
+#if !CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    free(handle->src_cache);
+#endif
+    handle->src_cache = NULL;
+}
+
+static esp_err_t esp_delta_ota_read_at(esp_delta_ota_ctx *handle, uint8_t *buf_p, size_t size, size_t offset)
+{
+    if (handle->src_partition) {
+        esp_err_t err = esp_delta_ota_src_read(handle, buf_p, size, offset);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error reading the source partition: %s", esp_err_to_name(err));
+        }
+        return err;
+    }
+    esp_err_t err = handle->read_cb(buf_p, size, offset);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error in read_cb(): %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+static reloc_map_t *reloc_map_alloc(void)
+{
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    memset(&s_arena.map, 0, sizeof(s_arena.map));
+    return &s_arena.map;
+#else
+    return calloc(1, sizeof(reloc_map_t));
+#endif
+}
+
+static void reloc_deinit(reloc_t *reloc)
+{
+#if !CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    free(reloc->map);
+#endif
+    reloc->map = NULL;
+    reloc->window_len = 0;
+}
+
+static size_t reloc_map_size(const reloc_map_t *map)
+{
+    return offsetof(reloc_map_t, ranges) + map->ranges_count * sizeof(reloc_range_t);
+}
+
+static bool reloc_address(const reloc_map_t *map, uint32_t addr, uint32_t *to)
+{
+    size_t lo = 0, hi = map->ranges_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (map->ranges[mid].begin <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || addr >= map->ranges[lo - 1].end) {
+        return false;
+    }
+    *to = addr + map->ranges[lo - 1].shift;
+    return true;
+}
+
+/* Same as relocate_window() of detools, the patch is made against its output */
+static void reloc_window(const reloc_map_t *map, const reloc_segment_t *segment, uint32_t addr,
+                         const uint8_t *src, uint8_t *dst, size_t len)
+{
+    uint32_t to;
+    uint16_t pointers = 0;          // one bit per word of the window
+    memcpy(dst, src, len);
+    /* Literal pools and pointer tables */
+    for (size_t i = 0; i + 4 <= len; i += 4) {
+        uint32_t value = src[i] | (src[i + 1] << 8) | (src[i + 2] << 16) | ((uint32_t)src[i + 3] << 24);
+        if (reloc_address(map, value, &to)) {
+            dst[i] = to;
+            dst[i + 1] = to >> 8;
+            dst[i + 2] = to >> 16;
+            dst[i + 3] = to >> 24;
+            pointers |= 1 << (i / 4);
+        }
+    }
+    if (segment->kind != RELOC_SEGMENT_KIND_CODE) {
+        return;
+    }
+    /* CALLn, on the instruction lengths of the core and density options. Pointers are literals, skipped. */
+    for (size_t i = 0; i + 3 <= len;) {
+        uint8_t op0 = src[i] & 0xf;
+        if (i % 4 == 0 && (pointers & (1 << (i / 4)))) {
+            i += 4;
+            continue;
+        }
+        if (op0 != 0x5) {
+            i += op0 >= 0x8 ? 2 : 3;
+            continue;
+        }
+        uint32_t insn = src[i] | (src[i + 1] << 8) | (src[i + 2] << 16);
+        int32_t offset = (int32_t)(insn << 8) >> 14;
+        uint32_t pc = addr + i, to_pc;
+        if (reloc_address(map, pc, &to_pc) && reloc_address(map, (pc & ~3) + offset * 4 + 4, &to)) {
+            int32_t to_offset = (int32_t)(to - ((to_pc & ~3) + 4));
+            if ((to_offset & 3) == 0 && to_offset >= -0x80000 && to_offset < 0x80000) {
+                insn = (insn & 0x3f) | ((((uint32_t)to_offset >> 2) & 0x3ffff) << 6);
+                dst[i] = insn;
+                dst[i + 1] = insn >> 8;
+                dst[i + 2] = insn >> 16;
+            }
+        }
+        i += 3;
+    }
+}
+
+static esp_err_t reloc_read(esp_delta_ota_ctx *handle, uint8_t *buf_p, size_t size, size_t offset)
+{
+    reloc_t *reloc = &handle->reloc;
+    const reloc_map_t *map = reloc->map;
+    while (size) {
+        const reloc_segment_t *segment = NULL;
+        size_t next = SIZE_MAX;
+        for (size_t i = 0; i < map->segments_count; i++) {
+            const reloc_segment_t *s = &map->segments[i];
+            if (offset >= s->offset && offset - s->offset < s->size) {
+                segment = s;
+                break;
+            }
+            if (s->offset > offset && s->offset < next) {
+                next = s->offset;
+            }
+        }
+        size_t n;
+        if (!segment) {
+            /* Headers and padding are not relocated */
+            n = MIN(size, next - offset);
+            esp_err_t err = esp_delta_ota_read_at(handle, buf_p, n, offset);
+            if (err != ESP_OK) {
+                return err;
+            }
+        } else {
+            size_t window = segment->offset + ((offset - segment->offset) & ~(RELOC_WINDOW_SIZE - 1));
+            if (!reloc->window_len || reloc->window_offset != window) {
+                uint8_t src[RELOC_WINDOW_SIZE];
+                size_t len = MIN(RELOC_WINDOW_SIZE, segment->offset + segment->size - window);
+                reloc->window_len = 0;
+                esp_err_t err = esp_delta_ota_read_at(handle, src, len, window);
+                if (err != ESP_OK) {
+                    return err;
+                }
+                reloc_window(map, segment, segment->addr + window - segment->offset, src, reloc->window, len);
+                reloc->window_offset = window;
+                reloc->window_len = len;
+            }
+            n = MIN(size, window + reloc->window_len - offset);
+            memcpy(buf_p, reloc->window + offset - window, n);
+        }
+        buf_p += n;
+        offset += n;
+        size -= n;
+    }
+    return ESP_OK;
+}
+
+static int reloc_store(reloc_t *reloc, int64_t value)
+{
+    reloc_map_t *map = reloc->map;
+    size_t i = reloc->values++;
+
+    if (i == 0) {
+        if (value < 0 || value > RELOC_MAX_SEGMENTS) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        map->segments_count = value;
+        return 0;
+    }
+    i -= 1;
+    if (i < 4 * map->segments_count) {
+        if (value < 0 || value > UINT32_MAX) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        reloc_segment_t *segment = &map->segments[i / 4];
+        switch (i % 4) {
+        case 0:
+            segment->offset = value;
+            break;
+        case 1:
+            segment->size = value;
+            break;
+        case 2:
+            segment->addr = value;
+            break;
+        default:
+            segment->kind = value;
+            break;
+        }
+        return 0;
+    }
+    i -= 4 * map->segments_count;
+    if (i == 0) {
+        if (value < 0) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        if (value > RELOC_MAX_RANGES) {
+            ESP_LOGE(TAG, "The patch has %" PRId64 " address ranges, more than ESP_DELTA_OTA_DATA_FORMAT_MAX_RANGES",
+                     value);
+            return -DETOOLS_OUT_OF_MEMORY;
+        }
+        map->ranges_count = value;
+        return 0;
+    }
+    i -= 1;
+    if (i >= 3 * map->ranges_count) {
+        return -DETOOLS_CORRUPT_PATCH;
+    }
+    reloc_range_t *range = &map->ranges[i / 3];
+    switch (i % 3) {
+    case 0:
+        if (value < 0 || reloc->end + value > UINT32_MAX) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        range->begin = reloc->end + value;
+        break;
+    case 1:
+        if (value <= 0 || range->begin + value > UINT32_MAX) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        range->end = range->begin + value;
+        reloc->end = range->end;
+        break;
+    default:
+        if (value < INT32_MIN || value > INT32_MAX) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        range->shift = value;
+        break;
+    }
+    return 0;
+}
+
+static bool reloc_complete(const reloc_t *reloc)
+{
+    size_t header = 4 * reloc->map->segments_count + 2;
+    return reloc->values >= header && reloc->values == header + 3 * reloc->map->ranges_count && !reloc->bits;
+}
+
+/* Unpacks the map, made of detools sizes, as the patch is fed */
+static int esp_delta_ota_dfpatch_write_cb(void *arg_p, int data_format, const uint8_t *buf_p, size_t size)
+{
+    esp_delta_ota_ctx *handle = (esp_delta_ota_ctx *)arg_p;
+    reloc_t *reloc = &handle->reloc;
+
+    if (data_format != DATA_FORMAT_XTENSA_ESP32) {
+        ESP_LOGE(TAG, "Unsupported data format %d", data_format);
+        return -DETOOLS_NOT_IMPLEMENTED;
+    }
+    if (!reloc->map) {
+        reloc->map = reloc_map_alloc();
+        if (!reloc->map) {
+            return -DETOOLS_OUT_OF_MEMORY;
+        }
+    }
+    if (size == 0) {
+        if (!reloc_complete(reloc)) {
+            return -DETOOLS_CORRUPT_PATCH;
+        }
+        ESP_LOGD(TAG, "Relocating %" PRIu32 " source segments with %" PRIu32 " address ranges",
+                 reloc->map->segments_count, reloc->map->ranges_count);
+        reloc->window_len = 0;
+        return 0;
+    }
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = buf_p[i];
+        if (reloc->bits == 0) {
+            reloc->value = byte & 0x3f;
+            reloc->negative = byte & 0x40;
+            reloc->bits = 6;
+        } else if (reloc->bits > 27) {
+            return -DETOOLS_CORRUPT_PATCH;
+        } else {
+            reloc->value |= (uint64_t)(byte & 0x7f) << reloc->bits;
+            reloc->bits += 7;
+        }
+        if (byte & 0x80) {
+            continue;
+        }
+        reloc->bits = 0;
+        int res = reloc_store(reloc, reloc->negative ? -(int64_t)reloc->value : (int64_t)reloc->value);
+        if (res != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+#endif /* CONFIG_ESP_DELTA_OTA_DATA_FORMAT */
 
 static int esp_delta_ota_read_cb(void *arg_p, uint8_t *buf_p, size_t size)
 {
@@ -57,9 +938,16 @@ static int esp_delta_ota_read_cb(void *arg_p, uint8_t *buf_p, size_t size)
         return -ESP_ERR_INVALID_ARG;
     }
     esp_delta_ota_ctx *handle = (esp_delta_ota_ctx *)arg_p;
-    esp_err_t err = handle->read_cb(buf_p, size, handle->src_offset);
+    esp_err_t err;
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    if (handle->reloc.map) {
+        err = reloc_read(handle, buf_p, size, handle->src_offset);
+    } else
+#endif
+    {
+        err = esp_delta_ota_read_at(handle, buf_p, size, handle->src_offset);
+    }
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error in read_cb(): %s", esp_err_to_name(err));
         return ESP_FAIL;
     }
     handle->src_offset += size;
@@ -73,9 +961,56 @@ static int esp_delta_ota_seek_cb(void *arg_p, int offset)
     return ESP_OK;
 }
 
-esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg)
+static esp_delta_ota_ctx *esp_delta_ota_ctx_alloc(bool in_place)
 {
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    if (s_arena.in_use) {
+        return NULL;
+    }
+    s_arena.in_use = true;
+    memset(&s_arena.ctx, 0, sizeof(s_arena.ctx));
+    if (in_place) {
+        memset(&s_arena.apply_patch_in_place, 0, sizeof(s_arena.apply_patch_in_place));
+        s_arena.ctx.apply_patch_in_place = &s_arena.apply_patch_in_place;
+    } else {
+        memset(&s_arena.apply_patch, 0, sizeof(s_arena.apply_patch));
+        s_arena.ctx.apply_patch = &s_arena.apply_patch;
+    }
+    return &s_arena.ctx;
+#else
     esp_delta_ota_ctx *ctx = calloc(1, sizeof(esp_delta_ota_ctx));
+    if (!ctx) {
+        return NULL;
+    }
+    if (in_place) {
+        ctx->apply_patch_in_place = calloc(1, sizeof(struct detools_apply_patch_in_place_t));
+    } else {
+        ctx->apply_patch = calloc(1, sizeof(struct detools_apply_patch_t));
+    }
+    if (!ctx->apply_patch && !ctx->apply_patch_in_place) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+#endif
+}
+
+static void esp_delta_ota_ctx_free(esp_delta_ota_ctx *ctx)
+{
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    s_arena.in_use = false;
+#else
+    free(ctx->apply_patch);
+    ctx->apply_patch = NULL;
+    free(ctx->apply_patch_in_place);
+    ctx->apply_patch_in_place = NULL;
+    free(ctx);
+#endif
+}
+
+esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg)
+{
+    esp_delta_ota_ctx *ctx = esp_delta_ota_ctx_alloc(false);
     if (!ctx) {
         ESP_LOGE(TAG, "Unable to allocate memory");
         return NULL;
@@ -83,33 +1018,424 @@ esp_delta_ota_handle_t esp_delta_ota_init(esp_delta_ota_cfg_t *cfg)
     ctx->user_data = cfg->user_data;
     ctx->read_cb = cfg->read_cb;
     ctx->write_cb_with_user_data = cfg->write_cb_with_user_data;
-    ctx->apply_patch = calloc(1, sizeof(struct detools_apply_patch_t));
-    if (!ctx->apply_patch) {
+    ctx->src_partition = cfg->src_partition;
+    if (ctx->src_partition && esp_delta_ota_src_init(ctx) != ESP_OK) {
         ESP_LOGE(TAG, "Unable to allocate memory");
-        free(ctx);
-        ctx = NULL;
+        esp_delta_ota_ctx_free(ctx);
+        return NULL;
+    }
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    if (pipeline_init(ctx) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start the write task");
+        esp_delta_ota_src_deinit(ctx);
+        esp_delta_ota_ctx_free(ctx);
         return NULL;
     }
+#endif
     int ret = detools_apply_patch_init(ctx->apply_patch, &esp_delta_ota_read_cb, &esp_delta_ota_seek_cb, 0, &esp_delta_ota_write_cb, ctx);
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    if (ret == 0) {
+        ret = detools_apply_patch_set_dfpatch_write(ctx->apply_patch, &esp_delta_ota_dfpatch_write_cb);
+    }
+#endif
     if (ret < 0) {
         ESP_LOGE(TAG, "Error while initializing delta_ota: %s", detools_error_as_string(ret));
-        free(ctx->apply_patch);
-        ctx->apply_patch = NULL;
-        free(ctx);
-        ctx = NULL;
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+        pipeline_deinit(&ctx->pipeline);
+#endif
+        esp_delta_ota_src_deinit(ctx);
+        esp_delta_ota_ctx_free(ctx);
         return NULL;
     }
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    if (cfg->decrypt_cfg) {
+        ctx->encrypted = true;
+        ctx->decrypt = esp_encrypted_img_decrypt_start(cfg->decrypt_cfg);
+        if (!ctx->decrypt) {
+            ESP_LOGE(TAG, "Unable to start the decryption");
+            esp_delta_ota_deinit(ctx);
+            return NULL;
+        }
+        ctx->decrypt_buf = malloc(ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(DECRYPT_SLICE_SIZE));
+        if (!ctx->decrypt_buf) {
+            ESP_LOGE(TAG, "Unable to allocate the decryption buffer");
+            esp_delta_ota_deinit(ctx);
+            return NULL;
+        }
+    }
+#endif
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    image_hash_start(&ctx->image_hash);
+#endif
     return (esp_delta_ota_handle_t)ctx;
 }
 
-esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size)
+static int esp_delta_ota_mem_read_cb(void *arg_p, void *dst_p, uintptr_t src, size_t size)
 {
-    if (handle == NULL) {
-        return ESP_ERR_INVALID_ARG;
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    esp_err_t err = esp_partition_read(ctx->partition, src, dst_p, size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error reading the partition at 0x%" PRIx32 ": %s", (uint32_t) src, esp_err_to_name(err));
+        return -DETOOLS_IO_FAILED;
     }
-    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
+    return 0;
+}
+
+static int esp_delta_ota_mem_write_cb(void *arg_p, uintptr_t dst, void *src_p, size_t size)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    esp_err_t err = esp_partition_write(ctx->partition, dst, src_p, size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error writing the partition at 0x%" PRIx32 ": %s", (uint32_t) dst, esp_err_to_name(err));
+        return -DETOOLS_IO_FAILED;
+    }
+    return 0;
+}
+
+static int esp_delta_ota_mem_erase_cb(void *arg_p, uintptr_t addr, size_t size)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    /* Segments start on a sector when the segment size of the patch is a multiple of it, the last one may be shorter */
+    if (addr % SPI_FLASH_SEC_SIZE) {
+        ESP_LOGE(TAG, "Segment at 0x%" PRIx32 " is not aligned on a flash sector", (uint32_t) addr);
+        return -DETOOLS_IO_FAILED;
+    }
+    size = MIN((size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1), ctx->partition->size - MIN(addr, ctx->partition->size));
+    esp_err_t err = esp_partition_erase_range(ctx->partition, addr, size);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error erasing the partition at 0x%" PRIx32 ": %s", (uint32_t) addr, esp_err_to_name(err));
+        return -DETOOLS_IO_FAILED;
+    }
+    return 0;
+}
+
+static int esp_delta_ota_step_set_cb(void *arg_p, int step)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CHECKPOINT_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_i32(nvs, ctx->step_key, step);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save the step: %s", esp_err_to_name(err));
+        return -1;
+    }
+    ctx->step = step;
+    return 0;
+}
+
+/* Called for every access to the partition, so the step is read from NVS only once */
+static int esp_delta_ota_step_get_cb(void *arg_p, int *step_p)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    *step_p = ctx->step;
+    return 0;
+}
+
+static esp_err_t esp_delta_ota_step_load(esp_delta_ota_ctx *ctx)
+{
+    nvs_handle_t nvs;
+    int32_t step = 0;
+    esp_err_t err = nvs_open(CHECKPOINT_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_get_i32(nvs, ctx->step_key, &step);
+        nvs_close(nvs);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        step = 0;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+    ctx->step = step;
+    if (step) {
+        ESP_LOGI(TAG, "Resuming the patching in place after step %" PRIi32, step);
+    }
+    return ESP_OK;
+}
+
+esp_delta_ota_handle_t esp_delta_ota_in_place_init(const esp_delta_ota_in_place_cfg_t *cfg)
+{
+    if (!cfg || !cfg->partition || !cfg->patch_size ||
+            (cfg->step_key && strlen(cfg->step_key) >= NVS_KEY_NAME_MAX_SIZE)) {
+        ESP_LOGE(TAG, "Invalid in place configuration");
+        return NULL;
+    }
+    esp_delta_ota_ctx *ctx = esp_delta_ota_ctx_alloc(true);
+    if (!ctx) {
+        ESP_LOGE(TAG, "Unable to allocate memory");
+        return NULL;
+    }
+    ctx->partition = cfg->partition;
+    ctx->patch_size = cfg->patch_size;
+    if (cfg->step_key) {
+        strcpy(ctx->step_key, cfg->step_key);
+        esp_err_t err = esp_delta_ota_step_load(ctx);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to read the step: %s", esp_err_to_name(err));
+            esp_delta_ota_ctx_free(ctx);
+            return NULL;
+        }
+    }
+    int ret = detools_apply_patch_in_place_init(ctx->apply_patch_in_place, &esp_delta_ota_mem_read_cb,
+                                                &esp_delta_ota_mem_write_cb, &esp_delta_ota_mem_erase_cb,
+                                                cfg->step_key ? &esp_delta_ota_step_set_cb : NULL,
+                                                cfg->step_key ? &esp_delta_ota_step_get_cb : NULL,
+                                                cfg->patch_size, ctx);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Error while initializing delta_ota: %s", detools_error_as_string(ret));
+        esp_delta_ota_ctx_free(ctx);
+        return NULL;
+    }
+    return (esp_delta_ota_handle_t)ctx;
+}
+
+static esp_err_t esp_delta_ota_in_place_feed_patch(esp_delta_ota_ctx *ctx, const uint8_t *buf, size_t size)
+{
+    int err;
+    if (ctx->header_len < MIN(IN_PLACE_HEADER_SIZE, ctx->patch_size)) {
+        size_t n = MIN(size, IN_PLACE_HEADER_SIZE - ctx->header_len);
+        memcpy(ctx->header + ctx->header_len, buf, n);
+        ctx->header_len += n;
+        buf += n;
+        size -= n;
+        if (ctx->header_len < MIN(IN_PLACE_HEADER_SIZE, ctx->patch_size)) {
+            return ESP_OK;
+        }
+        err = detools_apply_patch_in_place_process(ctx->apply_patch_in_place, ctx->header, ctx->header_len);
+        if (err != 0) {
+            goto exit;
+        }
+    }
+    err = detools_apply_patch_in_place_process(ctx->apply_patch_in_place, buf, size);
+exit:
+    if (err != 0) {
+        ESP_LOGE(TAG, "Error while applying patch: %s", detools_error_as_string(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+static hpatch_t *hpatch_alloc(void)
+{
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    memset(&s_arena.hpatch, 0, sizeof(s_arena.hpatch));
+    return &s_arena.hpatch;
+#else
+    return calloc(1, sizeof(hpatch_t));
+#endif
+}
+
+static void hpatch_free(hpatch_t *hpatch)
+{
+    if (!hpatch) {
+        return;
+    }
+    heap_caps_free(hpatch->diff);
+    hpatch->diff = NULL;
+#if !CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    free(hpatch);
+#endif
+}
+
+/*
+ * Unpacks a size of the header at `*offset`: the first byte has the sign and 6 bits of the value, the next ones 7 bits,
+ * as long as the top bit is set. Returns 1 when complete, 0 when more bytes are needed, -1 if it is not a valid size.
+ */
+static int hpatch_unpack_size(const uint8_t *buf, size_t len, size_t *offset, size_t *size)
+{
+    size_t i = *offset;
+    if (i >= len) {
+        return 0;
+    }
+    if (buf[i] & 0x40) {
+        return -1;
+    }
+    uint32_t value = buf[i] & 0x3f;
+    int shift = 6;
+    while (buf[i] & 0x80) {
+        if (++i >= len) {
+            return 0;
+        }
+        if (shift >= 32 || ((buf[i] & 0x7f) >> (32 - shift)) != 0) {
+            return -1;
+        }
+        value |= (uint32_t)(buf[i] & 0x7f) << shift;
+        shift += 7;
+    }
+    *offset = i + 1;
+    *size = value;
+    return 1;
+}
+
+static esp_err_t hpatch_parse_header(esp_delta_ota_ctx *ctx)
+{
+    hpatch_t *hpatch = ctx->hpatch;
+    size_t offset = 1;
+    int ret = hpatch_unpack_size(ctx->header, ctx->header_len, &offset, &hpatch->to_size);
+    if (ret > 0) {
+        ret = hpatch_unpack_size(ctx->header, ctx->header_len, &offset, &hpatch->diff_size);
+    }
+    if (ret == 0 && ctx->header_len < HPATCH_HEADER_SIZE) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+    if (ret <= 0) {
+        ESP_LOGE(TAG, "Corrupt patch header");
+        return ESP_FAIL;
+    }
+    hpatch->compression = ctx->header[0] & 0xf;
+    if (hpatch->compression != COMPRESSION_NONE && hpatch->compression != COMPRESSION_HEATSHRINK) {
+        ESP_LOGE(TAG, "Unsupported compression %d of the patch", hpatch->compression);
+        return ESP_FAIL;
+    }
+    if (hpatch->diff_size > HPATCH_MAX_DIFF_SIZE) {
+        ESP_LOGE(TAG, "Diff of %u bytes is larger than CONFIG_ESP_DELTA_OTA_HDIFFPATCH_MAX_DIFF_SIZE",
+                 (unsigned) hpatch->diff_size);
+        return ESP_FAIL;
+    }
+    if (hpatch->diff_size) {
+        /* In PSRAM if there is some, the diff is only read once complete */
+        hpatch->diff = heap_caps_malloc_prefer(hpatch->diff_size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+        if (!hpatch->diff) {
+            ESP_LOGE(TAG, "Unable to allocate %u bytes for the diff", (unsigned) hpatch->diff_size);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    heatshrink_decoder_reset(&hpatch->decoder);
+    hpatch->header_done = true;
+    return ESP_OK;
+}
+
+static esp_err_t hpatch_feed_patch(esp_delta_ota_ctx *ctx, const uint8_t *buf, size_t size)
+{
+    hpatch_t *hpatch = ctx->hpatch;
+
+    /* The header is parsed again for each byte until its sizes are complete */
+    while (size && !hpatch->header_done) {
+        ctx->header[ctx->header_len++] = *buf++;
+        size--;
+        esp_err_t err = hpatch_parse_header(ctx);
+        if (err != ESP_OK && err != ESP_ERR_NOT_FINISHED) {
+            return err;
+        }
+    }
+    if (!hpatch->header_done) {
+        return ESP_OK;
+    }
+    if (hpatch->compression == COMPRESSION_NONE) {
+        size_t n = MIN(size, hpatch->diff_size - hpatch->diff_len);
+        memcpy(hpatch->diff + hpatch->diff_len, buf, n);
+        hpatch->diff_len += n;
+        return ESP_OK;
+    }
+    /* Once the diff is complete, what is left is the padding of the last byte */
+    while (size && hpatch->diff_len < hpatch->diff_size) {
+        size_t n;
+        if (heatshrink_decoder_sink(&hpatch->decoder, (uint8_t *)buf, size, &n) < 0) {
+            return ESP_FAIL;
+        }
+        buf += n;
+        size -= n;
+        HSD_poll_res res;
+        do {
+            res = heatshrink_decoder_poll(&hpatch->decoder, hpatch->diff + hpatch->diff_len,
+                                          hpatch->diff_size - hpatch->diff_len, &n);
+            if (res < 0) {
+                ESP_LOGE(TAG, "Corrupt compressed patch");
+                return ESP_FAIL;
+            }
+            hpatch->diff_len += n;
+        } while (res == HSDR_POLL_MORE && hpatch->diff_len < hpatch->diff_size);
+    }
+    return ESP_OK;
+}
+
+static hpatch_BOOL hpatch_read_old(const hpatch_TStreamInput *stream, hpatch_StreamPos_t pos, unsigned char *data,
+                                   unsigned char *data_end)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)stream->streamImport;
+    return esp_delta_ota_read_at(ctx, data, data_end - data, pos) == ESP_OK;
+}
+
+static hpatch_BOOL hpatch_write_new(const hpatch_TStreamOutput *stream, hpatch_StreamPos_t pos,
+                                    const unsigned char *data, const unsigned char *data_end)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)stream->streamImport;
+    /* HDiffPatch writes the patched image in order, the write callback cannot seek */
+    if (pos != ctx->hpatch->written || esp_delta_ota_write_cb(ctx, data, data_end - data) != ESP_OK) {
+        return hpatch_FALSE;
+    }
+    ctx->hpatch->written += data_end - data;
+    return hpatch_TRUE;
+}
+
+static esp_err_t hpatch_finalize(esp_delta_ota_ctx *ctx)
+{
+    hpatch_t *hpatch = ctx->hpatch;
 
-    int err = detools_apply_patch_process(ctx->apply_patch, (const uint8_t *)buf, size);
+    if (!hpatch->header_done || hpatch->diff_len < hpatch->diff_size) {
+        ESP_LOGE(TAG, "Patch is incomplete");
+        return ESP_FAIL;
+    }
+    if (hpatch->to_size == 0) {
+        return ESP_OK;
+    }
+    hpatch_TStreamInput diff_stream;
+    hpatch_compressedDiffInfo info;
+    mem_as_hStreamInput(&diff_stream, hpatch->diff, hpatch->diff + hpatch->diff_size);
+    /* The sections of the diff of detools are not compressed, the whole patch is */
+    if (!getCompressedDiffInfo(&info, &diff_stream) || info.newDataSize != hpatch->to_size ||
+            info.compressedCount != 0) {
+        ESP_LOGE(TAG, "Corrupt diff");
+        return ESP_FAIL;
+    }
+    if (ctx->src_partition && info.oldDataSize > ctx->src_partition->size) {
+        ESP_LOGE(TAG, "Source image of the patch is larger than the source partition");
+        return ESP_FAIL;
+    }
+    hpatch_TStreamInput old_stream = {
+        .streamImport = ctx,
+        .streamSize = info.oldDataSize,
+        .read = hpatch_read_old,
+    };
+    hpatch_TStreamOutput new_stream = {
+        .streamImport = ctx,
+        .streamSize = hpatch->to_size,
+        .write = hpatch_write_new,
+    };
+    if (!patch_decompress_with_cache(&new_stream, &old_stream, &diff_stream, NULL, hpatch->cache,
+                                     hpatch->cache + HPATCH_CACHE_SIZE)) {
+        ESP_LOGE(TAG, "Error while applying patch");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_DELTA_OTA_HDIFFPATCH */
+
+static esp_err_t esp_delta_ota_apply(esp_delta_ota_ctx *ctx, const uint8_t *buf, size_t size)
+{
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    /* The engine is chosen from the patch type of the header */
+    if (!ctx->type_known && size) {
+        ctx->type_known = true;
+        if (((buf[0] >> 4) & 0x7) == PATCH_TYPE_HDIFFPATCH) {
+            ctx->hpatch = hpatch_alloc();
+            if (!ctx->hpatch) {
+                ESP_LOGE(TAG, "Unable to allocate memory");
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    if (ctx->hpatch) {
+        return hpatch_feed_patch(ctx, buf, size);
+    }
+#endif
+    int err = detools_apply_patch_process(ctx->apply_patch, buf, size);
     if (err != 0) {
         ESP_LOGE(TAG, "Error while applying patch: %s", detools_error_as_string(err));
         return ESP_FAIL;
@@ -117,6 +1443,61 @@ esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t
     return ESP_OK;
 }
 
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+/*
+ * Each slice is decrypted into the same buffer, allocated for the largest slice by esp_delta_ota_init(), and patched
+ * from there. The patch is not authenticated before esp_delta_ota_finalize().
+ */
+static esp_err_t esp_delta_ota_decrypt_feed_patch(esp_delta_ota_ctx *ctx, const uint8_t *buf, size_t size)
+{
+    if (!ctx->decrypt) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    while (size) {
+        if (ctx->decrypt_done) {
+            ESP_LOGE(TAG, "Data past the end of the encrypted patch");
+            return ESP_FAIL;
+        }
+        pre_enc_decrypt_arg_t args = {
+            .data_in = (const char *)buf,
+            .data_in_len = MIN(size, DECRYPT_SLICE_SIZE),
+            .data_out = ctx->decrypt_buf,
+        };
+        esp_err_t err = esp_encrypted_img_decrypt_data_to_buf(ctx->decrypt, &args,
+                                                              ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(DECRYPT_SLICE_SIZE));
+        if (err != ESP_OK && err != ESP_ERR_NOT_FINISHED) {
+            ESP_LOGE(TAG, "Error while decrypting patch: %s", esp_err_to_name(err));
+            return ESP_FAIL;
+        }
+        ctx->decrypt_done = err == ESP_OK;
+        if (args.data_out_len && esp_delta_ota_apply(ctx, (const uint8_t *)args.data_out, args.data_out_len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        buf += args.data_in_len;
+        size -= args.data_in_len;
+    }
+    return ESP_OK;
+}
+#endif
+
+esp_err_t esp_delta_ota_feed_patch(esp_delta_ota_handle_t handle, const uint8_t *buf, int size)
+{
+    if (handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
+
+    if (ctx->apply_patch_in_place) {
+        return esp_delta_ota_in_place_feed_patch(ctx, buf, size);
+    }
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    if (ctx->encrypted) {
+        return esp_delta_ota_decrypt_feed_patch(ctx, buf, size);
+    }
+#endif
+    return esp_delta_ota_apply(ctx, buf, size);
+}
+
 esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t handle)
 {
     if (handle == NULL) {
@@ -124,13 +1505,321 @@ esp_err_t esp_delta_ota_finalize(esp_delta_ota_handle_t handle)
     }
     esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
 
+    if (ctx->apply_patch_in_place) {
+        int err = 0;
+        if (ctx->header_len < MIN(IN_PLACE_HEADER_SIZE, ctx->patch_size)) {
+            /* Shorter than the header, detools reports it */
+            err = detools_apply_patch_in_place_process(ctx->apply_patch_in_place, ctx->header, ctx->header_len);
+        }
+        int ret = detools_apply_patch_in_place_finalize(ctx->apply_patch_in_place);
+        if (err < 0 || ret < 0) {
+            ESP_LOGE(TAG, "Error while finishing the patching: %s", detools_error_as_string(err < 0 ? err : ret));
+            return ESP_FAIL;
+        }
+        return ESP_OK;
+    }
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    if (ctx->encrypted) {
+        if (!ctx->decrypt || !esp_encrypted_img_is_complete_data_received(ctx->decrypt)) {
+            ESP_LOGE(TAG, "Encrypted patch is incomplete");
+            return ESP_FAIL;
+        }
+        /* Ends the decryption whatever the result */
+        esp_err_t ret = esp_encrypted_img_decrypt_end(ctx->decrypt);
+        ctx->decrypt = NULL;
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Encrypted patch failed authentication");
+            return ESP_FAIL;
+        }
+    }
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    if (ctx->hpatch) {
+        esp_err_t ret = hpatch_finalize(ctx);
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+        if (pipeline_drain(&ctx->pipeline) != ESP_OK) {
+            ret = ESP_FAIL;
+        }
+#endif
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+        if (ret == ESP_OK) {
+            ret = image_hash_finish(&ctx->image_hash);
+        }
+#endif
+        return ret;
+    }
+#endif
     int err = detools_apply_patch_finalize(ctx->apply_patch);
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    /* The image is complete only once written */
+    if (pipeline_drain(&ctx->pipeline) != ESP_OK) {
+        err = -DETOOLS_IO_FAILED;
+    }
+#endif
     if (err < 0) {
         ESP_LOGE(TAG, "Error while finishing the patching: %s", detools_error_as_string(err));
         return ESP_FAIL;
     }
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    return image_hash_finish(&ctx->image_hash);
+#else
+    return ESP_OK;
+#endif
+}
+
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+esp_err_t esp_delta_ota_get_image_sha256(esp_delta_ota_handle_t handle, uint8_t sha256[32])
+{
+    if (handle == NULL || sha256 == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
+
+    if (!ctx->image_hash.done) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    memcpy(sha256, ctx->image_hash.digest, IMAGE_DIGEST_SIZE);
     return ESP_OK;
 }
+#endif
+
+static checkpoint_t *esp_delta_ota_checkpoint_alloc(void)
+{
+#if CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    memset(&s_arena.checkpoint, 0, sizeof(s_arena.checkpoint));
+    return &s_arena.checkpoint;
+#else
+    return calloc(1, sizeof(checkpoint_t));
+#endif
+}
+
+static void esp_delta_ota_checkpoint_free(checkpoint_t *checkpoint)
+{
+#if !CONFIG_ESP_DELTA_OTA_STATIC_ALLOC
+    free(checkpoint);
+#endif
+}
+
+/* The address map is restored with the state, as it is at the start of the patch */
+static size_t esp_delta_ota_checkpoint_size(const checkpoint_t *checkpoint)
+{
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    return offsetof(checkpoint_t, map) + reloc_map_size(&checkpoint->map);
+#else
+    return offsetof(checkpoint_t, state) + checkpoint->state_size;
+#endif
+}
+
+static int esp_delta_ota_state_write_cb(void *arg_p, const void *buf_p, size_t size)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    if (size > sizeof(ctx->checkpoint->state) - ctx->checkpoint_len) {
+        return -DETOOLS_NOT_IMPLEMENTED;
+    }
+    memcpy((uint8_t *)&ctx->checkpoint->state + ctx->checkpoint_len, buf_p, size);
+    ctx->checkpoint_len += size;
+    return 0;
+}
+
+static int esp_delta_ota_state_read_cb(void *arg_p, void *buf_p, size_t size)
+{
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)arg_p;
+    if (size > ctx->checkpoint->state_size - ctx->checkpoint_len) {
+        return -DETOOLS_IO_FAILED;
+    }
+    memcpy(buf_p, (uint8_t *)&ctx->checkpoint->state + ctx->checkpoint_len, size);
+    ctx->checkpoint_len += size;
+    return 0;
+}
+
+esp_err_t esp_delta_ota_checkpoint(esp_delta_ota_handle_t handle, const char *key)
+{
+    if (handle == NULL || key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
+
+    /* Patching in place resumes from its steps */
+    if (ctx->apply_patch_in_place) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    /* The GCM state of the decryption cannot be saved */
+    if (ctx->encrypted) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    /* The diff is gathered in RAM */
+    if (ctx->hpatch) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    /* The header and the data format patch are parsed in steps which are not part of the dump */
+    if (ctx->apply_patch->state == detools_apply_patch_state_init_t ||
+            ctx->apply_patch->state == detools_apply_patch_state_dfpatch_data_format_t ||
+            ctx->apply_patch->state == detools_apply_patch_state_dfpatch_data_t) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    /* The image offset of the checkpoint must have been written */
+    if (pipeline_drain(&ctx->pipeline) != ESP_OK) {
+        return ESP_FAIL;
+    }
+#endif
+    ctx->checkpoint = esp_delta_ota_checkpoint_alloc();
+    if (!ctx->checkpoint) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->checkpoint_len = 0;
+    int ret = detools_apply_patch_dump(ctx->apply_patch, &esp_delta_ota_state_write_cb);
+    esp_err_t err = ESP_FAIL;
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Error while saving the patch state: %s", detools_error_as_string(ret));
+        goto exit;
+    }
+    ctx->checkpoint->magic = CHECKPOINT_MAGIC;
+    ctx->checkpoint->state_size = ctx->checkpoint_len;
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    if (ctx->reloc.map) {
+        memcpy(&ctx->checkpoint->map, ctx->reloc.map, reloc_map_size(ctx->reloc.map));
+    }
+#endif
+
+    nvs_handle_t nvs;
+    err = nvs_open(CHECKPOINT_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        goto exit;
+    }
+    err = nvs_set_blob(nvs, key, ctx->checkpoint, esp_delta_ota_checkpoint_size(ctx->checkpoint));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err == ESP_OK) {
+        ESP_LOGD(TAG, "Checkpoint at patch offset %u, image offset %u",
+                 (unsigned) ctx->checkpoint->state.patch_offset, (unsigned) ctx->checkpoint->state.to_offset);
+    }
+exit:
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to save the checkpoint: %s", esp_err_to_name(err));
+    }
+    esp_delta_ota_checkpoint_free(ctx->checkpoint);
+    ctx->checkpoint = NULL;
+    return err;
+}
+
+esp_err_t esp_delta_ota_resume(esp_delta_ota_handle_t handle, const char *key, esp_delta_ota_resume_info_t *info)
+{
+    if (handle == NULL || key == NULL || info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
+
+    if (ctx->apply_patch_in_place) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    if (ctx->encrypted) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    if (ctx->type_known) {
+        ESP_LOGE(TAG, "Resume before feeding the patch");
+        return ESP_ERR_INVALID_ARG;
+    }
+#endif
+    if (ctx->apply_patch->state != detools_apply_patch_state_init_t || ctx->apply_patch->patch_offset) {
+        ESP_LOGE(TAG, "Resume before feeding the patch");
+        return ESP_ERR_INVALID_ARG;
+    }
+    ctx->checkpoint = esp_delta_ota_checkpoint_alloc();
+    if (!ctx->checkpoint) {
+        return ESP_ERR_NO_MEM;
+    }
+    nvs_handle_t nvs;
+    size_t len = sizeof(checkpoint_t);
+    esp_err_t err = nvs_open(CHECKPOINT_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs, key, ctx->checkpoint, &len);
+        nvs_close(nvs);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_ERR_NOT_FOUND;
+        goto exit;
+    }
+    /* A checkpoint of another build does not have the same layout */
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && (len < offsetof(checkpoint_t, state) + sizeof(ctx->checkpoint->state) ||
+            ctx->checkpoint->magic != CHECKPOINT_MAGIC || ctx->checkpoint->state_size != sizeof(ctx->checkpoint->state) ||
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+            len < offsetof(checkpoint_t, map.ranges) || ctx->checkpoint->map.ranges_count > RELOC_MAX_RANGES ||
+#endif
+            len != esp_delta_ota_checkpoint_size(ctx->checkpoint)))) {
+        ESP_LOGW(TAG, "Discarding the checkpoint of another build");
+        err = ESP_ERR_INVALID_VERSION;
+        goto exit;
+    }
+    if (err != ESP_OK) {
+        goto exit;
+    }
+    ctx->checkpoint_len = 0;
+    int ret = detools_apply_patch_restore(ctx->apply_patch, &esp_delta_ota_state_read_cb);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Error while restoring the patch state: %s", detools_error_as_string(ret));
+        err = ESP_FAIL;
+        goto exit;
+    }
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    if (ctx->checkpoint->map.segments_count) {
+        ctx->reloc.map = reloc_map_alloc();
+        if (!ctx->reloc.map) {
+            err = ESP_ERR_NO_MEM;
+            goto exit;
+        }
+        memcpy(ctx->reloc.map, &ctx->checkpoint->map, reloc_map_size(&ctx->checkpoint->map));
+    }
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    /* Feeding continues within a detools patch */
+    ctx->type_known = true;
+#endif
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    /* The image written before the checkpoint is not written again, it cannot be hashed */
+    ctx->image_hash.valid = false;
+#endif
+    info->patch_offset = detools_apply_patch_get_patch_offset(ctx->apply_patch);
+    info->image_offset = detools_apply_patch_get_to_offset(ctx->apply_patch);
+    ESP_LOGI(TAG, "Resuming at patch offset %u, image offset %u", (unsigned) info->patch_offset,
+             (unsigned) info->image_offset);
+exit:
+    esp_delta_ota_checkpoint_free(ctx->checkpoint);
+    ctx->checkpoint = NULL;
+    return err;
+}
+
+esp_err_t esp_delta_ota_checkpoint_erase(const char *key)
+{
+    if (key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CHECKPOINT_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_erase_key(nvs, key);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    nvs_close(nvs);
+    return err;
+}
 
 esp_err_t esp_delta_ota_deinit(esp_delta_ota_handle_t handle)
 {
@@ -139,9 +1828,25 @@ esp_err_t esp_delta_ota_deinit(esp_delta_ota_handle_t handle)
     }
     esp_delta_ota_ctx *ctx = (esp_delta_ota_ctx *)handle;
 
-    free(ctx->apply_patch);
-    ctx->apply_patch = NULL;
-    free(ctx);
-    ctx = NULL;
+#if CONFIG_ESP_DELTA_OTA_PIPELINE
+    pipeline_deinit(&ctx->pipeline);
+#endif
+#if CONFIG_ESP_DELTA_OTA_DATA_FORMAT
+    reloc_deinit(&ctx->reloc);
+#endif
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+    hpatch_free(ctx->hpatch);
+#endif
+#if CONFIG_ESP_DELTA_OTA_ENCRYPTED
+    if (ctx->decrypt) {
+        esp_encrypted_img_decrypt_abort(ctx->decrypt);
+    }
+    free(ctx->decrypt_buf);
+#endif
+#if CONFIG_ESP_DELTA_OTA_IMAGE_SHA256
+    mbedtls_sha256_free(&ctx->image_hash.sha);
+#endif
+    esp_delta_ota_src_deinit(ctx);
+    esp_delta_ota_ctx_free(ctx);
     return ESP_OK;
 }
@@ -6,9 +6,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 #include <freertos/FreeRTOS.h>
 
 #include "unity.h"
+#include "nvs_flash.h"
 #include "esp_delta_ota.h"
 
 
@@ -20,6 +22,8 @@ extern const uint8_t patch_bin_start[] asm("_binary_patch_bin_start");
 extern const uint8_t patch_bin_end[]   asm("_binary_patch_bin_end");
 extern const uint8_t bad_patch_bin_start[] asm("_binary_bad_patch_bin_start");
 extern const uint8_t bad_patch_bin_end[]   asm("_binary_bad_patch_bin_end");
+extern const uint8_t hdiffpatch_patch_bin_start[] asm("_binary_hdiffpatch_patch_bin_start");
+extern const uint8_t hdiffpatch_patch_bin_end[]   asm("_binary_hdiffpatch_patch_bin_end");
 
 static uint8_t output_buffer[1300] = {0};
 static int output_index = 0;
@@ -116,3 +120,71 @@ TEST_CASE("Sending 1 byte of patch at once", "[esp_delta_ota]")
 
     TEST_ASSERT_EQUAL_INT(0, memcmp(new_bin_start, output_buffer, output_index));
 }
+
+TEST_CASE("Resuming from a checkpoint", "[esp_delta_ota]")
+{
+    memset(output_buffer, 0, 1000);
+    output_index = 0;
+    TEST_ESP_OK(nvs_flash_init());
+    TEST_ESP_OK(esp_delta_ota_checkpoint_erase("test"));
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = &read_cb,
+        .write_cb = &write_cb,
+    };
+
+    esp_delta_ota_handle_t handle = esp_delta_ota_init(&cfg);
+    TEST_ASSERT_NOT_NULL(handle);
+    esp_delta_ota_resume_info_t info;
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_delta_ota_resume(handle, "test", &info));
+
+    int patch_size = patch_bin_end - patch_bin_start;
+    int half = patch_size / 2;
+    TEST_ESP_OK(esp_delta_ota_feed_patch(handle, patch_bin_start, half));
+    TEST_ESP_OK(esp_delta_ota_checkpoint(handle, "test"));
+    /* Lost connection after some more data */
+    TEST_ESP_OK(esp_delta_ota_feed_patch(handle, patch_bin_start + half, (patch_size - half) / 2));
+    TEST_ESP_OK(esp_delta_ota_deinit(handle));
+
+    handle = esp_delta_ota_init(&cfg);
+    TEST_ASSERT_NOT_NULL(handle);
+    TEST_ESP_OK(esp_delta_ota_resume(handle, "test", &info));
+    TEST_ASSERT_EQUAL(half, info.patch_offset);
+    TEST_ASSERT_LESS_OR_EQUAL(output_index, info.image_offset);
+    output_index = info.image_offset;
+
+    TEST_ESP_OK(esp_delta_ota_feed_patch(handle, patch_bin_start + info.patch_offset, patch_size - info.patch_offset));
+    TEST_ESP_OK(esp_delta_ota_finalize(handle));
+    TEST_ESP_OK(esp_delta_ota_deinit(handle));
+    TEST_ESP_OK(esp_delta_ota_checkpoint_erase("test"));
+
+    TEST_ASSERT_EQUAL_INT(0, memcmp(new_bin_start, output_buffer, new_bin_end - new_bin_start));
+}
+
+#if CONFIG_ESP_DELTA_OTA_HDIFFPATCH
+TEST_CASE("Applying a hdiffpatch patch", "[esp_delta_ota]")
+{
+    memset(output_buffer, 0, 1000);
+    output_index = 0;
+    esp_delta_ota_cfg_t cfg = {
+        .read_cb = &read_cb,
+        .write_cb = &write_cb,
+    };
+
+    esp_delta_ota_handle_t handle = esp_delta_ota_init(&cfg);
+    TEST_ASSERT_NOT_NULL(handle);
+
+    int patch_size = hdiffpatch_patch_bin_end - hdiffpatch_patch_bin_start;
+    for (int i = 0; i < patch_size; i += 100) {
+        TEST_ESP_OK(esp_delta_ota_feed_patch(handle, hdiffpatch_patch_bin_start + i, MIN(100, patch_size - i)));
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_delta_ota_checkpoint(handle, "test"));
+    /* The patched image is written once the whole diff is there */
+    TEST_ASSERT_EQUAL_INT(0, output_index);
+
+    TEST_ESP_OK(esp_delta_ota_finalize(handle));
+    TEST_ESP_OK(esp_delta_ota_deinit(handle));
+
+    TEST_ASSERT_EQUAL_INT(new_bin_end - new_bin_start, output_index);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(new_bin_start, output_buffer, output_index));
+}
+#endif
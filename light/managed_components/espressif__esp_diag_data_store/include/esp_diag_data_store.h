@@ -53,6 +53,21 @@ esp_err_t esp_diag_data_store_critical_write(void *data, size_t len);
  */
 esp_err_t esp_diag_data_store_non_critical_write(const char *dg, void *data, size_t len);
 
+/**
+ * @brief Set the quota of a non critical data group
+ *
+ * The group keeps quota bytes of its data in the non critical data store, however much the other groups write.
+ * The data of the groups over their quota, and of the groups without one, goes first when room is needed.
+ * Data moved to flash (CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW) is not subject to the quotas.
+ *
+ * @param[in] dg Data group, as given to esp_diag_data_store_non_critical_write() (Must be the string stored in RODATA)
+ * @param[in] quota Bytes of the group kept in the store, headers of its records included
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS groups already have a quota,
+ *         ESP_ERR_NOT_SUPPORTED if quotas are disabled, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_non_critical_quota_set(const char *dg, size_t quota);
+
 /**
  * @brief Read critical data from the diagnostics data store
  *
@@ -73,6 +88,40 @@ int esp_diag_data_store_critical_read(uint8_t *buf, size_t size);
  */
 int esp_diag_data_store_non_critical_read(uint8_t *buf, size_t size);
 
+/**
+ * @brief Contiguous part of the data in the diagnostics data store
+ */
+typedef struct {
+    const uint8_t *data;    /*!< Start of the part, in the data store */
+    size_t len;             /*!< Length of the part */
+} esp_diag_data_store_span_t;
+
+/**
+ * @brief Get the critical data in place, without copying it out of the diagnostics data store
+ *
+ * The data is returned in one span, or in two if it wraps around the end of the store, the second span
+ * is empty otherwise. The data stays in place until it is released with esp_diag_data_store_critical_release().
+ * With CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW, while some of the data is in flash, it is copied to one span instead,
+ * which holds all the data or at least 1K of it.
+ *
+ * @param[out] spans Parts of the data, in order
+ *
+ * @return int bytes in the spans on success, -1 otherwise
+ */
+int esp_diag_data_store_critical_peek(esp_diag_data_store_span_t spans[2]);
+
+/**
+ * @brief Get the non_critical data in place, without copying it out of the diagnostics data store
+ *
+ * As esp_diag_data_store_critical_peek(). Until the next call to esp_diag_data_store_non_critical_release(),
+ * which has to follow, even with a size of 0, writes do not overwrite the data to make room.
+ *
+ * @param[out] spans Parts of the data, in order
+ *
+ * @return int bytes in the spans on success, -1 otherwise
+ */
+int esp_diag_data_store_non_critical_peek(esp_diag_data_store_span_t spans[2]);
+
 /**
  * @brief Release the size bytes of critical data from diagnostics data store
  *
@@ -114,6 +163,30 @@ void esp_diag_data_store_deinit(void);
  */
 uint32_t esp_diag_data_store_get_crc(void);
 
+/**
+ * @brief Usage of the diagnostics data store
+ */
+typedef struct {
+    size_t critical_filled;         /*!< Bytes of critical data not released yet */
+    size_t critical_size;           /*!< Size of the critical data store */
+    size_t non_critical_filled;     /*!< Bytes of non critical data not released yet */
+    size_t non_critical_size;       /*!< Size of the non critical data store */
+} esp_diag_data_store_usage_t;
+
+/**
+ * @brief Get the usage of the diagnostics data store
+ *
+ * Together with the ESP_DIAG_DATA_STORE_EVENT_*_LOW_MEM events, this lets the reporting side pace its uploads
+ * by how fast the store fills.
+ * Non critical data still staged (CONFIG_DIAG_DATA_STORE_STAGING) is not counted, and the call does not block.
+ * Data moved to flash (CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW) is counted as filled, so filled may exceed the size.
+ *
+ * @param[out] usage Usage of the critical and non critical data stores
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_data_store_usage_get(esp_diag_data_store_usage_t *usage);
+
 /**
  * @brief Discard values from diagnostics data store. This API should be called after esp_diag_data_store_init();
  *
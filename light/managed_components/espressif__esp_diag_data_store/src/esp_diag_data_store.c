@@ -10,6 +10,21 @@
 #include <esp_diag_data_store.h>
 #include <rtc_store.h>
 
+#if CONFIG_DIAG_DATA_STORE_STAGING
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#endif
+
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+#include <stdlib.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <flash_ring.h>
+#endif
+
 ESP_EVENT_DEFINE_BASE(ESP_DIAG_DATA_STORE_EVENT);
 
 /* Callback type to initialize the store */
@@ -20,8 +35,14 @@ typedef void (*deinit_cb_t) (void);
 typedef esp_err_t (*write_cb_t) (void *data, size_t len);
 /* Callback type to write non_critical data */
 typedef esp_err_t (*nc_write_cb_t) (const char *dg, void *data, size_t len);
+/* Callback type to write several non_critical data items */
+typedef esp_err_t (*nc_write_batch_cb_t) (const rtc_store_non_critical_item_t items[], size_t count, size_t *written);
+/* Callback type to set the quota of a non_critical data group */
+typedef esp_err_t (*nc_quota_cb_t) (const char *dg, size_t quota);
 /* Callback type to read data */
 typedef int (*read_cb_t) (uint8_t *buf, size_t size);
+/* Callback type to read data in place */
+typedef int (*peek_cb_t) (esp_diag_data_store_span_t spans[2]);
 /* Callback type to release the data */
 typedef esp_err_t (*release_cb_t) (size_t size);
 /* Callback type to get CRC of data store configuration.
@@ -29,18 +50,25 @@ This crc will be used to discard data from data store if its value is changed */
 typedef uint32_t (*crc_cb_t) ();
 /* Callback type to discard data from data store. */
 typedef esp_err_t (*discard_data_cb_t) ();
+/* Callback type to get the usage of data store */
+typedef esp_err_t (*usage_cb_t) (rtc_store_usage_t *usage);
 
 typedef struct {
     init_cb_t init;
     deinit_cb_t deinit;
     write_cb_t critical_write;
     nc_write_cb_t non_critical_write;
+    nc_write_batch_cb_t non_critical_write_batch;
+    nc_quota_cb_t non_critical_quota_set;
     read_cb_t critical_read;
     read_cb_t non_critical_read;
+    peek_cb_t critical_peek;
+    peek_cb_t non_critical_peek;
     release_cb_t critical_release;
     release_cb_t non_critical_release;
     crc_cb_t data_store_crc;
     discard_data_cb_t discard_data;
+    usage_cb_t usage;
 } data_store_cbs_t;
 
 typedef struct {
@@ -63,12 +91,17 @@ static void set_diag_store_cbs(void)
     s_priv_data.cbs.deinit = rtc_store_deinit;
     s_priv_data.cbs.critical_write = rtc_store_critical_data_write;
     s_priv_data.cbs.non_critical_write = rtc_store_non_critical_data_write;
+    s_priv_data.cbs.non_critical_write_batch = rtc_store_non_critical_data_write_batch;
+    s_priv_data.cbs.non_critical_quota_set = rtc_store_non_critical_quota_set;
     s_priv_data.cbs.critical_read = rtc_store_critical_data_read;
     s_priv_data.cbs.non_critical_read = rtc_store_non_critical_data_read;
+    s_priv_data.cbs.critical_peek = rtc_store_critical_data_peek;
+    s_priv_data.cbs.non_critical_peek = rtc_store_non_critical_data_peek;
     s_priv_data.cbs.critical_release = rtc_store_critical_data_release;
     s_priv_data.cbs.non_critical_release = rtc_store_non_critical_data_release;
     s_priv_data.cbs.data_store_crc = rtc_store_get_crc;
     s_priv_data.cbs.discard_data = rtc_store_discard_data;
+    s_priv_data.cbs.usage = rtc_store_usage_get;
 }
 
 static void unset_diag_store_cbs(void)
@@ -77,14 +110,427 @@ static void unset_diag_store_cbs(void)
     s_priv_data.cbs.deinit = NULL;
     s_priv_data.cbs.critical_write = NULL;
     s_priv_data.cbs.non_critical_write = NULL;
+    s_priv_data.cbs.non_critical_write_batch = NULL;
+    s_priv_data.cbs.non_critical_quota_set = NULL;
     s_priv_data.cbs.critical_read = NULL;
     s_priv_data.cbs.non_critical_read = NULL;
+    s_priv_data.cbs.critical_peek = NULL;
+    s_priv_data.cbs.non_critical_peek = NULL;
     s_priv_data.cbs.critical_release = NULL;
     s_priv_data.cbs.non_critical_release = NULL;
     s_priv_data.cbs.data_store_crc = NULL;
     s_priv_data.cbs.discard_data = NULL;
+    s_priv_data.cbs.usage = NULL;
+}
+
+#if CONFIG_DIAG_DATA_STORE_STAGING
+/* Non critical data is staged in a ring per core. The tasks of a core write to its ring with the
+ * interrupts of that core masked, which makes them a single producer without taking any lock, and
+ * the flush task, or a reader, is the single consumer under the staging lock.
+ */
+#define STAGING_SIZE            CONFIG_DIAG_DATA_STORE_STAGING_SIZE
+#define STAGING_MASK            (STAGING_SIZE - 1)
+#define STAGING_WRAP            SIZE_MAX    /* header length of the unused space at the end of the ring */
+#define STAGING_ALIGN(len)      (((len) + sizeof(staging_hdr_t) - 1) & ~(sizeof(staging_hdr_t) - 1))
+#define STAGING_BATCH_SIZE      16
+#define STAGING_TASK_STACK_SIZE 3072
+
+typedef struct {
+    const char *dg;
+    size_t len;
+} staging_hdr_t;
+
+_Static_assert((STAGING_SIZE & STAGING_MASK) == 0, "DIAG_DATA_STORE_STAGING_SIZE must be a power of 2");
+_Static_assert((sizeof(staging_hdr_t) & (sizeof(staging_hdr_t) - 1)) == 0, "staging header must be a power of 2");
+
+typedef struct {
+    atomic_uint head;   /* free running write offset, updated by the producer */
+    atomic_uint tail;   /* free running read offset, updated by the consumer */
+    uint8_t buf[STAGING_SIZE] __attribute__((aligned(sizeof(staging_hdr_t))));
+} staging_ring_t;
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    staging_ring_t rings[portNUM_PROCESSORS];
+} staging_data_t;
+
+static staging_data_t s_staging;
+
+static void staging_notify(void)
+{
+    if (!s_staging.task) {
+        return;
+    }
+    if (xPortInIsrContext()) {
+        vTaskNotifyGiveFromISR(s_staging.task, NULL);
+    } else {
+        xTaskNotifyGive(s_staging.task);
+    }
+}
+
+static esp_err_t staging_write(const char *dg, void *data, size_t len)
+{
+    size_t need = STAGING_ALIGN(sizeof(staging_hdr_t) + len);
+    if (need > STAGING_SIZE / 2) {
+        /* Could not be staged while the ring wraps */
+        return s_priv_data.cbs.non_critical_write(dg, data, len);
+    }
+
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    staging_ring_t *ring = &s_staging.rings[xPortGetCoreID()];
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned used = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t pos = head & STAGING_MASK;
+    size_t skip = (STAGING_SIZE - pos < need) ? STAGING_SIZE - pos : 0;
+    if (used + skip + need > STAGING_SIZE) {
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+        return ESP_ERR_NO_MEM;
+    }
+    if (skip) {
+        ((staging_hdr_t *) (ring->buf + pos))->len = STAGING_WRAP;
+        pos = 0;
+    }
+    staging_hdr_t *hdr = (staging_hdr_t *) (ring->buf + pos);
+    hdr->dg = dg;
+    hdr->len = len;
+    memcpy(hdr + 1, data, len);
+    atomic_store_explicit(&ring->head, head + skip + need, memory_order_release);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+
+    /* Wake the flush task once per fill, when the ring gets half full */
+    if (used < STAGING_SIZE / 2 && used + skip + need >= STAGING_SIZE / 2) {
+        staging_notify();
+    }
+    return ESP_OK;
+}
+
+/* Caller holds the staging lock */
+static void staging_flush_ring(staging_ring_t *ring)
+{
+    rtc_store_non_critical_item_t items[STAGING_BATCH_SIZE];
+    unsigned ends[STAGING_BATCH_SIZE];
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+        size_t count = 0;
+        unsigned pos = tail;
+        while (pos != head && count < STAGING_BATCH_SIZE) {
+            staging_hdr_t *hdr = (staging_hdr_t *) (ring->buf + (pos & STAGING_MASK));
+            if (hdr->len == STAGING_WRAP) {
+                pos += STAGING_SIZE - (pos & STAGING_MASK);
+                continue;
+            }
+            items[count].dg = hdr->dg;
+            items[count].data = hdr + 1;
+            items[count].len = hdr->len;
+            pos += STAGING_ALIGN(sizeof(staging_hdr_t) + hdr->len);
+            ends[count++] = pos;
+        }
+        if (count) {
+            size_t written = 0;
+            esp_err_t err = s_priv_data.cbs.non_critical_write_batch(items, count, &written);
+            if (err == ESP_ERR_INVALID_STATE) {
+                return;
+            }
+            if (written < count) {
+                /* The failed item is dropped, as a direct write would have dropped it */
+                written++;
+            }
+            pos = ends[written - 1];
+        }
+        tail = pos;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+static void staging_flush(void)
+{
+    xSemaphoreTake(s_staging.lock, portMAX_DELAY);
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        staging_flush_ring(&s_staging.rings[i]);
+    }
+    xSemaphoreGive(s_staging.lock);
 }
 
+static void staging_discard(void)
+{
+    xSemaphoreTake(s_staging.lock, portMAX_DELAY);
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        staging_ring_t *ring = &s_staging.rings[i];
+        atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->head, memory_order_acquire),
+                              memory_order_release);
+    }
+    xSemaphoreGive(s_staging.lock);
+}
+
+static void staging_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_DIAG_DATA_STORE_STAGING_FLUSH_INTERVAL_MS));
+        staging_flush();
+    }
+}
+
+static esp_err_t staging_init(void)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        atomic_init(&s_staging.rings[i].head, 0);
+        atomic_init(&s_staging.rings[i].tail, 0);
+    }
+    s_staging.lock = xSemaphoreCreateMutex();
+    if (!s_staging.lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(staging_task, "diag_staging", STAGING_TASK_STACK_SIZE, NULL,
+                    CONFIG_DIAG_DATA_STORE_STAGING_TASK_PRIORITY, &s_staging.task) != pdPASS) {
+        vSemaphoreDelete(s_staging.lock);
+        s_staging.lock = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void staging_deinit(void)
+{
+    /* The flush task only waits for notifications outside of the lock */
+    xSemaphoreTake(s_staging.lock, portMAX_DELAY);
+    vTaskDelete(s_staging.task);
+    s_staging.task = NULL;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        staging_flush_ring(&s_staging.rings[i]);
+    }
+    xSemaphoreGive(s_staging.lock);
+    vSemaphoreDelete(s_staging.lock);
+    s_staging.lock = NULL;
+}
+#endif /* CONFIG_DIAG_DATA_STORE_STAGING */
+
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+/* Data of a store is moved to its flash ring as a whole when the store fills past the reporting watermark,
+ * so the ring holds the oldest data and is read first. While data is in flash, a peek copies it to a buffer,
+ * followed by the data still in the store, and a release frees the data in flash first.
+ */
+#define OVERFLOW_PEEK_SIZE      1024
+#define OVERFLOW_WATERMARK      CONFIG_DIAG_DATA_STORE_REPORTING_WATERMARK_PERCENT
+
+static const char *TAG = "DIAG_DATA_STORE";
+
+typedef struct {
+    read_cb_t *read;
+    peek_cb_t *peek;
+    release_cb_t *release;
+    bool peeked;        // data is read in place, the store is not moved to flash until released
+    uint8_t *buf;       // copy of the data returned by the peek, when some of it is in flash
+} overflow_tier_t;
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    bool registered;
+    overflow_tier_t tiers[FLASH_RING_MAX];
+} overflow_data_t;
+
+static overflow_data_t s_overflow = {
+    .tiers = {
+        [FLASH_RING_CRITICAL] = {
+            .read = &s_priv_data.cbs.critical_read,
+            .peek = &s_priv_data.cbs.critical_peek,
+            .release = &s_priv_data.cbs.critical_release,
+        },
+        [FLASH_RING_NON_CRITICAL] = {
+            .read = &s_priv_data.cbs.non_critical_read,
+            .peek = &s_priv_data.cbs.non_critical_peek,
+            .release = &s_priv_data.cbs.non_critical_release,
+        },
+    },
+};
+
+static bool overflow_above_watermark(flash_ring_id_t id)
+{
+    rtc_store_usage_t usage;
+    if (s_priv_data.cbs.usage(&usage) != ESP_OK) {
+        return false;
+    }
+    if (id == FLASH_RING_CRITICAL) {
+        return usage.critical_filled * 100 >= usage.critical_size * OVERFLOW_WATERMARK;
+    }
+    return usage.non_critical_filled * 100 >= usage.non_critical_size * OVERFLOW_WATERMARK;
+}
+
+/* Moves all the data of the store to its flash ring, or nothing if the ring is full */
+static void overflow_drain(flash_ring_id_t id)
+{
+    overflow_tier_t *tier = &s_overflow.tiers[id];
+    esp_diag_data_store_span_t spans[2];
+
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    /* The reader releases by the offsets of what it peeked */
+    if (tier->peeked || !overflow_above_watermark(id)) {
+        xSemaphoreGive(s_overflow.lock);
+        return;
+    }
+    size_t moved = 0;
+    int len = (*tier->peek)(spans);
+    if (len > 0 && len <= flash_ring_free(id)) {
+        esp_err_t err = flash_ring_append(id, spans[0].data, spans[0].len);
+        if (err == ESP_OK) {
+            err = flash_ring_append(id, spans[1].data, spans[1].len);
+        }
+        if (err == ESP_OK) {
+            flash_ring_commit(id);
+            moved = len;
+        }
+    }
+    /* Also ends the peek */
+    (*tier->release)(moved);
+    xSemaphoreGive(s_overflow.lock);
+}
+
+/* This executes in the context of default event loop task */
+static void overflow_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_id == ESP_DIAG_DATA_STORE_EVENT_CRITICAL_DATA_LOW_MEM) {
+        overflow_drain(FLASH_RING_CRITICAL);
+    } else if (event_id == ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM) {
+        overflow_drain(FLASH_RING_NON_CRITICAL);
+    }
+}
+
+static int overflow_read(flash_ring_id_t id, uint8_t *buf, size_t size)
+{
+    overflow_tier_t *tier = &s_overflow.tiers[id];
+
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    int len = flash_ring_read(id, buf, size);
+    if (len == 0) {
+        len = (*tier->read)(buf, size);
+    } else if (len > 0 && (size_t) len < size) {
+        int rtc_len = (*tier->read)(buf + len, size - len);
+        if (rtc_len > 0) {
+            len += rtc_len;
+        }
+    }
+    xSemaphoreGive(s_overflow.lock);
+    return len;
+}
+
+static int overflow_peek(flash_ring_id_t id, esp_diag_data_store_span_t spans[2])
+{
+    overflow_tier_t *tier = &s_overflow.tiers[id];
+    esp_diag_data_store_span_t rtc_spans[2];
+    int len;
+
+    if (!spans) {
+        return -1;
+    }
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    /* A peek not released yet is replaced */
+    free(tier->buf);
+    tier->buf = NULL;
+    if (!flash_ring_filled(id)) {
+        len = (*tier->peek)(spans);
+        tier->peeked = len >= 0;
+        xSemaphoreGive(s_overflow.lock);
+        return len;
+    }
+    tier->buf = malloc(OVERFLOW_PEEK_SIZE);
+    len = tier->buf ? flash_ring_read(id, tier->buf, OVERFLOW_PEEK_SIZE) : -1;
+    if (len >= 0 && len < OVERFLOW_PEEK_SIZE && (*tier->peek)(rtc_spans) > 0) {
+        for (int i = 0; i < 2 && rtc_spans[i].len && len < OVERFLOW_PEEK_SIZE; i++) {
+            size_t n = OVERFLOW_PEEK_SIZE - len;
+            if (n > rtc_spans[i].len) {
+                n = rtc_spans[i].len;
+            }
+            memcpy(tier->buf + len, rtc_spans[i].data, n);
+            len += n;
+        }
+    }
+    if (len < 0) {
+        free(tier->buf);
+        tier->buf = NULL;
+    } else {
+        tier->peeked = true;
+        spans[0].data = tier->buf;
+        spans[0].len = len;
+        spans[1].data = NULL;
+        spans[1].len = 0;
+    }
+    xSemaphoreGive(s_overflow.lock);
+    return len;
+}
+
+static esp_err_t overflow_release(flash_ring_id_t id, size_t size)
+{
+    overflow_tier_t *tier = &s_overflow.tiers[id];
+
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    size_t in_flash = flash_ring_filled(id);
+    if (in_flash > size) {
+        in_flash = size;
+    }
+    if (in_flash) {
+        flash_ring_release(id, in_flash);
+    }
+    /* Called even with a size of 0, to end the peek of the store */
+    esp_err_t err = (*tier->release)(size - in_flash);
+    free(tier->buf);
+    tier->buf = NULL;
+    tier->peeked = false;
+    xSemaphoreGive(s_overflow.lock);
+    return err;
+}
+
+static void overflow_discard(void)
+{
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    flash_ring_discard();
+    xSemaphoreGive(s_overflow.lock);
+}
+
+static esp_err_t overflow_init(void)
+{
+    s_overflow.lock = xSemaphoreCreateMutex();
+    if (!s_overflow.lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Without the partition the data stays in RTC memory only */
+    esp_err_t err = flash_ring_init(CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW_PARTITION_LABEL);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Flash overflow disabled, partition %s: %s",
+                 CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW_PARTITION_LABEL, esp_err_to_name(err));
+        return ESP_OK;
+    }
+    err = esp_event_handler_register(ESP_DIAG_DATA_STORE_EVENT, ESP_EVENT_ANY_ID, overflow_event_handler, NULL);
+    if (err != ESP_OK) {
+        flash_ring_deinit();
+        vSemaphoreDelete(s_overflow.lock);
+        s_overflow.lock = NULL;
+        return err;
+    }
+    s_overflow.registered = true;
+    return ESP_OK;
+}
+
+static void overflow_deinit(void)
+{
+    if (s_overflow.registered) {
+        esp_event_handler_unregister(ESP_DIAG_DATA_STORE_EVENT, ESP_EVENT_ANY_ID, overflow_event_handler);
+        s_overflow.registered = false;
+    }
+    xSemaphoreTake(s_overflow.lock, portMAX_DELAY);
+    for (int i = 0; i < FLASH_RING_MAX; i++) {
+        free(s_overflow.tiers[i].buf);
+        s_overflow.tiers[i].buf = NULL;
+        s_overflow.tiers[i].peeked = false;
+    }
+    flash_ring_deinit();
+    xSemaphoreGive(s_overflow.lock);
+    vSemaphoreDelete(s_overflow.lock);
+    s_overflow.lock = NULL;
+}
+#endif /* CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW */
+
 esp_err_t esp_diag_data_store_critical_write(void *data, size_t len)
 {
     CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
@@ -94,31 +540,86 @@ esp_err_t esp_diag_data_store_critical_write(void *data, size_t len)
 esp_err_t esp_diag_data_store_non_critical_write(const char *dg, void *data, size_t len)
 {
     CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    if (!dg || !data || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return staging_write(dg, data, len);
+#else
     return s_priv_data.cbs.non_critical_write(dg, data, len);
+#endif
+}
+
+esp_err_t esp_diag_data_store_non_critical_quota_set(const char *dg, size_t quota)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    return s_priv_data.cbs.non_critical_quota_set(dg, quota);
 }
 
 int esp_diag_data_store_critical_read(uint8_t *buf, size_t size)
 {
     CHECK_STORE_INIT(-1);
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_read(FLASH_RING_CRITICAL, buf, size);
+#else
     return s_priv_data.cbs.critical_read(buf, size);
+#endif
 }
 
 int esp_diag_data_store_non_critical_read(uint8_t *buf, size_t size)
 {
     CHECK_STORE_INIT(-1);
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    staging_flush();
+#endif
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_read(FLASH_RING_NON_CRITICAL, buf, size);
+#else
     return s_priv_data.cbs.non_critical_read(buf, size);
+#endif
+}
+
+int esp_diag_data_store_critical_peek(esp_diag_data_store_span_t spans[2])
+{
+    CHECK_STORE_INIT(-1);
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_peek(FLASH_RING_CRITICAL, spans);
+#else
+    return s_priv_data.cbs.critical_peek(spans);
+#endif
+}
+
+int esp_diag_data_store_non_critical_peek(esp_diag_data_store_span_t spans[2])
+{
+    CHECK_STORE_INIT(-1);
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    staging_flush();
+#endif
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_peek(FLASH_RING_NON_CRITICAL, spans);
+#else
+    return s_priv_data.cbs.non_critical_peek(spans);
+#endif
 }
 
 esp_err_t esp_diag_data_store_critical_release(size_t size)
 {
     CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_release(FLASH_RING_CRITICAL, size);
+#else
     return s_priv_data.cbs.critical_release(size);
+#endif
 }
 
 esp_err_t esp_diag_data_store_non_critical_release(size_t size)
 {
     CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    return overflow_release(FLASH_RING_NON_CRITICAL, size);
+#else
     return s_priv_data.cbs.non_critical_release(size);
+#endif
 }
 
 esp_err_t esp_diag_data_store_init(void)
@@ -128,6 +629,25 @@ esp_err_t esp_diag_data_store_init(void)
     if (err != ESP_OK) {
         return err;
     }
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    err = staging_init();
+    if (err != ESP_OK) {
+        s_priv_data.cbs.deinit();
+        unset_diag_store_cbs();
+        return err;
+    }
+#endif
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    err = overflow_init();
+    if (err != ESP_OK) {
+#if CONFIG_DIAG_DATA_STORE_STAGING
+        staging_deinit();
+#endif
+        s_priv_data.cbs.deinit();
+        unset_diag_store_cbs();
+        return err;
+    }
+#endif
     s_priv_data.init = true;
     return ESP_OK;
 }
@@ -135,6 +655,12 @@ esp_err_t esp_diag_data_store_init(void)
 void esp_diag_data_store_deinit(void)
 {
     CHECK_STORE_INIT();
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    overflow_deinit();
+#endif
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    staging_deinit();
+#endif
     s_priv_data.cbs.deinit();
     unset_diag_store_cbs();
     s_priv_data.init = false;
@@ -146,8 +672,36 @@ uint32_t esp_diag_data_store_get_crc(void)
     return s_priv_data.cbs.data_store_crc();
 }
 
+esp_err_t esp_diag_data_store_usage_get(esp_diag_data_store_usage_t *usage)
+{
+    CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+    if (!usage) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    rtc_store_usage_t store_usage;
+    esp_err_t err = s_priv_data.cbs.usage(&store_usage);
+    if (err != ESP_OK) {
+        return err;
+    }
+    usage->critical_filled = store_usage.critical_filled;
+    usage->critical_size = store_usage.critical_size;
+    usage->non_critical_filled = store_usage.non_critical_filled;
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    usage->critical_filled += flash_ring_filled(FLASH_RING_CRITICAL);
+    usage->non_critical_filled += flash_ring_filled(FLASH_RING_NON_CRITICAL);
+#endif
+    usage->non_critical_size = store_usage.non_critical_size;
+    return ESP_OK;
+}
+
 esp_err_t esp_diag_data_discard_data(void)
 {
     CHECK_STORE_INIT(ESP_ERR_INVALID_STATE);
+#if CONFIG_DIAG_DATA_STORE_STAGING
+    staging_discard();
+#endif
+#if CONFIG_DIAG_DATA_STORE_FLASH_OVERFLOW
+    overflow_discard();
+#endif
     return s_priv_data.cbs.discard_data();
 }
\ No newline at end of file
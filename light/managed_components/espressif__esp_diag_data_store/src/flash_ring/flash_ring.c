@@ -0,0 +1,287 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_partition.h>
+#include <esp_crc.h>
+
+#include "flash_ring.h"
+
+/**
+ * @brief Append only rings in a flash data partition, one for the overflow of each RTC store buffer
+ *
+ * Each ring takes half of the sectors of the partition. A sector is erased when the data reaches its start,
+ * so every sector is erased once per turn of its ring, and one sector is kept free for it.
+ * The read and write positions are kept in RTC memory, which is what the records refer to through their
+ * meta header index, so the rings are discarded on the resets which discard the RTC store.
+ *
+ * @attention As in the RTC store, there are prints in this file and not logs, to not log them in Insights.
+ */
+
+#if CONFIG_DIAG_DATA_STORE_DBG_PRINTS
+#define FLASH_RING_DBG_PRINTS 1
+#endif
+
+#define FLASH_RING_SECTOR_SIZE      SPI_FLASH_SEC_SIZE
+#define FLASH_RING_STATE_MAGIC      0x52474e52  // "RNGR"
+#define FLASH_RING_CHECK_CHUNK      64
+
+typedef struct {
+    uint32_t head;      // offset of the oldest data in the ring
+    uint32_t filled;    // committed data
+} ring_pos_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t part_size;
+    ring_pos_t rings[FLASH_RING_MAX];
+    uint32_t crc;
+} flash_ring_state_t;
+
+typedef struct {
+    bool init;
+    const esp_partition_t *part;
+    size_t ring_size;
+    size_t pending[FLASH_RING_MAX];     // appended and not committed yet
+} flash_ring_priv_data_t;
+
+static flash_ring_priv_data_t s_priv_data;
+RTC_NOINIT_ATTR static flash_ring_state_t s_state;
+
+static uint32_t state_crc(void)
+{
+    return esp_crc32_le(0, (const uint8_t *) &s_state, offsetof(flash_ring_state_t, crc));
+}
+
+static void state_save(void)
+{
+    s_state.crc = state_crc();
+}
+
+static void ring_reset(flash_ring_id_t id)
+{
+    s_state.rings[id].head = 0;
+    s_state.rings[id].filled = 0;
+    s_priv_data.pending[id] = 0;
+    state_save();
+}
+
+static inline size_t ring_base(flash_ring_id_t id)
+{
+    return id * s_priv_data.ring_size;
+}
+
+/* Position in the ring after the data of the ring, committed or not */
+static inline size_t ring_write_pos(flash_ring_id_t id)
+{
+    return (s_state.rings[id].head + s_state.rings[id].filled + s_priv_data.pending[id]) % s_priv_data.ring_size;
+}
+
+/* The space after the write position up to the next sector is written only by the next append */
+static bool ring_tail_erased(flash_ring_id_t id)
+{
+    uint8_t buf[FLASH_RING_CHECK_CHUNK];
+    size_t pos = ring_write_pos(id);
+    size_t left = (FLASH_RING_SECTOR_SIZE - pos % FLASH_RING_SECTOR_SIZE) % FLASH_RING_SECTOR_SIZE;
+
+    while (left) {
+        size_t n = left < sizeof(buf) ? left : sizeof(buf);
+        if (esp_partition_read(s_priv_data.part, ring_base(id) + pos, buf, n) != ESP_OK) {
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (buf[i] != 0xff) {
+                return false;
+            }
+        }
+        pos += n;
+        left -= n;
+    }
+    return true;
+}
+
+size_t flash_ring_filled(flash_ring_id_t id)
+{
+    if (!s_priv_data.init || id >= FLASH_RING_MAX) {
+        return 0;
+    }
+    return s_state.rings[id].filled;
+}
+
+size_t flash_ring_free(flash_ring_id_t id)
+{
+    if (!s_priv_data.init || id >= FLASH_RING_MAX) {
+        return 0;
+    }
+    /* The sector the data enters next may still hold the oldest data */
+    return s_priv_data.ring_size - FLASH_RING_SECTOR_SIZE - s_state.rings[id].filled - s_priv_data.pending[id];
+}
+
+esp_err_t flash_ring_append(flash_ring_id_t id, const void *data, size_t len)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (id >= FLASH_RING_MAX || (!data && len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (len > flash_ring_free(id)) {
+        return ESP_ERR_NO_MEM;
+    }
+    const uint8_t *src = data;
+    size_t pos = ring_write_pos(id);
+    while (len) {
+        esp_err_t err = ESP_OK;
+        if (pos % FLASH_RING_SECTOR_SIZE == 0) {
+            err = esp_partition_erase_range(s_priv_data.part, ring_base(id) + pos, FLASH_RING_SECTOR_SIZE);
+        }
+        size_t n = FLASH_RING_SECTOR_SIZE - pos % FLASH_RING_SECTOR_SIZE;
+        if (n > len) {
+            n = len;
+        }
+        if (err == ESP_OK) {
+            err = esp_partition_write(s_priv_data.part, ring_base(id) + pos, src, n);
+        }
+        if (err != ESP_OK) {
+#if FLASH_RING_DBG_PRINTS
+            printf("flash_ring_append: ring %d, flash error 0x%x, discarding it\n", id, err);
+#endif
+            ring_reset(id);
+            return err;
+        }
+        s_priv_data.pending[id] += n;
+        pos = (pos + n) % s_priv_data.ring_size;
+        src += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+void flash_ring_commit(flash_ring_id_t id)
+{
+    if (!s_priv_data.init || id >= FLASH_RING_MAX) {
+        return;
+    }
+    s_state.rings[id].filled += s_priv_data.pending[id];
+    s_priv_data.pending[id] = 0;
+    state_save();
+}
+
+int flash_ring_read(flash_ring_id_t id, void *buf, size_t size)
+{
+    if (!s_priv_data.init || id >= FLASH_RING_MAX || !buf) {
+        return -1;
+    }
+    if (size > s_state.rings[id].filled) {
+        size = s_state.rings[id].filled;
+    }
+    uint8_t *dst = buf;
+    size_t pos = s_state.rings[id].head;
+    size_t left = size;
+    while (left) {
+        size_t n = s_priv_data.ring_size - pos;
+        if (n > left) {
+            n = left;
+        }
+        if (esp_partition_read(s_priv_data.part, ring_base(id) + pos, dst, n) != ESP_OK) {
+            return -1;
+        }
+        pos = (pos + n) % s_priv_data.ring_size;
+        dst += n;
+        left -= n;
+    }
+    return size;
+}
+
+esp_err_t flash_ring_release(flash_ring_id_t id, size_t size)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (id >= FLASH_RING_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (size > s_state.rings[id].filled) {
+        return ESP_FAIL;
+    }
+    s_state.rings[id].head = (s_state.rings[id].head + size) % s_priv_data.ring_size;
+    s_state.rings[id].filled -= size;
+    state_save();
+    return ESP_OK;
+}
+
+void flash_ring_discard(void)
+{
+    if (!s_priv_data.init) {
+        return;
+    }
+    for (int i = 0; i < FLASH_RING_MAX; i++) {
+        /* The write position stays, the space after it is still erased */
+        s_state.rings[i].head = ring_write_pos(i);
+        s_state.rings[i].filled = 0;
+        s_priv_data.pending[i] = 0;
+    }
+    state_save();
+}
+
+esp_err_t flash_ring_init(const char *label)
+{
+    if (s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part) {
+#if FLASH_RING_DBG_PRINTS
+        printf("flash_ring_init: partition %s not found\n", label ? label : "");
+#endif
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (part->encrypted) {
+        /* Erased flash is not read back as 0xff, which is how an interrupted append is found */
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    size_t ring_size = (part->size / FLASH_RING_MAX) & ~(FLASH_RING_SECTOR_SIZE - 1);
+    if (ring_size < 2 * FLASH_RING_SECTOR_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s_priv_data.part = part;
+    s_priv_data.ring_size = ring_size;
+    memset(s_priv_data.pending, 0, sizeof(s_priv_data.pending));
+
+    esp_reset_reason_t reset_reason = esp_reset_reason();
+    bool stale = reset_reason == ESP_RST_UNKNOWN ||
+                 reset_reason == ESP_RST_POWERON ||
+                 reset_reason == ESP_RST_BROWNOUT;
+    if (stale || s_state.magic != FLASH_RING_STATE_MAGIC || s_state.part_size != part->size ||
+            s_state.crc != state_crc()) {
+        memset(&s_state, 0, sizeof(s_state));
+        s_state.magic = FLASH_RING_STATE_MAGIC;
+        s_state.part_size = part->size;
+        state_save();
+    }
+    for (int i = 0; i < FLASH_RING_MAX; i++) {
+        if (s_state.rings[i].head >= ring_size ||
+                s_state.rings[i].filled > ring_size - FLASH_RING_SECTOR_SIZE || !ring_tail_erased(i)) {
+            /* Reset during an append, or the state does not match the partition */
+#if FLASH_RING_DBG_PRINTS
+            printf("flash_ring_init: discarding ring %d\n", i);
+#endif
+            ring_reset(i);
+        }
+    }
+    s_priv_data.init = true;
+    return ESP_OK;
+}
+
+void flash_ring_deinit(void)
+{
+    memset(&s_priv_data, 0, sizeof(s_priv_data));
+}
@@ -0,0 +1,110 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Rings of the flash partition, each holds the overflow of one RTC store buffer
+ */
+typedef enum {
+    FLASH_RING_CRITICAL,
+    FLASH_RING_NON_CRITICAL,
+    FLASH_RING_MAX,
+} flash_ring_id_t;
+
+/**
+ * @brief Initializes the flash rings in the partition with the given label
+ *
+ * The data of the rings is kept across the resets which keep the RTC store data.
+ * The rings are not thread safe, the caller serializes the calls.
+ *
+ * @param[in] label Label of the data partition
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+esp_err_t flash_ring_init(const char *label);
+
+/**
+ * @brief Deinitializes the flash rings
+ */
+void flash_ring_deinit(void);
+
+/**
+ * @brief Get the bytes stored in a ring
+ *
+ * @param[in] id Ring
+ *
+ * @return Bytes stored
+ */
+size_t flash_ring_filled(flash_ring_id_t id);
+
+/**
+ * @brief Get the bytes which can be appended to a ring
+ *
+ * @param[in] id Ring
+ *
+ * @return Bytes free
+ */
+size_t flash_ring_free(flash_ring_id_t id);
+
+/**
+ * @brief Append data to a ring, the sectors are erased as the data reaches them
+ *
+ * The data is read only after flash_ring_commit(), so that several appends are kept or lost together.
+ *
+ * @param[in] id Ring
+ * @param[in] data Data to append
+ * @param[in] len Length of the data, at most flash_ring_free()
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ *         On failure the data of the ring is discarded, as it cannot be appended in place any more.
+ */
+esp_err_t flash_ring_append(flash_ring_id_t id, const void *data, size_t len);
+
+/**
+ * @brief Commit the data appended to a ring since the last commit
+ *
+ * @param[in] id Ring
+ */
+void flash_ring_commit(flash_ring_id_t id);
+
+/**
+ * @brief Read the oldest data of a ring
+ *
+ * @param[in] id Ring
+ * @param[out] buf Buffer for the data
+ * @param[in] size Size of the buffer
+ *
+ * @return Number of bytes read or -1 on error
+ */
+int flash_ring_read(flash_ring_id_t id, void *buf, size_t size);
+
+/**
+ * @brief Release the oldest data of a ring
+ *
+ * @param[in] id Ring
+ * @param[in] size Number of bytes to release, at most flash_ring_filled()
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+esp_err_t flash_ring_release(flash_ring_id_t id, size_t size);
+
+/**
+ * @brief Discard the data of all the rings
+ */
+void flash_ring_discard(void);
+
+#ifdef __cplusplus
+}
+#endif
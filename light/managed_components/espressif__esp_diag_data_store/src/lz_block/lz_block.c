@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "lz_block.h"
+
+/**
+ * @brief LZ4 block format, without the frame
+ *
+ * A block is a list of sequences: a token, whose high nibble is the literals length and low nibble the match length
+ * minus 4, then the literals, the little endian offset of the match, on two bytes, and the rest of the lengths of 15
+ * or more, as a run of bytes of 255 ended by a smaller one. The last sequence only has literals.
+ * As in LZ4, the last 5 bytes are literals and no match starts in the last 12 bytes, so the blocks can also be
+ * decoded by the LZ4 tools.
+ */
+
+#define LZ_MIN_MATCH      4
+#define LZ_LAST_LITERALS  5
+#define LZ_MF_LIMIT       12
+#define LZ_MAX_OFFSET     0xffff
+#define LZ_HASH_BITS      8
+
+/* Position of the last sequence of 4 bytes with the hash, under the lock of the caller */
+static uint16_t s_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t *lz_put_len(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/* Writes a sequence, NULL if it does not fit */
+static uint8_t *lz_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t lit_len,
+                                size_t offset, size_t match_len, bool last)
+{
+    size_t need = 1 + (lit_len >= 15 ? lit_len / 255 + 1 : 0) + lit_len;
+    if (!last) {
+        need += 2 + (match_len >= 15 ? match_len / 255 + 1 : 0);
+    }
+    if (need > (size_t)(oend - op)) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15) {
+        op = lz_put_len(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (last) {
+        return op;
+    }
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    *token |= match_len >= 15 ? 15 : match_len;
+    if (match_len >= 15) {
+        op = lz_put_len(op, match_len - 15);
+    }
+    return op;
+}
+
+size_t lz_block_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + size;
+
+    if (len > 0x10000) {
+        return 0;
+    }
+    memset(s_table, 0, sizeof(s_table));
+    if (len >= LZ_MF_LIMIT) {
+        const uint8_t *mf_limit = end - LZ_MF_LIMIT;
+        const uint8_t *match_limit = end - LZ_LAST_LITERALS;
+        while (ip <= mf_limit) {
+            uint32_t seq = lz_read32(ip);
+            uint32_t h = lz_hash(seq);
+            const uint8_t *ref = src + s_table[h];
+            s_table[h] = ip - src;
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+            const uint8_t *mp = ip + LZ_MIN_MATCH, *rp = ref + LZ_MIN_MATCH;
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+            op = lz_put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip - LZ_MIN_MATCH, false);
+            if (!op) {
+                return 0;
+            }
+            ip = anchor = mp;
+        }
+    }
+    op = lz_put_sequence(op, oend, anchor, end - anchor, 0, 0, true);
+    return op ? op - dst : 0;
+}
+
+/* Reads the rest of a length of 15 or more, false past the end of the block */
+static inline bool lz_get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lz_block_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    const uint8_t *ip = src, *iend = src + len;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz_get_len(&ip, iend, &lit_len)) {
+            return -1;
+        }
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend) {
+            /* The last sequence */
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t match_len = token & 15;
+        if (match_len == 15 && !lz_get_len(&ip, iend, &match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        /* Byte by byte, the match overlaps the output when it repeats the last bytes */
+        const uint8_t *ref = op - offset;
+        while (match_len--) {
+            *op++ = *ref++;
+        }
+    }
+    return op - dst;
+}
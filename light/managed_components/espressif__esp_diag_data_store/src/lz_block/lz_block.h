@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Compresses a block in the LZ4 block format
+ *
+ * Matches are looked up in a hash table of static memory, the calls are not thread safe, the caller serializes them.
+ *
+ * @param[in] src Data to compress, at most 64K
+ * @param[in] len Length of the data
+ * @param[out] dst Buffer receiving the compressed block
+ * @param[in] size Size of dst
+ *
+ * @return Length of the compressed block, 0 if it does not fit in dst
+ */
+size_t lz_block_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+
+/**
+ * @brief Decompresses a block in the LZ4 block format
+ *
+ * Every length and offset of the block is checked, a corrupted block fails and is never read or written past the
+ * bounds of src and dst.
+ *
+ * @param[in] src Compressed block
+ * @param[in] len Length of the compressed block
+ * @param[out] dst Buffer receiving the data
+ * @param[in] size Size of dst
+ *
+ * @return Length of the data, -1 if the block is corrupted or does not fit in dst
+ */
+int lz_block_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,10 @@
 
 #include <esp_diag_data_store.h>
 #include "rtc_store.h"
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+#include <stdlib.h>
+#include "lz_block.h"
+#endif
 #include <esp_crc.h>
 #include <inttypes.h>
 
@@ -44,14 +48,33 @@
 #define DIAG_CRITICAL_BUF_SIZE        CONFIG_RTC_STORE_CRITICAL_DATA_SIZE
 #define NON_CRITICAL_DATA_SIZE        (CONFIG_RTC_STORE_DATA_SIZE - DIAG_CRITICAL_BUF_SIZE)
 
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+/* The records are written to a buffer of one block, which is compressed into the sealed blocks when it is full */
+#define NC_RAW_DATA_SIZE              CONFIG_RTC_STORE_NON_CRITICAL_BLOCK_SIZE
+#define NC_SEALED_BUF_SIZE            (NON_CRITICAL_DATA_SIZE - NC_RAW_DATA_SIZE)
+/* Peeking the sealed blocks decompresses that much at most */
+#define NC_SEALED_PEEK_SIZE           1024
+
+_Static_assert(NC_SEALED_BUF_SIZE >= NC_RAW_DATA_SIZE,
+               "CONFIG_RTC_STORE_NON_CRITICAL_BLOCK_SIZE is more than half of the non critical data size");
+#else
+#define NC_RAW_DATA_SIZE              NON_CRITICAL_DATA_SIZE
+#endif
+
 /* If data is perfectly aligned then buffers get wrapped and we have to perform two read
  * operation to get all the data, +1 ensures that data will be moved to the start of buffer
  * when there is not enough space at the end of buffer.
  */
-#if ((NON_CRITICAL_DATA_SIZE % 4) == 0)
-#define DIAG_NON_CRITICAL_BUF_SIZE    (NON_CRITICAL_DATA_SIZE + 1)
+#if ((NC_RAW_DATA_SIZE % 4) == 0)
+#define DIAG_NON_CRITICAL_BUF_SIZE    (NC_RAW_DATA_SIZE + 1)
+#else
+#define DIAG_NON_CRITICAL_BUF_SIZE    NC_RAW_DATA_SIZE
+#endif
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+#define NC_TOTAL_SIZE                 (DIAG_NON_CRITICAL_BUF_SIZE + NC_SEALED_BUF_SIZE)
 #else
-#define DIAG_NON_CRITICAL_BUF_SIZE    NON_CRITICAL_DATA_SIZE
+#define NC_TOTAL_SIZE                 DIAG_NON_CRITICAL_BUF_SIZE
 #endif
 
 /* When buffer is filled beyond configured capacity then we post an event.
@@ -63,7 +86,7 @@
 #define DIAG_CRITICAL_DATA_REPORTING_WATERMARK \
     ((DIAG_CRITICAL_BUF_SIZE * (100 - CONFIG_DIAG_DATA_STORE_REPORTING_WATERMARK_PERCENT)) / 100)
 #define DIAG_NON_CRITICAL_DATA_REPORTING_WATERMARK \
-    ((DIAG_NON_CRITICAL_BUF_SIZE * (100 - CONFIG_DIAG_DATA_STORE_REPORTING_WATERMARK_PERCENT)) / 100)
+    ((NC_TOTAL_SIZE * (100 - CONFIG_DIAG_DATA_STORE_REPORTING_WATERMARK_PERCENT)) / 100)
 
 /* non critical data is stored in Length - Value format */
 #define SIZE_OF_DATA_LEN    sizeof(size_t)
@@ -83,16 +106,69 @@ typedef struct {
     data_store_info_t info;
 } data_store_t;
 
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+/* Start of the stored records, so that room is made without reading their headers one by one.
+ * Records written while it is full are not indexed, making room then drops up to the next indexed one.
+ */
+#define RECORD_INDEX_SIZE   (DIAG_NON_CRITICAL_BUF_SIZE / 32 + 1)
+
+typedef struct {
+    uint16_t write_pos;                 // bytes written since init, the stored data ends there
+    uint16_t head;                      // oldest entry
+    uint16_t count;
+    uint16_t pos[RECORD_INDEX_SIZE];    // write_pos at the start of a record, oldest first
+} record_index_t;
+#endif
+
 typedef struct {
     SemaphoreHandle_t lock;     // critical lock
     data_store_t *store;        // pointer to rtc data store
     size_t wrap_cnt;            // keep track of no. of times wrapping happened
+    bool peeked;                // data is read in place, not to be overwritten until released
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    record_index_t *index;      // record boundaries, NULL if the records are not evicted
+#endif
 } rbuf_data_t;
 
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+/* Group 0 is the data without a quota */
+#define NC_GROUPS           (CONFIG_RTC_STORE_NON_CRITICAL_GROUPS + 1)
+#define NC_GROUP(g)         ((g) < NC_GROUPS ? (g) : 0)
+
+typedef struct {
+    const char *dg[NC_GROUPS];
+    uint16_t quota[NC_GROUPS];
+    uint16_t filled[NC_GROUPS];     // bytes of the records of the group in the non critical buffer
+    uint8_t count;                  // groups with a quota, from 1
+} nc_groups_t;
+#endif
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+/* Header of a sealed block, the records which filled the raw buffer, compressed in the LZ4 block format.
+ * The blocks are released from the oldest, skip being the bytes of its records released already.
+ */
+typedef struct {
+    uint16_t len;           // bytes following the header, raw_len if the records were stored as is
+    uint16_t raw_len;
+    uint16_t skip;
+} nc_block_hdr_t;
+
+typedef struct {
+    data_store_t *store;    // ring of the sealed blocks, under the non_critical lock
+    uint8_t *peek_buf;      // decompressed data of the last peek, until it is released
+} nc_sealed_t;
+#endif
+
 typedef struct {
     bool init;
     rbuf_data_t critical;
     rbuf_data_t non_critical;
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    nc_groups_t groups;
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    nc_sealed_t sealed;
+#endif
     rtc_store_meta_header_t *meta_hdr;
     char sha_sum[RTC_STORE_HEX_SHA_SIZE + 1];
 } rtc_store_priv_data_t;
@@ -112,6 +188,12 @@ typedef struct {
         data_store_t store;
         uint8_t buf[DIAG_NON_CRITICAL_BUF_SIZE];
     } non_critical;
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    struct {
+        data_store_t store;
+        uint8_t buf[NC_SEALED_BUF_SIZE];
+    } sealed;
+#endif
     rtc_store_meta_header_t meta[RTC_STORE_MAX_META_RECORDS];
     uint8_t meta_hdr_idx;
 } rtc_store_t;
@@ -126,6 +208,14 @@ typedef struct {
 
 static rtc_store_priv_data_t s_priv_data;
 RTC_NOINIT_ATTR static rtc_store_t s_rtc_store;
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+static record_index_t s_record_index;
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+/* Raw records of a block and its compressed data, while sealing or reading it under the non_critical lock */
+static uint8_t s_nc_block[DIAG_NON_CRITICAL_BUF_SIZE];
+static uint8_t s_nc_packed[DIAG_NON_CRITICAL_BUF_SIZE];
+#endif
 
 static inline size_t data_store_get_size(data_store_t *store)
 {
@@ -154,6 +244,120 @@ static inline size_t data_store_get_filled(data_store_t *store)
     return info->filled;
 }
 
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA || CONFIG_RTC_STORE_NON_CRITICAL_GROUPS || \
+    CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+// Copies len bytes from offset off of the stored data
+static void data_store_copy_out(data_store_t *store, size_t off, void *buf, size_t len)
+{
+    size_t pos = store->info.read_offset + off;
+    while (pos >= store->size) {
+        pos -= store->size;
+    }
+    size_t to_end = store->size - pos;
+    if (len <= to_end) {
+        memcpy(buf, store->buf + pos, len);
+    } else {
+        memcpy(buf, store->buf + pos, to_end);
+        memcpy((uint8_t *) buf + to_end, store->buf, len - to_end);
+    }
+}
+#endif
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+// Quota group of the data group dg, 0 if it has no quota
+static uint8_t nc_group_of(const char *dg)
+{
+    nc_groups_t *groups = &s_priv_data.groups;
+    for (uint8_t g = 1; g <= groups->count; g++) {
+        if (groups->dg[g] == dg || strcmp(groups->dg[g], dg) == 0) {
+            return g;
+        }
+    }
+    return 0;
+}
+
+// Adds the records in the len bytes at offset off of the stored data to the fill of their groups, or removes them
+static void nc_groups_account(data_store_t *store, size_t off, size_t len, bool add)
+{
+    uint16_t *filled = s_priv_data.groups.filled;
+    size_t end = off + len;
+    while (off + 1 + sizeof(rtc_store_non_critical_data_hdr_t) <= end) {
+        rtc_store_non_critical_data_hdr_t header;
+        data_store_copy_out(store, off + 1, &header, sizeof(header)); // skip meta_hdr idx
+        size_t rec_len = 1 + sizeof(header) + header.len;
+        if (off + rec_len > end) {
+            break;
+        }
+        uint8_t g = NC_GROUP(header.group);
+        if (add) {
+            filled[g] += rec_len;
+        } else {
+            filled[g] = filled[g] > rec_len ? filled[g] - rec_len : 0;
+        }
+        off += rec_len;
+    }
+}
+
+// Bytes of the quotas of the groups other than g not used yet, pending bytes of each group are being written
+static size_t nc_groups_reserved(uint8_t g, const uint16_t pending[NC_GROUPS])
+{
+    nc_groups_t *groups = &s_priv_data.groups;
+    size_t reserved = 0;
+    for (uint8_t i = 1; i <= groups->count; i++) {
+        size_t used = groups->filled[i] + pending[i];
+        if (i != g && used < groups->quota[i]) {
+            reserved += groups->quota[i] - used;
+        }
+    }
+    return reserved;
+}
+
+// Whether len bytes of group g fit in free bytes, within its quota or without the room left for the other quotas
+static bool nc_groups_admit(uint8_t g, size_t len, const uint16_t pending[NC_GROUPS], size_t free)
+{
+    nc_groups_t *groups = &s_priv_data.groups;
+    if (len > free) {
+        return false;
+    }
+    if (g && groups->filled[g] + pending[g] + len <= groups->quota[g]) {
+        return true;
+    }
+    return len + nc_groups_reserved(g, pending) <= free;
+}
+#endif
+
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+// Positions are compared by their distance from the start of the stored data, which is less than 64K
+static inline uint16_t record_index_read_pos(rbuf_data_t *rbuf_data)
+{
+    return rbuf_data->index->write_pos - rbuf_data->store->info.filled;
+}
+
+static inline uint16_t record_index_at(record_index_t *index, size_t i)
+{
+    return index->pos[(index->head + i) % RECORD_INDEX_SIZE];
+}
+
+static void record_index_add(record_index_t *index, uint16_t pos)
+{
+    if (index->count < RECORD_INDEX_SIZE) {
+        index->pos[(index->head + index->count) % RECORD_INDEX_SIZE] = pos;
+        index->count++;
+    }
+}
+
+// Drops the entries of the len bytes being freed at the start of the stored data
+static void record_index_free(rbuf_data_t *rbuf_data, size_t len)
+{
+    record_index_t *index = rbuf_data->index;
+    uint16_t read_pos = record_index_read_pos(rbuf_data);
+    while (index->count && (uint16_t) (record_index_at(index, 0) - read_pos) < len) {
+        index->head = (index->head + 1) % RECORD_INDEX_SIZE;
+        index->count--;
+    }
+}
+#endif
+
 static void rtc_store_read_complete(rbuf_data_t *rbuf_data, size_t len)
 {
     data_store_info_t info =  {
@@ -161,6 +365,16 @@ static void rtc_store_read_complete(rbuf_data_t *rbuf_data, size_t len)
     };
 #if RTC_STORE_DBG_PRINTS
     ESP_LOGI(TAG, "to free %u, size %u", len, rbuf_data->store->size);
+#endif
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    if (rbuf_data->index) {
+        record_index_free(rbuf_data, len);
+    }
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    if (rbuf_data == &s_priv_data.non_critical) {
+        nc_groups_account(rbuf_data->store, 0, len, false);
+    }
 #endif
     // modify new pointers
     info.filled -= len;
@@ -184,6 +398,11 @@ static void rtc_store_write_complete(rbuf_data_t *rbuf_data, size_t len)
 #endif
 
     info->filled += len;
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    if (rbuf_data->index) {
+        rbuf_data->index->write_pos += len;
+    }
+#endif
 
 #if RTC_STORE_DBG_PRINTS
     ESP_LOGI(TAG, "after write_complete, filled %" PRIu16 ", size %u, read_offset %" PRIu16 ", len %u",
@@ -227,6 +446,19 @@ static size_t rtc_store_write(rbuf_data_t *rbuf_data, void *data, size_t len)
     return rtc_store_write_at_offset(rbuf_data, data, len, 0);
 }
 
+// Copies len bytes to offset pos of the buffer, wrapping around its end, returns the offset following them
+static size_t data_store_copy_in(data_store_t *store, size_t pos, const void *data, size_t len)
+{
+    size_t to_end = store->size - pos;
+    if (len < to_end) {
+        memcpy(store->buf + pos, data, len);
+        return pos + len;
+    }
+    memcpy(store->buf + pos, data, to_end);
+    memcpy(store->buf, (const uint8_t *) data + to_end, len - to_end);
+    return len - to_end;
+}
+
 esp_err_t rtc_store_critical_data_write(void *data, size_t len)
 {
     esp_err_t ret = ESP_OK;
@@ -270,9 +502,7 @@ esp_err_t rtc_store_critical_data_write(void *data, size_t len)
     return ret;
 }
 
-static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size);
-
-esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len)
+static esp_err_t rtc_store_non_critical_data_check(const char *dg, const void *data, size_t len)
 {
     if (!dg || !len || !data) {
         return ESP_ERR_INVALID_ARG;
@@ -280,58 +510,414 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
     if (!esp_ptr_in_drom(dg)) {
         return ESP_ERR_INVALID_ARG;
     }
-    if (!s_priv_data.init) {
-        printf("rtc_store init not done! skipping non_critical_data_write...\n");
-        return ESP_ERR_INVALID_STATE;
-    }
-    rtc_store_non_critical_data_hdr_t header;
-    size_t req_free = sizeof(header) + len + 1; // 1 byte for meta index
-    size_t curr_free;
-
+    size_t req_free = sizeof(rtc_store_non_critical_data_hdr_t) + len + 1; // 1 byte for meta index
     if (req_free > DIAG_NON_CRITICAL_BUF_SIZE) {
         printf("rtc_store_non_critical_data_write: len too large %d, size %d\n",
                 req_free, DIAG_NON_CRITICAL_BUF_SIZE);
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    if (xSemaphoreTake(s_priv_data.non_critical.lock, 0) == pdFALSE) {
-        return ESP_FAIL;
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+// Drops the oldest records until req_free bytes are free, caller holds the non_critical lock
+static void rtc_store_non_critical_data_evict(rbuf_data_t *rbuf_data, size_t req_free)
+{
+    size_t curr_free = data_store_get_free(rbuf_data->store);
+    if (curr_free >= req_free) {
+        return;
+    }
+    record_index_t *index = rbuf_data->index;
+    uint16_t read_pos = record_index_read_pos(rbuf_data);
+    size_t needed = req_free - curr_free;
+
+    // first indexed record starting after the bytes needed
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((uint16_t) (record_index_at(index, mid) - read_pos) < needed) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t to_free;
+    if (lo < index->count) {
+        to_free = (uint16_t) (record_index_at(index, lo) - read_pos);
+    } else {
+        // the records past the last indexed one are not indexed, walk them
+        to_free = lo ? (uint16_t) (record_index_at(index, lo - 1) - read_pos) : 0;
+        size_t filled = data_store_get_filled(rbuf_data->store);
+        while (to_free < needed && to_free + 1 + sizeof(rtc_store_non_critical_data_hdr_t) <= filled) {
+            rtc_store_non_critical_data_hdr_t header;
+            data_store_copy_out(rbuf_data->store, to_free + 1, &header, sizeof(header)); // skip meta_hdr idx
+            to_free += 1 + sizeof(header) + header.len;
+        }
+        if (to_free < needed || to_free > filled) {
+            to_free = filled;
+        }
+    }
+    rtc_store_read_complete(rbuf_data, to_free);
+}
+#endif
+
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA && CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+// Moves len bytes of the stored data from offset src to offset dst, before it
+static void data_store_move(data_store_t *store, size_t dst, size_t src, size_t len)
+{
+    uint8_t bounce[32];
+    while (len) {
+        size_t n = len < sizeof(bounce) ? len : sizeof(bounce);
+        size_t pos = store->info.read_offset + dst;
+        while (pos >= store->size) {
+            pos -= store->size;
+        }
+        data_store_copy_out(store, src, bounce, n);
+        data_store_copy_in(store, pos, bounce, n);
+        dst += n;
+        src += n;
+        len -= n;
+    }
+}
+
+/* Drops the oldest records of the groups over their quota until req_free bytes are free, and an eighth of the
+ * buffer more so that the next writes do not drop again, moving the other records over them.
+ * Caller holds the non_critical lock, and the data is not being read in place.
+ */
+static void rtc_store_non_critical_data_compact(rbuf_data_t *rbuf_data, size_t req_free)
+{
+    data_store_t *store = rbuf_data->store;
+    nc_groups_t *groups = &s_priv_data.groups;
+    size_t filled = data_store_get_filled(store);
+    size_t curr_free = store->size - filled;
+    if (curr_free >= req_free) {
+        return;
+    }
+    size_t over[NC_GROUPS], over_total = 0;
+    for (uint8_t g = 0; g < NC_GROUPS; g++) {
+        over[g] = groups->filled[g] > groups->quota[g] ? groups->filled[g] - groups->quota[g] : 0;
+        over_total += over[g];
+    }
+    if (!over_total) {
+        return;
+    }
+
+    record_index_t *index = rbuf_data->index;
+    uint16_t read_pos = record_index_read_pos(rbuf_data);
+    size_t to_drop = req_free - curr_free + store->size / 8;
+    size_t in = 0, out = 0;
+    // the kept records are indexed again at their new position
+    index->head = 0;
+    index->count = 0;
+    while (in + 1 + sizeof(rtc_store_non_critical_data_hdr_t) <= filled) {
+        rtc_store_non_critical_data_hdr_t header;
+        data_store_copy_out(store, in + 1, &header, sizeof(header)); // skip meta_hdr idx
+        size_t rec_len = 1 + sizeof(header) + header.len;
+        if (in + rec_len > filled) {
+            break;
+        }
+        uint8_t g = NC_GROUP(header.group);
+        if (in - out < to_drop && over[g]) {
+            over[g] = over[g] > rec_len ? over[g] - rec_len : 0;
+            groups->filled[g] = groups->filled[g] > rec_len ? groups->filled[g] - rec_len : 0;
+        } else {
+            if (out != in) {
+                data_store_move(store, out, in, rec_len);
+            }
+            record_index_add(index, read_pos + out);
+            out += rec_len;
+        }
+        in += rec_len;
+    }
+    size_t dropped = in - out;
+    if (dropped && in < filled) {
+        data_store_move(store, out, in, filled - in);
+    }
+    store->info.filled -= dropped;
+    index->write_pos -= dropped;
+}
+#endif
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+// Position of offset off of the sealed blocks
+static inline size_t nc_sealed_pos(data_store_t *store, size_t off)
+{
+    size_t pos = store->info.read_offset + off;
+    while (pos >= store->size) {
+        pos -= store->size;
     }
+    return pos;
+}
+
+// Frees the len bytes of the oldest sealed blocks
+static void nc_sealed_free(data_store_t *store, size_t len)
+{
+    data_store_info_t info = {
+        .value = store->info.value,
+    };
+    info.read_offset = nc_sealed_pos(store, len);
+    info.filled -= len;
+    store->info.value = info.value;
+}
 
+// Bytes of the records of the sealed blocks not released yet
+static size_t nc_sealed_raw_filled(data_store_t *store)
+{
+    size_t raw_filled = 0;
+    for (size_t off = 0; off < store->info.filled;) {
+        nc_block_hdr_t hdr;
+        data_store_copy_out(store, off, &hdr, sizeof(hdr));
+        raw_filled += hdr.raw_len - hdr.skip;
+        off += sizeof(hdr) + hdr.len;
+    }
+    return raw_filled;
+}
+
+// Raw records of the block at offset off of the sealed blocks, NULL if it is corrupted
+static const uint8_t *nc_sealed_block_get(data_store_t *store, size_t off, nc_block_hdr_t *hdr)
+{
+    data_store_copy_out(store, off, hdr, sizeof(*hdr));
+    if (hdr->len == hdr->raw_len) {
+        data_store_copy_out(store, off + sizeof(*hdr), s_nc_block, hdr->len);
+        return s_nc_block;
+    }
+    data_store_copy_out(store, off + sizeof(*hdr), s_nc_packed, hdr->len);
+    if (lz_block_decompress(s_nc_packed, hdr->len, s_nc_block, sizeof(s_nc_block)) != hdr->raw_len) {
+        return NULL;
+    }
+    return s_nc_block;
+}
+
+/* Compresses the records of the raw buffer into a sealed block, making room for the next records.
+ * Caller holds the non_critical lock, returns false if the block does not fit.
+ */
+static bool nc_seal(rbuf_data_t *rbuf_data)
+{
+    data_store_t *sealed = s_priv_data.sealed.store;
+    size_t raw_len = data_store_get_filled(rbuf_data->store);
+    nc_block_hdr_t hdr = { 0 };
+
+    // the records read in place must stay where they are
+    if (!raw_len || (rbuf_data->peeked && !s_priv_data.sealed.peek_buf)) {
+        return false;
+    }
+    data_store_copy_out(rbuf_data->store, 0, s_nc_block, raw_len);
+    hdr.raw_len = raw_len;
+    hdr.len = lz_block_compress(s_nc_block, raw_len, s_nc_packed, raw_len - 1);
+    const uint8_t *data = s_nc_packed;
+    if (!hdr.len) {
+        // stored as is, it did not compress
+        hdr.len = raw_len;
+        data = s_nc_block;
+    }
+    size_t need = sizeof(hdr) + hdr.len;
 #if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
-    /* Make enough room for the item */
-    while (data_store_get_free(s_priv_data.non_critical.store) < req_free) {
-        uint8_t tmp_buf[sizeof(header) + 1];
-        rtc_store_data_read_unsafe(&s_priv_data.non_critical, tmp_buf, sizeof(tmp_buf));
-        memcpy(&header, tmp_buf + 1, sizeof(header)); // because 1 byte is meta_hdr idx
-        size_t to_free = sizeof(tmp_buf) + header.len;
-        rtc_store_read_complete(&s_priv_data.non_critical, to_free);
-    }
-#else // just check if we have enough space to write the item
-    curr_free = data_store_get_free(s_priv_data.non_critical.store);
-    if (curr_free < req_free) {
-        xSemaphoreGive(s_priv_data.non_critical.lock);
-        esp_event_post(ESP_DIAG_DATA_STORE_EVENT, ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM, NULL, 0, 0);
-        return ESP_ERR_NO_MEM;
+    // the oldest blocks make way, unless they are being read
+    while (!rbuf_data->peeked && sealed->info.filled && data_store_get_free(sealed) < need) {
+        nc_block_hdr_t oldest;
+        data_store_copy_out(sealed, 0, &oldest, sizeof(oldest));
+        nc_sealed_free(sealed, sizeof(oldest) + oldest.len);
     }
 #endif
+    if (data_store_get_free(sealed) < need) {
+        return false;
+    }
+    size_t pos = nc_sealed_pos(sealed, sealed->info.filled);
+    pos = data_store_copy_in(sealed, pos, &hdr, sizeof(hdr));
+    data_store_copy_in(sealed, pos, data, hdr.len);
+    sealed->info.filled += need;
+    rtc_store_read_complete(rbuf_data, raw_len);
+    return true;
+}
+
+// Bytes of the items, with their meta index and header
+static size_t nc_items_len(const rtc_store_non_critical_item_t items[], size_t count)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) {
+        len += 1 + sizeof(rtc_store_non_critical_data_hdr_t) + items[i].len;
+    }
+    return len;
+}
+#endif
+
+// Caller holds the non_critical lock and has checked the items, returns the number of items written
+static size_t rtc_store_non_critical_records_write_unsafe(const rtc_store_non_critical_item_t items[], size_t count)
+{
+    rbuf_data_t *rbuf_data = &s_priv_data.non_critical;
+    rtc_store_non_critical_data_hdr_t header;
+    size_t room = data_store_get_free(rbuf_data->store);
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA || CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    bool overwrite = false;
+#endif
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    if (!rbuf_data->peeked) {
+        // the oldest records make way, unless they are being read in place
+        room = data_store_get_size(rbuf_data->store);
+        overwrite = true;
+    }
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    uint16_t pending[NC_GROUPS] = { 0 };
+#endif
+    size_t n, req_free = 0;
+    for (n = 0; n < count; n++) {
+        size_t len = 1 + sizeof(header) + items[n].len; // 1 byte for meta index
+        if (req_free + len > room) {
+            break;
+        }
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+        // without overwriting, the room left for the quotas is kept
+        uint8_t g = nc_group_of(items[n].dg);
+        if (!overwrite && !nc_groups_admit(g, len, pending, room - req_free)) {
+            break;
+        }
+        pending[g] += len;
+#endif
+        req_free += len;
+    }
+    if (!n) {
+        return 0;
+    }
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    if (overwrite) {
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+        rtc_store_non_critical_data_compact(rbuf_data, req_free);
+#endif
+        rtc_store_non_critical_data_evict(rbuf_data, req_free);
+    }
+#endif
+
+    // we have made sure of free size at this point, write index byte, data header and then actual data of each
+    data_store_info_t *info = (data_store_info_t *) &rbuf_data->store->info;
+    size_t pos = info->read_offset + info->filled;
+    if (pos >= rbuf_data->store->size) {
+        pos -= rbuf_data->store->size;
+    }
     memset(&header, 0, sizeof(header));
-    header.len = len;
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    uint16_t record_pos = rbuf_data->index->write_pos;
+#endif
+    for (size_t i = 0; i < n; i++) {
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+        record_index_add(rbuf_data->index, record_pos);
+        record_pos += 1 + sizeof(header) + items[i].len;
+#endif
+        header.len = items[i].len;
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+        header.group = nc_group_of(items[i].dg);
+        s_priv_data.groups.filled[header.group] += 1 + sizeof(header) + items[i].len;
+#endif
+        pos = data_store_copy_in(rbuf_data->store, pos, &s_rtc_store.meta_hdr_idx, 1);
+        pos = data_store_copy_in(rbuf_data->store, pos, &header, sizeof(header));
+        pos = data_store_copy_in(rbuf_data->store, pos, items[i].data, items[i].len);
+    }
+    // the records are seen by the readers together
+    rtc_store_write_complete(rbuf_data, req_free);
+    return n;
+}
+
+// Caller holds the non_critical lock and has checked the items, returns the number of items written
+static size_t rtc_store_non_critical_data_write_unsafe(const rtc_store_non_critical_item_t items[], size_t count)
+{
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    // the records are sealed before any of them is dropped or an item does not fit
+    size_t n = 0;
+    while (n < count) {
+        if (nc_items_len(items + n, count - n) > data_store_get_free(s_priv_data.non_critical.store)) {
+            nc_seal(&s_priv_data.non_critical);
+        }
+        size_t written = rtc_store_non_critical_records_write_unsafe(items + n, count - n);
+        if (!written) {
+            break;
+        }
+        n += written;
+    }
+    return n;
+#else
+    return rtc_store_non_critical_records_write_unsafe(items, count);
+#endif
+}
+
+// Free bytes of the non critical data, caller holds the non_critical lock
+static size_t rtc_store_non_critical_data_free(void)
+{
+    size_t curr_free = data_store_get_free(s_priv_data.non_critical.store);
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    curr_free += data_store_get_free(s_priv_data.sealed.store);
+#endif
+    return curr_free;
+}
 
-    // we have made sure of free size at this point, write index byte, data header and then actual data
-    rtc_store_write(&s_priv_data.non_critical, &s_rtc_store.meta_hdr_idx, 1);
-    rtc_store_write_at_offset(&s_priv_data.non_critical, &header, sizeof(header), 1);
-    rtc_store_write_at_offset(&s_priv_data.non_critical, data, len, 1 + sizeof(header));
-    rtc_store_write_complete(&s_priv_data.non_critical, req_free);
+esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len)
+{
+    esp_err_t ret = rtc_store_non_critical_data_check(dg, data, len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (!s_priv_data.init) {
+        printf("rtc_store init not done! skipping non_critical_data_write...\n");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    curr_free = data_store_get_free(s_priv_data.non_critical.store);
+    rtc_store_non_critical_item_t item = {
+        .dg = dg,
+        .data = data,
+        .len = len,
+    };
+    if (xSemaphoreTake(s_priv_data.non_critical.lock, 0) == pdFALSE) {
+        return ESP_FAIL;
+    }
+    if (rtc_store_non_critical_data_write_unsafe(&item, 1) != 1) {
+        ret = ESP_ERR_NO_MEM;
+    }
+    size_t curr_free = rtc_store_non_critical_data_free();
     xSemaphoreGive(s_priv_data.non_critical.lock);
 
     // Post low memory event even if data overwrite is enabled.
     if (curr_free < DIAG_NON_CRITICAL_DATA_REPORTING_WATERMARK) {
         esp_event_post(ESP_DIAG_DATA_STORE_EVENT, ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM, NULL, 0, 0);
     }
-    return ESP_OK;
+    return ret;
+}
+
+esp_err_t rtc_store_non_critical_data_write_batch(const rtc_store_non_critical_item_t items[], size_t count,
+                                                  size_t *written)
+{
+    esp_err_t ret = ESP_OK;
+    size_t i, valid;
+
+    if (!items || !count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        printf("rtc_store init not done! skipping non_critical_data_write_batch...\n");
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (valid = 0; valid < count; valid++) {
+        ret = rtc_store_non_critical_data_check(items[valid].dg, items[valid].data, items[valid].len);
+        if (ret != ESP_OK) {
+            break;
+        }
+    }
+
+    // The batch is written off the reporting path, so it can wait for the reader
+    xSemaphoreTake(s_priv_data.non_critical.lock, portMAX_DELAY);
+    i = rtc_store_non_critical_data_write_unsafe(items, valid);
+    size_t curr_free = rtc_store_non_critical_data_free();
+    xSemaphoreGive(s_priv_data.non_critical.lock);
+
+    if (i < valid) {
+        ret = ESP_ERR_NO_MEM;
+    }
+
+    if (written) {
+        *written = i;
+    }
+    if (curr_free < DIAG_NON_CRITICAL_DATA_REPORTING_WATERMARK) {
+        esp_event_post(ESP_DIAG_DATA_STORE_EVENT, ESP_DIAG_DATA_STORE_EVENT_NON_CRITICAL_DATA_LOW_MEM, NULL, 0, 0);
+    }
+    return ret;
 }
 
 static int rtc_store_data_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size)
@@ -369,12 +955,51 @@ static int rtc_store_data_read(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size
     return size;
 }
 
+// Caller holds the lock of the buffer
+static int rtc_store_data_peek_unsafe(rbuf_data_t *rbuf_data, esp_diag_data_store_span_t spans[2])
+{
+    data_store_info_t info = {
+        .value = rbuf_data->store->info.value,
+    };
+    rbuf_data->peeked = true;
+
+    /* Writers only append past the filled data, which is left in place */
+    size_t read_offset = info.read_offset;
+    if (read_offset >= rbuf_data->store->size) {
+        read_offset -= rbuf_data->store->size;
+    }
+    size_t data_at_end = rbuf_data->store->size - read_offset;
+    spans[0].data = rbuf_data->store->buf + read_offset;
+    if (data_at_end < info.filled) {
+        spans[0].len = data_at_end;
+        spans[1].data = rbuf_data->store->buf;
+        spans[1].len = info.filled - data_at_end;
+    } else {
+        spans[0].len = info.filled;
+        spans[1].data = NULL;
+        spans[1].len = 0;
+    }
+    return info.filled;
+}
+
+static int rtc_store_data_peek(rbuf_data_t *rbuf_data, esp_diag_data_store_span_t spans[2])
+{
+    if (!spans || !s_priv_data.init) {
+        return -1;
+    }
+    xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
+    int len = rtc_store_data_peek_unsafe(rbuf_data, spans);
+    xSemaphoreGive(rbuf_data->lock);
+    return len;
+}
+
 static esp_err_t rtc_store_data_release(rbuf_data_t *rbuf_data, size_t size)
 {
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
     xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
+    rbuf_data->peeked = false;
     data_store_info_t *info = (data_store_info_t *) &rbuf_data->store->info;
     if (info->filled < size) {
         xSemaphoreGive(rbuf_data->lock);
@@ -385,11 +1010,109 @@ static esp_err_t rtc_store_data_release(rbuf_data_t *rbuf_data, size_t size)
     return ESP_OK;
 }
 
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+/* Copies the records of the sealed blocks, decompressed, then of the raw buffer, as one stream.
+ * Caller holds the non_critical lock.
+ */
+static size_t nc_sealed_read_unsafe(rbuf_data_t *rbuf_data, uint8_t *buf, size_t size)
+{
+    data_store_t *sealed = s_priv_data.sealed.store;
+    size_t off = 0, len = 0;
+    while (off < sealed->info.filled && len < size) {
+        nc_block_hdr_t hdr;
+        const uint8_t *block = nc_sealed_block_get(sealed, off, &hdr);
+        if (!block) {
+            printf("%s: corrupted non critical block, discarding the blocks...\n", TAG);
+            sealed->info.value = 0;
+            return 0;
+        }
+        size_t n = hdr.raw_len - hdr.skip;
+        if (n > size - len) {
+            n = size - len;
+        }
+        memcpy(buf + len, block + hdr.skip, n);
+        len += n;
+        off += sizeof(hdr) + hdr.len;
+    }
+    if (len < size) {
+        len += rtc_store_data_read_unsafe(rbuf_data, buf + len, size - len);
+    }
+    return len;
+}
+
+// The sealed blocks are decompressed to a buffer, the raw buffer alone is read in place
+static int nc_sealed_peek(rbuf_data_t *rbuf_data, esp_diag_data_store_span_t spans[2])
+{
+    nc_sealed_t *sealed = &s_priv_data.sealed;
+    int len = -1;
+
+    if (!spans || !s_priv_data.init) {
+        return -1;
+    }
+    xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
+    // a peek not released yet is replaced
+    free(sealed->peek_buf);
+    sealed->peek_buf = NULL;
+    if (!sealed->store->info.filled) {
+        len = rtc_store_data_peek_unsafe(rbuf_data, spans);
+    } else if ((sealed->peek_buf = malloc(NC_SEALED_PEEK_SIZE)) != NULL) {
+        len = nc_sealed_read_unsafe(rbuf_data, sealed->peek_buf, NC_SEALED_PEEK_SIZE);
+        rbuf_data->peeked = true;
+        spans[0].data = sealed->peek_buf;
+        spans[0].len = len;
+        spans[1].data = NULL;
+        spans[1].len = 0;
+    }
+    xSemaphoreGive(rbuf_data->lock);
+    return len;
+}
+
+// Releases the records of the sealed blocks first, then of the raw buffer
+static esp_err_t nc_sealed_release(rbuf_data_t *rbuf_data, size_t size)
+{
+    data_store_t *sealed = s_priv_data.sealed.store;
+    esp_err_t ret = ESP_OK;
+
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(rbuf_data->lock, portMAX_DELAY);
+    rbuf_data->peeked = false;
+    free(s_priv_data.sealed.peek_buf);
+    s_priv_data.sealed.peek_buf = NULL;
+    if (nc_sealed_raw_filled(sealed) + data_store_get_filled(rbuf_data->store) < size) {
+        ret = ESP_FAIL;
+        goto exit;
+    }
+    while (size && sealed->info.filled) {
+        nc_block_hdr_t hdr;
+        data_store_copy_out(sealed, 0, &hdr, sizeof(hdr));
+        size_t left = hdr.raw_len - hdr.skip;
+        if (size < left) {
+            hdr.skip += size;
+            data_store_copy_in(sealed, sealed->info.read_offset, &hdr, sizeof(hdr));
+            goto exit;
+        }
+        nc_sealed_free(sealed, sizeof(hdr) + hdr.len);
+        size -= left;
+    }
+    rtc_store_read_complete(rbuf_data, size);
+exit:
+    xSemaphoreGive(rbuf_data->lock);
+    return ret;
+}
+#endif
+
 int rtc_store_critical_data_read(uint8_t *buf, size_t size)
 {
     return rtc_store_data_read(&s_priv_data.critical, buf, size);
 }
 
+int rtc_store_critical_data_peek(esp_diag_data_store_span_t spans[2])
+{
+    return rtc_store_data_peek(&s_priv_data.critical, spans);
+}
+
 int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size)
 {
     int data_read = rtc_store_data_read(&s_priv_data.critical, buf, size);
@@ -401,14 +1124,33 @@ int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size)
 
 int rtc_store_non_critical_data_read(uint8_t *buf, size_t size)
 {
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    if (!size || !s_priv_data.init) {
+        return -1;
+    }
+    xSemaphoreTake(s_priv_data.non_critical.lock, portMAX_DELAY);
+    size = nc_sealed_read_unsafe(&s_priv_data.non_critical, buf, size);
+    xSemaphoreGive(s_priv_data.non_critical.lock);
+    return size;
+#else
     return rtc_store_data_read(&s_priv_data.non_critical, buf, size);
+#endif
+}
+
+int rtc_store_non_critical_data_peek(esp_diag_data_store_span_t spans[2])
+{
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    return nc_sealed_peek(&s_priv_data.non_critical, spans);
+#else
+    return rtc_store_data_peek(&s_priv_data.non_critical, spans);
+#endif
 }
 
 int rtc_store_non_critical_data_read_and_release(uint8_t *buf, size_t size)
 {
-    int data_read = rtc_store_data_read(&s_priv_data.non_critical, buf, size);
+    int data_read = rtc_store_non_critical_data_read(buf, size);
     if (data_read > 0) {
-        rtc_store_data_release(&s_priv_data.non_critical, data_read);
+        rtc_store_non_critical_data_release(data_read);
     }
     return data_read;
 }
@@ -420,7 +1162,11 @@ esp_err_t rtc_store_critical_data_release(size_t size)
 
 esp_err_t rtc_store_non_critical_data_release(size_t size)
 {
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    return nc_sealed_release(&s_priv_data.non_critical, size);
+#else
     return rtc_store_data_release(&s_priv_data.non_critical, size);
+#endif
 }
 
 static void rtc_store_rbuf_deinit(rbuf_data_t *rbuf_data)
@@ -435,6 +1181,10 @@ void rtc_store_deinit(void)
 {
     rtc_store_rbuf_deinit(&s_priv_data.critical);
     rtc_store_rbuf_deinit(&s_priv_data.non_critical);
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    free(s_priv_data.sealed.peek_buf);
+    s_priv_data.sealed.peek_buf = NULL;
+#endif
     s_priv_data.init = false;
 }
 
@@ -484,6 +1234,49 @@ static esp_err_t rtc_store_rbuf_init(rbuf_data_t *rbuf_data,
     return ESP_OK;
 }
 
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+// Checks the headers of the sealed blocks kept in RTC memory across the reset
+static bool nc_sealed_check(data_store_t *store)
+{
+    size_t off = 0;
+    if (!rtc_store_integrity_check(store)) {
+        return false;
+    }
+    while (off < store->info.filled) {
+        nc_block_hdr_t hdr;
+        if (store->info.filled - off < sizeof(hdr)) {
+            return false;
+        }
+        data_store_copy_out(store, off, &hdr, sizeof(hdr));
+        if (!hdr.raw_len || hdr.raw_len > DIAG_NON_CRITICAL_BUF_SIZE || hdr.len > hdr.raw_len ||
+                hdr.skip >= hdr.raw_len) {
+            return false;
+        }
+        off += sizeof(hdr) + hdr.len;
+    }
+    return off == store->info.filled;
+}
+
+static void nc_sealed_init(void)
+{
+    data_store_t *store = &s_rtc_store.sealed.store;
+    esp_reset_reason_t reset_reason = esp_reset_reason();
+
+    if (reset_reason == ESP_RST_UNKNOWN ||
+            reset_reason == ESP_RST_POWERON ||
+            reset_reason == ESP_RST_BROWNOUT) {
+        store->info.value = 0;
+    }
+    store->buf = s_rtc_store.sealed.buf;
+    store->size = NC_SEALED_BUF_SIZE;
+    if (!nc_sealed_check(store)) {
+        printf("%s: intergrity_check of the non critical blocks failed, discarding them...\n", TAG);
+        store->info.value = 0;
+    }
+    s_priv_data.sealed.store = store;
+}
+#endif
+
 rtc_store_meta_header_t *rtc_store_get_meta_record_by_index(uint8_t idx)
 {
     if (idx >= RTC_STORE_MAX_META_RECORDS) {
@@ -582,6 +1375,15 @@ esp_err_t rtc_store_discard_data(void)
     xSemaphoreGive(s_priv_data.critical.lock);
     xSemaphoreTake(s_priv_data.non_critical.lock, portMAX_DELAY);
     s_rtc_store.non_critical.store.info.value = 0;
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    s_rtc_store.sealed.store.info.value = 0;
+#endif
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    memset(&s_record_index, 0, sizeof(s_record_index));
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    memset(s_priv_data.groups.filled, 0, sizeof(s_priv_data.groups.filled));
+#endif
     xSemaphoreGive(s_priv_data.non_critical.lock);
     return ESP_OK;
 }
@@ -597,9 +1399,85 @@ uint32_t rtc_store_get_crc()
     };
     uint32_t crc = 0;
     crc = esp_crc32_le(crc, (const unsigned char *)&rtc_meta_info, sizeof(rtc_meta_info));
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    // the blocks kept across the reset are only read by a firmware with the same layout
+    size_t sealed_buf_size = NC_SEALED_BUF_SIZE;
+    crc = esp_crc32_le(crc, (const unsigned char *)&sealed_buf_size, sizeof(sealed_buf_size));
+#endif
     return crc;
 }
 
+esp_err_t rtc_store_non_critical_quota_set(const char *dg, size_t quota)
+{
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    nc_groups_t *groups = &s_priv_data.groups;
+    esp_err_t ret = ESP_OK;
+
+    if (!dg || !esp_ptr_in_drom(dg) || quota > DIAG_NON_CRITICAL_BUF_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_priv_data.non_critical.lock, portMAX_DELAY);
+    uint8_t g = nc_group_of(dg);
+    if (!g && groups->count < CONFIG_RTC_STORE_NON_CRITICAL_GROUPS) {
+        g = ++groups->count;
+        groups->dg[g] = dg;
+    }
+    if (g) {
+        groups->quota[g] = quota;
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s_priv_data.non_critical.lock);
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t rtc_store_usage_get(rtc_store_usage_t *usage)
+{
+    if (!usage) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* The fill level is updated with a single store, so a snapshot does not need the locks */
+    usage->critical_filled = data_store_get_filled(s_priv_data.critical.store);
+    usage->critical_size = data_store_get_size(s_priv_data.critical.store);
+    usage->non_critical_filled = data_store_get_filled(s_priv_data.non_critical.store);
+    usage->non_critical_size = data_store_get_size(s_priv_data.non_critical.store);
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    // memory taken by the sealed blocks, the records they hold are several times more
+    usage->non_critical_filled += data_store_get_filled(s_priv_data.sealed.store);
+    usage->non_critical_size += data_store_get_size(s_priv_data.sealed.store);
+#endif
+    return ESP_OK;
+}
+
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+// Indexes the records kept in RTC memory across the reset
+static void rtc_store_record_index_init(rbuf_data_t *rbuf_data)
+{
+    record_index_t *index = &s_record_index;
+    size_t filled = data_store_get_filled(rbuf_data->store);
+    size_t off = 0;
+
+    memset(index, 0, sizeof(*index));
+    index->write_pos = filled;
+    while (off + 1 + sizeof(rtc_store_non_critical_data_hdr_t) <= filled) {
+        rtc_store_non_critical_data_hdr_t header;
+        record_index_add(index, off);
+        data_store_copy_out(rbuf_data->store, off + 1, &header, sizeof(header)); // skip meta_hdr idx
+        off += 1 + sizeof(header) + header.len;
+    }
+    rbuf_data->index = index;
+}
+#endif
+
 esp_err_t rtc_store_init(void)
 {
     esp_err_t err;
@@ -629,6 +1507,17 @@ esp_err_t rtc_store_init(void)
         rtc_store_rbuf_deinit(&s_priv_data.critical);
         return err;
     }
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS
+    nc_sealed_init();
+#endif
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+    rtc_store_record_index_init(&s_priv_data.non_critical);
+#endif
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+    // records kept across the reset count for the group recorded in their header
+    memset(s_priv_data.groups.filled, 0, sizeof(s_priv_data.groups.filled));
+    nc_groups_account(s_priv_data.non_critical.store, 0, data_store_get_filled(s_priv_data.non_critical.store), true);
+#endif
 
     esp_reset_reason_t reset_reason = esp_reset_reason();
 
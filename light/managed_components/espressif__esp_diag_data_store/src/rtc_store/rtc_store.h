@@ -8,6 +8,7 @@
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <esp_diag_data_store.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,7 +46,9 @@ rtc_store_meta_header_t *rtc_store_get_meta_record_current();
  * @brief Non critical data header
  */
 typedef struct {
-    uint32_t len;       /*!< Length of data */
+    uint16_t len;       /*!< Length of data */
+    uint8_t group;      /*!< Quota group of the data, 0 if it has no quota */
+    uint8_t reserved;
 } rtc_store_non_critical_data_hdr_t;
 
 /**
@@ -107,6 +110,47 @@ int rtc_store_critical_data_read_and_release(uint8_t *buf, size_t size);
  */
 esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t len);
 
+/**
+ * @brief Non critical data item of a batch write
+ */
+typedef struct {
+    const char *dg;     /*!< Data group of the data (Must be the string stored in RODATA) */
+    const void *data;   /*!< Pointer to non critical data */
+    size_t len;         /*!< Length of non critical data */
+} rtc_store_non_critical_item_t;
+
+/**
+ * @brief Write several non critical data items to the RTC storage
+ *
+ * Unlike rtc_store_non_critical_data_write(), this API waits for the storage lock, and takes it once for
+ * all the items. Items are written in order, up to the first one that fails, and are seen by the readers
+ * together. Room for all of them is made at once, items that do not fit the storage fail with ESP_ERR_NO_MEM.
+ *
+ * @param[in] items Non critical data items
+ * @param[in] count Number of items
+ * @param[out] written Number of items written, may be NULL
+ *
+ * @return ESP_OK if all the items were written, error of the first item that failed otherwise.
+ */
+esp_err_t rtc_store_non_critical_data_write_batch(const rtc_store_non_critical_item_t items[], size_t count,
+                                                  size_t *written);
+
+/**
+ * @brief Set the quota of a non critical data group
+ *
+ * The group keeps quota bytes of its records, headers included, in the non critical data buffer. The records of
+ * the groups over their quota, and of the groups without one, are dropped first to make room for new data, or,
+ * when the data is not overwritten, cannot take the room left for the quotas of the other groups.
+ * A quota of 0 leaves the group to be dropped first.
+ *
+ * @param[in] dg Data group (Must be the string stored in RODATA)
+ * @param[in] quota Bytes of the group kept in the storage
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS groups already have a quota,
+ *         ESP_ERR_NOT_SUPPORTED if quotas are disabled, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_non_critical_quota_set(const char *dg, size_t quota);
+
 /**
  * @brief Read non critical data from the RTC storage
  *
@@ -117,6 +161,29 @@ esp_err_t rtc_store_non_critical_data_write(const char *dg, void *data, size_t l
  */
 int rtc_store_non_critical_data_read(uint8_t *buf, size_t size);
 
+/**
+ * @brief Get the critical data in place, in one span or two if it wraps around the end of the RTC storage
+ *
+ * @param[out] spans Parts of the data, the second one is empty if the data does not wrap
+ *
+ * @return Number of bytes in the spans or -1 on error
+ */
+int rtc_store_critical_data_peek(esp_diag_data_store_span_t spans[2]);
+
+/**
+ * @brief Get the non critical data in place, in one span or two if it wraps around the end of the RTC storage
+ *
+ * With CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA, the data is not overwritten to make room for new data
+ * until rtc_store_non_critical_data_release() is called.
+ * With CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS, once some of the data is compressed, the first 1K of the data is
+ * decompressed to a buffer, returned in the first span, which is freed on release or by the next peek.
+ *
+ * @param[out] spans Parts of the data, the second one is empty if the data does not wrap
+ *
+ * @return Number of bytes in the spans or -1 on error
+ */
+int rtc_store_non_critical_data_peek(esp_diag_data_store_span_t spans[2]);
+
 /**
  * @brief Release the size bytes non critical data from RTC storage
  *
@@ -155,6 +222,25 @@ void rtc_store_deinit(void);
  */
 uint32_t rtc_store_get_crc(void);
 
+/**
+ * @brief Usage of the RTC storage
+ */
+typedef struct {
+    size_t critical_filled;         /*!< Bytes of critical data not released yet */
+    size_t critical_size;           /*!< Size of the critical data buffer */
+    size_t non_critical_filled;     /*!< Bytes of non critical data not released yet */
+    size_t non_critical_size;       /*!< Size of the non critical data buffer */
+} rtc_store_usage_t;
+
+/**
+ * @brief Get the usage of the RTC storage
+ *
+ * @param[out] usage Usage of the critical and non critical data buffers
+ *
+ * @return ESP_OK on success, appropriate error code otherwise.
+ */
+esp_err_t rtc_store_usage_get(rtc_store_usage_t *usage);
+
 /**
  * @brief Discard values from RTC Store. This API should be called after rtc_store_init();
  *
@@ -102,6 +102,217 @@ TEST_CASE("data store write", "[data-store]")
     nvs_flash_deinit();
 }
 
+TEST_CASE("data store non_critical write_batch", "[data-store]")
+{
+    test_data_t records[3];
+    rtc_store_non_critical_item_t items[4];
+    rtc_store_non_critical_data_hdr_t header;
+    size_t written = 0;
+    int len = 0;
+    uint32_t i;
+
+    /* diag data store init */
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    /* Start from an empty non critical store */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    if (len > 0) {
+        TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+    }
+
+    for (i = 0; i < 3; i++) {
+        records[i].alphabet = 'a' + i;
+        records[i].len = sizeof(records[i].buf);
+        memset(records[i].buf, records[i].alphabet, records[i].len);
+        items[i].dg = "test";
+        items[i].data = &records[i];
+        items[i].len = sizeof(records[i]);
+    }
+    /* Last item is invalid, earlier ones must still be written */
+    items[3].dg = "test";
+    items[3].data = NULL;
+    items[3].len = 1;
+    TEST_ASSERT(rtc_store_non_critical_data_write_batch(items, 4, &written) == ESP_ERR_INVALID_ARG);
+    TEST_ASSERT(written == 3);
+
+    /* Records are stored as meta index, header and data */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    TEST_ASSERT(len == 3 * (1 + sizeof(header) + sizeof(test_data_t)));
+    for (i = 0; i < 3; i++) {
+        uint8_t *record = data + i * (1 + sizeof(header) + sizeof(test_data_t));
+        memcpy(&header, record + 1, sizeof(header));
+        TEST_ASSERT(header.len == sizeof(test_data_t));
+        TEST_ASSERT(memcmp(record + 1 + sizeof(header), &records[i], sizeof(test_data_t)) == 0);
+    }
+    TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+
+    /* Data store deinit */
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
+#if CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+TEST_CASE("data store non_critical overwrite", "[data-store]")
+{
+    rtc_store_non_critical_data_hdr_t header;
+    test_data_t record;
+    size_t off = 0;
+    int len = 0;
+    uint16_t i, last = 0;
+
+    /* diag data store init */
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    /* Start from an empty non critical store */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    if (len > 0) {
+        TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+    }
+
+    /* Write several times the size of the store, records of varying length make way for the new ones */
+    for (i = 0; i < 500; i++) {
+        record.alphabet = i;
+        record.len = 1 + esp_random() % sizeof(record.buf);
+        memset(record.buf, 'a' + i % 26, record.len);
+        TEST_ASSERT(rtc_store_non_critical_data_write("test", &record, 4 + record.len) == ESP_OK);
+    }
+
+    /* Only whole records remain, the newest ones in order */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    TEST_ASSERT(len > 0);
+    while (off < len) {
+        memcpy(&header, data + off + 1, sizeof(header));
+        TEST_ASSERT(off + 1 + sizeof(header) + header.len <= len);
+        memcpy(&record, data + off + 1 + sizeof(header), header.len);
+        TEST_ASSERT(header.len == 4 + record.len);
+        TEST_ASSERT(off == 0 || record.alphabet == last + 1);
+        last = record.alphabet;
+        off += 1 + sizeof(header) + header.len;
+    }
+    TEST_ASSERT(last == 499);
+    TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+
+    /* Data store deinit */
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_GROUPS
+TEST_CASE("data store non_critical quota", "[data-store]")
+{
+    const size_t quota = 200;
+    rtc_store_non_critical_data_hdr_t header;
+    test_data_t record;
+    size_t off = 0, rare = 0;
+    int len = 0;
+    uint16_t i;
+
+    /* diag data store init */
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    /* Start from an empty non critical store */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    if (len > 0) {
+        TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+    }
+    TEST_ASSERT(rtc_store_non_critical_quota_set("rare", quota) == ESP_OK);
+
+    /* The rare group writes one record for 20 of the chatty one, which does not have a quota */
+    record.len = sizeof(record.buf);
+    for (i = 0; i < 2000; i++) {
+        record.alphabet = (i % 20) ? 'c' : 'r';
+        memset(record.buf, record.alphabet, record.len);
+        TEST_ASSERT(rtc_store_non_critical_data_write(record.alphabet == 'r' ? "rare" : "chatty",
+                                                      &record, sizeof(record)) == ESP_OK);
+    }
+
+    /* The chatty records made way first, the rare group kept about its quota */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    TEST_ASSERT(len > 0);
+    while (off < len) {
+        memcpy(&header, data + off + 1, sizeof(header));
+        TEST_ASSERT(off + 1 + sizeof(header) + header.len <= len);
+        memcpy(&record, data + off + 1 + sizeof(header), header.len);
+        if (record.alphabet == 'r') {
+            rare += 1 + sizeof(header) + header.len;
+        }
+        off += 1 + sizeof(header) + header.len;
+    }
+    TEST_ASSERT(rare + 1 + sizeof(header) + sizeof(record) > quota);
+    TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+
+    /* Data store deinit */
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+#endif
+#endif
+
+#if CONFIG_RTC_STORE_NON_CRITICAL_COMPRESS && !CONFIG_RTC_STORE_OVERWRITE_NON_CRITICAL_DATA
+TEST_CASE("data store non_critical compress", "[data-store]")
+{
+    rtc_store_non_critical_data_hdr_t header;
+    rtc_store_usage_t usage;
+    test_data_t record;
+    esp_diag_data_store_span_t spans[2];
+    uint8_t next[1 + sizeof(header) + sizeof(record)];
+    size_t off = 0, written = 0;
+    int len = 0;
+    uint16_t i;
+
+    /* diag data store init */
+    init_nvs_flash();
+    TEST_ASSERT(rtc_store_init() == ESP_OK);
+
+    /* Start from an empty non critical store */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    if (len > 0) {
+        TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+    }
+
+    /* Write until full, the sealed blocks hold more records than the memory they take */
+    record.len = sizeof(record.buf);
+    for (i = 0; written < READ_DATA_SIZE - 1 - sizeof(header) - sizeof(record); i++) {
+        record.alphabet = i;
+        memset(record.buf, 'a' + (i / 8) % 26, record.len);
+        if (rtc_store_non_critical_data_write("test", &record, sizeof(record)) != ESP_OK) {
+            break;
+        }
+        written += 1 + sizeof(header) + sizeof(record);
+    }
+    TEST_ASSERT(rtc_store_usage_get(&usage) == ESP_OK);
+    TEST_ASSERT(written > usage.non_critical_size);
+
+    /* The records are read back decompressed, all of them in order */
+    len = rtc_store_non_critical_data_read(data, READ_DATA_SIZE);
+    TEST_ASSERT(len == written);
+    for (i = 0; off < len; i++) {
+        memcpy(&header, data + off + 1, sizeof(header));
+        TEST_ASSERT(header.len == sizeof(record));
+        memcpy(&record, data + off + 1 + sizeof(header), header.len);
+        TEST_ASSERT(record.alphabet == i);
+        off += 1 + sizeof(header) + header.len;
+    }
+
+    /* Peek the first records, decompressed to a buffer, and release them */
+    len = rtc_store_non_critical_data_peek(spans);
+    TEST_ASSERT(len > 0 && spans[1].len == 0);
+    TEST_ASSERT(memcmp(spans[0].data, data, spans[0].len) == 0);
+    len = (len / (1 + sizeof(header) + sizeof(record))) * (1 + sizeof(header) + sizeof(record));
+    TEST_ASSERT(rtc_store_non_critical_data_release(len) == ESP_OK);
+    TEST_ASSERT(rtc_store_non_critical_data_read(next, sizeof(next)) == sizeof(next));
+    TEST_ASSERT(memcmp(next, data + len, sizeof(next)) == 0);
+    TEST_ASSERT(rtc_store_non_critical_data_release(written - len) == ESP_OK);
+
+    /* Data store deinit */
+    rtc_store_deinit();
+    nvs_flash_deinit();
+}
+#endif
+
 TEST_CASE("data store write read release_all", "[data-store]")
 {
     size_t len = 0;
@@ -18,6 +18,8 @@ extern "C" {
 
 /**
  * @brief Callback to write log to diagnostics storage
+ *
+ * The data is a log record, which can be decoded using esp_diag_log_record_decode().
  */
 typedef esp_err_t (*esp_diag_log_write_cb_t)(void *data, size_t len, void *priv_data);
 
@@ -120,9 +122,43 @@ typedef struct {
     void *msg_ptr;                                      /*!< Address of err/warn/event message in rodata */
     uint8_t msg_args[CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE]; /*!< Arguments of log message */
     uint8_t msg_args_len;                               /*!< Length of argument */
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    uint8_t msg_args_raw;                               /*!< Arguments are raw, see esp_diag_log_args_to_tlv() */
+#endif
     char task_name[CONFIG_FREERTOS_MAX_TASK_NAME_LEN];  /*!< Task name */
+    uint32_t repeats;                                   /*!< Times the log was repeated after it was recorded at
+                                                             first_timestamp, timestamp is the one of the
+                                                             last repeat. 0 if it was not. */
+    uint64_t first_timestamp;                           /*!< Timestamp of the repeated log, if repeats */
 } esp_diag_log_data_t;
 
+/**
+ * @brief Size of the strings of the log records, tag and task name
+ */
+#define ESP_DIAG_LOG_STR_SIZE   (CONFIG_FREERTOS_MAX_TASK_NAME_LEN > 16 ? CONFIG_FREERTOS_MAX_TASK_NAME_LEN : 16)
+
+/**
+ * @brief Largest log record, flags, timestamp, pc, msg_ptr, tag, task name, args length, args, repeats
+ *        and time since the first repeat
+ */
+#define ESP_DIAG_LOG_RECORD_MAX_SIZE (1 + 10 + 4 + 4 + 2 * (10 + 1 + ESP_DIAG_LOG_STR_SIZE) + 1 + \
+                                      CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE + 2 * 10)
+
+/**
+ * @brief State of the decoding of diagnostics log records
+ *
+ * Log records are written in sequences: the first record of a sequence has the absolute timestamp, the
+ * following ones the time since the previous record. Tags and task names are defined by the first record
+ * using them and referred to by their index afterwards. Records can therefore only be decoded from the
+ * start of their sequence on.
+ */
+typedef struct {
+    bool synced;                                    /*!< Start of the sequence was decoded */
+    bool seq_start;                                 /*!< Last decoded record started a sequence */
+    uint64_t timestamp;                             /*!< Timestamp of the last decoded record */
+    char str[CONFIG_DIAG_LOG_STR_TABLE_SIZE][ESP_DIAG_LOG_STR_SIZE]; /*!< Strings defined in the sequence */
+} esp_diag_log_decoder_t;
+
 /**
  * @brief Device information structure
  */
@@ -195,6 +231,31 @@ typedef struct {
     } value;
 } esp_diag_str_data_pt_t;
 
+/**
+ * @brief Structure for the summary data point of an aggregated metrics window
+ */
+typedef struct {
+    uint16_t type;       /*!< Metrics */
+    uint16_t data_type;  /*!< Data type of the aggregated values */
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    char tag[16];        /*!< TAG */
+#endif
+    char key[16];        /*!< Key */
+    uint64_t ts;         /*!< Timestamp of the last value of the window */
+    uint64_t ts_start;   /*!< Timestamp of the first value of the window */
+    uint32_t count;      /*!< Number of values in the window */
+    union {
+        int32_t i;       /*!< Value for integer data type */
+        uint32_t u;      /*!< Value for unsigned integer data type */
+        float f;         /*!< Value for float data type */
+    } min, max;          /*!< Minimum and maximum of the values */
+    union {
+        int64_t i;       /*!< Sum for integer data type */
+        uint64_t u;      /*!< Sum for unsigned integer data type */
+        double f;        /*!< Sum for float data type */
+    } sum;               /*!< Sum of the values */
+} esp_diag_aggr_data_pt_t;
+
 /**
  * @brief Initialize diagnostics log hook
  *
@@ -204,6 +265,47 @@ typedef struct {
  */
 esp_err_t esp_diag_log_hook_init(esp_diag_log_config_t *config);
 
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+/**
+ * @brief Convert the raw arguments of a diagnostics log to TLV
+ *
+ * With the deferred argument format, logs record their arguments as they were passed, and leave their
+ * conversion to TLV to the time the logs are sent. The format must be the one of the log, and
+ * be in flash.
+ *
+ * @param[in]  format   Format of the log message, msg_ptr of \ref esp_diag_log_data_t
+ * @param[in]  raw      Raw arguments, msg_args of \ref esp_diag_log_data_t
+ * @param[in]  raw_len  Length of the raw arguments
+ * @param[out] tlv      Buffer for the TLV arguments
+ * @param[in]  tlv_size Size of the buffer
+ *
+ * @return Length of the TLV arguments, 0 if there are none or the format is not usable.
+ */
+uint8_t esp_diag_log_args_to_tlv(const char *format, const uint8_t *raw, uint8_t raw_len,
+                                 uint8_t *tlv, uint8_t tlv_size);
+#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED */
+
+/**
+ * @brief Decode a diagnostics log record
+ *
+ * @param[in]     data  Data written by the log hook, starting at a record
+ * @param[in]     size  Size of the data
+ * @param[in,out] dec   Decoding state, zeroed before decoding the first record of the data
+ * @param[out]    log   Decoded log, set only if dec->synced
+ *
+ * @return Size of the record, 0 if the data ends within the record, -1 if the data is not a log record.
+ */
+int esp_diag_log_record_decode(const uint8_t *data, size_t size, esp_diag_log_decoder_t *dec,
+                               esp_diag_log_data_t *log);
+
+/**
+ * @brief Start a new sequence of log records
+ *
+ * The records written afterwards do not refer to the earlier ones. Calling this before reading the
+ * records makes the last sequence of the data read complete.
+ */
+void esp_diag_log_hook_sync(void);
+
 /**
  * @brief Enable the diagnostics log hook for provided log type
  *
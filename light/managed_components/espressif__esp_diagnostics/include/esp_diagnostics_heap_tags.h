@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sdkconfig.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CONFIG_DIAG_HEAP_TAGS
+/**
+ * @brief Allocators which account the memory they return to a heap tag
+ *
+ * A heap tag names the owner of the memory, usually a component. The bytes of the blocks allocated and not freed
+ * yet, as told by heap_caps_get_allocated_size(), are counted for each tag and reported with the heap metrics.
+ * Memory must be freed with esp_diag_heap_tag_free() and the same tag, or it stays counted.
+ *
+ * The tag is looked up by its address first, pass the same string, stored in RODATA, on every call. Up to
+ * CONFIG_DIAG_HEAP_TAGS_MAX tags are counted, the allocations of the other tags are not.
+ *
+ * Components that do not depend on esp_diagnostics can declare these functions weak and redefine their
+ * allocators to call them when they are linked in, they are all defined in the same object.
+ */
+void *esp_diag_heap_tag_malloc(const char *tag, size_t size);
+void *esp_diag_heap_tag_calloc(const char *tag, size_t n, size_t size);
+void *esp_diag_heap_tag_realloc(const char *tag, void *ptr, size_t size);
+char *esp_diag_heap_tag_strdup(const char *tag, const char *str);
+char *esp_diag_heap_tag_strndup(const char *tag, const char *str, size_t n);
+void esp_diag_heap_tag_free(const char *tag, void *ptr);
+
+/**
+ * @brief Account a block returned by another allocator, heap_caps_malloc() for instance, to a heap tag
+ *
+ * @param[in] tag Heap tag
+ * @param[in] ptr Block allocated, NULL is ignored
+ */
+void esp_diag_heap_tag_add(const char *tag, void *ptr);
+
+/**
+ * @brief Usage of a heap tag
+ */
+typedef struct {
+    const char *tag;        /*!< Name of the heap tag */
+    uint32_t bytes;         /*!< Bytes allocated and not freed yet */
+    uint32_t peak;          /*!< Highest bytes since boot */
+    uint32_t allocs;        /*!< Blocks allocated since boot */
+} esp_diag_heap_tag_stats_t;
+
+/**
+ * @brief Callback called for each heap tag by esp_diag_heap_tags_foreach()
+ */
+typedef void (*esp_diag_heap_tag_stats_cb_t)(const esp_diag_heap_tag_stats_t *stats, void *arg);
+
+/**
+ * @brief Call cb with the usage of each heap tag used so far
+ *
+ * @param[in] cb Callback
+ * @param[in] arg Argument of the callback
+ */
+void esp_diag_heap_tags_foreach(esp_diag_heap_tag_stats_cb_t cb, void *arg);
+#endif /* CONFIG_DIAG_HEAP_TAGS */
+
+#ifdef __cplusplus
+}
+#endif
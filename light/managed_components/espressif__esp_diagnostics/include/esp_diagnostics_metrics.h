@@ -46,6 +46,13 @@ typedef struct {
     esp_diag_data_type_t type; /*!< Data type of metrics */
 } esp_diag_metrics_meta_t;
 
+/**
+ * @brief Handle of a registered metrics, for reporting without looking the metrics up by tag and key
+ *
+ * A handle is never 0. It becomes invalid when the metrics is unregistered.
+ */
+typedef uint32_t esp_diag_metrics_handle_t;
+
 /**
  * @brief Initialize the diagnostics metrics
  *
@@ -79,6 +86,28 @@ esp_err_t esp_diag_metrics_register(const char *tag,
                                     const char *path,
                                     esp_diag_data_type_t type);
 
+/**
+ * @brief Register a metrics and get its handle
+ *
+ * Same as \ref esp_diag_metrics_register, the handle is for the `esp_diag_metrics_add_*_by_handle` APIs,
+ * which report the metrics without looking it up by tag and key.
+ *
+ * @param[in]  tag    Tag of metrics
+ * @param[in]  key    Unique key for the metrics
+ * @param[in]  label  Label for the metrics
+ * @param[in]  path   Hierarchical path for key, must be separated by '.' for more than one level
+ * @param[in]  type   Data type of metrics
+ * @param[out] handle Handle of the registered metrics, can be NULL
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_register_with_handle(const char *tag,
+                                                const char *key,
+                                                const char *label,
+                                                const char *path,
+                                                esp_diag_data_type_t type,
+                                                esp_diag_metrics_handle_t *handle);
+
 /**
  * @brief Unregister all previously registered metrics
  *
@@ -100,6 +129,119 @@ const esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_all(uint32_t *len);
  */
 void esp_diag_metrics_meta_print_all(void);
 
+/**
+ * @brief Add metrics to storage, by handle
+ *
+ * @param[in] data_type Data type of metrics \ref esp_diag_data_type_t
+ * @param[in] handle    Handle of the metrics, from \ref esp_diag_metrics_register_with_handle
+ * @param[in] val       Value of metrics
+ * @param[in] val_sz    Size of val
+ * @param[in] ts        Timestamp in microseconds, this should be the value at the time of data gathering
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_by_handle(esp_diag_data_type_t data_type, esp_diag_metrics_handle_t handle,
+                                         const void *val, size_t val_sz, uint64_t ts);
+
+/**
+ * @brief Add the metrics of data type boolean, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] b      Value of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_bool_by_handle(esp_diag_metrics_handle_t handle, bool b);
+
+/**
+ * @brief Add the metrics of data type integer, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] i      Value of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_int_by_handle(esp_diag_metrics_handle_t handle, int32_t i);
+
+/**
+ * @brief Add the metrics of data type unsigned integer, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] u      Value of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_uint_by_handle(esp_diag_metrics_handle_t handle, uint32_t u);
+
+/**
+ * @brief Add the metrics of data type float, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] f      Value of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_float_by_handle(esp_diag_metrics_handle_t handle, float f);
+
+/**
+ * @brief Add the IPv4 address metrics, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] ip     IPv4 address
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_ipv4_by_handle(esp_diag_metrics_handle_t handle, uint32_t ip);
+
+/**
+ * @brief Add the MAC address metrics, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] mac    Array of length 6 i.e 6 octets of mac address
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_mac_by_handle(esp_diag_metrics_handle_t handle, uint8_t *mac);
+
+/**
+ * @brief Add the metrics of data type string, by handle
+ *
+ * @param[in] handle Handle of the metrics
+ * @param[in] str    Value of the metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_add_str_by_handle(esp_diag_metrics_handle_t handle, const char *str);
+
+/**
+ * @brief Aggregate the values of a metrics over time windows
+ *
+ * Instead of a data point per value, the metrics then records one summary data point per window,
+ * holding the minimum, maximum, sum and count of the values, see \ref esp_diag_aggr_data_pt_t.
+ * A window closes with the first value reported after its end, or on esp_diag_metrics_aggregation_flush().
+ * Aggregation suits metrics sampled at high rate, and is only supported for the integer,
+ * unsigned integer and float data types.
+ *
+ * @param[in] handle    Handle of the metrics
+ * @param[in] window_ms Length of the windows in milliseconds, 0 to disable the aggregation
+ *                      (the open window is then recorded)
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_aggregate_by_handle(esp_diag_metrics_handle_t handle, uint32_t window_ms);
+
+/**
+ * @brief Record the aggregated metrics windows that have ended
+ *
+ * This should be called before the recorded metrics are read, so that the windows of metrics
+ * which are no longer reported get recorded.
+ *
+ * @param[in] all Record all the open windows, not only the ended ones
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_metrics_aggregation_flush(bool all);
+
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
 
 /**
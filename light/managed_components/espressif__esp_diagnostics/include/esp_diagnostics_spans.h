@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sdkconfig.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CONFIG_DIAG_ENABLE_SPAN_METRICS
+
+/**
+ * @brief Counters of a span on one core, only written by that core
+ */
+typedef struct {
+    uint32_t seq;           /*!< Odd while the counters are being updated */
+    uint32_t count;         /*!< Spans ended */
+    uint64_t cycles;        /*!< CPU cycles spent in the spans */
+    uint32_t max;           /*!< Longest span since the last report, in CPU cycles */
+    uint32_t max_ever;      /*!< Longest span since boot, in CPU cycles */
+} esp_diag_span_core_t;
+
+/**
+ * @brief Span, defined by ESP_DIAG_SPAN_BEGIN() at the place it is measured
+ */
+typedef struct esp_diag_span {
+    const char *tag;                                /*!< Name of the span, also the prefix of its metrics keys */
+    struct esp_diag_span *next;                     /*!< Next span used so far */
+    uint32_t state;                                 /*!< Whether the span is in the list, internal */
+    esp_diag_span_core_t core[portNUM_PROCESSORS];  /*!< Counters of each core */
+} esp_diag_span_t;
+
+/**
+ * @brief Start a span
+ *
+ * Use ESP_DIAG_SPAN_BEGIN() instead. The span is added to the list of spans the first time it starts.
+ *
+ * @param[in] span Span
+ *
+ * @return Start of the span, to pass to esp_diag_span_end()
+ */
+uint32_t esp_diag_span_begin(esp_diag_span_t *span);
+
+/**
+ * @brief End a span
+ *
+ * Use ESP_DIAG_SPAN_END() instead. Adds the span to the counters of the calling core, with its interrupts masked
+ * and without any lock. A span which ended on another core than it started is not counted, the cycle counters of
+ * the cores are not in sync.
+ *
+ * @param[in] span Span
+ * @param[in] start Value returned by esp_diag_span_begin()
+ */
+void esp_diag_span_end(esp_diag_span_t *span, uint32_t start);
+
+/**
+ * @brief Start measuring the span named tag, until ESP_DIAG_SPAN_END() with the same tag in the same scope
+ *
+ * The tag is an identifier, of at most 11 characters so that the keys of its metrics fit. Can be used in tasks and
+ * ISRs, the span costs two reads of the cycle counter and a few increments.
+ */
+#define ESP_DIAG_SPAN_BEGIN(tag)                                    \
+    static esp_diag_span_t _diag_span_##tag = { #tag };             \
+    uint32_t _diag_span_start_##tag = esp_diag_span_begin(&_diag_span_##tag)
+
+/**
+ * @brief End the span started by ESP_DIAG_SPAN_BEGIN()
+ */
+#define ESP_DIAG_SPAN_END(tag)  esp_diag_span_end(&_diag_span_##tag, _diag_span_start_##tag)
+
+/**
+ * @brief Totals of a span since boot
+ */
+typedef struct {
+    const char *tag;        /*!< Name of the span */
+    uint32_t count;         /*!< Spans ended */
+    uint64_t total_us;      /*!< Time spent in the spans, in microseconds */
+    uint32_t max_us;        /*!< Longest span, in microseconds */
+} esp_diag_span_stats_t;
+
+/**
+ * @brief Callback called for each span by esp_diag_spans_foreach()
+ */
+typedef void (*esp_diag_span_stats_cb_t)(const esp_diag_span_stats_t *stats, void *arg);
+
+/**
+ * @brief Call cb with the totals of each span used so far, summed over the cores
+ *
+ * @param[in] cb Callback
+ * @param[in] arg Argument of the callback
+ */
+void esp_diag_spans_foreach(esp_diag_span_stats_cb_t cb, void *arg);
+
+/**
+ * @brief Initialize the span metrics
+ *
+ * The call count, total time and longest time of each span are reported periodically, as the metrics
+ * "<tag>_n", "<tag>_us" and "<tag>_max" of the tag "span", for the spans which ended since the previous report.
+ * Up to CONFIG_DIAG_SPAN_METRICS_MAX spans are reported. Spans are measured whether or not this is initialized.
+ *
+ * Default periodic interval is 60 seconds and can be changed with esp_diag_span_metrics_reset_interval().
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_span_metrics_init(void);
+
+/**
+ * @brief Deinitialize the span metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_span_metrics_deinit(void);
+
+/**
+ * @brief Report the span metrics of the time since the previous report, and start a new period
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_span_metrics_dump(void);
+
+/**
+ * @brief Reset the periodic interval
+ *
+ * If the interval is set to 0, span metrics are no longer reported, the spans are still measured.
+ *
+ * @param[in] period Period interval in seconds
+ */
+void esp_diag_span_metrics_reset_interval(uint32_t period);
+
+#else
+#define ESP_DIAG_SPAN_BEGIN(tag)
+#define ESP_DIAG_SPAN_END(tag)
+#endif /* CONFIG_DIAG_ENABLE_SPAN_METRICS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -21,6 +21,10 @@ extern "C"
  *
  * Default periodic interval is 30 seconds and can be changed with esp_diag_heap_metrics_reset_interval().
  *
+ * With CONFIG_DIAG_HEAP_METRICS_HOOKS, the allocation hooks also track the lowest free heap and largest
+ * free block, and the number of allocations, of every period. The tasks which allocated the most are
+ * recorded as an event.
+ *
  * @return ESP_OK if successful, appropriate error code otherwise.
  */
 esp_err_t esp_diag_heap_metrics_init(void);
@@ -91,8 +95,64 @@ esp_err_t esp_diag_wifi_metrics_dump(void);
  */
 void esp_diag_wifi_metrics_reset_interval(uint32_t period);
 
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+/**
+ * @brief Capture the Wi-Fi RSSI at a high rate for a short time
+ *
+ * CONFIG_DIAG_WIFI_METRICS_CAPTURE_SAMPLES samples are taken, every CONFIG_DIAG_WIFI_METRICS_CAPTURE_INTERVAL
+ * milliseconds, and recorded with the time they were taken. A capture is triggered by a disconnection, a beacon
+ * timeout and the RSSI falling to a new low. The application can trigger one on other events, e.g. a latency
+ * spike. A trigger during a capture extends it.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_wifi_metrics_trigger_capture(void);
+#endif /* CONFIG_DIAG_WIFI_METRICS_CAPTURE */
+
 #endif /* CONFIG_DIAG_ENABLE_WIFI_METRICS */
 
+#if CONFIG_DIAG_ENABLE_TASK_METRICS
+
+/**
+ * @brief Initialize the task metrics
+ *
+ * CPU load and CPU share of the busiest task are computed periodically, from the run time stats of the tasks
+ * over the last period. On dual core chips the load of each core is reported too, as "cpu0_load" and "cpu1_load".
+ * The three busiest tasks of the period are also recorded as an event.
+ * Default periodic interval is 30 seconds and can be changed with esp_diag_task_metrics_reset_interval().
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_task_metrics_init(void);
+
+/**
+ * @brief Deinitialize the task metrics
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_task_metrics_deinit(void);
+
+/**
+ * @brief Dumps the task metrics and prints them to the console.
+ *
+ * This API reports the metrics of the time since the previous report, and starts a new period.
+ *
+ * @return ESP_OK if successful, appropriate error code otherwise.
+ */
+esp_err_t esp_diag_task_metrics_dump(void);
+
+/**
+ * @brief Reset the periodic interval
+ *
+ * By default, task metrics are collected every 30 seconds, this function can be used to change the interval.
+ * If the interval is set to 0, task metrics collection disabled.
+ *
+ * @param[in] period Period interval in seconds
+ */
+void esp_diag_task_metrics_reset_interval(uint32_t period);
+
+#endif /* CONFIG_DIAG_ENABLE_TASK_METRICS */
+
 #ifdef __cplusplus
 }
 #endif
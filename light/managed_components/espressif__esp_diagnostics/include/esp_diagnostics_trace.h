@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CONFIG_DIAG_ENABLE_TRACE
+/**
+ * @brief Phases of the trace events, the ones of the Trace Event Format
+ */
+#define ESP_DIAG_TRACE_BEGIN    'B'     /*!< Start of a span, ended by the next ESP_DIAG_TRACE_END of the core */
+#define ESP_DIAG_TRACE_END      'E'     /*!< End of a span */
+#define ESP_DIAG_TRACE_INSTANT  'i'     /*!< Single point in time */
+
+/**
+ * @brief Record a trace event
+ *
+ * The event goes to the ring of the calling core with its interrupts masked, so this can be called from tasks
+ * and ISRs alike, without taking any lock. The oldest events of the core are overwritten when its ring is full.
+ *
+ * Components that do not depend on esp_diagnostics can declare this function weak and call it only when it is
+ * linked in, their markers then cost nothing in applications that do not trace.
+ *
+ * @param[in] name Name of the event (Must be the string stored in RODATA)
+ * @param[in] phase ESP_DIAG_TRACE_BEGIN, ESP_DIAG_TRACE_END or ESP_DIAG_TRACE_INSTANT
+ * @param[in] arg Value recorded with the event
+ */
+void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg);
+
+#define ESP_DIAG_TRACE_SPAN_BEGIN(name, arg)    esp_diag_trace_record(name, ESP_DIAG_TRACE_BEGIN, arg)
+#define ESP_DIAG_TRACE_SPAN_END(name, arg)      esp_diag_trace_record(name, ESP_DIAG_TRACE_END, arg)
+#define ESP_DIAG_TRACE_MARK(name, arg)          esp_diag_trace_record(name, ESP_DIAG_TRACE_INSTANT, arg)
+
+/**
+ * @brief Trace event, as read from the rings
+ */
+typedef struct {
+    uint64_t ts;        /*!< Time since boot in microseconds, esp_timer time */
+    const char *name;   /*!< Name of the event */
+    uint32_t arg;       /*!< Value recorded with the event */
+    uint8_t phase;      /*!< Phase of the event */
+    uint8_t core;       /*!< Core that recorded the event */
+} esp_diag_trace_event_t;
+
+/**
+ * @brief Position of a reader in the rings, zero initialize it to read all the events kept
+ */
+typedef struct {
+    uint32_t pos[portNUM_PROCESSORS];           /*!< Events of each core read so far */
+    uint32_t sync_cycles[portNUM_PROCESSORS];   /*!< Cycle count of the last time reference read, internal */
+    uint64_t sync_ts[portNUM_PROCESSORS];       /*!< Time of the last time reference read, 0 if none, internal */
+} esp_diag_trace_cursor_t;
+
+/**
+ * @brief Callback called for each trace event read, returns false to stop reading
+ */
+typedef bool (*esp_diag_trace_read_cb_t)(const esp_diag_trace_event_t *event, void *arg);
+
+/**
+ * @brief Read the trace events recorded since the cursor, and advance it past them
+ *
+ * Events are read core after core, each core in the order they were recorded. The events overwritten since the
+ * cursor are skipped. Reading does not stop the recording, nor does it remove the events from the rings.
+ *
+ * @param[inout] cursor Position of the reader, NULL to read all the events kept
+ * @param[in] max_events Maximum number of events to read, 0 for no limit
+ * @param[in] cb Callback called for each event
+ * @param[in] arg Argument of the callback
+ *
+ * @return Number of events read
+ */
+size_t esp_diag_trace_read(esp_diag_trace_cursor_t *cursor, size_t max_events, esp_diag_trace_read_cb_t cb,
+                           void *arg);
+
+/**
+ * @brief Print the trace events kept as a Trace Event Format JSON document
+ *
+ * The output can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing, one thread per core.
+ */
+void esp_diag_trace_print_json(void);
+
+/**
+ * @brief Drop all the trace events recorded
+ */
+void esp_diag_trace_clear(void);
+
+#else
+#define ESP_DIAG_TRACE_SPAN_BEGIN(name, arg)
+#define ESP_DIAG_TRACE_SPAN_END(name, arg)
+#define ESP_DIAG_TRACE_MARK(name, arg)
+#endif /* CONFIG_DIAG_ENABLE_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
@@ -34,6 +34,68 @@
 
 #define DEFAULT_POLLING_INTERVAL 30 /* 30 seconds */
 
+#if CONFIG_DIAG_HEAP_METRICS_HOOKS
+#include <freertos/task.h>
+#include <esp_memory_utils.h>
+
+#define KEY_ALLOCS         "allocs"
+#define KEY_FREE_LOW       "free_low"
+#define KEY_LFB_LOW        "lfb_low"
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+#define KEY_EXT_FREE_LOW   "ext_free_low"
+#define KEY_EXT_LFB_LOW    "ext_lfb_low"
+#endif /* CONFIG_ESP32_SPIRAM_SUPPORT */
+
+#define HOOKS_TOP_TASKS    3
+
+typedef enum {
+    HOOKS_CAPS_INTERNAL,
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    HOOKS_CAPS_SPIRAM,
+#endif
+    HOOKS_CAPS_MAX,
+} hooks_caps_t;
+
+static const uint32_t s_hooks_caps[HOOKS_CAPS_MAX] = {
+    MALLOC_CAP_INTERNAL,
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    MALLOC_CAP_SPIRAM,
+#endif
+};
+
+typedef struct {
+    uint32_t free_low;      /* UINT32_MAX if not sampled */
+    uint32_t lfb_low;       /* UINT32_MAX if not sampled */
+    uint32_t lfb_sampled;   /* allocs at the last sample of lfb */
+} hooks_caps_data_t;
+
+typedef struct {
+    TaskHandle_t task;
+    char name[CONFIG_FREERTOS_MAX_TASK_NAME_LEN];
+    uint32_t count;
+    uint32_t bytes;
+} hooks_task_data_t;
+
+/* Usage since the last report, updated by the allocation hooks */
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    hooks_caps_data_t caps[HOOKS_CAPS_MAX];
+    hooks_task_data_t tasks[CONFIG_DIAG_HEAP_METRICS_HOOKS_TASKS];
+} hooks_period_t;
+
+typedef struct {
+    bool enabled;
+    portMUX_TYPE lock;
+    hooks_period_t period;
+    hooks_period_t report;  /* copy of the period being reported */
+} hooks_data_t;
+
+static hooks_data_t s_hooks = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+#endif /* CONFIG_DIAG_HEAP_METRICS_HOOKS */
+
 typedef struct {
     bool init;
     TimerHandle_t handle;
@@ -100,9 +162,215 @@ esp_err_t esp_diag_heap_metrics_dump(void)
     return ESP_OK;
 }
 
+#if CONFIG_DIAG_HEAP_METRICS_HOOKS
+static void hooks_period_reset(hooks_period_t *period)
+{
+    memset(period, 0, sizeof(*period));
+    for (int i = 0; i < HOOKS_CAPS_MAX; i++) {
+        period->caps[i].free_low = UINT32_MAX;
+        period->caps[i].lfb_low = UINT32_MAX;
+    }
+}
+
+/* Called within s_hooks.lock */
+static void hooks_task_account(size_t size)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    hooks_task_data_t *slot = NULL;
+
+    if (!task) {
+        return;
+    }
+    for (int i = 0; i < CONFIG_DIAG_HEAP_METRICS_HOOKS_TASKS; i++) {
+        hooks_task_data_t *t = &s_hooks.period.tasks[i];
+        if (t->task == task) {
+            slot = t;
+            break;
+        }
+        if (!t->task) {
+            slot = t;
+            slot->task = task;
+            strlcpy(slot->name, pcTaskGetName(task), sizeof(slot->name));
+            break;
+        }
+    }
+    if (slot) {
+        slot->count++;
+        slot->bytes += size;
+    }
+}
+
+static void hooks_sample(hooks_caps_t caps_idx, uint32_t allocs)
+{
+    hooks_caps_data_t *caps = &s_hooks.period.caps[caps_idx];
+    uint32_t free = heap_caps_get_free_size(s_hooks_caps[caps_idx]);
+    uint32_t lfb = UINT32_MAX;
+
+    /* Racy read, the lock is taken to update */
+    if (free >= caps->free_low) {
+        return;
+    }
+    if (caps->lfb_low == UINT32_MAX || (allocs - caps->lfb_sampled) >= CONFIG_DIAG_HEAP_METRICS_HOOKS_LFB_INTERVAL) {
+        lfb = heap_caps_get_largest_free_block(s_hooks_caps[caps_idx]);
+    }
+    portENTER_CRITICAL_SAFE(&s_hooks.lock);
+    if (free < caps->free_low) {
+        caps->free_low = free;
+    }
+    if (lfb != UINT32_MAX) {
+        caps->lfb_sampled = allocs;
+        if (lfb < caps->lfb_low) {
+            caps->lfb_low = lfb;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&s_hooks.lock);
+}
+
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    uint32_t allocs;
+
+    if (!s_hooks.enabled || !ptr) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&s_hooks.lock);
+    allocs = ++s_hooks.period.allocs;
+    hooks_task_account(size);
+    portEXIT_CRITICAL_SAFE(&s_hooks.lock);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    if (esp_ptr_external_ram(ptr)) {
+        hooks_sample(HOOKS_CAPS_SPIRAM, allocs);
+        return;
+    }
+#endif
+    hooks_sample(HOOKS_CAPS_INTERNAL, allocs);
+}
+
+void esp_heap_trace_free_hook(void *ptr)
+{
+    if (!s_hooks.enabled || !ptr) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&s_hooks.lock);
+    s_hooks.period.frees++;
+    portEXIT_CRITICAL_SAFE(&s_hooks.lock);
+}
+
+static void hooks_report_uint(const char *key, uint32_t value)
+{
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_report_uint(METRICS_TAG, key, value);
+#else
+    esp_diag_metrics_add_uint(key, value);
+#endif
+}
+
+static void hooks_report_caps(const hooks_caps_data_t *caps, const char *key_free_low, const char *key_lfb_low)
+{
+    if (caps->free_low != UINT32_MAX) {
+        hooks_report_uint(key_free_low, caps->free_low);
+    }
+    if (caps->lfb_low != UINT32_MAX) {
+        hooks_report_uint(key_lfb_low, caps->lfb_low);
+    }
+}
+
+/* Reports the usage since the last report, at each period of the heap metrics */
+static void hooks_report(void)
+{
+    hooks_period_t *report = &s_hooks.report;
+    const hooks_task_data_t *top[HOOKS_TOP_TASKS] = {0};
+
+    portENTER_CRITICAL(&s_hooks.lock);
+    memcpy(report, &s_hooks.period, sizeof(*report));
+    hooks_period_reset(&s_hooks.period);
+    portEXIT_CRITICAL(&s_hooks.lock);
+
+    hooks_report_uint(KEY_ALLOCS, report->allocs);
+    hooks_report_caps(&report->caps[HOOKS_CAPS_INTERNAL], KEY_FREE_LOW, KEY_LFB_LOW);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    hooks_report_caps(&report->caps[HOOKS_CAPS_SPIRAM], KEY_EXT_FREE_LOW, KEY_EXT_LFB_LOW);
+#endif
+
+    for (int i = 0; i < CONFIG_DIAG_HEAP_METRICS_HOOKS_TASKS && report->tasks[i].task; i++) {
+        const hooks_task_data_t *t = &report->tasks[i];
+        for (int j = 0; j < HOOKS_TOP_TASKS; j++) {
+            if (!top[j] || t->count > top[j]->count) {
+                memmove(&top[j + 1], &top[j], (HOOKS_TOP_TASKS - j - 1) * sizeof(top[0]));
+                top[j] = t;
+                break;
+            }
+        }
+    }
+    if (!top[0]) {
+        return;
+    }
+    ESP_LOGI(LOG_TAG, KEY_ALLOCS ":%" PRIu32 " frees:%" PRIu32 " top:%s", report->allocs, report->frees, top[0]->name);
+    /* Fits the log arguments buffer: counts of the top tasks, bytes of the first one */
+    ESP_DIAG_EVENT(METRICS_TAG, KEY_ALLOCS " %s:%" PRIu32 "/%" PRIu32 "B %s:%" PRIu32 " %s:%" PRIu32,
+                   top[0]->name, top[0]->count, top[0]->bytes,
+                   top[1] ? top[1]->name : "-", top[1] ? top[1]->count : 0,
+                   top[2] ? top[2]->name : "-", top[2] ? top[2]->count : 0);
+}
+
+static void hooks_register(const char *key, const char *label, const char *path, const char *unit)
+{
+    esp_diag_metrics_register(METRICS_TAG, key, label, path, ESP_DIAG_DATA_TYPE_UINT);
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_add_unit(METRICS_TAG, key, unit);
+#else
+    esp_diag_metrics_add_unit(key, unit);
+#endif
+}
+
+static void hooks_unregister(const char *key)
+{
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_unregister(METRICS_TAG, key);
+#else
+    esp_diag_metrics_unregister(key);
+#endif
+}
+
+static void hooks_init(void)
+{
+    hooks_register(KEY_ALLOCS, "Allocations", PATH_HEAP_INTERNAL, "allocations");
+    hooks_register(KEY_FREE_LOW, "Lowest free heap", PATH_HEAP_INTERNAL, METRICS_UNIT);
+    hooks_register(KEY_LFB_LOW, "Lowest largest free block", PATH_HEAP_INTERNAL, METRICS_UNIT);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    hooks_register(KEY_EXT_FREE_LOW, "External lowest free heap", PATH_HEAP_EXTERNAL, METRICS_UNIT);
+    hooks_register(KEY_EXT_LFB_LOW, "External lowest largest free block", PATH_HEAP_EXTERNAL, METRICS_UNIT);
+#endif
+    portENTER_CRITICAL(&s_hooks.lock);
+    hooks_period_reset(&s_hooks.period);
+    s_hooks.enabled = true;
+    portEXIT_CRITICAL(&s_hooks.lock);
+}
+
+static void hooks_deinit(void)
+{
+    portENTER_CRITICAL(&s_hooks.lock);
+    s_hooks.enabled = false;
+    portEXIT_CRITICAL(&s_hooks.lock);
+    hooks_unregister(KEY_ALLOCS);
+    hooks_unregister(KEY_FREE_LOW);
+    hooks_unregister(KEY_LFB_LOW);
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    hooks_unregister(KEY_EXT_FREE_LOW);
+    hooks_unregister(KEY_EXT_LFB_LOW);
+#endif
+}
+#endif /* CONFIG_DIAG_HEAP_METRICS_HOOKS */
+
 static void heap_metrics_dump_cb(void *arg)
 {
     esp_diag_heap_metrics_dump();
+#if CONFIG_DIAG_HEAP_METRICS_HOOKS
+    hooks_report();
+#endif
+#if CONFIG_DIAG_HEAP_TAGS
+    esp_diag_heap_tags_report();
+#endif
 }
 
 static void heap_timer_cb(TimerHandle_t handle)
@@ -168,6 +436,9 @@ esp_err_t esp_diag_heap_metrics_init(void)
     esp_diag_metrics_add_unit(KEY_FREE, METRICS_UNIT);
     esp_diag_metrics_add_unit(KEY_LFB, METRICS_UNIT);
     esp_diag_metrics_add_unit(KEY_MIN_FREE, METRICS_UNIT);
+#endif
+#if CONFIG_DIAG_HEAP_METRICS_HOOKS
+    hooks_init();
 #endif
     s_priv_data.handle = xTimerCreate("heap_metrics", SEC2TICKS(DEFAULT_POLLING_INTERVAL),
                                       pdTRUE, NULL, heap_timer_cb);
@@ -191,6 +462,12 @@ esp_err_t esp_diag_heap_metrics_deinit(void)
     if (xTimerDelete(s_priv_data.handle, 10) == pdFALSE) {
         ESP_LOGW(LOG_TAG, "Failed to delete heap metric timer");
     }
+#if CONFIG_DIAG_HEAP_METRICS_HOOKS
+    hooks_deinit();
+#endif
+#if CONFIG_DIAG_HEAP_TAGS
+    esp_diag_heap_tags_unregister();
+#endif
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 2, 0)
     esp_diag_metrics_unregister(KEY_ALLOC_FAIL);
@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_diagnostics.h>
+#include <esp_diagnostics_metrics.h>
+#include <esp_diagnostics_heap_tags.h>
+#include "esp_diagnostics_internal.h"
+
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+#error "CONFIG_DIAG_HEAP_TAGS needs heap_caps_get_allocated_size(), from ESP-IDF v5.1"
+#endif
+
+#define LOG_TAG            "heap_tags"
+#define METRICS_TAG        "heap"
+#define METRICS_UNIT       "bytes"
+#define PATH_HEAP_TAGS     "heap.tags"
+
+/* Key of a metrics, the tag and one of these */
+#define KEY_SIZE           16
+#define KEY_SUFFIX_MAX_LEN 5
+
+typedef enum {
+    HEAP_TAG_KEY_BYTES,
+    HEAP_TAG_KEY_PEAK,
+    HEAP_TAG_KEY_NUM,
+} heap_tag_key_t;
+
+static const char *const s_key_suffix[HEAP_TAG_KEY_NUM] = { "_heap", "_peak" };
+
+typedef struct {
+    const char *tag;
+    uint32_t bytes;
+    uint32_t peak;                      /* Since the last report, exchanged by the reporter */
+    uint32_t peak_ever;
+    uint32_t allocs;
+    /* Only used by the reporter */
+    bool registered;
+    bool failed;                        /* Not reported, its metrics could not be registered */
+    char keys[HEAP_TAG_KEY_NUM][KEY_SIZE];
+    esp_diag_metrics_handle_t handles[HEAP_TAG_KEY_NUM];
+} heap_tag_t;
+
+static heap_tag_t s_tags[CONFIG_DIAG_HEAP_TAGS_MAX];
+static uint32_t s_tags_count;
+static portMUX_TYPE s_tags_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static heap_tag_t *heap_tag_get(const char *tag)
+{
+    uint32_t count = __atomic_load_n(&s_tags_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        if (s_tags[i].tag == tag) {
+            return &s_tags[i];
+        }
+    }
+    if (!tag) {
+        return NULL;
+    }
+    /* The same name, from another translation unit */
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(s_tags[i].tag, tag) == 0) {
+            return &s_tags[i];
+        }
+    }
+    heap_tag_t *t = NULL;
+    portENTER_CRITICAL(&s_tags_lock);
+    for (uint32_t i = count; i < s_tags_count; i++) {
+        if (strcmp(s_tags[i].tag, tag) == 0) {
+            t = &s_tags[i];
+            break;
+        }
+    }
+    if (!t && s_tags_count < CONFIG_DIAG_HEAP_TAGS_MAX) {
+        t = &s_tags[s_tags_count];
+        t->tag = tag;
+        __atomic_store_n(&s_tags_count, s_tags_count + 1, __ATOMIC_RELEASE);
+    }
+    portEXIT_CRITICAL(&s_tags_lock);
+    return t;
+}
+
+static inline void heap_tag_max(uint32_t *max, uint32_t value)
+{
+    uint32_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(max, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void esp_diag_heap_tag_add(const char *tag, void *ptr)
+{
+    heap_tag_t *t;
+    if (!ptr || !(t = heap_tag_get(tag))) {
+        return;
+    }
+    uint32_t bytes = __atomic_add_fetch(&t->bytes, heap_caps_get_allocated_size(ptr), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&t->allocs, 1, __ATOMIC_RELAXED);
+    heap_tag_max(&t->peak, bytes);
+    heap_tag_max(&t->peak_ever, bytes);
+}
+
+static void heap_tag_remove(const char *tag, void *ptr)
+{
+    heap_tag_t *t;
+    if (!ptr || !(t = heap_tag_get(tag))) {
+        return;
+    }
+    /* Blocks allocated before the tag was counted, or by another allocator, must not take it below zero */
+    uint32_t size = heap_caps_get_allocated_size(ptr);
+    uint32_t bytes = __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&t->bytes, &bytes, bytes > size ? bytes - size : 0, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void *esp_diag_heap_tag_malloc(const char *tag, size_t size)
+{
+    void *ptr = malloc(size);
+    esp_diag_heap_tag_add(tag, ptr);
+    return ptr;
+}
+
+void *esp_diag_heap_tag_calloc(const char *tag, size_t n, size_t size)
+{
+    void *ptr = calloc(n, size);
+    esp_diag_heap_tag_add(tag, ptr);
+    return ptr;
+}
+
+void *esp_diag_heap_tag_realloc(const char *tag, void *ptr, size_t size)
+{
+    heap_tag_remove(tag, ptr);
+    void *new_ptr = realloc(ptr, size);
+    if (new_ptr) {
+        esp_diag_heap_tag_add(tag, new_ptr);
+    } else if (size) {
+        /* Failed, the block is left as it was */
+        esp_diag_heap_tag_add(tag, ptr);
+    }
+    return new_ptr;
+}
+
+char *esp_diag_heap_tag_strdup(const char *tag, const char *str)
+{
+    char *ptr = strdup(str);
+    esp_diag_heap_tag_add(tag, ptr);
+    return ptr;
+}
+
+char *esp_diag_heap_tag_strndup(const char *tag, const char *str, size_t n)
+{
+    char *ptr = strndup(str, n);
+    esp_diag_heap_tag_add(tag, ptr);
+    return ptr;
+}
+
+void esp_diag_heap_tag_free(const char *tag, void *ptr)
+{
+    heap_tag_remove(tag, ptr);
+    free(ptr);
+}
+
+void esp_diag_heap_tags_foreach(esp_diag_heap_tag_stats_cb_t cb, void *arg)
+{
+    if (!cb) {
+        return;
+    }
+    uint32_t count = __atomic_load_n(&s_tags_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        esp_diag_heap_tag_stats_t stats = {
+            .tag = s_tags[i].tag,
+            .bytes = __atomic_load_n(&s_tags[i].bytes, __ATOMIC_RELAXED),
+            .peak = __atomic_load_n(&s_tags[i].peak_ever, __ATOMIC_RELAXED),
+            .allocs = __atomic_load_n(&s_tags[i].allocs, __ATOMIC_RELAXED),
+        };
+        cb(&stats, arg);
+    }
+}
+
+static void heap_tag_register(heap_tag_t *t)
+{
+    t->registered = true;
+    if (strlen(t->tag) > KEY_SIZE - 1 - KEY_SUFFIX_MAX_LEN) {
+        ESP_LOGW(LOG_TAG, "Heap tag %s not reported, its name is too long", t->tag);
+        t->failed = true;
+        return;
+    }
+    for (int k = 0; k < HEAP_TAG_KEY_NUM; k++) {
+        snprintf(t->keys[k], KEY_SIZE, "%s%s", t->tag, s_key_suffix[k]);
+        if (esp_diag_metrics_register_with_handle(METRICS_TAG, t->keys[k], t->tag, PATH_HEAP_TAGS,
+                                                  ESP_DIAG_DATA_TYPE_UINT, &t->handles[k]) != ESP_OK) {
+            ESP_LOGW(LOG_TAG, "Heap tag %s not reported, failed to register its metrics", t->tag);
+            t->failed = true;
+            return;
+        }
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_add_unit(METRICS_TAG, t->keys[k], METRICS_UNIT);
+#else
+        esp_diag_metrics_add_unit(t->keys[k], METRICS_UNIT);
+#endif
+    }
+}
+
+void esp_diag_heap_tags_report(void)
+{
+    uint32_t count = __atomic_load_n(&s_tags_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        heap_tag_t *t = &s_tags[i];
+        if (!t->registered) {
+            heap_tag_register(t);
+        }
+        uint32_t bytes = __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+        /* The next period starts from the bytes held now */
+        uint32_t peak = __atomic_exchange_n(&t->peak, bytes, __ATOMIC_RELAXED);
+        if (t->failed) {
+            continue;
+        }
+        esp_diag_metrics_add_uint_by_handle(t->handles[HEAP_TAG_KEY_BYTES], bytes);
+        esp_diag_metrics_add_uint_by_handle(t->handles[HEAP_TAG_KEY_PEAK], peak > bytes ? peak : bytes);
+    }
+}
+
+void esp_diag_heap_tags_unregister(void)
+{
+    uint32_t count = __atomic_load_n(&s_tags_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        heap_tag_t *t = &s_tags[i];
+        for (int k = 0; k < HEAP_TAG_KEY_NUM && t->keys[k][0]; k++) {
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+            esp_diag_metrics_unregister(METRICS_TAG, t->keys[k]);
+#else
+            esp_diag_metrics_unregister(t->keys[k]);
+#endif
+        }
+        /* The counts go on, the metrics are registered again at the next report */
+        t->registered = false;
+        t->failed = false;
+        memset(t->keys, 0, sizeof(t->keys));
+    }
+}
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -20,6 +22,34 @@ extern "C" {
 
 #define SEC2TICKS(s) ((s * 1000) / portTICK_PERIOD_MS)
 
+/* Version of the layout of the log records, data of other versions is discarded */
+#define DIAG_LOG_RECORD_VERSION 2
+
+/* Slots of the open addressing key index of the registered metrics or variables,
+ * twice the maximum count keeps the probe sequences short */
+#define DIAG_KEY_INDEX_SIZE(max_count) (2 * (max_count) + 1)
+
+/* Marks the cached metadata CRC stale, to be called on every change of the registered metrics or variables */
+void esp_diag_meta_changed(void);
+
+/* FNV-1a hash of a metrics or variable key, the key of the index */
+static inline uint32_t esp_diag_key_hash(const char *key)
+{
+    uint32_t hash = 2166136261U;
+    while (*key) {
+        hash = (hash ^ (uint8_t)*key++) * 16777619U;
+    }
+    return hash;
+}
+
+#if CONFIG_DIAG_HEAP_TAGS
+/* Reports the bytes and the peak of each heap tag, at each period of the heap metrics */
+void esp_diag_heap_tags_report(void);
+
+/* Unregisters the metrics of the heap tags, with the heap metrics */
+void esp_diag_heap_tags_unregister(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
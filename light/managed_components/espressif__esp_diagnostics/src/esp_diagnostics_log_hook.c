@@ -12,6 +12,8 @@
 #include "esp_idf_version.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_timer.h>
 
 /* Onwards esp-idf v5.0 esp_cpu_process_stack_pc() is moved to
  * components/xtensa/include/esp_cpu_utils.h
@@ -28,15 +30,67 @@
 
 #define IS_LOG_TYPE_ENABLED(type) (s_priv_data.init && (type & s_priv_data.enabled_log_type))
 
+/* Log record: flags, timestamp (varint), pc, msg_ptr, tag, task name (if LOG_REC_TASK), args length, args,
+ * repeats and time since the first repeat (varints, if LOG_REC_REPEAT).
+ * Strings are a varint of (index << 1 | defined), followed by their length and characters if defined.
+ */
+#define LOG_REC_MARK        0x80    /* Set in all the records */
+#define LOG_REC_TYPE_MASK   0x07    /* esp_diag_log_type_t */
+#define LOG_REC_SYNC        0x08    /* Starts a sequence, timestamp is absolute */
+#define LOG_REC_TASK        0x10    /* Has a task name */
+#define LOG_REC_RAW         0x20    /* Arguments are raw, see esp_diag_log_args_to_tlv() */
+#define LOG_REC_REPEAT      0x40    /* Repeats of a log written before, timestamp is the one of the last */
+
+#define LOG_REC_VARINT_MAX  10
+#define LOG_REC_STR_MAX     (LOG_REC_VARINT_MAX + 1 + ESP_DIAG_LOG_STR_SIZE)
+#define LOG_REC_MAX_SIZE    (1 + LOG_REC_VARINT_MAX + 4 + 4 + 2 * LOG_REC_STR_MAX + 1 + CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE + \
+                             2 * LOG_REC_VARINT_MAX)
+_Static_assert(LOG_REC_MAX_SIZE == ESP_DIAG_LOG_RECORD_MAX_SIZE, "ESP_DIAG_LOG_RECORD_MAX_SIZE out of date");
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    bool sync;                  /* Next record starts a sequence */
+    uint64_t timestamp;         /* Of the last record */
+    size_t size;                /* Of the sequence */
+    uint8_t str_count;
+    char str[CONFIG_DIAG_LOG_STR_TABLE_SIZE][ESP_DIAG_LOG_STR_SIZE];
+    uint8_t rec[LOG_REC_MAX_SIZE];
+#if CONFIG_DIAG_LOG_FOLD_REPEATS
+    bool has_last;
+    uint32_t repeats;           /* Of last, not written yet */
+    uint64_t repeat_timestamp;  /* Of the last repeat */
+    esp_diag_log_data_t last;   /* Last log written */
+#endif
+} log_seq_t;
+
+#if CONFIG_DIAG_LOG_RATE_LIMIT
+#define LOG_RATE_INTERVAL_US    (1000000 / CONFIG_DIAG_LOG_RATE_LIMIT)
+#define LOG_RATE_BURST_US       ((int64_t)(CONFIG_DIAG_LOG_RATE_LIMIT_BURST - 1) * LOG_RATE_INTERVAL_US)
+
+/* Token bucket of a log statement, kept as the time at which the bucket is full again */
+typedef struct {
+    const char *tag;
+    const char *format;
+    int64_t full_at;
+} log_rate_slot_t;
+#endif
+
 typedef struct {
     uint32_t enabled_log_type;
     esp_diag_log_config_t config;
     bool init;
+    log_seq_t seq;
+#if CONFIG_DIAG_LOG_RATE_LIMIT
+    log_rate_slot_t rate[CONFIG_DIAG_LOG_RATE_LIMIT_SLOTS];
+#endif
 } log_hook_priv_data_t;
 
 static log_hook_priv_data_t s_priv_data;
+#if CONFIG_DIAG_LOG_RATE_LIMIT
+static portMUX_TYPE s_rate_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
 
-#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV
+#if defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV) || defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED)
 typedef enum {
     MOD_NONE,   /* none */
     MOD_hh,     /* char */
@@ -49,8 +103,12 @@ typedef enum {
     MOD_L,      /* long double, NOTE: only for double */
 } modifiers_t;
 
+/* Not argument types, returned by next_arg_type() */
+#define ARG_TYPE_END    0xFF    /* End of the format */
+#define ARG_TYPE_NONE   0xFE    /* Conversion without argument */
+
 static esp_err_t append_arg(uint8_t *args, uint8_t *out_size, uint8_t max_len,
-                            uint8_t type, uint8_t len, void *value)
+                            uint8_t type, uint8_t len, const void *value)
 {
     if ((*out_size + 2 + len) > max_len) {
         return ESP_ERR_NO_MEM;
@@ -59,237 +117,380 @@ static esp_err_t append_arg(uint8_t *args, uint8_t *out_size, uint8_t max_len,
     args += *out_size;
     *args++ = type;
     *args++ = len;
-    memcpy(args, value, len);
+    if (len) {
+        memcpy(args, value, len);
+    }
     *out_size += (len + 2);
     return ESP_OK;
 }
 
-static void get_tlv_from_ap(esp_diag_log_data_t *log, const char *format, va_list ap)
+/* Parses the format up to the end of its next conversion, and returns the type of the argument of the
+ * conversion, with its size in len. Unsupported conversions return ARG_TYPE_INVALID, their argument is
+ * consumed as an int.
+ */
+static uint8_t next_arg_type(const char **format, uint8_t *len)
 {
-    const char *p = NULL;
-    uint8_t len, out_size = 0;
-    uint8_t arg_max_len = sizeof(log->msg_args);
-    esp_err_t err = ESP_OK;
-    esp_diag_arg_value_t arg_val;
+    const char *p = *format;
     modifiers_t mf;
+    uint8_t type;
 
+    while (*p && *p != '%') {
+        p++;
+    }
+    if (!*p) {
+        *format = p;
+        return ARG_TYPE_END;
+    }
+    p++;
+    if (*p == '%') {
+        *format = p + 1;
+        return ARG_TYPE_NONE;
+    }
     /* there can be flags, field width digits, precision digits, modifiers, specifiers
      * modifier tells the size of the field eg: hh, h, l, ll
      * specifier tells whether it is signed, unsigned, double, string, pointer, etc.
      * Following parsing is done by considering printf manual (man 3 printf)
      */
-    for (p = format; *p; p++) {
-        if (*p == '%') {
+    /* skip zero or more flags */
+    while (*p == '#' || *p == '0' || *p == '-' || *p == ' ' || *p == '+' || *p == '\'') {
+        p++;
+    }
+    /* skip the field width digits */
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    /* skip precision bytes, period(.) followed by digits */
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') {
             p++;
-        } else {
-            continue;
         }
-        /* skip zero or more flags */
-        while (*p == '#' || *p == '0' || *p == '-' || *p == ' ' || *p == '+' || *p == '\'') {
-            p++;
+    }
+    /* An optional length modifier, that specifies the size of the argument */
+    *len = 0;
+    mf = MOD_NONE;
+    while (*p) {
+        bool _default = false;
+        switch (*p) {
+            case 'h':
+                if (mf == MOD_h) {
+                    mf = MOD_hh;
+                    *len = sizeof(char);
+                } else {
+                    mf = MOD_h;
+                    *len = sizeof(short);
+                }
+                break;
+            case 'l':
+                if (mf == MOD_l) {
+                    mf = MOD_ll;
+                    *len = sizeof(long long);
+                } else {
+                    mf = MOD_l;
+                    *len = sizeof(long);
+                }
+                break;
+            case 'j':
+                mf = MOD_j;
+                *len = sizeof(intmax_t);
+                break;
+            case 't':
+                mf = MOD_t;
+                *len = sizeof(ptrdiff_t);
+                break;
+            case 'z':
+                mf = MOD_z;
+                *len = sizeof(size_t);
+                break;
+            case 'L':
+                mf = MOD_L;
+                *len = sizeof(long double);
+                break;
+            default:
+                _default = true;
+                break;
         }
-        /* skip the field width digits */
-        while (*p >= '0' && *p <= '9') {
-            p++;
+        if (_default) {
+            break;
         }
-        /* skip precision bytes, period(.) followed by digits */
-        if (*p == '.') {
-            p++;
-            while (*p >= '0' && *p <= '9') {
-                p++;
+        p++;
+    }
+    if (!*p) {
+        *format = p;
+        return ARG_TYPE_END;
+    }
+    *format = p + 1;
+    /* specifier, character that specifies the type of conversion to be applied */
+    type = ARG_TYPE_NONE;
+    switch (*p) {
+        case 'D': /* equivalent to ld */
+            type = ARG_TYPE_L;
+            *len = sizeof(long);
+            break;
+        case 'd':
+        case 'i':
+            switch (mf) {
+                case MOD_NONE: /* none, no modifier found */
+                case MOD_z: /* singed integer of size size_t */
+                    type = ARG_TYPE_INT;
+                    *len = sizeof(int);
+                    break;
+                case MOD_hh: /* char, promoted to int */
+                    type = ARG_TYPE_CHAR;
+                    break;
+                case MOD_h: /* short, promoted to int */
+                    type = ARG_TYPE_SHORT;
+                    break;
+                case MOD_l: /* long */
+                    type = ARG_TYPE_L;
+                    break;
+                case MOD_ll: /* long long */
+                    type = ARG_TYPE_LL;
+                    break;
+                case MOD_j: /* intmax_t */
+                    type = ARG_TYPE_INTMAX;
+                    break;
+                case MOD_t: /* ptrdiff_t */
+                    type = ARG_TYPE_PTRDIFF;
+                    break;
+                default:
+                    break;
             }
-        }
-        /* An optional length modifier, that specifies the size of the argument */
-        len = 0;
-        mf = MOD_NONE;
-        while (*p) {
-            bool _default = false;
-            switch (*p) {
-                case 'h':
-                    if (mf == MOD_h) {
-                        mf = MOD_hh;
-                        len = sizeof(char);
-                    } else {
-                        mf = MOD_h;
-                        len = sizeof(short);
-                    }
+            break;
+        case 'O':   /* equivalent to lo */
+        case 'U':   /* equivalent to lu */
+            type = ARG_TYPE_UL;
+            *len = sizeof(unsigned long);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'p':
+            switch (mf) {
+                case MOD_NONE:  /* none, no modifier found */
+                case MOD_t:     /* unsigned type of size ptrdiff_t */
+                    type = ARG_TYPE_UINT;
+                    *len = sizeof(unsigned int);
+                    break;
+                case MOD_hh:    /* unsinged char */
+                    type = ARG_TYPE_UCHAR;
+                    break;
+                case MOD_h: /* unsigned short */
+                    type = ARG_TYPE_USHORT;
                     break;
-                case 'l':
-                    if (mf == MOD_l) {
-                        mf = MOD_ll;
-                        len = sizeof(long long);
-                    } else {
-                        mf = MOD_l;
-                        len = sizeof(long);
-                    }
+                case MOD_l: /* unsigned long */
+                    type = ARG_TYPE_UL;
                     break;
-                case 'j':
-                    mf = MOD_j;
-                    len = sizeof(intmax_t);
+                case MOD_ll: /* unsigned long long */
+                    type = ARG_TYPE_ULL;
                     break;
-                case 't':
-                    mf = MOD_t;
-                    len = sizeof(ptrdiff_t);
+                case MOD_j: /* uintmax_t */
+                    type = ARG_TYPE_UINTMAX;
                     break;
-                case 'z':
-                    mf = MOD_z;
-                    len = sizeof(size_t);
+                case MOD_z: /* size_t */
+                    type = ARG_TYPE_SIZE;
                     break;
-                case 'L':
-                    mf = MOD_L;
-                    len = sizeof(long double);
+                default:
+                    break;
+            }
+            break;
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+            switch (mf) {
+                case MOD_NONE: /* double */
+                case MOD_l:    /* double */
+                    type = ARG_TYPE_DOUBLE;
+                    *len = sizeof(double);
+                    break;
+                case MOD_L: /* long double */
+                    type = ARG_TYPE_LDOUBLE;
                     break;
                 default:
-                    _default = true;
                     break;
             }
-            if (_default) {
+            break;
+        case 'c': /* char */
+            type = ARG_TYPE_CHAR;
+            *len = sizeof(char);
+            break;
+        case 's': /* array of chars, length is the one of the string */
+            type = ARG_TYPE_STR;
+            *len = 0;
+            break;
+        case 'n': /* %n outputs the number of bytes printed till that point, so will skip it */
+        default:
+            /* since we do not know the size or type of argument so, consuming the unsupported format specifier as integer. */
+            type = ARG_TYPE_INVALID;
+            break;
+    }
+    return type;
+}
+
+/* Takes the argument of the type from the list, and returns the address of its value */
+static const void *va_arg_value(va_list *ap, uint8_t type, esp_diag_arg_value_t *arg_val)
+{
+    switch (type) {
+        case ARG_TYPE_CHAR:
+            arg_val->c = va_arg(*ap, int);  /* char is promoted to int */
+            return &arg_val->c;
+        case ARG_TYPE_SHORT:
+            arg_val->s = va_arg(*ap, int);  /* short is promoted to int */
+            return &arg_val->s;
+        case ARG_TYPE_INT:
+            arg_val->i = va_arg(*ap, int);
+            return &arg_val->i;
+        case ARG_TYPE_L:
+            arg_val->l = va_arg(*ap, long);
+            return &arg_val->l;
+        case ARG_TYPE_LL:
+            arg_val->ll = va_arg(*ap, long long);
+            return &arg_val->ll;
+        case ARG_TYPE_INTMAX:
+            arg_val->imx = va_arg(*ap, intmax_t);
+            return &arg_val->imx;
+        case ARG_TYPE_PTRDIFF:
+            arg_val->ptrdiff = va_arg(*ap, ptrdiff_t);
+            return &arg_val->ptrdiff;
+        case ARG_TYPE_UCHAR:
+            arg_val->uc = va_arg(*ap, unsigned int);
+            return &arg_val->uc;
+        case ARG_TYPE_USHORT:
+            arg_val->us = va_arg(*ap, unsigned int);
+            return &arg_val->us;
+        case ARG_TYPE_UINT:
+            arg_val->u = va_arg(*ap, unsigned int);
+            return &arg_val->u;
+        case ARG_TYPE_UL:
+            arg_val->ul = va_arg(*ap, unsigned long);
+            return &arg_val->ul;
+        case ARG_TYPE_ULL:
+            arg_val->ull = va_arg(*ap, unsigned long long);
+            return &arg_val->ull;
+        case ARG_TYPE_UINTMAX:
+            arg_val->umx = va_arg(*ap, uintmax_t);
+            return &arg_val->umx;
+        case ARG_TYPE_SIZE:
+            arg_val->sz = va_arg(*ap, size_t);
+            return &arg_val->sz;
+        case ARG_TYPE_DOUBLE:
+            arg_val->d = va_arg(*ap, double);
+            return &arg_val->d;
+        case ARG_TYPE_LDOUBLE:
+            arg_val->ld = va_arg(*ap, long double);
+            return &arg_val->ld;
+        case ARG_TYPE_STR:
+            arg_val->str = va_arg(*ap, char *);
+            return arg_val->str;
+        default:
+            va_arg(*ap, int);
+            return NULL;
+    }
+}
+
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+/* Copies the arguments as they are, strings prefixed by their length byte, the format gives their types
+ * and sizes when they are converted to TLV, see esp_diag_log_args_to_tlv() */
+static void get_raw_from_ap(esp_diag_log_data_t *log, const char *format, va_list args)
+{
+    uint8_t type, len, out_size = 0;
+    uint8_t arg_max_len = sizeof(log->msg_args);
+    esp_diag_arg_value_t arg_val;
+    va_list ap;
+
+    va_copy(ap, args);
+    while ((type = next_arg_type(&format, &len)) != ARG_TYPE_END) {
+        if (type == ARG_TYPE_NONE) {
+            continue;
+        }
+        const void *value = va_arg_value(&ap, type, &arg_val);
+        if (type == ARG_TYPE_INVALID) {
+            continue;
+        }
+        if (type == ARG_TYPE_STR) {
+            size_t str_len = value ? strlen(value) : 0;
+            if (out_size + 1 + str_len > arg_max_len) {
                 break;
             }
-            p++;
+            log->msg_args[out_size++] = str_len;
+            len = str_len;
+        } else if (out_size + len > arg_max_len) {
+            break;
+        }
+        if (len) {
+            memcpy(log->msg_args + out_size, value, len);
+        }
+        out_size += len;
+    }
+    va_end(ap);
+    log->msg_args_len = out_size;
+    log->msg_args_raw = 1;
+}
+
+uint8_t esp_diag_log_args_to_tlv(const char *format, const uint8_t *raw, uint8_t raw_len,
+                                 uint8_t *tlv, uint8_t tlv_size)
+{
+    uint8_t type, len, in = 0, out_size = 0;
+
+    /* The format is only read if it is in flash, as it was when the log was recorded */
+    if (!format || !esp_ptr_in_drom(format) || !raw || !tlv) {
+        return 0;
+    }
+    while (in < raw_len && (type = next_arg_type(&format, &len)) != ARG_TYPE_END) {
+        if (type == ARG_TYPE_NONE || type == ARG_TYPE_INVALID) {
+            continue;
+        }
+        if (type == ARG_TYPE_STR) {
+            len = raw[in++];
+        }
+        if (in + len > raw_len ||
+                append_arg(tlv, &out_size, tlv_size, type, len, raw + in) != ESP_OK) {
+            break;
+        }
+        in += len;
+    }
+    return out_size;
+}
+#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED */
+
+static void get_tlv_from_ap(esp_diag_log_data_t *log, const char *format, va_list args)
+{
+    uint8_t type, len, out_size = 0;
+    uint8_t arg_max_len = sizeof(log->msg_args);
+    esp_diag_arg_value_t arg_val;
+    va_list ap;
+
+    va_copy(ap, args);
+    while ((type = next_arg_type(&format, &len)) != ARG_TYPE_END) {
+        if (type == ARG_TYPE_NONE) {
+            continue;
         }
-        /* specifier, character that specifies the type of conversion to be applied */
         memset(&arg_val, 0, sizeof(arg_val));
-        switch (*p) {
-            case 'D': /* equivalent to ld */
-                arg_val.l = va_arg(ap, long);
-                err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_L, sizeof(long), &arg_val.l);
-                break;
-            case 'd':
-            case 'i':
-                switch (mf) {
-                    case MOD_NONE: /* none, no modifier found */
-                    case MOD_z: /* singed integer of size size_t */
-                        arg_val.i = va_arg(ap, int);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_INT, sizeof(int), &arg_val.i);
-                        break;
-                    case MOD_hh: /* char */
-                        arg_val.c = va_arg(ap, int);    /* char is promoted to int */
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_CHAR, len, &arg_val.c);
-                        break;
-                    case MOD_h: /* short */
-                        arg_val.s = va_arg(ap, int);    /* short is promoted to int */
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_SHORT, len, &arg_val.s);
-                        break;
-                    case MOD_l: /* long */
-                        arg_val.l = va_arg(ap, long);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_L, len, &arg_val.l);
-                        break;
-                        break;
-                    case MOD_ll: /* long long */
-                        arg_val.ll = va_arg(ap, long long);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_LL, len, &arg_val.ll);
-                        break;
-                    case MOD_j:
-                        /* intmax_t */
-                        arg_val.imx = va_arg(ap, intmax_t);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_INTMAX, len, &arg_val.imx);
-                        break;
-                    case MOD_t:
-                        /* ptrdiff_t */
-                        arg_val.ptrdiff = va_arg(ap, ptrdiff_t);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_PTRDIFF, len, &arg_val.ptrdiff);
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case 'O':   /* equivalent to lo */
-            case 'U':   /* equivalent to lu */
-                arg_val.ul = va_arg(ap, unsigned long);
-                err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_ULL, sizeof(unsigned long), &arg_val.ul);
-                break;
-            case 'o':
-            case 'u':
-            case 'x':
-            case 'X':
-            case 'p':
-                switch (mf) {
-                    case MOD_NONE:  /* none, no modifier found */
-                    case MOD_t:     /* unsigned type of size ptrdiff_t */
-                        len = sizeof(unsigned int);
-                        arg_val.u = va_arg(ap, unsigned int);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_UINT, len, &arg_val.u);
-                        break;
-                    case MOD_hh:    /* unsinged char */
-                        arg_val.uc = va_arg(ap, unsigned int);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_UCHAR, len, &arg_val.uc);
-                        break;
-                    case MOD_h: /* unsigned short */
-                        arg_val.us = va_arg(ap, unsigned int);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_USHORT, len, &arg_val.us);
-                        break;
-                    case MOD_l: /* unsigned long */
-                        arg_val.ul = va_arg(ap, unsigned long);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_UL, len, &arg_val.ul);
-                        break;
-                    case MOD_ll: /* unsigned long long */
-                        arg_val.ull = va_arg(ap, unsigned long long);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_ULL, len, &arg_val.ull);
-                        break;
-                    case MOD_j: /* uintmax_t */
-                        arg_val.umx = va_arg(ap, uintmax_t);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_UINTMAX, len, &arg_val.umx);
-                        break;
-                    case MOD_z: /* size_t */
-                        arg_val.sz = va_arg(ap, size_t);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_SIZE, len, &arg_val.sz);
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case 'a':
-            case 'A':
-            case 'e':
-            case 'E':
-            case 'f':
-            case 'F':
-            case 'g':
-            case 'G':
-                switch (mf) {
-                    case MOD_NONE: /* double */
-                    case MOD_l:    /* double */
-                        len = sizeof(double);
-                        arg_val.d = va_arg(ap, double);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_DOUBLE, len, &arg_val.d);
-                        break;
-                    case MOD_L: /* long double */
-                        arg_val.ld = va_arg(ap, long double);
-                        err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_LDOUBLE, len, &arg_val.ld);
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case 'c': /* char */
-                arg_val.c = va_arg(ap, int);
-                err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_CHAR, sizeof(char), &arg_val.c);
-                break;
-            case 's': /* array of chars */
-                arg_val.str = va_arg(ap, char *);
-                if (arg_val.str) {
-                    len = strlen(arg_val.str);
-                } else {
-                    len = 0;
-                }
-                err = append_arg(log->msg_args, &out_size, arg_max_len, ARG_TYPE_STR, len, arg_val.str);
-                break;
-            case 'n': /* %n outputs the number of bytes printed till that point, so will skip it */
-                va_arg(ap, int);
-                break;
-            default:
-                /* since we do not know the size or type of argument so, consuming the unsupported format specifier as integer. */
-                va_arg(ap, int);
+        const void *value = va_arg_value(&ap, type, &arg_val);
+        if (type == ARG_TYPE_INVALID) {
+            continue;
+        }
+        if (type == ARG_TYPE_STR) {
+            size_t str_len = value ? strlen(value) : 0;
+            if (str_len > UINT8_MAX) {
                 break;
+            }
+            len = str_len;
         }
-        if (err != ESP_OK) {
+        if (append_arg(log->msg_args, &out_size, arg_max_len, type, len, value) != ESP_OK) {
             break;
         }
     }
+    va_end(ap);
     log->msg_args_len = out_size;
 }
-#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV */
+#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV || CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED */
 
 static esp_err_t write_data(void *data, size_t len)
 {
@@ -299,6 +500,342 @@ static esp_err_t write_data(void *data, size_t len)
     return ESP_FAIL;
 }
 
+static size_t put_varint(uint8_t *buf, uint64_t val)
+{
+    size_t len = 0;
+    while (val >= 0x80) {
+        buf[len++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    buf[len++] = val;
+    return len;
+}
+
+static size_t put_u32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+    buf[2] = val >> 16;
+    buf[3] = val >> 24;
+    return 4;
+}
+
+/* Refers to a string of the sequence, defines it if it is new. Returns false if the table is full. */
+static bool put_str(uint8_t *buf, size_t *len, const char *str, uint8_t *str_count)
+{
+    log_seq_t *seq = &s_priv_data.seq;
+    uint8_t idx;
+
+    for (idx = 0; idx < *str_count; idx++) {
+        if (strcmp(seq->str[idx], str) == 0) {
+            *len += put_varint(buf + *len, idx << 1);
+            return true;
+        }
+    }
+    if (idx >= CONFIG_DIAG_LOG_STR_TABLE_SIZE) {
+        return false;
+    }
+    /* Entries past str_count are unused, so the record does not need to be written to take the entry */
+    size_t str_len = strlcpy(seq->str[idx], str, sizeof(seq->str[idx]));
+    if (str_len >= sizeof(seq->str[idx])) {
+        str_len = sizeof(seq->str[idx]) - 1;
+    }
+    *len += put_varint(buf + *len, (idx << 1) | 1);
+    buf[(*len)++] = str_len;
+    memcpy(buf + *len, seq->str[idx], str_len);
+    *len += str_len;
+    (*str_count)++;
+    return true;
+}
+
+/* Encodes the log into seq.rec, with the timestamp ts, returns 0 if a new sequence must be started for it.
+ * If repeats, the timestamp of the log is the one of its first repeat.
+ */
+static size_t log_record_encode(const esp_diag_log_data_t *log, uint64_t ts, uint32_t repeats, bool sync,
+                                uint8_t *str_count)
+{
+    log_seq_t *seq = &s_priv_data.seq;
+    uint8_t *buf = seq->rec;
+    size_t len = 1;
+    bool has_task = log->task_name[0] != '\0';
+
+    buf[0] = LOG_REC_MARK | (log->type & LOG_REC_TYPE_MASK);
+    if (sync) {
+        buf[0] |= LOG_REC_SYNC;
+        len += put_varint(buf + len, ts);
+    } else {
+        len += put_varint(buf + len, ts - seq->timestamp);
+    }
+    if (has_task) {
+        buf[0] |= LOG_REC_TASK;
+    }
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    if (log->msg_args_raw) {
+        buf[0] |= LOG_REC_RAW;
+    }
+#endif
+    len += put_u32(buf + len, log->pc);
+    len += put_u32(buf + len, (uint32_t)log->msg_ptr);
+    if (!put_str(buf, &len, log->tag, str_count) ||
+            (has_task && !put_str(buf, &len, log->task_name, str_count))) {
+        return 0;
+    }
+    buf[len++] = log->msg_args_len;
+    memcpy(buf + len, log->msg_args, log->msg_args_len);
+    len += log->msg_args_len;
+    if (repeats) {
+        buf[0] |= LOG_REC_REPEAT;
+        len += put_varint(buf + len, repeats);
+        len += put_varint(buf + len, ts - log->timestamp);
+    }
+    return len;
+}
+
+/* Writes a record of the sequence, seq.lock must be taken */
+static esp_err_t log_record_put(const esp_diag_log_data_t *log, uint64_t ts, uint32_t repeats)
+{
+    log_seq_t *seq = &s_priv_data.seq;
+    esp_err_t err;
+
+    bool sync = seq->sync || (ts < seq->timestamp) || (seq->size >= CONFIG_DIAG_LOG_SEQ_MAX_SIZE);
+    uint8_t str_count = sync ? 0 : seq->str_count;
+    size_t len = log_record_encode(log, ts, repeats, sync, &str_count);
+    if (!len) {
+        sync = true;
+        str_count = 0;
+        len = log_record_encode(log, ts, repeats, sync, &str_count);
+    }
+    err = write_data(seq->rec, len);
+    if (err == ESP_OK) {
+        seq->sync = false;
+        seq->timestamp = ts;
+        seq->size = sync ? len : seq->size + len;
+        seq->str_count = str_count;
+    } else if (sync) {
+        /* The strings of the sequence were overwritten */
+        seq->sync = true;
+    }
+    return err;
+}
+
+#if CONFIG_DIAG_LOG_FOLD_REPEATS
+/* Same log but for the timestamp */
+static bool log_is_repeat(const esp_diag_log_data_t *last, const esp_diag_log_data_t *log)
+{
+    return last->type == log->type && last->pc == log->pc && last->msg_ptr == log->msg_ptr &&
+           last->msg_args_len == log->msg_args_len &&
+           memcmp(last->msg_args, log->msg_args, log->msg_args_len) == 0 &&
+           strcmp(last->tag, log->tag) == 0 && strcmp(last->task_name, log->task_name) == 0;
+}
+
+/* Writes the repeats of the last log, seq.lock must be taken. They are dropped if they cannot be written. */
+static void log_repeats_flush(log_seq_t *seq)
+{
+    if (seq->repeats) {
+        log_record_put(&seq->last, seq->repeat_timestamp, seq->repeats);
+        seq->repeats = 0;
+    }
+}
+#endif
+
+static esp_err_t log_record_write(const esp_diag_log_data_t *log)
+{
+    log_seq_t *seq = &s_priv_data.seq;
+    esp_err_t err;
+
+    /* Logs of the write itself would be written in the middle of the record */
+    if (xSemaphoreGetMutexHolder(seq->lock) == xTaskGetCurrentTaskHandle()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(seq->lock, portMAX_DELAY);
+#if CONFIG_DIAG_LOG_FOLD_REPEATS
+    if (seq->has_last && seq->repeats < UINT32_MAX && log_is_repeat(&seq->last, log)) {
+        seq->repeats++;
+        seq->repeat_timestamp = log->timestamp;
+        xSemaphoreGive(seq->lock);
+        return ESP_OK;
+    }
+    log_repeats_flush(seq);
+#endif
+    err = log_record_put(log, log->timestamp, 0);
+#if CONFIG_DIAG_LOG_FOLD_REPEATS
+    seq->has_last = (err == ESP_OK);
+    if (seq->has_last) {
+        memcpy(&seq->last, log, sizeof(seq->last));
+    }
+#endif
+    xSemaphoreGive(seq->lock);
+    return err;
+}
+
+static bool get_varint(const uint8_t *data, size_t size, size_t *off, uint64_t *val)
+{
+    *val = 0;
+    for (int shift = 0; *off < size && shift < 7 * LOG_REC_VARINT_MAX; shift += 7) {
+        uint8_t byte = data[(*off)++];
+        *val |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t get_u32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/* Returns 1 if decoded, 0 if the data ends within the string and -1 if it is invalid */
+static int get_str(const uint8_t *data, size_t size, size_t *off, esp_diag_log_decoder_t *dec,
+                   char *str, size_t str_size)
+{
+    uint64_t ref;
+    if (!get_varint(data, size, off, &ref)) {
+        return *off < size ? -1 : 0;
+    }
+    uint64_t idx = ref >> 1;
+    if (idx >= CONFIG_DIAG_LOG_STR_TABLE_SIZE) {
+        return -1;
+    }
+    if (ref & 1) {
+        if (*off >= size) {
+            return 0;
+        }
+        uint8_t len = data[(*off)++];
+        if (len >= ESP_DIAG_LOG_STR_SIZE) {
+            return -1;
+        }
+        if (*off + len > size) {
+            return 0;
+        }
+        memcpy(dec->str[idx], data + *off, len);
+        dec->str[idx][len] = '\0';
+        *off += len;
+    }
+    if (dec->synced) {
+        strlcpy(str, dec->str[idx], str_size);
+    }
+    return 1;
+}
+
+int esp_diag_log_record_decode(const uint8_t *data, size_t size, esp_diag_log_decoder_t *dec,
+                               esp_diag_log_data_t *log)
+{
+    size_t off = 0;
+    uint64_t ts;
+    int ret;
+
+    if (!data || !dec || !log || !size) {
+        return 0;
+    }
+    uint8_t flags = data[off++];
+    uint8_t type = flags & LOG_REC_TYPE_MASK;
+    if (!(flags & LOG_REC_MARK) || (type != ESP_DIAG_LOG_TYPE_ERROR && type != ESP_DIAG_LOG_TYPE_WARNING
+                                    && type != ESP_DIAG_LOG_TYPE_EVENT)) {
+        return -1;
+    }
+    if (!get_varint(data, size, &off, &ts)) {
+        return off < size ? -1 : 0;
+    }
+    if (off + 8 > size) {
+        return 0;
+    }
+    dec->seq_start = flags & LOG_REC_SYNC;
+    if (dec->seq_start) {
+        dec->synced = true;
+        dec->timestamp = ts;
+    } else {
+        dec->timestamp += ts;
+    }
+    memset(log, 0, sizeof(*log));
+    log->type = type;
+    log->timestamp = dec->timestamp;
+    log->pc = get_u32(data + off);
+    log->msg_ptr = (void *)get_u32(data + off + 4);
+    off += 8;
+    ret = get_str(data, size, &off, dec, log->tag, sizeof(log->tag));
+    if (ret <= 0) {
+        return ret;
+    }
+    if (flags & LOG_REC_TASK) {
+        ret = get_str(data, size, &off, dec, log->task_name, sizeof(log->task_name));
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+    if (off >= size) {
+        return 0;
+    }
+    uint8_t args_len = data[off++];
+    if (args_len > sizeof(log->msg_args)) {
+        return -1;
+    }
+    if (off + args_len > size) {
+        return 0;
+    }
+    memcpy(log->msg_args, data + off, args_len);
+    log->msg_args_len = args_len;
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    log->msg_args_raw = (flags & LOG_REC_RAW) ? 1 : 0;
+#endif
+    off += args_len;
+    if (flags & LOG_REC_REPEAT) {
+        uint64_t repeats, span;
+        if (!get_varint(data, size, &off, &repeats) || !get_varint(data, size, &off, &span)) {
+            return off < size ? -1 : 0;
+        }
+        if (!repeats || repeats > UINT32_MAX || span > log->timestamp) {
+            return -1;
+        }
+        log->repeats = repeats;
+        log->first_timestamp = log->timestamp - span;
+    }
+    return off;
+}
+
+void esp_diag_log_hook_sync(void)
+{
+    log_seq_t *seq = &s_priv_data.seq;
+    if (!s_priv_data.init) {
+        return;
+    }
+    xSemaphoreTake(seq->lock, portMAX_DELAY);
+#if CONFIG_DIAG_LOG_FOLD_REPEATS
+    /* The repeats are sent with the sequence, later ones are counted from a new record */
+    log_repeats_flush(seq);
+    seq->has_last = false;
+#endif
+    seq->sync = true;
+    xSemaphoreGive(seq->lock);
+}
+
+#if CONFIG_DIAG_LOG_RATE_LIMIT
+/* Takes a token from the bucket of the log statement, returns false if it is empty */
+static bool log_rate_take(const char *tag, const char *format)
+{
+    uint32_t hash = ((uintptr_t)format ^ ((uintptr_t)tag << 7)) * 2654435761u;
+    log_rate_slot_t *slot = &s_priv_data.rate[(hash >> 16) % CONFIG_DIAG_LOG_RATE_LIMIT_SLOTS];
+    int64_t now = esp_timer_get_time();
+    bool taken;
+
+    portENTER_CRITICAL(&s_rate_lock);
+    if (slot->format != format || slot->tag != tag) {
+        slot->tag = tag;
+        slot->format = format;
+        slot->full_at = now;
+    } else if (slot->full_at < now) {
+        slot->full_at = now;
+    }
+    taken = slot->full_at - now <= LOG_RATE_BURST_US;
+    if (taken) {
+        slot->full_at += LOG_RATE_INTERVAL_US;
+    }
+    portEXIT_CRITICAL(&s_rate_lock);
+    return taken;
+}
+#endif
+
 static esp_err_t diag_log_add(esp_diag_log_type_t type, uint32_t pc, const char *tag, const char *format, va_list args)
 {
     esp_diag_log_data_t log;
@@ -308,6 +845,11 @@ static esp_err_t diag_log_add(esp_diag_log_type_t type, uint32_t pc, const char
     if (!IS_LOG_TYPE_ENABLED(type)) {
         return ESP_ERR_NOT_FOUND;
     }
+#if CONFIG_DIAG_LOG_RATE_LIMIT
+    if (!log_rate_take(tag, format)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#endif
 
     memset(&log, 0, sizeof(log));
     log.type = type;
@@ -317,7 +859,14 @@ static esp_err_t diag_log_add(esp_diag_log_type_t type, uint32_t pc, const char
     strlcpy(log.tag, tag, sizeof(log.tag));
     log.msg_ptr = (void *)format;
     log.msg_args_len = sizeof(log.msg_args);
-#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV
+#if defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED)
+    /* Formats out of flash may be gone by the time the log is sent */
+    if (esp_ptr_in_drom(format)) {
+        get_raw_from_ap(&log, format, ap);
+    } else {
+        get_tlv_from_ap(&log, format, ap);
+    }
+#elif defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV)
     get_tlv_from_ap(&log, format, ap);
 #else
     vsnprintf((char *)log.msg_args, log.msg_args_len, format, ap);
@@ -332,7 +881,7 @@ static esp_err_t diag_log_add(esp_diag_log_type_t type, uint32_t pc, const char
     if (task_name) {
         strlcpy(log.task_name, task_name, sizeof(log.task_name));
     }
-    return write_data(&log, sizeof(log));
+    return log_record_write(&log);
 }
 
 /**
@@ -394,6 +943,11 @@ esp_err_t esp_diag_log_hook_init(esp_diag_log_config_t *config)
     if (s_priv_data.init) {
         return ESP_FAIL;
     }
+    s_priv_data.seq.lock = xSemaphoreCreateMutex();
+    if (!s_priv_data.seq.lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_priv_data.seq.sync = true;
     memcpy(&s_priv_data.config, config, sizeof(esp_diag_log_config_t));
     s_priv_data.init = true;
     return ESP_OK;
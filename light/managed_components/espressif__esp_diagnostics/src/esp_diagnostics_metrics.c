@@ -5,71 +5,216 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_metrics.h>
+#include "esp_diagnostics_internal.h"
 
 #define TAG "DIAG_METRICS"
 #define DIAG_METRICS_MAX_COUNT   CONFIG_DIAG_METRICS_MAX_COUNT
+#define DIAG_METRICS_INDEX_SIZE  DIAG_KEY_INDEX_SIZE(DIAG_METRICS_MAX_COUNT)
+
+/* A handle is the handle id plus one in the low half, so that 0 is never valid, and the generation of the id
+ * in the high half, so that the handle of an unregistered metrics does not report to a metrics registered later */
+#define HANDLE_MAKE(id, gen)     ((((uint32_t)(gen)) << 16) | ((id) + 1))
+#define HANDLE_ID(handle)        (((handle) & 0xFFFF) - 1)
+#define HANDLE_GEN(handle)       ((handle) >> 16)
 
 /* Max supported string lenth */
 #define MAX_STR_LEN             (sizeof(((esp_diag_str_data_pt_t *)0)->value.str) - 1)
 #define MAX_METRICS_WRITE_SZ     sizeof(esp_diag_data_pt_t)
 #define MAX_STR_METRICS_WRITE_SZ sizeof(esp_diag_str_data_pt_t)
 
+typedef struct {
+    uint64_t window_us;
+    esp_diag_aggr_data_pt_t pt;                     /* summary of the open window, empty if pt.count is 0 */
+} metrics_aggr_t;
+
 typedef struct {
     size_t metrics_count;
     esp_diag_metrics_meta_t metrics[DIAG_METRICS_MAX_COUNT];
+    uint16_t index[DIAG_METRICS_INDEX_SIZE];        /* slot plus one of the metrics, hashed by key, 0 if empty */
+    uint16_t slot_handle[DIAG_METRICS_MAX_COUNT];   /* handle id of the metrics in each slot */
+    uint16_t handle_slot[DIAG_METRICS_MAX_COUNT];   /* slot plus one of each handle id, 0 if the id is free */
+    uint16_t handle_gen[DIAG_METRICS_MAX_COUNT];    /* generation of each handle id */
+    metrics_aggr_t *aggr[DIAG_METRICS_MAX_COUNT];   /* aggregation of the metrics in each slot, NULL if none */
     esp_diag_metrics_config_t config;
     bool init;
 } metrics_priv_data_t;
 
 static metrics_priv_data_t s_priv_data;
+/* Protects the aggregation windows, which are updated by the reporting tasks */
+static portMUX_TYPE s_aggr_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void metrics_index_add(uint32_t slot)
+{
+    uint32_t i = esp_diag_key_hash(s_priv_data.metrics[slot].key) % DIAG_METRICS_INDEX_SIZE;
+    while (s_priv_data.index[i]) {
+        i = (i + 1) % DIAG_METRICS_INDEX_SIZE;
+    }
+    s_priv_data.index[i] = slot + 1;
+}
+
+/* Slots move on unregister, the index is simply rebuilt then */
+static void metrics_index_rebuild(void)
+{
+    memset(s_priv_data.index, 0, sizeof(s_priv_data.index));
+    for (uint32_t i = 0; i < s_priv_data.metrics_count; i++) {
+        metrics_index_add(i);
+    }
+}
+
+/* Returns the slot of the metrics, or -1. A NULL tag matches any tag */
+static int metrics_find(const char *tag, const char *key)
+{
+    uint32_t i = esp_diag_key_hash(key) % DIAG_METRICS_INDEX_SIZE;
+    while (s_priv_data.index[i]) {
+        esp_diag_metrics_meta_t *metrics = &s_priv_data.metrics[s_priv_data.index[i] - 1];
+        if ((strcmp(metrics->key, key) == 0) && (!tag || (strcmp(metrics->tag, tag) == 0))) {
+            return s_priv_data.index[i] - 1;
+        }
+        i = (i + 1) % DIAG_METRICS_INDEX_SIZE;
+    }
+    return -1;
+}
 
 static esp_diag_metrics_meta_t *esp_diag_metrics_meta_get(const char *tag, const char *key)
 {
-    uint32_t i;
     if (!tag || !key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].tag && s_priv_data.metrics[i].key &&
-                (strcmp(s_priv_data.metrics[i].tag, tag) == 0) &&
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            return &s_priv_data.metrics[i];
-        }
-    }
-    return NULL;
+    int slot = metrics_find(tag, key);
+    return slot < 0 ? NULL : &s_priv_data.metrics[slot];
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 /* Checks only by key for registered metric. Use this for meta version < 1.1 */
 static esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_by_key(const char *key)
 {
-    uint32_t i;
     if (!key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].key &&
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            return &s_priv_data.metrics[i];
+    int slot = metrics_find(NULL, key);
+    return slot < 0 ? NULL : &s_priv_data.metrics[slot];
+}
+#endif
+
+static esp_diag_metrics_meta_t *esp_diag_metrics_meta_get_by_handle(esp_diag_metrics_handle_t handle)
+{
+    uint32_t id = HANDLE_ID(handle);
+    if (id >= DIAG_METRICS_MAX_COUNT || !s_priv_data.handle_slot[id] ||
+            s_priv_data.handle_gen[id] != HANDLE_GEN(handle)) {
+        return NULL;
+    }
+    return &s_priv_data.metrics[s_priv_data.handle_slot[id] - 1];
+}
+
+static esp_err_t metrics_aggr_record(uint32_t slot, const esp_diag_aggr_data_pt_t *pt)
+{
+    if (s_priv_data.config.write_cb) {
+        return s_priv_data.config.write_cb(s_priv_data.metrics[slot].tag, (void *) pt, sizeof(*pt),
+                                           s_priv_data.config.cb_arg);
+    }
+    return ESP_OK;
+}
+
+/* Takes the window of the slot out if it is open and, unless all is set, has ended at ts.
+ * Caller holds s_aggr_lock */
+static bool metrics_aggr_take(uint32_t slot, bool all, uint64_t ts, esp_diag_aggr_data_pt_t *pt)
+{
+    metrics_aggr_t *aggr = s_priv_data.aggr[slot];
+    if (!aggr || !aggr->pt.count) {
+        return false;
+    }
+    /* Timestamps jump back when the time gets synchronized */
+    if (!all && ts >= aggr->pt.ts_start && ts - aggr->pt.ts_start < aggr->window_us) {
+        return false;
+    }
+    *pt = aggr->pt;
+    aggr->pt.count = 0;
+    return true;
+}
+
+/* Adds the value to the window of the slot, after recording the window if it has ended.
+ * Returns false if the metrics is not aggregated */
+static bool metrics_aggr_add(uint32_t slot, esp_diag_data_type_t data_type, const void *val, uint64_t ts,
+                             esp_err_t *err)
+{
+    esp_diag_aggr_data_pt_t closed;
+    portENTER_CRITICAL(&s_aggr_lock);
+    if (!s_priv_data.aggr[slot]) {
+        portEXIT_CRITICAL(&s_aggr_lock);
+        return false;
+    }
+    bool record = metrics_aggr_take(slot, false, ts, &closed);
+    esp_diag_aggr_data_pt_t *pt = &s_priv_data.aggr[slot]->pt;
+    if (!pt->count) {
+        pt->ts_start = ts;
+        memcpy(&pt->min, val, sizeof(pt->min));
+        pt->max = pt->min;
+        memset(&pt->sum, 0, sizeof(pt->sum));
+    }
+    switch (data_type) {
+        case ESP_DIAG_DATA_TYPE_INT: {
+            int32_t i;
+            memcpy(&i, val, sizeof(i));
+            pt->min.i = (i < pt->min.i) ? i : pt->min.i;
+            pt->max.i = (i > pt->max.i) ? i : pt->max.i;
+            pt->sum.i += i;
+            break;
+        }
+        case ESP_DIAG_DATA_TYPE_UINT: {
+            uint32_t u;
+            memcpy(&u, val, sizeof(u));
+            pt->min.u = (u < pt->min.u) ? u : pt->min.u;
+            pt->max.u = (u > pt->max.u) ? u : pt->max.u;
+            pt->sum.u += u;
+            break;
+        }
+        default: {
+            float f;
+            memcpy(&f, val, sizeof(f));
+            pt->min.f = (f < pt->min.f) ? f : pt->min.f;
+            pt->max.f = (f > pt->max.f) ? f : pt->max.f;
+            pt->sum.f += f;
+            break;
         }
     }
-    return NULL;
+    pt->count++;
+    pt->ts = ts;
+    portEXIT_CRITICAL(&s_aggr_lock);
+
+    *err = record ? metrics_aggr_record(slot, &closed) : ESP_OK;
+    return true;
+}
+
+/* Stops the aggregation of the slot, recording its open window */
+static esp_err_t metrics_aggr_remove(uint32_t slot)
+{
+    esp_diag_aggr_data_pt_t closed;
+    portENTER_CRITICAL(&s_aggr_lock);
+    bool record = metrics_aggr_take(slot, true, 0, &closed);
+    metrics_aggr_t *aggr = s_priv_data.aggr[slot];
+    s_priv_data.aggr[slot] = NULL;
+    portEXIT_CRITICAL(&s_aggr_lock);
+
+    free(aggr);
+    return record ? metrics_aggr_record(slot, &closed) : ESP_OK;
 }
-#endif
 
 static bool tag_key_present(const char *tag, const char *key)
 {
     return (esp_diag_metrics_meta_get(tag, key) != NULL);
 }
 
-esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
-                                    const char *label, const char *path,
-                                    esp_diag_data_type_t type)
+esp_err_t esp_diag_metrics_register_with_handle(const char *tag, const char *key,
+                                                const char *label, const char *path,
+                                                esp_diag_data_type_t type, esp_diag_metrics_handle_t *handle)
 {
     if (!tag || !key || !label || !path) {
         ESP_LOGE(TAG, "Failed to register metrics, tag, key, lable, or path is NULL");
@@ -86,16 +231,37 @@ esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
         ESP_LOGE(TAG, "Metrics tag: %s key:%s exists", tag, key);
         return ESP_FAIL;
     }
-    s_priv_data.metrics[s_priv_data.metrics_count].tag = tag;
-    s_priv_data.metrics[s_priv_data.metrics_count].key = key;
-    s_priv_data.metrics[s_priv_data.metrics_count].label = label;
-    s_priv_data.metrics[s_priv_data.metrics_count].unit = NULL;
-    s_priv_data.metrics[s_priv_data.metrics_count].path = path;
-    s_priv_data.metrics[s_priv_data.metrics_count].type = type;
+    uint32_t slot = s_priv_data.metrics_count;
+    s_priv_data.metrics[slot].tag = tag;
+    s_priv_data.metrics[slot].key = key;
+    s_priv_data.metrics[slot].label = label;
+    s_priv_data.metrics[slot].unit = NULL;
+    s_priv_data.metrics[slot].path = path;
+    s_priv_data.metrics[slot].type = type;
     s_priv_data.metrics_count++;
+    metrics_index_add(slot);
+    esp_diag_meta_changed();
+
+    /* There are as many handle ids as slots, so one is free */
+    uint32_t id = 0;
+    while (s_priv_data.handle_slot[id]) {
+        id++;
+    }
+    s_priv_data.handle_slot[id] = slot + 1;
+    s_priv_data.slot_handle[slot] = id;
+    if (handle) {
+        *handle = HANDLE_MAKE(id, s_priv_data.handle_gen[id]);
+    }
     return ESP_OK;
 }
 
+esp_err_t esp_diag_metrics_register(const char *tag, const char *key,
+                                    const char *label, const char *path,
+                                    esp_diag_data_type_t type)
+{
+    return esp_diag_metrics_register_with_handle(tag, key, label, path, type, NULL);
+}
+
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 esp_err_t esp_diag_metrics_add_unit(const char *key, const char *unit)
 #else
@@ -128,6 +294,7 @@ esp_err_t esp_diag_metrics_add_unit(const char *tag, const char *key, const char
     }
 #endif
     metrics->unit = unit;
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -137,31 +304,35 @@ esp_err_t esp_diag_metrics_unregister(const char *key)
 esp_err_t esp_diag_metrics_unregister(const char *tag, const char *key)
 #endif
 {
-    int i;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
     if (!tag) {
         return ESP_ERR_INVALID_ARG;
     }
+#else
+    const char *tag = NULL;
 #endif
     if (!key) {
         return ESP_ERR_INVALID_ARG;
     }
-    for (i = 0; i < s_priv_data.metrics_count; i++) {
-        if (s_priv_data.metrics[i].key &&
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                (strcmp(s_priv_data.metrics[i].tag, tag) == 0) &&
-#endif
-                (strcmp(s_priv_data.metrics[i].key, key) == 0)) {
-            break;
-        }
-    }
-    if (i < s_priv_data.metrics_count) {
-        s_priv_data.metrics[i] = s_priv_data.metrics[s_priv_data.metrics_count - 1];
-        memset(&s_priv_data.metrics[s_priv_data.metrics_count - 1], 0, sizeof(esp_diag_metrics_meta_t));
-        s_priv_data.metrics_count--;
-        return ESP_OK;
+    int i = metrics_find(tag, key);
+    if (i < 0) {
+        return ESP_ERR_NOT_FOUND;
     }
-    return ESP_ERR_NOT_FOUND;
+    metrics_aggr_remove(i);
+    uint32_t last = s_priv_data.metrics_count - 1;
+    uint16_t id = s_priv_data.slot_handle[i];
+    s_priv_data.handle_slot[id] = 0;
+    s_priv_data.handle_gen[id]++;
+    s_priv_data.metrics[i] = s_priv_data.metrics[last];
+    s_priv_data.slot_handle[i] = s_priv_data.slot_handle[last];
+    s_priv_data.handle_slot[s_priv_data.slot_handle[i]] = i + 1;
+    s_priv_data.aggr[i] = s_priv_data.aggr[last];
+    s_priv_data.aggr[last] = NULL;
+    memset(&s_priv_data.metrics[last], 0, sizeof(esp_diag_metrics_meta_t));
+    s_priv_data.metrics_count--;
+    metrics_index_rebuild();
+    esp_diag_meta_changed();
+    return ESP_OK;
 }
 
 esp_err_t esp_diag_metrics_unregister_all(void)
@@ -169,8 +340,17 @@ esp_err_t esp_diag_metrics_unregister_all(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    for (uint32_t i = 0; i < s_priv_data.metrics_count; i++) {
+        metrics_aggr_remove(i);
+    }
     memset(&s_priv_data.metrics, 0, sizeof(s_priv_data.metrics));
+    memset(&s_priv_data.index, 0, sizeof(s_priv_data.index));
+    memset(&s_priv_data.handle_slot, 0, sizeof(s_priv_data.handle_slot));
+    for (uint32_t id = 0; id < DIAG_METRICS_MAX_COUNT; id++) {
+        s_priv_data.handle_gen[id]++;
+    }
     s_priv_data.metrics_count = 0;
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -215,7 +395,48 @@ esp_err_t esp_diag_metrics_deinit(void)
     if (!s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    for (uint32_t i = 0; i < s_priv_data.metrics_count; i++) {
+        metrics_aggr_remove(i);
+    }
     memset(&s_priv_data, 0, sizeof(s_priv_data));
+    esp_diag_meta_changed();
+    return ESP_OK;
+}
+
+static esp_err_t esp_diag_metrics_write(const esp_diag_metrics_meta_t *metrics, esp_diag_data_type_t data_type,
+                                        const void *val, size_t val_sz, uint64_t ts)
+{
+    if (metrics->type != data_type) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err;
+    uint32_t slot = metrics - s_priv_data.metrics;
+    if (s_priv_data.aggr[slot] && metrics_aggr_add(slot, data_type, val, ts, &err)) {
+        return err;
+    }
+
+    size_t write_sz = MAX_METRICS_WRITE_SZ;
+    if (metrics->type == ESP_DIAG_DATA_TYPE_STR) {
+        write_sz = MAX_STR_METRICS_WRITE_SZ;
+        if (val_sz > MAX_STR_LEN) {
+            val_sz = MAX_STR_LEN;
+        }
+    }
+
+    esp_diag_str_data_pt_t data;
+    memset(&data, 0, sizeof(data));
+    data.type = ESP_DIAG_DATA_PT_METRICS;
+    data.data_type = data_type;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    strlcpy(data.tag, metrics->tag, sizeof(data.tag));
+#endif
+    strlcpy(data.key, metrics->key, sizeof(data.key));
+    data.ts = ts;
+    memcpy(&data.value, val, val_sz);
+
+    if (s_priv_data.config.write_cb) {
+        return s_priv_data.config.write_cb(metrics->tag, &data, write_sz, s_priv_data.config.cb_arg);
+    }
     return ESP_OK;
 }
 
@@ -252,29 +473,120 @@ esp_err_t esp_diag_metrics_report(esp_diag_data_type_t data_type, const char *ta
         return ESP_ERR_NOT_FOUND;
     }
 #endif
-    if (metrics->type != data_type) {
+    return esp_diag_metrics_write(metrics, data_type, val, val_sz, ts);
+}
+
+esp_err_t esp_diag_metrics_add_by_handle(esp_diag_data_type_t data_type, esp_diag_metrics_handle_t handle,
+                                         const void *val, size_t val_sz, uint64_t ts)
+{
+    if (!val) {
         return ESP_ERR_INVALID_ARG;
     }
-    size_t write_sz = MAX_METRICS_WRITE_SZ;
-    if (metrics->type == ESP_DIAG_DATA_TYPE_STR) {
-        write_sz = MAX_STR_METRICS_WRITE_SZ;
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_handle(handle);
+    if (!metrics) {
+        ESP_LOGI(TAG, "metrics with (handle 0x%" PRIx32 ") not registered", handle);
+        return ESP_ERR_NOT_FOUND;
     }
+    return esp_diag_metrics_write(metrics, data_type, val, val_sz, ts);
+}
 
-    esp_diag_str_data_pt_t data;
-    memset(&data, 0, sizeof(data));
-    data.type = ESP_DIAG_DATA_PT_METRICS;
-    data.data_type = data_type;
+esp_err_t esp_diag_metrics_aggregate_by_handle(esp_diag_metrics_handle_t handle, uint32_t window_ms)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_diag_metrics_meta_t *metrics = esp_diag_metrics_meta_get_by_handle(handle);
+    if (!metrics) {
+        ESP_LOGI(TAG, "metrics with (handle 0x%" PRIx32 ") not registered", handle);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (metrics->type != ESP_DIAG_DATA_TYPE_INT && metrics->type != ESP_DIAG_DATA_TYPE_UINT &&
+            metrics->type != ESP_DIAG_DATA_TYPE_FLOAT) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint32_t slot = metrics - s_priv_data.metrics;
+    if (!window_ms) {
+        return metrics_aggr_remove(slot);
+    }
+    if (s_priv_data.aggr[slot]) {
+        portENTER_CRITICAL(&s_aggr_lock);
+        s_priv_data.aggr[slot]->window_us = (uint64_t) window_ms * 1000;
+        portEXIT_CRITICAL(&s_aggr_lock);
+        return ESP_OK;
+    }
+    metrics_aggr_t *aggr = calloc(1, sizeof(metrics_aggr_t));
+    if (!aggr) {
+        return ESP_ERR_NO_MEM;
+    }
+    aggr->window_us = (uint64_t) window_ms * 1000;
+    aggr->pt.type = ESP_DIAG_DATA_PT_METRICS;
+    aggr->pt.data_type = metrics->type;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    strlcpy(data.tag, tag, sizeof(data.tag));
+    strlcpy(aggr->pt.tag, metrics->tag, sizeof(aggr->pt.tag));
 #endif
-    strlcpy(data.key, key, sizeof(data.key));
-    data.ts = ts;
-    memcpy(&data.value, val, val_sz);
+    strlcpy(aggr->pt.key, metrics->key, sizeof(aggr->pt.key));
+    portENTER_CRITICAL(&s_aggr_lock);
+    s_priv_data.aggr[slot] = aggr;
+    portEXIT_CRITICAL(&s_aggr_lock);
+    return ESP_OK;
+}
 
-    if (s_priv_data.config.write_cb) {
-        return s_priv_data.config.write_cb(metrics->tag, &data, write_sz, s_priv_data.config.cb_arg);
+esp_err_t esp_diag_metrics_aggregation_flush(bool all)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
     }
-    return ESP_OK;
+    esp_err_t ret = ESP_OK;
+    uint64_t now = esp_diag_timestamp_get();
+    for (uint32_t i = 0; i < s_priv_data.metrics_count; i++) {
+        esp_diag_aggr_data_pt_t closed;
+        portENTER_CRITICAL(&s_aggr_lock);
+        bool record = metrics_aggr_take(i, all, now, &closed);
+        portEXIT_CRITICAL(&s_aggr_lock);
+        if (record) {
+            esp_err_t err = metrics_aggr_record(i, &closed);
+            ret = (ret == ESP_OK) ? err : ret;
+        }
+    }
+    return ret;
+}
+
+esp_err_t esp_diag_metrics_add_bool_by_handle(esp_diag_metrics_handle_t handle, bool b)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_BOOL, handle, &b, sizeof(b), esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_int_by_handle(esp_diag_metrics_handle_t handle, int32_t i)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_INT, handle, &i, sizeof(i), esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_uint_by_handle(esp_diag_metrics_handle_t handle, uint32_t u)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_UINT, handle, &u, sizeof(u), esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_float_by_handle(esp_diag_metrics_handle_t handle, float f)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_FLOAT, handle, &f, sizeof(f), esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_ipv4_by_handle(esp_diag_metrics_handle_t handle, uint32_t ip)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_IPv4, handle, &ip, sizeof(ip), esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_mac_by_handle(esp_diag_metrics_handle_t handle, uint8_t *mac)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_MAC, handle, mac, 6, esp_diag_timestamp_get());
+}
+
+esp_err_t esp_diag_metrics_add_str_by_handle(esp_diag_metrics_handle_t handle, const char *str)
+{
+    return esp_diag_metrics_add_by_handle(ESP_DIAG_DATA_TYPE_STR, handle, str, strlen(str), esp_diag_timestamp_get());
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
@@ -8,6 +8,11 @@
 #include <esp_event.h>
 #include <esp_wifi.h>
 #include <esp_netif_ip_addr.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_diagnostics.h>
 #include <esp_diagnostics_variables.h>
 
 #define TAG_IP             "ip"
@@ -38,24 +43,220 @@
 #define PATH_IP_STATION    "IP.Station"
 #define PATH_WIFI_AP       "Wi-Fi.AP"
 
+/* Largest value of the variables, the SSID */
+#define NET_VAR_VALUE_MAX_SIZE  32
+
+#define HOLDOFF_US              ((int64_t)CONFIG_DIAG_NETWORK_VARIABLES_HOLDOFF * 1000)
+
+typedef enum {
+    NET_VAR_SSID,
+    NET_VAR_BSSID,
+    NET_VAR_CHANNEL,
+    NET_VAR_AUTHMODE,
+    NET_VAR_REASON,
+    NET_VAR_DISC_CNT,
+    NET_VAR_IPv4,
+    NET_VAR_NETMASK,
+    NET_VAR_GATEWAY,
+#if CONFIG_DIAG_MORE_NETWORK_VARS
+    NET_VAR_PROTOCOL,
+    NET_VAR_BANDWIDTH,
+    NET_VAR_POWER_SAVE,
+    NET_VAR_SECOND_CH,
+    NET_VAR_PROTOCOL_AP,
+    NET_VAR_BANDWIDTH_AP,
+#endif
+    NET_VAR_MAX,
+} net_var_id_t;
+
+typedef struct {
+    uint8_t value[NET_VAR_VALUE_MAX_SIZE];
+    size_t len;
+    int64_t reported_at;    /* esp_timer time of the last report */
+    bool reported;
+    /* The latest value, held off until the hold-off time since the last report elapses */
+    uint8_t pending[NET_VAR_VALUE_MAX_SIZE];
+    size_t pending_len;
+    uint64_t pending_ts;
+    bool is_pending;
+} net_var_state_t;
+
+typedef struct {
+    const char *tag;
+    const char *key;
+    esp_diag_data_type_t type;
+} net_var_desc_t;
+
+static const net_var_desc_t s_net_vars[NET_VAR_MAX] = {
+    [NET_VAR_SSID]         = { TAG_WIFI, KEY_SSID,         ESP_DIAG_DATA_TYPE_STR  },
+    [NET_VAR_BSSID]        = { TAG_WIFI, KEY_BSSID,        ESP_DIAG_DATA_TYPE_MAC  },
+    [NET_VAR_CHANNEL]      = { TAG_WIFI, KEY_CHANNEL,      ESP_DIAG_DATA_TYPE_INT  },
+    [NET_VAR_AUTHMODE]     = { TAG_WIFI, KEY_AUTHMODE,     ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_REASON]       = { TAG_WIFI, KEY_REASON,       ESP_DIAG_DATA_TYPE_INT  },
+    [NET_VAR_DISC_CNT]     = { TAG_WIFI, KEY_DISC_CNT,     ESP_DIAG_DATA_TYPE_INT  },
+    [NET_VAR_IPv4]         = { TAG_IP,   KEY_IPv4,         ESP_DIAG_DATA_TYPE_IPv4 },
+    [NET_VAR_NETMASK]      = { TAG_IP,   KEY_NETMASK,      ESP_DIAG_DATA_TYPE_IPv4 },
+    [NET_VAR_GATEWAY]      = { TAG_IP,   KEY_GATEWAY,      ESP_DIAG_DATA_TYPE_IPv4 },
+#if CONFIG_DIAG_MORE_NETWORK_VARS
+    [NET_VAR_PROTOCOL]     = { TAG_WIFI, KEY_PROTOCOL,     ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_BANDWIDTH]    = { TAG_WIFI, KEY_BANDWIDTH,    ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_POWER_SAVE]   = { TAG_WIFI, KEY_POWER_SAVE,   ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_SECOND_CH]    = { TAG_WIFI, KEY_SECOND_CH,    ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_PROTOCOL_AP]  = { TAG_WIFI, KEY_PROTOCOL_AP,  ESP_DIAG_DATA_TYPE_UINT },
+    [NET_VAR_BANDWIDTH_AP] = { TAG_WIFI, KEY_BANDWIDTH_AP, ESP_DIAG_DATA_TYPE_UINT },
+#endif
+};
+
 typedef struct {
-    wifi_event_sta_connected_t prev_sta_data;
     bool wifi_connected;
     int32_t disconn_cnt;
     bool init;
+    /* Taken by the event handler and the flush of the held off values, which runs in the work queue */
+    SemaphoreHandle_t lock;
+    net_var_state_t vars[NET_VAR_MAX];
+    /* Only the flush scheduled last runs, the ones scheduled before it or before a deinit return */
+    uint32_t flush_gen;
+    bool flush_scheduled;
 } priv_data_t;
 
 static priv_data_t s_priv_data;
 
-static bool bssid_matched(uint8_t *bssid1, uint8_t *bssid2)
+static void net_var_post(net_var_id_t id, const void *value, size_t len, uint64_t ts)
+{
+    const net_var_desc_t *desc = &s_net_vars[id];
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_variable_add(desc->type, desc->key, value, len, ts);
+#else
+    esp_diag_variable_report(desc->type, desc->tag, desc->key, value, len, ts);
+#endif
+}
+
+static bool net_var_changed(const net_var_state_t *var, const void *value, size_t len)
 {
-    uint8_t i;
-    for (i = 0; i < 6; i++) {
-        if (bssid1[i] != bssid2[i]) {
-            return false;
+    return !var->reported || var->len != len || memcmp(var->value, value, len) != 0;
+}
+
+/* Called with the lock held, posts the value and records it as the one reported last */
+static void net_var_commit(net_var_id_t id, const void *value, size_t len, uint64_t ts, int64_t now)
+{
+    net_var_state_t *var = &s_priv_data.vars[id];
+    memcpy(var->value, value, len);
+    var->len = len;
+    var->reported = true;
+    var->reported_at = now;
+    net_var_post(id, var->value, len, ts);
+}
+
+static void net_vars_flush(void *priv);
+
+/* Called with the lock held */
+static void net_vars_schedule_flush(uint32_t delay_ms)
+{
+    s_priv_data.flush_gen++;
+    if (esp_rmaker_work_queue_add_delayed_task(net_vars_flush, (void *)(uintptr_t)s_priv_data.flush_gen,
+                                               delay_ms) == ESP_OK) {
+        s_priv_data.flush_scheduled = true;
+        return;
+    }
+    /* Rather than losing them, report the held off values now */
+    s_priv_data.flush_scheduled = false;
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < NET_VAR_MAX; i++) {
+        net_var_state_t *var = &s_priv_data.vars[i];
+        if (var->is_pending) {
+            var->is_pending = false;
+            if (net_var_changed(var, var->pending, var->pending_len)) {
+                net_var_commit(i, var->pending, var->pending_len, var->pending_ts, now);
+            }
         }
     }
-    return true;
+}
+
+static void net_vars_flush(void *priv)
+{
+    xSemaphoreTake(s_priv_data.lock, portMAX_DELAY);
+    if (!s_priv_data.init || !s_priv_data.flush_scheduled || (uint32_t)(uintptr_t)priv != s_priv_data.flush_gen) {
+        xSemaphoreGive(s_priv_data.lock);
+        return;
+    }
+    s_priv_data.flush_scheduled = false;
+    int64_t now = esp_timer_get_time();
+    int64_t next = -1;
+    for (int i = 0; i < NET_VAR_MAX; i++) {
+        net_var_state_t *var = &s_priv_data.vars[i];
+        if (!var->is_pending) {
+            continue;
+        }
+        int64_t wait = var->reported_at + HOLDOFF_US - now;
+        if (wait > 0) {
+            if (next < 0 || wait < next) {
+                next = wait;
+            }
+            continue;
+        }
+        var->is_pending = false;
+        /* A value which flapped back to the one reported last is not reported again */
+        if (net_var_changed(var, var->pending, var->pending_len)) {
+            net_var_commit(i, var->pending, var->pending_len, var->pending_ts, now);
+        }
+    }
+    if (next >= 0) {
+        net_vars_schedule_flush((uint32_t)((next + 999) / 1000));
+    }
+    xSemaphoreGive(s_priv_data.lock);
+}
+
+/* Reports a network variable if its value changed since it was reported last. A value changing again
+ * within CONFIG_DIAG_NETWORK_VARIABLES_HOLDOFF of the last report is held off, and only its latest value
+ * is reported when the hold-off time elapses, so that roaming or a flaky AP do not write a burst of values.
+ */
+static void net_var_report(net_var_id_t id, const void *value, size_t len)
+{
+    net_var_state_t *var = &s_priv_data.vars[id];
+    uint64_t ts = esp_diag_timestamp_get();
+
+    if (len > NET_VAR_VALUE_MAX_SIZE) {
+        len = NET_VAR_VALUE_MAX_SIZE;
+    }
+    xSemaphoreTake(s_priv_data.lock, portMAX_DELAY);
+    if (var->is_pending) {
+        memcpy(var->pending, value, len);
+        var->pending_len = len;
+        var->pending_ts = ts;
+        goto exit;
+    }
+    if (!net_var_changed(var, value, len)) {
+        goto exit;
+    }
+    int64_t now = esp_timer_get_time();
+    if (var->reported && now - var->reported_at < HOLDOFF_US) {
+        memcpy(var->pending, value, len);
+        var->pending_len = len;
+        var->pending_ts = ts;
+        var->is_pending = true;
+        if (!s_priv_data.flush_scheduled) {
+            net_vars_schedule_flush((uint32_t)((var->reported_at + HOLDOFF_US - now + 999) / 1000));
+        }
+        goto exit;
+    }
+    net_var_commit(id, value, len, ts, now);
+exit:
+    xSemaphoreGive(s_priv_data.lock);
+}
+
+static void net_var_report_int(net_var_id_t id, int32_t i)
+{
+    net_var_report(id, &i, sizeof(i));
+}
+
+static void net_var_report_uint(net_var_id_t id, uint32_t u)
+{
+    net_var_report(id, &u, sizeof(u));
+}
+
+static void net_var_report_str(net_var_id_t id, const char *str, size_t max_len)
+{
+    net_var_report(id, str, strnlen(str, max_len));
 }
 
 #if CONFIG_DIAG_MORE_NETWORK_VARS
@@ -68,37 +269,20 @@ static void diag_add_more_wifi_vars()
     esp_wifi_get_bandwidth(WIFI_IF_STA, &wifi_bw);
     esp_wifi_get_ps(&wifi_ps_type);
 
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_variable_add_uint(KEY_PROTOCOL, wifi_protocol);
-    esp_diag_variable_add_uint(KEY_BANDWIDTH, wifi_bw);
-    esp_diag_variable_add_uint(KEY_POWER_SAVE, wifi_ps_type);
+    net_var_report_uint(NET_VAR_PROTOCOL, wifi_protocol);
+    net_var_report_uint(NET_VAR_BANDWIDTH, wifi_bw);
+    net_var_report_uint(NET_VAR_POWER_SAVE, wifi_ps_type);
     if (wifi_bw == WIFI_BW_HT40) {
         // not very useful for now, but will be useful for 5GHz band
         uint8_t primary_ch = 0;
         wifi_second_chan_t secondary_ch = WIFI_SECOND_CHAN_NONE;
         esp_wifi_get_channel(&primary_ch, &secondary_ch);
-        esp_diag_variable_add_uint(KEY_SECOND_CH, secondary_ch);
+        net_var_report_uint(NET_VAR_SECOND_CH, secondary_ch);
     }
     esp_wifi_get_protocol(WIFI_IF_AP, &wifi_protocol);
     esp_wifi_get_bandwidth(WIFI_IF_AP, &wifi_bw);
-    esp_diag_variable_add_uint(KEY_PROTOCOL_AP, wifi_protocol);
-    esp_diag_variable_add_uint(KEY_BANDWIDTH_AP, wifi_bw);
-#else
-    esp_diag_variable_report_uint(TAG_WIFI, KEY_PROTOCOL, wifi_protocol);
-    esp_diag_variable_report_uint(TAG_WIFI, KEY_BANDWIDTH, wifi_bw);
-    esp_diag_variable_report_uint(TAG_WIFI, KEY_POWER_SAVE, wifi_ps_type);
-    if (wifi_bw == WIFI_BW_HT40) {
-        // not very useful for now, but will be useful for 5GHz band
-        uint8_t primary_ch = 0;
-        wifi_second_chan_t secondary_ch = WIFI_SECOND_CHAN_NONE;
-        esp_wifi_get_channel(&primary_ch, &secondary_ch);
-        esp_diag_variable_report_uint(TAG_WIFI, KEY_SECOND_CH, secondary_ch);
-    }
-    esp_wifi_get_protocol(WIFI_IF_AP, &wifi_protocol);
-    esp_wifi_get_bandwidth(WIFI_IF_AP, &wifi_bw);
-    esp_diag_variable_report_uint(TAG_WIFI, KEY_PROTOCOL_AP, wifi_protocol);
-    esp_diag_variable_report_uint(TAG_WIFI, KEY_BANDWIDTH_AP, wifi_bw);
-#endif
+    net_var_report_uint(NET_VAR_PROTOCOL_AP, wifi_protocol);
+    net_var_report_uint(NET_VAR_BANDWIDTH_AP, wifi_bw);
 }
 #endif
 
@@ -133,34 +317,10 @@ static void evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_id, vo
             {
                 s_priv_data.wifi_connected = true;
                 wifi_event_sta_connected_t *data = evt_data;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                if (strncmp((char *)s_priv_data.prev_sta_data.ssid, (char *)data->ssid, data->ssid_len) != 0) {
-                    esp_diag_variable_add_str(KEY_SSID, (char *)data->ssid);
-                }
-                if (!bssid_matched(s_priv_data.prev_sta_data.bssid, data->bssid)) {
-                    esp_diag_variable_add_mac(KEY_BSSID, data->bssid);
-                }
-                if (s_priv_data.prev_sta_data.channel != data->channel) {
-                    esp_diag_variable_add_int(KEY_CHANNEL, data->channel);
-                }
-                if (s_priv_data.prev_sta_data.authmode != data->authmode) {
-                    esp_diag_variable_add_uint(KEY_AUTHMODE, data->authmode);
-                }
-#else
-                if (strncmp((char *)s_priv_data.prev_sta_data.ssid, (char *)data->ssid, data->ssid_len) != 0) {
-                    esp_diag_variable_report_str(TAG_WIFI, KEY_SSID, (char *)data->ssid);
-                }
-                if (!bssid_matched(s_priv_data.prev_sta_data.bssid, data->bssid)) {
-                    esp_diag_variable_report_mac(TAG_WIFI, KEY_BSSID, data->bssid);
-                }
-                if (s_priv_data.prev_sta_data.channel != data->channel) {
-                    esp_diag_variable_report_int(TAG_WIFI, KEY_CHANNEL, data->channel);
-                }
-                if (s_priv_data.prev_sta_data.authmode != data->authmode) {
-                    esp_diag_variable_report_uint(TAG_WIFI, KEY_AUTHMODE, data->authmode);
-                }
-#endif
-                memcpy(&s_priv_data.prev_sta_data, data, sizeof(s_priv_data.prev_sta_data));
+                net_var_report_str(NET_VAR_SSID, (char *)data->ssid, data->ssid_len);
+                net_var_report(NET_VAR_BSSID, data->bssid, sizeof(data->bssid));
+                net_var_report_int(NET_VAR_CHANNEL, data->channel);
+                net_var_report_uint(NET_VAR_AUTHMODE, data->authmode);
                 break;
             }
             case WIFI_EVENT_STA_DISCONNECTED:
@@ -169,25 +329,15 @@ static void evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_id, vo
                     s_priv_data.wifi_connected = false;
                     wifi_event_sta_disconnected_t *data = evt_data;
                     s_priv_data.disconn_cnt++;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                    esp_diag_variable_add_int(KEY_REASON, data->reason);
-                    esp_diag_variable_add_int(KEY_DISC_CNT, s_priv_data.disconn_cnt);
-#else
-                    esp_diag_variable_report_int(TAG_WIFI, KEY_REASON, data->reason);
-                    esp_diag_variable_report_int(TAG_WIFI, KEY_DISC_CNT, s_priv_data.disconn_cnt);
-#endif
+                    net_var_report_int(NET_VAR_REASON, data->reason);
+                    net_var_report_int(NET_VAR_DISC_CNT, s_priv_data.disconn_cnt);
                 }
                 break;
             }
             case WIFI_EVENT_STA_AUTHMODE_CHANGE:
             {
                 wifi_event_sta_authmode_change_t *data = evt_data;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                esp_diag_variable_add_uint(KEY_AUTHMODE, data->new_mode);
-#else
-                esp_diag_variable_report_uint(TAG_WIFI, KEY_AUTHMODE, data->new_mode);
-#endif
-                s_priv_data.prev_sta_data.authmode = data->new_mode;
+                net_var_report_uint(NET_VAR_AUTHMODE, data->new_mode);
                 break;
             }
             default:
@@ -198,15 +348,9 @@ static void evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_id, vo
             case IP_EVENT_STA_GOT_IP:
             {
                 ip_event_got_ip_t *data = evt_data;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                esp_diag_variable_add_ipv4(KEY_IPv4, data->ip_info.ip.addr);
-                esp_diag_variable_add_ipv4(KEY_NETMASK, data->ip_info.netmask.addr);
-                esp_diag_variable_add_ipv4(KEY_GATEWAY, data->ip_info.gw.addr);
-#else
-                esp_diag_variable_report_ipv4(TAG_IP, KEY_IPv4, data->ip_info.ip.addr);
-                esp_diag_variable_report_ipv4(TAG_IP, KEY_NETMASK, data->ip_info.netmask.addr);
-                esp_diag_variable_report_ipv4(TAG_IP, KEY_GATEWAY, data->ip_info.gw.addr);
-#endif
+                net_var_report(NET_VAR_IPv4, &data->ip_info.ip.addr, sizeof(uint32_t));
+                net_var_report(NET_VAR_NETMASK, &data->ip_info.netmask.addr, sizeof(uint32_t));
+                net_var_report(NET_VAR_GATEWAY, &data->ip_info.gw.addr, sizeof(uint32_t));
 #if CONFIG_DIAG_MORE_NETWORK_VARS
                 diag_add_more_wifi_vars();
 #endif
@@ -215,11 +359,7 @@ static void evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_id, vo
             case IP_EVENT_STA_LOST_IP:
             {
                 uint32_t ip = 0x0;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                esp_diag_variable_add_ipv4(KEY_IPv4, ip);
-#else
-                esp_diag_variable_report_ipv4(TAG_IP, KEY_IPv4, ip);
-#endif
+                net_var_report(NET_VAR_IPv4, &ip, sizeof(ip));
                 break;
             }
             default:
@@ -236,6 +376,13 @@ esp_err_t esp_diag_network_variables_init(void)
     if (s_priv_data.init) {
         return ESP_ERR_INVALID_STATE;
     }
+    /* Kept across a deinit, as a flush of the held off values may still be scheduled */
+    if (!s_priv_data.lock) {
+        s_priv_data.lock = xSemaphoreCreateMutex();
+        if (!s_priv_data.lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
     /* Register the event handler for wifi events */
     esp_err_t err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, evt_handler, NULL);
     if (err != ESP_OK) {
@@ -258,48 +405,28 @@ esp_err_t esp_diag_network_variables_init(void)
     esp_diag_variable_register(TAG_IP, KEY_NETMASK, "Netmask", PATH_IP_STATION, ESP_DIAG_DATA_TYPE_IPv4);
     esp_diag_variable_register(TAG_IP, KEY_GATEWAY, "Gateway", PATH_IP_STATION, ESP_DIAG_DATA_TYPE_IPv4);
 
-    memset(&s_priv_data.prev_sta_data, 0, sizeof(s_priv_data.prev_sta_data));
     /* If wifi is not connected then wifi details are recorded in event handler */
     if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
         /* If wifi is connected then record the wifi details */
-        memcpy(s_priv_data.prev_sta_data.ssid, ap_info.ssid, sizeof(s_priv_data.prev_sta_data.ssid));
-        memcpy(s_priv_data.prev_sta_data.bssid, ap_info.bssid, sizeof(s_priv_data.prev_sta_data.bssid));
-        s_priv_data.prev_sta_data.channel = ap_info.primary;
-        s_priv_data.prev_sta_data.authmode = ap_info.authmode;
         s_priv_data.wifi_connected = true;
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-        esp_diag_variable_add_str(KEY_SSID, (char *)ap_info.ssid);
-        esp_diag_variable_add_mac(KEY_BSSID, ap_info.bssid);
-        esp_diag_variable_add_int(KEY_CHANNEL, ap_info.primary);
-        esp_diag_variable_add_uint(KEY_AUTHMODE, ap_info.authmode);
-#else
-        esp_diag_variable_report_str(TAG_WIFI, KEY_SSID, (char *)ap_info.ssid);
-        esp_diag_variable_report_mac(TAG_WIFI, KEY_BSSID, ap_info.bssid);
-        esp_diag_variable_report_int(TAG_WIFI, KEY_CHANNEL, ap_info.primary);
-        esp_diag_variable_report_uint(TAG_WIFI, KEY_AUTHMODE, ap_info.authmode);
-#endif
+        net_var_report_str(NET_VAR_SSID, (char *)ap_info.ssid, sizeof(ap_info.ssid));
+        net_var_report(NET_VAR_BSSID, ap_info.bssid, sizeof(ap_info.bssid));
+        net_var_report_int(NET_VAR_CHANNEL, ap_info.primary);
+        net_var_report_uint(NET_VAR_AUTHMODE, ap_info.authmode);
     }
 
     memset(&ip_info, 0, sizeof(ip_info));
     /* If wifi interface is up and running then record the details */
     if (esp_netif_is_netif_up(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"))
         && esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info) == ESP_OK) {
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-        esp_diag_variable_add_ipv4(KEY_IPv4, ip_info.ip.addr);
-        esp_diag_variable_add_ipv4(KEY_NETMASK, ip_info.netmask.addr);
-        esp_diag_variable_add_ipv4(KEY_GATEWAY, ip_info.gw.addr);
-#else
-        esp_diag_variable_report_ipv4(TAG_IP, KEY_IPv4, ip_info.ip.addr);
-        esp_diag_variable_report_ipv4(TAG_IP, KEY_NETMASK, ip_info.netmask.addr);
-        esp_diag_variable_report_ipv4(TAG_IP, KEY_GATEWAY, ip_info.gw.addr);
-#endif
+        net_var_report(NET_VAR_IPv4, &ip_info.ip.addr, sizeof(uint32_t));
+        net_var_report(NET_VAR_NETMASK, &ip_info.netmask.addr, sizeof(uint32_t));
+        net_var_report(NET_VAR_GATEWAY, &ip_info.gw.addr, sizeof(uint32_t));
     }
-#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    esp_diag_variable_add_int(KEY_DISC_CNT, s_priv_data.disconn_cnt);
-#else
-    esp_diag_variable_report_int(TAG_WIFI, KEY_DISC_CNT, s_priv_data.disconn_cnt);
-#endif
+    net_var_report_int(NET_VAR_DISC_CNT, s_priv_data.disconn_cnt);
+    xSemaphoreTake(s_priv_data.lock, portMAX_DELAY);
     s_priv_data.init = true;
+    xSemaphoreGive(s_priv_data.lock);
     return ESP_OK;
 }
 
@@ -348,6 +475,12 @@ esp_err_t esp_diag_network_variables_deinit(void)
     esp_diag_variable_unregister(TAG_WIFI, KEY_BANDWIDTH_AP);
 #endif
 #endif
+    xSemaphoreTake(s_priv_data.lock, portMAX_DELAY);
+    SemaphoreHandle_t lock = s_priv_data.lock;
+    uint32_t flush_gen = s_priv_data.flush_gen;
     memset(&s_priv_data, 0, sizeof(s_priv_data));
+    s_priv_data.lock = lock;
+    s_priv_data.flush_gen = flush_gen;
+    xSemaphoreGive(lock);
     return ESP_OK;
 }
@@ -0,0 +1,308 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_idf_version.h>
+#include <esp_rom_sys.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+
+#include <esp_rmaker_work_queue.h>
+#include <esp_diagnostics.h>
+#include <esp_diagnostics_metrics.h>
+#include <esp_diagnostics_spans.h>
+#include "esp_diagnostics_internal.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_cpu.h>
+#define SPAN_CYCLE_COUNT() esp_cpu_get_cycle_count()
+#else
+#include <hal/cpu_hal.h>
+#define SPAN_CYCLE_COUNT() cpu_hal_get_cycle_count()
+#endif
+
+#define LOG_TAG            "span_metrics"
+#define METRICS_TAG        "span"
+#define PATH_SPANS         "spans"
+
+#define DEFAULT_POLLING_INTERVAL 60 /* 60 seconds */
+
+/* Key of a metrics, the tag and one of these */
+#define KEY_SIZE           16
+#define KEY_SUFFIX_MAX_LEN 4
+
+#define SPAN_UNLISTED      0
+#define SPAN_LISTING       1
+#define SPAN_LISTED        2
+
+typedef enum {
+    SPAN_KEY_COUNT,
+    SPAN_KEY_TOTAL,
+    SPAN_KEY_MAX,
+    SPAN_KEY_NUM,
+} span_key_t;
+
+static const char *const s_key_suffix[SPAN_KEY_NUM] = { "_n", "_us", "_max" };
+static const char *const s_key_unit[SPAN_KEY_NUM] = { "calls", "us", "us" };
+
+/* A reported span, only used by the reporter */
+typedef struct {
+    esp_diag_span_t *span;
+    bool failed;                        /* Not reported, its metrics could not be registered */
+    uint32_t prev_count;
+    uint64_t prev_cycles;
+    char keys[SPAN_KEY_NUM][KEY_SIZE];
+    esp_diag_metrics_handle_t handles[SPAN_KEY_NUM];
+} span_report_t;
+
+typedef struct {
+    bool init;
+    TimerHandle_t handle;
+    size_t reports_count;
+    span_report_t reports[CONFIG_DIAG_SPAN_METRICS_MAX];
+} span_diag_priv_data_t;
+
+/* Spans used so far, the newest first, pushed without a lock */
+static esp_diag_span_t *s_spans;
+static span_diag_priv_data_t s_priv_data;
+
+static void span_list(esp_diag_span_t *span)
+{
+    uint32_t state = SPAN_UNLISTED;
+    if (!__atomic_compare_exchange_n(&span->state, &state, SPAN_LISTING, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    esp_diag_span_t *head = __atomic_load_n(&s_spans, __ATOMIC_RELAXED);
+    do {
+        span->next = head;
+    } while (!__atomic_compare_exchange_n(&s_spans, &head, span, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_store_n(&span->state, SPAN_LISTED, __ATOMIC_RELEASE);
+}
+
+uint32_t esp_diag_span_begin(esp_diag_span_t *span)
+{
+    if (__atomic_load_n(&span->state, __ATOMIC_RELAXED) != SPAN_LISTED) {
+        span_list(span);
+    }
+    uint32_t start = SPAN_CYCLE_COUNT();
+#if portNUM_PROCESSORS > 1
+    /* The lowest bit tells the core, so that a span which moved to the other core can be dropped */
+    start = (start & ~1U) | xPortGetCoreID();
+#endif
+    return start;
+}
+
+void esp_diag_span_end(esp_diag_span_t *span, uint32_t start)
+{
+    uint32_t now = SPAN_CYCLE_COUNT();
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    int core = xPortGetCoreID();
+#if portNUM_PROCESSORS > 1
+    if ((int)(start & 1U) != core) {
+        portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+        return;
+    }
+    now = (now & ~1U) | core;
+#endif
+    esp_diag_span_core_t *c = &span->core[core];
+    uint32_t cycles = now - start;
+
+    /* Readers of the other core retry while seq is odd or changed */
+    __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    c->count++;
+    c->cycles += cycles;
+    if (cycles > c->max_ever) {
+        c->max_ever = cycles;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+
+    /* Exchanged by the reporter */
+    uint32_t max = __atomic_load_n(&c->max, __ATOMIC_RELAXED);
+    while (cycles > max && !__atomic_compare_exchange_n(&c->max, &max, cycles, true,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+/* Sums the counters of all the cores */
+static void span_read(esp_diag_span_t *span, uint32_t *count, uint64_t *cycles, uint32_t *max_ever)
+{
+    *count = 0;
+    *cycles = 0;
+    *max_ever = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_diag_span_core_t *c = &span->core[core];
+        uint32_t seq, c_count, c_max_ever;
+        uint64_t c_cycles;
+        do {
+            seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            c_count = c->count;
+            c_cycles = c->cycles;
+            c_max_ever = c->max_ever;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || seq != __atomic_load_n(&c->seq, __ATOMIC_RELAXED));
+        *count += c_count;
+        *cycles += c_cycles;
+        if (c_max_ever > *max_ever) {
+            *max_ever = c_max_ever;
+        }
+    }
+}
+
+void esp_diag_spans_foreach(esp_diag_span_stats_cb_t cb, void *arg)
+{
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    if (!cb) {
+        return;
+    }
+    for (esp_diag_span_t *span = __atomic_load_n(&s_spans, __ATOMIC_ACQUIRE); span; span = span->next) {
+        esp_diag_span_stats_t stats = {
+            .tag = span->tag,
+        };
+        uint64_t cycles;
+        uint32_t max_ever;
+        span_read(span, &stats.count, &cycles, &max_ever);
+        stats.total_us = cycles / ticks_per_us;
+        stats.max_us = max_ever / ticks_per_us;
+        cb(&stats, arg);
+    }
+}
+
+static span_report_t *span_report_get(esp_diag_span_t *span)
+{
+    for (size_t i = 0; i < s_priv_data.reports_count; i++) {
+        if (s_priv_data.reports[i].span == span) {
+            return &s_priv_data.reports[i];
+        }
+    }
+    if (s_priv_data.reports_count >= CONFIG_DIAG_SPAN_METRICS_MAX) {
+        return NULL;
+    }
+    span_report_t *report = &s_priv_data.reports[s_priv_data.reports_count++];
+    memset(report, 0, sizeof(*report));
+    report->span = span;
+    if (strlen(span->tag) > KEY_SIZE - 1 - KEY_SUFFIX_MAX_LEN) {
+        ESP_LOGW(LOG_TAG, "Span %s not reported, its tag is too long", span->tag);
+        report->failed = true;
+        return report;
+    }
+    for (int k = 0; k < SPAN_KEY_NUM; k++) {
+        snprintf(report->keys[k], KEY_SIZE, "%s%s", span->tag, s_key_suffix[k]);
+        if (esp_diag_metrics_register_with_handle(METRICS_TAG, report->keys[k], span->tag, PATH_SPANS,
+                                                  ESP_DIAG_DATA_TYPE_UINT, &report->handles[k]) != ESP_OK) {
+            ESP_LOGW(LOG_TAG, "Span %s not reported, failed to register its metrics", span->tag);
+            report->failed = true;
+            return report;
+        }
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_add_unit(METRICS_TAG, report->keys[k], s_key_unit[k]);
+#else
+        esp_diag_metrics_add_unit(report->keys[k], s_key_unit[k]);
+#endif
+    }
+    return report;
+}
+
+static void span_report_unregister(span_report_t *report)
+{
+    for (int k = 0; k < SPAN_KEY_NUM && report->keys[k][0]; k++) {
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_unregister(METRICS_TAG, report->keys[k]);
+#else
+        esp_diag_metrics_unregister(report->keys[k]);
+#endif
+    }
+}
+
+esp_err_t esp_diag_span_metrics_dump(void)
+{
+    if (!s_priv_data.init) {
+        ESP_LOGW(LOG_TAG, "Span metrics not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    for (esp_diag_span_t *span = __atomic_load_n(&s_spans, __ATOMIC_ACQUIRE); span; span = span->next) {
+        span_report_t *report = span_report_get(span);
+        if (!report || report->failed) {
+            continue;
+        }
+        uint32_t count, max_ever, max = 0;
+        uint64_t cycles;
+        span_read(span, &count, &cycles, &max_ever);
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            uint32_t core_max = __atomic_exchange_n(&span->core[core].max, 0, __ATOMIC_RELAXED);
+            if (core_max > max) {
+                max = core_max;
+            }
+        }
+        if (count == report->prev_count) {
+            continue;
+        }
+        esp_diag_metrics_add_uint_by_handle(report->handles[SPAN_KEY_COUNT], count - report->prev_count);
+        esp_diag_metrics_add_uint_by_handle(report->handles[SPAN_KEY_TOTAL],
+                                            (uint32_t)((cycles - report->prev_cycles) / ticks_per_us));
+        esp_diag_metrics_add_uint_by_handle(report->handles[SPAN_KEY_MAX], max / ticks_per_us);
+        report->prev_count = count;
+        report->prev_cycles = cycles;
+    }
+    return ESP_OK;
+}
+
+static void span_metrics_dump_cb(void *arg)
+{
+    esp_diag_span_metrics_dump();
+}
+
+static void span_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_work_queue_add_task(span_metrics_dump_cb, NULL);
+}
+
+esp_err_t esp_diag_span_metrics_init(void)
+{
+    if (s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_priv_data.handle = xTimerCreate("span_metrics", SEC2TICKS(DEFAULT_POLLING_INTERVAL),
+                                      pdTRUE, NULL, span_timer_cb);
+    if (s_priv_data.handle) {
+        xTimerStart(s_priv_data.handle, 0);
+    }
+    s_priv_data.init = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_diag_span_metrics_deinit(void)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Try to delete timer with 10 ticks wait time */
+    if (xTimerDelete(s_priv_data.handle, 10) == pdFALSE) {
+        ESP_LOGW(LOG_TAG, "Failed to delete span metric timer");
+    }
+    for (size_t i = 0; i < s_priv_data.reports_count; i++) {
+        span_report_unregister(&s_priv_data.reports[i]);
+    }
+    memset(&s_priv_data, 0, sizeof(s_priv_data));
+    return ESP_OK;
+}
+
+void esp_diag_span_metrics_reset_interval(uint32_t period)
+{
+    if (!s_priv_data.init) {
+        return;
+    }
+    if (period == 0) {
+        xTimerStop(s_priv_data.handle, 0);
+        return;
+    }
+    xTimerChangePeriod(s_priv_data.handle, SEC2TICKS(period), 0);
+}
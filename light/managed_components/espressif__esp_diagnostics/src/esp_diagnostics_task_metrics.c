@@ -0,0 +1,267 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+
+#include <esp_rmaker_work_queue.h>
+#include <esp_diagnostics.h>
+#include <esp_diagnostics_metrics.h>
+#include "esp_diagnostics_internal.h"
+
+#define LOG_TAG            "task_metrics"
+#define METRICS_TAG        "task"
+#define METRICS_UNIT       "%"
+
+#define KEY_CPU_LOAD       "cpu_load"
+#define KEY_CPU_TOP        "cpu_top"
+
+#if portNUM_PROCESSORS > 1
+/* Load of each core, to check the placement of the tasks */
+static const char *const s_core_load_keys[portNUM_PROCESSORS] = { "cpu0_load", "cpu1_load" };
+static const char *const s_core_load_labels[portNUM_PROCESSORS] = { "CPU0 load", "CPU1 load" };
+#endif
+
+#define PATH_TASK_CPU      "tasks.cpu"
+
+#define DEFAULT_POLLING_INTERVAL 30 /* 30 seconds */
+#define TOP_TASKS          3
+/* Slack for the tasks created between getting the number of tasks and the state of the tasks */
+#define EXTRA_TASKS        4
+
+/* FreeRTOS before v10.5 has 32 bit run time counters */
+#ifndef configRUN_TIME_COUNTER_TYPE
+#define configRUN_TIME_COUNTER_TYPE uint32_t
+#endif
+
+/* Run time counter of a task at the previous sample */
+typedef struct {
+    UBaseType_t number;
+    configRUN_TIME_COUNTER_TYPE run_time;
+} task_run_time_t;
+
+typedef struct {
+    const char *name;
+    uint32_t share;     /* Per mille of the CPU time of all cores */
+} task_share_t;
+
+typedef struct {
+    bool init;
+    TimerHandle_t handle;
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    task_run_time_t *prev;
+    UBaseType_t prev_count;
+} task_diag_priv_data_t;
+
+static task_diag_priv_data_t s_priv_data;
+
+static configRUN_TIME_COUNTER_TYPE prev_run_time_get(UBaseType_t number)
+{
+    for (UBaseType_t i = 0; i < s_priv_data.prev_count; i++) {
+        if (s_priv_data.prev[i].number == number) {
+            return s_priv_data.prev[i].run_time;
+        }
+    }
+    /* Created since the previous sample */
+    return 0;
+}
+
+static void top_tasks_add(task_share_t top[TOP_TASKS], const char *name, uint32_t share)
+{
+    for (int i = 0; i < TOP_TASKS; i++) {
+        if (!top[i].name || share > top[i].share) {
+            memmove(&top[i + 1], &top[i], (TOP_TASKS - i - 1) * sizeof(top[0]));
+            top[i].name = name;
+            top[i].share = share;
+            return;
+        }
+    }
+}
+
+esp_err_t esp_diag_task_metrics_dump(void)
+{
+    if (!s_priv_data.init) {
+        ESP_LOGW(LOG_TAG, "Task metrics not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    UBaseType_t count = uxTaskGetNumberOfTasks() + EXTRA_TASKS;
+    TaskStatus_t *tasks = calloc(count, sizeof(TaskStatus_t));
+    task_run_time_t *run_times = calloc(count, sizeof(task_run_time_t));
+    if (!tasks || !run_times) {
+        free(tasks);
+        free(run_times);
+        return ESP_ERR_NO_MEM;
+    }
+    configRUN_TIME_COUNTER_TYPE total_run_time;
+    count = uxTaskGetSystemState(tasks, count, &total_run_time);
+
+    /* Run time of the tasks adds up to the total run time on every core */
+    uint64_t elapsed = (uint64_t)(configRUN_TIME_COUNTER_TYPE)(total_run_time - s_priv_data.total_run_time) * portNUM_PROCESSORS;
+    uint64_t idle = 0;
+#if portNUM_PROCESSORS > 1
+    uint64_t core_idle[portNUM_PROCESSORS] = {0};
+#endif
+    task_share_t top[TOP_TASKS] = {0};
+    for (UBaseType_t i = 0; i < count; i++) {
+        configRUN_TIME_COUNTER_TYPE delta = tasks[i].ulRunTimeCounter - prev_run_time_get(tasks[i].xTaskNumber);
+        run_times[i].number = tasks[i].xTaskNumber;
+        run_times[i].run_time = tasks[i].ulRunTimeCounter;
+        if (strncmp(tasks[i].pcTaskName, "IDLE", 4) == 0) {
+            idle += delta;
+#if portNUM_PROCESSORS > 1
+            for (int core = 0; core < portNUM_PROCESSORS; core++) {
+                if (tasks[i].xHandle == xTaskGetIdleTaskHandleForCore(core)) {
+                    core_idle[core] += delta;
+                }
+            }
+#endif
+        } else if (elapsed) {
+            top_tasks_add(top, tasks[i].pcTaskName, (uint32_t)(((uint64_t)delta * 1000) / elapsed));
+        }
+    }
+    free(s_priv_data.prev);
+    s_priv_data.prev = run_times;
+    s_priv_data.prev_count = count;
+    s_priv_data.total_run_time = total_run_time;
+
+    esp_err_t err = ESP_OK;
+    if (elapsed && idle <= elapsed) {
+        uint32_t load = ((elapsed - idle) * 100) / elapsed;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        err = esp_diag_metrics_report_uint(METRICS_TAG, KEY_CPU_LOAD, load);
+        if (err == ESP_OK && top[0].name) {
+            err = esp_diag_metrics_report_uint(METRICS_TAG, KEY_CPU_TOP, top[0].share / 10);
+        }
+#else
+        err = esp_diag_metrics_add_uint(KEY_CPU_LOAD, load);
+        if (err == ESP_OK && top[0].name) {
+            err = esp_diag_metrics_add_uint(KEY_CPU_TOP, top[0].share / 10);
+        }
+#endif
+#if portNUM_PROCESSORS > 1
+        /* Each core ran for the total run time */
+        uint64_t core_elapsed = elapsed / portNUM_PROCESSORS;
+        for (int core = 0; core < portNUM_PROCESSORS && err == ESP_OK; core++) {
+            if (core_idle[core] > core_elapsed) {
+                continue;
+            }
+            uint32_t core_load = ((core_elapsed - core_idle[core]) * 100) / core_elapsed;
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+            err = esp_diag_metrics_report_uint(METRICS_TAG, s_core_load_keys[core], core_load);
+#else
+            err = esp_diag_metrics_add_uint(s_core_load_keys[core], core_load);
+#endif
+        }
+#endif
+        if (err != ESP_OK) {
+            ESP_LOGW(LOG_TAG, "Failed to add task metrics, err:0x%x", err);
+        }
+        if (top[0].name) {
+            ESP_LOGI(LOG_TAG, KEY_CPU_LOAD ":%" PRIu32 "%% top:%s %" PRIu32 ".%" PRIu32 "%%", load,
+                     top[0].name, top[0].share / 10, top[0].share % 10);
+            /* Names are not known when registering the metrics, so the top tasks are recorded as an event */
+            ESP_DIAG_EVENT(METRICS_TAG, KEY_CPU_TOP " %s:%" PRIu32 "%% %s:%" PRIu32 "%% %s:%" PRIu32 "%%",
+                           top[0].name, top[0].share / 10,
+                           top[1].name ? top[1].name : "-", top[1].share / 10,
+                           top[2].name ? top[2].name : "-", top[2].share / 10);
+        }
+    }
+    free(tasks);
+    return err;
+}
+
+static void task_metrics_dump_cb(void *arg)
+{
+    esp_diag_task_metrics_dump();
+}
+
+static void task_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_work_queue_add_task(task_metrics_dump_cb, NULL);
+}
+
+esp_err_t esp_diag_task_metrics_init(void)
+{
+    if (s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_diag_metrics_register(METRICS_TAG, KEY_CPU_LOAD, "CPU load", PATH_TASK_CPU, ESP_DIAG_DATA_TYPE_UINT);
+    esp_diag_metrics_register(METRICS_TAG, KEY_CPU_TOP, "CPU share of the busiest task", PATH_TASK_CPU, ESP_DIAG_DATA_TYPE_UINT);
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_add_unit(METRICS_TAG, KEY_CPU_LOAD, METRICS_UNIT);
+    esp_diag_metrics_add_unit(METRICS_TAG, KEY_CPU_TOP, METRICS_UNIT);
+#else
+    esp_diag_metrics_add_unit(KEY_CPU_LOAD, METRICS_UNIT);
+    esp_diag_metrics_add_unit(KEY_CPU_TOP, METRICS_UNIT);
+#endif
+#if portNUM_PROCESSORS > 1
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_diag_metrics_register(METRICS_TAG, s_core_load_keys[core], s_core_load_labels[core], PATH_TASK_CPU,
+                                  ESP_DIAG_DATA_TYPE_UINT);
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_add_unit(METRICS_TAG, s_core_load_keys[core], METRICS_UNIT);
+#else
+        esp_diag_metrics_add_unit(s_core_load_keys[core], METRICS_UNIT);
+#endif
+    }
+#endif
+    s_priv_data.handle = xTimerCreate("task_metrics", SEC2TICKS(DEFAULT_POLLING_INTERVAL),
+                                      pdTRUE, NULL, task_timer_cb);
+    if (s_priv_data.handle) {
+        xTimerStart(s_priv_data.handle, 0);
+    }
+    s_priv_data.init = true;
+
+    /* The first report covers the time since boot */
+    esp_diag_task_metrics_dump();
+    return ESP_OK;
+}
+
+esp_err_t esp_diag_task_metrics_deinit(void)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* Try to delete timer with 10 ticks wait time */
+    if (xTimerDelete(s_priv_data.handle, 10) == pdFALSE) {
+        ESP_LOGW(LOG_TAG, "Failed to delete task metric timer");
+    }
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    esp_diag_metrics_unregister(KEY_CPU_LOAD);
+    esp_diag_metrics_unregister(KEY_CPU_TOP);
+#else
+    esp_diag_metrics_unregister(METRICS_TAG, KEY_CPU_LOAD);
+    esp_diag_metrics_unregister(METRICS_TAG, KEY_CPU_TOP);
+#endif
+#if portNUM_PROCESSORS > 1
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+#ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_unregister(s_core_load_keys[core]);
+#else
+        esp_diag_metrics_unregister(METRICS_TAG, s_core_load_keys[core]);
+#endif
+    }
+#endif
+    free(s_priv_data.prev);
+    memset(&s_priv_data, 0, sizeof(s_priv_data));
+    return ESP_OK;
+}
+
+void esp_diag_task_metrics_reset_interval(uint32_t period)
+{
+    if (!s_priv_data.init) {
+        return;
+    }
+    if (period == 0) {
+        xTimerStop(s_priv_data.handle, 0);
+        return;
+    }
+    xTimerChangePeriod(s_priv_data.handle, SEC2TICKS(period), 0);
+}
@@ -0,0 +1,192 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+#include <esp_rom_sys.h>
+#include <freertos/task.h>
+#include <esp_diagnostics_trace.h>
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include <esp_cpu.h>
+#define TRACE_CYCLE_COUNT() esp_cpu_get_cycle_count()
+#else
+#include <hal/cpu_hal.h>
+#define TRACE_CYCLE_COUNT() cpu_hal_get_cycle_count()
+#endif
+
+#define TRACE_EVENTS        CONFIG_DIAG_TRACE_EVENTS
+#define TRACE_MASK          (TRACE_EVENTS - 1)
+_Static_assert((TRACE_EVENTS & TRACE_MASK) == 0, "CONFIG_DIAG_TRACE_EVENTS must be a power of two");
+
+/* Events are time stamped with the 32-bit cycle counter of their core, which is cheap to read but wraps within
+ * seconds. A time reference, the cycle count and esp_timer time together, is recorded before the first event of the
+ * core and again before any event more than this many cycles or ticks after the last reference, so that the reader
+ * can convert the cycles of the events that follow it without ambiguity. The ticks catch the counter wrapping over
+ * while the core records nothing.
+ */
+#define TRACE_SYNC_CYCLES   (1UL << 30)
+#define TRACE_SYNC_TICKS    pdMS_TO_TICKS(1000)
+#define TRACE_PHASE_SYNC    'S'
+
+/* 16 bytes on the targets */
+typedef struct {
+    uint32_t cycles;
+    union {
+        const char *name;
+        uint32_t ts_high;   /* TRACE_PHASE_SYNC, upper half of the esp_timer time */
+    };
+    uint32_t arg;           /* TRACE_PHASE_SYNC, lower half of the esp_timer time */
+    uint8_t phase;
+    uint8_t reserved[3];
+} trace_slot_t;
+
+/* Only written by its core, with its interrupts masked */
+typedef struct {
+    atomic_uint head;       /* Slots written since boot */
+    atomic_uint start;      /* Head at the last esp_diag_trace_clear() */
+    uint32_t sync_cycles;
+    TickType_t sync_ticks;
+    atomic_bool synced;     /* Cleared by esp_diag_trace_clear(), which drops the reference */
+    trace_slot_t slots[TRACE_EVENTS];
+} trace_ring_t;
+
+static trace_ring_t s_rings[portNUM_PROCESSORS];
+
+static inline void trace_ring_put(trace_ring_t *ring, const trace_slot_t *slot)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->slots[head & TRACE_MASK] = *slot;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg)
+{
+    if (!name) {
+        return;
+    }
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    trace_ring_t *ring = &s_rings[xPortGetCoreID()];
+    trace_slot_t slot = {
+        .cycles = TRACE_CYCLE_COUNT(),
+        .name = name,
+        .arg = arg,
+        .phase = phase,
+    };
+    TickType_t ticks = xTaskGetTickCountFromISR();
+    if (!atomic_load_explicit(&ring->synced, memory_order_relaxed) ||
+            slot.cycles - ring->sync_cycles > TRACE_SYNC_CYCLES || ticks - ring->sync_ticks >= TRACE_SYNC_TICKS) {
+        uint64_t now = esp_timer_get_time();
+        trace_slot_t sync = {
+            .cycles = slot.cycles,
+            .ts_high = (uint32_t)(now >> 32),
+            .arg = (uint32_t)now,
+            .phase = TRACE_PHASE_SYNC,
+        };
+        trace_ring_put(ring, &sync);
+        ring->sync_cycles = slot.cycles;
+        ring->sync_ticks = ticks;
+        atomic_store_explicit(&ring->synced, true, memory_order_relaxed);
+    }
+    trace_ring_put(ring, &slot);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+size_t esp_diag_trace_read(esp_diag_trace_cursor_t *cursor, size_t max_events, esp_diag_trace_read_cb_t cb,
+                           void *arg)
+{
+    esp_diag_trace_cursor_t all = { 0 };
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    size_t count = 0;
+
+    if (!cb) {
+        return 0;
+    }
+    if (!cursor) {
+        cursor = &all;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_ring_t *ring = &s_rings[core];
+        unsigned pos = cursor->pos[core];
+        unsigned start = atomic_load_explicit(&ring->start, memory_order_relaxed);
+
+        if ((int)(start - pos) > 0) {
+            pos = start;
+            cursor->sync_ts[core] = 0;
+        }
+        while (!max_events || count < max_events) {
+            unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            if (pos == head) {
+                break;
+            }
+            /* The oldest slot may be the one being overwritten */
+            if (head - pos >= TRACE_EVENTS) {
+                pos = head - TRACE_EVENTS + 1;
+                cursor->sync_ts[core] = 0;
+            }
+            trace_slot_t slot = ring->slots[pos & TRACE_MASK];
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ring->head, memory_order_relaxed) - pos >= TRACE_EVENTS) {
+                continue;
+            }
+            pos++;
+            if (slot.phase == TRACE_PHASE_SYNC) {
+                cursor->sync_cycles[core] = slot.cycles;
+                cursor->sync_ts[core] = ((uint64_t)slot.ts_high << 32) | slot.arg;
+                continue;
+            }
+            /* Events older than the first reference kept cannot be dated */
+            if (!cursor->sync_ts[core]) {
+                continue;
+            }
+            esp_diag_trace_event_t event = {
+                .ts = cursor->sync_ts[core] + (slot.cycles - cursor->sync_cycles[core]) / ticks_per_us,
+                .name = slot.name,
+                .arg = slot.arg,
+                .phase = slot.phase,
+                .core = core,
+            };
+            count++;
+            if (!cb(&event, arg)) {
+                cursor->pos[core] = pos;
+                return count;
+            }
+        }
+        cursor->pos[core] = pos;
+    }
+    return count;
+}
+
+static bool trace_print_json_cb(const esp_diag_trace_event_t *event, void *arg)
+{
+    size_t *printed = arg;
+    printf("%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":0,\"tid\":%u,%s"
+           "\"args\":{\"arg\":%" PRIu32 "}}",
+           *printed ? "," : "", event->name, event->phase, event->ts, event->core,
+           event->phase == ESP_DIAG_TRACE_INSTANT ? "\"s\":\"t\"," : "", event->arg);
+    (*printed)++;
+    return true;
+}
+
+void esp_diag_trace_print_json(void)
+{
+    size_t printed = 0;
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    esp_diag_trace_read(NULL, 0, trace_print_json_cb, &printed);
+    printf("\n]}\n");
+}
+
+void esp_diag_trace_clear(void)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        unsigned head = atomic_load_explicit(&s_rings[core].head, memory_order_relaxed);
+        atomic_store_explicit(&s_rings[core].start, head, memory_order_relaxed);
+        atomic_store_explicit(&s_rings[core].synced, false, memory_order_relaxed);
+    }
+}
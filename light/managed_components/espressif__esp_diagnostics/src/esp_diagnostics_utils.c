@@ -5,6 +5,7 @@
  */
 
 #include <string.h>
+#include <stdatomic.h>
 #include "esp_partition.h"
 #include "esp_idf_version.h"
 #include "esp_diagnostics.h"
@@ -19,6 +20,7 @@
 #include "esp_debug_helpers.h"
 #include "esp_diagnostics_metrics.h"
 #include "esp_diagnostics_variables.h"
+#include "esp_diagnostics_internal.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
 #include "esp_chip_info.h"
@@ -310,13 +312,30 @@ void esp_diag_task_snapshot_dump(void)
 uint32_t esp_diag_data_size_get_crc(void)
 {
     size_t diag_data_size = sizeof(esp_diag_data_pt_t) + sizeof(esp_diag_str_data_pt_t) + sizeof(esp_diag_log_data_t);
+    uint8_t log_record_version = DIAG_LOG_RECORD_VERSION;
     uint32_t crc = 0;
     crc = esp_crc32_le(crc, (const unsigned char *)&diag_data_size, sizeof(diag_data_size));
+    crc = esp_crc32_le(crc, &log_record_version, sizeof(log_record_version));
     return crc;
 }
 
+/* Generation of the metrics and variables metadata, the CRC is only computed again once it changed */
+static atomic_uint s_meta_gen = 1;
+static unsigned s_meta_crc_gen;
+static uint32_t s_meta_crc;
+
+void esp_diag_meta_changed(void)
+{
+    atomic_fetch_add(&s_meta_gen, 1);
+}
+
 uint32_t esp_diag_meta_crc_get(void)
 {
+    /* Read before the metadata, a change while computing leaves the cached CRC stale */
+    unsigned gen = atomic_load(&s_meta_gen);
+    if (gen == s_meta_crc_gen) {
+        return s_meta_crc;
+    }
     uint32_t crc = 0;
     const esp_app_desc_t *app_desc;
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -335,6 +354,9 @@ uint32_t esp_diag_meta_crc_get(void)
             crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].key, strlen(metrics[i].key));
             crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].label, strlen(metrics[i].label));
             crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].path, strlen(metrics[i].path));
+            if (metrics[i].unit) {
+                crc = ESP_CRC32_LE(crc, (const uint8_t *)metrics[i].unit, strlen(metrics[i].unit));
+            }
             crc = ESP_CRC32_LE(crc, (const uint8_t *)&metrics[i].type, sizeof(metrics[i].type));
         }
     }
@@ -350,9 +372,14 @@ uint32_t esp_diag_meta_crc_get(void)
             crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].key, strlen(variables[i].key));
             crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].label, strlen(variables[i].label));
             crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].path, strlen(variables[i].path));
+            if (variables[i].unit) {
+                crc = ESP_CRC32_LE(crc, (const uint8_t *)variables[i].unit, strlen(variables[i].unit));
+            }
             crc = ESP_CRC32_LE(crc, (const uint8_t *)&variables[i].type, sizeof(variables[i].type));
         }
     }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+    s_meta_crc = crc;
+    s_meta_crc_gen = gen;
     return crc;
 }
@@ -10,9 +10,11 @@
 #include <esp_log.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_variables.h>
+#include "esp_diagnostics_internal.h"
 
 #define TAG "DIAG_VARIABLES"
 #define DIAG_VARIABLES_MAX_COUNT   CONFIG_DIAG_VARIABLES_MAX_COUNT
+#define DIAG_VARIABLES_INDEX_SIZE  DIAG_KEY_INDEX_SIZE(DIAG_VARIABLES_MAX_COUNT)
 
 /* Max supported string lenth */
 #define MAX_STR_LEN         (sizeof(((esp_diag_str_data_pt_t *)0)->value.str) - 1)
@@ -22,43 +24,63 @@
 typedef struct {
     size_t variables_count;
     esp_diag_variable_meta_t variables[DIAG_VARIABLES_MAX_COUNT];
+    uint16_t index[DIAG_VARIABLES_INDEX_SIZE];      /* slot plus one of the variable, hashed by key, 0 if empty */
     esp_diag_variable_config_t config;
     bool init;
 } variables_priv_data_t;
 
 static variables_priv_data_t s_priv_data;
 
+static void variables_index_add(uint32_t slot)
+{
+    uint32_t i = esp_diag_key_hash(s_priv_data.variables[slot].key) % DIAG_VARIABLES_INDEX_SIZE;
+    while (s_priv_data.index[i]) {
+        i = (i + 1) % DIAG_VARIABLES_INDEX_SIZE;
+    }
+    s_priv_data.index[i] = slot + 1;
+}
+
+/* Slots move on unregister, the index is simply rebuilt then */
+static void variables_index_rebuild(void)
+{
+    memset(s_priv_data.index, 0, sizeof(s_priv_data.index));
+    for (uint32_t i = 0; i < s_priv_data.variables_count; i++) {
+        variables_index_add(i);
+    }
+}
+
+/* Returns the slot of the variable, or -1. A NULL tag matches any tag */
+static int variables_find(const char *tag, const char *key)
+{
+    uint32_t i = esp_diag_key_hash(key) % DIAG_VARIABLES_INDEX_SIZE;
+    while (s_priv_data.index[i]) {
+        esp_diag_variable_meta_t *variable = &s_priv_data.variables[s_priv_data.index[i] - 1];
+        if ((strcmp(variable->key, key) == 0) && (!tag || (strcmp(variable->tag, tag) == 0))) {
+            return s_priv_data.index[i] - 1;
+        }
+        i = (i + 1) % DIAG_VARIABLES_INDEX_SIZE;
+    }
+    return -1;
+}
+
 static esp_diag_variable_meta_t *esp_diag_variable_meta_get(const char *tag, const char *key)
 {
-    uint32_t i;
     if (!tag || !key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-                (strcmp(s_priv_data.variables[i].tag, tag) == 0) &&
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            return &s_priv_data.variables[i];
-        }
-    }
-    return NULL;
+    int slot = variables_find(tag, key);
+    return slot < 0 ? NULL : &s_priv_data.variables[slot];
 }
 
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
 /* Checks only by key for registered variable. Use this for meta version < 1.1 */
 static esp_diag_variable_meta_t *esp_diag_variable_meta_get_by_key(const char *key)
 {
-    uint32_t i;
     if (!key) {
         return NULL;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            return &s_priv_data.variables[i];
-        }
-    }
-    return NULL;
+    int slot = variables_find(NULL, key);
+    return slot < 0 ? NULL : &s_priv_data.variables[slot];
 }
 #endif
 
@@ -93,6 +115,8 @@ esp_err_t esp_diag_variable_register(const char *tag, const char *key,
     s_priv_data.variables[s_priv_data.variables_count].path = path;
     s_priv_data.variables[s_priv_data.variables_count].type = type;
     s_priv_data.variables_count++;
+    variables_index_add(s_priv_data.variables_count - 1);
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -122,6 +146,7 @@ esp_err_t esp_diag_variable_add_unit(const char *tag, const char *key, const cha
     }
 #endif
     variable->unit = unit;
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -131,31 +156,26 @@ esp_err_t esp_diag_variable_unregister(const char *key)
 esp_err_t esp_diag_variable_unregister(const char *tag, const char *key)
 #endif
 {
-    int i;
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
     if (!tag) {
         return ESP_ERR_INVALID_ARG;
     }
+#else
+    const char *tag = NULL;
 #endif
     if (!key) {
         return ESP_ERR_INVALID_ARG;
     }
-    for (i = 0; i < s_priv_data.variables_count; i++) {
-        if (s_priv_data.variables[i].key &&
-#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-                (strcmp(s_priv_data.variables[i].tag, tag) == 0) &&
-#endif
-                (strcmp(s_priv_data.variables[i].key, key) == 0)) {
-            break;
-        }
-    }
-    if (i < s_priv_data.variables_count) {
-        s_priv_data.variables[i] = s_priv_data.variables[s_priv_data.variables_count - 1];
-        memset(&s_priv_data.variables[s_priv_data.variables_count - 1], 0, sizeof(esp_diag_variable_meta_t));
-        s_priv_data.variables_count--;
-        return ESP_OK;
+    int i = variables_find(tag, key);
+    if (i < 0) {
+        return ESP_ERR_NOT_FOUND;
     }
-    return ESP_ERR_NOT_FOUND;
+    s_priv_data.variables[i] = s_priv_data.variables[s_priv_data.variables_count - 1];
+    memset(&s_priv_data.variables[s_priv_data.variables_count - 1], 0, sizeof(esp_diag_variable_meta_t));
+    s_priv_data.variables_count--;
+    variables_index_rebuild();
+    esp_diag_meta_changed();
+    return ESP_OK;
 }
 
 esp_err_t esp_diag_variable_unregister_all(void)
@@ -164,7 +184,9 @@ esp_err_t esp_diag_variable_unregister_all(void)
         return ESP_ERR_INVALID_STATE;
     }
     memset(&s_priv_data.variables, 0, sizeof(s_priv_data.variables));
+    memset(&s_priv_data.index, 0, sizeof(s_priv_data.index));
     s_priv_data.variables_count = 0;
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -210,6 +232,7 @@ esp_err_t esp_diag_variables_deinit(void)
         return ESP_ERR_INVALID_STATE;
     }
     memset(&s_priv_data, 0, sizeof(s_priv_data));
+    esp_diag_meta_changed();
     return ESP_OK;
 }
 
@@ -28,6 +28,13 @@
 /* start reporting minimum ever rssi when rssi reaches -50 dbm */
 #define WIFI_RSSI_THRESHOLD      -50
 
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+typedef struct {
+    uint64_t ts;
+    int32_t rssi;
+} wifi_capture_sample_t;
+#endif
+
 typedef struct {
     bool init;
     bool wifi_connected;
@@ -36,6 +43,14 @@ typedef struct {
     TimerHandle_t handle;
     int32_t prev_rssi;
     int32_t min_rssi;
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+    /* Only used from the work queue */
+    TimerHandle_t capture_handle;
+    wifi_capture_sample_t capture[CONFIG_DIAG_WIFI_METRICS_CAPTURE_SAMPLES];
+    uint32_t capture_cnt;
+    /* Samples still to take, a trigger during a capture extends it */
+    uint32_t capture_remaining;
+#endif
 } wifi_diag_priv_data_t;
 
 static wifi_diag_priv_data_t s_priv_data;
@@ -56,6 +71,76 @@ static void update_min_rssi(int32_t rssi)
     }
 }
 
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+static int32_t get_rssi(void);
+
+static void wifi_capture_flush(void)
+{
+    for (uint32_t i = 0; i < s_priv_data.capture_cnt; i++) {
+        wifi_capture_sample_t *sample = &s_priv_data.capture[i];
+        /* No RSSI while disconnected */
+        if (sample->rssi == 1) {
+            continue;
+        }
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+        esp_diag_metrics_report(ESP_DIAG_DATA_TYPE_INT, METRICS_TAG, KEY_RSSI, &sample->rssi,
+                                sizeof(sample->rssi), sample->ts);
+#else
+        esp_diag_metrics_add(ESP_DIAG_DATA_TYPE_INT, KEY_RSSI, &sample->rssi, sizeof(sample->rssi), sample->ts);
+#endif
+    }
+    s_priv_data.capture_cnt = 0;
+}
+
+static void wifi_capture_sample_cb(void *arg)
+{
+    if (!s_priv_data.init || s_priv_data.capture_remaining == 0) {
+        return;
+    }
+    wifi_capture_sample_t *sample = &s_priv_data.capture[s_priv_data.capture_cnt++];
+    sample->ts = esp_diag_timestamp_get();
+    sample->rssi = get_rssi();
+    if (sample->rssi != 1) {
+        update_min_rssi(sample->rssi);
+    }
+    s_priv_data.capture_remaining--;
+    if (s_priv_data.capture_remaining == 0) {
+        xTimerStop(s_priv_data.capture_handle, 0);
+        ESP_LOGI(LOG_TAG, "Wi-Fi capture done");
+    }
+    if (s_priv_data.capture_remaining == 0 || s_priv_data.capture_cnt == CONFIG_DIAG_WIFI_METRICS_CAPTURE_SAMPLES) {
+        wifi_capture_flush();
+    }
+}
+
+static void wifi_capture_start_cb(void *arg)
+{
+    if (!s_priv_data.init || !s_priv_data.capture_handle) {
+        return;
+    }
+    if (s_priv_data.capture_remaining == 0) {
+        ESP_LOGI(LOG_TAG, "Wi-Fi capture triggered");
+        xTimerStart(s_priv_data.capture_handle, 0);
+    }
+    s_priv_data.capture_remaining = CONFIG_DIAG_WIFI_METRICS_CAPTURE_SAMPLES;
+    /* The sample of the time of the trigger */
+    wifi_capture_sample_cb(NULL);
+}
+
+static void wifi_capture_timer_cb(TimerHandle_t handle)
+{
+    esp_rmaker_work_queue_add_task(wifi_capture_sample_cb, NULL);
+}
+
+esp_err_t esp_diag_wifi_metrics_trigger_capture(void)
+{
+    if (!s_priv_data.init) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_rmaker_work_queue_add_task(wifi_capture_start_cb, NULL);
+}
+#endif /* CONFIG_DIAG_WIFI_METRICS_CAPTURE */
+
 static void wifi_evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_id, void *evt_data)
 {
     switch (evt_id) {
@@ -64,9 +149,17 @@ static void wifi_evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_i
         {
             wifi_event_bss_rssi_low_t *data = evt_data;
             update_min_rssi(data->rssi);
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+            esp_diag_wifi_metrics_trigger_capture();
+#endif
         }
         break;
 #endif /* ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)  */
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+        case WIFI_EVENT_STA_BEACON_TIMEOUT:
+            esp_diag_wifi_metrics_trigger_capture();
+            break;
+#endif
         case WIFI_EVENT_STA_CONNECTED:
         {
             s_priv_data.wifi_connected = true;
@@ -96,6 +189,10 @@ static void wifi_evt_handler(void *arg, esp_event_base_t evt_base, int32_t evt_i
                 if (esp_diag_metrics_add_bool(KEY_STATUS, 0) == ESP_OK) {
                     s_priv_data.status_sent = true;
                 }
+#endif
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+                /* Captures the reconnection */
+                esp_diag_wifi_metrics_trigger_capture();
 #endif
             }
             break;
@@ -195,6 +292,15 @@ esp_err_t esp_diag_wifi_metrics_init(void)
     if (s_priv_data.handle) {
         xTimerStart(s_priv_data.handle, 0);
     }
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+    /* Started on a trigger */
+    s_priv_data.capture_handle = xTimerCreate("wifi_capture",
+                                              pdMS_TO_TICKS(CONFIG_DIAG_WIFI_METRICS_CAPTURE_INTERVAL),
+                                              pdTRUE, NULL, wifi_capture_timer_cb);
+    if (!s_priv_data.capture_handle) {
+        ESP_LOGW(LOG_TAG, "Failed to create Wi-Fi capture timer");
+    }
+#endif
     s_priv_data.init = true;
     /* Record RSSI at start */
     esp_diag_wifi_metrics_dump();
@@ -211,6 +317,11 @@ esp_err_t esp_diag_wifi_metrics_deinit(void)
     if (xTimerDelete(s_priv_data.handle, 10) == pdFALSE) {
         ESP_LOGW(LOG_TAG, "Failed to delete heap metric timer");
     }
+#if CONFIG_DIAG_WIFI_METRICS_CAPTURE
+    if (s_priv_data.capture_handle && xTimerDelete(s_priv_data.capture_handle, 10) == pdFALSE) {
+        ESP_LOGW(LOG_TAG, "Failed to delete Wi-Fi capture timer");
+    }
+#endif
 #ifdef CONFIG_ESP_INSIGHTS_META_VERSION_10
     esp_diag_metrics_unregister(KEY_RSSI);
     esp_diag_metrics_unregister(KEY_MIN_RSSI);
@@ -6,6 +6,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sdkconfig.h>
 #include <esp_err.h>
 #include <esp_idf_version.h>
 
@@ -52,6 +54,13 @@ extern "C" {
 
 typedef void *esp_decrypt_handle_t;
 
+/**
+ * @brief Size of the output buffer esp_encrypted_img_decrypt_data_to_buf() needs for data_in_len bytes of input
+ *
+ * The output of a call is at most the input plus the partial AES block kept from the previous call.
+ */
+#define ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(data_in_len)    ((data_in_len) + 15)
+
 typedef struct {
     union {
         const char *rsa_priv_key;                       /*!< 3072 bit RSA private key in PEM format */
@@ -110,6 +119,32 @@ esp_decrypt_handle_t esp_encrypted_img_decrypt_start(const esp_decrypt_cfg_t *cf
 esp_err_t esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args);
 
 
+/**
+* @brief  This function performs decryption on input data into a buffer owned by the caller.
+*
+* Same as esp_encrypted_img_decrypt_data(), except that the decrypted data is written to args->data_out, which the
+* caller provides and which is never reallocated nor freed. So no heap is allocated for each chunk of the image, and a
+* large image cannot fail late for a fragmented heap. The bytes of an AES block not complete yet are kept by the
+* handle and output with the next call.
+*
+* @note args->data_out must not overlap args->data_in. args->data_out_len is set to the number of bytes decrypted,
+*       which may be 0.
+*
+* @param[in]        ctx                 esp_decrypt_handle_t handle
+* @param[in/out]    args                pointer to pre_enc_decrypt_arg_t, with data_out pointing to the output buffer
+* @param[in]        data_out_size       size of the buffer pointed to by args->data_out, at least
+*                                       ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(args->data_in_len)
+*
+* @return
+*    - ESP_FAIL                         On failure
+*    - ESP_ERR_INVALID_ARG              Invalid arguments, or output buffer too small
+*    - ESP_ERR_NOT_FINISHED             Decryption is in process
+*    - ESP_OK                           Success
+*/
+esp_err_t esp_encrypted_img_decrypt_data_to_buf(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args,
+                                                size_t data_out_size);
+
+
 /**
 * @brief  Clean-up decryption process.
 *
@@ -118,6 +153,11 @@ esp_err_t esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decry
 * @note This API cleans the decrypt handle and return ESP_FAIL if the complete data has not been decrypted. Verify if complete data
 *       has been decrypted using API `esp_encrypted_img_is_complete_data_received` to prevent an early call to this API.
 *
+* @note With CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE, the GCM key kept for retries of the image is dropped once it has been decrypted
+*       and authenticated.
+*
+* @note With CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256, the decrypted image is also checked against the SHA-256 appended to it.
+*
 * @return
 *    - ESP_FAIL                 On failure
 *    - ESP_ERR_INVALID_ARG      Invalid argument
@@ -152,6 +192,28 @@ bool esp_encrypted_img_is_complete_data_received(esp_decrypt_handle_t ctx);
 */
 esp_err_t esp_encrypted_img_decrypt_abort(esp_decrypt_handle_t ctx);
 
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+/**
+* @brief  Gets the SHA-256 of the decrypted image, computed as it was output.
+*
+* For an app image, it is the hash of the image up to its checksum, the digest esptool appends to it and which
+* esp_partition_get_sha256() returns for the partition written. For other data, it is the hash of all of it.
+*
+* @note It must be called before `esp_encrypted_img_decrypt_end`, which frees the handle. The image is authentic only once
+*       `esp_encrypted_img_decrypt_end` returns ESP_OK.
+*
+* @param[in]   ctx      esp_decrypt_handle_t handle, once all of the data has been decrypted
+* @param[out]  sha256   32 bytes
+*
+* @return
+*    - ESP_ERR_INVALID_ARG      Invalid argument
+*    - ESP_ERR_INVALID_STATE    The complete data has not been decrypted
+*    - ESP_FAIL                 The image is truncated or does not match the SHA-256 appended to it
+*    - ESP_OK                   Success
+*/
+esp_err_t esp_encrypted_img_get_image_sha256(esp_decrypt_handle_t ctx, uint8_t sha256[32]);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -9,13 +9,27 @@
 #include <errno.h>
 #include <esp_log.h>
 #include <esp_err.h>
+#include <esp_heap_caps.h>
 
 #include "mbedtls/version.h"
 #include "mbedtls/pk.h"
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/gcm.h"
+#include "mbedtls/sha256.h"
 #include "sys/param.h"
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE
+#include <freertos/FreeRTOS.h>
+#endif
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE_NVS
+#include <nvs.h>
+#endif
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#endif
 
 static const char *TAG = "esp_encrypted_img";
 
@@ -36,6 +50,67 @@ typedef enum {
 #define BIN_SIZE_DATA       4
 #define AUTH_SIZE           16
 #define RESERVED_HEADER     88
+#define GCM_BLOCK_SIZE      16
+#define KEY_ID_SIZE         32
+
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+/* Layout of an app image, as in esp_app_format.h */
+#define IMAGE_MAGIC             0xe9
+#define IMAGE_HEADER_SIZE       24
+#define IMAGE_SEGMENT_COUNT     1   // offset in the image header
+#define IMAGE_HASH_APPENDED     23
+#define IMAGE_SEGMENT_HDR_SIZE  8
+#define IMAGE_DIGEST_SIZE       32
+
+typedef enum {
+    IMAGE_PART_HEADER,
+    IMAGE_PART_SEGMENT,
+    IMAGE_PART_DIGEST,
+    IMAGE_PART_NONE,                // the rest is hashed up to next, then not hashed
+} image_part_t;
+
+/*
+ * SHA-256 of the decrypted binary as it is output. The image layout is followed, to hash up to the checksum and
+ * gather the digest appended after it, which esp_encrypted_img_decrypt_end() compares.
+ */
+typedef struct {
+    mbedtls_sha256_context sha;
+    bool done;
+    esp_err_t err;                  // once done
+    size_t pos;                     // bytes of the binary hashed
+    image_part_t part;
+    size_t next;                    // offset of the part
+    uint8_t buf[IMAGE_DIGEST_SIZE]; // the part, gathered, and then the digest appended
+    size_t len;
+    size_t want;
+    int segments;                   // segment headers left
+    bool hash_appended;
+    uint8_t digest[IMAGE_DIGEST_SIZE];  // once done
+} image_hash_t;
+
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+#define HASH_BUF_COUNT      4
+#define HASH_BUF_SIZE       CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK_BUF_SIZE
+#define HASH_TASK_STACK     3072
+
+typedef struct {
+    uint8_t buf;
+    uint16_t len;                   // 0 ends the task
+} hash_msg_t;
+
+/* Hashes the decrypted binary on the other core, from copies of the output the caller may reuse straight away */
+typedef struct {
+    bool started;
+    bool failed;                    // could not be started, the binary is hashed by the caller
+    QueueHandle_t free;             // buffers hashed
+    QueueHandle_t full;             // buffers to hash
+    SemaphoreHandle_t done;
+    uint8_t *bufs;
+} hash_task_t;
+#endif
+#endif
+
+_Static_assert(ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(0) == GCM_BLOCK_SIZE - 1, "Output size must allow for a partial block");
 
 struct esp_encrypted_img_handle {
     char *rsa_pem;
@@ -43,12 +118,21 @@ struct esp_encrypted_img_handle {
     uint32_t binary_file_len;
     uint32_t binary_file_read;
     char gcm_key[GCM_KEY_SIZE];
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE
+    unsigned char key_id[KEY_ID_SIZE];
+#endif
     char iv[IV_SIZE];
     char auth_tag[AUTH_SIZE];
     esp_encrypted_img_state state;
     mbedtls_gcm_context gcm_ctx;
     size_t cache_buf_len;
     char *cache_buf;
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+    image_hash_t image_hash;        // updated by the hash task with CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+    hash_task_t hash_task;
+#endif
+#endif
 };
 
 typedef struct {
@@ -66,7 +150,7 @@ static uint32_t esp_enc_img_magic = 0x0788b6cf;
 
 typedef struct esp_encrypted_img_handle esp_encrypted_img_t;
 
-static int decipher_gcm_key(const char *enc_gcm, esp_encrypted_img_t *handle)
+static int rsa_decipher_gcm_key(const char *enc_gcm, esp_encrypted_img_t *handle)
 {
     int ret = 1;
     size_t olen = 0;
@@ -102,23 +186,406 @@ static int decipher_gcm_key(const char *enc_gcm, esp_encrypted_img_t *handle)
         ESP_LOGE(TAG, "failed\n  ! mbedtls_pk_decrypt returned -0x%04x\n", (unsigned int) - ret );
         goto exit;
     }
-    handle->cache_buf = realloc(handle->cache_buf, 16);
-    if (!handle->cache_buf) {
-        return ESP_ERR_NO_MEM;
-    }
-    handle->state = ESP_PRE_ENC_IMG_READ_IV;
-    handle->binary_file_read = 0;
-    handle->cache_buf_len = 0;
 exit:
     mbedtls_pk_free( &pk );
     mbedtls_entropy_free( &entropy );
     mbedtls_ctr_drbg_free( &ctr_drbg );
+
+    return (ret);
+}
+
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE
+/*
+ * The GCM key of the last image, until it is decrypted completely, so that retries and resumes of an update skip
+ * the RSA operation. It is identified by the hash of the RSA encrypted key of the image header, which is unique
+ * to the image.
+ */
+typedef struct {
+    bool valid;
+    unsigned char key_id[KEY_ID_SIZE];
+    char gcm_key[GCM_KEY_SIZE];
+} gcm_key_cache_t;
+
+static gcm_key_cache_t s_key_cache;
+static portMUX_TYPE s_key_cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE_NVS
+#define KEY_CACHE_NVS_NAMESPACE "esp_enc_img"
+#define KEY_CACHE_NVS_KEY       "gcm_key"
+
+static void key_cache_nvs_load(gcm_key_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(KEY_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(cache->key_id) + sizeof(cache->gcm_key);
+    char blob[sizeof(cache->key_id) + sizeof(cache->gcm_key)];
+    if (nvs_get_blob(nvs, KEY_CACHE_NVS_KEY, blob, &len) == ESP_OK && len == sizeof(blob)) {
+        memcpy(cache->key_id, blob, sizeof(cache->key_id));
+        memcpy(cache->gcm_key, blob + sizeof(cache->key_id), sizeof(cache->gcm_key));
+        cache->valid = true;
+    }
+    memset(blob, 0, sizeof(blob));
+    nvs_close(nvs);
+}
+
+static void key_cache_nvs_store(const gcm_key_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(KEY_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "Couldn't open NVS to keep the GCM key");
+        return;
+    }
+    esp_err_t err;
+    if (cache->valid) {
+        char blob[sizeof(cache->key_id) + sizeof(cache->gcm_key)];
+        memcpy(blob, cache->key_id, sizeof(cache->key_id));
+        memcpy(blob + sizeof(cache->key_id), cache->gcm_key, sizeof(cache->gcm_key));
+        err = nvs_set_blob(nvs, KEY_CACHE_NVS_KEY, blob, sizeof(blob));
+        memset(blob, 0, sizeof(blob));
+    } else {
+        err = nvs_erase_key(nvs, KEY_CACHE_NVS_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Couldn't update the GCM key in NVS: %s", esp_err_to_name(err));
+    }
+    nvs_close(nvs);
+}
+#endif
+
+static bool key_cache_get(const unsigned char *key_id, char *gcm_key)
+{
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE_NVS
+    gcm_key_cache_t stored = { 0 };
+    portENTER_CRITICAL(&s_key_cache_lock);
+    bool loaded = s_key_cache.valid;
+    portEXIT_CRITICAL(&s_key_cache_lock);
+    if (!loaded) {
+        key_cache_nvs_load(&stored);
+        portENTER_CRITICAL(&s_key_cache_lock);
+        if (!s_key_cache.valid) {
+            s_key_cache = stored;
+        }
+        portEXIT_CRITICAL(&s_key_cache_lock);
+        memset(&stored, 0, sizeof(stored));
+    }
+#endif
+    portENTER_CRITICAL(&s_key_cache_lock);
+    bool found = s_key_cache.valid && memcmp(s_key_cache.key_id, key_id, KEY_ID_SIZE) == 0;
+    if (found) {
+        memcpy(gcm_key, s_key_cache.gcm_key, GCM_KEY_SIZE);
+    }
+    portEXIT_CRITICAL(&s_key_cache_lock);
+    return found;
+}
+
+static void key_cache_set(const unsigned char *key_id, const char *gcm_key)
+{
+    gcm_key_cache_t entry = { .valid = true };
+    memcpy(entry.key_id, key_id, KEY_ID_SIZE);
+    memcpy(entry.gcm_key, gcm_key, GCM_KEY_SIZE);
+    portENTER_CRITICAL(&s_key_cache_lock);
+    s_key_cache = entry;
+    portEXIT_CRITICAL(&s_key_cache_lock);
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE_NVS
+    key_cache_nvs_store(&entry);
+#endif
+    memset(&entry, 0, sizeof(entry));
+}
+
+static void key_cache_clear(const unsigned char *key_id)
+{
+    portENTER_CRITICAL(&s_key_cache_lock);
+    bool found = s_key_cache.valid && memcmp(s_key_cache.key_id, key_id, KEY_ID_SIZE) == 0;
+    if (found) {
+        memset(&s_key_cache, 0, sizeof(s_key_cache));
+    }
+    portEXIT_CRITICAL(&s_key_cache_lock);
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE_NVS
+    if (found) {
+        const gcm_key_cache_t entry = { .valid = false };
+        key_cache_nvs_store(&entry);
+    }
+#endif
+}
+#endif
+
+static int decipher_gcm_key(const char *enc_gcm, esp_encrypted_img_t *handle)
+{
+    int ret;
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE
+#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
+    ret = mbedtls_sha256_ret((const unsigned char *)enc_gcm, ENC_GCM_KEY_SIZE, handle->key_id, 0);
+#else
+    ret = mbedtls_sha256((const unsigned char *)enc_gcm, ENC_GCM_KEY_SIZE, handle->key_id, 0);
+#endif
+    if (ret == 0 && key_cache_get(handle->key_id, handle->gcm_key)) {
+        ESP_LOGI(TAG, "Using the cached GCM key");
+    } else {
+        ret = rsa_decipher_gcm_key(enc_gcm, handle);
+        if (ret == 0) {
+            key_cache_set(handle->key_id, handle->gcm_key);
+        }
+    }
+#else
+    ret = rsa_decipher_gcm_key(enc_gcm, handle);
+#endif
     free(handle->rsa_pem);
     handle->rsa_pem = NULL;
+    if (ret != 0) {
+        return ret;
+    }
 
-    return (ret);
+    handle->cache_buf = realloc(handle->cache_buf, GCM_BLOCK_SIZE);
+    if (!handle->cache_buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    handle->state = ESP_PRE_ENC_IMG_READ_IV;
+    handle->binary_file_read = 0;
+    handle->cache_buf_len = 0;
+
+    return 0;
 }
 
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
+#define image_sha256_starts(sha)            mbedtls_sha256_starts_ret(sha, 0)
+#define image_sha256_update(sha, buf, len)  mbedtls_sha256_update_ret(sha, buf, len)
+#define image_sha256_finish(sha, out)       mbedtls_sha256_finish_ret(sha, out)
+#else
+#define image_sha256_starts(sha)            mbedtls_sha256_starts(sha, 0)
+#define image_sha256_update(sha, buf, len)  mbedtls_sha256_update(sha, buf, len)
+#define image_sha256_finish(sha, out)       mbedtls_sha256_finish(sha, out)
+#endif
+
+static void image_hash_start(image_hash_t *hash)
+{
+    memset(hash, 0, sizeof(*hash));
+    mbedtls_sha256_init(&hash->sha);
+    image_sha256_starts(&hash->sha);
+    hash->part = IMAGE_PART_HEADER;
+    hash->want = IMAGE_HEADER_SIZE;
+}
+
+/* A part of the image layout was gathered, sets the next one */
+static void image_hash_part(image_hash_t *hash)
+{
+    const uint8_t *buf = hash->buf;
+    hash->len = 0;
+    switch (hash->part) {
+    case IMAGE_PART_HEADER:
+        if (buf[0] != IMAGE_MAGIC) {
+            /* Not an app image, all of it is hashed */
+            hash->part = IMAGE_PART_NONE;
+            hash->next = SIZE_MAX;
+            return;
+        }
+        hash->segments = buf[IMAGE_SEGMENT_COUNT];
+        hash->hash_appended = buf[IMAGE_HASH_APPENDED] == 1;
+        hash->next = IMAGE_HEADER_SIZE;
+        break;
+    case IMAGE_PART_SEGMENT: {
+        uint32_t len = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+        if (len > SIZE_MAX / 2 - hash->next) {
+            /* Never reached, the image is reported truncated */
+            hash->part = IMAGE_PART_DIGEST;
+            hash->next = SIZE_MAX;
+            return;
+        }
+        hash->next += IMAGE_SEGMENT_HDR_SIZE + len;
+        hash->segments--;
+        break;
+    }
+    case IMAGE_PART_DIGEST:
+        /* Nothing after it is hashed */
+        hash->part = IMAGE_PART_NONE;
+        hash->next = 0;
+        return;
+    default:
+        return;
+    }
+    if (hash->segments) {
+        hash->part = IMAGE_PART_SEGMENT;
+        hash->want = IMAGE_SEGMENT_HDR_SIZE;
+        return;
+    }
+    /* The checksum ends the segments on a 16 byte boundary, the digest follows it */
+    hash->next = (hash->next + 16) & ~(size_t)15;
+    if (hash->hash_appended) {
+        hash->part = IMAGE_PART_DIGEST;
+        hash->want = IMAGE_DIGEST_SIZE;
+    } else {
+        hash->part = IMAGE_PART_NONE;
+    }
+}
+
+static void image_hash_update(image_hash_t *hash, const uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t n;
+        bool hashed = true;
+        if (hash->pos < hash->next) {
+            n = MIN(size, hash->next - hash->pos);
+        } else if (hash->part == IMAGE_PART_NONE) {
+            /* The padding after the digest is not hashed */
+            hash->pos += size;
+            return;
+        } else {
+            n = MIN(size, hash->want - hash->len);
+            memcpy(hash->buf + hash->len, buf, n);
+            hash->len += n;
+            hashed = hash->part != IMAGE_PART_DIGEST;
+        }
+        if (hashed) {
+            image_sha256_update(&hash->sha, buf, n);
+        }
+        hash->pos += n;
+        buf += n;
+        size -= n;
+        if (hash->len == hash->want) {
+            image_hash_part(hash);
+        }
+    }
+}
+
+/* Compares the hash of the binary with the digest appended to it */
+static esp_err_t image_hash_finish(image_hash_t *hash)
+{
+    if (hash->done) {
+        return hash->err;
+    }
+    hash->done = true;
+    image_sha256_finish(&hash->sha, hash->digest);
+    if (hash->part != IMAGE_PART_NONE || (hash->next != SIZE_MAX && hash->pos < hash->next)) {
+        ESP_LOGE(TAG, "Decrypted image is truncated");
+        hash->err = ESP_FAIL;
+    } else if (hash->hash_appended && memcmp(hash->digest, hash->buf, IMAGE_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Decrypted image does not match the SHA-256 appended to it");
+        hash->err = ESP_FAIL;
+    }
+    return hash->err;
+}
+
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+static void hash_task(void *arg)
+{
+    esp_encrypted_img_t *handle = (esp_encrypted_img_t *)arg;
+    hash_task_t *task = &handle->hash_task;
+    hash_msg_t msg;
+    while (xQueueReceive(task->full, &msg, portMAX_DELAY) == pdTRUE && msg.len) {
+        image_hash_update(&handle->image_hash, task->bufs + msg.buf * HASH_BUF_SIZE, msg.len);
+        xQueueSend(task->free, &msg.buf, portMAX_DELAY);
+    }
+    /* The task is not touched once done is given */
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+static void hash_task_free(hash_task_t *task)
+{
+    if (task->free) {
+        vQueueDelete(task->free);
+    }
+    if (task->full) {
+        vQueueDelete(task->full);
+    }
+    if (task->done) {
+        vSemaphoreDelete(task->done);
+    }
+    free(task->bufs);
+    task->free = NULL;
+    task->full = NULL;
+    task->done = NULL;
+    task->bufs = NULL;
+}
+
+static bool hash_task_start(esp_encrypted_img_t *handle)
+{
+    hash_task_t *task = &handle->hash_task;
+    task->failed = true;
+    task->bufs = malloc(HASH_BUF_COUNT * HASH_BUF_SIZE);
+    task->free = xQueueCreate(HASH_BUF_COUNT, sizeof(uint8_t));
+    /* One more for the end of the binary */
+    task->full = xQueueCreate(HASH_BUF_COUNT + 1, sizeof(hash_msg_t));
+    task->done = xSemaphoreCreateBinary();
+    if (!task->bufs || !task->free || !task->full || !task->done) {
+        goto failure;
+    }
+    for (uint8_t i = 0; i < HASH_BUF_COUNT; i++) {
+        xQueueSend(task->free, &i, 0);
+    }
+    /* The other core, the decryption and the flash write of the next blocks go on meanwhile */
+    if (xTaskCreatePinnedToCore(hash_task, "enc_img_hash", HASH_TASK_STACK, handle,
+                                CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK_PRIORITY, NULL, !xPortGetCoreID()) != pdPASS) {
+        goto failure;
+    }
+    task->started = true;
+    task->failed = false;
+    return true;
+
+failure:
+    ESP_LOGW(TAG, "Couldn't start the hash task, hashing the image inline");
+    hash_task_free(task);
+    return false;
+}
+
+/* Waits for the task to hash all of the binary output so far */
+static void hash_task_stop(hash_task_t *task)
+{
+    if (!task->started) {
+        return;
+    }
+    const hash_msg_t end = { 0 };
+    xQueueSend(task->full, &end, portMAX_DELAY);
+    xSemaphoreTake(task->done, portMAX_DELAY);
+    hash_task_free(task);
+    task->started = false;
+}
+#endif
+
+static void bin_hash(esp_encrypted_img_t *handle, const char *buf, size_t len)
+{
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+    hash_task_t *task = &handle->hash_task;
+    if (!task->failed && (task->started || hash_task_start(handle))) {
+        while (len) {
+            hash_msg_t msg = { .len = MIN(len, HASH_BUF_SIZE) };
+            xQueueReceive(task->free, &msg.buf, portMAX_DELAY);
+            memcpy(task->bufs + msg.buf * HASH_BUF_SIZE, buf, msg.len);
+            xQueueSend(task->full, &msg, portMAX_DELAY);
+            buf += msg.len;
+            len -= msg.len;
+        }
+        return;
+    }
+#endif
+    image_hash_update(&handle->image_hash, (const uint8_t *)buf, len);
+}
+
+static esp_err_t bin_hash_finish(esp_encrypted_img_t *handle)
+{
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+    hash_task_stop(&handle->hash_task);
+#endif
+    return image_hash_finish(&handle->image_hash);
+}
+
+static void bin_hash_free(esp_encrypted_img_t *handle)
+{
+#if CONFIG_ESP_ENCRYPTED_IMG_HASH_TASK
+    hash_task_stop(&handle->hash_task);
+#endif
+    mbedtls_sha256_free(&handle->image_hash.sha);
+}
+#endif /* CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256 */
+
 esp_decrypt_handle_t esp_encrypted_img_decrypt_start(const esp_decrypt_cfg_t *cfg)
 {
     if (cfg == NULL || cfg->rsa_priv_key == NULL) {
@@ -148,6 +615,9 @@ esp_decrypt_handle_t esp_encrypted_img_decrypt_start(const esp_decrypt_cfg_t *cf
     memcpy(handle->rsa_pem, cfg->rsa_priv_key, cfg->rsa_priv_key_len);
     handle->rsa_len = cfg->rsa_priv_key_len;
     handle->state = ESP_PRE_ENC_IMG_READ_MAGIC;
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+    image_hash_start(&handle->image_hash);
+#endif
 
     esp_decrypt_handle_t ctx = (esp_decrypt_handle_t)handle;
     return ctx;
@@ -160,91 +630,95 @@ failure:
     return NULL;
 }
 
-static esp_err_t process_bin(esp_encrypted_img_t *handle, pre_enc_decrypt_arg_t *args, int curr_index)
+static char *realloc_data_out(char *data_out, size_t size)
 {
-    size_t data_len = args->data_in_len;
-    size_t data_out_size = args->data_out_len;
-#if !(MBEDTLS_VERSION_NUMBER < 0x03000000)
-    size_t olen;
-#endif
-    handle->binary_file_read += data_len - curr_index;
-    int dec_len = 0;
-    if (handle->binary_file_read != handle->binary_file_len) {
-        size_t copy_len = 0;
-
-        if ((handle->cache_buf_len + (data_len - curr_index)) - (handle->cache_buf_len + (data_len - curr_index)) % 16 > 0) {
-            data_out_size = (handle->cache_buf_len + (data_len - curr_index)) - (handle->cache_buf_len + (data_len - curr_index)) % 16;
-            args->data_out = realloc(args->data_out, data_out_size);
-            if (!args->data_out) {
-                return ESP_ERR_NO_MEM;
-            }
-        }
-        if (handle->cache_buf_len != 0) {
-            copy_len = MIN(16 - handle->cache_buf_len, data_len - curr_index);
-            memcpy(handle->cache_buf + handle->cache_buf_len, args->data_in + curr_index, copy_len);
-            handle->cache_buf_len += copy_len;
-            if (handle->cache_buf_len != 16) {
-                args->data_out_len = 0;
-                return ESP_ERR_NOT_FINISHED;
-            }
-#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
-            if (mbedtls_gcm_update(&handle->gcm_ctx, 16, (const unsigned char *)handle->cache_buf, (unsigned char *) args->data_out) != 0) {
+#if CONFIG_MBEDTLS_HARDWARE_GCM
+    /* The AES DMA works on the buffers in place only if they are DMA capable, else through its own bounce buffer */
+    return heap_caps_realloc(data_out, size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
 #else
-            if (mbedtls_gcm_update(&handle->gcm_ctx, (const unsigned char *)handle->cache_buf, 16, (unsigned char *) args->data_out, data_out_size, &olen) != 0) {
+    return realloc(data_out, size);
 #endif
-                return ESP_FAIL;
-            }
-            dec_len = 16;
-        }
-        handle->cache_buf_len = (data_len - curr_index - copy_len) % 16;
-        if (handle->cache_buf_len != 0) {
-            data_len -= handle->cache_buf_len;
-            memcpy(handle->cache_buf, args->data_in + (data_len), handle->cache_buf_len);
-        }
+}
 
-        if (data_len - copy_len - curr_index > 0) {
+static esp_err_t gcm_decrypt(esp_encrypted_img_t *handle, const char *in, size_t len, char *out, size_t out_size)
+{
 #if (MBEDTLS_VERSION_NUMBER < 0x03000000)
-            if (mbedtls_gcm_update(&handle->gcm_ctx, data_len - copy_len - curr_index, (const unsigned char *)args->data_in + curr_index + copy_len, (unsigned char *)args->data_out + dec_len) != 0) {
+    if (mbedtls_gcm_update(&handle->gcm_ctx, len, (const unsigned char *)in, (unsigned char *)out) != 0) {
 #else
-            if (mbedtls_gcm_update(&handle->gcm_ctx, (const unsigned char *)args->data_in + curr_index + copy_len, data_len - copy_len - curr_index, (unsigned char *)args->data_out + dec_len, data_out_size - dec_len, &olen) != 0) {
+    size_t olen;
+    if (mbedtls_gcm_update(&handle->gcm_ctx, (const unsigned char *)in, len, (unsigned char *)out, out_size, &olen) != 0) {
 #endif
-                return ESP_FAIL;
-            }
-        }
-        args->data_out_len = dec_len + data_len - curr_index - copy_len;
-        return ESP_ERR_NOT_FINISHED;
+        return ESP_FAIL;
     }
-    data_out_size = handle->cache_buf_len + data_len - curr_index;
-    args->data_out = realloc(args->data_out, data_out_size);
-    if (!args->data_out) {
-        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+/* Bytes of the binary output once data_len more bytes of it are received */
+static size_t bin_out_size(const esp_encrypted_img_t *handle, size_t data_len)
+{
+    size_t size = handle->cache_buf_len + data_len;
+    if (handle->binary_file_read + data_len != handle->binary_file_len) {
+        size -= size % GCM_BLOCK_SIZE;
     }
-    size_t copy_len = 0;
+    return size;
+}
 
-    copy_len = MIN(16 - handle->cache_buf_len, data_len - curr_index);
-    memcpy(handle->cache_buf + handle->cache_buf_len, args->data_in + curr_index, copy_len);
-    handle->cache_buf_len += copy_len;
-#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
-    if (mbedtls_gcm_update(&handle->gcm_ctx, handle->cache_buf_len, (const unsigned char *)handle->cache_buf, (unsigned char *)args->data_out) != 0) {
-#else
-    if (mbedtls_gcm_update(&handle->gcm_ctx,  (const unsigned char *)handle->cache_buf, handle->cache_buf_len, (unsigned char *)args->data_out, data_out_size, &olen) != 0) {
-#endif
-        return ESP_FAIL;
+/*
+ * Whole blocks are decrypted straight from the input into the output buffer. Only the bytes of a partial block are
+ * kept in cache_buf, until the next input completes it, except for the last block of the binary which may be partial.
+ * Without out_buf, args->data_out is grown to the size of the output, else the output goes to out_buf, which holds
+ * at least ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(args->data_in_len) bytes.
+ */
+static esp_err_t process_bin(esp_encrypted_img_t *handle, pre_enc_decrypt_arg_t *args, int curr_index, char *out_buf)
+{
+    const char *data_in = args->data_in + curr_index;
+    size_t data_len = args->data_in_len - curr_index;
+    size_t data_out_size = bin_out_size(handle, data_len);
+    handle->binary_file_read += data_len;
+    const bool last = handle->binary_file_read == handle->binary_file_len;
+
+    args->data_out_len = 0;
+    if (data_out_size == 0) {
+        memcpy(handle->cache_buf + handle->cache_buf_len, data_in, data_len);
+        handle->cache_buf_len += data_len;
+        return last ? ESP_OK : ESP_ERR_NOT_FINISHED;
     }
-    if (data_len - curr_index - copy_len > 0) {
-#if (MBEDTLS_VERSION_NUMBER < 0x03000000)
-        if (mbedtls_gcm_update(&handle->gcm_ctx, data_len - curr_index - copy_len, (const unsigned char *)(args->data_in + curr_index + copy_len), (unsigned char *)(args->data_out + 16)) != 0) {
-#else
-        if (mbedtls_gcm_update(&handle->gcm_ctx,  (const unsigned char *)(args->data_in + curr_index + copy_len), data_len - curr_index - copy_len, (unsigned char *)(args->data_out + 16), data_out_size - 16, &olen) != 0) {
-#endif
-            return ESP_FAIL;
+    char *data_out = out_buf;
+    if (!data_out) {
+        data_out = realloc_data_out(args->data_out, data_out_size);
+        if (!data_out) {
+            return ESP_ERR_NO_MEM;
         }
+        args->data_out = data_out;
     }
 
-    args->data_out_len = handle->cache_buf_len + data_len - copy_len - curr_index;
-    handle->cache_buf_len = 0;
+    size_t dec_len = 0;
+    if (handle->cache_buf_len != 0) {
+        size_t copy_len = MIN(GCM_BLOCK_SIZE - handle->cache_buf_len, data_len);
+        memcpy(handle->cache_buf + handle->cache_buf_len, data_in, copy_len);
+        dec_len = handle->cache_buf_len + copy_len;
+        if (gcm_decrypt(handle, handle->cache_buf, dec_len, data_out, data_out_size) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        data_in += copy_len;
+        data_len -= copy_len;
+        handle->cache_buf_len = 0;
+    }
+    if (data_out_size > dec_len) {
+        if (gcm_decrypt(handle, data_in, data_out_size - dec_len, data_out + dec_len, data_out_size - dec_len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        data_in += data_out_size - dec_len;
+        data_len -= data_out_size - dec_len;
+    }
+    memcpy(handle->cache_buf, data_in, data_len);
+    handle->cache_buf_len = data_len;
+    args->data_out_len = data_out_size;
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+    bin_hash(handle, data_out, data_out_size);
+#endif
 
-    return ESP_OK;
+    return last ? ESP_OK : ESP_ERR_NOT_FINISHED;
 }
 
 static void read_and_cache_data(esp_encrypted_img_t *handle, pre_enc_decrypt_arg_t *args, int *curr_index, int data_size)
@@ -264,17 +738,8 @@ static void read_and_cache_data(esp_encrypted_img_t *handle, pre_enc_decrypt_arg
     handle->binary_file_read += MIN(args->data_in_len - temp, data_left);
 }
 
-esp_err_t esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args)
+static esp_err_t decrypt_data(esp_encrypted_img_t *handle, pre_enc_decrypt_arg_t *args, char *out_buf)
 {
-    if (ctx == NULL || args == NULL || args->data_in == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    esp_encrypted_img_t *handle = (esp_encrypted_img_t *)ctx;
-    if (handle == NULL) {
-        ESP_LOGE(TAG, "esp_encrypted_img_decrypt_data: Invalid argument");
-        return ESP_ERR_INVALID_ARG;
-    }
-
     esp_err_t err;
     int curr_index = 0;
 
@@ -404,12 +869,37 @@ esp_err_t esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decry
     }
 /* falls through */
     case ESP_PRE_ENC_DATA_DECODE_STATE:
-        err = process_bin(handle, args, curr_index);
+        err = process_bin(handle, args, curr_index, out_buf);
         return err;
     }
     return ESP_OK;
 }
 
+esp_err_t esp_encrypted_img_decrypt_data(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args)
+{
+    if (ctx == NULL || args == NULL || args->data_in == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_encrypted_img_t *handle = (esp_encrypted_img_t *)ctx;
+    if (handle == NULL) {
+        ESP_LOGE(TAG, "esp_encrypted_img_decrypt_data: Invalid argument");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return decrypt_data(handle, args, NULL);
+}
+
+esp_err_t esp_encrypted_img_decrypt_data_to_buf(esp_decrypt_handle_t ctx, pre_enc_decrypt_arg_t *args,
+                                                size_t data_out_size)
+{
+    if (ctx == NULL || args == NULL || args->data_in == NULL || args->data_out == NULL ||
+            data_out_size < ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(args->data_in_len)) {
+        ESP_LOGE(TAG, "esp_encrypted_img_decrypt_data_to_buf: Invalid argument");
+        return ESP_ERR_INVALID_ARG;
+    }
+    args->data_out_len = 0;
+    return decrypt_data((esp_encrypted_img_t *)ctx, args, args->data_out);
+}
+
 esp_err_t esp_encrypted_img_decrypt_end(esp_decrypt_handle_t ctx)
 {
     if (ctx == NULL) {
@@ -445,9 +935,22 @@ esp_err_t esp_encrypted_img_decrypt_end(esp_decrypt_handle_t ctx)
             err = ESP_FAIL;
             goto exit;
         }
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+        if (bin_hash_finish(handle) != ESP_OK) {
+            err = ESP_FAIL;
+            goto exit;
+        }
+#endif
+#if CONFIG_ESP_ENCRYPTED_IMG_KEY_CACHE
+        /* The update attempt is over */
+        key_cache_clear(handle->key_id);
+#endif
     }
     err = ESP_OK;
 exit:
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+    bin_hash_free(handle);
+#endif
     mbedtls_gcm_free(&handle->gcm_ctx);
     free(handle->cache_buf);
     free(handle->rsa_pem);
@@ -468,9 +971,31 @@ esp_err_t esp_encrypted_img_decrypt_abort(esp_decrypt_handle_t ctx)
         ESP_LOGE(TAG, "esp_encrypted_img_decrypt_data: Invalid argument");
         return ESP_ERR_INVALID_ARG;
     }
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+    bin_hash_free(handle);
+#endif
     mbedtls_gcm_free(&handle->gcm_ctx);
     free(handle->cache_buf);
     free(handle->rsa_pem);
     free(handle);
     return ESP_OK;
 }
+
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+esp_err_t esp_encrypted_img_get_image_sha256(esp_decrypt_handle_t ctx, uint8_t sha256[32])
+{
+    esp_encrypted_img_t *handle = (esp_encrypted_img_t *)ctx;
+    if (handle == NULL || sha256 == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->state != ESP_PRE_ENC_DATA_DECODE_STATE || handle->binary_file_read != handle->binary_file_len) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = bin_hash_finish(handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    memcpy(sha256, handle->image_hash.digest, IMAGE_DIGEST_SIZE);
+    return ESP_OK;
+}
+#endif
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Unlicense OR CC0-1.0
  */
 #include <stdio.h>
+#include <string.h>
 #include <freertos/FreeRTOS.h>
 
 #include "unity.h"
@@ -311,6 +312,91 @@ TEST_CASE("Sending random size data at once", "[encrypted_img]")
     free(args);
 }
 
+TEST_CASE("Sending unaligned chunks", "[encrypted_img]")
+{
+    esp_decrypt_cfg_t cfg = {
+        .rsa_priv_key = (char *)rsa_private_pem_start,
+        .rsa_priv_key_len = rsa_private_pem_end - rsa_private_pem_start,
+    };
+    esp_decrypt_handle_t ctx = esp_encrypted_img_decrypt_start(&cfg);
+    TEST_ASSERT_NOT_NULL(ctx);
+
+    pre_enc_decrypt_arg_t *args = calloc(1, sizeof(pre_enc_decrypt_arg_t));
+    TEST_ASSERT_NOT_NULL(args);
+
+    esp_err_t err;
+    size_t decrypted = 0;
+
+    int i = 0;
+    do {
+        uint32_t x = 519 < ((bin_end - bin_start) - i) ? 519 : ((bin_end - bin_start) - i);
+        args->data_in = (char *)(bin_start + i);
+        i += x;
+        args->data_in_len = x;
+        err = esp_encrypted_img_decrypt_data(ctx, args);
+        if (err == ESP_FAIL) {
+            printf("ESP_FAIL ERROR\n");
+            break;
+        }
+        decrypted += args->data_out_len;
+    } while (err != ESP_OK);
+
+    TEST_ESP_OK(err);
+    // Binary size field of the image header
+    TEST_ASSERT_EQUAL(*(uint32_t *)(bin_start + 404), decrypted);
+
+    err = esp_encrypted_img_decrypt_end(ctx);
+    TEST_ESP_OK(err);
+    if (args->data_out) {
+        free(args->data_out);
+    }
+    free(args);
+}
+
+TEST_CASE("Decrypting into a caller buffer", "[encrypted_img]")
+{
+    esp_decrypt_cfg_t cfg = {
+        .rsa_priv_key = (char *)rsa_private_pem_start,
+        .rsa_priv_key_len = rsa_private_pem_end - rsa_private_pem_start,
+    };
+    esp_decrypt_handle_t ctx = esp_encrypted_img_decrypt_start(&cfg);
+    TEST_ASSERT_NOT_NULL(ctx);
+
+    const size_t chunk = 519;
+    char *out = malloc(ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(chunk));
+    TEST_ASSERT_NOT_NULL(out);
+    pre_enc_decrypt_arg_t args = { 0 };
+
+    esp_err_t err;
+    size_t decrypted = 0;
+
+    int i = 0;
+    do {
+        uint32_t x = chunk < ((bin_end - bin_start) - i) ? chunk : ((bin_end - bin_start) - i);
+        args.data_in = (char *)(bin_start + i);
+        args.data_in_len = x;
+        args.data_out = out;
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                          esp_encrypted_img_decrypt_data_to_buf(ctx, &args, ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(x) - 1));
+        i += x;
+        err = esp_encrypted_img_decrypt_data_to_buf(ctx, &args, ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(chunk));
+        if (err == ESP_FAIL) {
+            printf("ESP_FAIL ERROR\n");
+            break;
+        }
+        TEST_ASSERT_EQUAL_PTR(out, args.data_out);
+        decrypted += args.data_out_len;
+    } while (err != ESP_OK);
+
+    TEST_ESP_OK(err);
+    // Binary size field of the image header
+    TEST_ASSERT_EQUAL(*(uint32_t *)(bin_start + 404), decrypted);
+
+    err = esp_encrypted_img_decrypt_end(ctx);
+    TEST_ESP_OK(err);
+    free(out);
+}
+
 TEST_CASE("Sending imcomplete data", "[encrypted_img]")
 {
     esp_decrypt_cfg_t cfg = {
@@ -357,3 +443,48 @@ TEST_CASE("Test canceling decryption frees memory", "[encrypted_img]")
     // +/- 16 bytes to allow for some small fluctuations
     TEST_ASSERT(abs(free_bytes_start - free_bytes_end) <= 16);
 }
+
+#if CONFIG_ESP_ENCRYPTED_IMG_IMAGE_SHA256
+static void decrypt_image_sha256(size_t chunk, uint8_t sha256[32])
+{
+    esp_decrypt_cfg_t cfg = {
+        .rsa_priv_key = (char *)rsa_private_pem_start,
+        .rsa_priv_key_len = rsa_private_pem_end - rsa_private_pem_start,
+    };
+    esp_decrypt_handle_t ctx = esp_encrypted_img_decrypt_start(&cfg);
+    TEST_ASSERT_NOT_NULL(ctx);
+
+    char *out = malloc(ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(chunk));
+    TEST_ASSERT_NOT_NULL(out);
+    pre_enc_decrypt_arg_t args = { 0 };
+
+    esp_err_t err;
+    int i = 0;
+    do {
+        TEST_ESP_ERR(ESP_ERR_INVALID_STATE, esp_encrypted_img_get_image_sha256(ctx, sha256));
+        uint32_t x = chunk < ((bin_end - bin_start) - i) ? chunk : ((bin_end - bin_start) - i);
+        args.data_in = (char *)(bin_start + i);
+        args.data_in_len = x;
+        args.data_out = out;
+        i += x;
+        err = esp_encrypted_img_decrypt_data_to_buf(ctx, &args, ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(chunk));
+        // The output buffer is reused straight away
+        memset(out, 0, ESP_ENCRYPTED_IMG_DECRYPT_OUT_SIZE(chunk));
+    } while (err == ESP_ERR_NOT_FINISHED);
+    TEST_ESP_OK(err);
+
+    TEST_ESP_OK(esp_encrypted_img_get_image_sha256(ctx, sha256));
+    TEST_ESP_OK(esp_encrypted_img_decrypt_end(ctx));
+    free(out);
+}
+
+TEST_CASE("Hashing the decrypted image", "[encrypted_img]")
+{
+    uint8_t sha256[32], sha256_chunks[32];
+    decrypt_image_sha256(bin_end - bin_start, sha256);
+    decrypt_image_sha256(1, sha256_chunks);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(sha256, sha256_chunks, sizeof(sha256));
+    decrypt_image_sha256(519, sha256_chunks);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(sha256, sha256_chunks, sizeof(sha256));
+}
+#endif
@@ -102,6 +102,37 @@ typedef void(*esp_insights_transport_disconnect_t)(void);
  */
 typedef int(*esp_insights_transport_data_send_t)(void *data, size_t len);
 
+/**
+ * @brief Insights transport streamed data send begin callback prototype
+ *
+ * Starts a message which is passed in chunks to \ref esp_insights_transport_data_send_chunk_t,
+ * so that the whole message never has to be in memory.
+ *
+ * @param[in] len  Length of the whole message
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+typedef esp_err_t(*esp_insights_transport_data_send_begin_t)(size_t len);
+
+/**
+ * @brief Insights transport streamed data send chunk callback prototype
+ *
+ * @param[in] data Chunk of the message
+ * @param[in] len  Length of the chunk
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+typedef esp_err_t(*esp_insights_transport_data_send_chunk_t)(const void *data, size_t len);
+
+/**
+ * @brief Insights transport streamed data send end callback prototype
+ *
+ * @param[in] complete false if the message was not passed completely and must be dropped
+ *
+ * @return msg_id  Same as \ref esp_insights_transport_data_send_t
+ */
+typedef int(*esp_insights_transport_data_send_end_t)(bool complete);
+
 /**
  * @brief Insights transport configurations
  */
@@ -118,6 +149,10 @@ typedef struct {
         esp_insights_transport_disconnect_t disconnect;
         /** Function to send data */
         esp_insights_transport_data_send_t data_send;
+        /** Functions to send data in chunks, optional. Either all or none of them must be set */
+        esp_insights_transport_data_send_begin_t data_send_begin;
+        esp_insights_transport_data_send_chunk_t data_send_chunk;
+        esp_insights_transport_data_send_end_t data_send_end;
     } callbacks;
     /** User data */
     void *userdata;
@@ -248,6 +283,29 @@ esp_err_t esp_insights_test_cmd_handler();
  */
 esp_err_t esp_insights_cmd_resp_enable(void);
 
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+/**
+ * @brief Add a message of a child device, to be uploaded with the data of this node
+ *
+ * For border routers, so that the children of their Thread network do not need a connection to the cloud
+ * each. A child registers, with esp_insights_transport_register(), a transport whose data_send callback
+ * hands its messages to the router over the network of the application, and the router adds each one it
+ * receives with this. The messages are uploaded in the "children" list of the data messages of the router,
+ * each with the node id of its child, in the order they were added.
+ *
+ * The message is copied, it may be freed once this returns.
+ *
+ * @param[in] node_id Node id of the child
+ * @param[in] data Message of the child, as given to its transport
+ * @param[in] len Length of the message
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the message is longer than
+ * CONFIG_ESP_INSIGHTS_GATEWAY_MSG_MAX, ESP_ERR_NO_MEM if the buffer of the messages of the children is
+ * full, for the child to send it again later, appropriate error code otherwise
+ */
+esp_err_t esp_insights_gateway_child_data_add(const char *node_id, const void *data, size_t len);
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,12 +15,15 @@
 
 #include <nvs.h>
 #include <esp_crc.h>
+#include <esp_random.h>
 #include <esp_diag_data_store.h>
 #include <esp_diagnostics.h>
 #include <esp_diagnostics_metrics.h>
 #include <esp_diagnostics_variables.h>
 #include <esp_diagnostics_system_metrics.h>
 #include <esp_diagnostics_network_variables.h>
+#include <esp_diagnostics_trace.h>
+#include <esp_diagnostics_spans.h>
 #include <esp_rmaker_utils.h>
 #include <esp_rmaker_factory.h>
 #include <esp_rmaker_work_queue.h>
@@ -30,6 +33,12 @@
 #include "esp_insights_client_data.h"
 #include "esp_insights_encoder.h"
 #include "esp_insights_cbor_decoder.h"
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS || CONFIG_ESP_INSIGHTS_METRICS_SERIES
+#include "esp_insights_cbor_encoder.h"
+#endif
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+#include "esp_insights_gateway.h"
+#endif
 
 #ifdef CONFIG_ESP_INSIGHTS_CMD_RESP_ENABLED
 #define INSIGHTS_CMD_RESP 1
@@ -49,6 +58,12 @@
 #define CLOUD_REPORTING_PERIOD_MIN_SEC    CONFIG_ESP_INSIGHTS_CLOUD_POST_MIN_INTERVAL_SEC
 #define CLOUD_REPORTING_PERIOD_MAX_SEC    CONFIG_ESP_INSIGHTS_CLOUD_POST_MAX_INTERVAL_SEC
 #define CLOUD_REPORTING_TIMEOUT_TICKS     ((30 * 1000) / portTICK_PERIOD_MS)
+#define CLOUD_REPORTING_FILL_TARGET       (CONFIG_ESP_INSIGHTS_CLOUD_POST_FILL_TARGET_PERCENT * 10)   /* per mille */
+#define CLOUD_REPORTING_JITTER_PERCENT    CONFIG_ESP_INSIGHTS_CLOUD_POST_JITTER_PERCENT
+#define CLOUD_REPORTING_BATCH_MAX         CONFIG_ESP_INSIGHTS_CLOUD_POST_BATCH_MAX
+#define CLOUD_REPORTING_LOW_MEM_SPREAD_MS (5 * 1000)    /* low memory uploads are spread over this much time */
+#define CLOUD_REPORTING_SLOW_LINK_MS      (2 * 1000)    /* data messages taking longer to deliver mean a slow link */
+#define CLOUD_REPORTING_WEAK_RSSI         (-80)
 
 #ifdef CONFIG_DIAG_DATA_STORE_RTC
 #if CONFIG_RTC_STORE_DATA_SIZE > (1024 * 4)
@@ -61,10 +76,26 @@
 #define INSIGHTS_DATA_MAX_SIZE (1024 * 6)
 #endif
 
-#define INSIGHTS_READ_BUF_SIZE  (1024)  // read this much data from data store in one go
+#define INSIGHTS_READ_BUF_SIZE  (1024)  // encode at most this much data of each data store in one go
+#define INSIGHTS_STREAM_CHUNK_SIZE  CONFIG_ESP_INSIGHTS_STREAM_CHUNK_SIZE
+
+#if CONFIG_ESP_INSIGHTS_COMPRESSION
+#if CONFIG_ESP_INSIGHTS_COMPRESSION_LOOKAHEAD_BITS >= CONFIG_ESP_INSIGHTS_COMPRESSION_WINDOW_BITS
+#error "CONFIG_ESP_INSIGHTS_COMPRESSION_LOOKAHEAD_BITS must be less than CONFIG_ESP_INSIGHTS_COMPRESSION_WINDOW_BITS"
+#endif
+#define INSIGHTS_COMPRESS   1
+#else
+#define INSIGHTS_COMPRESS   0
+#endif
 
 #define SEND_INSIGHTS_META (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
 
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+#define INSIGHTS_SERIES     1
+#else
+#define INSIGHTS_SERIES     0
+#endif
+
 /* TAG for reporting generic miscellaneous insights. Different from ESP_LOGx tag */
 #define TAG_DIAG            "diag"
 #define KEY_LOG_WR_FAIL     "log_wr_fail"
@@ -88,13 +119,17 @@ typedef struct esp_insights_entry {
 } esp_insights_entry_t;
 
 typedef struct {
-    uint8_t *scratch_buf;
-    uint8_t *read_buf;      // buffer to hold data read from RTC buf
+    uint8_t *scratch_buf;   // whole message, or one chunk of it if the transport streams
+    bool stream;            // transport sends messages in chunks
     int data_msg_id;
     uint32_t data_msg_len;
     SemaphoreHandle_t data_lock;
     char app_sha256[DIAG_HEX_SHA_SIZE + 1];
-    bool data_sent;
+    TickType_t upload_tick;     /* last delivery of a data message, the store fills from there */
+    TickType_t send_tick;       /* when the data message in flight was sent */
+    uint32_t latency_ms;        /* smoothed delivery time of data messages */
+    uint8_t send_failures;      /* consecutive failed sends, for the backoff */
+    uint8_t batch_left;         /* data messages still to send in this upload */
 #if SEND_INSIGHTS_META
 #if INSIGHTS_CMD_RESP
      bool conf_meta_msg_pending;
@@ -104,6 +139,13 @@ typedef struct {
     uint32_t meta_msg_id;
     uint32_t meta_crc;
 #endif /* SEND_INSIGHTS_META */
+#if INSIGHTS_COMPRESS
+    esp_insights_compress_t compress;
+    bool compress_ready;    /* cloud has the meta advertising the compression */
+#endif
+#if INSIGHTS_SERIES
+    bool series_ready;      /* cloud has the meta advertising the metrics series */
+#endif
     bool data_send_inprogress;
     uint32_t log_write_fail_cnt; /* Count of failed log write */
     TimerHandle_t data_send_timer; /* timer to reset data_send_inprogress flag on timeout */
@@ -121,16 +163,152 @@ static esp_insights_entry_t *s_periodic_insights_entry;
 
 extern esp_err_t esp_insights_cmd_resp_init(void);
 
+static void insights_periodic_handler(void *priv_data);
+
+/* Returns the period randomly spread by CLOUD_REPORTING_JITTER_PERCENT, so that devices
+ * booted or reconnected together do not keep uploading in the same second
+ */
+static uint32_t insights_sched_jitter(uint32_t period_ms)
+{
+    uint32_t spread = ((uint64_t) period_ms * CLOUD_REPORTING_JITTER_PERCENT) / 100;
+    if (spread == 0) {
+        return period_ms;
+    }
+    return period_ms - spread + (esp_random() % (2 * spread + 1));
+}
+
+/* Fill level of the fuller of the critical and non critical stores, in per mille */
+static uint32_t insights_sched_fill_get(size_t *filled)
+{
+    esp_diag_data_store_usage_t usage;
+    if (esp_diag_data_store_usage_get(&usage) != ESP_OK) {
+        *filled = 0;
+        return 0;
+    }
+    uint32_t critical = usage.critical_size ? (usage.critical_filled * 1000) / usage.critical_size : 0;
+    uint32_t non_critical = usage.non_critical_size ? (usage.non_critical_filled * 1000) / usage.non_critical_size : 0;
+    *filled = usage.critical_filled > usage.non_critical_filled ? usage.critical_filled : usage.non_critical_filled;
+    uint32_t fill = critical > non_critical ? critical : non_critical;
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    /* The messages of the children go out over the same uploads */
+    size_t children_filled;
+    uint32_t children = esp_insights_gateway_fill_get(&children_filled);
+    *filled += children_filled;
+    if (children > fill) {
+        fill = children;
+    }
+#endif
+    return fill;
+}
+
+/* Slow or weak links get fewer, bigger uploads */
+static bool insights_sched_link_slow(void)
+{
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK && ap_info.rssi < CLOUD_REPORTING_WEAK_RSSI) {
+        return true;
+    }
+    return s_insights_data.latency_ms > CLOUD_REPORTING_SLOW_LINK_MS;
+}
+
+/* Caller holds data_lock. Picks the period until the next upload, and the number of messages of the upload starting now.
+ *
+ * The period is the time the store takes to fill to CLOUD_REPORTING_FILL_TARGET at the rate it filled since the
+ * last upload, so that uploads are as rare as the store allows. Failed sends back off exponentially instead.
+ */
+static uint32_t insights_sched_next(const esp_insights_entry_t *entry, bool active)
+{
+    uint32_t min_ms = entry->min_seconds * 1000;
+    uint32_t max_ms = entry->max_seconds * 1000;
+    uint64_t period_ms;
+
+    s_insights_data.batch_left = 0;
+    if (!active) {
+        /* Check again soon, the store is drained once the link is back */
+        period_ms = min_ms;
+    } else if (s_insights_data.send_failures) {
+        uint8_t shift = s_insights_data.send_failures < 16 ? s_insights_data.send_failures : 16;
+        period_ms = (uint64_t) min_ms << shift;
+    } else {
+        size_t filled;
+        uint32_t fill = insights_sched_fill_get(&filled);
+        uint32_t target = CLOUD_REPORTING_FILL_TARGET;
+        if (insights_sched_link_slow()) {
+            target += (1000 - target) / 2;
+        }
+        uint64_t elapsed_ms = pdTICKS_TO_MS(xTaskGetTickCount() - s_insights_data.upload_tick);
+        period_ms = fill ? (elapsed_ms * target) / fill : max_ms;
+        /* Enough messages to drain what is stored now */
+        size_t batch = (filled + INSIGHTS_READ_BUF_SIZE - 1) / INSIGHTS_READ_BUF_SIZE;
+        if (batch > CLOUD_REPORTING_BATCH_MAX) {
+            batch = CLOUD_REPORTING_BATCH_MAX;
+        }
+        s_insights_data.batch_left = batch > 1 ? batch - 1 : 0;
+    }
+    if (period_ms < min_ms) {
+        period_ms = min_ms;
+    } else if (period_ms > max_ms) {
+        period_ms = max_ms;
+    }
+    return insights_sched_jitter(period_ms);
+}
+
+/* Caller holds data_lock */
+static void insights_sched_send_failed(void)
+{
+    if (s_insights_data.send_failures < UINT8_MAX) {
+        s_insights_data.send_failures++;
+    }
+    s_insights_data.batch_left = 0;
+}
+
+/* Caller holds data_lock. A data message reached the cloud, the next one of the batch is queued. */
+static void insights_sched_data_delivered(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    uint32_t latency_ms = pdTICKS_TO_MS(now - s_insights_data.send_tick);
+    s_insights_data.latency_ms = s_insights_data.latency_ms ? (s_insights_data.latency_ms * 3 + latency_ms) / 4 : latency_ms;
+    s_insights_data.send_failures = 0;
+    s_insights_data.upload_tick = now;
+    if (s_insights_data.batch_left) {
+        s_insights_data.batch_left--;
+        esp_rmaker_work_queue_add_task_with_prio(insights_periodic_handler, NULL, ESP_RMAKER_WORK_QUEUE_PRIO_LOW);
+    }
+}
+
+/* Brings the next upload forward when the store runs low on memory */
+static void insights_sched_expedite(void)
+{
+    if (!s_periodic_insights_entry || !s_periodic_insights_entry->timer) {
+        return;
+    }
+    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+    bool backoff = s_insights_data.send_failures > 0;
+    xSemaphoreGive(s_insights_data.data_lock);
+    if (backoff) {
+        /* Sending sooner would not get through either */
+        return;
+    }
+    TimerHandle_t timer = s_periodic_insights_entry->timer;
+    /* Devices filling up together, e.g. on a shared event, are spread over a few seconds */
+    TickType_t delay = pdMS_TO_TICKS(1000 + esp_random() % CLOUD_REPORTING_LOW_MEM_SPREAD_MS);
+    if (xTimerIsTimerActive(timer) == pdTRUE && xTimerGetExpiryTime(timer) - xTaskGetTickCount() <= delay) {
+        /* Due already, the event is posted on every write past the watermark */
+        return;
+    }
+    xTimerChangePeriod(timer, delay, 0);
+}
+
 static void esp_insights_first_call(void *priv_data)
 {
     if (!priv_data) {
         return;
     }
     esp_insights_entry_t *entry = (esp_insights_entry_t *)priv_data;
-    esp_rmaker_work_queue_add_task(entry->work_fn, entry->priv_data);
-    /* Start timer here so that the function is called periodically */
-    ESP_LOGI(TAG, "Scheduling Insights timer for %" PRIu32 " seconds.", entry->cur_seconds);
-    xTimerStart(entry->timer, 0);
+    /* The first upload is spread over the min period, so that devices powered up together do not send together */
+    uint32_t delay_ms = 1000 + esp_random() % (entry->min_seconds * 1000);
+    ESP_LOGI(TAG, "Scheduling Insights timer for %" PRIu32 " ms.", delay_ms);
+    xTimerChangePeriod(entry->timer, pdMS_TO_TICKS(delay_ms), 0);
 }
 
 /* Returns true if wifi is connected and insights is enabled, false otherwise */
@@ -151,42 +329,25 @@ static bool is_wifi_connected(void)
 
 /* This executes in the context of timer task.
  *
- * There is a dynamic logic to decide the next instance when the insights
- * data will be reported. Depending on whether data was sent or not during
- * the previous timeout, we double or halve the time period.
- * This ensures that data generally gets reported quick enough,
- * but if there's very frequent data being generated, it wont result
- * into too frquent publishes.
- * The period will keep changing between CLOUD_REPORTING_PERIOD_MIN_SEC and
- * CLOUD_REPORTING_PERIOD_MAX_SEC
+ * Each expiry starts an upload and picks, in insights_sched_next(), when the next one is due
+ * and how many messages this one sends. The period stays between
+ * CLOUD_REPORTING_PERIOD_MIN_SEC and CLOUD_REPORTING_PERIOD_MAX_SEC.
  */
 static void esp_insights_common_cb(TimerHandle_t handle)
 {
     esp_insights_entry_t *entry = (esp_insights_entry_t *)pvTimerGetTimerID(handle);
-    /* Check if any data was sent during the previous time out */
-    xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-    bool l_data_sent = s_insights_data.data_sent;
-    s_insights_data.data_sent = false;
-    xSemaphoreGive(s_insights_data.data_lock);
 
     if (entry) {
-        if (is_insights_active() == true) {
-            esp_rmaker_work_queue_add_task(entry->work_fn, entry->priv_data);
-        }
-        /* If data was sent during previous timer interval, double the period */
-        if (l_data_sent) {
-            entry->cur_seconds <<= 1; /* Double the period */
-            if (entry->cur_seconds > entry->max_seconds) {
-                entry->cur_seconds = entry->max_seconds;
-            }
-        } else {
-            /* If no data was sent during previous timer interval, halve the period */
-            entry->cur_seconds >>= 1; /* Halve the period */
-            if (entry->cur_seconds < entry->min_seconds) {
-                entry->cur_seconds = entry->min_seconds;
-            }
+        bool active = is_insights_active();
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        uint32_t period_ms = insights_sched_next(entry, active);
+        xSemaphoreGive(s_insights_data.data_lock);
+        if (active) {
+            /* Uploads are background work, so that they do not hold up the other work of RainMaker */
+            esp_rmaker_work_queue_add_task_with_prio(entry->work_fn, entry->priv_data, ESP_RMAKER_WORK_QUEUE_PRIO_LOW);
         }
-        xTimerChangePeriod(handle, (entry->cur_seconds * 1000)/ portTICK_PERIOD_MS, 100);
+        entry->cur_seconds = period_ms / 1000;
+        xTimerChangePeriod(handle, pdMS_TO_TICKS(period_ms), 100);
         xTimerStart(handle, 0);
     }
 }
@@ -253,10 +414,28 @@ static esp_err_t esp_insights_register_periodic_handler(esp_rmaker_work_fn_t wor
     return ret;
 }
 
+#if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
+static void core_dump_delivered(void)
+{
+    esp_core_dump_image_erase();
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+    esp_insights_crash_sig_delivered();
+#endif
+}
+#endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
+
 static void data_send_timeout_cb(TimerHandle_t handle)
 {
     xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
     s_insights_data.data_send_inprogress = false;
+    /* A late ack must not release the data while the next message reads it in place, it is sent again */
+    s_insights_data.data_msg_id = -1;
+    /* Ends the peek without releasing anything */
+    esp_diag_data_store_critical_release(0);
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    esp_insights_gateway_release(false);
+#endif
+    insights_sched_send_failed();
     if (s_insights_data.boot_msg_id > 0) {
         s_insights_data.boot_msg_id = -1;
     }
@@ -288,17 +467,25 @@ static void insights_event_handler(void* arg, esp_event_base_t event_base,
                 }
                 if (data->msg_id == s_insights_data.data_msg_id) {
                     esp_diag_data_store_critical_release(s_insights_data.data_msg_len);
-                    s_insights_data.data_sent = true;
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+                    esp_insights_gateway_release(true);
+#endif
                     s_insights_data.data_send_inprogress = false;
+                    insights_sched_data_delivered();
 #if SEND_INSIGHTS_META
                 } else if (s_insights_data.meta_msg_pending && data->msg_id == s_insights_data.meta_msg_id) {
                     esp_insights_meta_nvs_crc_set(s_insights_data.meta_crc);
                     s_insights_data.meta_msg_pending = false;
-                    s_insights_data.data_sent = true;
+#if INSIGHTS_COMPRESS
+                    s_insights_data.compress_ready = true;
+#endif
+#if INSIGHTS_SERIES
+                    s_insights_data.series_ready = true;
+#endif
 #endif /* SEND_INSIGHTS_META */
                 } else if (s_insights_data.boot_msg_id > 0 && s_insights_data.boot_msg_id == data->msg_id) {
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-                    esp_core_dump_image_erase();
+                    core_dump_delivered();
 #endif // CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
                     s_insights_data.boot_msg_id = 0;
                 }
@@ -316,7 +503,19 @@ static void insights_event_handler(void* arg, esp_event_base_t event_base,
                 xTimerStop(s_insights_data.data_send_timer, portMAX_DELAY);
             }
             s_insights_data.data_send_inprogress = false;
-            if (s_insights_data.boot_msg_id > 0 && data->msg_id == s_insights_data.boot_msg_id) {
+            if (data) {
+                /* Failures of synchronous transports come without data, and are counted by the sender */
+                insights_sched_send_failed();
+            }
+            if (!data) {
+                /* Synchronous transports report failures without msg_id */
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+            } else if (s_insights_data.data_msg_id > 0 && data->msg_id == s_insights_data.data_msg_id) {
+                /* Taken again by the next data message */
+                s_insights_data.data_msg_id = -1;
+                esp_insights_gateway_release(false);
+#endif
+            } else if (s_insights_data.boot_msg_id > 0 && data->msg_id == s_insights_data.boot_msg_id) {
                 s_insights_data.boot_msg_id = -1;
             }
 #if INSIGHTS_CMD_RESP
@@ -356,27 +555,94 @@ static void insights_dbg_dump(uint8_t *data, uint32_t len)
 }
 #endif /* INSIGHTS_DEBUG_ENABLED */
 
-static void send_boottime_data(void)
+/* Encodes a message into the stream and returns its length, 0 on error */
+typedef size_t (*insights_msg_encode_t)(esp_insights_encode_stream_t *stream, void *arg);
+
+/* Data messages are compressed once the cloud knows how, meta messages advertise it */
+static esp_insights_compress_t *insights_compress_get(bool data_msg)
+{
+#if INSIGHTS_COMPRESS
+    if (s_insights_data.compress.buf && (!data_msg || s_insights_data.compress_ready)) {
+        return &s_insights_data.compress;
+    }
+#endif
+    return NULL;
+}
+
+/* Metrics are sent as series once the cloud knows the format, meta messages advertise it */
+static bool insights_series_get(bool data_msg)
+{
+#if INSIGHTS_SERIES
+    return !data_msg || s_insights_data.series_ready;
+#else
+    return false;
+#endif
+}
+
+/* Encodes the message into the scratch buffer, or only counts its bytes if the transport streams */
+static size_t insights_msg_encode(esp_insights_encode_stream_t *stream, insights_msg_encode_t encode, void *arg,
+                                  esp_insights_compress_t *compress, bool series)
+{
+    if (s_insights_data.stream) {
+        esp_insights_encode_stream_init(stream, NULL, 0, NULL);
+    } else {
+        memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
+        esp_insights_encode_stream_init(stream, s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, NULL);
+    }
+    stream->compress = compress;
+    stream->series = series;
+    return encode(stream, arg);
+}
+
+/* Sends the message of insights_msg_encode(). A streamed message is encoded again, chunk by chunk,
+ * so that only one chunk of it is ever in memory.
+ */
+static int insights_msg_send(esp_insights_encode_stream_t *stream, insights_msg_encode_t encode, void *arg, size_t len)
 {
-    uint16_t len = 0;
-    esp_insights_encode_data_begin(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
+    if (!s_insights_data.stream) {
+#if INSIGHTS_DEBUG_ENABLED
+        insights_dbg_dump(s_insights_data.scratch_buf, len);
+#endif
+        return esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    }
+    if (esp_insights_transport_data_send_begin(len) != ESP_OK) {
+        return -1;
+    }
+    esp_insights_encode_stream_rewind(stream, s_insights_data.scratch_buf, INSIGHTS_STREAM_CHUNK_SIZE,
+                                      esp_insights_transport_data_send_chunk);
+    bool complete = encode(stream, arg) == len;
+    if (!complete) {
+        ESP_LOGE(TAG, "Failed to stream message of length %d, err:0x%x", (int) len, stream->err);
+    }
+    return esp_insights_transport_data_send_end(complete);
+}
+
+static size_t encode_boottime_msg(esp_insights_encode_stream_t *stream, void *arg)
+{
+    esp_insights_encode_data_begin_stream(stream);
     esp_insights_encode_boottime_data();
-    len = esp_insights_encode_data_end(s_insights_data.scratch_buf);
+    return esp_insights_encode_data_end_stream(stream);
+}
+
+static void send_boottime_data(void)
+{
+    esp_insights_encode_stream_t stream;
+    size_t len = insights_msg_encode(&stream, encode_boottime_msg, NULL, insights_compress_get(true), false);
     if (len == 0) {
         ESP_LOGE(TAG, "No boottime data to send");
         s_insights_data.boot_msg_id = 0; // mark it sent
+        return;
     }
 #if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Sending boottime data of length: %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    ESP_LOGI(TAG, "Sending boottime data of length: %d", (int) len);
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    int msg_id = insights_msg_send(&stream, encode_boottime_msg, NULL, len);
     s_insights_data.boot_msg_id = msg_id;
     if (msg_id > 0) {
         return;
     } else if (msg_id == 0) {
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-        esp_core_dump_image_erase();
+        core_dump_delivered();
 #endif // CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
     } else {
 #if INSIGHTS_DEBUG_ENABLED
@@ -399,22 +665,50 @@ static bool insights_meta_changed(void)
 {
     uint32_t nvs_crc;
     uint32_t meta_crc = esp_diag_meta_crc_get();
+#if INSIGHTS_COMPRESS
+    /* The meta has to be sent again if the compression it advertises changes */
+    if (s_insights_data.compress.buf) {
+        uint8_t compress_params[] = { CONFIG_ESP_INSIGHTS_COMPRESSION_WINDOW_BITS, CONFIG_ESP_INSIGHTS_COMPRESSION_LOOKAHEAD_BITS };
+        meta_crc = esp_crc32_le(meta_crc, compress_params, sizeof(compress_params));
+    }
+#endif
+#if INSIGHTS_SERIES
+    /* and if the series format it advertises changes */
+    uint8_t series_ver = ESP_INSIGHTS_METRICS_SERIES_VERSION;
+    meta_crc = esp_crc32_le(meta_crc, &series_ver, sizeof(series_ver));
+#endif
     esp_err_t err = esp_insights_meta_nvs_crc_get(&nvs_crc);
     if (err == ESP_OK && nvs_crc == meta_crc) {
         /* crc found and matched, no need to send insights meta */
+#if INSIGHTS_COMPRESS
+        s_insights_data.compress_ready = true;
+#endif
+#if INSIGHTS_SERIES
+        s_insights_data.series_ready = true;
+#endif
         return false;
     }
+#if INSIGHTS_COMPRESS
+    s_insights_data.compress_ready = false;
+#endif
+#if INSIGHTS_SERIES
+    s_insights_data.series_ready = false;
+#endif
     ESP_LOGI(TAG, "Insights metadata changed");
     s_insights_data.meta_crc = meta_crc;
     return true;
 }
 
-static void send_insights_meta(void)
+static size_t encode_meta_msg(esp_insights_encode_stream_t *stream, void *arg)
 {
-    uint16_t len = 0;
+    return esp_insights_encode_meta_stream(stream, s_insights_data.app_sha256);
+}
 
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
-    len = esp_insights_encode_meta(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, s_insights_data.app_sha256);
+static void send_insights_meta(void)
+{
+    esp_insights_encode_stream_t stream;
+    size_t len = insights_msg_encode(&stream, encode_meta_msg, NULL, insights_compress_get(false),
+                                     insights_series_get(false));
     if (len == 0) {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "No metadata to send");
@@ -422,10 +716,9 @@ static void send_insights_meta(void)
         return;
     }
 #if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Insights meta data length %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    ESP_LOGI(TAG, "Insights meta data length %d", (int) len);
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    int msg_id = insights_msg_send(&stream, encode_meta_msg, NULL, len);
     if (msg_id > 0) {
         xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
         s_insights_data.meta_msg_pending = true;
@@ -433,6 +726,12 @@ static void send_insights_meta(void)
         xSemaphoreGive(s_insights_data.data_lock);
     } else if (msg_id == 0) {
         esp_insights_meta_nvs_crc_set(s_insights_data.meta_crc);
+#if INSIGHTS_COMPRESS
+        s_insights_data.compress_ready = true;
+#endif
+#if INSIGHTS_SERIES
+        s_insights_data.series_ready = true;
+#endif
     } else {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "meta message send failed");
@@ -442,12 +741,15 @@ static void send_insights_meta(void)
 #endif /* SEND_INSIGHTS_META */
 
 #if INSIGHTS_CMD_RESP
-static void send_insights_conf_meta(void)
+static size_t encode_conf_meta_msg(esp_insights_encode_stream_t *stream, void *arg)
 {
-    uint16_t len = 0;
+    return esp_insights_encode_conf_meta_stream(stream, s_insights_data.app_sha256);
+}
 
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
-    len = esp_insights_encode_conf_meta(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE, s_insights_data.app_sha256);
+static void send_insights_conf_meta(void)
+{
+    esp_insights_encode_stream_t stream;
+    size_t len = insights_msg_encode(&stream, encode_conf_meta_msg, NULL, NULL, false);
     if (len == 0) {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "No conf metadata to send");
@@ -455,10 +757,9 @@ static void send_insights_conf_meta(void)
         return;
     }
 #if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Insights conf meta data length %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    ESP_LOGI(TAG, "Insights conf meta data length %d", (int) len);
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
+    int msg_id = insights_msg_send(&stream, encode_conf_meta_msg, NULL, len);
     if (msg_id > 0) {
         xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
         s_insights_data.conf_meta_msg_pending = true;
@@ -479,17 +780,81 @@ static void send_insights_conf_meta(void)
  * In short, there is the possibility of data duplication, so cloud should be able to handle it.
  */
 
+/* Data is encoded in place in the data store, it stays there until released */
+typedef struct {
+    esp_diag_data_store_span_t critical[2];
+    size_t critical_size;
+    size_t critical_consumed;
+    esp_diag_data_store_span_t non_critical[2];
+    size_t non_critical_size;
+    size_t non_critical_consumed;
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+    size_t trace_count;
+    esp_diag_trace_cursor_t trace_cursor;   /* Past the events of the message, kept once it is sent */
+#endif
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    size_t children_count;                  /* Messages of the children taken, freed once the message is sent */
+#endif
+} insights_data_msg_t;
+
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+/* Read once per message, as a streamed message is encoded twice and the rings keep changing */
+static esp_diag_trace_event_t s_trace_events[CONFIG_ESP_INSIGHTS_TRACE_UPLOAD_MAX];
+static esp_diag_trace_cursor_t s_trace_cursor;
+
+static bool trace_event_take(const esp_diag_trace_event_t *event, void *arg)
+{
+    size_t *count = arg;
+    s_trace_events[(*count)++] = *event;
+    return true;
+}
+#endif
+
+/* Limits the data of the spans to size bytes */
+static size_t insights_spans_clamp(esp_diag_data_store_span_t spans[2], int len, size_t size)
+{
+    if (len <= 0) {
+        spans[0].len = 0;
+        spans[1].len = 0;
+        return 0;
+    }
+    if (spans[0].len >= size) {
+        spans[0].len = size;
+        spans[1].len = 0;
+    } else if (spans[0].len + spans[1].len > size) {
+        spans[1].len = size - spans[0].len;
+    }
+    return spans[0].len + spans[1].len;
+}
+
+static size_t encode_data_msg(esp_insights_encode_stream_t *stream, void *arg)
+{
+    insights_data_msg_t *msg = (insights_data_msg_t *) arg;
+    esp_insights_encode_data_begin_stream(stream);
+    if (msg->critical_size > 0) {
+        msg->critical_consumed = esp_insights_encode_critical_data(msg->critical,
+                                                                   msg->critical_size < INSIGHTS_READ_BUF_SIZE);
+    }
+    if (msg->non_critical_size > 0) {
+        msg->non_critical_consumed = esp_insights_encode_non_critical_data(msg->non_critical, stream->series);
+    }
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+    esp_insights_encode_trace_data(s_trace_events, msg->trace_count);
+#endif
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    esp_insights_encode_gateway_data(msg->children_count);
+#endif
+    return esp_insights_encode_data_end_stream(stream);
+}
+
 /* This encodes and sends insights data */
 static void send_insights_data(void)
 {
-    uint16_t len = 0;
-    size_t critical_data_size = 0;
-    size_t non_critical_data_size = 0;
-    size_t critical_consumed = 0;
-    size_t non_critical_consumed = 0;
-
-    memset(s_insights_data.scratch_buf, 0, INSIGHTS_DATA_MAX_SIZE);
+    size_t len = 0;
+    esp_insights_encode_stream_t stream;
+    insights_data_msg_t msg = { 0 };
 
+    ESP_DIAG_TRACE_SPAN_BEGIN("insights_send", 0);
 #if CONFIG_DIAG_ENABLE_VARIABLES
     static uint32_t prev_log_write_fail_cnt = 0;
     if (s_insights_data.log_write_fail_cnt > prev_log_write_fail_cnt) {
@@ -501,21 +866,35 @@ static void send_insights_data(void)
 #endif
     }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
+#if CONFIG_DIAG_ENABLE_METRICS
+    /* Record the ended windows of metrics that are no longer reported */
+    esp_diag_metrics_aggregation_flush(false);
+#endif
 
-    esp_insights_encode_data_begin(s_insights_data.scratch_buf, INSIGHTS_DATA_MAX_SIZE);
-
-    critical_data_size = esp_diag_data_store_critical_read(s_insights_data.read_buf, INSIGHTS_READ_BUF_SIZE);
-    if (critical_data_size > 0) {
-        critical_consumed = esp_insights_encode_critical_data(s_insights_data.read_buf, critical_data_size);
-    }
+    /* Logs written from now on start a new sequence, so the last one read is complete */
+    esp_diag_log_hook_sync();
+    int peeked = esp_diag_data_store_critical_peek(msg.critical);
+    msg.critical_size = insights_spans_clamp(msg.critical, peeked, INSIGHTS_READ_BUF_SIZE);
+    peeked = esp_diag_data_store_non_critical_peek(msg.non_critical);
+    msg.non_critical_size = insights_spans_clamp(msg.non_critical, peeked, INSIGHTS_READ_BUF_SIZE);
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+    msg.trace_cursor = s_trace_cursor;
+    esp_diag_trace_read(&msg.trace_cursor, CONFIG_ESP_INSIGHTS_TRACE_UPLOAD_MAX, trace_event_take, &msg.trace_count);
+#endif
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    msg.children_count = esp_insights_gateway_take(CONFIG_ESP_INSIGHTS_GATEWAY_MSG_MAX);
+#endif
 
-    non_critical_data_size = esp_diag_data_store_non_critical_read(s_insights_data.read_buf, INSIGHTS_READ_BUF_SIZE);
-    if (non_critical_data_size > 0) {
-        non_critical_consumed = esp_insights_encode_non_critical_data(s_insights_data.read_buf, non_critical_data_size);
-        esp_diag_data_store_non_critical_release(non_critical_consumed);
-    }
-    len = esp_insights_encode_data_end(s_insights_data.scratch_buf);
-    if (!critical_consumed && !non_critical_consumed) {
+    len = insights_msg_encode(&stream, encode_data_msg, &msg, insights_compress_get(true),
+                              insights_series_get(true));
+    if (!msg.critical_consumed && !msg.non_critical_consumed
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+            && !msg.trace_count
+#endif
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+            && !msg.children_count
+#endif
+       ) {
         len = 0; // just ignore the encoded data
     }
 
@@ -523,32 +902,64 @@ static void send_insights_data(void)
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "No data to send");
 #endif
+        /* Also ends the peeks, so that non critical data can be overwritten again */
+        esp_diag_data_store_critical_release(0);
+        esp_diag_data_store_non_critical_release(msg.non_critical_consumed);
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+        esp_insights_gateway_release(false);
+#endif
+        /* The store is drained, the rest of the batch is not needed */
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        s_insights_data.batch_left = 0;
+        xSemaphoreGive(s_insights_data.data_lock);
         goto data_send_end;
     }
 #if INSIGHTS_DEBUG_ENABLED
-    ESP_LOGI(TAG, "Sending data of length: %d", len);
-    insights_dbg_dump(s_insights_data.scratch_buf, len);
+    ESP_LOGI(TAG, "Sending data of length: %d", (int) len);
+#endif
+    s_insights_data.send_tick = xTaskGetTickCount();
+    int msg_id = insights_msg_send(&stream, encode_data_msg, &msg, len);
+    /* Non critical data is not sent again, the message may need it until it is sent */
+    esp_diag_data_store_non_critical_release(msg.non_critical_consumed);
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+    /* Trace events are not sent again either, unless the message could not be sent at all */
+    if (msg_id >= 0) {
+        s_trace_cursor = msg.trace_cursor;
+    }
 #endif
-    int msg_id = esp_insights_transport_data_send(s_insights_data.scratch_buf, len);
     if (msg_id > 0) {
         xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
-        s_insights_data.data_msg_len = critical_consumed;
+        s_insights_data.data_msg_len = msg.critical_consumed;
         s_insights_data.data_msg_id = msg_id;
         xTimerReset(s_insights_data.data_send_timer, portMAX_DELAY);
         xSemaphoreGive(s_insights_data.data_lock);
+        ESP_DIAG_TRACE_SPAN_END("insights_send", len);
         return;
     } else if (msg_id == 0) {
-        esp_diag_data_store_critical_release(critical_consumed);
-        s_insights_data.data_sent = true;
+        esp_diag_data_store_critical_release(msg.critical_consumed);
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+        esp_insights_gateway_release(true);
+#endif
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        insights_sched_data_delivered();
+        xSemaphoreGive(s_insights_data.data_lock);
     } else {
 #if INSIGHTS_DEBUG_ENABLED
         ESP_LOGI(TAG, "insights_data message send failed");
 #endif
+        esp_diag_data_store_critical_release(0);
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+        esp_insights_gateway_release(false);
+#endif
+        xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
+        insights_sched_send_failed();
+        xSemaphoreGive(s_insights_data.data_lock);
     }
 data_send_end:
     xSemaphoreTake(s_insights_data.data_lock, portMAX_DELAY);
     s_insights_data.data_send_inprogress = false;
     xSemaphoreGive(s_insights_data.data_lock);
+    ESP_DIAG_TRACE_SPAN_END("insights_send", len);
 }
 
 #if INSIGHTS_CMD_RESP
@@ -605,7 +1016,7 @@ esp_err_t esp_insights_send_data(void)
 {
     if (is_wifi_connected() == true) {
         ESP_LOGI(TAG, "Sending data to cloud");
-        return esp_rmaker_work_queue_add_task(insights_periodic_handler, NULL);
+        return esp_rmaker_work_queue_add_task_with_prio(insights_periodic_handler, NULL, ESP_RMAKER_WORK_QUEUE_PRIO_LOW);
     }
     ESP_LOGW(TAG, "Wi-Fi not in connected state");
     return ESP_FAIL;
@@ -643,7 +1054,7 @@ static void data_store_event_handler(void* arg, esp_event_base_t event_base,
                     event_id == ESP_DIAG_DATA_STORE_EVENT_CRITICAL_DATA_LOW_MEM ? "" : "NON_");
 #endif
             if (is_insights_active() == true) {
-                esp_rmaker_work_queue_add_task(insights_periodic_handler, NULL);
+                insights_sched_expedite();
             }
             break;
         }
@@ -666,9 +1077,47 @@ static void data_store_event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+/* Only used by log_write_cb(), which the log hook calls with its lock taken */
+static struct {
+    esp_diag_log_decoder_t dec;
+    esp_diag_log_data_t log;
+    uint8_t rec[ESP_INSIGHTS_LOG_RECORD_MAX_SIZE];
+} s_log_capture;
+
+/* The records of the log hook are decoded as they are written, and stored as they will be uploaded */
+static esp_err_t log_pre_encode(void **data, size_t *len)
+{
+    int dec_len = esp_diag_log_record_decode(*data, *len, &s_log_capture.dec, &s_log_capture.log);
+    if (dec_len <= 0 || !s_log_capture.dec.synced) {
+        return ESP_FAIL;
+    }
+    size_t rec_len = esp_insights_cbor_encode_log_record(&s_log_capture.log, s_log_capture.rec,
+                                                         sizeof(s_log_capture.rec));
+    if (!rec_len) {
+        return ESP_FAIL;
+    }
+    *data = s_log_capture.rec;
+    *len = rec_len;
+    return ESP_OK;
+}
+#endif /* CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS */
+
 static esp_err_t log_write_cb(void *data, size_t len, void *priv_data)
 {
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+    uint64_t timestamp = s_log_capture.dec.timestamp;
+    esp_err_t ret_val = log_pre_encode(&data, &len);
+    if (ret_val == ESP_OK) {
+        ret_val = esp_diag_data_store_critical_write(data, len);
+    }
+    if (ret_val != ESP_OK) {
+        /* The log hook does not count a record which was not written, the next one follows the previous one */
+        s_log_capture.dec.timestamp = timestamp;
+    }
+#else
     esp_err_t ret_val = esp_diag_data_store_critical_write(data, len);
+#endif
 #if INSIGHTS_DEBUG_ENABLED
     if (ret_val != ESP_OK) {
         ESP_LOGI(TAG, "esp_diag_data_store_critical_write failed len %d, err 0x%04x", len, ret_val);
@@ -677,10 +1126,26 @@ static esp_err_t log_write_cb(void *data, size_t len, void *priv_data)
     return ret_val;
 }
 
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS && (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+/* Metrics and variables are written by any task, the record is on the stack of the caller */
+static esp_err_t data_pt_write(const char *group, void *data, size_t len)
+{
+    uint8_t rec[ESP_INSIGHTS_DATA_PT_RECORD_MAX_SIZE];
+    size_t rec_len = esp_insights_cbor_encode_data_pt_record(data, len, rec, sizeof(rec));
+    if (rec_len) {
+        return esp_diag_data_store_non_critical_write(group, rec, rec_len);
+    }
+    /* Not known, stored as it is and encoded at upload */
+    return esp_diag_data_store_non_critical_write(group, data, len);
+}
+#else
+#define data_pt_write(group, data, len) esp_diag_data_store_non_critical_write(group, data, len)
+#endif
+
 #if CONFIG_DIAG_ENABLE_METRICS
 static esp_err_t metrics_write_cb(const char *group, void *data, size_t len, void *cb_arg)
 {
-    esp_err_t ret_val = esp_diag_data_store_non_critical_write(group, data, len);
+    esp_err_t ret_val = data_pt_write(group, data, len);
 #if INSIGHTS_DEBUG_ENABLED
     if (ret_val != ESP_OK) {
         ESP_LOGI(TAG, "esp_diag_data_store_non_critical_write failed group %s, len %d, err 0x%04x", group, len, ret_val);
@@ -710,6 +1175,18 @@ static void metrics_init(void)
             ESP_LOGW(TAG, "Failed to initialize wifi metrics");
         }
 #endif /* CONFIG_DIAG_ENABLE_WIFI_METRICS */
+#if CONFIG_DIAG_ENABLE_TASK_METRICS
+        ret = esp_diag_task_metrics_init();
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to initialize task metrics");
+        }
+#endif /* CONFIG_DIAG_ENABLE_TASK_METRICS */
+#if CONFIG_DIAG_ENABLE_SPAN_METRICS
+        ret = esp_diag_span_metrics_init();
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to initialize span metrics");
+        }
+#endif /* CONFIG_DIAG_ENABLE_SPAN_METRICS */
         return;
     }
     ESP_LOGE(TAG, "Failed to initialize metrics.");
@@ -722,6 +1199,12 @@ static void metrics_deinit(void)
 #endif
 #if CONFIG_DIAG_ENABLE_WIFI_METRICS
     esp_diag_wifi_metrics_deinit();
+#endif
+#if CONFIG_DIAG_ENABLE_TASK_METRICS
+    esp_diag_task_metrics_deinit();
+#endif
+#if CONFIG_DIAG_ENABLE_SPAN_METRICS
+    esp_diag_span_metrics_deinit();
 #endif
     esp_diag_metrics_deinit();
 }
@@ -730,7 +1213,7 @@ static void metrics_deinit(void)
 #if CONFIG_DIAG_ENABLE_VARIABLES
 static esp_err_t variables_write_cb(const char *group, void *data, size_t len, void *cb_arg)
 {
-    return esp_diag_data_store_non_critical_write(group, data, len);
+    return data_pt_write(group, data, len);
 }
 
 static void variables_init(void)
@@ -776,6 +1259,9 @@ void esp_insights_disable(void)
 #endif
     esp_diag_log_hook_disable(ESP_DIAG_LOG_TYPE_ERROR | ESP_DIAG_LOG_TYPE_WARNING | ESP_DIAG_LOG_TYPE_EVENT);
     esp_diag_data_store_deinit();
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+    esp_insights_gateway_clear();
+#endif
     esp_event_handler_unregister(INSIGHTS_EVENT, ESP_EVENT_ANY_ID, insights_event_handler);
     esp_event_handler_unregister(ESP_DIAG_DATA_STORE_EVENT, ESP_EVENT_ANY_ID, data_store_event_handler);
     if (s_insights_data.data_lock) {
@@ -783,9 +1269,16 @@ void esp_insights_disable(void)
         s_insights_data.data_lock = NULL;
     }
     if (s_insights_data.scratch_buf) {
-        free(s_insights_data.scratch_buf);
+        INSIGHTS_HEAP_TAG_FREE(s_insights_data.scratch_buf);
         s_insights_data.scratch_buf = NULL;
     }
+#if INSIGHTS_COMPRESS
+    esp_insights_compress_deinit(&s_insights_data.compress);
+    s_insights_data.compress_ready = false;
+#endif
+#if INSIGHTS_SERIES
+    s_insights_data.series_ready = false;
+#endif
     if (s_insights_data.data_send_timer) {
         xTimerDelete(s_insights_data.data_send_timer, portMAX_DELAY);
         s_insights_data.data_send_timer = NULL;
@@ -895,24 +1388,27 @@ esp_err_t esp_insights_enable(esp_insights_config_t *config)
         ESP_LOGE(TAG, "Failed to set node id");
         goto enable_err;
     }
+    /* A streamed message needs one chunk, the data is encoded in place in the data store */
+    s_insights_data.stream = esp_insights_transport_stream_supported();
+    size_t scratch_buf_size = s_insights_data.stream ? INSIGHTS_STREAM_CHUNK_SIZE : INSIGHTS_DATA_MAX_SIZE;
     if (config->alloc_ext_ram) {
-        s_insights_data.scratch_buf = MEM_ALLOC_EXTRAM(INSIGHTS_DATA_MAX_SIZE);
-        s_insights_data.read_buf = MEM_ALLOC_EXTRAM(INSIGHTS_READ_BUF_SIZE);
+        s_insights_data.scratch_buf = MEM_ALLOC_EXTRAM(scratch_buf_size);
     } else {
-        s_insights_data.scratch_buf = malloc(INSIGHTS_DATA_MAX_SIZE);
-        s_insights_data.read_buf = malloc(INSIGHTS_READ_BUF_SIZE);
+        s_insights_data.scratch_buf = malloc(scratch_buf_size);
     }
     if (!s_insights_data.scratch_buf) {
         ESP_LOGE(TAG, "Failed to allocate memory for scratch buffer.");
         err = ESP_ERR_NO_MEM;
         goto enable_err;
     }
-    if (!s_insights_data.read_buf) {
-        ESP_LOGE(TAG, "Failed to allocate memory for read_buf");
-        free(s_insights_data.scratch_buf);
-        err = ESP_ERR_NO_MEM;
-        goto enable_err;
+    INSIGHTS_HEAP_TAG_ADD(s_insights_data.scratch_buf);
+#if INSIGHTS_COMPRESS
+    if (esp_insights_compress_init(&s_insights_data.compress, CONFIG_ESP_INSIGHTS_COMPRESSION_WINDOW_BITS,
+                                   CONFIG_ESP_INSIGHTS_COMPRESSION_LOOKAHEAD_BITS) != ESP_OK) {
+        /* Data is still sent, just not compressed */
+        ESP_LOGW(TAG, "Failed to allocate compression window");
     }
+#endif
 
     /* Get sha256 */
     esp_diag_device_info_t device_info;
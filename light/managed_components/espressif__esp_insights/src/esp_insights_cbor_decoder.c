@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -316,6 +317,45 @@ char *esp_insights_cbor_decoder_get_string(CborValue *val)
     return NULL;
 }
 
+esp_err_t esp_insights_cbor_decoder_get_string_view(CborValue *val, cbor_str_view_t *view)
+{
+    memset(view, 0, sizeof(*view));
+    if (cbor_value_get_type(val) != CborTextStringType) {
+        return ESP_FAIL;
+    }
+    if (!cbor_value_is_length_known(val)) {
+        /* A chunked string is not contiguous in the message */
+        size_t n;
+        if (cbor_value_dup_text_string(val, &view->copy, &n, val) != CborNoError) {
+            return ESP_FAIL;
+        }
+        view->str = view->copy;
+        view->len = n;
+        return ESP_OK;
+    }
+    CborValue next = *val;
+    if (cbor_value_begin_string_iteration(&next) != CborNoError ||
+            cbor_value_get_text_string_chunk(&next, &view->str, &view->len, &next) != CborNoError ||
+            cbor_value_finish_string_iteration(&next) != CborNoError) {
+        view->str = NULL;
+        view->len = 0;
+        return ESP_FAIL;
+    }
+    *val = next;
+    return ESP_OK;
+}
+
+bool esp_insights_cbor_decoder_string_equals(const cbor_str_view_t *view, const char *str)
+{
+    return view->str && strlen(str) == view->len && memcmp(view->str, str, view->len) == 0;
+}
+
+void esp_insights_cbor_decoder_string_free(cbor_str_view_t *view)
+{
+    free(view->copy);
+    memset(view, 0, sizeof(*view));
+}
+
 esp_err_t esp_insights_cbor_decoder_enter_container(cbor_parse_ctx_t *ctx)
 {
     CborError ret = CborNoError;
@@ -362,6 +402,19 @@ esp_err_t esp_insights_cbor_decoder_done(cbor_parse_ctx_t *ctx)
     return ESP_OK;
 }
 
+esp_err_t esp_insights_cbor_decoder_init(cbor_parse_ctx_t *ctx, const uint8_t *buffer, int len)
+{
+    if (!buffer || len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    if (cbor_parser_init(buffer, len, 0, &ctx->root_parser, &ctx->it[0]) != CborNoError) {
+        ESP_LOGE(TAG, "Error initializing cbor parser");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
 cbor_parse_ctx_t *esp_insights_cbor_decoder_start(const uint8_t *buffer, int len)
 {
     if (!buffer || len == 0) {
@@ -372,10 +425,8 @@ cbor_parse_ctx_t *esp_insights_cbor_decoder_start(const uint8_t *buffer, int len
         ESP_LOGE(TAG, "failed to allocate cbor ctx");
         return NULL;
     }
-    CborParser root_parser = ctx->root_parser;
-    CborValue *it = &ctx->it[0];
-    if (cbor_parser_init(buffer, len, 0, &root_parser, it) != CborNoError) {
-        ESP_LOGE(TAG, "Error initializing cbor parser");
+    if (esp_insights_cbor_decoder_init(ctx, buffer, len) != ESP_OK) {
+        free(ctx);
         return NULL;
     }
     return ctx;
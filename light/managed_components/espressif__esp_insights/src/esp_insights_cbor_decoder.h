@@ -25,13 +25,28 @@ typedef struct cbor_parse_ctx {
     int curr_itr;
 } cbor_parse_ctx_t;
 
+/* A text string of the message being decoded, pointing into the message.
+ * Only a chunked string is copied, into copy, to be freed by esp_insights_cbor_decoder_string_free().
+ */
+typedef struct cbor_str_view {
+    const char *str;    // not NULL terminated
+    size_t len;
+    char *copy;
+} cbor_str_view_t;
+
 cbor_parse_ctx_t *esp_insights_cbor_decoder_start(const uint8_t *buffer, int len);
+/* Same as esp_insights_cbor_decoder_start() in a context of the caller, nothing is allocated */
+esp_err_t esp_insights_cbor_decoder_init(cbor_parse_ctx_t *ctx, const uint8_t *buffer, int len);
 esp_err_t esp_insights_cbor_decoder_enter_and_check_value(cbor_parse_ctx_t *ctx, const char *val);
 bool esp_insights_cbor_decoder_at_end(cbor_parse_ctx_t *ctx);
 
 esp_err_t esp_insights_cbor_decoder_advance(cbor_parse_ctx_t *ctx);
 CborType esp_insights_cbor_decode_get_value_type(cbor_parse_ctx_t *ctx);
 char *esp_insights_cbor_decoder_get_string(CborValue *val);
+/* Gets the text string at val without copying it, and advances val past it */
+esp_err_t esp_insights_cbor_decoder_get_string_view(CborValue *val, cbor_str_view_t *view);
+bool esp_insights_cbor_decoder_string_equals(const cbor_str_view_t *view, const char *str);
+void esp_insights_cbor_decoder_string_free(cbor_str_view_t *view);
 
 esp_err_t esp_insights_cbor_decoder_enter_container(cbor_parse_ctx_t *ctx);
 esp_err_t esp_insights_cbor_decoder_exit_container(cbor_parse_ctx_t *ctx);
@@ -20,6 +20,9 @@
 #include <esp_diagnostics_variables.h>
 #include <soc/soc_memory_layout.h>
 #include "esp_insights_cbor_encoder.h"
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+#include "esp_insights_gateway.h"
+#endif
 
 #define TAG "cbor_encoder"
 
@@ -47,9 +50,23 @@ esp_err_t esp_insights_cbor_encoder_register_meta_cb(insights_cbor_encoder_cb_t
     return ESP_OK;
 }
 
+static void encode_diag_begin(const char *version, uint64_t ts);
+
 void esp_insights_cbor_encode_diag_begin(void *data, size_t data_size, const char *version)
 {
     cbor_encoder_init(&s_encoder, data, data_size, 0);
+    encode_diag_begin(version, esp_diag_timestamp_get());
+}
+
+void esp_insights_cbor_encode_diag_begin_writer(CborEncoderWriteFunction writer, void *token,
+                                                const char *version, uint64_t ts)
+{
+    cbor_encoder_init_writer(&s_encoder, writer, token);
+    encode_diag_begin(version, ts);
+}
+
+static void encode_diag_begin(const char *version, uint64_t ts)
+{
     cbor_encoder_create_map(&s_encoder, &s_result_map, 1);
     cbor_encode_text_stringz(&s_result_map, "diag");
     cbor_encoder_create_map(&s_result_map, &s_diag_map, CborIndefiniteLength);
@@ -58,7 +75,7 @@ void esp_insights_cbor_encode_diag_begin(void *data, size_t data_size, const cha
     cbor_encode_text_stringz(&s_diag_map, version);
 
     cbor_encode_text_stringz(&s_diag_map, "ts");
-    cbor_encode_uint(&s_diag_map, esp_diag_timestamp_get());
+    cbor_encode_uint(&s_diag_map, ts);
 
     // cbor_encode_text_stringz(&s_diag_map, "sha256");
     // cbor_encode_text_stringz(&s_diag_map, sha256);
@@ -72,7 +89,8 @@ size_t esp_insights_cbor_encode_diag_end(void *data)
 {
     cbor_encoder_close_container(&s_result_map, &s_diag_map);
     cbor_encoder_close_container(&s_encoder, &s_result_map);
-    return cbor_encoder_get_buffer_size(&s_encoder, data);
+    /* The writer keeps track of the size itself */
+    return data ? cbor_encoder_get_buffer_size(&s_encoder, data) : 0;
 }
 
 void esp_insights_cbor_encode_diag_data_begin(void)
@@ -98,7 +116,7 @@ void esp_insights_cbor_encode_diag_conf_data_end(void)
 }
 
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
+void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary, uint32_t sig, uint32_t count, bool full)
 {
     uint8_t i;
     CborEncoder crash_map, val_list, bt_list;
@@ -111,6 +129,12 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
     cbor_encode_text_stringz(&crash_map, (char *)summary->app_elf_sha256);
     cbor_encode_text_stringz(&crash_map, "task");
     cbor_encode_text_stringz(&crash_map, summary->exc_task);
+    if (count) {
+        cbor_encode_text_stringz(&crash_map, "sig");
+        cbor_encode_uint(&crash_map, sig);
+        cbor_encode_text_stringz(&crash_map, "sig_cnt");
+        cbor_encode_uint(&crash_map, count);
+    }
 
     cbor_encode_text_stringz(&crash_map, "exc_val");
     cbor_encoder_create_array(&crash_map, &val_list, CborIndefiniteLength);
@@ -120,6 +144,9 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
     cbor_encode_uint(&val_list, summary->ex_info.mtval);
 
     cbor_encoder_close_container(&crash_map, &val_list);
+    if (!full) {
+        goto end;
+    }
 
     cbor_encode_text_stringz(&crash_map, "stackdump");
     cbor_encoder_create_array(&crash_map, &bt_list, CborIndefiniteLength);
@@ -156,6 +183,9 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
     cbor_encode_uint(&val_list, summary->ex_info.exc_vaddr);
 
     cbor_encoder_close_container(&crash_map, &val_list);
+    if (!full) {
+        goto end;
+    }
     cbor_encode_text_stringz(&crash_map, "bt");
     cbor_encoder_create_array(&crash_map, &bt_list, CborIndefiniteLength);
     for (i = 0; i < summary->exc_bt_info.depth; i++) {
@@ -183,6 +213,7 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
     }
     cbor_encoder_close_container(&crash_map, &epcx_list);
 #endif /* CONFIG_IDF_TARGET_ARCH_RISCV */
+end:
     cbor_encoder_close_container(&s_diag_data_map, &crash_map);
 }
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
@@ -190,15 +221,91 @@ void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary)
 // use a scratch_pad to memcpy data before access
 // this avoids `potential` unaligned memory accesses as
 // data pointer we receive is not guaranteed to be word aligned
+// the data points are copied on the stack instead, they are also encoded by the write callbacks
 static union encode_scratch_buf {
-#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
-    esp_diag_str_data_pt_t str_data_pt;
-    esp_diag_data_pt_t data_pt;
-#endif
     esp_diag_log_data_t log_data_pt;
     char sha_sum[DIAG_HEX_SHA_SIZE + 1];
 } enc_scratch_buf;
 
+static esp_diag_log_decoder_t s_log_decoder;
+
+/* Records are read in place in the data store, except the one wrapping around its end which is copied here */
+static union {
+    uint8_t log[1 + ESP_DIAG_LOG_RECORD_MAX_SIZE];
+#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+    uint8_t str_data_pt[sizeof(esp_diag_str_data_pt_t)];
+    uint8_t data_pt[sizeof(esp_diag_data_pt_t)];
+#endif
+#if CONFIG_DIAG_ENABLE_METRICS
+    uint8_t aggr_data_pt[sizeof(esp_diag_aggr_data_pt_t)];
+#endif
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+    uint8_t pre_encoded_log[ESP_INSIGHTS_LOG_RECORD_MAX_SIZE];
+#if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+    uint8_t pre_encoded_pt[ESP_INSIGHTS_DATA_PT_RECORD_MAX_SIZE];
+#endif
+#endif /* CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS */
+} s_bounce_buf;
+
+static inline size_t spans_len(const esp_diag_data_store_span_t spans[2])
+{
+    return spans[0].len + spans[1].len;
+}
+
+/* len bytes at offset off of the data, off + len should not be past its end */
+static const uint8_t *spans_get(const esp_diag_data_store_span_t spans[2], size_t off, size_t len, uint8_t *bounce)
+{
+    if (off >= spans[0].len) {
+        return spans[1].data + (off - spans[0].len);
+    }
+    if (len <= spans[0].len - off) {
+        return spans[0].data + off;
+    }
+    size_t first = spans[0].len - off;
+    memcpy(bounce, spans[0].data + off, first);
+    memcpy(bounce + first, spans[1].data, len - first);
+    return bounce;
+}
+
+/* Meta idx byte at offset off and the record following it, avail is set to the bytes which can be read */
+static const uint8_t *log_record_get(const esp_diag_data_store_span_t spans[2], size_t off, size_t size, size_t *avail)
+{
+    *avail = size - off;
+    if (off < spans[0].len && *avail > spans[0].len - off) {
+        /* No record is longer than the bounce buffer */
+        if (*avail > sizeof(s_bounce_buf.log)) {
+            *avail = sizeof(s_bounce_buf.log);
+        }
+    }
+    return spans_get(spans, off, *avail, s_bounce_buf.log);
+}
+
+/* Appends a whole encoded element to the array, as tinycbor appends to the buffer or writer
+ * of the encoder. When out of buffer, only the size needed is counted, as in tinycbor.
+ */
+static CborError encode_raw(CborEncoder *array, const uint8_t *data, size_t len)
+{
+    if (array->remaining) {
+        array->remaining--;
+    }
+    if (array->flags & CborIteratorFlag_WriterFunction) {
+        return array->data.writer(array->end, data, len, CborEncoderAppendCborData);
+    }
+    if (!array->end) {
+        array->data.bytes_needed += len;
+        return CborErrorOutOfMemory;
+    }
+    size_t avail = array->end - array->data.ptr;
+    if (len > avail) {
+        array->end = NULL;
+        array->data.bytes_needed = len - avail;
+        return CborErrorOutOfMemory;
+    }
+    memcpy(array->data.ptr, data, len);
+    array->data.ptr += len;
+    return CborNoError;
+}
+
 static inline uint8_t to_hex_digit(unsigned val)
 {
     return (val < 10) ? ('0' + val) : ('a' + val - 10);
@@ -285,7 +392,7 @@ void esp_insights_cbor_encode_meta_nc_hdr(const rtc_store_meta_header_t *hdr)
 
 static void encode_msg_args(CborEncoder *element, uint8_t *args, uint8_t args_len)
 {
-#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV
+#if defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV) || defined(CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED)
     uint8_t type, len, i = 0;
     CborEncoder arg_list;
     esp_diag_arg_value_t arg_val;
@@ -423,15 +530,27 @@ static void encode_msg_args(CborEncoder *element, uint8_t *args, uint8_t args_le
     cbor_encoder_close_container(element, &arg_list);
 #else
     cbor_encode_text_stringz(element, (char *)args);
-#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV */
+#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_TLV || CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED */
 }
 
-static void encode_log_element(CborEncoder *list, esp_diag_log_data_t *data)
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+static uint8_t s_log_args_tlv[CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE];
+
+/* Format pointers of raw arguments can only be followed in the firmware that recorded them */
+static bool log_format_valid(uint8_t meta_idx)
+{
+    const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_by_index(meta_idx);
+    const rtc_store_meta_header_t *cur = rtc_store_get_meta_record_current();
+    return hdr && cur && (memcmp(hdr->sha_sum, cur->sha_sum, sizeof(hdr->sha_sum)) == 0);
+}
+#endif /* CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED */
+
+/* tlv is a buffer of CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE bytes for the raw arguments, NULL if their formats
+ * cannot be followed, the arguments are left out then.
+ */
+static void encode_log_element(CborEncoder *list, const esp_diag_log_data_t *log, uint8_t *tlv)
 {
     CborEncoder element;
-    esp_diag_log_data_t *log = &enc_scratch_buf.log_data_pt;
-    // copy at aligned address to avoid potential alignment issue
-    memcpy(log, data, sizeof(esp_diag_log_data_t));
 
     cbor_encoder_create_map(list, &element, CborIndefiniteLength);
     cbor_encode_text_stringz(&element, "ts");
@@ -443,180 +562,614 @@ static void encode_log_element(CborEncoder *list, esp_diag_log_data_t *data)
     cbor_encode_text_stringz(&element, "ro");
     cbor_encode_uint(&element, (uint32_t)log->msg_ptr);
     cbor_encode_text_stringz(&element, "av");
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    if (log->msg_args_raw) {
+        uint8_t tlv_len = 0;
+        if (tlv) {
+            tlv_len = esp_diag_log_args_to_tlv(log->msg_ptr, log->msg_args, log->msg_args_len,
+                                               tlv, CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE);
+        }
+        encode_msg_args(&element, tlv, tlv_len);
+    } else
+#endif
     encode_msg_args(&element, log->msg_args, log->msg_args_len);
     if (strlen(log->task_name) > 0) {
         cbor_encode_text_stringz(&element, "task");
         cbor_encode_text_stringz(&element, log->task_name);
     }
+    if (log->repeats) {
+        cbor_encode_text_stringz(&element, "rep");
+        cbor_encode_uint(&element, log->repeats);
+        cbor_encode_text_stringz(&element, "ts_first");
+        cbor_encode_uint(&element, log->first_timestamp);
+    }
     cbor_encoder_close_container(list, &element);
 }
 
-static size_t encode_log_list(CborEncoder *map, esp_diag_log_type_t type,
-                              const char *key, const uint8_t *data, size_t size)
+/* Every record is preceded by the meta idx byte. Records can only be decoded from the start of their
+ * sequence on, so only the complete sequences are encoded, and the size taken by them returned.
+ * The last sequence is complete if all the records were read, the log hook starts a new one when
+ * esp_diag_log_hook_sync() is called before the read.
+ */
+static size_t log_records_complete(const esp_diag_data_store_span_t spans[2], bool all_read)
+{
+    esp_diag_log_decoder_t *dec = &s_log_decoder;
+    esp_diag_log_data_t *log = &enc_scratch_buf.log_data_pt;
+    uint8_t meta_idx = spans[0].data[0];
+    size_t size = spans_len(spans);
+    size_t i = 0, complete = 0, avail;
+
+    memset(dec, 0, sizeof(*dec));
+    while (i < size) {
+        const uint8_t *rec = log_record_get(spans, i, size, &avail);
+        if (rec[0] != meta_idx) {
+#if INSIGHTS_DEBUG_ENABLED
+            printf("%s: skip data for next iteration meta: %d, data[i]: %d, itr: %d\n",
+                    "insights_cbor_enocoder", meta_idx, rec[0], (int) i);
+#endif
+            return i; // the boot of the records ended with them, encode next meta next time
+        }
+        int len = esp_diag_log_record_decode(rec + 1, avail - 1, dec, log);
+        if (len < 0) {
+            // no way to find the next record, drop what cannot be parsed
+            return i ? i : size;
+        } else if (len == 0) {
+            break;
+        }
+        if (dec->seq_start) {
+            complete = i;
+        }
+        i += len + 1;
+    }
+    if ((all_read && i == size) || !dec->synced) {
+        // records before the first sequence cannot be decoded, they are dropped
+        return i;
+    }
+    return complete;
+}
+
+static void encode_log_list(CborEncoder *map, esp_diag_log_type_t type,
+                            const char *key, const esp_diag_data_store_span_t spans[2], size_t size)
 {
-    int i = 0, len = 0;
+    size_t i = 0, avail;
+    int len = 0;
     CborEncoder list;
-    esp_diag_log_data_t *log = NULL;
+    esp_diag_log_decoder_t *dec = &s_log_decoder;
+    esp_diag_log_data_t *log = &enc_scratch_buf.log_data_pt;
     cbor_encode_text_stringz(map, key);
     cbor_encoder_create_array(map, &list, CborIndefiniteLength);
-    uint8_t meta_idx = data[0];
-    while (size > sizeof (esp_diag_log_data_t)) {
-        if (data[i] != meta_idx) {
-#if INSIGHTS_DEBUG_ENABLED
-            printf("%s: skip data for next iteration meta: %d, data[i]: %d, itr: %d\n",
-                    "insights_cbor_enocoder", meta_idx, data[i], i);
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    uint8_t *tlv = log_format_valid(spans[0].data[0]) ? s_log_args_tlv : NULL;
+#else
+    uint8_t *tlv = NULL;
 #endif
-            break; // do not encode for next meta info
+    memset(dec, 0, sizeof(*dec));
+    while (i < size) {
+        const uint8_t *rec = log_record_get(spans, i, size, &avail);
+        len = esp_diag_log_record_decode(rec + 1, avail - 1, dec, log);
+        if (len <= 0) {
+            break;
         }
-        i += 1; // skip meta byte
-        size -= 1;
-        if (data[i] == type) {
-            log = (esp_diag_log_data_t *)&data[i];
-            encode_log_element(&list, log);
+        if (dec->synced && log->type == type) {
+            encode_log_element(&list, log, tlv);
         }
-        len = sizeof(esp_diag_log_data_t);
-        i += len;
-        size -= len ;
+        i += len + 1;
     }
     cbor_encoder_close_container(map, &list);
+}
+
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+/* Pre-encoded log record: the log type, the length of the element (2 bytes, little endian) and the element of
+ * the log list. The first byte of the records of the log hook always has its top bit set.
+ */
+#define LOG_PRE_ENCODED_HDR_SIZE    3
+
+static inline bool log_record_pre_encoded(uint8_t first)
+{
+    return !(first & 0x80);
+}
+
+size_t esp_insights_cbor_encode_log_record(const esp_diag_log_data_t *log, uint8_t *buf, size_t size)
+{
+    CborEncoder encoder;
+#ifdef CONFIG_DIAG_LOG_MSG_ARG_FORMAT_DEFERRED
+    /* Recorded by this firmware, the formats can be followed */
+    uint8_t tlv[CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE];
+#else
+    uint8_t *tlv = NULL;
+#endif
+    if (!log || !buf || size <= LOG_PRE_ENCODED_HDR_SIZE) {
+        return 0;
+    }
+    cbor_encoder_init(&encoder, buf + LOG_PRE_ENCODED_HDR_SIZE, size - LOG_PRE_ENCODED_HDR_SIZE, 0);
+    encode_log_element(&encoder, log, tlv);
+    if (cbor_encoder_get_extra_bytes_needed(&encoder)) {
+        return 0;
+    }
+    size_t len = cbor_encoder_get_buffer_size(&encoder, buf + LOG_PRE_ENCODED_HDR_SIZE);
+    buf[0] = log->type;
+    buf[1] = len;
+    buf[2] = len >> 8;
+    return LOG_PRE_ENCODED_HDR_SIZE + len;
+}
+
+/* Meta idx byte and header of the pre-encoded record at offset off, the data must hold them */
+static const uint8_t *log_pre_encoded_hdr_get(const esp_diag_data_store_span_t spans[2], size_t off,
+                                              uint8_t *type, uint16_t *len)
+{
+    const uint8_t *rec = spans_get(spans, off, 1 + LOG_PRE_ENCODED_HDR_SIZE, s_bounce_buf.log);
+    *type = rec[1];
+    *len = rec[2] | (rec[3] << 8);
+    return rec;
+}
+
+/* Pre-encoded records do not depend on each other, all the complete ones of the same boot are encoded */
+static size_t log_pre_encoded_complete(const esp_diag_data_store_span_t spans[2])
+{
+    uint8_t meta_idx = spans[0].data[0];
+    size_t size = spans_len(spans);
+    size_t i = 0;
+    uint8_t type;
+    uint16_t len;
+
+    while (i + 1 + LOG_PRE_ENCODED_HDR_SIZE <= size) {
+        const uint8_t *rec = log_pre_encoded_hdr_get(spans, i, &type, &len);
+        if (rec[0] != meta_idx || !log_record_pre_encoded(type)) {
+            break; // encoded with the next meta or by the log hook, next time
+        }
+        if (len > ESP_INSIGHTS_LOG_RECORD_MAX_SIZE - LOG_PRE_ENCODED_HDR_SIZE) {
+            // no way to find the next record, drop what cannot be parsed
+            return i ? i : size;
+        }
+        if (i + 1 + LOG_PRE_ENCODED_HDR_SIZE + len > size) {
+            break;
+        }
+        i += 1 + LOG_PRE_ENCODED_HDR_SIZE + len;
+    }
     return i;
 }
 
+/* The elements are copied as they are */
+static void encode_log_list_pre_encoded(CborEncoder *map, esp_diag_log_type_t type,
+                                        const char *key, const esp_diag_data_store_span_t spans[2], size_t size)
+{
+    size_t i = 0;
+    uint8_t rec_type;
+    uint16_t len;
+    CborEncoder list;
+    cbor_encode_text_stringz(map, key);
+    cbor_encoder_create_array(map, &list, CborIndefiniteLength);
+    while (i < size) {
+        log_pre_encoded_hdr_get(spans, i, &rec_type, &len);
+        if (rec_type == type) {
+            encode_raw(&list, spans_get(spans, i + 1 + LOG_PRE_ENCODED_HDR_SIZE, len, s_bounce_buf.pre_encoded_log),
+                       len);
+        }
+        i += 1 + LOG_PRE_ENCODED_HDR_SIZE + len;
+    }
+    cbor_encoder_close_container(map, &list);
+}
+#endif /* CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS */
+
+static const struct {
+    esp_diag_log_type_t type;
+    const char *key;
+} s_log_lists[] = {
+    { ESP_DIAG_LOG_TYPE_ERROR, "errors" },
+    { ESP_DIAG_LOG_TYPE_WARNING, "warnings" },
+    { ESP_DIAG_LOG_TYPE_EVENT, "events" },
+};
+
 /* The TinyCBOR library does not support DOM (Document Object Model)-like API.
  * So, we need to traverse through the entire data to encode every type of log.
  */
-size_t esp_insights_cbor_encode_diag_logs(const uint8_t *data, size_t size)
+size_t esp_insights_cbor_encode_diag_logs(const esp_diag_data_store_span_t spans[2], bool all_read)
 {
     CborEncoder log_map;
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+    /* The records left by a firmware without pre-encoding are encoded as before */
+    bool pre_encoded = spans_len(spans) > 1 && log_record_pre_encoded(*spans_get(spans, 1, 1, s_bounce_buf.log));
+    size_t consumed = pre_encoded ? log_pre_encoded_complete(spans) : log_records_complete(spans, all_read);
+#else
+    size_t consumed = log_records_complete(spans, all_read);
+#endif
+    if (!consumed) {
+        return 0;
+    }
     cbor_encode_text_stringz(&s_diag_data_map, "traces");
     cbor_encoder_create_map(&s_diag_data_map, &log_map, CborIndefiniteLength);
-    size_t consumed = 0, consumed_max = 0;
-    consumed_max = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_ERROR, "errors", data, size);
-    consumed = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_WARNING, "warnings", data, size);
-    if (consumed > consumed_max) {
-        consumed_max = consumed;
-    }
-    consumed = encode_log_list(&log_map, ESP_DIAG_LOG_TYPE_EVENT, "events", data, size);
-    if (consumed > consumed_max) {
-        consumed_max = consumed;
+    for (size_t i = 0; i < sizeof(s_log_lists) / sizeof(s_log_lists[0]); i++) {
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+        if (pre_encoded) {
+            encode_log_list_pre_encoded(&log_map, s_log_lists[i].type, s_log_lists[i].key, spans, consumed);
+            continue;
+        }
+#endif
+        encode_log_list(&log_map, s_log_lists[i].type, s_log_lists[i].key, spans, consumed);
     }
     cbor_encoder_close_container(&s_diag_data_map, &log_map);
-    return consumed_max;
+    return consumed;
+}
+
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+void esp_insights_cbor_encode_diag_trace(const esp_diag_trace_event_t *events, size_t count)
+{
+    CborEncoder list, element;
+    cbor_encode_text_stringz(&s_diag_data_map, "timeline");
+    cbor_encoder_create_array(&s_diag_data_map, &list, count);
+    for (size_t i = 0; i < count; i++) {
+        char phase[2] = { events[i].phase, '\0' };
+        cbor_encoder_create_map(&list, &element, 5);
+        cbor_encode_text_stringz(&element, "ts");
+        cbor_encode_uint(&element, events[i].ts);
+        cbor_encode_text_stringz(&element, "n");
+        cbor_encode_text_stringz(&element, events[i].name);
+        cbor_encode_text_stringz(&element, "ph");
+        cbor_encode_text_stringz(&element, phase);
+        cbor_encode_text_stringz(&element, "core");
+        cbor_encode_uint(&element, events[i].core);
+        cbor_encode_text_stringz(&element, "arg");
+        cbor_encode_uint(&element, events[i].arg);
+        cbor_encoder_close_container(&list, &element);
+    }
+    cbor_encoder_close_container(&s_diag_data_map, &list);
+}
+#endif /* CONFIG_ESP_INSIGHTS_TRACE_UPLOAD */
+
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+static void encode_child_record(const char *node_id, const uint8_t *data, size_t len, void *arg)
+{
+    CborEncoder *list = (CborEncoder *) arg;
+    CborEncoder element;
+    cbor_encoder_create_map(list, &element, 2);
+    cbor_encode_text_stringz(&element, "node_id");
+    cbor_encode_text_stringz(&element, node_id);
+    cbor_encode_text_stringz(&element, "data");
+    cbor_encode_byte_string(&element, data, len);
+    cbor_encoder_close_container(list, &element);
+}
+
+void esp_insights_cbor_encode_diag_children(void)
+{
+    CborEncoder list;
+    cbor_encode_text_stringz(&s_diag_data_map, "children");
+    cbor_encoder_create_array(&s_diag_data_map, &list, CborIndefiniteLength);
+    esp_insights_gateway_foreach_taken(encode_child_record, &list);
+    cbor_encoder_close_container(&s_diag_data_map, &list);
 }
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
 
 #if (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES)
+/* The data points are many and all alike, so each one is encoded by hand into a buffer
+ * and appended at once: the keys and the structure are the same bytes for every point,
+ * only the values are encoded. This is the same CBOR as with the tinycbor calls.
+ */
+#define CBOR_TEXT_STRING        0x60
+#define CBOR_BYTE_STRING        0x40
+#define CBOR_UINT               0x00
+#define CBOR_NEGATIVE_INT       0x20
+#define CBOR_FALSE              0xf4
+#define CBOR_TRUE               0xf5
+#define CBOR_FLOAT              0xfa
+#define CBOR_BREAK              0xff
+
+// {"n": ["M"|"P", <tag>, <key>], "v": ... or {"n": <key>, "v": ...
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+static const uint8_t s_pt_name_metrics[] = { 0xbf, 0x61, 'n', 0x9f, 0x61, 'M' };
+static const uint8_t s_pt_name_variables[] = { 0xbf, 0x61, 'n', 0x9f, 0x61, 'P' };
+static const uint8_t s_pt_value_key[] = { CBOR_BREAK, 0x61, 'v' };
+#else
+static const uint8_t s_pt_name[] = { 0xbf, 0x61, 'n' };
+static const uint8_t s_pt_value_key[] = { 0x61, 'v' };
+#endif
+static const uint8_t s_pt_ts_key[] = { 0x61, 't' };
+
+/* Largest point, a string one: name, tag and key, value key, value, timestamp key and timestamp, break */
+#define DATA_PT_MAX_ENCODED_SIZE    (6 + 2 * (2 + 16) + 3 + (2 + 32) + 2 + 9 + 1)
+
+static inline uint8_t *pt_put(uint8_t *p, const void *data, size_t len)
+{
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static uint8_t *pt_put_number(uint8_t *p, uint8_t major_type, uint64_t val)
+{
+    int len;
+    if (val < 24) {
+        *p++ = major_type | val;
+        return p;
+    } else if (val <= 0xff) {
+        *p++ = major_type | 24;
+        len = 1;
+    } else if (val <= 0xffff) {
+        *p++ = major_type | 25;
+        len = 2;
+    } else if (val <= 0xffffffff) {
+        *p++ = major_type | 26;
+        len = 4;
+    } else {
+        *p++ = major_type | 27;
+        len = 8;
+    }
+    while (len--) {
+        *p++ = val >> (8 * len);
+    }
+    return p;
+}
+
+static uint8_t *pt_put_string(uint8_t *p, uint8_t major_type, const void *str, size_t len)
+{
+    p = pt_put_number(p, major_type, len);
+    return pt_put(p, str, len);
+}
+
+static uint8_t *pt_put_name(uint8_t *p, uint16_t type, const char *tag, size_t tag_size,
+                            const char *key, size_t key_size)
+{
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    if ((type & 0xffff) == ESP_DIAG_DATA_PT_METRICS) {
+        p = pt_put(p, s_pt_name_metrics, sizeof(s_pt_name_metrics));
+    } else {
+        p = pt_put(p, s_pt_name_variables, sizeof(s_pt_name_variables));
+    }
+    p = pt_put_string(p, CBOR_TEXT_STRING, tag, strnlen(tag, tag_size));
+#else
+    p = pt_put(p, s_pt_name, sizeof(s_pt_name));
+#endif
+    p = pt_put_string(p, CBOR_TEXT_STRING, key, strnlen(key, key_size));
+    return pt_put(p, s_pt_value_key, sizeof(s_pt_value_key));
+}
+
+static uint8_t *pt_put_ts(uint8_t *p, uint64_t ts)
+{
+    p = pt_put(p, s_pt_ts_key, sizeof(s_pt_ts_key));
+    p = pt_put_number(p, CBOR_UINT, ts);
+    *p++ = CBOR_BREAK;
+    return p;
+}
+
 // {"n":<key>, "v": <value>, "t": <ts> }
 static void encode_str_data_pt(CborEncoder *array, const uint8_t *data)
 {
-    CborEncoder map;
-    cbor_encoder_create_map(array, &map, CborIndefiniteLength);
-    esp_diag_str_data_pt_t *m_data = &enc_scratch_buf.str_data_pt;
+    uint8_t encoded[DATA_PT_MAX_ENCODED_SIZE];
+    esp_diag_str_data_pt_t pt, *m_data = &pt;
     // copy at aligned address to avoid potential alignment issue
     memcpy(m_data, data, sizeof(esp_diag_str_data_pt_t));
-    cbor_encode_text_stringz(&map, "n");
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    char temp_path_key[10] = {0};
-    snprintf(temp_path_key, sizeof(temp_path_key), "%s", ((m_data->type & 0xffff)==ESP_DIAG_DATA_PT_METRICS)?METRICS_PATH_VALUE:VARIABLES_PATH_VALUE);
-    CborEncoder key_arr;
-    cbor_encoder_create_array(&map, &key_arr, CborIndefiniteLength);
-    cbor_encode_text_stringz(&key_arr, temp_path_key);
-    cbor_encode_text_stringz(&key_arr, m_data->tag);
-    cbor_encode_text_stringz(&key_arr, m_data->key);
-    cbor_encoder_close_container(&map, &key_arr);
+    uint8_t *p = pt_put_name(encoded, m_data->type, m_data->tag, sizeof(m_data->tag),
+                             m_data->key, sizeof(m_data->key));
 #else
-    cbor_encode_text_stringz(&map, m_data->key);
+    uint8_t *p = pt_put_name(encoded, m_data->type, NULL, 0, m_data->key, sizeof(m_data->key));
 #endif
-    cbor_encode_text_stringz(&map, "v");
-    cbor_encode_text_stringz(&map, m_data->value.str);
-    cbor_encode_text_stringz(&map, "t");
-    cbor_encode_uint(&map, m_data->ts);
+    p = pt_put_string(p, CBOR_TEXT_STRING, m_data->value.str, strnlen(m_data->value.str, sizeof(m_data->value.str)));
+    p = pt_put_ts(p, m_data->ts);
+    encode_raw(array, encoded, p - encoded);
+}
 
-    cbor_encoder_close_container(array, &map);
+#if CONFIG_DIAG_ENABLE_METRICS
+static void encode_int64(CborEncoder *map, int64_t i)
+{
+    if (i < 0) {
+        cbor_encode_negative_int(map, -i);
+    } else {
+        cbor_encode_int(map, i);
+    }
 }
 
-static void encode_data_pt(CborEncoder *array, const uint8_t *data)
+// {"n":<key>, "v": <mean>, "t": <ts>, "st": <ts_start>, "cnt": <count>, "min": <min>, "max": <max>, "sum": <sum> }
+static void encode_aggr_data_pt(CborEncoder *array, const uint8_t *data)
 {
     CborEncoder map;
     cbor_encoder_create_map(array, &map, CborIndefiniteLength);
-    esp_diag_data_pt_t *m_data = &enc_scratch_buf.data_pt;
+    esp_diag_aggr_data_pt_t pt, *m_data = &pt;
     // copy at aligned address to avoid potential alignment issue
-    memcpy(m_data, data, sizeof(esp_diag_data_pt_t));
+    memcpy(m_data, data, sizeof(esp_diag_aggr_data_pt_t));
+    if (!m_data->count) {
+        m_data->count = 1; // not recorded empty, but do not divide by zero on a corrupted record
+    }
     cbor_encode_text_stringz(&map, "n");
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
-    char temp_path_key[10] = {0};
-    snprintf(temp_path_key, sizeof(temp_path_key), "%s", ((m_data->type & 0xffff)==ESP_DIAG_DATA_PT_METRICS)?METRICS_PATH_VALUE:VARIABLES_PATH_VALUE);
     CborEncoder key_arr;
     cbor_encoder_create_array(&map, &key_arr, CborIndefiniteLength);
-    cbor_encode_text_stringz(&key_arr, temp_path_key);
+    cbor_encode_text_stringz(&key_arr, METRICS_PATH_VALUE);
     cbor_encode_text_stringz(&key_arr, m_data->tag);
     cbor_encode_text_stringz(&key_arr, m_data->key);
     cbor_encoder_close_container(&map, &key_arr);
 #else
     cbor_encode_text_stringz(&map, m_data->key);
 #endif
+    // "v" holds the mean, so that the summary also reads as a plain data point
     cbor_encode_text_stringz(&map, "v");
+    switch (m_data->data_type) {
+        case ESP_DIAG_DATA_TYPE_INT:
+            encode_int64(&map, m_data->sum.i / (int64_t) m_data->count);
+            break;
+        case ESP_DIAG_DATA_TYPE_UINT:
+            cbor_encode_uint(&map, m_data->sum.u / m_data->count);
+            break;
+        default:
+            cbor_encode_float(&map, (float) (m_data->sum.f / m_data->count));
+            break;
+    }
+    cbor_encode_text_stringz(&map, "t");
+    cbor_encode_uint(&map, m_data->ts);
+    cbor_encode_text_stringz(&map, "st");
+    cbor_encode_uint(&map, m_data->ts_start);
+    cbor_encode_text_stringz(&map, "cnt");
+    cbor_encode_uint(&map, m_data->count);
+    switch (m_data->data_type) {
+        case ESP_DIAG_DATA_TYPE_INT:
+            cbor_encode_text_stringz(&map, "min");
+            encode_int64(&map, m_data->min.i);
+            cbor_encode_text_stringz(&map, "max");
+            encode_int64(&map, m_data->max.i);
+            cbor_encode_text_stringz(&map, "sum");
+            encode_int64(&map, m_data->sum.i);
+            break;
+        case ESP_DIAG_DATA_TYPE_UINT:
+            cbor_encode_text_stringz(&map, "min");
+            cbor_encode_uint(&map, m_data->min.u);
+            cbor_encode_text_stringz(&map, "max");
+            cbor_encode_uint(&map, m_data->max.u);
+            cbor_encode_text_stringz(&map, "sum");
+            cbor_encode_uint(&map, m_data->sum.u);
+            break;
+        default:
+            cbor_encode_text_stringz(&map, "min");
+            cbor_encode_float(&map, m_data->min.f);
+            cbor_encode_text_stringz(&map, "max");
+            cbor_encode_float(&map, m_data->max.f);
+            cbor_encode_text_stringz(&map, "sum");
+            cbor_encode_double(&map, m_data->sum.f);
+            break;
+    }
+
+    cbor_encoder_close_container(array, &map);
+}
+#endif /* CONFIG_DIAG_ENABLE_METRICS */
+
+static uint8_t *pt_put_value(uint8_t *p, const esp_diag_data_pt_t *m_data)
+{
     switch (m_data->data_type) {
         case ESP_DIAG_DATA_TYPE_BOOL:
-            cbor_encode_boolean(&map, m_data->value.b);
+            *p++ = m_data->value.b ? CBOR_TRUE : CBOR_FALSE;
             break;
         case ESP_DIAG_DATA_TYPE_INT:
             if (m_data->value.i < 0) {
-                cbor_encode_negative_int(&map, -(m_data->value.i));
+                p = pt_put_number(p, CBOR_NEGATIVE_INT, -(int64_t) m_data->value.i - 1);
             } else {
-                cbor_encode_int(&map, m_data->value.i);
+                p = pt_put_number(p, CBOR_UINT, m_data->value.i);
             }
             break;
         case ESP_DIAG_DATA_TYPE_UINT:
-            cbor_encode_uint(&map, m_data->value.u);
+            p = pt_put_number(p, CBOR_UINT, m_data->value.u);
             break;
-        case ESP_DIAG_DATA_TYPE_FLOAT:
-            cbor_encode_float(&map, m_data->value.f);
+        case ESP_DIAG_DATA_TYPE_FLOAT: {
+            uint32_t bits;
+            memcpy(&bits, &m_data->value.f, sizeof(bits));
+            *p++ = CBOR_FLOAT;
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                *p++ = bits >> shift;
+            }
             break;
+        }
         case ESP_DIAG_DATA_TYPE_IPv4:
-            cbor_encode_byte_string(&map, (uint8_t *)&m_data->value.ipv4, sizeof(m_data->value.ipv4));
+            p = pt_put_string(p, CBOR_BYTE_STRING, &m_data->value.ipv4, sizeof(m_data->value.ipv4));
             break;
         case ESP_DIAG_DATA_TYPE_MAC:
-            cbor_encode_byte_string(&map, &m_data->value.mac[0], sizeof(m_data->value.mac));
+            p = pt_put_string(p, CBOR_BYTE_STRING, m_data->value.mac, sizeof(m_data->value.mac));
             break;
         default:
             break;
     }
-    cbor_encode_text_stringz(&map, "t");
-    cbor_encode_uint(&map, m_data->ts);
+    return p;
+}
 
-    cbor_encoder_close_container(array, &map);
+static uint8_t *pt_put_data_pt_name(uint8_t *p, const esp_diag_data_pt_t *m_data)
+{
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+    return pt_put_name(p, m_data->type, m_data->tag, sizeof(m_data->tag), m_data->key, sizeof(m_data->key));
+#else
+    return pt_put_name(p, m_data->type, NULL, 0, m_data->key, sizeof(m_data->key));
+#endif
 }
 
-static size_t encode_data_points(const uint8_t *data, size_t size, const char *key, uint16_t type)
+static void encode_data_pt(CborEncoder *array, const uint8_t *data)
 {
-    assert(key);
-    size_t i = 0;
-    CborEncoder array;
-    /* FIXME */
-    rtc_store_non_critical_data_hdr_t header;
-    esp_diag_data_type_t data_type;
+    uint8_t encoded[DATA_PT_MAX_ENCODED_SIZE];
+    esp_diag_data_pt_t pt, *m_data = &pt;
+    // copy at aligned address to avoid potential alignment issue
+    memcpy(m_data, data, sizeof(esp_diag_data_pt_t));
+    uint8_t *p = pt_put_data_pt_name(encoded, m_data);
+    p = pt_put_value(p, m_data);
+    p = pt_put_ts(p, m_data->ts);
+    encode_raw(array, encoded, p - encoded);
+}
 
-    if (!data || (size <= sizeof(header))) {
-        printf("%s: Invalid arg! data %p, size %d. line %d\n",
-                "insights_cbor_enocoder", data, size, __LINE__);
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+/* The points which can be in a series of encode_data_pt_series() */
+static bool data_pt_series_eligible(uint16_t type, uint16_t data_type, size_t len)
+{
+    return type == ESP_DIAG_DATA_PT_METRICS && len == sizeof(esp_diag_data_pt_t) &&
+           (data_type == ESP_DIAG_DATA_TYPE_BOOL || data_type == ESP_DIAG_DATA_TYPE_INT ||
+            data_type == ESP_DIAG_DATA_TYPE_UINT || data_type == ESP_DIAG_DATA_TYPE_FLOAT);
+}
+
+#endif /* CONFIG_ESP_INSIGHTS_METRICS_SERIES */
+
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+/* Pre-encoded data point record: the type of the point, DATA_PT_PRE_ENCODED as its data type, and the element
+ * of the data point list. No data point struct has this data type.
+ */
+#define DATA_PT_PRE_ENCODED             0xffffU
+#define DATA_PT_PRE_ENCODED_HDR_SIZE    4
+
+size_t esp_insights_cbor_encode_data_pt_record(const void *data, size_t len, uint8_t *buf, size_t size)
+{
+    CborEncoder encoder;
+    uint32_t type_int;
+    if (!data || len < sizeof(type_int) || !buf || size <= DATA_PT_PRE_ENCODED_HDR_SIZE) {
         return 0;
     }
-    cbor_encode_text_stringz(&s_diag_data_map, key);
-    cbor_encoder_create_array(&s_diag_data_map, &array, CborIndefiniteLength);
+    memcpy(&type_int, data, sizeof(type_int));
+    uint16_t type = type_int & 0xffff;
+    uint16_t data_type = (type_int >> 16) & 0xffff;
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+    // kept as they are, to be grouped into series when uploaded
+    if (data_pt_series_eligible(type, data_type, len)) {
+        return 0;
+    }
+#endif
+    cbor_encoder_init(&encoder, buf + DATA_PT_PRE_ENCODED_HDR_SIZE, size - DATA_PT_PRE_ENCODED_HDR_SIZE, 0);
+    // same choice as encode_data_points()
+    if (data_type == ESP_DIAG_DATA_TYPE_STR && len == sizeof(esp_diag_str_data_pt_t)) {
+        encode_str_data_pt(&encoder, data);
+#if CONFIG_DIAG_ENABLE_METRICS
+    } else if (type == ESP_DIAG_DATA_PT_METRICS && len == sizeof(esp_diag_aggr_data_pt_t)) {
+        encode_aggr_data_pt(&encoder, data);
+#endif
+    } else if (len == sizeof(esp_diag_data_pt_t)) {
+        encode_data_pt(&encoder, data);
+    } else {
+        return 0;
+    }
+    if (cbor_encoder_get_extra_bytes_needed(&encoder)) {
+        return 0;
+    }
+    type_int = type | (DATA_PT_PRE_ENCODED << 16);
+    memcpy(buf, &type_int, sizeof(type_int));
+    return DATA_PT_PRE_ENCODED_HDR_SIZE + cbor_encoder_get_buffer_size(&encoder, buf + DATA_PT_PRE_ENCODED_HDR_SIZE);
+}
+#endif /* CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS */
+
+/* Called by data_points_foreach() for each complete record of the type */
+typedef void (*data_pt_cb_t)(const uint8_t *pt, uint16_t len, uint16_t type, uint16_t data_type, void *arg);
+
+/* Walks the records of the first meta idx, returns the bytes of the records walked */
+static size_t data_points_foreach(const esp_diag_data_store_span_t spans[2], uint16_t type, data_pt_cb_t cb, void *arg)
+{
+    size_t i = 0;
+    size_t size = spans_len(spans);
+    const uint8_t *data = spans[0].data;
+    /* FIXME */
+    rtc_store_non_critical_data_hdr_t header;
 
     uint8_t meta_idx = data[0];
+    uint8_t *bounce = (uint8_t *) &s_bounce_buf;
     while (size > sizeof(header)) { // if remaining
-        if (data[i] != meta_idx) {
+        const uint8_t *rec = spans_get(spans, i, 1 + sizeof(header), bounce);
+        if (rec[0] != meta_idx) {
 #if INSIGHTS_DEBUG_ENABLED
             printf("%s: skip data for next iteration meta: %d, data[i]: %d, itr: %d\n",
-                    "insights_cbor_enocoder", meta_idx, data[i], i);
+                    "insights_cbor_enocoder", meta_idx, rec[0], i);
 #endif
             break; // do not encode for next meta info
         }
         i += 1; // skip meta_idx byte
         size -= 1;
 
-        memcpy(&header, data + i, sizeof(header));
+        memcpy(&header, rec + 1, sizeof(header));
         if (sizeof(header) + header.len > size) {
 #if INSIGHTS_DEBUG_ENABLED
             // partial record
@@ -633,49 +1186,342 @@ static size_t encode_data_points(const uint8_t *data, size_t size, const char *k
             // invalid record
             printf("%s: invalid record, header.len %d\n", "insights_cbor_enocoder", header.len);
 
-            ESP_LOG_BUFFER_HEX_LEVEL("cbor_enc", data, size, ESP_LOG_INFO);
+            ESP_LOG_BUFFER_HEX_LEVEL("cbor_enc", rec, 1 + sizeof(header), ESP_LOG_INFO);
 #endif
             i -= 1;
             size += 1;
             break;
         }
-        uint32_t type_int;
-        memcpy(&type_int, &data[i + sizeof(header)], 4); // copy, (b'cos alignment!)
-        if ((type_int & 0xffff) == type) {
-            data_type = (type_int >> 16) & 0xffff;
-            if (data_type == ESP_DIAG_DATA_TYPE_STR && header.len == sizeof(esp_diag_str_data_pt_t)) {
-                encode_str_data_pt(&array, data + i + sizeof(header));
-            } else if (header.len == sizeof(esp_diag_data_pt_t)) {
-                encode_data_pt(&array, data + i + sizeof(header));
+        // only the records of known length are read, which fit the bounce buffer
+        if (header.len == sizeof(esp_diag_str_data_pt_t) ||
+#if CONFIG_DIAG_ENABLE_METRICS
+            header.len == sizeof(esp_diag_aggr_data_pt_t) ||
+#endif
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+            (header.len > DATA_PT_PRE_ENCODED_HDR_SIZE && header.len <= ESP_INSIGHTS_DATA_PT_RECORD_MAX_SIZE) ||
+#endif
+            header.len == sizeof(esp_diag_data_pt_t)) {
+            const uint8_t *pt = spans_get(spans, i + sizeof(header), header.len, bounce);
+            uint32_t type_int;
+            memcpy(&type_int, pt, 4); // copy, (b'cos alignment!)
+            if ((type_int & 0xffff) == type) {
+                cb(pt, header.len, type, (type_int >> 16) & 0xffff, arg);
             }
         }
         size -= (sizeof(header) + header.len);
         i += (sizeof(header) + header.len);
     }
-    cbor_encoder_close_container(&s_diag_data_map, &array);
     return i;
 }
+
+static void encode_data_pt_cb(const uint8_t *pt, uint16_t len, uint16_t type, uint16_t data_type, void *arg)
+{
+    CborEncoder *array = arg;
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+    if (data_type == DATA_PT_PRE_ENCODED) {
+        encode_raw(array, pt + DATA_PT_PRE_ENCODED_HDR_SIZE, len - DATA_PT_PRE_ENCODED_HDR_SIZE);
+    } else
+#endif
+    if (data_type == ESP_DIAG_DATA_TYPE_STR && len == sizeof(esp_diag_str_data_pt_t)) {
+        encode_str_data_pt(array, pt);
+#if CONFIG_DIAG_ENABLE_METRICS
+    } else if (type == ESP_DIAG_DATA_PT_METRICS && len == sizeof(esp_diag_aggr_data_pt_t)) {
+        encode_aggr_data_pt(array, pt);
+#endif
+    } else if (len == sizeof(esp_diag_data_pt_t)) {
+        encode_data_pt(array, pt);
+    }
+}
+
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+/* Series of the points of one metrics:
+ *   {"n": <name>, "v": <first value>, "t": <first ts>, "c": <count>, "dt": <bytes>, "dv": <bytes>}
+ * "dt" has the varints of the zigzag encoded delta of delta of the timestamps of the other points, the first
+ * one being the delta to the first ts. Periodic metrics take one byte per point.
+ * "dv" has the varints of the zigzag encoded delta of the values for bool, int and uint metrics, and of the
+ * xor of the bits with the previous value for float ones. Unchanged values take one byte per point.
+ */
+#define SERIES_VARINT_MAX_SIZE  10
+#define SERIES_CHUNK_SIZE       64
+
+typedef struct {
+    esp_diag_data_pt_t first;
+    /* Previous point of the walk */
+    uint32_t count;
+    uint64_t prev_ts;
+    int64_t prev_dts;
+    uint64_t prev_value;
+    size_t dt_len;
+    size_t dv_len;
+} data_pt_series_t;
+
+static data_pt_series_t s_series[CONFIG_ESP_INSIGHTS_METRICS_SERIES_MAX];
+static size_t s_series_count;
+
+typedef struct {
+    CborEncoder *array;
+    data_pt_series_t *series;   /* The one emitted, NULL for the points left */
+    bool values;                /* Emits "dv", "dt" otherwise */
+    size_t len;
+    uint8_t chunk[SERIES_CHUNK_SIZE];
+} data_pt_series_walk_t;
+
+static const uint8_t s_series_count_key[] = { 0x61, 'c' };
+static const uint8_t s_series_dt_key[] = { 0x62, 'd', 't' };
+static const uint8_t s_series_dv_key[] = { 0x62, 'd', 'v' };
+
+static inline uint64_t zigzag(int64_t val)
+{
+    return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+static size_t varint_put(uint8_t *p, uint64_t val)
+{
+    size_t len = 0;
+    while (val >= 0x80) {
+        p[len++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    p[len++] = val;
+    return len;
+}
+
+static uint64_t data_pt_series_value(const esp_diag_data_pt_t *pt)
+{
+    switch (pt->data_type) {
+        case ESP_DIAG_DATA_TYPE_BOOL:
+            return pt->value.b ? 1 : 0;
+        case ESP_DIAG_DATA_TYPE_INT:
+            return (uint64_t) (int64_t) pt->value.i;
+        case ESP_DIAG_DATA_TYPE_UINT:
+            return pt->value.u;
+        default: {
+            uint32_t bits;
+            memcpy(&bits, &pt->value.f, sizeof(bits));
+            return bits;
+        }
+    }
+}
+
+static bool data_pt_series_match(const data_pt_series_t *series, const esp_diag_data_pt_t *pt)
+{
+    return series->first.data_type == pt->data_type &&
+#ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
+           strncmp(series->first.tag, pt->tag, sizeof(pt->tag)) == 0 &&
+#endif
+           strncmp(series->first.key, pt->key, sizeof(pt->key)) == 0;
+}
+
+static data_pt_series_t *data_pt_series_find(const esp_diag_data_pt_t *pt)
+{
+    for (size_t i = 0; i < s_series_count; i++) {
+        if (data_pt_series_match(&s_series[i], pt)) {
+            return &s_series[i];
+        }
+    }
+    return NULL;
+}
+
+static void data_pt_series_rewind(data_pt_series_t *series)
+{
+    series->count = 0;
+    series->prev_dts = 0;
+}
+
+/* Adds the point to the walk of the series, dt and dv get its varints, none for the first point */
+static void data_pt_series_step(data_pt_series_t *series, const esp_diag_data_pt_t *pt,
+                                uint8_t *dt, size_t *dt_len, uint8_t *dv, size_t *dv_len)
+{
+    uint64_t value = data_pt_series_value(pt);
+    *dt_len = 0;
+    *dv_len = 0;
+    if (series->count) {
+        int64_t dts = (int64_t) (pt->ts - series->prev_ts);
+        *dt_len = varint_put(dt, zigzag(dts - series->prev_dts));
+        series->prev_dts = dts;
+        if (pt->data_type == ESP_DIAG_DATA_TYPE_FLOAT) {
+            *dv_len = varint_put(dv, value ^ series->prev_value);
+        } else {
+            *dv_len = varint_put(dv, zigzag((int64_t) (value - series->prev_value)));
+        }
+    }
+    series->count++;
+    series->prev_ts = pt->ts;
+    series->prev_value = value;
+}
+
+static void data_pt_series_collect_cb(const uint8_t *data, uint16_t len, uint16_t type, uint16_t data_type,
+                                      void *arg)
+{
+    uint8_t dt[SERIES_VARINT_MAX_SIZE], dv[SERIES_VARINT_MAX_SIZE];
+    size_t dt_len, dv_len;
+    esp_diag_data_pt_t pt;
+    if (!data_pt_series_eligible(type, data_type, len)) {
+        return;
+    }
+    memcpy(&pt, data, sizeof(pt));
+    data_pt_series_t *series = data_pt_series_find(&pt);
+    if (!series) {
+        if (s_series_count >= CONFIG_ESP_INSIGHTS_METRICS_SERIES_MAX) {
+            return; // sent as a data point
+        }
+        series = &s_series[s_series_count++];
+        memset(series, 0, sizeof(*series));
+        series->first = pt;
+    }
+    data_pt_series_step(series, &pt, dt, &dt_len, dv, &dv_len);
+    series->dt_len += dt_len;
+    series->dv_len += dv_len;
+}
+
+static void data_pt_series_emit_cb(const uint8_t *data, uint16_t len, uint16_t type, uint16_t data_type, void *arg)
+{
+    data_pt_series_walk_t *walk = arg;
+    uint8_t dt[SERIES_VARINT_MAX_SIZE], dv[SERIES_VARINT_MAX_SIZE];
+    size_t dt_len, dv_len;
+    esp_diag_data_pt_t pt;
+    if (!data_pt_series_eligible(type, data_type, len)) {
+        return;
+    }
+    memcpy(&pt, data, sizeof(pt));
+    if (!data_pt_series_match(walk->series, &pt)) {
+        return;
+    }
+    data_pt_series_step(walk->series, &pt, dt, &dt_len, dv, &dv_len);
+    if (walk->len + SERIES_VARINT_MAX_SIZE > sizeof(walk->chunk)) {
+        encode_raw(walk->array, walk->chunk, walk->len);
+        walk->len = 0;
+    }
+    if (walk->values) {
+        memcpy(walk->chunk + walk->len, dv, dv_len);
+        walk->len += dv_len;
+    } else {
+        memcpy(walk->chunk + walk->len, dt, dt_len);
+        walk->len += dt_len;
+    }
+}
+
+static void data_pt_series_rest_cb(const uint8_t *data, uint16_t len, uint16_t type, uint16_t data_type, void *arg)
+{
+    if (data_pt_series_eligible(type, data_type, len)) {
+        esp_diag_data_pt_t pt;
+        memcpy(&pt, data, sizeof(pt));
+        data_pt_series_t *series = data_pt_series_find(&pt);
+        if (series && series->count > 1) {
+            return; // in the series
+        }
+    }
+    encode_data_pt_cb(data, len, type, data_type, arg);
+}
+
+/* Walks the records once to find the series, twice for each series to emit its columns, and once to encode
+ * the points which are not in a series. The columns are written as they are walked, without a buffer.
+ */
+static size_t encode_data_pt_series(CborEncoder *array, const esp_diag_data_store_span_t spans[2], uint16_t type)
+{
+    static data_pt_series_walk_t walk;
+    uint8_t encoded[DATA_PT_MAX_ENCODED_SIZE + sizeof(s_series_count_key) + 5 + sizeof(s_series_dt_key) + 9];
+
+    s_series_count = 0;
+    size_t consumed = data_points_foreach(spans, type, data_pt_series_collect_cb, NULL);
+    walk.array = array;
+    for (size_t i = 0; i < s_series_count; i++) {
+        data_pt_series_t *series = &s_series[i];
+        if (series->count < 2) {
+            continue;
+        }
+        uint8_t *p = pt_put_data_pt_name(encoded, &series->first);
+        p = pt_put_value(p, &series->first);
+        p = pt_put(p, s_pt_ts_key, sizeof(s_pt_ts_key));
+        p = pt_put_number(p, CBOR_UINT, series->first.ts);
+        p = pt_put(p, s_series_count_key, sizeof(s_series_count_key));
+        p = pt_put_number(p, CBOR_UINT, series->count);
+        walk.series = series;
+        for (int values = 0; values < 2; values++) {
+            if (values) {
+                p = pt_put(p, s_series_dv_key, sizeof(s_series_dv_key));
+            } else {
+                p = pt_put(p, s_series_dt_key, sizeof(s_series_dt_key));
+            }
+            p = pt_put_number(p, CBOR_BYTE_STRING, values ? series->dv_len : series->dt_len);
+            encode_raw(array, encoded, p - encoded);
+            p = encoded;
+            walk.values = values;
+            walk.len = 0;
+            data_pt_series_rewind(series);
+            data_points_foreach(spans, type, data_pt_series_emit_cb, &walk);
+            encode_raw(array, walk.chunk, walk.len);
+        }
+        *p++ = CBOR_BREAK;
+        encode_raw(array, encoded, p - encoded);
+    }
+    data_points_foreach(spans, type, data_pt_series_rest_cb, array);
+    return consumed;
+}
+#endif /* CONFIG_ESP_INSIGHTS_METRICS_SERIES */
+
+static size_t encode_data_points(const esp_diag_data_store_span_t spans[2], const char *key, uint16_t type,
+                                 bool series)
+{
+    assert(key);
+    size_t size = spans_len(spans);
+    const uint8_t *data = spans[0].data;
+    CborEncoder array;
+    size_t consumed;
+
+    if (!data || (size <= sizeof(rtc_store_non_critical_data_hdr_t))) {
+        printf("%s: Invalid arg! data %p, size %d. line %d\n",
+                "insights_cbor_enocoder", data, size, __LINE__);
+        return 0;
+    }
+    cbor_encode_text_stringz(&s_diag_data_map, key);
+    cbor_encoder_create_array(&s_diag_data_map, &array, CborIndefiniteLength);
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+    if (series) {
+        consumed = encode_data_pt_series(&array, spans, type);
+    } else
+#endif
+    {
+        consumed = data_points_foreach(spans, type, encode_data_pt_cb, &array);
+    }
+    cbor_encoder_close_container(&s_diag_data_map, &array);
+    return consumed;
+}
 #endif /* (CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES) */
 
 #if CONFIG_DIAG_ENABLE_METRICS
-size_t esp_insights_cbor_encode_diag_metrics(const uint8_t *data, size_t size)
+size_t esp_insights_cbor_encode_diag_metrics(const esp_diag_data_store_span_t spans[2], bool series)
 {
-    return encode_data_points(data, size, "metrics", ESP_DIAG_DATA_PT_METRICS);
+    return encode_data_points(spans, "metrics", ESP_DIAG_DATA_PT_METRICS, series);
 }
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
 
 #if CONFIG_DIAG_ENABLE_VARIABLES
-size_t  esp_insights_cbor_encode_diag_variables(const uint8_t *data, size_t size)
+size_t  esp_insights_cbor_encode_diag_variables(const esp_diag_data_store_span_t spans[2])
 {
-    return encode_data_points(data, size, "params", ESP_DIAG_DATA_PT_VARIABLE);
+    return encode_data_points(spans, "params", ESP_DIAG_DATA_PT_VARIABLE, false);
 }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
 
 /* Below are the helpers to encode esp insights meta data */
 
+static void encode_meta_begin(const char *version, const char *sha256, uint64_t ts);
+
 void esp_insights_cbor_encode_meta_begin(void *data, size_t data_size, const char *version, const char *sha256)
 {
     cbor_encoder_init(&s_meta_encoder, data, data_size, 0);
+    encode_meta_begin(version, sha256, esp_diag_timestamp_get());
+}
+
+void esp_insights_cbor_encode_meta_begin_writer(CborEncoderWriteFunction writer, void *token,
+                                                const char *version, const char *sha256, uint64_t ts)
+{
+    cbor_encoder_init_writer(&s_meta_encoder, writer, token);
+    encode_meta_begin(version, sha256, ts);
+}
+
+static void encode_meta_begin(const char *version, const char *sha256, uint64_t ts)
+{
     cbor_encoder_create_map(&s_meta_encoder, &s_meta_result_map, 1);
     cbor_encode_text_stringz(&s_meta_result_map, "diagmeta");
     cbor_encoder_create_map(&s_meta_result_map, &s_diag_meta_map, CborIndefiniteLength);
@@ -684,7 +1530,7 @@ void esp_insights_cbor_encode_meta_begin(void *data, size_t data_size, const cha
     cbor_encode_text_stringz(&s_diag_meta_map, version);
 
     cbor_encode_text_stringz(&s_diag_meta_map, "ts");
-    cbor_encode_uint(&s_diag_meta_map, esp_diag_timestamp_get()); 
+    cbor_encode_uint(&s_diag_meta_map, ts);
     cbor_encode_text_stringz(&s_diag_meta_map, "sha256");
     cbor_encode_text_stringz(&s_diag_meta_map, sha256);
 }
@@ -693,8 +1539,43 @@ size_t esp_insights_cbor_encode_meta_end(void *data)
 {
     cbor_encoder_close_container(&s_meta_result_map, &s_diag_meta_map);
     cbor_encoder_close_container(&s_meta_encoder, &s_meta_result_map);
-    return cbor_encoder_get_buffer_size(&s_meta_encoder, data);
+    return data ? cbor_encoder_get_buffer_size(&s_meta_encoder, data) : 0;
+}
+
+void esp_insights_cbor_encode_meta_compression(const char *alg, uint8_t msg_type,
+                                               uint8_t window_sz2, uint8_t lookahead_sz2)
+{
+    CborEncoder comp_map;
+    cbor_encode_text_stringz(&s_diag_meta_map, "compression");
+    cbor_encoder_create_map(&s_diag_meta_map, &comp_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&comp_map, "alg");
+    cbor_encode_text_stringz(&comp_map, alg);
+    cbor_encode_text_stringz(&comp_map, "type");
+    cbor_encode_uint(&comp_map, msg_type);
+    cbor_encode_text_stringz(&comp_map, "window_sz2");
+    cbor_encode_uint(&comp_map, window_sz2);
+    cbor_encode_text_stringz(&comp_map, "lookahead_sz2");
+    cbor_encode_uint(&comp_map, lookahead_sz2);
+    cbor_encoder_close_container(&s_diag_meta_map, &comp_map);
+}
+
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+void esp_insights_cbor_encode_meta_series(void)
+{
+    CborEncoder series_map;
+    cbor_encode_text_stringz(&s_diag_meta_map, "series");
+    cbor_encoder_create_map(&s_diag_meta_map, &series_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&series_map, "ver");
+    cbor_encode_uint(&series_map, ESP_INSIGHTS_METRICS_SERIES_VERSION);
+    cbor_encode_text_stringz(&series_map, "ts");
+    cbor_encode_text_stringz(&series_map, "dod");
+    cbor_encode_text_stringz(&series_map, "int");
+    cbor_encode_text_stringz(&series_map, "delta");
+    cbor_encode_text_stringz(&series_map, "float");
+    cbor_encode_text_stringz(&series_map, "xor");
+    cbor_encoder_close_container(&s_diag_meta_map, &series_map);
 }
+#endif /* CONFIG_ESP_INSIGHTS_METRICS_SERIES */
 
 void esp_insights_cbor_encode_meta_data_begin(void)
 {
@@ -13,6 +13,9 @@
 #include <esp_core_dump.h>
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
 #include <rtc_store.h>
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+#include <esp_diagnostics_trace.h>
+#endif
 
 // make tag/group as a outer key and actual keys from it are contained within
 #ifndef CONFIG_ESP_INSIGHTS_META_VERSION_10
@@ -43,6 +46,19 @@ typedef void (*insights_cbor_encoder_cb_t) (CborEncoder *map, insights_msg_type_
 esp_err_t esp_insights_cbor_encoder_register_meta_cb(insights_cbor_encoder_cb_t cb);
 
 void esp_insights_cbor_encode_diag_begin(void *data, size_t data_size, const char *version);
+
+/**
+ * @brief start encoding diag data through a writer instead of a buffer
+ *
+ * @param writer function the encoded bytes are passed to
+ * @param token  argument of the writer
+ * @param version diag data version
+ * @param ts     timestamp of the message, encoding the same message again must give the same bytes
+ *
+ * @note esp_insights_cbor_encode_diag_end() must be called with NULL, it returns 0 in this case
+ */
+void esp_insights_cbor_encode_diag_begin_writer(CborEncoderWriteFunction writer, void *token,
+                                                const char *version, uint64_t ts);
 void esp_insights_cbor_encode_diag_data_begin(void);
 void esp_insights_cbor_encode_diag_boot_info(esp_diag_device_info_t *device_info);
 
@@ -56,17 +72,95 @@ void esp_insights_cbor_encode_meta_c_hdr(const rtc_store_meta_header_t *hdr);
 void esp_insights_cbor_encode_meta_nc_hdr(const rtc_store_meta_header_t *hdr);
 
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
-void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary);
+/**
+ * @brief encode the core dump summary
+ *
+ * @param summary core dump summary
+ * @param sig     signature of the crash, a hash of its PCs, not encoded if count is 0
+ * @param count   crashes with this signature in the current window, 0 if not counted
+ * @param full    encode the backtrace and the registers, which were already sent for this signature otherwise
+ */
+void esp_insights_cbor_encode_diag_crash(esp_core_dump_summary_t *summary, uint32_t sig, uint32_t count, bool full);
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
-size_t esp_insights_cbor_encode_diag_logs(const uint8_t *data, size_t size);
-size_t esp_insights_cbor_encode_diag_metrics(const uint8_t *data, size_t size);
-size_t esp_insights_cbor_encode_diag_variables(const uint8_t *data, size_t size);
+size_t esp_insights_cbor_encode_diag_logs(const esp_diag_data_store_span_t spans[2], bool all_read);
+/**
+ * @brief encode the metrics of the non critical data
+ *
+ * @param spans  non critical data
+ * @param series group the points of each numeric metrics into a series, as advertised by
+ *               esp_insights_cbor_encode_meta_series(), instead of encoding each point
+ * @return size_t length of data consumed
+ */
+size_t esp_insights_cbor_encode_diag_metrics(const esp_diag_data_store_span_t spans[2], bool series);
+size_t esp_insights_cbor_encode_diag_variables(const esp_diag_data_store_span_t spans[2]);
+
+#if CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS
+/* Largest pre-encoded log record: its header, then the keys and values of the log with the longest tag, task name
+ * and arguments, which take at most two bytes more in CBOR than in TLV */
+#define ESP_INSIGHTS_LOG_RECORD_MAX_SIZE        (3 + 96 + 2 * ESP_DIAG_LOG_STR_SIZE + CONFIG_DIAG_LOG_MSG_ARG_MAX_SIZE)
+/* Largest pre-encoded data point record, an aggregated metrics one */
+#define ESP_INSIGHTS_DATA_PT_RECORD_MAX_SIZE    (4 + 128)
+
+/**
+ * @brief encode a log into a record of the critical data, as it will be in the log list
+ *
+ * The record is copied as it is by esp_insights_cbor_encode_diag_logs(). It is not decoded again, so the message
+ * is not tied to the meta of the log hook records and the arguments of deferred formats are formatted now.
+ *
+ * @param log  log, as decoded from the record of the log hook
+ * @param buf  record buffer, ESP_INSIGHTS_LOG_RECORD_MAX_SIZE bytes fit any log
+ * @param size size of buf
+ * @return size_t length of the record, 0 if it does not fit
+ */
+size_t esp_insights_cbor_encode_log_record(const esp_diag_log_data_t *log, uint8_t *buf, size_t size);
+
+/**
+ * @brief encode a data point into a record of the non critical data, as it will be in the metrics or params list
+ *
+ * @param data data point, as passed to the write callback of the metrics or variables
+ * @param len  length of data
+ * @param buf  record buffer, ESP_INSIGHTS_DATA_PT_RECORD_MAX_SIZE bytes fit any data point
+ * @param size size of buf
+ * @return size_t length of the record, 0 if the data point is not known or does not fit
+ */
+size_t esp_insights_cbor_encode_data_pt_record(const void *data, size_t len, uint8_t *buf, size_t size);
+#endif /* CONFIG_ESP_INSIGHTS_PRE_ENCODED_RECORDS */
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+void esp_insights_cbor_encode_diag_trace(const esp_diag_trace_event_t *events, size_t count);
+#endif /* CONFIG_ESP_INSIGHTS_TRACE_UPLOAD */
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+/* Encodes the messages of the children taken with esp_insights_gateway_take() */
+void esp_insights_cbor_encode_diag_children(void);
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
 void esp_insights_cbor_encode_diag_data_end(void);
 size_t esp_insights_cbor_encode_diag_end(void *data);
 
 /* For encoding diag meta data */
 void esp_insights_cbor_encode_meta_begin(void *data, size_t data_size, const char *version, const char *sha256);
+/* Same as esp_insights_cbor_encode_diag_begin_writer() for the meta data */
+void esp_insights_cbor_encode_meta_begin_writer(CborEncoderWriteFunction writer, void *token,
+                                                const char *version, const char *sha256, uint64_t ts);
 void esp_insights_cbor_encode_meta_data_begin(void);
+
+/**
+ * @brief advertise the compression of the data messages
+ *
+ * @param alg           compression algorithm
+ * @param msg_type      message type of the compressed data messages
+ * @param window_sz2    log2 of the window size
+ * @param lookahead_sz2 log2 of the lookahead size
+ */
+void esp_insights_cbor_encode_meta_compression(const char *alg, uint8_t msg_type,
+                                               uint8_t window_sz2, uint8_t lookahead_sz2);
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+/* Version of the metrics series format, sent in the meta */
+#define ESP_INSIGHTS_METRICS_SERIES_VERSION     1
+
+/**
+ * @brief advertise the format of the metrics series of the data messages
+ */
+void esp_insights_cbor_encode_meta_series(void);
+#endif /* CONFIG_ESP_INSIGHTS_METRICS_SERIES */
 #if CONFIG_DIAG_ENABLE_METRICS
 void esp_insights_cbor_encode_meta_metrics(const esp_diag_metrics_meta_t *metrics, uint32_t metrics_len);
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
@@ -6,9 +6,11 @@
 
 #include <sdkconfig.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <nvs_flash.h>
 #include <nvs.h>
+#include <esp_log.h>
 #include <esp_rmaker_mqtt_glue.h>
 #include <esp_rmaker_factory.h>
 
@@ -81,11 +83,19 @@ void esp_insights_clean_mqtt_conn_params(esp_rmaker_mqtt_conn_params_t *mqtt_con
     }
 }
 
+/* The CRC is read from NVS once, the copy is kept up to date by esp_insights_meta_nvs_crc_set() */
+static uint32_t s_meta_crc;
+static bool s_meta_crc_cached;
+
 esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc)
 {
     if (!crc) {
         return ESP_ERR_INVALID_ARG;
     }
+    if (s_meta_crc_cached) {
+        *crc = s_meta_crc;
+        return ESP_OK;
+    }
     nvs_handle_t handle;
     esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READONLY, &handle);
     if (err != ESP_OK) {
@@ -97,11 +107,16 @@ esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc)
         return err;
     }
     nvs_close(handle);
+    s_meta_crc = *crc;
+    s_meta_crc_cached = true;
     return err;
 }
 
 esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc)
 {
+    if (s_meta_crc_cached && s_meta_crc == crc) {
+        return ESP_OK;
+    }
     nvs_handle_t handle;
     esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READWRITE, &handle);
     if (err != ESP_OK) {
@@ -114,5 +129,140 @@ esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc)
     }
     nvs_commit(handle);
     nvs_close(handle);
+    s_meta_crc = crc;
+    s_meta_crc_cached = true;
     return err;
 }
+
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+#define INSIGHTS_CRASH_SIG_NVS_KEY       "i_crash_sig"
+#define INSIGHTS_CRASH_SIG_MAX           8
+
+static const char *TAG = "insights_client";
+
+typedef struct {
+    uint32_t sig;
+    uint16_t count;     /* Crashes of the window */
+    uint8_t delivered;  /* The full record was delivered in this window */
+    uint8_t reserved;
+} crash_sig_entry_t;
+
+/* Crashes of the current window, one window is at most CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE_WINDOW consecutive
+ * boots after a crash */
+typedef struct {
+    uint32_t dump_hash;     /* Core dump accounted last, a dump which was not erased is not counted twice */
+    uint8_t boots;
+    uint8_t cnt;
+    uint8_t last;           /* Entry of the core dump accounted last */
+    uint8_t reserved;
+    crash_sig_entry_t entries[INSIGHTS_CRASH_SIG_MAX];
+} crash_sig_store_t;
+
+static crash_sig_store_t s_crash_sigs;
+static bool s_crash_sigs_loaded;
+
+static void crash_sig_load(void)
+{
+    if (s_crash_sigs_loaded) {
+        return;
+    }
+    s_crash_sigs_loaded = true;
+    nvs_handle_t handle;
+    if (nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(s_crash_sigs);
+    if (nvs_get_blob(handle, INSIGHTS_CRASH_SIG_NVS_KEY, &s_crash_sigs, &len) != ESP_OK
+        || len != sizeof(s_crash_sigs) || s_crash_sigs.cnt > INSIGHTS_CRASH_SIG_MAX) {
+        memset(&s_crash_sigs, 0, sizeof(s_crash_sigs));
+    }
+    nvs_close(handle);
+}
+
+static esp_err_t crash_sig_store(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(INSIGHTS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (s_crash_sigs.cnt) {
+        err = nvs_set_blob(handle, INSIGHTS_CRASH_SIG_NVS_KEY, &s_crash_sigs, sizeof(s_crash_sigs));
+    } else {
+        err = nvs_erase_key(handle, INSIGHTS_CRASH_SIG_NVS_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t esp_insights_crash_sig_account(uint32_t sig, uint32_t dump_hash, uint32_t *count, bool *full)
+{
+    if (!count || !full) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    crash_sig_load();
+    bool same_dump = s_crash_sigs.cnt && s_crash_sigs.dump_hash == dump_hash
+                     && s_crash_sigs.entries[s_crash_sigs.last].sig == sig;
+    if (!same_dump) {
+        if (s_crash_sigs.boots >= CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE_WINDOW) {
+            memset(&s_crash_sigs, 0, sizeof(s_crash_sigs));
+        }
+        uint8_t i;
+        for (i = 0; i < s_crash_sigs.cnt && s_crash_sigs.entries[i].sig != sig; i++);
+        if (i == s_crash_sigs.cnt) {
+            if (s_crash_sigs.cnt == INSIGHTS_CRASH_SIG_MAX) {
+                /* The signature seen first makes room */
+                memmove(&s_crash_sigs.entries[0], &s_crash_sigs.entries[1],
+                        (INSIGHTS_CRASH_SIG_MAX - 1) * sizeof(s_crash_sigs.entries[0]));
+                i = INSIGHTS_CRASH_SIG_MAX - 1;
+            } else {
+                s_crash_sigs.cnt++;
+            }
+            memset(&s_crash_sigs.entries[i], 0, sizeof(s_crash_sigs.entries[i]));
+            s_crash_sigs.entries[i].sig = sig;
+        }
+        if (s_crash_sigs.entries[i].count < UINT16_MAX) {
+            s_crash_sigs.entries[i].count++;
+        }
+        s_crash_sigs.boots++;
+        s_crash_sigs.last = i;
+        s_crash_sigs.dump_hash = dump_hash;
+        esp_err_t err = crash_sig_store();
+        if (err != ESP_OK) {
+            /* Still counted for this boot, the next crash may be sent in full again */
+            ESP_LOGW(TAG, "Failed to store crash signatures, err:0x%x", err);
+        }
+    }
+    const crash_sig_entry_t *entry = &s_crash_sigs.entries[s_crash_sigs.last];
+    *count = entry->count;
+    *full = !entry->delivered;
+    return ESP_OK;
+}
+
+void esp_insights_crash_sig_delivered(void)
+{
+    crash_sig_load();
+    if (!s_crash_sigs.cnt) {
+        return;
+    }
+    crash_sig_entry_t *entry = &s_crash_sigs.entries[s_crash_sigs.last];
+    entry->delivered = 1;
+    crash_sig_store();
+}
+
+void esp_insights_crash_sig_window_end(void)
+{
+    crash_sig_load();
+    if (!s_crash_sigs.cnt) {
+        return;
+    }
+    memset(&s_crash_sigs, 0, sizeof(s_crash_sigs));
+    crash_sig_store();
+}
+#endif /* CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE */
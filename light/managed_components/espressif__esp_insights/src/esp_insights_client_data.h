@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_err.h>
 #include <esp_rmaker_mqtt_glue.h>
 
@@ -18,6 +19,28 @@ esp_rmaker_mqtt_conn_params_t *esp_insights_get_mqtt_conn_params(void);
 void esp_insights_clean_mqtt_conn_params(esp_rmaker_mqtt_conn_params_t *mqtt_conn_params);
 esp_err_t esp_insights_meta_nvs_crc_get(uint32_t *crc);
 esp_err_t esp_insights_meta_nvs_crc_set(uint32_t crc);
+
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+/**
+ * @brief count a crash in the crash signatures kept in NVS
+ *
+ * The same core dump is counted once, however many times this is called for it.
+ *
+ * @param[in] sig       signature of the crash, a hash of its PCs
+ * @param[in] dump_hash hash of the whole core dump summary
+ * @param[out] count    crashes of this signature in the current window
+ * @param[out] full     true if the full record of the crash is to be sent, the full record of an earlier
+ *                      crash with the same signature was not delivered in the current window otherwise
+ * @return ESP_OK on success, appropriate error otherwise
+ */
+esp_err_t esp_insights_crash_sig_account(uint32_t sig, uint32_t dump_hash, uint32_t *count, bool *full);
+
+/* Marks the record of the crash accounted last as delivered */
+void esp_insights_crash_sig_delivered(void);
+
+/* Ends the window of crash signatures, on a boot without a crash */
+void esp_insights_crash_sig_window_end(void);
+#endif /* CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE */
 #ifdef __cplusplus
 }
 #endif
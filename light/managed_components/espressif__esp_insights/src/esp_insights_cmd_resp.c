@@ -21,6 +21,10 @@ static const char *TAG = "insights_cmd_resp";
 #include <esp_insights.h> /* for nodeID */
 #include <esp_rmaker_mqtt_glue.h>
 #include <esp_rmaker_utils.h>
+#include <esp_rmaker_work_queue.h>
+#include <esp_diagnostics_system_metrics.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include "esp_insights_internal.h"
 #include "esp_insights_cbor_decoder.h"
@@ -40,6 +44,15 @@ static const char *TAG = "insights_cmd_resp";
 #define CMD_STORE_SIZE 10
 #define SCRATCH_BUF_SIZE (1 * 1024)
 
+/* Value of a command, the "v" of its entry */
+typedef struct {
+    esp_diag_data_type_t type;  /* ESP_DIAG_DATA_TYPE_NULL if the entry has no value */
+    bool b;
+    uint32_t u;
+    cbor_str_view_t str;        /* Points into the message */
+} insights_cmd_value_t;
+
+/* data is the insights_cmd_value_t of the command, data_len its size */
 typedef esp_err_t (*esp_insights_cmd_cb_t)(const void *data, size_t data_len, const void *priv);
 
 typedef struct {
@@ -104,9 +117,207 @@ static void esp_insights_cbor_reboot_msg_cb(CborEncoder *map, insights_msg_type_
     }
 }
 
+#if CONFIG_DIAG_ENABLE_HEAP_METRICS || CONFIG_DIAG_ENABLE_WIFI_METRICS || CONFIG_DIAG_ENABLE_TASK_METRICS
+#define INSIGHTS_SAMPLING 1
+
+/* Sampling policy of a group of metrics, set by the "sampling" commands */
+typedef enum {
+    SAMPLING_OFF,
+    SAMPLING_LOW,
+    SAMPLING_HIGH,
+    SAMPLING_BURST,     /* The high rate of CONFIG_ESP_INSIGHTS_SAMPLING_BURST_INTERVAL, then back to the policy before */
+    SAMPLING_MAX,
+    SAMPLING_NONE = SAMPLING_MAX,
+} sampling_policy_t;
+
+static const char *s_sampling_policy_str[SAMPLING_MAX] = { "off", "low", "high", "burst" };
+
+static const uint32_t s_sampling_period[SAMPLING_MAX] = {
+    0,
+    CONFIG_ESP_INSIGHTS_SAMPLING_LOW_INTERVAL,
+    CONFIG_ESP_INSIGHTS_SAMPLING_HIGH_INTERVAL,
+    CONFIG_ESP_INSIGHTS_SAMPLING_BURST_INTERVAL,
+};
+
+typedef struct {
+    const char *name;
+    void (*reset_interval)(uint32_t period);
+    uint8_t policy;     /* SAMPLING_NONE until set, the metrics keep the period set locally */
+    uint8_t before_burst;
+    uint8_t staged;     /* Set by the message being handled, applied once the whole message is valid */
+} sampling_group_t;
+
+static sampling_group_t s_sampling_groups[] = {
+#if CONFIG_DIAG_ENABLE_HEAP_METRICS
+    { "heap", esp_diag_heap_metrics_reset_interval, SAMPLING_NONE, SAMPLING_NONE, SAMPLING_NONE },
+#endif
+#if CONFIG_DIAG_ENABLE_WIFI_METRICS
+    { "wifi", esp_diag_wifi_metrics_reset_interval, SAMPLING_NONE, SAMPLING_NONE, SAMPLING_NONE },
+#endif
+#if CONFIG_DIAG_ENABLE_TASK_METRICS
+    { "task", esp_diag_task_metrics_reset_interval, SAMPLING_NONE, SAMPLING_NONE, SAMPLING_NONE },
+#endif
+};
+
+#define SAMPLING_GROUP_CNT ((int)(sizeof(s_sampling_groups) / sizeof(s_sampling_groups[0])))
+
+static struct {
+    /* Commands are handled in the MQTT task, the end of a burst in the work queue */
+    SemaphoreHandle_t lock;
+    bool staged_invalid;
+    bool report_pending;
+    uint32_t burst_gen;
+} s_sampling;
+
+static void sampling_group_apply(sampling_group_t *group, uint8_t policy)
+{
+    ESP_LOGI(TAG, "%s sampling: %s", group->name, s_sampling_policy_str[policy]);
+    group->policy = policy;
+    group->reset_interval(s_sampling_period[policy]);
+}
+
+static void sampling_burst_end(void *priv)
+{
+    xSemaphoreTake(s_sampling.lock, portMAX_DELAY);
+    /* A burst set again restarts the time, only the end scheduled last applies */
+    if ((uint32_t)(uintptr_t)priv == s_sampling.burst_gen) {
+        for (int i = 0; i < SAMPLING_GROUP_CNT; i++) {
+            sampling_group_t *group = &s_sampling_groups[i];
+            if (group->policy == SAMPLING_BURST) {
+                sampling_group_apply(group, group->before_burst == SAMPLING_NONE ? SAMPLING_HIGH : group->before_burst);
+                s_sampling.report_pending = true;
+            }
+        }
+    }
+    xSemaphoreGive(s_sampling.lock);
+}
+
+/* The value of ["sampling", <group>] is the name of a policy */
+static esp_err_t sampling_cmd_handler(const void *data, size_t data_len, const void *prv_data)
+{
+    const insights_cmd_value_t *value = data;
+    sampling_group_t *group = (sampling_group_t *)prv_data;
+    uint8_t policy = SAMPLING_NONE;
+    if (value && value->type == ESP_DIAG_DATA_TYPE_STR) {
+        for (policy = 0; policy < SAMPLING_MAX; policy++) {
+            if (esp_insights_cbor_decoder_string_equals(&value->str, s_sampling_policy_str[policy])) {
+                break;
+            }
+        }
+    }
+    xSemaphoreTake(s_sampling.lock, portMAX_DELAY);
+    if (policy == SAMPLING_NONE) {
+        ESP_LOGE(TAG, "Invalid %s sampling policy", group->name);
+        s_sampling.staged_invalid = true;
+    } else {
+        group->staged = policy;
+    }
+    xSemaphoreGive(s_sampling.lock);
+    return policy == SAMPLING_NONE ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+/* Applies the policies of a message together, or none of them if one is invalid */
+static esp_err_t sampling_commit(void)
+{
+    esp_err_t err = ESP_OK;
+    bool burst = false;
+    xSemaphoreTake(s_sampling.lock, portMAX_DELAY);
+    for (int i = 0; i < SAMPLING_GROUP_CNT; i++) {
+        sampling_group_t *group = &s_sampling_groups[i];
+        if (group->staged == SAMPLING_NONE || s_sampling.staged_invalid) {
+            group->staged = SAMPLING_NONE;
+            continue;
+        }
+        if (group->staged == SAMPLING_BURST) {
+            if (group->policy != SAMPLING_BURST) {
+                group->before_burst = group->policy;
+            }
+            burst = true;
+        }
+        sampling_group_apply(group, group->staged);
+        group->staged = SAMPLING_NONE;
+        s_sampling.report_pending = true;
+    }
+    if (s_sampling.staged_invalid) {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    s_sampling.staged_invalid = false;
+    if (burst) {
+        s_sampling.burst_gen++;
+        if (esp_rmaker_work_queue_add_delayed_task(sampling_burst_end, (void *)(uintptr_t)s_sampling.burst_gen,
+                                                   CONFIG_ESP_INSIGHTS_SAMPLING_BURST_DURATION * 1000) != ESP_OK) {
+            /* Not left at the burst rate for good */
+            ESP_LOGE(TAG, "Failed to schedule the end of the sampling burst");
+            xSemaphoreGive(s_sampling.lock);
+            sampling_burst_end((void *)(uintptr_t)s_sampling.burst_gen);
+            return ESP_FAIL;
+        }
+    }
+    xSemaphoreGive(s_sampling.lock);
+    return err;
+}
+
+static void __collect_sampling_meta(CborEncoder *map)
+{
+    CborEncoder sampling_map, d_map, group_map, conf_map;
+    cbor_encode_text_stringz(map, "sampling");
+    cbor_encoder_create_map(map, &sampling_map, CborIndefiniteLength);
+    cbor_encode_text_stringz(&sampling_map, "d"); /* descendants, one config per group */
+    cbor_encoder_create_map(&sampling_map, &d_map, CborIndefiniteLength);
+    for (int i = 0; i < SAMPLING_GROUP_CNT; i++) {
+        cbor_encode_text_stringz(&d_map, s_sampling_groups[i].name);
+        cbor_encoder_create_map(&d_map, &group_map, CborIndefiniteLength);
+        cbor_encode_text_stringz(&group_map, "c");
+        cbor_encoder_create_map(&group_map, &conf_map, CborIndefiniteLength);
+        cbor_encode_text_stringz(&conf_map, "type");
+        cbor_encode_uint(&conf_map, ESP_DIAG_DATA_TYPE_STR);
+        cbor_encoder_close_container(&group_map, &conf_map);
+        cbor_encoder_close_container(&d_map, &group_map);
+    }
+    cbor_encoder_close_container(&sampling_map, &d_map);
+    cbor_encoder_close_container(map, &sampling_map);
+}
+
+static void __collect_sampling_data(CborEncoder *map)
+{
+    xSemaphoreTake(s_sampling.lock, portMAX_DELAY);
+    for (int i = 0; i < SAMPLING_GROUP_CNT; i++) {
+        if (s_sampling_groups[i].policy == SAMPLING_NONE) {
+            continue;
+        }
+        CborEncoder conf_map, key_arr;
+        cbor_encoder_create_map(map, &conf_map, CborIndefiniteLength);
+        cbor_encode_text_stringz(&conf_map, "n");
+        cbor_encoder_create_array(&conf_map, &key_arr, CborIndefiniteLength);
+        cbor_encode_text_stringz(&key_arr, "sampling");
+        cbor_encode_text_stringz(&key_arr, s_sampling_groups[i].name);
+        cbor_encoder_close_container(&conf_map, &key_arr);
+        cbor_encode_text_stringz(&conf_map, "v");
+        cbor_encode_text_stringz(&conf_map, s_sampling_policy_str[s_sampling_groups[i].policy]);
+        cbor_encode_text_stringz(&conf_map, "t");
+        cbor_encode_uint(&conf_map, esp_diag_timestamp_get());
+        cbor_encoder_close_container(map, &conf_map);
+    }
+    xSemaphoreGive(s_sampling.lock);
+}
+
+static void esp_insights_cbor_sampling_msg_cb(CborEncoder *map, insights_msg_type_t type)
+{
+    if (type == INSIGHTS_MSG_TYPE_META) {
+        __collect_sampling_meta(map);
+    } else if (s_sampling.report_pending) {
+        __collect_sampling_data(map);
+        s_sampling.report_pending = false;
+    }
+}
+#endif /* CONFIG_DIAG_ENABLE_HEAP_METRICS || CONFIG_DIAG_ENABLE_WIFI_METRICS || CONFIG_DIAG_ENABLE_TASK_METRICS */
+
 esp_err_t esp_insights_cmd_resp_register_cmd(esp_insights_cmd_cb_t cb, void *prv_data, int cmd_depth, ...)
 {
     int idx = s_cmd_resp_data.cmd_cnt;
+    if (idx == CMD_STORE_SIZE || cmd_depth > MAX_CMD_DEPTH) {
+        return ESP_ERR_NO_MEM;
+    }
 
     va_list valist;
     va_start(valist, cmd_depth);
@@ -124,58 +335,57 @@ esp_err_t esp_insights_cmd_resp_register_cmd(esp_insights_cmd_cb_t cb, void *prv
     return ESP_OK;
 }
 
-static esp_err_t insights_cmd_resp_search_execute_cmd_store(char **cmd_tree, int cmd_depth)
+/* The command path is a list of views into the received message, nothing is copied */
+static esp_err_t insights_cmd_resp_search_execute_cmd_store(cbor_str_view_t *cmd_tree, int cmd_depth,
+                                                            const insights_cmd_value_t *value)
 {
     for(int i = 0; i< s_cmd_resp_data.cmd_cnt; i++) {
         if (cmd_depth == s_cmd_resp_data.cmd_store[i].depth) {
             bool match_found = true;
             /* the command depth matches, now go for whole path */
             for (int j = 0; j < cmd_depth; j++) {
-                if (strcmp(cmd_tree[j], s_cmd_resp_data.cmd_store[i].cmd[j]) != 0) {
+                if (!esp_insights_cbor_decoder_string_equals(&cmd_tree[j], s_cmd_resp_data.cmd_store[i].cmd[j])) {
                     match_found = false;
                     break; /* break at first mismatch */
                 }
             }
             if (match_found) {
                 ESP_LOGI(TAG, "match found in cmd_store... Executing the callback");
-                s_cmd_resp_data.cmd_store[i].cb(NULL, 0, s_cmd_resp_data.cmd_store[i].prv_data);
-                return ESP_OK;
+                return s_cmd_resp_data.cmd_store[i].cb(value, sizeof(*value), s_cmd_resp_data.cmd_store[i].prv_data);
             }
         }
     }
     return ESP_ERR_NOT_FOUND;
 }
 
-static void insights_cmd_parser_clear_cmd_tree(char *cmd_tree[])
+static void insights_cmd_parser_clear_cmd_tree(cbor_str_view_t cmd_tree[])
 {
     for (int i = 0; i < MAX_CMD_DEPTH; i++) {
-        if (cmd_tree[i]) {
-            free(cmd_tree[i]);
-            cmd_tree[i] = NULL;
+        if (cmd_tree[i].str) {
+            esp_insights_cbor_decoder_string_free(&cmd_tree[i]);
         } else {
             return;
         }
     }
 }
 
-static void insights_cmd_parser_add_cmd_to_tree(char * cmd_tree[], char *cmd, int pos)
+static void insights_cmd_parser_add_cmd_to_tree(cbor_str_view_t cmd_tree[], const cbor_str_view_t *cmd, int pos)
 {
-    ESP_LOGV(TAG, "Adding %s to command path\n", cmd);
+    ESP_LOGV(TAG, "Adding %.*s to command path\n", (int) cmd->len, cmd->str);
     /* free depth already consumed */
     for (int i = pos; i < MAX_CMD_DEPTH; i++) {
-        if (cmd_tree[i]) {
-            free(cmd_tree[i]);
-            cmd_tree[i] = NULL;
+        if (cmd_tree[i].str) {
+            esp_insights_cbor_decoder_string_free(&cmd_tree[i]);
         } else {
             break;
         }
     }
 
     /* insert at the position */
-    cmd_tree[pos] = cmd;
+    cmd_tree[pos] = *cmd;
 }
 
-static void insights_cmd_parser_print_cmd_tree(const char *cmd_tree[], int depth)
+static void insights_cmd_parser_print_cmd_tree(const cbor_str_view_t cmd_tree[], int depth)
 {
     if (depth <= 0) {
         ESP_LOGI(TAG, "No command found to be printed");
@@ -183,22 +393,20 @@ static void insights_cmd_parser_print_cmd_tree(const char *cmd_tree[], int depth
     }
     printf("The command is: ");
     for (int i = 0; i < depth - 1; i++) {
-        if (cmd_tree[i]) {
-            printf("%s > ", cmd_tree[i]);
+        if (cmd_tree[i].str) {
+            printf("%.*s > ", (int) cmd_tree[i].len, cmd_tree[i].str);
         } else {
             printf("\ncouldn't find complete depth\n");
             return;
         }
     }
-    if (cmd_tree[depth - 1]) {
-        printf("%s\n", cmd_tree[depth - 1]);
+    if (cmd_tree[depth - 1].str) {
+        printf("%.*s\n", (int) cmd_tree[depth - 1].len, cmd_tree[depth - 1].str);
     } else {
         printf("\ncouldn't find complete depth\n");
     }
 }
 
-#define MAX_BUFFER_SIZE 100
-
 /* extract top level fields from CBOR and check for sanity */
 esp_err_t check_top_fields_from_cbor(const uint8_t *cbor_data, size_t cbor_data_len)
 {
@@ -222,59 +430,41 @@ esp_err_t check_top_fields_from_cbor(const uint8_t *cbor_data, size_t cbor_data_
 
     /* Iterate through the map and extract the desired fields */
     while (!cbor_value_at_end(&value)) {
-        CborValue map_key;
-
         /* Check the map key and extract the corresponding field */
         if (cbor_value_is_text_string(&value)) {
-            char buffer[MAX_BUFFER_SIZE];
-            size_t buffer_size = sizeof(buffer);
-            err = cbor_value_copy_text_string(&value, buffer, &buffer_size, &map_key);
-            if (err != CborNoError) {
-                ESP_LOGE(TAG, "CBOR value copy text string failed: %d", err);
+            cbor_str_view_t key, str;
+            if (esp_insights_cbor_decoder_get_string_view(&value, &key) != ESP_OK) {
+                ESP_LOGE(TAG, "CBOR get text string failed");
                 return ESP_FAIL;
             }
 
-            buffer_size = sizeof(buffer);
-            if (strcmp(buffer, "ver") == 0) {
-                if (cbor_value_is_text_string(&map_key)) {
-                    err = cbor_value_copy_text_string(&map_key, buffer, &buffer_size, &map_key);
-                    if (err != CborNoError) {
-                        ESP_LOGE(TAG, "CBOR value copy text string failed: %d", err);
+            if (esp_insights_cbor_decoder_string_equals(&key, "ver") ||
+                    esp_insights_cbor_decoder_string_equals(&key, "sha256")) {
+                if (cbor_value_is_text_string(&value)) {
+                    CborValue field = value;
+                    if (esp_insights_cbor_decoder_get_string_view(&field, &str) != ESP_OK) {
+                        ESP_LOGE(TAG, "CBOR get text string failed");
+                        esp_insights_cbor_decoder_string_free(&key);
                         return ESP_FAIL;
                     }
-                    ESP_LOGI(TAG, "ver: %s", buffer);
+                    ESP_LOGI(TAG, "%.*s: %.*s", (int) key.len, key.str, (int) str.len, str.str);
+                    esp_insights_cbor_decoder_string_free(&str);
                 } else {
-                    ESP_LOGE(TAG, "Invalid CBOR format: text string expected as ver key");
+                    ESP_LOGE(TAG, "Invalid CBOR format: text string expected as %.*s key", (int) key.len, key.str);
                 }
-            } else if (strcmp(buffer, "ts") == 0) {
-                CborType _type = cbor_value_get_type(&map_key);
+            } else if (esp_insights_cbor_decoder_string_equals(&key, "ts")) {
+                CborType _type = cbor_value_get_type(&value);
                 ESP_LOGI(TAG, "ts is of type %d", _type);
-            } else if (strcmp(buffer, "sha256") == 0) {
-                if (cbor_value_is_text_string(&map_key)) {
-                    err = cbor_value_copy_text_string(&map_key, buffer, &buffer_size, &map_key);
-                    if (err != CborNoError) {
-                        ESP_LOGE(TAG, "CBOR value copy text string failed: %d", err);
-                        return ESP_FAIL;
-                    }
-                    ESP_LOGI(TAG, "sha256: %s", buffer);
-                } else {
-                    ESP_LOGE(TAG, "Invalid CBOR format: text string expected as sha256 key");
-                }
-            } else if (strcmp(buffer, INS_CONF_STR) == 0) {
+            } else if (esp_insights_cbor_decoder_string_equals(&key, INS_CONF_STR)) {
                 /* Nothing to do here */
             }
-
-            /* skip this string now */
-            err = cbor_value_advance(&value);
-            if (err != CborNoError) {
-                ESP_LOGE(TAG, "CBOR value advance failed: %d", err);
-                return ESP_FAIL;
-            }
+            esp_insights_cbor_decoder_string_free(&key);
+        } else {
+            CborType _type = cbor_value_get_type(&value);
+            ESP_LOGI(TAG, "Skipping type %d", _type);
         }
 
-        /* advance the value */
-        CborType _type = cbor_value_get_type(&value);
-        ESP_LOGI(TAG, "Skipping type %d", _type);
+        /* advance past the value, or the key of another type */
         err = cbor_value_advance(&value);
         if (err != CborNoError) {
             ESP_LOGE(TAG, "CBOR value advance failed: %d", err);
@@ -290,12 +480,11 @@ esp_err_t check_top_fields_from_cbor(const uint8_t *cbor_data, size_t cbor_data_
  */
 static esp_err_t esp_insights_cmd_resp_parse_one_entry(cbor_parse_ctx_t *ctx)
 {
-    char *tmp_str = NULL;
+    cbor_str_view_t tmp_str;
     int cmd_depth = 0;
-    bool cmd_value_b;
-    size_t val_sz = 0;
+    insights_cmd_value_t value = { .type = ESP_DIAG_DATA_TYPE_NULL };
     esp_err_t ret = ESP_OK;
-    char *cmd_tree[MAX_CMD_DEPTH] = {0, };
+    cbor_str_view_t cmd_tree[MAX_CMD_DEPTH] = {0, };
 
     /* parse till we are at the end */
     while (!esp_insights_cbor_decoder_at_end(ctx)) {
@@ -304,54 +493,68 @@ static esp_err_t esp_insights_cmd_resp_parse_one_entry(cbor_parse_ctx_t *ctx)
         switch (type)
         {
         case CborTextStringType:
-            tmp_str = esp_insights_cbor_decoder_get_string(it);
-            if (!tmp_str) {
+            if (esp_insights_cbor_decoder_get_string_view(it, &tmp_str) != ESP_OK) {
+                insights_cmd_parser_clear_cmd_tree(cmd_tree);
                 return ESP_FAIL;
             }
-            ESP_LOGI(TAG, "found \"%s\"", tmp_str);
-            if (strcmp(tmp_str, "n") == 0) {
+            ESP_LOGI(TAG, "found \"%.*s\"", (int) tmp_str.len, tmp_str.str);
+            if (esp_insights_cbor_decoder_string_equals(&tmp_str, "n")) {
                 CborType _type = esp_insights_cbor_decode_get_value_type(ctx);
                 if (_type == CborArrayType) {
                     if (esp_insights_cbor_decoder_enter_container(ctx) == ESP_OK) {
                         while(!esp_insights_cbor_decoder_at_end(ctx)) {
-                            char *buffer = esp_insights_cbor_decoder_get_string(&ctx->it[ctx->curr_itr]);
-                            if (!buffer) {
+                            cbor_str_view_t buffer;
+                            if (cmd_depth == MAX_CMD_DEPTH ||
+                                    esp_insights_cbor_decoder_get_string_view(&ctx->it[ctx->curr_itr], &buffer) != ESP_OK) {
                                 ESP_LOGE(TAG, "Invalid entry");
                                 break;
                             }
-                            insights_cmd_parser_add_cmd_to_tree(cmd_tree, buffer, cmd_depth);
+                            insights_cmd_parser_add_cmd_to_tree(cmd_tree, &buffer, cmd_depth);
                             ++cmd_depth;
                         }
 
-                        insights_cmd_parser_print_cmd_tree((const char **) cmd_tree, cmd_depth);
+                        insights_cmd_parser_print_cmd_tree(cmd_tree, cmd_depth);
                         esp_insights_cbor_decoder_exit_container(ctx);
                     }
                 } else {
                     ESP_LOGE(TAG, "A config name must be of array type");
                 }
-            } else if (strcmp(tmp_str, "v") == 0) {
-                /* decide the type of the value first and then fetch it (bool for now) */
-                esp_diag_data_type_t type = ESP_DIAG_DATA_TYPE_BOOL;
-                /* get the value in val */
-                switch (type)
+            } else if (esp_insights_cbor_decoder_string_equals(&tmp_str, "v")) {
+                /* the type of the value is the one it is encoded with */
+                uint64_t u;
+                esp_insights_cbor_decoder_string_free(&value.str);
+                value.type = ESP_DIAG_DATA_TYPE_NULL;
+                switch (esp_insights_cbor_decode_get_value_type(ctx))
                 {
-                case ESP_DIAG_DATA_TYPE_BOOL:
-                    cbor_value_get_boolean(it, &cmd_value_b);
-                    val_sz = 1;
+                case CborBooleanType:
+                    cbor_value_get_boolean(it, &value.b);
+                    value.type = ESP_DIAG_DATA_TYPE_BOOL;
+                    cbor_value_advance_fixed(it);
+                    break;
+                case CborIntegerType:
+                    if (cbor_value_is_unsigned_integer(it) && cbor_value_get_uint64(it, &u) == CborNoError
+                            && u <= UINT32_MAX) {
+                        value.u = (uint32_t) u;
+                        value.type = ESP_DIAG_DATA_TYPE_UINT;
+                    }
+                    cbor_value_advance_fixed(it);
+                    break;
+                case CborTextStringType:
+                    if (esp_insights_cbor_decoder_get_string_view(it, &value.str) == ESP_OK) {
+                        value.type = ESP_DIAG_DATA_TYPE_STR;
+                    } else {
+                        esp_insights_cbor_decoder_advance(ctx);
+                    }
                     break;
                 default:
-                    val_sz = 0;
+                    esp_insights_cbor_decoder_advance(ctx);
                     break;
                 }
-                cbor_value_advance_fixed(it);
             } else {
                 esp_insights_cbor_decoder_advance(ctx);
             }
 
-            if (tmp_str) {
-                free(tmp_str);
-                tmp_str = NULL;
-            }
+            esp_insights_cbor_decoder_string_free(&tmp_str);
             break;
 
         default:
@@ -360,8 +563,9 @@ static esp_err_t esp_insights_cmd_resp_parse_one_entry(cbor_parse_ctx_t *ctx)
         }
     }
 
-    insights_cmd_resp_search_execute_cmd_store(cmd_tree, cmd_depth);
+    ret = insights_cmd_resp_search_execute_cmd_store(cmd_tree, cmd_depth, &value);
     insights_cmd_parser_clear_cmd_tree(cmd_tree);
+    esp_insights_cbor_decoder_string_free(&value.str);
 
     return ret;
 }
@@ -377,12 +581,17 @@ static esp_err_t esp_insights_cmd_resp_parse_execute(cbor_parse_ctx_t *ctx)
         esp_insights_cbor_decoder_exit_container(ctx);
         cmd_cnt++;
     }
+    esp_err_t err = ESP_OK;
+#if INSIGHTS_SAMPLING
+    /* The sampling commands of a message are applied together */
+    err = sampling_commit();
+#endif
     if (cmd_cnt) {
         esp_insights_report_config_update();
     }
     esp_insights_cbor_decoder_exit_container(ctx);
     ESP_LOGI(TAG, "parsed and executed %d commands", cmd_cnt);
-    return ESP_OK;
+    return err;
 }
 
 static esp_err_t esp_insights_cmd_resp_iterate_to_cmds_array(cbor_parse_ctx_t *ctx)
@@ -400,23 +609,20 @@ static esp_err_t esp_insights_cmd_resp_iterate_to_cmds_array(cbor_parse_ctx_t *c
 
     if (esp_insights_cbor_decoder_enter_container(ctx) == ESP_OK) {
         while(!esp_insights_cbor_decoder_at_end(ctx)) {
-            char *buffer = esp_insights_cbor_decoder_get_string(&ctx->it[ctx->curr_itr]);
-
-            if (!buffer) {
+            cbor_str_view_t buffer;
+            if (esp_insights_cbor_decoder_get_string_view(&ctx->it[ctx->curr_itr], &buffer) != ESP_OK) {
                 ESP_LOGE(TAG, "Parsing problem...");
                 return ESP_FAIL;
             }
 
-            if (strcmp(buffer, INS_CONF_STR) == 0) {
-                free(buffer);
-                buffer = NULL;
+            if (esp_insights_cbor_decoder_string_equals(&buffer, INS_CONF_STR)) {
+                esp_insights_cbor_decoder_string_free(&buffer);
                 ESP_LOGI(TAG, "Found commands array:");
                 return ESP_OK;
             } else {
-                ESP_LOGI(TAG, "skipping token %s", buffer);
+                ESP_LOGI(TAG, "skipping token %.*s", (int) buffer.len, buffer.str);
             }
-            free(buffer);
-            buffer = NULL;
+            esp_insights_cbor_decoder_string_free(&buffer);
             /* skip the value and find next for INS_CONF_STR */
             esp_insights_cbor_decoder_advance(ctx);
         }
@@ -450,16 +656,20 @@ static esp_err_t esp_insights_cmd_handler(const void *in_data, size_t in_len, vo
         snprintf(resp_data, sizeof(resp_data), "{\"status\":\"payload error\"}");
         goto out;
     }
-    cbor_parse_ctx_t *cbor_ctx = esp_insights_cbor_decoder_start(in_data, in_len);
-    if (cbor_ctx) {
-        ret = esp_insights_cmd_resp_iterate_to_cmds_array(cbor_ctx);
+    /* The commands are handled one at a time, as for resp_data, and parsed without allocating */
+    static cbor_parse_ctx_t cbor_ctx;
+    if (esp_insights_cbor_decoder_init(&cbor_ctx, in_data, in_len) == ESP_OK) {
+        ret = esp_insights_cmd_resp_iterate_to_cmds_array(&cbor_ctx);
         if (ret == ESP_OK) {
-            esp_insights_cmd_resp_parse_execute(cbor_ctx); /* it is okay if this is empty */
-            snprintf(resp_data, sizeof(resp_data), "{\"status\":\"success\"}");
+            /* it is okay if this is empty */
+            if (esp_insights_cmd_resp_parse_execute(&cbor_ctx) == ESP_OK) {
+                snprintf(resp_data, sizeof(resp_data), "{\"status\":\"success\"}");
+            } else {
+                snprintf(resp_data, sizeof(resp_data), "{\"status\":\"invalid value\"}");
+            }
         } else {
             snprintf(resp_data, sizeof(resp_data), "{\"status\":\"payload error\"}");
         }
-        esp_insights_cbor_decoder_done(cbor_ctx);
     } else {
         snprintf(resp_data, sizeof(resp_data), "{\"status\":\"internal error\"}");
     }
@@ -586,6 +796,7 @@ esp_err_t esp_insights_cmd_resp_init(void)
         err = ESP_ERR_NO_MEM;
         goto init_err;
     }
+    INSIGHTS_HEAP_TAG_ADD(s_cmd_resp_data.scratch_buf);
 
     const int topic_size = 100;
     char *mqtt_topic = (char *) s_cmd_resp_data.scratch_buf;
@@ -615,7 +826,7 @@ esp_err_t esp_insights_cmd_resp_init(void)
 
 init_err:
     if (s_cmd_resp_data.scratch_buf) {
-        free(s_cmd_resp_data.scratch_buf);
+        INSIGHTS_HEAP_TAG_FREE(s_cmd_resp_data.scratch_buf);
         s_cmd_resp_data.scratch_buf = NULL;
     }
     return err;
@@ -632,6 +843,7 @@ esp_err_t esp_insights_cmd_resp_enable(void)
 
     if (!s_cmd_resp_data.scratch_buf) {
         s_cmd_resp_data.scratch_buf = MEM_ALLOC_EXTRAM(SCRATCH_BUF_SIZE);
+        INSIGHTS_HEAP_TAG_ADD(s_cmd_resp_data.scratch_buf);
     }
     if (!s_cmd_resp_data.scratch_buf) {
         ESP_LOGE(TAG, "Failed to allocate memory for scratch buffer.");
@@ -642,6 +854,20 @@ esp_err_t esp_insights_cmd_resp_enable(void)
     esp_insights_cbor_encoder_register_meta_cb(&esp_insights_cbor_reboot_msg_cb);
     /* register `reboot` command to our commands store */
     esp_insights_cmd_resp_register_cmd(reboot_cmd_handler, NULL, 1, "reboot");
+#if INSIGHTS_SAMPLING
+    if (!s_sampling.lock) {
+        s_sampling.lock = xSemaphoreCreateMutex();
+    }
+    if (s_sampling.lock) {
+        esp_insights_cbor_encoder_register_meta_cb(&esp_insights_cbor_sampling_msg_cb);
+        for (int i = 0; i < SAMPLING_GROUP_CNT; i++) {
+            esp_insights_cmd_resp_register_cmd(sampling_cmd_handler, &s_sampling_groups[i], 2,
+                                               "sampling", s_sampling_groups[i].name);
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed to create the sampling lock, sampling commands disabled");
+    }
+#endif
 
     ESP_LOGI(TAG, "Enabling Command-Response Module.");
 
@@ -658,7 +884,7 @@ esp_err_t esp_insights_cmd_resp_enable(void)
 
 enable_err:
     if (s_cmd_resp_data.scratch_buf) {
-        free(s_cmd_resp_data.scratch_buf);
+        INSIGHTS_HEAP_TAG_FREE(s_cmd_resp_data.scratch_buf);
         s_cmd_resp_data.scratch_buf = NULL;
     }
     s_cmd_resp_data.init_done = false;
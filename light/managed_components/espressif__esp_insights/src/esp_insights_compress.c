@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_insights_compress.h"
+#include "esp_insights_internal.h"
+
+/* Limits of the heatshrink format */
+#define WINDOW_BITS_MIN     4
+#define WINDOW_BITS_MAX     15
+#define LOOKAHEAD_BITS_MIN  3
+
+/* Tag bits of the heatshrink format */
+#define TAG_LITERAL         1
+#define TAG_BACKREF         0
+
+esp_err_t esp_insights_compress_init(esp_insights_compress_t *cmp, uint8_t window_sz2, uint8_t lookahead_sz2)
+{
+    if (!cmp || window_sz2 < WINDOW_BITS_MIN || window_sz2 > WINDOW_BITS_MAX ||
+        lookahead_sz2 < LOOKAHEAD_BITS_MIN || lookahead_sz2 >= window_sz2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(cmp, 0, sizeof(*cmp));
+    /* One window of history and one of input */
+    cmp->buf = malloc(2 << window_sz2);
+    if (!cmp->buf) {
+        return ESP_ERR_NO_MEM;
+    }
+    INSIGHTS_HEAP_TAG_ADD(cmp->buf);
+    cmp->window_sz2 = window_sz2;
+    cmp->lookahead_sz2 = lookahead_sz2;
+    return ESP_OK;
+}
+
+void esp_insights_compress_deinit(esp_insights_compress_t *cmp)
+{
+    if (cmp) {
+        INSIGHTS_HEAP_TAG_FREE(cmp->buf);
+        memset(cmp, 0, sizeof(*cmp));
+    }
+}
+
+void esp_insights_compress_reset(esp_insights_compress_t *cmp, esp_insights_compress_out_t out, void *ctx)
+{
+    cmp->start = 0;
+    cmp->end = 0;
+    cmp->bits = 0;
+    cmp->bit_count = 0;
+    cmp->out_len = 0;
+    cmp->out = out;
+    cmp->ctx = ctx;
+}
+
+static void out_flush(esp_insights_compress_t *cmp)
+{
+    if (cmp->out_len) {
+        cmp->out(cmp->ctx, cmp->out_buf, cmp->out_len);
+        cmp->out_len = 0;
+    }
+}
+
+static void out_byte(esp_insights_compress_t *cmp, uint8_t byte)
+{
+    if (cmp->out_len == sizeof(cmp->out_buf)) {
+        out_flush(cmp);
+    }
+    cmp->out_buf[cmp->out_len++] = byte;
+}
+
+/* Bits are written most significant first */
+static void put_bits(esp_insights_compress_t *cmp, uint16_t value, uint8_t count)
+{
+    while (count--) {
+        cmp->bits = (cmp->bits << 1) | ((value >> count) & 1);
+        if (++cmp->bit_count == 8) {
+            out_byte(cmp, cmp->bits);
+            cmp->bits = 0;
+            cmp->bit_count = 0;
+        }
+    }
+}
+
+/* Encodes the byte at start as a literal, or the bytes from start as a back-reference into the window */
+static void compress_step(esp_insights_compress_t *cmp)
+{
+    const uint8_t *buf = cmp->buf;
+    size_t window = 1 << cmp->window_sz2;
+    size_t pos = cmp->start;
+    size_t max_len = cmp->end - pos;
+    if (max_len > (1 << cmp->lookahead_sz2)) {
+        max_len = 1 << cmp->lookahead_sz2;
+    }
+    size_t first = pos > window ? pos - window : 0;
+    size_t best_len = 0, best_offset = 0;
+
+    /* Nearest match first, a back-reference may run into the bytes it repeats */
+    for (size_t i = pos; i-- > first;) {
+        if (buf[i] != buf[pos] || buf[i + best_len] != buf[pos + best_len]) {
+            continue;
+        }
+        size_t len = 1;
+        while (len < max_len && buf[i + len] == buf[pos + len]) {
+            len++;
+        }
+        if (len > best_len) {
+            best_len = len;
+            best_offset = pos - i;
+            if (len == max_len) {
+                break;
+            }
+        }
+    }
+    /* A back-reference takes 1 + window + lookahead bits, each literal 9 */
+    if (best_len * 9 > 1 + cmp->window_sz2 + cmp->lookahead_sz2) {
+        put_bits(cmp, TAG_BACKREF, 1);
+        put_bits(cmp, best_offset - 1, cmp->window_sz2);
+        put_bits(cmp, best_len - 1, cmp->lookahead_sz2);
+        cmp->start += best_len;
+    } else {
+        put_bits(cmp, (TAG_LITERAL << 8) | buf[pos], 9);
+        cmp->start++;
+    }
+}
+
+void esp_insights_compress_sink(esp_insights_compress_t *cmp, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    size_t window = 1 << cmp->window_sz2;
+    size_t lookahead = 1 << cmp->lookahead_sz2;
+    while (len) {
+        if (cmp->end == 2 * window) {
+            /* Less than a lookahead is pending, so start is past the first window: drop what no match can reach */
+            size_t shift = cmp->start - window;
+            memmove(cmp->buf, cmp->buf + shift, cmp->end - shift);
+            cmp->start -= shift;
+            cmp->end -= shift;
+        }
+        size_t n = 2 * window - cmp->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(cmp->buf + cmp->end, src, n);
+        cmp->end += n;
+        src += n;
+        len -= n;
+        while (cmp->end - cmp->start >= lookahead) {
+            compress_step(cmp);
+        }
+    }
+}
+
+void esp_insights_compress_finish(esp_insights_compress_t *cmp)
+{
+    while (cmp->start < cmp->end) {
+        compress_step(cmp);
+    }
+    if (cmp->bit_count) {
+        /* Padding is too short to be read as a back-reference */
+        out_byte(cmp, cmp->bits << (8 - cmp->bit_count));
+        cmp->bits = 0;
+        cmp->bit_count = 0;
+    }
+    out_flush(cmp);
+}
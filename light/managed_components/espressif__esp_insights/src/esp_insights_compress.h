@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define INSIGHTS_COMPRESS_ALG           "heatshrink"
+#define INSIGHTS_COMPRESS_OUT_BUF_SIZE  32
+
+/**
+ * @brief output callback of the compressor
+ *
+ * @param ctx  context given to esp_insights_compress_reset()
+ * @param data compressed bytes
+ * @param len  number of compressed bytes
+ */
+typedef void (*esp_insights_compress_out_t)(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * @brief streaming compressor with the output format of heatshrink
+ *
+ * The output can be expanded by any heatshrink decoder configured with the same window and lookahead sizes.
+ */
+typedef struct {
+    uint8_t window_sz2;         /* log2 of the distance a back-reference can reach */
+    uint8_t lookahead_sz2;      /* log2 of the longest back-reference */
+    uint8_t *buf;               /* history window followed by the input not compressed yet */
+    size_t start;               /* first byte of buf not compressed yet */
+    size_t end;                 /* bytes in buf */
+    uint8_t bits;               /* output bits not forming a full byte yet */
+    uint8_t bit_count;
+    uint8_t out_buf[INSIGHTS_COMPRESS_OUT_BUF_SIZE];
+    size_t out_len;
+    esp_insights_compress_out_t out;
+    void *ctx;
+} esp_insights_compress_t;
+
+/**
+ * @brief allocate the window of the compressor
+ *
+ * @param cmp           compressor
+ * @param window_sz2    log2 of the window size, 4 to 15
+ * @param lookahead_sz2 log2 of the lookahead size, at least 3 and less than window_sz2
+ *
+ * @return ESP_OK on success, appropriate error otherwise
+ */
+esp_err_t esp_insights_compress_init(esp_insights_compress_t *cmp, uint8_t window_sz2, uint8_t lookahead_sz2);
+
+/**
+ * @brief free the window of the compressor
+ *
+ * @param cmp compressor
+ */
+void esp_insights_compress_deinit(esp_insights_compress_t *cmp);
+
+/**
+ * @brief start compressing a new message, nothing of the previous one is referenced
+ *
+ * @param cmp compressor
+ * @param out callback the compressed bytes are passed to
+ * @param ctx context of the callback
+ */
+void esp_insights_compress_reset(esp_insights_compress_t *cmp, esp_insights_compress_out_t out, void *ctx);
+
+/**
+ * @brief compress data
+ *
+ * Part of the data is kept as lookahead until more data comes or esp_insights_compress_finish() is called.
+ *
+ * @param cmp  compressor
+ * @param data data to compress
+ * @param len  length of data
+ */
+void esp_insights_compress_sink(esp_insights_compress_t *cmp, const void *data, size_t len);
+
+/**
+ * @brief compress the data left and pad the last byte
+ *
+ * @param cmp compressor
+ */
+void esp_insights_compress_finish(esp_insights_compress_t *cmp);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,6 +10,8 @@
 #include <esp_diagnostics_variables.h>
 
 #include "esp_insights_cbor_encoder.h"
+#include "esp_insights_encoder.h"
+#include "esp_insights_client_data.h"
 
 #if CONFIG_ESP_INSIGHTS_META_VERSION_10
 #define INSIGHTS_VERSION_MAJOR           "1"
@@ -33,6 +35,7 @@
 #define INSIGHTS_DATA_TYPE          0x02
 #define INSIGHTS_META_DATA_TYPE     0x03
 #define INSIGHTS_CONF_DATA_TYPE     0x12
+#define INSIGHTS_DATA_COMPRESSED_TYPE   0x22    /* Data message with the CBOR compressed as advertised in the meta */
 #define TLV_OFFSET                  3
 
 static void esp_insights_encode_meta_data(void)
@@ -77,7 +80,7 @@ size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *s
     return len;
 }
 
-esp_err_t esp_insights_encode_data_begin(void *out_data, size_t out_data_size)
+esp_err_t esp_insights_encode_data_begin(uint8_t *out_data, size_t out_data_size)
 {
     if (!out_data || !out_data_size) {
         return ESP_ERR_INVALID_ARG;
@@ -110,6 +113,35 @@ size_t esp_insights_encode_conf_meta(uint8_t *out_data, size_t out_data_size, ch
     return len;
 }
 
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+#define FNV1A_INIT 2166136261U
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len--) {
+        hash = (hash ^ *p++) * 16777619U;
+    }
+    return hash;
+}
+
+/* Signature of a crash, from the PC, the cause and the backtrace. Registers and addresses of the data vary from
+ * one occurrence to the other, they are left out. */
+static uint32_t crash_sig_get(const esp_core_dump_summary_t *summary)
+{
+    uint32_t hash = fnv1a(FNV1A_INIT, &summary->exc_pc, sizeof(summary->exc_pc));
+#if CONFIG_IDF_TARGET_ARCH_RISCV
+    /* The backtrace is not unwound on RISC-V, the return address stands for it */
+    hash = fnv1a(hash, &summary->ex_info.mcause, sizeof(summary->ex_info.mcause));
+    hash = fnv1a(hash, &summary->ex_info.ra, sizeof(summary->ex_info.ra));
+#else
+    hash = fnv1a(hash, &summary->ex_info.exc_cause, sizeof(summary->ex_info.exc_cause));
+    hash = fnv1a(hash, summary->exc_bt_info.bt, summary->exc_bt_info.depth * sizeof(summary->exc_bt_info.bt[0]));
+#endif
+    return hash;
+}
+#endif /* CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE */
+
 void esp_insights_encode_boottime_data(void)
 {
     /* encode device info */
@@ -127,13 +159,31 @@ void esp_insights_encode_boottime_data(void)
         if (summary) {
             memset(summary, 0, sizeof(esp_core_dump_summary_t));
             if (esp_core_dump_get_summary(summary) == ESP_OK) {
-                esp_insights_cbor_encode_diag_crash(summary);
+                uint32_t count = 0;
+                bool full = true;
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+                uint32_t sig = crash_sig_get(summary);
+                if (esp_insights_crash_sig_account(sig, fnv1a(FNV1A_INIT, summary, sizeof(*summary)),
+                                                   &count, &full) != ESP_OK) {
+                    count = 0;
+                    full = true;
+                }
+#else
+                uint32_t sig = 0;
+#endif /* CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE */
+                esp_insights_cbor_encode_diag_crash(summary, sig, count, full);
             }
             free(summary);
         }
     } else if (err == ESP_ERR_INVALID_CRC) {
         ESP_LOGE(TAG, "Core dump stored in flash is corrupted");
     }
+#if CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE
+    else {
+        /* A boot without a crash ends a crash loop */
+        esp_insights_crash_sig_window_end();
+    }
+#endif /* CONFIG_ESP_INSIGHTS_CRASH_SIGNATURE */
 #endif /* CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE */
 }
 
@@ -160,13 +210,13 @@ size_t esp_insights_encode_conf_end(uint8_t *out_data)
     return len;
 }
 
-size_t esp_insights_encode_critical_data(const void *data, size_t data_size)
+size_t esp_insights_encode_critical_data(const esp_diag_data_store_span_t spans[2], bool all_read)
 {
     size_t consumed = 0;
-    if (data) {
-        consumed = esp_insights_cbor_encode_diag_logs(data, data_size);
+    if (spans && spans[0].len) {
+        consumed = esp_insights_cbor_encode_diag_logs(spans, all_read);
         if (consumed) {
-            uint8_t meta_idx = ((uint8_t *) data)[0];
+            uint8_t meta_idx = spans[0].data[0];
             const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_by_index(meta_idx);
             if (hdr) {
                 esp_insights_cbor_encode_meta_c_hdr(hdr);
@@ -176,22 +226,22 @@ size_t esp_insights_encode_critical_data(const void *data, size_t data_size)
     return consumed;
 }
 
-size_t esp_insights_encode_non_critical_data(const void *data, size_t data_size)
+size_t esp_insights_encode_non_critical_data(const esp_diag_data_store_span_t spans[2], bool series)
 {
     size_t consumed_max = 0;
-    if (data) {
+    if (spans && spans[0].len) {
 #if CONFIG_DIAG_ENABLE_METRICS
-        consumed_max = esp_insights_cbor_encode_diag_metrics(data, data_size);
+        consumed_max = esp_insights_cbor_encode_diag_metrics(spans, series);
 #endif /* CONFIG_DIAG_ENABLE_METRICS */
 #if CONFIG_DIAG_ENABLE_VARIABLES
-        size_t consumed = esp_insights_cbor_encode_diag_variables(data, data_size);
+        size_t consumed = esp_insights_cbor_encode_diag_variables(spans);
         if (consumed > consumed_max) {
             consumed_max = consumed;
         }
 #endif /* CONFIG_DIAG_ENABLE_VARIABLES */
 #if CONFIG_DIAG_ENABLE_METRICS || CONFIG_DIAG_ENABLE_VARIABLES
         if (consumed_max) {
-            uint8_t meta_idx = ((uint8_t *) data)[0];
+            uint8_t meta_idx = spans[0].data[0];
             const rtc_store_meta_header_t *hdr = rtc_store_get_meta_record_by_index(meta_idx);
             if (hdr) {
                 esp_insights_cbor_encode_meta_nc_hdr(hdr);
@@ -202,6 +252,24 @@ size_t esp_insights_encode_non_critical_data(const void *data, size_t data_size)
     return consumed_max;
 }
 
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+void esp_insights_encode_trace_data(const esp_diag_trace_event_t *events, size_t count)
+{
+    if (events && count) {
+        esp_insights_cbor_encode_diag_trace(events, count);
+    }
+}
+#endif /* CONFIG_ESP_INSIGHTS_TRACE_UPLOAD */
+
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+void esp_insights_encode_gateway_data(size_t count)
+{
+    if (count) {
+        esp_insights_cbor_encode_diag_children();
+    }
+}
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
+
 size_t esp_insights_encode_data_end(uint8_t *out_data)
 {
     if (!out_data) {
@@ -215,3 +283,173 @@ size_t esp_insights_encode_data_end(uint8_t *out_data)
     len += TLV_OFFSET;
     return len;
 }
+
+void esp_insights_encode_stream_init(esp_insights_encode_stream_t *stream, uint8_t *buf, size_t size,
+                                     esp_insights_encode_flush_t flush)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->buf = buf;
+    stream->size = size;
+    stream->flush = flush;
+    stream->ts = esp_diag_timestamp_get();
+}
+
+void esp_insights_encode_stream_rewind(esp_insights_encode_stream_t *stream, uint8_t *buf, size_t size,
+                                       esp_insights_encode_flush_t flush)
+{
+    stream->buf = buf;
+    stream->size = size;
+    stream->flush = flush;
+    stream->msg_len = stream->total;
+    stream->total = 0;
+    stream->len = 0;
+    stream->err = ESP_OK;
+}
+
+static void stream_append(esp_insights_encode_stream_t *stream, const void *data, size_t len)
+{
+    const uint8_t *src = data;
+    stream->total += len;
+    if (!stream->buf || stream->err != ESP_OK) {
+        return;
+    }
+    if (stream->msg_len && stream->total > stream->msg_len) {
+        /* Not the message that was counted, its header has the wrong length */
+        stream->err = ESP_ERR_INVALID_SIZE;
+        return;
+    }
+    while (len) {
+        if (stream->len == stream->size) {
+            if (!stream->flush) {
+                stream->err = ESP_ERR_NO_MEM;
+                return;
+            }
+            stream->err = stream->flush(stream->buf, stream->len);
+            if (stream->err != ESP_OK) {
+                return;
+            }
+            stream->len = 0;
+        }
+        size_t n = stream->size - stream->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stream->buf + stream->len, src, n);
+        stream->len += n;
+        src += n;
+        len -= n;
+    }
+}
+
+static void stream_compress_out(void *ctx, const uint8_t *data, size_t len)
+{
+    stream_append((esp_insights_encode_stream_t *) ctx, data, len);
+}
+
+static CborError stream_write(void *token, const void *data, size_t len, CborEncoderAppendType append_type)
+{
+    esp_insights_encode_stream_t *stream = (esp_insights_encode_stream_t *) token;
+    if (stream->compressing) {
+        esp_insights_compress_sink(stream->compress, data, len);
+    } else {
+        stream_append(stream, data, len);
+    }
+    return CborNoError;
+}
+
+static void stream_header_write(esp_insights_encode_stream_t *stream, uint8_t type)
+{
+    /* Not known in the first pass, patched by stream_end() if the whole message is in the buffer */
+    uint16_t len = stream->msg_len ? stream->msg_len - TLV_OFFSET : 0;
+    uint8_t hdr[TLV_OFFSET] = { type };
+    memcpy(&hdr[1], &len, sizeof(len));
+    stream_append(stream, hdr, sizeof(hdr));
+}
+
+static size_t stream_end(esp_insights_encode_stream_t *stream)
+{
+    if (stream->total - TLV_OFFSET > UINT16_MAX) {
+        stream->err = ESP_ERR_INVALID_SIZE;
+    }
+    if (stream->buf && stream->err == ESP_OK) {
+        if (!stream->flush) {
+            uint16_t len = stream->total - TLV_OFFSET;
+            memcpy(&stream->buf[1], &len, sizeof(len));
+        } else if (stream->total != stream->msg_len) {
+            stream->err = ESP_ERR_INVALID_SIZE;
+        } else if (stream->len) {
+            stream->err = stream->flush(stream->buf, stream->len);
+            stream->len = 0;
+        }
+    }
+    return stream->err == ESP_OK ? stream->total : 0;
+}
+
+size_t esp_insights_encode_meta_stream(esp_insights_encode_stream_t *stream, char *sha256)
+{
+    if (!stream) {
+        return 0;
+    }
+    char sha[DIAG_HEX_SHA_SIZE + 1];
+    bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
+    stream_header_write(stream, INSIGHTS_META_DATA_TYPE);
+    esp_insights_cbor_encode_meta_begin_writer(stream_write, stream, INSIGHTS_META_VERSION, sha, stream->ts);
+    if (stream->compress) {
+        esp_insights_cbor_encode_meta_compression(INSIGHTS_COMPRESS_ALG, INSIGHTS_DATA_COMPRESSED_TYPE,
+                                                  stream->compress->window_sz2, stream->compress->lookahead_sz2);
+    }
+#if CONFIG_ESP_INSIGHTS_METRICS_SERIES
+    if (stream->series) {
+        esp_insights_cbor_encode_meta_series();
+    }
+#endif
+    esp_insights_cbor_encode_meta_data_begin();
+    esp_insights_encode_meta_data();
+    esp_insights_cbor_encode_meta_data_end();
+    esp_insights_cbor_encode_meta_end(NULL);
+    return stream_end(stream);
+}
+
+size_t esp_insights_encode_conf_meta_stream(esp_insights_encode_stream_t *stream, char *sha256)
+{
+    if (!stream) {
+        return 0;
+    }
+    char sha[DIAG_HEX_SHA_SIZE + 1];
+    bytes_to_hex((uint8_t *) sha256,(uint8_t *) sha, DIAG_SHA_SIZE);
+    stream_header_write(stream, INSIGHTS_META_DATA_TYPE);
+    esp_insights_cbor_encode_meta_begin_writer(stream_write, stream, INSIGHTS_META_VERSION, sha, stream->ts);
+    esp_insights_cbor_encode_conf_meta_data_begin();
+    esp_insights_cbor_encode_conf_meta_data_end();
+    esp_insights_cbor_encode_meta_end(NULL);
+    return stream_end(stream);
+}
+
+esp_err_t esp_insights_encode_data_begin_stream(esp_insights_encode_stream_t *stream)
+{
+    if (!stream) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    stream_header_write(stream, stream->compress ? INSIGHTS_DATA_COMPRESSED_TYPE : INSIGHTS_DATA_TYPE);
+    if (stream->compress) {
+        esp_insights_compress_reset(stream->compress, stream_compress_out, stream);
+        stream->compressing = true;
+    }
+    esp_insights_cbor_encode_diag_begin_writer(stream_write, stream, INSIGHTS_VERSION, stream->ts);
+    esp_insights_cbor_encode_diag_data_begin();
+    return ESP_OK;
+}
+
+size_t esp_insights_encode_data_end_stream(esp_insights_encode_stream_t *stream)
+{
+    if (!stream) {
+        return 0;
+    }
+    esp_insights_cbor_encode_diag_data_end();
+    esp_insights_cbor_encode_diag_end(NULL);
+    if (stream->compressing) {
+        esp_insights_compress_finish(stream->compress);
+        stream->compressing = false;
+    }
+    return stream_end(stream);
+}
@@ -6,11 +6,75 @@
 
 #pragma once
 
+#include <esp_diag_data_store.h>
+#include "esp_insights_compress.h"
+
 #if CONFIG_ESP_INSIGHTS_COREDUMP_ENABLE
 #include <esp_core_dump.h>
 #endif
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+#include <esp_diagnostics_trace.h>
+#endif
+
+/**
+ * @brief sends a full chunk of a streamed message
+ *
+ * @param data chunk
+ * @param len  length of the chunk
+ * @return ESP_OK on success, appropriate error otherwise
+ */
+typedef esp_err_t (*esp_insights_encode_flush_t)(const void *data, size_t len);
+
+/**
+ * @brief output of the stream encoding functions
+ *
+ * If flush is set then the message is written to buf, which is flushed every time it is full.
+ * The length of the message is needed for its header before the first byte can be flushed, so the
+ * message is encoded twice: once to count the bytes and once to send them.
+ * If flush is not set then the whole message is encoded into buf, or counted only if buf is NULL.
+ * The CBOR of a data message is compressed if compress is set, its header stays uncompressed.
+ * The metrics of a data message are grouped into series if series is set.
+ */
+typedef struct {
+    uint8_t *buf;                       /* Chunk or whole message buffer, NULL to count the bytes */
+    size_t size;                        /* Size of buf */
+    size_t len;                         /* Bytes in buf */
+    size_t total;                       /* Bytes of the message encoded so far */
+    size_t msg_len;                     /* Length of the message counted by the previous pass, 0 if unknown */
+    uint64_t ts;                        /* Timestamp of the message, same in both passes */
+    esp_insights_encode_flush_t flush;
+    esp_err_t err;                      /* First error, no more bytes are written after it */
+    esp_insights_compress_t *compress;  /* Compresses data messages and is advertised in meta messages, optional */
+    bool compressing;                   /* Bytes pass through compress */
+    bool series;                        /* Metrics series in data messages, advertised in meta messages */
+} esp_insights_encode_stream_t;
+
+/**
+ * @brief initialize a stream for the first pass
+ *
+ * @param stream stream to initialize
+ * @param buf    buffer, NULL to count the bytes only
+ * @param size   size of buf
+ * @param flush  function sending full chunks, NULL if buf holds the whole message
+ */
+void esp_insights_encode_stream_init(esp_insights_encode_stream_t *stream, uint8_t *buf, size_t size,
+                                     esp_insights_encode_flush_t flush);
+
+/**
+ * @brief prepare a stream for encoding the message counted by the previous pass again
+ *
+ * @param stream stream used by the previous pass
+ * @param buf    chunk buffer
+ * @param size   size of buf
+ * @param flush  function sending full chunks
+ */
+void esp_insights_encode_stream_rewind(esp_insights_encode_stream_t *stream, uint8_t *buf, size_t size,
+                                       esp_insights_encode_flush_t flush);
 
 size_t esp_insights_encode_meta(uint8_t *out_data, size_t out_data_size, char *sha256);
+size_t esp_insights_encode_meta_stream(esp_insights_encode_stream_t *stream, char *sha256);
+size_t esp_insights_encode_conf_meta_stream(esp_insights_encode_stream_t *stream, char *sha256);
+esp_err_t esp_insights_encode_data_begin_stream(esp_insights_encode_stream_t *stream);
 size_t esp_insights_encode_conf_meta(uint8_t *out_data, size_t out_data_size, char *sha256);
 esp_err_t esp_insights_encode_data_begin(uint8_t *out_data, size_t out_data_size);
 void esp_insights_encode_boottime_data(void);
@@ -18,20 +82,39 @@ void esp_insights_encode_boottime_data(void);
 /**
  * @brief encode critical data
  *
- * @param critical_data pointer to critical data
- * @param critical_data_size size of critical data
+ * @param spans critical data, in one or two parts as returned by esp_diag_data_store_critical_peek()
+ * @param all_read true if critical data has all the data of the data store
  * @return size_t length of data consumed
  */
-size_t esp_insights_encode_critical_data(const void *critical_data, size_t critical_data_size);
+size_t esp_insights_encode_critical_data(const esp_diag_data_store_span_t spans[2], bool all_read);
 
 /**
  * @brief encode non_critical data
  *
- * @param critical_data pointer to non_critical data
- * @param critical_data_size size of non_critical data
+ * @param spans non_critical data, in one or two parts as returned by esp_diag_data_store_non_critical_peek()
+ * @param series group the metrics into series
  * @return size_t length of data consumed
  */
-size_t esp_insights_encode_non_critical_data(const void *non_critical_data, size_t non_critical_data_size);
+size_t esp_insights_encode_non_critical_data(const esp_diag_data_store_span_t spans[2], bool series);
+
+#if CONFIG_ESP_INSIGHTS_TRACE_UPLOAD
+/**
+ * @brief encode trace events as the timeline
+ *
+ * @param events trace events, as read by esp_diag_trace_read()
+ * @param count number of events, nothing is encoded if 0
+ */
+void esp_insights_encode_trace_data(const esp_diag_trace_event_t *events, size_t count);
+#endif /* CONFIG_ESP_INSIGHTS_TRACE_UPLOAD */
+
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+/**
+ * @brief encode the messages of the children as the children list
+ *
+ * @param count number of messages taken with esp_insights_gateway_take(), nothing is encoded if 0
+ */
+void esp_insights_encode_gateway_data(size_t count);
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
 
 /**
  * @brief finish encoding message
@@ -40,3 +123,13 @@ size_t esp_insights_encode_non_critical_data(const void *non_critical_data, size
  * @return size_t size of the data encoded
  */
 size_t esp_insights_encode_data_end(uint8_t *out_data);
+
+/**
+ * @brief finish encoding message started with esp_insights_encode_data_begin_stream()
+ *
+ * The bytes left in the chunk are flushed.
+ *
+ * @param stream stream of the message
+ * @return size_t size of the message with its header, 0 on error
+ */
+size_t esp_insights_encode_data_end_stream(esp_insights_encode_stream_t *stream);
@@ -0,0 +1,161 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_insights.h>
+#include <esp_insights_internal.h>
+#include "esp_insights_gateway.h"
+
+#define GATEWAY_BUFFER_SIZE     CONFIG_ESP_INSIGHTS_GATEWAY_BUFFER_SIZE
+#define GATEWAY_MSG_MAX         CONFIG_ESP_INSIGHTS_GATEWAY_MSG_MAX
+
+static const char *TAG = "insights_gateway";
+
+/* A message of a child, waiting to be uploaded */
+typedef struct insights_child_record {
+    struct insights_child_record *next;
+    size_t len;
+    char *node_id;      /* After the data, in the same allocation */
+    uint8_t data[];
+} insights_child_record_t;
+
+/* Bytes a record counts for, in the buffer and in the data message */
+#define RECORD_BYTES(rec)   ((rec)->len + strlen((rec)->node_id) + 1)
+
+/* The records are added by the application and taken by the sender, the lock is held only to link and unlink them.
+ * The taken records are the first ones, the ones added later are linked after them and not seen by the sender.
+ */
+static struct {
+    portMUX_TYPE lock;
+    insights_child_record_t *head;
+    insights_child_record_t *tail;
+    size_t bytes;
+    size_t taken;
+} s_gateway = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+esp_err_t esp_insights_gateway_child_data_add(const char *node_id, const void *data, size_t len)
+{
+    if (!node_id || !data || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t node_id_len = strlen(node_id);
+    if (len + node_id_len + 1 > GATEWAY_MSG_MAX) {
+        ESP_LOGW(TAG, "Message of %d bytes from %s is too long", (int) len, node_id);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    insights_child_record_t *rec = malloc(sizeof(insights_child_record_t) + len + node_id_len + 1);
+    if (!rec) {
+        return ESP_ERR_NO_MEM;
+    }
+    rec->next = NULL;
+    rec->len = len;
+    memcpy(rec->data, data, len);
+    rec->node_id = (char *) rec->data + len;
+    memcpy(rec->node_id, node_id, node_id_len + 1);
+
+    bool full;
+    portENTER_CRITICAL(&s_gateway.lock);
+    full = s_gateway.bytes + len + node_id_len + 1 > GATEWAY_BUFFER_SIZE;
+    if (!full) {
+        if (s_gateway.tail) {
+            s_gateway.tail->next = rec;
+        } else {
+            s_gateway.head = rec;
+        }
+        s_gateway.tail = rec;
+        s_gateway.bytes += len + node_id_len + 1;
+    }
+    portEXIT_CRITICAL(&s_gateway.lock);
+    if (full) {
+        /* The child keeps it and sends it again later */
+        free(rec);
+        return ESP_ERR_NO_MEM;
+    }
+    INSIGHTS_HEAP_TAG_ADD(rec);
+    return ESP_OK;
+}
+
+size_t esp_insights_gateway_take(size_t max_bytes)
+{
+    size_t count = 0, bytes = 0;
+    portENTER_CRITICAL(&s_gateway.lock);
+    for (insights_child_record_t *rec = s_gateway.head; rec; rec = rec->next) {
+        if (bytes + RECORD_BYTES(rec) > max_bytes) {
+            break;
+        }
+        bytes += RECORD_BYTES(rec);
+        count++;
+    }
+    s_gateway.taken = count;
+    portEXIT_CRITICAL(&s_gateway.lock);
+    return count;
+}
+
+void esp_insights_gateway_foreach_taken(esp_insights_gateway_record_cb_t cb, void *arg)
+{
+    /* The taken records are not unlinked until released, by the same sender */
+    insights_child_record_t *rec = s_gateway.head;
+    for (size_t i = 0; i < s_gateway.taken && rec; i++, rec = rec->next) {
+        cb(rec->node_id, rec->data, rec->len, arg);
+    }
+}
+
+void esp_insights_gateway_release(bool delivered)
+{
+    insights_child_record_t *done = NULL;
+    portENTER_CRITICAL(&s_gateway.lock);
+    if (delivered && s_gateway.taken) {
+        done = s_gateway.head;
+        insights_child_record_t *last = done;
+        s_gateway.bytes -= RECORD_BYTES(last);
+        for (size_t i = 1; i < s_gateway.taken; i++) {
+            last = last->next;
+            s_gateway.bytes -= RECORD_BYTES(last);
+        }
+        s_gateway.head = last->next;
+        if (!s_gateway.head) {
+            s_gateway.tail = NULL;
+        }
+        last->next = NULL;
+    }
+    s_gateway.taken = 0;
+    portEXIT_CRITICAL(&s_gateway.lock);
+    while (done) {
+        insights_child_record_t *next = done->next;
+        INSIGHTS_HEAP_TAG_FREE(done);
+        done = next;
+    }
+}
+
+uint32_t esp_insights_gateway_fill_get(size_t *filled)
+{
+    portENTER_CRITICAL(&s_gateway.lock);
+    *filled = s_gateway.bytes;
+    portEXIT_CRITICAL(&s_gateway.lock);
+    return (*filled * 1000) / GATEWAY_BUFFER_SIZE;
+}
+
+void esp_insights_gateway_clear(void)
+{
+    portENTER_CRITICAL(&s_gateway.lock);
+    insights_child_record_t *rec = s_gateway.head;
+    s_gateway.head = NULL;
+    s_gateway.tail = NULL;
+    s_gateway.bytes = 0;
+    s_gateway.taken = 0;
+    portEXIT_CRITICAL(&s_gateway.lock);
+    while (rec) {
+        insights_child_record_t *next = rec->next;
+        INSIGHTS_HEAP_TAG_FREE(rec);
+        rec = next;
+    }
+}
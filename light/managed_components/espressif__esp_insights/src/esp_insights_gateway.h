@@ -0,0 +1,73 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sdkconfig.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if CONFIG_ESP_INSIGHTS_GATEWAY
+/**
+ * @brief called for each message of a child taken for the data message
+ *
+ * @param node_id node id of the child
+ * @param data    message of the child
+ * @param len     length of the message
+ * @param arg     argument given to esp_insights_gateway_foreach_taken()
+ */
+typedef void (*esp_insights_gateway_record_cb_t)(const char *node_id, const uint8_t *data, size_t len, void *arg);
+
+/**
+ * @brief take the oldest messages of the children for the next data message
+ *
+ * The messages stay held, and are the ones visited by esp_insights_gateway_foreach_taken(), until
+ * esp_insights_gateway_release().
+ *
+ * @param max_bytes bytes of messages and node ids to take at most
+ * @return number of messages taken
+ */
+size_t esp_insights_gateway_take(size_t max_bytes);
+
+/**
+ * @brief call cb for each message taken by esp_insights_gateway_take(), oldest first
+ *
+ * @param cb  callback
+ * @param arg argument of the callback
+ */
+void esp_insights_gateway_foreach_taken(esp_insights_gateway_record_cb_t cb, void *arg);
+
+/**
+ * @brief end the use of the messages taken
+ *
+ * @param delivered true if the data message with them reached the cloud, they are freed. They are taken
+ *                  again by the next data message otherwise.
+ */
+void esp_insights_gateway_release(bool delivered);
+
+/**
+ * @brief fill level of the messages held, in per mille of CONFIG_ESP_INSIGHTS_GATEWAY_BUFFER_SIZE
+ *
+ * @param[out] filled bytes held
+ * @return fill level
+ */
+uint32_t esp_insights_gateway_fill_get(size_t *filled);
+
+/**
+ * @brief free all the messages held
+ */
+void esp_insights_gateway_clear(void);
+#endif /* CONFIG_ESP_INSIGHTS_GATEWAY */
+
+#ifdef __cplusplus
+}
+#endif
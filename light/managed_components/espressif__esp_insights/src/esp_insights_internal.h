@@ -7,6 +7,20 @@
 #pragma once
 
 #include <esp_err.h>
+#include <sdkconfig.h>
+#include <esp_insights.h>
+
+#if CONFIG_DIAG_HEAP_TAGS
+#include <esp_diagnostics_heap_tags.h>
+
+/* The buffers which Insights keeps while it runs are accounted to the "insights" heap tag */
+#define INSIGHTS_HEAP_TAG               "insights"
+#define INSIGHTS_HEAP_TAG_ADD(ptr)      esp_diag_heap_tag_add(INSIGHTS_HEAP_TAG, ptr)
+#define INSIGHTS_HEAP_TAG_FREE(ptr)     esp_diag_heap_tag_free(INSIGHTS_HEAP_TAG, ptr)
+#else
+#define INSIGHTS_HEAP_TAG_ADD(ptr)
+#define INSIGHTS_HEAP_TAG_FREE(ptr)     free(ptr)
+#endif
 
 #ifdef CONFIG_ESP_INSIGHTS_TRANSPORT_MQTT
 #include <esp_rmaker_mqtt_glue.h>
@@ -47,6 +61,41 @@ void esp_insights_transport_disconnect(void);
  */
 int esp_insights_transport_data_send(void *data, size_t len);
 
+/**
+ * @brief Check if the transport can send data in chunks
+ *
+ * @return true if the streamed data send callbacks are registered
+ */
+bool esp_insights_transport_stream_supported(void);
+
+/**
+ * @brief Start sending a message in chunks
+ *
+ * @param[in] len  Length of the whole message
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+esp_err_t esp_insights_transport_data_send_begin(size_t len);
+
+/**
+ * @brief Send a chunk of the message started with esp_insights_transport_data_send_begin()
+ *
+ * @param[in] data Chunk of the message
+ * @param[in] len  Length of the chunk
+ *
+ * @return ESP_OK on success, appropriate error code otherwise
+ */
+esp_err_t esp_insights_transport_data_send_chunk(const void *data, size_t len);
+
+/**
+ * @brief Finish sending the message started with esp_insights_transport_data_send_begin()
+ *
+ * @param[in] complete false to drop the message
+ *
+ * @return msg_id  Same as esp_insights_transport_data_send()
+ */
+int esp_insights_transport_data_send_end(bool complete);
+
 /**
  * @brief Send update to the cloud about new state
  */
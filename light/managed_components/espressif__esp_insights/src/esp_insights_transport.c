@@ -35,6 +35,11 @@ esp_err_t esp_insights_transport_register(esp_insights_transport_config_t *confi
         ESP_LOGE(TAG, "Failed to init transport, Please set at least data_send callback");
         return ESP_ERR_INVALID_ARG;
     }
+    if (!config->callbacks.data_send_begin != !config->callbacks.data_send_chunk ||
+        !config->callbacks.data_send_begin != !config->callbacks.data_send_end) {
+        ESP_LOGE(TAG, "Failed to init transport, Please set all or none of the data_send_begin/chunk/end callbacks");
+        return ESP_ERR_INVALID_ARG;
+    }
     memcpy(&s_priv_data.config, config, sizeof(s_priv_data.config));
     s_priv_data.init = true;
 
@@ -86,3 +91,38 @@ int esp_insights_transport_data_send(void *data, size_t len)
     ESP_LOGW(TAG, "data send callback not set");
     return -1;
 }
+
+bool esp_insights_transport_stream_supported(void)
+{
+    return s_priv_data.init && s_priv_data.config.callbacks.data_send_begin;
+}
+
+esp_err_t esp_insights_transport_data_send_begin(size_t len)
+{
+    CHECK_TRANSPORT_INIT(ESP_ERR_INVALID_STATE);
+    if (s_priv_data.config.callbacks.data_send_begin) {
+        return s_priv_data.config.callbacks.data_send_begin(len);
+    }
+    ESP_LOGW(TAG, "data send begin callback not set");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_insights_transport_data_send_chunk(const void *data, size_t len)
+{
+    CHECK_TRANSPORT_INIT(ESP_ERR_INVALID_STATE);
+    if (s_priv_data.config.callbacks.data_send_chunk) {
+        return s_priv_data.config.callbacks.data_send_chunk(data, len);
+    }
+    ESP_LOGW(TAG, "data send chunk callback not set");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+int esp_insights_transport_data_send_end(bool complete)
+{
+    CHECK_TRANSPORT_INIT(-1);
+    if (s_priv_data.config.callbacks.data_send_end) {
+        return s_priv_data.config.callbacks.data_send_end(complete);
+    }
+    ESP_LOGW(TAG, "data send end callback not set");
+    return -1;
+}
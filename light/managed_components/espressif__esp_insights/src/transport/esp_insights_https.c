@@ -17,13 +17,20 @@
 #include <esp_log.h>
 #include <esp_event.h>
 #include <esp_http_client.h>
+#include <esp_idf_version.h>
+#include <esp_timer.h>
 #include <esp_insights.h>
 #include <esp_insights_internal.h>
 
+#define HTTPS_IDLE_TIMEOUT_US   ((int64_t)CONFIG_ESP_INSIGHTS_TRANSPORT_HTTPS_IDLE_TIMEOUT * 1000000)
+
 typedef struct {
     const char *auth_key;
     const char *node_id;
     const char *url;
+    esp_http_client_handle_t client;    /* Kept between uploads, with its connection */
+    int64_t last_used;
+    bool streaming;                     /* Request of the data being streamed */
 } https_data_t;
 
 static https_data_t s_https_data;
@@ -47,8 +54,20 @@ static esp_err_t esp_insights_https_init(void *userdata)
     return ESP_OK;
 }
 
+/* Drop the client, for errors and idle connections. The next upload makes a new one. */
+static void https_client_drop(void)
+{
+    if (s_https_data.client) {
+        esp_http_client_close(s_https_data.client);
+        esp_http_client_cleanup(s_https_data.client);
+        s_https_data.client = NULL;
+    }
+    s_https_data.streaming = false;
+}
+
 static void esp_insights_https_deinit(void)
 {
+    https_client_drop();
     memset(&s_https_data, 0, sizeof(s_https_data));
 }
 
@@ -85,17 +104,8 @@ static esp_err_t http_event_handle(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-static int esp_insights_https_data_send(void *data, size_t len)
+static esp_http_client_handle_t https_client_create(void)
 {
-    if (!data) {
-        return ESP_ERR_INVALID_ARG;
-    }
-    if (!s_https_data.auth_key) {
-        ESP_LOGE(TAG, "Transport not initialized");
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    int msg_id = -1;
     char url[256];
     memset(url, 0, sizeof(url));
     snprintf(url, sizeof(url), "%s?node_id=%s", s_https_data.url, s_https_data.node_id);
@@ -107,11 +117,18 @@ static int esp_insights_https_data_send(void *data, size_t len)
         .buffer_size_tx = 1024,
         .event_handler = http_event_handle,
         .cert_pem = (const char *)insights_https_server_crt_start,
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+        .keep_alive_enable = true,
+#endif
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* When the connection is made again, the TLS session is resumed instead of a full handshake */
+        .save_client_session = true,
+#endif
     };
     esp_http_client_handle_t client = esp_http_client_init(&client_config);
     if (!client) {
         ESP_LOGE(TAG, "Failed to initialize esp_http_client");
-        return msg_id;
+        return NULL;
     }
     esp_err_t err = esp_http_client_set_header(client, "Authorization", s_https_data.auth_key);
     if (err != ESP_OK) {
@@ -123,29 +140,189 @@ static int esp_insights_https_data_send(void *data, size_t len)
         ESP_LOGE(TAG, "Failed to set content type err:0x%x", err);
         goto cleanup;
     }
-    err = esp_http_client_set_post_field(client, data, len);
+    return client;
+cleanup:
+    esp_http_client_cleanup(client);
+    return NULL;
+}
+
+static int https_response_check(esp_http_client_handle_t client)
+{
+    int msg_id = -1;
+    int status = esp_http_client_get_status_code(client);
+    if (status == HttpStatus_Ok) {
+        msg_id = 0;
+    } else {
+        ESP_LOGE(TAG, "API response status = %d", status);
+    }
+    return msg_id;
+}
+
+/* The client of the previous upload, unless it has been idle too long for its connection to be
+ * still open, or a new one.
+ */
+static esp_http_client_handle_t https_client_get(bool *reused)
+{
+    int64_t now = esp_timer_get_time();
+    *reused = false;
+    if (s_https_data.client) {
+        if (now - s_https_data.last_used < HTTPS_IDLE_TIMEOUT_US) {
+            *reused = true;
+        } else {
+            https_client_drop();
+        }
+    }
+    if (!s_https_data.client) {
+        s_https_data.client = https_client_create();
+    }
+    s_https_data.last_used = now;
+    return s_https_data.client;
+}
+
+/* Read the rest of the response, so that the next request can go on the same connection */
+static void https_response_flush(esp_http_client_handle_t client)
+{
+    char buf[64];
+    while (esp_http_client_read(client, buf, sizeof(buf)) > 0) {
+    }
+}
+
+/* Done with a request: the client is kept for the next one if all went fine */
+static void https_client_release(bool ok)
+{
+    if (!ok || HTTPS_IDLE_TIMEOUT_US == 0) {
+        https_client_drop();
+        return;
+    }
+    s_https_data.last_used = esp_timer_get_time();
+}
+
+static void https_send_event_post(int msg_id)
+{
+    if (msg_id == 0) {
+        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_SUCCESS, NULL, 0, portMAX_DELAY);
+    } else {
+        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_FAILED, NULL, 0, portMAX_DELAY);
+    }
+}
+
+static int esp_insights_https_data_send(void *data, size_t len)
+{
+    if (!data) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!s_https_data.auth_key) {
+        ESP_LOGE(TAG, "Transport not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_https_data.streaming) {
+        ESP_LOGE(TAG, "Previous data send not finished");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int msg_id = -1;
+    bool reused;
+    esp_http_client_handle_t client = https_client_get(&reused);
+    if (!client) {
+        return msg_id;
+    }
+    esp_err_t err = esp_http_client_set_post_field(client, data, len);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_http_client_set_post_field failed err:0x%x", err);
-        goto cleanup;
+        https_client_release(false);
+        return msg_id;
     }
     err = esp_http_client_perform(client);
+    if (err != ESP_OK && reused) {
+        /* The server may have closed the connection kept since the previous upload */
+        ESP_LOGD(TAG, "Retrying on a new connection after err:0x%x", err);
+        https_client_drop();
+        client = https_client_get(&reused);
+        if (client && esp_http_client_set_post_field(client, data, len) == ESP_OK) {
+            err = esp_http_client_perform(client);
+        } else {
+            err = ESP_FAIL;
+        }
+    }
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_http_client_perform failed err:0x%x", err);
     } else {
-        int status = esp_http_client_get_status_code(client);
-        if (status == HttpStatus_Ok) {
-            msg_id = 0;
-        } else {
-            ESP_LOGE(TAG, "API response status = %d", status);
+        msg_id = https_response_check(client);
+    }
+    https_send_event_post(msg_id);
+    https_client_release(err == ESP_OK);
+    return msg_id;
+}
+
+/* The request is opened with the length of the whole message, and the chunks are written as its body */
+static esp_err_t esp_insights_https_data_send_begin(size_t len)
+{
+    if (!s_https_data.auth_key) {
+        ESP_LOGE(TAG, "Transport not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_https_data.streaming) {
+        ESP_LOGE(TAG, "Previous data send not finished");
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool reused;
+    esp_http_client_handle_t client = https_client_get(&reused);
+    if (!client) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = esp_http_client_open(client, len);
+    if (err != ESP_OK && reused) {
+        /* The server may have closed the connection kept since the previous upload */
+        https_client_drop();
+        client = https_client_get(&reused);
+        err = client ? esp_http_client_open(client, len) : ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_http_client_open failed err:0x%x", err);
+        https_client_release(false);
+        return err;
+    }
+    s_https_data.streaming = true;
+    return ESP_OK;
+}
+
+static esp_err_t esp_insights_https_data_send_chunk(const void *data, size_t len)
+{
+    if (!s_https_data.streaming) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    while (len) {
+        int written = esp_http_client_write(s_https_data.client, data, len);
+        if (written <= 0) {
+            ESP_LOGE(TAG, "esp_http_client_write failed");
+            return ESP_FAIL;
         }
+        data = (const uint8_t *)data + written;
+        len -= written;
     }
-    if (msg_id == 0) {
-        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_SUCCESS, NULL, 0, portMAX_DELAY);
-    } else {
-        esp_event_post(INSIGHTS_EVENT, INSIGHTS_EVENT_TRANSPORT_SEND_FAILED, NULL, 0, portMAX_DELAY);
+    return ESP_OK;
+}
+
+static int esp_insights_https_data_send_end(bool complete)
+{
+    int msg_id = -1;
+    if (!s_https_data.streaming) {
+        return msg_id;
     }
-cleanup:
-    esp_http_client_cleanup(client);
+    bool ok = false;
+    if (complete) {
+        if (esp_http_client_fetch_headers(s_https_data.client) < 0) {
+            ESP_LOGE(TAG, "esp_http_client_fetch_headers failed");
+        } else {
+            msg_id = https_response_check(s_https_data.client);
+            https_response_flush(s_https_data.client);
+            ok = true;
+        }
+    }
+    https_send_event_post(msg_id);
+    s_https_data.streaming = false;
+    /* An incomplete request leaves the connection in the middle of a body */
+    https_client_release(ok);
     return msg_id;
 }
 
@@ -154,5 +331,8 @@ esp_insights_transport_config_t g_default_insights_transport_https = {
         .init = esp_insights_https_init,
         .deinit = esp_insights_https_deinit,
         .data_send = esp_insights_https_data_send,
+        .data_send_begin = esp_insights_https_data_send_begin,
+        .data_send_chunk = esp_insights_https_data_send_chunk,
+        .data_send_end = esp_insights_https_data_send_end,
     }
 };
@@ -3,9 +3,13 @@
 import os
 import sys
 import argparse
+import base64
+import hashlib
+import json
 import pathlib
 import shutil
 import struct
+import zlib
 
 FILETAG_RCP_VERSION = 0
 FILETAG_RCP_FLASH_ARGS = 1
@@ -13,7 +17,12 @@ FILETAG_RCP_BOOTLOADER = 2
 FILETAG_RCP_PARTITION_TABLE = 3
 FILETAG_RCP_FIRMWARE = 4
 FILETAG_BR_OTA_IMAGE = 5
+FILETAG_RCP_FLASHER_STUB = 6
 FILETAG_IMAGE_HEADER = 0xff
+FILETAG_DEFLATED = 0x10
+FILETAG_REGIONS = 0x20
+
+FLASH_SECTOR_SIZE = 4096
 
 HEADER_ENTRY_SIZE = 3 * 4
 RCP_IMAGE_HEADER_SIZE = HEADER_ENTRY_SIZE * 6
@@ -34,7 +43,57 @@ def append_subfile(fout, target_file):
             data = fin.read(buf_size)
 
 
-def append_flash_args(fout, flash_args_path):
+def deflate_binary(target_file):
+    """Returns the binary compressed with zlib, after its size and MD5, so
+    that the RCP decompresses it as it is flashed.
+
+    """
+
+    with open(target_file, 'rb') as fin:
+        data = fin.read()
+    return (struct.pack('<L', len(data))
+            + hashlib.md5(data).digest()
+            + zlib.compress(data, 9))
+
+
+def split_binary(target_file, region_size, compress):
+    """Returns the binary split in regions of given size, after its size,
+    the region size and the stored size and MD5 of each region, so that
+    the RCP only flashes the regions whose MD5 differs from its flash.
+    Regions are compressed independently, to be flashed alone.
+
+    """
+
+    with open(target_file, 'rb') as fin:
+        data = fin.read()
+    regions = [data[i:i + region_size] for i in range(0, len(data), region_size)]
+    stored = [zlib.compress(region, 9) if compress else region for region in regions]
+    table = b''.join(struct.pack('<L', len(s)) + hashlib.md5(r).digest()
+                     for r, s in zip(regions, stored))
+    return struct.pack('<LL', len(data), region_size) + table + b''.join(stored)
+
+
+def pack_flasher_stub(stub_path):
+    """Returns the flasher stub of a stub JSON file of esptool, its entry
+    point and load addresses followed by its text and data segments.
+
+    """
+
+    with open(stub_path, 'r') as fin:
+        stub = json.load(fin)
+    text = base64.b64decode(stub['text'])
+    data = base64.b64decode(stub.get('data', ''))
+    return (struct.pack('<LLLLL',
+                        stub['entry'],
+                        stub['text_start'],
+                        len(text),
+                        stub.get('data_start', 0),
+                        len(data))
+            + text
+            + data)
+
+
+def append_flash_args(fout, flash_args_path, tag_flags):
     with open(flash_args_path, 'r') as f:
         # skip first line
         next(f)
@@ -42,11 +101,11 @@ def append_flash_args(fout, flash_args_path):
     for offset, partition_file in partition_info_list:
         offset = int(offset, 0)
         if partition_file.find('bootloader') >= 0:
-            fout.write(struct.pack('<LL', FILETAG_RCP_BOOTLOADER, offset))
+            fout.write(struct.pack('<LL', FILETAG_RCP_BOOTLOADER | tag_flags, offset))
         elif partition_file.find('partition_table') >= 0:
-            fout.write(struct.pack('<LL', FILETAG_RCP_PARTITION_TABLE, offset))
+            fout.write(struct.pack('<LL', FILETAG_RCP_PARTITION_TABLE | tag_flags, offset))
         else:
-            fout.write(struct.pack('<LL', FILETAG_RCP_FIRMWARE, offset))
+            fout.write(struct.pack('<LL', FILETAG_RCP_FIRMWARE | tag_flags, offset))
 
 
 def main():
@@ -54,7 +113,16 @@ def main():
     parser.add_argument('--rcp-build-dir', type=str, required=True)
     parser.add_argument('--br-firmware', type=str, required=False)
     parser.add_argument('--target-file', type=str, required=True)
+    parser.add_argument('--compress', action='store_true',
+                        help='Store the RCP binaries compressed, they are flashed compressed')
+    parser.add_argument('--flasher-stub', type=str, required=False,
+                        help='Stub JSON file of esptool for the RCP chip, the RCP is flashed with it')
+    parser.add_argument('--region-size', type=lambda x: int(x, 0), default=0,
+                        help='Split the RCP binaries in regions of this size, only the regions which '
+                        'differ from the RCP flash are flashed')
     args = parser.parse_args()
+    if args.region_size < 0 or args.region_size % FLASH_SECTOR_SIZE:
+        parser.error('--region-size must be a multiple of {}'.format(FLASH_SECTOR_SIZE))
     base_dir = args.rcp_build_dir
     pathlib.Path(os.path.dirname(args.target_file)).mkdir(parents=True, exist_ok=True)
     rcp_version_path = os.path.join(base_dir, 'rcp_version')
@@ -63,10 +131,32 @@ def main():
     partition_table_path = os.path.join(
             base_dir, 'partition_table', 'partition-table.bin')
     rcp_firmware_path = os.path.join(base_dir, 'esp_ot_rcp.bin')
+    rcp_binaries = []
+    for path in [bootloader_path, partition_table_path, rcp_firmware_path]:
+        if args.region_size:
+            rcp_binaries.append(split_binary(path, args.region_size, args.compress))
+        elif args.compress:
+            rcp_binaries.append(deflate_binary(path))
+        else:
+            with open(path, 'rb') as fin:
+                rcp_binaries.append(fin.read())
+    tag_flags = FILETAG_DEFLATED if args.compress else 0
+    if args.region_size:
+        tag_flags |= FILETAG_REGIONS
+    bootloader, partition_table, rcp_firmware = rcp_binaries
+    flasher_stub = None
+    if args.flasher_stub:
+        if os.path.exists(args.flasher_stub):
+            flasher_stub = pack_flasher_stub(args.flasher_stub)
+        else:
+            print('Warning: flasher stub {} not found, the RCP is flashed by its ROM loader'.format(
+                args.flasher_stub))
     with open(args.target_file, 'wb') as fout:
         image_header_size = RCP_IMAGE_HEADER_SIZE
         if args.br_firmware:
             image_header_size += HEADER_ENTRY_SIZE
+        if flasher_stub:
+            image_header_size += HEADER_ENTRY_SIZE
         offset = append_subfile_header(
                 fout, FILETAG_IMAGE_HEADER, image_header_size, 0)
         offset = append_subfile_header(
@@ -74,18 +164,22 @@ def main():
         offset = append_subfile_header(
                 fout, FILETAG_RCP_FLASH_ARGS, RCP_FLASH_ARGS_SIZE, offset)
         offset = append_subfile_header(
-                fout, FILETAG_RCP_BOOTLOADER, os.path.getsize(bootloader_path), offset)
+                fout, FILETAG_RCP_BOOTLOADER | tag_flags, len(bootloader), offset)
         offset = append_subfile_header(
-                fout, FILETAG_RCP_PARTITION_TABLE, os.path.getsize(partition_table_path), offset)
+                fout, FILETAG_RCP_PARTITION_TABLE | tag_flags, len(partition_table), offset)
         offset = append_subfile_header(
-                fout, FILETAG_RCP_FIRMWARE, os.path.getsize(rcp_firmware_path), offset)
+                fout, FILETAG_RCP_FIRMWARE | tag_flags, len(rcp_firmware), offset)
+        if flasher_stub:
+            offset = append_subfile_header(fout, FILETAG_RCP_FLASHER_STUB, len(flasher_stub), offset)
         if args.br_firmware:
             offset = append_subfile_header(fout, FILETAG_BR_OTA_IMAGE, os.path.getsize(args.br_firmware), offset)
         append_subfile(fout, rcp_version_path)
-        append_flash_args(fout, flash_args_path)
-        append_subfile(fout, bootloader_path)
-        append_subfile(fout, partition_table_path)
-        append_subfile(fout, rcp_firmware_path)
+        append_flash_args(fout, flash_args_path, tag_flags)
+        fout.write(bootloader)
+        fout.write(partition_table)
+        fout.write(rcp_firmware)
+        if flasher_stub:
+            fout.write(flasher_stub)
         if args.br_firmware:
             append_subfile(fout, args.br_firmware)
 
@@ -17,9 +17,17 @@ typedef enum {
     FILETAG_RCP_PARTITION_TABLE = 3,
     FILETAG_RCP_FIRMWARE = 4,
     FILETAG_BR_FIRMWARE = 5,
+    FILETAG_RCP_FLASHER_STUB = 6,
     FILETAG_IMAGE_HEADER = 0xff,
 } esp_br_filetag_t;
 
+/* Set in the tag of a binary to flash which is compressed, see esp_br_deflated_info_t */
+#define FILETAG_DEFLATED 0x10
+/* Set in the tag of a binary to flash which is split in regions, see esp_br_regions_info_t */
+#define FILETAG_REGIONS 0x20
+
+#define ESP_BR_FLASH_SECTOR_SIZE 4096
+
 struct esp_br_subfile_info {
     uint32_t tag;
     uint32_t size;
@@ -28,6 +36,41 @@ struct esp_br_subfile_info {
 
 typedef struct esp_br_subfile_info esp_br_subfile_info_t;
 
+/* Starts a compressed binary, followed by the binary compressed with zlib */
+struct esp_br_deflated_info {
+    uint32_t size;          /* of the binary decompressed */
+    uint8_t md5[16];        /* of the binary decompressed */
+} __attribute__((packed));
+
+typedef struct esp_br_deflated_info esp_br_deflated_info_t;
+
+/* Starts a binary split in regions, followed by an esp_br_region_info_t for each region and the regions,
+ * each compressed alone with zlib if the binary is compressed */
+struct esp_br_regions_info {
+    uint32_t size;          /* of the binary */
+    uint32_t region_size;   /* a multiple of the flash sector size, the last region may be shorter */
+} __attribute__((packed));
+
+typedef struct esp_br_regions_info esp_br_regions_info_t;
+
+struct esp_br_region_info {
+    uint32_t stored_size;   /* of the region in the image, compressed or not */
+    uint8_t md5[16];        /* of the region decompressed */
+} __attribute__((packed));
+
+typedef struct esp_br_region_info esp_br_region_info_t;
+
+/* Starts the flasher stub of the RCP, followed by its text and data segments */
+struct esp_br_flasher_stub_info {
+    uint32_t entry;
+    uint32_t text_start;
+    uint32_t text_size;
+    uint32_t data_start;
+    uint32_t data_size;
+} __attribute__((packed));
+
+typedef struct esp_br_flasher_stub_info esp_br_flasher_stub_info_t;
+
 #define ESP_BR_RCP_IMAGE_FILENAME "rcp_image"
 
 #ifdef __cplusplus
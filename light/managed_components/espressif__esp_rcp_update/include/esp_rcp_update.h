@@ -34,7 +34,8 @@ typedef struct {
     int uart_baudrate;                        /*!< UART baudrate */
     int reset_pin;                            /*!< RESET pin */
     int boot_pin;                             /*!< Boot mode select pin */
-    uint32_t update_baudrate;                 /*!< Baudrate when flashing the firmware */
+    uint32_t update_baudrate;                 /*!< Highest baudrate when flashing the firmware, lower ones
+                                                   are tried if the link fails at it, 0 to keep uart_baudrate */
     char firmware_dir[RCP_FIRMWARE_DIR_SIZE]; /*!< The directory storing the RCP firmware */
     target_chip_t target_chip;                /*!< The target chip type */
 } esp_rcp_update_config_t;
@@ -7,7 +7,9 @@
 #include "esp_rcp_update.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "esp32_port.h"
@@ -20,10 +22,18 @@
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 
 #define RCP_UPDATE_MAX_RETRY 3
 #define RCP_VERIFIED_FLAG (1 << 5)
 #define RCP_SEQ_KEY "rcp_seq"
+#define RCP_ROM_BLOCK_SIZE 1024
+/* Read on the RCP to check the link after a baudrate change, a ROM address which reads on all chips */
+#define RCP_LINK_CHECK_REG_ADDR 0x40001000
+#define RCP_READER_TASK_STACK_SIZE 3072
+#define RCP_PROGRESS_LOG_INTERVAL_MS 1000
 #define TAG "RCP_UPDATE"
 
 typedef struct esp_rcp_update_handle {
@@ -42,7 +52,10 @@ typedef struct rcp_flash_arg_t rcp_flash_arg_t;
 
 static esp_rcp_update_handle s_handle;
 
-static esp_loader_error_t connect_to_target(target_chip_t target_chip, uint32_t higher_baudrate)
+/* Tried in turn below update_baudrate when the link fails at it */
+static const uint32_t s_fallback_baudrates[] = {2000000, 1500000, 921600, 460800, 230400};
+
+static esp_loader_error_t connect_to_target(target_chip_t target_chip, const esp_loader_stub_t *stub)
 {
     esp_loader_connect_args_t connect_config = ESP_LOADER_CONNECT_DEFAULT();
 
@@ -54,12 +67,56 @@ static esp_loader_error_t connect_to_target(target_chip_t target_chip, uint32_t
         return ESP_LOADER_ERROR_UNSUPPORTED_CHIP;
     }
 
-    if (higher_baudrate) {
-        ESP_RETURN_ON_ERROR(esp_loader_change_transmission_rate(higher_baudrate), TAG,
-                            "Failed to change bootloader baudrate");
-        ESP_RETURN_ON_ERROR(loader_port_change_transmission_rate(higher_baudrate), TAG,
+    if (stub) {
+        ESP_RETURN_ON_ERROR(esp_loader_run_stub(stub), TAG, "Failed to run the flasher stub");
+    }
+    return ESP_LOADER_SUCCESS;
+}
+
+static esp_loader_error_t change_baudrate(uint32_t baudrate)
+{
+    uint32_t reg_value;
+
+    if (esp_loader_stub_running()) {
+        ESP_RETURN_ON_ERROR(esp_loader_change_transmission_rate_stub(s_handle.update_config.uart_baudrate, baudrate),
+                            TAG, "Failed to change stub baudrate");
+    } else {
+        ESP_RETURN_ON_ERROR(esp_loader_change_transmission_rate(baudrate), TAG, "Failed to change bootloader baudrate");
+    }
+    ESP_RETURN_ON_ERROR(loader_port_change_transmission_rate(baudrate), TAG, "Failed to change local port baudrate");
+    return esp_loader_read_register(RCP_LINK_CHECK_REG_ADDR, &reg_value);
+}
+
+static esp_loader_error_t connect_at_highest_baudrate(target_chip_t target_chip, const esp_loader_stub_t *stub,
+                                                      uint32_t max_baudrate)
+{
+    uint32_t uart_baudrate = s_handle.update_config.uart_baudrate;
+    uint32_t baudrate = max_baudrate;
+    size_t next = 0;
+
+    ESP_RETURN_ON_ERROR(connect_to_target(target_chip, stub), TAG, "Failed to connect at %" PRIu32 " baud",
+                        uart_baudrate);
+
+    while (baudrate > uart_baudrate) {
+        if (change_baudrate(baudrate) == ESP_LOADER_SUCCESS) {
+            ESP_LOGI(TAG, "Flashing at %" PRIu32 " baud", baudrate);
+            return ESP_LOADER_SUCCESS;
+        }
+        ESP_LOGW(TAG, "RCP link fails at %" PRIu32 " baud", baudrate);
+
+        /* The RCP is reset by the connection, so it is back at the UART baudrate */
+        ESP_RETURN_ON_ERROR(loader_port_change_transmission_rate(uart_baudrate), TAG,
                             "Failed to change local port baudrate");
+        ESP_RETURN_ON_ERROR(connect_to_target(target_chip, stub), TAG, "Failed to reconnect");
+
+        while (next < sizeof(s_fallback_baudrates) / sizeof(s_fallback_baudrates[0]) &&
+                s_fallback_baudrates[next] >= baudrate) {
+            next++;
+        }
+        baudrate = next < sizeof(s_fallback_baudrates) / sizeof(s_fallback_baudrates[0]) ?
+                   s_fallback_baudrates[next] : 0;
     }
+    ESP_LOGI(TAG, "Flashing at %" PRIu32 " baud", uart_baudrate);
     return ESP_LOADER_SUCCESS;
 }
 
@@ -89,6 +146,42 @@ static esp_err_t seek_to_subfile(FILE *fp, esp_br_filetag_t tag, esp_br_subfile_
     return ESP_ERR_NOT_FOUND;
 }
 
+static esp_err_t load_flasher_stub(FILE *fp, esp_loader_stub_t *stub, uint8_t **segments)
+{
+    esp_br_subfile_info_t subfile;
+    esp_br_flasher_stub_info_t info;
+
+    esp_err_t err = seek_to_subfile(fp, FILETAG_RCP_FLASHER_STUB, &subfile);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_RETURN_ON_FALSE(subfile.size >= sizeof(info) && fread(&info, 1, sizeof(info), fp) == sizeof(info), ESP_FAIL,
+                        TAG, "Failed to read flasher stub info");
+    size_t segments_size = subfile.size - sizeof(info);
+    ESP_RETURN_ON_FALSE(info.text_size <= segments_size && info.data_size == segments_size - info.text_size,
+                        ESP_ERR_INVALID_SIZE, TAG, "Invalid flasher stub");
+
+    *segments = malloc(segments_size);
+    ESP_RETURN_ON_FALSE(*segments, ESP_ERR_NO_MEM, TAG, "Failed to allocate flasher stub");
+    if (fread(*segments, 1, segments_size, fp) != segments_size) {
+        free(*segments);
+        *segments = NULL;
+        ESP_LOGE(TAG, "Failed to read flasher stub");
+        return ESP_FAIL;
+    }
+
+    *stub = (esp_loader_stub_t) {
+        .entry = info.entry,
+        .text_start = info.text_start,
+        .text = *segments,
+        .text_size = info.text_size,
+        .data_start = info.data_start,
+        .data = *segments + info.text_size,
+        .data_size = info.data_size,
+    };
+    return ESP_OK;
+}
+
 esp_err_t esp_rcp_load_version_in_storage(char *version_str, size_t size)
 {
     char fullpath[RCP_FILENAME_MAX_SIZE];
@@ -108,45 +201,163 @@ esp_err_t esp_rcp_load_version_in_storage(char *version_str, size_t size)
     return ESP_OK;
 }
 
-static esp_loader_error_t flash_binary(FILE *firmware, size_t size, size_t address)
+/* A block read from the image, or the end of the reader with a NULL data */
+typedef struct {
+    uint8_t *data;
+    size_t size;            /* 0 if it could not be read */
+} rcp_read_block_t;
+
+/* Reads the image in the background, into the free buffers it is given, while the blocks read are written */
+typedef struct {
+    FILE *firmware;
+    size_t size;            /* left to read */
+    size_t block_size;
+    QueueHandle_t free_buffers;
+    QueueHandle_t read_blocks;
+} rcp_reader_t;
+
+static void reader_task(void *arg)
+{
+    rcp_reader_t *reader = (rcp_reader_t *)arg;
+    uint8_t *buffer;
+
+    /* A NULL buffer stops the reader */
+    while (xQueueReceive(reader->free_buffers, &buffer, portMAX_DELAY) == pdTRUE && buffer != NULL) {
+        if (reader->size == 0) {
+            continue;
+        }
+        rcp_read_block_t block = {
+            .data = buffer,
+            .size = reader->size < reader->block_size ? reader->size : reader->block_size,
+        };
+        if (fread(buffer, 1, block.size, reader->firmware) != block.size) {
+            block.size = 0;
+            reader->size = 0;
+        } else {
+            reader->size -= block.size;
+        }
+        xQueueSend(reader->read_blocks, &block, portMAX_DELAY);
+    }
+    rcp_read_block_t end = { .data = NULL, .size = 0 };
+    xQueueSend(reader->read_blocks, &end, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t reader_start(rcp_reader_t *reader, FILE *firmware, size_t size, uint8_t *payload,
+                              size_t block_size)
+{
+    reader->firmware = firmware;
+    reader->size = size;
+    reader->block_size = block_size;
+    /* Both buffers and the NULL which stops the reader */
+    reader->free_buffers = xQueueCreate(3, sizeof(uint8_t *));
+    reader->read_blocks = xQueueCreate(3, sizeof(rcp_read_block_t));
+    if (reader->free_buffers == NULL || reader->read_blocks == NULL) {
+        goto fail;
+    }
+    uint8_t *buffers[2] = { payload, payload + block_size };
+    for (int i = 0; i < 2; i++) {
+        xQueueSend(reader->free_buffers, &buffers[i], 0);
+    }
+    if (xTaskCreate(reader_task, "rcp_reader", RCP_READER_TASK_STACK_SIZE, reader, uxTaskPriorityGet(NULL),
+                    NULL) != pdPASS) {
+        goto fail;
+    }
+    return ESP_OK;
+
+fail:
+    if (reader->free_buffers) {
+        vQueueDelete(reader->free_buffers);
+    }
+    if (reader->read_blocks) {
+        vQueueDelete(reader->read_blocks);
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+/* Stops the reader and waits for its end, after which the image can be read again */
+static void reader_stop(rcp_reader_t *reader)
+{
+    uint8_t *stop = NULL;
+    rcp_read_block_t block;
+
+    xQueueSend(reader->free_buffers, &stop, portMAX_DELAY);
+    do {
+        xQueueReceive(reader->read_blocks, &block, portMAX_DELAY);
+    } while (block.data != NULL);
+    vQueueDelete(reader->free_buffers);
+    vQueueDelete(reader->read_blocks);
+}
+
+/* Writes size bytes of the image at address, compressed if deflated_info is set. The payload holds two
+ * blocks, the next block is read from the image into one while the other is sent to the RCP. */
+static esp_loader_error_t write_binary(FILE *firmware, size_t size, size_t address,
+                                       const esp_br_deflated_info_t *deflated_info,
+                                       uint8_t *payload, size_t block_size)
 {
     esp_loader_error_t err;
-    static uint8_t payload[1024];
+    rcp_reader_t reader;
 
     ESP_LOGI(TAG, "Erasing flash (this may take a while)...");
-    err = esp_loader_flash_start(address, size, sizeof(payload));
+    if (deflated_info) {
+        /* The RCP decompresses the binary, only the compressed one goes over UART */
+        err = esp_loader_flash_deflate_start(address, deflated_info->size, size, block_size);
+    } else {
+        err = esp_loader_flash_start(address, size, block_size);
+    }
     if (err != ESP_LOADER_SUCCESS) {
         ESP_LOGE(TAG, "Erasing flash failed with error %d.", err);
         return err;
     }
-    ESP_LOGI(TAG, "Start programming");
+    if (reader_start(&reader, firmware, size, payload, block_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the image reader");
+        return ESP_LOADER_ERROR_FAIL;
+    }
+    ESP_LOGI(TAG, "Start programming, binary_size %u", size);
 
     size_t binary_size = size;
     size_t written = 0;
+    TickType_t last_progress = xTaskGetTickCount();
+
+    while (written < binary_size) {
+        rcp_read_block_t block;
+        xQueueReceive(reader.read_blocks, &block, portMAX_DELAY);
+        if (block.size == 0) {
+            ESP_LOGE(TAG, "Failed to read the image");
+            err = ESP_LOADER_ERROR_FAIL;
+            break;
+        }
 
-    ESP_LOGI(TAG, "binary_size %u", binary_size);
-    while (size > 0) {
-        size_t to_read = size < sizeof(payload) ? size : sizeof(payload);
-        fread(payload, 1, to_read, firmware);
-
-        err = esp_loader_flash_write(payload, to_read);
+        if (deflated_info) {
+            err = esp_loader_flash_deflate_write(block.data, block.size);
+        } else {
+            err = esp_loader_flash_write(block.data, block.size);
+        }
         if (err != ESP_LOADER_SUCCESS) {
             ESP_LOGE(TAG, "Packet could not be written! Error %d.", err);
-            return err;
+            break;
         }
+        xQueueSend(reader.free_buffers, &block.data, portMAX_DELAY);
 
-        size -= to_read;
-        written += to_read;
-        ESP_LOGI(TAG, "left size %u, written %u", size, written);
-
-        int progress = (int)(((float)written / binary_size) * 100);
-        ESP_LOGI(TAG, "Progress: %d %%", progress);
-        fflush(stdout);
+        written += block.size;
+        ESP_LOGD(TAG, "left size %u, written %u", binary_size - written, written);
+        if (xTaskGetTickCount() - last_progress >= pdMS_TO_TICKS(RCP_PROGRESS_LOG_INTERVAL_MS)) {
+            last_progress = xTaskGetTickCount();
+            ESP_LOGI(TAG, "Progress: %d %%", (int)(((float)written / binary_size) * 100));
+        }
     };
+    reader_stop(&reader);
+    if (err != ESP_LOADER_SUCCESS) {
+        return err;
+    }
 
     ESP_LOGI(TAG, "Finished programming");
 
-    err = esp_loader_flash_verify();
+    if (deflated_info) {
+        err = esp_loader_flash_verify_known_md5(address, deflated_info->size, deflated_info->md5);
+    } else {
+        err = esp_loader_flash_verify();
+    }
     if (err != ESP_LOADER_SUCCESS) {
         ESP_LOGE(TAG, "MD5 does not match. err: %d", err);
         return err;
@@ -156,6 +367,85 @@ static esp_loader_error_t flash_binary(FILE *firmware, size_t size, size_t addre
     return ESP_LOADER_SUCCESS;
 }
 
+/* Writes the regions of a binary split in regions whose MD5 differs from the one of the RCP flash */
+static esp_loader_error_t flash_regions(FILE *firmware, size_t size, size_t address, bool deflated,
+                                        uint8_t *payload, size_t block_size)
+{
+    esp_loader_error_t err;
+    esp_br_regions_info_t info;
+
+    if (size < sizeof(info) || fread(&info, 1, sizeof(info), firmware) != sizeof(info) ||
+            info.region_size == 0 || info.region_size % ESP_BR_FLASH_SECTOR_SIZE != 0) {
+        ESP_LOGE(TAG, "Failed to read regions info");
+        return ESP_LOADER_ERROR_FAIL;
+    }
+    size_t num_regions = (info.size + info.region_size - 1) / info.region_size;
+    size_t table_size = num_regions * sizeof(esp_br_region_info_t);
+    if (size - sizeof(info) < table_size) {
+        ESP_LOGE(TAG, "Failed to read regions info");
+        return ESP_LOADER_ERROR_FAIL;
+    }
+    long table_pos = ftell(firmware);
+    long data_pos = table_pos + table_size;
+    size_t num_skipped = 0;
+
+    for (size_t i = 0; i < num_regions; i++) {
+        esp_br_region_info_t region;
+        if (fseek(firmware, table_pos + i * sizeof(region), SEEK_SET) != 0 ||
+                fread(&region, 1, sizeof(region), firmware) != sizeof(region)) {
+            ESP_LOGE(TAG, "Failed to read region %u info", i);
+            return ESP_LOADER_ERROR_FAIL;
+        }
+        size_t region_address = address + i * info.region_size;
+        size_t region_size = info.size - i * info.region_size;
+        if (region_size > info.region_size) {
+            region_size = info.region_size;
+        }
+
+        /* Any other error than a mismatch is left to the write of the region to report */
+        if (esp_loader_flash_verify_known_md5(region_address, region_size, region.md5) == ESP_LOADER_SUCCESS) {
+            ESP_LOGI(TAG, "Region at 0x%x unchanged", region_address);
+            num_skipped++;
+        } else {
+            esp_br_deflated_info_t deflated_info = { .size = region_size };
+            memcpy(deflated_info.md5, region.md5, sizeof(deflated_info.md5));
+            if (fseek(firmware, data_pos, SEEK_SET) != 0) {
+                return ESP_LOADER_ERROR_FAIL;
+            }
+            err = write_binary(firmware, region.stored_size, region_address, deflated ? &deflated_info : NULL,
+                               payload, block_size);
+            if (err != ESP_LOADER_SUCCESS) {
+                return err;
+            }
+        }
+        data_pos += region.stored_size;
+    }
+    ESP_LOGI(TAG, "%u of %u regions unchanged", num_skipped, num_regions);
+
+    return ESP_LOADER_SUCCESS;
+}
+
+static esp_loader_error_t flash_binary(FILE *firmware, size_t size, size_t address, uint32_t tag,
+                                       uint8_t *payload, size_t block_size)
+{
+    bool deflated = (tag & FILETAG_DEFLATED) != 0;
+    esp_br_deflated_info_t deflated_info = {0};
+
+    if (tag & FILETAG_REGIONS) {
+        return flash_regions(firmware, size, address, deflated, payload, block_size);
+    }
+    if (deflated) {
+        if (size < sizeof(deflated_info) ||
+                fread(&deflated_info, 1, sizeof(deflated_info), firmware) != sizeof(deflated_info)) {
+            ESP_LOGE(TAG, "Failed to read compressed binary info");
+            return ESP_LOADER_ERROR_FAIL;
+        }
+        size -= sizeof(deflated_info);
+    }
+
+    return write_binary(firmware, size, address, deflated ? &deflated_info : NULL, payload, block_size);
+}
+
 static void load_rcp_update_seq(esp_rcp_update_handle *handle)
 {
     int8_t seq = 0;
@@ -243,15 +533,46 @@ esp_err_t esp_rcp_update(void)
         .reset_trigger_pin = s_handle.update_config.reset_pin,
         .gpio0_trigger_pin = s_handle.update_config.boot_pin,
     };
-    ESP_RETURN_ON_ERROR(loader_port_esp32_init(&loader_config), TAG, "Failed to initialize UART port");
-    ESP_RETURN_ON_ERROR(connect_to_target(s_handle.update_config.target_chip, s_handle.update_config.update_baudrate),
-                        TAG, "Failed to connect to RCP");
-
     char fullpath[RCP_FILENAME_MAX_SIZE];
     int update_seq = esp_rcp_get_update_seq();
     sprintf(fullpath, "%s_%d/" ESP_BR_RCP_IMAGE_FILENAME, s_handle.update_config.firmware_dir, update_seq);
     FILE *fp = fopen(fullpath, "r");
     ESP_RETURN_ON_FALSE(fp != NULL, ESP_ERR_NOT_FOUND, TAG, "Cannot find rcp image");
+
+    /* The flasher stub runs at higher baudrates than the ROM loader, images without one use the ROM loader */
+    esp_loader_stub_t stub;
+    uint8_t *stub_segments = NULL;
+    bool has_stub = load_flasher_stub(fp, &stub, &stub_segments) == ESP_OK;
+    if (!has_stub) {
+        ESP_LOGI(TAG, "No flasher stub in the rcp image, using the ROM loader");
+    }
+
+    esp_err_t err = loader_port_esp32_init(&loader_config);
+    if (err == ESP_OK) {
+        err = connect_at_highest_baudrate(s_handle.update_config.target_chip, has_stub ? &stub : NULL,
+                                          s_handle.update_config.update_baudrate);
+    }
+    free(stub_segments);
+    if (err != ESP_OK) {
+        fclose(fp);
+        ESP_LOGE(TAG, "Failed to connect to RCP");
+        return err;
+    }
+
+    /* The stub takes larger blocks, and more than one before it answers */
+    size_t block_size = RCP_ROM_BLOCK_SIZE;
+    if (esp_loader_stub_running()) {
+        block_size = CONFIG_RCP_UPDATE_STUB_BLOCK_SIZE;
+        esp_loader_flash_set_window(CONFIG_RCP_UPDATE_STUB_FLASH_WINDOW);
+    }
+    /* Two blocks, one is read from the image while the other is sent */
+    uint8_t *payload = malloc(2 * block_size);
+    if (payload == NULL) {
+        fclose(fp);
+        ESP_LOGE(TAG, "Failed to allocate flash block");
+        return ESP_ERR_NO_MEM;
+    }
+
     esp_br_subfile_info_t subfile;
     seek_to_subfile(fp, FILETAG_RCP_FLASH_ARGS, &subfile);
     int num_flash_binaries = subfile.size / sizeof(rcp_flash_arg_t);
@@ -265,7 +586,8 @@ esp_err_t esp_rcp_update(void)
             ESP_LOGE(TAG, "Failed to seek to subfile with tag %lu", flash_args.tag);
             abort();
         }
-        while (flash_binary(fp, subfile.size, flash_args.offset) != ESP_LOADER_SUCCESS) {
+        while (flash_binary(fp, subfile.size, flash_args.offset, flash_args.tag, payload, block_size) !=
+                ESP_LOADER_SUCCESS) {
             ESP_LOGW(TAG, "Failed to flash %s, retrying...", fullpath);
             num_retry++;
             if (num_retry > RCP_UPDATE_MAX_RETRY) {
@@ -276,6 +598,7 @@ esp_err_t esp_rcp_update(void)
         }
         fseek(fp, current, SEEK_SET);
     }
+    free(payload);
     fclose(fp);
     esp_loader_reset_target();
     loader_port_esp32_deinit();
@@ -67,6 +67,28 @@ typedef struct tlv_iterator {
  */
 esp_err_t esp_secure_cert_get_tlv_info(esp_secure_cert_tlv_config_t *tlv_config, esp_secure_cert_tlv_info_t *tlv_info);
 
+/*
+ *  Get the data of a plaintext TLV entry in place, in the memory mapped esp_secure_cert partition
+ *
+ *  @note
+ *  Nothing is allocated nor copied, and there is nothing to free: the data stays valid till reboot.
+ *  TLV entries which are encrypted, or whose key is derived with the HMAC peripheral, are not stored
+ *  in plaintext and are to be obtained with esp_secure_cert_get_tlv_info().
+ *  This API also validates the crc of the respective tlv.
+ * @input
+ *     tlv_config           Pointer to a readable struct of type esp_secure_cert_tlv_config_t,
+ *                          the type shall not be ESP_SECURE_CERT_TLV_END.
+ *     data                 Pointer to store the address of the TLV data
+ *     len                  Pointer to store the length of the TLV data
+ * @return
+ *
+ *      - ESP_OK                    On success
+ *      - ESP_ERR_NOT_SUPPORTED     The TLV data is not stored in plaintext
+ *      - ESP_FAIL/other relevant esp error code
+ *                                  On failure
+ */
+esp_err_t esp_secure_cert_get_tlv_data(const esp_secure_cert_tlv_config_t *tlv_config, const char **data, uint32_t *len);
+
 /*
  * Free the memory allocated while populating the tlv_info object
  * @note
@@ -119,6 +141,19 @@ esp_err_t esp_secure_cert_get_tlv_info_from_iterator(esp_secure_cert_tlv_iterato
  */
 void esp_secure_cert_list_tlv_entries(void);
 
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+/*
+ * Clear the cached private key
+ *
+ * The private key decrypted or derived with the HMAC peripheral is zeroized and freed,
+ * the next call to esp_secure_cert_get_priv_key() decrypts or derives it again.
+ *
+ * @note
+ * No private key buffer obtained before this call may be in use.
+ */
+void esp_secure_cert_clear_priv_key_cache(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
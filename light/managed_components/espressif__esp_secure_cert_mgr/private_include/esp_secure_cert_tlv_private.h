@@ -15,6 +15,7 @@
 #define ESP_SECURE_CERT_TLV_PARTITION_TYPE      0x3F                        /* Custom partition type */
 #define ESP_SECURE_CERT_TLV_PARTITION_NAME      "esp_secure_cert"           /* Name of the custom esp_secure_cert partition */
 #define ESP_SECURE_CERT_TLV_MAGIC                0xBA5EBA11
+#define ESP_SECURE_CERT_TLV_INDEX_MAX_ENTRIES    (32)                        /* TLV entries indexed when the partition is mapped */
 
 #define ESP_SECURE_CERT_HMAC_KEY_ID              (0)                         /* The hmac_key_id value that shall be used for HMAC based ecdsa key generation */
 #define ESP_SECURE_CERT_DERIVED_ECDSA_KEY_SIZE   (32)                       /* The key size in bytes of the derived ecdsa key */
@@ -145,6 +146,14 @@ esp_err_t esp_secure_cert_find_tlv(const void *esp_secure_cert_addr, esp_secure_
  */
 esp_err_t esp_secure_cert_tlv_get_addr(esp_secure_cert_tlv_type_t type, esp_secure_cert_tlv_subtype_t subtype, char **buffer, uint32_t *len);
 
+/*
+ * Free the data obtained with esp_secure_cert_tlv_get_addr()
+ *
+ * Note: Only the data which had to be decrypted or derived is freed, nothing is done
+ * for data in the mapped esp_secure_cert partition.
+ */
+void esp_secure_cert_tlv_free_addr(char *buffer);
+
 /*
  * Identify if esp_secure_cert partition of type TLV is present.
  * @return
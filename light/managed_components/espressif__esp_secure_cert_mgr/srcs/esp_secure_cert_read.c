@@ -339,6 +339,18 @@ static esp_err_t esp_secure_cert_read_metadata(esp_secure_cert_metadata *metadat
     return err;
 }
 
+/*
+ * Map the entire cust_flash partition once, the data is then read in place till reboot
+ */
+static const void *esp_secure_cert_get_cust_flash_mapped_addr(const esp_partition_t *part)
+{
+    static const void *mapped_addr;
+    if (mapped_addr == NULL) {
+        mapped_addr = esp_secure_cert_mmap(part, 0, part->size);
+    }
+    return mapped_addr;
+}
+
 static esp_err_t esp_secure_cert_get_addr(size_t offset, char **buffer, uint32_t *len)
 {
     esp_err_t err;
@@ -358,12 +370,14 @@ static esp_err_t esp_secure_cert_get_addr(size_t offset, char **buffer, uint32_t
         return err;
     }
 
-    *len = data_len;
-    *buffer = (char *)esp_secure_cert_mmap(part, offset, *len);
-    if (buffer == NULL) {
+    const char *mapped_addr = esp_secure_cert_get_cust_flash_mapped_addr(part);
+    if (mapped_addr == NULL || offset + data_len > part->size) {
         return ESP_FAIL;
     }
 
+    *len = data_len;
+    *buffer = (char *)(mapped_addr + offset);
+
     uint32_t read_crc = esp_crc32_le(UINT32_MAX, (const uint8_t * )*buffer, data_len);
     if (read_crc != data_crc) {
         ESP_LOGE(TAG, "Data has been tampered");
@@ -411,8 +425,10 @@ esp_err_t esp_secure_cert_get_device_cert(char **buffer, uint32_t *len)
 esp_err_t esp_secure_cert_free_device_cert(char *buffer)
 {
     switch(current_partition_format) {
-    // fall through
     case ESP_SECURE_CERT_PF_TLV:
+        esp_secure_cert_tlv_free_addr(buffer);
+        return ESP_OK;
+
     case ESP_SECURE_CERT_PF_CUST_FLASH:
     case ESP_SECURE_CERT_PF_CUST_FLASH_LEGACY:
         return ESP_OK;
@@ -467,8 +483,10 @@ esp_err_t esp_secure_cert_get_ca_cert(char **buffer, uint32_t *len)
 esp_err_t esp_secure_cert_free_ca_cert(char *buffer)
 {
     switch(current_partition_format) {
-    // fall through
     case ESP_SECURE_CERT_PF_TLV:
+        esp_secure_cert_tlv_free_addr(buffer);
+        return ESP_OK;
+
     case ESP_SECURE_CERT_PF_CUST_FLASH:
     case ESP_SECURE_CERT_PF_CUST_FLASH_LEGACY:
         return ESP_OK;
@@ -525,8 +543,10 @@ esp_err_t esp_secure_cert_get_priv_key(char **buffer, uint32_t *len)
 esp_err_t esp_secure_cert_free_priv_key(char *buffer)
 {
     switch(current_partition_format) {
-    // fall through
     case ESP_SECURE_CERT_PF_TLV:
+        esp_secure_cert_tlv_free_addr(buffer);
+        return ESP_OK;
+
     case ESP_SECURE_CERT_PF_CUST_FLASH:
     case ESP_SECURE_CERT_PF_CUST_FLASH_LEGACY:
         return ESP_OK;
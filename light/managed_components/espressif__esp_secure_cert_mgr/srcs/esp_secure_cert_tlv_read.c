@@ -32,6 +32,7 @@
 #include "mbedtls/ecdsa.h"
 #include "mbedtls/pk.h"
 #include "mbedtls/version.h"
+#include "mbedtls/platform_util.h"
 
 #include "esp_secure_cert_read.h"
 #include "esp_secure_cert_tlv_config.h"
@@ -43,6 +44,10 @@
 #include "esp_hmac.h"
 #endif
 
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+#include "freertos/FreeRTOS.h"
+#endif
+
 #if (MBEDTLS_VERSION_NUMBER < 0x03000000)
 /* mbedtls 2.x backward compatibility */
 #define MBEDTLS_2X_COMPAT 1
@@ -78,6 +83,186 @@ static esp_err_t esp_secure_cert_gen_ecdsa_key(esp_secure_cert_tlv_subtype_t sub
 
 /* This is the mininum required flash address alignment in bytes to write to an encrypted flash partition */
 
+/*
+ * Entry of the TLV index, for each TLV of the partition in the order
+ * they are stored
+ */
+typedef struct esp_secure_cert_tlv_index_entry {
+    uint32_t offset;                    /* Offset of the TLV header from the base of esp_secure_cert */
+    uint8_t type;
+    uint8_t subtype;
+    bool verified;                      /* The crc of the TLV matches */
+} esp_secure_cert_tlv_index_entry_t;
+
+/*
+ * Index of the TLV entries of the mapped partition, built once when it is mapped,
+ * so that looking up a TLV neither walks through the partition nor computes its crc again
+ */
+typedef struct esp_secure_cert_tlv_index {
+    bool complete;                      /* All the TLV entries are in the index */
+    uint16_t count;
+    uint32_t end_offset;                /* Offset of the end of the TLV entries */
+    esp_secure_cert_tlv_index_entry_t entries[ESP_SECURE_CERT_TLV_INDEX_MAX_ENTRIES];
+} esp_secure_cert_tlv_index_t;
+
+static esp_secure_cert_tlv_index_t s_tlv_index;
+
+static uint16_t esp_secure_cert_get_tlv_total_length(esp_secure_cert_tlv_header_t *tlv_header);
+static bool esp_secure_cert_verify_tlv_integrity(esp_secure_cert_tlv_header_t *tlv_header);
+
+/*
+ * Build the TLV index of the mapped esp_secure_cert partition
+ *
+ * @note
+ * When the partition holds more TLV entries than the index, the index
+ * is left incomplete and the TLV entries are found by walking through the partition.
+ */
+static void esp_secure_cert_build_tlv_index(const void *esp_secure_cert_addr, size_t partition_size)
+{
+    uint32_t tlv_offset = 0;
+
+    while (tlv_offset + sizeof(esp_secure_cert_tlv_header_t) <= partition_size) {
+        esp_secure_cert_tlv_header_t *tlv_header = (esp_secure_cert_tlv_header_t *)(esp_secure_cert_addr + tlv_offset);
+        if (tlv_header->magic != ESP_SECURE_CERT_TLV_MAGIC) {
+            break;
+        }
+
+        uint16_t total_length = esp_secure_cert_get_tlv_total_length(tlv_header);
+        if (tlv_offset + total_length > partition_size) {
+            ESP_LOGD(TAG, "TLV entry at offset %" PRIu32 " exceeds the partition", tlv_offset);
+            break;
+        }
+
+        if (s_tlv_index.count == ESP_SECURE_CERT_TLV_INDEX_MAX_ENTRIES) {
+            ESP_LOGD(TAG, "More than %d TLV entries, they are found by walking through the partition", ESP_SECURE_CERT_TLV_INDEX_MAX_ENTRIES);
+            return;
+        }
+
+        esp_secure_cert_tlv_index_entry_t *entry = &s_tlv_index.entries[s_tlv_index.count++];
+        entry->offset = tlv_offset;
+        entry->type = tlv_header->type;
+        entry->subtype = tlv_header->subtype;
+        entry->verified = esp_secure_cert_verify_tlv_integrity(tlv_header);
+
+        tlv_offset += total_length;
+    }
+
+    s_tlv_index.end_offset = tlv_offset;
+    s_tlv_index.complete = true;
+    ESP_LOGD(TAG, "Indexed %u TLV entries", s_tlv_index.count);
+}
+
+/*
+ * Find the TLV of given type and subtype in the TLV index,
+ * with the same results as esp_secure_cert_find_tlv()
+ */
+static esp_err_t esp_secure_cert_index_find_tlv(const void *esp_secure_cert_addr, esp_secure_cert_tlv_type_t type, uint8_t subtype, void **tlv_address)
+{
+    if (type == ESP_SECURE_CERT_TLV_END) {
+        *tlv_address = (void *)(esp_secure_cert_addr + s_tlv_index.end_offset);
+        return ESP_OK;
+    }
+
+    const esp_secure_cert_tlv_index_entry_t *found = NULL;
+    for (uint16_t i = 0; i < s_tlv_index.count; i++) {
+        const esp_secure_cert_tlv_index_entry_t *entry = &s_tlv_index.entries[i];
+        if ((esp_secure_cert_tlv_type_t)entry->type != type) {
+            continue;
+        }
+
+        if (subtype == ESP_SECURE_CERT_SUBTYPE_MAX) {
+            // Keep the latest entry of the given type
+            found = entry;
+        } else if (entry->subtype == subtype) {
+            found = entry;
+            break;
+        }
+    }
+
+    if (found == NULL) {
+        ESP_LOGD(TAG, "Unable to find tlv of type: %d", type);
+        return ESP_FAIL;
+    }
+
+    if (!found->verified) {
+        ESP_LOGD(TAG, "tlv structure of type %d and subtype %d failed the integrity check", type, found->subtype);
+        return ESP_FAIL;
+    }
+
+    *tlv_address = (void *)(esp_secure_cert_addr + found->offset);
+    return ESP_OK;
+}
+
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+/*
+ * The private key decrypted or derived with the HMAC peripheral,
+ * kept for the following requests of the same TLV entry
+ */
+typedef struct esp_secure_cert_priv_key_cache {
+    const esp_secure_cert_tlv_header_t *tlv_header;     /* TLV entry the key was obtained from */
+    char *key;
+    uint32_t len;
+} esp_secure_cert_priv_key_cache_t;
+
+static esp_secure_cert_priv_key_cache_t s_priv_key_cache;
+static portMUX_TYPE s_priv_key_cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool esp_secure_cert_priv_key_cache_get(const esp_secure_cert_tlv_header_t *tlv_header, char **buffer, uint32_t *len)
+{
+    bool found = false;
+    taskENTER_CRITICAL(&s_priv_key_cache_lock);
+    if (s_priv_key_cache.key != NULL && s_priv_key_cache.tlv_header == tlv_header) {
+        *buffer = s_priv_key_cache.key;
+        *len = s_priv_key_cache.len;
+        found = true;
+    }
+    taskEXIT_CRITICAL(&s_priv_key_cache_lock);
+    return found;
+}
+
+/*
+ * Keep the key in *buffer in the cache if it is empty. If the same key
+ * was cached meanwhile, *buffer is freed and set to the cached one.
+ */
+static void esp_secure_cert_priv_key_cache_put(const esp_secure_cert_tlv_header_t *tlv_header, char **buffer, uint32_t len)
+{
+    char *unused = NULL;
+    taskENTER_CRITICAL(&s_priv_key_cache_lock);
+    if (s_priv_key_cache.key == NULL) {
+        s_priv_key_cache.tlv_header = tlv_header;
+        s_priv_key_cache.key = *buffer;
+        s_priv_key_cache.len = len;
+    } else if (s_priv_key_cache.tlv_header == tlv_header) {
+        unused = *buffer;
+        *buffer = s_priv_key_cache.key;
+    }
+    taskEXIT_CRITICAL(&s_priv_key_cache_lock);
+
+    if (unused != NULL) {
+        mbedtls_platform_zeroize(unused, len);
+        free(unused);
+    }
+}
+
+static bool esp_secure_cert_priv_key_is_cached(const char *buffer)
+{
+    return buffer != NULL && buffer == s_priv_key_cache.key;
+}
+
+void esp_secure_cert_clear_priv_key_cache(void)
+{
+    taskENTER_CRITICAL(&s_priv_key_cache_lock);
+    esp_secure_cert_priv_key_cache_t cache = s_priv_key_cache;
+    memset(&s_priv_key_cache, 0, sizeof(s_priv_key_cache));
+    taskEXIT_CRITICAL(&s_priv_key_cache_lock);
+
+    if (cache.key != NULL) {
+        mbedtls_platform_zeroize(cache.key, cache.len);
+        free(cache.key);
+    }
+}
+#endif /* CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY */
+
 /*
  * Map the entire esp_secure_cert partition
  * and return the virtual address.
@@ -85,6 +270,7 @@ static esp_err_t esp_secure_cert_gen_ecdsa_key(esp_secure_cert_tlv_subtype_t sub
  * @note
  * The mapping is done only once and function shall
  * simply return same address in case of successive calls.
+ * The TLV index is built along with the mapping.
  **/
 const void *esp_secure_cert_get_mapped_addr(void)
 {
@@ -112,10 +298,14 @@ const void *esp_secure_cert_get_mapped_addr(void)
     esp_err_t err;
 
     /* Map the entire partition */
-    err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &esp_secure_cert_mapped_addr, &handle);
+    const void *mapped_addr;
+    err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped_addr, &handle);
     if (err != ESP_OK) {
         return NULL;
     }
+
+    esp_secure_cert_build_tlv_index(mapped_addr, partition->size);
+    esp_secure_cert_mapped_addr = mapped_addr;
     return esp_secure_cert_mapped_addr;
 }
 
@@ -286,7 +476,11 @@ static esp_err_t esp_secure_cert_tlv_get_header(esp_secure_cert_tlv_type_t type,
         ESP_LOGE(TAG, "Error in obtaining esp_secure_cert memory mapped address");
         return ESP_FAIL;
     }
-    err = esp_secure_cert_find_tlv(esp_secure_cert_addr, type, subtype, (void **)tlv_header);
+    if (s_tlv_index.complete) {
+        err = esp_secure_cert_index_find_tlv(esp_secure_cert_addr, type, subtype, (void **)tlv_header);
+    } else {
+        err = esp_secure_cert_find_tlv(esp_secure_cert_addr, type, subtype, (void **)tlv_header);
+    }
     if (err != ESP_OK) {
         ESP_LOGD(TAG, "Could not find the tlv of type %d and subtype %d", type, subtype);
         return err;
@@ -317,6 +511,13 @@ esp_err_t esp_secure_cert_tlv_get_addr(esp_secure_cert_tlv_type_t type, esp_secu
     *buffer = (char *)&tlv_header->value;
     *len = tlv_header->length;
 
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+    if (esp_secure_cert_priv_key_cache_get(tlv_header, buffer, len)) {
+        ESP_LOGD(TAG, "Private key obtained from the cache");
+        return ESP_OK;
+    }
+#endif
+
     if (ESP_SECURE_CERT_IS_TLV_ENCRYPTED(tlv_header->flags)) {
 #if SOC_HMAC_SUPPORTED
         ESP_LOGD(TAG, "TLV data is encrypted");
@@ -335,6 +536,11 @@ esp_err_t esp_secure_cert_tlv_get_addr(esp_secure_cert_tlv_type_t type, esp_secu
         ESP_FAULT_ASSERT(err == ESP_OK);
         *buffer = output_buf;
         *len =  *len - HMAC_ENCRYPTION_TAG_LEN;
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+        if (type == ESP_SECURE_CERT_PRIV_KEY_TLV) {
+            esp_secure_cert_priv_key_cache_put(tlv_header, buffer, *len);
+        }
+#endif
 #else
         return ESP_ERR_NOT_SUPPORTED;
 #endif
@@ -355,6 +561,11 @@ esp_err_t esp_secure_cert_tlv_get_addr(esp_secure_cert_tlv_type_t type, esp_secu
         ESP_FAULT_ASSERT(err == ESP_OK);
         *buffer = output_buf;
         *len = ESP_SECURE_CERT_ECDSA_DER_KEY_SIZE;
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+        if (type == ESP_SECURE_CERT_PRIV_KEY_TLV) {
+            esp_secure_cert_priv_key_cache_put(tlv_header, buffer, *len);
+        }
+#endif
 #else
         return ESP_ERR_NOT_SUPPORTED;
 #endif
@@ -403,13 +614,46 @@ esp_err_t esp_secure_cert_get_tlv_info(esp_secure_cert_tlv_config_t *tlv_config,
     return esp_ret;
 }
 
+esp_err_t esp_secure_cert_get_tlv_data(const esp_secure_cert_tlv_config_t *tlv_config, const char **data, uint32_t *len)
+{
+    if (tlv_config == NULL || data == NULL || len == NULL || tlv_config->type == ESP_SECURE_CERT_TLV_END) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_secure_cert_tlv_header_t *tlv_header = NULL;
+    esp_err_t err = esp_secure_cert_tlv_get_header(tlv_config->type, tlv_config->subtype, &tlv_header);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (ESP_SECURE_CERT_IS_TLV_ENCRYPTED(tlv_header->flags) || ESP_SECURE_CERT_HMAC_ECDSA_KEY_DERIVATION(tlv_header->flags)) {
+        ESP_LOGD(TAG, "TLV of type %d and subtype %d is not stored in plaintext", tlv_config->type, tlv_config->subtype);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    *data = (const char *)&tlv_header->value;
+    *len = tlv_header->length;
+    return ESP_OK;
+}
+
+void esp_secure_cert_tlv_free_addr(char *buffer)
+{
+#ifdef CONFIG_ESP_SECURE_CERT_CACHE_PRIV_KEY
+    if (esp_secure_cert_priv_key_is_cached(buffer)) {
+        /* The cached key is kept till esp_secure_cert_clear_priv_key_cache() */
+        return;
+    }
+#endif
+    if (!esp_ptr_in_drom((const void *) buffer)) {
+        /* Free the buffer only if it is not from the drom section */
+        free(buffer);
+    }
+}
+
 esp_err_t esp_secure_cert_free_tlv_info(esp_secure_cert_tlv_info_t *tlv_info)
 {
     if (tlv_info) {
-        if (!esp_ptr_in_drom((const void *) tlv_info->data)) {
-            /* Free the buffer only if it is not from the drom section */
-            free(tlv_info->data);
-        }
+        esp_secure_cert_tlv_free_addr(tlv_info->data);
     }
     return ESP_OK;
 }
@@ -793,7 +1037,7 @@ esp_err_t esp_secure_cert_get_device_cert(char **buffer, uint32_t *len)
 
 esp_err_t esp_secure_cert_free_device_cert(char *buffer)
 {
-    (void) buffer; /* nothing to do */
+    esp_secure_cert_tlv_free_addr(buffer);
     return ESP_OK;
 }
 
@@ -804,7 +1048,7 @@ esp_err_t esp_secure_cert_get_ca_cert(char **buffer, uint32_t *len)
 
 esp_err_t esp_secure_cert_free_ca_cert(char *buffer)
 {
-    (void) buffer; /* nothing to do */
+    esp_secure_cert_tlv_free_addr(buffer);
     return ESP_OK;
 }
 
@@ -816,11 +1060,7 @@ esp_err_t esp_secure_cert_get_priv_key(char **buffer, uint32_t *len)
 
 esp_err_t esp_secure_cert_free_priv_key(char *buffer)
 {
-    if (!esp_ptr_in_drom((const void *) buffer)) {
-        free(buffer);
-        return ESP_OK;
-    }
-    (void) buffer; /* nothing to do */
+    esp_secure_cert_tlv_free_addr(buffer);
     return ESP_OK;
 }
 
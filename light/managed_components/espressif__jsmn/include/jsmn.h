@@ -131,6 +131,63 @@ static void jsmn_fill_token(jsmntok_t *token, const jsmntype_t type,
     token->size = 0;
 }
 
+#ifdef JSMN_WORD_SCAN
+/**
+ * Word at a time scanning, for long strings and indentation. Words are only
+ * read aligned and within len, so never past the end of the JSON data.
+ */
+#if defined(__GNUC__)
+typedef size_t __attribute__((__may_alias__)) jsmn_word_t;
+#else
+typedef size_t jsmn_word_t;
+#endif
+
+#define JSMN_WORD_ONES          ((jsmn_word_t)-1 / 0xff)
+#define JSMN_WORD_HAS_ZERO(w)   (((w) - JSMN_WORD_ONES) & ~(w) & (JSMN_WORD_ONES * 0x80))
+#define JSMN_WORD_HAS_BYTE(w, c) JSMN_WORD_HAS_ZERO((w) ^ (JSMN_WORD_ONES * (unsigned char)(c)))
+#define JSMN_WORD_ALIGNED(p)    (((size_t)(p) % sizeof(jsmn_word_t)) == 0)
+
+/**
+ * Returns the position of the first quote, backslash or NUL from pos, or a
+ * position near len if there is none before.
+ */
+static size_t jsmn_skip_string_body(const char *js, size_t pos, const size_t len)
+{
+    jsmn_word_t w;
+    for (; pos < len && !JSMN_WORD_ALIGNED(js + pos); pos++) {
+        if (js[pos] == '\"' || js[pos] == '\\' || js[pos] == '\0') {
+            return pos;
+        }
+    }
+    for (; pos + sizeof(jsmn_word_t) <= len; pos += sizeof(jsmn_word_t)) {
+        w = *(const jsmn_word_t *)(js + pos);
+        if (JSMN_WORD_HAS_ZERO(w) || JSMN_WORD_HAS_BYTE(w, '\"') || JSMN_WORD_HAS_BYTE(w, '\\')) {
+            break;
+        }
+    }
+    return pos;
+}
+
+/**
+ * js[pos] is a space, returns the position of the last space of the words of
+ * spaces which follow it.
+ */
+static size_t jsmn_skip_spaces(const char *js, size_t pos, const size_t len)
+{
+    pos++;
+    for (; pos < len && js[pos] == ' ' && !JSMN_WORD_ALIGNED(js + pos); pos++) {
+    }
+    if (JSMN_WORD_ALIGNED(js + pos)) {
+        for (; pos + sizeof(jsmn_word_t) <= len; pos += sizeof(jsmn_word_t)) {
+            if (*(const jsmn_word_t *)(js + pos) != JSMN_WORD_ONES * ' ') {
+                break;
+            }
+        }
+    }
+    return pos - 1;
+}
+#endif /* JSMN_WORD_SCAN */
+
 /**
  * Fills next available token with JSON primitive.
  */
@@ -205,7 +262,16 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
     parser->pos++;
 
     for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
-        char c = js[parser->pos];
+        char c;
+
+#ifdef JSMN_WORD_SCAN
+        /* Straight to the next quote or escape */
+        parser->pos = jsmn_skip_string_body(js, parser->pos, len);
+        if (parser->pos >= len || js[parser->pos] == '\0') {
+            break;
+        }
+#endif
+        c = js[parser->pos];
 
         /* Quote: end of string */
         if (c == '\"') {
@@ -376,7 +442,11 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
         case '\t':
         case '\r':
         case '\n':
+            break;
         case ' ':
+#ifdef JSMN_WORD_SCAN
+            parser->pos = jsmn_skip_spaces(js, parser->pos, len);
+#endif
             break;
         case ':':
             parser->toksuper = parser->toknext - 1;
@@ -82,7 +82,9 @@ typedef struct {
  * This will be initialised internally and needs to be passed to all
  * subsequent function calls
  * \param[out] buf Pointer to an allocated buffer into which the JSON
- * string will be written
+ * string will be written. Can be NULL, for a sizing pass: nothing is written,
+ * and json_gen_str_end() returns the exact size of the buffer the same calls
+ * need, so that it can be allocated once before generating the string again.
  * \param[in] buf_size Size of the buffer
  * \param[in] flush_cb Pointer to the flushing function of type \ref json_gen_flush_cb_t
  * which will be invoked either when the buffer is full or when json_gen_str_end()
@@ -102,6 +104,7 @@ void json_gen_str_start(json_gen_str_t *jstr, char *buf, int buf_size,
  * json_gen_str_start()
  *
  * \return Total length of the JSON created, including the NULL termination byte.
+ * This is also returned for a sizing pass, with a NULL buffer passed to json_gen_str_start().
  */
 int json_gen_str_end(json_gen_str_t *jstr);
 
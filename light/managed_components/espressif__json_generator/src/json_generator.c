@@ -18,11 +18,20 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 
 #include <json_generator.h>
 
 #define MAX_INT_IN_STR      24
-#define MAX_FLOAT_IN_STR    30
+/* Sign, the 39 digits of FLT_MAX, the decimal point, the precision and the NULL termination */
+#define MAX_FLOAT_IN_STR    (42 + JSON_FLOAT_PRECISION)
+
+/* Floats below this are formatted without snprintf(). With at most 9 digits
+ * after the decimal point, the fraction of a float times the power of 10 is
+ * exact in a double, so the rounding is the same as the one of snprintf().
+ */
+#define MAX_FAST_FLOAT          4294967296.0
+#define MAX_FAST_FLOAT_PRECISION 9
 
 static inline int json_gen_get_empty_len(json_gen_str_t *jstr)
 {
@@ -34,19 +43,22 @@ static inline int json_gen_get_empty_len(json_gen_str_t *jstr)
  * flushed out will always be equal to the size of the buffer unless
  * this is the last chunk being flushed out on json_gen_end_str()
  */
-static int json_gen_add_to_str(json_gen_str_t *jstr, const char *str)
+static int json_gen_add_to_str_len(json_gen_str_t *jstr, const char *str, int len)
 {
-    if (!str) {
-        return 0;
-    }
-    int len = strlen(str);
     jstr->total_len += len;
     if (jstr->buf == NULL) {
         return 0;
     }
+    /* Most pieces fit in what is left of the buffer */
+    int len_remaining = json_gen_get_empty_len(jstr);
+    if (len <= len_remaining) {
+        memcpy(jstr->free_ptr, str, len);
+        jstr->free_ptr += len;
+        return 0;
+    }
     const char *cur_ptr = str;
     while (1) {
-        int len_remaining = json_gen_get_empty_len(jstr);
+        len_remaining = json_gen_get_empty_len(jstr);
         int copy_len = len_remaining > len ? len : len_remaining;
         memmove(jstr->free_ptr, cur_ptr, copy_len);
         cur_ptr += copy_len;
@@ -69,6 +81,25 @@ static int json_gen_add_to_str(json_gen_str_t *jstr, const char *str)
     return 0;
 }
 
+static int json_gen_add_to_str(json_gen_str_t *jstr, const char *str)
+{
+    if (!str) {
+        return 0;
+    }
+    return json_gen_add_to_str_len(jstr, str, strlen(str));
+}
+
+#define json_gen_add_literal(jstr, str) json_gen_add_to_str_len(jstr, str, sizeof(str) - 1)
+
+/* Writes the digits of val ending at end, and returns where they start */
+static char *json_gen_format_uint(char *end, uint64_t val)
+{
+    do {
+        *--end = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    return end;
+}
 
 void json_gen_str_start(json_gen_str_t *jstr, char *buf, int buf_size,
                         json_gen_flush_cb_t flush_cb, void *priv)
@@ -97,16 +128,16 @@ int json_gen_str_end(json_gen_str_t *jstr)
 static inline void json_gen_handle_comma(json_gen_str_t *jstr)
 {
     if (jstr->comma_req) {
-        json_gen_add_to_str(jstr, ",");
+        json_gen_add_literal(jstr, ",");
     }
 }
 
 
 static int json_gen_handle_name(json_gen_str_t *jstr, const char *name)
 {
-    json_gen_add_to_str(jstr, "\"");
+    json_gen_add_literal(jstr, "\"");
     json_gen_add_to_str(jstr, name);
-    return json_gen_add_to_str(jstr, "\":");
+    return json_gen_add_literal(jstr, "\":");
 }
 
 
@@ -114,13 +145,13 @@ int json_gen_start_object(json_gen_str_t *jstr)
 {
     json_gen_handle_comma(jstr);
     jstr->comma_req = false;
-    return json_gen_add_to_str(jstr, "{");
+    return json_gen_add_literal(jstr, "{");
 }
 
 int json_gen_end_object(json_gen_str_t *jstr)
 {
     jstr->comma_req = true;
-    return json_gen_add_to_str(jstr, "}");
+    return json_gen_add_literal(jstr, "}");
 }
 
 
@@ -128,13 +159,13 @@ int json_gen_start_array(json_gen_str_t *jstr)
 {
     json_gen_handle_comma(jstr);
     jstr->comma_req = false;
-    return json_gen_add_to_str(jstr, "[");
+    return json_gen_add_literal(jstr, "[");
 }
 
 int json_gen_end_array(json_gen_str_t *jstr)
 {
     jstr->comma_req = true;
-    return json_gen_add_to_str(jstr, "]");
+    return json_gen_add_literal(jstr, "]");
 }
 
 int json_gen_push_object(json_gen_str_t *jstr, const char *name)
@@ -142,13 +173,13 @@ int json_gen_push_object(json_gen_str_t *jstr, const char *name)
     json_gen_handle_comma(jstr);
     json_gen_handle_name(jstr, name);
     jstr->comma_req = false;
-    return json_gen_add_to_str(jstr, "{");
+    return json_gen_add_literal(jstr, "{");
 }
 
 int json_gen_pop_object(json_gen_str_t *jstr)
 {
     jstr->comma_req = true;
-    return json_gen_add_to_str(jstr, "}");
+    return json_gen_add_literal(jstr, "}");
 }
 
 int json_gen_push_object_str(json_gen_str_t *jstr, const char *name, const char *object_str)
@@ -164,12 +195,12 @@ int json_gen_push_array(json_gen_str_t *jstr, const char *name)
     json_gen_handle_comma(jstr);
     json_gen_handle_name(jstr, name);
     jstr->comma_req = false;
-    return json_gen_add_to_str(jstr, "[");
+    return json_gen_add_literal(jstr, "[");
 }
 int json_gen_pop_array(json_gen_str_t *jstr)
 {
     jstr->comma_req = true;
-    return json_gen_add_to_str(jstr, "]");
+    return json_gen_add_literal(jstr, "]");
 }
 
 int json_gen_push_array_str(json_gen_str_t *jstr, const char *name, const char *array_str)
@@ -184,9 +215,9 @@ static int json_gen_set_bool(json_gen_str_t *jstr, bool val)
 {
     jstr->comma_req = true;
     if (val) {
-        return json_gen_add_to_str(jstr, "true");
+        return json_gen_add_literal(jstr, "true");
     } else {
-        return json_gen_add_to_str(jstr, "false");
+        return json_gen_add_literal(jstr, "false");
     }
 }
 int json_gen_obj_set_bool(json_gen_str_t *jstr, const char *name, bool val)
@@ -206,8 +237,13 @@ static int json_gen_set_int(json_gen_str_t *jstr, int val)
 {
     jstr->comma_req = true;
     char str[MAX_INT_IN_STR];
-    snprintf(str, MAX_INT_IN_STR, "%d", val);
-    return json_gen_add_to_str(jstr, str);
+    char *end = str + sizeof(str);
+    /* The magnitude as unsigned, so that INT_MIN can be negated */
+    char *start = json_gen_format_uint(end, val < 0 ? -(uint64_t)val : (uint64_t)val);
+    if (val < 0) {
+        *--start = '-';
+    }
+    return json_gen_add_to_str_len(jstr, start, end - start);
 }
 
 int json_gen_obj_set_int(json_gen_str_t *jstr, const char *name, int val)
@@ -228,8 +264,46 @@ static int json_gen_set_float(json_gen_str_t *jstr, float val)
 {
     jstr->comma_req = true;
     char str[MAX_FLOAT_IN_STR];
-    snprintf(str, MAX_FLOAT_IN_STR, "%.*f", JSON_FLOAT_PRECISION, val);
-    return json_gen_add_to_str(jstr, str);
+    double d = val;
+    bool negative = signbit(d);
+    double mag = negative ? -d : d;
+    /* NaN, infinities and large values, as well as a higher precision, through snprintf() */
+    if (JSON_FLOAT_PRECISION > MAX_FAST_FLOAT_PRECISION || !(mag < MAX_FAST_FLOAT)) {
+        snprintf(str, MAX_FLOAT_IN_STR, "%.*f", JSON_FLOAT_PRECISION, val);
+        return json_gen_add_to_str(jstr, str);
+    }
+    uint64_t pow10 = 1;
+    for (int i = 0; i < JSON_FLOAT_PRECISION; i++) {
+        pow10 *= 10;
+    }
+    uint64_t int_part = (uint64_t)mag;
+    double scaled = (mag - int_part) * pow10;
+    uint64_t frac_part = (uint64_t)scaled;
+    double rem = scaled - frac_part;
+    /* Round half to even, on the last digit printed */
+    uint64_t last = JSON_FLOAT_PRECISION ? frac_part : int_part;
+    if (rem > 0.5 || (rem == 0.5 && (last & 1))) {
+        if (++frac_part == pow10) {
+            frac_part = 0;
+            int_part++;
+        }
+    }
+    char *end = str + sizeof(str);
+    char *start = end;
+    if (JSON_FLOAT_PRECISION) {
+        char *frac_start = json_gen_format_uint(end, frac_part);
+        /* Leading zeros of the fraction */
+        while (frac_start > end - JSON_FLOAT_PRECISION) {
+            *--frac_start = '0';
+        }
+        start = frac_start;
+        *--start = '.';
+    }
+    start = json_gen_format_uint(start, int_part);
+    if (negative) {
+        *--start = '-';
+    }
+    return json_gen_add_to_str_len(jstr, start, end - start);
 }
 int json_gen_obj_set_float(json_gen_str_t *jstr, const char *name, float val)
 {
@@ -246,9 +320,9 @@ int json_gen_arr_set_float(json_gen_str_t *jstr, float val)
 static int json_gen_set_string(json_gen_str_t *jstr, const char *val)
 {
     jstr->comma_req = true;
-    json_gen_add_to_str(jstr, "\"");
+    json_gen_add_literal(jstr, "\"");
     json_gen_add_to_str(jstr, val);
-    return json_gen_add_to_str(jstr, "\"");
+    return json_gen_add_literal(jstr, "\"");
 }
 
 int json_gen_obj_set_string(json_gen_str_t *jstr, const char *name, const char *val)
@@ -267,7 +341,7 @@ int json_gen_arr_set_string(json_gen_str_t *jstr, const char *val)
 static int json_gen_set_long_string(json_gen_str_t *jstr, const char *val)
 {
     jstr->comma_req = true;
-    json_gen_add_to_str(jstr, "\"");
+    json_gen_add_literal(jstr, "\"");
     return json_gen_add_to_str(jstr, val);
 }
 
@@ -291,12 +365,12 @@ int json_gen_add_to_long_string(json_gen_str_t *jstr, const char *val)
 
 int json_gen_end_long_string(json_gen_str_t *jstr)
 {
-    return json_gen_add_to_str(jstr, "\"");
+    return json_gen_add_literal(jstr, "\"");
 }
 static int json_gen_set_null(json_gen_str_t *jstr)
 {
     jstr->comma_req = true;
-    return json_gen_add_to_str(jstr, "null");
+    return json_gen_add_literal(jstr, "null");
 }
 int json_gen_obj_set_null(json_gen_str_t *jstr, const char *name)
 {
@@ -19,6 +19,7 @@
 #define JSMN_PARENT_LINKS
 #define JSMN_HEADER
 #include <jsmn.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -39,10 +40,21 @@ typedef struct {
     json_tok_t *tokens;
     json_tok_t *cur;
     int num_tokens;
+    int max_tokens;     /* Tokens allocated, by json_parse_start() and json_parse_start_reuse() */
+    json_tok_t *index_obj;  /* Object whose keys are indexed */
+    int *index;         /* Positions of its key tokens, hashed by key, -1 where none */
+    int index_size;
 } jparse_ctx_t;
 
 int json_parse_start(jparse_ctx_t *jctx, const char *js, int len);
 int json_parse_end(jparse_ctx_t *jctx);
+/* Parse keeping the tokens allocated in jctx for the next parse, so that a context
+ * kept by a task parses its messages without allocating. jctx must be zero initialised
+ * before its first use. End each parse with json_parse_end_reuse(), and free the tokens
+ * with json_parse_end() when the context is no longer needed.
+ */
+int json_parse_start_reuse(jparse_ctx_t *jctx, const char *js, int len);
+int json_parse_end_reuse(jparse_ctx_t *jctx);
 int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_tok_t *buffer_tokens, int buffer_tokens_max_count);
 int json_parse_end_static(jparse_ctx_t *jctx);
 
@@ -72,6 +84,89 @@ int json_arr_get_float(jparse_ctx_t *jctx, uint32_t index, float *val);
 int json_arr_get_string(jparse_ctx_t *jctx, uint32_t index, char *val, int size);
 int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen);
 
+/* Binding of the keys of an object to the members of a struct
+ *
+ * json_obj_bind() goes once through the keys of the current object and converts the value of
+ * each key found in the table into its member, instead of one search of the object per key.
+ * A value of the wrong type, or which does not convert, is left out as a missing key.
+ * A repeated key binds its first value, as the json_obj_get_*() functions find it.
+ */
+typedef enum {
+    JSON_BIND_BOOL,         /* bool */
+    JSON_BIND_INT,          /* int */
+    JSON_BIND_INT64,        /* int64_t */
+    JSON_BIND_FLOAT,        /* float */
+    JSON_BIND_STRING,       /* char array, NUL terminated, a longer string is left out */
+    JSON_BIND_OBJECT,       /* struct bound by its own table, found if the key is, whichever of its keys are */
+} json_bind_type_t;
+
+typedef struct json_bind_field {
+    const char *name;
+    json_bind_type_t type;
+    uint16_t offset;        /* Of the member in the struct */
+    uint16_t size;          /* Of the member */
+    const struct json_bind_field *fields;   /* JSON_BIND_OBJECT only */
+    int num_fields;
+} json_bind_field_t;
+
+#define JSON_BIND_MAX_FIELDS    32
+
+#define JSON_BIND_FIELD(key, type, s, member) \
+    { (key), (type), offsetof(s, member), sizeof(((s *)0)->member), NULL, 0 }
+#define JSON_BIND_FIELD_OBJECT(key, s, member, member_fields) \
+    { (key), JSON_BIND_OBJECT, offsetof(s, member), sizeof(((s *)0)->member), (member_fields), \
+      sizeof(member_fields) / sizeof((member_fields)[0]) }
+
+/* Fills the members of out bound to the keys of the current object, the others keep their values.
+ * found, if not NULL, gets bit n set if fields[n] was found. Fails if the current element is not
+ * an object or if there are more than JSON_BIND_MAX_FIELDS fields.
+ */
+int json_obj_bind(jparse_ctx_t *jctx, const json_bind_field_t *fields, int num_fields, void *out, uint32_t *found);
+
+/* Streaming parser
+ *
+ * Parses a document fed in chunks of any size, as they arrive, without the whole document
+ * in memory: the callback is called for each value, with its key when in an object.
+ * Only the key and the value being read are kept, in a buffer given by the caller.
+ * Strings are given as in the document, with their escapes, and are not NUL terminated.
+ */
+typedef enum {
+    JSON_STREAM_OBJECT_START,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_START,
+    JSON_STREAM_ARRAY_END,
+    JSON_STREAM_STRING,
+    JSON_STREAM_PRIMITIVE,      /* Number, true, false or null */
+} json_stream_event_t;
+
+/* depth is 0 for the top value and the end of the top object or array.
+ * key is NULL for the values which are not in an object, and for the ends of objects and arrays.
+ * Return OS_SUCCESS to carry on parsing, anything else stops it.
+ */
+typedef int (*json_stream_cb_t)(void *priv, json_stream_event_t event, int depth,
+                                const char *key, int key_len, const char *value, int value_len);
+
+#define JSON_STREAM_MAX_DEPTH   32
+
+typedef struct {
+    json_stream_cb_t cb;
+    void *priv;
+    char *buf;          /* The key, then the value being read */
+    int buf_size;
+    int len;
+    int key_len;        /* -1 when the value has no key */
+    int depth;
+    uint32_t objects;   /* Bit n set if the container at depth n is an object */
+    uint8_t state;
+    bool in_key;
+} json_stream_t;
+
+/* buf must hold the longest key and value together, a longer one fails the parse */
+int json_stream_init(json_stream_t *stream, char *buf, int buf_size, json_stream_cb_t cb, void *priv);
+int json_stream_feed(json_stream_t *stream, const char *data, int len);
+/* Succeeds if a complete document was fed */
+int json_stream_end(json_stream_t *stream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -102,6 +102,80 @@ static int json_tok_to_string(jparse_ctx_t *jctx, json_tok_t *tok, char *val, in
     return OS_SUCCESS;
 }
 
+/* Keys of objects with at least this many keys are looked up in an index, built the first time
+ * a key of the object is looked up. 0 looks up all the keys by going through the object.
+ * Only for the contexts which allocate their tokens, json_parse_start_static() allocates nothing.
+ */
+#ifndef JSON_PARSER_KEY_INDEX_MIN_KEYS
+#define JSON_PARSER_KEY_INDEX_MIN_KEYS 16
+#endif
+
+static uint32_t json_key_hash(const char *key, int len)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t) key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool json_obj_build_index(jparse_ctx_t *jctx, json_tok_t *obj)
+{
+    int index_size = 1;
+    while (index_size < 2 * obj->size) {
+        index_size <<= 1;
+    }
+    if (index_size > jctx->index_size) {
+        int *index = realloc(jctx->index, index_size * sizeof(int));
+        if (!index) {
+            return false;
+        }
+        jctx->index = index;
+        jctx->index_size = index_size;
+    }
+    /* Keep the size used, probes wrap around it */
+    index_size = jctx->index_size;
+    memset(jctx->index, 0xff, index_size * sizeof(int));
+
+    json_tok_t *tok = obj;
+    int size = obj->size;
+    while (size--) {
+        tok++;
+        uint32_t slot = json_key_hash(jctx->js + tok->start, tok->end - tok->start);
+        /* A key repeated goes after the first one, which is then found first, as when going through the object */
+        while (jctx->index[slot & (index_size - 1)] >= 0) {
+            slot++;
+        }
+        jctx->index[slot & (index_size - 1)] = tok - jctx->tokens;
+        tok = json_skip_elem(tok);
+    }
+    jctx->index_obj = obj;
+    return true;
+}
+
+static json_tok_t *json_obj_index_search(jparse_ctx_t *jctx, const char *key)
+{
+    int mask = jctx->index_size - 1;
+    uint32_t slot = json_key_hash(key, strlen(key));
+    int pos;
+    while ((pos = jctx->index[slot & mask]) >= 0) {
+        if (token_matches_str(jctx, &jctx->tokens[pos], key)) {
+            return &jctx->tokens[pos];
+        }
+        slot++;
+    }
+    return NULL;
+}
+
+static void json_obj_free_index(jparse_ctx_t *jctx)
+{
+    free(jctx->index);
+    jctx->index = NULL;
+    jctx->index_size = 0;
+    jctx->index_obj = NULL;
+}
+
 static json_tok_t *json_obj_search(jparse_ctx_t *jctx, const char *key)
 {
     json_tok_t *tok = jctx->cur;
@@ -113,6 +187,12 @@ static json_tok_t *json_obj_search(jparse_ctx_t *jctx, const char *key)
         return NULL;
     }
 
+    if (JSON_PARSER_KEY_INDEX_MIN_KEYS > 0 && size >= JSON_PARSER_KEY_INDEX_MIN_KEYS && jctx->max_tokens > 0) {
+        if (jctx->index_obj == tok || json_obj_build_index(jctx, tok)) {
+            return json_obj_index_search(jctx, key);
+        }
+    }
+
     while (size--) {
         tok++;
         if (token_matches_str(jctx, tok, key)) {
@@ -403,27 +483,130 @@ int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen)
     return OS_SUCCESS;
 }
 
-int json_parse_start(jparse_ctx_t *jctx, const char *js, int len)
+static void json_obj_bind_tok(jparse_ctx_t *jctx, json_tok_t *obj, const json_bind_field_t *fields, int num_fields,
+                              void *out, uint32_t *found);
+
+static bool json_bind_value(jparse_ctx_t *jctx, json_tok_t *tok, const json_bind_field_t *field, void *out)
+{
+    void *member = (uint8_t *) out + field->offset;
+    switch (field->type) {
+    case JSON_BIND_BOOL:
+        return tok->type == JSMN_PRIMITIVE && json_tok_to_bool(jctx, tok, member) == OS_SUCCESS;
+    case JSON_BIND_INT:
+        return tok->type == JSMN_PRIMITIVE && json_tok_to_int(jctx, tok, member) == OS_SUCCESS;
+    case JSON_BIND_INT64:
+        return tok->type == JSMN_PRIMITIVE && json_tok_to_int64(jctx, tok, member) == OS_SUCCESS;
+    case JSON_BIND_FLOAT:
+        return tok->type == JSMN_PRIMITIVE && json_tok_to_float(jctx, tok, member) == OS_SUCCESS;
+    case JSON_BIND_STRING:
+        return tok->type == JSMN_STRING && json_tok_to_string(jctx, tok, member, field->size) == OS_SUCCESS;
+    case JSON_BIND_OBJECT:
+        if (tok->type != JSMN_OBJECT || field->num_fields > JSON_BIND_MAX_FIELDS) {
+            return false;
+        }
+        json_obj_bind_tok(jctx, tok, field->fields, field->num_fields, member, NULL);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void json_obj_bind_tok(jparse_ctx_t *jctx, json_tok_t *obj, const json_bind_field_t *fields, int num_fields,
+                              void *out, uint32_t *found)
 {
-    memset(jctx, 0, sizeof(jparse_ctx_t));
-    jsmn_init(&jctx->parser);
-    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
-    if (num_tokens <= 0) {
-        return -OS_FAIL;
+    /* The fields not bound yet, each key is only compared with them */
+    uint32_t pending = num_fields == 32 ? 0xffffffffu : (1u << num_fields) - 1;
+    uint32_t bound = 0;
+    json_tok_t *tok = obj;
+    int size = obj->size;
+    while (size-- && pending) {
+        tok++;
+        const char *key = jctx->js + tok->start;
+        int key_len = tok->end - tok->start;
+        for (uint32_t bits = pending; bits; bits &= bits - 1) {
+            int i = __builtin_ctz(bits);
+            const char *name = fields[i].name;
+            if (strncmp(name, key, key_len) != 0 || name[key_len] != 0) {
+                continue;
+            }
+            pending &= ~(1u << i);
+            if (json_bind_value(jctx, tok + 1, &fields[i], out)) {
+                bound |= 1u << i;
+            }
+            break;
+        }
+        tok = json_skip_elem(tok);
     }
-    jctx->num_tokens = num_tokens;
-    jctx->tokens = calloc(num_tokens, sizeof(json_tok_t));
-    if (!jctx->tokens) {
+    if (found) {
+        *found = bound;
+    }
+}
+
+int json_obj_bind(jparse_ctx_t *jctx, const json_bind_field_t *fields, int num_fields, void *out, uint32_t *found)
+{
+    if (found) {
+        *found = 0;
+    }
+    if (jctx->cur->type != JSMN_OBJECT || num_fields < 0 || num_fields > JSON_BIND_MAX_FIELDS) {
         return -OS_FAIL;
     }
-    jctx->js = js;
+    json_obj_bind_tok(jctx, jctx->cur, fields, num_fields, out, found);
+    return OS_SUCCESS;
+}
+
+/* Tokens allocated for a string of len bytes at first, doubled as long as they are not enough */
+#define JSON_PARSER_MIN_TOKENS      16
+#define JSON_PARSER_BYTES_PER_TOKEN 16
+
+/* Parse js in a single pass into the tokens of jctx, growing them when they are not enough:
+ * jsmn stops at the token which does not fit, and carries on from there once grown.
+ */
+static int json_parse_grow(jparse_ctx_t *jctx, const char *js, int len)
+{
+    if (jctx->max_tokens == 0) {
+        int max_tokens = len / JSON_PARSER_BYTES_PER_TOKEN;
+        if (max_tokens < JSON_PARSER_MIN_TOKENS) {
+            max_tokens = JSON_PARSER_MIN_TOKENS;
+        }
+        jctx->tokens = malloc(max_tokens * sizeof(json_tok_t));
+        if (!jctx->tokens) {
+            return JSMN_ERROR_NOMEM;
+        }
+        jctx->max_tokens = max_tokens;
+    }
+
     jsmn_init(&jctx->parser);
-    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
-    if (ret <= 0) {
+    while (1) {
+        int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->max_tokens);
+        if (ret != JSMN_ERROR_NOMEM) {
+            return ret;
+        }
+        json_tok_t *tokens = realloc(jctx->tokens, 2 * jctx->max_tokens * sizeof(json_tok_t));
+        if (!tokens) {
+            return JSMN_ERROR_NOMEM;
+        }
+        jctx->tokens = tokens;
+        jctx->max_tokens *= 2;
+    }
+}
+
+int json_parse_start(jparse_ctx_t *jctx, const char *js, int len)
+{
+    memset(jctx, 0, sizeof(jparse_ctx_t));
+    int num_tokens = json_parse_grow(jctx, js, len);
+    if (num_tokens <= 0) {
         free(jctx->tokens);
         memset(jctx, 0, sizeof(jparse_ctx_t));
         return -OS_FAIL;
     }
+    /* Give back the tokens not used */
+    json_tok_t *tokens = realloc(jctx->tokens, num_tokens * sizeof(json_tok_t));
+    if (tokens) {
+        jctx->tokens = tokens;
+        jctx->max_tokens = num_tokens;
+    }
+    jctx->num_tokens = num_tokens;
+    jctx->js = js;
     jctx->cur = jctx->tokens;
     return OS_SUCCESS;
 }
@@ -433,20 +616,45 @@ int json_parse_end(jparse_ctx_t *jctx)
     if (jctx->tokens) {
         free(jctx->tokens);
     }
+    json_obj_free_index(jctx);
     memset(jctx, 0, sizeof(jparse_ctx_t));
     return OS_SUCCESS;
 }
 
+int json_parse_start_reuse(jparse_ctx_t *jctx, const char *js, int len)
+{
+    int num_tokens = json_parse_grow(jctx, js, len);
+    if (num_tokens <= 0) {
+        json_parse_end_reuse(jctx);
+        return -OS_FAIL;
+    }
+    jctx->num_tokens = num_tokens;
+    jctx->js = js;
+    jctx->cur = jctx->tokens;
+    return OS_SUCCESS;
+}
+
+int json_parse_end_reuse(jparse_ctx_t *jctx)
+{
+    /* The index is kept allocated as the tokens, for the next parse */
+    jctx->index_obj = NULL;
+    jctx->js = NULL;
+    jctx->cur = NULL;
+    jctx->num_tokens = 0;
+    return OS_SUCCESS;
+}
+
 int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_tok_t *buffer_tokens, int buffer_tokens_max_count)
 {
     // Init
     memset(buffer_tokens, 0, buffer_tokens_max_count * sizeof(json_tok_t));
     memset(jctx, 0, sizeof(jparse_ctx_t));
 
-    // Check fit
+    // Parse, failing if the tokens do not fit
     jsmn_init(&jctx->parser);
-    int num_tokens = jsmn_parse(&jctx->parser, js, len, NULL, 0);
-    if (num_tokens <= 0 || num_tokens > buffer_tokens_max_count) {
+    int num_tokens = jsmn_parse(&jctx->parser, js, len, buffer_tokens, buffer_tokens_max_count);
+    if (num_tokens <= 0) {
+        memset(jctx, 0, sizeof(jparse_ctx_t));
         return -OS_FAIL;
     }
 
@@ -454,14 +662,6 @@ int json_parse_start_static(jparse_ctx_t *jctx, const char *js, int len, json_to
     jctx->num_tokens = num_tokens;
     jctx->tokens = buffer_tokens;
     jctx->js = js;
-
-    // Parse
-    jsmn_init(&jctx->parser);
-    int ret = jsmn_parse(&jctx->parser, js, len, jctx->tokens, jctx->num_tokens);
-    if (ret <= 0) {
-        memset(jctx, 0, sizeof(jparse_ctx_t));
-        return -OS_FAIL;
-    }
     jctx->cur = jctx->tokens;
     return OS_SUCCESS;
 }
@@ -471,4 +671,3 @@ int json_parse_end_static(jparse_ctx_t *jctx)
     memset(jctx, 0, sizeof(jparse_ctx_t));
     return OS_SUCCESS;
 }
-
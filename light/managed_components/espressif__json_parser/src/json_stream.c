@@ -0,0 +1,253 @@
+/*
+ *    Copyright 2020 Piyush Shah <shahpiyushv@gmail.com>
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <json_parser.h>
+
+enum {
+    JSON_STREAM_STATE_VALUE,            /* A value, after ':' or after ',' in an array */
+    JSON_STREAM_STATE_VALUE_OR_END,     /* A value or ']', after '[' */
+    JSON_STREAM_STATE_KEY,              /* A key, after ',' in an object */
+    JSON_STREAM_STATE_KEY_OR_END,       /* A key or '}', after '{' */
+    JSON_STREAM_STATE_COLON,
+    JSON_STREAM_STATE_NEXT,             /* ',' or the end of the container, after a value */
+    JSON_STREAM_STATE_STRING,
+    JSON_STREAM_STATE_ESCAPE,
+    JSON_STREAM_STATE_PRIMITIVE,
+    JSON_STREAM_STATE_DONE,
+    JSON_STREAM_STATE_ERROR,
+};
+
+static bool json_stream_in_object(json_stream_t *stream)
+{
+    return stream->depth > 0 && (stream->objects & (1u << (stream->depth - 1)));
+}
+
+static int json_stream_value_start(json_stream_t *stream)
+{
+    return stream->key_len < 0 ? 0 : stream->key_len;
+}
+
+static int json_stream_emit(json_stream_t *stream, json_stream_event_t event, int depth)
+{
+    int value_start = json_stream_value_start(stream);
+    const char *key = stream->key_len < 0 ? NULL : stream->buf;
+    return stream->cb(stream->priv, event, depth, key, value_start,
+                      stream->buf + value_start, stream->len - value_start);
+}
+
+static int json_stream_putc(json_stream_t *stream, char c)
+{
+    if (stream->len == stream->buf_size) {
+        return -OS_FAIL;
+    }
+    stream->buf[stream->len++] = c;
+    return OS_SUCCESS;
+}
+
+/* The key is used up with its value, which completes the document at the top */
+static void json_stream_value_done(json_stream_t *stream)
+{
+    stream->key_len = -1;
+    stream->len = 0;
+    stream->state = stream->depth == 0 ? JSON_STREAM_STATE_DONE : JSON_STREAM_STATE_NEXT;
+}
+
+static int json_stream_open(json_stream_t *stream, bool object)
+{
+    if (stream->depth == JSON_STREAM_MAX_DEPTH) {
+        return -OS_FAIL;
+    }
+    if (json_stream_emit(stream, object ? JSON_STREAM_OBJECT_START : JSON_STREAM_ARRAY_START,
+                         stream->depth) != OS_SUCCESS) {
+        return -OS_FAIL;
+    }
+    if (object) {
+        stream->objects |= (1u << stream->depth);
+    } else {
+        stream->objects &= ~(1u << stream->depth);
+    }
+    stream->depth++;
+    stream->key_len = -1;
+    stream->len = 0;
+    stream->state = object ? JSON_STREAM_STATE_KEY_OR_END : JSON_STREAM_STATE_VALUE_OR_END;
+    return OS_SUCCESS;
+}
+
+static int json_stream_close(json_stream_t *stream, bool object)
+{
+    if (stream->depth == 0 || json_stream_in_object(stream) != object) {
+        return -OS_FAIL;
+    }
+    stream->depth--;
+    if (json_stream_emit(stream, object ? JSON_STREAM_OBJECT_END : JSON_STREAM_ARRAY_END,
+                         stream->depth) != OS_SUCCESS) {
+        return -OS_FAIL;
+    }
+    json_stream_value_done(stream);
+    return OS_SUCCESS;
+}
+
+static int json_stream_parse_value(json_stream_t *stream, char c)
+{
+    switch (c) {
+    case '{':
+    case '[':
+        return json_stream_open(stream, c == '{');
+    case '\"':
+        stream->in_key = false;
+        stream->len = json_stream_value_start(stream);
+        stream->state = JSON_STREAM_STATE_STRING;
+        return OS_SUCCESS;
+    case '-': case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+    case 't': case 'f': case 'n':
+        stream->len = json_stream_value_start(stream);
+        stream->state = JSON_STREAM_STATE_PRIMITIVE;
+        return json_stream_putc(stream, c);
+    default:
+        return -OS_FAIL;
+    }
+}
+
+static int json_stream_parse_char(json_stream_t *stream, char c)
+{
+    switch (stream->state) {
+    case JSON_STREAM_STATE_STRING:
+        if (c == '\"') {
+            if (stream->in_key) {
+                stream->key_len = stream->len;
+                stream->state = JSON_STREAM_STATE_COLON;
+                return OS_SUCCESS;
+            }
+            if (json_stream_emit(stream, JSON_STREAM_STRING, stream->depth) != OS_SUCCESS) {
+                return -OS_FAIL;
+            }
+            json_stream_value_done(stream);
+            return OS_SUCCESS;
+        }
+        if ((uint8_t) c < 32) {
+            return -OS_FAIL;
+        }
+        if (c == '\\') {
+            stream->state = JSON_STREAM_STATE_ESCAPE;
+        }
+        return json_stream_putc(stream, c);
+    case JSON_STREAM_STATE_ESCAPE:
+        stream->state = JSON_STREAM_STATE_STRING;
+        return json_stream_putc(stream, c);
+    case JSON_STREAM_STATE_PRIMITIVE:
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n' && c != ',' && c != ']' && c != '}') {
+            if (c < 32 || c >= 127) {
+                return -OS_FAIL;
+            }
+            return json_stream_putc(stream, c);
+        }
+        if (json_stream_emit(stream, JSON_STREAM_PRIMITIVE, stream->depth) != OS_SUCCESS) {
+            return -OS_FAIL;
+        }
+        json_stream_value_done(stream);
+        /* The character after the primitive is parsed as any other */
+        break;
+    default:
+        break;
+    }
+
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        return OS_SUCCESS;
+    }
+
+    switch (stream->state) {
+    case JSON_STREAM_STATE_VALUE_OR_END:
+        if (c == ']') {
+            return json_stream_close(stream, false);
+        }
+        return json_stream_parse_value(stream, c);
+    case JSON_STREAM_STATE_VALUE:
+        return json_stream_parse_value(stream, c);
+    case JSON_STREAM_STATE_KEY_OR_END:
+        if (c == '}') {
+            return json_stream_close(stream, true);
+        }
+    /* fall through */
+    case JSON_STREAM_STATE_KEY:
+        if (c != '\"') {
+            return -OS_FAIL;
+        }
+        stream->in_key = true;
+        stream->len = 0;
+        stream->state = JSON_STREAM_STATE_STRING;
+        return OS_SUCCESS;
+    case JSON_STREAM_STATE_COLON:
+        if (c != ':') {
+            return -OS_FAIL;
+        }
+        stream->state = JSON_STREAM_STATE_VALUE;
+        return OS_SUCCESS;
+    case JSON_STREAM_STATE_NEXT:
+        if (c == ',') {
+            stream->state = json_stream_in_object(stream) ? JSON_STREAM_STATE_KEY : JSON_STREAM_STATE_VALUE;
+            return OS_SUCCESS;
+        }
+        if (c == '}' || c == ']') {
+            return json_stream_close(stream, c == '}');
+        }
+        return -OS_FAIL;
+    default:
+        /* Anything after the document, or after an error */
+        return -OS_FAIL;
+    }
+}
+
+int json_stream_init(json_stream_t *stream, char *buf, int buf_size, json_stream_cb_t cb, void *priv)
+{
+    if (!stream || !buf || buf_size <= 0 || !cb) {
+        return -OS_FAIL;
+    }
+    memset(stream, 0, sizeof(json_stream_t));
+    stream->cb = cb;
+    stream->priv = priv;
+    stream->buf = buf;
+    stream->buf_size = buf_size;
+    stream->key_len = -1;
+    stream->state = JSON_STREAM_STATE_VALUE;
+    return OS_SUCCESS;
+}
+
+int json_stream_feed(json_stream_t *stream, const char *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        if (json_stream_parse_char(stream, data[i]) != OS_SUCCESS) {
+            stream->state = JSON_STREAM_STATE_ERROR;
+            return -OS_FAIL;
+        }
+    }
+    return OS_SUCCESS;
+}
+
+int json_stream_end(json_stream_t *stream)
+{
+    /* A primitive at the top ends with the document */
+    if (stream->state == JSON_STREAM_STATE_PRIMITIVE && stream->depth == 0) {
+        if (json_stream_emit(stream, JSON_STREAM_PRIMITIVE, 0) != OS_SUCCESS) {
+            stream->state = JSON_STREAM_STATE_ERROR;
+            return -OS_FAIL;
+        }
+        json_stream_value_done(stream);
+    }
+    return stream->state == JSON_STREAM_STATE_DONE ? OS_SUCCESS : -OS_FAIL;
+}
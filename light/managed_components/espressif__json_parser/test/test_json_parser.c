@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include "json_parser.h"
 #include "unity.h"
@@ -58,4 +59,174 @@ TEST_CASE("json_parser basic tests", "[json_parser]")
     TEST_ASSERT(int64_val == 109174583252);
 
     json_parse_end(&jctx);
-}
\ No newline at end of file
+}
+
+TEST_CASE("json_parser grows its tokens and reuses them", "[json_parser]")
+{
+    /* More tokens than allocated at first, {"a":[0,1,...]} */
+    char js[512];
+    int len = snprintf(js, sizeof(js), "{\"a\":[");
+    for (int i = 0; i < 100; i++) {
+        len += snprintf(js + len, sizeof(js) - len, "%s%d", i ? "," : "", i);
+    }
+    len += snprintf(js + len, sizeof(js) - len, "]}");
+
+    jparse_ctx_t jctx;
+    int num_elem, int_val;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, len));
+    TEST_ASSERT_EQUAL(103, jctx.num_tokens);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "a", &num_elem));
+    TEST_ASSERT_EQUAL(100, num_elem);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_arr_get_int(&jctx, 99, &int_val));
+    TEST_ASSERT_EQUAL_INT(99, int_val);
+    json_parse_end(&jctx);
+
+    memset(&jctx, 0, sizeof(jctx));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_reuse(&jctx, js, len));
+    json_tok_t *tokens = jctx.tokens;
+    json_parse_end_reuse(&jctx);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start_reuse(&jctx, json_test_str, strlen(json_test_str)));
+    TEST_ASSERT_EQUAL_PTR(tokens, jctx.tokens);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "int_val", &int_val));
+    TEST_ASSERT_EQUAL_INT(2017, int_val);
+    json_parse_end_reuse(&jctx);
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_parse_start_reuse(&jctx, "{\"a\":", 5));
+    json_parse_end(&jctx);
+}
+
+TEST_CASE("json_parser finds the keys of large objects", "[json_parser]")
+{
+    /* {"k0":0,"k1":{"k0":100},...,"k39":39,"k5":-1}, the first of the repeated keys is found */
+    char js[1024];
+    int len = snprintf(js, sizeof(js), "{");
+    for (int i = 0; i < 40; i++) {
+        if (i % 10 == 1) {
+            len += snprintf(js + len, sizeof(js) - len, "\"k%d\":{\"k0\":%d},", i, 100 + i);
+        } else {
+            len += snprintf(js + len, sizeof(js) - len, "\"k%d\":%d,", i, i);
+        }
+    }
+    len += snprintf(js + len, sizeof(js) - len, "\"k5\":-1}");
+
+    jparse_ctx_t jctx;
+    char key[8];
+    int int_val;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, js, len));
+    for (int i = 39; i >= 0; i--) {
+        snprintf(key, sizeof(key), "k%d", i);
+        if (i % 10 == 1) {
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_object(&jctx, key));
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "k0", &int_val));
+            TEST_ASSERT_EQUAL_INT(100 + i, int_val);
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_leave_object(&jctx));
+        } else {
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, key, &int_val));
+            TEST_ASSERT_EQUAL_INT(i, int_val);
+        }
+    }
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "k40", &int_val));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_get_int(&jctx, "k", &int_val));
+    json_parse_end(&jctx);
+}
+
+static int json_stream_test_cb(void *priv, json_stream_event_t event, int depth,
+                               const char *key, int key_len, const char *value, int value_len)
+{
+    char *out = priv;
+    int len = strlen(out);
+    snprintf(out + len, 512 - len, "%d%d:%.*s=%.*s;", event, depth, key ? key_len : 1, key ? key : "-", value_len, value);
+    return OS_SUCCESS;
+}
+
+TEST_CASE("json_parser streams documents fed in chunks", "[json_parser]")
+{
+    static char expected[512], out[512];
+    char buf[32];
+    json_stream_t stream;
+
+    memset(expected, 0, sizeof(expected));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_init(&stream, buf, sizeof(buf), json_stream_test_cb, expected));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_feed(&stream, "{\"a\":[1,\"x\\\"\"],\"b\":{}}", 22));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_end(&stream));
+    TEST_ASSERT_EQUAL_STRING("00:-=;21:a=;52:-=1;42:-=x\\\";31:-=;01:b=;11:-=;10:-=;", expected);
+
+    /* Any chunking gives the same events */
+    memset(expected, 0, sizeof(expected));
+    json_stream_init(&stream, buf, sizeof(buf), json_stream_test_cb, expected);
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_feed(&stream, json_test_str, strlen(json_test_str)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_end(&stream));
+    for (int chunk = 1; chunk < 8; chunk++) {
+        memset(out, 0, sizeof(out));
+        json_stream_init(&stream, buf, sizeof(buf), json_stream_test_cb, out);
+        for (int i = 0; i < strlen(json_test_str); i += chunk) {
+            int len = strlen(json_test_str) - i < chunk ? strlen(json_test_str) - i : chunk;
+            TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_feed(&stream, json_test_str + i, len));
+        }
+        TEST_ASSERT_EQUAL(OS_SUCCESS, json_stream_end(&stream));
+        TEST_ASSERT_EQUAL_STRING(expected, out);
+    }
+
+    /* Incomplete, invalid, and too long for the buffer */
+    const char *invalid[] = { "{\"a\":1", "{\"a\":1,}", "[1 2]", "{\"a\"}", "{} {}", "[\"0123456789012345678901234567890123\"]" };
+    for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        memset(out, 0, sizeof(out));
+        json_stream_init(&stream, buf, sizeof(buf), json_stream_test_cb, out);
+        int ret = json_stream_feed(&stream, invalid[i], strlen(invalid[i]));
+        TEST_ASSERT(ret != OS_SUCCESS || json_stream_end(&stream) != OS_SUCCESS);
+    }
+}
+
+typedef struct {
+    bool objects;
+    char arrays[8];
+} json_bind_test_features_t;
+
+typedef struct {
+    char str_val[16];
+    float float_val;
+    int int_val;
+    bool bool_val;
+    int64_t int_64;
+    json_bind_test_features_t features;
+    int missing;
+} json_bind_test_t;
+
+TEST_CASE("json_parser binds the keys of an object to a struct", "[json_parser]")
+{
+    static const json_bind_field_t features_fields[] = {
+        JSON_BIND_FIELD("objects", JSON_BIND_BOOL, json_bind_test_features_t, objects),
+        JSON_BIND_FIELD("arrays", JSON_BIND_STRING, json_bind_test_features_t, arrays),
+    };
+    static const json_bind_field_t fields[] = {
+        JSON_BIND_FIELD("str_val", JSON_BIND_STRING, json_bind_test_t, str_val),
+        JSON_BIND_FIELD("float_val", JSON_BIND_FLOAT, json_bind_test_t, float_val),
+        JSON_BIND_FIELD("int_val", JSON_BIND_INT, json_bind_test_t, int_val),
+        JSON_BIND_FIELD("bool_val", JSON_BIND_BOOL, json_bind_test_t, bool_val),
+        JSON_BIND_FIELD("int_64", JSON_BIND_INT64, json_bind_test_t, int_64),
+        JSON_BIND_FIELD_OBJECT("features", json_bind_test_t, features, features_fields),
+        JSON_BIND_FIELD("missing", JSON_BIND_INT, json_bind_test_t, missing),
+        /* Wrong type, left out */
+        JSON_BIND_FIELD("supported_el", JSON_BIND_INT, json_bind_test_t, missing),
+    };
+
+    jparse_ctx_t jctx;
+    json_bind_test_t val = { .missing = -1 };
+    uint32_t found;
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_parse_start(&jctx, json_test_str, strlen(json_test_str)));
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_bind(&jctx, fields, sizeof(fields) / sizeof(fields[0]), &val, &found));
+    TEST_ASSERT_EQUAL_HEX32(0x3f, found);
+    TEST_ASSERT_EQUAL_STRING("JSON Parser", val.str_val);
+    TEST_ASSERT(fabs(val.float_val - 2.0f) < 0.0001f);
+    TEST_ASSERT_EQUAL_INT(2017, val.int_val);
+    TEST_ASSERT_EQUAL(false, val.bool_val);
+    TEST_ASSERT(val.int_64 == 109174583252);
+    TEST_ASSERT_EQUAL(true, val.features.objects);
+    TEST_ASSERT_EQUAL_STRING("yes", val.features.arrays);
+    TEST_ASSERT_EQUAL_INT(-1, val.missing);
+
+    /* Only objects bind */
+    TEST_ASSERT_EQUAL(OS_SUCCESS, json_obj_get_array(&jctx, "supported_el", &val.int_val));
+    TEST_ASSERT_NOT_EQUAL(OS_SUCCESS, json_obj_bind(&jctx, fields, sizeof(fields) / sizeof(fields[0]), &val, &found));
+    TEST_ASSERT_EQUAL_HEX32(0, found);
+    json_parse_end(&jctx);
+}
@@ -9,6 +9,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_HUE 360
@@ -97,6 +98,26 @@ uint32_t led_indicator_rgb2hsv(uint32_t rgb_value);
  */
 void led_indicator_hsv2rgb(uint32_t hsv, uint32_t *r, uint32_t *g, uint32_t *b);
 
+/**
+ * @brief Convert an array of RGB color values to HSV color values.
+ *
+ * @param rgb RGB color values to convert, the index bits are ignored.
+ * @param hsv Array to store the resulting HSV color values, may be the same as rgb.
+ * @param count Number of values to convert.
+ */
+void led_indicator_rgb2hsv_batch(const uint32_t *rgb, uint32_t *hsv, size_t count);
+
+/**
+ * @brief Convert an array of HSV color values to RGB color values.
+ *
+ * Gives the same result as led_indicator_hsv2rgb() for each value, packed with SET_RGB().
+ *
+ * @param hsv HSV color values to convert, the index bits are ignored.
+ * @param rgb Array to store the resulting RGB color values, may be the same as hsv.
+ * @param count Number of values to convert.
+ */
+void led_indicator_hsv2rgb_batch(const uint32_t *hsv, uint32_t *rgb, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,10 @@ typedef struct {
     esp_err_t (*hal_indicator_set_rgb)(void *hardware, uint32_t rgb_value);                /*!< Pointer function for setting rgb, must be supported by hardware */
     esp_err_t (*hal_indicator_set_hsv)(void *hardware, uint32_t hsv_value);                /*!< Pointer function for setting rgb, must be supported by hardware */
     void *hardware_data;                                                                   /*!< user hardware data*/
+    esp_err_t (*hal_indicator_set_frame)(void *hardware, const uint32_t *rgb_frame, uint32_t pixel_num); /*!< Pointer function for writing a whole frame and refreshing once, optional */
+    esp_err_t (*hal_indicator_begin)(void *batch_data);                                    /*!< Called before the first update staged on batch_data, optional */
+    esp_err_t (*hal_indicator_commit)(void *batch_data);                                   /*!< Optional. When set, the set functions only stage their update and this flushes the updates staged on batch_data, see led_indicator_batch_begin() */
+    void *batch_data;                                                                      /*!< Shared by the indicators committed together, eg. the I2C PWM expander their channels are on */
 } led_indicator_custom_config_t;
 
 #ifdef __cplusplus
@@ -12,6 +12,18 @@ extern "C" {
 
 #include "esp_log.h"
 
+/**
+ * @brief Gamma table of each LED channel
+ *
+ */
+typedef enum {
+    LED_GAMMA_CHANNEL_R,   /*!< Red channel of RGB LEDs */
+    LED_GAMMA_CHANNEL_G,   /*!< Green channel of RGB LEDs */
+    LED_GAMMA_CHANNEL_B,   /*!< Blue channel of RGB LEDs */
+    LED_GAMMA_CHANNEL_W,   /*!< Brightness of single colour LEDs and value of HSV colours */
+    LED_GAMMA_CHANNEL_MAX,
+} led_gamma_channel_t;
+
 /**
  * @brief Get the gamma value of the LED indicator
  *
@@ -20,6 +32,15 @@ extern "C" {
  */
 uint8_t led_indicator_get_gamma_value(uint8_t input);
 
+/**
+ * @brief Get the gamma value of one LED channel
+ *
+ * @param channel The channel whose table is used
+ * @param input The input value to get the gamma value from, should be between 0 and 255
+ * @return uint8_t The final output value of the channel, with its max_output scale applied
+ */
+uint8_t led_indicator_get_channel_gamma_value(led_gamma_channel_t channel, uint8_t input);
+
 /**
  * @brief Create a new gamma table for the LED indicator
  *
@@ -35,6 +56,21 @@ uint8_t led_indicator_get_gamma_value(uint8_t input);
  */
 esp_err_t led_indicator_new_gamma_table(float gamma);
 
+/**
+ * @brief Create a new gamma table for one LED channel
+ *
+ * Use it when the R, G, B and W LEDs do not share the same curve or intensity.
+ * The output of the table is scaled to max_output, so a single lookup gives the final value.
+ *
+ * @param channel The channel to update
+ * @param gamma The gamma value to use for the new table, should be larger than 0
+ * @param max_output Output for the full input value, 255 leaves the channel unscaled
+ * @return esp_err_t
+ *         ESP_ERR_INVALID_ARG if gamma is less than or equal to 0 or channel is invalid
+ *         ESP_OK on success
+ */
+esp_err_t led_indicator_new_channel_gamma_table(led_gamma_channel_t channel, float gamma, uint8_t max_output);
+
 #ifdef __cplusplus
 }
 #endif
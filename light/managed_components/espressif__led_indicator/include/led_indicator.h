@@ -12,6 +12,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "sdkconfig.h"
 #include "esp_err.h"
 #include "led_gpio.h"
 #include "led_ledc.h"
@@ -89,6 +90,36 @@ typedef struct {
 
 typedef void *led_indicator_handle_t; /*!< LED indicator operation handle */
 
+#ifdef CONFIG_LED_INDICATOR_STATS
+/**
+ * @brief Timing statistics of the blink steps of an indicator, see led_indicator_get_stats()
+ *
+ * The lateness of a step is the time it started at minus the time it was scheduled for. The timers run on
+ * the tick, so it goes down to minus one tick, the jitter is late_max_us - late_min_us.
+ */
+typedef struct {
+    uint32_t steps;                                /*!< Number of steps run */
+    uint32_t retries;                              /*!< Number of steps postponed because the indicator was locked */
+    uint32_t late_count;                           /*!< Number of lateness samples */
+    int32_t late_min_us;                           /*!< Smallest lateness, in us */
+    int32_t late_max_us;                           /*!< Largest lateness, in us */
+    int64_t late_sum_us;                           /*!< Sum of the lateness, in us */
+    int64_t late_sq_sum_us;                        /*!< Sum of the squared lateness, in us^2 */
+    uint64_t cycles_sum;                           /*!< CPU cycles spent in the steps */
+    uint32_t cycles_max;                           /*!< CPU cycles of the longest step */
+} led_indicator_stats_t;
+#endif
+
+/**
+ * @brief Render callback of a frame animation, see led_indicator_frame_start()
+ *
+ * @param frame Framebuffer to fill, one RGB value (0xRRGGBB) per pixel. It still holds the previous frame.
+ * @param pixel_num Number of pixels in the framebuffer
+ * @param frame_index Number of frames rendered before this one
+ * @param user_data User data given to led_indicator_frame_start()
+ */
+typedef void (*led_indicator_frame_render_cb_t)(uint32_t *frame, uint32_t pixel_num, uint32_t frame_index, void *user_data);
+
 /**
  * @brief create a LED indicator instance with GPIO number and configuration
  *
@@ -259,6 +290,125 @@ esp_err_t led_indicator_set_rgb(led_indicator_handle_t handle, uint32_t irgb_val
  */
 esp_err_t led_indicator_set_color_temperature(led_indicator_handle_t handle, const uint32_t temperature);
 
+/**
+ * @brief Set the color temperature for the LED indicator, in mireds.
+ *
+ * Same as led_indicator_set_color_temperature without the conversion from kelvin,
+ * for callers that already work in mireds such as the Matter ColorControl cluster.
+ *
+ * @param handle LED indicator handle.
+ * @param mireds Color temperature of LED (0xIIMMMMMM)
+ *        I: 0-126, set 127 to control all, MMMMMM: mireds, 1000000 / kelvin
+
+ * @note Index settings are only supported for LED_RGB_MODE.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_FAIL: Failure
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ */
+esp_err_t led_indicator_set_color_temperature_mireds(led_indicator_handle_t handle, const uint32_t mireds);
+
+/**
+ * @brief Write a whole frame to the LED indicator, with a single refresh.
+ *
+ * @param handle LED indicator handle.
+ * @param rgb_frame One RGB value (0xRRGGBB) per pixel, starting from pixel 0.
+ * @param pixel_num Number of values in rgb_frame, pixels beyond the strip length are ignored.
+ * @note Only supported for LED_STRIPS_MODE, and LED_CUSTOM_MODE with hal_indicator_set_frame.
+ *       The frame does not change the value returned by the getters.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_FAIL: Failure
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ *     - ESP_ERR_NOT_SUPPORTED: The indicator can not display frames
+ */
+esp_err_t led_indicator_set_frame(led_indicator_handle_t handle, const uint32_t *rgb_frame, uint32_t pixel_num);
+
+/**
+ * @brief Start a frame animation on the LED indicator.
+ *
+ * Every period_ms the indicator timer calls render_cb to update a framebuffer owned by the indicator,
+ * then writes it with a single refresh. The animation takes over the output from the blink lists,
+ * which resume once led_indicator_frame_stop() is called. Starting a new animation replaces the running one.
+ *
+ * @param handle LED indicator handle.
+ * @param pixel_num Number of pixels in the framebuffer.
+ * @param period_ms Period between two frames, in ms.
+ * @param render_cb Callback rendering one frame, called from the timer task with the indicator locked,
+ *        it must not call other LED indicator APIs on the same handle.
+ * @param user_data User data passed to render_cb.
+ * @note Only supported for LED_STRIPS_MODE, and LED_CUSTOM_MODE with hal_indicator_set_frame.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ *     - ESP_ERR_NO_MEM: Framebuffer allocation failed
+ *     - ESP_ERR_NOT_SUPPORTED: The indicator can not display frames
+ */
+esp_err_t led_indicator_frame_start(led_indicator_handle_t handle, uint32_t pixel_num, uint32_t period_ms, led_indicator_frame_render_cb_t render_cb, void *user_data);
+
+/**
+ * @brief Stop the frame animation of the LED indicator, the blink lists take over again.
+ *
+ * @param handle LED indicator handle.
+ * @note The last frame stays displayed until something else is written.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ */
+esp_err_t led_indicator_frame_stop(led_indicator_handle_t handle);
+
+/**
+ * @brief Start a batch of updates, committed together by led_indicator_batch_commit().
+ *
+ * Custom backends with a hal_indicator_commit hook, such as I2C PWM expanders, only stage the updates of their
+ * indicators. Outside a batch every update is committed right away. Inside a batch, the updates made by the calling
+ * task are committed once per batch_data by led_indicator_batch_commit(), so that 16 channels of an expander set one
+ * after the other cost a single bus burst. Up to CONFIG_LED_INDICATOR_BATCH_MAX backends are staged at once, the
+ * updates of the others are committed right away. Other backends are not affected.
+ *
+ * With CONFIG_LED_INDICATOR_SHARED_TIMER the blink steps of all the indicators due at the same tick are one batch.
+ *
+ * @note Batches nest in the same task. Only one task at a time can be inside a batch.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_STATE: Another task is inside a batch, the updates of this one are committed right away
+ */
+esp_err_t led_indicator_batch_begin(void);
+
+/**
+ * @brief Commit the updates staged since led_indicator_batch_begin(), once per backend.
+ *
+ * @note The outermost call commits, the hooks are called from the calling task.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_STATE: The calling task is not inside a batch
+ *     - ESP_FAIL: A commit hook failed
+ */
+esp_err_t led_indicator_batch_commit(void);
+
+#ifdef CONFIG_LED_INDICATOR_STATS
+/**
+ * @brief Get the timing statistics of the blink steps of the LED indicator.
+ *
+ * @param handle LED indicator handle.
+ * @param stats Statistics accumulated since the indicator was created or led_indicator_reset_stats() was called.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ */
+esp_err_t led_indicator_get_stats(led_indicator_handle_t handle, led_indicator_stats_t *stats);
+
+/**
+ * @brief Clear the timing statistics of the LED indicator.
+ *
+ * @param handle LED indicator handle.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_ARG: Invalid parameter
+ */
+esp_err_t led_indicator_reset_stats(led_indicator_handle_t handle);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -107,6 +107,20 @@ esp_err_t led_indicator_strips_set_hsv(void *strips, uint32_t ihsv_value);
  */
 esp_err_t led_indicator_strips_set_brightness(void *strips, uint32_t ibrightness);
 
+/**
+ * @brief Write a frame to the strip and refresh it once.
+ *
+ * @param strips LED indicator LED Strips operation handle.
+ * @param rgb_frame One RGB value per pixel (0xRRGGBB), starting from pixel 0.
+ * @param pixel_num Number of values in rgb_frame, pixels beyond the strip length are ignored.
+ * @note Gamma correction is applied per channel, as for the other setters.
+ * @return esp_err_t
+ *     - ESP_OK: Success
+ *     - ESP_ERR_INVALID_ARG: Invalid argument provided
+ *     - ESP_FAIL: Failed to write the frame
+ */
+esp_err_t led_indicator_strips_set_frame(void *strips, const uint32_t *rgb_frame, uint32_t pixel_num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,18 +10,31 @@ extern "C" {
 #endif
 
 #include "driver/ledc.h"
+#include "esp_idf_version.h"
 
 #define LEDC_MODE       CONFIG_LEDC_SPEED_MODE_VALUE
 #define LEDC_DUTY_RES   CONFIG_LEDC_TIMER_BIT_NUM
 #define LEDC_FREQ_HZ    CONFIG_LEDC_TIMER_FREQ_HZ
 
+#if CONFIG_LEDC_KEEP_ALIVE_IN_SLEEP
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 4, 0)
+#error "CONFIG_LEDC_KEEP_ALIVE_IN_SLEEP needs the LEDC sleep modes, from ESP-IDF v5.4"
+#endif
+/* RC_FAST keeps running in light sleep, the channels keep their output there */
+#define LEDC_CLK        LEDC_USE_RC_FAST_CLK
+#define LEDC_SLEEP_MODE .sleep_mode = LEDC_SLEEP_MODE_KEEP_ALIVE,
+#else
+#define LEDC_CLK        LEDC_AUTO_CLK
+#define LEDC_SLEEP_MODE
+#endif
+
 #define LEDC_TIMER_CONFIG(ledc_timer)   \
 {                                     \
     .speed_mode = LEDC_MODE,          \
     .duty_resolution = LEDC_DUTY_RES, \
     .timer_num = ledc_timer,          \
     .freq_hz = LEDC_FREQ_HZ,          \
-    .clk_cfg = LEDC_AUTO_CLK,         \
+    .clk_cfg = LEDC_CLK,              \
 }
 
 #define LEDC_CHANNEL_CONFIG(ledc_timer, ledc_channel, gpio) \
@@ -33,6 +46,7 @@ extern "C" {
     .intr_type = LEDC_INTR_DISABLE,                     \
     .channel = ledc_channel,                            \
     .gpio_num = gpio,                                   \
+    LEDC_SLEEP_MODE                                     \
 }
 
 #ifdef __cplusplus
@@ -4,11 +4,33 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stddef.h>
 #include <stdint.h>
-#include <math.h>
 #include "led_convert.h"
 
-uint32_t led_indicator_rgb2hsv(uint32_t rgb_value)
+/* x / 255, exact for 0 <= x <= 65025 */
+#define DIV255(x) (((x) + 1 + ((x) >> 8)) >> 8)
+/* x / 60, exact for 0 <= x <= 15045 */
+#define DIV60(x)  (((x) * 34953) >> 21)
+
+enum {
+    HSV_MAX,    /*!< Channel at the value */
+    HSV_MIN,    /*!< Channel at the value lowered by the saturation */
+    HSV_RISE,   /*!< Channel rising from min to max across the sector */
+    HSV_FALL,   /*!< Channel falling from max to min across the sector */
+};
+
+/* Source of R, G and B in each 60 degree hue sector */
+static const uint8_t s_hue_sector[6][3] = {
+    {HSV_MAX,  HSV_RISE, HSV_MIN},
+    {HSV_FALL, HSV_MAX,  HSV_MIN},
+    {HSV_MIN,  HSV_MAX,  HSV_RISE},
+    {HSV_MIN,  HSV_FALL, HSV_MAX},
+    {HSV_RISE, HSV_MIN,  HSV_MAX},
+    {HSV_MAX,  HSV_MIN,  HSV_FALL},
+};
+
+static inline uint32_t _rgb2hsv(uint32_t rgb_value)
 {
     uint8_t r = (rgb_value >> 16) & 0xFF;
     uint8_t g = (rgb_value >> 8) & 0xFF;
@@ -41,51 +63,51 @@ uint32_t led_indicator_rgb2hsv(uint32_t rgb_value)
     return (h << 16) | (s << 8) | v;
 }
 
-void led_indicator_hsv2rgb(uint32_t hsv, uint32_t *r, uint32_t *g, uint32_t *b)
+static inline uint32_t _hsv2rgb(uint32_t hsv)
 {
-    uint16_t h = (hsv >> 16) & 0x1FF;
-    uint8_t s = (hsv >> 8) & 0xFF;
-    uint8_t v = hsv & 0xFF;
-
-    uint8_t rgb_max = v;
-    uint8_t rgb_min = rgb_max * (255 - s) / 255.0f;
+    uint32_t h = (hsv >> 16) & 0x1FF;
+    uint32_t s = (hsv >> 8) & 0xFF;
+    uint32_t v = hsv & 0xFF;
 
-    uint8_t i = h / 60;
-    uint8_t diff = h % 60;
+    uint32_t sector = DIV60(h);
+    uint32_t diff = h - sector * 60;
+    uint32_t channel[4];
 
+    channel[HSV_MAX] = v;
+    channel[HSV_MIN] = DIV255(v * (255 - s));
     // RGB adjustment amount by hue
-    uint8_t rgb_adj = (rgb_max - rgb_min) * diff / 60;
-
-    switch (i) {
-    case 0:
-        *r = rgb_max;
-        *g = rgb_min + rgb_adj;
-        *b = rgb_min;
-        break;
-    case 1:
-        *r = rgb_max - rgb_adj;
-        *g = rgb_max;
-        *b = rgb_min;
-        break;
-    case 2:
-        *r = rgb_min;
-        *g = rgb_max;
-        *b = rgb_min + rgb_adj;
-        break;
-    case 3:
-        *r = rgb_min;
-        *g = rgb_max - rgb_adj;
-        *b = rgb_max;
-        break;
-    case 4:
-        *r = rgb_min + rgb_adj;
-        *g = rgb_min;
-        *b = rgb_max;
-        break;
-    default:
-        *r = rgb_max;
-        *g = rgb_min;
-        *b = rgb_max - rgb_adj;
-        break;
+    uint32_t rgb_adj = DIV60((channel[HSV_MAX] - channel[HSV_MIN]) * diff);
+    channel[HSV_RISE] = channel[HSV_MIN] + rgb_adj;
+    channel[HSV_FALL] = channel[HSV_MAX] - rgb_adj;
+
+    // Hues above 360 keep the last sector, as they always did
+    const uint8_t *src = s_hue_sector[sector > 5 ? 5 : sector];
+    return SET_RGB(channel[src[0]], channel[src[1]], channel[src[2]]);
+}
+
+uint32_t led_indicator_rgb2hsv(uint32_t rgb_value)
+{
+    return _rgb2hsv(rgb_value);
+}
+
+void led_indicator_hsv2rgb(uint32_t hsv, uint32_t *r, uint32_t *g, uint32_t *b)
+{
+    uint32_t rgb = _hsv2rgb(hsv);
+    *r = GET_RED(rgb);
+    *g = GET_GREEN(rgb);
+    *b = GET_BLUE(rgb);
+}
+
+void led_indicator_rgb2hsv_batch(const uint32_t *rgb, uint32_t *hsv, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        hsv[i] = _rgb2hsv(rgb[i]);
+    }
+}
+
+void led_indicator_hsv2rgb_batch(const uint32_t *hsv, uint32_t *rgb, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        rgb[i] = _hsv2rgb(hsv[i]);
     }
 }
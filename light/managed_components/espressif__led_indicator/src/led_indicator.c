@@ -6,11 +6,13 @@
 
 #include <inttypes.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/queue.h>
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/timers.h"
 #include "freertos/semphr.h"
 #include "led_custom.h"
@@ -22,9 +24,43 @@
 #include "led_strips.h"
 #include "led_gamma.h"
 #include "led_convert.h"
+#ifdef CONFIG_LED_INDICATOR_STATS
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#include "esp_cpu.h"
+#define STATS_CYCLE_COUNT() esp_cpu_get_cycle_count()
+#else
+#include "hal/cpu_hal.h"
+#define STATS_CYCLE_COUNT() cpu_hal_get_cycle_count()
+#endif
+#endif
 
 static const char *TAG = "led_indicator";
 
+#if CONFIG_DIAG_ENABLE_TRACE
+/* Weak, so that the events are only recorded when the application links the esp_diagnostics trace */
+extern void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg) __attribute__((weak));
+#define LED_INDICATOR_TRACE(phase, arg) do {                         \
+        if (esp_diag_trace_record) {                                 \
+            esp_diag_trace_record("led_indicator_step", phase, arg); \
+        }                                                            \
+    } while (0)
+#else
+#define LED_INDICATOR_TRACE(phase, arg)
+#endif
+
+#if CONFIG_DIAG_HEAP_TAGS
+/* Weak as well, the indicators, their blink state and frames are accounted to the "led" heap tag */
+extern void *esp_diag_heap_tag_calloc(const char *tag, size_t n, size_t size) __attribute__((weak));
+extern void esp_diag_heap_tag_free(const char *tag, void *ptr) __attribute__((weak));
+#define LED_INDICATOR_HEAP_TAG      "led"
+#define calloc(n, size)             (esp_diag_heap_tag_calloc ?                                   \
+                                     esp_diag_heap_tag_calloc(LED_INDICATOR_HEAP_TAG, n, size) : calloc(n, size))
+#define free(ptr)                   (esp_diag_heap_tag_free ?                                     \
+                                     esp_diag_heap_tag_free(LED_INDICATOR_HEAP_TAG, ptr) : free(ptr))
+#endif
+
 #define LED_INDICATOR_CHECK(a, str, action) if(!(a)) { \
         ESP_LOGE(TAG,"%s:%d (%s):%s", __FILE__, __LINE__, __FUNCTION__, str); \
         action; \
@@ -42,25 +78,65 @@ static const char *TAG = "led_indicator";
 #define BRIGHTNESS_MIN     0
 #define NULL_ACTIVE_BLINK  -1
 #define NULL_PREEMPT_BLINK -1
+#define RETRY_TICKS        1
+
+#define BLINK_MASK_WORDS(n)  (((n) + 31) / 32)
+#define BLINK_MASK_BIT(i)    (0x80000000U >> ((i) & 31))
 
 typedef struct {
     uint16_t hue;
     uint8_t saturation;
 } HS_color_t;
 
-static const HS_color_t temp_table[] = {
-    {4, 100},  {8, 100},  {11, 100}, {14, 100}, {16, 100}, {18, 100}, {20, 100}, {22, 100}, {24, 100}, {25, 100},
-    {27, 100}, {28, 100}, {30, 100}, {31, 100}, {31, 95},  {30, 89},  {30, 85},  {29, 80},  {29, 76},  {29, 73},
-    {29, 69},  {28, 66},  {28, 63},  {28, 60},  {28, 57},  {28, 54},  {28, 52},  {27, 49},  {27, 47},  {27, 45},
-    {27, 43},  {27, 41},  {27, 39},  {27, 37},  {27, 35},  {27, 33},  {27, 31},  {27, 30},  {27, 28},  {27, 26},
-    {27, 25},  {27, 23},  {27, 22},  {27, 21},  {27, 19},  {27, 18},  {27, 17},  {27, 15},  {28, 14},  {28, 13},
-    {28, 12},  {29, 10},  {29, 9},   {30, 8},   {31, 7},   {32, 6},   {34, 5},   {36, 4},   {41, 3},   {49, 2},
-    {0, 0},    {294, 2},  {265, 3},  {251, 4},  {242, 5},  {237, 6},  {233, 7},  {231, 8},  {229, 9},  {228, 10},
-    {227, 11}, {226, 11}, {226, 12}, {225, 13}, {225, 13}, {224, 14}, {224, 14}, {224, 15}, {224, 15}, {223, 16},
-    {223, 16}, {223, 17}, {223, 17}, {223, 17}, {222, 18}, {222, 18}, {222, 19}, {222, 19}, {222, 19}, {222, 19},
-    {222, 20}, {222, 20}, {222, 20}, {222, 21}, {222, 21}
+/**
+ * @brief Hue and saturation (0-255) of the colour temperatures, indexed by mireds in steps of 1 << MIRED_TABLE_SHIFT
+ *
+ * Generated offline from the former 100 K table, the gamma correction of the value still applies on output.
+ * Mireds are spaced about evenly for the eye, so a fixed step interpolates with the same error over the
+ * whole range. Temperatures from MIRED_TABLE_MAX on (below 600 K) are red.
+ */
+#define MIRED_TABLE_SHIFT  3
+#define MIRED_TABLE_MAX    ((sizeof(mired_table) / sizeof(mired_table[0]) - 1) << MIRED_TABLE_SHIFT)
+
+static const HS_color_t mired_table[] = {
+    {222, 158}, {222, 66},  {222, 59},  {222, 57},  {222, 56},  {222, 55},  {222, 55},  {222, 54},  {222, 54},  {222, 54},
+    {222, 54},  {222, 54},  {222, 54},  {222, 51},  {223, 44},  {224, 38},  {226, 31},  {230, 22},  {247, 11},  {49, 1},
+    {35, 11},   {31, 19},   {29, 26},   {28, 35},   {27, 43},   {27, 48},   {27, 56},   {27, 62},   {27, 68},   {27, 76},
+    {27, 81},   {27, 88},   {27, 94},   {27, 100},  {27, 106},  {27, 111},  {27, 116},  {27, 121},  {27, 126},  {28, 132},
+    {28, 136},  {28, 142},  {28, 147},  {28, 152},  {28, 158},  {28, 162},  {28, 167},  {28, 171},  {29, 176},  {29, 181},
+    {29, 186},  {29, 190},  {29, 194},  {29, 198},  {29, 202},  {29, 207},  {30, 213},  {30, 217},  {30, 221},  {30, 225},
+    {30, 229},  {31, 235},  {31, 240},  {31, 244},  {31, 248},  {31, 252},  {31, 255},  {31, 255},  {30, 255},  {30, 255},
+    {30, 255},  {29, 255},  {29, 255},  {28, 255},  {28, 255},  {28, 255},  {27, 255},  {27, 255},  {27, 255},  {27, 255},
+    {26, 255},  {26, 255},  {25, 255},  {25, 255},  {25, 255},  {25, 255},  {25, 255},  {24, 255},  {24, 255},  {24, 255},
+    {24, 255},  {23, 255},  {23, 255},  {23, 255},  {23, 255},  {22, 255},  {22, 255},  {22, 255},  {22, 255},  {21, 255},
+    {21, 255},  {21, 255},  {21, 255},  {20, 255},  {20, 255},  {20, 255},  {20, 255},  {19, 255},  {19, 255},  {19, 255},
+    {19, 255},  {19, 255},  {18, 255},  {18, 255},  {18, 255},  {18, 255},  {18, 255},  {17, 255},  {17, 255},  {17, 255},
+    {17, 255},  {17, 255},  {16, 255},  {16, 255},  {16, 255},  {16, 255},  {16, 255},  {16, 255},  {16, 255},  {15, 255},
+    {15, 255},  {15, 255},  {15, 255},  {15, 255},  {15, 255},  {15, 255},  {14, 255},  {14, 255},  {14, 255},  {14, 255},
+    {14, 255},  {14, 255},  {13, 255},  {13, 255},  {13, 255},  {13, 255},  {13, 255},  {13, 255},  {12, 255},  {12, 255},
+    {12, 255},  {12, 255},  {12, 255},  {12, 255},  {11, 255},  {11, 255},  {11, 255},  {11, 255},  {11, 255},  {11, 255},
+    {10, 255},  {10, 255},  {10, 255},  {10, 255},  {10, 255},  {10, 255},  {10, 255},  {9, 255},   {9, 255},   {9, 255},
+    {9, 255},   {9, 255},   {9, 255},   {9, 255},   {9, 255},   {8, 255},   {8, 255},   {8, 255},   {8, 255},   {8, 255},
+    {8, 255},   {8, 255},   {7, 255},   {7, 255},   {7, 255},   {7, 255},   {7, 255},   {7, 255},   {7, 255},   {6, 255},
+    {6, 255},   {6, 255},   {6, 255},   {6, 255},   {6, 255},   {6, 255},   {6, 255},   {5, 255},   {5, 255},   {5, 255},
+    {5, 255},   {5, 255},   {5, 255},   {5, 255},   {5, 255},   {4, 255},   {4, 255},   {4, 255},   {4, 255},   {0, 255}
 };
 
+/**
+ * @brief Fade of one breathe/ring step, compiled on the first tick of the step
+ *
+ * A fade only depends on the step and on the value it starts from, so it is compiled once
+ * and every following tick only does an integer multiply-add per channel.
+ */
+typedef struct {
+    const blink_step_t *step;                      /*!< Step this fade was compiled for, NULL if none */
+    uint32_t from;                                 /*!< last_fade_value the fade starts from */
+    int32_t start[3];                              /*!< Start value of each channel, Q16.16 */
+    int32_t delta[3];                              /*!< Increment of each channel per fade step, Q16.16 */
+    uint16_t ticks;                                /*!< Period of one fade step in ms */
+    uint16_t count_step;                           /*!< Breathe only: increment of fade_value_count per tick */
+} _led_fade_plan_t;
+
 static const char *led_indicator_mode_str[5] = {"GPIO mode", "LEDC mode", "LED RGB mode", "LED Strips mode", "custom mode"};
 
 /**
@@ -73,21 +149,46 @@ typedef struct {
     esp_err_t (*hal_indicator_set_brightness)(void *hardware_data, uint32_t brightness);  /*!< Pointer function for setting brightness, must be supported by hardware */
     esp_err_t (*hal_indicator_set_rgb)(void *hardware, uint32_t rgb_value);               /*!< Pointer function for setting rgb, must be supported by hardware */
     esp_err_t (*hal_indicator_set_hsv)(void *hardware, uint32_t hsv_value);               /*!< Pointer function for setting hsv, must be supported by hardware */
+    esp_err_t (*hal_indicator_set_frame)(void *hardware, const uint32_t *rgb_frame, uint32_t pixel_num); /*!< Pointer function for writing a frame with a single refresh, optional */
+    esp_err_t (*hal_indicator_begin)(void *batch_data);                                   /*!< Pointer function called before the first update staged on batch_data, optional */
+    esp_err_t (*hal_indicator_commit)(void *batch_data);                                  /*!< Pointer function flushing the staged updates, optional */
+    void *batch_data;                              /*!< Backend the updates are staged on */
     void *hardware_data;                           /*!< Hardware data of the LED indicator */
     led_indicator_mode_t mode;                     /*!< LED work mode, eg. GPIO or pwm mode */
     int active_blink;                              /*!< Active blink list*/
     int preempt_blink;                             /*!< Highest priority blink list*/
     int *p_blink_steps;                            /*!< Stage of each blink list */
+    uint32_t *p_active_mask;                       /*!< Bit per blink list that is not stopped, MSB first, followed by a bit per non-zero word */
     led_indicator_ihsv_t current_fade_value;       /*!< Current fade value */
     led_indicator_ihsv_t last_fade_value;          /*!< Save the last value. */
+    _Atomic uint32_t published_value;              /*!< Copy of current_fade_value for the getters, which do not take the mutex */
     uint16_t fade_value_count;                     /*!< Count the number of fade */
     uint16_t fade_step;                            /*!< Step of fade */
     uint16_t fade_total_step;                      /*!< Total step of fade */
+    _led_fade_plan_t fade_plan;                    /*!< Compiled fade of the running breathe/ring step */
+    uint32_t *frame;                               /*!< Framebuffer of the running frame animation, NULL if none */
+    uint32_t frame_pixel_num;                      /*!< Number of pixels in the framebuffer */
+    uint32_t frame_period_ms;                      /*!< Period between two frames */
+    uint32_t frame_index;                          /*!< Number of frames rendered since the animation started */
+    led_indicator_frame_render_cb_t frame_render_cb; /*!< Render callback of the frame animation, NULL if none */
+    void *frame_user_data;                         /*!< User data of the render callback */
     uint32_t max_duty;                             /*!< Max duty cycle from duty_resolution : 2^duty_resolution -1 */
     SemaphoreHandle_t mutex;                       /*!< Mutex to achieve thread-safe */
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+    TickType_t deadline;                           /*!< Tick at which the shared timer runs this indicator next */
+    bool armed;                                    /*!< The indicator is waiting for the shared timer */
+#elif defined(CONFIG_LED_INDICATOR_ESP_TIMER)
+    esp_timer_handle_t h_timer;                    /*!< LED timer handle */
+    volatile bool deleted;                         /*!< The indicator is being deleted, its timer must not be started again */
+#else
     TimerHandle_t h_timer;                         /*!< LED timer handle, invalid if works in pwm mode */
+#endif
     blink_step_t const **blink_lists;              /*!< User defined LED blink lists */
     uint16_t blink_list_num;                       /*!< Number of blink lists */
+#ifdef CONFIG_LED_INDICATOR_STATS
+    int64_t due_us;                                /*!< Time the next step is due at, 0 if not scheduled */
+    led_indicator_stats_t stats;                   /*!< Timing statistics of the blink steps */
+#endif
 } _led_indicator_t;
 
 typedef struct _led_indicator_slist_t {
@@ -101,6 +202,10 @@ typedef struct _led_indicator_com_config {
     esp_err_t (*hal_indicator_set_brightness)(void *hardware_data, uint32_t brightness);  /*!< Pointer function for setting brightness, must be supported by hardware */
     esp_err_t (*hal_indicator_set_rgb)(void *hardware, uint32_t rgb_value);               /*!< Pointer function for setting rgb, must be supported by hardware */
     esp_err_t (*hal_indicator_set_hsv)(void *hardware, uint32_t hsv_value);               /*!< Pointer function for setting hsv, must be supported by hardware */
+    esp_err_t (*hal_indicator_set_frame)(void *hardware, const uint32_t *rgb_frame, uint32_t pixel_num); /*!< Pointer function for writing a frame with a single refresh, optional */
+    esp_err_t (*hal_indicator_begin)(void *batch_data);                                   /*!< Pointer function called before the first update staged on batch_data, optional */
+    esp_err_t (*hal_indicator_commit)(void *batch_data);                                  /*!< Pointer function flushing the staged updates, optional */
+    void *batch_data;                     /*!< Backend the updates are staged on */
     void *hardware_data;                  /*!< GPIO number of the LED indicator */
     blink_step_t const **blink_lists;     /*!< User defined LED blink lists */
     uint16_t blink_list_num;              /*!< Number of blink lists */
@@ -108,13 +213,92 @@ typedef struct _led_indicator_com_config {
 } _led_indicator_com_config_t;
 static SLIST_HEAD(_led_indicator_head_t, _led_indicator_slist_t) s_led_indicator_slist_head = SLIST_HEAD_INITIALIZER(s_led_indicator_slist_head);
 
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+/* One timer runs the blink lists of all the indicators, its period follows the nearest deadline */
+static TimerHandle_t s_shared_timer = NULL;
+static SemaphoreHandle_t s_list_mutex = NULL;                 /*!< Protects the indicator list against the shared timer */
+static portMUX_TYPE s_shared_lock = portMUX_INITIALIZER_UNLOCKED; /*!< Protects the deadlines */
+static TickType_t s_shared_deadline;                           /*!< Deadline the shared timer is armed for */
+static bool s_shared_armed = false;
+#define LIST_LOCK()   xSemaphoreTake(s_list_mutex, portMAX_DELAY)
+#define LIST_UNLOCK() xSemaphoreGive(s_list_mutex)
+#else
+#define LIST_LOCK()
+#define LIST_UNLOCK()
+#endif
+
+/* Backends of the updates staged inside led_indicator_batch_begin(), committed once each by led_indicator_batch_commit() */
+typedef struct {
+    esp_err_t (*commit)(void *batch_data);
+    void *batch_data;
+} _led_batch_entry_t;
+
+static portMUX_TYPE s_batch_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t s_batch_owner = NULL;                      /*!< Task inside a batch, NULL if none */
+static uint32_t s_batch_depth = 0;
+static uint32_t s_batch_count = 0;
+static _led_batch_entry_t s_batch[CONFIG_LED_INDICATOR_BATCH_MAX];
+
+/**
+ * @brief begin an update of the hardware of an indicator, must be followed by _led_indicator_update_end()
+ *
+ * A backend with a commit hook is begun once per batch, before the first update staged on it.
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @return true if the commit is left to led_indicator_batch_commit()
+ */
+static bool _led_indicator_update_begin(_led_indicator_t *p_led_indicator)
+{
+    if (!p_led_indicator->hal_indicator_commit) {
+        return false;
+    }
+    bool staged = false;
+    bool begun = false;
+    portENTER_CRITICAL(&s_batch_lock);
+    if (s_batch_owner == xTaskGetCurrentTaskHandle()) {
+        for (uint32_t i = 0; i < s_batch_count; i++) {
+            if (s_batch[i].commit == p_led_indicator->hal_indicator_commit && s_batch[i].batch_data == p_led_indicator->batch_data) {
+                staged = true;
+                begun = true;
+                break;
+            }
+        }
+        if (!staged && s_batch_count < CONFIG_LED_INDICATOR_BATCH_MAX) {
+            s_batch[s_batch_count].commit = p_led_indicator->hal_indicator_commit;
+            s_batch[s_batch_count].batch_data = p_led_indicator->batch_data;
+            s_batch_count++;
+            staged = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_batch_lock);
+    if (!begun && p_led_indicator->hal_indicator_begin) {
+        p_led_indicator->hal_indicator_begin(p_led_indicator->batch_data);
+    }
+    return staged;
+}
+
+/**
+ * @brief end an update of the hardware of an indicator, committed right away unless it is staged in a batch
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param staged value returned by _led_indicator_update_begin()
+ */
+static void _led_indicator_update_end(_led_indicator_t *p_led_indicator, bool staged)
+{
+    if (p_led_indicator->hal_indicator_commit && !staged) {
+        p_led_indicator->hal_indicator_commit(p_led_indicator->batch_data);
+    }
+}
+
 static esp_err_t _led_indicator_add_node(_led_indicator_t *p_led_indicator)
 {
     LED_INDICATOR_CHECK(p_led_indicator != NULL, "pointer can not be NULL", return ESP_ERR_INVALID_ARG);
     _led_indicator_slist_t *node = calloc(1, sizeof(_led_indicator_slist_t));
     LED_INDICATOR_CHECK(node != NULL, "calloc node failed", return ESP_ERR_NO_MEM);
     node->p_led_indicator = p_led_indicator;
+    LIST_LOCK();
     SLIST_INSERT_HEAD(&s_led_indicator_slist_head, node, next);
+    LIST_UNLOCK();
     return ESP_OK;
 }
 
@@ -122,6 +306,7 @@ static esp_err_t _led_indicator_remove_node(_led_indicator_t *p_led_indicator)
 {
     LED_INDICATOR_CHECK(p_led_indicator != NULL, "pointer can not be NULL", return ESP_ERR_INVALID_ARG);
     _led_indicator_slist_t *node;
+    LIST_LOCK();
     SLIST_FOREACH(node, &s_led_indicator_slist_head, next) {
         if (node->p_led_indicator == p_led_indicator) {
             SLIST_REMOVE(&s_led_indicator_slist_head, node, _led_indicator_slist_t, next);
@@ -129,9 +314,27 @@ static esp_err_t _led_indicator_remove_node(_led_indicator_t *p_led_indicator)
             break;
         }
     }
+    LIST_UNLOCK();
     return ESP_OK;
 }
 
+/**
+ * @brief publish current_fade_value to the lock-free getters, must be called with the mutex held
+ *
+ * current_fade_value is updated field by field, the getters only ever see the complete value published here.
+ *
+ * @param p_led_indicator pointer to LED indicator
+ */
+static inline void _led_indicator_publish(_led_indicator_t *p_led_indicator)
+{
+    atomic_store_explicit(&p_led_indicator->published_value, p_led_indicator->current_fade_value.value, memory_order_release);
+}
+
+static inline uint32_t _led_indicator_published(_led_indicator_t *p_led_indicator)
+{
+    return atomic_load_explicit(&p_led_indicator->published_value, memory_order_acquire);
+}
+
 static uint32_t _ihsv_convert_to_gamma(uint32_t ihsv_value)
 {
     led_indicator_ihsv_t ihsv = {
@@ -146,12 +349,174 @@ static uint32_t _irgb_convert_to_gamma(uint32_t irgb_value)
     led_indicator_irgb_t irgb = {
         .value = irgb_value,
     };
-    irgb.r = _ihsv_convert_to_gamma(irgb.r);
-    irgb.g = _ihsv_convert_to_gamma(irgb.g);
-    irgb.b = _ihsv_convert_to_gamma(irgb.b);
+    irgb.r = led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_R, irgb.r);
+    irgb.g = led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_G, irgb.g);
+    irgb.b = led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_B, irgb.b);
     return irgb.value;
 }
 
+/**
+ * @brief Hue and saturation of a colour temperature, interpolated between the two nearest entries of mired_table
+ *
+ * @param mireds Colour temperature in mireds
+ * @return HS_color_t Hue 0-359 and saturation 0-255
+ */
+static HS_color_t _mireds_to_hs(uint32_t mireds)
+{
+    if (mireds >= MIRED_TABLE_MAX) {
+        return mired_table[MIRED_TABLE_MAX >> MIRED_TABLE_SHIFT];
+    }
+    const HS_color_t *p_low = &mired_table[mireds >> MIRED_TABLE_SHIFT];
+    const HS_color_t *p_high = p_low + 1;
+    int32_t frac = mireds & ((1 << MIRED_TABLE_SHIFT) - 1);
+    /* Interpolate the hue the short way round, it crosses 0 near 6500 K */
+    int32_t hue_delta = (int32_t)p_high->hue - p_low->hue;
+    if (hue_delta > 180) {
+        hue_delta -= 360;
+    } else if (hue_delta < -180) {
+        hue_delta += 360;
+    }
+    int32_t hue = p_low->hue + hue_delta * frac / (1 << MIRED_TABLE_SHIFT);
+    if (hue < 0) {
+        hue += 360;
+    } else if (hue >= 360) {
+        hue -= 360;
+    }
+    HS_color_t hs = {
+        .hue = hue,
+        .saturation = p_low->saturation + ((int32_t)p_high->saturation - p_low->saturation) * frac / (1 << MIRED_TABLE_SHIFT),
+    };
+    return hs;
+}
+
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+/**
+ * @brief arm the shared timer for the given deadline, unless it already fires earlier
+ *
+ * @param deadline tick at which the shared timer should fire
+ */
+static void _shared_timer_arm(TickType_t deadline)
+{
+    bool rearm = false;
+    portENTER_CRITICAL(&s_shared_lock);
+    if (!s_shared_armed || (int32_t)(deadline - s_shared_deadline) < 0) {
+        s_shared_deadline = deadline;
+        s_shared_armed = true;
+        rearm = true;
+    }
+    portEXIT_CRITICAL(&s_shared_lock);
+    if (rearm) {
+        int32_t ticks = (int32_t)(deadline - xTaskGetTickCount());
+        xTimerChangePeriod(s_shared_timer, ticks > 0 ? ticks : 1, 0);
+        xTimerStart(s_shared_timer, 0);
+    }
+}
+#endif
+
+#ifdef CONFIG_LED_INDICATOR_STATS
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED; /*!< Protects the statistics of all the indicators */
+
+/**
+ * @brief account the start of a step against the time it was due at
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param retry the mutex was busy and the step is retried
+ */
+static void _led_indicator_stats_step(_led_indicator_t *p_led_indicator, bool retry)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_stats_lock);
+    led_indicator_stats_t *stats = &p_led_indicator->stats;
+    if (retry) {
+        stats->retries++;
+    }
+    if (p_led_indicator->due_us) {
+        int32_t late_us = (int32_t)(now - p_led_indicator->due_us);
+        if (stats->late_count == 0 || late_us < stats->late_min_us) {
+            stats->late_min_us = late_us;
+        }
+        if (stats->late_count == 0 || late_us > stats->late_max_us) {
+            stats->late_max_us = late_us;
+        }
+        stats->late_sum_us += late_us;
+        stats->late_sq_sum_us += (int64_t)late_us * late_us;
+        stats->late_count++;
+        p_led_indicator->due_us = 0;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+/**
+ * @brief account the CPU time of a step
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param cycles CPU cycles spent in the step
+ */
+static void _led_indicator_stats_cpu(_led_indicator_t *p_led_indicator, uint32_t cycles)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    led_indicator_stats_t *stats = &p_led_indicator->stats;
+    stats->steps++;
+    stats->cycles_sum += cycles;
+    if (cycles > stats->cycles_max) {
+        stats->cycles_max = cycles;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+#endif
+
+#ifdef CONFIG_LED_INDICATOR_ESP_TIMER
+/**
+ * @brief run the blink list of an indicator again after the given number of microseconds
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param period_us delay before the next step
+ */
+static void _led_indicator_schedule_us(_led_indicator_t *p_led_indicator, uint64_t period_us)
+{
+#ifdef CONFIG_LED_INDICATOR_STATS
+    int64_t due_us = esp_timer_get_time() + period_us;
+    portENTER_CRITICAL(&s_stats_lock);
+    p_led_indicator->due_us = due_us;
+    portEXIT_CRITICAL(&s_stats_lock);
+#endif
+    // restart the timer if it is already armed, esp_timer_start_once() fails on an active timer
+    esp_timer_stop(p_led_indicator->h_timer);
+    esp_timer_start_once(p_led_indicator->h_timer, period_us);
+}
+#endif
+
+/**
+ * @brief run the blink list of an indicator again after the given number of ticks
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param ticks delay before the next step
+ */
+static void _led_indicator_schedule(_led_indicator_t *p_led_indicator, TickType_t ticks)
+{
+#ifdef CONFIG_LED_INDICATOR_ESP_TIMER
+    _led_indicator_schedule_us(p_led_indicator, (uint64_t)(ticks > 0 ? ticks : 1) * portTICK_PERIOD_MS * 1000);
+    return;
+#endif
+#ifdef CONFIG_LED_INDICATOR_STATS
+    int64_t due_us = esp_timer_get_time() + (int64_t)(ticks > 0 ? ticks : 1) * portTICK_PERIOD_MS * 1000;
+    portENTER_CRITICAL(&s_stats_lock);
+    p_led_indicator->due_us = due_us;
+    portEXIT_CRITICAL(&s_stats_lock);
+#endif
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+    TickType_t deadline = xTaskGetTickCount() + (ticks > 0 ? ticks : 1);
+    portENTER_CRITICAL(&s_shared_lock);
+    p_led_indicator->deadline = deadline;
+    p_led_indicator->armed = true;
+    portEXIT_CRITICAL(&s_shared_lock);
+    _shared_timer_arm(deadline);
+#else
+    xTimerChangePeriod(p_led_indicator->h_timer, ticks, 0);
+    xTimerStart(p_led_indicator->h_timer, 0);
+#endif
+}
+
 /**
  * @brief switch to the first high priority incomplete blink steps
  *
@@ -164,38 +529,151 @@ static void _blink_list_switch(_led_indicator_t *p_led_indicator)
         return;
     }
     p_led_indicator->active_blink = NULL_ACTIVE_BLINK; //stop active blink
-    for (size_t index = 0; index < p_led_indicator->blink_list_num; index ++) { //find the first incomplete blink
-        if (p_led_indicator->p_blink_steps[index] != LED_BLINK_STOP) {
-            p_led_indicator->active_blink = index;
+    /* The first bit set in the summary gives the first non-zero word of the mask, one word covers 1024 lists */
+    uint32_t words = BLINK_MASK_WORDS(p_led_indicator->blink_list_num);
+    const uint32_t *p_summary = p_led_indicator->p_active_mask + words;
+    for (uint32_t i = 0; i < BLINK_MASK_WORDS(words); i++) {
+        if (p_summary[i]) {
+            uint32_t word = i * 32 + __builtin_clz(p_summary[i]);
+            p_led_indicator->active_blink = word * 32 + __builtin_clz(p_led_indicator->p_active_mask[word]);
             break;
         }
     }
 }
 
 /**
- * @brief timer callback to control LED and counter steps
+ * @brief set the stage of a blink list, and whether it is stopped in the mask of active blink lists
  *
- * @param xTimer handle of the timer instance
+ * @param p_led_indicator pointer to LED indicator
+ * @param blink_type blink list
+ * @param step stage of the blink list, LED_BLINK_STOP to stop it
  */
-static void _blink_list_runner(TimerHandle_t xTimer)
+static void _blink_list_set_step(_led_indicator_t *p_led_indicator, int blink_type, int step)
+{
+    uint32_t word = blink_type / 32;
+    uint32_t *p_summary = p_led_indicator->p_active_mask + BLINK_MASK_WORDS(p_led_indicator->blink_list_num);
+    p_led_indicator->p_blink_steps[blink_type] = step;
+    if (step != LED_BLINK_STOP) {
+        p_led_indicator->p_active_mask[word] |= BLINK_MASK_BIT(blink_type);
+        p_summary[word / 32] |= BLINK_MASK_BIT(word);
+    } else {
+        p_led_indicator->p_active_mask[word] &= ~BLINK_MASK_BIT(blink_type);
+        if (!p_led_indicator->p_active_mask[word]) {
+            p_summary[word / 32] &= ~BLINK_MASK_BIT(word);
+        }
+    }
+}
+
+/**
+ * @brief compile a linear fade of three channels into the fade plan
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param p_blink_step the ring step being compiled
+ * @param from start value of each channel
+ * @param to target value of each channel
+ */
+static void _fade_plan_compile(_led_indicator_t *p_led_indicator, const blink_step_t *p_blink_step, const int32_t from[3], const int32_t to[3])
+{
+    _led_fade_plan_t *plan = &p_led_indicator->fade_plan;
+    uint16_t ticks = BRIGHTNESS_TICKS;
+    int32_t diff[3] = {to[0] - from[0], to[1] - from[1], to[2] - from[2]};
+    int32_t max_diff = MAX3(abs(diff[0]), abs(diff[1]), abs(diff[2]));
+
+    /*!< Calculate total steps and timer ticks. */
+    if (max_diff == 0) {
+        ticks = p_blink_step->hold_time_ms;
+        p_led_indicator->fade_total_step = 1;
+    } else if (p_blink_step->hold_time_ms > ticks * max_diff) {
+        ticks = p_blink_step->hold_time_ms / max_diff;
+        p_led_indicator->fade_total_step = max_diff;
+    } else {
+        p_led_indicator->fade_total_step = p_blink_step->hold_time_ms / ticks;
+    }
+    if (p_led_indicator->fade_total_step == 0) {
+        p_led_indicator->fade_total_step = 1;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        plan->start[i] = from[i] * 65536;
+        plan->delta[i] = diff[i] * 65536 / p_led_indicator->fade_total_step;
+    }
+    plan->ticks = ticks;
+    plan->step = p_blink_step;
+    plan->from = p_led_indicator->last_fade_value.value;
+    ESP_LOGD(TAG, "fade compiled, ticks: %d, total fade step: %d", ticks, p_led_indicator->fade_total_step);
+}
+
+/**
+ * @brief whether the fade plan was compiled for this step and the current start value
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param p_blink_step the running breathe/ring step
+ * @return true if the plan can be used as is
+ */
+static inline bool _fade_plan_valid(const _led_indicator_t *p_led_indicator, const blink_step_t *p_blink_step)
+{
+    return p_led_indicator->fade_plan.step == p_blink_step && p_led_indicator->fade_plan.from == p_led_indicator->last_fade_value.value;
+}
+
+/**
+ * @brief value of a channel at the current fade step, the last step lands exactly on the target
+ *
+ * @param p_led_indicator pointer to LED indicator
+ * @param channel channel index in the fade plan
+ * @param to target value of the channel
+ * @return value of the channel
+ */
+static inline uint32_t _fade_plan_value(const _led_indicator_t *p_led_indicator, int channel, uint32_t to)
+{
+    if (p_led_indicator->fade_step >= p_led_indicator->fade_total_step) {
+        return to;
+    }
+    const _led_fade_plan_t *plan = &p_led_indicator->fade_plan;
+    return (uint32_t)((plan->start[channel] + plan->delta[channel] * p_led_indicator->fade_step) >> 16);
+}
+
+/**
+ * @brief control LED and counter steps, then schedule the next step
+ *
+ * @param p_led_indicator pointer to LED indicator
+ */
+static void _blink_list_run(_led_indicator_t *p_led_indicator)
 {
     bool leave = false;
     uint32_t hardware_level;
     bool timer_restart = false;
     TickType_t timer_period_ms = 0;
-    _led_indicator_t *p_led_indicator = (_led_indicator_t *)pvTimerGetTimerID(xTimer);
-    if (p_led_indicator == NULL) {
-        return;
-    }
 
     if (pdTRUE != xSemaphoreTake(p_led_indicator->mutex, 0)) {
         // In most cases, the semaphore should be taken successfully.
         // If not, it means that the blinks is changing, or user prepares to delete the indicator.
-        xTimerChangePeriod(p_led_indicator->h_timer, pdMS_TO_TICKS(50), 0);
-        xTimerStart(p_led_indicator->h_timer, 0);
-        ESP_LOGV(TAG, "timeout restart, period: %d ms", 50);
+        // Getters do not take the mutex, so it is only held briefly and retrying on the next tick is enough.
+#ifdef CONFIG_LED_INDICATOR_STATS
+        _led_indicator_stats_step(p_led_indicator, true);
+#endif
+#ifdef CONFIG_LED_INDICATOR_ESP_TIMER
+        if (p_led_indicator->deleted) {
+            return;
+        }
+#endif
+        _led_indicator_schedule(p_led_indicator, RETRY_TICKS);
+        ESP_LOGV(TAG, "timeout restart, period: %d ticks", RETRY_TICKS);
         return;
     }
+#ifdef CONFIG_LED_INDICATOR_STATS
+    _led_indicator_stats_step(p_led_indicator, false);
+    uint32_t start_cycles = STATS_CYCLE_COUNT();
+#endif
+    bool staged = _led_indicator_update_begin(p_led_indicator);
+
+    if (p_led_indicator->frame_render_cb) {
+        // The frame animation owns the output, the blink lists wait for it to stop
+        p_led_indicator->frame_render_cb(p_led_indicator->frame, p_led_indicator->frame_pixel_num, p_led_indicator->frame_index++, p_led_indicator->frame_user_data);
+        p_led_indicator->hal_indicator_set_frame(p_led_indicator->hardware_data, p_led_indicator->frame, p_led_indicator->frame_pixel_num);
+        leave = true;
+        timer_restart = true;
+        timer_period_ms = p_led_indicator->frame_period_ms;
+    }
 
     while (!leave) {
         if (p_led_indicator->active_blink == NULL_ACTIVE_BLINK) {
@@ -220,7 +698,7 @@ static void _blink_list_runner(TimerHandle_t xTimer)
             break;
 
         case LED_BLINK_STOP:
-            p_led_indicator->p_blink_steps[active_blink] = LED_BLINK_STOP;
+            _blink_list_set_step(p_led_indicator, active_blink, LED_BLINK_STOP);
             if (p_led_indicator->preempt_blink != NULL_PREEMPT_BLINK) {
                 p_led_indicator->preempt_blink = NULL_PREEMPT_BLINK;
             }
@@ -273,62 +751,47 @@ static void _blink_list_runner(TimerHandle_t xTimer)
                 break;
             }
 
-            led_indicator_irgb_t currect_rgb_value, last_rgb_value = {0};
-            uint16_t ticks = BRIGHTNESS_TICKS;
-            int16_t diff[3] = {0};
-
-            led_indicator_ihsv_t hsv_value = {
-                .value = led_indicator_rgb2hsv(p_blink_step_value.value),
+            led_indicator_irgb_t currect_rgb_value = {
+                .value = p_blink_step_value.value,
             };
 
             if (p_blink_step->hold_time_ms == 0) {
                 p_led_indicator->hal_indicator_set_rgb(p_led_indicator->hardware_data, _irgb_convert_to_gamma(p_blink_step_value.value));
-                p_led_indicator->current_fade_value.value = hsv_value.value;
+                p_led_indicator->current_fade_value.value = led_indicator_rgb2hsv(p_blink_step_value.value);
                 p_led_indicator->current_fade_value.i = p_blink_step_value.i;
                 p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
                 p_led_indicator->p_blink_steps[active_blink] += 1;
                 break;
             }
 
-            uint32_t r, g, b = 0;
-            /*!< Get the last fade value's RGB */
-            led_indicator_hsv2rgb(p_led_indicator->last_fade_value.value, &r, &g, &b);
-            last_rgb_value.value = SET_IRGB(p_blink_step_value.i, r, g, b),
-            currect_rgb_value.value = p_blink_step_value.value;
-            diff[0] = currect_rgb_value.r - last_rgb_value.r;
-            diff[1] = currect_rgb_value.g - last_rgb_value.g;
-            diff[2] = currect_rgb_value.b - last_rgb_value.b;
-            int16_t max_diff = MAX3(abs(diff[0]), abs(diff[1]), abs(diff[2]));
-
-            /*!< Calculate total steps and timer ticks. */
-            if (max_diff == 0) {
-                ticks = p_blink_step->hold_time_ms;
-                p_led_indicator->fade_total_step = 1;
-            } else if (p_blink_step->hold_time_ms > ticks * abs(max_diff)) {
-                ticks = p_blink_step->hold_time_ms / abs(max_diff) ;
-                p_led_indicator->fade_total_step = max_diff;
-            } else {
-                p_led_indicator->fade_total_step = p_blink_step->hold_time_ms / ticks;
+            const int32_t to[3] = {currect_rgb_value.r, currect_rgb_value.g, currect_rgb_value.b};
+            if (!_fade_plan_valid(p_led_indicator, p_blink_step)) {
+                uint32_t r, g, b = 0;
+                /*!< Get the last fade value's RGB */
+                led_indicator_hsv2rgb(p_led_indicator->last_fade_value.value, &r, &g, &b);
+                const int32_t from[3] = {r, g, b};
+                _fade_plan_compile(p_led_indicator, p_blink_step, from, to);
             }
 
             p_led_indicator->fade_step += 1;
-            ESP_LOGD(TAG, "ticks value: %d, total fade step: %d, fade step: %d", ticks, p_led_indicator->fade_total_step, p_led_indicator->fade_step);
+            ESP_LOGD(TAG, "ticks value: %d, total fade step: %d, fade step: %d", p_led_indicator->fade_plan.ticks, p_led_indicator->fade_total_step, p_led_indicator->fade_step);
 
-            currect_rgb_value.r = (uint8_t)(last_rgb_value.r + diff[0] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
-            currect_rgb_value.g = (uint8_t)(last_rgb_value.g + diff[1] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
-            currect_rgb_value.b = (uint8_t)(last_rgb_value.b + diff[2] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
+            currect_rgb_value.r = _fade_plan_value(p_led_indicator, 0, to[0]);
+            currect_rgb_value.g = _fade_plan_value(p_led_indicator, 1, to[1]);
+            currect_rgb_value.b = _fade_plan_value(p_led_indicator, 2, to[2]);
             ESP_LOGD(TAG, "currect_rgb_value: [%d, %d, %d]\n", currect_rgb_value.r, currect_rgb_value.g, currect_rgb_value.b);
 
             p_led_indicator->hal_indicator_set_rgb(p_led_indicator->hardware_data, _irgb_convert_to_gamma(currect_rgb_value.value));
 
             leave = true;
             timer_restart = true;
-            timer_period_ms = ticks;
+            timer_period_ms = p_led_indicator->fade_plan.ticks;
 
             if (p_led_indicator->fade_step >= p_led_indicator->fade_total_step) {
                 p_led_indicator->fade_step = 0;
                 p_led_indicator->fade_total_step = 0;
-                p_led_indicator->current_fade_value.value = hsv_value.value;
+                p_led_indicator->fade_plan.step = NULL;
+                p_led_indicator->current_fade_value.value = led_indicator_rgb2hsv(p_blink_step_value.value);
                 p_led_indicator->current_fade_value.i = p_blink_step_value.i;
                 p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
                 p_led_indicator->p_blink_steps[active_blink] += 1;
@@ -361,9 +824,6 @@ static void _blink_list_runner(TimerHandle_t xTimer)
                 break;
             }
 
-            uint16_t ticks = BRIGHTNESS_TICKS;
-            int16_t diff[3] = {0};
-
             if (p_blink_step->hold_time_ms == 0) {
                 p_led_indicator->hal_indicator_set_hsv(p_led_indicator->hardware_data, _ihsv_convert_to_gamma(p_blink_step_value.value));
                 p_led_indicator->current_fade_value = p_blink_step_value;
@@ -372,27 +832,18 @@ static void _blink_list_runner(TimerHandle_t xTimer)
                 break;
             }
 
-            diff[0] = p_blink_step_value.h - p_led_indicator->last_fade_value.h;
-            diff[1] = p_blink_step_value.s - p_led_indicator->last_fade_value.s;
-            diff[2] = p_blink_step_value.v - p_led_indicator->last_fade_value.v;
-            int16_t max_diff = MAX3(abs(diff[0]), abs(diff[1]), abs(diff[2]));
-
-            if (max_diff == 0) {
-                ticks = p_blink_step->hold_time_ms;
-                p_led_indicator->fade_total_step = 1;
-            } else if (p_blink_step->hold_time_ms > ticks * abs(max_diff)) {
-                ticks = p_blink_step->hold_time_ms / abs(max_diff) ;
-                p_led_indicator->fade_total_step = max_diff;
-            } else {
-                p_led_indicator->fade_total_step = p_blink_step->hold_time_ms / ticks;
+            const int32_t to[3] = {p_blink_step_value.h, p_blink_step_value.s, p_blink_step_value.v};
+            if (!_fade_plan_valid(p_led_indicator, p_blink_step)) {
+                const int32_t from[3] = {p_led_indicator->last_fade_value.h, p_led_indicator->last_fade_value.s, p_led_indicator->last_fade_value.v};
+                _fade_plan_compile(p_led_indicator, p_blink_step, from, to);
             }
 
             p_led_indicator->fade_step += 1;
-            ESP_LOGD(TAG, "hsv ring ticks value: %d, total fade step: %d, fade step: %d", ticks, p_led_indicator->fade_total_step, p_led_indicator->fade_step);
+            ESP_LOGD(TAG, "hsv ring ticks value: %d, total fade step: %d, fade step: %d", p_led_indicator->fade_plan.ticks, p_led_indicator->fade_total_step, p_led_indicator->fade_step);
 
-            p_led_indicator->current_fade_value.h = (uint32_t)(p_led_indicator->last_fade_value.h + diff[0] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
-            p_led_indicator->current_fade_value.s = (uint8_t)(p_led_indicator->last_fade_value.s + diff[1] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
-            p_led_indicator->current_fade_value.v = (uint8_t)(p_led_indicator->last_fade_value.v + diff[2] * p_led_indicator->fade_step * 1.0 / p_led_indicator->fade_total_step);
+            p_led_indicator->current_fade_value.h = _fade_plan_value(p_led_indicator, 0, to[0]);
+            p_led_indicator->current_fade_value.s = _fade_plan_value(p_led_indicator, 1, to[1]);
+            p_led_indicator->current_fade_value.v = _fade_plan_value(p_led_indicator, 2, to[2]);
             ESP_LOGD(TAG, "current_fade_value: [%d, %d, %d]\n", p_led_indicator->current_fade_value.h, p_led_indicator->current_fade_value.s, p_led_indicator->current_fade_value.v);
 
             p_led_indicator->current_fade_value.i = p_blink_step_value.i;
@@ -400,11 +851,12 @@ static void _blink_list_runner(TimerHandle_t xTimer)
 
             leave = true;
             timer_restart = true;
-            timer_period_ms = ticks;
+            timer_period_ms = p_led_indicator->fade_plan.ticks;
 
             if (p_led_indicator->fade_step >= p_led_indicator->fade_total_step) {
                 p_led_indicator->fade_step = 0;
                 p_led_indicator->fade_total_step = 0;
+                p_led_indicator->fade_plan.step = NULL;
                 p_led_indicator->current_fade_value = p_blink_step_value;
                 p_led_indicator->last_fade_value = p_blink_step_value;
                 p_led_indicator->p_blink_steps[active_blink] += 1;
@@ -440,7 +892,6 @@ static void _blink_list_runner(TimerHandle_t xTimer)
             }
 
             uint32_t brightness_value = p_blink_step_value.v;
-            uint16_t ticks = BRIGHTNESS_TICKS;
             int16_t diff_value = brightness_value - p_led_indicator->last_fade_value.v;
             p_led_indicator->current_fade_value.i = p_blink_step_value.i;
 
@@ -462,23 +913,30 @@ static void _blink_list_runner(TimerHandle_t xTimer)
             p_led_indicator->current_fade_value.v = brightness_value;
             p_led_indicator->hal_indicator_set_brightness(p_led_indicator->hardware_data, led_indicator_get_gamma_value(brightness_value));
 
-            if (diff_value == 0) {
-                ticks = p_blink_step->hold_time_ms;
-                p_led_indicator->fade_value_count += 1;
-            } else if (p_blink_step->hold_time_ms > BRIGHTNESS_TICKS * abs(diff_value)) {
-                ticks = p_blink_step->hold_time_ms /  abs(diff_value) ;
-                p_led_indicator->fade_value_count += 1;
-            } else {
-                p_led_indicator->fade_value_count += abs(diff_value) * ticks / p_blink_step->hold_time_ms;
+            _led_fade_plan_t *plan = &p_led_indicator->fade_plan;
+            if (!_fade_plan_valid(p_led_indicator, p_blink_step)) {
+                plan->ticks = BRIGHTNESS_TICKS;
+                plan->count_step = 1;
+                if (diff_value == 0) {
+                    plan->ticks = p_blink_step->hold_time_ms;
+                } else if (p_blink_step->hold_time_ms > BRIGHTNESS_TICKS * abs(diff_value)) {
+                    plan->ticks = p_blink_step->hold_time_ms / abs(diff_value);
+                } else {
+                    plan->count_step = abs(diff_value) * BRIGHTNESS_TICKS / p_blink_step->hold_time_ms;
+                }
+                plan->step = p_blink_step;
+                plan->from = p_led_indicator->last_fade_value.value;
+                ESP_LOGD(TAG, "breathe ticks value: %d", plan->ticks);
             }
+            p_led_indicator->fade_value_count += plan->count_step;
 
-            ESP_LOGD(TAG, "breathe ticks value: %d", ticks);
             leave = true;
             timer_restart = true;
-            timer_period_ms = ticks;
+            timer_period_ms = plan->ticks;
 
             if (p_led_indicator->fade_value_count > abs(diff_value)) {
                 p_led_indicator->fade_value_count = BRIGHTNESS_MIN;
+                plan->step = NULL;
                 p_led_indicator->current_fade_value.v = p_blink_step_value.v;
                 p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
                 p_led_indicator->p_blink_steps[active_blink] += 1;
@@ -493,21 +951,142 @@ static void _blink_list_runner(TimerHandle_t xTimer)
         }
     }
     // check if the indicator is deleted
-    p_led_indicator = (_led_indicator_t *)pvTimerGetTimerID(xTimer);
-    if (p_led_indicator && timer_restart && timer_period_ms) {
-        xTimerChangePeriod(p_led_indicator->h_timer, pdMS_TO_TICKS(timer_period_ms), 0);
-        xTimerStart(p_led_indicator->h_timer, 0);
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+    bool deleted = false;
+#elif defined(CONFIG_LED_INDICATOR_ESP_TIMER)
+    bool deleted = p_led_indicator->deleted;
+#else
+    bool deleted = pvTimerGetTimerID(p_led_indicator->h_timer) == NULL;
+#endif
+    if (!deleted && timer_restart && timer_period_ms) {
+#ifdef CONFIG_LED_INDICATOR_ESP_TIMER
+        // no rounding to the tick, a step of 15 ms lasts 15 ms
+        _led_indicator_schedule_us(p_led_indicator, (uint64_t)timer_period_ms * 1000);
+#else
+        _led_indicator_schedule(p_led_indicator, pdMS_TO_TICKS(timer_period_ms));
+#endif
         ESP_LOGV(TAG, "timer restart, period: %" PRIu32 " ms", timer_period_ms);
     }
+    _led_indicator_update_end(p_led_indicator, staged);
+    _led_indicator_publish(p_led_indicator);
+#ifdef CONFIG_LED_INDICATOR_STATS
+    _led_indicator_stats_cpu(p_led_indicator, STATS_CYCLE_COUNT() - start_cycles);
+#endif
     xSemaphoreGive(p_led_indicator->mutex);
 }
 
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+/**
+ * @brief shared timer callback, advances every indicator whose deadline has passed
+ *
+ * @param xTimer handle of the shared timer
+ */
+static void _shared_timer_runner(TimerHandle_t xTimer)
+{
+    if (pdTRUE != xSemaphoreTake(s_list_mutex, 0)) {
+        // An indicator is being created or deleted, come back on the next tick
+        portENTER_CRITICAL(&s_shared_lock);
+        s_shared_armed = false;
+        portEXIT_CRITICAL(&s_shared_lock);
+        _shared_timer_arm(xTaskGetTickCount() + 1);
+        return;
+    }
+
+    portENTER_CRITICAL(&s_shared_lock);
+    s_shared_armed = false;
+    portEXIT_CRITICAL(&s_shared_lock);
+
+    // The steps due at this tick are one batch, each custom backend is committed once
+    bool batch = led_indicator_batch_begin() == ESP_OK;
+    _led_indicator_slist_t *node;
+    TickType_t now = xTaskGetTickCount();
+    SLIST_FOREACH(node, &s_led_indicator_slist_head, next) {
+        _led_indicator_t *p_led_indicator = node->p_led_indicator;
+        portENTER_CRITICAL(&s_shared_lock);
+        bool due = p_led_indicator->armed && (int32_t)(now - p_led_indicator->deadline) >= 0;
+        if (due) {
+            p_led_indicator->armed = false;
+        }
+        portEXIT_CRITICAL(&s_shared_lock);
+        if (due) {
+            LED_INDICATOR_TRACE('B', p_led_indicator->active_blink);
+            _blink_list_run(p_led_indicator);
+            LED_INDICATOR_TRACE('E', p_led_indicator->active_blink);
+        }
+    }
+    if (batch) {
+        led_indicator_batch_commit();
+    }
+
+    // Sleep until the nearest deadline, the steps above may have armed some of them already
+    bool armed = false;
+    TickType_t deadline = 0;
+    portENTER_CRITICAL(&s_shared_lock);
+    SLIST_FOREACH(node, &s_led_indicator_slist_head, next) {
+        _led_indicator_t *p_led_indicator = node->p_led_indicator;
+        if (p_led_indicator->armed && (!armed || (int32_t)(p_led_indicator->deadline - deadline) < 0)) {
+            deadline = p_led_indicator->deadline;
+            armed = true;
+        }
+    }
+    portEXIT_CRITICAL(&s_shared_lock);
+    xSemaphoreGive(s_list_mutex);
+
+    if (armed) {
+        _shared_timer_arm(deadline);
+    }
+}
+#elif defined(CONFIG_LED_INDICATOR_ESP_TIMER)
+/**
+ * @brief esp_timer callback to control LED and counter steps
+ *
+ * @param arg pointer to LED indicator
+ */
+static void _blink_list_runner(void *arg)
+{
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)arg;
+    if (p_led_indicator->deleted) {
+        return;
+    }
+    LED_INDICATOR_TRACE('B', p_led_indicator->active_blink);
+    _blink_list_run(p_led_indicator);
+    LED_INDICATOR_TRACE('E', p_led_indicator->active_blink);
+}
+#else
+/**
+ * @brief timer callback to control LED and counter steps
+ *
+ * @param xTimer handle of the timer instance
+ */
+static void _blink_list_runner(TimerHandle_t xTimer)
+{
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)pvTimerGetTimerID(xTimer);
+    if (p_led_indicator == NULL) {
+        return;
+    }
+    LED_INDICATOR_TRACE('B', p_led_indicator->active_blink);
+    _blink_list_run(p_led_indicator);
+    LED_INDICATOR_TRACE('E', p_led_indicator->active_blink);
+}
+#endif
+
 static _led_indicator_t *_led_indicator_create_com(_led_indicator_com_config_t *cfg)
 {
     LED_INDICATOR_CHECK(NULL != cfg, "com config can't be NULL", return  NULL);
 
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+    if (s_list_mutex == NULL) {
+        s_list_mutex = xSemaphoreCreateMutex();
+        LED_INDICATOR_CHECK(s_list_mutex != NULL, "create list mutex failed", return NULL);
+    }
+    if (s_shared_timer == NULL) {
+        s_shared_timer = xTimerCreate("led_tmr_shared", 1, pdFALSE, NULL, _shared_timer_runner);
+        LED_INDICATOR_CHECK(s_shared_timer != NULL, "LED shared timer create failed", return NULL);
+    }
+#elif !defined(CONFIG_LED_INDICATOR_ESP_TIMER)
     char timer_name[16] = {'\0'};
     snprintf(timer_name, sizeof(timer_name) - 1, "%s%"PRIu32"", "led_tmr_", (uint32_t)cfg->hardware_data);
+#endif
     _led_indicator_t *p_led_indicator = (_led_indicator_t *)calloc(1, sizeof(_led_indicator_t));
     LED_INDICATOR_CHECK(p_led_indicator != NULL, "calloc indicator memory failed", return NULL);
     p_led_indicator->hardware_data = cfg->hardware_data;
@@ -516,6 +1095,10 @@ static _led_indicator_t *_led_indicator_create_com(_led_indicator_com_config_t *
     p_led_indicator->hal_indicator_set_brightness = cfg->hal_indicator_set_brightness;
     p_led_indicator->hal_indicator_set_rgb = cfg->hal_indicator_set_rgb;
     p_led_indicator->hal_indicator_set_hsv = cfg->hal_indicator_set_hsv;
+    p_led_indicator->hal_indicator_set_frame = cfg->hal_indicator_set_frame;
+    p_led_indicator->hal_indicator_begin = cfg->hal_indicator_begin;
+    p_led_indicator->hal_indicator_commit = cfg->hal_indicator_commit;
+    p_led_indicator->batch_data = cfg->batch_data;
     p_led_indicator->active_blink = NULL_ACTIVE_BLINK;
     p_led_indicator->max_duty = pow(2, cfg->duty_resolution) - 1;
     p_led_indicator->preempt_blink = NULL_PREEMPT_BLINK;
@@ -527,12 +1110,27 @@ static _led_indicator_t *_led_indicator_create_com(_led_indicator_com_config_t *
     for (size_t j = 0; j < cfg->blink_list_num; j++) {
         *(p_led_indicator->p_blink_steps + j) = LED_BLINK_STOP;
     }
+    uint32_t mask_words = BLINK_MASK_WORDS(cfg->blink_list_num);
+    p_led_indicator->p_active_mask = (uint32_t *)calloc(mask_words + BLINK_MASK_WORDS(mask_words), sizeof(uint32_t));
+    LED_INDICATOR_CHECK(p_led_indicator->p_active_mask != NULL, "calloc active mask memory failed", goto cleanup_indicator_blinkstep);
 
     p_led_indicator->blink_list_num = cfg->blink_list_num;
     p_led_indicator->mutex = xSemaphoreCreateMutex();
     LED_INDICATOR_CHECK(p_led_indicator->mutex != NULL, "create mutex failed", goto cleanup_indicator_blinkstep);
+#ifdef CONFIG_LED_INDICATOR_ESP_TIMER
+    const esp_timer_create_args_t timer_args = {
+        .callback = _blink_list_runner,
+        .arg = p_led_indicator,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "led_tmr",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &p_led_indicator->h_timer);
+    LED_INDICATOR_CHECK(ret == ESP_OK, "LED timer create failed", goto cleanup_all);
+#elif !defined(CONFIG_LED_INDICATOR_SHARED_TIMER)
     p_led_indicator->h_timer = xTimerCreate(timer_name, (pdMS_TO_TICKS(100)), pdFALSE, (void *)p_led_indicator, _blink_list_runner);
     LED_INDICATOR_CHECK(p_led_indicator->h_timer != NULL, "LED timer create failed", goto cleanup_all);
+#endif
 
     return p_led_indicator;
 
@@ -540,14 +1138,18 @@ cleanup_indicator:
     free(p_led_indicator);
     return NULL;
 cleanup_indicator_blinkstep:
+    free(p_led_indicator->p_active_mask);
     free(p_led_indicator->p_blink_steps);
     free(p_led_indicator);
     return NULL;
+#ifndef CONFIG_LED_INDICATOR_SHARED_TIMER
 cleanup_all:
     vSemaphoreDelete(p_led_indicator->mutex);
+    free(p_led_indicator->p_active_mask);
     free(p_led_indicator->p_blink_steps);
     free(p_led_indicator);
     return NULL;
+#endif
 }
 
 led_indicator_handle_t led_indicator_create(const led_indicator_config_t *config)
@@ -608,6 +1210,7 @@ led_indicator_handle_t led_indicator_create(const led_indicator_config_t *config
         com_cfg.hal_indicator_set_brightness = led_indicator_strips_set_brightness;
         com_cfg.hal_indicator_set_rgb = led_indicator_strips_set_rgb;
         com_cfg.hal_indicator_set_hsv = led_indicator_strips_set_hsv;
+        com_cfg.hal_indicator_set_frame = led_indicator_strips_set_frame;
         com_cfg.duty_resolution = LED_DUTY_8_BIT;
         break;
     }
@@ -623,6 +1226,10 @@ without_init:
         com_cfg.hal_indicator_set_brightness = cfg->hal_indicator_set_brightness;
         com_cfg.hal_indicator_set_rgb = cfg->hal_indicator_set_rgb;
         com_cfg.hal_indicator_set_hsv = cfg->hal_indicator_set_hsv;
+        com_cfg.hal_indicator_set_frame = cfg->hal_indicator_set_frame;
+        com_cfg.hal_indicator_begin = cfg->hal_indicator_begin;
+        com_cfg.hal_indicator_commit = cfg->hal_indicator_commit;
+        com_cfg.batch_data = cfg->batch_data;
         com_cfg.duty_resolution = cfg->duty_resolution;
         break;
     }
@@ -655,6 +1262,24 @@ unsupported_mode:
 static esp_err_t _led_indicator_delete_com(_led_indicator_t *p_led_indicator)
 {
     esp_err_t err;
+#ifdef CONFIG_LED_INDICATOR_SHARED_TIMER
+    // once off the list the shared timer cannot reach the indicator any more
+    _led_indicator_remove_node(p_led_indicator);
+    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+#elif defined(CONFIG_LED_INDICATOR_ESP_TIMER)
+    p_led_indicator->deleted = true;
+    // a step already running may still restart the timer before it sees the flag, wait for it
+    int timeout_ms = 200;
+    do {
+        esp_timer_stop(p_led_indicator->h_timer);
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+        timeout_ms -= 10;
+    } while (esp_timer_is_active(p_led_indicator->h_timer) && timeout_ms > 0);
+
+    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    esp_timer_delete(p_led_indicator->h_timer);
+    p_led_indicator->h_timer = NULL;
+#else
     vTimerSetTimerID(p_led_indicator->h_timer, NULL);
     // wait until the timmer is stopped before release resources
     int timeout_ms = 200;
@@ -667,9 +1292,10 @@ static esp_err_t _led_indicator_delete_com(_led_indicator_t *p_led_indicator)
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
     xTimerDelete(p_led_indicator->h_timer, portMAX_DELAY);
     p_led_indicator->h_timer = NULL;
+#endif
 
     for (int i = 0; i < p_led_indicator->blink_list_num; i++) {
-        p_led_indicator->p_blink_steps[i] = LED_BLINK_STOP;
+        _blink_list_set_step(p_led_indicator, i, LED_BLINK_STOP);
     }
 
     LED_INDICATOR_CHECK_WARNING(NULL != p_led_indicator->hal_indicator_deinit, "LED indicator not set deinit", goto not_deinit);
@@ -680,6 +1306,8 @@ not_deinit:
     xSemaphoreGive(p_led_indicator->mutex);
     vSemaphoreDelete(p_led_indicator->mutex);
     p_led_indicator->mutex = NULL;
+    free(p_led_indicator->frame);
+    free(p_led_indicator->p_active_mask);
     free(p_led_indicator->p_blink_steps);
     free(p_led_indicator);
     p_led_indicator = NULL;
@@ -702,12 +1330,11 @@ esp_err_t led_indicator_start(led_indicator_handle_t handle, int blink_type)
     LED_INDICATOR_CHECK(blink_type >= 0 && blink_type < p_led_indicator->blink_list_num, "blink_type out of range", return ESP_FAIL);
     LED_INDICATOR_CHECK(p_led_indicator->blink_lists[blink_type] != NULL, "undefined blink_type", return ESP_ERR_INVALID_ARG);
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    p_led_indicator->p_blink_steps[blink_type] = 0;
+    _blink_list_set_step(p_led_indicator, blink_type, 0);
     _blink_list_switch(p_led_indicator);
     xSemaphoreGive(p_led_indicator->mutex);
     if (p_led_indicator->active_blink == blink_type) { //re-run from first step
-        xTimerChangePeriod(p_led_indicator->h_timer, 1, 0);
-        xTimerStart(p_led_indicator->h_timer, 0);
+        _led_indicator_schedule(p_led_indicator, 1);
     }
 
     return ESP_OK;
@@ -720,7 +1347,7 @@ esp_err_t led_indicator_stop(led_indicator_handle_t handle, int blink_type)
     LED_INDICATOR_CHECK(blink_type >= 0 && blink_type < p_led_indicator->blink_list_num, "blink_type out of range", return ESP_FAIL);
     LED_INDICATOR_CHECK(p_led_indicator->blink_lists[blink_type] != NULL, "undefined blink_type", return ESP_ERR_INVALID_ARG);
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    p_led_indicator->p_blink_steps[blink_type] = LED_BLINK_STOP;
+    _blink_list_set_step(p_led_indicator, blink_type, LED_BLINK_STOP);
     _blink_list_switch(p_led_indicator); //stop and switch to next blink steps
     xSemaphoreGive(p_led_indicator->mutex);
 
@@ -736,16 +1363,15 @@ esp_err_t led_indicator_preempt_start(led_indicator_handle_t handle, int blink_t
 
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
     if (p_led_indicator->preempt_blink != NULL_PREEMPT_BLINK) {
-        p_led_indicator->p_blink_steps[p_led_indicator->preempt_blink] = LED_BLINK_STOP; // Maker sure the last preempt blink is stopped
+        _blink_list_set_step(p_led_indicator, p_led_indicator->preempt_blink, LED_BLINK_STOP); // Maker sure the last preempt blink is stopped
     }
-    p_led_indicator->p_blink_steps[blink_type] = 0;
+    _blink_list_set_step(p_led_indicator, blink_type, 0);
     p_led_indicator->preempt_blink = blink_type;
     _blink_list_switch(p_led_indicator); //stop and switch to next blink steps
     xSemaphoreGive(p_led_indicator->mutex);
 
     if (p_led_indicator->active_blink == blink_type) { //re-run from first step
-        xTimerChangePeriod(p_led_indicator->h_timer, 1, 0);
-        xTimerStart(p_led_indicator->h_timer, 0);
+        _led_indicator_schedule(p_led_indicator, 1);
     }
     return ESP_OK;
 }
@@ -758,7 +1384,7 @@ esp_err_t led_indicator_preempt_stop(led_indicator_handle_t handle, int blink_ty
     LED_INDICATOR_CHECK(p_led_indicator->blink_lists[blink_type] != NULL, "undefined blink_type", return ESP_ERR_INVALID_ARG);
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
     if (p_led_indicator->preempt_blink == blink_type) {
-        p_led_indicator->p_blink_steps[blink_type] = LED_BLINK_STOP;
+        _blink_list_set_step(p_led_indicator, blink_type, LED_BLINK_STOP);
         p_led_indicator->preempt_blink = NULL_PREEMPT_BLINK;
     }
     _blink_list_switch(p_led_indicator); //stop and switch to next blink steps
@@ -771,9 +1397,7 @@ uint8_t led_indicator_get_brightness(led_indicator_handle_t handle)
 {
     LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return 0);
     _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
-    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    uint8_t fade_value = p_led_indicator->current_fade_value.v;
-    xSemaphoreGive(p_led_indicator->mutex);
+    uint8_t fade_value = GET_BRIGHTNESS(_led_indicator_published(p_led_indicator));
     return fade_value;
 }
 
@@ -786,9 +1410,12 @@ esp_err_t led_indicator_set_on_off(led_indicator_handle_t handle, bool on_off)
         return ESP_FAIL;
     }
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool staged = _led_indicator_update_begin(p_led_indicator);
     p_led_indicator->hal_indicator_set_on_off(p_led_indicator->hardware_data, on_off);
+    _led_indicator_update_end(p_led_indicator, staged);
     p_led_indicator->current_fade_value.v = on_off ? BRIGHTNESS_MAX : BRIGHTNESS_MIN;
     p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
+    _led_indicator_publish(p_led_indicator);
     xSemaphoreGive(p_led_indicator->mutex);
     return ESP_OK;
 }
@@ -802,7 +1429,9 @@ esp_err_t led_indicator_set_brightness(led_indicator_handle_t handle, uint32_t b
         return ESP_FAIL;
     }
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool staged = _led_indicator_update_begin(p_led_indicator);
     p_led_indicator->hal_indicator_set_brightness(p_led_indicator->hardware_data, led_indicator_get_gamma_value(brightness));
+    _led_indicator_update_end(p_led_indicator, staged);
     led_indicator_ihsv_t ihsv = {
         .value = brightness,
     };
@@ -810,6 +1439,7 @@ esp_err_t led_indicator_set_brightness(led_indicator_handle_t handle, uint32_t b
     p_led_indicator->current_fade_value.i = ihsv.i;
     p_led_indicator->current_fade_value.v = ihsv.v;
     p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
+    _led_indicator_publish(p_led_indicator);
     xSemaphoreGive(p_led_indicator->mutex);
     return ESP_OK;
 }
@@ -818,9 +1448,7 @@ uint32_t led_indicator_get_hsv(led_indicator_handle_t handle)
 {
     LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return 0);
     _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
-    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    uint32_t hsv_value = p_led_indicator->current_fade_value.value & 0x1FFFFFFF;
-    xSemaphoreGive(p_led_indicator->mutex);
+    uint32_t hsv_value = _led_indicator_published(p_led_indicator) & 0x1FFFFFFF;
     return hsv_value;
 }
 
@@ -833,9 +1461,12 @@ esp_err_t led_indicator_set_hsv(led_indicator_handle_t handle, uint32_t ihsv_val
         return ESP_FAIL;
     }
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool staged = _led_indicator_update_begin(p_led_indicator);
     p_led_indicator->hal_indicator_set_hsv(p_led_indicator->hardware_data, _ihsv_convert_to_gamma(ihsv_value));
+    _led_indicator_update_end(p_led_indicator, staged);
     p_led_indicator->current_fade_value.value = ihsv_value;
     p_led_indicator->last_fade_value.value = ihsv_value;
+    _led_indicator_publish(p_led_indicator);
     xSemaphoreGive(p_led_indicator->mutex);
     return ESP_OK;
 }
@@ -844,9 +1475,7 @@ uint32_t led_indicator_get_rgb(led_indicator_handle_t handle)
 {
     LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return 0);
     _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
-    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    uint32_t ihsv_value = p_led_indicator->current_fade_value.value;
-    xSemaphoreGive(p_led_indicator->mutex);
+    uint32_t ihsv_value = _led_indicator_published(p_led_indicator);
 
     uint32_t r, g, b, rgb_value;
     led_indicator_hsv2rgb(ihsv_value, &r, &g, &b);
@@ -867,43 +1496,180 @@ esp_err_t led_indicator_set_rgb(led_indicator_handle_t handle, uint32_t irgb_val
         .value = led_indicator_rgb2hsv(irgb_value),
     };
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool staged = _led_indicator_update_begin(p_led_indicator);
     p_led_indicator->hal_indicator_set_rgb(p_led_indicator->hardware_data, _irgb_convert_to_gamma(irgb_value));
+    _led_indicator_update_end(p_led_indicator, staged);
     p_led_indicator->current_fade_value = ihsv;
     p_led_indicator->current_fade_value.i = GET_INDEX(irgb_value);
     p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
+    _led_indicator_publish(p_led_indicator);
     xSemaphoreGive(p_led_indicator->mutex);
     return ESP_OK;
 }
 
-esp_err_t led_indicator_set_color_temperature(led_indicator_handle_t handle, const uint32_t temperature)
+/**
+ * @brief Set the hue and saturation of a colour temperature, the brightness is kept
+ */
+static esp_err_t _led_indicator_set_mireds(_led_indicator_t *p_led_indicator, uint32_t mireds, uint8_t index)
 {
-    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
-    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
     if (!p_led_indicator->hal_indicator_set_hsv) {
         ESP_LOGW(TAG, "LED indicator does not have the hal_indicator_set_hsv function");
         return ESP_FAIL;
     }
-    uint16_t hue;
-    uint8_t saturation;
+    HS_color_t hs = _mireds_to_hs(mireds);
 
     xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
-    if ((temperature & 0xFFFFFF) < 600) {
-        hue = 0;
-        saturation = 100;
-    } else if ((temperature & 0xFFFFFF) > 10000) {
-        hue = 222;
-        saturation = 21 + ((temperature & 0xFFFFFF) - 10000) * 41 / 990000;
-    } else {
-        hue = temp_table[((temperature & 0xFFFFFF) - 600) / 100].hue;
-        saturation = temp_table[((temperature & 0xFFFFFF) - 600) / 100].saturation;
-    }
-    saturation = (saturation * 255) / 100;
-
-    p_led_indicator->current_fade_value.h = hue;
-    p_led_indicator->current_fade_value.s = saturation;
-    p_led_indicator->current_fade_value.i = GET_INDEX(temperature);
+    p_led_indicator->current_fade_value.h = hs.hue;
+    p_led_indicator->current_fade_value.s = hs.saturation;
+    p_led_indicator->current_fade_value.i = index;
+    bool staged = _led_indicator_update_begin(p_led_indicator);
     p_led_indicator->hal_indicator_set_hsv(p_led_indicator->hardware_data, _ihsv_convert_to_gamma(p_led_indicator->current_fade_value.value));
+    _led_indicator_update_end(p_led_indicator, staged);
     p_led_indicator->last_fade_value = p_led_indicator->current_fade_value;
+    _led_indicator_publish(p_led_indicator);
+    xSemaphoreGive(p_led_indicator->mutex);
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_set_color_temperature(led_indicator_handle_t handle, const uint32_t temperature)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    uint32_t kelvin = temperature & 0xFFFFFF;
+    uint32_t mireds = kelvin ? 1000000 / kelvin : UINT32_MAX;
+    return _led_indicator_set_mireds((_led_indicator_t *)handle, mireds, GET_INDEX(temperature));
+}
+
+esp_err_t led_indicator_set_color_temperature_mireds(led_indicator_handle_t handle, const uint32_t mireds)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    return _led_indicator_set_mireds((_led_indicator_t *)handle, mireds & 0xFFFFFF, GET_INDEX(mireds));
+}
+
+esp_err_t led_indicator_set_frame(led_indicator_handle_t handle, const uint32_t *rgb_frame, uint32_t pixel_num)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    LED_INDICATOR_CHECK(rgb_frame != NULL, "invalid rgb_frame", return ESP_ERR_INVALID_ARG);
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
+    if (!p_led_indicator->hal_indicator_set_frame) {
+        ESP_LOGW(TAG, "LED indicator does not have the hal_indicator_set_frame function");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool staged = _led_indicator_update_begin(p_led_indicator);
+    esp_err_t err = p_led_indicator->hal_indicator_set_frame(p_led_indicator->hardware_data, rgb_frame, pixel_num);
+    _led_indicator_update_end(p_led_indicator, staged);
+    xSemaphoreGive(p_led_indicator->mutex);
+    return err == ESP_OK ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t led_indicator_frame_start(led_indicator_handle_t handle, uint32_t pixel_num, uint32_t period_ms, led_indicator_frame_render_cb_t render_cb, void *user_data)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    LED_INDICATOR_CHECK(render_cb != NULL, "invalid render_cb", return ESP_ERR_INVALID_ARG);
+    LED_INDICATOR_CHECK(pixel_num > 0 && period_ms > 0, "pixel_num and period_ms can not be 0", return ESP_ERR_INVALID_ARG);
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
+    if (!p_led_indicator->hal_indicator_set_frame) {
+        ESP_LOGW(TAG, "LED indicator does not have the hal_indicator_set_frame function");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    uint32_t *frame = (uint32_t *)calloc(pixel_num, sizeof(uint32_t));
+    LED_INDICATOR_CHECK(frame != NULL, "calloc framebuffer failed", return ESP_ERR_NO_MEM);
+
+    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    free(p_led_indicator->frame);
+    p_led_indicator->frame = frame;
+    p_led_indicator->frame_pixel_num = pixel_num;
+    p_led_indicator->frame_period_ms = period_ms;
+    p_led_indicator->frame_index = 0;
+    p_led_indicator->frame_render_cb = render_cb;
+    p_led_indicator->frame_user_data = user_data;
     xSemaphoreGive(p_led_indicator->mutex);
+
+    _led_indicator_schedule(p_led_indicator, 1);
     return ESP_OK;
 }
+
+esp_err_t led_indicator_frame_stop(led_indicator_handle_t handle)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
+
+    xSemaphoreTake(p_led_indicator->mutex, portMAX_DELAY);
+    bool running = p_led_indicator->frame_render_cb != NULL;
+    free(p_led_indicator->frame);
+    p_led_indicator->frame = NULL;
+    p_led_indicator->frame_pixel_num = 0;
+    p_led_indicator->frame_render_cb = NULL;
+    p_led_indicator->frame_user_data = NULL;
+    xSemaphoreGive(p_led_indicator->mutex);
+
+    if (running && p_led_indicator->active_blink != NULL_ACTIVE_BLINK) { // hand the output back to the blink lists
+        _led_indicator_schedule(p_led_indicator, 1);
+    }
+    return ESP_OK;
+}
+
+#ifdef CONFIG_LED_INDICATOR_STATS
+esp_err_t led_indicator_get_stats(led_indicator_handle_t handle, led_indicator_stats_t *stats)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    LED_INDICATOR_CHECK(stats != NULL, "invalid stats", return ESP_ERR_INVALID_ARG);
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = p_led_indicator->stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_reset_stats(led_indicator_handle_t handle)
+{
+    LED_INDICATOR_CHECK(handle != NULL, "invalid p_handle", return ESP_ERR_INVALID_ARG);
+    _led_indicator_t *p_led_indicator = (_led_indicator_t *)handle;
+    portENTER_CRITICAL(&s_stats_lock);
+    memset(&p_led_indicator->stats, 0, sizeof(p_led_indicator->stats));
+    portEXIT_CRITICAL(&s_stats_lock);
+    return ESP_OK;
+}
+#endif
+
+esp_err_t led_indicator_batch_begin(void)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&s_batch_lock);
+    if (s_batch_owner == NULL || s_batch_owner == self) {
+        s_batch_owner = self;
+        s_batch_depth++;
+    } else {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    portEXIT_CRITICAL(&s_batch_lock);
+    return ret;
+}
+
+esp_err_t led_indicator_batch_commit(void)
+{
+    _led_batch_entry_t batch[CONFIG_LED_INDICATOR_BATCH_MAX];
+    uint32_t count = 0;
+    portENTER_CRITICAL(&s_batch_lock);
+    if (s_batch_owner != xTaskGetCurrentTaskHandle()) {
+        portEXIT_CRITICAL(&s_batch_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (--s_batch_depth == 0) {
+        count = s_batch_count;
+        memcpy(batch, s_batch, count * sizeof(_led_batch_entry_t));
+        s_batch_count = 0;
+        s_batch_owner = NULL;
+    }
+    portEXIT_CRITICAL(&s_batch_lock);
+
+    // The bus transactions run outside the lock, the backends serialize them themselves
+    esp_err_t ret = ESP_OK;
+    for (uint32_t i = 0; i < count; i++) {
+        if (batch[i].commit(batch[i].batch_data) != ESP_OK) {
+            ret = ESP_FAIL;
+        }
+    }
+    return ret;
+}
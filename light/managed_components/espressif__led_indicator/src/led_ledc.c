@@ -28,14 +28,39 @@ typedef struct {
 
 } led_indicator_ledc_channel_t;
 
+#define LEDC_HW_FADE_TIME_MS CONFIG_LEDC_HW_FADE_TIME_MS
+
 typedef struct {
     uint8_t channel_num;                                          /*!< Number of LEDC channels already in use */
+    bool fade_installed;                                          /*!< The LEDC fade service is installed by this driver */
     uint32_t max_duty;                                            /*!< Max duty cycle from duty_resolution : 2^duty_resolution -1 */
     led_indicator_ledc_channel_t ledc_channel[LEDC_MAX_CHANNEL];  /*!< LEDC channel state */
 } led_indicator_ledc_t;
 
 static led_indicator_ledc_t *s_ledc = NULL;
 
+/**
+ * @brief Apply a duty, as a short hardware fade when LEDC_HW_FADE_TIME_MS is set
+ *
+ * @param channel LEDC channel
+ * @param duty target duty
+ * @return esp_err_t
+ */
+static esp_err_t _led_indicator_ledc_write_duty(ledc_channel_t channel, uint32_t duty)
+{
+    esp_err_t ret;
+#if LEDC_HW_FADE_TIME_MS > 0
+    ret = ledc_set_fade_time_and_start(LEDC_MODE, channel, duty, LEDC_HW_FADE_TIME_MS, LEDC_FADE_NO_WAIT);
+    LED_LEDC_CHECK(ESP_OK == ret, "LEDC fade error", return ret);
+#else
+    ret = ledc_set_duty(LEDC_MODE, channel, duty);
+    LED_LEDC_CHECK(ESP_OK == ret, "LEDC set duty error", return ret);
+    ret = ledc_update_duty(LEDC_MODE, channel);
+    LED_LEDC_CHECK(ESP_OK == ret, "LEDC update duty error", return ret);
+#endif
+    return ESP_OK;
+}
+
 esp_err_t led_indicator_ledc_init(void *param)
 {
     esp_err_t ret = ESP_OK;
@@ -52,6 +77,15 @@ esp_err_t led_indicator_ledc_init(void *param)
         s_ledc->max_duty = pow(2, ledc_timer_cfg.duty_resolution) - 1;
     }
 
+#if LEDC_HW_FADE_TIME_MS > 0
+    if (!s_ledc->fade_installed) {
+        ret = ledc_fade_func_install(0);
+        // ESP_ERR_INVALID_STATE: the application already installed the fade service
+        LED_LEDC_CHECK(ESP_OK == ret || ESP_ERR_INVALID_STATE == ret, "LEDC fade install fail!", goto EXIT);
+        s_ledc->fade_installed = (ESP_OK == ret);
+    }
+#endif
+
     ledc_channel_t ch = cfg->channel;
     LED_LEDC_CHECK(!s_ledc->ledc_channel[ch].is_init, "LEDC channel is already initialized!", goto EXIT);
     ledc_channel_config_t ledc_ch_cfg = LEDC_CHANNEL_CONFIG(cfg->timer_num, cfg->channel, cfg->gpio_num);
@@ -79,6 +113,9 @@ esp_err_t led_indicator_ledc_deinit(void *channel)
     s_ledc->ledc_channel[ch].is_init = false;
     s_ledc->channel_num -= 1;
     if (s_ledc->channel_num <= 0 && s_ledc) {
+        if (s_ledc->fade_installed) {
+            ledc_fade_func_uninstall();
+        }
         free(s_ledc);
         s_ledc = NULL;
     }
@@ -96,11 +133,8 @@ esp_err_t led_indicator_ledc_set_on_off(void *channel, bool on_off)
         duty = s_ledc->max_duty - duty;
     }
 
-    ret = ledc_set_duty(LEDC_MODE, s_ledc->ledc_channel[ch].channel, duty);
-    LED_LEDC_CHECK(ESP_OK == ret, "LEDC set duty error", return ret);
-    ret = ledc_update_duty(LEDC_MODE, s_ledc->ledc_channel[ch].channel);
-    LED_LEDC_CHECK(ESP_OK == ret, "LEDC update duty error", return ret);
-    return ESP_OK;
+    ret = _led_indicator_ledc_write_duty(s_ledc->ledc_channel[ch].channel, duty);
+    return ret;
 }
 
 esp_err_t led_indicator_ledc_set_brightness(void *channel, uint32_t brightness)
@@ -110,9 +144,6 @@ esp_err_t led_indicator_ledc_set_brightness(void *channel, uint32_t brightness)
     LED_LEDC_CHECK(s_ledc->ledc_channel[ch].is_init, "LEDC channel doesn't init", return ESP_FAIL);
     LED_LEDC_CHECK(brightness <= UINT8_MAX, "brightness can't be larger than UINT8_MAX", return ESP_FAIL);
     brightness = s_ledc->ledc_channel[ch].is_active_level_high ? brightness : (UINT8_MAX - brightness);
-    ret = ledc_set_duty(LEDC_MODE, s_ledc->ledc_channel[ch].channel, brightness * s_ledc->max_duty / UINT8_MAX);
-    LED_LEDC_CHECK(ESP_OK == ret, "LEDC set duty error", return ret);
-    ret = ledc_update_duty(LEDC_MODE, s_ledc->ledc_channel[ch].channel);
-    LED_LEDC_CHECK(ESP_OK == ret, "LEDC update duty error", return ret);
-    return ESP_OK;
+    ret = _led_indicator_ledc_write_duty(s_ledc->ledc_channel[ch].channel, brightness * s_ledc->max_duty / UINT8_MAX);
+    return ret;
 }
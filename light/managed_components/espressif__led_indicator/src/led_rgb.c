@@ -5,6 +5,8 @@
  */
 
 #include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/ledc.h"
 #include "esp_log.h"
 #include "led_rgb.h"
@@ -20,13 +22,21 @@
         action;                                                   \
     }
 
+#define LEDC_HW_FADE_TIME_MS CONFIG_LEDC_HW_FADE_TIME_MS
+
 typedef struct {
     bool is_active_level_high;     /*!< Set true if GPIO level is high when light is ON, otherwise false. */
     ledc_channel_t rgb_channel[3]; /*!< RGB Channels */
     uint32_t max_duty;             /*!< Max duty cycle from duty_resolution : 2^duty_resolution -1 */
+    uint32_t duty[3];              /*!< Duty last written to each channel, after the active level */
     led_indicator_ihsv_t hsv;      /*!< HSV: H [0-360] - 9 bits, S [0-255] - 8 bits, V [0-255] - 8 bits*/
 } led_rgb_t;
 
+#if LEDC_HW_FADE_TIME_MS > 0
+static uint32_t s_fade_users;      /*!< RGB LEDs using the LEDC fade service */
+static bool s_fade_installed;      /*!< The LEDC fade service is installed by this driver */
+#endif
+
 esp_err_t led_indicator_rgb_init(void *param, void **ret_rgb)
 {
     esp_err_t ret = ESP_OK;
@@ -49,6 +59,16 @@ esp_err_t led_indicator_rgb_init(void *param, void **ret_rgb)
     ledc_channel_config_t blue_ch_cfg = LEDC_CHANNEL_CONFIG(cfg->timer_num, cfg->blue_channel, cfg->blue_gpio_num);
     ret = ledc_channel_config(&blue_ch_cfg);
     LED_RGB_CHECK(ESP_OK == ret, "blud ledc_channel_config fail!", goto EXIT);
+#if LEDC_HW_FADE_TIME_MS > 0
+    if (s_fade_users == 0) {
+        ret = ledc_fade_func_install(0);
+        // ESP_ERR_INVALID_STATE: the application or the LEDC backend already installed the fade service
+        LED_RGB_CHECK(ESP_OK == ret || ESP_ERR_INVALID_STATE == ret, "LEDC fade install fail!", goto EXIT);
+        s_fade_installed = (ESP_OK == ret);
+        ret = ESP_OK;
+    }
+    s_fade_users++;
+#endif
     rgb->rgb_channel[0] = cfg->red_channel;
     rgb->rgb_channel[1] = cfg->green_channel;
     rgb->rgb_channel[2] = cfg->blue_channel;
@@ -65,23 +85,72 @@ EXIT:
 esp_err_t led_indicator_rgb_deinit(void *rgb_handle)
 {
     LED_RGB_CHECK(NULL != rgb_handle, "rgb_handle pointer invalid", return ESP_ERR_INVALID_ARG);
+#if LEDC_HW_FADE_TIME_MS > 0
+    if (--s_fade_users == 0 && s_fade_installed) {
+        ledc_fade_func_uninstall();
+        s_fade_installed = false;
+    }
+#endif
     free(rgb_handle);
     return ESP_OK;
 }
 
+/**
+ * @brief Write the duties of the three channels as one colour change
+ *
+ * All the changed duties are staged first and then started together, so that the channels, which share one LEDC
+ * timer, switch on the same PWM period instead of showing the colours in between. Channels whose duty did not
+ * change are left alone.
+ *
+ * @param p_rgb RGB LED
+ * @param rgb duty of each channel
+ * @return esp_err_t
+ */
 static esp_err_t led_indicator_rgb_set_duty(led_rgb_t *p_rgb, uint32_t rgb[])
 {
-    esp_err_t ret;
+    esp_err_t ret = ESP_OK;
+    bool changed[3];
     if (!p_rgb->is_active_level_high) {
         rgb[0] = p_rgb->max_duty - rgb[0];
         rgb[1] = p_rgb->max_duty - rgb[1];
         rgb[2] = p_rgb->max_duty - rgb[2];
     }
     for (int i = 0; i < 3; i++) {
+        changed[i] = rgb[i] != p_rgb->duty[i];
+        if (!changed[i]) {
+            continue;
+        }
+#if LEDC_HW_FADE_TIME_MS > 0
+        // Same length for the three fades, so that they also end together
+        ret = ledc_set_fade_with_time(LEDC_MODE, p_rgb->rgb_channel[i], rgb[i], LEDC_HW_FADE_TIME_MS);
+        LED_RGB_CHECK(ESP_OK == ret, "LEDC set fade error", return ret);
+#else
         ret = ledc_set_duty(LEDC_MODE, p_rgb->rgb_channel[i], rgb[i]);
         LED_RGB_CHECK(ESP_OK == ret, "LEDC set duty error", return ret);
-        ret = ledc_update_duty(LEDC_MODE, p_rgb->rgb_channel[i]);
-        LED_RGB_CHECK(ESP_OK == ret, "LEDC update duty error", return ret);
+#endif
+    }
+
+#if LEDC_HW_FADE_TIME_MS > 0
+    for (int i = 0; i < 3 && ESP_OK == ret; i++) {
+        if (changed[i]) {
+            ret = ledc_fade_start(LEDC_MODE, p_rgb->rgb_channel[i], LEDC_FADE_NO_WAIT);
+        }
+    }
+    LED_RGB_CHECK(ESP_OK == ret, "LEDC fade start error", return ret);
+#else
+    // No other task runs between the updates, a duty takes effect at the end of the PWM period it is updated in
+    vTaskSuspendAll();
+    for (int i = 0; i < 3 && ESP_OK == ret; i++) {
+        if (changed[i]) {
+            ret = ledc_update_duty(LEDC_MODE, p_rgb->rgb_channel[i]);
+        }
+    }
+    xTaskResumeAll();
+    LED_RGB_CHECK(ESP_OK == ret, "LEDC update duty error", return ret);
+#endif
+
+    for (int i = 0; i < 3; i++) {
+        p_rgb->duty[i] = rgb[i];
     }
     return ESP_OK;
 }
@@ -16,6 +16,7 @@
 #include "led_strip.h"
 #include "led_strip_types.h"
 #include "led_convert.h"
+#include "led_gamma.h"
 
 #define TAG "led_strips"
 
@@ -30,23 +31,80 @@ typedef struct {
     led_strip_handle_t led_strip;
     uint32_t max_index;             /*!< Maximum LEDs in a single strip */
     led_indicator_ihsv_t ihsv;      /*!< IHSV: I [0-127] 7 bits -  H [0-360] - 9 bits, S [0-255] - 8 bits, V [0-255] - 8 bits*/
+    bool hw_brightness;             /*!< The driver scales pixels already set, brightness of the whole strip needs no rewrite */
+    bool uniform;                   /*!< Every pixel holds the H and S of ihsv */
+    uint8_t strip_brightness;       /*!< Brightness applied by the driver, the pixels are at full brightness when it is not MAX_BRIGHTNESS */
 } led_strips_t;
 
+/**
+ * @brief Bring the driver brightness back to full, baking it into the pixels
+ *
+ * Called before any write other than a brightness change of the whole strip.
+ */
+static esp_err_t _led_strips_drop_hw_brightness(led_strips_t *p_strip)
+{
+    if (p_strip->strip_brightness == MAX_BRIGHTNESS) {
+        return ESP_OK;
+    }
+    uint32_t r, g, b;
+    led_indicator_hsv2rgb(SET_HSV(p_strip->ihsv.h, p_strip->ihsv.s, p_strip->strip_brightness), &r, &g, &b);
+    for (int j = 0; j < p_strip->max_index; j++) {
+        esp_err_t err = led_strip_set_pixel(p_strip->led_strip, j, r, g, b);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    p_strip->strip_brightness = MAX_BRIGHTNESS;
+    return led_strip_set_brightness(p_strip->led_strip, MAX_BRIGHTNESS);
+}
+
+/**
+ * @brief Write the current IHSV to the indexed pixel or to all of them
+ *
+ * The colour is converted to RGB once, instead of once per pixel by led_strip_set_pixel_hsv().
+ */
+static esp_err_t _led_strips_set_pixels_hsv(led_strips_t *p_strip)
+{
+    esp_err_t ret = _led_strips_drop_hw_brightness(p_strip);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    uint32_t r, g, b;
+    led_indicator_hsv2rgb(p_strip->ihsv.value, &r, &g, &b);
+
+    p_strip->uniform = p_strip->ihsv.i == MAX_INDEX;
+    if (p_strip->ihsv.i != MAX_INDEX) {
+        return led_strip_set_pixel(p_strip->led_strip, p_strip->ihsv.i, r, g, b);
+    }
+    for (int j = 0; j < p_strip->max_index; j++) {
+        esp_err_t err = led_strip_set_pixel(p_strip->led_strip, j, r, g, b);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t led_indicator_strips_init(void *param, void **ret_strips)
 {
     esp_err_t ret = ESP_OK;
     const led_indicator_strips_config_t *cfg = (led_indicator_strips_config_t *)param;
     LED_STRIPS_CHECK(NULL != cfg, "param pointer invalid", return ESP_ERR_INVALID_ARG);
-    LED_STRIPS_CHECK(cfg->led_strip_cfg.max_leds < MAX_INDEX, "The LED indicator supports a maximum of 126 LEDs", return ESP_ERR_INVALID_ARG);
+    LED_STRIPS_CHECK(cfg->led_strip_cfg.max_leds > 0, "The strip needs at least one LED", return ESP_ERR_INVALID_ARG);
 
     led_strips_t *p_strip = calloc(1, sizeof(led_strips_t));
     p_strip->max_index = cfg->led_strip_cfg.max_leds;
     LED_STRIPS_CHECK(NULL != p_strip, "calloc failed", return ESP_ERR_NO_MEM);
+    p_strip->strip_brightness = MAX_BRIGHTNESS;
     switch (cfg->led_strip_driver) {
 #if !CONFIG_IDF_TARGET_ESP32C2
     case LED_STRIP_RMT: {
         ret = led_strip_new_rmt_device(&cfg->led_strip_cfg, &cfg->led_strip_rmt_cfg, &p_strip->led_strip);
         LED_STRIPS_CHECK(ret == ESP_OK, "Created LED strip object with RMT backend", goto fail);
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        // the RMT encoder scales the pixels on every refresh
+        p_strip->hw_brightness = true;
+#endif
         break;
     }
 #endif
@@ -87,17 +145,7 @@ esp_err_t led_indicator_strips_set_on_off(void *strips, bool on_off)
 {
     led_strips_t *p_strip = (led_strips_t *)strips;
     p_strip->ihsv.v = on_off ? MAX_BRIGHTNESS : 0;
-    esp_err_t err = ESP_OK;
-    if (p_strip->ihsv.i == MAX_INDEX) {
-        for (int j = 0; j < p_strip->max_index; j++) {
-            err |= led_strip_set_pixel_hsv(p_strip->led_strip, j, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
-            if (err != ESP_OK) {
-                return err;
-            }
-        }
-    } else {
-        err |= led_strip_set_pixel_hsv(p_strip->led_strip, p_strip->ihsv.i, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
-    }
+    esp_err_t err = _led_strips_set_pixels_hsv(p_strip);
 
     err |= led_strip_refresh(p_strip->led_strip);
 
@@ -116,7 +164,10 @@ esp_err_t led_indicator_strips_set_rgb(void *strips, uint32_t irgb_value)
     g = GET_GREEN(irgb_value);
     b = GET_BLUE(irgb_value);
 
-    esp_err_t err = ESP_OK;
+    esp_err_t err = _led_strips_drop_hw_brightness(p_strip);
+    if (err != ESP_OK) {
+        return err;
+    }
     if (i == MAX_INDEX) {
         for (int j = 0; j < p_strip->max_index; j++) {
             err |= led_strip_set_pixel(p_strip->led_strip, j, r, g, b);
@@ -135,6 +186,7 @@ esp_err_t led_indicator_strips_set_rgb(void *strips, uint32_t irgb_value)
     }
     p_strip->ihsv.value = led_indicator_rgb2hsv(irgb_value);
     p_strip->ihsv.i = i;
+    p_strip->uniform = i == MAX_INDEX;
     return ESP_OK;
 }
 
@@ -143,17 +195,7 @@ esp_err_t led_indicator_strips_set_hsv(void *strips, uint32_t ihsv_value)
     led_strips_t *p_strip = (led_strips_t *)strips;
     p_strip->ihsv.value = ihsv_value;
 
-    esp_err_t err = ESP_OK;
-    if (p_strip->ihsv.i == MAX_INDEX) {
-        for (int j = 0; j < p_strip->max_index; j++) {
-            err |= led_strip_set_pixel_hsv(p_strip->led_strip, j, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
-            if (err != ESP_OK) {
-                return err;
-            }
-        }
-    } else {
-        err |= led_strip_set_pixel_hsv(p_strip->led_strip, p_strip->ihsv.i, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
-    }
+    esp_err_t err = _led_strips_set_pixels_hsv(p_strip);
 
     err |= led_strip_refresh(p_strip->led_strip);
     if (err != ESP_OK) {
@@ -166,21 +208,28 @@ esp_err_t led_indicator_strips_set_hsv(void *strips, uint32_t ihsv_value)
 esp_err_t led_indicator_strips_set_brightness(void *strips, uint32_t ihsv)
 {
     led_strips_t *p_strip = (led_strips_t *)strips;
-    p_strip->ihsv.i = GET_INDEX(ihsv);
-    p_strip->ihsv.v = GET_BRIGHTNESS(ihsv);
-
     esp_err_t err = ESP_OK;
-    if (p_strip->ihsv.i == MAX_INDEX) {
-        for (int j = 0; j < p_strip->max_index; j++) {
-            err |= led_strip_set_pixel_hsv(p_strip->led_strip, j, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
+    if (p_strip->hw_brightness && p_strip->uniform && GET_INDEX(ihsv) == MAX_INDEX) {
+        // dim the whole strip in the driver, the pixels are written at full brightness once
+        if (p_strip->strip_brightness == MAX_BRIGHTNESS && p_strip->ihsv.v != MAX_BRIGHTNESS) {
+            p_strip->ihsv.v = MAX_BRIGHTNESS;
+            err = _led_strips_set_pixels_hsv(p_strip);
             if (err != ESP_OK) {
                 return err;
             }
         }
-    } else {
-        err |= led_strip_set_pixel_hsv(p_strip->led_strip, p_strip->ihsv.i, p_strip->ihsv.h, p_strip->ihsv.s, p_strip->ihsv.v);
+        p_strip->ihsv.v = GET_BRIGHTNESS(ihsv);
+        p_strip->strip_brightness = p_strip->ihsv.v;
+        err = led_strip_set_brightness(p_strip->led_strip, p_strip->strip_brightness);
+        err |= led_strip_refresh(p_strip->led_strip);
+        return err == ESP_OK ? ESP_OK : ESP_FAIL;
     }
 
+    p_strip->ihsv.i = GET_INDEX(ihsv);
+    p_strip->ihsv.v = GET_BRIGHTNESS(ihsv);
+
+    err = _led_strips_set_pixels_hsv(p_strip);
+
     err |= led_strip_refresh(p_strip->led_strip);
     if (err != ESP_OK) {
         return err;
@@ -188,3 +237,27 @@ esp_err_t led_indicator_strips_set_brightness(void *strips, uint32_t ihsv)
 
     return ESP_OK;
 }
+
+esp_err_t led_indicator_strips_set_frame(void *strips, const uint32_t *rgb_frame, uint32_t pixel_num)
+{
+    LED_STRIPS_CHECK(NULL != strips && NULL != rgb_frame, "param pointer invalid", return ESP_ERR_INVALID_ARG);
+    led_strips_t *p_strip = (led_strips_t *)strips;
+    uint32_t count = pixel_num < p_strip->max_index ? pixel_num : p_strip->max_index;
+    esp_err_t ret = _led_strips_drop_hw_brightness(p_strip);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    p_strip->uniform = false;
+
+    for (uint32_t j = 0; j < count; j++) {
+        uint32_t rgb = rgb_frame[j];
+        esp_err_t err = led_strip_set_pixel(p_strip->led_strip, j, led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_R, GET_RED(rgb)),
+                                            led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_G, GET_GREEN(rgb)),
+                                            led_indicator_get_channel_gamma_value(LED_GAMMA_CHANNEL_B, GET_BLUE(rgb)));
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    return led_strip_refresh(p_strip->led_strip);
+}
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
 #include "driver/ledc.h"
@@ -509,6 +510,96 @@ TEST_CASE("custom mode test", "[LED][indicator]")
     led_indicator_deinit();
 }
 
+/* Expander of 16 channels, the channels are only written to the chip on commit */
+typedef struct {
+    uint32_t staged[16];
+    uint32_t written[16];
+    int begins;
+    int commits;
+} test_expander_t;
+
+static test_expander_t s_expander;
+
+typedef struct {
+    test_expander_t *expander;
+    int channel;
+} test_expander_channel_t;
+
+static test_expander_channel_t s_expander_channels[16];
+
+static esp_err_t test_expander_set_brightness(void *hardware_data, uint32_t brightness)
+{
+    test_expander_channel_t *ch = (test_expander_channel_t *)hardware_data;
+    ch->expander->staged[ch->channel] = brightness;
+    return ESP_OK;
+}
+
+static esp_err_t test_expander_begin(void *batch_data)
+{
+    ((test_expander_t *)batch_data)->begins++;
+    return ESP_OK;
+}
+
+static esp_err_t test_expander_commit(void *batch_data)
+{
+    test_expander_t *expander = (test_expander_t *)batch_data;
+    memcpy(expander->written, expander->staged, sizeof(expander->written));
+    expander->commits++;
+    return ESP_OK;
+}
+
+TEST_CASE("custom mode batch commit", "[LED][indicator]")
+{
+    led_indicator_handle_t handles[16];
+    for (int i = 0; i < 16; i++) {
+        s_expander_channels[i].expander = &s_expander;
+        s_expander_channels[i].channel = i;
+        led_indicator_custom_config_t custom_config = {
+            .duty_resolution = LED_DUTY_8_BIT,
+            .hal_indicator_set_brightness = test_expander_set_brightness,
+            .hardware_data = &s_expander_channels[i],
+            .hal_indicator_begin = test_expander_begin,
+            .hal_indicator_commit = test_expander_commit,
+            .batch_data = &s_expander,
+        };
+        led_indicator_config_t config = {
+            .led_indicator_custom_config = &custom_config,
+            .mode = LED_CUSTOM_MODE,
+        };
+        handles[i] = led_indicator_create(&config);
+        TEST_ASSERT_NOT_NULL(handles[i]);
+    }
+
+    // Outside a batch every update is committed
+    memset(&s_expander, 0, sizeof(s_expander));
+    TEST_ASSERT_EQUAL(ESP_OK, led_indicator_set_brightness(handles[0], 50));
+    TEST_ASSERT_EQUAL(1, s_expander.begins);
+    TEST_ASSERT_EQUAL(1, s_expander.commits);
+    TEST_ASSERT_EQUAL(led_indicator_get_gamma_value(50), s_expander.written[0]);
+
+    // The 16 channels of a batch are one commit, nothing reaches the chip before it
+    memset(&s_expander, 0, sizeof(s_expander));
+    TEST_ASSERT_EQUAL(ESP_OK, led_indicator_batch_begin());
+    TEST_ASSERT_EQUAL(ESP_OK, led_indicator_batch_begin());
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, led_indicator_set_brightness(handles[i], 100 + i));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, led_indicator_batch_commit());
+    TEST_ASSERT_EQUAL(1, s_expander.begins);
+    TEST_ASSERT_EQUAL(0, s_expander.commits);
+    TEST_ASSERT_EQUAL(0, s_expander.written[15]);
+    TEST_ASSERT_EQUAL(ESP_OK, led_indicator_batch_commit());
+    TEST_ASSERT_EQUAL(1, s_expander.commits);
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL(led_indicator_get_gamma_value(100 + i), s_expander.written[i]);
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, led_indicator_batch_commit());
+
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, led_indicator_delete(handles[i]));
+    }
+}
+
 TEST_CASE("test gamma table", "[LED][indicator]")
 {
     led_indicator_new_gamma_table(2.3);
@@ -0,0 +1,277 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/ledc.h"
+#include "esp_idf_version.h"
+#include "soc/soc_caps.h"
+#include "led_indicator.h"
+#include "unity.h"
+
+#ifdef CONFIG_LED_INDICATOR_STATS
+
+/* Every indicator takes its pins from this table, the RGB backend takes three */
+static const int s_bench_gpio[] = {11, 12, 13, 14, 15, 16, 17, 18, 1, 2, 4, 5, 6, 7, 8, 9};
+#define BENCH_GPIO_NUM         (sizeof(s_bench_gpio) / sizeof(s_bench_gpio[0]))
+#define BENCH_MAX_INDICATORS   16
+#define BENCH_RUN_MS           2000
+#define BENCH_STRIP_LEDS       16
+#define BENCH_STRIP_RMT_RES_HZ (10 * 1000 * 1000)
+
+enum {
+    BENCH_BLINK = 0,
+    BENCH_BREATHE,
+    BENCH_LIST_NUM,
+};
+
+static const blink_step_t bench_blink[] = {
+    {LED_BLINK_HOLD, LED_STATE_ON, 50},
+    {LED_BLINK_HOLD, LED_STATE_OFF, 50},
+    {LED_BLINK_LOOP, 0, 0},
+};
+
+static const blink_step_t bench_breathe[] = {
+    {LED_BLINK_BREATHE, LED_STATE_ON, 500},
+    {LED_BLINK_BREATHE, LED_STATE_OFF, 500},
+    {LED_BLINK_LOOP, 0, 0},
+};
+
+static blink_step_t const *bench_lists[] = {
+    [BENCH_BLINK] = bench_blink,
+    [BENCH_BREATHE] = bench_breathe,
+};
+
+typedef enum {
+    BENCH_BACKEND_GPIO,
+    BENCH_BACKEND_LEDC,
+    BENCH_BACKEND_RGB,
+    BENCH_BACKEND_STRIPS,
+} bench_backend_t;
+
+typedef struct {
+    bench_backend_t backend;
+    const char *name;
+    int max_indicators;                 /*!< Indicators the target has the channels for */
+    bool breathe;                       /*!< The backend has a brightness, so it can breathe */
+} bench_backend_desc_t;
+
+static const bench_backend_desc_t s_backends[] = {
+    {BENCH_BACKEND_GPIO, "gpio", BENCH_GPIO_NUM, false},
+    {BENCH_BACKEND_LEDC, "ledc", SOC_LEDC_CHANNEL_NUM, true},
+    {BENCH_BACKEND_RGB, "rgb", SOC_LEDC_CHANNEL_NUM / 3, true},
+    {BENCH_BACKEND_STRIPS, "strips", SOC_RMT_TX_CANDIDATES_PER_GROUP, true},
+};
+
+static const int s_counts[] = {1, 4, 8, 16};
+
+static led_indicator_handle_t s_handles[BENCH_MAX_INDICATORS];
+static volatile bool s_contend;
+static volatile int s_contend_list;
+static TaskHandle_t s_contender;
+
+static led_indicator_handle_t bench_create(bench_backend_t backend, int index)
+{
+    led_indicator_config_t config = {
+        .blink_lists = bench_lists,
+        .blink_list_num = BENCH_LIST_NUM,
+    };
+
+    switch (backend) {
+    case BENCH_BACKEND_GPIO: {
+        led_indicator_gpio_config_t gpio_config = {
+            .is_active_level_high = 1,
+            .gpio_num = s_bench_gpio[index],
+        };
+        config.mode = LED_GPIO_MODE;
+        config.led_indicator_gpio_config = &gpio_config;
+        return led_indicator_create(&config);
+    }
+    case BENCH_BACKEND_LEDC: {
+        led_indicator_ledc_config_t ledc_config = {
+            .is_active_level_high = 1,
+            .timer_inited = index > 0,
+            .timer_num = LEDC_TIMER_0,
+            .gpio_num = s_bench_gpio[index],
+            .channel = index,
+        };
+        config.mode = LED_LEDC_MODE;
+        config.led_indicator_ledc_config = &ledc_config;
+        return led_indicator_create(&config);
+    }
+    case BENCH_BACKEND_RGB: {
+        led_indicator_rgb_config_t rgb_config = {
+            .is_active_level_high = 1,
+            .timer_inited = index > 0,
+            .timer_num = LEDC_TIMER_0,
+            .red_gpio_num = s_bench_gpio[index * 3],
+            .green_gpio_num = s_bench_gpio[index * 3 + 1],
+            .blue_gpio_num = s_bench_gpio[index * 3 + 2],
+            .red_channel = index * 3,
+            .green_channel = index * 3 + 1,
+            .blue_channel = index * 3 + 2,
+        };
+        config.mode = LED_RGB_MODE;
+        config.led_indicator_rgb_config = &rgb_config;
+        return led_indicator_create(&config);
+    }
+    case BENCH_BACKEND_STRIPS: {
+        led_indicator_strips_config_t strips_config = {
+            .led_strip_cfg = {
+                .strip_gpio_num = s_bench_gpio[index],
+                .max_leds = BENCH_STRIP_LEDS,
+                .led_pixel_format = LED_PIXEL_FORMAT_GRB,
+                .led_model = LED_MODEL_WS2812,
+            },
+            .led_strip_driver = LED_STRIP_RMT,
+            .led_strip_rmt_cfg = {
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+                .rmt_channel = index,
+#else
+                .clk_src = RMT_CLK_SRC_DEFAULT,
+                .resolution_hz = BENCH_STRIP_RMT_RES_HZ,
+#endif
+            },
+        };
+        config.mode = LED_STRIPS_MODE;
+        config.led_indicator_strips_config = &strips_config;
+        return led_indicator_create(&config);
+    }
+    default:
+        return NULL;
+    }
+}
+
+/* Stands for an application calling the API while the indicators run: it takes the mutex of every indicator
+ * once per tick, stopping the list which is not running so that the output is not disturbed. */
+static void bench_contender(void *arg)
+{
+    int count = (int)arg;
+    while (s_contend) {
+        for (int i = 0; i < count; i++) {
+            led_indicator_stop(s_handles[i], s_contend_list);
+        }
+        vTaskDelay(1);
+    }
+    s_contender = NULL;
+    vTaskDelete(NULL);
+}
+
+static void bench_run(const bench_backend_desc_t *desc, int count, int list, bool contend)
+{
+    for (int i = 0; i < count; i++) {
+        s_handles[i] = bench_create(desc->backend, i);
+        TEST_ASSERT_NOT_NULL(s_handles[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, led_indicator_start(s_handles[i], list));
+    }
+    /* Skip the first steps, which start from the API and not from the timer */
+    vTaskDelay(pdMS_TO_TICKS(200));
+    for (int i = 0; i < count; i++) {
+        led_indicator_reset_stats(s_handles[i]);
+    }
+
+    if (contend) {
+        s_contend = true;
+        s_contend_list = list == BENCH_BLINK ? BENCH_BREATHE : BENCH_BLINK;
+#if CONFIG_FREERTOS_UNICORE
+        BaseType_t core = tskNO_AFFINITY;
+#else
+        BaseType_t core = 1;
+#endif
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(bench_contender, "bench_contender", 2048, (void *)count,
+                                                          uxTaskPriorityGet(NULL), &s_contender, core));
+    }
+    vTaskDelay(pdMS_TO_TICKS(BENCH_RUN_MS));
+    if (contend) {
+        s_contend = false;
+        while (s_contender) {
+            vTaskDelay(1);
+        }
+    }
+
+    led_indicator_stats_t total = {0};
+    uint32_t jitter_us = 0;
+    for (int i = 0; i < count; i++) {
+        led_indicator_stats_t stats;
+        TEST_ASSERT_EQUAL(ESP_OK, led_indicator_get_stats(s_handles[i], &stats));
+        total.steps += stats.steps;
+        total.retries += stats.retries;
+        total.late_count += stats.late_count;
+        total.late_sum_us += stats.late_sum_us;
+        total.late_sq_sum_us += stats.late_sq_sum_us;
+        total.cycles_sum += stats.cycles_sum;
+        if (stats.cycles_max > total.cycles_max) {
+            total.cycles_max = stats.cycles_max;
+        }
+        if (i == 0 || stats.late_min_us < total.late_min_us) {
+            total.late_min_us = stats.late_min_us;
+        }
+        if (i == 0 || stats.late_max_us > total.late_max_us) {
+            total.late_max_us = stats.late_max_us;
+        }
+        if (stats.late_max_us - stats.late_min_us > jitter_us) {
+            jitter_us = stats.late_max_us - stats.late_min_us;
+        }
+        TEST_ASSERT_EQUAL(ESP_OK, led_indicator_delete(s_handles[i]));
+        s_handles[i] = NULL;
+    }
+
+    TEST_ASSERT_GREATER_THAN(0, total.steps);
+    double mean = total.late_count ? (double)total.late_sum_us / total.late_count : 0;
+    double var = total.late_count ? (double)total.late_sq_sum_us / total.late_count - mean * mean : 0;
+    printf("BENCH %-6s %-7s n=%-2d %-9s steps/s=%-6" PRIu32 " late_us mean=%.1f std=%.1f min=%" PRId32 " max=%" PRId32
+           " jitter_us=%" PRIu32 " retry=%.2f%% cycles/step avg=%" PRIu64 " max=%" PRIu32 "\n",
+           desc->name, list == BENCH_BLINK ? "blink" : "breathe", count, contend ? "contended" : "idle",
+           total.steps * 1000 / BENCH_RUN_MS, mean, sqrt(var > 0 ? var : 0), total.late_min_us, total.late_max_us,
+           jitter_us, total.steps ? 100.0 * total.retries / total.steps : 0, total.cycles_sum / total.steps,
+           total.cycles_max);
+}
+
+static void bench_backend(bench_backend_t backend)
+{
+    const bench_backend_desc_t *desc = &s_backends[backend];
+    for (int c = 0; c < sizeof(s_counts) / sizeof(s_counts[0]); c++) {
+        int count = s_counts[c];
+        if (count > desc->max_indicators) {
+            printf("BENCH %-6s n=%-2d skipped, the target has channels for %d indicators\n", desc->name, count,
+                   desc->max_indicators);
+            continue;
+        }
+        for (int list = BENCH_BLINK; list < BENCH_LIST_NUM; list++) {
+            if (list == BENCH_BREATHE && !desc->breathe) {
+                continue;
+            }
+            bench_run(desc, count, list, false);
+            bench_run(desc, count, list, true);
+        }
+    }
+}
+
+TEST_CASE("bench step timing gpio", "[LED][bench]")
+{
+    bench_backend(BENCH_BACKEND_GPIO);
+}
+
+TEST_CASE("bench step timing ledc", "[LED][bench]")
+{
+    bench_backend(BENCH_BACKEND_LEDC);
+}
+
+TEST_CASE("bench step timing rgb", "[LED][bench]")
+{
+    bench_backend(BENCH_BACKEND_RGB);
+}
+
+TEST_CASE("bench step timing strips", "[LED][bench]")
+{
+    bench_backend(BENCH_BACKEND_STRIPS);
+}
+
+#endif
@@ -12,6 +12,7 @@
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
 #include "led_strip_spi.h"
+#include "led_strip_parallel.h"
 #endif
 
 #ifdef __cplusplus
@@ -70,6 +71,126 @@ esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uin
  */
 esp_err_t led_strip_set_pixel_hsv(led_strip_handle_t strip, uint32_t index, uint16_t hue, uint8_t saturation, uint8_t value);
 
+/**
+ * @brief Set a span of pixels from a packed buffer
+ *
+ * @note The pixels are converted to the order of the LEDs in one pass, which is much cheaper than
+ *       calling led_strip_set_pixel() for every pixel of a frame.
+ *       Data with a white component needs a strip of LED_PIXEL_FORMAT_GRBW; RGB data on such a strip sets white to 0.
+ *
+ * @param strip: LED strip
+ * @param start: index of the first pixel to set
+ * @param count: number of pixels to set
+ * @param data: packed pixel data, 3 or 4 bytes per pixel depending on the format
+ * @param format: layout of the pixel data
+ *
+ * @return
+ *      - ESP_OK: Set pixels successfully
+ *      - ESP_ERR_INVALID_ARG: Set pixels failed because of an invalid argument
+ *      - ESP_FAIL: Set pixels failed because other error occurred
+ */
+esp_err_t led_strip_set_pixels(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format);
+
+/**
+ * @brief Set a span of pixels from a packed buffer of 16-bit components
+ *
+ * @note 0xFFFF is full brightness, an 8-bit value v is v * 257. A RMT strip created with `flags.high_depth` keeps the
+ *       16 bits and dithers them over the refreshes: each LED shows the integer part of the 8-bit level and the
+ *       fraction left is added on the next frame, so the average light follows the 16-bit level. Refresh at a high
+ *       rate, a refresh with nothing set again still sends the pixels that are dithering.
+ *       Other strips round the components to 8 bits.
+ *
+ * @param strip: LED strip
+ * @param start: index of the first pixel to set
+ * @param count: number of pixels to set
+ * @param data: packed pixel data, 3 or 4 components per pixel depending on the format
+ * @param format: layout of the pixel data
+ *
+ * @return
+ *      - ESP_OK: Set pixels successfully
+ *      - ESP_ERR_INVALID_ARG: Set pixels failed because of an invalid argument
+ *      - ESP_FAIL: Set pixels failed because other error occurred
+ */
+esp_err_t led_strip_set_pixels_16bit(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint16_t *data, led_strip_data_format_t format);
+
+/**
+ * @brief Get the pixel memory of a span of pixels, to render a frame in place without any copy
+ *
+ * @note The memory is in the order the LEDs expect: 3 bytes (G, R, B) or 4 bytes (G, R, B, W) per pixel,
+ *       depending on the led_pixel_format of the strip. The span is marked as changed, write it and call
+ *       led_strip_refresh(). The pointer is only valid until that refresh, with async refresh the pixel
+ *       memory moves to the other buffer afterwards.
+ *       Only the RMT backend keeps pixels in this form, the SPI and parallel backends hold the encoded
+ *       waveform instead and return ESP_ERR_NOT_SUPPORTED.
+ *
+ * @param strip: LED strip
+ * @param start: index of the first pixel
+ * @param count: number of pixels that are going to be written
+ * @param buf: returned pointer to the first pixel
+ *
+ * @return
+ *      - ESP_OK: Get pixel memory successfully
+ *      - ESP_ERR_INVALID_ARG: Get pixel memory failed because of an invalid argument
+ *      - ESP_ERR_NOT_SUPPORTED: The backend does not keep pixels in LED order
+ */
+esp_err_t led_strip_get_pixel_buf(led_strip_handle_t strip, uint32_t start, uint32_t count, uint8_t **buf);
+
+/**
+ * @brief Set the brightness and white balance of the whole strip
+ *
+ * @note Every color component is multiplied by its scale / 255 by the driver while the pixels are encoded,
+ *       so dimming or color correcting a strip doesn't need the pixels to be set again.
+ *       To combine a brightness with a white balance, pass brightness * correction / 255 for each component.
+ *       The RMT backend applies the scale to the pixels already set, on the next refresh.
+ *       The SPI and parallel backends encode the pixels when they are set, the scale only applies to the pixels set afterwards.
+ *
+ * @param strip: LED strip
+ * @param red: scale of the red component, 255 leaves it unchanged
+ * @param green: scale of the green component, 255 leaves it unchanged
+ * @param blue: scale of the blue component, 255 leaves it unchanged
+ * @param white: scale of the white component, 255 leaves it unchanged
+ *
+ * @return
+ *      - ESP_OK: Set color scale successfully
+ *      - ESP_ERR_INVALID_ARG: Set color scale failed because of an invalid argument
+ *      - ESP_ERR_NOT_SUPPORTED: The backend has no color scale stage
+ *      - ESP_FAIL: Set color scale failed because other error occurred
+ */
+esp_err_t led_strip_set_color_scale(led_strip_handle_t strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white);
+
+/**
+ * @brief Set the brightness of the whole strip, same scale for every color component
+ *
+ * @note See led_strip_set_color_scale() for when the brightness takes effect.
+ *
+ * @param strip: LED strip
+ * @param brightness: 0 turns the strip off, 255 leaves the colors unchanged
+ *
+ * @return
+ *      - ESP_OK: Set brightness successfully
+ *      - ESP_ERR_INVALID_ARG: Set brightness failed because of an invalid argument
+ *      - ESP_ERR_NOT_SUPPORTED: The backend has no color scale stage
+ *      - ESP_FAIL: Set brightness failed because other error occurred
+ */
+esp_err_t led_strip_set_brightness(led_strip_handle_t strip, uint8_t brightness);
+
+/**
+ * @brief Set the 5-bit global brightness of a specific pixel of a clocked LED model (APA102, SK9822)
+ *
+ * @note The LED scales its PWM by brightness / 31 on top of the color, which gives low levels more steps than dimming
+ *       the color bytes. Pixels start at 31. The color set by led_strip_set_pixel() does not change it.
+ *
+ * @param strip: LED strip
+ * @param index: index of pixel to set
+ * @param brightness: global brightness, 0 to 31
+ *
+ * @return
+ *      - ESP_OK: Set global brightness successfully
+ *      - ESP_ERR_INVALID_ARG: Set global brightness failed because of an invalid argument
+ *      - ESP_ERR_NOT_SUPPORTED: The LED model or the backend has no global brightness
+ */
+esp_err_t led_strip_set_pixel_global_brightness(led_strip_handle_t strip, uint32_t index, uint8_t brightness);
+
 /**
  * @brief Refresh memory colors to LEDs
  *
@@ -81,6 +202,9 @@ esp_err_t led_strip_set_pixel_hsv(led_strip_handle_t strip, uint32_t index, uint
  *
  * @note:
  *      After updating the LED colors in the memory, a following invocation of this API is needed to flush colors to strip.
+ *      The RMT and SPI backends only send the pixels up to the highest one set since the last refresh,
+ *      and return at once without sending anything if no pixel was set. A high depth RMT strip also sends the
+ *      pixels that are still dithering.
  */
 esp_err_t led_strip_refresh(led_strip_handle_t strip);
 
@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "led_strip_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LED_STRIP_PARALLEL_MAX_STRIPS 16 /*!< Maximum number of strips driven by one parallel bus */
+
+/**
+ * @brief LED Strip parallel (I80 LCD bus) specific configuration
+ */
+typedef struct {
+    size_t strip_count;         /*!< Number of strips, 8 or 16. It is also the bus width */
+    int strip_gpio_nums[LED_STRIP_PARALLEL_MAX_STRIPS]; /*!< Data line of each strip, strip i is driven by data line i of the bus */
+    int clk_gpio_num;           /*!< Free GPIO for the bus write clock, it must not be connected to the strips */
+    int dc_gpio_num;            /*!< Free GPIO for the bus D/C line, it must not be connected to the strips */
+} led_strip_parallel_config_t;
+
+/**
+ * @brief Create LED strips driven in parallel from one I80 LCD bus (LCD peripheral on ESP32-S3, I2S on ESP32 and ESP32-S2)
+ *
+ * All the strips share one DMA buffer and are sent out in a single transfer. They share max_leds, led_pixel_format
+ * and led_model of the led_config, strip_gpio_num is not used. Each returned handle works with the usual led_strip_* API;
+ * refreshing any of them sends all the strips of the bus at once.
+ *
+ * @note Strips of the same bus share memory, do not update them from different tasks at the same time.
+ *
+ * @param led_config LED strip configuration
+ * @param parallel_config Parallel bus specific configuration
+ * @param ret_strips Returned LED strip handles, an array of parallel_config->strip_count
+ * @return
+ *      - ESP_OK: create LED strips successfully
+ *      - ESP_ERR_INVALID_ARG: create LED strips failed because of invalid argument
+ *      - ESP_ERR_NO_MEM: create LED strips failed because of out of memory
+ *      - ESP_FAIL: create LED strips failed because some other error
+ */
+esp_err_t led_strip_new_parallel_devices(const led_strip_config_t *led_config, const led_strip_parallel_config_t *parallel_config, led_strip_handle_t *ret_strips);
+
+#ifdef __cplusplus
+}
+#endif
@@ -31,7 +31,16 @@ typedef struct {
     size_t mem_block_symbols;   /*!< How many RMT symbols can one RMT channel hold at one time. Set to 0 will fallback to use the default size. */
     struct {
         uint32_t with_dma: 1;   /*!< Use DMA to transmit data */
+        uint32_t async_refresh: 1; /*!< led_strip_refresh() returns once the frame is queued, pixels of the next frame go to a second buffer. IDF v5.0 and above only */
+        uint32_t pixels_in_psram: 1; /*!< Keep the pixels in PSRAM, the encoder streams them through its internal chunk. IDF v5.0 and above only, not with CONFIG_RMT_ISR_IRAM_SAFE */
+        uint32_t high_depth: 1; /*!< Keep 16 bits per color component, set by led_strip_set_pixels_16bit(). The encoder dithers them to the 8 bits of the LEDs over the refreshes, carrying the fraction of each component to the next frame. Doubles the pixel memory, adds one byte of internal RAM per component. IDF v5.0 and above only */
+        uint32_t dma_frame: 1;  /*!< Size the DMA buffer of the channel for the whole frame, which is encoded in one go by led_strip_refresh(), so the RMT interrupt has nothing to refill. Needs with_dma, overrides mem_block_symbols. Takes 96 (GRB) or 128 (GRBW) bytes of internal DMA memory per LED */
     } flags;                    /*!< Extra driver flags */
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    led_strip_refresh_done_cb_t on_refresh_done; /*!< Called from ISR context when a frame has been sent out, can be NULL */
+    void *user_ctx;             /*!< User context passed to on_refresh_done */
+    size_t encoder_chunk_bytes; /*!< Pixel bytes the encoder expands at a time in the RMT ISR, 0 for the default (16). Each byte takes 32 bytes of internal RAM */
+#endif
 } led_strip_rmt_config_t;
 
 /**
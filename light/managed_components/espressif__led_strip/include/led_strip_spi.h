@@ -22,7 +22,12 @@ typedef struct {
     spi_host_device_t spi_bus;  /*!< SPI bus ID. Which buses are available depends on the specific chip */
     struct {
         uint32_t with_dma: 1;   /*!< Use DMA to transmit data */
+        uint32_t async_refresh: 1; /*!< led_strip_refresh() returns once the frame is queued, pixels of the next frame go to a second buffer */
+        uint32_t pixels_in_psram: 1; /*!< Keep plain pixels in PSRAM and encode them on refresh through a small internal DMA staging buffer. Needs with_dma, not with async_refresh */
     } flags;                    /*!< Extra driver flags */
+    uint32_t staging_pixels;    /*!< Pixels per staging chunk when pixels_in_psram is set, two chunks are allocated. Set to 0 will fallback to use the default size (32) */
+    int clk_gpio_num;           /*!< GPIO of the clock line of clocked LED models (APA102, SK9822), not used by the others */
+    uint32_t clock_speed_hz;    /*!< SPI clock of clocked LED models. Set to 0 will fallback to use the default speed (10MHz) */
 } led_strip_spi_config_t;
 
 /**
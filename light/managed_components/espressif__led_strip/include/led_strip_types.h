@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -20,6 +21,17 @@ typedef enum {
     LED_PIXEL_FORMAT_INVALID /*!< Invalid pixel format */
 } led_pixel_format_t;
 
+/**
+ * @brief Layout of the pixel data given to led_strip_set_pixels, one byte per color component
+ */
+typedef enum {
+    LED_STRIP_DATA_FORMAT_RGB,    /*!< 3 bytes per pixel: red, green, blue */
+    LED_STRIP_DATA_FORMAT_GRB,    /*!< 3 bytes per pixel: green, red, blue */
+    LED_STRIP_DATA_FORMAT_RGBW,   /*!< 4 bytes per pixel: red, green, blue, white */
+    LED_STRIP_DATA_FORMAT_GRBW,   /*!< 4 bytes per pixel: green, red, blue, white */
+    LED_STRIP_DATA_FORMAT_INVALID /*!< Invalid data format */
+} led_strip_data_format_t;
+
 /**
  * @brief LED strip model
  * @note Different led model may have different timing parameters, so we need to distinguish them.
@@ -27,6 +39,8 @@ typedef enum {
 typedef enum {
     LED_MODEL_WS2812, /*!< LED strip model: WS2812 */
     LED_MODEL_SK6812, /*!< LED strip model: SK6812 */
+    LED_MODEL_APA102, /*!< LED strip model: APA102, clocked, SPI backend only */
+    LED_MODEL_SK9822, /*!< LED strip model: SK9822, clocked, SPI backend only */
     LED_MODEL_INVALID /*!< Invalid LED strip model */
 } led_model_t;
 
@@ -35,6 +49,15 @@ typedef enum {
  */
 typedef struct led_strip_t *led_strip_handle_t;
 
+/**
+ * @brief Callback invoked when a refreshed frame has been sent out, called from ISR context
+ *
+ * @param strip LED strip handle
+ * @param user_ctx User context given in the backend configuration
+ * @return Whether a high priority task has been woken up by this callback
+ */
+typedef bool (*led_strip_refresh_done_cb_t)(led_strip_handle_t strip, void *user_ctx);
+
 /**
  * @brief LED Strip Configuration
  */
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "esp_err.h"
+#include "led_strip_types.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -88,6 +89,85 @@ struct led_strip_t {
      *      - ESP_FAIL: Free resources failed because error occurred
      */
     esp_err_t (*del)(led_strip_t *strip);
+
+    /**
+     * @brief Set a span of pixels from a packed buffer, optional
+     *
+     * @param strip: LED strip
+     * @param start: index of the first pixel to set
+     * @param count: number of pixels to set
+     * @param data: packed pixel data in the given format
+     * @param format: layout of the pixel data
+     *
+     * @return
+     *      - ESP_OK: Set pixels successfully
+     *      - ESP_ERR_INVALID_ARG: Set pixels failed because of an invalid argument
+     *
+     * @note:
+     *      Backends leaving it NULL get the pixels one by one through `set_pixel` and `set_pixel_rgbw`.
+     */
+    esp_err_t (*set_pixels)(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format);
+
+    /**
+     * @brief Set a span of pixels from a packed buffer of 16-bit components, optional
+     *
+     * @param strip: LED strip
+     * @param start: index of the first pixel to set
+     * @param count: number of pixels to set
+     * @param data: packed pixel data in the given format, one uint16_t per component
+     * @param format: layout of the pixel data
+     *
+     * @return
+     *      - ESP_OK: Set pixels successfully
+     *      - ESP_ERR_INVALID_ARG: Set pixels failed because of an invalid argument
+     *
+     * @note:
+     *      Backends leaving it NULL get the pixels rounded to 8 bits, one by one through `set_pixel` and `set_pixel_rgbw`.
+     */
+    esp_err_t (*set_pixels_16bit)(led_strip_t *strip, uint32_t start, uint32_t count, const uint16_t *data, led_strip_data_format_t format);
+
+    /**
+     * @brief Get the memory of a span of pixels, in the order the LEDs expect (GRB or GRBW), optional
+     *
+     * @param strip: LED strip
+     * @param start: index of the first pixel
+     * @param count: number of pixels that are going to be written
+     * @param buf: returned pointer to the first pixel
+     *
+     * @return
+     *      - ESP_OK: Get pixel memory successfully
+     *      - ESP_ERR_INVALID_ARG: Get pixel memory failed because of an invalid argument
+     */
+    esp_err_t (*get_pixel_buf)(led_strip_t *strip, uint32_t start, uint32_t count, uint8_t **buf);
+
+    /**
+     * @brief Set the scale applied to every color component when the pixels are encoded, optional
+     *
+     * @param strip: LED strip
+     * @param red: scale of the red component, 255 leaves it unchanged
+     * @param green: scale of the green component, 255 leaves it unchanged
+     * @param blue: scale of the blue component, 255 leaves it unchanged
+     * @param white: scale of the white component, 255 leaves it unchanged
+     *
+     * @return
+     *      - ESP_OK: Set color scale successfully
+     *      - ESP_FAIL: Set color scale failed because other error occurred
+     */
+    esp_err_t (*set_color_scale)(led_strip_t *strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white);
+
+    /**
+     * @brief Set the global brightness of a specific pixel of a clocked LED model, optional
+     *
+     * @param strip: LED strip
+     * @param index: index of pixel to set
+     * @param brightness: global brightness, 0 to 31
+     *
+     * @return
+     *      - ESP_OK: Set global brightness successfully
+     *      - ESP_ERR_INVALID_ARG: Set global brightness failed because of an invalid argument
+     *      - ESP_ERR_NOT_SUPPORTED: The LED model has no global brightness
+     */
+    esp_err_t (*set_pixel_global_brightness)(led_strip_t *strip, uint32_t index, uint8_t brightness);
 };
 
 #ifdef __cplusplus
@@ -3,13 +3,27 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_check.h"
+#include "sdkconfig.h"
 #include "led_strip.h"
 #include "led_strip_interface.h"
 
 static const char *TAG = "led_strip";
 
+#if CONFIG_DIAG_ENABLE_TRACE
+/* Weak, so that the events are only recorded when the application links the esp_diagnostics trace */
+extern void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg) __attribute__((weak));
+#define LED_STRIP_TRACE(phase, arg) do {                            \
+        if (esp_diag_trace_record) {                                \
+            esp_diag_trace_record("led_strip_refresh", phase, arg); \
+        }                                                           \
+    } while (0)
+#else
+#define LED_STRIP_TRACE(phase, arg)
+#endif
+
 esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
@@ -75,10 +89,89 @@ esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uin
     return strip->set_pixel_rgbw(strip, index, red, green, blue, white);
 }
 
+esp_err_t led_strip_set_pixels(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format)
+{
+    ESP_RETURN_ON_FALSE(strip && data && format < LED_STRIP_DATA_FORMAT_INVALID, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (strip->set_pixels) {
+        return strip->set_pixels(strip, start, count, data, format);
+    }
+
+    // the backend has no bulk path, hand over the pixels one by one
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+        uint8_t red = red_first ? data[0] : data[1];
+        uint8_t green = red_first ? data[1] : data[0];
+        if (has_white) {
+            ESP_RETURN_ON_ERROR(strip->set_pixel_rgbw(strip, start + i, red, green, data[2], data[3]), TAG, "set pixel %"PRIu32" failed", start + i);
+        } else {
+            ESP_RETURN_ON_ERROR(strip->set_pixel(strip, start + i, red, green, data[2]), TAG, "set pixel %"PRIu32" failed", start + i);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixels_16bit(led_strip_handle_t strip, uint32_t start, uint32_t count, const uint16_t *data, led_strip_data_format_t format)
+{
+    ESP_RETURN_ON_FALSE(strip && data && format < LED_STRIP_DATA_FORMAT_INVALID, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    if (strip->set_pixels_16bit) {
+        return strip->set_pixels_16bit(strip, start, count, data, format);
+    }
+
+    // the backend only has 8 bits per component, round to the nearest level
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    uint8_t levels[4];
+    for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+        for (uint8_t c = 0; c < data_bpp; c++) {
+            levels[c] = (data[c] - (data[c] >> 8) + 128) >> 8;
+        }
+        uint8_t red = red_first ? levels[0] : levels[1];
+        uint8_t green = red_first ? levels[1] : levels[0];
+        if (has_white) {
+            ESP_RETURN_ON_ERROR(strip->set_pixel_rgbw(strip, start + i, red, green, levels[2], levels[3]), TAG, "set pixel %"PRIu32" failed", start + i);
+        } else {
+            ESP_RETURN_ON_ERROR(strip->set_pixel(strip, start + i, red, green, levels[2]), TAG, "set pixel %"PRIu32" failed", start + i);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t led_strip_get_pixel_buf(led_strip_handle_t strip, uint32_t start, uint32_t count, uint8_t **buf)
+{
+    ESP_RETURN_ON_FALSE(strip && buf, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(strip->get_pixel_buf, ESP_ERR_NOT_SUPPORTED, TAG, "pixel memory is not in LED order for this backend");
+    return strip->get_pixel_buf(strip, start, count, buf);
+}
+
+esp_err_t led_strip_set_color_scale(led_strip_handle_t strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white)
+{
+    ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(strip->set_color_scale, ESP_ERR_NOT_SUPPORTED, TAG, "color scale is not supported by this backend");
+    return strip->set_color_scale(strip, red, green, blue, white);
+}
+
+esp_err_t led_strip_set_brightness(led_strip_handle_t strip, uint8_t brightness)
+{
+    return led_strip_set_color_scale(strip, brightness, brightness, brightness, brightness);
+}
+
+esp_err_t led_strip_set_pixel_global_brightness(led_strip_handle_t strip, uint32_t index, uint8_t brightness)
+{
+    ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(strip->set_pixel_global_brightness, ESP_ERR_NOT_SUPPORTED, TAG, "global brightness is not supported by this backend");
+    return strip->set_pixel_global_brightness(strip, index, brightness);
+}
+
 esp_err_t led_strip_refresh(led_strip_handle_t strip)
 {
     ESP_RETURN_ON_FALSE(strip, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
-    return strip->refresh(strip);
+    LED_STRIP_TRACE('B', 0);
+    esp_err_t ret = strip->refresh(strip);
+    LED_STRIP_TRACE('E', ret);
+    return ret;
 }
 
 esp_err_t led_strip_clear(led_strip_handle_t strip)
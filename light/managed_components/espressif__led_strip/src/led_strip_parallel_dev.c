@@ -0,0 +1,288 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/cdefs.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_lcd_panel_io.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "led_strip.h"
+#include "led_strip_interface.h"
+
+// Same timing as the SPI backend: each bit of a color takes 3 bus cycles, low_level:100 ,high_level:110
+#define LED_STRIP_PARALLEL_DEFAULT_RESOLUTION (2500 * 1000) // 2.5MHz bus clock
+#define LED_STRIP_PARALLEL_TRANS_QUEUE_SIZE 1
+#define CYCLES_PER_COLOR_BIT 3
+#define CYCLES_PER_COLOR_BYTE (CYCLES_PER_COLOR_BIT * 8)
+// idle low for 280us after the frame, as the other backends do
+#define RESET_CYCLES (LED_STRIP_PARALLEL_DEFAULT_RESOLUTION / 1000 * 280 / 1000)
+
+#define LED_STRIP_SCALE(value, scale) (((value) * (scale) + 127) / 255)
+
+static const char *TAG = "led_strip_parallel";
+
+typedef struct led_strip_parallel_bus_t led_strip_parallel_bus_t;
+
+typedef struct {
+    led_strip_t base;
+    led_strip_parallel_bus_t *bus;
+    uint8_t lane;
+    bool deleted;
+    uint8_t scale[4];           // brightness and white balance of each color component, in the order of GRBW
+} led_strip_parallel_obj;
+
+struct led_strip_parallel_bus_t {
+    esp_lcd_i80_bus_handle_t i80_bus;
+    esp_lcd_panel_io_handle_t io;
+    SemaphoreHandle_t done_sem;
+    uint32_t strip_len;
+    uint8_t bytes_per_pixel;
+    uint8_t bus_width;          // 8 or 16, one data line per strip
+    uint8_t strips_alive;
+    size_t buf_size;
+    uint8_t *buf;               // one bus word per cycle, DMA capable
+    led_strip_parallel_obj strips[];
+};
+
+static bool led_strip_parallel_trans_done(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_io_event_data_t *edata, void *user_ctx)
+{
+    led_strip_parallel_bus_t *bus = (led_strip_parallel_bus_t *)user_ctx;
+    BaseType_t high_task_woken = pdFALSE;
+    xSemaphoreGiveFromISR(bus->done_sem, &high_task_woken);
+    return high_task_woken == pdTRUE;
+}
+
+// Only the middle cycle of a bit carries data, the first one is always high and the last one always low
+static void led_strip_parallel_put_byte(led_strip_parallel_bus_t *bus, uint8_t lane, size_t byte_index, uint8_t data)
+{
+    size_t cycle = byte_index * CYCLES_PER_COLOR_BYTE + 1;
+    if (bus->bus_width == 8) {
+        uint8_t *word = bus->buf;
+        for (int bit = 7; bit >= 0; bit--, cycle += CYCLES_PER_COLOR_BIT) {
+            word[cycle] = (word[cycle] & ~BIT(lane)) | (((data >> bit) & 1) << lane);
+        }
+    } else {
+        uint16_t *word = (uint16_t *)bus->buf;
+        for (int bit = 7; bit >= 0; bit--, cycle += CYCLES_PER_COLOR_BIT) {
+            word[cycle] = (word[cycle] & ~BIT(lane)) | (((data >> bit) & 1) << lane);
+        }
+    }
+}
+
+// color components are scaled on their way into the bus words
+static inline void led_strip_parallel_put_component(led_strip_parallel_obj *parallel_strip, int component, size_t byte_index, uint8_t data)
+{
+    led_strip_parallel_put_byte(parallel_strip->bus, parallel_strip->lane, byte_index, LED_STRIP_SCALE(data, parallel_strip->scale[component]));
+}
+
+static esp_err_t led_strip_parallel_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+    ESP_RETURN_ON_FALSE(index < bus->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    size_t start = index * bus->bytes_per_pixel;
+    // In thr order of GRB, as LED strip like WS2812 sends out pixels in this order
+    led_strip_parallel_put_component(parallel_strip, 0, start + 0, green & 0xFF);
+    led_strip_parallel_put_component(parallel_strip, 1, start + 1, red & 0xFF);
+    led_strip_parallel_put_component(parallel_strip, 2, start + 2, blue & 0xFF);
+    if (bus->bytes_per_pixel > 3) {
+        led_strip_parallel_put_byte(bus, parallel_strip->lane, start + 3, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_parallel_set_pixel_rgbw(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue, uint32_t white)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+    ESP_RETURN_ON_FALSE(index < bus->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    ESP_RETURN_ON_FALSE(bus->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    size_t start = index * 4;
+    // SK6812 component order is GRBW
+    led_strip_parallel_put_component(parallel_strip, 0, start + 0, green & 0xFF);
+    led_strip_parallel_put_component(parallel_strip, 1, start + 1, red & 0xFF);
+    led_strip_parallel_put_component(parallel_strip, 2, start + 2, blue & 0xFF);
+    led_strip_parallel_put_component(parallel_strip, 3, start + 3, white & 0xFF);
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_parallel_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+    ESP_RETURN_ON_FALSE(start <= bus->strip_len && count <= bus->strip_len - start, ESP_ERR_INVALID_ARG, TAG, "pixels out of maximum number of LEDs");
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    ESP_RETURN_ON_FALSE(!has_white || bus->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    size_t byte_index = start * bus->bytes_per_pixel;
+    for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+        led_strip_parallel_put_component(parallel_strip, 0, byte_index++, red_first ? data[1] : data[0]);
+        led_strip_parallel_put_component(parallel_strip, 1, byte_index++, red_first ? data[0] : data[1]);
+        led_strip_parallel_put_component(parallel_strip, 2, byte_index++, data[2]);
+        if (bus->bytes_per_pixel > 3) {
+            led_strip_parallel_put_component(parallel_strip, 3, byte_index++, has_white ? data[3] : 0);
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_parallel_set_color_scale(led_strip_t *strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    // pixels are encoded when they are set, the scale applies to the pixels set from now on
+    parallel_strip->scale[0] = green;
+    parallel_strip->scale[1] = red;
+    parallel_strip->scale[2] = blue;
+    parallel_strip->scale[3] = white;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_parallel_refresh(led_strip_t *strip)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+
+    // no command phase, the whole buffer is color data
+    ESP_RETURN_ON_ERROR(esp_lcd_panel_io_tx_color(bus->io, -1, bus->buf, bus->buf_size), TAG, "transmit pixels by LCD bus failed");
+    xSemaphoreTake(bus->done_sem, portMAX_DELAY);
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_parallel_clear(led_strip_t *strip)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+    // Write zero to turn off all leds of this strip, the other strips of the bus keep their colors
+    for (size_t i = 0; i < bus->strip_len * bus->bytes_per_pixel; i++) {
+        led_strip_parallel_put_byte(bus, parallel_strip->lane, i, 0);
+    }
+    return led_strip_parallel_refresh(strip);
+}
+
+static void led_strip_parallel_free_bus(led_strip_parallel_bus_t *bus)
+{
+    if (bus->io) {
+        esp_lcd_panel_io_del(bus->io);
+    }
+    if (bus->i80_bus) {
+        esp_lcd_del_i80_bus(bus->i80_bus);
+    }
+    if (bus->done_sem) {
+        vSemaphoreDelete(bus->done_sem);
+    }
+    heap_caps_free(bus->buf);
+    free(bus);
+}
+
+static esp_err_t led_strip_parallel_del(led_strip_t *strip)
+{
+    led_strip_parallel_obj *parallel_strip = __containerof(strip, led_strip_parallel_obj, base);
+    led_strip_parallel_bus_t *bus = parallel_strip->bus;
+    ESP_RETURN_ON_FALSE(!parallel_strip->deleted, ESP_ERR_INVALID_STATE, TAG, "strip already deleted");
+    parallel_strip->deleted = true;
+    // the bus goes away with its last strip
+    if (--bus->strips_alive == 0) {
+        led_strip_parallel_free_bus(bus);
+    }
+    return ESP_OK;
+}
+
+esp_err_t led_strip_new_parallel_devices(const led_strip_config_t *led_config, const led_strip_parallel_config_t *parallel_config, led_strip_handle_t *ret_strips)
+{
+    led_strip_parallel_bus_t *bus = NULL;
+    esp_err_t ret = ESP_OK;
+    ESP_GOTO_ON_FALSE(led_config && parallel_config && ret_strips, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
+    ESP_GOTO_ON_FALSE(led_config->led_pixel_format < LED_PIXEL_FORMAT_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led_pixel_format");
+    ESP_GOTO_ON_FALSE(parallel_config->strip_count == 8 || parallel_config->strip_count == 16, ESP_ERR_INVALID_ARG, err, TAG, "strip_count must be 8 or 16");
+    ESP_GOTO_ON_FALSE(led_config->led_model == LED_MODEL_WS2812 || led_config->led_model == LED_MODEL_SK6812, ESP_ERR_NOT_SUPPORTED, err, TAG,
+                      "clocked LED models need the SPI backend");
+    uint8_t bytes_per_pixel = 3;
+    if (led_config->led_pixel_format == LED_PIXEL_FORMAT_GRBW) {
+        bytes_per_pixel = 4;
+    } else if (led_config->led_pixel_format == LED_PIXEL_FORMAT_GRB) {
+        bytes_per_pixel = 3;
+    } else {
+        assert(false);
+    }
+    uint8_t bus_width = parallel_config->strip_count;
+    size_t data_cycles = led_config->max_leds * bytes_per_pixel * CYCLES_PER_COLOR_BYTE;
+    size_t buf_size = (data_cycles + RESET_CYCLES) * (bus_width / 8);
+
+    bus = calloc(1, sizeof(led_strip_parallel_bus_t) + parallel_config->strip_count * sizeof(led_strip_parallel_obj));
+    ESP_GOTO_ON_FALSE(bus, ESP_ERR_NO_MEM, err, TAG, "no mem for parallel strips");
+    // DMA buffer must be placed in internal SRAM, calloc leaves the reset cycles low
+    bus->buf = heap_caps_calloc(1, buf_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    ESP_GOTO_ON_FALSE(bus->buf, ESP_ERR_NO_MEM, err, TAG, "no mem for parallel strip buffer");
+    bus->done_sem = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(bus->done_sem, ESP_ERR_NO_MEM, err, TAG, "no mem for parallel strip semaphore");
+    bus->strip_len = led_config->max_leds;
+    bus->bytes_per_pixel = bytes_per_pixel;
+    bus->bus_width = bus_width;
+    bus->buf_size = buf_size;
+
+    // the first cycle of every bit is high on all the data lines
+    for (size_t cycle = 0; cycle < data_cycles; cycle += CYCLES_PER_COLOR_BIT) {
+        if (bus_width == 8) {
+            bus->buf[cycle] = 0xFF;
+        } else {
+            ((uint16_t *)bus->buf)[cycle] = 0xFFFF;
+        }
+    }
+
+    esp_lcd_i80_bus_config_t bus_config = {
+        .clk_src = LCD_CLK_SRC_DEFAULT,
+        .dc_gpio_num = parallel_config->dc_gpio_num,
+        .wr_gpio_num = parallel_config->clk_gpio_num,
+        .bus_width = bus_width,
+        .max_transfer_bytes = buf_size,
+    };
+    for (size_t i = 0; i < bus_width; i++) {
+        bus_config.data_gpio_nums[i] = parallel_config->strip_gpio_nums[i];
+    }
+    ESP_GOTO_ON_ERROR(esp_lcd_new_i80_bus(&bus_config, &bus->i80_bus), err, TAG, "create I80 bus failed");
+
+    esp_lcd_panel_io_i80_config_t io_config = {
+        .cs_gpio_num = -1,
+        .pclk_hz = LED_STRIP_PARALLEL_DEFAULT_RESOLUTION,
+        .trans_queue_depth = LED_STRIP_PARALLEL_TRANS_QUEUE_SIZE,
+        .on_color_trans_done = led_strip_parallel_trans_done,
+        .user_ctx = bus,
+        .lcd_cmd_bits = 8,
+        .lcd_param_bits = 8,
+    };
+    ESP_GOTO_ON_ERROR(esp_lcd_new_panel_io_i80(bus->i80_bus, &io_config, &bus->io), err, TAG, "create I80 panel IO failed");
+
+    // the strips are not inverted
+    if (led_config->flags.invert_out) {
+        ESP_LOGW(TAG, "invert_out is not supported by the parallel backend");
+    }
+
+    for (size_t i = 0; i < parallel_config->strip_count; i++) {
+        led_strip_parallel_obj *parallel_strip = &bus->strips[i];
+        parallel_strip->bus = bus;
+        parallel_strip->lane = i;
+        parallel_strip->base.set_pixel = led_strip_parallel_set_pixel;
+        parallel_strip->base.set_pixel_rgbw = led_strip_parallel_set_pixel_rgbw;
+        parallel_strip->base.refresh = led_strip_parallel_refresh;
+        parallel_strip->base.clear = led_strip_parallel_clear;
+        parallel_strip->base.del = led_strip_parallel_del;
+        parallel_strip->base.set_pixels = led_strip_parallel_set_pixels;
+        parallel_strip->base.set_color_scale = led_strip_parallel_set_color_scale;
+        memset(parallel_strip->scale, 0xFF, sizeof(parallel_strip->scale));
+        ret_strips[i] = &parallel_strip->base;
+    }
+    bus->strips_alive = parallel_config->strip_count;
+    return ESP_OK;
+err:
+    if (bus) {
+        led_strip_parallel_free_bus(bus);
+    }
+    return ret;
+}
@@ -8,6 +8,7 @@
 #include <sys/cdefs.h>
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "driver/rmt_tx.h"
 #include "led_strip.h"
 #include "led_strip_interface.h"
@@ -21,6 +22,8 @@
 #else
 #define LED_STRIP_RMT_DEFAULT_MEM_BLOCK_SYMBOLS 48
 #endif
+// every bit of the frame, the reset code and the end marker of the RMT driver, rounded up to the two halves of the DMA buffer
+#define LED_STRIP_RMT_FRAME_SYMBOLS(leds, bytes_per_pixel) (((leds) * (bytes_per_pixel) * 8 + 2 + 1) & ~1)
 
 static const char *TAG = "led_strip_rmt";
 
@@ -29,21 +32,57 @@ typedef struct {
     rmt_channel_handle_t rmt_chan;
     rmt_encoder_handle_t strip_encoder;
     uint32_t strip_len;
+    uint32_t dirty_len; // pixels [0, dirty_len) changed since the last refresh
     uint8_t bytes_per_pixel;
-    uint8_t pixel_buf[];
+    uint8_t component_size; // 2 for high depth pixels, uint16_t components dithered by the encoder
+    bool async_refresh;
+    led_strip_refresh_done_cb_t on_refresh_done;
+    void *user_ctx;
+    uint8_t *draw_buf; // the frame set_pixel writes to, in async mode the other half of pixel_buf may be on the wire
+    uint8_t *pixel_buf; // the frame(s), right after the object or in PSRAM
+    uint8_t internal_buf[];
 } led_strip_rmt_obj;
 
+static bool led_strip_rmt_trans_done(rmt_channel_handle_t tx_chan, const rmt_tx_done_event_data_t *edata, void *user_ctx)
+{
+    led_strip_rmt_obj *rmt_strip = (led_strip_rmt_obj *)user_ctx;
+    return rmt_strip->on_refresh_done(&rmt_strip->base, rmt_strip->user_ctx);
+}
+
+// an 8-bit value v is v * 257 in 16 bits, the encoder sends it as v without any dithering
+#define LED_STRIP_RMT_TO_16BIT(value) ((uint16_t)((value) & 0xFF) * 257)
+// round to the nearest 8-bit value, the inverse of LED_STRIP_RMT_TO_16BIT
+#define LED_STRIP_RMT_TO_8BIT(value) ((uint8_t)(((value) - ((value) >> 8) + 128) >> 8))
+
+static void led_strip_rmt_set_pixel_16bit(led_strip_rmt_obj *rmt_strip, uint32_t index, uint16_t green, uint16_t red, uint16_t blue, uint16_t white)
+{
+    uint16_t *buf = (uint16_t *)rmt_strip->draw_buf + index * rmt_strip->bytes_per_pixel;
+    buf[0] = green;
+    buf[1] = red;
+    buf[2] = blue;
+    if (rmt_strip->bytes_per_pixel > 3) {
+        buf[3] = white;
+    }
+}
+
 static esp_err_t led_strip_rmt_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     ESP_RETURN_ON_FALSE(index < rmt_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
     uint32_t start = index * rmt_strip->bytes_per_pixel;
+    if (index >= rmt_strip->dirty_len) {
+        rmt_strip->dirty_len = index + 1;
+    }
+    if (rmt_strip->component_size > 1) {
+        led_strip_rmt_set_pixel_16bit(rmt_strip, index, LED_STRIP_RMT_TO_16BIT(green), LED_STRIP_RMT_TO_16BIT(red), LED_STRIP_RMT_TO_16BIT(blue), 0);
+        return ESP_OK;
+    }
     // In thr order of GRB, as LED strip like WS2812 sends out pixels in this order
-    rmt_strip->pixel_buf[start + 0] = green & 0xFF;
-    rmt_strip->pixel_buf[start + 1] = red & 0xFF;
-    rmt_strip->pixel_buf[start + 2] = blue & 0xFF;
+    rmt_strip->draw_buf[start + 0] = green & 0xFF;
+    rmt_strip->draw_buf[start + 1] = red & 0xFF;
+    rmt_strip->draw_buf[start + 2] = blue & 0xFF;
     if (rmt_strip->bytes_per_pixel > 3) {
-        rmt_strip->pixel_buf[start + 3] = 0;
+        rmt_strip->draw_buf[start + 3] = 0;
     }
     return ESP_OK;
 }
@@ -53,7 +92,15 @@ static esp_err_t led_strip_rmt_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     ESP_RETURN_ON_FALSE(index < rmt_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
     ESP_RETURN_ON_FALSE(rmt_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
-    uint8_t *buf_start = rmt_strip->pixel_buf + index * 4;
+    uint8_t *buf_start = rmt_strip->draw_buf + index * 4;
+    if (index >= rmt_strip->dirty_len) {
+        rmt_strip->dirty_len = index + 1;
+    }
+    if (rmt_strip->component_size > 1) {
+        led_strip_rmt_set_pixel_16bit(rmt_strip, index, LED_STRIP_RMT_TO_16BIT(green), LED_STRIP_RMT_TO_16BIT(red),
+                                      LED_STRIP_RMT_TO_16BIT(blue), LED_STRIP_RMT_TO_16BIT(white));
+        return ESP_OK;
+    }
     // SK6812 component order is GRBW
     *buf_start = green & 0xFF;
     *++buf_start = red & 0xFF;
@@ -62,18 +109,151 @@ static esp_err_t led_strip_rmt_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     return ESP_OK;
 }
 
+static esp_err_t led_strip_rmt_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    ESP_RETURN_ON_FALSE(start <= rmt_strip->strip_len && count <= rmt_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG, "pixels out of maximum number of LEDs");
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    ESP_RETURN_ON_FALSE(!has_white || rmt_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    if (count == 0) {
+        return ESP_OK;
+    }
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    if (rmt_strip->component_size > 1) {
+        for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+            led_strip_rmt_set_pixel_16bit(rmt_strip, start + i, LED_STRIP_RMT_TO_16BIT(red_first ? data[1] : data[0]),
+                                          LED_STRIP_RMT_TO_16BIT(red_first ? data[0] : data[1]), LED_STRIP_RMT_TO_16BIT(data[2]),
+                                          has_white ? LED_STRIP_RMT_TO_16BIT(data[3]) : 0);
+        }
+    } else if ((format == LED_STRIP_DATA_FORMAT_GRB && rmt_strip->bytes_per_pixel == 3) || format == LED_STRIP_DATA_FORMAT_GRBW) {
+        uint8_t *buf = rmt_strip->draw_buf + start * rmt_strip->bytes_per_pixel;
+        // already in the order of the LEDs
+        memcpy(buf, data, count * rmt_strip->bytes_per_pixel);
+    } else {
+        uint8_t *buf = rmt_strip->draw_buf + start * rmt_strip->bytes_per_pixel;
+        for (uint32_t i = 0; i < count; i++, data += data_bpp, buf += rmt_strip->bytes_per_pixel) {
+            buf[0] = red_first ? data[1] : data[0];
+            buf[1] = red_first ? data[0] : data[1];
+            buf[2] = data[2];
+            if (rmt_strip->bytes_per_pixel > 3) {
+                buf[3] = has_white ? data[3] : 0;
+            }
+        }
+    }
+    if (start + count > rmt_strip->dirty_len) {
+        rmt_strip->dirty_len = start + count;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_set_pixels_16bit(led_strip_t *strip, uint32_t start, uint32_t count, const uint16_t *data, led_strip_data_format_t format)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    ESP_RETURN_ON_FALSE(start <= rmt_strip->strip_len && count <= rmt_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG, "pixels out of maximum number of LEDs");
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    ESP_RETURN_ON_FALSE(!has_white || rmt_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    if (count == 0) {
+        return ESP_OK;
+    }
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    if (rmt_strip->component_size > 1 && !red_first && data_bpp == rmt_strip->bytes_per_pixel) {
+        // already in the order of the LEDs
+        memcpy((uint16_t *)rmt_strip->draw_buf + start * data_bpp, data, count * data_bpp * sizeof(uint16_t));
+    } else {
+        for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+            uint16_t green = red_first ? data[1] : data[0];
+            uint16_t red = red_first ? data[0] : data[1];
+            uint16_t white = has_white ? data[3] : 0;
+            if (rmt_strip->component_size > 1) {
+                led_strip_rmt_set_pixel_16bit(rmt_strip, start + i, green, red, data[2], white);
+                continue;
+            }
+            // no dithering stage, the components are rounded to 8 bits
+            uint8_t *buf = rmt_strip->draw_buf + (start + i) * rmt_strip->bytes_per_pixel;
+            buf[0] = LED_STRIP_RMT_TO_8BIT(green);
+            buf[1] = LED_STRIP_RMT_TO_8BIT(red);
+            buf[2] = LED_STRIP_RMT_TO_8BIT(data[2]);
+            if (rmt_strip->bytes_per_pixel > 3) {
+                buf[3] = LED_STRIP_RMT_TO_8BIT(white);
+            }
+        }
+    }
+    if (start + count > rmt_strip->dirty_len) {
+        rmt_strip->dirty_len = start + count;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_get_pixel_buf(led_strip_t *strip, uint32_t start, uint32_t count, uint8_t **buf)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    ESP_RETURN_ON_FALSE(start <= rmt_strip->strip_len && count <= rmt_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG, "pixels out of maximum number of LEDs");
+    ESP_RETURN_ON_FALSE(rmt_strip->component_size == 1, ESP_ERR_NOT_SUPPORTED, TAG, "high depth pixels are not in LED order");
+    // the caller writes the span, so it has to go out on the next refresh
+    if (start + count > rmt_strip->dirty_len) {
+        rmt_strip->dirty_len = start + count;
+    }
+    *buf = rmt_strip->draw_buf + start * rmt_strip->bytes_per_pixel;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_rmt_set_color_scale(led_strip_t *strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white)
+{
+    led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    // the scale is applied by the encoder, don't change it in the middle of a frame
+    if (rmt_strip->async_refresh) {
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
+    }
+    // in the order of the pixel bytes: GRBW
+    uint8_t scale[4] = {green, red, blue, white};
+    ESP_RETURN_ON_ERROR(rmt_led_strip_encoder_set_scale(rmt_strip->strip_encoder, scale), TAG, "set encoder scale failed");
+    // every LED changes, the next refresh sends the whole strip
+    rmt_strip->dirty_len = rmt_strip->strip_len;
+    return ESP_OK;
+}
+
 static esp_err_t led_strip_rmt_refresh(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     rmt_transmit_config_t tx_conf = {
         .loop_count = 0,
     };
+    // LEDs behind the last changed one keep their color, so the chain only has to be sent up to it.
+    // Dithered LEDs change on every frame, they are sent until none of their components has a fraction
+    uint32_t send_len = rmt_strip->dirty_len;
+    if (rmt_strip->component_size > 1) {
+        uint32_t dither_len = rmt_led_strip_encoder_get_dither_len(rmt_strip->strip_encoder);
+        if (dither_len > send_len) {
+            send_len = dither_len;
+        }
+    }
+    if (send_len == 0) {
+        return ESP_OK;
+    }
+    size_t dirty_size = send_len * rmt_strip->bytes_per_pixel * rmt_strip->component_size;
+
+    if (rmt_strip->async_refresh) {
+        size_t frame_size = rmt_strip->strip_len * rmt_strip->bytes_per_pixel * rmt_strip->component_size;
+        // the previous frame is sent out from the other buffer, it must be done before that buffer is reused
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
+        ESP_RETURN_ON_ERROR(rmt_transmit(rmt_strip->rmt_chan, rmt_strip->strip_encoder, rmt_strip->draw_buf,
+                                         dirty_size, &tx_conf), TAG, "transmit pixels by RMT failed");
+        // the other buffer holds the previous frame, which only differs in the dirty part
+        uint8_t *next_buf = rmt_strip->draw_buf == rmt_strip->pixel_buf ? rmt_strip->pixel_buf + frame_size : rmt_strip->pixel_buf;
+        memcpy(next_buf, rmt_strip->draw_buf, dirty_size);
+        rmt_strip->draw_buf = next_buf;
+        rmt_strip->dirty_len = 0;
+        return ESP_OK;
+    }
 
     ESP_RETURN_ON_ERROR(rmt_enable(rmt_strip->rmt_chan), TAG, "enable RMT channel failed");
     ESP_RETURN_ON_ERROR(rmt_transmit(rmt_strip->rmt_chan, rmt_strip->strip_encoder, rmt_strip->pixel_buf,
-                                     rmt_strip->strip_len * rmt_strip->bytes_per_pixel, &tx_conf), TAG, "transmit pixels by RMT failed");
+                                     dirty_size, &tx_conf), TAG, "transmit pixels by RMT failed");
     ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
     ESP_RETURN_ON_ERROR(rmt_disable(rmt_strip->rmt_chan), TAG, "disable RMT channel failed");
+    rmt_strip->dirty_len = 0;
     return ESP_OK;
 }
 
@@ -81,15 +261,24 @@ static esp_err_t led_strip_rmt_clear(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
     // Write zero to turn off all leds
-    memset(rmt_strip->pixel_buf, 0, rmt_strip->strip_len * rmt_strip->bytes_per_pixel);
+    memset(rmt_strip->draw_buf, 0, rmt_strip->strip_len * rmt_strip->bytes_per_pixel * rmt_strip->component_size);
+    rmt_strip->dirty_len = rmt_strip->strip_len;
     return led_strip_rmt_refresh(strip);
 }
 
 static esp_err_t led_strip_rmt_del(led_strip_t *strip)
 {
     led_strip_rmt_obj *rmt_strip = __containerof(strip, led_strip_rmt_obj, base);
+    if (rmt_strip->async_refresh) {
+        // the channel stays enabled between frames in async mode
+        ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rmt_strip->rmt_chan, -1), TAG, "flush RMT channel failed");
+        ESP_RETURN_ON_ERROR(rmt_disable(rmt_strip->rmt_chan), TAG, "disable RMT channel failed");
+    }
     ESP_RETURN_ON_ERROR(rmt_del_channel(rmt_strip->rmt_chan), TAG, "delete RMT channel failed");
     ESP_RETURN_ON_ERROR(rmt_del_encoder(rmt_strip->strip_encoder), TAG, "delete strip encoder failed");
+    if (rmt_strip->pixel_buf != rmt_strip->internal_buf) {
+        heap_caps_free(rmt_strip->pixel_buf);
+    }
     free(rmt_strip);
     return ESP_OK;
 }
@@ -108,8 +297,26 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     } else {
         assert(false);
     }
-    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + led_config->max_leds * bytes_per_pixel);
+    // async refresh keeps a second frame to draw into while the first one is on the wire
+    size_t frame_num = rmt_config->flags.async_refresh ? 2 : 1;
+    uint8_t component_size = rmt_config->flags.high_depth ? sizeof(uint16_t) : 1;
+    size_t frames_size = frame_num * led_config->max_leds * bytes_per_pixel * component_size;
+#if CONFIG_RMT_ISR_IRAM_SAFE
+    // the encoder reads the pixels from the ISR, which must keep working while the cache is disabled
+    ESP_GOTO_ON_FALSE(!rmt_config->flags.pixels_in_psram, ESP_ERR_INVALID_ARG, err, TAG, "pixels_in_psram can't be used with CONFIG_RMT_ISR_IRAM_SAFE");
+#endif
+    rmt_strip = calloc(1, sizeof(led_strip_rmt_obj) + (rmt_config->flags.pixels_in_psram ? 0 : frames_size));
     ESP_GOTO_ON_FALSE(rmt_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for rmt strip");
+    rmt_strip->pixel_buf = rmt_strip->internal_buf;
+    if (rmt_config->flags.pixels_in_psram) {
+        // only the encoder chunk has to be in internal RAM, the pixels are read from here a chunk at a time
+        rmt_strip->pixel_buf = heap_caps_calloc(1, frames_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!rmt_strip->pixel_buf) {
+            ESP_LOGW(TAG, "no PSRAM for the pixels, using the default heap");
+            rmt_strip->pixel_buf = heap_caps_calloc(1, frames_size, MALLOC_CAP_DEFAULT);
+        }
+        ESP_GOTO_ON_FALSE(rmt_strip->pixel_buf, ESP_ERR_NO_MEM, err, TAG, "no mem for rmt strip pixels");
+    }
     uint32_t resolution = rmt_config->resolution_hz ? rmt_config->resolution_hz : LED_STRIP_RMT_DEFAULT_RESOLUTION;
 
     // for backward compatibility, if the user does not set the clk_src, use the default value
@@ -122,6 +329,12 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
     if (rmt_config->mem_block_symbols) {
         mem_block_symbols = rmt_config->mem_block_symbols;
     }
+    if (rmt_config->flags.dma_frame) {
+        // rmt_transmit() runs the encoder in the calling task when the channel is idle, which is always the case for
+        // a refresh. With room for the whole frame it completes there, and no refill depends on the interrupt latency
+        ESP_GOTO_ON_FALSE(rmt_config->flags.with_dma, ESP_ERR_INVALID_ARG, err, TAG, "dma_frame needs with_dma");
+        mem_block_symbols = LED_STRIP_RMT_FRAME_SYMBOLS(led_config->max_leds, bytes_per_pixel);
+    }
     rmt_tx_channel_config_t rmt_chan_config = {
         .clk_src = clk_src,
         .gpio_num = led_config->strip_gpio_num,
@@ -135,18 +348,41 @@ esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const l
 
     led_strip_encoder_config_t strip_encoder_conf = {
         .resolution = resolution,
-        .led_model = led_config->led_model
+        .led_model = led_config->led_model,
+        .chunk_bytes = rmt_config->encoder_chunk_bytes,
+        .bytes_per_pixel = bytes_per_pixel,
+        .high_depth_leds = rmt_config->flags.high_depth ? led_config->max_leds : 0,
     };
     ESP_GOTO_ON_ERROR(rmt_new_led_strip_encoder(&strip_encoder_conf, &rmt_strip->strip_encoder), err, TAG, "create LED strip encoder failed");
 
+    if (rmt_config->on_refresh_done) {
+        rmt_strip->on_refresh_done = rmt_config->on_refresh_done;
+        rmt_strip->user_ctx = rmt_config->user_ctx;
+        rmt_tx_event_callbacks_t cbs = {
+            .on_trans_done = led_strip_rmt_trans_done,
+        };
+        ESP_GOTO_ON_ERROR(rmt_tx_register_event_callbacks(rmt_strip->rmt_chan, &cbs, rmt_strip), err, TAG, "register RMT callbacks failed");
+    }
+    rmt_strip->async_refresh = rmt_config->flags.async_refresh;
+    if (rmt_strip->async_refresh) {
+        ESP_GOTO_ON_ERROR(rmt_enable(rmt_strip->rmt_chan), err, TAG, "enable RMT channel failed");
+    }
 
     rmt_strip->bytes_per_pixel = bytes_per_pixel;
+    rmt_strip->component_size = component_size;
     rmt_strip->strip_len = led_config->max_leds;
+    // the colors already latched in the LEDs are unknown, the first refresh sends the whole strip
+    rmt_strip->dirty_len = rmt_strip->strip_len;
+    rmt_strip->draw_buf = rmt_strip->pixel_buf;
     rmt_strip->base.set_pixel = led_strip_rmt_set_pixel;
     rmt_strip->base.set_pixel_rgbw = led_strip_rmt_set_pixel_rgbw;
     rmt_strip->base.refresh = led_strip_rmt_refresh;
     rmt_strip->base.clear = led_strip_rmt_clear;
     rmt_strip->base.del = led_strip_rmt_del;
+    rmt_strip->base.set_pixels = led_strip_rmt_set_pixels;
+    rmt_strip->base.set_pixels_16bit = led_strip_rmt_set_pixels_16bit;
+    rmt_strip->base.get_pixel_buf = led_strip_rmt_get_pixel_buf;
+    rmt_strip->base.set_color_scale = led_strip_rmt_set_color_scale;
 
     *ret_strip = &rmt_strip->base;
     return ESP_OK;
@@ -158,6 +394,9 @@ err:
         if (rmt_strip->strip_encoder) {
             rmt_del_encoder(rmt_strip->strip_encoder);
         }
+        if (rmt_strip->pixel_buf && rmt_strip->pixel_buf != rmt_strip->internal_buf) {
+            heap_caps_free(rmt_strip->pixel_buf);
+        }
         free(rmt_strip);
     }
     return ret;
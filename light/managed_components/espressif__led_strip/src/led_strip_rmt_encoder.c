@@ -4,43 +4,125 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <string.h>
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "led_strip_rmt_encoder.h"
 
 static const char *TAG = "led_rmt_encoder";
 
+#define LED_STRIP_ENCODER_DEFAULT_CHUNK_BYTES 16
+#define LED_STRIP_SCALE(value, scale) (((value) * (scale) + 127) / 255)
+
 typedef struct {
     rmt_encoder_t base;
-    rmt_encoder_t *bytes_encoder;
     rmt_encoder_t *copy_encoder;
     int state;
+    size_t chunk_bytes;         // pixel bytes expanded into chunk_symbols at a time
+    size_t byte_offset;         // first color component of the chunk being sent
+    size_t chunk_len;           // color components in chunk_symbols, 0 if the next chunk is not expanded yet
+    uint8_t bytes_per_pixel;
+    bool scaled;                // any of scale[] is not 255
+    uint8_t scale[4];           // brightness and white balance of each color component, in the order of the pixel bytes
+    uint8_t *error;             // high depth only: fraction of each component carried to the next frame, NULL for 8-bit pixels
+    uint32_t frame_dither_len;  // pixels [0, frame_dither_len) of the frame being sent had a fraction
+    uint32_t dither_len;        // same, for the last frame sent
     rmt_symbol_word_t reset_code;
+    rmt_symbol_word_t (*lut)[8]; // RMT symbols of every byte value, MSB first
+    rmt_symbol_word_t chunk_symbols[];
 } rmt_led_strip_encoder_t;
 
+/**
+ * @brief Expand 16-bit components, each LED gets the integer part and the fraction is added to the next frame
+ */
+static void rmt_led_strip_expand_dithered(rmt_led_strip_encoder_t *led_encoder, const uint16_t *pixels, size_t offset, size_t len)
+{
+    size_t component = offset % led_encoder->bytes_per_pixel;
+    uint8_t *error = led_encoder->error + offset;
+    uint8_t fraction = 0;
+    for (size_t i = 0; i < len; i++) {
+        // 8.8 fixed point, 0xFFFF is 255.0 and an 8-bit value v set as v * 257 is exactly v.0
+        uint32_t value = pixels[i] - (pixels[i] >> 8);
+        if (led_encoder->scaled) {
+            value = LED_STRIP_SCALE(value, led_encoder->scale[component]);
+        }
+        fraction |= value;
+        value += error[i];
+        error[i] = value & 0xFF;
+        memcpy(&led_encoder->chunk_symbols[i * 8], led_encoder->lut[value >> 8], sizeof(led_encoder->lut[0]));
+        if (++component == led_encoder->bytes_per_pixel) {
+            component = 0;
+            if (fraction & 0xFF) {
+                led_encoder->frame_dither_len = (offset + i) / led_encoder->bytes_per_pixel + 1;
+            }
+            fraction = 0;
+        }
+    }
+    if (fraction & 0xFF) {
+        led_encoder->frame_dither_len = (offset + len - 1) / led_encoder->bytes_per_pixel + 1;
+    }
+}
+
 static size_t rmt_encode_led_strip(rmt_encoder_t *encoder, rmt_channel_handle_t channel, const void *primary_data, size_t data_size, rmt_encode_state_t *ret_state)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_encoder_handle_t bytes_encoder = led_encoder->bytes_encoder;
     rmt_encoder_handle_t copy_encoder = led_encoder->copy_encoder;
+    const uint8_t *pixels = (const uint8_t *)primary_data;
     rmt_encode_state_t session_state = 0;
     rmt_encode_state_t state = 0;
     size_t encoded_symbols = 0;
+    // high depth pixels take two bytes per component
+    size_t components = led_encoder->error ? data_size / sizeof(uint16_t) : data_size;
     switch (led_encoder->state) {
     case 0: // send RGB data
-        encoded_symbols += bytes_encoder->encode(bytes_encoder, channel, primary_data, data_size, &session_state);
-        if (session_state & RMT_ENCODING_COMPLETE) {
-            led_encoder->state = 1; // switch to next state when current encoding session finished
-        }
-        if (session_state & RMT_ENCODING_MEM_FULL) {
-            state |= RMT_ENCODING_MEM_FULL;
-            goto out; // yield if there's no free space for encoding artifacts
+        while (led_encoder->byte_offset < components) {
+            if (led_encoder->chunk_len == 0) {
+                // expand the next chunk from the table, the copy encoder then only moves whole symbols
+                size_t chunk_len = components - led_encoder->byte_offset;
+                if (chunk_len > led_encoder->chunk_bytes) {
+                    chunk_len = led_encoder->chunk_bytes;
+                }
+                const uint8_t *chunk = pixels + led_encoder->byte_offset;
+                if (led_encoder->error) {
+                    rmt_led_strip_expand_dithered(led_encoder, (const uint16_t *)primary_data + led_encoder->byte_offset,
+                                                  led_encoder->byte_offset, chunk_len);
+                } else if (led_encoder->scaled) {
+                    size_t component = led_encoder->byte_offset % led_encoder->bytes_per_pixel;
+                    for (size_t i = 0; i < chunk_len; i++) {
+                        uint8_t data = LED_STRIP_SCALE(chunk[i], led_encoder->scale[component]);
+                        memcpy(&led_encoder->chunk_symbols[i * 8], led_encoder->lut[data], sizeof(led_encoder->lut[0]));
+                        if (++component == led_encoder->bytes_per_pixel) {
+                            component = 0;
+                        }
+                    }
+                } else {
+                    for (size_t i = 0; i < chunk_len; i++) {
+                        memcpy(&led_encoder->chunk_symbols[i * 8], led_encoder->lut[chunk[i]], sizeof(led_encoder->lut[0]));
+                    }
+                }
+                led_encoder->chunk_len = chunk_len;
+            }
+            encoded_symbols += copy_encoder->encode(copy_encoder, channel, led_encoder->chunk_symbols,
+                                                    led_encoder->chunk_len * sizeof(led_encoder->lut[0]), &session_state);
+            if (session_state & RMT_ENCODING_COMPLETE) {
+                led_encoder->byte_offset += led_encoder->chunk_len;
+                led_encoder->chunk_len = 0;
+            }
+            if (session_state & RMT_ENCODING_MEM_FULL) {
+                state |= RMT_ENCODING_MEM_FULL;
+                goto out; // yield if there's no free space for encoding artifacts
+            }
         }
+        led_encoder->state = 1; // switch to next state when all the pixels are sent
     // fall-through
     case 1: // send reset code
         encoded_symbols += copy_encoder->encode(copy_encoder, channel, &led_encoder->reset_code,
                                                 sizeof(led_encoder->reset_code), &session_state);
         if (session_state & RMT_ENCODING_COMPLETE) {
             led_encoder->state = 0; // back to the initial encoding session
+            led_encoder->byte_offset = 0;
+            led_encoder->dither_len = led_encoder->frame_dither_len;
+            led_encoder->frame_dither_len = 0;
             state |= RMT_ENCODING_COMPLETE;
         }
         if (session_state & RMT_ENCODING_MEM_FULL) {
@@ -56,18 +138,21 @@ out:
 static esp_err_t rmt_del_led_strip_encoder(rmt_encoder_t *encoder)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_del_encoder(led_encoder->bytes_encoder);
     rmt_del_encoder(led_encoder->copy_encoder);
-    free(led_encoder);
+    heap_caps_free(led_encoder->lut);
+    heap_caps_free(led_encoder->error);
+    heap_caps_free(led_encoder);
     return ESP_OK;
 }
 
 static esp_err_t rmt_led_strip_encoder_reset(rmt_encoder_t *encoder)
 {
     rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
-    rmt_encoder_reset(led_encoder->bytes_encoder);
     rmt_encoder_reset(led_encoder->copy_encoder);
     led_encoder->state = 0;
+    led_encoder->byte_offset = 0;
+    led_encoder->chunk_len = 0;
+    led_encoder->frame_dither_len = 0;
     return ESP_OK;
 }
 
@@ -77,49 +162,62 @@ esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rm
     rmt_led_strip_encoder_t *led_encoder = NULL;
     ESP_GOTO_ON_FALSE(config && ret_encoder, ESP_ERR_INVALID_ARG, err, TAG, "invalid argument");
     ESP_GOTO_ON_FALSE(config->led_model < LED_MODEL_INVALID, ESP_ERR_INVALID_ARG, err, TAG, "invalid led model");
-    led_encoder = calloc(1, sizeof(rmt_led_strip_encoder_t));
+    ESP_GOTO_ON_FALSE(config->led_model == LED_MODEL_WS2812 || config->led_model == LED_MODEL_SK6812, ESP_ERR_NOT_SUPPORTED, err, TAG,
+                      "clocked LED models need the SPI backend");
+    size_t chunk_bytes = config->chunk_bytes ? config->chunk_bytes : LED_STRIP_ENCODER_DEFAULT_CHUNK_BYTES;
+    // the encoder runs in the RMT ISR, keep everything it touches in internal RAM
+    led_encoder = heap_caps_calloc(1, sizeof(rmt_led_strip_encoder_t) + chunk_bytes * sizeof(led_encoder->lut[0]), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     ESP_GOTO_ON_FALSE(led_encoder, ESP_ERR_NO_MEM, err, TAG, "no mem for led strip encoder");
+    led_encoder->lut = heap_caps_malloc(256 * sizeof(led_encoder->lut[0]), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ESP_GOTO_ON_FALSE(led_encoder->lut, ESP_ERR_NO_MEM, err, TAG, "no mem for led strip symbol table");
+    led_encoder->chunk_bytes = chunk_bytes;
+    led_encoder->bytes_per_pixel = config->bytes_per_pixel ? config->bytes_per_pixel : 3;
+    if (config->high_depth_leds) {
+        led_encoder->error = heap_caps_calloc(config->high_depth_leds, led_encoder->bytes_per_pixel, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        ESP_GOTO_ON_FALSE(led_encoder->error, ESP_ERR_NO_MEM, err, TAG, "no mem for led strip dither error");
+    }
+    memset(led_encoder->scale, 0xFF, sizeof(led_encoder->scale));
     led_encoder->base.encode = rmt_encode_led_strip;
     led_encoder->base.del = rmt_del_led_strip_encoder;
     led_encoder->base.reset = rmt_led_strip_encoder_reset;
-    rmt_bytes_encoder_config_t bytes_encoder_config;
+    rmt_symbol_word_t bit0;
+    rmt_symbol_word_t bit1;
     if (config->led_model == LED_MODEL_SK6812) {
-        bytes_encoder_config = (rmt_bytes_encoder_config_t) {
-            .bit0 = {
-                .level0 = 1,
-                .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
-                .level1 = 0,
-                .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
-            },
-            .bit1 = {
-                .level0 = 1,
-                .duration0 = 0.6 * config->resolution / 1000000, // T1H=0.6us
-                .level1 = 0,
-                .duration1 = 0.6 * config->resolution / 1000000, // T1L=0.6us
-            },
-            .flags.msb_first = 1 // SK6812 transfer bit order: G7...G0R7...R0B7...B0(W7...W0)
+        bit0 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
+            .level1 = 0,
+            .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
+        };
+        bit1 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.6 * config->resolution / 1000000, // T1H=0.6us
+            .level1 = 0,
+            .duration1 = 0.6 * config->resolution / 1000000, // T1L=0.6us
         };
     } else if (config->led_model == LED_MODEL_WS2812) {
         // different led strip might have its own timing requirements, following parameter is for WS2812
-        bytes_encoder_config = (rmt_bytes_encoder_config_t) {
-            .bit0 = {
-                .level0 = 1,
-                .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
-                .level1 = 0,
-                .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
-            },
-            .bit1 = {
-                .level0 = 1,
-                .duration0 = 0.9 * config->resolution / 1000000, // T1H=0.9us
-                .level1 = 0,
-                .duration1 = 0.3 * config->resolution / 1000000, // T1L=0.3us
-            },
-            .flags.msb_first = 1 // WS2812 transfer bit order: G7...G0R7...R0B7...B0
+        bit0 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.3 * config->resolution / 1000000, // T0H=0.3us
+            .level1 = 0,
+            .duration1 = 0.9 * config->resolution / 1000000, // T0L=0.9us
+        };
+        bit1 = (rmt_symbol_word_t) {
+            .level0 = 1,
+            .duration0 = 0.9 * config->resolution / 1000000, // T1H=0.9us
+            .level1 = 0,
+            .duration1 = 0.3 * config->resolution / 1000000, // T1L=0.3us
         };
     } else {
         assert(false);
     }
-    ESP_GOTO_ON_ERROR(rmt_new_bytes_encoder(&bytes_encoder_config, &led_encoder->bytes_encoder), err, TAG, "create bytes encoder failed");
+    // WS2812 and SK6812 transfer bit order: G7...G0R7...R0B7...B0(W7...W0)
+    for (int data = 0; data < 256; data++) {
+        for (int bit = 0; bit < 8; bit++) {
+            led_encoder->lut[data][bit] = (data & (0x80 >> bit)) ? bit1 : bit0;
+        }
+    }
     rmt_copy_encoder_config_t copy_encoder_config = {};
     ESP_GOTO_ON_ERROR(rmt_new_copy_encoder(&copy_encoder_config, &led_encoder->copy_encoder), err, TAG, "create copy encoder failed");
 
@@ -134,13 +232,27 @@ esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rm
     return ESP_OK;
 err:
     if (led_encoder) {
-        if (led_encoder->bytes_encoder) {
-            rmt_del_encoder(led_encoder->bytes_encoder);
-        }
         if (led_encoder->copy_encoder) {
             rmt_del_encoder(led_encoder->copy_encoder);
         }
-        free(led_encoder);
+        heap_caps_free(led_encoder->lut);
+        heap_caps_free(led_encoder->error);
+        heap_caps_free(led_encoder);
     }
     return ret;
 }
+
+esp_err_t rmt_led_strip_encoder_set_scale(rmt_encoder_handle_t encoder, const uint8_t scale[4])
+{
+    ESP_RETURN_ON_FALSE(encoder && scale, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
+    memcpy(led_encoder->scale, scale, sizeof(led_encoder->scale));
+    led_encoder->scaled = (scale[0] & scale[1] & scale[2] & scale[3]) != 0xFF;
+    return ESP_OK;
+}
+
+uint32_t rmt_led_strip_encoder_get_dither_len(rmt_encoder_handle_t encoder)
+{
+    rmt_led_strip_encoder_t *led_encoder = __containerof(encoder, rmt_led_strip_encoder_t, base);
+    return led_encoder->dither_len;
+}
@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "driver/rmt_encoder.h"
 #include "led_strip_types.h"
@@ -19,6 +20,9 @@ extern "C" {
 typedef struct {
     uint32_t resolution;   /*!< Encoder resolution, in Hz */
     led_model_t led_model; /*!< LED model */
+    size_t chunk_bytes;    /*!< Pixel bytes expanded to RMT symbols per encoder call, 0 for the default (16) */
+    uint8_t bytes_per_pixel; /*!< Color components per pixel, 3 (GRB) or 4 (GRBW) */
+    uint32_t high_depth_leds; /*!< LEDs of a strip with 16-bit components, dithered to 8 bits over the frames, 0 for 8-bit pixels */
 } led_strip_encoder_config_t;
 
 /**
@@ -33,6 +37,25 @@ typedef struct {
  */
 esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config, rmt_encoder_handle_t *ret_encoder);
 
+/**
+ * @brief Set the scale the encoder applies to every color component
+ *
+ * @param[in] encoder Encoder handle created by rmt_new_led_strip_encoder()
+ * @param[in] scale Scale of each component in the order of the pixel bytes (G, R, B, W), 255 leaves a component unchanged
+ * @return
+ *      - ESP_ERR_INVALID_ARG for any invalid arguments
+ *      - ESP_OK if the scale is set successfully
+ */
+esp_err_t rmt_led_strip_encoder_set_scale(rmt_encoder_handle_t encoder, const uint8_t scale[4]);
+
+/**
+ * @brief Get the pixels still dithering, they change on every frame even if they are not set again
+ *
+ * @param[in] encoder Encoder handle created by rmt_new_led_strip_encoder()
+ * @return Pixels [0, len) of the last frame sent which had a component with a fraction, 0 for 8-bit pixels
+ */
+uint32_t rmt_led_strip_encoder_get_dither_len(rmt_encoder_handle_t encoder);
+
 #ifdef __cplusplus
 }
 #endif
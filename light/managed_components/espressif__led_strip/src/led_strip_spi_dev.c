@@ -16,10 +16,22 @@
 
 #define LED_STRIP_SPI_DEFAULT_RESOLUTION (2.5 * 1000 * 1000) // 2.5MHz resolution
 #define LED_STRIP_SPI_DEFAULT_TRANS_QUEUE_SIZE 4
+#define LED_STRIP_SPI_DEFAULT_STAGING_PIXELS 32
 
 #define SPI_BYTES_PER_COLOR_BYTE 3
 #define SPI_BITS_PER_COLOR_BYTE (SPI_BYTES_PER_COLOR_BYTE * 8)
 
+// Clocked LEDs (APA102, SK9822) take the bytes as they are: a start frame of 32 zero bits, then for every pixel
+// 0b111 and 5 bits of global brightness followed by blue, green and red.
+// The end frame gives the half clock per LED the data needs to ripple through, and the 32 zero bits SK9822 latches on
+#define LED_STRIP_SPI_CLOCKED_DEFAULT_SPEED_HZ (10 * 1000 * 1000) // 10MHz
+#define CLOCKED_START_FRAME_BYTES 4
+#define CLOCKED_BYTES_PER_PIXEL 4
+#define CLOCKED_END_FRAME_BYTES(leds) (4 + ((leds) + 15) / 16)
+#define CLOCKED_HEADER 0xE0
+#define CLOCKED_BRIGHTNESS_MAX 0x1F
+#define LED_STRIP_SCALE(value, scale) (((value) * (scale) + 127) / 255)
+
 static const char *TAG = "led_strip_spi";
 
 typedef struct {
@@ -27,10 +39,25 @@ typedef struct {
     spi_host_device_t spi_host;
     spi_device_handle_t spi_device;
     uint32_t strip_len;
+    uint32_t dirty_len;         // pixels [0, dirty_len) changed since the last refresh
     uint8_t bytes_per_pixel;
+    bool clocked;               // APA102/SK9822: 4 bytes per pixel behind a start frame, no bit expansion
+    uint8_t scale[4];           // brightness and white balance of each color component, in the order of GRBW
+    bool async_refresh;
+    bool trans_pending;         // a queued transaction has not been collected yet
+    spi_transaction_t trans;    // must live until the queued transaction is collected
+    uint8_t *draw_buf;          // the frame set_pixel writes to, in async mode the other half of pixel_buf may be on the wire
+    uint8_t *pixels;            // in staged mode: plain GRB(W) pixels, usually in PSRAM, encoded on refresh
+    uint8_t *staging;           // in staged mode: two chunks of encoded pixels in internal DMA memory
+    uint32_t staging_pixels;    // pixels per staging chunk
+    spi_transaction_t staging_trans[2];
     uint8_t pixel_buf[];
 } led_strip_spi_obj;
 
+// SPI pattern of every color byte, filled once from __led_strip_spi_bit
+static uint8_t s_spi_pattern[256][SPI_BYTES_PER_COLOR_BYTE];
+static bool s_spi_pattern_built = false;
+
 // please make sure to zero-initialize the buf before calling this function
 static void __led_strip_spi_bit(uint8_t data, uint8_t *buf)
 {
@@ -47,19 +74,80 @@ static void __led_strip_spi_bit(uint8_t data, uint8_t *buf)
     *(buf + 0) |= data & BIT(7) ? BIT(7) | BIT(6) : BIT(7);
 }
 
+static void led_strip_spi_build_pattern(void)
+{
+    if (s_spi_pattern_built) {
+        return;
+    }
+    for (int data = 0; data < 256; data++) {
+        memset(s_spi_pattern[data], 0, SPI_BYTES_PER_COLOR_BYTE);
+        __led_strip_spi_bit(data, s_spi_pattern[data]);
+    }
+    s_spi_pattern_built = true;
+}
+
+static inline void led_strip_spi_put_byte(uint8_t data, uint8_t *buf)
+{
+    const uint8_t *pattern = s_spi_pattern[data];
+    buf[0] = pattern[0];
+    buf[1] = pattern[1];
+    buf[2] = pattern[2];
+}
+
+// color components are scaled on their way into the SPI pattern
+static inline void led_strip_spi_put_component(led_strip_spi_obj *spi_strip, int component, uint8_t data, uint8_t *buf)
+{
+    led_strip_spi_put_byte(LED_STRIP_SCALE(data, spi_strip->scale[component]), buf);
+}
+
+// size of a whole frame in the pixel buffer
+static size_t led_strip_spi_frame_size(bool clocked, uint32_t leds, uint8_t bytes_per_pixel)
+{
+    if (clocked) {
+        return CLOCKED_START_FRAME_BYTES + leds * CLOCKED_BYTES_PER_PIXEL + CLOCKED_END_FRAME_BYTES(leds);
+    }
+    return leds * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+}
+
+static inline void led_strip_spi_write_pixel(led_strip_spi_obj *spi_strip, uint32_t index, uint8_t green, uint8_t red, uint8_t blue, uint8_t white)
+{
+    if (spi_strip->clocked) {
+        // the first byte holds the global brightness of the pixel, it is left as it is
+        uint8_t *buf = spi_strip->draw_buf + CLOCKED_START_FRAME_BYTES + index * CLOCKED_BYTES_PER_PIXEL;
+        buf[1] = LED_STRIP_SCALE(blue, spi_strip->scale[2]);
+        buf[2] = LED_STRIP_SCALE(green, spi_strip->scale[0]);
+        buf[3] = LED_STRIP_SCALE(red, spi_strip->scale[1]);
+        return;
+    }
+    if (spi_strip->pixels) {
+        // staged mode keeps the plain pixel, it is scaled and encoded on refresh
+        uint8_t *pixel = spi_strip->pixels + index * spi_strip->bytes_per_pixel;
+        pixel[0] = green;
+        pixel[1] = red;
+        pixel[2] = blue;
+        if (spi_strip->bytes_per_pixel > 3) {
+            pixel[3] = white;
+        }
+        return;
+    }
+    // LED_PIXEL_FORMAT_GRB takes 72bits(9bytes), LED_PIXEL_FORMAT_GRBW takes 96bits(12bytes)
+    uint8_t *buf = spi_strip->draw_buf + index * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+    led_strip_spi_put_component(spi_strip, 0, green, buf);
+    led_strip_spi_put_component(spi_strip, 1, red, buf + SPI_BYTES_PER_COLOR_BYTE);
+    led_strip_spi_put_component(spi_strip, 2, blue, buf + SPI_BYTES_PER_COLOR_BYTE * 2);
+    if (spi_strip->bytes_per_pixel > 3) {
+        led_strip_spi_put_component(spi_strip, 3, white, buf + SPI_BYTES_PER_COLOR_BYTE * 3);
+    }
+}
+
 static esp_err_t led_strip_spi_set_pixel(led_strip_t *strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
-    // LED_PIXEL_FORMAT_GRB takes 72bits(9bytes)
-    uint32_t start = index * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
-    memset(spi_strip->pixel_buf + start, 0, spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
-    __led_strip_spi_bit(green, &spi_strip->pixel_buf[start]);
-    __led_strip_spi_bit(red, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE]);
-    __led_strip_spi_bit(blue, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 2]);
-    if (spi_strip->bytes_per_pixel > 3) {
-        __led_strip_spi_bit(0, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 3]);
+    if (index >= spi_strip->dirty_len) {
+        spi_strip->dirty_len = index + 1;
     }
+    led_strip_spi_write_pixel(spi_strip, index, green & 0xFF, red & 0xFF, blue & 0xFF, 0);
     return ESP_OK;
 }
 
@@ -68,28 +156,155 @@ static esp_err_t led_strip_spi_set_pixel_rgbw(led_strip_t *strip, uint32_t index
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
     ESP_RETURN_ON_FALSE(spi_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
-    // LED_PIXEL_FORMAT_GRBW takes 96bits(12bytes)
-    uint32_t start = index * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+    if (index >= spi_strip->dirty_len) {
+        spi_strip->dirty_len = index + 1;
+    }
     // SK6812 component order is GRBW
-    memset(spi_strip->pixel_buf + start, 0, spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
-    __led_strip_spi_bit(green, &spi_strip->pixel_buf[start]);
-    __led_strip_spi_bit(red, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE]);
-    __led_strip_spi_bit(blue, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 2]);
-    __led_strip_spi_bit(white, &spi_strip->pixel_buf[start + SPI_BYTES_PER_COLOR_BYTE * 3]);
+    led_strip_spi_write_pixel(spi_strip, index, green & 0xFF, red & 0xFF, blue & 0xFF, white & 0xFF);
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_set_pixels(led_strip_t *strip, uint32_t start, uint32_t count, const uint8_t *data, led_strip_data_format_t format)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    ESP_RETURN_ON_FALSE(start <= spi_strip->strip_len && count <= spi_strip->strip_len - start, ESP_ERR_INVALID_ARG, TAG, "pixels out of maximum number of LEDs");
+    bool has_white = format == LED_STRIP_DATA_FORMAT_RGBW || format == LED_STRIP_DATA_FORMAT_GRBW;
+    ESP_RETURN_ON_FALSE(!has_white || spi_strip->bytes_per_pixel == 4, ESP_ERR_INVALID_ARG, TAG, "wrong LED pixel format, expected 4 bytes per pixel");
+    if (count == 0) {
+        return ESP_OK;
+    }
+    bool red_first = format == LED_STRIP_DATA_FORMAT_RGB || format == LED_STRIP_DATA_FORMAT_RGBW;
+    uint8_t data_bpp = has_white ? 4 : 3;
+    for (uint32_t i = 0; i < count; i++, data += data_bpp) {
+        led_strip_spi_write_pixel(spi_strip, start + i, red_first ? data[1] : data[0], red_first ? data[0] : data[1],
+                                  data[2], has_white ? data[3] : 0);
+    }
+    if (start + count > spi_strip->dirty_len) {
+        spi_strip->dirty_len = start + count;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_set_pixel_global_brightness(led_strip_t *strip, uint32_t index, uint8_t brightness)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    ESP_RETURN_ON_FALSE(spi_strip->clocked, ESP_ERR_NOT_SUPPORTED, TAG, "global brightness needs a clocked LED model");
+    ESP_RETURN_ON_FALSE(index < spi_strip->strip_len, ESP_ERR_INVALID_ARG, TAG, "index out of maximum number of LEDs");
+    ESP_RETURN_ON_FALSE(brightness <= CLOCKED_BRIGHTNESS_MAX, ESP_ERR_INVALID_ARG, TAG, "global brightness out of range");
+    if (index >= spi_strip->dirty_len) {
+        spi_strip->dirty_len = index + 1;
+    }
+    spi_strip->draw_buf[CLOCKED_START_FRAME_BYTES + index * CLOCKED_BYTES_PER_PIXEL] = CLOCKED_HEADER | brightness;
+    return ESP_OK;
+}
+
+static esp_err_t led_strip_spi_set_color_scale(led_strip_t *strip, uint8_t red, uint8_t green, uint8_t blue, uint8_t white)
+{
+    led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    // pixels are encoded when they are set, the scale applies to the pixels set from now on.
+    // In staged mode the pixels are encoded on refresh, so it applies to all of them on the next refresh
+    if (spi_strip->pixels) {
+        spi_strip->dirty_len = spi_strip->strip_len;
+    }
+    spi_strip->scale[0] = green;
+    spi_strip->scale[1] = red;
+    spi_strip->scale[2] = blue;
+    spi_strip->scale[3] = white;
+    return ESP_OK;
+}
 
+static esp_err_t led_strip_spi_wait_pending(led_strip_spi_obj *spi_strip)
+{
+    if (spi_strip->trans_pending) {
+        spi_transaction_t *done = NULL;
+        ESP_RETURN_ON_ERROR(spi_device_get_trans_result(spi_strip->spi_device, &done, portMAX_DELAY), TAG, "wait SPI transaction failed");
+        spi_strip->trans_pending = false;
+    }
     return ESP_OK;
 }
 
+// encode the plain pixels chunk by chunk while the previous chunk is on the wire
+static esp_err_t led_strip_spi_refresh_staged(led_strip_spi_obj *spi_strip)
+{
+    esp_err_t ret = ESP_OK;
+    size_t chunk_size = spi_strip->staging_pixels * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+    int queued = 0;
+    spi_transaction_t *done = NULL;
+    for (uint32_t index = 0, chunk = 0; index < spi_strip->dirty_len; index += spi_strip->staging_pixels, chunk ^= 1) {
+        if (queued == 2) {
+            // the oldest of the two in flight uses this staging chunk
+            ESP_GOTO_ON_ERROR(spi_device_get_trans_result(spi_strip->spi_device, &done, portMAX_DELAY), out, TAG, "wait SPI transaction failed");
+            queued--;
+        }
+        uint32_t count = spi_strip->dirty_len - index;
+        if (count > spi_strip->staging_pixels) {
+            count = spi_strip->staging_pixels;
+        }
+        const uint8_t *pixel = spi_strip->pixels + index * spi_strip->bytes_per_pixel;
+        uint8_t *buf = spi_strip->staging + chunk * chunk_size;
+        for (uint32_t i = 0; i < count * spi_strip->bytes_per_pixel; i++) {
+            led_strip_spi_put_component(spi_strip, i % spi_strip->bytes_per_pixel, pixel[i], buf + i * SPI_BYTES_PER_COLOR_BYTE);
+        }
+        spi_transaction_t *trans = &spi_strip->staging_trans[chunk];
+        memset(trans, 0, sizeof(spi_transaction_t));
+        trans->length = count * spi_strip->bytes_per_pixel * SPI_BITS_PER_COLOR_BYTE;
+        trans->tx_buffer = buf;
+        ESP_GOTO_ON_ERROR(spi_device_queue_trans(spi_strip->spi_device, trans, portMAX_DELAY), out, TAG, "queue pixels by SPI failed");
+        queued++;
+    }
+    spi_strip->dirty_len = 0;
+out:
+    // the staging chunks must not be reused before their transactions are done
+    while (queued--) {
+        spi_device_get_trans_result(spi_strip->spi_device, &done, portMAX_DELAY);
+    }
+    return ret;
+}
+
 static esp_err_t led_strip_spi_refresh(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
+    // LEDs behind the last changed one keep their color, so the chain only has to be sent up to it
+    if (spi_strip->dirty_len == 0) {
+        return ESP_OK;
+    }
+    if (spi_strip->pixels) {
+        return led_strip_spi_refresh_staged(spi_strip);
+    }
+    size_t dirty_size = spi_strip->dirty_len * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+    size_t copy_size = dirty_size;
+    if (spi_strip->clocked) {
+        // SK9822 latches on the end frame behind the last LED, so the whole frame goes out.
+        // Only the pixels up to the dirty one differ from the previous frame
+        dirty_size = led_strip_spi_frame_size(true, spi_strip->strip_len, spi_strip->bytes_per_pixel);
+        copy_size = CLOCKED_START_FRAME_BYTES + spi_strip->dirty_len * CLOCKED_BYTES_PER_PIXEL;
+    }
+
+    if (spi_strip->async_refresh) {
+        size_t frame_size = led_strip_spi_frame_size(spi_strip->clocked, spi_strip->strip_len, spi_strip->bytes_per_pixel);
+        // the previous frame is sent out from the other buffer, it must be done before that buffer is reused
+        ESP_RETURN_ON_ERROR(led_strip_spi_wait_pending(spi_strip), TAG, "flush SPI failed");
+        memset(&spi_strip->trans, 0, sizeof(spi_strip->trans));
+        spi_strip->trans.length = dirty_size * 8;
+        spi_strip->trans.tx_buffer = spi_strip->draw_buf;
+        ESP_RETURN_ON_ERROR(spi_device_queue_trans(spi_strip->spi_device, &spi_strip->trans, portMAX_DELAY), TAG, "queue pixels by SPI failed");
+        spi_strip->trans_pending = true;
+        // the other buffer holds the previous frame, which only differs in the dirty part
+        uint8_t *next_buf = spi_strip->draw_buf == spi_strip->pixel_buf ? spi_strip->pixel_buf + frame_size : spi_strip->pixel_buf;
+        memcpy(next_buf, spi_strip->draw_buf, copy_size);
+        spi_strip->draw_buf = next_buf;
+        spi_strip->dirty_len = 0;
+        return ESP_OK;
+    }
+
     spi_transaction_t tx_conf;
     memset(&tx_conf, 0, sizeof(tx_conf));
 
-    tx_conf.length = spi_strip->strip_len * spi_strip->bytes_per_pixel * SPI_BITS_PER_COLOR_BYTE;
-    tx_conf.tx_buffer = spi_strip->pixel_buf;
+    tx_conf.length = dirty_size * 8;
+    tx_conf.tx_buffer = spi_strip->draw_buf;
     tx_conf.rx_buffer = NULL;
     ESP_RETURN_ON_ERROR(spi_device_transmit(spi_strip->spi_device, &tx_conf), TAG, "transmit pixels by SPI failed");
+    spi_strip->dirty_len = 0;
 
     return ESP_OK;
 }
@@ -98,12 +313,24 @@ static esp_err_t led_strip_spi_clear(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
     //Write zero to turn off all leds
-    memset(spi_strip->pixel_buf, 0, spi_strip->strip_len * spi_strip->bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE);
-    uint8_t *buf = spi_strip->pixel_buf;
+    if (spi_strip->pixels) {
+        memset(spi_strip->pixels, 0, spi_strip->strip_len * spi_strip->bytes_per_pixel);
+        spi_strip->dirty_len = spi_strip->strip_len;
+        return led_strip_spi_refresh(strip);
+    }
+    uint8_t *buf = spi_strip->draw_buf;
+    if (spi_strip->clocked) {
+        for (int index = 0; index < spi_strip->strip_len; index++) {
+            memset(buf + CLOCKED_START_FRAME_BYTES + index * CLOCKED_BYTES_PER_PIXEL + 1, 0, CLOCKED_BYTES_PER_PIXEL - 1);
+        }
+        spi_strip->dirty_len = spi_strip->strip_len;
+        return led_strip_spi_refresh(strip);
+    }
     for (int index = 0; index < spi_strip->strip_len * spi_strip->bytes_per_pixel; index++) {
-        __led_strip_spi_bit(0, buf);
+        led_strip_spi_put_byte(0, buf);
         buf += SPI_BYTES_PER_COLOR_BYTE;
     }
+    spi_strip->dirty_len = spi_strip->strip_len;
 
     return led_strip_spi_refresh(strip);
 }
@@ -112,9 +339,12 @@ static esp_err_t led_strip_spi_del(led_strip_t *strip)
 {
     led_strip_spi_obj *spi_strip = __containerof(strip, led_strip_spi_obj, base);
 
+    ESP_RETURN_ON_ERROR(led_strip_spi_wait_pending(spi_strip), TAG, "flush SPI failed");
     ESP_RETURN_ON_ERROR(spi_bus_remove_device(spi_strip->spi_device), TAG, "delete spi device failed");
     ESP_RETURN_ON_ERROR(spi_bus_free(spi_strip->spi_host), TAG, "free spi bus failed");
 
+    heap_caps_free(spi_strip->pixels);
+    heap_caps_free(spi_strip->staging);
     free(spi_strip);
     return ESP_OK;
 }
@@ -133,14 +363,41 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
     } else {
         assert(false);
     }
+    bool staged = spi_config->flags.pixels_in_psram;
+    ESP_GOTO_ON_FALSE(!staged || (spi_config->flags.with_dma && !spi_config->flags.async_refresh), ESP_ERR_INVALID_ARG, err, TAG,
+                      "pixels_in_psram needs with_dma and can't be used with async_refresh");
+    bool clocked = led_config->led_model == LED_MODEL_APA102 || led_config->led_model == LED_MODEL_SK9822;
+    ESP_GOTO_ON_FALSE(!clocked || bytes_per_pixel == 3, ESP_ERR_INVALID_ARG, err, TAG, "clocked LED models only support LED_PIXEL_FORMAT_GRB");
+    // the pixels of clocked LEDs are already as small as the plain ones, there is nothing to stage
+    ESP_GOTO_ON_FALSE(!clocked || !staged, ESP_ERR_NOT_SUPPORTED, err, TAG, "pixels_in_psram is not supported by clocked LED models");
     uint32_t mem_caps = MALLOC_CAP_DEFAULT;
     if (spi_config->flags.with_dma) {
         // DMA buffer must be placed in internal SRAM
         mem_caps |= MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA;
     }
-    spi_strip = heap_caps_calloc(1, sizeof(led_strip_spi_obj) + led_config->max_leds * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE, mem_caps);
+    // async refresh keeps a second frame to draw into while the first one is on the wire,
+    // staged mode has no encoded frame at all, only the staging chunks
+    size_t frame_num = staged ? 0 : spi_config->flags.async_refresh ? 2 : 1;
+    size_t frame_size = led_strip_spi_frame_size(clocked, led_config->max_leds, bytes_per_pixel);
+    spi_strip = heap_caps_calloc(1, sizeof(led_strip_spi_obj) + frame_num * frame_size, mem_caps);
 
     ESP_GOTO_ON_FALSE(spi_strip, ESP_ERR_NO_MEM, err, TAG, "no mem for spi strip");
+    size_t transfer_size = frame_size;
+    if (staged) {
+        spi_strip->staging_pixels = spi_config->staging_pixels ? spi_config->staging_pixels : LED_STRIP_SPI_DEFAULT_STAGING_PIXELS;
+        if (spi_strip->staging_pixels > led_config->max_leds) {
+            spi_strip->staging_pixels = led_config->max_leds;
+        }
+        transfer_size = spi_strip->staging_pixels * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE;
+        spi_strip->pixels = heap_caps_calloc(1, led_config->max_leds * bytes_per_pixel, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (!spi_strip->pixels) {
+            ESP_LOGW(TAG, "no PSRAM for the pixels, using the default heap");
+            spi_strip->pixels = heap_caps_calloc(1, led_config->max_leds * bytes_per_pixel, MALLOC_CAP_DEFAULT);
+        }
+        ESP_GOTO_ON_FALSE(spi_strip->pixels, ESP_ERR_NO_MEM, err, TAG, "no mem for spi strip pixels");
+        spi_strip->staging = heap_caps_calloc(2, transfer_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+        ESP_GOTO_ON_FALSE(spi_strip->staging, ESP_ERR_NO_MEM, err, TAG, "no mem for spi strip staging buffer");
+    }
 
     spi_strip->spi_host = spi_config->spi_bus;
     // for backward compatibility, if the user does not set the clk_src, use the default value
@@ -153,10 +410,10 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
         .mosi_io_num = led_config->strip_gpio_num,
         //Only use MOSI to generate the signal, set -1 when other pins are not used.
         .miso_io_num = -1,
-        .sclk_io_num = -1,
+        .sclk_io_num = clocked ? spi_config->clk_gpio_num : -1,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
-        .max_transfer_sz = led_config->max_leds * bytes_per_pixel * SPI_BYTES_PER_COLOR_BYTE,
+        .max_transfer_sz = transfer_size,
     };
     ESP_GOTO_ON_ERROR(spi_bus_initialize(spi_strip->spi_host, &spi_bus_cfg, spi_config->flags.with_dma ? SPI_DMA_CH_AUTO : SPI_DMA_DISABLED), err, TAG, "create SPI bus failed");
 
@@ -176,6 +433,10 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
         .queue_size = LED_STRIP_SPI_DEFAULT_TRANS_QUEUE_SIZE,
     };
 
+    if (clocked) {
+        spi_dev_cfg.clock_speed_hz = spi_config->clock_speed_hz ? spi_config->clock_speed_hz : LED_STRIP_SPI_CLOCKED_DEFAULT_SPEED_HZ;
+    }
+
     ESP_GOTO_ON_ERROR(spi_bus_add_device(spi_strip->spi_host, &spi_dev_cfg, &spi_strip->spi_device), err, TAG, "Failed to add spi device");
     //ensure the reset time is enough
     esp_rom_delay_us(10);
@@ -184,16 +445,35 @@ esp_err_t led_strip_new_spi_device(const led_strip_config_t *led_config, const l
     // TODO: ideally we should decide the SPI_BYTES_PER_COLOR_BYTE by the real clock resolution
     // But now, let's fixed the resolution, the downside is, we don't support a clock source whose frequency is not multiple of LED_STRIP_SPI_DEFAULT_RESOLUTION
     // clock_resolution between 2.2MHz to 2.8MHz is supported
-    ESP_GOTO_ON_FALSE((clock_resolution_khz < LED_STRIP_SPI_DEFAULT_RESOLUTION / 1000 + 300) && (clock_resolution_khz > LED_STRIP_SPI_DEFAULT_RESOLUTION / 1000 - 300), ESP_ERR_NOT_SUPPORTED, err,
+    // clocked LEDs follow the clock line, any SPI clock they can take will do
+    ESP_GOTO_ON_FALSE(clocked || ((clock_resolution_khz < LED_STRIP_SPI_DEFAULT_RESOLUTION / 1000 + 300) && (clock_resolution_khz > LED_STRIP_SPI_DEFAULT_RESOLUTION / 1000 - 300)), ESP_ERR_NOT_SUPPORTED, err,
                       TAG, "unsupported clock resolution:%dKHz", clock_resolution_khz);
 
+    led_strip_spi_build_pattern();
     spi_strip->bytes_per_pixel = bytes_per_pixel;
+    spi_strip->clocked = clocked;
     spi_strip->strip_len = led_config->max_leds;
+    // the colors already latched in the LEDs are unknown, the first refresh sends the whole strip
+    spi_strip->dirty_len = spi_strip->strip_len;
+    spi_strip->async_refresh = spi_config->flags.async_refresh;
+    memset(spi_strip->scale, 0xFF, sizeof(spi_strip->scale));
+    spi_strip->draw_buf = spi_strip->pixel_buf;
+    if (clocked) {
+        // pixels start at full global brightness, the start and end frames stay zero
+        for (size_t frame = 0; frame < frame_num; frame++) {
+            for (uint32_t index = 0; index < led_config->max_leds; index++) {
+                spi_strip->pixel_buf[frame * frame_size + CLOCKED_START_FRAME_BYTES + index * CLOCKED_BYTES_PER_PIXEL] = CLOCKED_HEADER | CLOCKED_BRIGHTNESS_MAX;
+            }
+        }
+    }
     spi_strip->base.set_pixel = led_strip_spi_set_pixel;
     spi_strip->base.set_pixel_rgbw = led_strip_spi_set_pixel_rgbw;
     spi_strip->base.refresh = led_strip_spi_refresh;
     spi_strip->base.clear = led_strip_spi_clear;
     spi_strip->base.del = led_strip_spi_del;
+    spi_strip->base.set_pixels = led_strip_spi_set_pixels;
+    spi_strip->base.set_color_scale = led_strip_spi_set_color_scale;
+    spi_strip->base.set_pixel_global_brightness = led_strip_spi_set_pixel_global_brightness;
 
     *ret_strip = &spi_strip->base;
     return ESP_OK;
@@ -205,6 +485,8 @@ err:
         if (spi_strip->spi_host) {
             spi_bus_free(spi_strip->spi_host);
         }
+        heap_caps_free(spi_strip->pixels);
+        heap_caps_free(spi_strip->staging);
         free(spi_strip);
     }
     return ret;
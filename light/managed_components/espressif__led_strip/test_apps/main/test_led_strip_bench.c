@@ -0,0 +1,334 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Frame rate and CPU cost of the led_strip backends
+ *
+ * For each backend and strip length this measures:
+ * - the frames per second reached by a loop setting every pixel and refreshing,
+ * - the time spent in led_strip_refresh() (average and worst) and the CPU cycles of led_strip_set_pixel(),
+ * - the CPU load of refreshing the same frame over and over, the ISR and driver cost of a frame. It is what a spinner
+ *   task of lower priority, on the same core, did not get to run compared to an idle core,
+ * - the late frames, refreshes that took longer than the frame on the wire plus REFRESH_LATE_MARGIN_US. With a
+ *   synchronous refresh this is a frame the line stalled in, which the strip takes as a reset. Colours corrupted by
+ *   a late RMT refill do not change the timing, they need a logic analyzer.
+ *
+ * The same measurements can run while raw 802.11 frames are sent as fast as the WiFi driver takes them, so that the
+ * WiFi interrupts and tasks compete with the strip. No access point is needed.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "soc/soc_caps.h"
+#include "unity.h"
+#include "led_strip.h"
+
+#define TAG "LED strip bench"
+
+#define BENCH_GPIO_NUM              8
+#define BENCH_CLK_GPIO_NUM          10
+#define BENCH_DURATION_MS           2000
+#define BENCH_SET_PIXEL_FRAMES      20
+#define BENCH_TASK_PRIORITY         5
+#define BENCH_SPINNER_PRIORITY      1
+#define BENCH_WIFI_TX_PRIORITY      6
+#define BENCH_WIFI_CHANNEL          6
+
+/* What one frame takes on the wire: 24 bits of 1.25 us and the reset code of the RMT encoder */
+#define FRAME_US(pixels)            ((pixels) * 30 + 280)
+/* Clocked LEDs at the default 10 MHz: the start frame, 32 bits per pixel and the end frame */
+#define CLOCKED_FRAME_US(pixels)    ((8 + (pixels) * 4 + ((pixels) + 15) / 16) * 8 / 10)
+#define REFRESH_LATE_MARGIN_US      200
+
+typedef enum {
+    BENCH_BACKEND_RMT,
+    BENCH_BACKEND_SPI,
+} bench_backend_t;
+
+typedef struct {
+    const char *name;
+    bench_backend_t backend;
+    bool with_dma;
+    bool async_refresh;
+    led_model_t led_model;
+    bool dma_frame;
+} bench_config_t;
+
+static const bench_config_t s_configs[] = {
+#if SOC_RMT_SUPPORTED
+    {"RMT", BENCH_BACKEND_RMT, false, false},
+    {"RMT async", BENCH_BACKEND_RMT, false, true},
+#if SOC_RMT_SUPPORT_DMA
+    {"RMT DMA", BENCH_BACKEND_RMT, true, false},
+    {"RMT DMA frame", BENCH_BACKEND_RMT, true, false, LED_MODEL_WS2812, true},
+#endif
+#endif
+#if SOC_GPSPI_SUPPORTED
+    {"SPI DMA", BENCH_BACKEND_SPI, true, false},
+    {"SPI DMA async", BENCH_BACKEND_SPI, true, true},
+    {"SPI APA102", BENCH_BACKEND_SPI, true, false, LED_MODEL_APA102},
+#endif
+};
+
+static const uint32_t s_pixel_counts[] = {60, 300, 1000};
+
+typedef struct {
+    float fps;
+    uint32_t refresh_avg_us;
+    uint32_t refresh_max_us;
+    float set_pixel_cycles;
+    float load_percent;
+    uint32_t late_frames;
+    uint32_t errors;
+} bench_result_t;
+
+static volatile uint32_t s_spin_count;
+static volatile bool s_spin_stop;
+static volatile bool s_wifi_tx_stop;
+
+static esp_err_t bench_strip_create(const bench_config_t *config, uint32_t pixels, led_strip_handle_t *strip)
+{
+    led_strip_config_t strip_config = {
+        .strip_gpio_num = BENCH_GPIO_NUM,
+        .max_leds = pixels,
+        .led_pixel_format = LED_PIXEL_FORMAT_GRB,
+        .led_model = config->led_model,
+    };
+#if SOC_RMT_SUPPORTED
+    if (config->backend == BENCH_BACKEND_RMT) {
+        led_strip_rmt_config_t rmt_config = {
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = 10 * 1000 * 1000,
+            .flags.with_dma = config->with_dma,
+            .flags.async_refresh = config->async_refresh,
+            .flags.dma_frame = config->dma_frame,
+        };
+        return led_strip_new_rmt_device(&strip_config, &rmt_config, strip);
+    }
+#endif
+#if SOC_GPSPI_SUPPORTED
+    led_strip_spi_config_t spi_config = {
+        .clk_src = SPI_CLK_SRC_DEFAULT,
+        .spi_bus = SPI2_HOST,
+        .flags.with_dma = config->with_dma,
+        .flags.async_refresh = config->async_refresh,
+        .clk_gpio_num = BENCH_CLK_GPIO_NUM,
+    };
+    return led_strip_new_spi_device(&strip_config, &spi_config, strip);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static esp_err_t bench_fill(led_strip_handle_t strip, uint32_t pixels, uint32_t frame)
+{
+    esp_err_t err = ESP_OK;
+    for (uint32_t i = 0; i < pixels; i++) {
+        err |= led_strip_set_pixel(strip, i, (i + frame) & 0xFF, (i * 3 + frame) & 0xFF, (i * 7 + frame) & 0xFF);
+    }
+    return err;
+}
+
+static void bench_spinner_task(void *arg)
+{
+    while (!s_spin_stop) {
+        s_spin_count++;
+    }
+    vTaskDelete(NULL);
+}
+
+/* Spins below the benchmark on the same core, what it counts is what the benchmark left over */
+static void bench_spinner_start(void)
+{
+    s_spin_count = 0;
+    s_spin_stop = false;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(bench_spinner_task, "bench_spin", 2048, NULL,
+                                                      BENCH_SPINNER_PRIORITY, NULL, xPortGetCoreID()));
+}
+
+static uint32_t bench_spinner_stop(void)
+{
+    uint32_t count = s_spin_count;
+    s_spin_stop = true;
+    /* Let the spinner see the flag and delete itself */
+    vTaskDelay(pdMS_TO_TICKS(10));
+    return count;
+}
+
+static uint32_t bench_spinner_idle_count(void)
+{
+    bench_spinner_start();
+    vTaskDelay(pdMS_TO_TICKS(BENCH_DURATION_MS / 2));
+    return bench_spinner_stop();
+}
+
+static void bench_run(const bench_config_t *config, uint32_t pixels, uint32_t idle_count, bench_result_t *result)
+{
+    led_strip_handle_t strip = NULL;
+    memset(result, 0, sizeof(*result));
+    TEST_ESP_OK(bench_strip_create(config, pixels, &strip));
+
+    /* Pixel writes alone */
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+    for (uint32_t frame = 0; frame < BENCH_SET_PIXEL_FRAMES; frame++) {
+        bench_fill(strip, pixels, frame);
+    }
+    result->set_pixel_cycles = (float)(esp_cpu_get_cycle_count() - start_cycles) / (BENCH_SET_PIXEL_FRAMES * pixels);
+
+    /* Animation loop: a new frame every time */
+    uint32_t frames = 0;
+    uint64_t refresh_total_us = 0;
+    int64_t start_us = esp_timer_get_time();
+    int64_t end_us = start_us + BENCH_DURATION_MS * 1000LL;
+    while (esp_timer_get_time() < end_us) {
+        if (bench_fill(strip, pixels, frames) != ESP_OK) {
+            result->errors++;
+        }
+        int64_t refresh_start_us = esp_timer_get_time();
+        if (led_strip_refresh(strip) != ESP_OK) {
+            result->errors++;
+        }
+        uint32_t refresh_us = (uint32_t)(esp_timer_get_time() - refresh_start_us);
+        refresh_total_us += refresh_us;
+        if (refresh_us > result->refresh_max_us) {
+            result->refresh_max_us = refresh_us;
+        }
+        uint32_t frame_us = config->led_model == LED_MODEL_APA102 ? CLOCKED_FRAME_US(pixels) : FRAME_US(pixels);
+        if (!config->async_refresh && refresh_us > frame_us + REFRESH_LATE_MARGIN_US) {
+            result->late_frames++;
+        }
+        frames++;
+    }
+    result->fps = frames * 1e6f / (float)(esp_timer_get_time() - start_us);
+    result->refresh_avg_us = frames ? (uint32_t)(refresh_total_us / frames) : 0;
+
+    /* Refreshes of the same frame, the cost of sending it out */
+    bench_spinner_start();
+    end_us = esp_timer_get_time() + BENCH_DURATION_MS / 2 * 1000LL;
+    while (esp_timer_get_time() < end_us) {
+        /* An async refresh waits for the previous frame, so both kinds block for the frame time */
+        if (led_strip_refresh(strip) != ESP_OK) {
+            result->errors++;
+        }
+    }
+    uint32_t busy_count = bench_spinner_stop();
+    result->load_percent = busy_count >= idle_count ? 0 : 100.0f * (idle_count - busy_count) / idle_count;
+
+    TEST_ESP_OK(led_strip_clear(strip));
+    TEST_ESP_OK(led_strip_del(strip));
+}
+
+static void bench_run_all(const char *title)
+{
+    /* Above the spinner, the main task runs at its priority */
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, BENCH_TASK_PRIORITY);
+    uint32_t idle_count = bench_spinner_idle_count();
+    TEST_ASSERT_NOT_EQUAL(0, idle_count);
+
+    printf("\n%s\n", title);
+    printf("%-14s %6s %9s %11s %11s %10s %7s %6s %6s\n", "backend", "pixels", "fps", "refresh us", "refresh max",
+           "set cycles", "load %", "late", "errors");
+    for (size_t i = 0; i < sizeof(s_configs) / sizeof(s_configs[0]); i++) {
+        for (size_t j = 0; j < sizeof(s_pixel_counts) / sizeof(s_pixel_counts[0]); j++) {
+            bench_result_t result;
+            bench_run(&s_configs[i], s_pixel_counts[j], idle_count, &result);
+            printf("%-14s %6" PRIu32 " %9.1f %11" PRIu32 " %11" PRIu32 " %10.1f %7.1f %6" PRIu32 " %6" PRIu32 "\n",
+                   s_configs[i].name, s_pixel_counts[j], result.fps, result.refresh_avg_us, result.refresh_max_us,
+                   result.set_pixel_cycles, result.load_percent, result.late_frames, result.errors);
+            TEST_ASSERT_EQUAL(0, result.errors);
+        }
+    }
+    vTaskPrioritySet(NULL, priority);
+}
+
+/* Broadcast data frame, one of the frame types esp_wifi_80211_tx() accepts */
+static const uint8_t s_wifi_frame[] = {
+    0x08, 0x00,                             /* Data */
+    0x00, 0x00,                             /* Duration */
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff,     /* Receiver */
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x01,     /* Transmitter, locally administered */
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x01,     /* BSSID */
+    0x00, 0x00,                             /* Sequence, set by the driver */
+    0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x08, 0x00,
+    /* Payload */
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+static void bench_wifi_tx_task(void *arg)
+{
+    uint32_t sent = 0;
+    while (!s_wifi_tx_stop) {
+        /* Fails with ESP_ERR_NO_MEM while the driver queue is full, which is the point */
+        if (esp_wifi_80211_tx(WIFI_IF_STA, s_wifi_frame, sizeof(s_wifi_frame), true) == ESP_OK) {
+            sent++;
+        } else {
+            vTaskDelay(1);
+        }
+    }
+    ESP_LOGI(TAG, "%" PRIu32 " WiFi frames sent", sent);
+    *(volatile bool *)arg = true;
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("Refresh benchmark of the backends", "[led_strip][bench]")
+{
+    bench_run_all("Refresh benchmark");
+}
+
+#if SOC_WIFI_SUPPORTED
+TEST_CASE("Refresh benchmark of the backends with WiFi traffic", "[led_strip][bench][wifi]")
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        TEST_ESP_OK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    TEST_ESP_OK(err);
+    TEST_ESP_OK(esp_event_loop_create_default());
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_wifi_init(&cfg));
+    TEST_ESP_OK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    TEST_ESP_OK(esp_wifi_set_mode(WIFI_MODE_STA));
+    TEST_ESP_OK(esp_wifi_start());
+    TEST_ESP_OK(esp_wifi_set_channel(BENCH_WIFI_CHANNEL, WIFI_SECOND_CHAN_NONE));
+
+    /* On the other core when there is one, so that the strip core only sees the WiFi interrupts */
+    volatile bool tx_done = false;
+    s_wifi_tx_stop = false;
+    BaseType_t core = portNUM_PROCESSORS > 1 ? !xPortGetCoreID() : 0;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreatePinnedToCore(bench_wifi_tx_task, "bench_wifi_tx", 3072, (void *)&tx_done,
+                                                      BENCH_WIFI_TX_PRIORITY, NULL, core));
+
+    bench_run_all("Refresh benchmark with WiFi traffic");
+
+    s_wifi_tx_stop = true;
+    while (!tx_done) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ESP_OK(esp_wifi_stop());
+    TEST_ESP_OK(esp_wifi_deinit());
+    TEST_ESP_OK(esp_event_loop_delete_default());
+    TEST_ESP_OK(nvs_flash_deinit());
+}
+#endif
+
+void app_main(void)
+{
+    printf("LED strip benchmark, strip data line on GPIO %d\n", BENCH_GPIO_NUM);
+    unity_run_menu();
+}
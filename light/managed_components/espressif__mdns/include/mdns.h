@@ -34,6 +34,11 @@ extern "C" {
  */
 typedef struct mdns_search_once_s mdns_search_once_t;
 
+/**
+ * @brief   Batched asynchronous query handle
+ */
+typedef struct mdns_query_batch_s mdns_query_batch_t;
+
 /**
  * @brief   Daemon query handle
  */
@@ -59,6 +64,16 @@ typedef enum {
     MDNS_IP_PROTOCOL_MAX
 } mdns_ip_protocol_t;
 
+/**
+ * @brief   mDNS enum to specify what changed in a browsed instance
+ *          Used in mdns_browse_delta_new()
+ */
+typedef enum {
+    MDNS_BROWSE_ADDED,                      /*!< instance seen for the first time, it might not have all its records yet */
+    MDNS_BROWSE_CHANGED,                    /*!< host, port, TXT, addresses or TTL of a known instance changed */
+    MDNS_BROWSE_REMOVED,                    /*!< instance has gone (TTL 0), the result is freed after the notification */
+} mdns_browse_event_t;
+
 /**
  * @brief   mDNS basic text item structure
  *          Used in mdns_service_add()
@@ -84,6 +99,41 @@ typedef struct mdns_ip_addr_s {
     struct mdns_ip_addr_s *next;            /*!< next IP, or NULL for the last IP in the list */
 } mdns_ip_addr_t;
 
+/**
+ * @brief   mDNS service of a delegated host, for bulk registration
+ */
+typedef struct {
+    const char *instance;                   /*!< instance name, or NULL for the default instance */
+    const char *service;                    /*!< service type (_http, _ftp, etc) */
+    const char *proto;                      /*!< service protocol (_tcp, _udp) */
+    uint16_t port;                          /*!< service port */
+    mdns_txt_item_t *txt;                   /*!< TXT data, or NULL */
+    size_t num_items;                       /*!< number of items in TXT data */
+} mdns_delegate_service_t;
+
+/**
+ * @brief   mDNS delegated host with its services, for bulk registration
+ */
+typedef struct {
+    const char *hostname;                   /*!< hostname to delegate */
+    const mdns_ip_addr_t *address_list;     /*!< IP address list of the host */
+    const mdns_delegate_service_t *services;/*!< services of the host, or NULL */
+    size_t num_services;                    /*!< number of services */
+} mdns_delegate_host_t;
+
+/**
+ * @brief   mDNS statistics of an interface, counted since mdns_init()
+ */
+typedef struct {
+    uint32_t rx_packets;                    /*!< packets received from other hosts */
+    uint32_t rx_questions;                  /*!< questions parsed from the received packets */
+    uint32_t rx_dropped;                    /*!< received packets dropped, as the mDNS task could not take them */
+    uint32_t tx_answers;                    /*!< answers sent */
+    uint32_t tx_suppressed;                 /*!< answers not sent, as the asker already knew them */
+    uint32_t tx_bytes;                      /*!< bytes sent */
+    uint32_t probe_conflicts;               /*!< probes of ours that another host answered */
+} mdns_stats_t;
+
 /**
  * @brief mDNS query type to be explicitly set to either Unicast or Multicast
  */
@@ -117,8 +167,43 @@ typedef struct mdns_result_s {
     mdns_ip_addr_t *addr;                   /*!< linked list of IP addresses found */
 } mdns_result_t;
 
+/**
+ * @brief   Question of a batched query
+ */
+typedef struct {
+    const char *name;                       /*!< service instance or host name (NULL for PTR queries) */
+    const char *service_type;               /*!< service type (NULL for host queries) */
+    const char *proto;                      /*!< service protocol (NULL for host queries) */
+    uint16_t type;                          /*!< type of query (MDNS_TYPE_*) */
+} mdns_query_item_t;
+
 typedef void (*mdns_query_notify_t)(mdns_search_once_t *search);
+typedef void (*mdns_query_batch_notify_t)(mdns_query_batch_t *batch, size_t index);
 typedef void (*mdns_browse_notify_t)(mdns_result_t *result);
+typedef void (*mdns_browse_delta_notify_t)(mdns_result_t *result, mdns_browse_event_t event);
+
+/**
+ * @brief  Function queuing work on an executor, such as esp_rmaker_work_queue_add_task()
+ */
+typedef esp_err_t (*mdns_executor_post_t)(void (*work)(void *arg), void *arg);
+
+/**
+ * @brief  Run the mDNS actions on an executor shared with other components instead of the mDNS task
+ *
+ * @note   Only with CONFIG_MDNS_SHARED_TASK, and before mdns_init(). The mDNS task, and its stack, are then not
+ *         created: each action queued posts a drain of the action queue to the executor, which runs it in its own
+ *         task. The scheduler still runs from the esp_timer task. The APIs which wait for the action they
+ *         queued, like mdns_hostname_set() or mdns_query(), must not be called from the executor task, they
+ *         would wait for work queued behind them.
+ *
+ * @param  post  posts work to the executor, NULL to run the mDNS task again
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE mDNS is running
+ *     - ESP_ERR_NOT_SUPPORTED CONFIG_MDNS_SHARED_TASK is disabled
+ */
+esp_err_t mdns_executor_set(mdns_executor_post_t post);
 
 /**
  * @brief  Initialize mDNS on given interface
@@ -180,6 +265,24 @@ esp_err_t mdns_hostname_get(char *hostname);
  */
 esp_err_t mdns_delegate_hostname_add(const char *hostname, const mdns_ip_addr_t *address_list);
 
+/**
+ * @brief  Adds several delegated hostnames together with their services
+ *         All the services are probed and announced in one combined sequence,
+ *         rather than one per host as with mdns_delegate_hostname_add() and mdns_service_add_for_host()
+ *
+ * @note   Nothing is added if any of the hosts or services cannot be added.
+ *
+ * @param  hosts        array of the hosts to add
+ * @param  num_hosts    number of hosts in the array
+ *
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_STATE mDNS is not running
+ *     - ESP_ERR_INVALID_ARG Parameter error, a hostname is already added or a service already exists
+ *     - ESP_ERR_NO_MEM memory error, or more services than CONFIG_MDNS_MAX_SERVICES
+ */
+esp_err_t mdns_delegate_hosts_add(const mdns_delegate_host_t hosts[], size_t num_hosts);
+
 /**
  * @brief  Set the address to a delegated hostname
  *
@@ -642,6 +745,29 @@ esp_err_t mdns_service_subtype_update_multiple_items_for_host(const char *instan
  */
 esp_err_t mdns_service_remove_all(void);
 
+/**
+ * @brief  Start a batch of service updates
+ *
+ * @note   The port, TXT, subtype and instance name setters called until the matching mdns_transaction_commit()
+ *         update the services right away, but their announcements are held back and sent as one announcement
+ *         per interface on commit. Transactions can be nested, only the outermost commit announces.
+ *
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_STATE mDNS is not running or too many nested transactions
+ */
+esp_err_t mdns_transaction_begin(void);
+
+/**
+ * @brief  End a batch of service updates started with mdns_transaction_begin()
+ *         and announce all the services changed within it
+ *
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_STATE mDNS is not running or no transaction was started
+ */
+esp_err_t mdns_transaction_commit(void);
+
 /**
  * @brief Deletes the finished query. Call this only after the search has ended!
  *
@@ -688,6 +814,56 @@ bool mdns_query_async_get_results(mdns_search_once_t *search, uint32_t timeout,
 mdns_search_once_t *mdns_query_async_new(const char *name, const char *service_type, const char *proto, uint16_t type,
         uint32_t timeout, size_t max_results, mdns_query_notify_t notifier);
 
+/**
+ * @brief  Query mDNS for several hosts or services at once, asynchronously.
+ *         Batch has to be tested for progress and deleted manually!
+ *
+ * @note   The questions are sent together, packed into as few query packets per interface as they fit in,
+ *         instead of one packet per question. Each question collects its results and ends on its own,
+ *         when it has max_results or the timeout is over.
+ *
+ * @param  items        questions of the batch
+ * @param  num_items    number of questions
+ * @param  timeout      time in milliseconds during which the questions are active
+ * @param  max_results  maximum results to be collected for each question
+ * @param  notifier     Notification function to be called with the index of each question when its results
+ *                      are ready, can be NULL
+ *
+ * @return pointer to new batch object if the queries were initiated successfully.
+ *         NULL otherwise.
+ */
+mdns_query_batch_t *mdns_query_batch_new(const mdns_query_item_t *items, size_t num_items, uint32_t timeout,
+        size_t max_results, mdns_query_batch_notify_t notifier);
+
+/**
+ * @brief Get the results of one question of a batch. The results are owned by the batch
+ *        and stay valid until `mdns_query_batch_delete`.
+ *
+ * @param batch pointer to batch object
+ * @param index index of the question in the items given to `mdns_query_batch_new`
+ * @param timeout time in milliseconds to wait for the question to end
+ * @param results pointer to the results of the question (set to NULL to ignore this return value)
+ * @param num_results pointer to the number of the actual result items (set to NULL to ignore this return value)
+ *
+ * @return
+ *      True if the question has finished before or at timeout
+ *      False if the timeout is over, or the index is out of range
+ */
+bool mdns_query_batch_get_results(mdns_query_batch_t *batch, size_t index, uint32_t timeout,
+                                  mdns_result_t **results, uint8_t *num_results);
+
+/**
+ * @brief Deletes the finished batch and the results of all its questions. Call this only after all of them have ended!
+ *
+ * @param batch pointer to batch object
+ *
+ * @return
+ *     - ESP_OK success
+ *     - ESP_ERR_INVALID_STATE  a question has not finished
+ *     - ESP_ERR_INVALID_ARG    pointer to batch object is NULL
+ */
+esp_err_t mdns_query_batch_delete(mdns_query_batch_t *batch);
+
 /**
  * @brief  Generic mDNS query
  *         All following query methods are derived from this one
@@ -908,6 +1084,20 @@ esp_err_t mdns_unregister_netif(esp_netif_t *esp_netif);
  */
 esp_err_t mdns_netif_action(esp_netif_t *esp_netif, mdns_event_actions_t event_action);
 
+/**
+ * @brief   Get the statistics of an interface
+ *
+ * @param esp_netif  Pointer to esp-netif interface, or NULL for the sum over all the interfaces
+ * @param stats      Pointer to the statistics to fill in, IPv4 and IPv6 are counted together
+ * @return
+ *     - ESP_OK                 success
+ *     - ESP_ERR_INVALID_STATE  mDNS is not running
+ *     - ESP_ERR_INVALID_ARG    stats is NULL
+ *     - ESP_ERR_NOT_FOUND      this esp-netif was not registered in mDNS service
+ *     - ESP_ERR_NOT_SUPPORTED  CONFIG_MDNS_ENABLE_STATS is disabled
+ */
+esp_err_t mdns_stats_get(esp_netif_t *esp_netif, mdns_stats_t *stats);
+
 /**
  * @brief   Browse mDNS for a service `_service._proto`.
  *
@@ -919,6 +1109,20 @@ esp_err_t mdns_netif_action(esp_netif_t *esp_netif, mdns_event_actions_t event_a
  */
 mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier);
 
+/**
+ * @brief   Browse mDNS for a service `_service._proto`, notifying the changes per instance.
+ *
+ * Unlike mdns_browse_new(), the notifier is called once per added, changed or removed instance,
+ * with a single result (its `next` is NULL) which stays owned by the browse.
+ *
+ * @param service  Pointer to the `_service` which will be browsed.
+ * @param proto    Pointer to the `_proto` which will be browsed.
+ * @param notifier The callback which will be called for each instance that changed.
+ * @return mdns_browse_t pointer to new browse object if initiated successfully.
+ *         NULL otherwise.
+ */
+mdns_browse_t *mdns_browse_delta_new(const char *service, const char *proto, mdns_browse_delta_notify_t notifier);
+
 /**
  * @brief   Stop the `_service._proto` browse.
  * @param service  Pointer to the `_service` which will be browsed.
@@ -5,6 +5,8 @@
  */
 
 #include <string.h>
+#include <stddef.h>
+#include <ctype.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -39,6 +41,11 @@ static void _mdns_browse_send(mdns_browse_t *browse, mdns_if_t interface);
 #include "esp_wifi.h"
 #endif
 
+#ifdef CONFIG_MDNS_FAST_BOOT_PROBE
+#include "nvs.h"
+#define MDNS_NVS_NAMESPACE  "mdns"
+#endif
+
 #ifdef MDNS_ENABLE_DEBUG
 void mdns_debug_packet(const uint8_t *data, size_t len);
 #endif
@@ -60,10 +67,62 @@ static mdns_host_item_t _mdns_self_host;
 
 static const char *TAG = "mdns";
 
+#if CONFIG_DIAG_ENABLE_TRACE
+/* Weak, so that the events are only recorded when the application links the esp_diagnostics trace */
+extern void esp_diag_trace_record(const char *name, uint8_t phase, uint32_t arg) __attribute__((weak));
+#define MDNS_TRACE(phase, arg) do {                                 \
+        if (esp_diag_trace_record) {                                \
+            esp_diag_trace_record("mdns_parse_packet", phase, arg); \
+        }                                                           \
+    } while (0)
+#else
+#define MDNS_TRACE(phase, arg)
+#endif
+
+#if CONFIG_DIAG_HEAP_TAGS
+/* Weak as well, the memory of this file is accounted to the "mdns" heap tag when esp_diagnostics is linked in.
+ * The allocators are defined together, checking one of them is enough. */
+extern void *esp_diag_heap_tag_malloc(const char *tag, size_t size) __attribute__((weak));
+extern void *esp_diag_heap_tag_calloc(const char *tag, size_t n, size_t size) __attribute__((weak));
+extern char *esp_diag_heap_tag_strdup(const char *tag, const char *str) __attribute__((weak));
+extern char *esp_diag_heap_tag_strndup(const char *tag, const char *str, size_t n) __attribute__((weak));
+extern void esp_diag_heap_tag_free(const char *tag, void *ptr) __attribute__((weak));
+#define MDNS_HEAP_TAG       "mdns"
+#define MDNS_HEAP_TAGGED    (esp_diag_heap_tag_malloc != NULL)
+#define malloc(size)        (MDNS_HEAP_TAGGED ? esp_diag_heap_tag_malloc(MDNS_HEAP_TAG, size) : malloc(size))
+#define calloc(n, size)     (MDNS_HEAP_TAGGED ? esp_diag_heap_tag_calloc(MDNS_HEAP_TAG, n, size) : calloc(n, size))
+#define strdup(str)         (MDNS_HEAP_TAGGED ? esp_diag_heap_tag_strdup(MDNS_HEAP_TAG, str) : strdup(str))
+#define strndup(str, n)     (MDNS_HEAP_TAGGED ? esp_diag_heap_tag_strndup(MDNS_HEAP_TAG, str, n) : strndup(str, n))
+#define free(ptr)           (MDNS_HEAP_TAGGED ? esp_diag_heap_tag_free(MDNS_HEAP_TAG, ptr) : free(ptr))
+#endif
+
 static volatile TaskHandle_t _mdns_service_task_handle = NULL;
 static SemaphoreHandle_t _mdns_service_semaphore = NULL;
+#ifdef CONFIG_MDNS_SHARED_TASK
+static mdns_executor_post_t _mdns_executor_post = NULL;   // set by mdns_executor_set(), NULL to run the mDNS task
+static bool _mdns_executor_running;                         // actions are drained from the executor, no mDNS task
+static bool _mdns_executor_posted;                          // a drain is posted and has not started yet
+static bool _mdns_executor_busy;                            // a drain is running
+static bool _mdns_executor_stopping;
+#endif /* CONFIG_MDNS_SHARED_TASK */
+
+static BaseType_t _mdns_action_send(mdns_action_t *action);
 
 static void _mdns_search_finish_done(void);
+static void _mdns_timer_rearm(void);
+static inline uint16_t _mdns_read_u16(const uint8_t *packet, uint16_t index);
+static void _mdns_set_multicast_dst(esp_ip_addr_t *dst, mdns_ip_protocol_t ip_protocol);
+#ifdef CONFIG_MDNS_MCAST_RATE_LIMIT
+static void _mdns_mcast_records_sent(const mdns_tx_packet_t *p);
+#else
+#define _mdns_mcast_records_sent(p)
+#define _mdns_mcast_records_forget(service, host)
+#define _mdns_mcast_rate_limit(packet, interval)
+#endif /* CONFIG_MDNS_MCAST_RATE_LIMIT */
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+static void _mdns_netif_events_add(mdns_if_t mdns_if, uint32_t action);
+static void _mdns_netif_events_flush(void);
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
 static mdns_search_once_t *_mdns_search_find_from(mdns_search_once_t *search, mdns_name_t *name, uint16_t type, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
 static mdns_browse_t *_mdns_browse_find_from(mdns_browse_t *b, mdns_name_t *name, uint16_t type, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol);
 static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostname, const char *instance, const char *service, const char *proto,
@@ -267,6 +326,112 @@ static char *_mdns_mangle_name(char *in)
     return ret;
 }
 
+#ifdef CONFIG_MDNS_FAST_BOOT_PROBE
+// NVS keys of the names claimed, each stored as "<requested>\0<claimed>\0"
+static const char *const _mdns_claimed_keys[MDNS_CLAIMED_NAMES] = { "host", "inst" };
+
+/**
+ * @brief  Name to probe for a requested one: the name claimed for it before the reboot, if it was renamed
+ *         after a conflict, so that renaming goes on from there instead of starting from scratch
+ *
+ * @return requested, or the claimed name in place of it (requested is freed)
+ */
+static char *_mdns_claimed_name_restore(mdns_claimed_name_t kind, char *requested)
+{
+    free(_mdns_server->claimed_requested[kind]);
+    _mdns_server->claimed_requested[kind] = NULL;
+    if (_str_null_or_empty(requested)) {
+        return requested;
+    }
+    _mdns_server->claimed_requested[kind] = strdup(requested);
+
+    char stored[2 * MDNS_NAME_BUF_LEN];
+    size_t len = sizeof(stored);
+    nvs_handle_t handle;
+    if (nvs_open(MDNS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return requested;
+    }
+    esp_err_t err = nvs_get_blob(handle, _mdns_claimed_keys[kind], stored, &len);
+    nvs_close(handle);
+    if (err != ESP_OK || len < 2 || stored[len - 1] != 0) {
+        return requested;
+    }
+    size_t requested_len = strlen(stored);
+    if (requested_len + 1 >= len || strcmp(stored, requested)) {
+        // claimed for another name
+        return requested;
+    }
+    const char *claimed = stored + requested_len + 1;
+    if (!strcmp(claimed, requested)) {
+        return requested;
+    }
+    char *name = strdup(claimed);
+    if (!name) {
+        HOOK_MALLOC_FAILED;
+        return requested;
+    }
+    ESP_LOGD(TAG, "Probing for %s, claimed for %s before", name, requested);
+    free(requested);
+    return name;
+}
+
+/**
+ * @brief  Persist the name claimed for the requested one, written only when it changed
+ */
+static void _mdns_claimed_name_store(mdns_claimed_name_t kind, const char *claimed)
+{
+    const char *requested = _mdns_server->claimed_requested[kind];
+    if (!requested || _str_null_or_empty(claimed)) {
+        return;
+    }
+    char entry[2 * MDNS_NAME_BUF_LEN];
+    int len = snprintf(entry, sizeof(entry), "%s%c%s", requested, 0, claimed);
+    if (len < 0 || (size_t)len >= sizeof(entry)) {
+        return;
+    }
+    len++;
+
+    char stored[2 * MDNS_NAME_BUF_LEN];
+    size_t stored_len = sizeof(stored);
+    nvs_handle_t handle;
+    if (nvs_open(MDNS_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(handle, _mdns_claimed_keys[kind], stored, &stored_len) != ESP_OK
+            || stored_len != (size_t)len || memcmp(stored, entry, len)) {
+        if (nvs_set_blob(handle, _mdns_claimed_keys[kind], entry, len) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to store the claimed name %s", claimed);
+        }
+    }
+    nvs_close(handle);
+}
+
+/**
+ * @brief  Persist the hostname and instance name, once a probe for them has succeeded
+ */
+static void _mdns_claimed_names_store(void)
+{
+    _mdns_claimed_name_store(MDNS_CLAIMED_HOSTNAME, _mdns_server->hostname);
+    _mdns_claimed_name_store(MDNS_CLAIMED_INSTANCE, _mdns_server->instance);
+}
+#else
+#define _mdns_claimed_name_restore(kind, requested) (requested)
+#define _mdns_claimed_names_store()
+#endif /* CONFIG_MDNS_FAST_BOOT_PROBE */
+
+/**
+ * @brief  Random delay before the first probe of a PCB
+ */
+static uint32_t _mdns_probe_delay(void)
+{
+#ifdef CONFIG_MDNS_FAST_BOOT_PROBE
+    // uniformly distributed in 0-250 ms, as early as RFC 6762, 8.1 allows
+    return esp_random() % 250;
+#else
+    return 120 + (esp_random() & 0x7F);
+#endif
+}
+
 static bool _mdns_service_match(const mdns_service_t *srv, const char *service, const char *proto,
                                 const char *hostname)
 {
@@ -277,6 +442,61 @@ static bool _mdns_service_match(const mdns_service_t *srv, const char *service,
            (_str_null_or_empty(hostname) || !strcasecmp(srv->hostname, hostname));
 }
 
+/**
+ * @brief  continues the case insensitive FNV-1a hash with the string
+ */
+static uint32_t _mdns_hash_str(uint32_t hash, const char *str)
+{
+    for (const char *c = str; *c; c++) {
+        hash = (hash ^ (uint8_t)tolower((unsigned char)*c)) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief  case insensitive FNV-1a hash of the service type and proto, the key of the service index
+ */
+static uint32_t _mdns_service_hash(const char *service, const char *proto)
+{
+    uint32_t hash = _mdns_hash_str(2166136261U, service);
+    hash = (hash ^ '.') * 16777619U;
+    return _mdns_hash_str(hash, proto);
+}
+
+static inline mdns_srv_item_t *_mdns_service_index_bucket(uint32_t hash)
+{
+    return _mdns_server->service_index[hash & (MDNS_SERVICE_INDEX_SIZE - 1)];
+}
+
+/**
+ * @brief  adds the service item to the head of the services list and of its index bucket
+ *         so that the buckets keep the list order and lookups return the same item as a list walk
+ */
+static void _mdns_service_item_link(mdns_srv_item_t *item)
+{
+    item->index_hash = _mdns_service_hash(item->service->service, item->service->proto);
+    mdns_srv_item_t **bucket = &_mdns_server->service_index[item->index_hash & (MDNS_SERVICE_INDEX_SIZE - 1)];
+    item->index_next = *bucket;
+    *bucket = item;
+    item->next = _mdns_server->services;
+    _mdns_server->services = item;
+}
+
+/**
+ * @brief  removes the service item from its index bucket, the caller unlinks it from the services list
+ */
+static void _mdns_service_index_remove(mdns_srv_item_t *item)
+{
+    mdns_srv_item_t **it = &_mdns_server->service_index[item->index_hash & (MDNS_SERVICE_INDEX_SIZE - 1)];
+    while (*it) {
+        if (*it == item) {
+            *it = item->index_next;
+            return;
+        }
+        it = &(*it)->index_next;
+    }
+}
+
 /**
  * @brief  finds service from given service type
  * @param  server       the server
@@ -288,21 +508,29 @@ static bool _mdns_service_match(const mdns_service_t *srv, const char *service,
  */
 static mdns_srv_item_t *_mdns_get_service_item(const char *service, const char *proto, const char *hostname)
 {
-    mdns_srv_item_t *s = _mdns_server->services;
+    if (!service || !proto) {
+        return NULL;
+    }
+    uint32_t hash = _mdns_service_hash(service, proto);
+    mdns_srv_item_t *s = _mdns_service_index_bucket(hash);
     while (s) {
-        if (_mdns_service_match(s->service, service, proto, hostname)) {
+        if (s->index_hash == hash && _mdns_service_match(s->service, service, proto, hostname)) {
             return s;
         }
-        s = s->next;
+        s = s->index_next;
     }
     return NULL;
 }
 
 static mdns_srv_item_t *_mdns_get_service_item_subtype(const char *subtype, const char *service, const char *proto)
 {
-    mdns_srv_item_t *s = _mdns_server->services;
+    if (!service || !proto) {
+        return NULL;
+    }
+    uint32_t hash = _mdns_service_hash(service, proto);
+    mdns_srv_item_t *s = _mdns_service_index_bucket(hash);
     while (s) {
-        if (_mdns_service_match(s->service, service, proto, NULL)) {
+        if (s->index_hash == hash && _mdns_service_match(s->service, service, proto, NULL)) {
             mdns_subtype_t *subtype_item = s->service->subtype;
             while (subtype_item) {
                 if (!strcasecmp(subtype_item->subtype, subtype)) {
@@ -311,7 +539,7 @@ static mdns_srv_item_t *_mdns_get_service_item_subtype(const char *subtype, cons
                 subtype_item = subtype_item->next;
             }
         }
-        s = s->next;
+        s = s->index_next;
     }
     return NULL;
 }
@@ -356,16 +584,22 @@ esp_err_t _mdns_send_rx_action(mdns_rx_packet_t *packet)
     action = (mdns_action_t *)malloc(sizeof(mdns_action_t));
     if (!action) {
         HOOK_MALLOC_FAILED;
-        return ESP_ERR_NO_MEM;
+        goto drop;
     }
 
     action->type = ACTION_RX_HANDLE;
     action->data.rx_handle.packet = packet;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(action);
-        return ESP_ERR_NO_MEM;
+        goto drop;
     }
     return ESP_OK;
+
+drop:
+    for (mdns_rx_packet_t *p = packet; p; p = p->next) {
+        MDNS_STATS_INC(p->tcpip_if, rx_dropped);
+    }
+    return ESP_ERR_NO_MEM;
 }
 
 static const char *_mdns_get_default_instance_name(void)
@@ -420,8 +654,16 @@ static bool _mdns_service_match_instance(const mdns_service_t *srv, const char *
 static mdns_srv_item_t *_mdns_get_service_item_instance(const char *instance, const char *service, const char *proto,
         const char *hostname)
 {
-    mdns_srv_item_t *s = _mdns_server->services;
+    if (!service || !proto) {
+        return NULL;
+    }
+    uint32_t hash = _mdns_service_hash(service, proto);
+    mdns_srv_item_t *s = _mdns_service_index_bucket(hash);
     while (s) {
+        if (s->index_hash != hash) {
+            s = s->index_next;
+            continue;
+        }
         if (instance) {
             if (_mdns_service_match_instance(s->service, instance, service, proto, hostname)) {
                 return s;
@@ -431,7 +673,7 @@ static mdns_srv_item_t *_mdns_get_service_item_instance(const char *instance, co
                 return s;
             }
         }
-        s = s->next;
+        s = s->index_next;
     }
     return NULL;
 }
@@ -500,6 +742,12 @@ static const uint8_t *_mdns_read_fqdn(const uint8_t *packet, const uint8_t *star
     return start + index + 1;
 }
 
+/**
+ * @brief  set when a record could not be appended as the tx packet is full,
+ *         so the dispatcher moves the record to the next packet
+ */
+static bool _mdns_packet_overflow = false;
+
 /**
  * @brief  sets uint16_t value in a packet
  *
@@ -528,6 +776,7 @@ static inline void _mdns_set_u16(uint8_t *packet, uint16_t index, uint16_t value
 static inline uint8_t _mdns_append_u8(uint8_t *packet, uint16_t *index, uint8_t value)
 {
     if (*index >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     packet[*index] = value;
@@ -547,6 +796,7 @@ static inline uint8_t _mdns_append_u8(uint8_t *packet, uint16_t *index, uint8_t
 static inline uint8_t _mdns_append_u16(uint8_t *packet, uint16_t *index, uint16_t value)
 {
     if ((*index + 1) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, (value >> 8) & 0xFF);
@@ -566,6 +816,7 @@ static inline uint8_t _mdns_append_u16(uint8_t *packet, uint16_t *index, uint16_
 static inline uint8_t _mdns_append_u32(uint8_t *packet, uint16_t *index, uint32_t value)
 {
     if ((*index + 3) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, (value >> 24) & 0xFF);
@@ -588,6 +839,7 @@ static inline uint8_t _mdns_append_u32(uint8_t *packet, uint16_t *index, uint32_
 static inline uint8_t _mdns_append_type(uint8_t *packet, uint16_t *index, uint8_t type, bool flush, uint32_t ttl)
 {
     if ((*index + 10) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     uint16_t mdns_class = MDNS_CLASS_IN;
@@ -620,6 +872,7 @@ static inline uint8_t _mdns_append_type(uint8_t *packet, uint16_t *index, uint8_
 static inline uint8_t _mdns_append_string_with_len(uint8_t *packet, uint16_t *index, const char *string, uint8_t len)
 {
     if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, len);
@@ -641,6 +894,7 @@ static inline uint8_t _mdns_append_string(uint8_t *packet, uint16_t *index, cons
 {
     uint8_t len = strlen(string);
     if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, len);
@@ -668,6 +922,7 @@ static inline int append_one_txt_record_entry(uint8_t *packet, uint16_t *index,
     size_t key_len = strlen(txt->key);
     size_t len = key_len + txt->value_len + (txt->value ? 1 : 0);
     if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, len);
@@ -684,6 +939,7 @@ static inline int append_one_txt_record_entry(uint8_t *packet, uint16_t *index,
 static inline int append_single_str(uint8_t *packet, uint16_t *index, const char *str, int len)
 {
     if ((*index + len + 1) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     if (!_mdns_append_u8(packet, index, len)) {
@@ -997,6 +1253,20 @@ static uint16_t _mdns_append_txt_record(uint8_t *packet, uint16_t *index, mdns_s
     uint16_t data_len_location = *index - 2;
     uint16_t data_len = 0;
 
+    if (service->txt_rdata) {
+        // txt not changed since the last answer, copy the already encoded data
+        data_len = service->txt_rdata_len;
+        if ((*index + data_len) >= MDNS_MAX_PACKET_SIZE) {
+            _mdns_packet_overflow = true;
+            return 0;
+        }
+        memcpy(packet + *index, service->txt_rdata, data_len);
+        *index += data_len;
+        _mdns_set_u16(packet, data_len_location, data_len);
+        record_length += data_len;
+        return record_length;
+    }
+
     mdns_txt_linked_item_t *txt = service->txt;
     while (txt) {
         int l = append_one_txt_record_entry(packet, index, txt);
@@ -1013,6 +1283,12 @@ static uint16_t _mdns_append_txt_record(uint8_t *packet, uint16_t *index, mdns_s
         *index = *index + 1;
     }
     _mdns_set_u16(packet, data_len_location, data_len);
+    // keep the encoded data for the next answers, on allocation failure it is simply encoded again
+    service->txt_rdata = (uint8_t *)malloc(data_len);
+    if (service->txt_rdata) {
+        memcpy(service->txt_rdata, packet + *index - data_len, data_len);
+        service->txt_rdata_len = data_len;
+    }
     record_length += data_len;
     return record_length;
 }
@@ -1128,6 +1404,7 @@ static uint16_t _mdns_append_a_record(uint8_t *packet, uint16_t *index, const ch
     uint16_t data_len_location = *index - 2;
 
     if ((*index + 3) >= MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
     _mdns_append_u8(packet, index, ip & 0xFF);
@@ -1181,6 +1458,7 @@ static uint16_t _mdns_append_aaaa_record(uint8_t *packet, uint16_t *index, const
     uint16_t data_len_location = *index - 2;
 
     if ((*index + MDNS_ANSWER_AAAA_SIZE) > MDNS_MAX_PACKET_SIZE) {
+        _mdns_packet_overflow = true;
         return 0;
     }
 
@@ -1480,19 +1758,59 @@ static uint8_t _mdns_append_answer(uint8_t *packet, uint16_t *index, mdns_out_an
     return 0;
 }
 
+/**
+ * @brief  writes one encoded packet to the network
+ *
+ * @param  p       the packet being sent
+ * @param  packet  encoded data
+ * @param  len     length of the encoded data
+ */
+static void _mdns_write_tx_packet(mdns_tx_packet_t *p, uint8_t *packet, uint16_t len)
+{
+#ifdef MDNS_ENABLE_DEBUG
+    _mdns_dbg_printf("\nTX[%lu][%lu]: ", (unsigned long)p->tcpip_if, (unsigned long)p->ip_protocol);
+#ifdef CONFIG_LWIP_IPV4
+    if (p->dst.type == ESP_IPADDR_TYPE_V4) {
+        _mdns_dbg_printf("To: " IPSTR ":%u, ", IP2STR(&p->dst.u_addr.ip4), p->port);
+    }
+#endif
+#ifdef CONFIG_LWIP_IPV6
+    if (p->dst.type == ESP_IPADDR_TYPE_V6) {
+        _mdns_dbg_printf("To: " IPV6STR ":%u, ", IPV62STR(p->dst.u_addr.ip6), p->port);
+    }
+#endif
+    mdns_debug_packet(packet, len);
+#endif
+
+    if (_mdns_udp_pcb_write(p->tcpip_if, p->ip_protocol, &p->dst, p->port, packet, len)) {
+        MDNS_STATS_ADD(p->tcpip_if, tx_answers, _mdns_read_u16(packet, MDNS_HEAD_ANSWERS_OFFSET));
+        MDNS_STATS_ADD(p->tcpip_if, tx_bytes, len);
+    }
+}
+
 /**
  * @brief  sends a packet
  *
+ * Records that do not fit in MDNS_MAX_PACKET_SIZE are carried by following packets. Those repeat
+ * neither the questions nor the records already sent. A query continued this way has the TC bit
+ * set, so responders wait for the rest of its known answers (RFC 6762, 7.2). Responses are split
+ * with the TC bit clear, as required for multicast responses (RFC 6762, 18.5).
+ *
  * @param  p       the packet
  */
 static void _mdns_dispatch_tx_packet(mdns_tx_packet_t *p)
 {
     static uint8_t packet[MDNS_MAX_PACKET_SIZE];
+    static const uint16_t count_offsets[] = { MDNS_HEAD_ANSWERS_OFFSET, MDNS_HEAD_SERVERS_OFFSET, MDNS_HEAD_ADDITIONAL_OFFSET };
+    mdns_out_answer_t *sections[] = { p->answers, p->servers, p->additional };
+    uint8_t counts[3] = { 0 };
     uint16_t index = MDNS_HEAD_LEN;
+    uint16_t records_start;
     memset(packet, 0, MDNS_HEAD_LEN);
     mdns_out_question_t *q;
     mdns_out_answer_t *a;
     uint8_t count;
+    size_t i;
 
     _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
     _mdns_set_u16(packet, MDNS_HEAD_ID_OFFSET, p->id);
@@ -1500,55 +1818,131 @@ static void _mdns_dispatch_tx_packet(mdns_tx_packet_t *p)
     count = 0;
     q = p->questions;
     while (q) {
-        if (_mdns_append_question(packet, &index, q)) {
+        uint16_t question_index = index;
+        _mdns_packet_overflow = false;
+        if (_mdns_append_question(packet, &index, q) && !_mdns_packet_overflow) {
             count++;
+            q = q->next;
+            continue;
+        }
+        // drop what was written of the question, send the questions so far and retry it alone in the next packet
+        index = question_index;
+        if (count) {
+            _mdns_set_u16(packet, MDNS_HEAD_QUESTIONS_OFFSET, count);
+            _mdns_write_tx_packet(p, packet, index);
+            memset(packet, 0, MDNS_HEAD_LEN);
+            _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
+            _mdns_set_u16(packet, MDNS_HEAD_ID_OFFSET, p->id);
+            index = MDNS_HEAD_LEN;
+            count = 0;
+            continue;
         }
+        ESP_LOGD(TAG, "Question too large for a packet, skipped");
         q = q->next;
     }
     _mdns_set_u16(packet, MDNS_HEAD_QUESTIONS_OFFSET, count);
+    records_start = index;
 
-    count = 0;
-    a = p->answers;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
+    for (i = 0; i < ARRAY_SIZE(sections); i++) {
+        a = sections[i];
+        while (a) {
+            uint16_t record_index = index;
+            _mdns_packet_overflow = false;
+            count = _mdns_append_answer(packet, &index, a, p->tcpip_if);
+            if (_mdns_packet_overflow) {
+                // drop what was written of the answer and retry it alone in the next packet
+                index = record_index;
+                count = 0;
+                if (index > records_start) {
+                    for (size_t j = 0; j < ARRAY_SIZE(counts); j++) {
+                        _mdns_set_u16(packet, count_offsets[j], counts[j]);
+                        counts[j] = 0;
+                    }
+                    if (p->questions && (p->flags & MDNS_FLAGS_QUERY_REPSONSE) == 0) {
+                        _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags | MDNS_FLAGS_TRUNCATED);
+                    }
+                    _mdns_write_tx_packet(p, packet, index);
+                    memset(packet, 0, MDNS_HEAD_LEN);
+                    _mdns_set_u16(packet, MDNS_HEAD_FLAGS_OFFSET, p->flags);
+                    _mdns_set_u16(packet, MDNS_HEAD_ID_OFFSET, p->id);
+                    index = MDNS_HEAD_LEN;
+                    records_start = index;
+                    continue;
+                }
+                ESP_LOGD(TAG, "Answer too large for a packet, skipped");
+            }
+            counts[i] += count;
+            a = a->next;
+        }
     }
-    _mdns_set_u16(packet, MDNS_HEAD_ANSWERS_OFFSET, count);
-
-    count = 0;
-    a = p->servers;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
+    for (i = 0; i < ARRAY_SIZE(counts); i++) {
+        _mdns_set_u16(packet, count_offsets[i], counts[i]);
     }
-    _mdns_set_u16(packet, MDNS_HEAD_SERVERS_OFFSET, count);
+    _mdns_write_tx_packet(p, packet, index);
+    _mdns_mcast_records_sent(p);
+}
 
-    count = 0;
-    a = p->additional;
-    while (a) {
-        count += _mdns_append_answer(packet, &index, a, p->tcpip_if);
-        a = a->next;
-    }
-    _mdns_set_u16(packet, MDNS_HEAD_ADDITIONAL_OFFSET, count);
+#ifdef CONFIG_MDNS_MEMORY_POOL
+typedef struct mdns_pool_item_s {
+    struct mdns_pool_item_s *next;
+} mdns_pool_item_t;
 
-#ifdef MDNS_ENABLE_DEBUG
-    _mdns_dbg_printf("\nTX[%lu][%lu]: ", (unsigned long)p->tcpip_if, (unsigned long)p->ip_protocol);
-#ifdef CONFIG_LWIP_IPV4
-    if (p->dst.type == ESP_IPADDR_TYPE_V4) {
-        _mdns_dbg_printf("To: " IPSTR ":%u, ", IP2STR(&p->dst.u_addr.ip4), p->port);
+typedef struct {
+    mdns_pool_item_t *free_items;           // items given back to the pool
+    uint8_t *storage;
+    size_t item_size;
+    size_t count;
+    size_t used;                            // items of the storage handed out at least once
+} mdns_pool_t;
+
+static mdns_tx_packet_t _mdns_tx_packet_storage[CONFIG_MDNS_POOL_TX_PACKETS];
+static mdns_out_answer_t _mdns_answer_storage[CONFIG_MDNS_POOL_ANSWERS];
+static mdns_pool_t _mdns_tx_packet_pool = { NULL, (uint8_t *)_mdns_tx_packet_storage, sizeof(mdns_tx_packet_t), CONFIG_MDNS_POOL_TX_PACKETS, 0 };
+static mdns_pool_t _mdns_answer_pool = { NULL, (uint8_t *)_mdns_answer_storage, sizeof(mdns_out_answer_t), CONFIG_MDNS_POOL_ANSWERS, 0 };
+
+/**
+ * @brief  takes an item from the pool, or from the heap if the pool is exhausted
+ *         Like the tx queue, pools are only used from the service task or with the service lock taken
+ */
+static void *_mdns_pool_alloc(mdns_pool_t *pool)
+{
+    if (pool->free_items) {
+        mdns_pool_item_t *item = pool->free_items;
+        pool->free_items = item->next;
+        return item;
     }
-#endif
-#ifdef CONFIG_LWIP_IPV6
-    if (p->dst.type == ESP_IPADDR_TYPE_V6) {
-        _mdns_dbg_printf("To: " IPV6STR ":%u, ", IPV62STR(p->dst.u_addr.ip6), p->port);
+    if (pool->used < pool->count) {
+        return pool->storage + (pool->used++ * pool->item_size);
     }
-#endif
-    mdns_debug_packet(packet, index);
-#endif
+    return malloc(pool->item_size);
+}
 
-    _mdns_udp_pcb_write(p->tcpip_if, p->ip_protocol, &p->dst, p->port, packet, index);
+/**
+ * @brief  gives an item back to the pool it was taken from, or to the heap
+ */
+static void _mdns_pool_free(mdns_pool_t *pool, void *ptr)
+{
+    uint8_t *p = (uint8_t *)ptr;
+    if (p >= pool->storage && p < pool->storage + (pool->count * pool->item_size)) {
+        mdns_pool_item_t *item = (mdns_pool_item_t *)ptr;
+        item->next = pool->free_items;
+        pool->free_items = item;
+        return;
+    }
+    free(ptr);
 }
 
+#define _mdns_mem_alloc_tx_packet()     ((mdns_tx_packet_t *)_mdns_pool_alloc(&_mdns_tx_packet_pool))
+#define _mdns_mem_free_tx_packet(p)     _mdns_pool_free(&_mdns_tx_packet_pool, (p))
+#define _mdns_mem_alloc_answer()        ((mdns_out_answer_t *)_mdns_pool_alloc(&_mdns_answer_pool))
+#define _mdns_mem_free_answer(a)        _mdns_pool_free(&_mdns_answer_pool, (a))
+#else
+#define _mdns_mem_alloc_tx_packet()     ((mdns_tx_packet_t *)malloc(sizeof(mdns_tx_packet_t)))
+#define _mdns_mem_free_tx_packet(p)     free(p)
+#define _mdns_mem_alloc_answer()        ((mdns_out_answer_t *)malloc(sizeof(mdns_out_answer_t)))
+#define _mdns_mem_free_answer(a)        free(a)
+#endif /* CONFIG_MDNS_MEMORY_POOL */
+
 /**
  * @brief  frees a packet
  *
@@ -1571,10 +1965,10 @@ static void _mdns_free_tx_packet(mdns_tx_packet_t *packet)
         free(q);
         q = next;
     }
-    queueFree(mdns_out_answer_t, packet->answers);
-    queueFree(mdns_out_answer_t, packet->servers);
-    queueFree(mdns_out_answer_t, packet->additional);
-    free(packet);
+    queueFreeWith(mdns_out_answer_t, packet->answers, _mdns_mem_free_answer);
+    queueFreeWith(mdns_out_answer_t, packet->servers, _mdns_mem_free_answer);
+    queueFreeWith(mdns_out_answer_t, packet->additional, _mdns_mem_free_answer);
+    _mdns_mem_free_tx_packet(packet);
 }
 
 /**
@@ -1593,6 +1987,7 @@ static void _mdns_schedule_tx_packet(mdns_tx_packet_t *packet, uint32_t ms_after
     if (!_mdns_server->tx_queue_head || _mdns_server->tx_queue_head->send_at > packet->send_at) {
         packet->next = _mdns_server->tx_queue_head;
         _mdns_server->tx_queue_head = packet;
+        _mdns_timer_rearm();
         return;
     }
     mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
@@ -1601,6 +1996,7 @@ static void _mdns_schedule_tx_packet(mdns_tx_packet_t *packet, uint32_t ms_after
     }
     packet->next = q->next;
     q->next = packet;
+    _mdns_timer_rearm();
 }
 
 /**
@@ -1678,13 +2074,15 @@ static void _mdns_remove_scheduled_answer(mdns_if_t tcpip_if, mdns_ip_protocol_t
             if (a) {
                 if (a->type == type && a->service == service->service) {
                     q->answers = q->answers->next;
-                    free(a);
+                    _mdns_mem_free_answer(a);
+                    MDNS_STATS_INC(tcpip_if, tx_suppressed);
                 } else {
                     while (a->next) {
                         if (a->next->type == type && a->next->service == service->service) {
                             mdns_out_answer_t *b = a->next;
                             a->next = b->next;
-                            free(b);
+                            _mdns_mem_free_answer(b);
+                            MDNS_STATS_INC(tcpip_if, tx_suppressed);
                             break;
                         }
                         a = a->next;
@@ -1697,90 +2095,275 @@ static void _mdns_remove_scheduled_answer(mdns_if_t tcpip_if, mdns_ip_protocol_t
 }
 
 /**
- * @brief  Remove and free answer from answer list (destination)
+ * @brief  Check if both packets go to the same destination
  */
-static void _mdns_dealloc_answer(mdns_out_answer_t **destination, uint16_t type, mdns_srv_item_t *service)
+static bool _mdns_tx_packet_same_dst(const mdns_tx_packet_t *a, const mdns_tx_packet_t *b)
 {
-    mdns_out_answer_t *d = *destination;
-    if (!d) {
-        return;
-    }
-    mdns_srv_item_t s = {NULL, NULL};
-    if (!service) {
-        service = &s;
+    if (a->port != b->port || a->dst.type != b->dst.type) {
+        return false;
     }
-    if (d->type == type && d->service == service->service) {
-        *destination = d->next;
-        free(d);
-        return;
+#ifdef CONFIG_LWIP_IPV4
+    if (a->dst.type == ESP_IPADDR_TYPE_V4) {
+        return a->dst.u_addr.ip4.addr == b->dst.u_addr.ip4.addr;
     }
-    while (d->next) {
-        mdns_out_answer_t *a = d->next;
-        if (a->type == type && a->service == service->service) {
-            d->next = a->next;
-            free(a);
-            return;
-        }
-        d = d->next;
+#endif /* CONFIG_LWIP_IPV4 */
+#ifdef CONFIG_LWIP_IPV6
+    if (a->dst.type == ESP_IPADDR_TYPE_V6) {
+        return !memcmp(a->dst.u_addr.ip6.addr, b->dst.u_addr.ip6.addr, sizeof(a->dst.u_addr.ip6.addr));
     }
+#endif /* CONFIG_LWIP_IPV6 */
+    return false;
 }
 
 /**
- * @brief  Allocate new answer and add it to answer list (destination)
+ * @brief  Check if the answer is already in the answer list
  */
-static bool _mdns_alloc_answer(mdns_out_answer_t **destination, uint16_t type, mdns_service_t *service,
-                               mdns_host_item_t *host, bool flush, bool bye)
+static bool _mdns_answer_exists(const mdns_out_answer_t *needle, const mdns_out_answer_t *haystack)
 {
-    mdns_out_answer_t *d = *destination;
-    while (d) {
-        if (d->type == type && d->service == service && d->host == host) {
+    while (haystack) {
+        if (haystack->type == needle->type
+                && haystack->service == needle->service
+                && haystack->host == needle->host
+                && haystack->bye == needle->bye
+                && haystack->flush == needle->flush
+                && haystack->custom_instance == needle->custom_instance
+                && haystack->custom_service == needle->custom_service
+                && haystack->custom_proto == needle->custom_proto) {
             return true;
         }
-        d = d->next;
+        haystack = haystack->next;
     }
+    return false;
+}
 
-    mdns_out_answer_t *a = (mdns_out_answer_t *)malloc(sizeof(mdns_out_answer_t));
-    if (!a) {
-        HOOK_MALLOC_FAILED;
+/**
+ * @brief  Check if a response scheduled before send_at already carries all the records of the packet
+ *         to the same destination, so that a question repeated by several hosts is answered once
+ */
+static bool _mdns_scheduled_packet_covers(mdns_tx_packet_t *packet, uint32_t send_at)
+{
+    if (packet->questions) {
         return false;
     }
-    a->type = type;
-    a->service = service;
-    a->host = host;
-    a->custom_service = NULL;
-    a->bye = bye;
-    a->flush = flush;
-    a->next = NULL;
-    queueToEnd(mdns_out_answer_t, *destination, a);
-    return true;
+    mdns_tx_packet_t *q = _mdns_server->tx_queue_head;
+    while (q && q->send_at <= send_at) {
+        if (q->tcpip_if == packet->tcpip_if && q->ip_protocol == packet->ip_protocol
+                && q->flags == packet->flags && _mdns_tx_packet_same_dst(q, packet)) {
+            bool covers = true;
+            mdns_out_answer_t *a = packet->answers;
+            while (covers && a) {
+                covers = _mdns_answer_exists(a, q->answers);
+                a = a->next;
+            }
+            a = packet->additional;
+            while (covers && a) {
+                covers = _mdns_answer_exists(a, q->answers) || _mdns_answer_exists(a, q->additional);
+                a = a->next;
+            }
+            if (covers) {
+                return true;
+            }
+        }
+        q = q->next;
+    }
+    return false;
 }
 
 /**
- * @brief  Allocate new packet for sending
+ * @brief  Check if the packet goes to the mDNS multicast group
  */
-static mdns_tx_packet_t *_mdns_alloc_packet_default(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+static bool _mdns_tx_packet_is_multicast(const mdns_tx_packet_t *p)
 {
-    mdns_tx_packet_t *packet = (mdns_tx_packet_t *)malloc(sizeof(mdns_tx_packet_t));
-    if (!packet) {
-        HOOK_MALLOC_FAILED;
-        return NULL;
-    }
-    memset((uint8_t *)packet, 0, sizeof(mdns_tx_packet_t));
-    packet->tcpip_if = tcpip_if;
-    packet->ip_protocol = ip_protocol;
-    packet->port = MDNS_SERVICE_PORT;
-#ifdef CONFIG_LWIP_IPV4
+    mdns_tx_packet_t group = { .port = MDNS_SERVICE_PORT };
+    _mdns_set_multicast_dst(&group.dst, p->ip_protocol);
+    return _mdns_tx_packet_same_dst(p, &group);
+}
+
+#ifdef CONFIG_MDNS_MCAST_RATE_LIMIT
+/**
+ * @brief  Find the record in the cache of the records multicast lately
+ */
+static mdns_mcast_record_t *_mdns_mcast_record_find(const mdns_out_answer_t *a, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    for (size_t i = 0; i < CONFIG_MDNS_MCAST_RATE_LIMIT_RECORDS; i++) {
+        mdns_mcast_record_t *r = &_mdns_server->mcast_records[i];
+        if (r->type == a->type && r->service == a->service && r->host == a->host
+                && r->tcpip_if == tcpip_if && r->ip_protocol == ip_protocol) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief  Remember when the records of a multicast response were sent, the oldest entries are replaced
+ */
+static void _mdns_mcast_records_sent(const mdns_tx_packet_t *p)
+{
+    if (!(p->flags & MDNS_FLAGS_QUERY_REPSONSE) || !_mdns_tx_packet_is_multicast(p)) {
+        return;
+    }
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    mdns_out_answer_t *sections[] = { p->answers, p->additional };
+    for (size_t i = 0; i < ARRAY_SIZE(sections); i++) {
+        for (mdns_out_answer_t *a = sections[i]; a; a = a->next) {
+            if (a->bye) {
+                continue;
+            }
+            mdns_mcast_record_t *r = _mdns_mcast_record_find(a, p->tcpip_if, p->ip_protocol);
+            if (!r) {
+                r = &_mdns_server->mcast_records[0];
+                for (size_t j = 1; j < CONFIG_MDNS_MCAST_RATE_LIMIT_RECORDS; j++) {
+                    mdns_mcast_record_t *e = &_mdns_server->mcast_records[j];
+                    if (!e->type || (r->type && (now - e->sent_at) > (now - r->sent_at))) {
+                        r = e;
+                    }
+                }
+                r->type = a->type;
+                r->service = a->service;
+                r->host = a->host;
+                r->tcpip_if = p->tcpip_if;
+                r->ip_protocol = p->ip_protocol;
+            }
+            r->sent_at = now;
+        }
+    }
+}
+
+/**
+ * @brief  Forget the records of a service or of a host that is freed
+ */
+static void _mdns_mcast_records_forget(const mdns_service_t *service, const mdns_host_item_t *host)
+{
+    if (!_mdns_server) {
+        return;
+    }
+    for (size_t i = 0; i < CONFIG_MDNS_MCAST_RATE_LIMIT_RECORDS; i++) {
+        mdns_mcast_record_t *r = &_mdns_server->mcast_records[i];
+        if ((service && r->service == service) || (host && r->host == host)) {
+            memset(r, 0, sizeof(mdns_mcast_record_t));
+        }
+    }
+}
+
+/**
+ * @brief  Remove the records multicast on the interface less than interval ms ago from a multicast response
+ *         (RFC 6762, 6), the queriers still have them from the previous response
+ */
+static void _mdns_mcast_rate_limit(mdns_tx_packet_t *packet, uint32_t interval)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    mdns_out_answer_t **sections[] = { &packet->answers, &packet->additional };
+    for (size_t i = 0; i < ARRAY_SIZE(sections); i++) {
+        mdns_out_answer_t **it = sections[i];
+        while (*it) {
+            mdns_out_answer_t *a = *it;
+            mdns_mcast_record_t *r = _mdns_mcast_record_find(a, packet->tcpip_if, packet->ip_protocol);
+            if (r && (now - r->sent_at) < interval) {
+                *it = a->next;
+                _mdns_mem_free_answer(a);
+                MDNS_STATS_INC(packet->tcpip_if, tx_suppressed);
+            } else {
+                it = &a->next;
+            }
+        }
+    }
+}
+#endif /* CONFIG_MDNS_MCAST_RATE_LIMIT */
+
+/**
+ * @brief  Remove and free answer from answer list (destination)
+ */
+static void _mdns_dealloc_answer(mdns_out_answer_t **destination, uint16_t type, mdns_srv_item_t *service)
+{
+    mdns_out_answer_t *d = *destination;
+    if (!d) {
+        return;
+    }
+    mdns_srv_item_t s = {NULL, NULL};
+    if (!service) {
+        service = &s;
+    }
+    if (d->type == type && d->service == service->service) {
+        *destination = d->next;
+        _mdns_mem_free_answer(d);
+        return;
+    }
+    while (d->next) {
+        mdns_out_answer_t *a = d->next;
+        if (a->type == type && a->service == service->service) {
+            d->next = a->next;
+            _mdns_mem_free_answer(a);
+            return;
+        }
+        d = d->next;
+    }
+}
+
+/**
+ * @brief  Allocate new answer and add it to answer list (destination)
+ */
+static bool _mdns_alloc_answer(mdns_out_answer_t **destination, uint16_t type, mdns_service_t *service,
+                               mdns_host_item_t *host, bool flush, bool bye)
+{
+    mdns_out_answer_t *d = *destination;
+    while (d) {
+        if (d->type == type && d->service == service && d->host == host) {
+            return true;
+        }
+        d = d->next;
+    }
+
+    mdns_out_answer_t *a = _mdns_mem_alloc_answer();
+    if (!a) {
+        HOOK_MALLOC_FAILED;
+        return false;
+    }
+    a->type = type;
+    a->service = service;
+    a->host = host;
+    a->custom_service = NULL;
+    a->bye = bye;
+    a->flush = flush;
+    a->next = NULL;
+    queueToEnd(mdns_out_answer_t, *destination, a);
+    return true;
+}
+
+/**
+ * @brief  Set the mDNS multicast group of the IP protocol as destination
+ */
+static void _mdns_set_multicast_dst(esp_ip_addr_t *dst, mdns_ip_protocol_t ip_protocol)
+{
+#ifdef CONFIG_LWIP_IPV4
     if (ip_protocol == MDNS_IP_PROTOCOL_V4) {
         esp_ip_addr_t addr = ESP_IP4ADDR_INIT(224, 0, 0, 251);
-        memcpy(&packet->dst, &addr, sizeof(esp_ip_addr_t));
+        memcpy(dst, &addr, sizeof(esp_ip_addr_t));
     }
 #endif
 #ifdef CONFIG_LWIP_IPV6
     if (ip_protocol == MDNS_IP_PROTOCOL_V6) {
         esp_ip_addr_t addr = ESP_IP6ADDR_INIT(0x000002ff, 0, 0, 0xfb000000);
-        memcpy(&packet->dst, &addr, sizeof(esp_ip_addr_t));
+        memcpy(dst, &addr, sizeof(esp_ip_addr_t));
     }
 #endif
+}
+
+/**
+ * @brief  Allocate new packet for sending
+ */
+static mdns_tx_packet_t *_mdns_alloc_packet_default(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    mdns_tx_packet_t *packet = _mdns_mem_alloc_tx_packet();
+    if (!packet) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
+    }
+    memset((uint8_t *)packet, 0, sizeof(mdns_tx_packet_t));
+    packet->tcpip_if = tcpip_if;
+    packet->ip_protocol = ip_protocol;
+    packet->port = MDNS_SERVICE_PORT;
+    _mdns_set_multicast_dst(&packet->dst, ip_protocol);
     return packet;
 }
 
@@ -1854,8 +2437,16 @@ static bool _mdns_service_match_ptr_question(const mdns_service_t *service, cons
     return true;
 }
 
+#define MDNS_ANSWER_PACKET_MULTICAST    0
+#define MDNS_ANSWER_PACKET_UNICAST      1
+#define MDNS_ANSWER_PACKETS             2
+
 /**
- * @brief  Create answer packet to questions from parsed packet
+ * @brief  Create answer packets to questions from parsed packet
+ *
+ * Answers to questions with the QU bit are sent by unicast to the querier, even when its other questions are
+ * answered by multicast (RFC 6762, 5.4). Multicast is sent at basic rates on WiFi, it is kept to the answers
+ * asked for by multicast. Those are rate limited per record and per interface.
  */
 static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_packet)
 {
@@ -1863,19 +2454,27 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
         return;
     }
     bool send_flush = parsed_packet->src_port == MDNS_SERVICE_PORT;
-    bool unicast = false;
     bool shared = false;
-    mdns_tx_packet_t *packet = _mdns_alloc_packet_default(parsed_packet->tcpip_if, parsed_packet->ip_protocol);
-    if (!packet) {
-        return;
+    // answers to QM questions are multicast, the ones to QU questions and to legacy queriers are unicast
+    mdns_tx_packet_t *packets[MDNS_ANSWER_PACKETS] = { NULL };
+    uint32_t out_record_nums[MDNS_ANSWER_PACKETS] = { 0 };
+    mdns_tx_packet_t *packet = NULL;
+    size_t i;
+    for (i = 0; i < MDNS_ANSWER_PACKETS; i++) {
+        packet = _mdns_alloc_packet_default(parsed_packet->tcpip_if, parsed_packet->ip_protocol);
+        if (!packet) {
+            goto error;
+        }
+        packet->flags = MDNS_FLAGS_QR_AUTHORITATIVE;
+        packet->distributed = parsed_packet->distributed;
+        packet->id = parsed_packet->id;
+        packets[i] = packet;
     }
-    packet->flags = MDNS_FLAGS_QR_AUTHORITATIVE;
-    packet->distributed = parsed_packet->distributed;
-    packet->id = parsed_packet->id;
 
     mdns_parsed_question_t *q = parsed_packet->questions;
-    uint32_t out_record_nums = 0;
     while (q) {
+        i = (q->unicast || !send_flush) ? MDNS_ANSWER_PACKET_UNICAST : MDNS_ANSWER_PACKET_MULTICAST;
+        packet = packets[i];
         shared = q->type == MDNS_TYPE_PTR || q->type == MDNS_TYPE_SDPTR || !parsed_packet->probe;
         if (q->type == MDNS_TYPE_SRV || q->type == MDNS_TYPE_TXT) {
             mdns_srv_item_t *service = _mdns_get_service_item_instance(q->host, q->service, q->proto, NULL);
@@ -1884,10 +2483,9 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
                 continue;
             }
             if (!_mdns_create_answer_from_service(packet, service->service, q, shared, send_flush)) {
-                _mdns_free_tx_packet(packet);
-                return;
+                goto error;
             } else {
-                out_record_nums++;
+                out_record_nums[i]++;
             }
         } else if (q->service && q->proto) {
             mdns_srv_item_t *service = _mdns_server->services;
@@ -1911,10 +2509,9 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
                     }
                     if (!is_record_exist) {
                         if (!_mdns_create_answer_from_service(packet, service->service, q, shared, send_flush)) {
-                            _mdns_free_tx_packet(packet);
-                            return;
+                            goto error;
                         } else {
-                            out_record_nums++;
+                            out_record_nums[i]++;
                         }
                     }
                 }
@@ -1922,33 +2519,29 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
             }
         } else if (q->type == MDNS_TYPE_A || q->type == MDNS_TYPE_AAAA) {
             if (!_mdns_create_answer_from_hostname(packet, q->host, send_flush)) {
-                _mdns_free_tx_packet(packet);
-                return;
+                goto error;
             } else {
-                out_record_nums++;
+                out_record_nums[i]++;
             }
         } else if (q->type == MDNS_TYPE_ANY) {
             if (!_mdns_append_host_list(&packet->answers, send_flush, false)) {
-                _mdns_free_tx_packet(packet);
-                return;
+                goto error;
             } else {
-                out_record_nums++;
+                out_record_nums[i]++;
             }
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
         } else if (q->type == MDNS_TYPE_PTR) {
             mdns_host_item_t *host = mdns_get_host_item(q->host);
             if (!_mdns_alloc_answer(&packet->answers, MDNS_TYPE_PTR, NULL, host, send_flush, false)) {
-                _mdns_free_tx_packet(packet);
-                return;
+                goto error;
             } else {
-                out_record_nums++;
+                out_record_nums[i]++;
             }
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
         } else if (!_mdns_alloc_answer(&packet->answers, q->type, NULL, NULL, send_flush, false)) {
-            _mdns_free_tx_packet(packet);
-            return;
+            goto error;
         } else {
-            out_record_nums++;
+            out_record_nums[i]++;
         }
 
         if (parsed_packet->src_port != MDNS_SERVICE_PORT &&  // Repeat the queries only for "One-Shot mDNS queries"
@@ -1960,8 +2553,7 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
             mdns_out_question_t *out_question = malloc(sizeof(mdns_out_question_t));
             if (out_question == NULL) {
                 HOOK_MALLOC_FAILED;
-                _mdns_free_tx_packet(packet);
-                return;
+                goto error;
             }
             out_question->type = q->type;
             out_question->unicast = q->unicast;
@@ -1977,27 +2569,45 @@ static void _mdns_create_answer_from_parsed_packet(mdns_parsed_packet_t *parsed_
             out_question->own_dynamic_memory = true;
             queueToEnd(mdns_out_question_t, packet->questions, out_question);
         }
-        if (q->unicast) {
-            unicast = true;
-        }
         q = q->next;
     }
-    if (out_record_nums == 0) {
-        _mdns_free_tx_packet(packet);
-        return;
-    }
-    if (unicast || !send_flush) {
-        memcpy(&packet->dst, &parsed_packet->src, sizeof(esp_ip_addr_t));
-        packet->port = parsed_packet->src_port;
-    }
 
     static uint8_t share_step = 0;
-    if (shared) {
-        _mdns_schedule_tx_packet(packet, 25 + (share_step * 25));
-        share_step = (share_step + 1) & 0x03;
-    } else {
-        _mdns_dispatch_tx_packet(packet);
-        _mdns_free_tx_packet(packet);
+    for (i = 0; i < MDNS_ANSWER_PACKETS; i++) {
+        packet = packets[i];
+        packets[i] = NULL;
+        if (i == MDNS_ANSWER_PACKET_UNICAST) {
+            memcpy(&packet->dst, &parsed_packet->src, sizeof(esp_ip_addr_t));
+            packet->port = parsed_packet->src_port;
+        } else {
+            // defending our records against a probe may repeat them sooner (RFC 6762, 6)
+            _mdns_mcast_rate_limit(packet, parsed_packet->probe ? 250 : 1000);
+        }
+        if (out_record_nums[i] == 0 || (i == MDNS_ANSWER_PACKET_MULTICAST && !packet->answers)) {
+            _mdns_free_tx_packet(packet);
+            continue;
+        }
+        if (shared) {
+            uint32_t ms_after = 25 + (share_step * 25);
+            if (_mdns_scheduled_packet_covers(packet, (xTaskGetTickCount() * portTICK_PERIOD_MS) + ms_after)) {
+                // the same question was asked again before our answer went out
+                _mdns_free_tx_packet(packet);
+                continue;
+            }
+            _mdns_schedule_tx_packet(packet, ms_after);
+            share_step = (share_step + 1) & 0x03;
+        } else {
+            _mdns_dispatch_tx_packet(packet);
+            _mdns_free_tx_packet(packet);
+        }
+    }
+    return;
+
+error:
+    for (i = 0; i < MDNS_ANSWER_PACKETS; i++) {
+        if (packets[i]) {
+            _mdns_free_tx_packet(packets[i]);
+        }
     }
 }
 
@@ -2253,9 +2863,10 @@ static void _mdns_pcb_send_bye(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protoco
 }
 
 /**
- * @brief  Send probe for additional services on particular PCB
+ * @brief  Send probe for additional services on particular PCB, the first one delay ms later
  */
-static void _mdns_init_pcb_probe_new_service(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, mdns_srv_item_t **services, size_t len, bool probe_ip)
+static void _mdns_init_pcb_probe_new_service(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, mdns_srv_item_t **services, size_t len, bool probe_ip,
+        uint32_t delay)
 {
     mdns_pcb_t *pcb = &_mdns_server->interfaces[tcpip_if].pcbs[ip_protocol];
     size_t services_final_len = len;
@@ -2300,7 +2911,7 @@ static void _mdns_init_pcb_probe_new_service(mdns_if_t tcpip_if, mdns_ip_protoco
     pcb->probe_services = _services;
     pcb->probe_services_len = services_final_len;
     pcb->probe_running = true;
-    _mdns_schedule_tx_packet(packet, ((pcb->failed_probes > 5) ? 1000 : 120) + (esp_random() & 0x7F));
+    _mdns_schedule_tx_packet(packet, (pcb->failed_probes > 5) ? 1000 + (esp_random() & 0x7F) : delay);
     pcb->state = PCB_PROBE_1;
 }
 
@@ -2310,8 +2921,11 @@ static void _mdns_init_pcb_probe_new_service(mdns_if_t tcpip_if, mdns_ip_protoco
  * Tests possible duplication on probing service structure and probes only for new entries.
  * - If pcb probing then add only non-probing services and restarts probing
  * - If pcb not probing, run probing for all specified services
+ *
+ * The first probe is sent delay ms later.
  */
-static void _mdns_init_pcb_probe(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, mdns_srv_item_t **services, size_t len, bool probe_ip)
+static void _mdns_init_pcb_probe_at(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, mdns_srv_item_t **services, size_t len, bool probe_ip,
+                                    uint32_t delay)
 {
     mdns_pcb_t *pcb = &_mdns_server->interfaces[tcpip_if].pcbs[ip_protocol];
 
@@ -2341,13 +2955,21 @@ static void _mdns_init_pcb_probe(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_proto
         }
         // init probing for newly added services
         _mdns_init_pcb_probe_new_service(tcpip_if, ip_protocol,
-                                         new_probe_service_len ? new_probe_services : NULL, new_probe_service_len, probe_ip);
+                                         new_probe_service_len ? new_probe_services : NULL, new_probe_service_len, probe_ip, delay);
     } else {
         // not probing, so init for all services
-        _mdns_init_pcb_probe_new_service(tcpip_if, ip_protocol, services, len, probe_ip);
+        _mdns_init_pcb_probe_new_service(tcpip_if, ip_protocol, services, len, probe_ip, delay);
     }
 }
 
+/**
+ * @brief  Send probe for particular services on particular PCB, after a random delay
+ */
+static void _mdns_init_pcb_probe(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol, mdns_srv_item_t **services, size_t len, bool probe_ip)
+{
+    _mdns_init_pcb_probe_at(tcpip_if, ip_protocol, services, len, probe_ip, _mdns_probe_delay());
+}
+
 /**
  * @brief  Restart the responder on particular PCB
  */
@@ -2488,10 +3110,14 @@ static void _mdns_announce_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protoco
 
 /**
  * @brief  Send probe on all active PCBs
+ *
+ * The PCBs share one random delay, their probes and announcements are then sent together,
+ * in the same runs of the scheduler, instead of each on its own schedule.
  */
 static void _mdns_probe_all_pcbs(mdns_srv_item_t **services, size_t len, bool probe_ip, bool clear_old_probe)
 {
     uint8_t i, j;
+    uint32_t delay = _mdns_probe_delay();
     for (i = 0; i < MDNS_MAX_INTERFACES; i++) {
         for (j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
             if (mdns_is_netif_ready(i, j)) {
@@ -2502,7 +3128,7 @@ static void _mdns_probe_all_pcbs(mdns_srv_item_t **services, size_t len, bool pr
                     _pcb->probe_services_len = 0;
                     _pcb->probe_running = false;
                 }
-                _mdns_init_pcb_probe((mdns_if_t)i, (mdns_ip_protocol_t)j, services, len, probe_ip);
+                _mdns_init_pcb_probe_at((mdns_if_t)i, (mdns_ip_protocol_t)j, services, len, probe_ip, delay);
             }
         }
     }
@@ -2514,6 +3140,14 @@ static void _mdns_probe_all_pcbs(mdns_srv_item_t **services, size_t len, bool pr
 static void _mdns_announce_all_pcbs(mdns_srv_item_t **services, size_t len, bool include_ip)
 {
     uint8_t i, j;
+    if (_mdns_server->transaction_depth) {
+        // inside a transaction, mdns_transaction_commit() sends one announcement for all the changes
+        for (i = 0; i < len; i++) {
+            services[i]->announce_deferred = true;
+        }
+        _mdns_server->transaction_include_ip |= include_ip;
+        return;
+    }
     for (i = 0; i < MDNS_MAX_INTERFACES; i++) {
         for (j = 0; j < MDNS_IP_PROTOCOL_MAX; j++) {
             _mdns_announce_pcb((mdns_if_t)i, (mdns_ip_protocol_t)j, services, len, include_ip);
@@ -2631,6 +3265,63 @@ static void _mdns_restart_all_pcbs(void)
 
 
 
+/**
+ * @brief  takes a reference to the interned copy of the TXT key or value, adding the string to the table
+ *         if no TXT item holds it yet, as the same keys and values repeat across the services
+ *
+ * @param  str  the string, it may be a binary value
+ * @param  len  length of the string
+ *
+ * @return the interned string, NUL terminated, or NULL if out of memory
+ */
+static const char *_mdns_txt_str_get(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)str[i]) * 16777619U;
+    }
+    mdns_txt_str_t **bucket = &_mdns_server->txt_strings[hash & (MDNS_TXT_STR_INDEX_SIZE - 1)];
+    for (mdns_txt_str_t *it = *bucket; it; it = it->next) {
+        if (it->hash == hash && it->len == len && it->refs < UINT16_MAX && !memcmp(it->str, str, len)) {
+            it->refs++;
+            return it->str;
+        }
+    }
+    mdns_txt_str_t *it = (mdns_txt_str_t *)malloc(sizeof(mdns_txt_str_t) + len + 1);
+    if (!it) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
+    }
+    it->hash = hash;
+    it->refs = 1;
+    it->len = len;
+    memcpy(it->str, str, len);
+    it->str[len] = 0;
+    it->next = *bucket;
+    *bucket = it;
+    return it->str;
+}
+
+/**
+ * @brief  drops a reference to an interned TXT key or value, noop if str==NULL
+ */
+static void _mdns_txt_str_put(const char *str)
+{
+    if (!str) {
+        return;
+    }
+    mdns_txt_str_t *str_item = (mdns_txt_str_t *)(str - offsetof(mdns_txt_str_t, str));
+    if (--str_item->refs) {
+        return;
+    }
+    mdns_txt_str_t **it = &_mdns_server->txt_strings[str_item->hash & (MDNS_TXT_STR_INDEX_SIZE - 1)];
+    while (*it != str_item) {
+        it = &(*it)->next;
+    }
+    *it = str_item->next;
+    free(str_item);
+}
+
 /**
  * @brief  creates/allocates new text item list
  * @param  num_items     service number of txt items or 0
@@ -2649,18 +3340,18 @@ static mdns_txt_linked_item_t *_mdns_allocate_txt(size_t num_items, mdns_txt_ite
                 HOOK_MALLOC_FAILED;
                 break;
             }
-            new_item->key = strdup(txt[i].key);
+            new_item->key = _mdns_txt_str_get(txt[i].key, strlen(txt[i].key));
             if (!new_item->key) {
                 free(new_item);
                 break;
             }
-            new_item->value = strdup(txt[i].value);
+            new_item->value_len = strlen(txt[i].value);
+            new_item->value = _mdns_txt_str_get(txt[i].value, new_item->value_len);
             if (!new_item->value) {
-                free((char *)new_item->key);
+                _mdns_txt_str_put(new_item->key);
                 free(new_item);
                 break;
             }
-            new_item->value_len = strlen(new_item->value);
             new_item->next = new_txt;
             new_txt = new_item;
         }
@@ -2668,6 +3359,16 @@ static mdns_txt_linked_item_t *_mdns_allocate_txt(size_t num_items, mdns_txt_ite
     return new_txt;
 }
 
+/**
+ * @brief  drops the encoded TXT data of the service, called whenever its txt items change
+ */
+static void _mdns_service_txt_changed(mdns_service_t *service)
+{
+    free(service->txt_rdata);
+    service->txt_rdata = NULL;
+    service->txt_rdata_len = 0;
+}
+
 /**
  * @brief Deallocate the txt linked list
  * @param txt pointer to the txt pointer to free, noop if txt==NULL
@@ -2678,8 +3379,8 @@ static void _mdns_free_linked_txt(mdns_txt_linked_item_t *txt)
     while (txt) {
         t = txt;
         txt = txt->next;
-        free((char *)t->value);
-        free((char *)t->key);
+        _mdns_txt_str_put(t->value);
+        _mdns_txt_str_put(t->key);
         free(t);
     }
 }
@@ -2760,14 +3461,14 @@ static void _mdns_dealloc_scheduled_service_answers(mdns_out_answer_t **destinat
     }
     while (d && d->service == service) {
         *destination = d->next;
-        free(d);
+        _mdns_mem_free_answer(d);
         d = *destination;
     }
     while (d && d->next) {
         mdns_out_answer_t *a = d->next;
         if (a->service == service) {
             d->next = a->next;
-            free(a);
+            _mdns_mem_free_answer(a);
         } else {
             d = d->next;
         }
@@ -2891,11 +3592,13 @@ static void _mdns_free_service(mdns_service_t *service)
     while (service->txt) {
         mdns_txt_linked_item_t *s = service->txt;
         service->txt = service->txt->next;
-        free((char *)s->key);
-        free((char *)s->value);
+        _mdns_txt_str_put(s->key);
+        _mdns_txt_str_put(s->value);
         free(s);
     }
     _mdns_free_service_subtype(service);
+    _mdns_service_txt_changed(service);
+    _mdns_mcast_records_forget(service, NULL);
     free(service);
 }
 
@@ -3234,6 +3937,7 @@ static bool _mdns_delegate_hostname_remove(const char *hostname)
             mdns_srv_item_t *to_free = srv;
             _mdns_send_bye(&srv, 1, false);
             _mdns_remove_scheduled_service_packets(srv->service);
+            _mdns_service_index_remove(srv);
             if (prev_srv == NULL) {
                 _mdns_server->services = srv->next;
                 srv = srv->next;
@@ -3259,6 +3963,7 @@ static bool _mdns_delegate_hostname_remove(const char *hostname)
             }
             free_address_list(host->address_list);
             free((char *)host->hostname);
+            _mdns_mcast_records_forget(NULL, host);
             free(host);
             break;
         } else {
@@ -3393,57 +4098,155 @@ static inline uint32_t _mdns_read_u32(const uint8_t *packet, uint16_t index)
 }
 
 /**
- * @brief  reads and formats MDNS FQDN into mdns_name_t structure
- *
- * @param  packet       MDNS packet
- * @param  start        Starting point of FQDN
- * @param  name         mdns_name_t structure to populate
- *
- * @return the address after the parsed FQDN in the packet or NULL on error
+ * @brief  compares a label in the packet with a string, case insensitive and without copying the label
  */
-static const uint8_t *_mdns_parse_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, size_t packet_len)
+static inline bool _mdns_label_equals(const uint8_t *label, uint8_t len, const char *str, size_t str_len)
 {
-    name->parts = 0;
-    name->sub = 0;
-    name->host[0] = 0;
-    name->service[0] = 0;
-    name->proto[0] = 0;
-    name->domain[0] = 0;
-    name->invalid = false;
-
-    static char buf[MDNS_NAME_BUF_LEN];
-
-    const uint8_t *next_data = (uint8_t *)_mdns_read_fqdn(packet, start, name, buf, packet_len);
-    if (!next_data) {
-        return 0;
-    }
-    if (!name->parts || name->invalid) {
-        return next_data;
-    }
-    if (name->parts == 3) {
-        memmove((uint8_t *)name + (MDNS_NAME_BUF_LEN), (uint8_t *)name, 3 * (MDNS_NAME_BUF_LEN));
-        name->host[0] = 0;
-    } else if (name->parts == 2) {
-        memmove((uint8_t *)(name->domain), (uint8_t *)(name->service), (MDNS_NAME_BUF_LEN));
-        name->service[0] = 0;
-        name->proto[0] = 0;
-    }
-    if (strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN) == 0 || strcasecmp(name->domain, "arpa") == 0) {
-        return next_data;
-    }
-    name->invalid = true; // mark the current name invalid, but continue with other question
-    return next_data;
+    return len == str_len && !strncasecmp((const char *)label, str, len);
 }
 
 /**
- * @brief  Called from parser to check if question matches particular service
+ * @brief  Check if a label read in place could belong to one of our names
+ *         the first label is compared with the first part of our hostnames,
+ *         the underscore labels with the discovery name and our service types
  */
-static bool _mdns_question_matches(mdns_parsed_question_t *question, uint16_t type, mdns_srv_item_t *service)
+static bool _mdns_label_may_be_ours(const uint8_t *label, uint8_t len, bool first)
 {
-    if (question->type != type) {
-        return false;
-    }
-    if (type == MDNS_TYPE_A || type == MDNS_TYPE_AAAA) {
+    if (first) {
+        if (!_str_null_or_empty(_mdns_server->hostname)
+                && _mdns_label_equals(label, len, _mdns_server->hostname, strcspn(_mdns_server->hostname, "."))) {
+            return true;
+        }
+        mdns_host_item_t *host = _mdns_host_list;
+        while (host) {
+            if (!_str_null_or_empty(host->hostname)
+                    && _mdns_label_equals(label, len, host->hostname, strcspn(host->hostname, "."))) {
+                return true;
+            }
+            host = host->next;
+        }
+    }
+    if (len && label[0] == '_') {
+        if (_mdns_label_equals(label, len, "_services", sizeof("_services") - 1)) {
+            return true;
+        }
+        mdns_srv_item_t *s = _mdns_server->services;
+        while (s) {
+            if (_mdns_label_equals(label, len, s->service->service, strlen(s->service->service))) {
+                return true;
+            }
+            s = s->next;
+        }
+    }
+#ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
+    if (_mdns_label_equals(label, len, "arpa", sizeof("arpa") - 1)) {
+        return true;
+    }
+#endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
+    return false;
+}
+
+/**
+ * @brief  walks MDNS FQDN in place, following the compression pointers, without copying the labels
+ *         Used to step over the names of other hosts before _mdns_parse_fqdn() copies them
+ *
+ * @param  packet       MDNS packet
+ * @param  start        Starting point of FQDN
+ * @param  packet_len   length of the packet
+ * @param  ours         set to false if no label could belong to our hostnames or services
+ *
+ * @return the address after the FQDN in the packet or NULL on error, as _mdns_parse_fqdn() would
+ */
+static const uint8_t *_mdns_skip_fqdn(const uint8_t *packet, const uint8_t *start, size_t packet_len, bool *ours)
+{
+    const uint8_t *packet_end = packet + packet_len;
+    const uint8_t *labels = start;              // start of the labels being read, pointers must point before it
+    const uint8_t *ptr = start;
+    const uint8_t *next_data = NULL;            // the address after the first compression pointer
+    bool first = true;
+    *ours = false;
+    while (ptr < packet_end && *ptr) {
+        uint8_t len = *ptr++;
+        if (len < 0xC0) {
+            if (len > 63 || ptr + len > packet_end) {
+                //length can not be more than 63 nor go past the packet
+                return NULL;
+            }
+            if (!*ours) {
+                *ours = _mdns_label_may_be_ours(ptr, len, first);
+            }
+            first = false;
+            ptr += len;
+        } else {
+            if (ptr >= packet_end) {
+                return NULL;
+            }
+            size_t address = (((uint16_t)len & 0x3F) << 8) | *ptr++;
+            if ((packet + address) >= labels) {
+                //reference address can not be after where we are
+                return NULL;
+            }
+            if (!next_data) {
+                next_data = ptr;
+            }
+            labels = ptr = packet + address;
+        }
+    }
+    return next_data ? next_data : ptr + 1;
+}
+
+/**
+ * @brief  reads and formats MDNS FQDN into mdns_name_t structure
+ *
+ * @param  packet       MDNS packet
+ * @param  start        Starting point of FQDN
+ * @param  name         mdns_name_t structure to populate
+ *
+ * @return the address after the parsed FQDN in the packet or NULL on error
+ */
+static const uint8_t *_mdns_parse_fqdn(const uint8_t *packet, const uint8_t *start, mdns_name_t *name, size_t packet_len)
+{
+    name->parts = 0;
+    name->sub = 0;
+    name->host[0] = 0;
+    name->service[0] = 0;
+    name->proto[0] = 0;
+    name->domain[0] = 0;
+    name->invalid = false;
+
+    static char buf[MDNS_NAME_BUF_LEN];
+
+    const uint8_t *next_data = (uint8_t *)_mdns_read_fqdn(packet, start, name, buf, packet_len);
+    if (!next_data) {
+        return 0;
+    }
+    if (!name->parts || name->invalid) {
+        return next_data;
+    }
+    if (name->parts == 3) {
+        memmove((uint8_t *)name + (MDNS_NAME_BUF_LEN), (uint8_t *)name, 3 * (MDNS_NAME_BUF_LEN));
+        name->host[0] = 0;
+    } else if (name->parts == 2) {
+        memmove((uint8_t *)(name->domain), (uint8_t *)(name->service), (MDNS_NAME_BUF_LEN));
+        name->service[0] = 0;
+        name->proto[0] = 0;
+    }
+    if (strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN) == 0 || strcasecmp(name->domain, "arpa") == 0) {
+        return next_data;
+    }
+    name->invalid = true; // mark the current name invalid, but continue with other question
+    return next_data;
+}
+
+/**
+ * @brief  Called from parser to check if question matches particular service
+ */
+static bool _mdns_question_matches(mdns_parsed_question_t *question, uint16_t type, mdns_srv_item_t *service)
+{
+    if (question->type != type) {
+        return false;
+    }
+    if (type == MDNS_TYPE_A || type == MDNS_TYPE_AAAA) {
         return true;
     } else if (type == MDNS_TYPE_PTR || type == MDNS_TYPE_SDPTR) {
         if (question->service && question->proto && question->domain
@@ -3484,6 +4287,7 @@ static void _mdns_remove_parsed_question(mdns_parsed_packet_t *parsed_packet, ui
         free(q->proto);
         free(q->domain);
         free(q);
+        MDNS_STATS_INC(parsed_packet->tcpip_if, tx_suppressed);
         return;
     }
 
@@ -3496,12 +4300,43 @@ static void _mdns_remove_parsed_question(mdns_parsed_packet_t *parsed_packet, ui
             free(p->proto);
             free(p->domain);
             free(p);
+            MDNS_STATS_INC(parsed_packet->tcpip_if, tx_suppressed);
             return;
         }
         q = q->next;
     }
 }
 
+/**
+ * @brief  Check if the parsed question is the one our search sends
+ */
+static bool _mdns_question_matches_search(mdns_name_t *name, uint16_t type, mdns_search_once_t *search)
+{
+    if (search->type != type || strcasecmp(name->domain, MDNS_DEFAULT_DOMAIN)) {
+        return false;
+    }
+    return (search->instance ? !strcasecmp(name->host, search->instance) : !name->host[0])
+           && (search->service ? !strcasecmp(name->service, search->service) : !name->service[0])
+           && (search->proto ? !strcasecmp(name->proto, search->proto) : !name->proto[0]);
+}
+
+/**
+ * @brief  Duplicate question suppression (RFC 6762, 7.3)
+ *         Another host multicast the same QM question as our running search without known answers,
+ *         so the responses are coming anyway and our next query is treated as sent
+ */
+static void _mdns_search_suppress_duplicate(mdns_name_t *name, uint16_t type)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    mdns_search_once_t *s = _mdns_server->search_once;
+    while (s) {
+        if (s->state == SEARCH_RUNNING && !s->unicast && !name->sub && _mdns_question_matches_search(name, type, s)) {
+            s->sent_at = now;
+        }
+        s = s->next;
+    }
+}
+
 /**
  * @brief  Get number of items in TXT parsed data
  */
@@ -3713,6 +4548,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
 #endif /* CONFIG_LWIP_IPV6 */
 #endif // CONFIG_MDNS_SKIP_SUPPRESSING_OWN_QUERIES
 
+    MDNS_STATS_INC(packet->tcpip_if, rx_packets);
+
     // Check for the minimum size of mdns packet
     if (len <=  MDNS_HEAD_ADDITIONAL_OFFSET) {
         return;
@@ -3760,7 +4597,11 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
         uint8_t qs = header.questions;
 
         while (qs--) {
-            content = _mdns_parse_fqdn(data, content, name, len);
+            // step over the names of other hosts without copying them, unless our searches may ask the same
+            bool may_be_ours;
+            const uint8_t *name_end = _mdns_skip_fqdn(data, content, len, &may_be_ours);
+            bool parse_name = may_be_ours || _mdns_server->search_once;
+            content = (name_end && parse_name) ? _mdns_parse_fqdn(data, content, name, len) : name_end;
             if (!content) {
                 header.answers = 0;
                 header.additional = 0;
@@ -3776,8 +4617,16 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
             bool unicast = !!(mdns_class & 0x8000);
             mdns_class &= 0x7FFF;
             content = content + 4;
+            MDNS_STATS_INC(packet->tcpip_if, rx_questions);
+
+            if (mdns_class != 0x0001 || !parse_name || name->invalid) {//bad class or invalid name for this question entry
+                continue;
+            }
 
-            if (mdns_class != 0x0001 || name->invalid) {//bad class or invalid name for this question entry
+            if (!unicast && !header.answers && (header.flags & MDNS_FLAGS_QUERY_REPSONSE) == 0 && _mdns_server->search_once) {
+                _mdns_search_suppress_duplicate(name, type);
+            }
+            if (!may_be_ours) {
                 continue;
             }
 
@@ -3842,7 +4691,11 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
 
         while (content < (data + len)) {
 
-            content = _mdns_parse_fqdn(data, content, name, len);
+            // without a running search or browse only the records of our names are of interest
+            bool may_be_ours;
+            const uint8_t *name_end = _mdns_skip_fqdn(data, content, len, &may_be_ours);
+            bool skip_record = !may_be_ours && !_mdns_server->search_once && !_mdns_server->browse;
+            content = (name_end && !skip_record) ? _mdns_parse_fqdn(data, content, name, len) : name_end;
             if (!content) {
                 goto clear_rx_packet;//error
             }
@@ -3874,8 +4727,8 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
             }
             recordIndex++;
 
-            if (type == MDNS_TYPE_NSEC || type == MDNS_TYPE_OPT) {
-                //skip NSEC and OPT
+            if (type == MDNS_TYPE_NSEC || type == MDNS_TYPE_OPT || skip_record) {
+                //skip NSEC and OPT and the records of other hosts
                 continue;
             }
 
@@ -3947,9 +4800,14 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         service = _mdns_get_service_item(name->service, name->proto, NULL);
                     }
                     if (discovery && service) {
-                        _mdns_remove_parsed_question(parsed_packet, MDNS_TYPE_SDPTR, service);
+                        //known answer, suppress ours only if the asker still holds it for more than half of its TTL
+                        if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, MDNS_TYPE_SDPTR, service);
+                        }
                     } else if (service && parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                     } else if (service) {
                         //check if TTL is more than half of the full TTL value (4500)
                         if (ttl > (MDNS_ANSWER_PTR_TTL / 2)) {
@@ -4042,7 +4900,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_SRV_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                         continue;
                     } else if (parsed_packet->distributed) {
                         _mdns_remove_scheduled_answer(packet->tcpip_if, packet->ip_protocol, type, service);
@@ -4065,6 +4925,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                             do_not_reply = true;
                             if (_mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].probe_running) {
                                 _mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].failed_probes++;
+                                MDNS_STATS_INC(packet->tcpip_if, probe_conflicts);
                                 if (!_str_null_or_empty(service->service->instance)) {
                                     char *new_instance = _mdns_mangle_name((char *)service->service->instance);
                                     if (new_instance) {
@@ -4143,7 +5004,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe && service) {
-                        _mdns_remove_parsed_question(parsed_packet, type, service);
+                        if (ttl > (MDNS_ANSWER_TXT_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, service);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4183,7 +5046,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        if (ttl > (MDNS_ANSWER_AAAA_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4205,6 +5070,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         if (_mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].probe_running) {
                             if (col && (parsed_packet->probe || parsed_packet->authoritative)) {
                                 _mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].failed_probes++;
+                                MDNS_STATS_INC(packet->tcpip_if, probe_conflicts);
                                 char *new_host = _mdns_mangle_name((char *)_mdns_server->hostname);
                                 if (new_host) {
                                     _mdns_remap_self_service_hostname(_mdns_server->hostname, new_host);
@@ -4240,7 +5106,9 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                     }
                 } else if (ours) {
                     if (parsed_packet->questions && !parsed_packet->probe) {
-                        _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        if (ttl > (MDNS_ANSWER_A_TTL / 2)) {
+                            _mdns_remove_parsed_question(parsed_packet, type, NULL);
+                        }
                         continue;
                     }
                     if (!_mdns_name_is_selfhosted(name)) {
@@ -4262,6 +5130,7 @@ void mdns_parse_packet(mdns_rx_packet_t *packet)
                         if (_mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].probe_running) {
                             if (col && (parsed_packet->probe || parsed_packet->authoritative)) {
                                 _mdns_server->interfaces[packet->tcpip_if].pcbs[packet->ip_protocol].failed_probes++;
+                                MDNS_STATS_INC(packet->tcpip_if, probe_conflicts);
                                 char *new_host = _mdns_mangle_name((char *)_mdns_server->hostname);
                                 if (new_host) {
                                     _mdns_remap_self_service_hostname(_mdns_server->hostname, new_host);
@@ -4379,6 +5248,9 @@ void _mdns_disable_pcb(mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
         }
     }
     _mdns_server->interfaces[tcpip_if].pcbs[ip_protocol].state = PCB_OFF;
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    _mdns_server->interfaces[tcpip_if].pcbs[ip_protocol].announced_addrs = 0;
+#endif
 }
 
 #ifdef CONFIG_MDNS_RESPOND_REVERSE_QUERIES
@@ -4459,6 +5331,122 @@ static void perform_event_action(mdns_if_t mdns_if, mdns_event_actions_t action)
 #endif /* CONFIG_MDNS_RESPOND_REVERSE_QUERIES */
 }
 
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+/**
+ * @brief  Hash of the current IPv4 and IPv6 addresses of an interface, never 0
+ *
+ * Both are hashed for both PCBs, as the host answers of each PCB carry the A and AAAA records.
+ */
+static uint32_t _mdns_netif_addrs_hash(mdns_if_t mdns_if)
+{
+    uint32_t hash = 2166136261U;    // FNV-1a
+    const uint8_t *bytes;
+    size_t len;
+    esp_netif_t *netif = _mdns_get_esp_netif(mdns_if);
+    if (!netif) {
+        return 1;
+    }
+#ifdef CONFIG_LWIP_IPV4
+    esp_netif_ip_info_t if_ip_info;
+    if (esp_netif_get_ip_info(netif, &if_ip_info) == ESP_OK) {
+        bytes = (const uint8_t *)&if_ip_info.ip.addr;
+        for (len = 0; len < sizeof(if_ip_info.ip.addr); len++) {
+            hash = (hash ^ bytes[len]) * 16777619U;
+        }
+    }
+#endif /* CONFIG_LWIP_IPV4 */
+#ifdef CONFIG_LWIP_IPV6
+    struct esp_ip6_addr if_ip6s[NETIF_IPV6_MAX_NUMS];
+    int count = esp_netif_get_all_ip6(netif, if_ip6s);
+    for (int i = 0; i < count && i < NETIF_IPV6_MAX_NUMS; i++) {
+        bytes = (const uint8_t *)if_ip6s[i].addr;
+        for (len = 0; len < sizeof(if_ip6s[i].addr); len++) {
+            hash = (hash ^ bytes[len]) * 16777619U;
+        }
+    }
+#endif /* CONFIG_LWIP_IPV6 */
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief  Adds events of an interface to its pending ones, performed CONFIG_MDNS_NETIF_EVENT_DEBOUNCE_MS after the first
+ *
+ * The window is not extended by the later events, so that a stream of them does not defer the first forever.
+ * Of enabling and disabling the same PCB, the last one asked wins.
+ */
+static void _mdns_netif_events_add(mdns_if_t mdns_if, uint32_t action)
+{
+    if (!_mdns_server || mdns_if >= MDNS_MAX_INTERFACES) {
+        return;
+    }
+    uint32_t *pending = &_mdns_server->interfaces[mdns_if].pending_events;
+    if (!*pending) {
+        _mdns_server->interfaces[mdns_if].events_at = xTaskGetTickCount() * portTICK_PERIOD_MS
+                                                      + CONFIG_MDNS_NETIF_EVENT_DEBOUNCE_MS;
+    }
+    if (action & MDNS_EVENT_ENABLE_IP4) {
+        *pending &= ~MDNS_EVENT_DISABLE_IP4;
+    }
+    if (action & MDNS_EVENT_DISABLE_IP4) {
+        *pending &= ~MDNS_EVENT_ENABLE_IP4;
+    }
+    if (action & MDNS_EVENT_ENABLE_IP6) {
+        *pending &= ~MDNS_EVENT_DISABLE_IP6;
+    }
+    if (action & MDNS_EVENT_DISABLE_IP6) {
+        *pending &= ~MDNS_EVENT_ENABLE_IP6;
+    }
+    *pending |= action;
+    _mdns_timer_rearm();
+}
+
+/**
+ * @brief  Performs the coalesced events of an interface
+ *
+ * An announcement is left out when the PCB is enabled or disabled too, the probing of an enabled PCB ends with
+ * one already, or when the addresses of the interface did not change since the last announcement on the PCB.
+ */
+static void _mdns_netif_events_perform(mdns_if_t mdns_if, uint32_t action)
+{
+    static const uint32_t announce[MDNS_IP_PROTOCOL_MAX] = { MDNS_EVENT_ANNOUNCE_IP4, MDNS_EVENT_ANNOUNCE_IP6 };
+    static const uint32_t change[MDNS_IP_PROTOCOL_MAX] = {
+        MDNS_EVENT_ENABLE_IP4 | MDNS_EVENT_DISABLE_IP4, MDNS_EVENT_ENABLE_IP6 | MDNS_EVENT_DISABLE_IP6
+    };
+    uint32_t addrs = _mdns_netif_addrs_hash(mdns_if);
+    for (int i = 0; i < MDNS_IP_PROTOCOL_MAX; i++) {
+        mdns_pcb_t *pcb = &_mdns_server->interfaces[mdns_if].pcbs[i];
+        if (action & change[i]) {
+            action &= ~announce[i];
+        } else if ((action & announce[i]) && pcb->announced_addrs == addrs) {
+            ESP_LOGD(TAG, "Addresses of interface %d unchanged, not announced", (int)mdns_if);
+            action &= ~announce[i];
+        }
+    }
+    perform_event_action(mdns_if, (mdns_event_actions_t)action);
+    for (int i = 0; i < MDNS_IP_PROTOCOL_MAX; i++) {
+        if ((action & (announce[i] | change[i])) && mdns_is_netif_ready(mdns_if, i)) {
+            _mdns_server->interfaces[mdns_if].pcbs[i].announced_addrs = addrs;
+        }
+    }
+}
+
+/**
+ * @brief  Performs the pending events of the interfaces whose window is over
+ */
+static void _mdns_netif_events_flush(void)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    _mdns_server->events_flush_queued = false;
+    for (mdns_if_t i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        uint32_t action = _mdns_server->interfaces[i].pending_events;
+        if (action && (int32_t)(now - _mdns_server->interfaces[i].events_at) >= 0) {
+            _mdns_server->interfaces[i].pending_events = 0;
+            _mdns_netif_events_perform(i, action);
+        }
+    }
+}
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
+
 /**
  * @brief  Dispatch interface changes based on system events
  */
@@ -4580,6 +5568,18 @@ static void _mdns_search_free(mdns_search_once_t *search)
     free(search);
 }
 
+/**
+ * @brief  Free batch structure, its searches and their results
+ */
+static void _mdns_search_batch_free(mdns_query_batch_t *batch)
+{
+    for (size_t i = 0; i < batch->num_searches; i++) {
+        mdns_query_results_free(batch->searches[i]->result);
+        _mdns_search_free(batch->searches[i]);
+    }
+    free(batch);
+}
+
 /**
  * @brief  Allocate new search structure
  */
@@ -4638,26 +5638,257 @@ static mdns_search_once_t *_mdns_search_init(const char *name, const char *servi
     return search;
 }
 
+#ifdef CONFIG_MDNS_QUERY_CACHE
 /**
- * @brief  Mark search as finished and remove it from search chain
+ * @brief  Copy of one result, strings, txt items and addresses included
  */
-static void _mdns_search_finish(mdns_search_once_t *search)
+static mdns_result_t *_mdns_result_copy(const mdns_result_t *r)
+{
+    mdns_result_t *c = (mdns_result_t *)calloc(1, sizeof(mdns_result_t));
+    if (!c) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
+    }
+    c->esp_netif = r->esp_netif;
+    c->ttl = r->ttl;
+    c->ip_protocol = r->ip_protocol;
+    c->port = r->port;
+    if ((r->instance_name && !(c->instance_name = strdup(r->instance_name)))
+            || (r->service_type && !(c->service_type = strdup(r->service_type)))
+            || (r->proto && !(c->proto = strdup(r->proto)))
+            || (r->hostname && !(c->hostname = strdup(r->hostname)))
+            || (r->addr && !(c->addr = copy_address_list(r->addr)))) {
+        goto fail;
+    }
+    if (r->txt_count) {
+        c->txt = (mdns_txt_item_t *)calloc(r->txt_count, sizeof(mdns_txt_item_t));
+        c->txt_value_len = (uint8_t *)calloc(r->txt_count, sizeof(uint8_t));
+        if (!c->txt || !c->txt_value_len) {
+            goto fail;
+        }
+        c->txt_count = r->txt_count;
+        for (size_t i = 0; i < r->txt_count; i++) {
+            uint8_t value_len = r->txt_value_len ? r->txt_value_len[i] : 0;
+            c->txt_value_len[i] = value_len;
+            c->txt[i].key = strdup(r->txt[i].key);
+            if (!c->txt[i].key) {
+                goto fail;
+            }
+            if (r->txt[i].value) {
+                char *value = (char *)malloc(value_len + 1);
+                if (!value) {
+                    goto fail;
+                }
+                memcpy(value, r->txt[i].value, value_len);
+                value[value_len] = 0;
+                c->txt[i].value = value;
+            }
+        }
+    }
+    return c;
+
+fail:
+    HOOK_MALLOC_FAILED;
+    _mdns_query_results_free(c);
+    return NULL;
+}
+
+/**
+ * @brief  Copy of the first max_results results of the list (all of them if max_results is 0)
+ */
+static mdns_result_t *_mdns_results_copy(const mdns_result_t *results, uint8_t max_results, uint8_t *num_results)
+{
+    mdns_result_t *head = NULL;
+    mdns_result_t *tail = NULL;
+    uint8_t num = 0;
+    while (results && (!max_results || num < max_results)) {
+        mdns_result_t *c = _mdns_result_copy(results);
+        if (!c) {
+            _mdns_query_results_free(head);
+            return NULL;
+        }
+        if (tail) {
+            tail->next = c;
+        } else {
+            head = c;
+        }
+        tail = c;
+        num++;
+        results = results->next;
+    }
+    *num_results = num;
+    return head;
+}
+
+static inline bool _mdns_query_cache_str_match(const char *a, const char *b)
+{
+    return (!a && !b) || (a && b && !strcasecmp(a, b));
+}
+
+static void _mdns_query_cache_item_free(mdns_query_cache_t *item)
+{
+    _mdns_query_results_free(item->result);
+    free(item->instance);
+    free(item->service);
+    free(item->proto);
+    free(item);
+}
+
+/**
+ * @brief  Drops the cached queries which are past 80% of their TTL, or all of them
+ */
+static void _mdns_query_cache_purge(bool all)
+{
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    mdns_query_cache_t **it = &_mdns_server->query_cache;
+    while (*it) {
+        mdns_query_cache_t *item = *it;
+        if (all || (int32_t)(now - item->expires_at) >= 0) {
+            *it = item->next;
+            _mdns_query_cache_item_free(item);
+        } else {
+            it = &item->next;
+        }
+    }
+}
+
+static mdns_query_cache_t *_mdns_query_cache_find(mdns_search_once_t *search)
+{
+    mdns_query_cache_t *item = _mdns_server->query_cache;
+    while (item) {
+        if (item->type == search->type
+                && _mdns_query_cache_str_match(item->instance, search->instance)
+                && _mdns_query_cache_str_match(item->service, search->service)
+                && _mdns_query_cache_str_match(item->proto, search->proto)) {
+            return item;
+        }
+        item = item->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief  Keeps a copy of the results of a finished search, replacing the older results of the same query
+ */
+static void _mdns_query_cache_store(mdns_search_once_t *search)
+{
+    uint32_t min_ttl = UINT32_MAX;
+    for (mdns_result_t *r = search->result; r; r = r->next) {
+        min_ttl = r->ttl < min_ttl ? r->ttl : min_ttl;
+    }
+    if (!search->result || !min_ttl) {
+        return;
+    }
+    _mdns_query_cache_purge(false);
+    mdns_query_cache_t *item = _mdns_query_cache_find(search);
+    if (item) {
+        queueDetach(mdns_query_cache_t, _mdns_server->query_cache, item);
+        _mdns_query_cache_item_free(item);
+    }
+
+    item = (mdns_query_cache_t *)calloc(1, sizeof(mdns_query_cache_t));
+    if (!item) {
+        HOOK_MALLOC_FAILED;
+        return;
+    }
+    item->type = search->type;
+    if ((search->instance && !(item->instance = strdup(search->instance)))
+            || (search->service && !(item->service = strdup(search->service)))
+            || (search->proto && !(item->proto = strdup(search->proto)))
+            || !(item->result = _mdns_results_copy(search->result, 0, &item->num_results))) {
+        _mdns_query_cache_item_free(item);
+        return;
+    }
+    // refresh from the network at 80% of the TTL, as a cache maintenance query would (RFC 6762, 5.2)
+    uint32_t valid_ms = min_ttl > (INT32_MAX / 800) ? INT32_MAX : min_ttl * 800;
+    item->expires_at = (xTaskGetTickCount() * portTICK_PERIOD_MS) + valid_ms;
+    item->next = _mdns_server->query_cache;
+    _mdns_server->query_cache = item;
+
+    // keep the newest queries only
+    size_t count = 0;
+    mdns_query_cache_t **it = &_mdns_server->query_cache;
+    while (*it) {
+        if (++count > CONFIG_MDNS_QUERY_CACHE_SIZE) {
+            mdns_query_cache_t *old = *it;
+            *it = old->next;
+            _mdns_query_cache_item_free(old);
+        } else {
+            it = &(*it)->next;
+        }
+    }
+}
+
+/**
+ * @brief  Fills a new search with the cached results of the same query
+ *
+ * @return true if the search got its results from the cache and needs no transmission
+ */
+static bool _mdns_query_cache_answer(mdns_search_once_t *search)
+{
+    _mdns_query_cache_purge(false);
+    mdns_query_cache_t *item = _mdns_query_cache_find(search);
+    if (!item) {
+        return false;
+    }
+    search->result = _mdns_results_copy(item->result, search->max_results, &search->num_results);
+    return search->result != NULL;
+}
+#endif /* CONFIG_MDNS_QUERY_CACHE */
+
+/**
+ * @brief  Tell the waiters of a search that it has ended
+ */
+static void _mdns_search_notify(mdns_search_once_t *search)
 {
-    search->state = SEARCH_OFF;
-    queueDetach(mdns_search_once_t, _mdns_server->search_once, search);
     if (search->notifier) {
         search->notifier(search);
     }
+    if (search->batch && search->batch->notifier) {
+        search->batch->notifier(search->batch, search->batch_index);
+    }
     xSemaphoreGive(search->done_semaphore);
 }
 
+/**
+ * @brief  Mark search as finished and remove it from search chain
+ */
+static void _mdns_search_finish(mdns_search_once_t *search)
+{
+#ifdef CONFIG_MDNS_QUERY_CACHE
+    _mdns_query_cache_store(search);
+#endif /* CONFIG_MDNS_QUERY_CACHE */
+    search->state = SEARCH_OFF;
+    queueDetach(mdns_search_once_t, _mdns_server->search_once, search);
+    _mdns_search_notify(search);
+}
+
 /**
  * @brief  Add new search to the search chain
  */
 static void _mdns_search_add(mdns_search_once_t *search)
 {
+#ifdef CONFIG_MDNS_QUERY_CACHE
+    if (_mdns_query_cache_answer(search)) {
+        // answered without being added to the search chain, nor stored again in the cache
+        search->state = SEARCH_OFF;
+        _mdns_search_notify(search);
+        return;
+    }
+#endif /* CONFIG_MDNS_QUERY_CACHE */
     search->next = _mdns_server->search_once;
     _mdns_server->search_once = search;
+    _mdns_timer_rearm();
+}
+
+/**
+ * @brief  Add all the searches of a batch to the search chain
+ */
+static void _mdns_search_batch_add(mdns_query_batch_t *batch)
+{
+    for (size_t i = 0; i < batch->num_searches; i++) {
+        _mdns_search_add(batch->searches[i]);
+    }
 }
 
 /**
@@ -4990,21 +6221,18 @@ static mdns_search_once_t *_mdns_search_find_from(mdns_search_once_t *s, mdns_na
 }
 
 /**
- * @brief  Create search packet for particular interface
+ * @brief  Append the question of a search, and its known answers, to a search packet
+ *
+ * @return false on allocation failure, the packet has to be freed
  */
-static mdns_tx_packet_t *_mdns_create_search_packet(mdns_search_once_t *search, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+static bool _mdns_search_packet_append(mdns_tx_packet_t *packet, mdns_search_once_t *search, mdns_if_t tcpip_if,
+                                       mdns_ip_protocol_t ip_protocol)
 {
     mdns_result_t *r = NULL;
-    mdns_tx_packet_t *packet = _mdns_alloc_packet_default(tcpip_if, ip_protocol);
-    if (!packet) {
-        return NULL;
-    }
-
     mdns_out_question_t *q = (mdns_out_question_t *)malloc(sizeof(mdns_out_question_t));
     if (!q) {
         HOOK_MALLOC_FAILED;
-        _mdns_free_tx_packet(packet);
-        return NULL;
+        return false;
     }
     q->next = NULL;
     q->unicast = search->unicast;
@@ -5024,11 +6252,10 @@ static mdns_tx_packet_t *_mdns_create_search_packet(mdns_search_once_t *search,
                 r = r->next;
                 continue;
             }
-            mdns_out_answer_t *a = (mdns_out_answer_t *)malloc(sizeof(mdns_out_answer_t));
+            mdns_out_answer_t *a = _mdns_mem_alloc_answer();
             if (!a) {
                 HOOK_MALLOC_FAILED;
-                _mdns_free_tx_packet(packet);
-                return NULL;
+                return false;
             }
             a->type = MDNS_TYPE_PTR;
             a->service = NULL;
@@ -5043,6 +6270,51 @@ static mdns_tx_packet_t *_mdns_create_search_packet(mdns_search_once_t *search,
         }
     }
 
+    return true;
+}
+
+/**
+ * @brief  Create search packet for particular interface
+ */
+static mdns_tx_packet_t *_mdns_create_search_packet(mdns_search_once_t *search, mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    mdns_tx_packet_t *packet = _mdns_alloc_packet_default(tcpip_if, ip_protocol);
+    if (!packet) {
+        return NULL;
+    }
+    if (!_mdns_search_packet_append(packet, search, tcpip_if, ip_protocol)) {
+        _mdns_free_tx_packet(packet);
+        return NULL;
+    }
+    return packet;
+}
+
+/**
+ * @brief  Create one search packet with the questions of all the running searches of a batch,
+ *         split by the dispatcher if they do not fit in one
+ */
+static mdns_tx_packet_t *_mdns_create_search_batch_packet(mdns_query_batch_t *batch, mdns_if_t tcpip_if,
+        mdns_ip_protocol_t ip_protocol)
+{
+    mdns_tx_packet_t *packet = _mdns_alloc_packet_default(tcpip_if, ip_protocol);
+    if (!packet) {
+        return NULL;
+    }
+    for (size_t i = 0; i < batch->num_searches; i++) {
+        mdns_search_once_t *search = batch->searches[i];
+        // ended, or answered from the cache
+        if (search->state == SEARCH_OFF) {
+            continue;
+        }
+        if (!_mdns_search_packet_append(packet, search, tcpip_if, ip_protocol)) {
+            _mdns_free_tx_packet(packet);
+            return NULL;
+        }
+    }
+    if (!packet->questions) {
+        _mdns_free_tx_packet(packet);
+        return NULL;
+    }
     return packet;
 }
 
@@ -5053,7 +6325,11 @@ static void _mdns_search_send_pcb(mdns_search_once_t *search, mdns_if_t tcpip_if
 {
     mdns_tx_packet_t *packet = NULL;
     if (mdns_is_netif_ready(tcpip_if, ip_protocol) && _mdns_server->interfaces[tcpip_if].pcbs[ip_protocol].state > PCB_INIT) {
-        packet = _mdns_create_search_packet(search, tcpip_if, ip_protocol);
+        if (search->batch) {
+            packet = _mdns_create_search_batch_packet(search->batch, tcpip_if, ip_protocol);
+        } else {
+            packet = _mdns_create_search_packet(search, tcpip_if, ip_protocol);
+        }
         if (!packet) {
             return;
         }
@@ -5129,6 +6405,7 @@ static void _mdns_tx_handle_packet(mdns_tx_packet_t *p)
         free(pcb->probe_services);
         pcb->probe_services = NULL;
         _mdns_free_tx_packet(p);
+        _mdns_claimed_names_store();
         p = a;
         send_after = 250;
     //fallthrough
@@ -5193,6 +6470,9 @@ static void _mdns_free_action(mdns_action_t *action)
     case ACTION_SEARCH_END:
         _mdns_search_free(action->data.search_add.search);
         break;
+    case ACTION_SEARCH_BATCH_ADD:
+        _mdns_search_batch_free(action->data.search_batch_add.batch);
+        break;
     case ACTION_BROWSE_ADD:
     //fallthrough
     case ACTION_BROWSE_END:
@@ -5204,9 +6484,15 @@ static void _mdns_free_action(mdns_action_t *action)
     case ACTION_TX_HANDLE:
         _mdns_free_tx_packet(action->data.tx_handle.packet);
         break;
-    case ACTION_RX_HANDLE:
-        _mdns_packet_free(action->data.rx_handle.packet);
-        break;
+    case ACTION_RX_HANDLE: {
+        mdns_rx_packet_t *packet = action->data.rx_handle.packet;
+        while (packet) {
+            mdns_rx_packet_t *next = packet->next;
+            _mdns_packet_free(packet);
+            packet = next;
+        }
+    }
+    break;
     case ACTION_DELEGATE_HOSTNAME_SET_ADDR:
     case ACTION_DELEGATE_HOSTNAME_ADD:
         free((char *)action->data.delegate_hostname.hostname);
@@ -5228,21 +6514,30 @@ static void _mdns_execute_action(mdns_action_t *action)
 {
     switch (action->type) {
     case ACTION_SYSTEM_EVENT:
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+        _mdns_netif_events_add(action->data.sys_event.interface, action->data.sys_event.event_action);
+#else
         perform_event_action(action->data.sys_event.interface, action->data.sys_event.event_action);
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
+        break;
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    case ACTION_SYSTEM_EVENT_FLUSH:
+        _mdns_netif_events_flush();
         break;
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
     case ACTION_HOSTNAME_SET:
         _mdns_send_bye_all_pcbs_no_instance(true);
         _mdns_remap_self_service_hostname(_mdns_server->hostname, action->data.hostname_set.hostname);
         free((char *)_mdns_server->hostname);
-        _mdns_server->hostname = action->data.hostname_set.hostname;
-        _mdns_self_host.hostname = action->data.hostname_set.hostname;
+        _mdns_server->hostname = _mdns_claimed_name_restore(MDNS_CLAIMED_HOSTNAME, action->data.hostname_set.hostname);
+        _mdns_self_host.hostname = _mdns_server->hostname;
         _mdns_restart_all_pcbs();
         xSemaphoreGive(_mdns_server->action_sema);
         break;
     case ACTION_INSTANCE_SET:
         _mdns_send_bye_all_pcbs_no_instance(false);
         free((char *)_mdns_server->instance);
-        _mdns_server->instance = action->data.instance;
+        _mdns_server->instance = _mdns_claimed_name_restore(MDNS_CLAIMED_INSTANCE, action->data.instance);
         _mdns_restart_all_pcbs_no_instance();
 
         break;
@@ -5255,6 +6550,9 @@ static void _mdns_execute_action(mdns_action_t *action)
     case ACTION_SEARCH_END:
         _mdns_search_finish(action->data.search_add.search);
         break;
+    case ACTION_SEARCH_BATCH_ADD:
+        _mdns_search_batch_add(action->data.search_batch_add.batch);
+        break;
 
     case ACTION_BROWSE_ADD:
         _mdns_browse_add(action->data.browse_add.browse);
@@ -5279,10 +6577,19 @@ static void _mdns_execute_action(mdns_action_t *action)
         }
     }
     break;
-    case ACTION_RX_HANDLE:
-        mdns_parse_packet(action->data.rx_handle.packet);
-        _mdns_packet_free(action->data.rx_handle.packet);
-        break;
+    case ACTION_RX_HANDLE: {
+        // the networking backend might pass a batch of packets received together
+        mdns_rx_packet_t *packet = action->data.rx_handle.packet;
+        while (packet) {
+            mdns_rx_packet_t *next = packet->next;
+            MDNS_TRACE('B', _mdns_get_packet_len(packet));
+            mdns_parse_packet(packet);
+            MDNS_TRACE('E', 0);
+            _mdns_packet_free(packet);
+            packet = next;
+        }
+    }
+    break;
     case ACTION_DELEGATE_HOSTNAME_ADD:
         if (!_mdns_delegate_hostname_add(action->data.delegate_hostname.hostname,
                                          action->data.delegate_hostname.address_list)) {
@@ -5323,7 +6630,7 @@ static esp_err_t _mdns_send_search_action(mdns_action_type_t type, mdns_search_o
 
     action->type = type;
     action->data.search_add.search = search;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(action);
         return ESP_ERR_NO_MEM;
     }
@@ -5333,7 +6640,7 @@ static esp_err_t _mdns_send_search_action(mdns_action_type_t type, mdns_search_o
 /**
  * @brief  Called from timer task to run mDNS responder
  *
- * periodically checks first unqueued packet (from tx head).
+ * checks first unqueued packet (from tx head), when the scheduler timer fires for it.
  * if it is scheduled to be transmitted, then pushes the packet to action queue to be handled.
  *
  */
@@ -5357,7 +6664,7 @@ static void _mdns_scheduler_run(void)
             action->type = ACTION_TX_HANDLE;
             action->data.tx_handle.packet = p;
             p->queued = true;
-            if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+            if (_mdns_action_send(action) != pdPASS) {
                 free(action);
                 p->queued = false;
             }
@@ -5393,8 +6700,12 @@ static void _mdns_search_run(void)
             } else if (s->state == SEARCH_INIT || (now - s->sent_at) > 1000) {
                 s->state = SEARCH_RUNNING;
                 s->sent_at = now;
-                if (_mdns_send_search_action(ACTION_SEARCH_SEND, s) != ESP_OK) {
+                if (s->batch && s->batch->sent_at == now) {
+                    // its question goes in the packet already queued for another search of the batch
+                } else if (_mdns_send_search_action(ACTION_SEARCH_SEND, s) != ESP_OK) {
                     s->sent_at -= 1000;
+                } else if (s->batch) {
+                    s->batch->sent_at = now;
                 }
             }
         }
@@ -5403,6 +6714,99 @@ static void _mdns_search_run(void)
     MDNS_SERVICE_UNLOCK();
 }
 
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+/**
+ * @brief  Called from timer task to queue the flush of the netif events whose window is over
+ */
+static void _mdns_netif_events_run(void)
+{
+    MDNS_SERVICE_LOCK();
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    bool due = false;
+    for (mdns_if_t i = 0; i < MDNS_MAX_INTERFACES; i++) {
+        if (_mdns_server->interfaces[i].pending_events && (int32_t)(now - _mdns_server->interfaces[i].events_at) >= 0) {
+            due = true;
+        }
+    }
+    if (due && !_mdns_server->events_flush_queued) {
+        mdns_action_t *action = (mdns_action_t *)calloc(1, sizeof(mdns_action_t));
+        if (!action) {
+            HOOK_MALLOC_FAILED;
+        } else {
+            action->type = ACTION_SYSTEM_EVENT_FLUSH;
+            if (_mdns_action_send(action) != pdPASS) {
+                free(action);
+            } else {
+                _mdns_server->events_flush_queued = true;
+            }
+        }
+    }
+    MDNS_SERVICE_UNLOCK();
+}
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
+
+#ifdef CONFIG_MDNS_SHARED_TASK
+// actions executed per run of the executor, so that a burst of packets does not hold it for long
+#define MDNS_EXECUTOR_BATCH 8
+
+static void _mdns_executor_schedule(void);
+
+/**
+ * @brief  Executes the queued actions on the shared executor, in place of the service task
+ */
+static void _mdns_executor_work(void *arg)
+{
+    __atomic_store_n(&_mdns_executor_posted, false, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&_mdns_executor_busy, true, __ATOMIC_SEQ_CST);
+    bool more = false;
+    if (!__atomic_load_n(&_mdns_executor_stopping, __ATOMIC_SEQ_CST) && _mdns_server && _mdns_server->action_queue) {
+        mdns_action_t *a = NULL;
+        size_t done = 0;
+        while (done < MDNS_EXECUTOR_BATCH && xQueueReceive(_mdns_server->action_queue, &a, 0) == pdTRUE) {
+            MDNS_SERVICE_LOCK();
+            _mdns_execute_action(a);
+            MDNS_SERVICE_UNLOCK();
+            done++;
+        }
+        more = done == MDNS_EXECUTOR_BATCH && uxQueueMessagesWaiting(_mdns_server->action_queue);
+    }
+    __atomic_store_n(&_mdns_executor_busy, false, __ATOMIC_SEQ_CST);
+    if (more) {
+        _mdns_executor_schedule();
+    }
+}
+
+/**
+ * @brief  Posts a drain of the action queue to the executor, unless one is pending already
+ */
+static void _mdns_executor_schedule(void)
+{
+    if (__atomic_exchange_n(&_mdns_executor_posted, true, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    if (_mdns_executor_post(_mdns_executor_work, NULL) != ESP_OK) {
+        // the actions stay queued until the next one is sent
+        __atomic_store_n(&_mdns_executor_posted, false, __ATOMIC_SEQ_CST);
+    }
+}
+#endif /* CONFIG_MDNS_SHARED_TASK */
+
+/**
+ * @brief  Queue an action for the service task, or for the shared executor
+ */
+static BaseType_t _mdns_action_send(mdns_action_t *action)
+{
+    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+        return pdFAIL;
+    }
+#ifdef CONFIG_MDNS_SHARED_TASK
+    if (_mdns_executor_running) {
+        _mdns_executor_schedule();
+    }
+#endif /* CONFIG_MDNS_SHARED_TASK */
+    return pdPASS;
+}
+
 /**
  * @brief  the main MDNS service task. Packets are received and parsed here
  */
@@ -5428,10 +6832,97 @@ static void _mdns_service_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief  Arms the one shot scheduler timer for the earliest pending deadline
+ *
+ * The deadline is the earliest of the first unqueued tx packet, of the next send or timeout
+ * of active searches and of the end of the window of pending netif events. The timer is left idle if nothing is pending, and never fires sooner than
+ * CONFIG_MDNS_TIMER_PERIOD_MS. An already armed timer is kept if it fires before the new deadline, as the
+ * timer callback rearms it anyway. Called with the service lock held.
+ */
+static void _mdns_timer_rearm(void)
+{
+    if (!_mdns_server || !_mdns_server->timer_handle) {
+        return;
+    }
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    bool pending = false;
+    int32_t delay = INT32_MAX;
+
+    mdns_tx_packet_t *p = _mdns_server->tx_queue_head;
+    while (p && p->queued) {
+        p = p->next;
+    }
+    if (p) {
+        pending = true;
+        // _mdns_scheduler_run() sends the packets strictly past their time
+        delay = (int32_t)(p->send_at + 1 - now);
+    }
+    mdns_search_once_t *s = _mdns_server->search_once;
+    while (s) {
+        if (s->state == SEARCH_INIT) {
+            pending = true;
+            delay = 0;
+        } else if (s->state == SEARCH_RUNNING) {
+            // as checked in _mdns_search_run(): timed out, or one second after the last query
+            int32_t timeout_in = (int32_t)(s->started_at + s->timeout + 1 - now);
+            int32_t resend_in = (int32_t)(s->sent_at + 1001 - now);
+            pending = true;
+            if (timeout_in < delay) {
+                delay = timeout_in;
+            }
+            if (resend_in < delay) {
+                delay = resend_in;
+            }
+        }
+        s = s->next;
+    }
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    for (mdns_if_t i = 0; i < MDNS_MAX_INTERFACES && !_mdns_server->events_flush_queued; i++) {
+        if (_mdns_server->interfaces[i].pending_events) {
+            int32_t events_in = (int32_t)(_mdns_server->interfaces[i].events_at - now);
+            pending = true;
+            if (events_in < delay) {
+                delay = events_in;
+            }
+        }
+    }
+#endif /* CONFIG_MDNS_NETIF_EVENT_DEBOUNCE */
+
+    if (!pending) {
+        if (_mdns_server->timer_armed) {
+            esp_timer_stop(_mdns_server->timer_handle);
+            _mdns_server->timer_armed = false;
+        }
+        return;
+    }
+    if (delay < CONFIG_MDNS_TIMER_PERIOD_MS) {
+        delay = CONFIG_MDNS_TIMER_PERIOD_MS;
+    }
+    uint32_t deadline = now + delay;
+    if (_mdns_server->timer_armed && (int32_t)(_mdns_server->timer_deadline - deadline) <= 0) {
+        return;
+    }
+    esp_timer_stop(_mdns_server->timer_handle);
+    if (esp_timer_start_once(_mdns_server->timer_handle, (uint64_t)delay * 1000) == ESP_OK) {
+        _mdns_server->timer_deadline = deadline;
+        _mdns_server->timer_armed = true;
+    } else {
+        _mdns_server->timer_armed = false;
+    }
+}
+
 static void _mdns_timer_cb(void *arg)
 {
     _mdns_scheduler_run();
     _mdns_search_run();
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    _mdns_netif_events_run();
+#endif
+    MDNS_SERVICE_LOCK();
+    _mdns_server->timer_armed = false;
+    _mdns_timer_rearm();
+    MDNS_SERVICE_UNLOCK();
 }
 
 static esp_err_t _mdns_start_timer(void)
@@ -5446,18 +6937,25 @@ static esp_err_t _mdns_start_timer(void)
     if (err) {
         return err;
     }
-    return esp_timer_start_periodic(_mdns_server->timer_handle, MDNS_TIMER_PERIOD_US);
+    _mdns_server->timer_armed = false;
+    // packets of the probes started before the timer existed are pending already
+    _mdns_timer_rearm();
+    return ESP_OK;
 }
 
 static esp_err_t _mdns_stop_timer(void)
 {
     esp_err_t err = ESP_OK;
     if (_mdns_server->timer_handle) {
-        err = esp_timer_stop(_mdns_server->timer_handle);
-        if (err) {
-            return err;
+        if (_mdns_server->timer_armed) {
+            // one shot timer, which might have expired already
+            esp_timer_stop(_mdns_server->timer_handle);
+            _mdns_server->timer_armed = false;
         }
         err = esp_timer_delete(_mdns_server->timer_handle);
+        if (!err) {
+            _mdns_server->timer_handle = NULL;
+        }
     }
     return err;
 }
@@ -5482,6 +6980,16 @@ static esp_err_t _mdns_service_task_start(void)
         MDNS_SERVICE_UNLOCK();
         return ESP_FAIL;
     }
+#ifdef CONFIG_MDNS_SHARED_TASK
+    if (_mdns_executor_post) {
+        __atomic_store_n(&_mdns_executor_stopping, false, __ATOMIC_SEQ_CST);
+        _mdns_executor_running = true;
+        // actions queued while starting
+        _mdns_executor_schedule();
+        MDNS_SERVICE_UNLOCK();
+        return ESP_OK;
+    }
+#endif /* CONFIG_MDNS_SHARED_TASK */
     if (!_mdns_service_task_handle) {
         xTaskCreatePinnedToCore(_mdns_service_task, "mdns", MDNS_SERVICE_STACK_DEPTH, NULL, MDNS_TASK_PRIORITY,
                                 (TaskHandle_t *const)(&_mdns_service_task_handle), MDNS_TASK_AFFINITY);
@@ -5506,6 +7014,16 @@ static esp_err_t _mdns_service_task_start(void)
 static esp_err_t _mdns_service_task_stop(void)
 {
     _mdns_stop_timer();
+#ifdef CONFIG_MDNS_SHARED_TASK
+    if (_mdns_executor_running) {
+        // a drain posted already returns at once, wait for the one running if any
+        __atomic_store_n(&_mdns_executor_stopping, true, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&_mdns_executor_busy, __ATOMIC_SEQ_CST)) {
+            vTaskDelay(1);
+        }
+        _mdns_executor_running = false;
+    }
+#endif /* CONFIG_MDNS_SHARED_TASK */
     if (_mdns_service_task_handle) {
         mdns_action_t action;
         mdns_action_t *a = &action;
@@ -5538,7 +7056,7 @@ static esp_err_t mdns_post_custom_action_tcpip_if(mdns_if_t mdns_if, mdns_event_
     action->data.sys_event.event_action = event_action;
     action->data.sys_event.interface = mdns_if;
 
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(action);
     }
     return ESP_OK;
@@ -5625,11 +7143,62 @@ esp_err_t mdns_unregister_netif(esp_netif_t *esp_netif)
             break;
         }
     }
-    MDNS_SERVICE_UNLOCK();
-    return err;
+    MDNS_SERVICE_UNLOCK();
+    return err;
+}
+
+esp_err_t mdns_stats_get(esp_netif_t *esp_netif, mdns_stats_t *stats)
+{
+#ifdef CONFIG_MDNS_ENABLE_STATS
+    if (!_mdns_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = ESP_OK;
+    MDNS_SERVICE_LOCK();
+    if (esp_netif) {
+        mdns_if_t tcpip_if = _mdns_get_if_from_esp_netif(esp_netif);
+        if (tcpip_if < MDNS_MAX_INTERFACES) {
+            *stats = _mdns_server->interfaces[tcpip_if].stats;
+        } else {
+            err = ESP_ERR_NOT_FOUND;
+        }
+    } else {
+        memset(stats, 0, sizeof(mdns_stats_t));
+        for (mdns_if_t i = 0; i < MDNS_MAX_INTERFACES; ++i) {
+            const mdns_stats_t *s = &_mdns_server->interfaces[i].stats;
+            stats->rx_packets += s->rx_packets;
+            stats->rx_questions += s->rx_questions;
+            stats->rx_dropped += s->rx_dropped;
+            stats->tx_answers += s->tx_answers;
+            stats->tx_suppressed += s->tx_suppressed;
+            stats->tx_bytes += s->tx_bytes;
+            stats->probe_conflicts += s->probe_conflicts;
+        }
+    }
+    MDNS_SERVICE_UNLOCK();
+    return err;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif /* CONFIG_MDNS_ENABLE_STATS */
+}
+
+
+esp_err_t mdns_executor_set(mdns_executor_post_t post)
+{
+#ifdef CONFIG_MDNS_SHARED_TASK
+    if (_mdns_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    _mdns_executor_post = post;
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif /* CONFIG_MDNS_SHARED_TASK */
 }
 
-
 esp_err_t mdns_init(void)
 {
     esp_err_t err = ESP_OK;
@@ -5748,6 +7317,11 @@ void mdns_free(void)
     }
     free((char *)_mdns_server->hostname);
     free((char *)_mdns_server->instance);
+#ifdef CONFIG_MDNS_FAST_BOOT_PROBE
+    for (i = 0; i < MDNS_CLAIMED_NAMES; i++) {
+        free(_mdns_server->claimed_requested[i]);
+    }
+#endif /* CONFIG_MDNS_FAST_BOOT_PROBE */
     if (_mdns_server->action_queue) {
         mdns_action_t *c;
         while (xQueueReceive(_mdns_server->action_queue, &c, 0) == pdTRUE) {
@@ -5756,6 +7330,9 @@ void mdns_free(void)
         vQueueDelete(_mdns_server->action_queue);
     }
     _mdns_clear_tx_queue_head();
+#ifdef CONFIG_MDNS_QUERY_CACHE
+    _mdns_query_cache_purge(true);
+#endif /* CONFIG_MDNS_QUERY_CACHE */
     while (_mdns_server->search_once) {
         mdns_search_once_t *h = _mdns_server->search_once;
         _mdns_server->search_once = h->next;
@@ -5800,7 +7377,7 @@ esp_err_t mdns_hostname_set(const char *hostname)
     }
     action->type = ACTION_HOSTNAME_SET;
     action->data.hostname_set.hostname = new_hostname;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(new_hostname);
         free(action);
         return ESP_ERR_NO_MEM;
@@ -5849,7 +7426,7 @@ esp_err_t mdns_delegate_hostname_add(const char *hostname, const mdns_ip_addr_t
     action->type = ACTION_DELEGATE_HOSTNAME_ADD;
     action->data.delegate_hostname.hostname = new_hostname;
     action->data.delegate_hostname.address_list = copy_address_list(address_list);
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(new_hostname);
         free(action);
         return ESP_ERR_NO_MEM;
@@ -5858,6 +7435,122 @@ esp_err_t mdns_delegate_hostname_add(const char *hostname, const mdns_ip_addr_t
     return ESP_OK;
 }
 
+/**
+ * @brief  unlinks and frees the hosts and services added last by mdns_delegate_hosts_add()
+ *         which are still at the heads of the host and services lists, as nothing is probed before they all are added
+ */
+static void _mdns_delegate_hosts_rollback(size_t num_hosts, size_t num_services)
+{
+    while (num_services--) {
+        mdns_srv_item_t *item = _mdns_server->services;
+        _mdns_service_index_remove(item);
+        _mdns_server->services = item->next;
+        _mdns_free_service(item->service);
+        free(item);
+    }
+    while (num_hosts--) {
+        mdns_host_item_t *host = _mdns_host_list;
+        _mdns_host_list = host->next;
+        free_address_list(host->address_list);
+        free((char *)host->hostname);
+        free(host);
+    }
+}
+
+esp_err_t mdns_delegate_hosts_add(const mdns_delegate_host_t hosts[], size_t num_hosts)
+{
+    if (!_mdns_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!hosts || !num_hosts) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t total_services = 0;
+    for (size_t i = 0; i < num_hosts; i++) {
+        if (_str_null_or_empty(hosts[i].hostname) || strlen(hosts[i].hostname) > (MDNS_NAME_BUF_LEN - 1) ||
+                (hosts[i].num_services && !hosts[i].services)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        for (size_t j = 0; j < hosts[i].num_services; j++) {
+            if (_str_null_or_empty(hosts[i].services[j].service) || _str_null_or_empty(hosts[i].services[j].proto)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        total_services += hosts[i].num_services;
+    }
+    mdns_srv_item_t **items = NULL;
+    if (total_services) {
+        items = (mdns_srv_item_t **)malloc(total_services * sizeof(mdns_srv_item_t *));
+        if (!items) {
+            HOOK_MALLOC_FAILED;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    MDNS_SERVICE_LOCK();
+    esp_err_t ret = ESP_OK;
+    size_t added_hosts = 0;
+    size_t added_services = 0;
+    mdns_host_item_t *host = NULL;
+    mdns_service_t *s = NULL;
+    for (size_t i = 0; i < num_hosts; i++) {
+        // hosts and services are linked as they are created, so that duplicates within the batch are found too
+        ESP_GOTO_ON_FALSE(!_hostname_is_ours(hosts[i].hostname), ESP_ERR_INVALID_ARG, err, TAG,
+                          "Hostname %s already exists", hosts[i].hostname);
+        host = (mdns_host_item_t *)calloc(1, sizeof(mdns_host_item_t));
+        ESP_GOTO_ON_FALSE(host, ESP_ERR_NO_MEM, err, TAG, "Cannot add host: Out of memory");
+        host->hostname = strndup(hosts[i].hostname, MDNS_NAME_BUF_LEN - 1);
+        ESP_GOTO_ON_FALSE(host->hostname, ESP_ERR_NO_MEM, err, TAG, "Cannot add host: Out of memory");
+        if (hosts[i].address_list) {
+            host->address_list = copy_address_list(hosts[i].address_list);
+            ESP_GOTO_ON_FALSE(host->address_list, ESP_ERR_NO_MEM, err, TAG, "Cannot add host: Out of memory");
+        }
+        host->next = _mdns_host_list;
+        _mdns_host_list = host;
+        host = NULL;
+        added_hosts++;
+
+        for (size_t j = 0; j < hosts[i].num_services; j++) {
+            const mdns_delegate_service_t *srv = &hosts[i].services[j];
+            ESP_GOTO_ON_FALSE(_mdns_can_add_more_services(), ESP_ERR_NO_MEM, err, TAG,
+                              "Cannot add more services, please increase CONFIG_MDNS_MAX_SERVICES (%d)", CONFIG_MDNS_MAX_SERVICES);
+            ESP_GOTO_ON_FALSE(!_mdns_get_service_item_instance(srv->instance, srv->service, srv->proto, hosts[i].hostname),
+                              ESP_ERR_INVALID_ARG, err, TAG, "Service already exists");
+            s = _mdns_create_service(srv->service, srv->proto, hosts[i].hostname, srv->port, srv->instance,
+                                     srv->num_items, srv->txt);
+            ESP_GOTO_ON_FALSE(s, ESP_ERR_NO_MEM, err, TAG, "Cannot create service: Out of memory");
+            mdns_srv_item_t *item = (mdns_srv_item_t *)malloc(sizeof(mdns_srv_item_t));
+            ESP_GOTO_ON_FALSE(item, ESP_ERR_NO_MEM, err, TAG, "Cannot create service: Out of memory");
+            item->service = s;
+            item->announce_deferred = false;
+            _mdns_service_item_link(item);
+            s = NULL;
+            items[added_services++] = item;
+        }
+    }
+    if (added_services) {
+        // a single probe of all the services, the probe packets carry as many of them as fit
+        _mdns_probe_all_pcbs(items, added_services, false, false);
+    }
+    MDNS_SERVICE_UNLOCK();
+    free(items);
+    return ESP_OK;
+
+err:
+    _mdns_delegate_hosts_rollback(added_hosts, added_services);
+    _mdns_free_service(s);
+    MDNS_SERVICE_UNLOCK();
+    if (host) {
+        free((char *)host->hostname);
+        free(host);
+    }
+    free(items);
+    if (ret == ESP_ERR_NO_MEM) {
+        HOOK_MALLOC_FAILED;
+    }
+    return ret;
+}
+
 esp_err_t mdns_delegate_hostname_remove(const char *hostname)
 {
     if (!_mdns_server) {
@@ -5879,7 +7572,7 @@ esp_err_t mdns_delegate_hostname_remove(const char *hostname)
     }
     action->type = ACTION_DELEGATE_HOSTNAME_REMOVE;
     action->data.delegate_hostname.hostname = new_hostname;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(new_hostname);
         free(action);
         return ESP_ERR_NO_MEM;
@@ -5909,7 +7602,7 @@ esp_err_t mdns_delegate_hostname_set_address(const char *hostname, const mdns_ip
     action->type = ACTION_DELEGATE_HOSTNAME_SET_ADDR;
     action->data.delegate_hostname.hostname = new_hostname;
     action->data.delegate_hostname.address_list = copy_address_list(address_list);
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(new_hostname);
         free(action);
         return ESP_ERR_NO_MEM;
@@ -5947,7 +7640,7 @@ esp_err_t mdns_instance_name_set(const char *instance)
     }
     action->type = ACTION_INSTANCE_SET;
     action->data.instance = new_instance;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(new_instance);
         free(action);
         return ESP_ERR_NO_MEM;
@@ -5984,17 +7677,15 @@ esp_err_t mdns_service_add_for_host(const char *instance, const char *service, c
     ESP_GOTO_ON_FALSE(item, ESP_ERR_NO_MEM, err, TAG, "Cannot create service: Out of memory");
 
     item->service = s;
-    item->next = NULL;
-
-    item->next = _mdns_server->services;
-    _mdns_server->services = item;
+    item->announce_deferred = false;
+    _mdns_service_item_link(item);
     _mdns_probe_all_pcbs(&item, 1, false, false);
     MDNS_SERVICE_UNLOCK();
     return ESP_OK;
 
 err:
-    MDNS_SERVICE_UNLOCK();
     _mdns_free_service(s);
+    MDNS_SERVICE_UNLOCK();
     if (ret == ESP_ERR_NO_MEM) {
         HOOK_MALLOC_FAILED;
     }
@@ -6214,15 +7905,14 @@ esp_err_t mdns_service_txt_set_for_host(const char *instance, const char *servic
     mdns_txt_linked_item_t *new_txt = NULL;
     if (num_items) {
         new_txt = _mdns_allocate_txt(num_items, txt_items);
-        if (!new_txt) {
-            return ESP_ERR_NO_MEM;
-        }
+        ESP_GOTO_ON_FALSE(new_txt, ESP_ERR_NO_MEM, err, TAG, "Out of memory");
     }
     mdns_service_t *srv = s->service;
     mdns_txt_linked_item_t *txt = srv->txt;
     srv->txt = NULL;
     _mdns_free_linked_txt(txt);
     srv->txt = new_txt;
+    _mdns_service_txt_changed(srv);
     _mdns_announce_all_pcbs(&s, 1, false);
 
 err:
@@ -6243,7 +7933,7 @@ esp_err_t mdns_service_txt_item_set_for_host_with_explicit_value_len(const char
 {
     MDNS_SERVICE_LOCK();
     esp_err_t ret = ESP_OK;
-    char *value = NULL;
+    const char *value = NULL;
     mdns_txt_linked_item_t *new_txt = NULL;
     const char *hostname = host ? host : _mdns_server->hostname;
     ESP_GOTO_ON_FALSE(_mdns_server && _mdns_server->services && !_str_null_or_empty(service) && !_str_null_or_empty(proto) && !_str_null_or_empty(key) &&
@@ -6254,16 +7944,15 @@ esp_err_t mdns_service_txt_item_set_for_host_with_explicit_value_len(const char
 
     mdns_service_t *srv = s->service;
     if (value_len > 0) {
-        value = (char *) malloc(value_len);
+        value = _mdns_txt_str_get(value_arg, value_len);
         ESP_GOTO_ON_FALSE(value, ESP_ERR_NO_MEM, out_of_mem, TAG, "Out of memory");
-        memcpy(value, value_arg, value_len);
     } else {
         value_len = 0;
     }
     mdns_txt_linked_item_t *txt = srv->txt;
     while (txt) {
         if (strcmp(txt->key, key) == 0) {
-            free((char *)txt->value);
+            _mdns_txt_str_put(txt->value);
             txt->value = value;
             txt->value_len = value_len;
             break;
@@ -6273,13 +7962,14 @@ esp_err_t mdns_service_txt_item_set_for_host_with_explicit_value_len(const char
     if (!txt) {
         new_txt = (mdns_txt_linked_item_t *)malloc(sizeof(mdns_txt_linked_item_t));
         ESP_GOTO_ON_FALSE(new_txt, ESP_ERR_NO_MEM, out_of_mem, TAG, "Out of memory");
-        new_txt->key = strdup(key);
+        new_txt->key = _mdns_txt_str_get(key, strlen(key));
         ESP_GOTO_ON_FALSE(new_txt->key, ESP_ERR_NO_MEM, out_of_mem, TAG, "Out of memory");
         new_txt->value = value;
         new_txt->value_len = value_len;
         new_txt->next = srv->txt;
         srv->txt = new_txt;
     }
+    _mdns_service_txt_changed(srv);
 
     _mdns_announce_all_pcbs(&s, 1, false);
 
@@ -6287,9 +7977,9 @@ err:
     MDNS_SERVICE_UNLOCK();
     return ret;
 out_of_mem:
+    _mdns_txt_str_put(value);
     MDNS_SERVICE_UNLOCK();
     HOOK_MALLOC_FAILED;
-    free(value);
     free(new_txt);
     return ret;
 }
@@ -6339,16 +8029,16 @@ esp_err_t mdns_service_txt_item_remove_for_host(const char *instance, const char
     }
     if (strcmp(txt->key, key) == 0) {
         srv->txt = txt->next;
-        free((char *)txt->key);
-        free((char *)txt->value);
+        _mdns_txt_str_put(txt->key);
+        _mdns_txt_str_put(txt->value);
         free(txt);
     } else {
         while (txt->next) {
             if (strcmp(txt->next->key, key) == 0) {
                 mdns_txt_linked_item_t *t = txt->next;
                 txt->next = t->next;
-                free((char *)t->key);
-                free((char *)t->value);
+                _mdns_txt_str_put(t->key);
+                _mdns_txt_str_put(t->value);
                 free(t);
                 break;
             } else {
@@ -6356,6 +8046,7 @@ esp_err_t mdns_service_txt_item_remove_for_host(const char *instance, const char
             }
         }
     }
+    _mdns_service_txt_changed(srv);
 
     _mdns_announce_all_pcbs(&s, 1, false);
 
@@ -6652,6 +8343,7 @@ esp_err_t mdns_service_remove_for_host(const char *instance, const char *service
     if (instance) {
         while (a) {
             if (_mdns_service_match_instance(a->service, instance, service, proto, hostname)) {
+                _mdns_service_index_remove(a);
                 if (_mdns_server->services != a) {
                     b->next = a->next;
                 } else {
@@ -6669,6 +8361,7 @@ esp_err_t mdns_service_remove_for_host(const char *instance, const char *service
     } else {
         while (a) {
             if (_mdns_service_match(a->service, service, proto, hostname)) {
+                _mdns_service_index_remove(a);
                 if (_mdns_server->services != a) {
                     b->next = a->next;
                 } else {
@@ -6710,6 +8403,7 @@ esp_err_t mdns_service_remove_all(void)
     _mdns_send_final_bye(false);
     mdns_srv_item_t *services = _mdns_server->services;
     _mdns_server->services = NULL;
+    memset(_mdns_server->service_index, 0, sizeof(_mdns_server->service_index));
     while (services) {
         mdns_srv_item_t *s = services;
         services = services->next;
@@ -6723,6 +8417,56 @@ done:
     return ret;
 }
 
+esp_err_t mdns_transaction_begin(void)
+{
+    if (!_mdns_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_OK;
+    MDNS_SERVICE_LOCK();
+    ESP_GOTO_ON_FALSE(_mdns_server->transaction_depth < UINT8_MAX, ESP_ERR_INVALID_STATE, err, TAG, "Too many nested transactions");
+    _mdns_server->transaction_depth++;
+err:
+    MDNS_SERVICE_UNLOCK();
+    return ret;
+}
+
+esp_err_t mdns_transaction_commit(void)
+{
+    if (!_mdns_server) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_OK;
+    MDNS_SERVICE_LOCK();
+    ESP_GOTO_ON_FALSE(_mdns_server->transaction_depth, ESP_ERR_INVALID_STATE, err, TAG, "No transaction to commit");
+    if (--_mdns_server->transaction_depth) {
+        goto err;
+    }
+    size_t srv_count = 0;
+    mdns_srv_item_t *a = _mdns_server->services;
+    while (a) {
+        srv_count += a->announce_deferred;
+        a = a->next;
+    }
+    if (srv_count) {
+        mdns_srv_item_t *services[srv_count];
+        size_t i = 0;
+        a = _mdns_server->services;
+        while (a) {
+            if (a->announce_deferred) {
+                a->announce_deferred = false;
+                services[i++] = a;
+            }
+            a = a->next;
+        }
+        _mdns_announce_all_pcbs(services, srv_count, _mdns_server->transaction_include_ip);
+    }
+    _mdns_server->transaction_include_ip = false;
+err:
+    MDNS_SERVICE_UNLOCK();
+    return ret;
+}
+
 /*
  * MDNS QUERY
  * */
@@ -6816,6 +8560,85 @@ mdns_search_once_t *mdns_query_async_new(const char *name, const char *service,
     return search;
 }
 
+mdns_query_batch_t *mdns_query_batch_new(const mdns_query_item_t *items, size_t num_items, uint32_t timeout,
+        size_t max_results, mdns_query_batch_notify_t notifier)
+{
+    mdns_query_batch_t *batch = NULL;
+
+    if (!_mdns_server || !timeout || !items || !num_items) {
+        return NULL;
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        if (_str_null_or_empty(items[i].service_type) != _str_null_or_empty(items[i].proto)) {
+            return NULL;
+        }
+    }
+
+    batch = (mdns_query_batch_t *)calloc(1, sizeof(mdns_query_batch_t) + num_items * sizeof(mdns_search_once_t *));
+    if (!batch) {
+        HOOK_MALLOC_FAILED;
+        return NULL;
+    }
+    batch->notifier = notifier;
+    batch->sent_at = UINT32_MAX;
+
+    for (size_t i = 0; i < num_items; i++) {
+        const mdns_query_item_t *item = &items[i];
+        mdns_search_once_t *search = _mdns_search_init(item->name, item->service_type, item->proto, item->type,
+                                     item->type != MDNS_TYPE_PTR, timeout, max_results, NULL);
+        if (!search) {
+            _mdns_search_batch_free(batch);
+            return NULL;
+        }
+        search->batch = batch;
+        search->batch_index = i;
+        batch->searches[batch->num_searches++] = search;
+    }
+
+    mdns_action_t *action = (mdns_action_t *)malloc(sizeof(mdns_action_t));
+    if (!action) {
+        HOOK_MALLOC_FAILED;
+        _mdns_search_batch_free(batch);
+        return NULL;
+    }
+    action->type = ACTION_SEARCH_BATCH_ADD;
+    action->data.search_batch_add.batch = batch;
+    if (_mdns_action_send(action) != pdPASS) {
+        free(action);
+        _mdns_search_batch_free(batch);
+        return NULL;
+    }
+
+    return batch;
+}
+
+bool mdns_query_batch_get_results(mdns_query_batch_t *batch, size_t index, uint32_t timeout,
+                                  mdns_result_t **results, uint8_t *num_results)
+{
+    if (!batch || index >= batch->num_searches) {
+        return false;
+    }
+    return mdns_query_async_get_results(batch->searches[index], timeout, results, num_results);
+}
+
+esp_err_t mdns_query_batch_delete(mdns_query_batch_t *batch)
+{
+    if (!batch) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < batch->num_searches; i++) {
+        if (batch->searches[i]->state != SEARCH_OFF) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    MDNS_SERVICE_LOCK();
+    _mdns_search_batch_free(batch);
+    MDNS_SERVICE_UNLOCK();
+
+    return ESP_OK;
+}
+
 esp_err_t mdns_query_generic(const char *name, const char *service, const char *proto, uint16_t type, mdns_query_transmission_type_t transmission_type, uint32_t timeout, size_t max_results, mdns_result_t **results)
 {
     mdns_search_once_t *search = NULL;
@@ -7231,7 +9054,7 @@ static esp_err_t _mdns_sync_browse_action(mdns_action_type_t type, mdns_browse_s
 
     action->type = type;
     action->data.browse_sync.browse_sync = browse_sync;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(action);
         return ESP_ERR_NO_MEM;
     }
@@ -7254,7 +9077,7 @@ static esp_err_t _mdns_send_browse_action(mdns_action_type_t type, mdns_browse_t
 
     action->type = type;
     action->data.browse_add.browse = browse;
-    if (xQueueSend(_mdns_server->action_queue, &action, (TickType_t)0) != pdPASS) {
+    if (_mdns_action_send(action) != pdPASS) {
         free(action);
         return ESP_ERR_NO_MEM;
     }
@@ -7266,6 +9089,13 @@ static esp_err_t _mdns_send_browse_action(mdns_action_type_t type, mdns_browse_t
  */
 static void _mdns_browse_item_free(mdns_browse_t *browse)
 {
+    for (size_t i = 0; i < MDNS_BROWSE_INDEX_SIZE; i++) {
+        while (browse->index[i]) {
+            mdns_browse_entry_t *entry = browse->index[i];
+            browse->index[i] = entry->next;
+            free(entry);
+        }
+    }
     free(browse->service);
     free(browse->proto);
     if (browse->result) {
@@ -7277,7 +9107,8 @@ static void _mdns_browse_item_free(mdns_browse_t *browse)
 /**
  * @brief  Allocate new browse structure
  */
-static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto, mdns_browse_notify_t notifier)
+static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto, mdns_browse_notify_t notifier,
+                                        mdns_browse_delta_notify_t delta_notifier)
 {
     mdns_browse_t *browse = (mdns_browse_t *)malloc(sizeof(mdns_browse_t));
 
@@ -7305,10 +9136,12 @@ static mdns_browse_t *_mdns_browse_init(const char *service, const char *proto,
     }
 
     browse->notifier = notifier;
+    browse->delta_notifier = delta_notifier;
     return browse;
 }
 
-mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier)
+static mdns_browse_t *_mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier,
+                                       mdns_browse_delta_notify_t delta_notifier)
 {
     mdns_browse_t *browse = NULL;
 
@@ -7316,7 +9149,7 @@ mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_brow
         return NULL;
     }
 
-    browse = _mdns_browse_init(service, proto, notifier);
+    browse = _mdns_browse_init(service, proto, notifier, delta_notifier);
     if (!browse) {
         return NULL;
     }
@@ -7329,6 +9162,19 @@ mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_brow
     return browse;
 }
 
+mdns_browse_t *mdns_browse_new(const char *service, const char *proto, mdns_browse_notify_t notifier)
+{
+    return _mdns_browse_new(service, proto, notifier, NULL);
+}
+
+mdns_browse_t *mdns_browse_delta_new(const char *service, const char *proto, mdns_browse_delta_notify_t notifier)
+{
+    if (!notifier) {
+        return NULL;
+    }
+    return _mdns_browse_new(service, proto, NULL, notifier);
+}
+
 esp_err_t mdns_browse_delete(const char *service, const char *proto)
 {
     mdns_browse_t *browse = NULL;
@@ -7337,7 +9183,7 @@ esp_err_t mdns_browse_delete(const char *service, const char *proto)
         return ESP_FAIL;
     }
 
-    browse = _mdns_browse_init(service, proto, NULL);
+    browse = _mdns_browse_init(service, proto, NULL, NULL);
     if (!browse) {
         return ESP_ERR_NO_MEM;
     }
@@ -7421,10 +9267,67 @@ static void _mdns_browse_send(mdns_browse_t *browse, mdns_if_t interface)
     }
 }
 
+/**
+ * @brief  Adds a result of the browse to its instance index
+ */
+static esp_err_t _mdns_browse_index_add(mdns_browse_t *browse, mdns_result_t *r)
+{
+    mdns_browse_entry_t *entry = (mdns_browse_entry_t *)malloc(sizeof(mdns_browse_entry_t));
+    if (!entry) {
+        HOOK_MALLOC_FAILED;
+        return ESP_ERR_NO_MEM;
+    }
+    entry->hash = _mdns_hash_str(2166136261U, r->instance_name);
+    entry->result = r;
+    entry->next = browse->index[entry->hash & (MDNS_BROWSE_INDEX_SIZE - 1)];
+    browse->index[entry->hash & (MDNS_BROWSE_INDEX_SIZE - 1)] = entry;
+    return ESP_OK;
+}
+
+/**
+ * @brief  Removes a result of the browse from its instance index
+ */
+static void _mdns_browse_index_remove(mdns_browse_t *browse, mdns_result_t *r)
+{
+    uint32_t hash = _mdns_hash_str(2166136261U, r->instance_name);
+    mdns_browse_entry_t **it = &browse->index[hash & (MDNS_BROWSE_INDEX_SIZE - 1)];
+    while (*it) {
+        if ((*it)->result == r) {
+            mdns_browse_entry_t *entry = *it;
+            *it = entry->next;
+            free(entry);
+            return;
+        }
+        it = &(*it)->next;
+    }
+}
+
+/**
+ * @brief  Finds the result of the browse for the instance on the interface and protocol
+ */
+static mdns_result_t *_mdns_browse_result_find(mdns_browse_t *browse, const char *instance, const char *service, const char *proto,
+                                               mdns_if_t tcpip_if, mdns_ip_protocol_t ip_protocol)
+{
+    uint32_t hash = _mdns_hash_str(2166136261U, instance);
+    mdns_browse_entry_t *entry = browse->index[hash & (MDNS_BROWSE_INDEX_SIZE - 1)];
+    while (entry) {
+        mdns_result_t *r = entry->result;
+        if (entry->hash == hash && r->esp_netif == _mdns_get_esp_netif(tcpip_if) && r->ip_protocol == ip_protocol &&
+                !strcasecmp(instance, r->instance_name) &&
+                !_str_null_or_empty(r->service_type) && !strcasecmp(service, r->service_type) &&
+                !_str_null_or_empty(r->proto) && !strcasecmp(proto, r->proto)) {
+            return r;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
 /**
  * @brief  Add result to browse, only add when the result is a new one.
+ *         An instance added by the packet is notified as added, even if it changed again afterwards
  */
-static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_result_t *r)
+static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_result_t *r, mdns_browse_event_t event)
 {
     mdns_browse_result_sync_t *sync_r = sync_browse->sync_result;
     while (sync_r) {
@@ -7442,8 +9345,11 @@ static esp_err_t _mdns_add_browse_result(mdns_browse_sync_t *sync_browse, mdns_r
             return ESP_ERR_NO_MEM;
         }
         new->result = r;
+        new->event = event;
         new->next = sync_browse->sync_result;
         sync_browse->sync_result = new;
+    } else if (event == MDNS_BROWSE_ADDED) {
+        sync_r->event = MDNS_BROWSE_ADDED;
     }
     return ESP_OK;
 }
@@ -7500,7 +9406,7 @@ static void _mdns_browse_result_add_ip(mdns_browse_t *browse, const char *hostna
                                 _mdns_result_update_ttl(r, ttl);
                             }
                         }
-                        if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+                        if (_mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_CHANGED) != ESP_OK) {
                             return;
                         }
                         break;
@@ -7575,55 +9481,49 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
             return;
         }
     }
-    mdns_result_t *r = browse->result;
-    while (r) {
-        if (r->esp_netif == _mdns_get_esp_netif(tcpip_if) && r->ip_protocol == ip_protocol &&
-                !_str_null_or_empty(r->instance_name) && !strcasecmp(instance, r->instance_name) &&
-                !_str_null_or_empty(r->service_type) && !strcasecmp(service, r->service_type) &&
-                !_str_null_or_empty(r->proto) && !strcasecmp(proto, r->proto)) {
-            bool should_update = false;
-            if (r->txt) {
-                // Check if txt changed
-                if (txt_count != r->txt_count) {
-                    should_update = true;
-                } else {
-                    for (size_t txt_index = 0; txt_index < txt_count; txt_index++) {
-                        if (!is_txt_item_in_list(txt[txt_index], txt_value_len[txt_index], r->txt, r->txt_value_len, r->txt_count)) {
-                            should_update = true;
-                            break;
-                        }
+    mdns_result_t *r = _mdns_browse_result_find(browse, instance, service, proto, tcpip_if, ip_protocol);
+    if (r) {
+        bool should_update = false;
+        if (r->txt) {
+            // Check if txt changed
+            if (txt_count != r->txt_count) {
+                should_update = true;
+            } else {
+                for (size_t txt_index = 0; txt_index < txt_count; txt_index++) {
+                    if (!is_txt_item_in_list(txt[txt_index], txt_value_len[txt_index], r->txt, r->txt_value_len, r->txt_count)) {
+                        should_update = true;
+                        break;
                     }
                 }
-                // If the result has a previous txt entry, we delete it and re-add.
-                for (size_t i = 0; i < r->txt_count; i++) {
-                    free((char *)(r->txt[i].key));
-                    free((char *)(r->txt[i].value));
-                }
-                free(r->txt);
-                free(r->txt_value_len);
             }
-            r->txt = txt;
-            r->txt_value_len = txt_value_len;
-            r->txt_count = txt_count;
-            if (r->ttl != ttl) {
-                uint32_t previous_ttl = r->ttl;
-                if (r->ttl == 0) {
-                    r->ttl = ttl;
-                } else {
-                    _mdns_result_update_ttl(r, ttl);
-                }
-                if (previous_ttl != r->ttl) {
-                    should_update = true;
-                }
+            // If the result has a previous txt entry, we delete it and re-add.
+            for (size_t i = 0; i < r->txt_count; i++) {
+                free((char *)(r->txt[i].key));
+                free((char *)(r->txt[i].value));
             }
-            if (should_update) {
-                if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
-                    return;
-                }
+            free(r->txt);
+            free(r->txt_value_len);
+        }
+        r->txt = txt;
+        r->txt_value_len = txt_value_len;
+        r->txt_count = txt_count;
+        if (r->ttl != ttl) {
+            uint32_t previous_ttl = r->ttl;
+            if (r->ttl == 0) {
+                r->ttl = ttl;
+            } else {
+                _mdns_result_update_ttl(r, ttl);
+            }
+            if (previous_ttl != r->ttl) {
+                should_update = true;
             }
-            return;
         }
-        r = r->next;
+        if (should_update) {
+            if (_mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_CHANGED) != ESP_OK) {
+                return;
+            }
+        }
+        return;
     }
     r = (mdns_result_t *)malloc(sizeof(mdns_result_t));
     if (!r) {
@@ -7641,6 +9541,13 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
         free(r);
         return;
     }
+    if (_mdns_browse_index_add(browse, r) != ESP_OK) {
+        free(r->instance_name);
+        free(r->service_type);
+        free(r->proto);
+        free(r);
+        goto free_txt;
+    }
     r->txt = txt;
     r->txt_value_len = txt_value_len;
     r->txt_count = txt_count;
@@ -7649,7 +9556,7 @@ static void _mdns_browse_result_add_txt(mdns_browse_t *browse, const char *insta
     r->ttl = ttl;
     r->next = browse->result;
     browse->result = r;
-    _mdns_add_browse_result(out_sync_browse, r);
+    _mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_ADDED);
     return;
 
 free_txt:
@@ -7693,45 +9600,45 @@ static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostn
             return;
         }
     }
-    mdns_result_t *r = browse->result;
-    while (r) {
-        if (r->esp_netif == _mdns_get_esp_netif(tcpip_if) && r->ip_protocol == ip_protocol &&
-                !_str_null_or_empty(r->instance_name) && !strcasecmp(instance, r->instance_name) &&
-                !_str_null_or_empty(r->service_type) && !strcasecmp(service, r->service_type) &&
-                !_str_null_or_empty(r->proto) && !strcasecmp(proto, r->proto)) {
-            if (_str_null_or_empty(r->hostname) || strcasecmp(hostname, r->hostname)) {
-                r->hostname = strdup(hostname);
-                r->port = port;
-                if (!r->hostname) {
-                    HOOK_MALLOC_FAILED;
-                    return;
-                }
-                if (!r->addr) {
-                    esp_err_t err = _mdns_copy_address_in_previous_result(browse->result, r);
-                    if (err == ESP_ERR_NO_MEM) {
-                        return;
-                    }
-                }
-                if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
+    mdns_result_t *r = _mdns_browse_result_find(browse, instance, service, proto, tcpip_if, ip_protocol);
+    if (r) {
+        if (_str_null_or_empty(r->hostname) || strcasecmp(hostname, r->hostname)) {
+            free(r->hostname);
+            r->hostname = strdup(hostname);
+            r->port = port;
+            if (!r->hostname) {
+                HOOK_MALLOC_FAILED;
+                return;
+            }
+            if (!r->addr) {
+                esp_err_t err = _mdns_copy_address_in_previous_result(browse->result, r);
+                if (err == ESP_ERR_NO_MEM) {
                     return;
                 }
             }
-            if (r->ttl != ttl) {
-                uint32_t previous_ttl = r->ttl;
-                if (r->ttl == 0) {
-                    r->ttl = ttl;
-                } else {
-                    _mdns_result_update_ttl(r, ttl);
-                }
-                if (previous_ttl != r->ttl) {
-                    if (_mdns_add_browse_result(out_sync_browse, r) != ESP_OK) {
-                        return;
-                    }
+            if (_mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_CHANGED) != ESP_OK) {
+                return;
+            }
+        } else if (r->port != port) {
+            r->port = port;
+            if (_mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_CHANGED) != ESP_OK) {
+                return;
+            }
+        }
+        if (r->ttl != ttl) {
+            uint32_t previous_ttl = r->ttl;
+            if (r->ttl == 0) {
+                r->ttl = ttl;
+            } else {
+                _mdns_result_update_ttl(r, ttl);
+            }
+            if (previous_ttl != r->ttl) {
+                if (_mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_CHANGED) != ESP_OK) {
+                    return;
                 }
             }
-            return;
         }
-        r = r->next;
+        return;
     }
     r = (mdns_result_t *)malloc(sizeof(mdns_result_t));
     if (!r) {
@@ -7753,13 +9660,21 @@ static void _mdns_browse_result_add_srv(mdns_browse_t *browse, const char *hostn
         free(r);
         return;
     }
+    if (_mdns_browse_index_add(browse, r) != ESP_OK) {
+        free(r->hostname);
+        free(r->instance_name);
+        free(r->service_type);
+        free(r->proto);
+        free(r);
+        return;
+    }
     r->port = port;
     r->esp_netif = _mdns_get_esp_netif(tcpip_if);
     r->ip_protocol = ip_protocol;
     r->ttl = ttl;
     r->next = browse->result;
     browse->result = r;
-    _mdns_add_browse_result(out_sync_browse, r);
+    _mdns_add_browse_result(out_sync_browse, r, MDNS_BROWSE_ADDED);
     return;
 }
 
@@ -7772,9 +9687,18 @@ static void _mdns_browse_sync(mdns_browse_sync_t *browse_sync)
 #ifdef MDNS_ENABLE_DEBUG
         debug_printf_browse_result(result, browse_sync->browse);
 #endif
-        browse->notifier(result);
+        if (browse->delta_notifier) {
+            // hand over the changed instance alone, not the rest of the results linked after it
+            mdns_result_t *next = result->next;
+            result->next = NULL;
+            browse->delta_notifier(result, result->ttl == 0 ? MDNS_BROWSE_REMOVED : sync_result->event);
+            result->next = next;
+        } else if (browse->notifier) {
+            browse->notifier(result);
+        }
         if (result->ttl == 0) {
             queueDetach(mdns_result_t, browse->result, result);
+            _mdns_browse_index_remove(browse, result);
             // Just free current result
             result->next = NULL;
             mdns_query_results_free(result);
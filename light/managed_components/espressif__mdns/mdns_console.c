@@ -1125,6 +1125,36 @@ static void register_mdns_service_remove_all(void)
     ESP_ERROR_CHECK( esp_console_cmd_register(&cmd_free) );
 }
 
+#ifdef CONFIG_MDNS_ENABLE_STATS
+static int cmd_mdns_stats(int argc, char **argv)
+{
+    mdns_stats_t stats;
+    if (mdns_stats_get(NULL, &stats) != ESP_OK) {
+        printf("ERROR: Could not get the statistics\n");
+        return 1;
+    }
+    printf("RX packets: %" PRIu32 ", questions: %" PRIu32 ", dropped: %" PRIu32 "\n",
+           stats.rx_packets, stats.rx_questions, stats.rx_dropped);
+    printf("TX answers: %" PRIu32 ", suppressed: %" PRIu32 ", bytes: %" PRIu32 "\n",
+           stats.tx_answers, stats.tx_suppressed, stats.tx_bytes);
+    printf("Probe conflicts: %" PRIu32 "\n", stats.probe_conflicts);
+    return 0;
+}
+
+static void register_mdns_stats(void)
+{
+    const esp_console_cmd_t cmd_stats = {
+        .command = "mdns_stats",
+        .help = "Print the MDNS statistics of all the interfaces",
+        .hint = NULL,
+        .func = &cmd_mdns_stats,
+        .argtable = NULL
+    };
+
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd_stats) );
+}
+#endif /* CONFIG_MDNS_ENABLE_STATS */
+
 #define MDNS_MAX_LOOKUP_RESULTS CONFIG_MDNS_MAX_SERVICES
 
 static struct {
@@ -1427,6 +1457,9 @@ void mdns_console_register(void)
     register_mdns_service_txt_set();
     register_mdns_service_txt_remove();
     register_mdns_service_remove_all();
+#ifdef CONFIG_MDNS_ENABLE_STATS
+    register_mdns_stats();
+#endif
 
     register_mdns_lookup_service();
     register_mdns_delegate_host();
@@ -153,6 +153,7 @@ static void _udp_recv(void *arg, struct udp_pcb *upcb, struct pbuf *pb, const ip
 
         packet->tcpip_if = MDNS_MAX_INTERFACES;
         packet->pb = this_pb;
+        packet->next = NULL;
         packet->src_port = rport;
 #if LWIP_IPV4 && LWIP_IPV6
         packet->src.type = raddr->type;
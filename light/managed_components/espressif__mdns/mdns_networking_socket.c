@@ -57,6 +57,17 @@ struct pbuf  {
 #define s6_addr32 un.u32_addr
 #endif // CONFIG_IDF_TARGET_LINUX
 
+// Receive buffer, handed to the mdns engine together with its packet structure
+typedef struct {
+    mdns_rx_packet_t packet;
+    struct pbuf pb;
+    uint8_t payload[MDNS_MAX_PACKET_SIZE];
+    volatile bool used;     // set by the receive task, cleared by the mdns task when the packet is freed
+} rx_buffer_t;
+
+static rx_buffer_t s_rx_buffers[CONFIG_MDNS_SOCKET_RX_BUFFERS];
+static size_t s_rx_buffer_next = 0;
+
 static void __attribute__((constructor)) ctor_networking_socket(void)
 {
     for (int i = 0; i < sizeof(s_interfaces) / sizeof(s_interfaces[0]); ++i) {
@@ -87,6 +98,11 @@ size_t _mdns_get_packet_len(mdns_rx_packet_t *packet)
 
 void _mdns_packet_free(mdns_rx_packet_t *packet)
 {
+    if ((void *)packet >= (void *)s_rx_buffers && (void *)packet < (void *)(s_rx_buffers + CONFIG_MDNS_SOCKET_RX_BUFFERS)) {
+        // packet is the first member of rx_buffer_t
+        ((rx_buffer_t *)packet)->used = false;
+        return;
+    }
     free(packet->pb->payload);
     free(packet->pb);
     free(packet);
@@ -246,6 +262,101 @@ static inline void inet_to_espaddr(const struct sockaddr_storage *in_addr, esp_i
 #endif // CONFIG_LWIP_IPV6
 }
 
+/**
+ * @brief  takes the next free receive buffer of the ring, or NULL if all are being parsed
+ */
+static rx_buffer_t *rx_buffer_acquire(void)
+{
+    for (size_t i = 0; i < CONFIG_MDNS_SOCKET_RX_BUFFERS; i++) {
+        rx_buffer_t *buffer = &s_rx_buffers[s_rx_buffer_next];
+        s_rx_buffer_next = (s_rx_buffer_next + 1) % CONFIG_MDNS_SOCKET_RX_BUFFERS;
+        if (!buffer->used) {
+            buffer->used = true;
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief  reads one datagram of the socket without blocking
+ *
+ * The datagram goes to a free receive buffer, or to the heap if there is none.
+ *
+ * @param  tcpip_if     interface of the socket
+ * @param  sock         socket ready for reading
+ * @param  drained      set when there are no more datagrams to read
+ *
+ * @return the received packet, NULL if none was read or it could not be stored
+ */
+static mdns_rx_packet_t *sock_recv_packet(mdns_if_t tcpip_if, int sock, bool *drained)
+{
+    static char recvbuf[MDNS_MAX_PACKET_SIZE];
+    rx_buffer_t *buffer = rx_buffer_acquire();
+    uint8_t *data = buffer ? buffer->payload : (uint8_t *)recvbuf;
+    uint16_t port = 0;
+
+    struct sockaddr_storage raddr; // Large enough for both IPv4 or IPv6
+    socklen_t socklen = sizeof(struct sockaddr_storage);
+    esp_ip_addr_t addr = {0};
+    int len = recvfrom(sock, data, MDNS_MAX_PACKET_SIZE, MSG_DONTWAIT,
+                       (struct sockaddr *) &raddr, &socklen);
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ESP_LOGE(TAG, "multicast recvfrom failed. errno=%d: %s", errno, strerror(errno));
+        }
+        if (buffer) {
+            buffer->used = false;
+        }
+        *drained = true;
+        return NULL;
+    }
+    ESP_LOGD(TAG, "[sock=%d]: Received from IP:%s", sock, get_string_address(&raddr));
+    ESP_LOG_BUFFER_HEXDUMP(TAG, data, len, ESP_LOG_VERBOSE);
+    inet_to_espaddr(&raddr, &addr, &port);
+
+    mdns_rx_packet_t *packet;
+    struct pbuf *packet_pbuf;
+    if (buffer) {
+        packet = &buffer->packet;
+        packet_pbuf = &buffer->pb;
+        memset(packet, 0, sizeof(mdns_rx_packet_t));
+        memset(packet_pbuf, 0, sizeof(struct pbuf));
+        packet_pbuf->payload = buffer->payload;
+    } else {
+        // Allocate the packet structure and pass it to the mdns main engine
+        packet = (mdns_rx_packet_t *) calloc(1, sizeof(mdns_rx_packet_t));
+        packet_pbuf = calloc(1, sizeof(struct pbuf));
+        uint8_t *buf = malloc(len);
+        if (packet == NULL || packet_pbuf == NULL || buf == NULL ) {
+            free(buf);
+            free(packet_pbuf);
+            free(packet);
+            HOOK_MALLOC_FAILED;
+            ESP_LOGE(TAG, "Failed to allocate the mdns packet");
+            return NULL;
+        }
+        memcpy(buf, recvbuf, len);
+        packet_pbuf->payload = buf;
+    }
+    packet_pbuf->next = NULL;
+    packet_pbuf->tot_len = len;
+    packet_pbuf->len = len;
+    packet->tcpip_if = tcpip_if;
+    packet->pb = packet_pbuf;
+    packet->src_port = ntohs(port);
+    memcpy(&packet->src, &addr, sizeof(esp_ip_addr_t));
+    // TODO(IDF-3651): Add the correct dest addr -- for mdns to decide multicast/unicast
+    // Currently it's enough to assume the packet is multicast and mdns to check the source port of the packet
+    memset(&packet->dest, 0, sizeof(esp_ip_addr_t));
+    packet->multicast = 1;
+    packet->dest.type = packet->src.type;
+    packet->ip_protocol =
+        packet->src.type == ESP_IPADDR_TYPE_V4 ? MDNS_IP_PROTOCOL_V4 : MDNS_IP_PROTOCOL_V6;
+    packet->next = NULL;
+    return packet;
+}
+
 void sock_recv_task(void *arg)
 {
     while (s_run_sock_recv_task) {
@@ -274,64 +385,33 @@ void sock_recv_task(void *arg)
             ESP_LOGE(TAG, "Select failed. errno=%d: %s", errno, strerror(errno));
             break;
         } else if (s > 0) {
+            // drain all the ready sockets and pass the packets as one batch, taking one slot of the action queue
+            mdns_rx_packet_t *batch = NULL;
+            mdns_rx_packet_t **batch_end = &batch;
+            size_t received = 0;
             for (int tcpip_if = 0; tcpip_if < MDNS_MAX_INTERFACES; tcpip_if++) {
                 int sock = s_interfaces[tcpip_if].sock;
-                if (sock < 0) {
+                if (sock < 0 || !FD_ISSET(sock, &rfds)) {
                     continue;
                 }
-                if (FD_ISSET(sock, &rfds)) {
-                    static char recvbuf[MDNS_MAX_PACKET_SIZE];
-                    uint16_t port = 0;
-
-                    struct sockaddr_storage raddr; // Large enough for both IPv4 or IPv6
-                    socklen_t socklen = sizeof(struct sockaddr_storage);
-                    esp_ip_addr_t addr = {0};
-                    int len = recvfrom(sock, recvbuf, sizeof(recvbuf), 0,
-                                       (struct sockaddr *) &raddr, &socklen);
-                    if (len < 0) {
-                        ESP_LOGE(TAG, "multicast recvfrom failed. errno=%d: %s", errno, strerror(errno));
-                        break;
-                    }
-                    ESP_LOGD(TAG, "[sock=%d]: Received from IP:%s", sock, get_string_address(&raddr));
-                    ESP_LOG_BUFFER_HEXDUMP(TAG, recvbuf, len, ESP_LOG_VERBOSE);
-                    inet_to_espaddr(&raddr, &addr, &port);
-
-                    // Allocate the packet structure and pass it to the mdns main engine
-                    mdns_rx_packet_t *packet = (mdns_rx_packet_t *) calloc(1, sizeof(mdns_rx_packet_t));
-                    struct pbuf *packet_pbuf = calloc(1, sizeof(struct pbuf));
-                    uint8_t *buf = malloc(len);
-                    if (packet == NULL || packet_pbuf == NULL || buf == NULL ) {
-                        free(buf);
-                        free(packet_pbuf);
-                        free(packet);
-                        HOOK_MALLOC_FAILED;
-                        ESP_LOGE(TAG, "Failed to allocate the mdns packet");
-                        continue;
-                    }
-                    memcpy(buf, recvbuf, len);
-                    packet_pbuf->next = NULL;
-                    packet_pbuf->payload = buf;
-                    packet_pbuf->tot_len = len;
-                    packet_pbuf->len = len;
-                    packet->tcpip_if = tcpip_if;
-                    packet->pb = packet_pbuf;
-                    packet->src_port = ntohs(port);
-                    memcpy(&packet->src, &addr, sizeof(esp_ip_addr_t));
-                    // TODO(IDF-3651): Add the correct dest addr -- for mdns to decide multicast/unicast
-                    // Currently it's enough to assume the packet is multicast and mdns to check the source port of the packet
-                    memset(&packet->dest, 0, sizeof(esp_ip_addr_t));
-                    packet->multicast = 1;
-                    packet->dest.type = packet->src.type;
-                    packet->ip_protocol =
-                        packet->src.type == ESP_IPADDR_TYPE_V4 ? MDNS_IP_PROTOCOL_V4 : MDNS_IP_PROTOCOL_V6;
-                    if (_mdns_send_rx_action(packet) != ESP_OK) {
-                        ESP_LOGE(TAG, "_mdns_send_rx_action failed!");
-                        free(packet->pb->payload);
-                        free(packet->pb);
-                        free(packet);
+                bool drained = false;
+                while (!drained && received < CONFIG_MDNS_SOCKET_RX_BUFFERS) {
+                    mdns_rx_packet_t *packet = sock_recv_packet(tcpip_if, sock, &drained);
+                    if (packet) {
+                        *batch_end = packet;
+                        batch_end = &packet->next;
+                        received++;
                     }
                 }
             }
+            if (batch && _mdns_send_rx_action(batch) != ESP_OK) {
+                ESP_LOGE(TAG, "_mdns_send_rx_action failed!");
+                while (batch) {
+                    mdns_rx_packet_t *next = batch->next;
+                    _mdns_packet_free(batch);
+                    batch = next;
+                }
+            }
         }
     }
     vTaskDelete(NULL);
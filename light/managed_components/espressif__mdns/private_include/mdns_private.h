@@ -57,6 +57,9 @@
 
 /** The maximum number of services */
 #define MDNS_MAX_SERVICES           CONFIG_MDNS_MAX_SERVICES
+#define MDNS_SERVICE_INDEX_SIZE     32                      // Buckets of the service type hash index, must be a power of two
+#define MDNS_BROWSE_INDEX_SIZE      16                      // Buckets of the instance hash index of a browse, must be a power of two
+#define MDNS_TXT_STR_INDEX_SIZE     16                      // Buckets of the interned TXT strings, must be a power of two
 
 #define MDNS_ANSWER_PTR_TTL         4500
 #define MDNS_ANSWER_TXT_TTL         4500
@@ -68,6 +71,7 @@
 #define MDNS_FLAGS_AUTHORITATIVE    0x0400
 #define MDNS_FLAGS_QR_AUTHORITATIVE (MDNS_FLAGS_QUERY_REPSONSE | MDNS_FLAGS_AUTHORITATIVE)
 #define MDNS_FLAGS_DISTRIBUTED      0x0200
+#define MDNS_FLAGS_TRUNCATED        0x0200                  // TC, more known answers of the query follow (same bit as above)
 
 #define MDNS_NAME_REF               0xC000
 
@@ -124,11 +128,21 @@
 #define MDNS_SRV_PORT_OFFSET        4
 #define MDNS_SRV_FQDN_OFFSET        6
 
-#define MDNS_TIMER_PERIOD_US        (CONFIG_MDNS_TIMER_PERIOD_MS*1000)
-
 #define MDNS_SERVICE_LOCK()     xSemaphoreTake(_mdns_service_semaphore, portMAX_DELAY)
 #define MDNS_SERVICE_UNLOCK()   xSemaphoreGive(_mdns_service_semaphore)
 
+#ifdef CONFIG_MDNS_ENABLE_STATS
+#define MDNS_STATS_ADD(tcpip_if, counter, value)                            \
+    do {                                                                    \
+        if ((tcpip_if) < MDNS_MAX_INTERFACES) {                             \
+            _mdns_server->interfaces[tcpip_if].stats.counter += (value);    \
+        }                                                                   \
+    } while (0)
+#else
+#define MDNS_STATS_ADD(tcpip_if, counter, value)
+#endif /* CONFIG_MDNS_ENABLE_STATS */
+#define MDNS_STATS_INC(tcpip_if, counter)   MDNS_STATS_ADD(tcpip_if, counter, 1)
+
 #define queueToEnd(type, queue, item)       \
     if (!queue) {                           \
         queue = item;                       \
@@ -155,6 +169,7 @@
     }
 
 #define queueFree(type, queue)  while (queue) { type * _q = queue; queue = queue->next; free(_q); }
+#define queueFreeWith(type, queue, free_fn)  while (queue) { type * _q = queue; queue = queue->next; free_fn(_q); }
 
 #define PCB_STATE_IS_PROBING(s) (s->state > PCB_OFF && s->state < PCB_ANNOUNCE_1)
 #define PCB_STATE_IS_ANNOUNCING(s) (s->state > PCB_PROBE_3 && s->state < PCB_RUNNING)
@@ -179,11 +194,13 @@ typedef enum {
 
 typedef enum {
     ACTION_SYSTEM_EVENT,
+    ACTION_SYSTEM_EVENT_FLUSH,
     ACTION_HOSTNAME_SET,
     ACTION_INSTANCE_SET,
     ACTION_SEARCH_ADD,
     ACTION_SEARCH_SEND,
     ACTION_SEARCH_END,
+    ACTION_SEARCH_BATCH_ADD,
     ACTION_BROWSE_ADD,
     ACTION_BROWSE_SYNC,
     ACTION_BROWSE_END,
@@ -257,7 +274,7 @@ typedef struct {
     uint16_t id;
 } mdns_parsed_packet_t;
 
-typedef struct {
+typedef struct mdns_rx_packet_s {
     mdns_if_t tcpip_if;
     mdns_ip_protocol_t ip_protocol;
     struct pbuf *pb;
@@ -265,11 +282,23 @@ typedef struct {
     esp_ip_addr_t dest;
     uint16_t src_port;
     uint8_t multicast;
+    struct mdns_rx_packet_s *next;          // further packets received in the same batch, parsed in order
 } mdns_rx_packet_t;
 
+/**
+ * @brief  TXT key or value shared by all the service TXT items that hold the same string
+ */
+typedef struct mdns_txt_str_s {
+    struct mdns_txt_str_s *next;            // next string of the same bucket
+    uint32_t hash;
+    uint16_t refs;                          // TXT items holding the string
+    uint16_t len;
+    char str[];                             // NUL terminated, also when it is a binary value
+} mdns_txt_str_t;
+
 typedef struct mdns_txt_linked_item_s {
-    const char *key;                        /*!< item key name */
-    char *value;                            /*!< item value string */
+    const char *key;                        /*!< item key name, interned */
+    const char *value;                      /*!< item value string, interned */
     uint8_t value_len;                      /*!< item value length */
     struct mdns_txt_linked_item_s *next;    /*!< next result, or NULL for the last result in the list */
 } mdns_txt_linked_item_t;
@@ -289,11 +318,16 @@ typedef struct {
     uint16_t port;
     mdns_txt_linked_item_t *txt;
     mdns_subtype_t *subtype;
+    uint8_t *txt_rdata;                     // encoded TXT record data, built on first answer, NULL if txt has changed
+    uint16_t txt_rdata_len;
 } mdns_service_t;
 
 typedef struct mdns_srv_item_s {
     struct mdns_srv_item_s *next;
     mdns_service_t *service;
+    struct mdns_srv_item_s *index_next;     // next item in the same service index bucket, in list order
+    uint32_t index_hash;                    // hash of the service type and proto
+    bool announce_deferred;                 // changed inside a transaction, announced on commit
 } mdns_srv_item_t;
 
 typedef struct mdns_out_question_s {
@@ -349,6 +383,9 @@ typedef struct {
     uint8_t probe_ip;
     uint8_t probe_running;
     uint16_t failed_probes;
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    uint32_t announced_addrs;               // hash of the interface addresses when last announced, 0 if never
+#endif
 } mdns_pcb_t;
 
 typedef enum {
@@ -382,21 +419,39 @@ typedef struct mdns_search_once_s {
     char *service;
     char *proto;
     mdns_result_t *result;
+    struct mdns_query_batch_s *batch;   // batch the search belongs to, NULL for a single search
+    size_t batch_index;
 } mdns_search_once_t;
 
+typedef struct mdns_query_batch_s {
+    mdns_query_batch_notify_t notifier;
+    uint32_t sent_at;                   // when the questions of all the searches were last queued, in one send
+    size_t num_searches;
+    mdns_search_once_t *searches[];
+} mdns_query_batch_t;
+
+typedef struct mdns_browse_entry_s {
+    struct mdns_browse_entry_s *next;
+    uint32_t hash;
+    mdns_result_t *result;
+} mdns_browse_entry_t;
+
 typedef struct mdns_browse_s {
     struct mdns_browse_s *next;
 
     mdns_browse_state_t state;
     mdns_browse_notify_t notifier;
+    mdns_browse_delta_notify_t delta_notifier;
 
     char *service;
     char *proto;
     mdns_result_t *result;
+    mdns_browse_entry_t *index[MDNS_BROWSE_INDEX_SIZE];     // results hashed by instance name
 } mdns_browse_t;
 
 typedef struct mdns_browse_result_sync_t {
     mdns_result_t *result;
+    mdns_browse_event_t event;              // MDNS_BROWSE_REMOVED is only decided when notifying
     struct mdns_browse_result_sync_t *next;
 } mdns_browse_result_sync_t;
 
@@ -405,19 +460,68 @@ typedef struct mdns_browse_sync {
     mdns_browse_result_sync_t *sync_result;
 } mdns_browse_sync_t;
 
+typedef struct mdns_query_cache_s {
+    struct mdns_query_cache_s *next;
+    uint16_t type;
+    char *instance;
+    char *service;
+    char *proto;
+    uint32_t expires_at;                    // ms tick at 80% of the lowest TTL of the results
+    uint8_t num_results;
+    mdns_result_t *result;                  // private copy of the results of the query
+} mdns_query_cache_t;
+
+typedef struct {
+    uint16_t type;                          // 0 for a free entry
+    mdns_if_t tcpip_if;
+    mdns_ip_protocol_t ip_protocol;
+    mdns_service_t *service;
+    mdns_host_item_t *host;
+    uint32_t sent_at;                       // time (ms) the record was last multicast on the interface
+} mdns_mcast_record_t;
+
+typedef enum {
+    MDNS_CLAIMED_HOSTNAME,
+    MDNS_CLAIMED_INSTANCE,
+    MDNS_CLAIMED_NAMES
+} mdns_claimed_name_t;
+
 typedef struct mdns_server_s {
     struct {
         mdns_pcb_t pcbs[MDNS_IP_PROTOCOL_MAX];
+#ifdef CONFIG_MDNS_ENABLE_STATS
+        mdns_stats_t stats;                 // counted with MDNS_STATS_ADD(), both IP protocols together
+#endif
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+        uint32_t pending_events;            // mdns_event_actions_t coalesced until events_at
+        uint32_t events_at;                 // time (ms) the pending events are performed
+#endif
     } interfaces[MDNS_MAX_INTERFACES];
     const char *hostname;
     const char *instance;
     mdns_srv_item_t *services;
+    mdns_srv_item_t *service_index[MDNS_SERVICE_INDEX_SIZE];  // services hashed by type and proto, kept in step with the list
+    mdns_txt_str_t *txt_strings[MDNS_TXT_STR_INDEX_SIZE];   // interned TXT keys and values of the services
     QueueHandle_t action_queue;
     SemaphoreHandle_t action_sema;
     mdns_tx_packet_t *tx_queue_head;
     mdns_search_once_t *search_once;
     esp_timer_handle_t timer_handle;
+    uint32_t timer_deadline;                // time (ms) the one shot scheduler timer is armed for
+    bool timer_armed;                       // scheduler timer is running, idle when nothing is pending
+#ifdef CONFIG_MDNS_NETIF_EVENT_DEBOUNCE
+    bool events_flush_queued;               // an ACTION_SYSTEM_EVENT_FLUSH is in the action queue
+#endif
     mdns_browse_t *browse;
+    mdns_query_cache_t *query_cache;
+#ifdef CONFIG_MDNS_FAST_BOOT_PROBE
+    char *claimed_requested[MDNS_CLAIMED_NAMES];    // names set by the application, the probed ones may be renamed
+#endif
+#ifdef CONFIG_MDNS_MCAST_RATE_LIMIT
+    mdns_mcast_record_t mcast_records[CONFIG_MDNS_MCAST_RATE_LIMIT_RECORDS];   // records multicast lately, by interface
+#endif
+    uint8_t transaction_depth;              // nesting of mdns_transaction_begin(), announcements are deferred while non zero
+    bool transaction_include_ip;            // one of the deferred announcements includes the host addresses
 } mdns_server_t;
 
 typedef struct {
@@ -434,6 +538,9 @@ typedef struct {
         struct {
             mdns_search_once_t *search;
         } search_add;
+        struct {
+            mdns_query_batch_t *batch;
+        } search_batch_add;
         struct {
             mdns_tx_packet_t *packet;
         } tx_handle;
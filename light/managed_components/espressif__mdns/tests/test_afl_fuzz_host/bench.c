@@ -0,0 +1,314 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * MDNS Benchmark -- replays recorded packets through the parser and the responder
+ *
+ * Packets are read from raw files (one packet per file, as in the `in` folder) and from pcap captures,
+ * of which the UDP datagrams to or from port 5353 are taken. On glibc the heap functions are interposed
+ * to count the allocations and the peak heap use while replaying.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_PACKET_SIZE   1460
+#define BENCH_MDNS_PORT         5353
+#define BENCH_DEFAULT_ITERATIONS 100
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} bench_packet_t;
+
+static bench_packet_t *s_packets = NULL;
+static size_t s_packets_count = 0;
+static size_t s_packets_size = 0;
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t s_alloc_count = 0;
+static size_t s_heap_used = 0;
+static size_t s_heap_peak = 0;
+
+static void heap_account(void *ptr)
+{
+    if (ptr) {
+        s_alloc_count++;
+        s_heap_used += malloc_usable_size(ptr);
+        if (s_heap_used > s_heap_peak) {
+            s_heap_peak = s_heap_used;
+        }
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_account(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+    heap_account(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr || !size) {
+        s_heap_used -= old_size;
+    }
+    heap_account(new_ptr);
+    return new_ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr) {
+        s_heap_used -= malloc_usable_size(ptr);
+    }
+    __libc_free(ptr);
+}
+#endif // __GLIBC__
+
+static bool bench_add_packet(const uint8_t *data, size_t len)
+{
+    if (!len || len > BENCH_MAX_PACKET_SIZE) {
+        return true;    // not a packet the networking would pass to mdns
+    }
+    if (s_packets_count == s_packets_size) {
+        size_t size = s_packets_size ? 2 * s_packets_size : 64;
+        bench_packet_t *packets = realloc(s_packets, size * sizeof(bench_packet_t));
+        if (!packets) {
+            return false;
+        }
+        s_packets = packets;
+        s_packets_size = size;
+    }
+    s_packets[s_packets_count].data = malloc(len);
+    if (!s_packets[s_packets_count].data) {
+        return false;
+    }
+    memcpy(s_packets[s_packets_count].data, data, len);
+    s_packets[s_packets_count].len = len;
+    s_packets_count++;
+    return true;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get_u32(const uint8_t *p, bool swapped)
+{
+    if (swapped) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+/**
+ * @brief  takes the mdns payload of an IP packet, if it is a complete UDP datagram of port 5353
+ */
+static bool bench_add_ip_packet(const uint8_t *ip, size_t len)
+{
+    const uint8_t *udp = NULL;
+    size_t udp_len = 0;
+    if (len >= 20 && (ip[0] >> 4) == 4) {
+        size_t ihl = (ip[0] & 0x0F) * 4;
+        if (ip[9] != 17 || ihl < 20 || len < ihl + 8 || (get_be16(ip + 6) & 0x3FFF)) {
+            return true;    // not UDP or fragmented
+        }
+        udp = ip + ihl;
+        udp_len = len - ihl;
+    } else if (len >= 40 && (ip[0] >> 4) == 6) {
+        if (ip[6] != 17 || len < 48) {
+            return true;    // not UDP, or behind extension headers
+        }
+        udp = ip + 40;
+        udp_len = len - 40;
+    } else {
+        return true;
+    }
+    if (get_be16(udp) != BENCH_MDNS_PORT && get_be16(udp + 2) != BENCH_MDNS_PORT) {
+        return true;
+    }
+    size_t datagram_len = get_be16(udp + 4);
+    if (datagram_len < 8 || datagram_len > udp_len) {
+        return true;    // truncated by the capture
+    }
+    return bench_add_packet(udp + 8, datagram_len - 8);
+}
+
+/**
+ * @brief  loads the mdns packets of a classic pcap capture (Ethernet, Linux cooked or raw IP links)
+ */
+static bool bench_load_pcap(FILE *file, const char *name)
+{
+    uint8_t header[24];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        fprintf(stderr, "%s: not a pcap file\n", name);
+        return false;
+    }
+    uint32_t magic = get_u32(header, false);
+    bool swapped;
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+        swapped = false;
+    } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+        swapped = true;
+    } else {
+        fprintf(stderr, "%s: unsupported capture format (pcapng must be converted to pcap)\n", name);
+        return false;
+    }
+    uint32_t link_type = get_u32(header + 20, swapped);
+    static uint8_t frame[65536];
+    uint8_t record[16];
+    while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+        uint32_t captured = get_u32(record + 8, swapped);
+        if (captured > sizeof(frame) || fread(frame, 1, captured, file) != captured) {
+            fprintf(stderr, "%s: truncated capture\n", name);
+            return false;
+        }
+        size_t offset = 0;
+        uint16_t ether_type = 0;
+        switch (link_type) {
+        case 1:     // Ethernet
+            offset = 14;
+            if (captured >= 18 && get_be16(frame + 12) == 0x8100) {
+                offset = 18;    // VLAN tagged
+            }
+            ether_type = captured >= offset ? get_be16(frame + offset - 2) : 0;
+            break;
+        case 113:   // Linux cooked
+            offset = 16;
+            ether_type = captured >= offset ? get_be16(frame + 14) : 0;
+            break;
+        case 276:   // Linux cooked v2
+            offset = 20;
+            ether_type = captured >= offset ? get_be16(frame) : 0;
+            break;
+        case 101:   // raw IP
+            ether_type = captured ? ((frame[0] >> 4) == 6 ? 0x86DD : 0x0800) : 0;
+            break;
+        default:
+            fprintf(stderr, "%s: unsupported link type %u\n", name, (unsigned)link_type);
+            return false;
+        }
+        if ((ether_type == 0x0800 || ether_type == 0x86DD) && !bench_add_ip_packet(frame + offset, captured - offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bench_load(const char *name)
+{
+    FILE *file = fopen(name, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", name);
+        return false;
+    }
+    bool ret;
+    size_t name_len = strlen(name);
+    if (name_len > 5 && !strcmp(name + name_len - 5, ".pcap")) {
+        ret = bench_load_pcap(file, name);
+    } else {
+        uint8_t buf[BENCH_MAX_PACKET_SIZE];
+        size_t len = fread(buf, 1, sizeof(buf), file);
+        ret = bench_add_packet(buf, len);
+    }
+    fclose(file);
+    return ret;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief  replays the packets of the given files and prints the throughput, allocations and peak heap
+ *
+ * @param  argc     number of arguments: [-n iterations] files...
+ * @param  argv     the arguments
+ * @param  replay   passes one packet to mdns
+ *
+ * @return 0 on success
+ */
+int mdns_bench_run(int argc, char **argv, void (*replay)(const uint8_t *data, size_t len))
+{
+    unsigned long iterations = BENCH_DEFAULT_ITERATIONS;
+    int files = 0;
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            iterations = strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+        if (!bench_load(argv[i])) {
+            return 1;
+        }
+        files++;
+    }
+    if (!s_packets_count || !iterations) {
+        printf("Benchmark mode: please supply [-n iterations] and packet files (raw packets or .pcap captures)\n");
+        return 1;
+    }
+
+    // first pass warms up the caches of mdns, so that the measurement shows the steady state
+    for (size_t p = 0; p < s_packets_count; p++) {
+        replay(s_packets[p].data, s_packets[p].len);
+    }
+#ifdef __GLIBC__
+    size_t heap_base = s_heap_used;
+    size_t allocs_base = s_alloc_count;
+    s_heap_peak = s_heap_used;
+#endif
+    double start = bench_now();
+    for (unsigned long i = 0; i < iterations; i++) {
+        for (size_t p = 0; p < s_packets_count; p++) {
+            replay(s_packets[p].data, s_packets[p].len);
+        }
+    }
+    double elapsed = bench_now() - start;
+    double total = (double)iterations * s_packets_count;
+#ifdef __GLIBC__
+    // taken before printing, as stdout allocates its buffer
+    size_t allocs = s_alloc_count - allocs_base;
+    size_t heap_peak = s_heap_peak - heap_base;
+#endif
+
+    printf("packets:     %zu from %d file(s), replayed %lu times\n", s_packets_count, files, iterations);
+    printf("throughput:  %.0f packets/s, %.2f us/packet\n", total / elapsed, elapsed * 1e6 / total);
+#ifdef __GLIBC__
+    printf("allocations: %.2f per packet\n", allocs / total);
+    printf("peak heap:   %zu bytes above the %zu bytes in use after setup\n", heap_peak, heap_base);
+#else
+    printf("allocations: not counted on this platform\n");
+#endif
+
+    for (size_t p = 0; p < s_packets_count; p++) {
+        free(s_packets[p].data);
+    }
+    free(s_packets);
+    return 0;
+}
@@ -18,6 +18,9 @@ mdns_search_once_t *(*mdns_test_static_search_init)(const char *name, const char
         mdns_query_notify_t notifier) = NULL;
 esp_err_t         (*mdns_test_static_send_search_action)(mdns_action_type_t type, mdns_search_once_t *search) = NULL;
 void              (*mdns_test_static_search_free)(mdns_search_once_t *search) = NULL;
+void              (*mdns_test_static_tx_handle_packet)(mdns_tx_packet_t *p) = NULL;
+
+extern mdns_server_t *_mdns_server;
 
 static void _mdns_execute_action(mdns_action_t *action);
 static mdns_srv_item_t *_mdns_get_service_item(const char *service, const char *proto, const char *hostname);
@@ -25,6 +28,7 @@ static mdns_search_once_t *_mdns_search_init(const char *name, const char *servi
         uint32_t timeout, uint8_t max_results, mdns_query_notify_t notifier);
 static esp_err_t _mdns_send_search_action(mdns_action_type_t type, mdns_search_once_t *search);
 static void _mdns_search_free(mdns_search_once_t *search);
+static void _mdns_tx_handle_packet(mdns_tx_packet_t *p);
 
 void mdns_test_init_di(void)
 {
@@ -33,6 +37,17 @@ void mdns_test_init_di(void)
     mdns_test_static_search_init = _mdns_search_init;
     mdns_test_static_send_search_action = _mdns_send_search_action;
     mdns_test_static_search_free = _mdns_search_free;
+    mdns_test_static_tx_handle_packet = _mdns_tx_handle_packet;
+}
+
+void mdns_test_flush_tx_queue(void)
+{
+    // sends the scheduled packets right away, as the scheduler timer does not run in test mode
+    while (_mdns_server->tx_queue_head) {
+        mdns_tx_packet_t *p = _mdns_server->tx_queue_head;
+        _mdns_server->tx_queue_head = p->next;
+        mdns_test_static_tx_handle_packet(p);
+    }
 }
 
 void mdns_test_execute_action(void *action)
@@ -28,6 +28,7 @@ mdns_search_once_t *mdns_test_search_init(const char *name, const char *service,
 esp_err_t mdns_test_send_search_action(mdns_action_type_t type, mdns_search_once_t *search);
 void mdns_test_search_free(mdns_search_once_t *search);
 void mdns_test_init_di(void);
+void mdns_test_flush_tx_queue(void);
 extern mdns_server_t *_mdns_server;
 
 //
@@ -137,6 +138,26 @@ static void mdns_test_query_free(void)
 //
 void mdns_parse_packet(mdns_rx_packet_t *packet);
 
+#ifdef MDNS_BENCHMARK
+int mdns_bench_run(int argc, char **argv, void (*replay)(const uint8_t *data, size_t len));
+
+//
+// replays one recorded packet as a multicast from another responder, and sends the responses
+static void mdns_bench_replay(const uint8_t *data, size_t len)
+{
+    mypbuf.payload = (void *)data;
+    mypbuf.len = len;
+    g_packet.pb = &mypbuf;
+    g_packet.src.type = ESP_IPADDR_TYPE_V4;
+    g_packet.dest.type = ESP_IPADDR_TYPE_V4;
+    g_packet.ip_protocol = MDNS_IP_PROTOCOL_V4;
+    g_packet.src_port = MDNS_SERVICE_PORT;
+    g_packet.multicast = 1;
+    mdns_parse_packet(&g_packet);
+    mdns_test_flush_tx_queue();
+}
+#endif
+
 //
 // Test starts here
 //
@@ -232,6 +253,14 @@ int main(int argc, char **argv)
     FILE *file;
     size_t nread;
 
+#ifdef MDNS_BENCHMARK
+    // running searches, so that the responses in the captures are collected as well
+    mdns_test_query(NULL, "_fritz", "_tcp", MDNS_TYPE_PTR);
+    mdns_test_query(NULL, "_afpovertcp", "_tcp", MDNS_TYPE_PTR);
+    if (mdns_bench_run(argc - 1, argv + 1, mdns_bench_replay)) {
+        return 1;
+    }
+#else
 #ifdef INSTR_IS_OFF
     size_t len = 1460;
     memset(buf, 0, 1460);
@@ -264,6 +293,7 @@ int main(int argc, char **argv)
         mdns_parse_packet(&g_packet);
         free(mypbuf.payload);
     }
+#endif // MDNS_BENCHMARK
 #ifndef MDNS_NO_SERVICES
     mdns_service_remove_all();
     mdns_action_t *a = NULL;
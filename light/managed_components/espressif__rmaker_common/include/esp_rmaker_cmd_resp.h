@@ -121,6 +121,65 @@ typedef esp_err_t (*esp_rmaker_cmd_handler_t)(const void *in_data, size_t in_len
  */
 esp_err_t esp_rmaker_cmd_register(uint16_t cmd, uint8_t access, esp_rmaker_cmd_handler_t handler, bool free_on_return, void *priv);
 
+/** Writer of the data of a command response, for streaming command handlers */
+typedef struct esp_rmaker_cmd_resp_writer esp_rmaker_cmd_resp_writer_t;
+
+/** Prototype for streaming Command Handler
+ *
+ * The handler to be invoked when a given command is received, writing the response data with
+ * esp_rmaker_cmd_resp_write() straight into the response to be sent, instead of returning a buffer
+ * which is then copied into it.
+ *
+ * @param[in] in_data Pointer to input data.
+ * @param[in] in_len data len.
+ * @param[in] writer Writer for the response data. Valid only till the handler returns.
+ * @param[in] ctx Command Context.
+ * @param[in] priv Private data, if specified while registering command.
+ *
+ * @return ESP_OK on success.
+ * @return error on failure, in which case the data written is dropped and the response has the failure status.
+ */
+typedef esp_err_t (*esp_rmaker_cmd_stream_handler_t)(const void *in_data, size_t in_len, esp_rmaker_cmd_resp_writer_t *writer, esp_rmaker_cmd_ctx_t *ctx, void *priv);
+
+/** Register a new command with a streaming handler
+ *
+ * @param[in] cmd Command Identifier. Custom commands should start beyond ESP_RMAKER_CMD_STANDARD_LAST
+ * @param[in] access User Access for the command, as for esp_rmaker_cmd_register().
+ * @param[in] handler The handler to be invoked when the given command is received.
+ * @param[in] priv Optional private data to be passed to the handler.
+ *
+ * @return ESP_OK on success.
+ * @return error on failure.
+ */
+esp_err_t esp_rmaker_cmd_register_stream(uint16_t cmd, uint8_t access, esp_rmaker_cmd_stream_handler_t handler, void *priv);
+
+/** Append data to a command response
+ *
+ * Can be called any number of times by a streaming command handler. The data of all the calls
+ * makes the response data.
+ *
+ * @param[in] writer Writer passed to the handler.
+ * @param[in] data Data to append.
+ * @param[in] len Length of the data.
+ *
+ * @return ESP_OK on success.
+ * @return error on failure.
+ */
+esp_err_t esp_rmaker_cmd_resp_write(esp_rmaker_cmd_resp_writer_t *writer, const void *data, size_t len);
+
+/** Make room in a command response
+ *
+ * Optional. Allocates the response at once for len more bytes of data, for handlers knowing the
+ * size of their response in advance.
+ *
+ * @param[in] writer Writer passed to the handler.
+ * @param[in] len Length of data to be written.
+ *
+ * @return ESP_OK on success.
+ * @return error on failure.
+ */
+esp_err_t esp_rmaker_cmd_resp_reserve(esp_rmaker_cmd_resp_writer_t *writer, size_t len);
+
 /** De-register a command
  *
  * @param[in] cmd Command Identifier. Custom commands should start beyond ESP_RMAKER_CMD_STANDARD_LAST
@@ -56,6 +56,21 @@ void *esp_rmaker_factory_get(const char *key);
  */
 size_t esp_rmaker_factory_get_size(const char *key);
 
+/** Get a view of a value in factory NVS
+ *
+ * With CONFIG_ESP_RMAKER_FACTORY_CACHE, the factory namespace is read once, on first use, and this
+ * returns a pointer to the value in that copy, without allocating nor reading NVS. The value is
+ * followed by a NULL byte, so strings can be used as is. It must not be modified nor freed, and
+ * stays valid till esp_rmaker_factory_set() is called. Without the cache, this returns NULL.
+ *
+ * @param[in] key The key of the value to be read from factory NVS.
+ * @param[out] len Size of the value. Can be NULL.
+ *
+ * @return pointer to the value on success.
+ * @return NULL on failure.
+ */
+const void *esp_rmaker_factory_get_view(const char *key, size_t *len);
+
 /** Set a value in factory NVS
  *
  * This will write the value for the specified key into factory NVS.
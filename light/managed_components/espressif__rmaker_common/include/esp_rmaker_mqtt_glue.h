@@ -64,6 +64,21 @@ typedef esp_rmaker_mqtt_conn_params_t *(*esp_rmaker_mqtt_get_conn_params_t)(void
  */
 typedef void (*esp_rmaker_mqtt_subscribe_cb_t)(const char *topic, void *payload, size_t payload_len, void *priv_data);
 
+/** MQTT Subscribe callback prototype, for messages delivered in fragments
+ *
+ * Called for each fragment of a message as it arrives, so that a message longer
+ * than the MQTT buffer is not put together in memory, e.g. to feed a streaming parser.
+ *
+ * @param[in] topic Topic on which the message was received
+ * @param[in] data Data of the fragment
+ * @param[in] data_len Length of the fragment
+ * @param[in] offset Offset of the fragment in the message
+ * @param[in] total_len Length of the message, the last fragment ends at it
+ * @param[in] priv_data The private data passed during subscription
+ */
+typedef void (*esp_rmaker_mqtt_subscribe_fragment_cb_t)(const char *topic, const void *data, size_t data_len,
+        size_t offset, size_t total_len, void *priv_data);
+
 /** MQTT Init function prototype
  *
  * @param[in] conn_params The MQTT connection parameters. If NULL is passed, it should internally use the
@@ -124,6 +139,19 @@ typedef esp_err_t (*esp_rmaker_mqtt_publish_t)(const char *topic, void *data, si
  */
 typedef esp_err_t (*esp_rmaker_mqtt_subscribe_t)(const char *topic, esp_rmaker_mqtt_subscribe_cb_t cb, uint8_t qos, void *priv_data);
 
+/** MQTT Subscribe function prototype, for messages delivered in fragments
+ *
+ * @param[in] topic The topic to be subscribed to.
+ * @param[in] cb The callback to be invoked for each fragment of a message received on the given topic.
+ * @param[in] qos Quality of service for the subscription.
+ * @param[in] priv_data Optional private data to be passed to the callback.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of any error.
+ */
+typedef esp_err_t (*esp_rmaker_mqtt_subscribe_fragments_t)(const char *topic, esp_rmaker_mqtt_subscribe_fragment_cb_t cb,
+        uint8_t qos, void *priv_data);
+
 /** MQTT Unsubscribe function prototype
  *
  * @param[in] topic Topic from which to unsubscribe.
@@ -153,6 +181,9 @@ typedef struct {
     esp_rmaker_mqtt_subscribe_t subscribe;
     /** Pointer to MQTT Unsubscribe function */
     esp_rmaker_mqtt_unsubscribe_t unsubscribe;
+    /** Pointer to MQTT Subscribe function for messages delivered in fragments, optional.
+     * Unsubscribe with the Unsubscribe function. */
+    esp_rmaker_mqtt_subscribe_fragments_t subscribe_fragments;
 } esp_rmaker_mqtt_config_t;
 
 /** Setup MQTT Glue
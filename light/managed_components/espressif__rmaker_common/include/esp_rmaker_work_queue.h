@@ -25,6 +25,21 @@ extern "C"
  */
 typedef void (*esp_rmaker_work_fn_t)(void *priv_data);
 
+/** Priority of the work queued
+ *
+ * Work of a higher priority runs first, whenever the function run before returns.
+ */
+typedef enum {
+    /** Time critical work, e.g. command responses */
+    ESP_RMAKER_WORK_QUEUE_PRIO_HIGH = 0,
+    /** The priority of esp_rmaker_work_queue_add_task() and of the delayed work */
+    ESP_RMAKER_WORK_QUEUE_PRIO_NORMAL,
+    /** Background work, e.g. Insights uploads */
+    ESP_RMAKER_WORK_QUEUE_PRIO_LOW,
+    /** Number of priorities, not a priority */
+    ESP_RMAKER_WORK_QUEUE_PRIO_MAX,
+} esp_rmaker_work_queue_prio_t;
+
 /** Initializes the Work Queue
  *
  * This initializes the work queue, which is basically a mechanism to run
@@ -77,6 +92,36 @@ esp_err_t esp_rmaker_work_queue_stop(void);
  */
 esp_err_t esp_rmaker_work_queue_add_task(esp_rmaker_work_fn_t work_fn, void *priv_data);
 
+/** Queue execution of a function in the Work Queue's context, with a priority
+ *
+ * Same as esp_rmaker_work_queue_add_task(), for the given priority.
+ *
+ * @param[in] work_fn The Work function to be queued.
+ * @param[in] priv_data Private data to be passed to the work function.
+ * @param[in] prio Priority of the work.
+ *
+ * @return ESP_OK on success.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_work_queue_add_task_with_prio(esp_rmaker_work_fn_t work_fn, void *priv_data,
+        esp_rmaker_work_queue_prio_t prio);
+
+/** Queue execution of a function in the Work Queue's context, after a delay
+ *
+ * The function is queued with the normal priority once the delay has elapsed, without
+ * a timer of its own. At most CONFIG_ESP_RMAKER_WORK_QUEUE_MAX_DELAYED_TASKS functions
+ * can be waiting.
+ *
+ * @param[in] work_fn The Work function to be queued.
+ * @param[in] priv_data Private data to be passed to the work function.
+ * @param[in] delay_ms Delay, in milliseconds.
+ *
+ * @return ESP_OK on success.
+ * @return ESP_ERR_NO_MEM if too many functions are waiting.
+ * @return error in case of failure.
+ */
+esp_err_t esp_rmaker_work_queue_add_delayed_task(esp_rmaker_work_fn_t work_fn, void *priv_data, uint32_t delay_ms);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,6 +12,12 @@
 #include <esp_rmaker_utils.h>
 
 #define RMAKER_MAX_CMD  CONFIG_ESP_RMAKER_MAX_COMMANDS
+/* Open addressing, kept at most half full so that probes stay short */
+#define RMAKER_CMD_TABLE_SIZE   (2 * RMAKER_MAX_CMD + 1)
+
+/* Each TLV carries up to 255 bytes after its type and length */
+#define TLV_MAX_LEN         255
+#define TLV_SIZE(len)       ((len) + 2 * (((len) + TLV_MAX_LEN - 1) / TLV_MAX_LEN + ((len) == 0)))
 
 static const char *TAG = "esp_rmaker_common_cmd_resp";
 
@@ -20,6 +26,7 @@ typedef struct {
     uint8_t access;
     bool free_on_return;
     esp_rmaker_cmd_handler_t handler;
+    esp_rmaker_cmd_stream_handler_t stream_handler;
     void *priv;
 } esp_rmaker_cmd_info_t;
 
@@ -29,7 +36,13 @@ typedef struct {
     int curlen;
 } esp_rmaker_tlv_data_t;
 
-static esp_rmaker_cmd_info_t *esp_rmaker_cmd_list[RMAKER_MAX_CMD];
+struct esp_rmaker_cmd_resp_writer {
+    esp_rmaker_tlv_data_t tlv_data;
+    int data_len_offset;    /* Length byte of the last data TLV, -1 before any data */
+};
+
+static esp_rmaker_cmd_info_t *esp_rmaker_cmd_table[RMAKER_CMD_TABLE_SIZE];
+static int esp_rmaker_cmd_count;
 
 /* Get uint16 from Little Endian data buffer */
 static uint16_t get_u16_le(const void *val_ptr)
@@ -60,6 +73,31 @@ static void esp_rmaker_tlv_data_init(esp_rmaker_tlv_data_t *tlv_data, uint8_t *b
     tlv_data->curlen = 0;
 }
 
+/* Get the value of the given type, if it is in a single TLV.
+ *
+ * Returns pointer to the value in buf, and NULL if the TLV was not found or the value is split
+ */
+static const uint8_t *esp_rmaker_get_tlv_value_ptr(const uint8_t *buf, int buflen, uint8_t type, int *len)
+{
+    int curlen = 0;
+    while (buflen >= 2) {
+        uint8_t tlv_len = buf[curlen + 1];
+        if ((buflen - tlv_len) < 2) {
+            return NULL;
+        }
+        if (buf[curlen] == type) {
+            if (tlv_len == TLV_MAX_LEN) {
+                return NULL;
+            }
+            *len = tlv_len;
+            return &buf[curlen + 2];
+        }
+        buflen -= (2 + tlv_len);
+        curlen += (2 + tlv_len);
+    }
+    return NULL;
+}
+
 /* Get length of data, for given type.
  *
  * Returns length of data on success and -1 if the TLV was not found
@@ -183,6 +221,26 @@ const char *esp_rmaker_get_user_role_string(uint8_t user_role)
     }
 }
 
+/* Size of the TLVs before the data of a response */
+static int esp_rmaker_cmd_response_header_size(esp_rmaker_cmd_ctx_t *cmd_ctx)
+{
+    size_t req_id_len = strnlen(cmd_ctx->req_id, sizeof(cmd_ctx->req_id));
+    return (req_id_len ? TLV_SIZE(req_id_len) : 0) + TLV_SIZE(sizeof(uint8_t)) + TLV_SIZE(sizeof(uint16_t));
+}
+
+/* Add the Request Id, Status and Command Id of the response */
+static void esp_rmaker_cmd_add_response_header(esp_rmaker_tlv_data_t *tlv_data, esp_rmaker_cmd_ctx_t *cmd_ctx, uint8_t status)
+{
+    size_t req_id_len = strnlen(cmd_ctx->req_id, sizeof(cmd_ctx->req_id));
+    if (req_id_len) {
+        esp_rmaker_add_tlv(tlv_data, ESP_RMAKER_TLV_TYPE_REQ_ID, req_id_len, cmd_ctx->req_id);
+    }
+    esp_rmaker_add_tlv(tlv_data, ESP_RMAKER_TLV_TYPE_STATUS, sizeof(status), &status);
+    uint8_t cmd_buf[2];
+    put_u16_le(cmd_buf, cmd_ctx->cmd);
+    esp_rmaker_add_tlv(tlv_data, ESP_RMAKER_TLV_TYPE_CMD, sizeof(cmd_buf), cmd_buf);
+}
+
 /* Prepare the response TLV8 which includes
  *
  * Request Id
@@ -192,22 +250,19 @@ const char *esp_rmaker_get_user_role_string(uint8_t user_role)
  */
 static esp_err_t esp_rmaker_cmd_prepare_response(esp_rmaker_cmd_ctx_t *cmd_ctx, uint8_t status, void *response, size_t response_size, void **output, size_t *output_len)
 {
-    size_t publish_size = response_size + 100; /* +100 for rest of metadata. TODO: Do exact calculation */
-    void *publish_data = MEM_CALLOC_EXTRAM(1, publish_size);
+    if (response == NULL) {
+        response_size = 0;
+    }
+    size_t publish_size = esp_rmaker_cmd_response_header_size(cmd_ctx) + (response_size ? TLV_SIZE(response_size) : 0);
+    void *publish_data = MEM_ALLOC_EXTRAM(publish_size);
     if (!publish_data) {
-        ESP_LOGE(TAG, "Failed to allocate buffer of size %d for response.", response_size + 100);
+        ESP_LOGE(TAG, "Failed to allocate buffer of size %d for response.", publish_size);
         return ESP_ERR_NO_MEM;
     }
     esp_rmaker_tlv_data_t tlv_data;
     esp_rmaker_tlv_data_init(&tlv_data, publish_data, publish_size);
-    if (strlen(cmd_ctx->req_id)) {
-        esp_rmaker_add_tlv(&tlv_data, ESP_RMAKER_TLV_TYPE_REQ_ID, strlen(cmd_ctx->req_id), cmd_ctx->req_id);
-    }
-    esp_rmaker_add_tlv(&tlv_data, ESP_RMAKER_TLV_TYPE_STATUS, sizeof(status), &status);
-    uint8_t cmd_buf[2];
-    put_u16_le(cmd_buf, cmd_ctx->cmd);
-    esp_rmaker_add_tlv(&tlv_data, ESP_RMAKER_TLV_TYPE_CMD, sizeof(cmd_buf), cmd_buf);
-    if (response != NULL && response_size != 0) {
+    esp_rmaker_cmd_add_response_header(&tlv_data, cmd_ctx, status);
+    if (response_size != 0) {
         esp_rmaker_add_tlv(&tlv_data, ESP_RMAKER_TLV_TYPE_DATA, response_size, response);
     }
     ESP_LOGD(TAG, "Generated response of size %d for cmd %d", tlv_data.curlen, cmd_ctx->cmd);
@@ -216,6 +271,106 @@ static esp_err_t esp_rmaker_cmd_prepare_response(esp_rmaker_cmd_ctx_t *cmd_ctx,
     return ESP_OK;
 }
 
+/* Make room for len more bytes in the response */
+static esp_err_t esp_rmaker_cmd_resp_grow(esp_rmaker_cmd_resp_writer_t *writer, size_t len)
+{
+    esp_rmaker_tlv_data_t *tlv_data = &writer->tlv_data;
+    if (len <= (size_t)(tlv_data->bufsize - tlv_data->curlen)) {
+        return ESP_OK;
+    }
+    if (len > (size_t)(INT32_MAX - tlv_data->curlen)) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Doubling, so that many small writes cost few reallocations */
+    int bufsize = tlv_data->bufsize * 2;
+    if (bufsize < tlv_data->curlen + (int)len) {
+        bufsize = tlv_data->curlen + len;
+    }
+    uint8_t *bufptr = MEM_REALLOC_EXTRAM(tlv_data->bufptr, bufsize);
+    if (!bufptr) {
+        ESP_LOGE(TAG, "Failed to allocate buffer of size %d for response.", bufsize);
+        return ESP_ERR_NO_MEM;
+    }
+    tlv_data->bufptr = bufptr;
+    tlv_data->bufsize = bufsize;
+    return ESP_OK;
+}
+
+esp_err_t esp_rmaker_cmd_resp_reserve(esp_rmaker_cmd_resp_writer_t *writer, size_t len)
+{
+    if (!writer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* The data fitting in the last data TLV, and the new TLVs for the rest */
+    size_t open_len = 0;
+    if (writer->data_len_offset >= 0) {
+        open_len = TLV_MAX_LEN - writer->tlv_data.bufptr[writer->data_len_offset];
+        open_len = open_len < len ? open_len : len;
+    }
+    size_t new_len = len - open_len;
+    return esp_rmaker_cmd_resp_grow(writer, open_len + (new_len ? TLV_SIZE(new_len) : 0));
+}
+
+esp_err_t esp_rmaker_cmd_resp_write(esp_rmaker_cmd_resp_writer_t *writer, const void *data, size_t len)
+{
+    if (!writer || (len && !data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_rmaker_cmd_resp_reserve(writer, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_rmaker_tlv_data_t *tlv_data = &writer->tlv_data;
+    const uint8_t *ptr = data;
+    while (len) {
+        /* Continue the last data TLV until it is full, as a value split over 255 byte TLVs */
+        if (writer->data_len_offset < 0 || tlv_data->bufptr[writer->data_len_offset] == TLV_MAX_LEN) {
+            tlv_data->bufptr[tlv_data->curlen++] = ESP_RMAKER_TLV_TYPE_DATA;
+            writer->data_len_offset = tlv_data->curlen;
+            tlv_data->bufptr[tlv_data->curlen++] = 0;
+        }
+        uint8_t *tlv_len = &tlv_data->bufptr[writer->data_len_offset];
+        size_t chunk = TLV_MAX_LEN - *tlv_len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(&tlv_data->bufptr[tlv_data->curlen], ptr, chunk);
+        tlv_data->curlen += chunk;
+        *tlv_len += chunk;
+        ptr += chunk;
+        len -= chunk;
+    }
+    return ESP_OK;
+}
+
+/* Run a streaming handler, which writes its response data after the header */
+static esp_err_t esp_rmaker_cmd_stream_response(esp_rmaker_cmd_info_t *cmd_info, const void *data, size_t data_size,
+        esp_rmaker_cmd_ctx_t *cmd_ctx, void **output, size_t *output_len)
+{
+    int header_size = esp_rmaker_cmd_response_header_size(cmd_ctx);
+    int bufsize = header_size + TLV_SIZE(TLV_MAX_LEN);
+    esp_rmaker_cmd_resp_writer_t writer = {
+        .data_len_offset = -1,
+    };
+    uint8_t *buf = MEM_ALLOC_EXTRAM(bufsize);
+    if (!buf) {
+        ESP_LOGE(TAG, "Failed to allocate buffer of size %d for response.", bufsize);
+        return ESP_ERR_NO_MEM;
+    }
+    esp_rmaker_tlv_data_init(&writer.tlv_data, buf, bufsize);
+    esp_rmaker_cmd_add_response_header(&writer.tlv_data, cmd_ctx, ESP_RMAKER_CMD_STATUS_SUCCESS);
+    esp_err_t err = cmd_info->stream_handler(data, data_size, &writer, cmd_ctx, cmd_info->priv);
+    if (err != ESP_OK) {
+        /* Same response as a failed handler, without data. The status is the third last TLV. */
+        writer.tlv_data.curlen = header_size;
+        writer.tlv_data.bufptr[header_size - TLV_SIZE(sizeof(uint16_t)) - 1] = ESP_RMAKER_CMD_STATUS_FAILED;
+    }
+    ESP_LOGD(TAG, "Generated response of size %d for cmd %d", writer.tlv_data.curlen, cmd_ctx->cmd);
+    *output = writer.tlv_data.bufptr;
+    *output_len = writer.tlv_data.curlen;
+    return ESP_OK;
+}
+
 esp_err_t esp_rmaker_cmd_prepare_empty_response(void **output, size_t *output_len)
 {
     size_t publish_size = 6; /* unit16 cmd = 0 (4 bytes in TLV), req_id = empty (2 bytes) */
@@ -235,36 +390,74 @@ esp_err_t esp_rmaker_cmd_prepare_empty_response(void **output, size_t *output_le
     return ESP_OK;
 }
 
-/* Register a new command with its handler
+/* Home slot of a command in the table */
+static int esp_rmaker_cmd_slot(uint16_t cmd)
+{
+    return ((uint32_t)cmd * 40503U) % RMAKER_CMD_TABLE_SIZE;
+}
+
+/* Find the slot of given command
+ *
+ * Returns the slot if found and -1 if not
  */
-esp_err_t esp_rmaker_cmd_register(uint16_t cmd, uint8_t access, esp_rmaker_cmd_handler_t handler, bool free_on_return, void *priv)
+static int esp_rmaker_cmd_find(uint16_t cmd)
 {
-    int i;
-    for (i = 0; i < RMAKER_MAX_CMD; i++) {
-        if (esp_rmaker_cmd_list[i] && (esp_rmaker_cmd_list[i]->cmd == cmd)) {
-            ESP_LOGE(TAG, "Handler for command %d already exists.", cmd);
-            return ESP_FAIL;
+    int i = esp_rmaker_cmd_slot(cmd);
+    /* The table is never full, so there always is an empty slot to stop at */
+    while (esp_rmaker_cmd_table[i]) {
+        if (esp_rmaker_cmd_table[i]->cmd == cmd) {
+            return i;
         }
+        i = (i + 1) % RMAKER_CMD_TABLE_SIZE;
     }
-    for (i = 0; i < RMAKER_MAX_CMD; i++) {
-        if (!esp_rmaker_cmd_list[i]) {
-            esp_rmaker_cmd_info_t *cmd_info = calloc(1, sizeof(esp_rmaker_cmd_info_t));
-            if (!cmd_info) {
-                ESP_LOGE(TAG, "Could not allocate memory for cmd %d", cmd);
-                return ESP_ERR_NO_MEM;
-            }
-            cmd_info->cmd = cmd;
-            cmd_info->access = access;
-            cmd_info->free_on_return = free_on_return;
-            cmd_info->handler = handler;
-            cmd_info->priv = priv;
-            esp_rmaker_cmd_list[i] = cmd_info;
-            ESP_LOGI(TAG, "Registered command %d", cmd);
-            return ESP_OK;
-        }
+    return -1;
+}
+
+static esp_err_t esp_rmaker_cmd_add(uint16_t cmd, uint8_t access, esp_rmaker_cmd_handler_t handler,
+        esp_rmaker_cmd_stream_handler_t stream_handler, bool free_on_return, void *priv)
+{
+    if (esp_rmaker_cmd_find(cmd) >= 0) {
+        ESP_LOGE(TAG, "Handler for command %d already exists.", cmd);
+        return ESP_FAIL;
+    }
+    if (esp_rmaker_cmd_count >= RMAKER_MAX_CMD) {
+        ESP_LOGE(TAG, "No space to add command %d", cmd);
+        return ESP_ERR_NO_MEM;
     }
-    ESP_LOGE(TAG, "No space to add command %d", cmd);
-    return ESP_ERR_NO_MEM;
+    esp_rmaker_cmd_info_t *cmd_info = calloc(1, sizeof(esp_rmaker_cmd_info_t));
+    if (!cmd_info) {
+        ESP_LOGE(TAG, "Could not allocate memory for cmd %d", cmd);
+        return ESP_ERR_NO_MEM;
+    }
+    cmd_info->cmd = cmd;
+    cmd_info->access = access;
+    cmd_info->free_on_return = free_on_return;
+    cmd_info->handler = handler;
+    cmd_info->stream_handler = stream_handler;
+    cmd_info->priv = priv;
+    int i = esp_rmaker_cmd_slot(cmd);
+    while (esp_rmaker_cmd_table[i]) {
+        i = (i + 1) % RMAKER_CMD_TABLE_SIZE;
+    }
+    esp_rmaker_cmd_table[i] = cmd_info;
+    esp_rmaker_cmd_count++;
+    ESP_LOGI(TAG, "Registered command %d", cmd);
+    return ESP_OK;
+}
+
+/* Register a new command with its handler
+ */
+esp_err_t esp_rmaker_cmd_register(uint16_t cmd, uint8_t access, esp_rmaker_cmd_handler_t handler, bool free_on_return, void *priv)
+{
+    return esp_rmaker_cmd_add(cmd, access, handler, NULL, free_on_return, priv);
+}
+
+esp_err_t esp_rmaker_cmd_register_stream(uint16_t cmd, uint8_t access, esp_rmaker_cmd_stream_handler_t handler, void *priv)
+{
+    if (!handler) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_rmaker_cmd_add(cmd, access, NULL, handler, false, priv);
 }
 
 /* Find the command infor for given command
@@ -273,12 +466,10 @@ esp_err_t esp_rmaker_cmd_register(uint16_t cmd, uint8_t access, esp_rmaker_cmd_h
  */
 static esp_rmaker_cmd_info_t *esp_rmaker_get_cmd_info(uint16_t cmd)
 {
-    int i;
-    for (i = 0; i < RMAKER_MAX_CMD; i++) {
-        if (esp_rmaker_cmd_list[i] && (esp_rmaker_cmd_list[i]->cmd == cmd)) {
-            ESP_LOGI(TAG, "Handler found for command %d.", cmd);
-            return esp_rmaker_cmd_list[i];
-        }
+    int i = esp_rmaker_cmd_find(cmd);
+    if (i >= 0) {
+        ESP_LOGI(TAG, "Handler found for command %d.", cmd);
+        return esp_rmaker_cmd_table[i];
     }
     ESP_LOGE(TAG, "No handler found for command %d.", cmd);
     return NULL;
@@ -287,16 +478,33 @@ static esp_rmaker_cmd_info_t *esp_rmaker_get_cmd_info(uint16_t cmd)
 /* De-register given command */
 esp_err_t esp_rmaker_cmd_deregister(uint16_t cmd)
 {
-    int i;
-    for (i = 0; i < RMAKER_MAX_CMD; i++) {
-        if (esp_rmaker_cmd_list[i] && (esp_rmaker_cmd_list[i]->cmd == cmd)) {
-            free(esp_rmaker_cmd_list[i]);
-            esp_rmaker_cmd_list[i] = NULL;
-            return ESP_OK;
+    int i = esp_rmaker_cmd_find(cmd);
+    if (i < 0) {
+        ESP_LOGE(TAG, "Cannot unregister command %d as it wasn't registered.", cmd);
+        return ESP_ERR_INVALID_ARG;
+    }
+    free(esp_rmaker_cmd_table[i]);
+    esp_rmaker_cmd_table[i] = NULL;
+    esp_rmaker_cmd_count--;
+    /* Move back the commands after it which could not get their home slot, so that none is
+     * left behind an empty slot
+     */
+    int j = i;
+    while (true) {
+        j = (j + 1) % RMAKER_CMD_TABLE_SIZE;
+        if (!esp_rmaker_cmd_table[j]) {
+            break;
+        }
+        int home = esp_rmaker_cmd_slot(esp_rmaker_cmd_table[j]->cmd);
+        /* Stays if its home is cyclically in (i, j] */
+        bool stays = (i < j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            esp_rmaker_cmd_table[i] = esp_rmaker_cmd_table[j];
+            esp_rmaker_cmd_table[j] = NULL;
+            i = j;
         }
     }
-    ESP_LOGE(TAG, "Cannot unregister command %d as it wasn't registered.", cmd);
-    return ESP_ERR_INVALID_ARG;
+    return ESP_OK;
 }
 
 /* Main command response handling function.
@@ -326,33 +534,45 @@ esp_err_t esp_rmaker_cmd_response_handler(const void *input, size_t input_len, v
     esp_rmaker_cmd_info_t *cmd_info = esp_rmaker_get_cmd_info(cmd_ctx.cmd);
     if (cmd_info) {
         if (cmd_info->access & cmd_ctx.user_role) {
-            void *data = NULL;
-            int data_size = esp_rmaker_get_tlv_length(input, input_len, ESP_RMAKER_TLV_TYPE_DATA);
-            if (data_size > 0) {
-                /* TODO: If data size < 255, can just use the pointer to input */
-                data = MEM_CALLOC_EXTRAM(1, data_size);
-                if (!data) {
+            void *data_copy = NULL;
+            int data_size = 0;
+            /* Data in a single TLV is passed as is, only data split over several TLVs is copied */
+            const void *data = esp_rmaker_get_tlv_value_ptr(input, input_len, ESP_RMAKER_TLV_TYPE_DATA, &data_size);
+            if (!data) {
+                data_size = esp_rmaker_get_tlv_length(input, input_len, ESP_RMAKER_TLV_TYPE_DATA);
+            }
+            if (!data && data_size > 0) {
+                data_copy = MEM_ALLOC_EXTRAM(data_size);
+                if (!data_copy) {
                     ESP_LOGE(TAG, "Failed to allocate buffer of size %d for data.", data_size);
                     return ESP_ERR_NO_MEM;
                 }
-                esp_rmaker_get_value_from_tlv(input, input_len, ESP_RMAKER_TLV_TYPE_DATA, data, data_size);
-            } else {
+                esp_rmaker_get_value_from_tlv(input, input_len, ESP_RMAKER_TLV_TYPE_DATA, data_copy, data_size);
+                data = data_copy;
+            } else if (data_size <= 0) {
                 /* It is not mandatory to have data for a given command. So, just throwing a warning */
                 ESP_LOGW(TAG, "No data received for the command.");
+                data = NULL;
                 data_size = 0;
             }
-            void *response;
-            size_t response_size = 0;
-            esp_err_t err = cmd_info->handler(data, data_size, &response, &response_size, &cmd_ctx, cmd_info->priv);
-            if (err == ESP_OK) {
-                err = esp_rmaker_cmd_prepare_response(&cmd_ctx, ESP_RMAKER_CMD_STATUS_SUCCESS, response, response_size, output, output_len);
+            esp_err_t err;
+            if (cmd_info->stream_handler) {
+                err = esp_rmaker_cmd_stream_response(cmd_info, data, data_size, &cmd_ctx, output, output_len);
             } else {
-                err = esp_rmaker_cmd_prepare_response(&cmd_ctx, ESP_RMAKER_CMD_STATUS_FAILED, NULL, 0, output, output_len);
-            }
-            if (response && cmd_info->free_on_return) {
-                ESP_LOGI(TAG, "Freeing response buffer.");
-                free(response);
+                void *response = NULL;
+                size_t response_size = 0;
+                err = cmd_info->handler(data, data_size, &response, &response_size, &cmd_ctx, cmd_info->priv);
+                if (err == ESP_OK) {
+                    err = esp_rmaker_cmd_prepare_response(&cmd_ctx, ESP_RMAKER_CMD_STATUS_SUCCESS, response, response_size, output, output_len);
+                } else {
+                    err = esp_rmaker_cmd_prepare_response(&cmd_ctx, ESP_RMAKER_CMD_STATUS_FAILED, NULL, 0, output, output_len);
+                }
+                if (response && cmd_info->free_on_return) {
+                    ESP_LOGI(TAG, "Freeing response buffer.");
+                    free(response);
+                }
             }
+            free(data_copy);
             return err;
         } else {
             return esp_rmaker_cmd_prepare_response(&cmd_ctx, ESP_RMAKER_CMD_STATUS_AUTH_FAIL, NULL, 0, output, output_len);
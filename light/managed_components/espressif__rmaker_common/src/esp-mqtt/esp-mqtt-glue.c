@@ -17,6 +17,7 @@
 #include <sdkconfig.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
 #include <mqtt_client.h>
 #include <esp_event.h>
@@ -24,6 +25,7 @@
 #include <esp_rmaker_mqtt_glue.h>
 #include <esp_idf_version.h>
 #include <esp_rmaker_utils.h>
+#include <esp_rmaker_work_queue.h>
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 1, 0)
 // Features supported in 4.1+
 
@@ -57,111 +59,672 @@
 
 static const char *TAG = "esp_mqtt_glue";
 
+#if CONFIG_DIAG_HEAP_TAGS
+/* Weak, the memory of this file is accounted to the "mqtt" heap tag when esp_diagnostics is linked in.
+ * The allocators are defined together, checking one of them is enough.
+ */
+extern void *esp_diag_heap_tag_malloc(const char *tag, size_t size) __attribute__((weak));
+extern void *esp_diag_heap_tag_calloc(const char *tag, size_t n, size_t size) __attribute__((weak));
+extern void *esp_diag_heap_tag_realloc(const char *tag, void *ptr, size_t size) __attribute__((weak));
+extern char *esp_diag_heap_tag_strdup(const char *tag, const char *str) __attribute__((weak));
+extern char *esp_diag_heap_tag_strndup(const char *tag, const char *str, size_t n) __attribute__((weak));
+extern void esp_diag_heap_tag_free(const char *tag, void *ptr) __attribute__((weak));
+extern void esp_diag_heap_tag_add(const char *tag, void *ptr) __attribute__((weak));
+#define MQTT_GLUE_HEAP_TAG      "mqtt"
+#define MQTT_GLUE_HEAP_TAGGED   (esp_diag_heap_tag_malloc != NULL)
+
+/* MEM_ALLOC_EXTRAM() may not go through malloc() */
+static void *esp_mqtt_glue_alloc_extram(size_t size)
+{
+    void *ptr = MEM_ALLOC_EXTRAM(size);
+    if (MQTT_GLUE_HEAP_TAGGED) {
+        esp_diag_heap_tag_add(MQTT_GLUE_HEAP_TAG, ptr);
+    }
+    return ptr;
+}
+
+#undef MEM_ALLOC_EXTRAM
+#define MEM_ALLOC_EXTRAM(size)  esp_mqtt_glue_alloc_extram(size)
+#define malloc(size)            (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_malloc(MQTT_GLUE_HEAP_TAG, size) \
+                                                       : malloc(size))
+#define calloc(n, size)         (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_calloc(MQTT_GLUE_HEAP_TAG, n, size) \
+                                                       : calloc(n, size))
+#define realloc(ptr, size)      (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_realloc(MQTT_GLUE_HEAP_TAG, ptr, size) \
+                                                       : realloc(ptr, size))
+#define strdup(str)             (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_strdup(MQTT_GLUE_HEAP_TAG, str) \
+                                                       : strdup(str))
+#define strndup(str, n)         (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_strndup(MQTT_GLUE_HEAP_TAG, str, n) \
+                                                       : strndup(str, n))
+#define free(ptr)               (MQTT_GLUE_HEAP_TAGGED ? esp_diag_heap_tag_free(MQTT_GLUE_HEAP_TAG, ptr) \
+                                                       : free(ptr))
+#endif /* CONFIG_DIAG_HEAP_TAGS */
+
 #define MAX_MQTT_SUBSCRIPTIONS      CONFIG_ESP_RMAKER_MAX_MQTT_SUBSCRIPTIONS
+#define MQTT_REASSEMBLY_BUFFER_SIZE CONFIG_ESP_RMAKER_MQTT_REASSEMBLY_BUFFER_SIZE
+#define MQTT_PUBLISH_BATCH_WINDOW   CONFIG_ESP_RMAKER_MQTT_PUBLISH_BATCH_WINDOW
+#define MQTT_OUTBOX_LIMIT           CONFIG_ESP_RMAKER_MQTT_OUTBOX_LIMIT
 
-typedef struct {
+#if MQTT_PUBLISH_BATCH_WINDOW
+#define MQTT_PUBLISH_BATCH_SIZE     CONFIG_ESP_RMAKER_MQTT_PUBLISH_BATCH_SIZE
+
+/* A QoS 0 publish waiting for the batch to be sent */
+typedef struct esp_mqtt_glue_pending_publish {
+    struct esp_mqtt_glue_pending_publish *next;
+    size_t data_len;
+    char *topic;        /* After the data, in the same allocation */
+    char data[];
+} esp_mqtt_glue_pending_publish_t;
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
+
+typedef struct esp_mqtt_glue_subscription {
     char *topic;
     esp_rmaker_mqtt_subscribe_cb_t cb;
+    esp_rmaker_mqtt_subscribe_fragment_cb_t fragment_cb;    /* Instead of cb, for the fragments of the messages */
     void *priv;
+    bool wildcard;      /* The topic has + or #, so the callbacks get the topic of the message */
+    bool removed;       /* Unsubscribed from a callback, freed once the message is dispatched */
+    struct esp_mqtt_glue_subscription *next;    /* Of the same topic */
 } esp_mqtt_glue_subscription_t;
 
+/* The subscriptions are in a trie of the levels of their topics, so that a message is
+ * dispatched in as many steps as its topic has levels, whatever the number of subscriptions.
+ */
+typedef struct esp_mqtt_glue_topic_node {
+    struct esp_mqtt_glue_topic_node *parent;
+    struct esp_mqtt_glue_topic_node *children;
+    struct esp_mqtt_glue_topic_node *next;      /* Sibling */
+    esp_mqtt_glue_subscription_t *subscriptions;
+    char level[];
+} esp_mqtt_glue_topic_node_t;
+
+/* A message longer than the MQTT buffer, received in fragments */
+typedef struct {
+    char *data;         /* Put together for the subscriptions taking whole messages */
+    size_t data_size;   /* Kept for the next messages, when not above MQTT_REASSEMBLY_BUFFER_SIZE */
+    char *topic;
+    size_t topic_size;
+    int topic_len;
+    bool in_progress;
+    bool whole_message;
+} esp_mqtt_glue_long_data_t;
+
 typedef struct {
     esp_mqtt_client_handle_t mqtt_client;
     esp_rmaker_mqtt_conn_params_t *conn_params;
-    esp_mqtt_glue_subscription_t *subscriptions[MAX_MQTT_SUBSCRIPTIONS];
+    esp_mqtt_glue_topic_node_t *topics;
+    esp_mqtt_glue_long_data_t long_data;
+    int subscription_cnt;
+    bool dispatching;
+    bool removed_pending;
+#if MQTT_PUBLISH_BATCH_WINDOW
+    SemaphoreHandle_t publish_lock;
+    esp_mqtt_glue_pending_publish_t *pending;
+    esp_mqtt_glue_pending_publish_t *pending_tail;
+    size_t pending_size;
+    bool flush_scheduled;
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
 } esp_mqtt_glue_data_t;
 esp_mqtt_glue_data_t *mqtt_data;
 
-typedef struct {
-    char *data;
-    char *topic;
-} esp_mqtt_glue_long_data_t;
-
 static void esp_mqtt_glue_deinit(void);
 
-static void esp_mqtt_glue_subscribe_callback(const char *topic, int topic_len, const char *data, int data_len)
+static esp_mqtt_glue_topic_node_t *esp_mqtt_glue_topic_node_new(esp_mqtt_glue_topic_node_t *parent,
+        const char *level, size_t level_len)
 {
-    esp_mqtt_glue_subscription_t **subscriptions = mqtt_data->subscriptions;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if ((strncmp(topic, subscriptions[i]->topic, topic_len) == 0)
-                    && (topic_len == strlen(subscriptions[i]->topic))) {
-                subscriptions[i]->cb(subscriptions[i]->topic, (void *)data, data_len, subscriptions[i]->priv);
-            }
+    esp_mqtt_glue_topic_node_t *node = calloc(1, sizeof(esp_mqtt_glue_topic_node_t) + level_len + 1);
+    if (!node) {
+        return NULL;
+    }
+    memcpy(node->level, level, level_len);
+    node->parent = parent;
+    if (parent) {
+        node->next = parent->children;
+        parent->children = node;
+    }
+    return node;
+}
+
+static esp_mqtt_glue_topic_node_t *esp_mqtt_glue_topic_node_child(esp_mqtt_glue_topic_node_t *node,
+        const char *level, size_t level_len)
+{
+    esp_mqtt_glue_topic_node_t *child;
+    for (child = node->children; child; child = child->next) {
+        if (strncmp(child->level, level, level_len) == 0 && child->level[level_len] == '\0') {
+            return child;
         }
     }
+    return NULL;
 }
 
-static esp_err_t esp_mqtt_glue_subscribe(const char *topic, esp_rmaker_mqtt_subscribe_cb_t cb, uint8_t qos, void *priv_data)
+/* Frees the nodes left without subscriptions nor children, from node up */
+static void esp_mqtt_glue_topic_node_prune(esp_mqtt_glue_topic_node_t *node)
 {
-    if ( !mqtt_data || !topic || !cb) {
-        return ESP_FAIL;
+    while (node->parent && !node->subscriptions && !node->children) {
+        esp_mqtt_glue_topic_node_t *parent = node->parent;
+        esp_mqtt_glue_topic_node_t **link = &parent->children;
+        while (*link != node) {
+            link = &(*link)->next;
+        }
+        *link = node->next;
+        free(node);
+        node = parent;
     }
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (!mqtt_data->subscriptions[i]) {
-            esp_mqtt_glue_subscription_t *subscription = calloc(1, sizeof(esp_mqtt_glue_subscription_t));
-            if (!subscription) {
-                return ESP_FAIL;
+}
+
+/* Finds the node of a topic, creating the missing ones if create is set */
+static esp_mqtt_glue_topic_node_t *esp_mqtt_glue_topic_node_find(const char *topic, bool create)
+{
+    esp_mqtt_glue_topic_node_t *node = mqtt_data->topics;
+    const char *level = topic;
+    while (node) {
+        const char *sep = strchr(level, '/');
+        size_t level_len = sep ? (size_t)(sep - level) : strlen(level);
+        esp_mqtt_glue_topic_node_t *child = esp_mqtt_glue_topic_node_child(node, level, level_len);
+        if (!child && create) {
+            child = esp_mqtt_glue_topic_node_new(node, level, level_len);
+            if (!child) {
+                /* Drop the levels added for the topic */
+                esp_mqtt_glue_topic_node_prune(node);
+                return NULL;
             }
-            subscription->topic = strdup(topic);
-            if (!subscription->topic) {
-                free(subscription);
-                return ESP_FAIL;
+        }
+        node = child;
+        if (!sep) {
+            break;
+        }
+        level = sep + 1;
+    }
+    return node;
+}
+
+static void esp_mqtt_glue_subscription_free(esp_mqtt_glue_subscription_t *subscription)
+{
+    free(subscription->topic);
+    free(subscription);
+}
+
+typedef void (*esp_mqtt_glue_visit_t)(esp_mqtt_glue_subscription_t *subscription, void *ctx);
+
+static void esp_mqtt_glue_visit_node(esp_mqtt_glue_topic_node_t *node, esp_mqtt_glue_visit_t visit, void *ctx)
+{
+    esp_mqtt_glue_subscription_t *subscription;
+    for (subscription = node->subscriptions; subscription; subscription = subscription->next) {
+        if (!subscription->removed) {
+            visit(subscription, ctx);
+        }
+    }
+}
+
+/* Visits the subscriptions under node matching the levels of the topic from level on.
+ * As in MQTT, the wildcards do not match a first level starting with $.
+ */
+static void esp_mqtt_glue_match(esp_mqtt_glue_topic_node_t *node, const char *level, const char *end, bool first,
+        esp_mqtt_glue_visit_t visit, void *ctx)
+{
+    const char *sep = memchr(level, '/', end - level);
+    size_t level_len = (sep ? sep : end) - level;
+    bool wildcards = !(first && level_len && level[0] == '$');
+    esp_mqtt_glue_topic_node_t *child;
+    for (child = node->children; child; child = child->next) {
+        if (strcmp(child->level, "#") == 0) {
+            if (wildcards) {
+                esp_mqtt_glue_visit_node(child, visit, ctx);
             }
-            int ret = esp_mqtt_client_subscribe(mqtt_data->mqtt_client, subscription->topic, qos);
-            if (ret < 0) {
-                free(subscription->topic);
-                free(subscription);
-                return ESP_FAIL;
+            continue;
+        }
+        if (!(wildcards && strcmp(child->level, "+") == 0) &&
+                !(strncmp(child->level, level, level_len) == 0 && child->level[level_len] == '\0')) {
+            continue;
+        }
+        if (sep) {
+            esp_mqtt_glue_match(child, sep + 1, end, false, visit, ctx);
+        } else {
+            esp_mqtt_glue_visit_node(child, visit, ctx);
+            /* a/# also matches a */
+            esp_mqtt_glue_topic_node_t *all = esp_mqtt_glue_topic_node_child(child, "#", 1);
+            if (all) {
+                esp_mqtt_glue_visit_node(all, visit, ctx);
             }
-            subscription->priv = priv_data;
-            subscription->cb = cb;
-            mqtt_data->subscriptions[i] = subscription;
-            ESP_LOGD(TAG, "Subscribed to topic: %s", topic);
-            return ESP_OK;
         }
     }
-    return ESP_FAIL;
 }
 
-static void unsubscribe_helper(esp_mqtt_glue_subscription_t **subscription)
+/* Frees the subscriptions unsubscribed from the callbacks, once nothing walks the trie,
+ * and the nodes below node left empty.
+ */
+static void esp_mqtt_glue_free_removed(esp_mqtt_glue_topic_node_t *node)
+{
+    esp_mqtt_glue_topic_node_t **child_link = &node->children;
+    while (*child_link) {
+        esp_mqtt_glue_topic_node_t *child = *child_link;
+        esp_mqtt_glue_free_removed(child);
+        if (!child->subscriptions && !child->children) {
+            *child_link = child->next;
+            free(child);
+        } else {
+            child_link = &child->next;
+        }
+    }
+    esp_mqtt_glue_subscription_t **link = &node->subscriptions;
+    while (*link) {
+        esp_mqtt_glue_subscription_t *subscription = *link;
+        if (subscription->removed) {
+            *link = subscription->next;
+            esp_mqtt_glue_subscription_free(subscription);
+        } else {
+            link = &subscription->next;
+        }
+    }
+}
+
+typedef struct {
+    const char *topic;
+    int topic_len;
+    char *topic_str;    /* The topic NULL terminated, for the wildcard subscriptions */
+    const char *data;
+    int data_len;
+    int offset;
+    int total_len;
+    bool whole_message;
+} esp_mqtt_glue_dispatch_t;
+
+static const char *esp_mqtt_glue_dispatch_topic(esp_mqtt_glue_subscription_t *subscription,
+        esp_mqtt_glue_dispatch_t *dispatch)
+{
+    if (!subscription->wildcard) {
+        return subscription->topic;
+    }
+    if (!dispatch->topic_str) {
+        dispatch->topic_str = strndup(dispatch->topic, dispatch->topic_len);
+    }
+    return dispatch->topic_str;
+}
+
+static void esp_mqtt_glue_visit_cb(esp_mqtt_glue_subscription_t *subscription, void *ctx)
 {
-    if (subscription && *subscription) {
-        if (esp_mqtt_client_unsubscribe(mqtt_data->mqtt_client, (*subscription)->topic) < 0) {
-            ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", (*subscription)->topic);
+    esp_mqtt_glue_dispatch_t *dispatch = ctx;
+    if (subscription->cb) {
+        const char *topic = esp_mqtt_glue_dispatch_topic(subscription, dispatch);
+        if (topic) {
+            subscription->cb(topic, (void *)dispatch->data, dispatch->data_len, subscription->priv);
         }
-        free((*subscription)->topic);
-        free(*subscription);
-        *subscription = NULL;
     }
 }
 
+static void esp_mqtt_glue_visit_fragment_cb(esp_mqtt_glue_subscription_t *subscription, void *ctx)
+{
+    esp_mqtt_glue_dispatch_t *dispatch = ctx;
+    if (subscription->fragment_cb) {
+        const char *topic = esp_mqtt_glue_dispatch_topic(subscription, dispatch);
+        if (topic) {
+            subscription->fragment_cb(topic, dispatch->data, dispatch->data_len, dispatch->offset,
+                    dispatch->total_len, subscription->priv);
+        }
+    }
+}
+
+static void esp_mqtt_glue_visit_whole_message(esp_mqtt_glue_subscription_t *subscription, void *ctx)
+{
+    if (subscription->cb) {
+        ((esp_mqtt_glue_dispatch_t *)ctx)->whole_message = true;
+    }
+}
+
+static void esp_mqtt_glue_dispatch(esp_mqtt_glue_dispatch_t *dispatch, esp_mqtt_glue_visit_t visit)
+{
+    mqtt_data->dispatching = true;
+    esp_mqtt_glue_match(mqtt_data->topics, dispatch->topic, dispatch->topic + dispatch->topic_len, true,
+            visit, dispatch);
+    mqtt_data->dispatching = false;
+    if (mqtt_data->removed_pending) {
+        mqtt_data->removed_pending = false;
+        esp_mqtt_glue_free_removed(mqtt_data->topics);
+    }
+    free(dispatch->topic_str);
+    dispatch->topic_str = NULL;
+}
+
+/* Call the subscriptions taking whole messages */
+static void esp_mqtt_glue_subscribe_callback(const char *topic, int topic_len, const char *data, int data_len)
+{
+    esp_mqtt_glue_dispatch_t dispatch = {
+        .topic = topic,
+        .topic_len = topic_len,
+        .data = data,
+        .data_len = data_len,
+    };
+    esp_mqtt_glue_dispatch(&dispatch, esp_mqtt_glue_visit_cb);
+}
+
+/* Call the subscriptions taking fragments */
+static void esp_mqtt_glue_fragment_callback(const char *topic, int topic_len, const char *data, int data_len,
+        int offset, int total_len)
+{
+    esp_mqtt_glue_dispatch_t dispatch = {
+        .topic = topic,
+        .topic_len = topic_len,
+        .data = data,
+        .data_len = data_len,
+        .offset = offset,
+        .total_len = total_len,
+    };
+    esp_mqtt_glue_dispatch(&dispatch, esp_mqtt_glue_visit_fragment_cb);
+}
+
+static bool esp_mqtt_glue_needs_whole_message(const char *topic, int topic_len)
+{
+    esp_mqtt_glue_dispatch_t dispatch = {
+        .topic = topic,
+        .topic_len = topic_len,
+    };
+    esp_mqtt_glue_dispatch(&dispatch, esp_mqtt_glue_visit_whole_message);
+    return dispatch.whole_message;
+}
+
+static esp_err_t esp_mqtt_glue_subscribe_helper(const char *topic, esp_rmaker_mqtt_subscribe_cb_t cb,
+        esp_rmaker_mqtt_subscribe_fragment_cb_t fragment_cb, uint8_t qos, void *priv_data)
+{
+    if ( !mqtt_data || !topic) {
+        return ESP_FAIL;
+    }
+    if (MAX_MQTT_SUBSCRIPTIONS && mqtt_data->subscription_cnt >= MAX_MQTT_SUBSCRIPTIONS) {
+        ESP_LOGE(TAG, "Cannot subscribe to more than %d topics", MAX_MQTT_SUBSCRIPTIONS);
+        return ESP_FAIL;
+    }
+    esp_mqtt_glue_subscription_t *subscription = calloc(1, sizeof(esp_mqtt_glue_subscription_t));
+    if (!subscription) {
+        return ESP_FAIL;
+    }
+    subscription->topic = strdup(topic);
+    if (!subscription->topic) {
+        free(subscription);
+        return ESP_FAIL;
+    }
+    esp_mqtt_glue_topic_node_t *node = esp_mqtt_glue_topic_node_find(topic, true);
+    if (!node) {
+        esp_mqtt_glue_subscription_free(subscription);
+        return ESP_FAIL;
+    }
+    int ret = esp_mqtt_client_subscribe(mqtt_data->mqtt_client, subscription->topic, qos);
+    if (ret < 0) {
+        esp_mqtt_glue_subscription_free(subscription);
+        esp_mqtt_glue_topic_node_prune(node);
+        return ESP_FAIL;
+    }
+    subscription->priv = priv_data;
+    subscription->cb = cb;
+    subscription->fragment_cb = fragment_cb;
+    subscription->wildcard = strpbrk(topic, "+#") != NULL;
+    /* At the end, so that the subscriptions to a topic are called in order */
+    esp_mqtt_glue_subscription_t **link = &node->subscriptions;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = subscription;
+    mqtt_data->subscription_cnt++;
+    ESP_LOGD(TAG, "Subscribed to topic: %s", topic);
+    return ESP_OK;
+}
+
+static esp_err_t esp_mqtt_glue_subscribe(const char *topic, esp_rmaker_mqtt_subscribe_cb_t cb, uint8_t qos, void *priv_data)
+{
+    if (!cb) {
+        return ESP_FAIL;
+    }
+    return esp_mqtt_glue_subscribe_helper(topic, cb, NULL, qos, priv_data);
+}
+
+static esp_err_t esp_mqtt_glue_subscribe_fragments(const char *topic, esp_rmaker_mqtt_subscribe_fragment_cb_t cb,
+        uint8_t qos, void *priv_data)
+{
+    if (!cb) {
+        return ESP_FAIL;
+    }
+    return esp_mqtt_glue_subscribe_helper(topic, NULL, cb, qos, priv_data);
+}
+
+static void unsubscribe_helper(esp_mqtt_glue_topic_node_t *node, esp_mqtt_glue_subscription_t **link)
+{
+    esp_mqtt_glue_subscription_t *subscription = *link;
+    if (esp_mqtt_client_unsubscribe(mqtt_data->mqtt_client, subscription->topic) < 0) {
+        ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", subscription->topic);
+    }
+    mqtt_data->subscription_cnt--;
+    if (mqtt_data->dispatching) {
+        /* A message is being dispatched, the trie is changed afterwards */
+        subscription->removed = true;
+        mqtt_data->removed_pending = true;
+        return;
+    }
+    *link = subscription->next;
+    esp_mqtt_glue_subscription_free(subscription);
+    esp_mqtt_glue_topic_node_prune(node);
+}
+
 static esp_err_t esp_mqtt_glue_unsubscribe(const char *topic)
 {
     if (!mqtt_data || !topic) {
         return ESP_FAIL;
     }
-    esp_mqtt_glue_subscription_t **subscriptions = mqtt_data->subscriptions;
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (subscriptions[i]) {
-            if (strncmp(topic, subscriptions[i]->topic, strlen(topic)) == 0) {
-                unsubscribe_helper(&subscriptions[i]);
-                return ESP_OK;
-            }
+    esp_mqtt_glue_topic_node_t *node = esp_mqtt_glue_topic_node_find(topic, false);
+    if (!node) {
+        return ESP_FAIL;
+    }
+    esp_mqtt_glue_subscription_t **link = &node->subscriptions;
+    while (*link && (*link)->removed) {
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        return ESP_FAIL;
+    }
+    unsubscribe_helper(node, link);
+    return ESP_OK;
+}
+
+/* Calls visit for each subscription, in the order of the trie */
+static void esp_mqtt_glue_for_each_subscription(esp_mqtt_glue_topic_node_t *node,
+        esp_mqtt_glue_visit_t visit, void *ctx)
+{
+    esp_mqtt_glue_topic_node_t *child;
+    esp_mqtt_glue_visit_node(node, visit, ctx);
+    for (child = node->children; child; child = child->next) {
+        esp_mqtt_glue_for_each_subscription(child, visit, ctx);
+    }
+}
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+/* Topics resubscribed per SUBSCRIBE, which has to fit in the MQTT buffer, 1024 bytes by default */
+#define MQTT_RESUBSCRIBE_BATCH_TOPICS   16
+#define MQTT_RESUBSCRIBE_BATCH_BYTES    768
+
+typedef struct {
+    esp_mqtt_client_handle_t client;
+    esp_mqtt_topic_t topics[MQTT_RESUBSCRIBE_BATCH_TOPICS];
+    int count;
+    size_t bytes;
+    const char *last;   /* Topic added last, the subscriptions of a topic are visited one after the other */
+} esp_mqtt_glue_resubscribe_t;
+
+static void esp_mqtt_glue_resubscribe_flush(esp_mqtt_glue_resubscribe_t *batch)
+{
+    if (batch->count && esp_mqtt_client_subscribe_multiple(batch->client, batch->topics, batch->count) < 0) {
+        ESP_LOGW(TAG, "Could not resubscribe to %d topics", batch->count);
+    }
+    batch->count = 0;
+    batch->bytes = 0;
+}
+
+/* Adds the topic to the batch, sent in one SUBSCRIBE when full */
+static void esp_mqtt_glue_visit_resubscribe(esp_mqtt_glue_subscription_t *subscription, void *ctx)
+{
+    esp_mqtt_glue_resubscribe_t *batch = (esp_mqtt_glue_resubscribe_t *)ctx;
+    if (batch->last && strcmp(batch->last, subscription->topic) == 0) {
+        return;
+    }
+    /* Length, topic and options of each topic in the payload */
+    size_t bytes = 2 + strlen(subscription->topic) + 1;
+    if (batch->count == MQTT_RESUBSCRIBE_BATCH_TOPICS || batch->bytes + bytes > MQTT_RESUBSCRIBE_BATCH_BYTES) {
+        esp_mqtt_glue_resubscribe_flush(batch);
+    }
+    batch->topics[batch->count].filter = subscription->topic;
+    batch->topics[batch->count].qos = 1;
+    batch->count++;
+    batch->bytes += bytes;
+    batch->last = subscription->topic;
+}
+
+static void esp_mqtt_glue_resubscribe_all(esp_mqtt_client_handle_t client)
+{
+    esp_mqtt_glue_resubscribe_t batch = {
+        .client = client,
+    };
+    esp_mqtt_glue_for_each_subscription(mqtt_data->topics, esp_mqtt_glue_visit_resubscribe, &batch);
+    esp_mqtt_glue_resubscribe_flush(&batch);
+}
+#else
+static void esp_mqtt_glue_visit_resubscribe(esp_mqtt_glue_subscription_t *subscription, void *ctx)
+{
+    esp_mqtt_client_subscribe((esp_mqtt_client_handle_t)ctx, subscription->topic, 1);
+}
+
+static void esp_mqtt_glue_resubscribe_all(esp_mqtt_client_handle_t client)
+{
+    esp_mqtt_glue_for_each_subscription(mqtt_data->topics, esp_mqtt_glue_visit_resubscribe, client);
+}
+#endif /* !IDF5.1 */
+
+#if MQTT_PUBLISH_BATCH_WINDOW
+/* Takes the pending publishes. To be called with publish_lock held. */
+static esp_mqtt_glue_pending_publish_t *esp_mqtt_glue_take_pending(void)
+{
+    esp_mqtt_glue_pending_publish_t *pending = mqtt_data->pending;
+    mqtt_data->pending = NULL;
+    mqtt_data->pending_tail = NULL;
+    mqtt_data->pending_size = 0;
+    return pending;
+}
+
+static void esp_mqtt_glue_send_pending(esp_mqtt_glue_pending_publish_t *pending)
+{
+    while (pending) {
+        esp_mqtt_glue_pending_publish_t *next = pending->next;
+        if (esp_mqtt_client_publish(mqtt_data->mqtt_client, pending->topic, pending->data,
+                    pending->data_len, 0, 0) < 0) {
+            ESP_LOGE(TAG, "MQTT Publish failed");
+        }
+        free(pending);
+        pending = next;
+    }
+}
+
+static void esp_mqtt_glue_free_pending(esp_mqtt_glue_pending_publish_t *pending)
+{
+    while (pending) {
+        esp_mqtt_glue_pending_publish_t *next = pending->next;
+        free(pending);
+        pending = next;
+    }
+}
+
+/* Sends the batch, from the work queue once the window is over */
+static void esp_mqtt_glue_flush_pending(void *priv_data)
+{
+    if (!mqtt_data) {
+        return;
+    }
+    xSemaphoreTake(mqtt_data->publish_lock, portMAX_DELAY);
+    esp_mqtt_glue_pending_publish_t *pending = esp_mqtt_glue_take_pending();
+    mqtt_data->flush_scheduled = false;
+    xSemaphoreGive(mqtt_data->publish_lock);
+    esp_mqtt_glue_send_pending(pending);
+}
+
+/* QoS 0 publishes are gathered for MQTT_PUBLISH_BATCH_WINDOW ms and sent together, so that the
+ * radio wakes up once for them. A publish with the same topic and data as a pending one is the
+ * same message and is dropped.
+ */
+static esp_err_t esp_mqtt_glue_publish_batched(const char *topic, void *data, size_t data_len)
+{
+    size_t topic_len = strlen(topic);
+    esp_mqtt_glue_pending_publish_t *sent = NULL;
+    esp_mqtt_glue_pending_publish_t *pending;
+
+    xSemaphoreTake(mqtt_data->publish_lock, portMAX_DELAY);
+    for (pending = mqtt_data->pending; pending; pending = pending->next) {
+        if (pending->data_len == data_len && memcmp(pending->data, data, data_len) == 0 &&
+                strcmp(pending->topic, topic) == 0) {
+            xSemaphoreGive(mqtt_data->publish_lock);
+            return ESP_OK;
         }
     }
-    return ESP_FAIL;
+    pending = malloc(sizeof(esp_mqtt_glue_pending_publish_t) + data_len + topic_len + 1);
+    if (!pending) {
+        xSemaphoreGive(mqtt_data->publish_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(pending->data, data, data_len);
+    pending->topic = pending->data + data_len;
+    memcpy(pending->topic, topic, topic_len + 1);
+    pending->data_len = data_len;
+    pending->next = NULL;
+    /* A full batch is sent now, without waiting for the window */
+    if (mqtt_data->pending_size + data_len > MQTT_PUBLISH_BATCH_SIZE) {
+        sent = esp_mqtt_glue_take_pending();
+    }
+    if (mqtt_data->pending_tail) {
+        mqtt_data->pending_tail->next = pending;
+    } else {
+        mqtt_data->pending = pending;
+    }
+    mqtt_data->pending_tail = pending;
+    mqtt_data->pending_size += data_len;
+    bool send_now = false;
+    if (!mqtt_data->flush_scheduled) {
+        if (esp_rmaker_work_queue_add_delayed_task(esp_mqtt_glue_flush_pending, NULL,
+                    MQTT_PUBLISH_BATCH_WINDOW) == ESP_OK) {
+            mqtt_data->flush_scheduled = true;
+        } else {
+            /* Nothing will send the batch later */
+            send_now = true;
+        }
+    }
+    xSemaphoreGive(mqtt_data->publish_lock);
+    esp_mqtt_glue_send_pending(sent);
+    if (send_now) {
+        esp_mqtt_glue_flush_pending(NULL);
+    }
+    return ESP_OK;
 }
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
 
 static esp_err_t esp_mqtt_glue_publish(const char *topic, void *data, size_t data_len, uint8_t qos, int *msg_id)
 {
     if (!mqtt_data || !topic || !data) {
         return ESP_FAIL;
     }
+#if MQTT_OUTBOX_LIMIT && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    /* Messages waiting for their acknowledgement are kept in the outbox. Past the limit, the
+     * publisher is told to retry later instead of the outbox growing without bound.
+     */
+    if (qos > 0) {
+        int outbox_size = esp_mqtt_client_get_outbox_size(mqtt_data->mqtt_client);
+        if (outbox_size > 0 && (size_t)outbox_size + data_len > MQTT_OUTBOX_LIMIT) {
+            ESP_LOGW(TAG, "MQTT outbox full, not publishing to %s", topic);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+#endif
     ESP_LOGD(TAG, "Publishing to %s", topic);
+#if MQTT_PUBLISH_BATCH_WINDOW
+    if (qos == 0 && data_len <= MQTT_PUBLISH_BATCH_SIZE) {
+        esp_err_t err = esp_mqtt_glue_publish_batched(topic, data, data_len);
+        if (err == ESP_OK && msg_id) {
+            /* As for any QoS 0 publish */
+            *msg_id = 0;
+        }
+        return err;
+    }
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
     int ret = esp_mqtt_client_publish(mqtt_data->mqtt_client, topic, data, data_len, qos, 0);
     if (ret < 0) {
         ESP_LOGE(TAG, "MQTT Publish failed");
@@ -173,52 +736,73 @@ static esp_err_t esp_mqtt_glue_publish(const char *topic, void *data, size_t dat
     return ESP_OK;
 }
 
-static esp_mqtt_glue_long_data_t *esp_mqtt_glue_free_long_data(esp_mqtt_glue_long_data_t *long_data)
+/* Ends the long message being received. Unless keep is false, the topic buffer is kept for the
+ * next one, and so is the data buffer if it is not larger than MQTT_REASSEMBLY_BUFFER_SIZE.
+ */
+static void esp_mqtt_glue_release_long_data(esp_mqtt_glue_long_data_t *long_data, bool keep)
 {
-    if (long_data) {
-        if (long_data->topic) {
-            free(long_data->topic);
-        }
-        if (long_data->data) {
-            free(long_data->data);
-        }
-        free(long_data);
+    long_data->in_progress = false;
+    if (!keep || long_data->data_size > MQTT_REASSEMBLY_BUFFER_SIZE) {
+        free(long_data->data);
+        long_data->data = NULL;
+        long_data->data_size = 0;
+    }
+    if (!keep) {
+        free(long_data->topic);
+        long_data->topic = NULL;
+        long_data->topic_size = 0;
     }
-    return NULL;
 }
 
-static esp_mqtt_glue_long_data_t *esp_mqtt_glue_manage_long_data(esp_mqtt_glue_long_data_t *long_data,
-        esp_mqtt_event_handle_t event)
+static void esp_mqtt_glue_manage_long_data(esp_mqtt_glue_long_data_t *long_data, esp_mqtt_event_handle_t event)
 {
     if (event->topic) {
-        /* This is new data. Free any earlier data, if present. */
-        esp_mqtt_glue_free_long_data(long_data);
-        long_data = calloc(1, sizeof(esp_mqtt_glue_long_data_t));
-        if (!long_data) {
-            ESP_LOGE(TAG, "Could not allocate memory for esp_mqtt_glue_long_data_t");
-            return NULL;
-        }
-        long_data->data = MEM_CALLOC_EXTRAM(1, event->total_data_len);
-        if (!long_data->data) {
-            ESP_LOGE(TAG, "Could not allocate %d bytes for received data.", event->total_data_len);
-            return esp_mqtt_glue_free_long_data(long_data);
+        /* This is new data. Drop any earlier data, if present. */
+        long_data->in_progress = false;
+        if (long_data->topic_size < (size_t)event->topic_len + 1) {
+            char *topic = realloc(long_data->topic, event->topic_len + 1);
+            if (!topic) {
+                ESP_LOGE(TAG, "Could not allocate %d bytes for received topic.", event->topic_len);
+                return;
+            }
+            long_data->topic = topic;
+            long_data->topic_size = event->topic_len + 1;
         }
-        long_data->topic = strndup(event->topic, event->topic_len);
-        if (!long_data->topic) {
-            ESP_LOGE(TAG, "Could not allocate %d bytes for received topic.", event->topic_len);
-            return esp_mqtt_glue_free_long_data(long_data);
+        memcpy(long_data->topic, event->topic, event->topic_len);
+        long_data->topic[event->topic_len] = '\0';
+        long_data->topic_len = event->topic_len;
+        /* The message is put together only for the subscriptions taking whole messages,
+         * the others get the fragments as they arrive.
+         */
+        long_data->whole_message = esp_mqtt_glue_needs_whole_message(event->topic, event->topic_len);
+        if (long_data->whole_message && long_data->data_size < (size_t)event->total_data_len) {
+            /* Nothing to keep from the smaller buffer, so no realloc */
+            free(long_data->data);
+            long_data->data_size = 0;
+            long_data->data = MEM_ALLOC_EXTRAM(event->total_data_len);
+            if (!long_data->data) {
+                ESP_LOGE(TAG, "Could not allocate %d bytes for received data.", event->total_data_len);
+                return;
+            }
+            long_data->data_size = event->total_data_len;
         }
+        long_data->in_progress = true;
+    }
+    if (!long_data->in_progress) {
+        return;
     }
-    if (long_data) {
+    esp_mqtt_glue_fragment_callback(long_data->topic, long_data->topic_len, event->data, event->data_len,
+            event->current_data_offset, event->total_data_len);
+    if (long_data->whole_message) {
         memcpy(long_data->data + event->current_data_offset, event->data, event->data_len);
-
-        if ((event->current_data_offset + event->data_len) == event->total_data_len) {
-            esp_mqtt_glue_subscribe_callback(long_data->topic, strlen(long_data->topic),
+    }
+    if ((event->current_data_offset + event->data_len) == event->total_data_len) {
+        if (long_data->whole_message) {
+            esp_mqtt_glue_subscribe_callback(long_data->topic, long_data->topic_len,
                         long_data->data, event->total_data_len);
-            return esp_mqtt_glue_free_long_data(long_data);
         }
+        esp_mqtt_glue_release_long_data(long_data, true);
     }
-    return long_data;
 }
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -235,13 +819,17 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 
     switch (event_id) {
         case MQTT_EVENT_CONNECTED:
+#ifdef CONFIG_ESP_RMAKER_MQTT_PERSISTENT_SESSION
+            /* The broker kept the session, and the subscriptions with it */
+            if (event->session_present) {
+                ESP_LOGI(TAG, "MQTT Connected, session restored");
+                esp_event_post(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_CONNECTED, NULL, 0, portMAX_DELAY);
+                break;
+            }
+#endif /* CONFIG_ESP_RMAKER_MQTT_PERSISTENT_SESSION */
             ESP_LOGI(TAG, "MQTT Connected");
             /* Resubscribe to all topics after reconnection */
-            for (int i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-                if (mqtt_data->subscriptions[i]) {
-                    esp_mqtt_client_subscribe(event->client, mqtt_data->subscriptions[i]->topic, 1);
-                }
-            }
+            esp_mqtt_glue_resubscribe_all(event->client);
             esp_event_post(RMAKER_COMMON_EVENT, RMAKER_MQTT_EVENT_CONNECTED, NULL, 0, portMAX_DELAY);
             break;
         case MQTT_EVENT_DISCONNECTED:
@@ -267,22 +855,23 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event)
 #endif /* CONFIG_MQTT_REPORT_DELETED_MESSAGES */
         case MQTT_EVENT_DATA: {
             ESP_LOGD(TAG, "MQTT_EVENT_DATA");
-            static esp_mqtt_glue_long_data_t *long_data;
             /* Topic can be NULL, for data longer than the MQTT buffer */
             if (event->topic) {
                 ESP_LOGD(TAG, "TOPIC=%.*s\r\n", event->topic_len, event->topic);
             }
             ESP_LOGD(TAG, "DATA=%.*s\r\n", event->data_len, event->data);
             if (event->data_len == event->total_data_len) {
-                /* If long_data still exists, it means there was some issue getting the
-                 * long data, and so, it needs to be freed up.
+                /* If long data is still in progress, it means there was some issue getting it,
+                 * and so, it needs to be dropped.
                  */
-                if (long_data) {
-                    long_data = esp_mqtt_glue_free_long_data(long_data);
+                if (mqtt_data->long_data.in_progress) {
+                    esp_mqtt_glue_release_long_data(&mqtt_data->long_data, true);
                 }
+                esp_mqtt_glue_fragment_callback(event->topic, event->topic_len, event->data, event->data_len,
+                        0, event->total_data_len);
                 esp_mqtt_glue_subscribe_callback(event->topic, event->topic_len, event->data, event->data_len);
             } else {
-                long_data = esp_mqtt_glue_manage_long_data(long_data, event);
+                esp_mqtt_glue_manage_long_data(&mqtt_data->long_data, event);
             }
             break;
         }
@@ -312,17 +901,34 @@ static esp_err_t esp_mqtt_glue_connect(void)
     return ESP_OK;
 }
 
-static void esp_mqtt_glue_unsubscribe_all(void)
+/* Unsubscribes and frees the subscriptions under node, and the nodes below it */
+static void esp_mqtt_glue_unsubscribe_node(esp_mqtt_glue_topic_node_t *node)
 {
-    if (!mqtt_data) {
-        return;
+    while (node->children) {
+        esp_mqtt_glue_topic_node_t *child = node->children;
+        node->children = child->next;
+        esp_mqtt_glue_unsubscribe_node(child);
+        free(child);
     }
-    int i;
-    for (i = 0; i < MAX_MQTT_SUBSCRIPTIONS; i++) {
-        if (mqtt_data->subscriptions[i]) {
-            unsubscribe_helper(&(mqtt_data->subscriptions[i]));
+    while (node->subscriptions) {
+        esp_mqtt_glue_subscription_t *subscription = node->subscriptions;
+        node->subscriptions = subscription->next;
+        if (!subscription->removed) {
+            if (esp_mqtt_client_unsubscribe(mqtt_data->mqtt_client, subscription->topic) < 0) {
+                ESP_LOGW(TAG, "Could not unsubscribe from topic: %s", subscription->topic);
+            }
         }
+        esp_mqtt_glue_subscription_free(subscription);
+    }
+}
+
+static void esp_mqtt_glue_unsubscribe_all(void)
+{
+    if (!mqtt_data || !mqtt_data->topics) {
+        return;
     }
+    esp_mqtt_glue_unsubscribe_node(mqtt_data->topics);
+    mqtt_data->subscription_cnt = 0;
 }
 
 static esp_err_t esp_mqtt_glue_disconnect(void)
@@ -363,6 +969,20 @@ static esp_err_t esp_mqtt_glue_init(esp_rmaker_mqtt_conn_params_t *conn_params)
         return ESP_ERR_NO_MEM;
     }
     mqtt_data->conn_params = conn_params;
+    mqtt_data->topics = esp_mqtt_glue_topic_node_new(NULL, "", 0);
+    if (!mqtt_data->topics) {
+        ESP_LOGE(TAG, "Failed to allocate memory for the topics");
+        esp_mqtt_glue_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+#if MQTT_PUBLISH_BATCH_WINDOW
+    mqtt_data->publish_lock = xSemaphoreCreateMutex();
+    if (!mqtt_data->publish_lock) {
+        ESP_LOGE(TAG, "Failed to create the publish lock");
+        esp_mqtt_glue_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
     const esp_mqtt_client_config_t mqtt_client_cfg = {
@@ -458,6 +1078,15 @@ static void esp_mqtt_glue_deinit(void)
         esp_mqtt_client_destroy(mqtt_data->mqtt_client);
     }
     if (mqtt_data) {
+#if MQTT_PUBLISH_BATCH_WINDOW
+        /* Pending QoS 0 publishes are dropped, as when the connection is lost */
+        esp_mqtt_glue_free_pending(mqtt_data->pending);
+        if (mqtt_data->publish_lock) {
+            vSemaphoreDelete(mqtt_data->publish_lock);
+        }
+#endif /* MQTT_PUBLISH_BATCH_WINDOW */
+        esp_mqtt_glue_release_long_data(&mqtt_data->long_data, false);
+        free(mqtt_data->topics);
         free(mqtt_data);
         mqtt_data = NULL;
     }
@@ -472,6 +1101,7 @@ esp_err_t esp_rmaker_mqtt_glue_setup(esp_rmaker_mqtt_config_t *mqtt_config)
     mqtt_config->publish        = esp_mqtt_glue_publish;
     mqtt_config->subscribe      = esp_mqtt_glue_subscribe;
     mqtt_config->unsubscribe    = esp_mqtt_glue_unsubscribe;
+    mqtt_config->subscribe_fragments = esp_mqtt_glue_subscribe_fragments;
     mqtt_config->setup_done     = true;
     return ESP_OK;
 }
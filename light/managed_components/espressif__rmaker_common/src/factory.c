@@ -12,10 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <string.h>
+#include <stdlib.h>
 #include <esp_log.h>
 #include <nvs_flash.h>
 #include <nvs.h>
+#include <esp_idf_version.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_rmaker_utils.h>
+#include <esp_rmaker_factory.h>
 #include <esp_partition.h>
 
 static const char *TAG = "esp_rmaker_fctry";
@@ -23,6 +28,154 @@ static const char *TAG = "esp_rmaker_fctry";
 #define RMAKER_FACTORY_NAMESPACE    CONFIG_ESP_RMAKER_FACTORY_NAMESPACE
 #define RMAKER_FACTORY_PART         CONFIG_ESP_RMAKER_FACTORY_PARTITION_NAME        
 
+#ifdef CONFIG_ESP_RMAKER_FACTORY_CACHE
+typedef struct {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t offset;
+    size_t size;
+} esp_rmaker_factory_entry_t;
+
+/* All the blobs of the factory namespace, read once. The entries, sorted by key, are followed
+ * in the same allocation by the values, each followed by a NULL byte.
+ */
+typedef struct {
+    int count;
+    uint8_t *values;
+    esp_rmaker_factory_entry_t entries[];
+} esp_rmaker_factory_cache_t;
+
+static esp_rmaker_factory_cache_t *s_factory_cache;
+static SemaphoreHandle_t s_factory_cache_lock;
+
+/* Iterate over the blobs of the factory namespace, with the iterator API of ESP-IDF v5.0 and older */
+static nvs_iterator_t esp_rmaker_factory_first_blob(void)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    nvs_iterator_t it = NULL;
+    if (nvs_entry_find(RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE, NVS_TYPE_BLOB, &it) != ESP_OK) {
+        nvs_release_iterator(it);
+        return NULL;
+    }
+    return it;
+#else
+    return nvs_entry_find(RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE, NVS_TYPE_BLOB);
+#endif
+}
+
+static nvs_iterator_t esp_rmaker_factory_next_blob(nvs_iterator_t it)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    if (nvs_entry_next(&it) != ESP_OK) {
+        nvs_release_iterator(it);
+        return NULL;
+    }
+    return it;
+#else
+    return nvs_entry_next(it);
+#endif
+}
+
+static int esp_rmaker_factory_entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const esp_rmaker_factory_entry_t *)a)->key, ((const esp_rmaker_factory_entry_t *)b)->key);
+}
+
+/* Read the whole namespace: a first pass for the sizes, so that all of it goes in one allocation */
+static esp_rmaker_factory_cache_t *esp_rmaker_factory_cache_load(void)
+{
+    nvs_handle handle;
+    esp_err_t err;
+    if ((err = nvs_open_from_partition(RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE,
+                                NVS_READONLY, &handle)) != ESP_OK) {
+        ESP_LOGD(TAG, "NVS open for %s %s failed with error %d", RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE, err);
+        return NULL;
+    }
+    int count = 0;
+    size_t values_size = 0;
+    nvs_iterator_t it;
+    for (it = esp_rmaker_factory_first_blob(); it; it = esp_rmaker_factory_next_blob(it)) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        size_t size = 0;
+        if (nvs_get_blob(handle, info.key, NULL, &size) == ESP_OK) {
+            count++;
+            values_size += size + 1; /* + 1 for NULL termination */
+        }
+    }
+    size_t entries_size = sizeof(esp_rmaker_factory_cache_t) + count * sizeof(esp_rmaker_factory_entry_t);
+    esp_rmaker_factory_cache_t *cache = MEM_CALLOC_EXTRAM(1, entries_size + values_size);
+    if (!cache) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for factory data", entries_size + values_size);
+        nvs_close(handle);
+        return NULL;
+    }
+    cache->values = (uint8_t *)cache + entries_size;
+    size_t offset = 0;
+    for (it = esp_rmaker_factory_first_blob(); it; it = esp_rmaker_factory_next_blob(it)) {
+        esp_rmaker_factory_entry_t *entry = &cache->entries[cache->count];
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        size_t size = 0;
+        if (cache->count == count || nvs_get_blob(handle, info.key, NULL, &size) != ESP_OK ||
+                offset + size + 1 > values_size) {
+            continue;
+        }
+        if (nvs_get_blob(handle, info.key, cache->values + offset, &size) != ESP_OK) {
+            continue;
+        }
+        strncpy(entry->key, info.key, sizeof(entry->key) - 1);
+        entry->offset = offset;
+        entry->size = size;
+        offset += size + 1;
+        cache->count++;
+    }
+    nvs_close(handle);
+    qsort(cache->entries, cache->count, sizeof(esp_rmaker_factory_entry_t), esp_rmaker_factory_entry_cmp);
+    ESP_LOGD(TAG, "Read %d factory values, %d bytes", cache->count, offset);
+    return cache;
+}
+
+static const esp_rmaker_factory_entry_t *esp_rmaker_factory_cache_find(const char *key)
+{
+    if (!s_factory_cache_lock) {
+        return NULL;
+    }
+    xSemaphoreTake(s_factory_cache_lock, portMAX_DELAY);
+    if (!s_factory_cache) {
+        s_factory_cache = esp_rmaker_factory_cache_load();
+    }
+    esp_rmaker_factory_cache_t *cache = s_factory_cache;
+    xSemaphoreGive(s_factory_cache_lock);
+    /* Longer keys cannot be in NVS */
+    if (!cache || !key || strnlen(key, NVS_KEY_NAME_MAX_SIZE) == NVS_KEY_NAME_MAX_SIZE) {
+        return NULL;
+    }
+    esp_rmaker_factory_entry_t needle = {0};
+    strcpy(needle.key, key);
+    return bsearch(&needle, cache->entries, cache->count, sizeof(esp_rmaker_factory_entry_t),
+            esp_rmaker_factory_entry_cmp);
+}
+
+const void *esp_rmaker_factory_get_view(const char *key, size_t *len)
+{
+    const esp_rmaker_factory_entry_t *entry = esp_rmaker_factory_cache_find(key);
+    if (!entry) {
+        ESP_LOGD(TAG, "Failed to read key %s", key);
+        return NULL;
+    }
+    if (len) {
+        *len = entry->size;
+    }
+    return s_factory_cache->values + entry->offset;
+}
+#else
+const void *esp_rmaker_factory_get_view(const char *key, size_t *len)
+{
+    ESP_LOGE(TAG, "Views of factory values need CONFIG_ESP_RMAKER_FACTORY_CACHE");
+    return NULL;
+}
+#endif /* !CONFIG_ESP_RMAKER_FACTORY_CACHE */
+
 esp_err_t esp_rmaker_factory_init(void)
 {
     static bool esp_rmaker_storage_init_done;
@@ -54,14 +207,34 @@ esp_err_t esp_rmaker_factory_init(void)
 #endif
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "NVS Flash init failed");
-    } else {
-        esp_rmaker_storage_init_done = true;
+        return err;
     }
+#ifdef CONFIG_ESP_RMAKER_FACTORY_CACHE
+    s_factory_cache_lock = xSemaphoreCreateMutex();
+    if (!s_factory_cache_lock) {
+        ESP_LOGE(TAG, "Failed to create factory cache lock");
+        return ESP_ERR_NO_MEM;
+    }
+#endif /* CONFIG_ESP_RMAKER_FACTORY_CACHE */
+    esp_rmaker_storage_init_done = true;
     return err;
 }
 
 void *esp_rmaker_factory_get(const char *key)
 {
+#ifdef CONFIG_ESP_RMAKER_FACTORY_CACHE
+    size_t len = 0;
+    const void *view = esp_rmaker_factory_get_view(key, &len);
+    if (!view) {
+        return NULL;
+    }
+    void *copy = MEM_ALLOC_EXTRAM(len + 1);
+    if (copy) {
+        /* With the NULL termination */
+        memcpy(copy, view, len + 1);
+    }
+    return copy;
+#else
     nvs_handle handle;
     esp_err_t err;
     if ((err = nvs_open_from_partition(RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE,
@@ -81,10 +254,16 @@ void *esp_rmaker_factory_get(const char *key)
     }
     nvs_close(handle);
     return value;
+#endif /* !CONFIG_ESP_RMAKER_FACTORY_CACHE */
 }
 
 size_t esp_rmaker_factory_get_size(const char *key)
 {
+#ifdef CONFIG_ESP_RMAKER_FACTORY_CACHE
+    size_t len = 0;
+    esp_rmaker_factory_get_view(key, &len);
+    return len;
+#else
     nvs_handle handle;
     esp_err_t err;
     if ((err = nvs_open_from_partition(RMAKER_FACTORY_PART, RMAKER_FACTORY_NAMESPACE,
@@ -98,6 +277,7 @@ size_t esp_rmaker_factory_get_size(const char *key)
     }
     nvs_close(handle);
     return required_size;
+#endif /* !CONFIG_ESP_RMAKER_FACTORY_CACHE */
 }
 
 esp_err_t esp_rmaker_factory_set(const char *key, void *value, size_t len)
@@ -116,5 +296,14 @@ esp_err_t esp_rmaker_factory_set(const char *key, void *value, size_t len)
     }
     nvs_commit(handle);
     nvs_close(handle);
+#ifdef CONFIG_ESP_RMAKER_FACTORY_CACHE
+    /* Read again on the next get */
+    if (s_factory_cache_lock) {
+        xSemaphoreTake(s_factory_cache_lock, portMAX_DELAY);
+        free(s_factory_cache);
+        s_factory_cache = NULL;
+        xSemaphoreGive(s_factory_cache_lock);
+    }
+#endif /* CONFIG_ESP_RMAKER_FACTORY_CACHE */
     return ESP_OK;
 }
@@ -23,6 +23,8 @@
 #define ESP_RMAKER_TASK_QUEUE_SIZE           8
 #define ESP_RMAKER_TASK_STACK       CONFIG_ESP_RMAKER_WORK_QUEUE_TASK_STACK
 #define ESP_RMAKER_TASK_PRIORITY    CONFIG_ESP_RMAKER_WORK_QUEUE_TASK_PRIORITY
+#define ESP_RMAKER_TASK_AFFINITY    CONFIG_ESP_RMAKER_WORK_QUEUE_TASK_AFFINITY
+#define ESP_RMAKER_MAX_DELAYED_TASKS    CONFIG_ESP_RMAKER_WORK_QUEUE_MAX_DELAYED_TASKS
 
 static const char *TAG = "esp_rmaker_work_queue";
 
@@ -38,17 +40,110 @@ typedef struct {
     void *priv_data;
 } esp_rmaker_work_queue_entry_t;
 
-static QueueHandle_t work_queue;
+typedef struct {
+    TickType_t due;
+    esp_rmaker_work_queue_entry_t entry;
+} esp_rmaker_delayed_work_t;
+
+/* One queue per priority, the higher ones drained first */
+static QueueHandle_t work_queue[ESP_RMAKER_WORK_QUEUE_PRIO_MAX];
 static esp_rmaker_work_queue_state_t queue_state;
+static TaskHandle_t work_queue_task;
+
+/* Delayed work, a binary min-heap on the due tick */
+static esp_rmaker_delayed_work_t delayed_work[ESP_RMAKER_MAX_DELAYED_TASKS];
+static int delayed_work_cnt;
+static portMUX_TYPE delayed_work_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline bool esp_rmaker_tick_before(TickType_t a, TickType_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/* Caller holds delayed_work_lock */
+static void esp_rmaker_delayed_work_push(const esp_rmaker_delayed_work_t *work)
+{
+    int i = delayed_work_cnt++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!esp_rmaker_tick_before(work->due, delayed_work[parent].due)) {
+            break;
+        }
+        delayed_work[i] = delayed_work[parent];
+        i = parent;
+    }
+    delayed_work[i] = *work;
+}
+
+/* Caller holds delayed_work_lock */
+static void esp_rmaker_delayed_work_pop(void)
+{
+    esp_rmaker_delayed_work_t last = delayed_work[--delayed_work_cnt];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= delayed_work_cnt) {
+            break;
+        }
+        if (child + 1 < delayed_work_cnt && esp_rmaker_tick_before(delayed_work[child + 1].due, delayed_work[child].due)) {
+            child++;
+        }
+        if (!esp_rmaker_tick_before(delayed_work[child].due, last.due)) {
+            break;
+        }
+        delayed_work[i] = delayed_work[child];
+        i = child;
+    }
+    delayed_work[i] = last;
+}
+
+/* Moves the delayed work which is due to the normal priority queue, and returns
+ * the ticks until the next one is due.
+ */
+static TickType_t esp_rmaker_handle_delayed_work(void)
+{
+    while (1) {
+        taskENTER_CRITICAL(&delayed_work_lock);
+        if (!delayed_work_cnt) {
+            taskEXIT_CRITICAL(&delayed_work_lock);
+            return portMAX_DELAY;
+        }
+        TickType_t now = xTaskGetTickCount();
+        if (esp_rmaker_tick_before(now, delayed_work[0].due)) {
+            TickType_t wait = delayed_work[0].due - now;
+            taskEXIT_CRITICAL(&delayed_work_lock);
+            return wait;
+        }
+        esp_rmaker_work_queue_entry_t entry = delayed_work[0].entry;
+        esp_rmaker_delayed_work_pop();
+        taskEXIT_CRITICAL(&delayed_work_lock);
+        if (xQueueSend(work_queue[ESP_RMAKER_WORK_QUEUE_PRIO_NORMAL], &entry, 0) != pdTRUE) {
+            /* Due already, so rather run it now than wait for room in the queue */
+            entry.work_fn(entry.priv_data);
+        }
+    }
+}
 
 static void esp_rmaker_handle_work_queue(void)
 {
     esp_rmaker_work_queue_entry_t work_queue_entry;
-    /* 2 sec delay to prevent spinning */
-    BaseType_t ret = xQueueReceive(work_queue, &work_queue_entry, 2000 / portTICK_PERIOD_MS);
-    while (ret == pdTRUE) {
-        work_queue_entry.work_fn(work_queue_entry.priv_data);
-        ret = xQueueReceive(work_queue, &work_queue_entry, 0);
+    TickType_t wait = esp_rmaker_handle_delayed_work();
+    for (int prio = 0; prio < ESP_RMAKER_WORK_QUEUE_PRIO_MAX; prio++) {
+        if (xQueueReceive(work_queue[prio], &work_queue_entry, 0) == pdTRUE) {
+            /* A single entry, so that more urgent work queued meanwhile goes next */
+            work_queue_entry.work_fn(work_queue_entry.priv_data);
+            return;
+        }
+    }
+    /* Nothing to do until some work is queued, some delayed work is due or a stop is requested */
+    ulTaskNotifyTake(pdTRUE, wait);
+}
+
+static void esp_rmaker_work_queue_notify(void)
+{
+    TaskHandle_t task = work_queue_task;
+    if (task) {
+        xTaskNotifyGive(task);
     }
 }
 
@@ -59,13 +154,18 @@ static void esp_rmaker_work_queue_task(void *param)
         esp_rmaker_handle_work_queue();
     }
     ESP_LOGI(TAG, "Stopping Work Queue task");
+    work_queue_task = NULL;
     queue_state = WORK_QUEUE_STATE_INIT_DONE;
     vTaskDelete(NULL);
 }
 
-esp_err_t esp_rmaker_work_queue_add_task(esp_rmaker_work_fn_t work_fn, void *priv_data)
+esp_err_t esp_rmaker_work_queue_add_task_with_prio(esp_rmaker_work_fn_t work_fn, void *priv_data,
+        esp_rmaker_work_queue_prio_t prio)
 {
-    if (!work_queue) {
+    if ((unsigned) prio >= ESP_RMAKER_WORK_QUEUE_PRIO_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!work_queue[prio]) {
         ESP_LOGE(TAG, "Cannot enqueue function as Work Queue hasn't been created.");
         return ESP_ERR_INVALID_STATE;
     }
@@ -73,22 +173,74 @@ esp_err_t esp_rmaker_work_queue_add_task(esp_rmaker_work_fn_t work_fn, void *pri
         .work_fn = work_fn,
         .priv_data = priv_data,
     };
-    if (xQueueSend(work_queue, &work_queue_entry, 0) == pdTRUE) {
+    if (xQueueSend(work_queue[prio], &work_queue_entry, 0) == pdTRUE) {
+        esp_rmaker_work_queue_notify();
         return ESP_OK;
     }
     return ESP_FAIL;
 }
 
+esp_err_t esp_rmaker_work_queue_add_task(esp_rmaker_work_fn_t work_fn, void *priv_data)
+{
+    return esp_rmaker_work_queue_add_task_with_prio(work_fn, priv_data, ESP_RMAKER_WORK_QUEUE_PRIO_NORMAL);
+}
+
+esp_err_t esp_rmaker_work_queue_add_delayed_task(esp_rmaker_work_fn_t work_fn, void *priv_data, uint32_t delay_ms)
+{
+    if (!work_queue[ESP_RMAKER_WORK_QUEUE_PRIO_NORMAL]) {
+        ESP_LOGE(TAG, "Cannot enqueue function as Work Queue hasn't been created.");
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_rmaker_delayed_work_t work = {
+        .due = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms),
+        .entry = {
+            .work_fn = work_fn,
+            .priv_data = priv_data,
+        },
+    };
+    esp_err_t err = ESP_OK;
+    taskENTER_CRITICAL(&delayed_work_lock);
+    if (delayed_work_cnt < ESP_RMAKER_MAX_DELAYED_TASKS) {
+        esp_rmaker_delayed_work_push(&work);
+    } else {
+        err = ESP_ERR_NO_MEM;
+    }
+    taskEXIT_CRITICAL(&delayed_work_lock);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot add more than %d delayed functions.", ESP_RMAKER_MAX_DELAYED_TASKS);
+        return err;
+    }
+    /* The task picks the wait until the earliest delayed work again */
+    esp_rmaker_work_queue_notify();
+    return ESP_OK;
+}
+
+static void esp_rmaker_work_queue_delete(void)
+{
+    for (int prio = 0; prio < ESP_RMAKER_WORK_QUEUE_PRIO_MAX; prio++) {
+        if (work_queue[prio]) {
+            vQueueDelete(work_queue[prio]);
+            work_queue[prio] = NULL;
+        }
+    }
+    taskENTER_CRITICAL(&delayed_work_lock);
+    delayed_work_cnt = 0;
+    taskEXIT_CRITICAL(&delayed_work_lock);
+}
+
 esp_err_t esp_rmaker_work_queue_init(void)
 {
     if (queue_state != WORK_QUEUE_STATE_DEINIT) {
         ESP_LOGW(TAG, "Work Queue already initialiased/started.");
         return ESP_OK;
     }
-    work_queue = xQueueCreate(ESP_RMAKER_TASK_QUEUE_SIZE, sizeof(esp_rmaker_work_queue_entry_t));
-    if (!work_queue) {
-        ESP_LOGE(TAG, "Failed to create Work Queue.");
-        return ESP_FAIL;
+    for (int prio = 0; prio < ESP_RMAKER_WORK_QUEUE_PRIO_MAX; prio++) {
+        work_queue[prio] = xQueueCreate(ESP_RMAKER_TASK_QUEUE_SIZE, sizeof(esp_rmaker_work_queue_entry_t));
+        if (!work_queue[prio]) {
+            ESP_LOGE(TAG, "Failed to create Work Queue.");
+            esp_rmaker_work_queue_delete();
+            return ESP_FAIL;
+        }
     }
     ESP_LOGI(TAG, "Work Queue created.");
     queue_state = WORK_QUEUE_STATE_INIT_DONE;
@@ -112,8 +264,7 @@ esp_err_t esp_rmaker_work_queue_deinit(void)
         ESP_LOGE(TAG, "Cannot deinitialize Work Queue as the task is still running.");
         return ESP_ERR_INVALID_STATE;
     } else {
-        vQueueDelete(work_queue);
-        work_queue = NULL;
+        esp_rmaker_work_queue_delete();
         queue_state = WORK_QUEUE_STATE_DEINIT;
     }
     ESP_LOGI(TAG, "esp_rmaker_work_queue was successfully deinitialized");
@@ -130,12 +281,14 @@ esp_err_t esp_rmaker_work_queue_start(void)
         ESP_LOGE(TAG, "Failed to start Work Queue as it wasn't initialized.");
         return ESP_ERR_INVALID_STATE;
     }
-    if (xTaskCreate(&esp_rmaker_work_queue_task, "rmaker_queue_task", ESP_RMAKER_TASK_STACK,
-                NULL, ESP_RMAKER_TASK_PRIORITY, NULL) != pdPASS) {
+    /* Running before setting the task, so that it does not stop at once */
+    queue_state = WORK_QUEUE_STATE_RUNNING;
+    if (xTaskCreatePinnedToCore(&esp_rmaker_work_queue_task, "rmaker_queue_task", ESP_RMAKER_TASK_STACK,
+                NULL, ESP_RMAKER_TASK_PRIORITY, &work_queue_task, ESP_RMAKER_TASK_AFFINITY) != pdPASS) {
+        queue_state = WORK_QUEUE_STATE_INIT_DONE;
         ESP_LOGE(TAG, "Couldn't create RainMaker work queue task");
         return ESP_FAIL;
     }
-    queue_state = WORK_QUEUE_STATE_RUNNING;
     return ESP_OK;
 }
 
@@ -143,6 +296,8 @@ esp_err_t esp_rmaker_work_queue_stop(void)
 {
     if (queue_state == WORK_QUEUE_STATE_RUNNING) {
         queue_state = WORK_QUEUE_STATE_STOP_REQUESTED;
+        /* Wake the task up, it does not poll */
+        esp_rmaker_work_queue_notify();
     }
     return ESP_OK;
 }
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+#
+# SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: Apache-2.0
+
+# Checks that the functions of the real-time paths, listed in hot_path.csv, stay out of flash. They run from
+# interrupts which keep running while the flash is written (OTA, NVS), a function in flash then stalls or crashes
+# them and the LED output glitches.
+#
+# --function checks the function.csv of the relinker, which moves the functions it lists from IRAM to flash.
+# --elf checks the section each function is linked to in the application.
+
+import argparse
+import csv
+import os
+import re
+import subprocess
+import sys
+
+OPT_MIN_LEN = 7
+
+
+class sdkconfig_c:
+    def __init__(self, path):
+        self.config = dict()
+        if path is None:
+            self.config = None
+            return
+        for l in open(path).read().splitlines():
+            if len(l) > OPT_MIN_LEN and l[0] != '#':
+                mo = re.match(r'(.*)=(.*)', l)
+                if mo:
+                    self.config[mo.group(1)] = mo.group(2).replace('"', '')
+
+    # Same syntax as the option of the relinker function.csv, options joined by && and negated by !
+    def check(self, options):
+        options = (options or '').replace(' ', '')
+        if not options:
+            return True
+        if options == 'FALSE':
+            return False
+        if self.config is None:
+            # Without a sdkconfig, every entry counts
+            return True
+        for i in options.split('&&'):
+            if i[0] == '!':
+                if i[1:] in self.config:
+                    return False
+            elif i not in self.config:
+                return False
+        return True
+
+
+def read_csv(path, sdkconfig):
+    with open(path) as f:
+        return [row for row in csv.DictReader(f) if sdkconfig.check(row['option'])]
+
+
+def check_function_csv(hot_path, path, sdkconfig):
+    relinked = dict((row['function'], row) for row in read_csv(path, sdkconfig))
+    errors = 0
+    for row in hot_path:
+        if row['function'] in relinked:
+            print('error: %s (%s) is moved to flash by %s' % (row['function'], row['object'], path))
+            errors += 1
+    return errors
+
+
+def read_elf_sections(elf, objdump):
+    env = os.environ.copy()
+    env['LC_ALL'] = 'C'
+    dump = subprocess.check_output([objdump, '-t', elf], env=env).decode()
+    sections = dict()
+    for l in dump.splitlines():
+        # 42000020 l     F .flash.text	0000004a rmt_encode_led_strip
+        m = re.match(r'^[0-9a-fA-F]+\s.*\sF\s+(\S+)\s+[0-9a-fA-F]+\s+(\S+)$', l)
+        if m:
+            sections.setdefault(m.group(2), set()).add(m.group(1))
+    return sections
+
+
+def check_elf(hot_path, elf, objdump, verbose):
+    sections = read_elf_sections(elf, objdump)
+    errors = 0
+    for row in hot_path:
+        found = sections.get(row['function'])
+        if not found:
+            # Not used by this build, or inlined in its caller
+            if verbose:
+                print('%s (%s) is not linked' % (row['function'], row['object']))
+            continue
+        in_flash = sorted(s for s in found if s.startswith('.flash'))
+        if in_flash:
+            print('error: %s (%s) is linked to %s' % (row['function'], row['object'], ', '.join(in_flash)))
+            errors += 1
+        elif verbose:
+            print('%s (%s) is linked to %s' % (row['function'], row['object'], ', '.join(sorted(found))))
+    return errors
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check that the functions of the real-time paths are not in flash')
+    parser.add_argument('--hot-path', required=True, help='csv of the functions which must stay out of flash')
+    parser.add_argument('--sdkconfig', help='sdkconfig of the build, the options of the csv are evaluated against it')
+    parser.add_argument('--function', help='function.csv of the relinker')
+    parser.add_argument('--elf', help='application elf')
+    parser.add_argument('--objdump', default='objdump', help='objdump of the toolchain')
+    parser.add_argument('--verbose', action='store_true', help='print where every function is linked')
+    args = parser.parse_args()
+
+    sdkconfig = sdkconfig_c(args.sdkconfig)
+    hot_path = read_csv(args.hot_path, sdkconfig)
+    errors = 0
+    if args.function:
+        errors += check_function_csv(hot_path, args.function, sdkconfig)
+    if args.elf:
+        errors += check_elf(hot_path, args.elf, args.objdump, args.verbose)
+    if errors:
+        print('%d function(s) of the real-time paths are in flash, they stall while the flash is written. '
+              'Keep them in IRAM, see %s' % (errors, args.hot_path))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,469 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/*
+ * Light driver benchmark -- replays a trace of attribute updates and commands through the driver
+ *
+ * The trace runs on a virtual clock, with the commit, transition and report timers of the driver firing at the times
+ * they would on the device, so the coalescing of the writes is the same as on the device. The host time taken by the
+ * replay gives the cost of an update, on glibc the heap functions are interposed to count the allocations.
+ *
+ * Trace format, one event per line, `#` starts a comment:
+ *
+ *   lights <count>                              number of light endpoints, 1 to 16, before the first event
+ *   <time_ms> <endpoint|*> on_off <0|1>         attribute writes, as the cluster servers make them
+ *   <time_ms> <endpoint|*> level <0-254>
+ *   <time_ms> <endpoint|*> hue <0-254>
+ *   <time_ms> <endpoint|*> saturation <0-254>
+ *   <time_ms> <endpoint|*> temperature <mireds>
+ *   <time_ms> <endpoint|*> transition <flags> <level> <hue> <saturation> <duration_ms>
+ *   <time_ms> <endpoint|*> group <on|off|toggle|level> [level]    group command, fast path then server update
+ *   <time_ms> <endpoint|*> store <group_id> <scene_id>
+ *   <time_ms> <endpoint|*> recall <group_id> <scene_id>
+ *   <time_ms> <endpoint|*> button
+ *
+ * The light endpoints are 1 to count, `*` is all of them.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#endif
+
+#include <esp_matter.h>
+
+#include <app_priv.h>
+
+#include "esp32_mock.h"
+
+using namespace chip::app::Clusters;
+
+#define BENCH_DEFAULT_ITERATIONS 100
+#define BENCH_MAX_LINE           256
+#define BENCH_IDLE_MS            10000   /* Longest a transition may still run after the last event */
+
+typedef enum {
+    BENCH_OP_ON_OFF,
+    BENCH_OP_LEVEL,
+    BENCH_OP_HUE,
+    BENCH_OP_SATURATION,
+    BENCH_OP_TEMPERATURE,
+    BENCH_OP_TRANSITION,
+    BENCH_OP_GROUP_ON,
+    BENCH_OP_GROUP_OFF,
+    BENCH_OP_GROUP_TOGGLE,
+    BENCH_OP_GROUP_LEVEL,
+    BENCH_OP_STORE,
+    BENCH_OP_RECALL,
+    BENCH_OP_BUTTON,
+} bench_op_t;
+
+typedef struct {
+    int64_t time_us;
+    uint16_t endpoint_id;       /* 0 for all the lights */
+    bench_op_t op;
+    uint32_t args[5];
+} bench_event_t;
+
+static bench_event_t *s_events = NULL;
+static size_t s_events_count = 0;
+static size_t s_events_size = 0;
+static int s_lights_count = 1;
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static bool s_heap_counting = false;
+static size_t s_alloc_count = 0;
+static size_t s_heap_used = 0;
+static size_t s_heap_peak = 0;
+
+static void heap_account(void *ptr)
+{
+    if (ptr && s_heap_counting) {
+        s_alloc_count++;
+        s_heap_used += malloc_usable_size(ptr);
+        if (s_heap_used > s_heap_peak) {
+            s_heap_peak = s_heap_used;
+        }
+    }
+}
+
+static void heap_release(void *ptr)
+{
+    if (ptr && s_heap_counting) {
+        size_t size = malloc_usable_size(ptr);
+        s_heap_used = size < s_heap_used ? s_heap_used - size : 0;
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_account(ptr);
+    return ptr;
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+    heap_account(ptr);
+    return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    heap_release(ptr);
+    void *new_ptr = __libc_realloc(ptr, size);
+    heap_account(new_ptr);
+    return new_ptr;
+}
+
+extern "C" void free(void *ptr)
+{
+    heap_release(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool bench_add_event(const bench_event_t *event)
+{
+    if (s_events_count == s_events_size) {
+        size_t size = s_events_size ? s_events_size * 2 : 256;
+        bench_event_t *events = (bench_event_t *)realloc(s_events, size * sizeof(bench_event_t));
+        if (!events) {
+            return false;
+        }
+        s_events = events;
+        s_events_size = size;
+    }
+    s_events[s_events_count++] = *event;
+    return true;
+}
+
+static const struct {
+    const char *name;
+    bench_op_t op;
+    int args;
+} s_ops[] = {
+    {"on_off", BENCH_OP_ON_OFF, 1},
+    {"level", BENCH_OP_LEVEL, 1},
+    {"hue", BENCH_OP_HUE, 1},
+    {"saturation", BENCH_OP_SATURATION, 1},
+    {"temperature", BENCH_OP_TEMPERATURE, 1},
+    {"transition", BENCH_OP_TRANSITION, 5},
+    {"store", BENCH_OP_STORE, 2},
+    {"recall", BENCH_OP_RECALL, 2},
+    {"button", BENCH_OP_BUTTON, 0},
+};
+
+static bool bench_parse_group(char **saveptr, bench_event_t *event)
+{
+    const char *command = strtok_r(NULL, " \t\r\n", saveptr);
+    if (!command) {
+        return false;
+    }
+    if (strcmp(command, "on") == 0) {
+        event->op = BENCH_OP_GROUP_ON;
+    } else if (strcmp(command, "off") == 0) {
+        event->op = BENCH_OP_GROUP_OFF;
+    } else if (strcmp(command, "toggle") == 0) {
+        event->op = BENCH_OP_GROUP_TOGGLE;
+    } else if (strcmp(command, "level") == 0) {
+        const char *level = strtok_r(NULL, " \t\r\n", saveptr);
+        if (!level) {
+            return false;
+        }
+        event->op = BENCH_OP_GROUP_LEVEL;
+        event->args[0] = strtoul(level, NULL, 0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool bench_parse_event(char *line, bench_event_t *event)
+{
+    char *saveptr;
+    const char *time_ms = strtok_r(line, " \t\r\n", &saveptr);
+    const char *endpoint = strtok_r(NULL, " \t\r\n", &saveptr);
+    const char *op = strtok_r(NULL, " \t\r\n", &saveptr);
+    if (!time_ms || !endpoint || !op) {
+        return false;
+    }
+    memset(event, 0, sizeof(*event));
+    event->time_us = (int64_t)(strtod(time_ms, NULL) * 1000);
+    if (strcmp(endpoint, "*") != 0) {
+        event->endpoint_id = (uint16_t)strtoul(endpoint, NULL, 0);
+        if (event->endpoint_id < 1 || event->endpoint_id > s_lights_count) {
+            return false;
+        }
+    }
+    if (strcmp(op, "group") == 0) {
+        return bench_parse_group(&saveptr, event);
+    }
+    for (size_t i = 0; i < sizeof(s_ops) / sizeof(s_ops[0]); i++) {
+        if (strcmp(op, s_ops[i].name) != 0) {
+            continue;
+        }
+        event->op = s_ops[i].op;
+        for (int arg = 0; arg < s_ops[i].args; arg++) {
+            const char *value = strtok_r(NULL, " \t\r\n", &saveptr);
+            if (!value) {
+                return false;
+            }
+            event->args[arg] = strtoul(value, NULL, 0);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool bench_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Cannot open %s\n", path);
+        return false;
+    }
+    char line[BENCH_MAX_LINE];
+    int line_number = 0;
+    bool ok = true;
+    int64_t last_us = 0;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0') {
+            continue;
+        }
+        if (strncmp(start, "lights", 6) == 0) {
+            s_lights_count = atoi(start + 6);
+            ok = s_events_count == 0 && s_lights_count >= 1 && s_lights_count <= APP_DRIVER_MAX_LIGHTS;
+        } else {
+            bench_event_t event;
+            ok = bench_parse_event(start, &event) && event.time_us >= last_us && bench_add_event(&event);
+            last_us = event.time_us;
+        }
+        if (!ok) {
+            printf("%s:%d: invalid event\n", path, line_number);
+        }
+    }
+    fclose(file);
+    return ok && s_events_count > 0;
+}
+
+static app_driver_handle_t s_lights[APP_DRIVER_MAX_LIGHTS];
+
+static bool bench_setup(void)
+{
+    int count = 0;
+    mock_set_led_count(s_lights_count);
+    if (app_driver_light_init(s_lights, &count, APP_DRIVER_MAX_LIGHTS) != ESP_OK || count != s_lights_count) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        uint16_t endpoint_id = i + 1;
+        mock_endpoint_create(endpoint_id, s_lights[i]);
+        if (app_driver_light_register(endpoint_id) != ESP_OK ||
+                app_driver_attribute_cache_fill(endpoint_id) != ESP_OK) {
+            return false;
+        }
+        app_driver_light_set_defaults(endpoint_id);
+    }
+    app_driver_button_init(1);
+    mock_run_idle(BENCH_IDLE_MS * 1000LL);
+    return true;
+}
+
+static void bench_write(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t val)
+{
+    esp_matter::attribute::update(endpoint_id, cluster_id, attribute_id, &val);
+}
+
+/* A group command goes through the fast path of app_group.cpp, then the server updates the data model */
+static void bench_group(uint16_t endpoint_id, const bench_event_t *event)
+{
+    app_driver_light_action_t action = {};
+    bool on_off = mock_attribute_value(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id);
+    switch (event->op) {
+    case BENCH_OP_GROUP_ON:
+    case BENCH_OP_GROUP_OFF:
+        action.flags = APP_DRIVER_ACTION_POWER;
+        action.on_off = (event->op == BENCH_OP_GROUP_ON);
+        on_off = action.on_off;
+        break;
+    case BENCH_OP_GROUP_TOGGLE:
+        action.flags = APP_DRIVER_ACTION_TOGGLE;
+        on_off = !on_off;
+        break;
+    default:
+        action.flags = APP_DRIVER_ACTION_LEVEL_IF_ON;
+        action.level = (uint8_t)event->args[0];
+        break;
+    }
+    app_driver_light_apply_now(app_driver_light_get(endpoint_id), &action);
+    if (event->op == BENCH_OP_GROUP_LEVEL) {
+        bench_write(endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                    esp_matter_nullable_uint8(action.level));
+    } else {
+        bench_write(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id, esp_matter_bool(on_off));
+    }
+}
+
+static void bench_apply(uint16_t endpoint_id, const bench_event_t *event)
+{
+    app_driver_handle_t handle = app_driver_light_get(endpoint_id);
+    switch (event->op) {
+    case BENCH_OP_ON_OFF:
+        bench_write(endpoint_id, OnOff::Id, OnOff::Attributes::OnOff::Id, esp_matter_bool(event->args[0] != 0));
+        break;
+    case BENCH_OP_LEVEL:
+        bench_write(endpoint_id, LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id,
+                    esp_matter_nullable_uint8((uint8_t)event->args[0]));
+        break;
+    case BENCH_OP_HUE:
+        bench_write(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentHue::Id,
+                    esp_matter_uint8((uint8_t)event->args[0]));
+        break;
+    case BENCH_OP_SATURATION:
+        bench_write(endpoint_id, ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id,
+                    esp_matter_uint8((uint8_t)event->args[0]));
+        break;
+    case BENCH_OP_TEMPERATURE:
+        bench_write(endpoint_id, ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id,
+                    esp_matter_uint16((uint16_t)event->args[0]));
+        break;
+    case BENCH_OP_TRANSITION: {
+        app_driver_light_transition_t transition = {
+            .flags = event->args[0],
+            .level = (uint8_t)event->args[1],
+            .hue = (uint8_t)event->args[2],
+            .saturation = (uint8_t)event->args[3],
+        };
+        app_driver_light_start_transition(handle, &transition, event->args[4]);
+        break;
+    }
+    case BENCH_OP_STORE:
+        app_driver_light_scene_store(handle, (uint16_t)event->args[0], (uint8_t)event->args[1]);
+        break;
+    case BENCH_OP_RECALL:
+        app_driver_light_scene_recall(handle, (uint16_t)event->args[0], (uint8_t)event->args[1]);
+        break;
+    case BENCH_OP_BUTTON:
+        mock_button_press();
+        break;
+    default:
+        bench_group(endpoint_id, event);
+        break;
+    }
+}
+
+/* Every event is one update of each light it is for */
+static size_t bench_replay(int64_t offset_us)
+{
+    size_t updates = 0;
+    for (size_t i = 0; i < s_events_count; i++) {
+        const bench_event_t *event = &s_events[i];
+        mock_run_until(offset_us + event->time_us);
+        if (event->op == BENCH_OP_BUTTON) {
+            bench_apply(1, event);
+            updates++;
+        } else if (event->endpoint_id) {
+            bench_apply(event->endpoint_id, event);
+            updates++;
+        } else {
+            for (int light = 1; light <= s_lights_count; light++) {
+                bench_apply(light, event);
+            }
+            updates += s_lights_count;
+        }
+        mock_run_work();
+    }
+    mock_run_idle(BENCH_IDLE_MS * 1000LL);
+    return updates;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = BENCH_DEFAULT_ITERATIONS;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path || iterations <= 0) {
+        printf("Usage: %s [-n iterations] <trace>\n", argv[0]);
+        return 1;
+    }
+    if (!bench_load(path)) {
+        return 1;
+    }
+    if (!bench_setup()) {
+        printf("Failed to set up %d lights\n", s_lights_count);
+        return 1;
+    }
+
+    mock_reset_stats();
+#ifdef __GLIBC__
+    s_heap_counting = true;
+#endif
+    size_t updates = 0;
+    uint64_t start_ns = bench_now_ns();
+#if BENCH_HAS_CYCLES
+    uint64_t start_cycles = __rdtsc();
+#endif
+    for (int i = 0; i < iterations; i++) {
+        updates += bench_replay(mock_time_us());
+    }
+#if BENCH_HAS_CYCLES
+    uint64_t cycles = __rdtsc() - start_cycles;
+#endif
+    uint64_t elapsed_ns = bench_now_ns() - start_ns;
+#ifdef __GLIBC__
+    s_heap_counting = false;
+#endif
+
+    printf("%s: %zu events, %d lights, %d iterations\n", path, s_events_count, s_lights_count, iterations);
+    printf("  %zu updates in %.3f ms, %.0f updates/s, %.1f ns/update", updates, elapsed_ns / 1e6,
+           updates * 1e9 / (elapsed_ns ? elapsed_ns : 1), (double)elapsed_ns / updates);
+#if BENCH_HAS_CYCLES
+    printf(", %.0f cycles/update", (double)cycles / updates);
+#endif
+    printf("\n");
+    printf("  per update: %.3f LED writes, %.3f data model updates (%.3f from the driver), %.3f timer callbacks, "
+           "%.3f scheduled work\n", (double)g_mock_stats.led_writes / updates,
+           (double)g_mock_stats.attribute_updates / updates, (double)g_mock_stats.driver_reports / updates,
+           (double)g_mock_stats.timer_callbacks / updates, (double)g_mock_stats.scheduled_work / updates);
+#ifdef __GLIBC__
+    printf("  heap: %zu allocations, %.3f per update, peak %zu bytes\n", s_alloc_count, (double)s_alloc_count / updates,
+           s_heap_peak);
+#endif
+    free(s_events);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/* The LEDs and the button of the board, the LED writes are counted by esp32_mock.cpp */
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/queue.h"
+#include "led_convert.h"
+
+#define BSP_BUTTON_NUM 1
+
+enum {
+    BSP_LED_ON,
+    BSP_LED_OFF,
+};
+
+typedef void *led_indicator_handle_t;
+
+esp_err_t bsp_led_indicator_create(led_indicator_handle_t led_array[], int *led_cnt, int led_array_size);
+esp_err_t led_indicator_start(led_indicator_handle_t handle, int blink_type);
+esp_err_t led_indicator_set_brightness(led_indicator_handle_t handle, uint32_t brightness);
+uint32_t led_indicator_get_hsv(led_indicator_handle_t handle);
+esp_err_t led_indicator_set_hsv(led_indicator_handle_t handle, uint32_t ihsv_value);
+esp_err_t led_indicator_set_rgb(led_indicator_handle_t handle, uint32_t irgb_value);
+esp_err_t led_indicator_set_color_temperature(led_indicator_handle_t handle, const uint32_t temperature);
+esp_err_t led_indicator_set_color_temperature_mireds(led_indicator_handle_t handle, const uint32_t mireds);
+
+typedef void *button_handle_t;
+typedef void (*button_cb_t)(void *button_handle, void *usr_data);
+
+typedef enum {
+    BUTTON_PRESS_DOWN = 0,
+} button_event_t;
+
+typedef struct {
+    button_handle_t btn_handle;
+    button_event_t event;
+    button_cb_t cb;
+    void *usr_data;
+} button_event_msg_t;
+
+esp_err_t bsp_iot_button_create(button_handle_t btn_array[], int *btn_cnt, int btn_array_size);
+esp_err_t iot_button_register_cb(button_handle_t btn_handle, button_event_t event, button_cb_t cb, void *usr_data);
+esp_err_t iot_button_set_event_queue(QueueHandle_t queue);
+void iot_button_dispatch_event_msg(const button_event_msg_t *msg);
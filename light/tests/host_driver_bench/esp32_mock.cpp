@@ -0,0 +1,418 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+/*
+ * Host versions of the esp_timer, esp_matter data model, Matter task, LED and button functions used by the light
+ * driver. Nothing is allocated once the endpoints are created, so the allocations counted while replaying are the
+ * driver's own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <esp_matter.h>
+#include <platform/CHIPDeviceLayer.h>
+#include "bsp/esp-bsp.h"
+
+#include <app_priv.h>
+
+#include "esp32_mock.h"
+
+using namespace chip::app::Clusters;
+
+#define MOCK_MAX_TIMERS     (APP_DRIVER_MAX_LIGHTS * 2 + 4)
+#define MOCK_MAX_WORK       64
+#define MOCK_ATTRIBUTES     6
+
+mock_stats_t g_mock_stats;
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    bool armed;
+    int64_t expiry_us;
+    uint64_t period_us;     /* 0 for one shot timers */
+};
+
+static struct esp_timer s_timers[MOCK_MAX_TIMERS];
+static int s_timers_count;
+static int64_t s_time_us;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (s_timers_count == MOCK_MAX_TIMERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_timer_handle_t timer = &s_timers[s_timers_count++];
+    memset(timer, 0, sizeof(*timer));
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t mock_timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = true;
+    timer->expiry_us = s_time_us + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return mock_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return mock_timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    timer->armed = false;
+    timer->callback = NULL;
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return s_time_us;
+}
+
+int64_t mock_time_us(void)
+{
+    return s_time_us;
+}
+
+/* Ring of the work scheduled on the Matter task */
+static struct {
+    chip::DeviceLayer::AsyncWorkFunct work;
+    intptr_t arg;
+} s_work[MOCK_MAX_WORK];
+static int s_work_head;
+static int s_work_count;
+static bool s_in_work;
+
+namespace chip {
+namespace DeviceLayer {
+CHIP_ERROR PlatformManager::ScheduleWork(AsyncWorkFunct work, intptr_t arg)
+{
+    if (s_work_count == MOCK_MAX_WORK) {
+        return -1;
+    }
+    int index = (s_work_head + s_work_count++) % MOCK_MAX_WORK;
+    s_work[index].work = work;
+    s_work[index].arg = arg;
+    g_mock_stats.scheduled_work++;
+    return CHIP_NO_ERROR;
+}
+
+PlatformManager &PlatformMgr()
+{
+    static PlatformManager s_platform_manager;
+    return s_platform_manager;
+}
+} // namespace DeviceLayer
+} // namespace chip
+
+void mock_run_work(void)
+{
+    while (s_work_count > 0) {
+        chip::DeviceLayer::AsyncWorkFunct work = s_work[s_work_head].work;
+        intptr_t arg = s_work[s_work_head].arg;
+        s_work_head = (s_work_head + 1) % MOCK_MAX_WORK;
+        s_work_count--;
+        s_in_work = true;
+        work(arg);
+        s_in_work = false;
+    }
+}
+
+/* Earliest armed timer due by time_us */
+static esp_timer_handle_t mock_timer_next(int64_t time_us)
+{
+    esp_timer_handle_t next = NULL;
+    for (int i = 0; i < s_timers_count; i++) {
+        esp_timer_handle_t timer = &s_timers[i];
+        if (timer->armed && timer->expiry_us <= time_us && (!next || timer->expiry_us < next->expiry_us)) {
+            next = timer;
+        }
+    }
+    return next;
+}
+
+void mock_run_until(int64_t time_us)
+{
+    esp_timer_handle_t timer;
+    while ((timer = mock_timer_next(time_us)) != NULL) {
+        s_time_us = timer->expiry_us;
+        if (timer->period_us) {
+            timer->expiry_us += (int64_t)timer->period_us;
+        } else {
+            timer->armed = false;
+        }
+        g_mock_stats.timer_callbacks++;
+        timer->callback(timer->arg);
+        mock_run_work();
+    }
+    if (time_us > s_time_us) {
+        s_time_us = time_us;
+    }
+}
+
+void mock_run_idle(int64_t max_us)
+{
+    int64_t end_us = s_time_us + max_us;
+    while (true) {
+        int64_t next_us = INT64_MAX;
+        for (int i = 0; i < s_timers_count; i++) {
+            if (s_timers[i].armed && s_timers[i].expiry_us < next_us) {
+                next_us = s_timers[i].expiry_us;
+            }
+        }
+        if (next_us > end_us) {
+            break;
+        }
+        mock_run_until(next_us);
+    }
+}
+
+typedef struct {
+    uint32_t cluster_id;
+    uint32_t attribute_id;
+    esp_matter_attr_val_t val;
+} mock_attribute_t;
+
+typedef struct {
+    void *priv_data;
+    mock_attribute_t attributes[MOCK_ATTRIBUTES];
+} mock_endpoint_t;
+
+static mock_endpoint_t s_endpoints[APP_DRIVER_MAX_ENDPOINTS];
+
+void mock_endpoint_create(uint16_t endpoint_id, void *priv_data)
+{
+    mock_endpoint_t *endpoint = &s_endpoints[endpoint_id];
+    endpoint->priv_data = priv_data;
+    /* Same defaults as the extended color light of app_main.cpp */
+    mock_attribute_t attributes[MOCK_ATTRIBUTES] = {
+        {OnOff::Id, OnOff::Attributes::OnOff::Id, esp_matter_bool(DEFAULT_POWER)},
+        {LevelControl::Id, LevelControl::Attributes::CurrentLevel::Id, esp_matter_nullable_uint8(DEFAULT_BRIGHTNESS)},
+        {ColorControl::Id, ColorControl::Attributes::ColorMode::Id,
+         esp_matter_uint8((uint8_t)ColorControl::ColorMode::kCurrentHueAndCurrentSaturation)},
+        {ColorControl::Id, ColorControl::Attributes::CurrentHue::Id, esp_matter_uint8(DEFAULT_HUE)},
+        {ColorControl::Id, ColorControl::Attributes::CurrentSaturation::Id, esp_matter_uint8(DEFAULT_SATURATION)},
+        {ColorControl::Id, ColorControl::Attributes::ColorTemperatureMireds::Id, esp_matter_uint16(250)},
+    };
+    memcpy(endpoint->attributes, attributes, sizeof(attributes));
+}
+
+namespace esp_matter {
+namespace attribute {
+attribute_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    if (endpoint_id >= APP_DRIVER_MAX_ENDPOINTS || !s_endpoints[endpoint_id].priv_data) {
+        return NULL;
+    }
+    for (int i = 0; i < MOCK_ATTRIBUTES; i++) {
+        mock_attribute_t *attribute = &s_endpoints[endpoint_id].attributes[i];
+        if (attribute->cluster_id == cluster_id && attribute->attribute_id == attribute_id) {
+            return (attribute_t *)attribute;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t get_val(attribute_t *attribute, esp_matter_attr_val_t *val)
+{
+    if (!attribute || !val) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *val = ((mock_attribute_t *)attribute)->val;
+    return ESP_OK;
+}
+
+/* Like the PRE_UPDATE attribute callback of app_main.cpp, the driver can refuse the value */
+esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    mock_attribute_t *attribute = (mock_attribute_t *)get(endpoint_id, cluster_id, attribute_id);
+    if (!attribute) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    g_mock_stats.attribute_updates++;
+    if (s_in_work) {
+        g_mock_stats.driver_reports++;
+    }
+    esp_err_t err = app_driver_attribute_update(s_endpoints[endpoint_id].priv_data, endpoint_id, cluster_id,
+                                                attribute_id, val);
+    if (err == ESP_OK) {
+        attribute->val.val = val->val;
+    }
+    return err;
+}
+} // namespace attribute
+
+namespace endpoint {
+void *get_priv_data(uint16_t endpoint_id)
+{
+    return endpoint_id < APP_DRIVER_MAX_ENDPOINTS ? s_endpoints[endpoint_id].priv_data : NULL;
+}
+} // namespace endpoint
+} // namespace esp_matter
+
+uint32_t mock_attribute_value(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id)
+{
+    mock_attribute_t *attribute = (mock_attribute_t *)esp_matter::attribute::get(endpoint_id, cluster_id,
+                                                                                   attribute_id);
+    if (!attribute) {
+        return 0;
+    }
+    switch (attribute->val.type) {
+    case ESP_MATTER_VAL_TYPE_BOOLEAN:
+        return attribute->val.val.b;
+    case ESP_MATTER_VAL_TYPE_UINT16:
+        return attribute->val.val.u16;
+    default:
+        return attribute->val.val.u8;
+    }
+}
+
+typedef struct {
+    uint32_t hsv;
+    bool on;
+} mock_led_t;
+
+static mock_led_t s_leds[CONFIG_BSP_LEDS_NUM];
+static int s_led_count = 1;
+
+void mock_set_led_count(int count)
+{
+    s_led_count = count < CONFIG_BSP_LEDS_NUM ? count : CONFIG_BSP_LEDS_NUM;
+}
+
+esp_err_t bsp_led_indicator_create(led_indicator_handle_t led_array[], int *led_cnt, int led_array_size)
+{
+    int count = s_led_count < led_array_size ? s_led_count : led_array_size;
+    for (int i = 0; i < count; i++) {
+        led_array[i] = &s_leds[i];
+    }
+    *led_cnt = count;
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_start(led_indicator_handle_t handle, int blink_type)
+{
+    g_mock_stats.led_writes++;
+    ((mock_led_t *)handle)->on = (blink_type == BSP_LED_ON);
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_set_brightness(led_indicator_handle_t handle, uint32_t brightness)
+{
+    g_mock_stats.led_writes++;
+    mock_led_t *led = (mock_led_t *)handle;
+    led->hsv = (led->hsv & ~0xFFUL) | (brightness & 0xFF);
+    return ESP_OK;
+}
+
+uint32_t led_indicator_get_hsv(led_indicator_handle_t handle)
+{
+    return ((mock_led_t *)handle)->hsv;
+}
+
+esp_err_t led_indicator_set_hsv(led_indicator_handle_t handle, uint32_t ihsv_value)
+{
+    g_mock_stats.led_writes++;
+    ((mock_led_t *)handle)->hsv = ihsv_value;
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_set_rgb(led_indicator_handle_t handle, uint32_t irgb_value)
+{
+    g_mock_stats.led_writes++;
+    ((mock_led_t *)handle)->hsv = led_indicator_rgb2hsv(irgb_value);
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_set_color_temperature(led_indicator_handle_t handle, const uint32_t temperature)
+{
+    g_mock_stats.led_writes++;
+    return ESP_OK;
+}
+
+esp_err_t led_indicator_set_color_temperature_mireds(led_indicator_handle_t handle, const uint32_t mireds)
+{
+    g_mock_stats.led_writes++;
+    return ESP_OK;
+}
+
+static button_cb_t s_button_cb;
+static void *s_button_usr_data;
+static int s_button;
+
+esp_err_t bsp_iot_button_create(button_handle_t btn_array[], int *btn_cnt, int btn_array_size)
+{
+    btn_array[0] = &s_button;
+    if (btn_cnt) {
+        *btn_cnt = 1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t iot_button_register_cb(button_handle_t btn_handle, button_event_t event, button_cb_t cb, void *usr_data)
+{
+    s_button_cb = cb;
+    s_button_usr_data = usr_data;
+    return ESP_OK;
+}
+
+esp_err_t iot_button_set_event_queue(QueueHandle_t queue)
+{
+    return ESP_OK;
+}
+
+void iot_button_dispatch_event_msg(const button_event_msg_t *msg)
+{
+    msg->cb(msg->btn_handle, msg->usr_data);
+}
+
+void mock_button_press(void)
+{
+    if (s_button_cb) {
+        s_button_cb(&s_button, s_button_usr_data);
+        mock_run_work();
+    }
+}
+
+void app_latency_record(uint32_t cluster_id, int64_t start_us)
+{
+    if (start_us) {
+        g_mock_stats.latency_records++;
+    }
+}
+
+void mock_reset_stats(void)
+{
+    memset(&g_mock_stats, 0, sizeof(g_mock_stats));
+}
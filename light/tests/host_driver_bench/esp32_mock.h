@@ -0,0 +1,53 @@
+/*
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/* What the driver did while replaying, reset by mock_reset_stats() */
+typedef struct {
+    uint64_t attribute_updates;     /* Updates of the data model, from the trace or the driver */
+    uint64_t driver_reports;        /* Updates made by the driver from the Matter task */
+    uint64_t led_writes;            /* Calls to the led_indicator functions */
+    uint64_t timer_callbacks;
+    uint64_t scheduled_work;
+    uint64_t latency_records;
+} mock_stats_t;
+
+extern mock_stats_t g_mock_stats;
+
+/** Number of LEDs bsp_led_indicator_create() returns */
+void mock_set_led_count(int count);
+
+/** Add a light endpoint to the data model, with the attributes the driver reads
+ *
+ * @param[in] endpoint_id Endpoint ID, below APP_DRIVER_MAX_ENDPOINTS.
+ * @param[in] priv_data Light driver handle.
+ */
+void mock_endpoint_create(uint16_t endpoint_id, void *priv_data);
+
+/** Current value of an attribute in the data model, 0 if the endpoint does not have it */
+uint32_t mock_attribute_value(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+
+/** Time of the virtual clock */
+int64_t mock_time_us(void);
+
+/** Run the timers due until `time_us`, each followed by the Matter work it scheduled, and move the clock there */
+void mock_run_until(int64_t time_us);
+
+/** Run the timers until none is armed, or for `max_us` at most */
+void mock_run_idle(int64_t max_us);
+
+/** Run the Matter work scheduled so far */
+void mock_run_work(void);
+
+/** Press the button registered with iot_button_register_cb() */
+void mock_button_press(void);
+
+void mock_reset_stats(void);
@@ -0,0 +1,140 @@
+#pragma once
+
+/*
+ * The part of the esp_matter data model API used by the light driver. The attributes live in esp32_mock.cpp,
+ * updates go to app_driver_attribute_update() like the attribute callback of app_main.cpp does.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define REMAP_TO_RANGE(value, from, to) ((value * to) / from)
+#define REMAP_TO_RANGE_INVERSE(value, factor) (factor / (value ? value : 1))
+
+typedef enum {
+    ESP_MATTER_VAL_TYPE_INVALID = 0,
+    ESP_MATTER_VAL_TYPE_BOOLEAN,
+    ESP_MATTER_VAL_TYPE_UINT8,
+    ESP_MATTER_VAL_TYPE_UINT16,
+    ESP_MATTER_VAL_TYPE_NULLABLE_UINT8,
+} esp_matter_val_type_t;
+
+typedef union {
+    bool b;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    void *p;
+} esp_matter_val_t;
+
+typedef struct {
+    esp_matter_val_type_t type;
+    esp_matter_val_t val;
+} esp_matter_attr_val_t;
+
+static inline esp_matter_attr_val_t esp_matter_invalid(void *val)
+{
+    esp_matter_attr_val_t attr_val = {};
+    attr_val.type = ESP_MATTER_VAL_TYPE_INVALID;
+    attr_val.val.p = val;
+    return attr_val;
+}
+
+static inline esp_matter_attr_val_t esp_matter_bool(bool val)
+{
+    esp_matter_attr_val_t attr_val = {};
+    attr_val.type = ESP_MATTER_VAL_TYPE_BOOLEAN;
+    attr_val.val.b = val;
+    return attr_val;
+}
+
+static inline esp_matter_attr_val_t esp_matter_uint8(uint8_t val)
+{
+    esp_matter_attr_val_t attr_val = {};
+    attr_val.type = ESP_MATTER_VAL_TYPE_UINT8;
+    attr_val.val.u8 = val;
+    return attr_val;
+}
+
+static inline esp_matter_attr_val_t esp_matter_nullable_uint8(uint8_t val)
+{
+    esp_matter_attr_val_t attr_val = {};
+    attr_val.type = ESP_MATTER_VAL_TYPE_NULLABLE_UINT8;
+    attr_val.val.u8 = val;
+    return attr_val;
+}
+
+static inline esp_matter_attr_val_t esp_matter_uint16(uint16_t val)
+{
+    esp_matter_attr_val_t attr_val = {};
+    attr_val.type = ESP_MATTER_VAL_TYPE_UINT16;
+    attr_val.val.u16 = val;
+    return attr_val;
+}
+
+namespace chip {
+typedef uint32_t ClusterId;
+typedef uint32_t AttributeId;
+
+namespace app {
+namespace Clusters {
+namespace OnOff {
+static constexpr ClusterId Id = 0x0006;
+namespace Attributes {
+namespace OnOff {
+static constexpr AttributeId Id = 0x0000;
+} // namespace OnOff
+} // namespace Attributes
+} // namespace OnOff
+
+namespace LevelControl {
+static constexpr ClusterId Id = 0x0008;
+namespace Attributes {
+namespace CurrentLevel {
+static constexpr AttributeId Id = 0x0000;
+} // namespace CurrentLevel
+} // namespace Attributes
+} // namespace LevelControl
+
+namespace ColorControl {
+static constexpr ClusterId Id = 0x0300;
+enum class ColorMode : uint8_t {
+    kCurrentHueAndCurrentSaturation = 0x00,
+    kCurrentXAndCurrentY = 0x01,
+    kColorTemperature = 0x02,
+};
+namespace Attributes {
+namespace CurrentHue {
+static constexpr AttributeId Id = 0x0000;
+} // namespace CurrentHue
+namespace CurrentSaturation {
+static constexpr AttributeId Id = 0x0001;
+} // namespace CurrentSaturation
+namespace ColorTemperatureMireds {
+static constexpr AttributeId Id = 0x0007;
+} // namespace ColorTemperatureMireds
+namespace ColorMode {
+static constexpr AttributeId Id = 0x0008;
+} // namespace ColorMode
+} // namespace Attributes
+} // namespace ColorControl
+} // namespace Clusters
+} // namespace app
+} // namespace chip
+
+namespace esp_matter {
+/* Opaque handle, as in esp_matter */
+typedef size_t attribute_t;
+
+namespace attribute {
+attribute_t *get(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id);
+esp_err_t get_val(attribute_t *attribute, esp_matter_attr_val_t *val);
+esp_err_t update(uint16_t endpoint_id, uint32_t cluster_id, uint32_t attribute_id, esp_matter_attr_val_t *val);
+} // namespace attribute
+
+namespace endpoint {
+void *get_priv_data(uint16_t endpoint_id);
+} // namespace endpoint
+} // namespace esp_matter
@@ -0,0 +1,3 @@
+#pragma once
+
+/* The console commands are not built, CONFIG_ENABLE_CHIP_SHELL is not set */
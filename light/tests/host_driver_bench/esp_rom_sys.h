@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Only read by the statistics dump, which is not replayed */
+static inline uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 160;
+}
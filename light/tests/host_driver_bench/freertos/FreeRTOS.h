@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+/* The replay is single threaded, the critical sections only have to compile */
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+
+typedef struct {
+    uint32_t owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZE(mux) ((mux)->owner = 0)
+#define portENTER_CRITICAL(mux) ((mux)->owner++)
+#define portEXIT_CRITICAL(mux)  ((mux)->owner--)
+
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define pdTRUE              1
+#define pdPASS              1
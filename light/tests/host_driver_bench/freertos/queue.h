@@ -0,0 +1,30 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+typedef struct {
+    int unused;
+} StaticQueue_t;
+
+/* Nothing is ever sent, the button callbacks run from the replay directly */
+static inline QueueHandle_t xQueueCreate(uint32_t length, uint32_t item_size)
+{
+    static int s_queue;
+    return &s_queue;
+}
+
+static inline QueueHandle_t xQueueCreateStatic(uint32_t length, uint32_t item_size, uint8_t *storage,
+                                               StaticQueue_t *queue)
+{
+    return queue;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return 0;
+}
+
+static inline void vQueueDelete(QueueHandle_t queue)
+{
+}
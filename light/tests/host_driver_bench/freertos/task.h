@@ -0,0 +1,24 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *arg);
+typedef void *TaskHandle_t;
+typedef struct {
+    int unused;
+} StaticTask_t;
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+static inline BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack, void *arg,
+                                     uint32_t priority, TaskHandle_t *handle)
+{
+    return pdPASS;
+}
+
+static inline TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t task, const char *name, uint32_t stack,
+                                                         void *arg, uint32_t priority, StackType_t *stack_buffer,
+                                                         StaticTask_t *task_buffer, BaseType_t core)
+{
+    return task_buffer;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int32_t CHIP_ERROR;
+#define CHIP_NO_ERROR 0
+
+namespace chip {
+namespace DeviceLayer {
+typedef void (*AsyncWorkFunct)(intptr_t arg);
+
+/* The Matter task is simulated by the replay, work runs after the event or timer that scheduled it */
+class PlatformManager {
+public:
+    CHIP_ERROR ScheduleWork(AsyncWorkFunct work, intptr_t arg = 0);
+};
+
+PlatformManager &PlatformMgr();
+} // namespace DeviceLayer
+} // namespace chip
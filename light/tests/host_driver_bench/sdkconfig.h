@@ -0,0 +1,7 @@
+/*
+ * Configuration of the host build, included before every source
+ */
+#pragma once
+
+/* As many LEDs as the driver has lights, the replay decides how many are used */
+#define CONFIG_BSP_LEDS_NUM 16